@@ -29,6 +29,8 @@
 #include <sys/zio.h>
 #include <sys/vdev_raidz.h>
 #include <sys/vdev_raidz_impl.h>
+#include <sys/zio_checksum.h>
+#include <zfs_fletcher.h>
 #include <stdio.h>
 
 #include <sys/time.h>
@@ -40,6 +42,7 @@
 #define	BENCH_ASHIFT		12
 #define	MIN_CS_SHIFT		BENCH_ASHIFT
 #define	MAX_CS_SHIFT		SPA_MAXBLOCKSHIFT
+#define	IO_BENCH_MEMORY		(((uint64_t)1ULL)<<28)
 
 static zio_t zio_bench;
 static raidz_map_t *rm_bench;
@@ -215,6 +218,274 @@ run_rec_bench(void)
 	}
 }
 
+/*
+ * Compares reconstruction followed by a checksum of the whole block, as
+ * combinatorial reconstruction used to verify each candidate, against
+ * vdev_raidz_reconstruct_cksum(), which only checksums the reconstructed
+ * columns while they are still in the cache.
+ */
+static void
+run_rec_cksum_bench_impl(const char *impl)
+{
+	int fn, ncols, nbad;
+	uint64_t ds, iter_cnt, iter, disksize;
+	hrtime_t start;
+	double elapsed, d_bw, f_bw;
+	zio_cksum_t *partial, zc;
+	static const int tgt[7][3] = {
+		{1, 2, 3},	/* rec_p:   bad QR & D[0]	*/
+		{0, 2, 3},	/* rec_q:   bad PR & D[0]	*/
+		{0, 1, 3},	/* rec_r:   bad PQ & D[0]	*/
+		{2, 3, 4},	/* rec_pq:  bad R  & D[0][1]	*/
+		{1, 3, 4},	/* rec_pr:  bad Q  & D[0][1]	*/
+		{0, 3, 4},	/* rec_qr:  bad P  & D[0][1]	*/
+		{3, 4, 5}	/* rec_pqr: bad    & D[0][1][2] */
+	};
+
+	for (fn = 0; fn < RAIDZ_REC_NUM; fn++) {
+		for (ds = MIN_CS_SHIFT; ds <= MAX_CS_SHIFT; ds++) {
+
+			ncols = rto_opts.rto_dcols + PARITY_PQR;
+			zio_bench.io_size = 1ULL << ds;
+
+			if (zio_bench.io_size / rto_opts.rto_dcols <
+			    (1ULL << BENCH_ASHIFT))
+				continue;
+
+			rm_bench = vdev_raidz_map_alloc(&zio_bench,
+			    BENCH_ASHIFT, ncols, PARITY_PQR);
+
+			iter_cnt = (REC_BENCH_MEMORY);
+			iter_cnt /= zio_bench.io_size;
+
+			nbad = MIN(3, raidz_ncols(rm_bench) -
+			    raidz_parity(rm_bench));
+
+			start = gethrtime();
+			for (iter = 0; iter < iter_cnt; iter++) {
+				vdev_raidz_reconstruct(rm_bench, tgt[fn], nbad);
+				abd_fletcher_4_native(zio_bench.io_abd,
+				    zio_bench.io_size, NULL, &zc);
+			}
+			elapsed = NSEC2SEC((double)(gethrtime() - start));
+
+			disksize = (1ULL << ds) / rto_opts.rto_dcols;
+			d_bw = (double)iter_cnt * (double)(disksize);
+			d_bw /= (1024.0 * 1024.0 * elapsed);
+
+			partial = umem_alloc(ncols * sizeof (zio_cksum_t),
+			    UMEM_NOFAIL);
+			vdev_raidz_cksum_partial(rm_bench, B_FALSE, partial);
+
+			start = gethrtime();
+			for (iter = 0; iter < iter_cnt; iter++) {
+				(void) vdev_raidz_reconstruct_cksum(rm_bench,
+				    tgt[fn], nbad, B_FALSE, partial, &zc);
+			}
+			elapsed = NSEC2SEC((double)(gethrtime() - start));
+
+			f_bw = (double)iter_cnt * (double)(disksize);
+			f_bw /= (1024.0 * 1024.0 * elapsed);
+
+			LOG(D_ALL, "%10s, %8s, %zu, %10llu, %lf, %lf, %u\n",
+			    impl,
+			    raidz_rec_name[fn],
+			    rto_opts.rto_dcols,
+			    (1ULL<<ds),
+			    d_bw,
+			    f_bw,
+			    (unsigned)iter_cnt);
+
+			umem_free(partial, ncols * sizeof (zio_cksum_t));
+			vdev_raidz_map_free(rm_bench);
+		}
+	}
+}
+
+void
+run_rec_cksum_bench(void)
+{
+	char **impl_name;
+
+	LOG(D_INFO, DBLSEP "\nBenchmarking data reconstruction with "
+	    "checksum verification...\n\n");
+	LOG(D_ALL, "impl, math, dcols, iosize, disk_bw, fused_disk_bw, "
+	    "iter\n");
+
+	for (impl_name = (char **)raidz_impl_names; *impl_name != NULL;
+	    impl_name++) {
+
+		if (vdev_raidz_impl_set(*impl_name) != 0)
+			continue;
+
+		run_rec_cksum_bench_impl(*impl_name);
+	}
+}
+
+/*
+ * Block sizes used by the I/O path benchmark, in sectors.  They are not
+ * multiples of the stripe width, so that maps have short columns and skip
+ * sectors, as most blocks of a real pool do.
+ */
+static const uint64_t io_bench_sectors[] = {
+	1, 3, 7, 24, 65, 200, 1021, 4093
+};
+
+typedef enum io_bench_mode {
+	IO_BENCH_READ,
+	IO_BENCH_WRITE,
+	IO_BENCH_DEGRADED,
+	IO_BENCH_MODES
+} io_bench_mode_t;
+
+static const char *io_bench_mode_name[IO_BENCH_MODES] = {
+	"read", "write", "degraded"
+};
+
+typedef struct io_bench_args {
+	io_bench_mode_t	iba_mode;
+	int		iba_parity;
+	uint64_t	iba_bytes;
+} io_bench_args_t;
+
+static kmutex_t io_bench_lock;
+static kcondvar_t io_bench_cv;
+static int io_bench_running;
+
+/*
+ * Builds, processes and frees raidz maps the way vdev_raidz_io_start() and
+ * vdev_raidz_io_done() do for one read, write or degraded read, over
+ * scatter ABDs of varied sizes and offsets.
+ */
+static void
+io_bench_thread(void *arg)
+{
+	io_bench_args_t *iba = arg;
+	uint64_t ncols = rto_opts.rto_dcols + iba->iba_parity;
+	uint64_t iter, nsizes = ARRAY_SIZE(io_bench_sectors);
+	zio_t zio;
+	raidz_map_t *rm;
+	int tgts[PARITY_PQR];
+
+	bzero(&zio, sizeof (zio_t));
+	zio.io_size = SPA_MAXBLOCKSIZE;
+	zio.io_abd = raidz_alloc(SPA_MAXBLOCKSIZE);
+	init_zio_abd(&zio);
+
+	for (iter = 0; iba->iba_bytes < IO_BENCH_MEMORY; iter++) {
+		zio.io_size = io_bench_sectors[iter % nsizes] << BENCH_ASHIFT;
+		zio.io_offset = (iter * 7) << BENCH_ASHIFT;
+
+		rm = vdev_raidz_map_alloc(&zio, BENCH_ASHIFT, ncols,
+		    iba->iba_parity);
+
+		if (iba->iba_mode == IO_BENCH_WRITE) {
+			vdev_raidz_generate_parity(rm);
+		} else if (iba->iba_mode == IO_BENCH_DEGRADED) {
+			int ntgts = MIN(iba->iba_parity,
+			    raidz_ncols(rm) - raidz_parity(rm));
+
+			for (int i = 0; i < ntgts; i++)
+				tgts[i] = raidz_parity(rm) + i;
+			(void) vdev_raidz_reconstruct(rm, tgts, ntgts);
+		}
+
+		vdev_raidz_map_free(rm);
+		iba->iba_bytes += zio.io_size;
+	}
+
+	raidz_free(zio.io_abd, SPA_MAXBLOCKSIZE);
+
+	mutex_enter(&io_bench_lock);
+	io_bench_running--;
+	cv_signal(&io_bench_cv);
+	mutex_exit(&io_bench_lock);
+
+	thread_exit();
+}
+
+static void
+run_io_bench_impl(const char *impl, int max_threads)
+{
+	io_bench_args_t *iba;
+	hrtime_t start;
+	double elapsed, bw;
+	uint64_t bytes;
+
+	iba = umem_alloc(max_threads * sizeof (io_bench_args_t),
+	    UMEM_NOFAIL);
+
+	for (int parity = 1; parity <= PARITY_PQR; parity++) {
+		for (int mode = 0; mode < IO_BENCH_MODES; mode++) {
+			for (int nthr = 1; nthr <= max_threads; nthr *= 2) {
+				io_bench_running = nthr;
+				start = gethrtime();
+
+				for (int t = 0; t < nthr; t++) {
+					iba[t].iba_mode = mode;
+					iba[t].iba_parity = parity;
+					iba[t].iba_bytes = 0;
+					VERIFY3P(thread_create(NULL, 0,
+					    io_bench_thread, &iba[t], 0, NULL,
+					    TS_RUN, defclsyspri), !=, NULL);
+				}
+
+				mutex_enter(&io_bench_lock);
+				while (io_bench_running > 0)
+					cv_wait(&io_bench_cv, &io_bench_lock);
+				mutex_exit(&io_bench_lock);
+
+				elapsed = NSEC2SEC((double)(gethrtime() -
+				    start));
+				bytes = 0;
+				for (int t = 0; t < nthr; t++)
+					bytes += iba[t].iba_bytes;
+				bw = (double)bytes / (1e9 * elapsed);
+
+				LOG(D_ALL, "%10s, %8s, %d, %zu, %d, %lf\n",
+				    impl,
+				    io_bench_mode_name[mode],
+				    parity,
+				    rto_opts.rto_dcols,
+				    nthr,
+				    bw);
+			}
+		}
+	}
+
+	umem_free(iba, max_threads * sizeof (io_bench_args_t));
+}
+
+/*
+ * Benchmarks the raidz map build path for reads, writes and degraded
+ * reads with an increasing number of threads, to catch regressions in
+ * the I/O path itself rather than only in the parity math.
+ */
+void
+run_io_bench(void)
+{
+	char **impl_name;
+	int max_threads = MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+	LOG(D_INFO, DBLSEP "\nBenchmarking raidz I/O path...\n\n");
+	LOG(D_ALL, "impl, mode, parity, dcols, threads, GB/s\n");
+
+	mutex_init(&io_bench_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&io_bench_cv, NULL, CV_DEFAULT, NULL);
+
+	for (impl_name = (char **)raidz_impl_names; *impl_name != NULL;
+	    impl_name++) {
+
+		if (vdev_raidz_impl_set(*impl_name) != 0)
+			continue;
+
+		run_io_bench_impl(*impl_name, max_threads);
+	}
+
+	cv_destroy(&io_bench_cv);
+	mutex_destroy(&io_bench_lock);
+}
+
 void
 run_raidz_benchmark(void)
 {
@@ -222,6 +493,9 @@ run_raidz_benchmark(void)
 
 	run_gen_bench();
 	run_rec_bench();
+	run_rec_cksum_bench();
 
 	bench_fini_raidz_maps();
+
+	run_io_bench();
 }
@@ -114,6 +114,7 @@ typedef void object_viewer_t(objset_t *, uint64_t, void *data, size_t size);
 uint64_t *zopt_object = NULL;
 static unsigned zopt_objects = 0;
 uint64_t max_inflight = 1000;
+static int traverse_threads = 1;
 static int leaked_objects = 0;
 static range_tree_t *mos_refd_objs;
 
@@ -143,7 +144,8 @@ usage(void)
 	(void) fprintf(stderr,
 	    "Usage:\t%s [-AbcdDFGhikLMPsvX] [-e [-V] [-p <path> ...]] "
 	    "[-I <inflight I/Os>]\n"
-	    "\t\t[-o <var>=<value>]... [-t <txg>] [-U <cache>] [-x <dumpdir>]\n"
+	    "\t\t[-j <threads>] [-o <var>=<value>]... [-t <txg>] [-U <cache>]\n"
+	    "\t\t[-x <dumpdir>]\n"
 	    "\t\t[<poolname> [<object> ...]]\n"
 	    "\t%s [-AdiPv] [-e [-V] [-p <path> ...]] [-U <cache>] <dataset>\n"
 	    "\t\t[<object> ...]\n"
@@ -156,8 +158,8 @@ usage(void)
 	    "\t%s -R [-A] [-e [-V] [-p <path> ...]] [-U <cache>]\n"
 	    "\t\t<poolname> <vdev>:<offset>:<size>[:<flags>]\n"
 	    "\t%s -E [-A] word0:word1:...:word15\n"
-	    "\t%s -S [-AP] [-e [-V] [-p <path> ...]] [-U <cache>] "
-	    "<poolname>\n\n",
+	    "\t%s -S [-AP] [-e [-V] [-p <path> ...]] [-n <entries>] "
+	    "[-U <cache>]\n\t\t<poolname>\n\n",
 	    cmdname, cmdname, cmdname, cmdname, cmdname, cmdname, cmdname,
 	    cmdname, cmdname, cmdname);
 
@@ -205,6 +207,11 @@ usage(void)
 	(void) fprintf(stderr, "        -I <number of inflight I/Os> -- "
 	    "specify the maximum number of\n           "
 	    "checksumming I/Os [default is 200]\n");
+	(void) fprintf(stderr, "        -j <threads> -- traverse datasets "
+	    "with this many threads for -b\n");
+	(void) fprintf(stderr, "        -n <entries> -- sample blocks to "
+	    "keep at most this many\n           simulated DDT entries for -S "
+	    "[default is 16777216, 0 for all]\n");
 	(void) fprintf(stderr, "        -o <variable>=<value> set global "
 	    "variable to an unsigned 32-bit integer\n");
 	(void) fprintf(stderr, "        -p <path> -- use one or more with "
@@ -945,7 +952,7 @@ dump_metaslab_stats(metaslab_t *msp)
 {
 	char maxbuf[32];
 	range_tree_t *rt = msp->ms_allocatable;
-	avl_tree_t *t = &msp->ms_allocatable_by_size;
+	zfs_btree_t *t = &msp->ms_allocatable_by_size;
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	/* max sure nicenum has enough space */
@@ -954,7 +961,7 @@ dump_metaslab_stats(metaslab_t *msp)
 	zdb_nicenum(metaslab_block_maxsize(msp), maxbuf, sizeof (maxbuf));
 
 	(void) printf("\t %25s %10lu   %7s  %6s   %4s %4d%%\n",
-	    "segments", avl_numnodes(t), "maxsize", maxbuf,
+	    "segments", zfs_btree_numnodes(t), "maxsize", maxbuf,
 	    "freepct", free_pct);
 	(void) printf("\tIn-memory histogram:\n");
 	dump_histogram(rt->rt_histogram, RANGE_TREE_HISTOGRAM_SIZE, 0);
@@ -1320,6 +1327,24 @@ dump_ddt(ddt_t *ddt, enum ddt_type type, enum ddt_class class)
 	(void) printf("\n");
 }
 
+static void
+dump_ddt_log(ddt_t *ddt)
+{
+	ddt_log_t *active = ddt->ddt_log_active;
+	ddt_log_t *flushing = ddt->ddt_log_flushing;
+
+	if (active->ddl_object == 0)
+		return;
+
+	(void) printf("DDT-log-%s: %llu active entries (%llu records "
+	    "since txg %llu), %llu flushing entries\n",
+	    zio_checksum_table[ddt->ddt_checksum].ci_name,
+	    (u_longlong_t)avl_numnodes(&active->ddl_tree),
+	    (u_longlong_t)active->ddl_phys.dlp_length,
+	    (u_longlong_t)active->ddl_phys.dlp_first_txg,
+	    (u_longlong_t)avl_numnodes(&flushing->ddl_tree));
+}
+
 static void
 dump_all_ddts(spa_t *spa)
 {
@@ -1337,6 +1362,7 @@ dump_all_ddts(spa_t *spa)
 				dump_ddt(ddt, type, class);
 			}
 		}
+		dump_ddt_log(ddt);
 	}
 
 	ddt_get_dedup_stats(spa, &dds_total);
@@ -2610,6 +2636,29 @@ dump_object(objset_t *os, uint64_t object, int verbosity,
 		dnode_rele(dn, FTAG);
 }
 
+/* Marks a livelist and the bpobjs of its sublists as referenced */
+static void
+count_livelist_mos_objects(objset_t *mos, uint64_t obj)
+{
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	uint64_t objs[2];
+
+	if (obj == 0)
+		return;
+
+	mos_obj_refd(obj);
+	for (zap_cursor_init(&zc, mos, obj);
+	    zap_cursor_retrieve(&zc, &za) == 0;
+	    zap_cursor_advance(&zc)) {
+		VERIFY0(zap_lookup(mos, obj, za.za_name, sizeof (uint64_t),
+		    2, objs));
+		mos_obj_refd(objs[0]);
+		mos_obj_refd(objs[1]);
+	}
+	zap_cursor_fini(&zc);
+}
+
 static void
 count_dir_mos_objects(dsl_dir_t *dd)
 {
@@ -2618,6 +2667,8 @@ count_dir_mos_objects(dsl_dir_t *dd)
 	mos_obj_refd(dsl_dir_phys(dd)->dd_deleg_zapobj);
 	mos_obj_refd(dsl_dir_phys(dd)->dd_props_zapobj);
 	mos_obj_refd(dsl_dir_phys(dd)->dd_clones);
+	count_livelist_mos_objects(dd->dd_pool->dp_meta_objset,
+	    dd->dd_livelist.ll_object);
 
 	/*
 	 * The dd_crypto_obj can be referenced by multiple dsl_dir's.
@@ -3561,6 +3612,9 @@ typedef struct zdb_cb {
 	int		zcb_haderrors;
 	spa_t		*zcb_spa;
 	uint32_t	**zcb_vd_obsolete_counts;
+	struct zdb_cb	*zcb_parent;	/* of a traversal thread's zcb */
+	struct zdb_cb	**zcb_workers;	/* the traversal threads' zcbs */
+	int		zcb_nworkers;
 } zdb_cb_t;
 
 /* test if two DVA offsets from same vdev are within the same metaslab */
@@ -3673,15 +3727,18 @@ zdb_count_block(zdb_cb_t *zcb, zilog_t *zilog, const blkptr_t *bp,
 	if (BP_GET_DEDUP(bp)) {
 		ddt_t *ddt;
 		ddt_entry_t *dde;
+		ddt_phys_t *ddp;
 
 		ddt = ddt_select(zcb->zcb_spa, bp);
 		ddt_enter(ddt);
 		dde = ddt_lookup(ddt, bp, B_FALSE);
 
-		if (dde == NULL) {
+		/* A block whose entry was pruned is counted as ordinary */
+		ddp = (dde == NULL) ? NULL : ddt_phys_select(dde, bp);
+
+		if (ddp == NULL) {
 			refcnt = 0;
 		} else {
-			ddt_phys_t *ddp = ddt_phys_select(dde, bp);
 			ddt_phys_decref(ddp);
 			refcnt = ddp->ddp_refcnt;
 			if (ddt_phys_total_refcnt(dde) == 0)
@@ -3796,10 +3853,24 @@ zdb_blkptr_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	else
 		return (0);
 
+	/* with -j only the first traversal thread reports progress */
+	if (zcb->zcb_parent != NULL && zcb != zcb->zcb_parent->zcb_workers[0])
+		return (0);
+
 	if (dump_opt['b'] < 5 && gethrtime() > zcb->zcb_lastprint + NANOSEC) {
 		uint64_t now = gethrtime();
 		char buf[10];
 		uint64_t bytes = zcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize;
+
+		if (zcb->zcb_parent != NULL) {
+			zdb_cb_t *pzcb = zcb->zcb_parent;
+
+			bytes = pzcb->zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize;
+			for (int w = 0; w < pzcb->zcb_nworkers; w++) {
+				bytes += pzcb->zcb_workers[w]->
+				    zcb_type[ZB_TOTAL][ZDB_OT_TOTAL].zb_asize;
+			}
+		}
 		int kb_per_sec =
 		    1 + bytes / (1 + ((now - zcb->zcb_start) / 1000 / 1000));
 		int sec_remaining =
@@ -4052,46 +4123,68 @@ zdb_load_obsolete_counts(vdev_t *vd)
 	return (counts);
 }
 
+static void
+zdb_ddt_leak_entry(spa_t *spa, zdb_cb_t *zcb, enum zio_checksum checksum,
+    ddt_entry_t *dde)
+{
+	blkptr_t blk;
+	ddt_phys_t *ddp = dde->dde_phys;
+	ddt_t *ddt = spa->spa_ddt[checksum];
+	int p;
+
+	ASSERT(ddt_phys_total_refcnt(dde) > 1);
+
+	for (p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
+		if (ddp->ddp_phys_birth == 0)
+			continue;
+		ddt_bp_create(checksum, &dde->dde_key, ddp, &blk);
+		if (p == DDT_PHYS_DITTO) {
+			zdb_count_block(zcb, NULL, &blk, ZDB_OT_DITTO);
+		} else {
+			zcb->zcb_dedup_asize +=
+			    BP_GET_ASIZE(&blk) * (ddp->ddp_refcnt - 1);
+			zcb->zcb_dedup_blocks++;
+		}
+	}
+	ddt_enter(ddt);
+	VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
+	ddt_exit(ddt);
+}
+
 static void
 zdb_ddt_leak_init(spa_t *spa, zdb_cb_t *zcb)
 {
 	ddt_bookmark_t ddb;
 	ddt_entry_t dde;
 	int error;
-	int p;
 
 	ASSERT(!dump_opt['L']);
 
 	bzero(&ddb, sizeof (ddb));
 	while ((error = ddt_walk(spa, &ddb, &dde)) == 0) {
-		blkptr_t blk;
-		ddt_phys_t *ddp = dde.dde_phys;
-
 		if (ddb.ddb_class == DDT_CLASS_UNIQUE)
-			return;
+			break;
+		zdb_ddt_leak_entry(spa, zcb, ddb.ddb_checksum, &dde);
+	}
+
+	ASSERT(error == 0 || error == ENOENT);
 
-		ASSERT(ddt_phys_total_refcnt(&dde) > 1);
+	/*
+	 * The entries with a record in the dedup log are not returned by
+	 * ddt_walk().
+	 */
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		void *cookie = NULL;
 
-		for (p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
-			if (ddp->ddp_phys_birth == 0)
+		while ((error = ddt_log_walk(ddt, &cookie, &dde)) == 0) {
+			if (dde.dde_class == DDT_CLASS_UNIQUE)
 				continue;
-			ddt_bp_create(ddb.ddb_checksum,
-			    &dde.dde_key, ddp, &blk);
-			if (p == DDT_PHYS_DITTO) {
-				zdb_count_block(zcb, NULL, &blk, ZDB_OT_DITTO);
-			} else {
-				zcb->zcb_dedup_asize +=
-				    BP_GET_ASIZE(&blk) * (ddp->ddp_refcnt - 1);
-				zcb->zcb_dedup_blocks++;
-			}
+			zdb_ddt_leak_entry(spa, zcb, c, &dde);
 		}
-		ddt_t *ddt = spa->spa_ddt[ddb.ddb_checksum];
-		ddt_enter(ddt);
-		VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
-		ddt_exit(ddt);
-	}
 
-	ASSERT(error == ENOENT);
+		ASSERT(error == ENOENT);
+	}
 }
 
 typedef struct checkpoint_sm_exclude_entry_arg {
@@ -4621,6 +4714,190 @@ count_block_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 	return (0);
 }
 
+/*
+ * With -j the datasets are traversed by that many threads, each counting
+ * into its own zdb_cb_t, and the counts are summed once all the checksum
+ * I/Os have completed.  Each thread takes the next dataset from
+ * zdb_traverse.zt_dsobjs until there are none left.
+ */
+static struct {
+	int		zt_flags;
+	uint64_t	*zt_dsobjs;
+	uint64_t	zt_ndsobjs;
+	uint64_t	zt_next;
+	int		zt_err;
+} zdb_traverse;
+
+/*
+ * Traverse one dataset as traverse_pool() does: only the blocks born since
+ * its previous snapshot, the snapshot accounting for the older ones.
+ */
+static int
+zdb_traverse_dataset(spa_t *spa, uint64_t dsobj, zdb_cb_t *zcb)
+{
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dsl_dataset_t *ds;
+	int err;
+
+	dsl_pool_config_enter(dp, FTAG);
+	err = dsl_dataset_hold_obj(dp, dsobj, FTAG, &ds);
+	dsl_pool_config_exit(dp, FTAG);
+	if (err != 0)
+		return (0);	/* TRAVERSE_HARD */
+
+	err = traverse_dataset(ds, dsl_dataset_phys(ds)->ds_prev_snap_txg,
+	    zdb_traverse.zt_flags, zdb_blkptr_cb, zcb);
+	dsl_dataset_rele(ds, FTAG);
+
+	return (err);
+}
+
+static void
+zdb_traverse_thread(void *arg)
+{
+	zdb_cb_t *zcb = arg;
+	uint64_t i;
+	int err;
+
+	while ((i = atomic_inc_64_nv(&zdb_traverse.zt_next) - 1) <
+	    zdb_traverse.zt_ndsobjs) {
+		err = zdb_traverse_dataset(zcb->zcb_spa,
+		    zdb_traverse.zt_dsobjs[i], zcb);
+		if (err != 0) {
+			/* like traverse_pool(), stop at the first error */
+			zdb_traverse.zt_err = err;
+			zdb_traverse.zt_next = zdb_traverse.zt_ndsobjs;
+			break;
+		}
+	}
+}
+
+/*
+ * The equivalent of traverse_pool() for dump_block_stats(), using
+ * traverse_threads threads for the datasets.  The per-thread counts are
+ * left in zcb->zcb_workers for zdb_traverse_merge().
+ */
+static int
+zdb_traverse_pool(spa_t *spa, int flags, zdb_cb_t *zcb)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	uint64_t size = 0;
+	taskq_t *tq;
+	int err;
+
+	if (traverse_threads <= 1)
+		return (traverse_pool(spa, 0, flags, zdb_blkptr_cb, zcb));
+
+	err = traverse_mos(spa, 0, flags, zdb_blkptr_cb, zcb);
+	if (err != 0)
+		return (err);
+
+	bzero(&zdb_traverse, sizeof (zdb_traverse));
+	zdb_traverse.zt_flags = flags;
+	for (uint64_t obj = 1; err == 0;
+	    err = dmu_object_next(mos, &obj, B_FALSE, 0)) {
+		dmu_object_info_t doi;
+
+		if (dmu_object_info(mos, obj, &doi) != 0 ||
+		    doi.doi_bonus_type != DMU_OT_DSL_DATASET)
+			continue;
+
+		if (zdb_traverse.zt_ndsobjs == size) {
+			uint64_t *dsobjs = umem_alloc(
+			    MAX(size * 2, 64) * sizeof (uint64_t), UMEM_NOFAIL);
+
+			if (size != 0) {
+				bcopy(zdb_traverse.zt_dsobjs, dsobjs,
+				    size * sizeof (uint64_t));
+				umem_free(zdb_traverse.zt_dsobjs,
+				    size * sizeof (uint64_t));
+			}
+			zdb_traverse.zt_dsobjs = dsobjs;
+			size = MAX(size * 2, 64);
+		}
+		zdb_traverse.zt_dsobjs[zdb_traverse.zt_ndsobjs++] = obj;
+	}
+
+	zcb->zcb_nworkers = traverse_threads;
+	zcb->zcb_workers = umem_alloc(traverse_threads * sizeof (zdb_cb_t *),
+	    UMEM_NOFAIL);
+	tq = taskq_create("zdb_traverse", traverse_threads, minclsyspri,
+	    traverse_threads, traverse_threads, TASKQ_PREPOPULATE);
+	for (int w = 0; w < traverse_threads; w++) {
+		zdb_cb_t *wzcb = umem_zalloc(sizeof (zdb_cb_t), UMEM_NOFAIL);
+
+		wzcb->zcb_spa = zcb->zcb_spa;
+		wzcb->zcb_vd_obsolete_counts = zcb->zcb_vd_obsolete_counts;
+		wzcb->zcb_start = zcb->zcb_start;
+		wzcb->zcb_lastprint = zcb->zcb_lastprint;
+		wzcb->zcb_totalasize = zcb->zcb_totalasize;
+		wzcb->zcb_parent = zcb;
+		zcb->zcb_workers[w] = wzcb;
+	}
+	for (int w = 0; w < traverse_threads; w++) {
+		VERIFY3U(taskq_dispatch(tq, zdb_traverse_thread,
+		    zcb->zcb_workers[w], TQ_SLEEP), !=, TASKQID_INVALID);
+	}
+	taskq_wait(tq);
+	taskq_destroy(tq);
+
+	if (size != 0)
+		umem_free(zdb_traverse.zt_dsobjs, size * sizeof (uint64_t));
+
+	return (zdb_traverse.zt_err);
+}
+
+/*
+ * Add the counts of zdb_traverse_pool()'s threads into zcb and free them.
+ */
+static void
+zdb_traverse_merge(zdb_cb_t *zcb)
+{
+	for (int w = 0; w < zcb->zcb_nworkers; w++) {
+		zdb_cb_t *wzcb = zcb->zcb_workers[w];
+
+		for (int l = 0; l <= ZB_TOTAL; l++) {
+			for (int t = 0; t <= ZDB_OT_TOTAL; t++) {
+				zdb_blkstats_t *zb = &zcb->zcb_type[l][t];
+				zdb_blkstats_t *wzb = &wzcb->zcb_type[l][t];
+
+				zb->zb_asize += wzb->zb_asize;
+				zb->zb_lsize += wzb->zb_lsize;
+				zb->zb_psize += wzb->zb_psize;
+				zb->zb_count += wzb->zb_count;
+				zb->zb_gangs += wzb->zb_gangs;
+				zb->zb_ditto_samevdev +=
+				    wzb->zb_ditto_samevdev;
+				zb->zb_ditto_same_ms += wzb->zb_ditto_same_ms;
+				for (int h = 0; h < PSIZE_HISTO_SIZE; h++) {
+					zb->zb_psize_histogram[h] +=
+					    wzb->zb_psize_histogram[h];
+				}
+			}
+		}
+		for (int i = 0; i < NUM_BP_EMBEDDED_TYPES; i++) {
+			zcb->zcb_embedded_blocks[i] +=
+			    wzcb->zcb_embedded_blocks[i];
+			for (int h = 0; h <= BPE_PAYLOAD_SIZE; h++) {
+				zcb->zcb_embedded_histogram[i][h] +=
+				    wzcb->zcb_embedded_histogram[i][h];
+			}
+		}
+		for (int e = 0; e < 256; e++)
+			zcb->zcb_errors[e] += wzcb->zcb_errors[e];
+		zcb->zcb_haderrors |= wzcb->zcb_haderrors;
+
+		umem_free(wzcb, sizeof (zdb_cb_t));
+	}
+
+	if (zcb->zcb_workers != NULL) {
+		umem_free(zcb->zcb_workers,
+		    zcb->zcb_nworkers * sizeof (zdb_cb_t *));
+		zcb->zcb_workers = NULL;
+		zcb->zcb_nworkers = 0;
+	}
+}
+
 static int
 dump_block_stats(spa_t *spa)
 {
@@ -4675,6 +4952,9 @@ dump_block_stats(spa_t *spa)
 		    &zcb, NULL));
 	}
 
+	VERIFY0(dsl_livelist_iterate_deleted(spa->spa_dsl_pool,
+	    count_block_cb, &zcb));
+
 	if (dump_opt['c'] > 1)
 		flags |= TRAVERSE_PREFETCH_DATA;
 
@@ -4682,7 +4962,7 @@ dump_block_stats(spa_t *spa)
 	zcb.zcb_totalasize += metaslab_class_get_alloc(spa_special_class(spa));
 	zcb.zcb_totalasize += metaslab_class_get_alloc(spa_dedup_class(spa));
 	zcb.zcb_start = zcb.zcb_lastprint = gethrtime();
-	err = traverse_pool(spa, 0, flags, zdb_blkptr_cb, &zcb);
+	err = zdb_traverse_pool(spa, flags, &zcb);
 
 	/*
 	 * If we've traversed the data blocks then we need to wait for those
@@ -4702,6 +4982,7 @@ dump_block_stats(spa_t *spa)
 	 * Done after zio_wait() since zcb_haderrors is modified in
 	 * zdb_blkptr_done()
 	 */
+	zdb_traverse_merge(&zcb);
 	zcb.zcb_haderrors |= err;
 
 	if (zcb.zcb_haderrors) {
@@ -4949,12 +5230,74 @@ typedef struct zdb_ddt_entry {
 	avl_node_t	zdde_node;
 } zdb_ddt_entry_t;
 
+/*
+ * The simulated DDT holds at most ddt_sim_max entries (unlimited if 0).
+ * When it would grow past that, only the entries whose checksum hashes into
+ * the lower half of the current sample are kept, and from then on only such
+ * blocks are added.  Since every copy of a block has the same checksum, an
+ * entry is either sampled with all its references or not at all, so the
+ * reference counts, and hence the shape of the histogram, stay exact and
+ * only the totals have to be scaled up by 2^zds_shift.
+ */
+static uint64_t ddt_sim_max = 1ULL << 24;
+
+typedef struct zdb_ddt_sim {
+	avl_tree_t	zds_tree;
+	int		zds_shift;	/* 1/2^zds_shift of entries sampled */
+} zdb_ddt_sim_t;
+
+static uint64_t
+zdb_ddt_hash(const ddt_key_t *ddk)
+{
+	uint64_t h = ddk->ddk_cksum.zc_word[0] ^ ddk->ddk_cksum.zc_word[3];
+
+	/*
+	 * Mix the bits, as the low words of the weaker dedup checksums
+	 * (fletcher with verify) are far from uniform.
+	 */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return (h);
+}
+
+static boolean_t
+zdb_ddt_sampled(const ddt_key_t *ddk, int shift)
+{
+	return (shift == 0 || (zdb_ddt_hash(ddk) >> (64 - shift)) == 0);
+}
+
+static void
+zdb_ddt_halve_sample(zdb_ddt_sim_t *zds)
+{
+	avl_tree_t *t = &zds->zds_tree;
+	zdb_ddt_entry_t *zdde, *next;
+
+	zds->zds_shift++;
+	for (zdde = avl_first(t); zdde != NULL; zdde = next) {
+		next = AVL_NEXT(t, zdde);
+		if (!zdb_ddt_sampled(&zdde->zdde_key, zds->zds_shift)) {
+			avl_remove(t, zdde);
+			umem_free(zdde, sizeof (*zdde));
+		}
+	}
+
+	if (dump_opt['S'] > 1) {
+		(void) printf("sampling 1/%llu of blocks, %lu entries kept\n",
+		    1ULL << zds->zds_shift, avl_numnodes(t));
+	}
+}
+
 /* ARGSUSED */
 static int
 zdb_ddt_add_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
     const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg)
 {
-	avl_tree_t *t = arg;
+	zdb_ddt_sim_t *zds = arg;
+	avl_tree_t *t = &zds->zds_tree;
 	avl_index_t where;
 	zdb_ddt_entry_t *zdde, zdde_search;
 
@@ -4976,9 +5319,20 @@ zdb_ddt_add_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 
 	ddt_key_fill(&zdde_search.zdde_key, bp);
 
+	if (!zdb_ddt_sampled(&zdde_search.zdde_key, zds->zds_shift))
+		return (0);
+
 	zdde = avl_find(t, &zdde_search, &where);
 
 	if (zdde == NULL) {
+		if (ddt_sim_max != 0 && avl_numnodes(t) >= ddt_sim_max &&
+		    zds->zds_shift < 63) {
+			zdb_ddt_halve_sample(zds);
+			if (!zdb_ddt_sampled(&zdde_search.zdde_key,
+			    zds->zds_shift))
+				return (0);
+			VERIFY3P(avl_find(t, &zdde_search, &where), ==, NULL);
+		}
 		zdde = umem_zalloc(sizeof (*zdde), UMEM_NOFAIL);
 		zdde->zdde_key = zdde_search.zdde_key;
 		avl_insert(t, zdde, where);
@@ -4995,38 +5349,42 @@ zdb_ddt_add_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 static void
 dump_simulated_ddt(spa_t *spa)
 {
-	avl_tree_t t;
+	zdb_ddt_sim_t zds;
 	void *cookie = NULL;
 	zdb_ddt_entry_t *zdde;
 	ddt_histogram_t ddh_total;
 	ddt_stat_t dds_total;
+	uint64_t scale, entries;
+	char incore[32], ondisk[32];
 
 	bzero(&ddh_total, sizeof (ddh_total));
 	bzero(&dds_total, sizeof (dds_total));
-	avl_create(&t, ddt_entry_compare,
+	zds.zds_shift = 0;
+	avl_create(&zds.zds_tree, ddt_entry_compare,
 	    sizeof (zdb_ddt_entry_t), offsetof(zdb_ddt_entry_t, zdde_node));
 
 	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
 
 	(void) traverse_pool(spa, 0, TRAVERSE_PRE | TRAVERSE_PREFETCH_METADATA |
-	    TRAVERSE_NO_DECRYPT, zdb_ddt_add_cb, &t);
+	    TRAVERSE_NO_DECRYPT, zdb_ddt_add_cb, &zds);
 
 	spa_config_exit(spa, SCL_CONFIG, FTAG);
 
-	while ((zdde = avl_destroy_nodes(&t, &cookie)) != NULL) {
+	scale = 1ULL << zds.zds_shift;
+	while ((zdde = avl_destroy_nodes(&zds.zds_tree, &cookie)) != NULL) {
 		ddt_stat_t dds;
 		uint64_t refcnt = zdde->zdde_ref_blocks;
 		ASSERT(refcnt != 0);
 
-		dds.dds_blocks = zdde->zdde_ref_blocks / refcnt;
-		dds.dds_lsize = zdde->zdde_ref_lsize / refcnt;
-		dds.dds_psize = zdde->zdde_ref_psize / refcnt;
-		dds.dds_dsize = zdde->zdde_ref_dsize / refcnt;
+		dds.dds_blocks = zdde->zdde_ref_blocks / refcnt * scale;
+		dds.dds_lsize = zdde->zdde_ref_lsize / refcnt * scale;
+		dds.dds_psize = zdde->zdde_ref_psize / refcnt * scale;
+		dds.dds_dsize = zdde->zdde_ref_dsize / refcnt * scale;
 
-		dds.dds_ref_blocks = zdde->zdde_ref_blocks;
-		dds.dds_ref_lsize = zdde->zdde_ref_lsize;
-		dds.dds_ref_psize = zdde->zdde_ref_psize;
-		dds.dds_ref_dsize = zdde->zdde_ref_dsize;
+		dds.dds_ref_blocks = zdde->zdde_ref_blocks * scale;
+		dds.dds_ref_lsize = zdde->zdde_ref_lsize * scale;
+		dds.dds_ref_psize = zdde->zdde_ref_psize * scale;
+		dds.dds_ref_dsize = zdde->zdde_ref_dsize * scale;
 
 		ddt_stat_add(&ddh_total.ddh_stat[highbit64(refcnt) - 1],
 		    &dds, 0);
@@ -5034,15 +5392,32 @@ dump_simulated_ddt(spa_t *spa)
 		umem_free(zdde, sizeof (*zdde));
 	}
 
-	avl_destroy(&t);
+	avl_destroy(&zds.zds_tree);
 
 	ddt_histogram_stat(&dds_total, &ddh_total);
 
-	(void) printf("Simulated DDT histogram:\n");
+	if (zds.zds_shift != 0) {
+		(void) printf("Simulated DDT histogram, estimated from 1/%llu "
+		    "of blocks:\n", (u_longlong_t)scale);
+	} else {
+		(void) printf("Simulated DDT histogram:\n");
+	}
 
 	zpool_dump_ddt(&dds_total, &ddh_total);
 
 	dump_dedup_ratio(&dds_total);
+
+	/*
+	 * Each entry costs a ddt_entry_t while it is being looked up or
+	 * changed, and a key and its phys array in the ZAP blocks of the DDT
+	 * objects which have to be cached for writes not to wait on them.
+	 */
+	entries = dds_total.dds_blocks;
+	zdb_nicenum(entries * sizeof (ddt_entry_t), incore, sizeof (incore));
+	zdb_nicenum(entries * (sizeof (ddt_key_t) +
+	    DDT_PHYS_TYPES * sizeof (ddt_phys_t)), ondisk, sizeof (ondisk));
+	(void) printf("Projected DDT size: %llu entries, %s in core, "
+	    "%s of DDT objects\n\n", (u_longlong_t)entries, incore, ondisk);
 }
 
 static int
@@ -5603,8 +5978,17 @@ mos_obj_refd_multiple(uint64_t obj)
 static void
 mos_leak_vdev_top_zap(vdev_t *vd)
 {
-	uint64_t ms_flush_data_obj;
+	uint64_t ms_condense_sm_obj;
 	int error = zap_lookup(spa_meta_objset(vd->vdev_spa),
+	    vd->vdev_top_zap, VDEV_TOP_ZAP_MS_CONDENSE_SM,
+	    sizeof (ms_condense_sm_obj), 1, &ms_condense_sm_obj);
+	if (error == 0)
+		mos_obj_refd(ms_condense_sm_obj);
+	else
+		ASSERT3U(error, ==, ENOENT);
+
+	uint64_t ms_flush_data_obj;
+	error = zap_lookup(spa_meta_objset(vd->vdev_spa),
 	    vd->vdev_top_zap, VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS,
 	    sizeof (ms_flush_data_obj), 1, &ms_flush_data_obj);
 	if (error == ENOENT)
@@ -5686,7 +6070,19 @@ dump_mos_leaks(spa_t *spa)
 	mos_obj_refd(spa->spa_all_vdev_zaps);
 	mos_obj_refd(spa->spa_dsl_pool->dp_bptree_obj);
 	mos_obj_refd(spa->spa_dsl_pool->dp_tmp_userrefs_obj);
+	if (dp->dp_deleted_clones_obj != 0) {
+		zap_cursor_t zc;
+		zap_attribute_t za;
+
+		mos_obj_refd(dp->dp_deleted_clones_obj);
+		for (zap_cursor_init(&zc, mos, dp->dp_deleted_clones_obj);
+		    zap_cursor_retrieve(&zc, &za) == 0;
+		    zap_cursor_advance(&zc))
+			count_livelist_mos_objects(mos, za.za_first_integer);
+		zap_cursor_fini(&zc);
+	}
 	mos_obj_refd(spa->spa_dsl_pool->dp_scan->scn_phys.scn_queue_obj);
+	mos_obj_refd(spa->spa_dsl_pool->dp_scan->scn_spill_obj);
 	bpobj_count_refd(&spa->spa_deferred_bpobj);
 	mos_obj_refd(dp->dp_empty_bpobj);
 	bpobj_count_refd(&dp->dp_obsolete_bpobj);
@@ -6442,7 +6838,7 @@ main(int argc, char **argv)
 		spa_config_path = spa_config_path_env;
 
 	while ((c = getopt(argc, argv,
-	    "AbcCdDeEFGhiI:klLmMo:Op:PqRsSt:uU:vVx:XY")) != -1) {
+	    "AbcCdDeEFGhiI:j:klLmMn:o:Op:PqRsSt:uU:vVx:XY")) != -1) {
 		switch (c) {
 		case 'b':
 		case 'c':
@@ -6488,6 +6884,17 @@ main(int argc, char **argv)
 				usage();
 			}
 			break;
+		case 'j':
+			traverse_threads = atoi(optarg);
+			if (traverse_threads <= 0) {
+				(void) fprintf(stderr, "number of traversal "
+				    "threads must be greater than 0\n");
+				usage();
+			}
+			break;
+		case 'n':
+			ddt_sim_max = strtoull(optarg, NULL, 0);
+			break;
 		case 'o':
 			error = set_global_var(optarg);
 			if (error != 0)
@@ -40,6 +40,11 @@
  */
 #define	ZED_MAX_EVENTS		0
 
+/*
+ * Default maximum number of ZEDLETs running at once.
+ */
+#define	ZED_MAX_JOBS		16
+
 /*
  * Reserved for future use.
  */
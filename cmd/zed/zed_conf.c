@@ -46,6 +46,7 @@ zed_conf_create(void)
 	zcp->syslog_facility = LOG_DAEMON;
 	zcp->min_events = ZED_MIN_EVENTS;
 	zcp->max_events = ZED_MAX_EVENTS;
+	zcp->max_jobs = ZED_MAX_JOBS;
 	zcp->pid_fd = -1;
 	zcp->zedlets = NULL;		/* created via zed_conf_scan_dir() */
 	zcp->state_fd = -1;		/* opened via zed_conf_open_state() */
@@ -155,6 +156,8 @@ _zed_conf_display_help(const char *prog, int got_err)
 	    "Run daemon in the foreground.");
 	fprintf(fp, "%*c%*s %s\n", w1, 0x20, -w2, "-M",
 	    "Lock all pages in memory.");
+	fprintf(fp, "%*c%*s %s\n", w1, 0x20, -w2, "-I",
+	    "Run builtin ZEDLETs in-process.");
 	fprintf(fp, "%*c%*s %s\n", w1, 0x20, -w2, "-P",
 	    "$PATH for ZED to use (only used by ZTS).");
 	fprintf(fp, "%*c%*s %s\n", w1, 0x20, -w2, "-Z",
@@ -170,6 +173,8 @@ _zed_conf_display_help(const char *prog, int got_err)
 	    "Write daemon's PID to FILE.", ZED_PID_FILE);
 	fprintf(fp, "%*c%*s %s [%s]\n", w1, 0x20, -w2, "-s FILE",
 	    "Write daemon's state to FILE.", ZED_STATE_FILE);
+	fprintf(fp, "%*c%*s %s [%d]\n", w1, 0x20, -w2, "-j JOBS",
+	    "Run up to JOBS ZEDLETs at once.", ZED_MAX_JOBS);
 	fprintf(fp, "\n");
 
 	exit(got_err ? EXIT_FAILURE : EXIT_SUCCESS);
@@ -249,8 +254,9 @@ _zed_conf_parse_path(char **resultp, const char *path)
 void
 zed_conf_parse_opts(struct zed_conf *zcp, int argc, char **argv)
 {
-	const char * const opts = ":hLVc:d:p:P:s:vfFMZ";
+	const char * const opts = ":hLVc:d:p:P:s:vfFMZIj:";
 	int opt;
+	char *end;
 
 	if (!zcp || !argv || !argv[0])
 		zed_log_die("Failed to parse options: Internal error");
@@ -298,6 +304,19 @@ zed_conf_parse_opts(struct zed_conf *zcp, int argc, char **argv)
 		case 'Z':
 			zcp->do_zero = 1;
 			break;
+		case 'I':
+			zcp->do_builtin = 1;
+			break;
+		case 'j':
+			errno = 0;
+			zcp->max_jobs = strtol(optarg, &end, 10);
+			if ((errno != 0) || (*end != '\0') ||
+			    (zcp->max_jobs < 1)) {
+				fprintf(stderr, "%s: %s '%s'\n\n", argv[0],
+				    "Invalid number of jobs", optarg);
+				_zed_conf_display_help(argv[0], EXIT_FAILURE);
+			}
+			break;
 		case '?':
 		default:
 			if (optopt == '?')
@@ -25,9 +25,11 @@ struct zed_conf {
 	unsigned	do_memlock:1;		/* true if locking memory */
 	unsigned	do_verbose:1;		/* true if verbosity enabled */
 	unsigned	do_zero:1;		/* true if zeroing state */
+	unsigned	do_builtin:1;		/* true if builtins enabled */
 	int		syslog_facility;	/* syslog facility value */
 	int		min_events;		/* RESERVED FOR FUTURE USE */
 	int		max_events;		/* RESERVED FOR FUTURE USE */
+	int		max_jobs;		/* max concurrent zedlets */
 	char		*conf_file;		/* abs path to config file */
 	char		*pid_file;		/* abs path to pid file */
 	int		pid_fd;			/* fd to pid file for lock */
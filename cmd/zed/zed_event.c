@@ -59,6 +59,8 @@ zed_event_init(struct zed_conf *zcp)
 
 	if (zed_disk_event_init() != 0)
 		zed_log_die("Failed to initialize disk events");
+
+	zed_exec_init(zcp->max_jobs, zcp->do_builtin);
 }
 
 /*
@@ -70,6 +72,7 @@ zed_event_fini(struct zed_conf *zcp)
 	if (!zcp)
 		zed_log_die("Failed zed_event_fini: %s", strerror(EINVAL));
 
+	zed_exec_fini();
 	zed_disk_event_fini();
 	zfs_agent_fini();
 
@@ -870,41 +873,19 @@ _zed_event_add_time_strings(uint64_t eid, zed_strings_t *zsp, int64_t etime[])
 }
 
 /*
- * Service the next zevent, blocking until one is available.
+ * Process the zevent [nvl].
  */
-void
-zed_event_service(struct zed_conf *zcp)
+static void
+_zed_event_process(struct zed_conf *zcp, nvlist_t *nvl)
 {
-	nvlist_t *nvl;
 	nvpair_t *nvp;
-	int n_dropped;
 	zed_strings_t *zsp;
 	uint64_t eid;
 	int64_t *etime;
 	uint_t nelem;
 	char *class;
 	const char *subclass;
-	int rv;
-
-	if (!zcp) {
-		errno = EINVAL;
-		zed_log_msg(LOG_ERR, "Failed to service zevent: %s",
-		    strerror(errno));
-		return;
-	}
-	rv = zpool_events_next(zcp->zfs_hdl, &nvl, &n_dropped, ZEVENT_NONE,
-	    zcp->zevent_fd);
 
-	if ((rv != 0) || !nvl)
-		return;
-
-	if (n_dropped > 0) {
-		zed_log_msg(LOG_WARNING, "Missed %d events", n_dropped);
-		/*
-		 * FIXME: Increase max size of event nvlist in
-		 * /sys/module/zfs/parameters/zfs_zevent_len_max ?
-		 */
-	}
 	if (nvlist_lookup_uint64(nvl, "eid", &eid) != 0) {
 		zed_log_msg(LOG_WARNING, "Failed to lookup zevent eid");
 	} else if (nvlist_lookup_int64_array(
@@ -948,5 +929,49 @@ zed_event_service(struct zed_conf *zcp)
 
 		zed_strings_destroy(zsp);
 	}
-	nvlist_free(nvl);
+}
+
+/*
+ * Service the pending zevents, blocking until one is available.  They are
+ * retrieved in batches so that zed keeps up when many are posted at once.
+ */
+void
+zed_event_service(struct zed_conf *zcp)
+{
+	nvlist_t *batch;
+	nvpair_t *nvp;
+	int n_dropped;
+	int rv;
+
+	if (!zcp) {
+		errno = EINVAL;
+		zed_log_msg(LOG_ERR, "Failed to service zevent: %s",
+		    strerror(errno));
+		return;
+	}
+	rv = zpool_events_next_batch(zcp->zfs_hdl, &batch, &n_dropped,
+	    ZEVENT_NONE, zcp->zevent_fd);
+
+	if ((rv != 0) || !batch)
+		return;
+
+	if (n_dropped > 0) {
+		zed_log_msg(LOG_WARNING, "Missed %d events", n_dropped);
+		/*
+		 * FIXME: Increase max size of event nvlist in
+		 * /sys/module/zfs/parameters/zfs_zevent_len_max ?
+		 */
+	}
+	for (nvp = nvlist_next_nvpair(batch, NULL); nvp != NULL;
+	    nvp = nvlist_next_nvpair(batch, nvp)) {
+		nvlist_t *nvl;
+
+		if (nvpair_value_nvlist(nvp, &nvl) != 0) {
+			zed_log_msg(LOG_WARNING,
+			    "Failed to lookup zevent in batch");
+			continue;
+		}
+		_zed_event_process(zcp, nvl);
+	}
+	nvlist_free(batch);
 }
@@ -22,12 +22,65 @@
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "zed.h"
 #include "zed_file.h"
 #include "zed_log.h"
 #include "zed_strings.h"
 
 #define	ZEVENT_FILENO	3
 
+/*
+ * Time in seconds after which a ZEDLET is considered hung and killed.
+ */
+#define	ZED_JOB_TIMEOUT	10
+
+/*
+ * A ZEDLET which has been forked and not yet reaped.
+ */
+struct zed_job {
+	pid_t		pid;
+	uint64_t	eid;
+	char		*prog;
+	time_t		start;
+	int		killed;
+};
+
+static struct zed_job *_zed_jobs;
+static int _zed_max_jobs = 1;
+static int _zed_num_jobs;
+static int _zed_do_builtin;
+
+/*
+ * A ZEDLET which can be run in-process instead of being forked.
+ */
+struct zed_builtin {
+	const char	*prog;
+	void		(*func)(uint64_t eid, zed_strings_t *envs);
+};
+
+static void _zed_exec_builtin_syslog(uint64_t eid, zed_strings_t *envs);
+
+static const struct zed_builtin _zed_builtins[] = {
+	{ "all-syslog.sh",	_zed_exec_builtin_syslog },
+	{ NULL,			NULL }
+};
+
+/*
+ * Set up to run up to [max_jobs] ZEDLETs at once, and the ZEDLETs which
+ * have a builtin equivalent in-process if [do_builtin] is set.
+ */
+void
+zed_exec_init(int max_jobs, int do_builtin)
+{
+	_zed_max_jobs = (max_jobs > 0) ? max_jobs : 1;
+	_zed_jobs = calloc(_zed_max_jobs, sizeof (struct zed_job));
+	if (!_zed_jobs)
+		zed_log_die("Failed to allocate job table: %s",
+		    strerror(errno));
+	_zed_num_jobs = 0;
+	_zed_do_builtin = do_builtin;
+}
+
 /*
  * Create an environment string array for passing to execve() using the
  * NAME=VALUE strings in container [zsp].
@@ -69,9 +122,105 @@ _zed_exec_create_env(zed_strings_t *zsp)
 	return ((char **)buf);
 }
 
+/*
+ * Reap the ZEDLETs which have finished, and kill those which have been
+ * running for longer than ZED_JOB_TIMEOUT.  If [wait] is set, do not return
+ * until there is room in the job table for another.
+ */
+static void
+_zed_exec_reap(int wait)
+{
+	struct zed_job *jp;
+	struct timespec t;
+	pid_t wpid;
+	int status;
+	int i;
+
+	for (;;) {
+		for (i = 0; i < _zed_max_jobs; i++) {
+			jp = &_zed_jobs[i];
+			if (jp->pid == 0)
+				continue;
+
+			wpid = waitpid(jp->pid, &status, WNOHANG);
+			if (wpid == (pid_t)-1) {
+				if (errno == EINTR)
+					continue;
+				zed_log_msg(LOG_WARNING,
+				    "Failed to wait for \"%s\" eid=%llu pid=%d",
+				    jp->prog, jp->eid, jp->pid);
+			} else if (wpid == 0) {
+				/* child still running */
+				if (!jp->killed && (time(NULL) - jp->start >=
+				    ZED_JOB_TIMEOUT)) {
+					zed_log_msg(LOG_WARNING,
+					    "Killing hung \"%s\" pid=%d",
+					    jp->prog, jp->pid);
+					(void) kill(jp->pid, SIGKILL);
+					jp->killed = 1;
+				}
+				continue;
+			} else if (WIFEXITED(status)) {
+				zed_log_msg(LOG_INFO,
+				    "Finished \"%s\" eid=%llu pid=%d exit=%d",
+				    jp->prog, jp->eid, jp->pid,
+				    WEXITSTATUS(status));
+			} else if (WIFSIGNALED(status)) {
+				zed_log_msg(LOG_INFO,
+				    "Finished \"%s\" eid=%llu pid=%d sig=%d/%s",
+				    jp->prog, jp->eid, jp->pid,
+				    WTERMSIG(status),
+				    strsignal(WTERMSIG(status)));
+			} else {
+				zed_log_msg(LOG_INFO,
+				    "Finished \"%s\" eid=%llu pid=%d "
+				    "status=0x%X", jp->prog, jp->eid, jp->pid,
+				    (unsigned int) status);
+			}
+
+			free(jp->prog);
+			memset(jp, 0, sizeof (*jp));
+			_zed_num_jobs--;
+		}
+
+		if (!wait || (_zed_num_jobs < _zed_max_jobs))
+			break;
+
+		t.tv_sec = 0;
+		t.tv_nsec = 10000000;	/* 10ms */
+		(void) nanosleep(&t, NULL);
+	}
+}
+
+/*
+ * Wait for all running ZEDLETs to finish.
+ */
+void
+zed_exec_fini(void)
+{
+	struct timespec t;
+
+	if (!_zed_jobs)
+		return;
+
+	for (;;) {
+		_zed_exec_reap(0);
+		if (_zed_num_jobs == 0)
+			break;
+
+		t.tv_sec = 0;
+		t.tv_nsec = 10000000;	/* 10ms */
+		(void) nanosleep(&t, NULL);
+	}
+	free(_zed_jobs);
+	_zed_jobs = NULL;
+}
+
 /*
  * Fork a child process to handle event [eid].  The program [prog]
  * in directory [dir] is executed with the environment [env].
+ * Up to _zed_max_jobs children run at once; if that many are already
+ * running, wait for one of them to finish first.
  *
  * The file descriptor [zfd] is the zevent_fd used to track the
  * current cursor location within the zevent nvlist.
@@ -81,11 +230,10 @@ _zed_exec_fork_child(uint64_t eid, const char *dir, const char *prog,
     char *env[], int zfd)
 {
 	char path[PATH_MAX];
+	struct zed_job *jp;
 	int n;
 	pid_t pid;
 	int fd;
-	pid_t wpid;
-	int status;
 
 	assert(dir != NULL);
 	assert(prog != NULL);
@@ -99,6 +247,8 @@ _zed_exec_fork_child(uint64_t eid, const char *dir, const char *prog,
 		    prog, eid, strerror(ENAMETOOLONG));
 		return;
 	}
+	_zed_exec_reap(1);
+
 	pid = fork();
 	if (pid < 0) {
 		zed_log_msg(LOG_WARNING,
@@ -123,56 +273,76 @@ _zed_exec_fork_child(uint64_t eid, const char *dir, const char *prog,
 	zed_log_msg(LOG_INFO, "Invoking \"%s\" eid=%llu pid=%d",
 	    prog, eid, pid);
 
-	/* FIXME: Timeout rogue child processes with sigalarm? */
+	for (jp = _zed_jobs; jp->pid != 0; jp++)
+		;
+	jp->pid = pid;
+	jp->eid = eid;
+	jp->prog = strdup(prog);
+	jp->start = time(NULL);
+	_zed_num_jobs++;
+}
 
-	/*
-	 * Wait for child process using WNOHANG to limit
-	 * the time spent waiting to 10 seconds (10,000ms).
-	 */
-	for (n = 0; n < 1000; n++) {
-		wpid = waitpid(pid, &status, WNOHANG);
-		if (wpid == (pid_t)-1) {
-			if (errno == EINTR)
-				continue;
-			zed_log_msg(LOG_WARNING,
-			    "Failed to wait for \"%s\" eid=%llu pid=%d",
-			    prog, eid, pid);
-			break;
-		} else if (wpid == 0) {
-			struct timespec t;
-
-			/* child still running */
-			t.tv_sec = 0;
-			t.tv_nsec = 10000000;	/* 10ms */
-			(void) nanosleep(&t, NULL);
-			continue;
-		}
+/*
+ * Return the value of the variable [name] in the environment [envs],
+ * or NULL if it is not set.
+ */
+static const char *
+_zed_exec_getenv(zed_strings_t *envs, const char *name)
+{
+	const char *s;
+	size_t len = strlen(name);
 
-		if (WIFEXITED(status)) {
-			zed_log_msg(LOG_INFO,
-			    "Finished \"%s\" eid=%llu pid=%d exit=%d",
-			    prog, eid, pid, WEXITSTATUS(status));
-		} else if (WIFSIGNALED(status)) {
-			zed_log_msg(LOG_INFO,
-			    "Finished \"%s\" eid=%llu pid=%d sig=%d/%s",
-			    prog, eid, pid, WTERMSIG(status),
-			    strsignal(WTERMSIG(status)));
-		} else {
-			zed_log_msg(LOG_INFO,
-			    "Finished \"%s\" eid=%llu pid=%d status=0x%X",
-			    prog, eid, (unsigned int) status);
-		}
-		break;
+	for (s = zed_strings_first(envs); s; s = zed_strings_next(envs)) {
+		if ((strncmp(s, name, len) == 0) && (s[len] == '='))
+			return (s + len + 1);
 	}
+	return (NULL);
+}
+
+/*
+ * Builtin equivalent of all-syslog.sh: log the event through zed's own log.
+ * Unlike the script, it does not source zed.rc, and so it ignores the
+ * ZED_SYSLOG_* settings there.
+ */
+static void
+_zed_exec_builtin_syslog(uint64_t eid, zed_strings_t *envs)
+{
+	const char *subclass, *pool_guid, *vdev_path, *vdev_state;
+
+	subclass = _zed_exec_getenv(envs, ZEVENT_VAR_PREFIX "SUBCLASS");
+	pool_guid = _zed_exec_getenv(envs, ZEVENT_VAR_PREFIX "POOL_GUID");
+	vdev_path = _zed_exec_getenv(envs, ZEVENT_VAR_PREFIX "VDEV_PATH");
+	vdev_state = _zed_exec_getenv(envs,
+	    ZEVENT_VAR_PREFIX "VDEV_STATE_STR");
+
+	zed_log_msg(LOG_NOTICE, "eid=%llu class=%s%s%s%s%s%s%s", eid,
+	    subclass ? subclass : "",
+	    pool_guid ? " pool_guid=" : "", pool_guid ? pool_guid : "",
+	    vdev_path ? " vdev_path=" : "", vdev_path ? vdev_path : "",
+	    vdev_state ? " vdev_state=" : "", vdev_state ? vdev_state : "");
+}
+
+/*
+ * Run ZEDLET [prog] for event [eid] in-process if it has a builtin
+ * equivalent and those are enabled.  Return 1 if it was run, 0 otherwise.
+ */
+static int
+_zed_exec_builtin(uint64_t eid, const char *prog, zed_strings_t *envs)
+{
+	const struct zed_builtin *bp;
 
-	/*
-	 * kill child process after 10 seconds
-	 */
-	if (wpid == 0) {
-		zed_log_msg(LOG_WARNING, "Killing hung \"%s\" pid=%d",
-		    prog, pid);
-		(void) kill(pid, SIGKILL);
+	if (!_zed_do_builtin)
+		return (0);
+
+	for (bp = _zed_builtins; bp->prog; bp++) {
+		if (strcmp(prog, bp->prog) == 0) {
+			zed_log_msg(LOG_INFO, "Invoking builtin \"%s\" "
+			    "eid=%llu", prog, eid);
+			bp->func(eid, envs);
+			return (1);
+		}
 	}
+	return (0);
 }
 
 /*
@@ -222,7 +392,9 @@ zed_exec_process(uint64_t eid, const char *class, const char *subclass,
 	for (z = zed_strings_first(zedlets); z; z = zed_strings_next(zedlets)) {
 		for (csp = class_strings; *csp; csp++) {
 			n = strlen(*csp);
-			if ((strncmp(z, *csp, n) == 0) && !isalpha(z[n]))
+			if ((strncmp(z, *csp, n) != 0) || isalpha(z[n]))
+				continue;
+			if (!_zed_exec_builtin(eid, z, envs))
 				_zed_exec_fork_child(eid, dir, z, e, zfd);
 		}
 	}
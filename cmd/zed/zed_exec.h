@@ -17,6 +17,10 @@
 
 #include <stdint.h>
 
+void zed_exec_init(int max_jobs, int do_builtin);
+
+void zed_exec_fini(void);
+
 int zed_exec_process(uint64_t eid, const char *class, const char *subclass,
     const char *dir, zed_strings_t *zedlets, zed_strings_t *envs,
     int zevent_fd);
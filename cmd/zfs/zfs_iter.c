@@ -65,6 +65,7 @@ typedef struct callback_data {
 	int			cb_depth_limit;
 	int			cb_depth;
 	uint8_t			cb_props_table[ZFS_NUM_PROPS];
+	nvlist_t		*cb_snap_props;
 } callback_data_t;
 
 uu_avl_pool_t *avl_pool;
@@ -149,9 +150,14 @@ zfs_callback(zfs_handle_t *zhp, void *data)
 
 		if (((zfs_get_type(zhp) & (ZFS_TYPE_SNAPSHOT |
 		    ZFS_TYPE_BOOKMARK)) == 0) && include_snaps) {
-			(void) zfs_iter_snapshots(zhp,
-			    (cb->cb_flags & ZFS_ITER_SIMPLE) != 0,
-			    zfs_callback, data, 0, 0);
+			if (cb->cb_flags & ZFS_ITER_SIMPLE) {
+				(void) zfs_iter_snapshots(zhp, B_TRUE,
+				    zfs_callback, data, 0, 0);
+			} else {
+				(void) zfs_iter_snapshots_props(zhp,
+				    cb->cb_snap_props, zfs_callback, data,
+				    0, 0);
+			}
 		}
 
 		if (((zfs_get_type(zhp) & (ZFS_TYPE_SNAPSHOT |
@@ -417,14 +423,25 @@ zfs_for_each(int argc, char **argv, int flags, zfs_type_t types,
 	 * always retain the zoned property, which some other properties
 	 * need (userquota & friends), and the createtxg property, which
 	 * we need to sort snapshots.
+	 *
+	 * Snapshots are listed with only the retained properties and the
+	 * user properties in cb_proplist/sortcol, so that the kernel does
+	 * not have to look up the others.
 	 */
 	if (cb.cb_proplist && *cb.cb_proplist) {
 		zprop_list_t *p = *cb.cb_proplist;
 
+		if (!p->pl_all)
+			cb.cb_snap_props = fnvlist_alloc();
+
 		while (p) {
 			if (p->pl_prop >= ZFS_PROP_TYPE &&
 			    p->pl_prop < ZFS_NUM_PROPS) {
 				cb.cb_props_table[p->pl_prop] = B_TRUE;
+			} else if (p->pl_prop == ZPROP_INVAL &&
+			    cb.cb_snap_props != NULL) {
+				fnvlist_add_boolean(cb.cb_snap_props,
+				    p->pl_user_prop);
 			}
 			p = p->pl_next;
 		}
@@ -433,12 +450,24 @@ zfs_for_each(int argc, char **argv, int flags, zfs_type_t types,
 			if (sortcol->sc_prop >= ZFS_PROP_TYPE &&
 			    sortcol->sc_prop < ZFS_NUM_PROPS) {
 				cb.cb_props_table[sortcol->sc_prop] = B_TRUE;
+			} else if (sortcol->sc_prop == ZPROP_INVAL &&
+			    cb.cb_snap_props != NULL) {
+				fnvlist_add_boolean(cb.cb_snap_props,
+				    sortcol->sc_user_prop);
 			}
 			sortcol = sortcol->sc_next;
 		}
 
 		cb.cb_props_table[ZFS_PROP_ZONED] = B_TRUE;
 		cb.cb_props_table[ZFS_PROP_CREATETXG] = B_TRUE;
+
+		for (zfs_prop_t prop = ZFS_PROP_TYPE;
+		    cb.cb_snap_props != NULL && prop < ZFS_NUM_PROPS; prop++) {
+			if (cb.cb_props_table[prop]) {
+				fnvlist_add_boolean(cb.cb_snap_props,
+				    zfs_prop_to_name(prop));
+			}
+		}
 	} else {
 		(void) memset(cb.cb_props_table, B_TRUE,
 		    sizeof (cb.cb_props_table));
@@ -507,6 +536,7 @@ zfs_for_each(int argc, char **argv, int flags, zfs_type_t types,
 	uu_avl_walk_end(walk);
 	uu_avl_destroy(cb.cb_avl);
 	uu_avl_pool_destroy(avl_pool);
+	fnvlist_free(cb.cb_snap_props);
 
 	return (ret);
 }
@@ -314,8 +314,8 @@ get_usage(zfs_help_t idx)
 	case HELP_SEND:
 		return (gettext("\tsend [-DnPpRvLecwhb] [-[i|I] snapshot] "
 		    "<snapshot>\n"
-		    "\tsend [-nvPLecw] [-i snapshot|bookmark] "
-		    "<filesystem|volume|snapshot>\n"
+		    "\tsend [-nvPLecw] [-i snapshot|bookmark] [-C chunk/count] "
+		    "[-Z compression] <filesystem|volume|snapshot>\n"
 		    "\tsend [-DnPpvLec] [-i bookmark|snapshot] "
 		    "--redact <bookmark> <snapshot>\n"
 		    "\tsend [-nvPe] -t <receive_resume_token>\n"));
@@ -386,7 +386,8 @@ get_usage(zfs_help_t idx)
 	case HELP_CHANNEL_PROGRAM:
 		return (gettext("\tprogram [-jn] [-t <instruction limit>] "
 		    "[-m <memory limit (b)>]\n"
-		    "\t    <pool> <program file> [lua args...]\n"));
+		    "\t    [-y <instructions per txg>] "
+		    "<pool> <program file> [lua args...]\n"));
 	case HELP_LOAD_KEY:
 		return (gettext("\tload-key [-rn] [-L <keylocation>] "
 		    "<-a | filesystem|volume>\n"));
@@ -1164,6 +1165,7 @@ typedef struct destroy_cbdata {
 	boolean_t	cb_dryrun;
 	nvlist_t	*cb_nvl;
 	nvlist_t	*cb_batchedsnaps;
+	nvlist_t	*cb_earlysnaps;
 
 	/* first snap in contiguous run */
 	char		*cb_firstsnap;
@@ -1285,6 +1287,11 @@ destroy_callback(zfs_handle_t *zhp, void *data)
 	 * because we must delete a clone before its origin.
 	 */
 	if (zfs_get_type(zhp) == ZFS_TYPE_SNAPSHOT) {
+		if (cb->cb_earlysnaps != NULL &&
+		    nvlist_exists(cb->cb_earlysnaps, name)) {
+			zfs_close(zhp);
+			return (0);
+		}
 		cb->cb_snap_count++;
 		fnvlist_add_boolean(cb->cb_batchedsnaps, name);
 		if (cb->cb_snap_count % 10 == 0 && cb->cb_defer_destroy)
@@ -1424,6 +1431,24 @@ out:
 	return (err);
 }
 
+/*
+ * Snapshots without clones can be destroyed before any of the datasets,
+ * so when destroying recursively those of all datasets are gathered into
+ * one batch, destroyed in a single txg, rather than a batch for each
+ * filesystem.
+ */
+static int
+gather_early_snapshots(zfs_handle_t *zhp, void *data)
+{
+	destroy_cbdata_t *cb = data;
+
+	if (zfs_get_type(zhp) == ZFS_TYPE_SNAPSHOT &&
+	    zfs_prop_get_int(zhp, ZFS_PROP_NUMCLONES) == 0)
+		fnvlist_add_boolean(cb->cb_earlysnaps, zfs_get_name(zhp));
+	zfs_close(zhp);
+	return (0);
+}
+
 static int
 destroy_clones(destroy_cbdata_t *cb)
 {
@@ -1663,6 +1688,22 @@ zfs_do_destroy(int argc, char **argv)
 			rv = 1;
 			goto out;
 		}
+		/*
+		 * If the batch fails, say because a snapshot is held, leave
+		 * its snapshots to be destroyed and their errors reported with
+		 * their filesystems.
+		 */
+		if (!cb.cb_dryrun && !cb.cb_defer_destroy) {
+			cb.cb_earlysnaps = fnvlist_alloc();
+			if (zfs_iter_dependents(zhp, B_FALSE,
+			    gather_early_snapshots, &cb) != 0 ||
+			    lzc_destroy_snaps(cb.cb_earlysnaps, B_FALSE,
+			    NULL) != 0) {
+				fnvlist_free(cb.cb_earlysnaps);
+				cb.cb_earlysnaps = NULL;
+			}
+		}
+
 		cb.cb_batchedsnaps = fnvlist_alloc();
 		if (zfs_iter_dependents(zhp, B_FALSE, destroy_callback,
 		    &cb) != 0) {
@@ -1686,6 +1727,7 @@ zfs_do_destroy(int argc, char **argv)
 
 out:
 	fnvlist_free(cb.cb_batchedsnaps);
+	fnvlist_free(cb.cb_earlysnaps);
 	fnvlist_free(cb.cb_nvl);
 	if (zhp != NULL)
 		zfs_close(zhp);
@@ -4224,11 +4266,13 @@ zfs_do_send(int argc, char **argv)
 		{"raw",		no_argument,		NULL, 'w'},
 		{"backup",	no_argument,		NULL, 'b'},
 		{"holds",	no_argument,		NULL, 'h'},
+		{"chunk",	required_argument,	NULL, 'C'},
+		{"stream-compress", required_argument,	NULL, 'Z'},
 		{0, 0, 0, 0}
 	};
 
 	/* check options */
-	while ((c = getopt_long(argc, argv, ":i:I:RDpvnPLeht:cwbd:",
+	while ((c = getopt_long(argc, argv, ":i:I:RDpvnPLeht:cwbd:C:Z:",
 	    long_options, NULL)) != -1) {
 		switch (c) {
 		case 'i':
@@ -4248,6 +4292,34 @@ zfs_do_send(int argc, char **argv)
 		case 'd':
 			redactbook = optarg;
 			break;
+		case 'C':
+			errno = 0;
+			flags.chunk = strtoull(optarg, &cp, 10);
+			if (errno == 0 && cp != optarg && *cp == '/') {
+				char *end;
+
+				flags.nchunks = strtoull(cp + 1, &end, 10);
+				if (errno != 0 || end == cp + 1 || *end != '\0')
+					flags.nchunks = 0;
+			}
+			if (flags.nchunks == 0 ||
+			    flags.chunk >= flags.nchunks) {
+				(void) fprintf(stderr, gettext("invalid chunk "
+				    "'%s': must be <chunk>/<count> with "
+				    "chunk < count\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case 'Z':
+			if (zfs_prop_string_to_index(ZFS_PROP_COMPRESSION,
+			    optarg, &flags.stream_compress) != 0 ||
+			    flags.stream_compress == ZIO_COMPRESS_OFF ||
+			    flags.stream_compress == ZIO_COMPRESS_ON) {
+				(void) fprintf(stderr, gettext("invalid stream "
+				    "compression '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
 		case 'p':
 			flags.props = B_TRUE;
 			break;
@@ -4365,6 +4437,21 @@ zfs_do_send(int argc, char **argv)
 		return (1);
 	}
 
+	if (flags.nchunks != 0 && (resume_token != NULL || flags.replicate ||
+	    flags.doall || flags.props || flags.backup || flags.holds ||
+	    flags.dedup || redactbook != NULL)) {
+		(void) fprintf(stderr,
+		    gettext("invalid flags combined with -C\n"));
+		usage(B_FALSE);
+	}
+
+	if (flags.stream_compress != 0 && (resume_token != NULL ||
+	    flags.replicate || flags.doall || flags.dedup)) {
+		(void) fprintf(stderr,
+		    gettext("invalid flags combined with -Z\n"));
+		usage(B_FALSE);
+	}
+
 	if (!flags.dryrun && isatty(STDOUT_FILENO)) {
 		(void) fprintf(stderr,
 		    gettext("Error: Stream can not be written to a terminal.\n"
@@ -6070,11 +6157,65 @@ zfs_do_unallow(int argc, char **argv)
 	return (zfs_do_allow_unallow_impl(argc, argv, B_TRUE));
 }
 
+/*
+ * The holds or releases of the arguments of zfs hold or release on one
+ * pool, made in a single ioctl.
+ */
+typedef struct hold_batch {
+	zfs_handle_t	*hb_zhp;	/* a dataset of the pool */
+	nvlist_t	*hb_holds;	/* of all the arguments */
+	nvlist_t	**hb_args;	/* of each argument */
+	int		hb_nargs;
+} hold_batch_t;
+
+static int
+hold_batch_nvl(zfs_handle_t *zhp, nvlist_t *holds, boolean_t holding)
+{
+	return (holding ? zfs_hold_nvl(zhp, -1, holds) :
+	    zfs_release_nvl(zhp, holds));
+}
+
+/*
+ * Apply the batch.  If that fails, apply the holds of each argument on its
+ * own instead, so that, as if they had been applied in turn, only those of
+ * the failing arguments fail and their errors are reported.
+ */
+static int
+hold_batch_flush(hold_batch_t *hb, boolean_t holding)
+{
+	int errors = 0;
+
+	if (hb->hb_nargs == 0)
+		return (0);
+
+	libzfs_print_on_error(g_zfs, B_FALSE);
+	if (hold_batch_nvl(hb->hb_zhp, hb->hb_holds, holding) != 0) {
+		libzfs_print_on_error(g_zfs, B_TRUE);
+		for (int i = 0; i < hb->hb_nargs; i++) {
+			if (hold_batch_nvl(hb->hb_zhp, hb->hb_args[i],
+			    holding) != 0)
+				errors++;
+		}
+	}
+	libzfs_print_on_error(g_zfs, B_TRUE);
+
+	for (int i = 0; i < hb->hb_nargs; i++)
+		fnvlist_free(hb->hb_args[i]);
+	fnvlist_free(hb->hb_holds);
+	hb->hb_holds = fnvlist_alloc();
+	hb->hb_nargs = 0;
+	zfs_close(hb->hb_zhp);
+	hb->hb_zhp = NULL;
+
+	return (errors);
+}
+
 static int
 zfs_do_hold_rele_impl(int argc, char **argv, boolean_t holding)
 {
 	int errors = 0;
 	int i;
+	hold_batch_t hb = { 0 };
 	const char *tag;
 	boolean_t recursive = B_FALSE;
 	const char *opts = holding ? "rt" : "r";
@@ -6110,11 +6251,20 @@ zfs_do_hold_rele_impl(int argc, char **argv, boolean_t holding)
 		usage(B_FALSE);
 	}
 
+	hb.hb_holds = fnvlist_alloc();
+	hb.hb_args = safe_malloc(argc * sizeof (nvlist_t *));
+
+	/*
+	 * Each hold or release waits for a txg to sync, so those on the same
+	 * pool are gathered and made together.
+	 */
 	for (i = 0; i < argc; ++i) {
 		zfs_handle_t *zhp;
 		char parent[ZFS_MAX_DATASET_NAME_LEN];
 		const char *delim;
 		char *path = argv[i];
+		nvlist_t *holds;
+		int ret;
 
 		delim = strchr(path, '@');
 		if (delim == NULL) {
@@ -6132,16 +6282,51 @@ zfs_do_hold_rele_impl(int argc, char **argv, boolean_t holding)
 			++errors;
 			continue;
 		}
-		if (holding) {
-			if (zfs_hold(zhp, delim+1, tag, recursive, -1) != 0)
-				++errors;
-		} else {
-			if (zfs_release(zhp, delim+1, tag, recursive) != 0)
-				++errors;
+
+		holds = fnvlist_alloc();
+		if (holding)
+			ret = zfs_hold_add(zhp, delim+1, tag, recursive, holds);
+		else
+			ret = zfs_release_add(zhp, delim+1, tag, recursive,
+			    holds);
+		if (ret != 0) {
+			fnvlist_free(holds);
+			zfs_close(zhp);
+			++errors;
+			continue;
 		}
-		zfs_close(zhp);
+
+		/*
+		 * A snapshot named again must see the outcome of the earlier
+		 * argument, as must one on another pool since lzc_hold() and
+		 * lzc_release() are limited to one pool.
+		 */
+		if (hb.hb_zhp != NULL && strcmp(zpool_get_name(
+		    zfs_get_pool_handle(hb.hb_zhp)),
+		    zpool_get_name(zfs_get_pool_handle(zhp))) != 0)
+			errors += hold_batch_flush(&hb, holding);
+		for (nvpair_t *pair = nvlist_next_nvpair(holds, NULL);
+		    pair != NULL; pair = nvlist_next_nvpair(holds, pair)) {
+			if (nvlist_exists(hb.hb_holds, nvpair_name(pair))) {
+				errors += hold_batch_flush(&hb, holding);
+				break;
+			}
+		}
+
+		for (nvpair_t *pair = nvlist_next_nvpair(holds, NULL);
+		    pair != NULL; pair = nvlist_next_nvpair(holds, pair))
+			fnvlist_add_nvpair(hb.hb_holds, pair);
+		hb.hb_args[hb.hb_nargs++] = holds;
+		if (hb.hb_zhp == NULL)
+			hb.hb_zhp = zhp;
+		else
+			zfs_close(zhp);
 	}
 
+	errors += hold_batch_flush(&hb, holding);
+	fnvlist_free(hb.hb_holds);
+	free(hb.hb_args);
+
 	return (errors != 0);
 }
 
@@ -6878,14 +7063,18 @@ share_mount(int op, int argc, char **argv)
 		pthread_mutex_init(&share_mount_state.sm_lock, NULL);
 
 		/*
-		 * libshare isn't mt-safe, so only do the operation in parallel
-		 * if we're mounting. Additionally, the key-loading option must
+		 * Shares are only issued in parallel if libshare allows it
+		 * for the batch. Additionally, the key-loading option must
 		 * be serialized so that we can prompt the user for their keys
 		 * in a consistent manner.
 		 */
+		boolean_t parallel = !(flags & MS_CRYPT);
+		if (op == OP_SHARE && !zfs_share_batch_begin(g_zfs))
+			parallel = B_FALSE;
 		zfs_foreach_mountpoint(g_zfs, cb.cb_handles, cb.cb_used,
-		    share_mount_one_cb, &share_mount_state,
-		    op == OP_MOUNT && !(flags & MS_CRYPT));
+		    share_mount_one_cb, &share_mount_state, parallel);
+		if (op == OP_SHARE)
+			zfs_share_batch_end(g_zfs);
 		ret = share_mount_state.sm_status;
 
 		for (int i = 0; i < cb.cb_used; i++)
@@ -7652,14 +7841,16 @@ zfs_do_channel_program(int argc, char **argv)
 	nvlist_t *outnvl = NULL;
 	uint64_t instrlimit = ZCP_DEFAULT_INSTRLIMIT;
 	uint64_t memlimit = ZCP_DEFAULT_MEMLIMIT;
+	uint64_t txg_instrlimit = 0;
 	boolean_t sync_flag = B_TRUE, json_output = B_FALSE;
 	zpool_handle_t *zhp;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "nt:m:j")) != -1) {
+	while ((c = getopt(argc, argv, "nt:m:jy:")) != -1) {
 		switch (c) {
 		case 't':
-		case 'm': {
+		case 'm':
+		case 'y': {
 			uint64_t arg;
 			char *endp;
 
@@ -7674,6 +7865,8 @@ zfs_do_channel_program(int argc, char **argv)
 
 			if (c == 't') {
 				instrlimit = arg;
+			} else if (c == 'y') {
+				txg_instrlimit = arg;
 			} else {
 				ASSERT3U(c, ==, 'm');
 				memlimit = arg;
@@ -7695,6 +7888,12 @@ zfs_do_channel_program(int argc, char **argv)
 		}
 	}
 
+	if (!sync_flag && txg_instrlimit != 0) {
+		(void) fprintf(stderr,
+		    gettext("-y cannot be used with -n\n"));
+		goto usage;
+	}
+
 	argc -= optind;
 	argv += optind;
 
@@ -7761,7 +7960,10 @@ zfs_do_channel_program(int argc, char **argv)
 	nvlist_t *argnvl = fnvlist_alloc();
 	fnvlist_add_string_array(argnvl, ZCP_ARG_CLIARGV, argv + 2, argc - 2);
 
-	if (sync_flag) {
+	if (sync_flag && txg_instrlimit != 0) {
+		ret = lzc_channel_program_yielding(poolname, progbuf,
+		    instrlimit, txg_instrlimit, memlimit, argnvl, &outnvl);
+	} else if (sync_flag) {
 		ret = lzc_channel_program(poolname, progbuf,
 		    instrlimit, memlimit, argnvl, &outnvl);
 	} else {
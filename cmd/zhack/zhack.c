@@ -48,6 +48,10 @@
 #include <sys/zio_compress.h>
 #include <sys/zfeature.h>
 #include <sys/dmu_tx.h>
+#include <sys/dsl_destroy.h>
+#include <sys/abd.h>
+#include <sys/arc.h>
+#include <sys/range_tree.h>
 #include <libzutil.h>
 
 extern boolean_t zfeature_checks_disable;
@@ -76,6 +80,11 @@ usage(void)
 	    "        change the refcount on the given feature\n"
 	    "        -d decrease instead of increase the refcount\n"
 	    "        -m add the feature to the label if increasing refcount\n"
+	    "    bench [-j] [-s seconds] [-t threads] <pool> [benchmark ...]\n"
+	    "        microbenchmark core primitives on a scratch dataset\n"
+	    "        -j print the results as JSON\n"
+	    "        -s <seconds> to run each benchmark for, default 1\n"
+	    "        -t <threads> to scale up to, default the CPU count\n"
 	    "\n"
 	    "    <feature> : should be a feature guid\n");
 	exit(1);
@@ -469,6 +478,451 @@ zhack_do_feature(int argc, char **argv)
 	return (0);
 }
 
+/*
+ * Microbenchmarks of core primitives, run with 1, 2, 4 ... threads up to
+ * the requested count so that their scaling with cores can be seen.  The
+ * benchmarks work on objects of a dataset created for the purpose, which is
+ * destroyed again afterwards; the block and ZAP lookups are all cache hits.
+ */
+#define	ZHACK_BENCH_DS		"zhack_bench"
+#define	ZHACK_BENCH_BLKSZ	4096
+#define	ZHACK_BENCH_BLOCKS	64
+#define	ZHACK_BENCH_ENTRIES	10000
+#define	ZHACK_BENCH_BATCH	256
+#define	ZHACK_BENCH_ABD_SIZE	(128 * 1024)
+#define	ZHACK_BENCH_SEGS	65536
+
+typedef struct zhack_bench_ctx {
+	spa_t		*zbc_spa;
+	objset_t	*zbc_os;
+	uint64_t	zbc_data_obj;	/* ZHACK_BENCH_BLOCKS blocks */
+	uint64_t	zbc_zap_obj;	/* ZHACK_BENCH_ENTRIES entries */
+	uint64_t	zbc_add_obj;	/* grown by zap_add */
+	uint64_t	zbc_pass;	/* of zap_add, to keep names unique */
+	blkptr_t	zbc_bp[ZHACK_BENCH_BLOCKS];
+	hrtime_t	zbc_deadline;
+} zhack_bench_ctx_t;
+
+typedef uint64_t zhack_bench_func_t(zhack_bench_ctx_t *, int);
+
+typedef struct zhack_bench {
+	const char		*zb_name;
+	zhack_bench_func_t	*zb_func;
+} zhack_bench_t;
+
+typedef struct zhack_bench_thread {
+	zhack_bench_ctx_t	*zbt_ctx;
+	const zhack_bench_t	*zbt_bench;
+	int			zbt_id;
+	uint64_t		zbt_ops;
+} zhack_bench_thread_t;
+
+/*
+ * Whether a benchmark which has done ops operations should go on.  The
+ * clock is only read every 64 operations.
+ */
+#define	ZHACK_BENCH_RUNNING(ctx, ops)	\
+	((ops) % 64 != 0 || gethrtime() < (ctx)->zbc_deadline)
+
+/* ARGSUSED */
+static int
+zhack_bench_abd_cb(void *buf, size_t len, void *private)
+{
+	uint64_t *sum = private;
+
+	for (size_t i = 0; i < len / sizeof (uint64_t); i++)
+		*sum += ((uint64_t *)buf)[i];
+
+	return (0);
+}
+
+/* ARGSUSED */
+static uint64_t
+zhack_bench_abd_iterate(zhack_bench_ctx_t *ctx, int id)
+{
+	abd_t *abd = abd_alloc(ZHACK_BENCH_ABD_SIZE, B_FALSE);
+	uint64_t ops, sum = 0;
+
+	abd_zero(abd, ZHACK_BENCH_ABD_SIZE);
+	for (ops = 0; ZHACK_BENCH_RUNNING(ctx, ops); ops++) {
+		(void) abd_iterate_func(abd, 0, ZHACK_BENCH_ABD_SIZE,
+		    zhack_bench_abd_cb, &sum);
+	}
+	abd_free(abd);
+
+	return (ops);
+}
+
+/* ARGSUSED */
+static uint64_t
+zhack_bench_range_tree_add(zhack_bench_ctx_t *ctx, int id)
+{
+	range_tree_t *rt = range_tree_create(NULL, NULL);
+	uint64_t ops;
+
+	for (ops = 0; ZHACK_BENCH_RUNNING(ctx, ops); ops++) {
+		uint64_t seg = ops % ZHACK_BENCH_SEGS;
+
+		if (seg == 0)
+			range_tree_vacate(rt, NULL, NULL);
+		/* Leave a gap so that every segment is a node of its own */
+		range_tree_add(rt, seg * 2, 1);
+	}
+	range_tree_vacate(rt, NULL, NULL);
+	range_tree_destroy(rt);
+
+	return (ops);
+}
+
+/* ARGSUSED */
+static uint64_t
+zhack_bench_zio_nowait(zhack_bench_ctx_t *ctx, int id)
+{
+	zio_t *rio = zio_root(ctx->zbc_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	uint64_t ops;
+
+	for (ops = 0; ZHACK_BENCH_RUNNING(ctx, ops); ops++) {
+		if (ops % 1024 == 1023) {
+			(void) zio_wait(rio);
+			rio = zio_root(ctx->zbc_spa, NULL, NULL,
+			    ZIO_FLAG_CANFAIL);
+		}
+		zio_nowait(zio_null(rio, ctx->zbc_spa, NULL, NULL, NULL, 0));
+	}
+	(void) zio_wait(rio);
+
+	return (ops);
+}
+
+static uint64_t
+zhack_bench_dbuf_hold(zhack_bench_ctx_t *ctx, int id)
+{
+	uint64_t ops;
+
+	for (ops = 0; ZHACK_BENCH_RUNNING(ctx, ops); ops++) {
+		uint64_t blk = (id + ops) % ZHACK_BENCH_BLOCKS;
+		dmu_buf_t *db;
+
+		VERIFY0(dmu_buf_hold(ctx->zbc_os, ctx->zbc_data_obj,
+		    blk * ZHACK_BENCH_BLKSZ, FTAG, &db, DMU_READ_NO_PREFETCH));
+		dmu_buf_rele(db, FTAG);
+	}
+
+	return (ops);
+}
+
+static uint64_t
+zhack_bench_arc_read(zhack_bench_ctx_t *ctx, int id)
+{
+	uint64_t ops;
+
+	for (ops = 0; ZHACK_BENCH_RUNNING(ctx, ops); ops++) {
+		uint64_t blk = (id + ops) % ZHACK_BENCH_BLOCKS;
+		arc_flags_t aflags = ARC_FLAG_WAIT;
+		arc_buf_t *abuf = NULL;
+		zbookmark_phys_t zb;
+
+		SET_BOOKMARK(&zb, dmu_objset_id(ctx->zbc_os),
+		    ctx->zbc_data_obj, 0, blk);
+		VERIFY0(arc_read(NULL, ctx->zbc_spa, &ctx->zbc_bp[blk],
+		    arc_getbuf_func, &abuf, ZIO_PRIORITY_SYNC_READ,
+		    ZIO_FLAG_CANFAIL, &aflags, &zb));
+		arc_buf_destroy(abuf, &abuf);
+	}
+
+	return (ops);
+}
+
+static uint64_t
+zhack_bench_zap_lookup(zhack_bench_ctx_t *ctx, int id)
+{
+	char name[32];
+	uint64_t ops, value;
+
+	for (ops = 0; ZHACK_BENCH_RUNNING(ctx, ops); ops++) {
+		(void) snprintf(name, sizeof (name), "e%llu",
+		    (u_longlong_t)((id + ops * 7919) % ZHACK_BENCH_ENTRIES));
+		VERIFY0(zap_lookup(ctx->zbc_os, ctx->zbc_zap_obj, name,
+		    sizeof (uint64_t), 1, &value));
+	}
+
+	return (ops);
+}
+
+/*
+ * ZHACK_BENCH_BATCH entries are added per tx, so that this measures the
+ * ZAP rather than the tx.
+ */
+static uint64_t
+zhack_bench_zap_add(zhack_bench_ctx_t *ctx, int id)
+{
+	char name[64];
+	uint64_t ops = 0;
+
+	while (ZHACK_BENCH_RUNNING(ctx, 0)) {
+		dmu_tx_t *tx = dmu_tx_create(ctx->zbc_os);
+
+		dmu_tx_hold_zap(tx, ctx->zbc_add_obj, B_TRUE, NULL);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		for (int i = 0; i < ZHACK_BENCH_BATCH; i++, ops++) {
+			(void) snprintf(name, sizeof (name), "p%llut%de%llu",
+			    (u_longlong_t)ctx->zbc_pass, id, (u_longlong_t)ops);
+			VERIFY0(zap_add(ctx->zbc_os, ctx->zbc_add_obj, name,
+			    sizeof (uint64_t), 1, &ops, tx));
+		}
+		dmu_tx_commit(tx);
+	}
+
+	return (ops);
+}
+
+static const zhack_bench_t zhack_benches[] = {
+	{ "abd_iterate_func",	zhack_bench_abd_iterate },
+	{ "range_tree_add",	zhack_bench_range_tree_add },
+	{ "zio_nowait",		zhack_bench_zio_nowait },
+	{ "dbuf_hold",		zhack_bench_dbuf_hold },
+	{ "arc_read",		zhack_bench_arc_read },
+	{ "zap_lookup",		zhack_bench_zap_lookup },
+	{ "zap_add",		zhack_bench_zap_add },
+};
+
+#define	ZHACK_BENCHES	ARRAY_SIZE(zhack_benches)
+
+static void
+zhack_bench_thread(void *arg)
+{
+	zhack_bench_thread_t *zbt = arg;
+
+	zbt->zbt_ops = zbt->zbt_bench->zb_func(zbt->zbt_ctx, zbt->zbt_id);
+}
+
+/*
+ * Run a benchmark on nthreads threads at once for the given time and
+ * return the number of operations done per second.
+ */
+static uint64_t
+zhack_bench_run(zhack_bench_ctx_t *ctx, const zhack_bench_t *zb,
+    taskq_t *tq, int nthreads, hrtime_t duration)
+{
+	zhack_bench_thread_t *zbt;
+	uint64_t ops = 0;
+	hrtime_t start;
+
+	zbt = umem_zalloc(nthreads * sizeof (*zbt), UMEM_NOFAIL);
+	ctx->zbc_pass++;
+	start = gethrtime();
+	ctx->zbc_deadline = start + duration;
+	for (int t = 0; t < nthreads; t++) {
+		zbt[t].zbt_ctx = ctx;
+		zbt[t].zbt_bench = zb;
+		zbt[t].zbt_id = t;
+		VERIFY3U(taskq_dispatch(tq, zhack_bench_thread, &zbt[t],
+		    TQ_SLEEP), !=, TASKQID_INVALID);
+	}
+	taskq_wait(tq);
+
+	for (int t = 0; t < nthreads; t++)
+		ops += zbt[t].zbt_ops;
+	umem_free(zbt, nthreads * sizeof (*zbt));
+
+	return (ops * NANOSEC / MAX(gethrtime() - start, 1));
+}
+
+/*
+ * Create the objects the benchmarks work on, and let them reach disk so
+ * that their blocks have block pointers for arc_read().
+ */
+static void
+zhack_bench_setup(zhack_bench_ctx_t *ctx)
+{
+	objset_t *os = ctx->zbc_os;
+	char name[32];
+	dmu_tx_t *tx;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, DMU_NEW_OBJECT, 0,
+	    ZHACK_BENCH_BLOCKS * ZHACK_BENCH_BLKSZ);
+	dmu_tx_hold_zap(tx, DMU_NEW_OBJECT, B_TRUE, NULL);
+	dmu_tx_hold_zap(tx, DMU_NEW_OBJECT, B_TRUE, NULL);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	ctx->zbc_data_obj = dmu_object_alloc(os, DMU_OT_UINT64_OTHER,
+	    ZHACK_BENCH_BLKSZ, DMU_OT_NONE, 0, tx);
+	for (int b = 0; b < ZHACK_BENCH_BLOCKS; b++) {
+		uint64_t buf[ZHACK_BENCH_BLKSZ / sizeof (uint64_t)];
+
+		for (int i = 0; i < ARRAY_SIZE(buf); i++)
+			buf[i] = b * ARRAY_SIZE(buf) + i;
+		dmu_write(os, ctx->zbc_data_obj, b * ZHACK_BENCH_BLKSZ,
+		    ZHACK_BENCH_BLKSZ, buf, tx);
+	}
+	ctx->zbc_zap_obj = zap_create(os, DMU_OT_ZAP_OTHER, DMU_OT_NONE, 0,
+	    tx);
+	ctx->zbc_add_obj = zap_create(os, DMU_OT_ZAP_OTHER, DMU_OT_NONE, 0,
+	    tx);
+	dmu_tx_commit(tx);
+
+	for (uint64_t e = 0; e < ZHACK_BENCH_ENTRIES; ) {
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_zap(tx, ctx->zbc_zap_obj, B_TRUE, NULL);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		for (int i = 0; i < ZHACK_BENCH_BATCH &&
+		    e < ZHACK_BENCH_ENTRIES; i++, e++) {
+			(void) snprintf(name, sizeof (name), "e%llu",
+			    (u_longlong_t)e);
+			VERIFY0(zap_add(os, ctx->zbc_zap_obj, name,
+			    sizeof (uint64_t), 1, &e, tx));
+		}
+		dmu_tx_commit(tx);
+	}
+
+	txg_wait_synced(spa_get_dsl(ctx->zbc_spa), 0);
+
+	for (int b = 0; b < ZHACK_BENCH_BLOCKS; b++) {
+		dmu_buf_t *db;
+
+		VERIFY0(dmu_buf_hold(os, ctx->zbc_data_obj,
+		    b * ZHACK_BENCH_BLKSZ, FTAG, &db, DMU_READ_NO_PREFETCH));
+		ctx->zbc_bp[b] = *dmu_buf_get_blkptr(db);
+		dmu_buf_rele(db, FTAG);
+	}
+}
+
+static void
+zhack_do_bench(int argc, char **argv)
+{
+	zhack_bench_ctx_t ctx = { 0 };
+	boolean_t json = B_FALSE, selected[ZHACK_BENCHES];
+	hrtime_t duration = SEC2NSEC(1);
+	char dsname[ZFS_MAX_DATASET_NAME_LEN];
+	int maxthreads = 0;
+	char *target;
+	taskq_t *tq;
+	int c, err;
+
+	optind = 1;
+	while ((c = getopt(argc, argv, "+js:t:")) != -1) {
+		switch (c) {
+		case 'j':
+			json = B_TRUE;
+			break;
+		case 's':
+			duration = SEC2NSEC(strtoull(optarg, NULL, 0));
+			break;
+		case 't':
+			maxthreads = atoi(optarg);
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr, "error: missing pool name\n");
+		usage();
+	}
+	target = argv[0];
+
+	for (int b = 0; b < ZHACK_BENCHES; b++)
+		selected[b] = (argc == 1);
+	for (int a = 1; a < argc; a++) {
+		int b;
+
+		for (b = 0; b < ZHACK_BENCHES; b++) {
+			if (strcmp(argv[a], zhack_benches[b].zb_name) == 0)
+				break;
+		}
+		if (b == ZHACK_BENCHES) {
+			(void) fprintf(stderr, "error: unknown benchmark: "
+			    "%s\n", argv[a]);
+			usage();
+		}
+		selected[b] = B_TRUE;
+	}
+
+	zhack_spa_open(target, B_FALSE, FTAG, &ctx.zbc_spa);
+	if (maxthreads <= 0)
+		maxthreads = boot_ncpus;
+
+	(void) snprintf(dsname, sizeof (dsname), "%s/%s", target,
+	    ZHACK_BENCH_DS);
+	err = dmu_objset_create(dsname, DMU_OST_OTHER, 0, NULL, NULL, NULL);
+	if (err != 0) {
+		fatal(ctx.zbc_spa, FTAG, "cannot create '%s': %s", dsname,
+		    strerror(err));
+	}
+	err = dmu_objset_own(dsname, DMU_OST_OTHER, B_FALSE, B_TRUE, FTAG,
+	    &ctx.zbc_os);
+	if (err != 0) {
+		(void) dsl_destroy_head(dsname);
+		fatal(ctx.zbc_spa, FTAG, "cannot open '%s': %s", dsname,
+		    strerror(err));
+	}
+	zhack_bench_setup(&ctx);
+
+	tq = taskq_create("zhack_bench", maxthreads, minclsyspri, maxthreads,
+	    maxthreads, TASKQ_PREPOPULATE);
+
+	if (json) {
+		(void) printf("{\n  \"pool\": \"%s\",\n"
+		    "  \"seconds\": %llu,\n  \"benchmarks\": [", target,
+		    (u_longlong_t)(duration / NANOSEC));
+	} else {
+		(void) printf("%-20s %8s %16s\n", "benchmark", "threads",
+		    "ops/s");
+	}
+
+	boolean_t first = B_TRUE;
+	for (int b = 0; b < ZHACK_BENCHES; b++) {
+		const zhack_bench_t *zb = &zhack_benches[b];
+
+		if (!selected[b])
+			continue;
+
+		if (json) {
+			(void) printf("%s\n    { \"name\": \"%s\", "
+			    "\"unit\": \"ops/s\", \"results\": [",
+			    first ? "" : ",", zb->zb_name);
+		}
+		first = B_FALSE;
+
+		for (int t = 1; ; t = MIN(t * 2, maxthreads)) {
+			uint64_t rate = zhack_bench_run(&ctx, zb, tq, t,
+			    duration);
+
+			if (json) {
+				(void) printf("%s\n      { \"threads\": %d, "
+				    "\"rate\": %llu }", t == 1 ? "" : ",", t,
+				    (u_longlong_t)rate);
+			} else {
+				(void) printf("%-20s %8d %16llu\n",
+				    zb->zb_name, t, (u_longlong_t)rate);
+			}
+			(void) fflush(stdout);
+			if (t == maxthreads)
+				break;
+		}
+
+		if (json)
+			(void) printf("\n    ] }");
+	}
+
+	if (json)
+		(void) printf("\n  ]\n}\n");
+
+	taskq_destroy(tq);
+	dmu_objset_disown(ctx.zbc_os, B_TRUE, FTAG);
+	err = dsl_destroy_head(dsname);
+	if (err != 0) {
+		fatal(ctx.zbc_spa, FTAG, "cannot destroy '%s': %s", dsname,
+		    strerror(err));
+	}
+
+	spa_close(ctx.zbc_spa, FTAG);
+}
+
 #define	MAX_NUM_PATHS 1024
 
 int
@@ -514,6 +968,8 @@ main(int argc, char **argv)
 
 	if (strcmp(subcommand, "feature") == 0) {
 		rv = zhack_do_feature(argc, argv);
+	} else if (strcmp(subcommand, "bench") == 0) {
+		zhack_do_bench(argc, argv);
 	} else {
 		(void) fprintf(stderr, "error: unknown subcommand: %s\n",
 		    subcommand);
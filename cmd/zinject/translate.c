@@ -364,7 +364,7 @@ translate_device(const char *pool, const char *device, err_type_t label_type,
 	 * 2). zfs label faults
 	 * 3). generic disk faults
 	 */
-	if (record->zi_timer != 0) {
+	if (record->zi_timer != 0 || record->zi_bandwidth != 0) {
 		record->zi_cmd = ZINJECT_DELAY_IO;
 	} else if (label_type != TYPE_INVAL) {
 		record->zi_cmd = ZINJECT_LABEL_FAULT;
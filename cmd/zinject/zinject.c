@@ -249,7 +249,7 @@ usage(void)
 	    "\tzinject -d device -A <degrade|fault> -D <delay secs> pool\n"
 	    "\t\tPerform a specific action on a particular device.\n"
 	    "\n"
-	    "\tzinject -d device -D latency:lanes pool\n"
+	    "\tzinject -d device -D latency:lanes[:options] [-T type] pool\n"
 	    "\n"
 	    "\t\tAdd an artificial delay to IO requests on a particular\n"
 	    "\t\tdevice, such that the requests take a minimum of 'latency'\n"
@@ -257,6 +257,14 @@ usage(void)
 	    "\t\tnumber of 'lanes' which defines the number of concurrent\n"
 	    "\t\tIO requests that can be processed.\n"
 	    "\n"
+	    "\t\tThe options, separated by commas, vary the delay:\n"
+	    "\t\t'lognormal=sigma' makes 'latency' the median of a\n"
+	    "\t\tlognormal distribution, 'bimodal=ms@percent' makes that\n"
+	    "\t\tpercentage of IOs take 'ms' instead, 'spike=ms@percent'\n"
+	    "\t\tmakes them take 'ms' longer, and 'rate=MB/s' adds the\n"
+	    "\t\ttime each lane takes to transfer the IO at that rate.\n"
+	    "\t\t'latency' may be 0 if a rate is given.\n"
+	    "\n"
 	    "\t\tFor example, with a single lane delay of 10 ms (-D 10:1),\n"
 	    "\t\tthe device will only be able to service a single IO request\n"
 	    "\t\tat a time with each request taking 10 ms to complete. So,\n"
@@ -430,19 +438,41 @@ print_delay_handler(int id, const char *pool, zinject_record_t *record,
 		return (0);
 
 	if (*count == 0) {
-		(void) printf("%3s  %-15s  %-15s  %-15s  %s\n",
-		    "ID", "POOL", "DELAY (ms)", "LANES", "GUID");
+		(void) printf("%3s  %-15s  %-15s  %-15s  %-16s  %s\n",
+		    "ID", "POOL", "DELAY (ms)", "LANES", "GUID", "VARIATION");
 		(void) printf("---  ---------------  ---------------  "
-		    "---------------  ----------------\n");
+		    "---------------  ----------------  ---------\n");
 	}
 
 	*count += 1;
 
-	(void) printf("%3d  %-15s  %-15llu  %-15llu  %llx\n", id, pool,
+	(void) printf("%3d  %-15s  %-15llu  %-15llu  %-16llx  ", id, pool,
 	    (u_longlong_t)NSEC2MSEC(record->zi_timer),
 	    (u_longlong_t)record->zi_nlanes,
 	    (u_longlong_t)record->zi_guid);
 
+	switch (record->zi_delay_dist) {
+	case ZINJECT_DELAY_LOGNORMAL:
+		(void) printf("lognormal=%.3f", record->zi_sigma / 1000.0);
+		break;
+	case ZINJECT_DELAY_BIMODAL:
+	case ZINJECT_DELAY_SPIKE:
+		(void) printf("%s=%llu@%.4f",
+		    record->zi_delay_dist == ZINJECT_DELAY_BIMODAL ?
+		    "bimodal" : "spike",
+		    (u_longlong_t)NSEC2MSEC(record->zi_timer2),
+		    record->zi_delay_freq * 100.0 / ZI_PERCENTAGE_MAX);
+		break;
+	default:
+		(void) printf("-");
+		break;
+	}
+	if (record->zi_bandwidth != 0) {
+		(void) printf(",rate=%llu",
+		    (u_longlong_t)(record->zi_bandwidth >> 20));
+	}
+	(void) printf("\n");
+
 	return (0);
 }
 
@@ -634,21 +664,76 @@ perform_action(const char *pool, zinject_record_t *record, int cmd)
 	return (1);
 }
 
+static int parse_frequency(const char *str, uint32_t *percent);
+
 static int
-parse_delay(char *str, uint64_t *delay, uint64_t *nlanes)
+parse_delay(char *str, zinject_record_t *record)
 {
 	unsigned long scan_delay;
 	unsigned long scan_nlanes;
+	unsigned long scan_ms;
+	char *opts, *value, *at, *post;
+	double val;
+	int opt;
+	char *delay_subopts[] = { "lognormal", "bimodal", "spike", "rate",
+	    NULL };
 
 	if (sscanf(str, "%lu:%lu", &scan_delay, &scan_nlanes) != 2)
 		return (1);
 
 	/*
-	 * We explicitly disallow a delay of zero here, because we key
-	 * off this value being non-zero in translate_device(), to
-	 * determine if the fault is a ZINJECT_DELAY_IO fault or not.
+	 * The lanes may be followed by options choosing how the delay
+	 * varies, e.g. "10:4:lognormal=0.5" or "0:1:rate=50".
+	 */
+	opts = strchr(strchr(str, ':') + 1, ':');
+	if (opts != NULL)
+		opts++;
+	while (opts != NULL && *opts != '\0') {
+		switch (opt = getsubopt(&opts, delay_subopts, &value)) {
+		case 0:
+			/* lognormal=<sigma> about a median of the delay */
+			if (value == NULL)
+				return (1);
+			val = strtod(value, &post);
+			if (*post != '\0' || val <= 0 || val > 10)
+				return (1);
+			record->zi_delay_dist = ZINJECT_DELAY_LOGNORMAL;
+			record->zi_sigma = (uint64_t)(val * 1000);
+			break;
+		case 1:
+		case 2:
+			/* bimodal|spike=<ms>@<percent of IOs> */
+			if (value == NULL || (at = strchr(value, '@')) == NULL)
+				return (1);
+			*at = '\0';
+			if (sscanf(value, "%lu", &scan_ms) != 1 ||
+			    parse_frequency(at + 1,
+			    &record->zi_delay_freq) != 0)
+				return (1);
+			record->zi_delay_dist = (opt == 1) ?
+			    ZINJECT_DELAY_BIMODAL : ZINJECT_DELAY_SPIKE;
+			record->zi_timer2 = MSEC2NSEC(scan_ms);
+			break;
+		case 3:
+			/* rate=<MB/s> */
+			if (value == NULL)
+				return (1);
+			val = strtod(value, &post);
+			if (*post != '\0' || val <= 0)
+				return (1);
+			record->zi_bandwidth = (uint64_t)(val * 1024 * 1024);
+			break;
+		default:
+			return (1);
+		}
+	}
+
+	/*
+	 * We explicitly disallow a delay of zero here, unless a rate is
+	 * given, because we key off these values in translate_device(),
+	 * to determine if the fault is a ZINJECT_DELAY_IO fault or not.
 	 */
-	if (scan_delay == 0)
+	if (scan_delay == 0 && record->zi_bandwidth == 0)
 		return (1);
 
 	/*
@@ -657,8 +742,8 @@ parse_delay(char *str, uint64_t *delay, uint64_t *nlanes)
 	 * Thus we scale the milliseconds to nanoseconds here, and this
 	 * nanosecond value is used to pass the delay to the kernel.
 	 */
-	*delay = MSEC2NSEC(scan_delay);
-	*nlanes = scan_nlanes;
+	record->zi_timer = MSEC2NSEC(scan_delay);
+	record->zi_nlanes = scan_nlanes;
 
 	return (0);
 }
@@ -834,8 +919,7 @@ main(int argc, char **argv)
 			break;
 		case 'D':
 			errno = 0;
-			ret = parse_delay(optarg, &record.zi_timer,
-			    &record.zi_nlanes);
+			ret = parse_delay(optarg, &record);
 			if (ret != 0) {
 
 				(void) fprintf(stderr, "invalid i/o delay "
@@ -418,6 +418,19 @@ make_leaf_vdev(nvlist_t *props, const char *arg, uint64_t is_log)
 	boolean_t wholedisk = B_FALSE;
 	uint64_t ashift = 0;
 
+	/*
+	 * Distributed spares are named after their dRAID vdev and have no
+	 * device or file of their own.
+	 */
+	if (zpool_is_draid_spare(arg)) {
+		vdev = fnvlist_alloc();
+		fnvlist_add_string(vdev, ZPOOL_CONFIG_PATH, arg);
+		fnvlist_add_string(vdev, ZPOOL_CONFIG_TYPE,
+		    VDEV_TYPE_DRAID_SPARE);
+		fnvlist_add_uint64(vdev, ZPOOL_CONFIG_IS_LOG, is_log);
+		return (vdev);
+	}
+
 	/*
 	 * Determine what type of vdev this is, and put the full path into
 	 * 'path'.  We detect whether this is a device of file afterwards by
@@ -677,7 +690,8 @@ get_replication(nvlist_t *nvroot, boolean_t fatal)
 			rep.zprl_type = type;
 			rep.zprl_children = 0;
 
-			if (strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
+			if (strcmp(type, VDEV_TYPE_RAIDZ) == 0 ||
+			    strcmp(type, VDEV_TYPE_DRAID) == 0) {
 				verify(nvlist_lookup_uint64(nv,
 				    ZPOOL_CONFIG_NPARITY,
 				    &rep.zprl_parity) == 0);
@@ -1276,6 +1290,20 @@ is_grouping(const char *type, int *mindev, int *maxdev)
 		return (VDEV_TYPE_RAIDZ);
 	}
 
+	if (strncmp(type, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) == 0) {
+		uint64_t nparity, ndata, nspares, nchildren;
+
+		if (draid_parse_type(type, &nparity, &ndata, &nspares,
+		    &nchildren) != 0)
+			return (NULL);
+
+		if (mindev != NULL)
+			*mindev = nparity + MAX(ndata, 1) + nspares;
+		if (maxdev != NULL)
+			*maxdev = VDEV_DRAID_MAX_CHILDREN;
+		return (VDEV_TYPE_DRAID);
+	}
+
 	if (maxdev != NULL)
 		*maxdev = INT_MAX;
 
@@ -1348,6 +1376,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		 */
 		if ((type = is_grouping(argv[0], &mindev, &maxdev)) != NULL) {
 			nvlist_t **child = NULL;
+			const char *grouping = argv[0];
 			int c, children = 0;
 
 			if (strcmp(type, VDEV_TYPE_SPARE) == 0) {
@@ -1500,6 +1529,15 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					    ZPOOL_CONFIG_NPARITY,
 					    mindev - 1) == 0);
 				}
+				if (strcmp(type, VDEV_TYPE_DRAID) == 0 &&
+				    draid_config_by_type(nv, grouping,
+				    children) != 0) {
+					for (c = 0; c < children; c++)
+						nvlist_free(child[c]);
+					free(child);
+					nvlist_free(nv);
+					goto spec_out;
+				}
 				verify(nvlist_add_nvlist_array(nv,
 				    ZPOOL_CONFIG_CHILDREN, child,
 				    children) == 0);
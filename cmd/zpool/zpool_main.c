@@ -181,6 +181,8 @@ enum iostat_type {
 	IOS_QUEUES = 2,
 	IOS_L_HISTO = 3,
 	IOS_RQ_HISTO = 4,
+	IOS_S_HISTO = 5,
+	IOS_PERCENTILES = 6,
 	IOS_COUNT,	/* always last element */
 };
 
@@ -190,9 +192,11 @@ enum iostat_type {
 #define	IOS_QUEUES_M	(1ULL << IOS_QUEUES)
 #define	IOS_L_HISTO_M	(1ULL << IOS_L_HISTO)
 #define	IOS_RQ_HISTO_M	(1ULL << IOS_RQ_HISTO)
+#define	IOS_S_HISTO_M	(1ULL << IOS_S_HISTO)
+#define	IOS_PERCENTILES_M	(1ULL << IOS_PERCENTILES)
 
 /* Mask of all the histo bits */
-#define	IOS_ANYHISTO_M (IOS_L_HISTO_M | IOS_RQ_HISTO_M)
+#define	IOS_ANYHISTO_M (IOS_L_HISTO_M | IOS_RQ_HISTO_M | IOS_S_HISTO_M)
 
 /*
  * Lookup table for iostat flags to nvlist names.  Basically a list
@@ -241,6 +245,20 @@ static const char *vsx_type_to_nvlist[IOS_COUNT][13] = {
 	    ZPOOL_CONFIG_VDEV_IND_TRIM_HISTO,
 	    ZPOOL_CONFIG_VDEV_AGG_TRIM_HISTO,
 	    NULL},
+	[IOS_S_HISTO] = {
+	    ZPOOL_CONFIG_VDEV_TASKQ_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_COMPRESS_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_ENCRYPT_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_CHECKSUM_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_ALLOC_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_DONE_LAT_HISTO,
+	    NULL},
+	[IOS_PERCENTILES] = {
+	    ZPOOL_CONFIG_VDEV_TOT_R_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_TOT_W_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_DISK_R_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_DISK_W_LAT_HISTO,
+	    NULL},
 };
 
 
@@ -328,7 +346,7 @@ get_usage(zpool_help_t idx)
 		return (gettext("\tadd [-fgLnP] [-o property=value] "
 		    "<pool> <vdev> ...\n"));
 	case HELP_ATTACH:
-		return (gettext("\tattach [-f] [-o property=value] "
+		return (gettext("\tattach [-fs] [-o property=value] "
 		    "<pool> <device> <new-device>\n"));
 	case HELP_CLEAR:
 		return (gettext("\tclear [-nF] <pool> [device]\n"));
@@ -357,7 +375,7 @@ get_usage(zpool_help_t idx)
 		    "\t    [--rewind-to-checkpoint] <pool | id> [newpool]\n"));
 	case HELP_IOSTAT:
 		return (gettext("\tiostat [[[-c [script1,script2,...]"
-		    "[-lq]]|[-rw]] [-T d | u] [-ghHLpPvy]\n"
+		    "[-lqt]]|[-rsw]] [-T d | u] [-ghHLpPvy]\n"
 		    "\t    [[pool ...]|[pool vdev ...]|[vdev ...]]"
 		    " [[-n] interval [count]]\n"));
 	case HELP_LABELCLEAR:
@@ -371,7 +389,7 @@ get_usage(zpool_help_t idx)
 	case HELP_ONLINE:
 		return (gettext("\tonline [-e] <pool> <device> ...\n"));
 	case HELP_REPLACE:
-		return (gettext("\treplace [-f] [-o property=value] "
+		return (gettext("\treplace [-fs] [-o property=value] "
 		    "<pool> <device> [new-device]\n"));
 	case HELP_REMOVE:
 		return (gettext("\tremove [-nps] <pool> <device> ...\n"));
@@ -381,7 +399,8 @@ get_usage(zpool_help_t idx)
 		return (gettext("\tinitialize [-c | -s] <pool> "
 		    "[<device> ...]\n"));
 	case HELP_SCRUB:
-		return (gettext("\tscrub [-s | -p] <pool> ...\n"));
+		return (gettext("\tscrub [-s | -p] [-C | -t <txg>[:<txg>]] "
+		    "<pool> ...\n"));
 	case HELP_RESILVER:
 		return (gettext("\tresilver <pool> ...\n"));
 	case HELP_TRIM:
@@ -3485,6 +3504,9 @@ static const name_and_columns_t iostat_top_labels[][IOSTAT_MAX_LABELS] =
 	[IOS_RQ_HISTO] = {{"sync_read", 2}, {"sync_write", 2},
 	    {"async_read", 2}, {"async_write", 2}, {"scrub", 2},
 	    {"trim", 2}, {NULL}},
+	[IOS_S_HISTO] = {{"pipeline_stage", 6}, {NULL}},
+	[IOS_PERCENTILES] = {{"total_read", 3}, {"total_write", 3},
+	    {"disk_read", 3}, {"disk_write", 3}, {NULL}},
 };
 
 /* Shorthand - if "columns" field not set, default to 1 column */
@@ -3501,11 +3523,17 @@ static const name_and_columns_t iostat_bottom_labels[][IOSTAT_MAX_LABELS] =
 	    {"write"}, {"read"}, {"write"}, {"scrub"}, {"trim"}, {NULL}},
 	[IOS_RQ_HISTO] = {{"ind"}, {"agg"}, {"ind"}, {"agg"}, {"ind"}, {"agg"},
 	    {"ind"}, {"agg"}, {"ind"}, {"agg"}, {"ind"}, {"agg"}, {NULL}},
+	[IOS_S_HISTO] = {{"taskq"}, {"comp"}, {"crypt"}, {"cksum"},
+	    {"alloc"}, {"done"}, {NULL}},
+	[IOS_PERCENTILES] = {{"p50"}, {"p99"}, {"p999"}, {"p50"}, {"p99"},
+	    {"p999"}, {"p50"}, {"p99"}, {"p999"}, {"p50"}, {"p99"}, {"p999"},
+	    {NULL}},
 };
 
 static const char *histo_to_title[] = {
 	[IOS_L_HISTO] = "latency",
 	[IOS_RQ_HISTO] = "req_size",
+	[IOS_S_HISTO] = "stage",
 };
 
 /*
@@ -3561,6 +3589,8 @@ default_column_width(iostat_cbdata_t *cb, enum iostat_type type)
 		[IOS_QUEUES] = 6,   /* 1M queue entries */
 		[IOS_L_HISTO] = 10, /* 1B ns = 10sec */
 		[IOS_RQ_HISTO] = 6, /* 1M queue entries */
+		[IOS_S_HISTO] = 10, /* 1B ns = 10sec */
+		[IOS_PERCENTILES] = 10, /* 1B ns = 10sec */
 	};
 
 	if (cb->cb_literal)
@@ -3994,7 +4024,7 @@ print_iostat_histo(struct stat_array *nva, unsigned int len,
 
 	for (j = start_bucket; j < buckets; j++) {
 		/* Print histogram bucket label */
-		if (cb->cb_flags & IOS_L_HISTO_M) {
+		if (cb->cb_flags & (IOS_L_HISTO_M | IOS_S_HISTO_M)) {
 			/* Ending range of this bucket */
 			val = (1UL << (j + 1)) - 1;
 			zfs_nicetime(val, buf, sizeof (buf));
@@ -4113,6 +4143,67 @@ single_histo_average(uint64_t *histo, unsigned int buckets)
 	return (count == 0 ? 0 : total / count);
 }
 
+/*
+ * Calculate a percentile of a power-of-two latency histogram, interpolating
+ * linearly within the bucket it falls in.
+ */
+static uint64_t
+single_histo_percentile(uint64_t *histo, unsigned int buckets,
+    double percentile)
+{
+	int i;
+	uint64_t count = 0;
+	double rank, total = 0;
+
+	for (i = 0; i < buckets; i++)
+		count += histo[i];
+
+	if (count == 0)
+		return (0);
+
+	rank = count * percentile / 100;
+	for (i = 0; i < buckets; i++) {
+		if (histo[i] != 0 && total + histo[i] >= rank) {
+			/* Bucket i holds the latencies from 2^i to 2^(i+1) */
+			double frac = (rank - total) / histo[i];
+			return ((1ULL << i) + (uint64_t)((1ULL << i) * frac));
+		}
+		total += histo[i];
+	}
+
+	return (1ULL << (buckets - 1));
+}
+
+static void
+print_iostat_percentiles(iostat_cbdata_t *cb, nvlist_t *oldnv,
+    nvlist_t *newnv)
+{
+	int i, j;
+	const double percentiles[] = { 50, 99, 99.9 };
+	const char **names = vsx_type_to_nvlist[IOS_PERCENTILES];
+	unsigned int names_len = str_array_len(names);
+	struct stat_array *nva;
+
+	unsigned int column_width = default_column_width(cb, IOS_PERCENTILES);
+	enum zfs_nicenum_format format;
+
+	nva = calc_and_alloc_stats_ex(names, names_len, oldnv, newnv);
+
+	if (cb->cb_literal)
+		format = ZFS_NICENUM_RAWTIME;
+	else
+		format = ZFS_NICENUM_TIME;
+
+	for (i = 0; i < names_len; i++) {
+		for (j = 0; j < ARRAY_SIZE(percentiles); j++) {
+			print_one_stat(single_histo_percentile(nva[i].data,
+			    nva[i].count, percentiles[j]), format,
+			    column_width, cb->cb_scripted);
+		}
+	}
+	free_calc_stats(nva, names_len);
+}
+
 static void
 print_iostat_queues(iostat_cbdata_t *cb, nvlist_t *oldnv,
     nvlist_t *newnv)
@@ -4338,6 +4429,8 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 		print_iostat_latency(cb, oldnv, newnv);
 	if (cb->cb_flags & IOS_QUEUES_M)
 		print_iostat_queues(cb, oldnv, newnv);
+	if (cb->cb_flags & IOS_PERCENTILES_M)
+		print_iostat_percentiles(cb, oldnv, newnv);
 	if (cb->cb_flags & IOS_ANYHISTO_M) {
 		printf("\n");
 		print_iostat_histos(cb, oldnv, newnv, scale, name);
@@ -4488,7 +4581,7 @@ refresh_iostat(zpool_handle_t *zhp, void *data)
 	/*
 	 * If the pool has disappeared, remove it from the list and continue.
 	 */
-	if (zpool_refresh_stats(zhp, &missing) != 0)
+	if (zpool_refresh_vdev_stats(zhp, &missing) != 0)
 		return (-1);
 
 	if (missing)
@@ -5018,7 +5111,7 @@ get_namewidth_iostat(zpool_handle_t *zhp, void *data)
 }
 
 /*
- * zpool iostat [[-c [script1,script2,...]] [-lq]|[-rw]] [-ghHLpPvy] [-n name]
+ * zpool iostat [[-c [script1,script2,...]] [-lq]|[-rsw]] [-ghHLpPvy] [-n name]
  *              [-T d|u] [[ pool ...]|[pool vdev ...]|[vdev ...]]
  *              [interval [count]]
  *
@@ -5035,6 +5128,7 @@ get_namewidth_iostat(zpool_handle_t *zhp, void *data)
  *	-q	Display queue depths
  *	-w	Display latency histograms
  *	-r	Display request size histogram
+ *	-s	Display pipeline stage latency histograms
  *	-T	Display a timestamp in date(1) or Unix format
  *	-n	Only print headers once
  *
@@ -5057,6 +5151,7 @@ zpool_do_iostat(int argc, char **argv)
 	zpool_list_t *list;
 	boolean_t verbose = B_FALSE;
 	boolean_t latency = B_FALSE, l_histo = B_FALSE, rq_histo = B_FALSE;
+	boolean_t s_histo = B_FALSE, percentiles = B_FALSE;
 	boolean_t queues = B_FALSE, parsable = B_FALSE, scripted = B_FALSE;
 	boolean_t omit_since_boot = B_FALSE;
 	boolean_t guid = B_FALSE;
@@ -5068,12 +5163,13 @@ zpool_do_iostat(int argc, char **argv)
 
 	/* Used for printing error message */
 	const char flag_to_arg[] = {[IOS_LATENCY] = 'l', [IOS_QUEUES] = 'q',
-	    [IOS_L_HISTO] = 'w', [IOS_RQ_HISTO] = 'r'};
+	    [IOS_L_HISTO] = 'w', [IOS_RQ_HISTO] = 'r', [IOS_S_HISTO] = 's',
+	    [IOS_PERCENTILES] = 't'};
 
 	uint64_t unsupported_flags;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "c:gLPT:vyhplqrwnH")) != -1) {
+	while ((c = getopt(argc, argv, "c:gLPT:vyhplqrstwnH")) != -1) {
 		switch (c) {
 		case 'c':
 			if (cmd != NULL) {
@@ -5124,6 +5220,9 @@ zpool_do_iostat(int argc, char **argv)
 		case 'q':
 			queues = B_TRUE;
 			break;
+		case 't':
+			percentiles = B_TRUE;
+			break;
 		case 'H':
 			scripted = B_TRUE;
 			break;
@@ -5133,6 +5232,9 @@ zpool_do_iostat(int argc, char **argv)
 		case 'r':
 			rq_histo = B_TRUE;
 			break;
+		case 's':
+			s_histo = B_TRUE;
+			break;
 		case 'y':
 			omit_since_boot = B_TRUE;
 			break;
@@ -5240,18 +5342,20 @@ zpool_do_iostat(int argc, char **argv)
 		return (1);
 	}
 
-	if ((l_histo || rq_histo) && (cmd != NULL || latency || queues)) {
+	if ((l_histo || rq_histo || s_histo) &&
+	    (cmd != NULL || latency || queues || percentiles)) {
 		pool_list_free(list);
 		(void) fprintf(stderr,
-		    gettext("[-r|-w] isn't allowed with [-c|-l|-q]\n"));
+		    gettext("[-r|-s|-w] isn't allowed with [-c|-l|-q|-t]\n"));
 		usage(B_FALSE);
 		return (1);
 	}
 
-	if (l_histo && rq_histo) {
+	if (l_histo + rq_histo + s_histo > 1) {
 		pool_list_free(list);
 		(void) fprintf(stderr,
-		    gettext("Only one of [-r|-w] can be passed at a time\n"));
+		    gettext("Only one of [-r|-s|-w] can be passed at a "
+		    "time\n"));
 		usage(B_FALSE);
 		return (1);
 	}
@@ -5270,12 +5374,16 @@ zpool_do_iostat(int argc, char **argv)
 		cb.cb_flags = IOS_L_HISTO_M;
 	} else if (rq_histo) {
 		cb.cb_flags = IOS_RQ_HISTO_M;
+	} else if (s_histo) {
+		cb.cb_flags = IOS_S_HISTO_M;
 	} else {
 		cb.cb_flags = IOS_DEFAULT_M;
 		if (latency)
 			cb.cb_flags |= IOS_LATENCY_M;
 		if (queues)
 			cb.cb_flags |= IOS_QUEUES_M;
+		if (percentiles)
+			cb.cb_flags |= IOS_PERCENTILES_M;
 	}
 
 	/*
@@ -5948,6 +6056,7 @@ static int
 zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 {
 	boolean_t force = B_FALSE;
+	boolean_t rebuild = B_FALSE;
 	int c;
 	nvlist_t *nvroot;
 	char *poolname, *old_disk, *new_disk;
@@ -5957,7 +6066,7 @@ zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 	int ret;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "fo:")) != -1) {
+	while ((c = getopt(argc, argv, "fo:s")) != -1) {
 		switch (c) {
 		case 'f':
 			force = B_TRUE;
@@ -5975,6 +6084,9 @@ zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 			    (add_prop_list(optarg, propval, &props, B_TRUE)))
 				usage(B_FALSE);
 			break;
+		case 's':
+			rebuild = B_TRUE;
+			break;
 		case '?':
 			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
 			    optopt);
@@ -6056,7 +6168,8 @@ zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 		return (1);
 	}
 
-	ret = zpool_vdev_attach(zhp, old_disk, new_disk, nvroot, replacing);
+	ret = zpool_vdev_attach(zhp, old_disk, new_disk, nvroot, replacing,
+	    rebuild);
 
 	nvlist_free(props);
 	nvlist_free(nvroot);
@@ -6066,9 +6179,10 @@ zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 }
 
 /*
- * zpool replace [-f] <pool> <device> <new_device>
+ * zpool replace [-fs] <pool> <device> <new_device>
  *
  *	-f	Force attach, even if <new_device> appears to be in use.
+ *	-s	Use sequential instead of healing reconstruction for resilver.
  *
  * Replace <device> with <new_device>.
  */
@@ -6080,9 +6194,10 @@ zpool_do_replace(int argc, char **argv)
 }
 
 /*
- * zpool attach [-f] [-o property=value] <pool> <device> <new_device>
+ * zpool attach [-fs] [-o property=value] <pool> <device> <new_device>
  *
  *	-f	Force attach, even if <new_device> appears to be in use.
+ *	-s	Use sequential instead of healing reconstruction for resilver.
  *	-o	Set property=value.
  *
  * Attach <new_device> to the mirror containing <device>.  If <device> is not
@@ -6653,6 +6768,7 @@ typedef struct scrub_cbdata {
 	int	cb_argc;
 	char	**cb_argv;
 	pool_scrub_cmd_t cb_scrub_cmd;
+	nvlist_t *cb_range;
 } scrub_cbdata_t;
 
 static boolean_t
@@ -6696,7 +6812,8 @@ scrub_callback(zpool_handle_t *zhp, void *data)
 		return (1);
 	}
 
-	err = zpool_scan(zhp, cb->cb_type, cb->cb_scrub_cmd);
+	err = zpool_scan_range(zhp, cb->cb_type, cb->cb_scrub_cmd,
+	    cb->cb_range);
 
 	if (err == 0 && zpool_has_checkpoint(zhp) &&
 	    cb->cb_type == POOL_SCAN_SCRUB) {
@@ -6709,22 +6826,27 @@ scrub_callback(zpool_handle_t *zhp, void *data)
 }
 
 /*
- * zpool scrub [-s | -p] <pool> ...
+ * zpool scrub [-s | -p] [-C | -t <txg>[:<txg>]] <pool> ...
  *
  *	-s	Stop.  Stops any in-progress scrub.
  *	-p	Pause. Pause in-progress scrub.
+ *	-C	Only scrub blocks written since the last completed scrub.
+ *	-t	Only scrub blocks written in the given range of txgs.
  */
 int
 zpool_do_scrub(int argc, char **argv)
 {
-	int c;
+	int c, ret;
 	scrub_cbdata_t cb;
+	uint64_t txg_start, txg_end = 0;
+	char *end;
 
 	cb.cb_type = POOL_SCAN_SCRUB;
 	cb.cb_scrub_cmd = POOL_SCRUB_NORMAL;
+	cb.cb_range = NULL;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "sp")) != -1) {
+	while ((c = getopt(argc, argv, "spCt:")) != -1) {
 		switch (c) {
 		case 's':
 			cb.cb_type = POOL_SCAN_NONE;
@@ -6732,6 +6854,37 @@ zpool_do_scrub(int argc, char **argv)
 		case 'p':
 			cb.cb_scrub_cmd = POOL_SCRUB_PAUSE;
 			break;
+		case 'C':
+		case 't':
+			if (cb.cb_range != NULL) {
+				(void) fprintf(stderr, gettext("invalid option "
+				    "combination: -C and -t are mutually "
+				    "exclusive\n"));
+				usage(B_FALSE);
+			}
+			cb.cb_range = fnvlist_alloc();
+			if (c == 'C') {
+				fnvlist_add_boolean(cb.cb_range,
+				    ZPOOL_SCAN_CONTINUE);
+				break;
+			}
+			errno = 0;
+			txg_start = strtoull(optarg, &end, 10);
+			if (errno == 0 && *end == ':')
+				txg_end = strtoull(end + 1, &end, 10);
+			if (errno != 0 || *end != '\0' || end == optarg ||
+			    (txg_end != 0 && txg_end <= txg_start)) {
+				(void) fprintf(stderr, gettext("invalid txg "
+				    "range '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			fnvlist_add_uint64(cb.cb_range, ZPOOL_SCAN_TXG_START,
+			    txg_start);
+			if (txg_end != 0) {
+				fnvlist_add_uint64(cb.cb_range,
+				    ZPOOL_SCAN_TXG_END, txg_end);
+			}
+			break;
 		case '?':
 			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
 			    optopt);
@@ -6746,6 +6899,13 @@ zpool_do_scrub(int argc, char **argv)
 		usage(B_FALSE);
 	}
 
+	if (cb.cb_range != NULL && (cb.cb_type == POOL_SCAN_NONE ||
+	    cb.cb_scrub_cmd == POOL_SCRUB_PAUSE)) {
+		(void) fprintf(stderr, gettext("invalid option combination: "
+		    "-C and -t can only be used to start a scrub\n"));
+		usage(B_FALSE);
+	}
+
 	cb.cb_argc = argc;
 	cb.cb_argv = argv;
 	argc -= optind;
@@ -6756,7 +6916,10 @@ zpool_do_scrub(int argc, char **argv)
 		usage(B_FALSE);
 	}
 
-	return (for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb));
+	ret = for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb);
+	nvlist_free(cb.cb_range);
+
+	return (ret);
 }
 
 /*
@@ -6772,6 +6935,7 @@ zpool_do_resilver(int argc, char **argv)
 
 	cb.cb_type = POOL_SCAN_RESILVER;
 	cb.cb_scrub_cmd = POOL_SCRUB_NORMAL;
+	cb.cb_range = NULL;
 	cb.cb_argc = argc;
 	cb.cb_argv = argv;
 
@@ -7044,6 +7208,15 @@ print_scan_status(pool_scan_stat_t *ps)
 		    scanned_buf, issued_buf, total_buf);
 	}
 
+	if (ps->pss_func == POOL_SCAN_RESILVER && ps->pss_prio_issued != 0) {
+		char prio_buf[7];
+
+		zfs_nicebytes(ps->pss_prio_issued, prio_buf,
+		    sizeof (prio_buf));
+		(void) printf(gettext("\t%s of metadata and at-risk blocks "
+		    "issued first\n"), prio_buf);
+	}
+
 	if (ps->pss_func == POOL_SCAN_RESILVER) {
 		(void) printf(gettext("\t%s resilvered, %.2f%% done"),
 		    processed_buf, 100 * fraction_done);
@@ -7068,6 +7241,121 @@ print_scan_status(pool_scan_stat_t *ps)
 	}
 }
 
+/*
+ * Print out detailed sequential resilver (rebuild) status for each
+ * top-level vdev which has been rebuilt.
+ */
+static void
+print_rebuild_status(zpool_handle_t *zhp, nvlist_t *nvroot)
+{
+	nvlist_t **child;
+	uint_t children;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return;
+
+	for (uint_t c = 0; c < children; c++) {
+		vdev_rebuild_stat_t *vrs;
+		uint64_t elapsed, total_secs_left;
+		uint64_t days_left, hours_left, mins_left, secs_left;
+		uint64_t scan_rate, issue_rate;
+		char bytes_scanned[7], bytes_issued[7], bytes_rebuilt[7];
+		char bytes_est[7], srate_buf[7], irate_buf[7];
+		time_t start, end;
+		uint_t i;
+		char *vname;
+
+		if (nvlist_lookup_uint64_array(child[c],
+		    ZPOOL_CONFIG_REBUILD_STATS, (uint64_t **)&vrs, &i) != 0)
+			continue;
+
+		if (vrs->vrs_state == VDEV_REBUILD_NONE)
+			continue;
+
+		vname = zpool_vdev_name(g_zfs, zhp, child[c],
+		    VDEV_NAME_TYPE_ID);
+		start = vrs->vrs_start_time;
+		end = vrs->vrs_end_time;
+
+		zfs_nicebytes(vrs->vrs_bytes_scanned, bytes_scanned,
+		    sizeof (bytes_scanned));
+		zfs_nicebytes(vrs->vrs_bytes_issued, bytes_issued,
+		    sizeof (bytes_issued));
+		zfs_nicebytes(vrs->vrs_bytes_rebuilt, bytes_rebuilt,
+		    sizeof (bytes_rebuilt));
+		zfs_nicebytes(vrs->vrs_bytes_est, bytes_est,
+		    sizeof (bytes_est));
+
+		if (vrs->vrs_state == VDEV_REBUILD_COMPLETE) {
+			total_secs_left = end - start;
+			days_left = total_secs_left / 60 / 60 / 24;
+			hours_left = (total_secs_left / 60 / 60) % 24;
+			mins_left = (total_secs_left / 60) % 60;
+			secs_left = (total_secs_left % 60);
+
+			(void) printf(gettext("  scan: resilvered (%s) %s "
+			    "in %llu days %02llu:%02llu:%02llu "
+			    "with %llu errors on %s"), vname, bytes_rebuilt,
+			    (u_longlong_t)days_left, (u_longlong_t)hours_left,
+			    (u_longlong_t)mins_left, (u_longlong_t)secs_left,
+			    (u_longlong_t)vrs->vrs_errors, ctime(&end));
+			free(vname);
+			continue;
+		} else if (vrs->vrs_state == VDEV_REBUILD_CANCELED) {
+			(void) printf(gettext("  scan: resilver (%s) "
+			    "canceled on %s"), vname, ctime(&end));
+			free(vname);
+			continue;
+		}
+
+		assert(vrs->vrs_state == VDEV_REBUILD_ACTIVE);
+
+		(void) printf(gettext("  scan: resilver (%s) in progress "
+		    "since %s"), vname, ctime(&start));
+
+		/* elapsed time for this pass, rounding up to 1 if it's 0 */
+		elapsed = vrs->vrs_pass_time_ms / 1000;
+		elapsed = (elapsed != 0) ? elapsed : 1;
+
+		scan_rate = vrs->vrs_pass_bytes_scanned / elapsed;
+		issue_rate = vrs->vrs_pass_bytes_issued / elapsed;
+		total_secs_left = (issue_rate != 0 &&
+		    vrs->vrs_bytes_est >= vrs->vrs_bytes_issued) ?
+		    ((vrs->vrs_bytes_est - vrs->vrs_bytes_issued) /
+		    issue_rate) : UINT64_MAX;
+
+		days_left = total_secs_left / 60 / 60 / 24;
+		hours_left = (total_secs_left / 60 / 60) % 24;
+		mins_left = (total_secs_left / 60) % 60;
+		secs_left = (total_secs_left % 60);
+
+		zfs_nicebytes(scan_rate, srate_buf, sizeof (srate_buf));
+		zfs_nicebytes(issue_rate, irate_buf, sizeof (irate_buf));
+
+		(void) printf(gettext("\t%s scanned at %s/s, "
+		    "%s issued at %s/s, %s total\n"), bytes_scanned,
+		    srate_buf, bytes_issued, irate_buf, bytes_est);
+
+		(void) printf(gettext("\t%s resilvered, %.2f%% done"),
+		    bytes_rebuilt, vrs->vrs_bytes_est == 0 ? 0.0 :
+		    100.0 * vrs->vrs_bytes_issued / vrs->vrs_bytes_est);
+
+		if (total_secs_left != UINT64_MAX &&
+		    issue_rate >= 10 * 1024 * 1024) {
+			(void) printf(gettext(", %llu days "
+			    "%02llu:%02llu:%02llu to go\n"),
+			    (u_longlong_t)days_left, (u_longlong_t)hours_left,
+			    (u_longlong_t)mins_left, (u_longlong_t)secs_left);
+		} else {
+			(void) printf(gettext(", no estimated "
+			    "completion time\n"));
+		}
+
+		free(vname);
+	}
+}
+
 /*
  * As we don't scrub checkpointed blocks, we want to warn the
  * user that we skipped scanning some blocks if a checkpoint exists
@@ -7207,6 +7495,99 @@ print_removal_status(zpool_handle_t *zhp, pool_removal_stat_t *prs)
 	}
 }
 
+static void
+print_raidz_expand_status(zpool_handle_t *zhp, pool_raidz_expand_stat_t *pres)
+{
+	char copied_buf[7], total_buf[7], rate_buf[7];
+	time_t start, end;
+	nvlist_t *config, *nvroot;
+	nvlist_t **child;
+	uint_t children;
+	char *vdev_name;
+
+	if (pres == NULL || pres->pres_state == DSS_NONE)
+		return;
+
+	/*
+	 * Determine name of vdev.
+	 */
+	config = zpool_get_config(zhp, NULL);
+	nvroot = fnvlist_lookup_nvlist(config,
+	    ZPOOL_CONFIG_VDEV_TREE);
+	verify(nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) == 0);
+	assert(pres->pres_expanding_vdev < children);
+	vdev_name = zpool_vdev_name(g_zfs, zhp,
+	    child[pres->pres_expanding_vdev], VDEV_NAME_TYPE_ID);
+
+	(void) printf(gettext("expand: "));
+
+	start = pres->pres_start_time;
+	end = pres->pres_end_time;
+	zfs_nicenum(pres->pres_reflowed, copied_buf, sizeof (copied_buf));
+
+	/*
+	 * Expansion is finished.
+	 */
+	if (pres->pres_state == DSS_FINISHED) {
+		uint64_t minutes_taken = (end - start) / 60;
+
+		(void) printf(gettext("Expansion of %s copied %s "
+		    "in %lluh%um, completed on %s"),
+		    vdev_name, copied_buf,
+		    (u_longlong_t)(minutes_taken / 60),
+		    (uint_t)(minutes_taken % 60),
+		    ctime((time_t *)&end));
+	} else {
+		uint64_t copied, total, elapsed, mins_left, hours_left;
+		double fraction_done;
+		uint_t rate;
+
+		assert(pres->pres_state == DSS_SCANNING);
+
+		/*
+		 * Expansion is in progress.
+		 */
+		(void) printf(gettext(
+		    "Expansion of %s in progress since %s"),
+		    vdev_name, ctime(&start));
+
+		copied = pres->pres_reflowed > 0 ? pres->pres_reflowed : 1;
+		total = pres->pres_to_reflow > copied ?
+		    pres->pres_to_reflow : copied;
+		fraction_done = (double)copied / total;
+
+		/* elapsed time for this pass */
+		elapsed = time(NULL) - pres->pres_start_time;
+		elapsed = elapsed > 0 ? elapsed : 1;
+		rate = copied / elapsed;
+		rate = rate > 0 ? rate : 1;
+		mins_left = ((total - copied) / rate) / 60;
+		hours_left = mins_left / 60;
+
+		zfs_nicenum(copied, copied_buf, sizeof (copied_buf));
+		zfs_nicenum(total, total_buf, sizeof (total_buf));
+		zfs_nicenum(rate, rate_buf, sizeof (rate_buf));
+
+		/*
+		 * do not print estimated time if hours_left is more than
+		 * 30 days
+		 */
+		(void) printf(gettext("    %s copied out of %s at %s/s, "
+		    "%.2f%% done"),
+		    copied_buf, total_buf, rate_buf, 100 * fraction_done);
+		if (hours_left < (30 * 24)) {
+			(void) printf(gettext(", %lluh%um to go\n"),
+			    (u_longlong_t)hours_left, (uint_t)(mins_left % 60));
+		} else {
+			(void) printf(gettext(
+			    ", (copy is slow, no estimated time)\n"));
+		}
+	}
+
+	free(vdev_name);
+}
+
 static void
 print_checkpoint_status(pool_checkpoint_stat_t *pcs)
 {
@@ -7683,6 +8064,7 @@ status_callback(zpool_handle_t *zhp, void *data)
 		pool_checkpoint_stat_t *pcs = NULL;
 		pool_scan_stat_t *ps = NULL;
 		pool_removal_stat_t *prs = NULL;
+		pool_raidz_expand_stat_t *pres = NULL;
 
 		(void) nvlist_lookup_uint64_array(nvroot,
 		    ZPOOL_CONFIG_CHECKPOINT_STATS, (uint64_t **)&pcs, &c);
@@ -7690,10 +8072,14 @@ status_callback(zpool_handle_t *zhp, void *data)
 		    ZPOOL_CONFIG_SCAN_STATS, (uint64_t **)&ps, &c);
 		(void) nvlist_lookup_uint64_array(nvroot,
 		    ZPOOL_CONFIG_REMOVAL_STATS, (uint64_t **)&prs, &c);
+		(void) nvlist_lookup_uint64_array(nvroot,
+		    ZPOOL_CONFIG_RAIDZ_EXPAND_STATS, (uint64_t **)&pres, &c);
 
 		print_scan_status(ps);
+		print_rebuild_status(zhp, nvroot);
 		print_checkpoint_scan_warning(ps, pcs);
 		print_removal_status(zhp, prs);
+		print_raidz_expand_status(zhp, pres);
 		print_checkpoint_status(pcs);
 
 		cbp->cb_namewidth = max_width(zhp, nvroot, 0, 0,
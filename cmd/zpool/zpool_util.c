@@ -28,6 +28,7 @@
 #include <libintl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <ctype.h>
 
@@ -137,3 +138,100 @@ lowbit64(uint64_t i)
 
 	return (__builtin_ffsll(i));
 }
+
+/*
+ * Parse a dRAID vdev type of the form
+ * "draid[<parity>][:<data>d][:<spares>s][:<children>c]".  Values which are
+ * not given are returned as zero, except for the parity which defaults to
+ * one.  Returns -1 if the type is not a valid dRAID type.
+ */
+int
+draid_parse_type(const char *type, uint64_t *nparity, uint64_t *ndata,
+    uint64_t *nspares, uint64_t *nchildren)
+{
+	const char *p = type + strlen(VDEV_TYPE_DRAID);
+	char *end;
+
+	if (strncmp(type, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) != 0)
+		return (-1);
+
+	*nparity = 1;
+	*ndata = *nspares = *nchildren = 0;
+
+	if (*p == '0')
+		return (-1); /* no zero prefixes allowed */
+	if (isdigit(*p)) {
+		errno = 0;
+		*nparity = strtoull(p, &end, 10);
+		if (errno != 0 || *nparity < 1 ||
+		    *nparity > VDEV_DRAID_MAXPARITY)
+			return (-1);
+		p = end;
+	}
+
+	while (*p == ':') {
+		uint64_t val;
+
+		p++;
+		if (!isdigit(*p))
+			return (-1);
+		errno = 0;
+		val = strtoull(p, &end, 10);
+		if (errno != 0 || val > VDEV_DRAID_MAX_CHILDREN)
+			return (-1);
+
+		switch (*end) {
+		case 'd':
+			if (val == 0)
+				return (-1);
+			*ndata = val;
+			break;
+		case 's':
+			*nspares = val;
+			break;
+		case 'c':
+			*nchildren = val;
+			break;
+		default:
+			return (-1);
+		}
+		p = end + 1;
+	}
+
+	return (*p == '\0' ? 0 : -1);
+}
+
+/*
+ * Add the layout of a dRAID vdev of the given type and number of children
+ * to its config.  When not given, the number of data devices per
+ * redundancy group defaults to 8, or as many as there are children for.
+ */
+int
+draid_config_by_type(nvlist_t *nv, const char *type, uint64_t children)
+{
+	uint64_t nparity, ndata, nspares, nchildren;
+
+	if (draid_parse_type(type, &nparity, &ndata, &nspares,
+	    &nchildren) != 0 || (nchildren != 0 && nchildren != children)) {
+		(void) fprintf(stderr, gettext("invalid vdev specification: "
+		    "%s does not match %llu devices\n"), type,
+		    (u_longlong_t)children);
+		return (EINVAL);
+	}
+
+	if (ndata == 0 && children > nparity + nspares)
+		ndata = MIN(8, children - nparity - nspares);
+
+	if (ndata == 0 || ndata + nparity + nspares > children) {
+		(void) fprintf(stderr, gettext("invalid vdev specification: "
+		    "%s requires at least %llu devices\n"), type,
+		    (u_longlong_t)(MAX(ndata, 1) + nparity + nspares));
+		return (EINVAL);
+	}
+
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_NPARITY, nparity);
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_NDATA, ndata);
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_NSPARES, nspares);
+
+	return (0);
+}
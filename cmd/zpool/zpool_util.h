@@ -46,6 +46,13 @@ int zfs_isnumber(char *str);
 int highbit64(uint64_t i);
 int lowbit64(uint64_t i);
 
+/*
+ * dRAID utility functions
+ */
+int draid_parse_type(const char *type, uint64_t *nparity, uint64_t *ndata,
+    uint64_t *nspares, uint64_t *nchildren);
+int draid_config_by_type(nvlist_t *nv, const char *type, uint64_t children);
+
 /*
  * Misc utility functions
  */
@@ -31,13 +31,17 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
 #include <libnvpair.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <thread_pool.h>
 
+#include <sys/avl.h>
 #include <sys/dmu.h>
 #include <sys/zfs_ioctl.h>
 #include <sys/zio.h>
@@ -58,14 +62,94 @@ FILE *send_stream = 0;
 boolean_t do_byteswap = B_FALSE;
 boolean_t do_cksum = B_TRUE;
 
+/*
+ * Parallel checksum verification.
+ *
+ * The stream checksum is a running fletcher-4 over every byte of the
+ * stream, and each record header carries the value it had just before the
+ * header's own checksum field.  With -j the payloads are checksummed from
+ * zero by a pool of threads while the stream is read, and the results are
+ * folded into the running checksum in stream order with fletcher_4_combine()
+ * as records are retired from a window of CKSUM_WINDOW records per thread.
+ * Header checksums are therefore verified a window behind the record being
+ * printed.  BEGIN and END records drain the window and are handled as
+ * without -j, so END checksum mismatches are reported in order.
+ */
+#define	CKSUM_WINDOW	4
+#define	CKSUM_HDR_LEN	\
+	offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum)
+
+typedef struct cksum_hdr {
+	zio_cksum_t	ch_hdr;		/* header up to drr_checksum */
+	zio_cksum_t	ch_drr;		/* whole header */
+	zio_cksum_t	ch_stored;	/* drr_checksum as read */
+} cksum_hdr_t;
+
+typedef struct cksum_rec {
+	cksum_hdr_t	cr_hdr;
+	char		*cr_buf;
+	size_t		cr_len;
+	zio_cksum_t	cr_cksum;	/* of the payload alone */
+	boolean_t	cr_done;
+} cksum_rec_t;
+
+int cksum_threads = 0;
+static tpool_t *cksum_tpool;
+static cksum_rec_t *cksum_recs;
+static int cksum_nrecs;
+static uint64_t cksum_issued, cksum_retired;
+static boolean_t cksum_failed = B_FALSE;
+static pthread_mutex_t cksum_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cksum_cv = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Per-object statistics, kept with -s.  Objects are told apart by the
+ * number of the BEGIN record they follow, since a compound stream from
+ * "zfs send -R" holds one substream per dataset.
+ */
+#define	OBJ_STATS_SHOWN	20
+
+typedef struct obj_stat {
+	avl_node_t	os_node;
+	uint64_t	os_stream;
+	uint64_t	os_object;
+	uint64_t	os_records;
+	uint64_t	os_bytes;	/* headers and payloads */
+	uint64_t	os_logical;	/* logical size of data written */
+	uint64_t	os_freed;
+} obj_stat_t;
+
+int obj_stats = 0;
+static avl_tree_t obj_stats_tree;
+static uint64_t obj_stats_stream = 0;
+
+static const char *drr_type_names[DRR_NUMTYPES] = {
+	"DRR_BEGIN",
+	"DRR_OBJECT",
+	"DRR_FREEOBJECTS",
+	"DRR_WRITE",
+	"DRR_FREE",
+	"DRR_END",
+	"DRR_WRITE_BYREF",
+	"DRR_SPILL",
+	"DRR_WRITE_EMBEDDED",
+	"DRR_OBJECT_RANGE",
+	"DRR_REDACT",
+};
+
 static void
 usage(void)
 {
-	(void) fprintf(stderr, "usage: zstreamdump [-v] [-C] [-d] < file\n");
+	(void) fprintf(stderr, "usage: zstreamdump [-v] [-C] [-d] [-s] "
+	    "[-j threads] < file\n");
 	(void) fprintf(stderr, "\t -v -- verbose\n");
 	(void) fprintf(stderr, "\t -C -- suppress checksum verification\n");
 	(void) fprintf(stderr, "\t -d -- dump contents of blocks modified, "
 	    "implies verbose\n");
+	(void) fprintf(stderr, "\t -s -- print a breakdown by record type and "
+	    "per-object statistics\n");
+	(void) fprintf(stderr, "\t -j -- verify checksums with this many "
+	    "threads\n");
 	exit(1);
 }
 
@@ -94,7 +178,7 @@ ssread(void *buf, size_t len, zio_cksum_t *cksum)
 	if ((outlen = fread(buf, len, 1, send_stream)) == 0)
 		return (0);
 
-	if (do_cksum) {
+	if (do_cksum && cksum != NULL) {
 		if (do_byteswap)
 			fletcher_4_incremental_byteswap(buf, len, cksum);
 		else
@@ -104,34 +188,337 @@ ssread(void *buf, size_t len, zio_cksum_t *cksum)
 	return (outlen);
 }
 
+static boolean_t
+check_hdr_cksum(const zio_cksum_t *stored, const zio_cksum_t *expected)
+{
+	if (!ZIO_CHECKSUM_IS_ZERO(stored) &&
+	    !ZIO_CHECKSUM_EQUAL(*expected, *stored)) {
+		fprintf(stderr, "invalid checksum\n");
+		(void) printf("Incorrect checksum in record header.\n");
+		(void) printf("Expected checksum = %llx/%llx/%llx/%llx\n",
+		    (longlong_t)expected->zc_word[0],
+		    (longlong_t)expected->zc_word[1],
+		    (longlong_t)expected->zc_word[2],
+		    (longlong_t)expected->zc_word[3]);
+		return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Read a record header.  If cksum is NULL the header checksum is left to
+ * the caller.
+ */
 static size_t
 read_hdr(dmu_replay_record_t *drr, zio_cksum_t *cksum)
 {
-	ASSERT3U(offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum),
+	ASSERT3U(CKSUM_HDR_LEN,
 	    ==, sizeof (dmu_replay_record_t) - sizeof (zio_cksum_t));
 	size_t r = ssread(drr, sizeof (*drr) - sizeof (zio_cksum_t), cksum);
 	if (r == 0)
 		return (0);
-	zio_cksum_t saved_cksum = *cksum;
+	zio_cksum_t saved_cksum = cksum != NULL ? *cksum : (zio_cksum_t){{0}};
 	r = ssread(&drr->drr_u.drr_checksum.drr_checksum,
 	    sizeof (zio_cksum_t), cksum);
 	if (r == 0)
 		return (0);
-	if (!ZIO_CHECKSUM_IS_ZERO(&drr->drr_u.drr_checksum.drr_checksum) &&
-	    !ZIO_CHECKSUM_EQUAL(saved_cksum,
-	    drr->drr_u.drr_checksum.drr_checksum)) {
-		fprintf(stderr, "invalid checksum\n");
-		(void) printf("Incorrect checksum in record header.\n");
-		(void) printf("Expected checksum = %llx/%llx/%llx/%llx\n",
-		    (longlong_t)saved_cksum.zc_word[0],
-		    (longlong_t)saved_cksum.zc_word[1],
-		    (longlong_t)saved_cksum.zc_word[2],
-		    (longlong_t)saved_cksum.zc_word[3]);
+	if (cksum != NULL && !check_hdr_cksum(
+	    &drr->drr_u.drr_checksum.drr_checksum, &saved_cksum))
 		return (0);
-	}
 	return (sizeof (*drr));
 }
 
+/*
+ * Checksum a header from zero, before any of its fields are byteswapped.
+ */
+static void
+cksum_hdr_init(dmu_replay_record_t *drr, cksum_hdr_t *ch)
+{
+	zio_cksum_t *stored = &drr->drr_u.drr_checksum.drr_checksum;
+
+	ZIO_SET_CHECKSUM(&ch->ch_hdr, 0, 0, 0, 0);
+	if (do_byteswap) {
+		fletcher_4_incremental_byteswap(drr, CKSUM_HDR_LEN,
+		    &ch->ch_hdr);
+		ch->ch_drr = ch->ch_hdr;
+		fletcher_4_incremental_byteswap(stored, sizeof (zio_cksum_t),
+		    &ch->ch_drr);
+	} else {
+		fletcher_4_incremental_native(drr, CKSUM_HDR_LEN,
+		    &ch->ch_hdr);
+		ch->ch_drr = ch->ch_hdr;
+		fletcher_4_incremental_native(stored, sizeof (zio_cksum_t),
+		    &ch->ch_drr);
+	}
+	ch->ch_stored = *stored;
+}
+
+/*
+ * Verify a header against the running checksum zc and fold it in.
+ */
+static boolean_t
+cksum_hdr_fold(cksum_hdr_t *ch, zio_cksum_t *zc)
+{
+	zio_cksum_t expected = *zc;
+
+	fletcher_4_combine(&expected, CKSUM_HDR_LEN, &ch->ch_hdr);
+	if (!check_hdr_cksum(&ch->ch_stored, &expected)) {
+		cksum_failed = B_TRUE;
+		return (B_FALSE);
+	}
+	fletcher_4_combine(zc, sizeof (dmu_replay_record_t), &ch->ch_drr);
+	return (B_TRUE);
+}
+
+static void
+cksum_worker(void *arg)
+{
+	cksum_rec_t *cr = arg;
+	zio_cksum_t zc = { { 0 } };
+
+	if (do_byteswap)
+		fletcher_4_incremental_byteswap(cr->cr_buf, cr->cr_len, &zc);
+	else
+		fletcher_4_incremental_native(cr->cr_buf, cr->cr_len, &zc);
+
+	(void) pthread_mutex_lock(&cksum_lock);
+	cr->cr_cksum = zc;
+	cr->cr_done = B_TRUE;
+	(void) pthread_cond_broadcast(&cksum_cv);
+	(void) pthread_mutex_unlock(&cksum_lock);
+}
+
+static void
+cksum_setup(void)
+{
+	cksum_nrecs = cksum_threads * CKSUM_WINDOW;
+	cksum_recs = safe_malloc(cksum_nrecs * sizeof (cksum_rec_t));
+	for (int i = 0; i < cksum_nrecs; i++)
+		cksum_recs[i].cr_buf = safe_malloc(SPA_MAXBLOCKSIZE);
+
+	cksum_tpool = tpool_create(1, cksum_threads, 0, NULL);
+	if (cksum_tpool == NULL) {
+		(void) fprintf(stderr, "ERROR; failed to create %d threads\n",
+		    cksum_threads);
+		exit(1);
+	}
+}
+
+static void
+cksum_teardown(void)
+{
+	tpool_wait(cksum_tpool);
+	tpool_destroy(cksum_tpool);
+	for (int i = 0; i < cksum_nrecs; i++)
+		free(cksum_recs[i].cr_buf);
+	free(cksum_recs);
+}
+
+/*
+ * Retire the oldest record in the window, folding its header and payload
+ * into the running checksum zc.
+ */
+static boolean_t
+cksum_retire(zio_cksum_t *zc)
+{
+	cksum_rec_t *cr = &cksum_recs[cksum_retired++ % cksum_nrecs];
+
+	(void) pthread_mutex_lock(&cksum_lock);
+	while (!cr->cr_done)
+		(void) pthread_cond_wait(&cksum_cv, &cksum_lock);
+	(void) pthread_mutex_unlock(&cksum_lock);
+
+	if (!cksum_hdr_fold(&cr->cr_hdr, zc))
+		return (B_FALSE);
+	if (cr->cr_len != 0)
+		fletcher_4_combine(zc, cr->cr_len, &cr->cr_cksum);
+	return (B_TRUE);
+}
+
+static boolean_t
+cksum_drain(zio_cksum_t *zc)
+{
+	while (!cksum_failed && cksum_retired < cksum_issued)
+		(void) cksum_retire(zc);
+	return (!cksum_failed);
+}
+
+/*
+ * Take the next slot in the window for a record with header ch, retiring
+ * the oldest record if the window is full.
+ */
+static cksum_rec_t *
+cksum_rec_start(cksum_hdr_t *ch, zio_cksum_t *zc)
+{
+	cksum_rec_t *cr;
+
+	if (cksum_issued - cksum_retired == cksum_nrecs && !cksum_retire(zc))
+		return (NULL);
+
+	cr = &cksum_recs[cksum_issued++ % cksum_nrecs];
+	cr->cr_hdr = *ch;
+	cr->cr_len = 0;
+	cr->cr_done = B_FALSE;
+	return (cr);
+}
+
+/*
+ * Hand the payload read into *bufp to the thread pool, giving the caller
+ * the slot's free buffer in exchange.
+ */
+static void
+cksum_rec_issue(cksum_rec_t *cr, char **bufp, size_t len)
+{
+	char *buf = cr->cr_buf;
+
+	cr->cr_buf = *bufp;
+	*bufp = buf;
+	cr->cr_len = len;
+
+	if (len == 0)
+		cr->cr_done = B_TRUE;
+	else if (tpool_dispatch(cksum_tpool, cksum_worker, cr) != 0)
+		cksum_worker(cr);
+}
+
+static int
+obj_stat_compare(const void *x1, const void *x2)
+{
+	const obj_stat_t *os1 = x1;
+	const obj_stat_t *os2 = x2;
+
+	int cmp = AVL_CMP(os1->os_stream, os2->os_stream);
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_CMP(os1->os_object, os2->os_object));
+}
+
+static int
+obj_stat_bytes_compare(const void *x1, const void *x2)
+{
+	const obj_stat_t *os1 = *(const obj_stat_t **)x1;
+	const obj_stat_t *os2 = *(const obj_stat_t **)x2;
+
+	return (AVL_CMP(os2->os_bytes, os1->os_bytes));
+}
+
+/*
+ * Account a record, whose fields have been byteswapped, to its object.
+ */
+static void
+obj_stat_add(dmu_replay_record_t *drr, uint64_t payload_size)
+{
+	obj_stat_t search, *os;
+	uint64_t logical = 0, freed = 0;
+	avl_index_t where;
+
+	switch (drr->drr_type) {
+	case DRR_BEGIN:
+		obj_stats_stream++;
+		return;
+	case DRR_OBJECT:
+		search.os_object = drr->drr_u.drr_object.drr_object;
+		break;
+	case DRR_WRITE:
+		search.os_object = drr->drr_u.drr_write.drr_object;
+		logical = drr->drr_u.drr_write.drr_logical_size;
+		break;
+	case DRR_WRITE_BYREF:
+		search.os_object = drr->drr_u.drr_write_byref.drr_object;
+		logical = drr->drr_u.drr_write_byref.drr_length;
+		break;
+	case DRR_WRITE_EMBEDDED:
+		search.os_object = drr->drr_u.drr_write_embedded.drr_object;
+		logical = drr->drr_u.drr_write_embedded.drr_length;
+		break;
+	case DRR_SPILL:
+		search.os_object = drr->drr_u.drr_spill.drr_object;
+		logical = drr->drr_u.drr_spill.drr_length;
+		break;
+	case DRR_FREE:
+		search.os_object = drr->drr_u.drr_free.drr_object;
+		/* A length of -1 frees to the end of the object */
+		if (drr->drr_u.drr_free.drr_length != -1ULL)
+			freed = drr->drr_u.drr_free.drr_length;
+		break;
+	case DRR_REDACT:
+		search.os_object = drr->drr_u.drr_redact.drr_object;
+		break;
+	default:
+		return;
+	}
+
+	search.os_stream = obj_stats_stream;
+	os = avl_find(&obj_stats_tree, &search, &where);
+	if (os == NULL) {
+		os = safe_malloc(sizeof (obj_stat_t));
+		bzero(os, sizeof (obj_stat_t));
+		os->os_stream = search.os_stream;
+		os->os_object = search.os_object;
+		avl_insert(&obj_stats_tree, os, where);
+	}
+	os->os_records++;
+	os->os_bytes += sizeof (*drr) + payload_size;
+	os->os_logical += logical;
+	os->os_freed += freed;
+}
+
+static void
+print_stats(uint64_t *record_count, uint64_t *byte_count)
+{
+	uint64_t nobjs = avl_numnodes(&obj_stats_tree);
+	uint64_t shown = nobjs;
+	obj_stat_t **sorted, *os;
+	void *cookie = NULL;
+	uint64_t i = 0;
+
+	(void) printf("STREAM BREAKDOWN:\n");
+	(void) printf("\t%-20s %12s %16s %8s\n", "type", "records",
+	    "bytes", "stream");
+	for (int t = 0; t < DRR_NUMTYPES; t++) {
+		uint64_t bytes = record_count[t] *
+		    sizeof (dmu_replay_record_t) + byte_count[t];
+
+		(void) printf("\t%-20s %12llu %16llu %7.2f%%\n",
+		    drr_type_names[t], (u_longlong_t)record_count[t],
+		    (u_longlong_t)bytes, total_stream_len == 0 ? 0.0 :
+		    100.0 * bytes / total_stream_len);
+	}
+
+	/*
+	 * With -s the largest objects are listed, with -ss all of them in
+	 * stream order.
+	 */
+	sorted = safe_malloc(MAX(nobjs, 1) * sizeof (obj_stat_t *));
+	for (os = avl_first(&obj_stats_tree); os != NULL;
+	    os = AVL_NEXT(&obj_stats_tree, os))
+		sorted[i++] = os;
+	if (obj_stats < 2) {
+		qsort(sorted, nobjs, sizeof (obj_stat_t *),
+		    obj_stat_bytes_compare);
+		shown = MIN(nobjs, OBJ_STATS_SHOWN);
+	}
+
+	(void) printf("OBJECTS:\n");
+	(void) printf("\t%llu objects, %llu shown\n", (u_longlong_t)nobjs,
+	    (u_longlong_t)shown);
+	(void) printf("\t%6s %12s %10s %16s %16s %16s\n", "stream",
+	    "object", "records", "bytes", "logical", "freed");
+	for (i = 0; i < shown; i++) {
+		os = sorted[i];
+		(void) printf("\t%6llu %12llu %10llu %16llu %16llu %16llu\n",
+		    (u_longlong_t)os->os_stream, (u_longlong_t)os->os_object,
+		    (u_longlong_t)os->os_records, (u_longlong_t)os->os_bytes,
+		    (u_longlong_t)os->os_logical, (u_longlong_t)os->os_freed);
+	}
+	free(sorted);
+
+	while ((os = avl_destroy_nodes(&obj_stats_tree, &cookie)) != NULL)
+		free(os);
+	avl_destroy(&obj_stats_tree);
+}
+
 /*
  * Print part of a block in ASCII characters
  */
@@ -253,12 +640,29 @@ main(int argc, char *argv[])
 	int err;
 	zio_cksum_t zc = { { 0 } };
 	zio_cksum_t pcksum = { { 0 } };
+	zio_cksum_t *zcp = &zc;
+	cksum_hdr_t ch;
+	cksum_rec_t *cr = NULL;
+	char *endp;
 
-	while ((c = getopt(argc, argv, ":vCd")) != -1) {
+	while ((c = getopt(argc, argv, ":vCdj:s")) != -1) {
 		switch (c) {
 		case 'C':
 			do_cksum = B_FALSE;
 			break;
+		case 'j':
+			errno = 0;
+			cksum_threads = strtol(optarg, &endp, 10);
+			if (errno != 0 || *endp != '\0' || cksum_threads < 0 ||
+			    cksum_threads > 1024) {
+				(void) fprintf(stderr,
+				    "invalid number of threads '%s'\n", optarg);
+				usage();
+			}
+			break;
+		case 's':
+			obj_stats++;
+			break;
 		case 'v':
 			if (verbose)
 				very_verbose = B_TRUE;
@@ -290,9 +694,18 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if (!do_cksum)
+		cksum_threads = 0;
+	if (cksum_threads > 0)
+		cksum_setup();
+	if (obj_stats) {
+		avl_create(&obj_stats_tree, obj_stat_compare,
+		    sizeof (obj_stat_t), offsetof(obj_stat_t, os_node));
+	}
+
 	fletcher_4_init();
 	send_stream = stdin;
-	while (read_hdr(drr, &zc)) {
+	while (read_hdr(drr, cksum_threads > 0 ? NULL : &zc)) {
 
 		/*
 		 * If this is the first DMU record being processed, check for
@@ -301,7 +714,7 @@ main(int argc, char *argv[])
 		if (first) {
 			if (drrb->drr_magic == BSWAP_64(DMU_BACKUP_MAGIC)) {
 				do_byteswap = B_TRUE;
-				if (do_cksum) {
+				if (do_cksum && cksum_threads == 0) {
 					ZIO_SET_CHECKSUM(&zc, 0, 0, 0, 0);
 					/*
 					 * recalculate header checksum now
@@ -318,6 +731,8 @@ main(int argc, char *argv[])
 			}
 			first = B_FALSE;
 		}
+		if (cksum_threads > 0)
+			cksum_hdr_init(drr, &ch);
 		if (do_byteswap) {
 			drr->drr_type = BSWAP_32(drr->drr_type);
 			drr->drr_payloadlen =
@@ -338,6 +753,28 @@ main(int argc, char *argv[])
 			exit(1);
 		}
 
+		/*
+		 * With -j, BEGIN and END records and their payloads are
+		 * checksummed inline once every earlier record has been, and
+		 * the payloads of all others are handed to the thread pool.
+		 */
+		if (cksum_threads > 0) {
+			if (drr->drr_type == DRR_BEGIN ||
+			    drr->drr_type == DRR_END) {
+				if (!cksum_drain(&zc))
+					break;
+				pcksum = zc;
+				if (!cksum_hdr_fold(&ch, &zc))
+					break;
+				zcp = &zc;
+				cr = NULL;
+			} else {
+				if ((cr = cksum_rec_start(&ch, &zc)) == NULL)
+					break;
+				zcp = NULL;
+			}
+		}
+
 		drr_record_count[drr->drr_type]++;
 		total_overhead_size += sizeof (*drr);
 		total_records++;
@@ -385,7 +822,7 @@ main(int argc, char *argv[])
 					free(buf);
 					buf = safe_malloc(sz);
 				}
-				(void) ssread(buf, sz, &zc);
+				(void) ssread(buf, sz, zcp);
 				if (ferror(send_stream))
 					perror("fread");
 				err = nvlist_unpack(buf, sz, &nv, 0);
@@ -478,7 +915,7 @@ main(int argc, char *argv[])
 				    drro->drr_nblkptr);
 			}
 			if (drro->drr_bonuslen > 0) {
-				(void) ssread(buf, payload_size, &zc);
+				(void) ssread(buf, payload_size, zcp);
 				if (dump)
 					print_block(buf, payload_size);
 			}
@@ -553,7 +990,7 @@ main(int argc, char *argv[])
 			/*
 			 * Read the contents of the block in from STDIN to buf
 			 */
-			(void) ssread(buf, payload_size, &zc);
+			(void) ssread(buf, payload_size, zcp);
 			/*
 			 * If in dump mode
 			 */
@@ -648,7 +1085,7 @@ main(int argc, char *argv[])
 				    iv,
 				    mac);
 			}
-			(void) ssread(buf, payload_size, &zc);
+			(void) ssread(buf, payload_size, zcp);
 			if (dump) {
 				print_block(buf, payload_size);
 			}
@@ -683,7 +1120,7 @@ main(int argc, char *argv[])
 				    drrwe->drr_psize);
 			}
 			(void) ssread(buf,
-			    P2ROUNDUP(drrwe->drr_psize, 8), &zc);
+			    P2ROUNDUP(drrwe->drr_psize, 8), zcp);
 			if (dump) {
 				print_block(buf,
 				    P2ROUNDUP(drrwe->drr_psize, 8));
@@ -743,10 +1180,20 @@ main(int argc, char *argv[])
 			    (longlong_t)drrc->drr_checksum.zc_word[2],
 			    (longlong_t)drrc->drr_checksum.zc_word[3]);
 		}
+		if (cr != NULL) {
+			cksum_rec_issue(cr, &buf, payload_size);
+			cr = NULL;
+		}
+		if (obj_stats)
+			obj_stat_add(drr, payload_size);
 		pcksum = zc;
 		drr_byte_count[drr->drr_type] += payload_size;
 		total_payload_size += payload_size;
 	}
+	if (cksum_threads > 0) {
+		(void) cksum_drain(&zc);
+		cksum_teardown();
+	}
 	free(buf);
 	fletcher_4_fini();
 
@@ -789,5 +1236,7 @@ main(int argc, char *argv[])
 	    (u_longlong_t)total_overhead_size);
 	(void) printf("\tTotal stream length = %lld (0x%llx)\n",
 	    (u_longlong_t)total_stream_len, (u_longlong_t)total_stream_len);
+	if (obj_stats)
+		print_stats(drr_record_count, drr_byte_count);
 	return (0);
 }
@@ -79,6 +79,13 @@
  *
  * Use the -k option to set the desired frequency of kills.
  *
+ * Use the -S option to measure rather than verify: the threads then run
+ * only the given mix of functions, as fast as they can and without kills,
+ * and each pass reports the ops/s and latency percentiles of every function
+ * in the mix, so that lock contention in the DMU and SPA shows up without
+ * any hardware.  For example, -S dmu_write_parallel:4,dmu_object_alloc_free,zap
+ * weights the parallel writes four times as heavily as the other two.
+ *
  * When ztest invokes itself it passes all relevant information through a
  * temporary file which is mmap-ed in the child process. This allows shared
  * memory to survive the exec syscall. The ztest_shared_hdr_t struct is always
@@ -172,6 +179,7 @@ typedef struct ztest_shared_opts {
 	int zo_mirrors;
 	int zo_raidz;
 	int zo_raidz_parity;
+	char zo_raidz_type[8];
 	int zo_datasets;
 	int zo_threads;
 	uint64_t zo_passtime;
@@ -184,6 +192,7 @@ typedef struct ztest_shared_opts {
 	int zo_mmp_test;
 	int zo_special_vdevs;
 	int zo_dump_dbgmsg;
+	char zo_stress[MAXNAMELEN];
 } ztest_shared_opts_t;
 
 static const ztest_shared_opts_t ztest_opts_defaults = {
@@ -196,6 +205,7 @@ static const ztest_shared_opts_t ztest_opts_defaults = {
 	.zo_mirrors = 2,
 	.zo_raidz = 4,
 	.zo_raidz_parity = 1,
+	.zo_raidz_type = VDEV_TYPE_RAIDZ,
 	.zo_vdev_size = SPA_MINDEVSIZE * 4,	/* 256m default size */
 	.zo_datasets = 7,
 	.zo_threads = 23,
@@ -220,6 +230,9 @@ extern int dmu_object_alloc_chunk_shift;
 extern boolean_t zfs_force_some_double_word_sm_entries;
 extern unsigned long zio_decompress_fail_fraction;
 extern unsigned long zfs_reconstruct_indirect_damage_fraction;
+#ifdef HAVE_LIBURING
+extern int vdev_file_uring;
+#endif
 
 
 static ztest_shared_opts_t *ztest_shared_opts;
@@ -335,10 +348,18 @@ typedef struct ztest_info {
 	const char	*zi_funcname;	/* name of test function */
 } ztest_info_t;
 
+/*
+ * Latencies are kept in a histogram with 2^ZTEST_LAT_SUB_BITS buckets per
+ * power of two nanoseconds, so percentiles are good to within 12.5%.
+ */
+#define	ZTEST_LAT_SUB_BITS	3
+#define	ZTEST_LAT_BUCKETS	(64 << ZTEST_LAT_SUB_BITS)
+
 typedef struct ztest_shared_callstate {
 	uint64_t	zc_count;	/* per-pass count */
 	uint64_t	zc_time;	/* per-pass time */
 	uint64_t	zc_next;	/* next time to call this function */
+	uint64_t	zc_lat[ZTEST_LAT_BUCKETS]; /* per-pass -S latencies */
 } ztest_shared_callstate_t;
 
 static ztest_shared_callstate_t *ztest_shared_callstate;
@@ -438,6 +459,12 @@ ztest_info_t ztest_info[] = {
 
 #define	ZTEST_FUNCS	(sizeof (ztest_info) / sizeof (ztest_info_t))
 
+/*
+ * Relative weights of the functions in the -S mix, zero when not in it.
+ */
+static uint64_t ztest_stress_weight[ZTEST_FUNCS];
+static uint64_t ztest_stress_total;
+
 /*
  * The following struct is used to hold a list of uncalled commit callbacks.
  * The callbacks are ordered by txg number.
@@ -467,6 +494,7 @@ typedef struct ztest_shared {
 	uint64_t	zs_metaslab_sz;
 	uint64_t	zs_metaslab_df_alloc_threshold;
 	uint64_t	zs_guid;
+	hrtime_t	zs_thread_done;
 } ztest_shared_t;
 
 #define	ID_PARALLEL	-1ULL
@@ -689,6 +717,7 @@ usage(boolean_t requested)
 	    "\t[-m mirror_copies (default: %d)]\n"
 	    "\t[-r raidz_disks (default: %d)]\n"
 	    "\t[-R raidz_parity (default: %d)]\n"
+	    "\t[-K raidz_kind (default: %s)] raidz|draid\n"
 	    "\t[-d datasets (default: %d)]\n"
 	    "\t[-t threads (default: %d)]\n"
 	    "\t[-g gang_block_threshold (default: %s)]\n"
@@ -704,6 +733,8 @@ usage(boolean_t requested)
 	    "\t[-P passtime (default: %llu sec)] time per pass\n"
 	    "\t[-B alt_ztest (default: <none>)] alternate ztest path\n"
 	    "\t[-C vdev class state (default: random)] special=on|off|random\n"
+	    "\t[-S func[:weight],...] only run this mix of functions, without\n"
+	    "\t    kills, and report their ops/s and latencies\n"
 	    "\t[-o variable=value] ... set global variable to an unsigned\n"
 	    "\t    32-bit integer value\n"
 	    "\t[-G dump zfs_dbgmsg buffer before exiting due to an error\n"
@@ -716,6 +747,7 @@ usage(boolean_t requested)
 	    zo->zo_mirrors,				/* -m */
 	    zo->zo_raidz,				/* -r */
 	    zo->zo_raidz_parity,			/* -R */
+	    zo->zo_raidz_type,				/* -K */
 	    zo->zo_datasets,				/* -d */
 	    zo->zo_threads,				/* -t */
 	    nice_force_ganging,				/* -g */
@@ -769,6 +801,59 @@ ztest_parse_name_value(const char *input, ztest_shared_opts_t *zo)
 		(void) printf("%s vdev state is '%s'\n", name, value);
 }
 
+/*
+ * Parse a -S mix of the form func[:weight],... into ztest_stress_weight[].
+ * The ztest_ prefix of the function names may be left off, and the weight
+ * defaults to 1.
+ */
+static int
+ztest_stress_parse(const char *mix)
+{
+	char *buf = strdup(mix);
+	char *name, *weight, *lasts = NULL;
+	int error = 0;
+
+	bzero(ztest_stress_weight, sizeof (ztest_stress_weight));
+	ztest_stress_total = 0;
+
+	for (name = strtok_r(buf, ",", &lasts); name != NULL && error == 0;
+	    name = strtok_r(NULL, ",", &lasts)) {
+		uint64_t w = 1;
+		int f;
+
+		if ((weight = strchr(name, ':')) != NULL) {
+			*weight++ = '\0';
+			w = nicenumtoull(weight);
+		}
+
+		for (f = 0; f < ZTEST_FUNCS; f++) {
+			const char *fname = ztest_info[f].zi_funcname;
+
+			if (strcmp(name, fname) == 0 ||
+			    strcmp(name, fname + strlen("ztest_")) == 0)
+				break;
+		}
+
+		if (f == ZTEST_FUNCS || w == 0) {
+			(void) fprintf(stderr, "invalid '-S' function or "
+			    "weight '%s'\n", name);
+			error = EINVAL;
+			break;
+		}
+
+		ztest_stress_weight[f] += w;
+		ztest_stress_total += w;
+	}
+	free(buf);
+
+	if (error == 0 && ztest_stress_total == 0) {
+		(void) fprintf(stderr, "empty '-S' function mix\n");
+		error = EINVAL;
+	}
+
+	return (error);
+}
+
 static void
 process_options(int argc, char **argv)
 {
@@ -782,7 +867,7 @@ process_options(int argc, char **argv)
 	bcopy(&ztest_opts_defaults, zo, sizeof (*zo));
 
 	while ((opt = getopt(argc, argv,
-	    "v:s:a:m:r:R:d:t:g:i:k:p:f:MVET:P:hF:B:C:o:G")) != EOF) {
+	    "v:s:a:m:r:R:K:d:t:g:i:k:p:f:MVET:P:hF:B:C:o:GS:")) != EOF) {
 		value = 0;
 		switch (opt) {
 		case 'v':
@@ -820,6 +905,13 @@ process_options(int argc, char **argv)
 		case 'R':
 			zo->zo_raidz_parity = MIN(MAX(value, 1), 3);
 			break;
+		case 'K':
+			if (strcmp(optarg, VDEV_TYPE_RAIDZ) != 0 &&
+			    strcmp(optarg, VDEV_TYPE_DRAID) != 0)
+				usage(B_FALSE);
+			(void) strlcpy(zo->zo_raidz_type, optarg,
+			    sizeof (zo->zo_raidz_type));
+			break;
 		case 'd':
 			zo->zo_datasets = MAX(1, value);
 			break;
@@ -883,6 +975,10 @@ process_options(int argc, char **argv)
 		case 'G':
 			zo->zo_dump_dbgmsg = 1;
 			break;
+		case 'S':
+			(void) strlcpy(zo->zo_stress, optarg,
+			    sizeof (zo->zo_stress));
+			break;
 		case 'h':
 			usage(B_TRUE);
 			break;
@@ -895,6 +991,17 @@ process_options(int argc, char **argv)
 
 	zo->zo_raidz_parity = MIN(zo->zo_raidz_parity, zo->zo_raidz - 1);
 
+	/* Kills would only distort the numbers the stress mix is run for */
+	if (strlen(zo->zo_stress) > 0) {
+		if (ztest_stress_parse(zo->zo_stress) != 0)
+			usage(B_FALSE);
+		zo->zo_killrate = 0;
+	}
+
+	/* dRAID vdevs must be top-level, so they can't be mirrored */
+	if (strcmp(zo->zo_raidz_type, VDEV_TYPE_DRAID) == 0)
+		zo->zo_mirrors = 0;
+
 	zo->zo_vdevtime =
 	    (zo->zo_vdevs > 0 ? zo->zo_time * NANOSEC / zo->zo_vdevs :
 	    UINT64_MAX >> 2);
@@ -1058,9 +1165,19 @@ make_vdev_raidz(char *path, char *aux, char *pool, size_t size,
 
 	VERIFY(nvlist_alloc(&raidz, NV_UNIQUE_NAME, 0) == 0);
 	VERIFY(nvlist_add_string(raidz, ZPOOL_CONFIG_TYPE,
-	    VDEV_TYPE_RAIDZ) == 0);
+	    ztest_opts.zo_raidz_type) == 0);
 	VERIFY(nvlist_add_uint64(raidz, ZPOOL_CONFIG_NPARITY,
 	    ztest_opts.zo_raidz_parity) == 0);
+
+	if (strcmp(ztest_opts.zo_raidz_type, VDEV_TYPE_DRAID) == 0) {
+		/* use one distributed spare when there are enough children */
+		uint64_t nparity = ztest_opts.zo_raidz_parity;
+		uint64_t nspares = (r > nparity + 2) ? 1 : 0;
+
+		fnvlist_add_uint64(raidz, ZPOOL_CONFIG_DRAID_NDATA,
+		    r - nparity - nspares);
+		fnvlist_add_uint64(raidz, ZPOOL_CONFIG_DRAID_NSPARES, nspares);
+	}
 	VERIFY(nvlist_add_nvlist_array(raidz, ZPOOL_CONFIG_CHILDREN,
 	    child, r) == 0);
 
@@ -2807,6 +2924,10 @@ ztest_spa_upgrade(ztest_ds_t *zd, uint64_t id)
 	if (ztest_opts.zo_mmp_test)
 		return;
 
+	/* dRAID vdevs require feature flags, there is nothing to upgrade */
+	if (strcmp(ztest_opts.zo_raidz_type, VDEV_TYPE_DRAID) == 0)
+		return;
+
 	mutex_enter(&ztest_vdev_lock);
 	name = kmem_asprintf("%s_upgrade", ztest_opts.zo_pool);
 
@@ -3339,6 +3460,7 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	uint64_t oldsize, newsize;
 	char *oldpath, *newpath;
 	int replacing;
+	int rebuild = B_FALSE;
 	int oldvd_has_siblings = B_FALSE;
 	int newvd_is_spare = B_FALSE;
 	int oldvd_is_log;
@@ -3396,7 +3518,8 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 
 	/* pick a child out of the raidz group */
 	if (ztest_opts.zo_raidz > 1) {
-		ASSERT(oldvd->vdev_ops == &vdev_raidz_ops);
+		ASSERT(oldvd->vdev_ops == &vdev_raidz_ops ||
+		    oldvd->vdev_ops == &vdev_draid_ops);
 		ASSERT(oldvd->vdev_children == ztest_opts.zo_raidz);
 		oldvd = oldvd->vdev_child[leaf % ztest_opts.zo_raidz];
 	}
@@ -3442,8 +3565,16 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	 * For the new vdev, choose with equal probability between the two
 	 * standard paths (ending in either 'a' or 'b') or a random hot spare.
 	 */
+	newvd = NULL;
 	if (sav->sav_count != 0 && ztest_random(3) == 0) {
 		newvd = sav->sav_vdevs[ztest_random(sav->sav_count)];
+
+		/* distributed spares aren't described by a file path */
+		if (newvd->vdev_ops == &vdev_draid_spare_ops)
+			newvd = NULL;
+	}
+
+	if (newvd != NULL) {
 		newvd_is_spare = B_TRUE;
 		(void) strcpy(newpath, newvd->vdev_path);
 	} else {
@@ -3497,6 +3628,22 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	else
 		expected_error = 0;
 
+	/*
+	 * Half of the time use a sequential rebuild when the feature is
+	 * enabled and every vdev above oldvd is a mirror-like vdev; this
+	 * mode cannot be used for raidz and dRAID.
+	 */
+	if (spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REBUILD) &&
+	    ztest_random(2) == 0) {
+		rebuild = B_TRUE;
+		for (vdev_t *vd = pvd; vd != rvd; vd = vd->vdev_parent) {
+			if (vd->vdev_ops != &vdev_mirror_ops &&
+			    vd->vdev_ops != &vdev_replacing_ops &&
+			    vd->vdev_ops != &vdev_spare_ops)
+				rebuild = B_FALSE;
+		}
+	}
+
 	spa_config_exit(spa, SCL_ALL, FTAG);
 
 	/*
@@ -3505,7 +3652,7 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	root = make_vdev_root(newpath, NULL, NULL, newvd == NULL ? newsize : 0,
 	    ashift, NULL, 0, 0, 1);
 
-	error = spa_vdev_attach(spa, oldguid, root, replacing);
+	error = spa_vdev_attach(spa, oldguid, root, replacing, rebuild);
 
 	nvlist_free(root);
 
@@ -5731,6 +5878,7 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 	vdev_t *vd0 = NULL;
 	uint64_t guid0 = 0;
 	boolean_t islog = B_FALSE;
+	boolean_t isdraid = B_FALSE;
 
 	path0 = umem_alloc(MAXPATHLEN, UMEM_NOFAIL);
 	pathrand = umem_alloc(MAXPATHLEN, UMEM_NOFAIL);
@@ -5805,6 +5953,14 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 		if (vd0 != NULL && vd0->vdev_top->vdev_islog)
 			islog = B_TRUE;
 
+		/*
+		 * The columns of a dRAID block may be at different offsets
+		 * on each child, so the injection ranges below can't keep
+		 * damage to a single column of any block.
+		 */
+		if (vd0 != NULL && vd0->vdev_top->vdev_ops == &vdev_draid_ops)
+			isdraid = B_TRUE;
+
 		/*
 		 * If the top-level vdev needs to be resilvered
 		 * then we only allow faults on the device that is
@@ -5902,7 +6058,7 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 		}
 	}
 
-	if (maxfaults == 0)
+	if (maxfaults == 0 || isdraid)
 		goto out;
 
 	/*
@@ -6679,6 +6835,37 @@ ztest_deadman_thread(void *arg)
 	thread_exit();
 }
 
+static int
+ztest_lat_bucket(hrtime_t ns)
+{
+	uint64_t v = MAX(ns, 0);
+	int shift;
+
+	if (v < (1ULL << ZTEST_LAT_SUB_BITS))
+		return (v);
+
+	shift = highbit64(v) - 1 - ZTEST_LAT_SUB_BITS;
+	return (((shift + 1) << ZTEST_LAT_SUB_BITS) +
+	    ((v >> shift) & ((1ULL << ZTEST_LAT_SUB_BITS) - 1)));
+}
+
+/*
+ * Return the largest latency which falls in the given bucket.
+ */
+static uint64_t
+ztest_lat_bucket_max(int b)
+{
+	int shift;
+
+	b++;
+	if (b < (1 << ZTEST_LAT_SUB_BITS))
+		return (b - 1);
+
+	shift = (b >> ZTEST_LAT_SUB_BITS) - 1;
+	return ((((1ULL << ZTEST_LAT_SUB_BITS) +
+	    (b & ((1 << ZTEST_LAT_SUB_BITS) - 1))) << shift) - 1);
+}
+
 static void
 ztest_execute(int test, ztest_info_t *zi, uint64_t id)
 {
@@ -6687,8 +6874,21 @@ ztest_execute(int test, ztest_info_t *zi, uint64_t id)
 	hrtime_t functime = gethrtime();
 	int i;
 
-	for (i = 0; i < zi->zi_iters; i++)
-		zi->zi_func(zd, id);
+	if (ztest_stress_total != 0) {
+		hrtime_t start = functime;
+
+		for (i = 0; i < zi->zi_iters; i++) {
+			zi->zi_func(zd, id);
+			hrtime_t end = gethrtime();
+			int b = ztest_lat_bucket(end - start);
+
+			atomic_inc_64(&zc->zc_lat[b]);
+			start = end;
+		}
+	} else {
+		for (i = 0; i < zi->zi_iters; i++)
+			zi->zi_func(zd, id);
+	}
 
 	functime = gethrtime() - functime;
 
@@ -6724,6 +6924,18 @@ ztest_thread(void *arg)
 		if (zs->zs_enospc_count > 10)
 			break;
 
+		/*
+		 * With a -S mix, pick from it by weight and ignore intervals.
+		 */
+		if (ztest_stress_total != 0) {
+			uint64_t r = ztest_random(ztest_stress_total);
+
+			for (rand = 0; r >= ztest_stress_weight[rand]; rand++)
+				r -= ztest_stress_weight[rand];
+			ztest_execute(rand, &ztest_info[rand], id);
+			continue;
+		}
+
 		/*
 		 * Pick a random function to execute.
 		 */
@@ -7046,6 +7258,7 @@ ztest_run(ztest_shared_t *zs)
 	 */
 	for (t = 0; t < ztest_opts.zo_threads; t++)
 		VERIFY0(thread_join(run_threads[t]));
+	zs->zs_thread_done = gethrtime();
 
 	/*
 	 * Close all datasets. This must be done after all the threads
@@ -7205,6 +7418,68 @@ ztest_freeze(void)
 	kernel_fini();
 }
 
+/*
+ * Return the given percentile, in microseconds, of a latency histogram
+ * holding total entries.
+ */
+static double
+ztest_lat_percentile(const uint64_t *lat, uint64_t total, double pct)
+{
+	uint64_t target = MAX((uint64_t)(total * pct / 100.0), 1);
+	uint64_t seen = 0;
+	int b;
+
+	for (b = 0; b < ZTEST_LAT_BUCKETS - 1; b++) {
+		seen += lat[b];
+		if (seen >= target)
+			break;
+	}
+
+	return ((double)ztest_lat_bucket_max(b) / (NANOSEC / MICROSEC));
+}
+
+/*
+ * Report the throughput and latencies of the -S mix for the last pass.
+ */
+static void
+ztest_stress_summary(ztest_shared_t *zs)
+{
+	hrtime_t elapsed = MAX(zs->zs_thread_done - zs->zs_thread_start, 1);
+
+	(void) printf("\nStress summary, %d threads for %.1f sec:\n\n",
+	    ztest_opts.zo_threads, (double)elapsed / NANOSEC);
+	(void) printf("%10s %10s %9s %9s %9s %9s %9s   %s\n", "Ops", "Ops/s",
+	    "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)",
+	    "Function");
+
+	for (int f = 0; f < ZTEST_FUNCS; f++) {
+		ztest_shared_callstate_t *zc = ZTEST_GET_SHARED_CALLSTATE(f);
+		uint64_t ops = 0;
+
+		if (ztest_stress_weight[f] == 0)
+			continue;
+
+		for (int b = 0; b < ZTEST_LAT_BUCKETS; b++)
+			ops += zc->zc_lat[b];
+		if (ops == 0) {
+			(void) printf("%10d %10s %9s %9s %9s %9s %9s   %s\n",
+			    0, "-", "-", "-", "-", "-", "-",
+			    ztest_info[f].zi_funcname);
+			continue;
+		}
+
+		(void) printf("%10llu %10.1f %9.1f %9.1f %9.1f %9.1f %9.1f   "
+		    "%s\n", (u_longlong_t)ops, (double)ops * NANOSEC / elapsed,
+		    ztest_lat_percentile(zc->zc_lat, ops, 50),
+		    ztest_lat_percentile(zc->zc_lat, ops, 90),
+		    ztest_lat_percentile(zc->zc_lat, ops, 99),
+		    ztest_lat_percentile(zc->zc_lat, ops, 99.9),
+		    ztest_lat_percentile(zc->zc_lat, ops, 100),
+		    ztest_info[f].zi_funcname);
+	}
+	(void) printf("\n");
+}
+
 void
 print_time(hrtime_t t, char *timebuf)
 {
@@ -7594,6 +7869,14 @@ main(int argc, char **argv)
 	 */
 	zfs_reconstruct_indirect_damage_fraction = 100;
 
+#ifdef HAVE_LIBURING
+	/*
+	 * Keep file vdevs on vn_rdwr(), which splits writes so that a
+	 * killed child leaves torn writes behind for the next pass to find.
+	 */
+	vdev_file_uring = 0;
+#endif
+
 	action.sa_handler = sig_handler;
 	sigemptyset(&action.sa_mask);
 	action.sa_flags = 0;
@@ -7630,6 +7913,8 @@ main(int argc, char **argv)
 		ztest_fd_data = atoi(fd_data_str);
 		setup_data();
 		bcopy(ztest_shared_opts, &ztest_opts, sizeof (ztest_opts));
+		if (strlen(ztest_opts.zo_stress) > 0)
+			VERIFY0(ztest_stress_parse(ztest_opts.zo_stress));
 	}
 	ASSERT3U(ztest_opts.zo_datasets, ==, ztest_shared_hdr->zh_ds_count);
 
@@ -7709,6 +7994,7 @@ main(int argc, char **argv)
 			zc = ZTEST_GET_SHARED_CALLSTATE(f);
 			zc->zc_count = 0;
 			zc->zc_time = 0;
+			bzero(zc->zc_lat, sizeof (zc->zc_lat));
 		}
 
 		/* Set the allocation switch size */
@@ -7771,6 +8057,9 @@ main(int argc, char **argv)
 			(void) printf("\n");
 		}
 
+		if (ztest_stress_total != 0)
+			ztest_stress_summary(zs);
+
 		if (!ztest_opts.zo_mmp_test)
 			ztest_run_zdb(ztest_opts.zo_pool);
 	}
@@ -0,0 +1,38 @@
+dnl #
+dnl # Linux 4.13 API change
+dnl # The blk-mq queue_rq() callback returns a blk_status_t.  Only this
+dnl # version of the interface, which also provides BLK_MQ_F_BLOCKING, is
+dnl # supported for blk-mq backed zvols.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_BLK_MQ], [
+	AC_MSG_CHECKING([whether block multiqueue with blk_status_t is available])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/blkdev.h>
+		#include <linux/blk-mq.h>
+
+		static blk_status_t
+		queue_rq(struct blk_mq_hw_ctx *hctx,
+		    const struct blk_mq_queue_data *bd)
+		{
+			return (BLK_STS_OK);
+		}
+
+		static const struct blk_mq_ops
+		    ops __attribute__ ((unused)) = {
+			.queue_rq = queue_rq,
+		};
+	],[
+		struct blk_mq_tag_set tag_set __attribute__ ((unused)) = {0};
+		struct request_queue *q __attribute__ ((unused));
+
+		tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+		(void) blk_mq_alloc_tag_set(&tag_set);
+		q = blk_mq_init_queue(&tag_set);
+		blk_mq_free_tag_set(&tag_set);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_BLK_MQ, 1, [block multiqueue is available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
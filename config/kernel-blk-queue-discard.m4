@@ -63,3 +63,31 @@ AC_DEFUN([ZFS_AC_KERNEL_BLK_QUEUE_SECURE_ERASE], [
 		])
 	])
 ])
+
+dnl #
+dnl # 4.12 - 4.x API,
+dnl #   bdev_write_zeroes_sectors() and blkdev_issue_zeroout() flags
+dnl #
+dnl # Earlier kernels always fall back to writing zeroed pages, which is no
+dnl # faster than the initialize pattern writes.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_BLKDEV_ISSUE_ZEROOUT_NOFALLBACK], [
+	AC_MSG_CHECKING([whether blkdev_issue_zeroout() takes NOFALLBACK])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/blkdev.h>
+	],[
+		struct block_device *bdev __attribute__ ((unused)) = NULL;
+		unsigned int max __attribute__ ((unused));
+		int error __attribute__ ((unused));
+
+		max = bdev_write_zeroes_sectors(bdev);
+		error = blkdev_issue_zeroout(bdev, 0, 0, GFP_NOFS,
+		    BLKDEV_ZERO_NOUNMAP | BLKDEV_ZERO_NOFALLBACK);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_BLKDEV_ISSUE_ZEROOUT_NOFALLBACK, 1,
+		    [blkdev_issue_zeroout() takes BLKDEV_ZERO_NOFALLBACK])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
@@ -0,0 +1,27 @@
+dnl #
+dnl # 4.5 API change
+dnl # Added file_operations->copy_file_range().
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_VFS_COPY_FILE_RANGE], [
+	AC_MSG_CHECKING([whether fops->copy_file_range() is available])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/fs.h>
+
+		static ssize_t test_copy_file_range(struct file *src_file,
+		    loff_t src_off, struct file *dst_file, loff_t dst_off,
+		    size_t len, unsigned int flags)
+		    { return (0); }
+
+		static const struct file_operations
+		    fops __attribute__ ((unused)) = {
+			.copy_file_range = test_copy_file_range,
+		};
+	],[
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_VFS_COPY_FILE_RANGE, 1,
+		    [fops->copy_file_range() is available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
@@ -0,0 +1,37 @@
+dnl #
+dnl # Linux 4.20 API
+dnl #
+dnl # The iov_iter type may be queried with iov_iter_type().  This is used
+dnl # to detect ITER_PIPE iterators, which are passed to ->read_iter() by
+dnl # generic_file_splice_read(), so the data can be copied directly into
+dnl # the pipe with copy_to_iter().
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_VFS_IOV_ITER],
+	[AC_MSG_CHECKING([whether iov_iter_type() is available])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/fs.h>
+		#include <linux/uio.h>
+		#include <linux/splice.h>
+
+		static const struct file_operations
+		    fops __attribute__ ((unused)) = {
+		    .splice_read = generic_file_splice_read,
+		    .splice_write = iter_file_splice_write,
+		};
+	],[
+		struct iov_iter iter = { 0 };
+		size_t ret __attribute__ ((unused));
+		char buf[1];
+
+		ret = (iov_iter_type(&iter) == ITER_PIPE);
+		ret = copy_to_iter(buf, sizeof (buf), &iter);
+		ret = copy_from_iter(buf, sizeof (buf), &iter);
+		iov_iter_advance(&iter, 1);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_VFS_IOV_ITER, 1,
+			[iov_iter_type() and splice via ->read_iter() available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
@@ -0,0 +1,36 @@
+dnl #
+dnl # zstd compat,
+dnl # Verify the kernel has CONFIG_ZSTD_COMPRESS and CONFIG_ZSTD_DECOMPRESS
+dnl # support enabled.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_CONFIG_ZSTD], [
+	AC_MSG_CHECKING([whether CONFIG_ZSTD_COMPRESS is defined])
+	ZFS_LINUX_TRY_COMPILE([
+		#if !defined(CONFIG_ZSTD_COMPRESS) && \
+		    !defined(CONFIG_ZSTD_COMPRESS_MODULE)
+		#error CONFIG_ZSTD_COMPRESS not defined
+		#endif
+	],[ ],[
+		AC_MSG_RESULT([yes])
+	],[
+		AC_MSG_RESULT([no])
+		AC_MSG_ERROR([
+	*** This kernel does not include the required zstd compress support.
+	*** Rebuild the kernel with CONFIG_ZSTD_COMPRESS=y|m set.])
+	])
+
+	AC_MSG_CHECKING([whether CONFIG_ZSTD_DECOMPRESS is defined])
+	ZFS_LINUX_TRY_COMPILE([
+		#if !defined(CONFIG_ZSTD_DECOMPRESS) && \
+		    !defined(CONFIG_ZSTD_DECOMPRESS_MODULE)
+		#error CONFIG_ZSTD_DECOMPRESS not defined
+		#endif
+	],[ ],[
+		AC_MSG_RESULT([yes])
+	],[
+		AC_MSG_RESULT([no])
+		AC_MSG_ERROR([
+	*** This kernel does not include the required zstd decompress support.
+	*** Rebuild the kernel with CONFIG_ZSTD_DECOMPRESS=y|m set.])
+	])
+])
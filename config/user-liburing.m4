@@ -0,0 +1,18 @@
+dnl #
+dnl # Check for liburing - used by libzpool to drive file and disk vdevs.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_LIBURING], [
+	LIBURING=
+
+	AC_CHECK_HEADER([liburing.h], [
+	    AC_CHECK_LIB([uring], [io_uring_queue_init_params], [
+		user_liburing=yes
+		AC_SUBST([LIBURING], ["-luring"])
+		AC_DEFINE([HAVE_LIBURING], 1, [Define if you have liburing])
+	    ], [
+		user_liburing=no
+	    ])
+	], [
+	    user_liburing=no
+	])
+])
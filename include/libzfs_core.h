@@ -58,6 +58,7 @@ int lzc_destroy_snaps(nvlist_t *, boolean_t, nvlist_t **);
 int lzc_bookmark(nvlist_t *, nvlist_t **);
 int lzc_get_bookmarks(const char *, nvlist_t *, nvlist_t **);
 int lzc_get_bookmark_props(const char *, nvlist_t **);
+int lzc_list_snapshots(const char *, nvlist_t *, nvlist_t **);
 int lzc_destroy_bookmarks(nvlist_t *, nvlist_t **);
 int lzc_load_key(const char *, boolean_t, uint8_t *, uint_t);
 int lzc_unload_key(const char *);
@@ -84,6 +85,10 @@ enum lzc_send_flags {
 int lzc_send(const char *, const char *, int, enum lzc_send_flags);
 int lzc_send_resume(const char *, const char *, int,
     enum lzc_send_flags, uint64_t, uint64_t);
+int lzc_send_chunk(const char *, const char *, int,
+    enum lzc_send_flags, uint64_t, uint64_t);
+int lzc_send_stream_compressed(const char *, const char *, int,
+    enum lzc_send_flags, uint64_t, uint64_t, const char *, uint64_t);
 int lzc_send_space(const char *, const char *, enum lzc_send_flags, uint64_t *);
 
 struct dmu_replay_record;
@@ -123,13 +128,36 @@ int lzc_channel_program(const char *, const char *, uint64_t,
     uint64_t, nvlist_t *, nvlist_t **);
 int lzc_channel_program_nosync(const char *, const char *, uint64_t,
     uint64_t, nvlist_t *, nvlist_t **);
+int lzc_channel_program_yielding(const char *, const char *, uint64_t,
+    uint64_t, uint64_t, nvlist_t *, nvlist_t **);
+int lzc_channel_program_stream(const char *, const char *, boolean_t,
+    uint64_t, uint64_t, uint64_t, int, nvlist_t *, nvlist_t **);
 
 int lzc_sync(const char *, nvlist_t *, nvlist_t **);
+int lzc_pool_vdev_stats(const char *, nvlist_t **);
+int lzc_diff_blocks(const char *, nvlist_t *, nvlist_t **);
+int lzc_pool_error_log(const char *, nvlist_t *, nvlist_t **);
 int lzc_reopen(const char *, boolean_t);
 
 int lzc_pool_checkpoint(const char *);
 int lzc_pool_checkpoint_discard(const char *);
 
+typedef struct lzc_async lzc_async_t;
+typedef void lzc_async_cb_t(int, nvlist_t *, void *);
+
+/* Call callbacks from lzc_async_complete(), when lzc_async_fd() polls in */
+#define	LZC_ASYNC_FD	(1 << 0)
+
+lzc_async_t *lzc_async_create(uint_t, int);
+void lzc_async_free(lzc_async_t *);
+int lzc_async_fd(lzc_async_t *);
+int lzc_async_complete(lzc_async_t *);
+void lzc_async_wait(lzc_async_t *);
+int lzc_async_snapshot(lzc_async_t *, nvlist_t *, nvlist_t *,
+    lzc_async_cb_t *, void *);
+int lzc_async_destroy_snaps(lzc_async_t *, nvlist_t *, boolean_t,
+    lzc_async_cb_t *, void *);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -51,6 +51,7 @@ struct libzfs_handle {
 	int libzfs_fd;
 	FILE *libzfs_mnttab;
 	FILE *libzfs_sharetab;
+	pthread_mutex_t libzfs_sharetab_lock;	/* protects libzfs_sharetab */
 	zpool_handle_t *libzfs_pool_handles;
 	uu_avl_pool_t *libzfs_ns_avlpool;
 	uu_avl_t *libzfs_ns_avl;
@@ -77,6 +78,7 @@ struct libzfs_handle {
 };
 
 #define	ZFSSHARE_MISS	0x01	/* Didn't find entry in cache */
+#define	ZFSSHARE_BATCH	0x02	/* In zfs_share_batch_begin() */
 
 struct zfs_handle {
 	libzfs_handle_t *zfs_hdl;
@@ -145,6 +147,8 @@ int zpool_standard_error_fmt(libzfs_handle_t *, int, const char *, ...);
 
 zfs_handle_t *make_dataset_handle_zc(libzfs_handle_t *, zfs_cmd_t *);
 zfs_handle_t *make_dataset_simple_handle_zc(zfs_handle_t *, zfs_cmd_t *);
+zfs_handle_t *make_dataset_handle_nvl(libzfs_handle_t *, const char *,
+    const dmu_objset_stats_t *, nvlist_t *);
 
 int zprop_parse_value(libzfs_handle_t *, nvpair_t *, int, zfs_type_t,
     nvlist_t *, char **, uint64_t *, const char *);
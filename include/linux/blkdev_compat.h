@@ -638,6 +638,23 @@ blk_queue_discard_secure(struct request_queue *q)
 #endif
 }
 
+/*
+ * 4.12 - 4.x API,
+ *   bdev_write_zeroes_sectors() and BLKDEV_ZERO_NOFALLBACK
+ *
+ * Older kernels either lack REQ_OP_WRITE_ZEROES or can't be told not to
+ * fall back to writing zeroed pages, so treat them as unsupported.
+ */
+static inline int
+bdev_write_zeroes(struct block_device *bdev)
+{
+#if defined(HAVE_BLKDEV_ISSUE_ZEROOUT_NOFALLBACK)
+	return (bdev_write_zeroes_sectors(bdev) != 0);
+#else
+	return (0);
+#endif
+}
+
 /*
  * Default Linux IO Scheduler,
  * Setting the scheduler to noop will allow the Linux IO scheduler to
@@ -30,6 +30,9 @@
  *	kfpu_initialize()
  *	kfpu_begin()
  *	kfpu_end()
+ *
+ * CPU feature methods:
+ *	zfs_sha2_available()
  */
 
 #ifndef _SIMD_AARCH64_H
@@ -43,6 +46,7 @@
 
 #if defined(_KERNEL)
 #include <asm/neon.h>
+#include <asm/cpufeature.h>
 #define	kfpu_allowed()		1
 #define	kfpu_initialize(tsk)	do {} while (0)
 #define	kfpu_begin()		kernel_neon_begin()
@@ -55,8 +59,28 @@
 #define	kfpu_initialize(tsk)	do {} while (0)
 #define	kfpu_begin()		do {} while (0)
 #define	kfpu_end()		do {} while (0)
+#include <sys/auxv.h>
 #endif /* defined(_KERNEL) */
 
+/*
+ * Check if the ARMv8 SHA256 instructions are available
+ */
+static inline boolean_t
+zfs_sha2_available(void)
+{
+#if defined(_KERNEL)
+#if defined(cpu_have_named_feature)
+	return (cpu_have_named_feature(SHA2));
+#elif defined(HWCAP_SHA2)
+	return ((elf_hwcap & HWCAP_SHA2) != 0);
+#else
+	return (B_FALSE);
+#endif
+#else
+	return ((getauxval(AT_HWCAP) & HWCAP_SHA2) != 0);
+#endif
+}
+
 #endif /* __aarch64__ */
 
 #endif /* _SIMD_AARCH64_H */
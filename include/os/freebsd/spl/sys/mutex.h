@@ -74,6 +74,20 @@ typedef enum {
 #define	mutex_owned(lock)	sx_xlocked(lock)
 #define	mutex_owner(lock)	sx_xholder(lock)
 
+/*
+ * Lock contention accounting is only implemented by the Linux SPL, DTrace's
+ * lockstat provider covers sx locks here.  These keep the callers in common
+ * code compiling.
+ */
+typedef struct spl_lockstat_class {
+	const char	*lsc_name;
+} spl_lockstat_class_t;
+
+#define	SPL_LOCKSTAT_CLASS_INIT(name, func)	{ .lsc_name = (name) }
+#define	spl_lockstat_start()			((hrtime_t)0)
+#define	spl_lockstat_acquired(lsc, start)	((void) (lsc), (void) (start))
+#define	spl_lockstat_released(lsc, start)	((void) (lsc), (void) (start))
+
 #endif	/* _KERNEL */
 
 #endif	/* _OPENSOLARIS_SYS_MUTEX_H_ */
@@ -64,6 +64,7 @@ struct proc;
 #define	TASKQ_DYNAMIC		0x0004	/* Use dynamic thread scheduling */
 #define	TASKQ_THREADS_CPU_PCT	0x0008	/* number of threads as % of ncpu */
 #define	TASKQ_DC_BATCH		0x0010	/* Taskq uses SDC in batch mode */
+#define	TASKQ_STEAL		0x0020	/* Per-thread queues (ignored) */
 
 /*
  * Flags for taskq_dispatch. TQ_SLEEP/TQ_NOSLEEP should be same as
@@ -99,6 +100,10 @@ taskq_t	*taskq_create_proc(const char *, int, pri_t, int, int,
     struct proc *, uint_t);
 taskq_t	*taskq_create_sysdc(const char *, int, int, int,
     struct proc *, uint_t, uint_t);
+#define	taskq_create_on_node(name, nthreads, pri, min, max, flags, node) \
+    taskq_create(name, nthreads, pri, min, max, flags)
+#define	taskq_nnodes()		1
+#define	taskq_curnode()		0
 void	nulltask(void *);
 extern void taskq_destroy(taskq_t *);
 extern void taskq_wait_id(taskq_t *, taskqid_t);
@@ -0,0 +1,80 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SPL_LOCKSTAT_H
+#define	_SPL_LOCKSTAT_H
+
+#include <linux/module.h>
+#include <linux/list.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+/*
+ * Lock contention accounting.
+ *
+ * Every lock belongs to a class, one per place the lock is initialized, and
+ * while spl_lockstat_enabled is set each class counts its acquisitions and
+ * keeps histograms of how long they waited for and then held the lock.  The
+ * classes register themselves on first use and are reported by the
+ * spl/lockstat kstat.  When disabled the cost is a test of
+ * spl_lockstat_enabled on every acquisition.
+ *
+ * Bucket 0 of the histograms counts times under 1us, and bucket n > 0 those
+ * from 2^(n-1) up to 2^n us, with the last bucket taking everything longer.
+ */
+#define	SPL_LOCKSTAT_BUCKETS	24
+
+typedef struct spl_lockstat_class {
+	const char		*lsc_name;
+	const char		*lsc_func;
+	struct module		*lsc_module;
+	struct list_head	lsc_list;
+	int			lsc_registered;
+	uint64_t		lsc_acquires;
+	uint64_t		lsc_contended;
+	uint64_t		lsc_wait_ns;
+	uint64_t		lsc_hold_ns;
+	uint64_t		lsc_wait[SPL_LOCKSTAT_BUCKETS];
+	uint64_t		lsc_hold[SPL_LOCKSTAT_BUCKETS];
+} spl_lockstat_class_t;
+
+#define	SPL_LOCKSTAT_CLASS_INIT(name, func)			\
+	{ .lsc_name = (name), .lsc_func = (func), .lsc_module = THIS_MODULE }
+
+extern int spl_lockstat_enabled;
+
+extern void spl_lockstat_acquired(spl_lockstat_class_t *lsc, hrtime_t start);
+extern void spl_lockstat_released(spl_lockstat_class_t *lsc, hrtime_t start);
+
+/*
+ * Return the time to pass to spl_lockstat_acquired() or _released() for an
+ * acquisition which may have to wait, or a hold, starting now.
+ */
+static inline hrtime_t
+spl_lockstat_start(void)
+{
+	return (unlikely(spl_lockstat_enabled) ? gethrtime() : 0);
+}
+
+int spl_lockstat_init(void);
+void spl_lockstat_fini(void);
+
+#endif /* _SPL_LOCKSTAT_H */
@@ -29,6 +29,7 @@
 #include <linux/mutex.h>
 #include <linux/lockdep.h>
 #include <linux/compiler_compat.h>
+#include <sys/lockstat.h>
 
 typedef enum {
 	MUTEX_DEFAULT	= 0,
@@ -44,6 +45,8 @@ typedef struct {
 #ifdef CONFIG_LOCKDEP
 	kmutex_type_t		m_type;
 #endif /* CONFIG_LOCKDEP */
+	spl_lockstat_class_t	*m_class;	/* see sys/lockstat.h */
+	hrtime_t		m_acquired;	/* when lockstat enabled */
 } kmutex_t;
 
 #define	MUTEX(mp)		(&((mp)->m_mutex))
@@ -99,12 +102,16 @@ spl_mutex_lockdep_on_maybe(kmutex_t *mp)			\
 #define	mutex_init(mp, name, type, ibc)				\
 {								\
 	static struct lock_class_key __key;			\
+	static spl_lockstat_class_t __lsc =			\
+	    SPL_LOCKSTAT_CLASS_INIT(#mp, __func__);		\
 	ASSERT(type == MUTEX_DEFAULT || type == MUTEX_NOLOCKDEP); \
 								\
 	__mutex_init(MUTEX(mp), (name) ? (#name) : (#mp), &__key); \
 	spin_lock_init(&(mp)->m_lock);				\
 	spl_mutex_clear_owner(mp);				\
 	spl_mutex_set_type(mp, type);				\
+	(mp)->m_class = &__lsc;					\
+	(mp)->m_acquired = 0;					\
 }
 
 #undef mutex_destroy
@@ -119,8 +126,13 @@ spl_mutex_lockdep_on_maybe(kmutex_t *mp)			\
 	int _rc_;						\
 								\
 	spl_mutex_lockdep_off_maybe(mp);			\
-	if ((_rc_ = mutex_trylock(MUTEX(mp))) == 1)		\
+	if ((_rc_ = mutex_trylock(MUTEX(mp))) == 1) {		\
 		spl_mutex_set_owner(mp);			\
+		if (unlikely(spl_lockstat_enabled)) {		\
+			spl_lockstat_acquired((mp)->m_class, 0); \
+			(mp)->m_acquired = gethrtime();		\
+		}						\
+	}							\
 	spl_mutex_lockdep_on_maybe(mp);				\
 								\
 	_rc_;							\
@@ -130,24 +142,36 @@ spl_mutex_lockdep_on_maybe(kmutex_t *mp)			\
 #define	NESTED_SINGLE 1
 
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
-#define	mutex_enter_nested(mp, subclass)			\
-{								\
-	ASSERT3P(mutex_owner(mp), !=, current);			\
-	spl_mutex_lockdep_off_maybe(mp);			\
-	mutex_lock_nested(MUTEX(mp), (subclass));		\
-	spl_mutex_lockdep_on_maybe(mp);				\
-	spl_mutex_set_owner(mp);				\
-}
+#define	spl_mutex_lock(mp, subclass)				\
+	mutex_lock_nested(MUTEX(mp), (subclass))
 #else /* CONFIG_DEBUG_LOCK_ALLOC */
+#define	spl_mutex_lock(mp, subclass)				\
+	mutex_lock(MUTEX(mp))
+#endif /*  CONFIG_DEBUG_LOCK_ALLOC */
+
+/*
+ * With lockstat enabled, an uncontended mutex is taken with mutex_trylock()
+ * so that only the contended acquisitions are timed.
+ */
 #define	mutex_enter_nested(mp, subclass)			\
 {								\
 	ASSERT3P(mutex_owner(mp), !=, current);			\
 	spl_mutex_lockdep_off_maybe(mp);			\
-	mutex_lock(MUTEX(mp));					\
+	if (unlikely(spl_lockstat_enabled)) {			\
+		hrtime_t _start_ = 0;				\
+								\
+		if (mutex_trylock(MUTEX(mp)) != 1) {		\
+			_start_ = gethrtime();			\
+			spl_mutex_lock(mp, subclass);		\
+		}						\
+		spl_lockstat_acquired((mp)->m_class, _start_);	\
+		(mp)->m_acquired = gethrtime();			\
+	} else {						\
+		spl_mutex_lock(mp, subclass);			\
+	}							\
 	spl_mutex_lockdep_on_maybe(mp);				\
 	spl_mutex_set_owner(mp);				\
 }
-#endif /*  CONFIG_DEBUG_LOCK_ALLOC */
 
 #define	mutex_enter(mp) mutex_enter_nested((mp), 0)
 
@@ -173,6 +197,11 @@ spl_mutex_lockdep_on_maybe(kmutex_t *mp)			\
 #define	mutex_exit(mp)						\
 {								\
 	spl_mutex_clear_owner(mp);				\
+	if (unlikely((mp)->m_acquired != 0)) {			\
+		spl_lockstat_released((mp)->m_class,		\
+		    (mp)->m_acquired);				\
+		(mp)->m_acquired = 0;				\
+	}							\
 	spin_lock(&(mp)->m_lock);				\
 	spl_mutex_lockdep_off_maybe(mp);			\
 	mutex_unlock(MUTEX(mp));				\
@@ -42,6 +42,7 @@
 #define	TASKQ_DYNAMIC		0x00000004
 #define	TASKQ_THREADS_CPU_PCT	0x00000008
 #define	TASKQ_DC_BATCH		0x00000010
+#define	TASKQ_STEAL		0x00000020
 #define	TASKQ_ACTIVE		0x80000000
 
 /*
@@ -75,6 +76,16 @@ typedef enum tq_lock_role {
 typedef unsigned long taskqid_t;
 typedef void (task_func_t)(void *);
 
+/*
+ * A TASKQ_STEAL taskq has one of these queues per thread.  Tasks are queued
+ * on and taken from the queue of the current CPU, and taken from the other
+ * queues once it is empty.
+ */
+typedef struct taskq_deque {
+	spinlock_t		tqd_lock;	/* protects tqd_list */
+	struct list_head	tqd_list;	/* queued taskq_ent_t's */
+} ____cacheline_aligned_in_smp taskq_deque_t;
+
 typedef struct taskq {
 	spinlock_t		tq_lock;	/* protects taskq_t */
 	char			*tq_name;	/* taskq name */
@@ -86,6 +97,7 @@ typedef struct taskq {
 	int			tq_nspawn;	/* # of threads being spawned */
 	int			tq_maxthreads;	/* # of threads maximum */
 	int			tq_pri;		/* priority */
+	int			tq_node;	/* NUMA node threads run on */
 	int			tq_minalloc;	/* min taskq_ent_t pool size */
 	int			tq_maxalloc;	/* max taskq_ent_t pool size */
 	int			tq_nalloc;	/* cur taskq_ent_t pool size */
@@ -100,6 +112,10 @@ typedef struct taskq {
 	spl_wait_queue_head_t	tq_work_waitq;	/* new work waitq */
 	spl_wait_queue_head_t	tq_wait_waitq;	/* wait waitq */
 	tq_lock_role_t		tq_lock_class;	/* class when taking tq_lock */
+	taskq_deque_t		*tq_deques;	/* per-thread queues */
+	int			tq_ndeques;	/* # of per-thread queues */
+	atomic_t		tq_ws_queued;	/* # of tasks in the queues */
+	atomic_t		tq_ws_outstanding; /* # queued or running */
 } taskq_t;
 
 typedef struct taskq_ent {
@@ -145,6 +161,8 @@ extern void taskq_dispatch_ent(taskq_t *, task_func_t, void *, uint_t,
 extern int taskq_empty_ent(taskq_ent_t *);
 extern void taskq_init_ent(taskq_ent_t *);
 extern taskq_t *taskq_create(const char *, int, pri_t, int, int, uint_t);
+extern taskq_t *taskq_create_on_node(const char *, int, pri_t, int, int,
+    uint_t, int);
 extern void taskq_destroy(taskq_t *);
 extern void taskq_wait_id(taskq_t *, taskqid_t);
 extern void taskq_wait_outstanding(taskq_t *, taskqid_t);
@@ -156,6 +174,8 @@ extern int taskq_member(taskq_t *, kthread_t *);
     taskq_create(name, nthreads, pri, min, max, flags)
 #define	taskq_create_sysdc(name, nthreads, min, max, proc, dc, flags) \
     taskq_create(name, nthreads, maxclsyspri, min, max, flags)
+#define	taskq_nnodes()		((int)nr_node_ids)
+#define	taskq_curnode()		numa_node_id()
 
 int spl_taskq_init(void);
 void spl_taskq_fini(void);
@@ -43,12 +43,16 @@ typedef enum uio_seg {
 	UIO_SYSSPACE =		1,
 	UIO_USERISPACE =	2,
 	UIO_BVEC =		3,
+	UIO_ITER =		4,
 } uio_seg_t;
 
 typedef struct uio {
 	union {
 		const struct iovec	*uio_iov;
 		const struct bio_vec	*uio_bvec;
+#if defined(HAVE_VFS_IOV_ITER)
+		struct iov_iter		*uio_iter;
+#endif
 	};
 	int		uio_iovcnt;
 	offset_t	uio_loffset;
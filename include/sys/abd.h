@@ -50,6 +50,8 @@ typedef enum abd_flags {
 	ABD_FLAG_MULTI_ZONE  = 1 << 3,	/* pages split over memory zones */
 	ABD_FLAG_MULTI_CHUNK = 1 << 4,	/* pages split over multiple chunks */
 	ABD_FLAG_LINEAR_PAGE = 1 << 5,	/* linear but allocd from page */
+	ABD_FLAG_GANG	= 1 << 6,	/* chain of ABDs */
+	ABD_FLAG_GANG_FREE = 1 << 7,	/* gang ABD is responsible for mem */
 } abd_flags_t;
 
 typedef struct abd {
@@ -57,6 +59,7 @@ typedef struct abd {
 	uint_t		abd_size;	/* excludes scattered abd_offset */
 	struct abd	*abd_parent;
 	zfs_refcount_t	abd_children;
+	list_node_t	abd_gang_link;	/* in the chain of a gang ABD */
 	union {
 		struct abd_scatter {
 			uint_t		abd_offset;
@@ -72,6 +75,9 @@ typedef struct abd {
 			void		*abd_buf;
 			struct scatterlist *abd_sgl; /* for LINEAR_PAGE */
 		} abd_linear;
+		struct abd_gang {
+			list_t		abd_gang_chain;
+		} abd_gang;
 	} abd_u;
 } abd_t;
 
@@ -93,6 +99,12 @@ abd_is_linear_page(abd_t *abd)
 	    B_TRUE : B_FALSE);
 }
 
+static inline boolean_t
+abd_is_gang(abd_t *abd)
+{
+	return ((abd->abd_flags & ABD_FLAG_GANG) != 0 ? B_TRUE : B_FALSE);
+}
+
 /*
  * Allocations and deallocations
  */
@@ -101,6 +113,8 @@ abd_t *abd_alloc(size_t, boolean_t);
 abd_t *abd_alloc_linear(size_t, boolean_t);
 abd_t *abd_alloc_for_io(size_t, boolean_t);
 abd_t *abd_alloc_sametype(abd_t *, size_t);
+abd_t *abd_alloc_gang_abd(void);
+void abd_gang_add(abd_t *, abd_t *, boolean_t);
 void abd_free(abd_t *);
 abd_t *abd_get_offset(abd_t *, size_t);
 abd_t *abd_get_offset_size(abd_t *, size_t, size_t);
@@ -133,6 +147,12 @@ int abd_cmp(abd_t *, abd_t *);
 int abd_cmp_buf_off(abd_t *, const void *, size_t, size_t);
 void abd_zero_off(abd_t *, size_t, size_t);
 
+#if defined(__FreeBSD__) && defined(_KERNEL)
+struct vm_page;
+int abd_unmapped_pages_off(abd_t *, size_t, size_t, struct vm_page **,
+    int *);
+#endif
+
 #if defined(_KERNEL)
 unsigned int abd_scatter_bio_map_off(struct bio *, abd_t *, unsigned int,
 		size_t);
@@ -188,6 +208,7 @@ abd_zero(abd_t *abd, size_t size)
 
 void abd_init(void);
 void abd_fini(void);
+void abd_cache_reap_now(void);
 
 #ifdef __cplusplus
 }
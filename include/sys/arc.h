@@ -146,6 +146,15 @@ typedef enum arc_flags
 	ARC_FLAG_COMPRESSED_ARC		= 1 << 20,
 	ARC_FLAG_SHARED_DATA		= 1 << 21,
 
+	/*
+	 * Public flags refining ARC_FLAG_L2CACHE, following the
+	 * secondarycache property: only feed the buffer to the L2ARC
+	 * once it is in the MFU state, or feed it even if it was
+	 * prefetched and l2arc_noprefetch is set.
+	 */
+	ARC_FLAG_L2_MFUONLY		= 1 << 22,
+	ARC_FLAG_L2_PREFETCH		= 1 << 23,
+
 	/*
 	 * The arc buffer's compression mode is stored in the top 7 bits of the
 	 * flags field, so these dummy flags are included so that MDB can
@@ -161,6 +170,9 @@ typedef enum arc_flags
 
 } arc_flags_t;
 
+#define	ARC_FLAG_L2CACHE_MASK	\
+	(ARC_FLAG_L2CACHE | ARC_FLAG_L2_MFUONLY | ARC_FLAG_L2_PREFETCH)
+
 typedef enum arc_buf_flags {
 	ARC_BUF_FLAG_SHARED		= 1 << 0,
 	ARC_BUF_FLAG_COMPRESSED		= 1 << 1,
@@ -264,6 +276,7 @@ void arc_buf_info(arc_buf_t *buf, arc_buf_info_t *abi, int state_index);
 uint64_t arc_buf_size(arc_buf_t *buf);
 uint64_t arc_buf_lsize(arc_buf_t *buf);
 void arc_buf_access(arc_buf_t *buf);
+uint32_t arc_buf_hits(arc_buf_t *buf);
 void arc_release(arc_buf_t *buf, void *tag);
 int arc_released(arc_buf_t *buf);
 void arc_buf_sigsegv(int sig, siginfo_t *si, void *unused);
@@ -277,7 +290,7 @@ int arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp,
     arc_read_done_func_t *done, void *private, zio_priority_t priority,
     int flags, arc_flags_t *arc_flags, const zbookmark_phys_t *zb);
 zio_t *arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
-    blkptr_t *bp, arc_buf_t *buf, boolean_t l2arc, const zio_prop_t *zp,
+    blkptr_t *bp, arc_buf_t *buf, arc_flags_t l2arc_flags, const zio_prop_t *zp,
     arc_write_done_func_t *ready, arc_write_done_func_t *child_ready,
     arc_write_done_func_t *physdone, arc_write_done_func_t *done,
     void *private, zio_priority_t priority, int zio_flags,
@@ -304,8 +317,6 @@ void l2arc_remove_vdev(vdev_t *vd);
 boolean_t l2arc_vdev_present(vdev_t *vd);
 void l2arc_init(void);
 void l2arc_fini(void);
-void l2arc_start(void);
-void l2arc_stop(void);
 
 #ifndef _KERNEL
 extern boolean_t arc_watch;
@@ -144,6 +144,39 @@ struct arc_write_callback {
  * words in pointers. arc_hdr_realloc() is used to switch a header between
  * these two allocation states.
  */
+/*
+ * A decompressed copy of a compressed hdr's data, kept on the hdr after the
+ * arc_buf_t that needed it has gone away so the next reader can skip
+ * decompression.  Entries are kept on a global LRU list, see the
+ * "Decompressed Buffer Cache" comment in arc.c.
+ */
+typedef struct arc_dcache_entry {
+	/* protected by arc_dcache_lock */
+	list_node_t		de_node;
+
+	/* immutable */
+	arc_buf_hdr_t		*de_hdr;
+	void			*de_data;
+} arc_dcache_entry_t;
+
+/*
+ * The logical size of the blocks an objset has in arc_mru and arc_mfu,
+ * see the "Per-Objset Residency" comment in arc.c.
+ */
+typedef struct arc_os_stat {
+	/* protected by the arc_os_bucket_t lock */
+	list_node_t		aos_node;
+
+	/* immutable */
+	uint64_t		aos_spa;	/* spa_load_guid() */
+	uint64_t		aos_objset;
+
+	/* updated atomically */
+	uint64_t		aos_refcnt;	/* hdrs pointing here */
+	uint64_t		aos_mru_size;
+	uint64_t		aos_mfu_size;
+} arc_os_stat_t;
+
 typedef struct l1arc_buf_hdr {
 	kmutex_t		b_freeze_lock;
 	zio_cksum_t		*b_freeze_cksum;
@@ -172,6 +205,12 @@ typedef struct l1arc_buf_hdr {
 
 	arc_callback_t		*b_acb;
 	abd_t			*b_pabd;
+
+	/* protected by the hash lock and arc_dcache_lock */
+	arc_dcache_entry_t	*b_dcache;
+
+	/* protected by the hash lock */
+	arc_os_stat_t		*b_os;
 } l1arc_buf_hdr_t;
 
 /*
@@ -204,6 +243,126 @@ typedef struct arc_buf_hdr_crypt {
 	uint8_t			b_mac[ZIO_DATA_MAC_LEN];
 } arc_buf_hdr_crypt_t;
 
+/*
+ * Persistent L2ARC
+ *
+ * The L2ARC device contents are described by a small device header, which
+ * lives right after the front vdev labels, and a chain of log blocks which
+ * are interleaved with the cached buffers themselves.  Each log block
+ * records the identity and device location of up to
+ * L2ARC_LOG_BLK_MAX_ENTRIES buffers and points back to the log block that
+ * was written before it.  The device header points to the most recently
+ * written log block, so that on pool import l2arc_rebuild() can walk the
+ * chain backwards (newest to oldest) and recreate the L2-only ARC headers
+ * without having to re-feed the device.
+ *
+ *	+-------+-------+------+----------+------+----------+----------+
+ *	| label | label | dev  | buffers  | log  | buffers  | log  ... |
+ *	|   0   |   1   | hdr  |          | blk  |          | blk      |
+ *	+-------+-------+------+----------+------+----------+----------+
+ *	                   |        ^          ^      |          |
+ *	                   |        |          `------+----------'
+ *	                   |        `-----------------'  lb_prev_lbp
+ *	                   `--> dh_start_lbp (newest log block)
+ *
+ * All on-disk structures are stored in native byte order.  A device written
+ * on a host with a different endianness is simply not rebuilt.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x5a46534341434845LLU	/* ASCII: "ZFSCACHE" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c4f47424c4b4844LLU	/* ASCII: "LOGBLKHD" */
+#define	L2ARC_PERSISTENT_VERSION	1
+
+/* Log blocks are always 64k, including the header section */
+#define	L2ARC_LOG_BLK_MAX_ENTRIES	(1022)
+
+/* Device header flags */
+typedef enum l2arc_dev_hdr_flags_t {
+	L2ARC_DEV_HDR_EVICT_FIRST = (1 << 0),	/* mirror of l2ad_first */
+} l2arc_dev_hdr_flags_t;
+
+/*
+ * Pointer to a log block.  lbp_prop uses the L2BLK_* accessors below, of
+ * which only the LSIZE, PSIZE (the on-disk size of the log block) and
+ * CHECKSUM fields are meaningful.
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t	lbp_daddr;		/* device address of log blk */
+	uint64_t	lbp_payload_asize;	/* asize of described buffers */
+	uint64_t	lbp_payload_start;	/* offset of its first buffer */
+	uint64_t	lbp_prop;		/* log block properties */
+	zio_cksum_t	lbp_cksum;		/* fletcher4 of log block */
+} l2arc_log_blkptr_t;
+
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t	dh_magic;		/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t	dh_version;		/* L2ARC_PERSISTENT_VERSION */
+
+	/* Identity of the pool and cache device which wrote the header */
+	uint64_t	dh_spa_guid;
+	uint64_t	dh_vdev_guid;
+
+	uint64_t	dh_log_entries;		/* L2ARC_LOG_BLK_MAX_ENTRIES */
+	uint64_t	dh_evict;		/* mirror of l2ad_evict */
+	uint64_t	dh_flags;		/* l2arc_dev_hdr_flags_t */
+	uint64_t	dh_start;		/* mirror of l2ad_start */
+	uint64_t	dh_end;			/* mirror of l2ad_end */
+
+	l2arc_log_blkptr_t	dh_start_lbp;	/* newest log block */
+
+	/*
+	 * Pad to 512 bytes.  The header is written with an embedded label
+	 * checksum, which occupies the tail of the ashift-aligned I/O.
+	 */
+	uint64_t	dh_pad[47];
+} l2arc_dev_hdr_phys_t;
+
+/*
+ * A single L2ARC buffer as described by a log block.  le_prop uses the
+ * L2BLK_* accessors below.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;			/* dva of buffer */
+	uint64_t	le_birth;		/* birth txg of buffer */
+	uint64_t	le_prop;		/* buffer properties */
+	uint64_t	le_daddr;		/* buffer location on device */
+	uint64_t	le_pad[3];		/* pad to 64 bytes */
+} l2arc_log_ent_phys_t;
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	l2arc_log_blkptr_t	lb_prev_lbp;	/* previous log block */
+	uint64_t		lb_pad[7];	/* pad header to 128 bytes */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_MAX_ENTRIES];
+} l2arc_log_blk_phys_t;
+
+CTASSERT_GLOBAL(sizeof (l2arc_dev_hdr_phys_t) == SPA_MINBLOCKSIZE);
+CTASSERT_GLOBAL(sizeof (l2arc_log_blk_phys_t) == 64 * 1024);
+
+#define	L2BLK_GET_LSIZE(field)	\
+	BF64_GET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_LSIZE(field, x)	\
+	BF64_SET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_PSIZE(field)	\
+	BF64_GET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_PSIZE(field, x)	\
+	BF64_SET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_COMPRESS(field)	\
+	BF64_GET((field), 32, SPA_COMPRESSBITS)
+#define	L2BLK_SET_COMPRESS(field, x)	\
+	BF64_SET((field), 32, SPA_COMPRESSBITS, x)
+#define	L2BLK_GET_CHECKSUM(field)	BF64_GET((field), 40, 8)
+#define	L2BLK_SET_CHECKSUM(field, x)	BF64_SET((field), 40, 8, x)
+#define	L2BLK_GET_TYPE(field)		BF64_GET((field), 48, 8)
+#define	L2BLK_SET_TYPE(field, x)	BF64_SET((field), 48, 8, x)
+#define	L2BLK_GET_PROTECTED(field)	BF64_GET((field), 56, 1)
+#define	L2BLK_SET_PROTECTED(field, x)	BF64_SET((field), 56, 1, x)
+
+/*
+ * We can feed L2ARC from two states of ARC buffers, mru and mfu,
+ * and each of the state has two types: data and metadata.
+ */
+#define	L2ARC_FEED_TYPES	4
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
@@ -216,14 +375,39 @@ typedef struct l2arc_dev {
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	zfs_refcount_t		l2ad_alloc;	/* allocated bytes */
+	/*
+	 * Persistent L2ARC state.  The device header and the log block
+	 * under construction are only modified by the feed thread, or by
+	 * the rebuild thread before feeding to the device is allowed.
+	 */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;	/* device header */
+	uint64_t		l2ad_dev_hdr_asize; /* aligned hdr size */
+	l2arc_log_blk_phys_t	l2ad_log_blk;	/* log block being built */
+	int			l2ad_log_ent_idx; /* index into log block */
+	uint64_t		l2ad_log_blk_payload_asize;
+	uint64_t		l2ad_log_blk_payload_start;
+	uint64_t		l2ad_evict;	/* last addr evicted */
+	/* protected by l2arc_rebuild_thr_lock */
+	boolean_t		l2ad_rebuild;	/* rebuild in progress */
+	boolean_t		l2ad_rebuild_cancel;
+	/* protected by l2arc_feed_thr_lock */
+	boolean_t		l2ad_feeding;	/* feed thread running */
+	boolean_t		l2ad_feed_exit;	/* feed thread should exit */
+	kcondvar_t		l2ad_feed_cv;
+	/*
+	 * Only used by the feed thread: the write size multiplier, the
+	 * evict_l2_eligible kstat at the last feed, and one marker per
+	 * sublist of each list fed from, see l2arc_write_buffers().
+	 */
+	uint64_t		l2ad_feed_mult;
+	uint64_t		l2ad_feed_evicted;
+	arc_buf_hdr_t		**l2ad_markers[L2ARC_FEED_TYPES];
 } l2arc_dev_t;
 
 typedef struct l2arc_buf_hdr {
 	/* protected by arc_buf_hdr mutex */
 	l2arc_dev_t		*b_dev;		/* L2ARC device */
 	uint64_t		b_daddr;	/* disk address, offset byte */
-	uint32_t		b_hits;
-
 	list_node_t		b_l2node;
 } l2arc_buf_hdr_t;
 
@@ -238,6 +422,13 @@ struct arc_buf_hdr {
 	uint64_t		b_birth;
 
 	arc_buf_contents_t	b_type;
+	/*
+	 * L2ARC hit count, undefined when not in L2ARC.  It lives here
+	 * rather than in b_l2hdr so that it fills the hole after b_type,
+	 * which keeps the L2-only header (everything before b_l1hdr) as
+	 * small as possible.
+	 */
+	uint32_t		b_l2hits;
 	arc_buf_hdr_t		*b_hash_next;
 	arc_flags_t		b_flags;
 
@@ -322,6 +513,19 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_evict_l2_eligible;
 	kstat_named_t arcstat_evict_l2_ineligible;
 	kstat_named_t arcstat_evict_l2_skip;
+	/*
+	 * Number of bytes evicted from the MRU and MFU states to their
+	 * respective ghost states.  Sampling these gives the eviction rate
+	 * of each state, which together with the ghost hits and arcstat_p
+	 * shows how the cache is balancing between recency and frequency.
+	 */
+	kstat_named_t arcstat_evict_mru;
+	kstat_named_t arcstat_evict_mfu;
+	/*
+	 * Number of ghost hits which did not adapt arcstat_p because the
+	 * buffer had only ever been prefetched before it was evicted.
+	 */
+	kstat_named_t arcstat_adapt_prefetch_skip;
 	kstat_named_t arcstat_hash_elements;
 	kstat_named_t arcstat_hash_elements_max;
 	kstat_named_t arcstat_hash_collisions;
@@ -353,6 +557,13 @@ typedef struct arc_stats {
 	 * values have been set (see comment in dbuf.c for more information).
 	 */
 	kstat_named_t arcstat_overhead_size;
+	/*
+	 * Number of bytes held by the decompressed buffer cache, and the
+	 * number of times a buffer was filled from it instead of being
+	 * decompressed again.
+	 */
+	kstat_named_t arcstat_dcache_size;
+	kstat_named_t arcstat_dcache_hits;
 	/*
 	 * Number of bytes consumed by internal ARC structures necessary
 	 * for tracking purposes; these structures are not actually
@@ -530,6 +741,22 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_psize;
 	/* Not updated directly; only synced in arc_kstat_update. */
 	kstat_named_t arcstat_l2_hdr_size;
+	/*
+	 * Persistent L2ARC statistics.  The rebuild counters describe the
+	 * log blocks and buffers recovered from cache devices at pool
+	 * import or device add time.
+	 */
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_size;
+	kstat_named_t arcstat_l2_rebuild_asize;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_memory_direct_count;
 	kstat_named_t arcstat_memory_indirect_count;
@@ -549,6 +776,12 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_async_upgrade_sync;
 	kstat_named_t arcstat_demand_hit_predictive_prefetch;
 	kstat_named_t arcstat_demand_hit_prescient_prefetch;
+	/*
+	 * Number and size of predictively prefetched buffers that were
+	 * evicted from the mru or mfu before any demand read used them.
+	 */
+	kstat_named_t arcstat_evict_predictive_prefetch_unread;
+	kstat_named_t arcstat_evict_predictive_prefetch_unread_bytes;
 	kstat_named_t arcstat_need_free;
 	kstat_named_t arcstat_sys_free;
 	kstat_named_t arcstat_raw_size;
@@ -251,6 +251,15 @@ extern void *avl_nearest(avl_tree_t *tree, avl_index_t where, int direction);
  */
 extern void avl_add(avl_tree_t *tree, void *node);
 
+/*
+ * Fill an empty tree with nodes which are already in ascending order,
+ * in O(n) rather than the O(n log n) of adding them one at a time.
+ * No two nodes may compare equal.
+ *
+ * nodes    - array of the nodes to add
+ * numnodes - number of entries in nodes
+ */
+extern void avl_build_sorted(avl_tree_t *tree, void **nodes, ulong_t numnodes);
 
 /*
  * Remove a single node from the tree.  The node must be in the tree.
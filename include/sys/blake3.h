@@ -0,0 +1,91 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Interface declarations for BLAKE3 hashing.  The algorithm is described
+ * in the BLAKE3 specification found at:
+ * https://github.com/BLAKE3-team/BLAKE3-specs/blob/master/blake3.pdf
+ */
+
+#ifndef	_SYS_BLAKE3_H
+#define	_SYS_BLAKE3_H
+
+#ifdef  _KERNEL
+#include <sys/types.h>		/* get size_t definition */
+#else
+#include <stdint.h>
+#include <stdlib.h>
+#endif
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	BLAKE3_KEY_LEN		32
+#define	BLAKE3_OUT_LEN		32
+#define	BLAKE3_MAX_DEPTH	54
+#define	BLAKE3_BLOCK_LEN	64
+#define	BLAKE3_CHUNK_LEN	1024
+
+/*
+ * State of the chunk currently being hashed.
+ */
+typedef struct {
+	uint32_t	cv[8];		/* chaining value */
+	uint64_t	chunk_counter;
+	uint8_t		buf[BLAKE3_BLOCK_LEN];
+	uint8_t		buf_len;
+	uint8_t		blocks_compressed;
+	uint8_t		flags;
+} blake3_chunk_state_t;
+
+typedef struct {
+	uint32_t		key[8];
+	blake3_chunk_state_t	chunk;
+	/* chaining values of the completed subtrees, see Blake3_Update() */
+	uint8_t			cv_stack_len;
+	uint8_t	cv_stack[(BLAKE3_MAX_DEPTH + 1) * BLAKE3_OUT_LEN];
+} BLAKE3_CTX;
+
+void Blake3_Init(BLAKE3_CTX *ctx);
+void Blake3_InitKeyed(BLAKE3_CTX *ctx, const uint8_t key[BLAKE3_KEY_LEN]);
+void Blake3_Update(BLAKE3_CTX *ctx, const void *input, size_t len);
+void Blake3_Final(const BLAKE3_CTX *ctx, uint8_t *out);
+void Blake3_FinalSeek(const BLAKE3_CTX *ctx, uint64_t seek, uint8_t *out,
+    size_t len);
+
+/*
+ * Selection of the BLAKE3 implementation.  Implementations are identified
+ * by their index among the supported ones, or by name.  Until
+ * blake3_impl_init() has been called the generic implementation is used.
+ */
+void blake3_impl_init(void);
+void blake3_impl_fini(void);
+uint32_t blake3_impl_getcnt(void);
+const char *blake3_impl_getname(uint32_t id);
+int blake3_impl_setid(uint32_t id);
+int blake3_impl_set(const char *name);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BLAKE3_H */
@@ -34,6 +34,15 @@ typedef struct bqueue {
 	uint64_t bq_maxsize;
 	uint64_t bq_fill_fraction;
 	size_t bq_node_offset;
+	int bq_add_waiters;		/* producers blocked on a full queue */
+	int bq_pop_waiters;		/* consumers blocked on an empty one */
+	list_t bq_stage;		/* producer's unpublished items */
+	uint64_t bq_stage_size;
+	int bq_stage_count;
+	list_t bq_take;			/* items moved out for the consumer */
+	uint64_t bq_bytes;		/* total size of enqueued items */
+	hrtime_t bq_enqueue_wait;	/* time spent blocked on a full queue */
+	hrtime_t bq_dequeue_wait;	/* time spent blocked on an empty one */
 } bqueue_t;
 
 typedef struct bqueue_node {
@@ -46,9 +55,16 @@ int bqueue_init(bqueue_t *, uint64_t, uint64_t, size_t);
 void bqueue_destroy(bqueue_t *);
 void bqueue_enqueue(bqueue_t *, void *, uint64_t);
 void bqueue_enqueue_flush(bqueue_t *, void *, uint64_t);
+void bqueue_flush(bqueue_t *);
 void *bqueue_dequeue(bqueue_t *);
 boolean_t bqueue_empty(bqueue_t *);
 
+/* Number of named kstats filled in by bqueue_kstat_init() */
+#define	BQUEUE_KSTAT_COUNT	4
+
+void bqueue_kstat_init(kstat_named_t *, const char *);
+void bqueue_kstat_update(bqueue_t *, kstat_named_t *);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,193 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_BTREE_H
+#define	_BTREE_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include	<sys/zfs_context.h>
+
+/*
+ * This file defines the interface for a B-Tree implementation for ZFS. The
+ * tree can be used to store arbitrary sortable data types with low overhead
+ * and good cache locality.
+ *
+ * Unlike the AVL tree, which links separately allocated nodes embedded in
+ * the caller's structures, the B-Tree copies each element into fixed-size
+ * tree nodes.  Elements are packed back to back in the nodes, so the per
+ * element overhead is close to zero and walking the tree touches far fewer
+ * cache lines.  The element size is fixed when the tree is created.
+ *
+ * The trade-off is that elements do not have a stable address: any
+ * insertion or removal may move other elements around within and between
+ * nodes.  Pointers returned by the lookup and iteration functions, and
+ * zfs_btree_index_t values, are only valid until the tree is next
+ * modified.  Elements may be modified in place as long as their position
+ * in the sort order does not change.
+ *
+ * Like the rest of ZFS's data structures the tree does no locking of its
+ * own; consumers must provide it.
+ */
+
+/*
+ * Size of a leaf node in bytes, and number of elements in a core node.
+ */
+#define	BTREE_LEAF_SIZE		4096
+#define	BTREE_CORE_ELEMS	126
+
+typedef struct zfs_btree_hdr {
+	struct zfs_btree_core	*bth_parent;
+	boolean_t		bth_core;
+	/*
+	 * For both leaf and core nodes, the number of elements stored in
+	 * the node.  Core nodes have one more child than elements.
+	 */
+	uint32_t		bth_count;
+} zfs_btree_hdr_t;
+
+typedef struct zfs_btree_core {
+	zfs_btree_hdr_t	btc_hdr;
+	zfs_btree_hdr_t	*btc_children[BTREE_CORE_ELEMS + 1];
+	uint8_t		btc_elems[];
+} zfs_btree_core_t;
+
+typedef struct zfs_btree_leaf {
+	zfs_btree_hdr_t	btl_hdr;
+	uint8_t		btl_elems[];
+} zfs_btree_leaf_t;
+
+typedef struct zfs_btree_index {
+	zfs_btree_hdr_t	*bti_node;
+	uint32_t	bti_offset;
+	/*
+	 * True if the location is before the element at bti_offset rather
+	 * than on it.  Such indexes are returned by a failed zfs_btree_find()
+	 * and describe where the searched-for value would be inserted.
+	 */
+	boolean_t	bti_before;
+} zfs_btree_index_t;
+
+typedef struct zfs_btree {
+	zfs_btree_hdr_t		*bt_root;
+	int64_t			bt_height;	/* -1 when empty */
+	size_t			bt_elem_size;
+	uint32_t		bt_leaf_cap;	/* elements per leaf */
+	uint64_t		bt_num_elems;
+	uint64_t		bt_num_nodes;
+	int (*bt_compar) (const void *, const void *);
+} zfs_btree_t;
+
+/*
+ * Allocate and deallocate caches for the B-Tree nodes.
+ */
+void zfs_btree_init(void);
+void zfs_btree_fini(void);
+void zfs_btree_reap(void);
+
+/*
+ * Initialize a B-Tree.  The comparator follows the AVL convention: it
+ * returns a negative value, zero or a positive value if the first element
+ * sorts before, equal to or after the second one.  "size" is the size of
+ * the elements stored in the tree and must be small enough that several
+ * of them fit in a leaf node.
+ */
+void zfs_btree_create(zfs_btree_t *, int (*) (const void *, const void *),
+    size_t);
+
+/*
+ * Find a node with a matching value in the tree.  Returns the matching
+ * element; otherwise NULL, in which case "where" (if non-NULL) is set to
+ * the location the value would be inserted at.
+ */
+void *zfs_btree_find(zfs_btree_t *, const void *, zfs_btree_index_t *);
+
+/*
+ * Insert a new value at the location returned by a failed zfs_btree_find().
+ */
+void zfs_btree_add_idx(zfs_btree_t *, const void *, const zfs_btree_index_t *);
+
+/*
+ * Return the first or last valued node in the tree.  Returns NULL if the
+ * tree is empty.  The index may be NULL.
+ */
+void *zfs_btree_first(zfs_btree_t *, zfs_btree_index_t *);
+void *zfs_btree_last(zfs_btree_t *, zfs_btree_index_t *);
+
+/*
+ * Return the next or previous valued node in the tree, starting from
+ * "idx", which may be the result of a failed zfs_btree_find().  "out_idx"
+ * may be the same index as "idx".  Returns NULL at the end of the tree.
+ */
+void *zfs_btree_next(zfs_btree_t *, const zfs_btree_index_t *,
+    zfs_btree_index_t *);
+void *zfs_btree_prev(zfs_btree_t *, const zfs_btree_index_t *,
+    zfs_btree_index_t *);
+
+/*
+ * Get a value from a tree and an index.
+ */
+void *zfs_btree_get(zfs_btree_t *, zfs_btree_index_t *);
+
+/*
+ * Add a single value to the tree.  The value must not already exist.
+ */
+void zfs_btree_add(zfs_btree_t *, const void *);
+
+/*
+ * Remove a single value from the tree.  The value must exist.  The pointer
+ * passed in may be an element of the tree itself.
+ */
+void zfs_btree_remove(zfs_btree_t *, const void *);
+
+/*
+ * Remove the value at the given location from the tree.
+ */
+void zfs_btree_remove_idx(zfs_btree_t *, zfs_btree_index_t *);
+
+/*
+ * Return the number of elements in the tree.
+ */
+ulong_t zfs_btree_numnodes(zfs_btree_t *);
+
+/*
+ * Remove all the elements from the tree and free all its nodes.
+ */
+void zfs_btree_clear(zfs_btree_t *);
+
+/*
+ * Destroy an empty tree.
+ */
+void zfs_btree_destroy(zfs_btree_t *);
+
+/*
+ * Check the internal consistency of the tree.  Only does any work when
+ * zfs_btree_verify_intensity is non-zero.
+ */
+void zfs_btree_verify(zfs_btree_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _BTREE_H */
@@ -31,6 +31,36 @@
 #include <sys/dmu.h>
 #include <sys/kstat.h>
 
+/*
+ * Latency histogram buckets hold operations that took up to 2^n
+ * microseconds, from 1us up to 16s (the last bucket holds anything
+ * slower).  Size histogram buckets hold operations of up to 2^(n + 9)
+ * bytes, from 512 bytes up to 16M (the last bucket holds anything
+ * larger).
+ */
+#define	DATASET_LAT_BUCKETS	25
+#define	DATASET_SIZE_BUCKETS	16
+#define	DATASET_SIZE_MINSHIFT	9
+
+typedef enum dataset_op {
+	DATASET_OP_READ,
+	DATASET_OP_WRITE,
+	DATASET_OP_FSYNC,
+	DATASET_OP_TYPES
+} dataset_op_t;
+
+/* Only reads and writes have a size */
+#define	DATASET_SIZE_OPS	DATASET_OP_FSYNC
+
+/*
+ * Each CPU counts into its own copy of the histograms, which are only
+ * summed up when the kstat is read.
+ */
+typedef struct dataset_histograms {
+	uint64_t dh_lat[DATASET_OP_TYPES][DATASET_LAT_BUCKETS];
+	uint64_t dh_size[DATASET_SIZE_OPS][DATASET_SIZE_BUCKETS];
+} dataset_histograms_t;
+
 typedef struct dataset_aggsum_stats_t {
 	aggsum_t das_writes;
 	aggsum_t das_nwritten;
@@ -56,10 +86,18 @@ typedef struct dataset_kstat_values {
 	 * entry is removed from the unlinked set
 	 */
 	kstat_named_t dkv_nunlinked;
+	/*
+	 * The histograms, named <op>_lat_<n>us and <op>_size_<n>, only
+	 * present if zfs_dataset_kstats_histograms was set at mount time.
+	 */
+	kstat_named_t dkv_lat[DATASET_OP_TYPES][DATASET_LAT_BUCKETS];
+	kstat_named_t dkv_size[DATASET_SIZE_OPS][DATASET_SIZE_BUCKETS];
 } dataset_kstat_values_t;
 
 typedef struct dataset_kstats {
 	dataset_aggsum_stats_t dk_aggsums;
+	dataset_histograms_t **dk_histograms;	/* per CPU, may be NULL */
+	uint_t dk_nhistograms;
 	kstat_t *dk_kstats;
 } dataset_kstats_t;
 
@@ -68,6 +106,8 @@ void dataset_kstats_destroy(dataset_kstats_t *);
 
 void dataset_kstats_update_write_kstats(dataset_kstats_t *, int64_t);
 void dataset_kstats_update_read_kstats(dataset_kstats_t *, int64_t);
+void dataset_kstats_update_latency(dataset_kstats_t *, dataset_op_t,
+    hrtime_t);
 
 void dataset_kstats_update_nunlinks_kstat(dataset_kstats_t *, int64_t);
 void dataset_kstats_update_nunlinked_kstat(dataset_kstats_t *, int64_t);
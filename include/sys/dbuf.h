@@ -55,6 +55,7 @@ extern "C" {
 #define	DB_RF_NEVERWAIT		(1 << 4)
 #define	DB_RF_CACHED		(1 << 5)
 #define	DB_RF_NO_DECRYPT	(1 << 6)
+#define	DB_RF_NOCACHE		(1 << 7)
 
 /*
  * The simplified state transition diagram for dbufs looks like:
@@ -161,6 +162,8 @@ typedef struct dbuf_dirty_record {
 			uint8_t dr_copies;
 			boolean_t dr_nopwrite;
 			boolean_t dr_has_raw_params;
+			/* rewrite on the special class, see dmu_promote() */
+			boolean_t dr_promote;
 
 			/*
 			 * If dr_has_raw_params is set, the following crypt
@@ -272,6 +275,9 @@ typedef struct dmu_buf_impl {
 	/* Tells us which dbuf cache this dbuf is in, if any */
 	dbuf_cached_state_t db_caching_status;
 
+	/* Sublist of that cache, that of the CPU which inserted the dbuf */
+	uint32_t db_cache_sublist;
+
 	/* Data which is unique to data (leaf) blocks: */
 
 	/* User callback information. */
@@ -296,16 +302,23 @@ typedef struct dmu_buf_impl {
 	 */
 	uint8_t db_pending_evict;
 
+	/*
+	 * This dbuf was brought in by a direct I/O (DMU_DIRECTIO) and
+	 * should be dropped from the dbuf cache and the ARC once its
+	 * last hold is released, unless a cached access clears it first.
+	 */
+	uint8_t db_uncached;
+
 	uint8_t db_dirtycnt;
 } dmu_buf_impl_t;
 
 /* Note: the dbuf hash table is exposed only for the mdb module */
-#define	DBUF_MUTEXES 8192
-#define	DBUF_HASH_MUTEX(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+#define	DBUF_RWLOCKS 8192
+#define	DBUF_HASH_RWLOCK(h, idx) (&(h)->hash_rwlocks[(idx) & (DBUF_RWLOCKS-1)])
 typedef struct dbuf_hash_table {
 	uint64_t hash_table_mask;
 	dmu_buf_impl_t **hash_table;
-	kmutex_t hash_mutexes[DBUF_MUTEXES];
+	krwlock_t hash_rwlocks[DBUF_RWLOCKS];
 } dbuf_hash_table_t;
 
 uint64_t dbuf_whichblock(const struct dnode *di, const int64_t level,
@@ -338,6 +351,7 @@ dmu_buf_impl_t *dbuf_find(struct objset *os, uint64_t object, uint8_t level,
     uint64_t blkid);
 
 int dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags);
+void dbuf_set_uncached(dmu_buf_impl_t *db);
 void dmu_buf_will_not_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_will_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_fill_done(dmu_buf_t *db, dmu_tx_t *tx);
@@ -364,6 +378,8 @@ void dbuf_new_size(dmu_buf_impl_t *db, int size, dmu_tx_t *tx);
 
 void dbuf_stats_init(dbuf_hash_table_t *hash);
 void dbuf_stats_destroy(void);
+void dbuf_stats_objset_add(objset_t *os);
+void dbuf_stats_objset_remove(objset_t *os);
 
 int dbuf_dnode_findbp(dnode_t *dn, uint64_t level, uint64_t blkid,
     blkptr_t *bp, uint16_t *datablkszsec, uint8_t *indblkshift);
@@ -387,16 +403,12 @@ boolean_t dbuf_is_metadata(dmu_buf_impl_t *db);
 	(dbuf_is_metadata(_db) &&					\
 	((_db)->db_objset->os_primary_cache == ZFS_CACHE_METADATA)))
 
-#define	DBUF_IS_L2CACHEABLE(_db)					\
-	((_db)->db_objset->os_secondary_cache == ZFS_CACHE_ALL ||	\
-	(dbuf_is_metadata(_db) &&					\
-	((_db)->db_objset->os_secondary_cache == ZFS_CACHE_METADATA)))
+#define	DBUF_L2CACHE_FLAGS(_db)						\
+	dmu_objset_l2cache_flags((_db)->db_objset, dbuf_is_metadata(_db))
 
-#define	DNODE_LEVEL_IS_L2CACHEABLE(_dn, _level)				\
-	((_dn)->dn_objset->os_secondary_cache == ZFS_CACHE_ALL ||	\
-	(((_level) > 0 ||						\
-	DMU_OT_IS_METADATA((_dn)->dn_handle->dnh_dnode->dn_type)) &&	\
-	((_dn)->dn_objset->os_secondary_cache == ZFS_CACHE_METADATA)))
+#define	DNODE_LEVEL_L2CACHE_FLAGS(_dn, _level)				\
+	dmu_objset_l2cache_flags((_dn)->dn_objset, (_level) > 0 ||	\
+	DMU_OT_IS_METADATA((_dn)->dn_handle->dnh_dnode->dn_type))
 
 #ifdef ZFS_DEBUG
 
@@ -131,6 +131,81 @@ struct ddt_entry {
 	avl_node_t	dde_node;
 };
 
+/*
+ * On-disk dedup log header, kept in the bonus buffer of each log object.
+ * While a log is being flushed, the records of the keys up to and
+ * including the checkpoint have been applied to the ZAPs.
+ */
+typedef struct ddt_log_phys {
+	uint64_t	dlp_flags;		/* DDT_LOG_FLAG_* */
+	uint64_t	dlp_length;		/* number of records */
+	uint64_t	dlp_first_txg;		/* txg of the first record */
+	ddt_key_t	dlp_checkpoint;		/* last key flushed */
+} ddt_log_phys_t;
+
+#define	DDT_LOG_FLAG_FLUSHING	(1ULL << 0)
+#define	DDT_LOG_FLAG_CHECKPOINT	(1ULL << 1)
+
+/*
+ * On-disk dedup log record: the state of an entry at the end of a txg.
+ * An entry without references is removed from the table.
+ */
+typedef struct ddt_log_record {
+	ddt_key_t	dlr_key;
+	ddt_phys_t	dlr_phys[DDT_PHYS_TYPES];
+} ddt_log_record_t;
+
+/*
+ * In-core dedup log entry, the latest record of a key in a log
+ */
+typedef struct ddt_log_entry {
+	ddt_key_t	dle_key;
+	ddt_phys_t	dle_phys[DDT_PHYS_TYPES];
+	avl_node_t	dle_node;
+} ddt_log_entry_t;
+
+/*
+ * In-core dedup log.  Each table has two: records are appended to the
+ * active one, while the entries of the flushing one are applied to the
+ * ZAPs.  The roles are swapped when the flushing log is empty.
+ */
+typedef struct ddt_log {
+	uint64_t	ddl_object;
+	ddt_log_phys_t	ddl_phys;
+	avl_tree_t	ddl_tree;
+} ddt_log_t;
+
+/*
+ * Records appended to the active log in a txg, written out a buffer at
+ * a time.
+ */
+typedef struct ddt_log_update {
+	ddt_log_record_t *dlu_buf;
+	uint64_t	dlu_count;	/* records in dlu_buf */
+	uint64_t	dlu_max;	/* capacity of dlu_buf */
+	dmu_tx_t	*dlu_tx;
+} ddt_log_update_t;
+
+/*
+ * In-core state of the pruning of unique entries, see ddt_prune().  The
+ * first walk of the unique class counts the entries by age, the second
+ * one removes those born before the cutoff.
+ */
+enum ddt_prune_state {
+	DDT_PRUNE_NONE = 0,
+	DDT_PRUNE_COUNT,
+	DDT_PRUNE_REMOVE
+};
+
+typedef struct ddt_prune {
+	enum ddt_prune_state dpr_state;
+	uint64_t	dpr_cursor;		/* walk of the unique class */
+	uint64_t	dpr_txg;		/* txg the count started in */
+	uint64_t	dpr_cutoff;		/* remove entries born up to */
+	uint64_t	dpr_total;		/* unique entries counted */
+	uint64_t	dpr_hist[65];		/* entries by highbit of age */
+} ddt_prune_t;
+
 /*
  * In-core ddt
  */
@@ -146,6 +221,10 @@ struct ddt {
 	ddt_histogram_t	ddt_histogram[DDT_TYPES][DDT_CLASSES];
 	ddt_histogram_t	ddt_histogram_cache[DDT_TYPES][DDT_CLASSES];
 	ddt_object_t	ddt_object_stats[DDT_TYPES][DDT_CLASSES];
+	ddt_log_t	ddt_log[2];
+	ddt_log_t	*ddt_log_active;
+	ddt_log_t	*ddt_log_flushing;
+	ddt_prune_t	ddt_prune;
 	avl_node_t	ddt_node;
 };
 
@@ -170,8 +249,12 @@ typedef struct ddt_ops {
 	int (*ddt_op_lookup)(objset_t *os, uint64_t object, ddt_entry_t *dde);
 	void (*ddt_op_prefetch)(objset_t *os, uint64_t object,
 	    ddt_entry_t *dde);
+	void (*ddt_op_prefetch_batch)(objset_t *os, uint64_t object,
+	    const ddt_key_t *keys, uint_t count);
 	int (*ddt_op_update)(objset_t *os, uint64_t object, ddt_entry_t *dde,
 	    dmu_tx_t *tx);
+	int (*ddt_op_update_batch)(objset_t *os, uint64_t object,
+	    ddt_entry_t **ddes, uint_t count, dmu_tx_t *tx);
 	int (*ddt_op_remove)(objset_t *os, uint64_t object, ddt_entry_t *dde,
 	    dmu_tx_t *tx);
 	int (*ddt_op_walk)(objset_t *os, uint64_t object, ddt_entry_t *dde,
@@ -181,6 +264,11 @@ typedef struct ddt_ops {
 
 #define	DDT_NAMELEN	80
 
+extern unsigned int zfs_dedup_log_txg_max;
+extern unsigned int zfs_dedup_log_flush_entries_min;
+extern unsigned int zfs_dedup_prune_percent;
+extern unsigned int zfs_dedup_prune_entries_per_txg;
+
 extern void ddt_object_name(ddt_t *ddt, enum ddt_type type,
     enum ddt_class class, char *name);
 extern int ddt_object_walk(ddt_t *ddt, enum ddt_type type,
@@ -219,6 +307,8 @@ extern void ddt_get_dedup_stats(spa_t *spa, ddt_stat_t *dds_total);
 
 extern uint64_t ddt_get_dedup_dspace(spa_t *spa);
 extern uint64_t ddt_get_pool_dedup_ratio(spa_t *spa);
+extern uint64_t ddt_get_ddt_dsize(spa_t *spa);
+extern boolean_t ddt_over_quota(spa_t *spa);
 
 extern size_t ddt_compress(void *src, uchar_t *dst, size_t s_len, size_t d_len);
 extern void ddt_decompress(uchar_t *src, void *dst, size_t s_len, size_t d_len);
@@ -230,6 +320,8 @@ extern void ddt_init(void);
 extern void ddt_fini(void);
 extern ddt_entry_t *ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add);
 extern void ddt_prefetch(spa_t *spa, const blkptr_t *bp);
+extern void ddt_prefetch_batch(spa_t *spa, const blkptr_t *bps,
+    uint_t count);
 extern void ddt_remove(ddt_t *ddt, ddt_entry_t *dde);
 
 extern boolean_t ddt_class_contains(spa_t *spa, enum ddt_class max_class,
@@ -238,6 +330,7 @@ extern boolean_t ddt_class_contains(spa_t *spa, enum ddt_class max_class,
 extern ddt_entry_t *ddt_repair_start(ddt_t *ddt, const blkptr_t *bp);
 extern void ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde);
 
+extern int ddt_key_compare(const ddt_key_t *k1, const ddt_key_t *k2);
 extern int ddt_entry_compare(const void *x1, const void *x2);
 
 extern void ddt_create(spa_t *spa);
@@ -247,6 +340,26 @@ extern void ddt_sync(spa_t *spa, uint64_t txg);
 extern int ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde);
 extern int ddt_object_update(ddt_t *ddt, enum ddt_type type,
     enum ddt_class class, ddt_entry_t *dde, dmu_tx_t *tx);
+extern void ddt_prefetch_key(ddt_t *ddt, const ddt_key_t *ddk);
+extern void ddt_flush_entry(ddt_t *ddt, const ddt_key_t *ddk,
+    const ddt_phys_t *ddp, dmu_tx_t *tx);
+
+extern void ddt_log_init(void);
+extern void ddt_log_fini(void);
+extern void ddt_log_alloc(ddt_t *ddt);
+extern void ddt_log_free(ddt_t *ddt);
+extern int ddt_log_load(ddt_t *ddt);
+extern boolean_t ddt_log_find(ddt_t *ddt, const ddt_key_t *ddk,
+    ddt_phys_t *ddp);
+extern boolean_t ddt_log_empty(ddt_t *ddt);
+extern boolean_t ddt_log_pending(ddt_t *ddt);
+extern void ddt_log_begin(ddt_t *ddt, ddt_log_update_t *dlu, dmu_tx_t *tx);
+extern void ddt_log_entry(ddt_t *ddt, ddt_log_update_t *dlu,
+    const ddt_entry_t *dde);
+extern void ddt_log_commit(ddt_t *ddt, ddt_log_update_t *dlu);
+extern void ddt_log_flush(ddt_t *ddt, dmu_tx_t *tx, boolean_t all);
+extern void ddt_log_destroy(ddt_t *ddt, dmu_tx_t *tx);
+extern int ddt_log_walk(ddt_t *ddt, void **cookie, ddt_entry_t *dde);
 
 extern const ddt_ops_t ddt_zap_ops;
 
@@ -371,6 +371,8 @@ typedef struct dmu_buf {
 #define	DMU_POOL_TMP_USERREFS		"tmp_userrefs"
 #define	DMU_POOL_DDT			"DDT-%s-%s-%s"
 #define	DMU_POOL_DDT_STATS		"DDT-statistics"
+#define	DMU_POOL_DDT_LOG		"DDT-log-%s-%u"
+#define	DMU_POOL_DDT_PRUNED		"DDT-pruned"
 #define	DMU_POOL_CREATION_VERSION	"creation_version"
 #define	DMU_POOL_SCAN			"scan"
 #define	DMU_POOL_FREE_BPOBJ		"free_bpobj"
@@ -383,6 +385,9 @@ typedef struct dmu_buf {
 #define	DMU_POOL_CONDENSING_INDIRECT	"com.delphix:condensing_indirect"
 #define	DMU_POOL_ZPOOL_CHECKPOINT	"com.delphix:zpool_checkpoint"
 #define	DMU_POOL_LOG_SPACEMAP_ZAP	"com.delphix:log_spacemap_zap"
+#define	DMU_POOL_SCAN_SPILL		"org.openzfs:scan_spill"
+#define	DMU_POOL_LAST_SCRUBBED_TXG	"org.openzfs:last_scrubbed_txg"
+#define	DMU_POOL_DELETED_CLONES		"org.openzfs:deleted_clones"
 
 /*
  * Allocate an object from this objset.  The range of object numbers
@@ -810,11 +815,20 @@ void dmu_tx_mark_netfree(dmu_tx_t *tx);
  * When multiple callbacks are registered to the transaction, the callbacks
  * will be called in reverse order to let Lustre, the only user of commit
  * callback currently, take the fast path of its commit callback handling.
+ *
+ * dmu_tx_callback_register_txg() registers a callback on the currently open
+ * txg of the pool without a transaction, and returns that txg.  This lets
+ * any number of waiters be notified in one batch once the txg is synced,
+ * instead of each of them waiting in txg_wait_synced().  The callback is
+ * not called before something else causes the txg to sync; txg_kick() may
+ * be used to hurry it along.
  */
 typedef void dmu_tx_callback_func_t(void *dcb_data, int error);
 
 void dmu_tx_callback_register(dmu_tx_t *tx, dmu_tx_callback_func_t *dcb_func,
     void *dcb_data);
+uint64_t dmu_tx_callback_register_txg(objset_t *os,
+    dmu_tx_callback_func_t *dcb_func, void *dcb_data);
 void dmu_tx_do_callbacks(list_t *cb_list, int error);
 
 /*
@@ -836,6 +850,7 @@ int dmu_free_long_object(objset_t *os, uint64_t object);
 #define	DMU_READ_PREFETCH	0 /* prefetch */
 #define	DMU_READ_NO_PREFETCH	1 /* don't prefetch */
 #define	DMU_READ_NO_DECRYPT	2 /* don't decrypt */
+#define	DMU_DIRECTIO		4 /* don't retain uncached blocks */
 int dmu_read(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	void *buf, uint32_t flags);
 int dmu_read_by_dnode(dnode_t *dn, uint64_t offset, uint64_t size, void *buf,
@@ -851,12 +866,13 @@ void dmu_prealloc(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 #include <linux/blkdev_compat.h>
 #endif
 int dmu_read_uio(objset_t *os, uint64_t object, struct uio *uio, uint64_t size);
-int dmu_read_uio_dbuf(dmu_buf_t *zdb, struct uio *uio, uint64_t size);
+int dmu_read_uio_dbuf(dmu_buf_t *zdb, struct uio *uio, uint64_t size,
+    uint32_t flags);
 int dmu_read_uio_dnode(dnode_t *dn, struct uio *uio, uint64_t size);
 int dmu_write_uio(objset_t *os, uint64_t object, struct uio *uio, uint64_t size,
 	dmu_tx_t *tx);
 int dmu_write_uio_dbuf(dmu_buf_t *zdb, struct uio *uio, uint64_t size,
-	dmu_tx_t *tx);
+	dmu_tx_t *tx, uint32_t flags);
 int dmu_write_uio_dnode(dnode_t *dn, struct uio *uio, uint64_t size,
 	dmu_tx_t *tx);
 #endif
@@ -890,6 +906,14 @@ extern int zfs_max_recordsize;
 void dmu_prefetch(objset_t *os, uint64_t object, int64_t level, uint64_t offset,
 	uint64_t len, enum zio_priority pri);
 
+/*
+ * Asynchronously read in the dnodes of a batch of objects, such as the
+ * entries of a directory being listed.  Sorts objs in place.
+ */
+#define	DMU_PREFETCH_DNODES_BATCH	64
+void dmu_prefetch_dnodes(objset_t *os, uint64_t *objs, int count,
+	enum zio_priority pri);
+
 typedef struct dmu_object_info {
 	/* All sizes are in bytes unless otherwise indicated. */
 	uint32_t doi_data_block_size;
@@ -1079,6 +1103,9 @@ int dmu_diff(const char *tosnap_name, const char *fromsnap_name,
 int dmu_diff(const char *tosnap_name, const char *fromsnap_name,
     struct vnode *vp, offset_t *offp);
 #endif
+int dmu_diff_blocks(const char *tosnap_name, const char *fromsnap_name,
+    uint64_t object, uint64_t *cookie, uint64_t *extents,
+    uint64_t *nextents, boolean_t *more);
 
 /* CRC64 table */
 #define	ZFS_CRC64_POLY	0xC96C5795D7870F42ULL	/* ECMA-182, reflected form */
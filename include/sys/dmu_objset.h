@@ -91,6 +91,30 @@ typedef struct objset_phys {
 
 typedef int (*dmu_objset_upgrade_cb_t)(objset_t *);
 
+/*
+ * Token buckets of the read/write bandwidth and IOPS limit properties.
+ */
+typedef enum os_iolimit_type {
+	OS_IOLIMIT_BW_READ,
+	OS_IOLIMIT_BW_WRITE,
+	OS_IOLIMIT_OPS_READ,
+	OS_IOLIMIT_OPS_WRITE,
+	OS_IOLIMIT_TYPES
+} os_iolimit_type_t;
+
+typedef struct os_iolimit {
+	uint64_t oil_rate;	/* per second, 0 if unlimited */
+	int64_t oil_tokens;	/* negative while in debt */
+	hrtime_t oil_last;	/* last refill */
+} os_iolimit_t;
+
+/* Deltas to the used space of each user, group and project, by id */
+typedef struct userquota_cache {
+	avl_tree_t uqc_user_deltas;
+	avl_tree_t uqc_group_deltas;
+	avl_tree_t uqc_project_deltas;
+} userquota_cache_t;
+
 #define	OBJSET_PROP_UNINITIALIZED	((uint64_t)-1)
 struct objset {
 	/* Immutable: */
@@ -114,6 +138,11 @@ struct objset {
 
 	list_node_t os_evicting_node;
 
+	/* Number and size of this objset's dbufs by level, see dbuf_stats.c */
+	uint64_t os_dbuf_count[DN_MAX_LEVELS];
+	uint64_t os_dbuf_size[DN_MAX_LEVELS];
+	list_node_t os_dbuf_stats_node;
+
 	/* can change, under dsl_dir's locks: */
 	uint64_t os_dnodesize; /* default dnode size for new objects */
 	enum zio_checksum os_checksum;
@@ -143,6 +172,28 @@ struct objset {
 	 */
 	int os_zpl_special_smallblock;
 
+	/*
+	 * Recent compression outcomes for this objset, used to decide
+	 * whether expensive compression should be preceded by a cheap probe.
+	 * Updated with atomics and periodically decayed; approximate.
+	 */
+	uint64_t os_compress_tries;
+	uint64_t os_compress_fails;
+
+	/*
+	 * Bytes of data predictively prefetched in this objset, of those
+	 * accessed by the prefetch streams, and of those left unaccessed
+	 * when their stream ended.  Updated with atomics by dmu_zfetch.
+	 */
+	uint64_t os_prefetch_issued;
+	uint64_t os_prefetch_used;
+	uint64_t os_prefetch_wasted;
+	kstat_t *os_prefetch_ksp;
+
+	/* I/O limits; the rates are set by the property callbacks */
+	kmutex_t os_iolimit_lock;
+	os_iolimit_t os_iolimit[OS_IOLIMIT_TYPES];
+
 	/*
 	 * Pointer is constant; the blkptr it points to is protected by
 	 * os_dsl_dataset->ds_bp_rwlock
@@ -164,6 +215,7 @@ struct objset {
 	/* Protected by os_obj_lock */
 	kmutex_t os_obj_lock;
 	uint64_t os_obj_next_chunk;
+	int os_obj_chunk_shift;	/* grown when os_obj_lock is contended */
 
 	/* Per-CPU next object to allocate, protected by atomic ops. */
 	uint64_t *os_obj_next_percpu;
@@ -175,8 +227,14 @@ struct objset {
 	list_t os_dnodes;
 	list_t os_downgraded_dbufs;
 
-	/* Protects changes to DMU_{USER,GROUP,PROJECT}USED_OBJECT */
+	/*
+	 * Protects os_userquota_cache and os_userquota_tasks, into which the
+	 * userquota_updates_task()s of the syncing txg merge their deltas
+	 * before the last of them applies them.
+	 */
 	kmutex_t os_userused_lock;
+	userquota_cache_t os_userquota_cache;
+	uint_t os_userquota_tasks;
 
 	/* stuff we store for the user */
 	kmutex_t os_user_ptr_lock;
@@ -199,10 +257,6 @@ struct objset {
 #define	DMU_GROUPUSED_DNODE(os)	((os)->os_groupused_dnode.dnh_dnode)
 #define	DMU_PROJECTUSED_DNODE(os) ((os)->os_projectused_dnode.dnh_dnode)
 
-#define	DMU_OS_IS_L2CACHEABLE(os)				\
-	((os)->os_secondary_cache == ZFS_CACHE_ALL ||		\
-	(os)->os_secondary_cache == ZFS_CACHE_METADATA)
-
 /* called from zpl */
 int dmu_objset_hold(const char *name, void *tag, objset_t **osp);
 int dmu_objset_hold_flags(const char *name, boolean_t decrypt, void *tag,
@@ -233,6 +287,7 @@ inode_timespec_t dmu_objset_snap_cmtime(objset_t *os);
 /* called from dsl */
 void dmu_objset_sync(objset_t *os, zio_t *zio, dmu_tx_t *tx);
 boolean_t dmu_objset_is_dirty(objset_t *os, uint64_t txg);
+arc_flags_t dmu_objset_l2cache_flags(objset_t *os, boolean_t metadata);
 objset_t *dmu_objset_create_impl_dnstats(spa_t *spa, struct dsl_dataset *ds,
     blkptr_t *bp, dmu_objset_type_t type, int levels, int blksz, int ibs,
     dmu_tx_t *tx);
@@ -254,6 +309,9 @@ boolean_t dmu_objset_projectquota_enabled(objset_t *os);
 boolean_t dmu_objset_projectquota_present(objset_t *os);
 boolean_t dmu_objset_projectquota_upgradable(objset_t *os);
 void dmu_objset_id_quota_upgrade(objset_t *os);
+boolean_t dmu_objset_compress_probe(objset_t *os);
+void dmu_objset_compress_account(objset_t *os, boolean_t compressed);
+void dmu_objset_iolimit(objset_t *os, boolean_t write, uint64_t size);
 
 int dmu_fsname(const char *snapname, char *buf);
 
@@ -60,6 +60,8 @@ typedef struct dmu_recv_cookie {
 	void *drc_owner;
 	cred_t *drc_cred;
 	nvlist_t *drc_begin_nvl;
+	uint64_t drc_end_object;	/* end of a chunked stream */
+	uint64_t drc_stream_compress;	/* of WRITE payloads in the stream */
 
 	objset_t *drc_os;
 #if defined(__FreeBSD__) && defined(_KERNEL)
@@ -70,6 +72,7 @@ typedef struct dmu_recv_cookie {
 #endif
 	uint64_t drc_voff; /* The current offset in the stream */
 	uint64_t drc_bytes_read;
+	hrtime_t drc_input_wait;	/* time spent reading the stream */
 	/*
 	 * A record that has had its payload read in, but hasn't yet been handed
 	 * off to the worker thread.
@@ -79,6 +82,10 @@ typedef struct dmu_recv_cookie {
 	struct receive_record_arg *drc_next_rrd;
 	zio_cksum_t drc_cksum;
 	zio_cksum_t drc_prev_cksum;
+	/* Threads checksumming large payloads, NULL to do it inline. */
+	struct taskq *drc_cksum_tq;
+	struct receive_cksum_arg *drc_cksum_args;
+	int drc_cksum_nargs;
 	int drc_err;
 	/* Sorted list of objects not to issue prefetches for. */
 	objlist_t *drc_ignore_objlist;
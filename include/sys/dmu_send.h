@@ -41,6 +41,8 @@
 #define	BEGINNV_REDACT_FROM_SNAPS	"redact_from_snaps"
 #define	BEGINNV_RESUME_OBJECT		"resume_object"
 #define	BEGINNV_RESUME_OFFSET		"resume_offset"
+#define	BEGINNV_END_OBJECT		"end_object"
+#define	BEGINNV_STREAM_COMPRESS		"stream_compress"
 
 struct vnode;
 struct dsl_dataset;
@@ -51,7 +53,8 @@ struct dmu_send_outparams;
 int
 dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
     boolean_t large_block_ok, boolean_t compressok, boolean_t rawok,
-    uint64_t resumeobj, uint64_t resumeoff, const char *redactbook, int outfd,
+    uint64_t resumeobj, uint64_t resumeoff, uint64_t chunk, uint64_t nchunks,
+    enum zio_compress stream_compress, const char *redactbook, int outfd,
     offset_t *off, struct dmu_send_outparams *dsop);
 int dmu_send_estimate_fast(struct dsl_dataset *ds, struct dsl_dataset *fromds,
     zfs_bookmark_phys_t *frombook, boolean_t stream_compressed,
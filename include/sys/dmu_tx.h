@@ -45,6 +45,34 @@ struct dsl_pool;
 struct dnode;
 struct dsl_dir;
 
+enum dmu_tx_hold_type {
+	THT_NEWOBJECT,
+	THT_WRITE,
+	THT_BONUS,
+	THT_FREE,
+	THT_ZAP,
+	THT_SPACE,
+	THT_SPILL,
+	THT_NUMTYPES
+};
+
+typedef struct dmu_tx_hold {
+	dmu_tx_t *txh_tx;
+	list_node_t txh_node;
+	struct dnode *txh_dnode;
+	zfs_refcount_t txh_space_towrite;
+	zfs_refcount_t txh_memory_tohold;
+	enum dmu_tx_hold_type txh_type;
+	uint64_t txh_arg1;
+	uint64_t txh_arg2;
+} dmu_tx_hold_t;
+
+/*
+ * The holds of most transactions fit in the dmu_tx_t, and are only
+ * allocated separately beyond this many.
+ */
+#define	DMU_TX_PREALLOC_HOLDS	4
+
 struct dmu_tx {
 	/*
 	 * No synchronization is needed because a tx can only be handled
@@ -80,30 +108,12 @@ struct dmu_tx {
 	boolean_t tx_dirty_delayed;
 
 	int tx_err;
-};
 
-enum dmu_tx_hold_type {
-	THT_NEWOBJECT,
-	THT_WRITE,
-	THT_BONUS,
-	THT_FREE,
-	THT_ZAP,
-	THT_SPACE,
-	THT_SPILL,
-	THT_NUMTYPES
+	/* number of tx_prealloc_holds in use */
+	int tx_nprealloc_holds;
+	dmu_tx_hold_t tx_prealloc_holds[DMU_TX_PREALLOC_HOLDS];
 };
 
-typedef struct dmu_tx_hold {
-	dmu_tx_t *txh_tx;
-	list_node_t txh_node;
-	struct dnode *txh_dnode;
-	zfs_refcount_t txh_space_towrite;
-	zfs_refcount_t txh_memory_tohold;
-	enum dmu_tx_hold_type txh_type;
-	uint64_t txh_arg1;
-	uint64_t txh_arg2;
-} dmu_tx_hold_t;
-
 typedef struct dmu_tx_callback {
 	list_node_t		dcb_node;    /* linked to tx_callbacks list */
 	dmu_tx_callback_func_t	*dcb_func;   /* caller function pointer */
@@ -39,7 +39,17 @@ extern "C" {
 extern unsigned long	zfetch_array_rd_sz;
 
 struct dnode;				/* so we can reference dnode */
+struct objset;				/* so we can reference objset */
 
+/*
+ * A prefetch stream. Streams are either sequential (zs_stride == 0), with
+ * each access starting where the previous one ended, or strided, with each
+ * access of zs_nblks blocks starting zs_stride blocks from the previous
+ * one. A negative stride is a backward scan. A slot with a zs_atime of 0
+ * is unused. zs_pf_issued and zs_pf_used count the data blocks prefetched
+ * by the stream and how many of those were then accessed through it; what
+ * is left when the stream ends was prefetched in vain.
+ */
 typedef struct zstream {
 	uint64_t	zs_blkid;	/* expect next access at this blkid */
 	uint64_t	zs_pf_blkid;	/* next block to prefetch */
@@ -50,20 +60,29 @@ typedef struct zstream {
 	 */
 	uint64_t	zs_ipf_blkid;
 
-	kmutex_t	zs_lock;	/* protects stream */
+	uint64_t	zs_last_blkid;	/* first block of the last access */
+	int64_t		zs_stride;	/* blocks between strided accesses */
+	uint32_t	zs_nblks;	/* blocks per strided access */
+	uint32_t	zs_depth;	/* max strided accesses ahead */
 	hrtime_t	zs_atime;	/* time last prefetch issued */
-	list_node_t	zs_node;	/* link for zf_stream */
+	hrtime_t	zs_ctime;	/* time stream created */
+	uint64_t	zs_pf_issued;	/* data blocks prefetched */
+	uint64_t	zs_pf_used;	/* prefetched blocks accessed */
 } zstream_t;
 
 typedef struct zfetch {
-	krwlock_t	zf_rwlock;	/* protects zfetch structure */
-	list_t		zf_stream;	/* list of zstream_t's */
+	kmutex_t	zf_lock;	/* protects zfetch structure */
+	zstream_t	*zf_streams;	/* array of zf_nstreams streams */
+	uint_t		zf_nstreams;	/* allocated streams, or 0 */
 	struct dnode	*zf_dnode;	/* dnode that owns this zfetch */
 } zfetch_t;
 
 void		zfetch_init(void);
 void		zfetch_fini(void);
 
+void		dmu_zfetch_objset_init(struct objset *);
+void		dmu_zfetch_objset_fini(struct objset *);
+
 void		dmu_zfetch_init(zfetch_t *, struct dnode *);
 void		dmu_zfetch_fini(zfetch_t *);
 void		dmu_zfetch(zfetch_t *, uint64_t, uint64_t, boolean_t,
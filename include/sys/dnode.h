@@ -510,6 +510,11 @@ typedef struct dnode_stats {
 	 * at least one slot was allocated.
 	 */
 	kstat_named_t dnode_hold_free_misses;
+	/*
+	 * Number of those misses found without taking the slot locks,
+	 * because a slot was seen to be allocated or interior.
+	 */
+	kstat_named_t dnode_hold_free_peek_misses;
 	/*
 	 * Number of times dnode_hold(..., DNODE_MUST_BE_FREE) was not
 	 * able to hold the requested range of free dnode slots because
@@ -558,6 +563,11 @@ typedef struct dnode_stats {
 	 * object ID chunk and advanced to a new one.
 	 */
 	kstat_named_t dnode_alloc_next_chunk;
+	/*
+	 * Number of times advancing to a new object ID chunk found the
+	 * objset's os_obj_lock held, which grows the chunks of the objset.
+	 */
+	kstat_named_t dnode_alloc_chunk_contended;
 	/*
 	 * Number of times multiple threads attempted to allocate a dnode
 	 * from the same block of free dnodes.
@@ -0,0 +1,86 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_DSL_LIVELIST_H
+#define	_SYS_DSL_LIVELIST_H
+
+#include <sys/bpobj.h>
+#include <sys/bplist.h>
+#include <sys/zthr.h>
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct dsl_pool;
+
+/*
+ * The blocks of a clone born in the txgs from ls_mintxg up to the
+ * ls_mintxg of the next sublist.  Each of them is in ls_allocs, and also
+ * in ls_frees once it has been freed.
+ */
+typedef struct livelist_sublist {
+	avl_node_t	ls_node;
+	uint64_t	ls_mintxg;
+	bpobj_t		ls_allocs;
+	bpobj_t		ls_frees;
+} livelist_sublist_t;
+
+typedef struct dsl_livelist {
+	kmutex_t	ll_lock;	/* protects the sublists */
+	uint64_t	ll_dir_obj;	/* dsl_dir of the clone */
+	objset_t	*ll_os;
+	uint64_t	ll_object;	/* ZAP of the sublists, 0 if closed */
+	avl_tree_t	ll_sublists;	/* by ls_mintxg */
+
+	/* Blocks born and freed in the txg, see dsl_livelist_sync() */
+	bplist_t	ll_pending_allocs;
+	bplist_t	ll_pending_frees;
+} dsl_livelist_t;
+
+void dsl_livelist_init(dsl_livelist_t *ll, uint64_t dir_obj);
+void dsl_livelist_fini(dsl_livelist_t *ll);
+uint64_t dsl_livelist_alloc(objset_t *os, dmu_tx_t *tx);
+void dsl_livelist_free(objset_t *os, uint64_t obj, dmu_tx_t *tx);
+int dsl_livelist_open(dsl_livelist_t *ll, objset_t *os, uint64_t obj);
+void dsl_livelist_close(dsl_livelist_t *ll);
+boolean_t dsl_livelist_is_open(dsl_livelist_t *ll);
+void dsl_livelist_append_alloc(dsl_livelist_t *ll, const blkptr_t *bp);
+void dsl_livelist_append_free(dsl_livelist_t *ll, const blkptr_t *bp,
+    boolean_t async, dmu_tx_t *tx);
+void dsl_livelist_sync(dsl_livelist_t *ll, dmu_tx_t *tx);
+
+void dsl_livelist_delete(struct dsl_pool *dp, uint64_t obj, dmu_tx_t *tx);
+boolean_t dsl_livelist_deleting(struct dsl_pool *dp);
+int dsl_livelist_delete_sublist(struct dsl_pool *dp, bpobj_itor_t func,
+    void *arg, dmu_tx_t *tx);
+int dsl_livelist_iterate_deleted(struct dsl_pool *dp, bpobj_itor_t func,
+    void *arg);
+
+boolean_t spa_livelist_condense_thread_check(void *arg, zthr_t *zthr);
+void spa_livelist_condense_thread(void *arg, zthr_t *zthr);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_DSL_LIVELIST_H */
@@ -58,6 +58,7 @@ struct dsl_crypto_params;
 extern unsigned long zfs_dirty_data_max;
 extern unsigned long zfs_dirty_data_max_max;
 extern int zfs_dirty_data_sync_percent;
+extern int zfs_dirty_data_target_ms;
 extern int zfs_dirty_data_max_percent;
 extern int zfs_dirty_data_max_max_percent;
 extern int zfs_delay_min_dirty_percent;
@@ -103,6 +104,7 @@ typedef struct dsl_pool {
 	uint64_t dp_tmp_userrefs_obj;
 	bpobj_t dp_free_bpobj;
 	uint64_t dp_bptree_obj;
+	uint64_t dp_deleted_clones_obj;
 	uint64_t dp_empty_bpobj;
 	bpobj_t dp_obsolete_bpobj;
 
@@ -117,6 +119,8 @@ typedef struct dsl_pool {
 	uint64_t dp_mos_used_delta;
 	uint64_t dp_mos_compressed_delta;
 	uint64_t dp_mos_uncompressed_delta;
+	uint64_t dp_sync_rate;		/* bytes per second */
+	uint64_t dp_dirty_max;		/* 0 if not adaptive */
 
 	/*
 	 * Time of most recently scheduled (furthest in the future)
@@ -141,7 +145,13 @@ typedef struct dsl_pool {
 	 * syncing context does not need to ever have it for read, since
 	 * nobody else could possibly have it for write.
 	 */
-	rrwlock_t dp_config_rwlock;
+	rrmlock_t dp_config_rwlock;
+
+	/*
+	 * Bumped by every change to a property or to the dsl_dir hierarchy,
+	 * see dsl_prop_get_dd().
+	 */
+	uint64_t dp_prop_gen;
 
 	zfs_all_blkstats_t *dp_blkstats;
 } dsl_pool_t;
@@ -170,6 +180,8 @@ void dsl_pool_mos_diduse_space(dsl_pool_t *dp,
 void dsl_pool_ckpoint_diduse_space(dsl_pool_t *dp,
     int64_t used, int64_t comp, int64_t uncomp);
 boolean_t dsl_pool_need_dirty_delay(dsl_pool_t *dp);
+uint64_t dsl_pool_dirty_max(dsl_pool_t *dp);
+void dsl_pool_sync_done_rate(dsl_pool_t *dp, uint64_t dirty, hrtime_t delta);
 void dsl_pool_config_enter(dsl_pool_t *dp, void *tag);
 void dsl_pool_config_enter_prio(dsl_pool_t *dp, void *tag);
 void dsl_pool_config_exit(dsl_pool_t *dp, void *tag);
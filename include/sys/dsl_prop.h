@@ -56,6 +56,18 @@ typedef struct dsl_prop_cb_record {
 	void *cbr_arg;
 } dsl_prop_cb_record_t;
 
+/*
+ * The effective value of an integer property of a dsl_dir, valid as long
+ * as the pool's dp_prop_gen is pce_gen.
+ */
+typedef struct dsl_prop_cache_entry {
+	list_node_t pce_node; /* link on dd_prop_cache */
+	const char *pce_propname;
+	boolean_t pce_snapshot;
+	uint64_t pce_gen;
+	uint64_t pce_value;
+} dsl_prop_cache_entry_t;
+
 typedef struct dsl_props_arg {
 	nvlist_t *pa_props;
 	zprop_source_t pa_source;
@@ -69,6 +81,7 @@ int dsl_prop_unregister(struct dsl_dataset *ds, const char *propname,
     dsl_prop_changed_cb_t *callback, void *cbarg);
 void dsl_prop_unregister_all(struct dsl_dataset *ds, void *cbarg);
 void dsl_prop_notify_all(struct dsl_dir *dd);
+void dsl_prop_cache_invalidate(dsl_pool_t *dp);
 boolean_t dsl_prop_hascb(struct dsl_dataset *ds);
 
 int dsl_prop_get(const char *ddname, const char *propname,
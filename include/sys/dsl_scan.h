@@ -153,6 +153,17 @@ typedef struct dsl_scan {
 	dsl_scan_phys_t scn_phys_cached;
 	avl_tree_t scn_queue;		/* queue of datasets to scan */
 	uint64_t scn_bytes_pending;	/* outstanding data to issue */
+
+	/* sorted queues spilled to the pool, see dsl_scan_spill() */
+	uint64_t scn_spill_obj;		/* MOS object of spilled sios */
+	uint64_t scn_spill_size;	/* bytes written to scn_spill_obj */
+	uint64_t scn_spill_runs;	/* runs not yet merged back */
+
+	/* blocks born before this txg were covered by completed scrubs */
+	uint64_t scn_last_scrubbed_txg;
+
+	/* metadata and at-risk bytes resilvered first, not stored on disk */
+	uint64_t scn_prio_issued;
 } dsl_scan_t;
 
 typedef struct dsl_scan_io_queue dsl_scan_io_queue_t;
@@ -163,7 +174,7 @@ int dsl_scan_init(struct dsl_pool *dp, uint64_t txg);
 void dsl_scan_fini(struct dsl_pool *dp);
 void dsl_scan_sync(struct dsl_pool *, dmu_tx_t *);
 int dsl_scan_cancel(struct dsl_pool *);
-int dsl_scan(struct dsl_pool *, pool_scan_func_t);
+int dsl_scan(struct dsl_pool *, pool_scan_func_t, uint64_t, uint64_t);
 boolean_t dsl_scan_scrubbing(const struct dsl_pool *dp);
 int dsl_scrub_set_pause_resume(const struct dsl_pool *dp, pool_scrub_cmd_t cmd);
 void dsl_resilver_restart(struct dsl_pool *, uint64_t txg);
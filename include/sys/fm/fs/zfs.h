@@ -105,6 +105,11 @@ extern "C" {
 #define	FM_EREPORT_PAYLOAD_ZFS_BAD_CLEARED_BITS	"bad_cleared_bits"
 #define	FM_EREPORT_PAYLOAD_ZFS_BAD_SET_HISTOGRAM "bad_set_histogram"
 #define	FM_EREPORT_PAYLOAD_ZFS_BAD_CLEARED_HISTOGRAM "bad_cleared_histogram"
+#define	FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED	"suppressed"
+#define	FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED_DELTA_MIN "suppressed_delta_min"
+#define	FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED_DELTA_MAX "suppressed_delta_max"
+#define	FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED_OFFSET_MIN "suppressed_offset_min"
+#define	FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED_OFFSET_MAX "suppressed_offset_max"
 
 #define	FM_EREPORT_FAILMODE_WAIT		"wait"
 #define	FM_EREPORT_FAILMODE_CONTINUE		"continue"
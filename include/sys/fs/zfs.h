@@ -186,6 +186,10 @@ typedef enum {
 	ZFS_PROP_IVSET_GUID,		/* not exposed to the user */
 	ZFS_PROP_REDACTED,
 	ZFS_PROP_REDACT_SNAPS,
+	ZFS_PROP_READ_BW_LIMIT,
+	ZFS_PROP_WRITE_BW_LIMIT,
+	ZFS_PROP_READ_OPS_LIMIT,
+	ZFS_PROP_WRITE_OPS_LIMIT,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -246,6 +250,8 @@ typedef enum {
 	ZPOOL_PROP_CHECKPOINT,
 	ZPOOL_PROP_LOAD_GUID,
 	ZPOOL_PROP_AUTOTRIM,
+	ZPOOL_PROP_DEDUP_TABLE_SIZE,
+	ZPOOL_PROP_DEDUP_TABLE_QUOTA,
 	ZPOOL_NUM_PROPS
 } zpool_prop_t;
 
@@ -395,7 +401,11 @@ typedef enum zfs_smb_acl_op {
 typedef enum zfs_cache_type {
 	ZFS_CACHE_NONE = 0,
 	ZFS_CACHE_METADATA = 1,
-	ZFS_CACHE_ALL = 2
+	ZFS_CACHE_ALL = 2,
+	/* secondarycache only */
+	ZFS_CACHE_MFU = 3,
+	ZFS_CACHE_METADATA_MFU = 4,
+	ZFS_CACHE_PREFETCH = 5
 } zfs_cache_type_t;
 
 typedef enum {
@@ -619,7 +629,11 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_DTL		"DTL"
 #define	ZPOOL_CONFIG_SCAN_STATS		"scan_stats"	/* not stored on disk */
 #define	ZPOOL_CONFIG_REMOVAL_STATS	"removal_stats"	/* not stored on disk */
+/* Rebuild stats are not stored on disk */
+#define	ZPOOL_CONFIG_REBUILD_STATS	"org.openzfs:rebuild_stats"
 #define	ZPOOL_CONFIG_CHECKPOINT_STATS	"checkpoint_stats" /* not on disk */
+/* RAID-Z expansion stats are not stored on disk */
+#define	ZPOOL_CONFIG_RAIDZ_EXPAND_STATS	"org.openzfs:raidz_expand_stats"
 #define	ZPOOL_CONFIG_VDEV_STATS		"vdev_stats"	/* not stored on disk */
 #define	ZPOOL_CONFIG_INDIRECT_SIZE	"indirect_size"	/* not stored on disk */
 
@@ -654,6 +668,14 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_VDEV_SCRUB_LAT_HISTO	"vdev_scrub_histo"
 #define	ZPOOL_CONFIG_VDEV_TRIM_LAT_HISTO	"vdev_trim_histo"
 
+/* zio pipeline stage latency histograms */
+#define	ZPOOL_CONFIG_VDEV_TASKQ_LAT_HISTO	"vdev_taskq_lat_histo"
+#define	ZPOOL_CONFIG_VDEV_COMPRESS_LAT_HISTO	"vdev_compress_lat_histo"
+#define	ZPOOL_CONFIG_VDEV_ENCRYPT_LAT_HISTO	"vdev_encrypt_lat_histo"
+#define	ZPOOL_CONFIG_VDEV_CHECKSUM_LAT_HISTO	"vdev_checksum_lat_histo"
+#define	ZPOOL_CONFIG_VDEV_ALLOC_LAT_HISTO	"vdev_alloc_lat_histo"
+#define	ZPOOL_CONFIG_VDEV_DONE_LAT_HISTO	"vdev_done_lat_histo"
+
 /* Request size histograms */
 #define	ZPOOL_CONFIG_VDEV_SYNC_IND_R_HISTO	"vdev_sync_ind_r_histo"
 #define	ZPOOL_CONFIG_VDEV_SYNC_IND_W_HISTO	"vdev_sync_ind_w_histo"
@@ -680,6 +702,11 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_SPARES		"spares"
 #define	ZPOOL_CONFIG_IS_SPARE		"is_spare"
 #define	ZPOOL_CONFIG_NPARITY		"nparity"
+#define	ZPOOL_CONFIG_DRAID_NDATA	"draid_ndata"
+#define	ZPOOL_CONFIG_DRAID_NSPARES	"draid_nspares"
+#define	ZPOOL_CONFIG_DRAID_SEED		"draid_seed"
+#define	ZPOOL_CONFIG_RAIDZ_EXPANDING	"org.openzfs:raidz_expanding"
+#define	ZPOOL_CONFIG_RAIDZ_EXPAND_TXGS	"org.openzfs:raidz_expand_txgs"
 #define	ZPOOL_CONFIG_HOSTID		"hostid"
 #define	ZPOOL_CONFIG_HOSTNAME		"hostname"
 #define	ZPOOL_CONFIG_LOADED_TIME	"initial_load_time"
@@ -699,6 +726,7 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_SPLIT_LIST		"guid_list"
 #define	ZPOOL_CONFIG_REMOVING		"removing"
 #define	ZPOOL_CONFIG_RESILVER_TXG	"resilver_txg"
+#define	ZPOOL_CONFIG_REBUILD_TXG	"org.openzfs:rebuild_txg"
 #define	ZPOOL_CONFIG_COMMENT		"comment"
 #define	ZPOOL_CONFIG_SUSPENDED		"suspended"	/* not stored on disk */
 #define	ZPOOL_CONFIG_SUSPENDED_REASON	"suspended_reason"	/* not stored */
@@ -754,6 +782,8 @@ typedef struct zpool_load_policy {
 #define	VDEV_TYPE_MIRROR		"mirror"
 #define	VDEV_TYPE_REPLACING		"replacing"
 #define	VDEV_TYPE_RAIDZ			"raidz"
+#define	VDEV_TYPE_DRAID			"draid"
+#define	VDEV_TYPE_DRAID_SPARE		"dspare"
 #define	VDEV_TYPE_DISK			"disk"
 #define	VDEV_TYPE_FILE			"file"
 #define	VDEV_TYPE_MISSING		"missing"
@@ -763,6 +793,14 @@ typedef struct zpool_load_policy {
 #define	VDEV_TYPE_L2CACHE		"l2cache"
 #define	VDEV_TYPE_INDIRECT		"indirect"
 
+/*
+ * dRAID limits, and the name given to its distributed spares:
+ * draid<parity>-<top-level vdev id>-<spare id>
+ */
+#define	VDEV_DRAID_MAXPARITY		3
+#define	VDEV_DRAID_MAX_CHILDREN		255
+#define	VDEV_DRAID_SPARE_PATH_FMT	"draid%llu-%llu-%llu"
+
 /* VDEV_TOP_ZAP_* are used in top-level vdev ZAP objects. */
 #define	VDEV_TOP_ZAP_INDIRECT_OBSOLETE_SM \
 	"com.delphix:indirect_obsolete_sm"
@@ -772,9 +810,15 @@ typedef struct zpool_load_policy {
 	"com.delphix:pool_checkpoint_sm"
 #define	VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS \
 	"com.delphix:ms_unflushed_phys_txgs"
+#define	VDEV_TOP_ZAP_MS_CONDENSE_SM \
+	"org.openzfs:ms_condense_sm"
 
 #define	VDEV_TOP_ZAP_ALLOCATION_BIAS \
 	"org.zfsonlinux:allocation_bias"
+#define	VDEV_TOP_ZAP_VDEV_REBUILD_PHYS \
+	"org.openzfs:vdev_rebuild"
+#define	VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS \
+	"org.openzfs:raidz_expand"
 
 /* vdev metaslab allocation bias */
 #define	VDEV_ALLOC_BIAS_LOG		"log"
@@ -911,6 +955,14 @@ typedef enum pool_scrub_cmd {
 	POOL_SCRUB_FLAGS_END
 } pool_scrub_cmd_t;
 
+/*
+ * Optional arguments of ZFS_IOC_POOL_SCAN, restricting a scrub to the
+ * blocks born in [start, end) txgs, or since the last completed scrub.
+ */
+#define	ZPOOL_SCAN_TXG_START		"scan_txg_start"
+#define	ZPOOL_SCAN_TXG_END		"scan_txg_end"
+#define	ZPOOL_SCAN_CONTINUE		"scan_continue"
+
 typedef enum {
 	CS_NONE,
 	CS_CHECKPOINT_EXISTS,
@@ -962,6 +1014,7 @@ typedef struct pool_scan_stat {
 	uint64_t	pss_pass_scrub_spent_paused;
 	uint64_t	pss_pass_issued; /* issued bytes per scan pass */
 	uint64_t	pss_issued;	/* total bytes checked by scanner */
+	uint64_t	pss_prio_issued; /* bytes resilvered ahead of rest */
 } pool_scan_stat_t;
 
 typedef struct pool_removal_stat {
@@ -978,6 +1031,46 @@ typedef struct pool_removal_stat {
 	uint64_t prs_mapping_memory;
 } pool_removal_stat_t;
 
+/*
+ * Statistics of the RAID-Z expansion of a pool, at most one of its raidz
+ * vdevs is expanded at a time.
+ */
+typedef struct pool_raidz_expand_stat {
+	uint64_t pres_state; /* dsl_scan_state_t */
+	uint64_t pres_expanding_vdev;
+	uint64_t pres_start_time;
+	uint64_t pres_end_time;
+	uint64_t pres_to_reflow; /* bytes that need to be moved */
+	uint64_t pres_reflowed; /* bytes moved so far */
+} pool_raidz_expand_stat_t;
+
+/*
+ * Sequential rebuild statistics of a top-level vdev.  Note: all fields
+ * should be 64-bit because this is passed between kernel and userland
+ * as an nvlist uint64 array.
+ */
+typedef struct vdev_rebuild_stat {
+	uint64_t vrs_state;		/* vdev_rebuild_state_t */
+	uint64_t vrs_start_time;	/* time_t */
+	uint64_t vrs_end_time;		/* time_t */
+	uint64_t vrs_scan_time_ms;	/* total run time (millisecs) */
+	uint64_t vrs_bytes_scanned;	/* allocated bytes scanned */
+	uint64_t vrs_bytes_issued;	/* read bytes issued */
+	uint64_t vrs_bytes_rebuilt;	/* rebuilt bytes */
+	uint64_t vrs_bytes_est;		/* total bytes to scan */
+	uint64_t vrs_errors;		/* scanning errors */
+	uint64_t vrs_pass_time_ms;	/* pass run time (millisecs) */
+	uint64_t vrs_pass_bytes_scanned; /* bytes scanned since start/resume */
+	uint64_t vrs_pass_bytes_issued;	/* bytes rebuilt since start/resume */
+} vdev_rebuild_stat_t;
+
+typedef enum vdev_rebuild_state {
+	VDEV_REBUILD_NONE,
+	VDEV_REBUILD_ACTIVE,
+	VDEV_REBUILD_CANCELED,
+	VDEV_REBUILD_COMPLETE,
+} vdev_rebuild_state_t;
+
 typedef enum dsl_scan_state {
 	DSS_NONE,
 	DSS_SCANNING,
@@ -1047,6 +1140,21 @@ typedef struct vdev_stat {
 	uint64_t	vs_physical_ashift;	/* vdev_physical_ashift */
 } vdev_stat_t;
 
+/*
+ * zio pipeline stages which are timed when zio_stage_histo is set.  The
+ * taskq class is the time a zio waited in a taskq before it ran, the done
+ * class the time spent in its done callback.
+ */
+typedef enum zio_stage_class {
+	ZIO_STAGE_CLASS_TASKQ,
+	ZIO_STAGE_CLASS_COMPRESS,
+	ZIO_STAGE_CLASS_ENCRYPT,
+	ZIO_STAGE_CLASS_CHECKSUM,
+	ZIO_STAGE_CLASS_ALLOC,
+	ZIO_STAGE_CLASS_DONE,
+	ZIO_STAGE_CLASSES
+} zio_stage_class_t;
+
 /*
  * Extended stats
  *
@@ -1083,6 +1191,9 @@ typedef struct vdev_stat_ex {
 	/* Amount of time to read/write the disk (ns) */
 	uint64_t vsx_disk_histo[ZIO_TYPES][VDEV_L_HISTO_BUCKETS];
 
+	/* Time spent in the zio pipeline stages (ns), see zio_stage_class */
+	uint64_t vsx_stage_histo[ZIO_STAGE_CLASSES][VDEV_L_HISTO_BUCKETS];
+
 	/* "lookup the bucket for a value" histogram macros */
 #define	HISTO(val, buckets) (val != 0 ? MIN(highbit64(val) - 1, \
 	    buckets - 1) : 0)
@@ -1181,7 +1292,7 @@ typedef enum {
 
 /*
  * nvlist name constants. Facilitate restricting snapshot iteration range for
- * the "list next snapshot" ioctl
+ * the "list next snapshot" and "list snapshots" ioctls
  */
 #define	SNAP_ITER_MIN_TXG	"snap_iter_min_txg"
 #define	SNAP_ITER_MAX_TXG	"snap_iter_max_txg"
@@ -1284,6 +1395,10 @@ typedef enum zfs_ioc {
 	ZFS_IOC_POOL_TRIM,			/* 0x5a50 */
 	ZFS_IOC_REDACT,				/* 0x5a51 */
 	ZFS_IOC_GET_BOOKMARK_PROPS,		/* 0x5a52 */
+	ZFS_IOC_LIST_SNAPSHOTS,			/* 0x5a53 */
+	ZFS_IOC_POOL_VDEV_STATS,		/* 0x5a54 */
+	ZFS_IOC_DIFF_BLOCKS,			/* 0x5a55 */
+	ZFS_IOC_POOL_ERROR_LOG,			/* 0x5a56 */
 
 	/*
 	 * Linux - 3/64 numbers reserved.
@@ -1333,6 +1448,7 @@ typedef enum {
 	ZFS_ERR_SPILL_BLOCK_FLAG_MISSING,
 	ZFS_ERR_UNKNOWN_SEND_STREAM_FEATURE,
 	ZFS_ERR_EXPORT_IN_PROGRESS,
+	ZFS_ERR_RAIDZ_EXPAND_IN_PROGRESS,
 } zfs_errno_t;
 
 /*
@@ -1428,6 +1544,8 @@ typedef enum {
 #define	ZCP_ARG_SYNC		"sync"
 #define	ZCP_ARG_INSTRLIMIT	"instrlimit"
 #define	ZCP_ARG_MEMLIMIT	"memlimit"
+#define	ZCP_ARG_TXG_INSTRLIMIT	"txg_instrlimit"
+#define	ZCP_ARG_OUTPUT_FD	"output_fd"
 
 #define	ZCP_ARG_CLIARGV		"argv"
 
@@ -166,6 +166,7 @@ struct metaslab_class {
 	 * updated the MOS config and the space has been added to the pool).
 	 */
 	uint64_t		mc_groups;
+	uint64_t		mc_raidz_groups; /* # of them on raidz vdevs */
 
 	/*
 	 * Toggle to enable/disable the allocation throttle.
@@ -193,6 +194,7 @@ struct metaslab_class {
 	uint64_t		mc_deferred;	/* total deferred frees */
 	uint64_t		mc_space;	/* total space (alloc + free) */
 	uint64_t		mc_dspace;	/* total deflated space */
+	uint64_t		mc_write_rate;	/* bytes/s of async writes */
 	uint64_t		mc_histogram[RANGE_TREE_HISTOGRAM_SIZE];
 };
 
@@ -205,10 +207,25 @@ struct metaslab_class {
  * simply find the next metaslab group in the linked list and attempt
  * to allocate from that group instead.
  */
+/*
+ * A run of free space which an allocator has reserved from its primary
+ * metaslab, see metaslab_chunk_alloc().  The whole chunk is allocated in
+ * mck_txg at once; [mck_start, mck_end) is the part which is not handed
+ * out yet.
+ */
+typedef struct metaslab_chunk {
+	kmutex_t		mck_lock;
+	metaslab_t		*mck_msp;
+	uint64_t		mck_txg;
+	uint64_t		mck_start;
+	uint64_t		mck_end;
+} metaslab_chunk_t;
+
 struct metaslab_group {
 	kmutex_t		mg_lock;
 	metaslab_t		**mg_primaries;
 	metaslab_t		**mg_secondaries;
+	metaslab_chunk_t	*mg_chunks;
 	avl_tree_t		mg_metaslab_tree;
 	uint64_t		mg_aliquot;
 	boolean_t		mg_allocatable;		/* can we allocate? */
@@ -224,6 +241,7 @@ struct metaslab_group {
 
 	uint64_t		mg_free_capacity;	/* percentage free */
 	int64_t			mg_bias;
+	uint64_t		mg_write_rate;		/* bytes/s of writes */
 	int64_t			mg_activation_count;
 	metaslab_class_t	*mg_class;
 	vdev_t			*mg_vd;
@@ -270,6 +288,15 @@ struct metaslab_group {
 	uint64_t		mg_allocations;
 	uint64_t		mg_failed_allocations;
 	uint64_t		mg_fragmentation;
+
+	/*
+	 * Moving average of the bytes allocated from this group per txg,
+	 * used to predict how many metaslabs to preload.  mg_alloc_txg_bytes
+	 * accumulates the allocations synced in the current txg.
+	 */
+	uint64_t		mg_alloc_rate;
+	uint64_t		mg_alloc_rate_txg;
+	uint64_t		mg_alloc_txg_bytes;
 	uint64_t		mg_histogram[RANGE_TREE_HISTOGRAM_SIZE];
 
 	int			mg_ms_disabled;
@@ -401,6 +428,7 @@ struct metaslab {
 
 	boolean_t	ms_condensing;	/* condensing? */
 	boolean_t	ms_condense_wanted;
+	boolean_t	ms_condensing_bg; /* condensing in the background? */
 
 	/*
 	 * The number of consumers which have disabled the metaslab.
@@ -494,9 +522,17 @@ struct metaslab {
 	 * only difference is that the ms_allocatable_by_size is ordered by
 	 * segment sizes.
 	 */
-	avl_tree_t	ms_allocatable_by_size;
+	zfs_btree_t	ms_allocatable_by_size;
 	uint64_t	ms_lbas[MAX_LBAS];
 
+	/*
+	 * Used by the segregated fit allocator only: the segments of the
+	 * ms_allocatable in one offset-ordered tree per power of two size
+	 * bucket, as in rt_histogram, and a bitmap of the non-empty buckets.
+	 */
+	zfs_btree_t	*ms_allocatable_by_bucket;
+	uint64_t	ms_allocatable_buckets;
+
 	metaslab_group_t *ms_group;	/* metaslab group		*/
 	avl_node_t	ms_group_node;	/* node in metaslab group tree	*/
 	txg_node_t	ms_txg_node;	/* per-txg dirty metaslab links	*/
@@ -523,6 +559,26 @@ struct metaslab {
 	boolean_t	ms_new;
 };
 
+/*
+ * State of a metaslab whose space map is being rewritten in the background
+ * by the spa_ms_condense_zthr, see metaslab_condense_bg_start().  Only
+ * accessed from syncing context.
+ *
+ * The new space map, msc_sm, is written to incrementally over several
+ * txgs, from snapshots of the segments which were allocated (msc_alloc)
+ * and free (msc_free) when the condense started.  The net changes
+ * synced since then are accumulated in msc_allocs and msc_frees, and are
+ * appended when the new space map replaces the old one.
+ */
+typedef struct metaslab_condense {
+	metaslab_t	*msc_msp;
+	space_map_t	*msc_sm;
+	range_tree_t	*msc_alloc;
+	range_tree_t	*msc_free;
+	range_tree_t	*msc_allocs;
+	range_tree_t	*msc_frees;
+} metaslab_condense_t;
+
 typedef struct metaslab_unflushed_phys {
 	/* on-disk counterpart of ms_unflushed_txg */
 	uint64_t	msp_unflushed_txg;
@@ -141,6 +141,7 @@ extern nv_alloc_t *nv_alloc_nosleep;
 #if defined(_KERNEL)
 extern nv_alloc_t *nv_alloc_sleep;
 extern nv_alloc_t *nv_alloc_pushpage;
+extern const nv_alloc_ops_t *nv_arena_ops;
 #endif
 
 int nv_alloc_init(nv_alloc_t *, const nv_alloc_ops_t *, /* args */ ...);
@@ -44,6 +44,7 @@ typedef enum qat_encrypt_dir {
  * Timeout - no response from hardware after 0.5 seconds
  */
 #define	QAT_TIMEOUT_MS		500
+#define	QAT_TIMEOUT		msecs_to_jiffies(QAT_TIMEOUT_MS)
 
 /*
  * The minimal and maximal buffer size which are not restricted
@@ -161,6 +162,37 @@ qat_mem_to_page(void *addr)
 	return (vmalloc_to_page(addr));
 }
 
+/*
+ * Each request blocks its caller until the hardware completes it, so the
+ * requests in flight are bounded by the number of calling threads.  Make
+ * the most of them by sending each one to the instance with the fewest
+ * requests outstanding, starting the search at a rotating position so
+ * that ties are spread evenly.  The returned instance must be released
+ * with qat_instance_put() once the request has completed.
+ */
+static inline Cpa16U
+qat_instance_get(uint32_t *inflight, Cpa16U num_inst, uint32_t *rotor)
+{
+	Cpa16U start = atomic_inc_32_nv(rotor) % num_inst;
+	Cpa16U best = start;
+
+	for (Cpa16U n = 1; n < num_inst && inflight[best] != 0; n++) {
+		Cpa16U i = (start + n) % num_inst;
+
+		if (inflight[i] < inflight[best])
+			best = i;
+	}
+	atomic_inc_32(&inflight[best]);
+
+	return (best);
+}
+
+static inline void
+qat_instance_put(uint32_t *inflight, Cpa16U i)
+{
+	atomic_dec_32(&inflight[i]);
+}
+
 CpaStatus qat_mem_alloc_contig(void **pp_mem_addr, Cpa32U size_bytes);
 void qat_mem_free_contig(void **pp_mem_addr);
 #define	QAT_PHYS_CONTIG_ALLOC(pp_mem_addr, size_bytes)	\
@@ -29,6 +29,7 @@
 #include <sys/inttypes.h>
 #include <sys/list.h>
 #include <sys/zfs_context.h>
+#include <sys/aggsum.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -118,6 +119,35 @@ typedef struct refcount {
 
 #endif	/* ZFS_DEBUG */
 
+/*
+ * zfs_refcount_pcpu_t is for the few objects which are held and released
+ * concurrently on many CPUs, where the single counter of a zfs_refcount_t
+ * bounces between their caches.  Holds and releases only touch a per-CPU
+ * aggsum_t bucket, and reading the count is a slow path which gathers them
+ * all, so unlike zfs_refcount_add() and _remove() the hold and release don't
+ * return the new count.  Debug builds use a zfs_refcount_t, so that holders
+ * are still tracked.
+ */
+#ifdef	ZFS_DEBUG
+typedef zfs_refcount_t zfs_refcount_pcpu_t;
+
+#define	zfs_refcount_pcpu_create(rc)		zfs_refcount_create(rc)
+#define	zfs_refcount_pcpu_destroy(rc)		zfs_refcount_destroy(rc)
+#define	zfs_refcount_pcpu_count(rc)		zfs_refcount_count(rc)
+#define	zfs_refcount_pcpu_add(rc, holder) \
+	((void) zfs_refcount_add(rc, holder))
+#define	zfs_refcount_pcpu_remove(rc, holder) \
+	((void) zfs_refcount_remove(rc, holder))
+#else	/* ZFS_DEBUG */
+typedef aggsum_t zfs_refcount_pcpu_t;
+
+#define	zfs_refcount_pcpu_create(rc)		aggsum_init(rc, 0)
+#define	zfs_refcount_pcpu_destroy(rc)		aggsum_fini(rc)
+#define	zfs_refcount_pcpu_count(rc)		((int64_t)aggsum_value(rc))
+#define	zfs_refcount_pcpu_add(rc, holder)	aggsum_add(rc, 1)
+#define	zfs_refcount_pcpu_remove(rc, holder)	aggsum_add(rc, -1)
+#endif	/* ZFS_DEBUG */
+
 #ifdef	__cplusplus
 }
 #endif
@@ -52,6 +52,8 @@ extern "C" {
  * - rr_anon_rount: number of active anonymous readers
  * - rr_linked_rcount: total number of non-anonymous active readers
  * - rr_writer_wanted: a writer wants the lock
+ * - rr_class: lock contention accounting class, see rrw_init()
+ * - rr_write_start: when the writer took the lock, for rr_class
  */
 typedef struct rrwlock {
 	kmutex_t	rr_lock;
@@ -61,6 +63,8 @@ typedef struct rrwlock {
 	zfs_refcount_t	rr_linked_rcount;
 	boolean_t	rr_writer_wanted;
 	boolean_t	rr_track_all;
+	spl_lockstat_class_t *rr_class;
+	hrtime_t	rr_write_start;
 } rrwlock_t;
 
 /*
@@ -68,7 +72,19 @@ typedef struct rrwlock {
  * 'tag' must be the same in a rrw_enter() as in its
  * corresponding rrw_exit().
  */
-void rrw_init(rrwlock_t *rrl, boolean_t track_all);
+/*
+ * Like mutex_init(), each place a rrwlock_t is initialized is its own class
+ * for lock contention accounting.  Read holds aren't timed, as they overlap.
+ */
+#define	rrw_init(rrl, track_all)				\
+{								\
+	static spl_lockstat_class_t __lsc =			\
+	    SPL_LOCKSTAT_CLASS_INIT(#rrl, __func__);		\
+	rrw_init_impl((rrl), (track_all), &__lsc);		\
+}
+
+void rrw_init_impl(rrwlock_t *rrl, boolean_t track_all,
+    spl_lockstat_class_t *lsc);
 void rrw_destroy(rrwlock_t *rrl);
 void rrw_enter(rrwlock_t *rrl, krw_t rw, void *tag);
 void rrw_enter_read(rrwlock_t *rrl, void *tag);
@@ -95,10 +111,20 @@ typedef struct rrmlock {
 	rrwlock_t	locks[RRM_NUM_LOCKS];
 } rrmlock_t;
 
-void rrm_init(rrmlock_t *rrl, boolean_t track_all);
+/* As with rrw_init(), all the locks of an rrmlock_t share one class. */
+#define	rrm_init(rrl, track_all)				\
+{								\
+	static spl_lockstat_class_t __lsc =			\
+	    SPL_LOCKSTAT_CLASS_INIT(#rrl, __func__);		\
+	rrm_init_impl((rrl), (track_all), &__lsc);		\
+}
+
+void rrm_init_impl(rrmlock_t *rrl, boolean_t track_all,
+    spl_lockstat_class_t *lsc);
 void rrm_destroy(rrmlock_t *rrl);
 void rrm_enter(rrmlock_t *rrl, krw_t rw, void *tag);
 void rrm_enter_read(rrmlock_t *rrl, void *tag);
+void rrm_enter_read_prio(rrmlock_t *rrl, void *tag);
 void rrm_enter_write(rrmlock_t *rrl);
 void rrm_exit(rrmlock_t *rrl, void *tag);
 boolean_t rrm_held(rrmlock_t *rrl, krw_t rw);
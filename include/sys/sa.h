@@ -131,6 +131,8 @@ int sa_update(sa_handle_t *, sa_attr_type_t, void *buf,
     uint32_t buflen, dmu_tx_t *);
 int sa_remove(sa_handle_t *, sa_attr_type_t, dmu_tx_t *);
 int sa_bulk_lookup(sa_handle_t *, sa_bulk_attr_t *, int count);
+int sa_bulk_lookup_objects(objset_t *, const uint64_t *, uint_t,
+    sa_bulk_attr_t *, int, int *);
 int sa_bulk_lookup_locked(sa_handle_t *, sa_bulk_attr_t *, int count);
 int sa_bulk_update(sa_handle_t *, sa_bulk_attr_t *, int count, dmu_tx_t *);
 int sa_size(sa_handle_t *, sa_attr_type_t, int *);
@@ -133,6 +133,13 @@ typedef struct sa_idx_tab {
  * The assumption is that typically attributes will just be updated and
  * adding a completely new attribute is a very rare operation.
  */
+/*
+ * Number of layouts that sa_find_idx_tab() looks up without searching
+ * sa_layout_num_tree.  Layout numbers are handed out sequentially, and
+ * few datasets use more than a handful.
+ */
+#define	SA_LAYOUT_NUM_CACHE	16
+
 struct sa_os {
 	kmutex_t 	sa_lock;
 	boolean_t	sa_need_attr_registration;
@@ -147,6 +154,8 @@ struct sa_os {
 	avl_tree_t	sa_layout_hash_tree; /* keyed by layout hash value */
 	int		sa_user_table_sz;
 	sa_attr_type_t	*sa_user_table; /* user name->attr mapping table */
+	/* layouts of the low numbers, as found in sa_layout_num_tree */
+	sa_lot_t	*sa_layout_num_cache[SA_LAYOUT_NUM_CACHE];
 };
 
 /*
@@ -792,6 +792,7 @@ extern int spa_open_rewind(const char *pool, spa_t **, void *tag,
     nvlist_t *policy, nvlist_t **config);
 extern int spa_get_stats(const char *pool, nvlist_t **config, char *altroot,
     size_t buflen);
+extern int spa_get_vdev_stats(const char *pool, nvlist_t *stats);
 extern int spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
     nvlist_t *zplprops, struct dsl_crypto_params *dcp);
 extern int spa_import(char *pool, nvlist_t *config, nvlist_t *props,
@@ -823,6 +824,7 @@ extern int spa_scan_get_stats(spa_t *spa, pool_scan_stat_t *ps);
 #define	SPA_ASYNC_INITIALIZE_RESTART		0x100
 #define	SPA_ASYNC_TRIM_RESTART			0x200
 #define	SPA_ASYNC_AUTOTRIM_RESTART		0x400
+#define	SPA_ASYNC_REBUILD_DONE			0x800
 
 /*
  * Controls the behavior of spa_vdev_remove().
@@ -837,7 +839,7 @@ extern int spa_config_parse(spa_t *spa, vdev_t **vdp, nvlist_t *nv,
 /* device manipulation */
 extern int spa_vdev_add(spa_t *spa, nvlist_t *nvroot);
 extern int spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot,
-    int replacing);
+    int replacing, int rebuild);
 extern int spa_vdev_detach(spa_t *spa, uint64_t guid, uint64_t pguid,
     int replace_done);
 extern int spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare);
@@ -866,6 +868,8 @@ extern void spa_l2cache_drop(spa_t *spa);
 
 /* scanning */
 extern int spa_scan(spa_t *spa, pool_scan_func_t func);
+extern int spa_scan_range(spa_t *spa, pool_scan_func_t func,
+    uint64_t txg_start, uint64_t txg_end);
 extern int spa_scan_stop(spa_t *spa);
 extern int spa_scrub_pause_resume(spa_t *spa, pool_scrub_cmd_t flag);
 
@@ -892,6 +896,8 @@ extern void spa_config_set(spa_t *spa, nvlist_t *config);
 extern nvlist_t *spa_config_generate(spa_t *spa, vdev_t *vd, uint64_t txg,
     int getstats);
 extern void spa_config_update(spa_t *spa, int what);
+extern void spa_config_update_deferred(spa_t *spa, int what);
+extern void spa_config_fini(void);
 
 /*
  * Miscellaneous SPA routines in spa_misc.c
@@ -946,6 +952,7 @@ typedef struct spa_stats {
 	spa_history_list_t	mmp_history;
 	spa_history_kstat_t	state;		/* pool state */
 	spa_history_kstat_t	iostats;
+	spa_history_kstat_t	zio_stages[ZIO_STAGE_CLASSES];
 } spa_stats_t;
 
 typedef enum txg_state {
@@ -978,6 +985,10 @@ typedef struct spa_iostats {
 	kstat_named_t	autotrim_bytes_skipped;
 	kstat_named_t	autotrim_extents_failed;
 	kstat_named_t	autotrim_bytes_failed;
+	kstat_named_t	mmp_writes;
+	kstat_named_t	mmp_writes_failed;
+	kstat_named_t	mmp_write_time_ns;
+	kstat_named_t	mmp_write_time_max_ns;
 } spa_iostats_t;
 
 extern void spa_stats_init(spa_t *spa);
@@ -1001,6 +1012,7 @@ extern void spa_iostats_trim_add(spa_t *spa, trim_type_t type,
     uint64_t extents_written, uint64_t bytes_written,
     uint64_t extents_skipped, uint64_t bytes_skipped,
     uint64_t extents_failed, uint64_t bytes_failed);
+extern void spa_iostats_mmp_add(spa_t *spa, hrtime_t duration, int error);
 extern void spa_import_progress_add(spa_t *spa);
 extern void spa_import_progress_remove(uint64_t spa_guid);
 extern int spa_import_progress_set_mmp_check(uint64_t pool_guid,
@@ -1073,9 +1085,12 @@ extern boolean_t spa_deflate(spa_t *spa);
 extern metaslab_class_t *spa_normal_class(spa_t *spa);
 extern metaslab_class_t *spa_log_class(spa_t *spa);
 extern metaslab_class_t *spa_special_class(spa_t *spa);
+extern metaslab_class_t *spa_bp_class(spa_t *spa, const blkptr_t *bp);
 extern metaslab_class_t *spa_dedup_class(spa_t *spa);
 extern metaslab_class_t *spa_preferred_class(spa_t *spa, uint64_t size,
     dmu_object_type_t objtype, uint_t level, uint_t special_smallblk);
+extern metaslab_class_t *spa_gang_fallback_class(spa_t *spa,
+    metaslab_class_t *mc, uint64_t size);
 
 extern void spa_evicting_os_register(spa_t *, objset_t *os);
 extern void spa_evicting_os_deregister(spa_t *, objset_t *os);
@@ -1164,6 +1179,9 @@ extern void spa_history_log_internal_ds(struct dsl_dataset *ds, const char *op,
 	dmu_tx_t *tx, const char *fmt, ...) __printflike(4, 5);
 extern void spa_history_log_internal_dd(dsl_dir_t *dd, const char *operation,
 	dmu_tx_t *tx, const char *fmt, ...) __printflike(4, 5);
+extern void spa_history_sync(spa_t *spa, dmu_tx_t *tx);
+extern void spa_history_flush_lazy(spa_t *spa);
+extern void spa_history_fini(spa_t *spa);
 
 extern const char *spa_state_to_name(spa_t *spa);
 
@@ -1182,6 +1200,8 @@ extern void zfs_post_state_change(spa_t *spa, vdev_t *vd, uint64_t laststate);
 extern void zfs_post_autoreplace(spa_t *spa, vdev_t *vd);
 extern uint64_t spa_get_errlog_size(spa_t *spa);
 extern int spa_get_errlog(spa_t *spa, void *uaddr, size_t *count);
+extern int spa_get_errlog_page(spa_t *spa, uint64_t cookie[3],
+    zbookmark_phys_t *zb, uint64_t *count, boolean_t *more);
 extern void spa_errlog_rotate(spa_t *spa);
 extern void spa_errlog_drain(spa_t *spa);
 extern void spa_errlog_sync(spa_t *spa, uint64_t txg);
@@ -1195,6 +1215,10 @@ extern void vdev_cache_stat_fini(void);
 extern void vdev_mirror_stat_init(void);
 extern void vdev_mirror_stat_fini(void);
 
+/* vdev queue */
+extern void vdev_queue_stat_init(void);
+extern void vdev_queue_stat_fini(void);
+
 /* Initialization and termination */
 extern void spa_init(int flags);
 extern void spa_fini(void);
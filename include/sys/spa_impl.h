@@ -69,6 +69,16 @@ typedef struct spa_history_phys {
 	uint64_t sh_records_lost;	/* num of records overwritten */
 } spa_history_phys_t;
 
+/*
+ * History records waiting to be appended to the on-disk log, each the packed
+ * length followed by the packed nvlist, as they are on disk.
+ */
+typedef struct spa_history_buf {
+	char		*shb_data;
+	uint64_t	shb_len;	/* bytes used */
+	uint64_t	shb_size;	/* bytes allocated */
+} spa_history_buf_t;
+
 /*
  * All members must be uint64_t, for byteswap purposes.
  */
@@ -141,6 +151,7 @@ typedef struct spa_config_lock {
 	int		scl_write_wanted;
 	kcondvar_t	scl_cv;
 	zfs_refcount_t	scl_count;
+	hrtime_t	scl_write_start;	/* for lock accounting */
 } spa_config_lock_t;
 
 typedef struct spa_config_dirent {
@@ -177,9 +188,16 @@ typedef enum spa_proc_state {
 
 typedef struct spa_taskqs {
 	uint_t stqs_count;
+	uint_t stqs_nodes;
 	taskq_t **stqs_taskq;
 } spa_taskqs_t;
 
+/* The livelist sublist for the livelist condense zthr to rewrite */
+typedef struct spa_livelist_condense {
+	uint64_t	lc_dir_obj;	/* dsl_dir of the clone, 0 if none */
+	uint64_t	lc_mintxg;	/* first birth txg of the sublist */
+} spa_livelist_condense_t;
+
 typedef enum spa_all_vdev_zap_action {
 	AVZ_ACTION_NONE = 0,
 	AVZ_ACTION_DESTROY,	/* Destroy all per-vdev ZAPs and the AVZ. */
@@ -301,10 +319,15 @@ struct spa {
 
 	spa_removing_phys_t spa_removing_phys;
 	spa_vdev_removal_t *spa_vdev_removal;
+	struct vdev_raidz_expand *spa_raidz_expand; /* expansion in progress */
 
 	spa_condensing_indirect_phys_t	spa_condensing_indirect_phys;
 	spa_condensing_indirect_t	*spa_condensing_indirect;
 	zthr_t		*spa_condense_zthr;	/* zthr doing condense. */
+	struct metaslab_condense *spa_ms_condense; /* metaslab condense */
+	zthr_t		*spa_ms_condense_zthr;
+	spa_livelist_condense_t spa_livelist_to_condense;
+	zthr_t		*spa_livelist_condense_zthr;
 
 	uint64_t	spa_checkpoint_txg;	/* the txg of the checkpoint */
 	spa_checkpoint_info_t spa_checkpoint_info; /* checkpoint accounting */
@@ -313,6 +336,7 @@ struct spa {
 	space_map_t	*spa_syncing_log_sm;	/* current log space map */
 	avl_tree_t	spa_sm_logs_by_txg;
 	kmutex_t	spa_flushed_ms_lock;	/* for metaslabs_by_flushed */
+	kmutex_t	spa_vdev_sync_lock;	/* shared by vdev_sync()s */
 	avl_tree_t	spa_metaslabs_by_flushed;
 	spa_unflushed_stats_t	spa_unflushed_stats;
 	list_t		spa_log_summary;
@@ -337,6 +361,10 @@ struct spa {
 	uint64_t	spa_deflate;		/* should we deflate? */
 	uint64_t	spa_history;		/* history object */
 	kmutex_t	spa_history_lock;	/* history lock */
+	spa_history_buf_t spa_history_pending;	/* records for this txg */
+	uint64_t	spa_history_create_end;	/* create record end in above */
+	spa_history_buf_t spa_history_lazy;	/* lazily written records */
+	boolean_t	spa_history_lazy_flush;	/* write lazy records out */
 	vdev_t		*spa_pending_vdev;	/* pending vdev additions */
 	kmutex_t	spa_props_lock;		/* property lock */
 	uint64_t	spa_pool_props_object;	/* object for properties */
@@ -361,6 +389,11 @@ struct spa {
 	ddt_t		*spa_ddt[ZIO_CHECKSUM_FUNCTIONS]; /* in-core DDTs */
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_dspace;	/* Cache get_dedup_dspace() */
+	uint64_t	spa_dedup_dsize;	/* Cache get_ddt_dsize() */
+	uint64_t	spa_dedup_table_quota;	/* dedup_table_quota prop */
+	uint64_t	spa_dedup_quota_count;	/* DDT entries at the quota */
+	uint64_t	spa_dedup_pruned;	/* DDT entries ever pruned */
+	boolean_t	spa_dedup_over_quota;	/* see ddt_over_quota() */
 	uint64_t	spa_dedup_checksum;	/* default dedup checksum */
 	uint64_t	spa_dspace;		/* dspace in normal class */
 	kmutex_t	spa_vdev_top_lock;	/* dueling offline/remove */
@@ -391,6 +424,8 @@ struct spa {
 	uint64_t	spa_autotrim;		/* automatic background trim? */
 	uint64_t	spa_errata;		/* errata issues detected */
 	spa_stats_t	spa_stats;		/* assorted spa statistics */
+	uint64_t	spa_stage_histo[ZIO_STAGE_CLASSES]
+	    [VDEV_L_HISTO_BUCKETS];		/* logical zio stage times */
 	spa_keystore_t	spa_keystore;		/* loaded crypto keys */
 
 	/* arc_memory_throttle() parameters during low memory condition */
@@ -398,6 +433,8 @@ struct spa {
 	uint64_t	spa_lowmem_last_txg;	/* txg window start */
 
 	hrtime_t	spa_ccw_fail_time;	/* Conf cache write fail time */
+	boolean_t	spa_ccw_deferred;	/* Conf cache write pending */
+	boolean_t	spa_ccw_deferred_event;	/* ... and its sysevent */
 	taskq_t		*spa_zvol_taskq;	/* Taskq for minor management */
 	taskq_t		*spa_prefetch_taskq;	/* Taskq for prefetch threads */
 	uint64_t	spa_multihost;		/* multihost aware (mmp) */
@@ -412,7 +449,7 @@ struct spa {
 	 * fields must remain in the same location.
 	 */
 	spa_config_lock_t spa_config_lock[SCL_LOCKS]; /* config changes */
-	zfs_refcount_t	spa_refcount;		/* number of opens */
+	zfs_refcount_pcpu_t spa_refcount;	/* number of opens */
 
 	taskq_t		*spa_upgrade_taskq;	/* taskq for upgrade jobs */
 	/* FreeBSD XXX */
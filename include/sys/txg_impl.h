@@ -55,8 +55,15 @@ extern "C" {
  *
  * The tx_cpu contains two locks, the tc_lock and tc_open_lock.
  * The tc_lock is used to protect all members of the tx_cpu structure with
- * the exception of the tc_open_lock. This lock should only be held for a
- * short period of time, typically when updating the value of tc_count.
+ * the exception of the tc_open_lock and tc_count. This lock should only be
+ * held for a short period of time.
+ *
+ * The tc_count is updated with atomics, so that taking and releasing a
+ * hold doesn't need the tc_lock. It can only be incremented with the
+ * tc_open_lock held, thus once the txg has been closed it only decreases.
+ * The tc_lock is only taken by the thread dropping the last hold of a
+ * txg, to wake up the quiesce thread, which checks the tc_count and waits
+ * on tc_cv with the tc_lock held.
  *
  * The tc_open_lock protects the tx_open_txg member of the tx_state structure.
  * This lock is used to ensure that transactions are only assigned into
@@ -136,6 +136,13 @@ struct uberblock {
 	 * the ZIL block is not allocated [see uses of spa_min_claim_txg()].
 	 */
 	uint64_t	ub_checkpoint_txg;
+
+	/*
+	 * While a raidz vdev is being expanded, the byte offset below which
+	 * its sectors have been reflowed to the new width and the copies
+	 * flushed to stable storage.  Zero otherwise.
+	 */
+	uint64_t	ub_raidz_reflow_info;
 };
 
 #ifdef	__cplusplus
@@ -0,0 +1,95 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_DRAID_H
+#define	_SYS_VDEV_DRAID_H
+
+#include <sys/types.h>
+#include <sys/nvpair.h>
+#include <sys/spa.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * The per-child height of a redundancy group column is aligned to this
+ * many bytes, and is never smaller than it.
+ */
+#define	VDEV_DRAID_ROW_SHIFT		16
+
+/*
+ * Number of distinct child permutations generated per dRAID vdev.  Slices
+ * of redundancy groups cycle through them.
+ */
+#define	VDEV_DRAID_NPERMS		256
+
+/*
+ * Metaslabs are kept small enough that each child holds at least this
+ * many slices, which bounds the capacity lost to a partial last slice.
+ */
+#define	VDEV_DRAID_MIN_SLICES		16
+
+/*
+ * Type-specific data of a dRAID vdev
+ */
+typedef struct vdev_draid_config {
+	uint64_t	vdc_ndata;	/* data columns per group */
+	uint64_t	vdc_nparity;	/* parity columns per group */
+	uint64_t	vdc_nspares;	/* distributed spares */
+	uint64_t	vdc_children;	/* number of children */
+	uint64_t	vdc_ndisks;	/* children holding data per slice */
+	uint64_t	vdc_groupwidth;	/* ndata + nparity */
+	uint64_t	vdc_ngroups;	/* redundancy groups per slice */
+	uint64_t	vdc_nrows;	/* group columns per child per slice */
+	uint64_t	vdc_seed;	/* permutation seed */
+	uint64_t	vdc_nperms;	/* number of permutations */
+	uint8_t		*vdc_perms;	/* nperms x children */
+	uint64_t	vdc_child_asize; /* smallest child at last open */
+} vdev_draid_config_t;
+
+/*
+ * Type-specific data of a distributed spare
+ */
+typedef struct vdev_draid_spare {
+	uint64_t	vds_nparity;	/* parity of the parent dRAID */
+	uint64_t	vds_top_id;	/* vdev id of the parent dRAID */
+	uint64_t	vds_spare_id;	/* spare index within the parent */
+} vdev_draid_spare_t;
+
+extern int vdev_draid_config_create(nvlist_t *, uint64_t, int, void **);
+extern int vdev_draid_spare_config_create(nvlist_t *, void **);
+extern void vdev_draid_config_free(vdev_t *);
+extern void vdev_draid_config_generate(vdev_t *, nvlist_t *);
+
+extern uint64_t vdev_draid_ndisks(vdev_t *);
+extern uint64_t vdev_draid_min_asize(vdev_t *);
+extern uint64_t vdev_draid_max_ms_shift(vdev_t *);
+
+extern vdev_t *vdev_draid_spare_get_parent(vdev_t *);
+extern nvlist_t *vdev_draid_read_config_spare(vdev_t *);
+extern void vdev_draid_spare_create(nvlist_t *, vdev_t *, uint64_t);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_VDEV_DRAID_H */
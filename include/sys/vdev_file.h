@@ -35,6 +35,7 @@ extern "C" {
 
 typedef struct vdev_file {
 	vnode_t		*vf_vnode;
+	void		*vf_uring;	/* userland io_uring state */
 } vdev_file_t;
 
 extern void vdev_file_init(void);
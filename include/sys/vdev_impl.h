@@ -39,6 +39,7 @@
 #include <sys/vdev_indirect_mapping.h>
 #include <sys/vdev_indirect_births.h>
 #include <sys/vdev_removal.h>
+#include <sys/vdev_rebuild.h>
 #include <sys/zfs_ratelimit.h>
 
 #ifdef	__cplusplus
@@ -70,7 +71,7 @@ extern uint32_t zfs_vdev_async_write_max_active;
 typedef int	vdev_open_func_t(vdev_t *vd, uint64_t *size, uint64_t *max_size,
     uint64_t *ashift, uint64_t *pshift);
 typedef void	vdev_close_func_t(vdev_t *vd);
-typedef uint64_t vdev_asize_func_t(vdev_t *vd, uint64_t psize);
+typedef uint64_t vdev_asize_func_t(vdev_t *vd, uint64_t psize, uint64_t txg);
 typedef void	vdev_io_start_func_t(zio_t *zio);
 typedef void	vdev_io_done_func_t(zio_t *zio);
 typedef void	vdev_state_change_func_t(vdev_t *vd, int, int);
@@ -88,6 +89,11 @@ typedef void	vdev_remap_func_t(vdev_t *vd, uint64_t offset, uint64_t size,
  */
 typedef void vdev_xlation_func_t(vdev_t *cvd, const range_seg_t *in,
     range_seg_t *res);
+/*
+ * Given a top-level vdev, adjusts the range of a new metaslab
+ */
+typedef void vdev_metaslab_init_func_t(vdev_t *vd, uint64_t *ms_start,
+    uint64_t *ms_size);
 
 typedef const struct vdev_ops {
 	vdev_open_func_t		*vdev_op_open;
@@ -105,6 +111,11 @@ typedef const struct vdev_ops {
 	 * Used when initializing vdevs. Isn't used by leaf ops.
 	 */
 	vdev_xlation_func_t		*vdev_op_xlate;
+	/*
+	 * Optional; for top-level vdevs which can't allocate from the whole
+	 * of each metaslab (e.g. draid).
+	 */
+	vdev_metaslab_init_func_t	*vdev_op_metaslab_init;
 	char				vdev_op_type[16];
 	boolean_t			vdev_op_leaf;
 } vdev_ops_t;
@@ -120,6 +131,7 @@ struct vdev_cache_entry {
 	avl_node_t	ve_lastused_node;
 	uint32_t	ve_hits;
 	uint16_t	ve_missed_update;
+	uint64_t	ve_served;	/* slices already handed to the ARC */
 	zio_t		*ve_fill_io;
 };
 
@@ -131,12 +143,16 @@ struct vdev_cache {
 
 typedef struct vdev_queue_class {
 	uint32_t	vqc_active;
+	uint32_t	vqc_queued;	/* number of queued i/os */
+	uint32_t	vqc_deadline_ios; /* i/os done in deadline interval */
+	hrtime_t	vqc_latency;	/* moving average i/o latency */
 
 	/*
-	 * Sorted by offset or timestamp, depending on if the queue is
-	 * LBA-ordered vs FIFO.
+	 * FIFO queues are kept in a list in submission order, LBA-ordered
+	 * queues in a tree sorted by offset.
 	 */
-	avl_tree_t	vqc_queued_tree;
+	list_t		vqc_list;
+	avl_tree_t	vqc_tree;
 } vdev_queue_class_t;
 
 struct vdev_queue {
@@ -149,6 +165,8 @@ struct vdev_queue {
 	uint64_t	vq_last_offset;
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
+	hrtime_t	vq_deadline_ts; /* time of last deadline update */
+	uint32_t	vq_deadline_pct; /* % of max_active for background */
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
 };
@@ -250,6 +268,10 @@ struct vdev {
 	boolean_t	vdev_expanding;	/* expand the vdev?		*/
 	boolean_t	vdev_reopening;	/* reopen in progress?		*/
 	boolean_t	vdev_nonrot;	/* true if solid state		*/
+	boolean_t	vdev_agg_nocopy; /* maps aggregated writes itself */
+	hrtime_t	vdev_mirror_latency; /* avg mirror read service time */
+	hrtime_t	vdev_mirror_latency_dev; /* its mean deviation */
+	hrtime_t	vdev_mirror_sampled; /* time of last read latency */
 	int		vdev_open_error; /* error on last open		*/
 	kthread_t	*vdev_open_thread; /* thread opening children	*/
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
@@ -263,6 +285,8 @@ struct vdev {
 	metaslab_group_t *vdev_mg;	/* metaslab group		*/
 	metaslab_t	**vdev_ms;	/* metaslab array		*/
 	uint64_t	vdev_pending_fastwrite; /* allocated fastwrites */
+	hrtime_t	vdev_fastwrite_latency; /* avg fastwrite latency */
+	hrtime_t	vdev_fastwrite_sampled; /* time of last latency */
 	txg_list_t	vdev_ms_list;	/* per-txg dirty metaslab lists	*/
 	txg_list_t	vdev_dtl_list;	/* per-txg dirty DTL lists	*/
 	txg_node_t	vdev_txg_node;	/* per-txg dirty vdev linkage	*/
@@ -316,6 +340,17 @@ struct vdev {
 	uint64_t	vdev_trim_secure;	/* requested secure TRIM */
 	time_t		vdev_trim_action_time;	/* start and end time */
 
+	/* Rebuild related */
+	boolean_t	vdev_rebuilding;
+	boolean_t	vdev_rebuild_exit_wanted;
+	boolean_t	vdev_rebuild_cancel_wanted;
+	boolean_t	vdev_rebuild_reset_wanted;
+	/* Protects vdev_rebuild_thread and vdev_rebuild_config. */
+	kmutex_t	vdev_rebuild_lock;
+	kcondvar_t	vdev_rebuild_cv;
+	kthread_t	*vdev_rebuild_thread;
+	vdev_rebuild_t	vdev_rebuild_config;
+
 	/* for limiting outstanding I/Os (initialize and TRIM) */
 	kmutex_t	vdev_initialize_io_lock;
 	kcondvar_t	vdev_initialize_io_cv;
@@ -379,6 +414,7 @@ struct vdev {
 	uint64_t	vdev_degraded;	/* persistent degraded state	*/
 	uint64_t	vdev_removed;	/* persistent removed state	*/
 	uint64_t	vdev_resilver_txg; /* persistent resilvering state */
+	uint64_t	vdev_rebuild_txg; /* persistent rebuilding state */
 	uint64_t	vdev_nparity;	/* number of parity devices for raidz */
 	char		*vdev_path;	/* vdev path (if any)		*/
 	char		*vdev_devid;	/* vdev devid (if any)		*/
@@ -390,6 +426,7 @@ struct vdev {
 	boolean_t	vdev_nowritecache; /* true if flushwritecache failed */
 	boolean_t	vdev_has_trim;	/* TRIM is supported		*/
 	boolean_t	vdev_has_securetrim; /* secure TRIM is supported */
+	boolean_t	vdev_has_zeroes; /* native write zeroes supported */
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
 	boolean_t	vdev_splitting;	/* split or repair in progress  */
@@ -402,17 +439,27 @@ struct vdev {
 	boolean_t	vdev_isl2cache;	/* was a l2cache device		*/
 	boolean_t	vdev_copy_uberblocks;  /* post expand copy uberblocks */
 	boolean_t	vdev_resilver_deferred;  /* resilver deferred */
-	vdev_queue_t	vdev_queue;	/* I/O deadline schedule queue	*/
+	vdev_queue_t	*vdev_queue;	/* I/O deadline schedule queues	*/
+	uint_t		vdev_queue_shards; /* number of vdev_queue shards */
+	uint32_t	vdev_queue_active[ZIO_PRIORITY_NUM_QUEUEABLE];
+	uint32_t	vdev_queue_active_total; /* active i/os of all shards */
 	vdev_cache_t	vdev_cache;	/* physical block cache		*/
 	spa_aux_vdev_t	*vdev_aux;	/* for l2cache and spares vdevs	*/
 	zio_t		*vdev_probe_zio; /* root of current probe	*/
+	zio_t		*vdev_flush_zio; /* cache flush in flight	*/
+	list_t		vdev_flush_riders; /* completed by vdev_flush_zio */
+	list_t		vdev_flush_queue; /* waiting for the next flush	*/
 	vdev_aux_t	vdev_label_aux;	/* on-disk aux state		*/
 	uint64_t	vdev_leaf_zap;
 	hrtime_t	vdev_mmp_pending; /* 0 if write finished	*/
 	uint64_t	vdev_mmp_kstat_id;	/* to find kstat entry */
+	hrtime_t	vdev_mmp_latency; /* decaying avg mmp write time */
 	uint64_t	vdev_expansion_time;	/* vdev's last expansion time */
 	list_node_t	vdev_leaf_node;		/* leaf vdev list */
 	uint16_t	vdev_rotation_rate; /* rotational rate of the media */
+	zio_cksum_t	vdev_label_cksum; /* cksum of label sans txg	*/
+	uint64_t	vdev_label_txg;	/* txg vdev_label_cksum written	*/
+	uint64_t	vdev_label_skip_txg; /* txg label writes skipped */
 
 #define	VDEV_RATE_UNKNOWN	0
 #define	VDEV_RATE_NON_ROTATING	1
@@ -427,6 +474,7 @@ struct vdev {
 	kmutex_t	vdev_dtl_lock;	/* vdev_dtl_{map,resilver}	*/
 	kmutex_t	vdev_stat_lock;	/* vdev_stat			*/
 	kmutex_t	vdev_probe_lock; /* protects vdev_probe_zio	*/
+	kmutex_t	vdev_flush_lock; /* protects vdev_flush_*	*/
 
 	/*
 	 * We rate limit ZIO delay and ZIO checksum events, since they
@@ -539,6 +587,8 @@ extern vdev_ops_t vdev_root_ops;
 extern vdev_ops_t vdev_mirror_ops;
 extern vdev_ops_t vdev_replacing_ops;
 extern vdev_ops_t vdev_raidz_ops;
+extern vdev_ops_t vdev_draid_ops;
+extern vdev_ops_t vdev_draid_spare_ops;
 extern vdev_ops_t vdev_disk_ops;
 extern vdev_ops_t vdev_file_ops;
 extern vdev_ops_t vdev_missing_ops;
@@ -551,7 +601,7 @@ extern vdev_ops_t vdev_indirect_ops;
  */
 extern void vdev_default_xlate(vdev_t *vd, const range_seg_t *in,
     range_seg_t *out);
-extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
+extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize, uint64_t txg);
 extern uint64_t vdev_get_min_asize(vdev_t *vd);
 extern void vdev_set_min_asize(vdev_t *vd);
 
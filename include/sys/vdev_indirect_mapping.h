@@ -76,6 +76,13 @@ typedef struct vdev_indirect_mapping_phys {
 
 #define	VDEV_INDIRECT_MAPPING_SIZE_V0	(3 * sizeof (uint64_t))
 
+/*
+ * Number of slots in the per-mapping lookup hint table.  Must be a
+ * power of two.
+ */
+#define	VIM_HINT_SHIFT		10
+#define	VIM_HINT_SLOTS		(1 << VIM_HINT_SHIFT)
+
 typedef struct vdev_indirect_mapping {
 	uint64_t	vim_object;
 	boolean_t	vim_havecounts;
@@ -92,6 +99,16 @@ typedef struct vdev_indirect_mapping {
 
 	dmu_buf_t	*vim_dbuf;
 	vdev_indirect_mapping_phys_t	*vim_phys;
+
+	/*
+	 * Direct-mapped cache of recent lookups, hashed by source offset.
+	 * Each slot holds an index into vim_entries plus one (zero means
+	 * empty).  Slots are only ever hints: they are updated without
+	 * locking and validated against the entry before use.  Entries
+	 * are only appended while the mapping is open, so an index that
+	 * was valid stays valid across vdev_indirect_mapping_add_entries().
+	 */
+	uint32_t	vim_hints[VIM_HINT_SLOTS];
 } vdev_indirect_mapping_t;
 
 extern vdev_indirect_mapping_t *vdev_indirect_mapping_open(objset_t *os,
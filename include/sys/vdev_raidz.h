@@ -26,13 +26,20 @@
 #define	_SYS_VDEV_RAIDZ_H
 
 #include <sys/types.h>
+#include <sys/txg.h>
+#include <sys/zfs_rlock.h>
 
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
 struct zio;
+struct vdev;
 struct raidz_map;
+struct spa;
+struct dmu_tx;
+struct pool_raidz_expand_stat;
+struct zio_cksum;
 #if !defined(_KERNEL)
 struct kernel_param {};
 #endif
@@ -42,9 +49,87 @@ struct kernel_param {};
  */
 struct raidz_map *vdev_raidz_map_alloc(struct zio *, uint64_t, uint64_t,
     uint64_t);
+struct raidz_map *vdev_raidz_map_alloc_offset(struct zio *, uint64_t,
+    uint64_t, uint64_t, uint64_t);
 void vdev_raidz_map_free(struct raidz_map *);
 void vdev_raidz_generate_parity(struct raidz_map *);
 int vdev_raidz_reconstruct(struct raidz_map *, const int *, int);
+void vdev_raidz_cksum_partial(struct raidz_map *, boolean_t,
+    struct zio_cksum *);
+int vdev_raidz_reconstruct_cksum(struct raidz_map *, const int *, int,
+    boolean_t, const struct zio_cksum *, struct zio_cksum *);
+
+/*
+ * Shared with dRAID, which stores each block as a RAID-Z stripe
+ */
+void vdev_raidz_io_start_map(struct zio *, struct raidz_map *);
+void vdev_raidz_io_done(struct zio *);
+void vdev_raidz_state_change(struct vdev *, int, int);
+
+/*
+ * Number of entries in the vdev_raidz_expand_phys_t.  This state is
+ * stored in the top-level vdev ZAP as VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS.
+ */
+#define	RAIDZ_EXPAND_PHYS_ENTRIES	5
+
+/*
+ * On-disk state of the expansion of a raidz vdev.  The reflow offset is
+ * not part of it, it is kept in the uberblock so it is updated atomically
+ * with the blocks which reference the reflowed sectors.  When adding new
+ * fields they must be added to the end of the structure.
+ */
+typedef struct vdev_raidz_expand_phys {
+	uint64_t	vrep_state;		/* dsl_scan_state_t */
+	uint64_t	vrep_start_time;	/* start time */
+	uint64_t	vrep_end_time;		/* end time */
+	uint64_t	vrep_bytes_to_reflow;	/* allocated bytes at start */
+	uint64_t	vrep_bytes_reflowed;	/* allocated bytes reflowed */
+} vdev_raidz_expand_phys_t;
+
+/*
+ * In-core state of the expansion of a raidz vdev by its last child.  The
+ * sectors of the vdev below vre_offset are laid out across all children,
+ * those above across all but the last one.  vre_offset is only advanced
+ * by the reflow thread, which holds the range being reflowed locked as
+ * writer in vre_rangelock; every raidz I/O locks its range as reader.
+ */
+typedef struct vdev_raidz_expand {
+	uint64_t	vre_vdev_id;
+	kmutex_t	vre_lock;		/* protects the fields below */
+	kcondvar_t	vre_cv;
+	kthread_t	*vre_thread;
+	boolean_t	vre_exit_wanted;
+	uint64_t	vre_offset;		/* reflowed bytes, in-core */
+	rangelock_t	vre_rangelock;
+	vdev_raidz_expand_phys_t vre_phys;	/* updated once per txg */
+} vdev_raidz_expand_t;
+
+/*
+ * Type specific data of a raidz vdev.  A vdev which was expanded keeps
+ * the stripe width its blocks were written with as (txg, width) pairs in
+ * vd_expand_txgs; blocks born before the first txg use vd_original_width.
+ */
+typedef struct vdev_raidz {
+	uint64_t	vd_original_width;
+	uint64_t	vd_nexpand;		/* pairs in vd_expand_txgs */
+	uint64_t	*vd_expand_txgs;
+	krwlock_t	vd_expand_lock;		/* protects vd_expand_txgs */
+	boolean_t	vd_expanding;		/* last child being reflowed */
+	vdev_raidz_expand_t vd_expand;
+} vdev_raidz_t;
+
+/*
+ * RAID-Z expansion
+ */
+int vdev_raidz_config_create(nvlist_t *, void **);
+void vdev_raidz_config_free(struct vdev *);
+void vdev_raidz_config_generate(struct vdev *, nvlist_t *);
+uint64_t vdev_raidz_asize_width(struct vdev *);
+void vdev_raidz_attach(struct vdev *, struct dmu_tx *);
+int vdev_raidz_load(struct vdev *);
+void vdev_raidz_expand_restart(struct spa *);
+void vdev_raidz_expand_stop_all(struct spa *);
+int spa_raidz_expand_get_stats(struct spa *, struct pool_raidz_expand_stat *);
 
 /*
  * vdev_raidz_math interface
@@ -110,8 +110,22 @@ typedef struct raidz_col {
 	int rc_error;			/* I/O error for this device */
 	uint8_t rc_tried;		/* Did we attempt this I/O column? */
 	uint8_t rc_skipped;		/* Did we skip this I/O column? */
+	uint64_t rc_shadow_devidx;	/* also written here, see below */
+	uint64_t rc_shadow_offset;	/* UINT64_MAX if not written twice */
+	int rc_shadow_error;		/* I/O error for the shadow write */
 } raidz_col_t;
 
+/*
+ * The sectors of a block on a raidz vdev which was expanded, or is being
+ * expanded, are not necessarily laid out with the stripe width the block
+ * was written with.  Its map then carries a map per row of the stripe,
+ * rm_row[], whose columns are single sectors at their actual location.
+ * Their abds are views of the columns of the block's map, which is used
+ * to generate the parity; I/O is issued and reconstruction is done per
+ * row.  Sectors which were reflowed since the last txg synced are written
+ * to both their new and their old (shadow) location.
+ */
+
 typedef struct raidz_map {
 	uint64_t rm_cols;		/* Regular column count */
 	uint64_t rm_scols;		/* Count including skipped columns */
@@ -127,6 +141,9 @@ typedef struct raidz_map {
 	uint8_t	rm_freed;		/* map no longer has referencing ZIO */
 	uint8_t	rm_ecksuminjected;	/* checksum error was injected */
 	const raidz_impl_ops_t *rm_ops;	/* RAIDZ math operations */
+	uint64_t rm_nrows;		/* Rows in rm_row, if reflowed */
+	struct raidz_map **rm_row;	/* Per-row maps of a reflowed block */
+	struct locked_range *rm_lr;	/* Range locked during expansion */
 	raidz_col_t rm_col[1];		/* Flexible array of I/O columns */
 } raidz_map_t;
 
@@ -222,6 +222,8 @@ int zap_contains(objset_t *ds, uint64_t zapobj, const char *name);
 int zap_prefetch(objset_t *os, uint64_t zapobj, const char *name);
 int zap_prefetch_uint64(objset_t *os, uint64_t zapobj, const uint64_t *key,
     int key_numints);
+int zap_prefetch_uint64_batch(objset_t *os, uint64_t zapobj,
+    const uint64_t *keys, int key_numints, uint_t count);
 
 int zap_lookup_by_dnode(dnode_t *dn, const char *name,
     uint64_t integer_size, uint64_t num_integers, void *buf);
@@ -263,6 +265,30 @@ int zap_update_uint64(objset_t *os, uint64_t zapobj, const uint64_t *key,
     int key_numints,
     int integer_size, uint64_t num_integers, const void *val, dmu_tx_t *tx);
 
+/*
+ * One update of a batch.  zbe_key is the name of the attribute for
+ * zap_update_batch(), and an array of key_numints integers for
+ * zap_update_uint64_batch().
+ */
+typedef struct zap_batch_ent {
+	const void	*zbe_key;
+	int		zbe_integer_size;
+	uint64_t	zbe_num_integers;
+	const void	*zbe_val;
+} zap_batch_ent_t;
+
+/*
+ * Apply count updates, as zap_update() or zap_update_uint64() would, under
+ * a single hold of the ZAP.  The updates are applied in hash order, so that
+ * those to the same leaf are applied together.  Processing stops at the
+ * first error, which is returned; the updates before it remain applied.
+ * The keys must be distinct.
+ */
+int zap_update_batch(objset_t *os, uint64_t zapobj,
+    const zap_batch_ent_t *zbes, uint_t count, dmu_tx_t *tx);
+int zap_update_uint64_batch(objset_t *os, uint64_t zapobj, int key_numints,
+    const zap_batch_ent_t *zbes, uint_t count, dmu_tx_t *tx);
+
 /*
  * Get the length (in integers) and the integer size of the specified
  * attribute.
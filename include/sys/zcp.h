@@ -38,8 +38,19 @@ extern unsigned long zfs_lua_max_memlimit;
 
 int zcp_argerror(lua_State *, int, const char *, ...);
 
+/*
+ * Writes output streamed by a channel program with zfs.stream() to the
+ * caller.  Called in open context, between txgs.
+ */
+typedef int (zcp_stream_func_t)(void *buf, size_t len, void *arg);
+
+typedef struct zcp_stream {
+	zcp_stream_func_t	*zs_func;
+	void			*zs_arg;
+} zcp_stream_t;
+
 int zcp_eval(const char *, const char *, boolean_t, uint64_t, uint64_t,
-    nvpair_t *, nvlist_t *);
+    uint64_t, zcp_stream_t *, nvpair_t *, nvlist_t *);
 
 int zcp_load_list_lib(lua_State *);
 
@@ -93,6 +104,24 @@ typedef struct zcp_run_info {
 	 */
 	uint64_t	zri_curinstrs;
 
+	/*
+	 * The number of Lua instructions the channel program may execute in
+	 * one txg before it is suspended and resumed in the next one.  A
+	 * value of 0 runs the whole program in a single txg.
+	 */
+	uint64_t	zri_txg_maxinstrs;
+
+	/*
+	 * The number of Lua instructions executed in the current txg.
+	 */
+	uint64_t	zri_txg_curinstrs;
+
+	/*
+	 * Boolean indicating whether the channel program was suspended at
+	 * the end of the current txg and has yet to run to completion.
+	 */
+	boolean_t	zri_yielded;
+
 	/*
 	 * Boolean indicating whether or not the channel program exited
 	 * because it timed out.
@@ -121,6 +150,12 @@ typedef struct zcp_run_info {
 	 */
 	lua_State	*zri_state;
 
+	/*
+	 * The coroutine the channel program runs in when it may span txgs,
+	 * or NULL.
+	 */
+	lua_State	*zri_thread;
+
 	/*
 	 * Lua memory allocator arguments.
 	 */
@@ -131,6 +166,15 @@ typedef struct zcp_run_info {
 	 */
 	nvlist_t	*zri_outnvl;
 
+	/*
+	 * Where values passed to zfs.stream() are written, or NULL, and
+	 * the buffer they are staged in until the end of the current txg.
+	 */
+	zcp_stream_t	*zri_stream;
+	char		*zri_stream_buf;
+	size_t		zri_stream_len;
+	size_t		zri_stream_size;
+
 	/*
 	 * The errno number returned to caller of zcp_eval().
 	 */
@@ -167,6 +167,8 @@ typedef struct zfs_acl {
 	zfs_acl_node_t	*z_curr_node;	/* current node iterator is handling */
 	list_t		z_acl;		/* chunks of ACE data */
 	acl_ops_t	*z_ops;		/* ACL operations */
+	uint32_t	z_everyone_allow; /* granted to all, see aces_check */
+	boolean_t	z_everyone_valid; /* z_everyone_allow is computed */
 } zfs_acl_t;
 
 typedef struct acl_locator_cb {
@@ -82,6 +82,21 @@
 	module_param(name_prefix ## name, type, perm); \
 	MODULE_PARM_DESC(name_prefix ## name, desc)
 
+/*
+ * Holds back the bios submitted by the current thread so that the block
+ * layer can merge and dispatch them together.
+ */
+#if defined(HAVE_BLK_QUEUE_HAVE_BLK_PLUG)
+#include <linux/blkdev.h>
+typedef struct blk_plug	zfs_blk_plug_t;
+#define	zfs_blk_start_plug(p)	blk_start_plug(p)
+#define	zfs_blk_finish_plug(p)	blk_finish_plug(p)
+#else
+typedef int		zfs_blk_plug_t;
+#define	zfs_blk_start_plug(p)	((void) (p))
+#define	zfs_blk_finish_plug(p)	((void) (p))
+#endif
+
 
 #elif defined(__FreeBSD__)
 #include <sys/kcondvar.h>
@@ -97,6 +112,10 @@
 #define	cv_wait_io(cv, mp)			cv_wait(cv, mp)
 #define	cv_wait_io_sig(cv, mp)			cv_wait_sig(cv, mp)
 
+typedef int		zfs_blk_plug_t;
+#define	zfs_blk_start_plug(p)	((void) (p))
+#define	zfs_blk_finish_plug(p)	((void) (p))
+
 #define	cond_resched()		kern_yield(PRI_USER)
 
 #include <sys/sysctl.h>
@@ -367,6 +386,19 @@ extern int mutex_tryenter(kmutex_t *mp);
 
 #define	NESTED_SINGLE 1
 #define	mutex_enter_nested(mp, class) mutex_enter(mp)
+
+/*
+ * Lock contention accounting is only implemented in the Linux kernel.
+ */
+typedef struct spl_lockstat_class {
+	const char	*lsc_name;
+} spl_lockstat_class_t;
+
+#define	SPL_LOCKSTAT_CLASS_INIT(name, func)	{ .lsc_name = (name) }
+#define	spl_lockstat_start()			((hrtime_t)0)
+#define	spl_lockstat_acquired(lsc, start)	((void) (lsc), (void) (start))
+#define	spl_lockstat_released(lsc, start)	((void) (lsc), (void) (start))
+
 /*
  * RW locks
  */
@@ -429,6 +461,10 @@ extern void cv_broadcast(kcondvar_t *cv);
 #define	cv_timedwait_sig_hires(cv, mp, t, r, f) \
 	cv_timedwait_hires(cv, mp, t, r, f)
 
+typedef int		zfs_blk_plug_t;
+#define	zfs_blk_start_plug(p)	((void) (p))
+#define	zfs_blk_finish_plug(p)	((void) (p))
+
 /*
  * Thread-specific data
  */
@@ -545,6 +581,11 @@ typedef struct taskq_ent {
 	uintptr_t		tqent_flags;
 } taskq_ent_t;
 
+typedef struct taskq_deque {
+	kmutex_t	tqd_lock;
+	taskq_ent_t	tqd_task;
+} taskq_deque_t;
+
 typedef struct taskq {
 	char		tq_name[TASKQ_NAMELEN + 1];
 	kmutex_t	tq_lock;
@@ -562,6 +603,11 @@ typedef struct taskq {
 	int		tq_maxalloc_wait;
 	taskq_ent_t	*tq_freelist;
 	taskq_ent_t	tq_task;
+	taskq_deque_t	*tq_deques;
+	int		tq_ndeques;
+	uint32_t	tq_ws_next;
+	uint32_t	tq_ws_queued;
+	uint32_t	tq_ws_idle;
 } taskq_t;
 
 #define	TQENT_FLAG_PREALLOC	0x1	/* taskq_dispatch_ent used */
@@ -571,6 +617,7 @@ typedef struct taskq {
 #define	TASKQ_DYNAMIC		0x0004	/* Use dynamic thread scheduling */
 #define	TASKQ_THREADS_CPU_PCT	0x0008	/* Scale # threads by # cpus */
 #define	TASKQ_DC_BATCH		0x0010	/* Mark threads as batch */
+#define	TASKQ_STEAL		0x0020	/* Per-thread queues for prealloc'd */
 
 #define	TQ_SLEEP	KM_SLEEP	/* Can block for memory */
 #define	TQ_NOSLEEP	KM_NOSLEEP	/* cannot block for memory; may fail */
@@ -587,6 +634,10 @@ extern taskq_t	*taskq_create(const char *, int, pri_t, int, int, uint_t);
 	    (taskq_create(a, b, c, d, e, f))
 #define	taskq_create_sysdc(a, b, d, e, p, dc, f) \
 	    (taskq_create(a, b, maxclsyspri, d, e, f))
+#define	taskq_create_on_node(a, b, c, d, e, f, n) \
+	    (taskq_create(a, b, c, d, e, f))
+#define	taskq_nnodes()		1
+#define	taskq_curnode()		0
 extern taskqid_t taskq_dispatch(taskq_t *, task_func_t, void *, uint_t);
 extern taskqid_t taskq_dispatch_delay(taskq_t *, task_func_t, void *, uint_t,
     clock_t);
@@ -115,8 +115,11 @@ typedef enum drr_headertype {
 #define	DMU_BACKUP_FEATURE_COMPRESSED		(1 << 22)
 #define	DMU_BACKUP_FEATURE_LARGE_DNODE		(1 << 23)
 #define	DMU_BACKUP_FEATURE_RAW			(1 << 24)
-/* flag #25 is reserved for the ZSTD compression feature */
+#define	DMU_BACKUP_FEATURE_ZSTD			(1 << 25)
 #define	DMU_BACKUP_FEATURE_HOLDS		(1 << 26)
+#define	DMU_BACKUP_FEATURE_CHUNKED		(1 << 27)
+#define	DMU_BACKUP_FEATURE_STREAM_COMPRESS	(1 << 28)
+#define	DMU_BACKUP_FEATURE_CHUNKED_COMPRESS	(1 << 29)
 
 /*
  * Mask of all supported backup features
@@ -127,7 +130,9 @@ typedef enum drr_headertype {
     DMU_BACKUP_FEATURE_RESUMING | DMU_BACKUP_FEATURE_LARGE_BLOCKS | \
     DMU_BACKUP_FEATURE_COMPRESSED | DMU_BACKUP_FEATURE_LARGE_DNODE | \
     DMU_BACKUP_FEATURE_RAW | DMU_BACKUP_FEATURE_HOLDS | \
-	DMU_BACKUP_FEATURE_REDACTED)
+	DMU_BACKUP_FEATURE_REDACTED | DMU_BACKUP_FEATURE_ZSTD | \
+	DMU_BACKUP_FEATURE_CHUNKED | DMU_BACKUP_FEATURE_STREAM_COMPRESS | \
+	DMU_BACKUP_FEATURE_CHUNKED_COMPRESS)
 
 /* Are all features in the given flag word currently supported? */
 #define	DMU_STREAM_SUPPORTED(x)	(!((x) & ~DMU_BACKUP_FEATURE_MASK))
@@ -198,17 +203,20 @@ typedef enum dmu_send_resume_token_version {
 #define	DRR_RAW_BYTESWAP	(1<<1)
 #define	DRR_OBJECT_SPILL	(1<<2) /* OBJECT record has a spill block */
 #define	DRR_SPILL_UNMODIFIED	(1<<2) /* SPILL record for unmodified block */
+#define	DRR_STREAM_COMPRESSED	(1<<3) /* WRITE payload compressed in stream */
 
 #define	DRR_IS_DEDUP_CAPABLE(flags)	((flags) & DRR_CHECKSUM_DEDUP)
 #define	DRR_IS_RAW_BYTESWAPPED(flags)	((flags) & DRR_RAW_BYTESWAP)
 #define	DRR_OBJECT_HAS_SPILL(flags)	((flags) & DRR_OBJECT_SPILL)
 #define	DRR_SPILL_IS_UNMODIFIED(flags)	((flags) & DRR_SPILL_UNMODIFIED)
+#define	DRR_IS_STREAM_COMPRESSED(flags)	((flags) & DRR_STREAM_COMPRESSED)
 
 /* deal with compressed drr_write replay records */
 #define	DRR_WRITE_COMPRESSED(drrw)	((drrw)->drr_compressiontype != 0)
 #define	DRR_WRITE_PAYLOAD_SIZE(drrw) \
-	(DRR_WRITE_COMPRESSED(drrw) ? (drrw)->drr_compressed_size : \
-	(drrw)->drr_logical_size)
+	(DRR_WRITE_COMPRESSED(drrw) || \
+	DRR_IS_STREAM_COMPRESSED((drrw)->drr_flags) ? \
+	(drrw)->drr_compressed_size : (drrw)->drr_logical_size)
 #define	DRR_SPILL_PAYLOAD_SIZE(drrs) \
 	((drrs)->drr_compressed_size ? \
 	(drrs)->drr_compressed_size : (drrs)->drr_length)
@@ -407,6 +415,11 @@ typedef struct zinject_record {
 	uint64_t	zi_nlanes;
 	uint32_t	zi_cmd;
 	uint32_t	zi_dvas;
+	uint32_t	zi_delay_dist;	/* zinject_delay_dist_t */
+	uint32_t	zi_delay_freq;	/* share of bimodal/spike I/Os */
+	uint64_t	zi_timer2;	/* bimodal/spike delay (ns) */
+	uint64_t	zi_sigma;	/* lognormal sigma (thousandths) */
+	uint64_t	zi_bandwidth;	/* throttle (bytes/sec), 0 for none */
 } zinject_record_t;
 
 #define	ZINJECT_NULL		0x1
@@ -416,7 +429,9 @@ typedef struct zinject_record {
 
 #define	ZEVENT_NONE		0x0
 #define	ZEVENT_NONBLOCK		0x1
+#define	ZEVENT_BATCH		0x2
 #define	ZEVENT_SIZE		1024
+#define	ZEVENT_BATCH_SIZE	(128 * 1024)
 
 #define	ZEVENT_SEEK_START	0
 #define	ZEVENT_SEEK_END		UINT64_MAX
@@ -438,6 +453,17 @@ typedef enum zinject_type {
 	ZINJECT_DECRYPT_FAULT,
 } zinject_type_t;
 
+/*
+ * How the delay of a ZINJECT_DELAY_IO record is chosen for each I/O.
+ */
+typedef enum zinject_delay_dist {
+	ZINJECT_DELAY_FIXED,		/* zi_timer */
+	ZINJECT_DELAY_LOGNORMAL,	/* median zi_timer, sigma zi_sigma */
+	ZINJECT_DELAY_BIMODAL,		/* zi_timer2 at zi_delay_freq */
+	ZINJECT_DELAY_SPIKE,		/* plus zi_timer2 at zi_delay_freq */
+	ZINJECT_DELAY_DISTS
+} zinject_delay_dist_t;
+
 typedef struct zfs_share {
 	uint64_t	z_exportdata;
 	uint64_t	z_sharedata;
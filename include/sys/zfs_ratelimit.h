@@ -22,9 +22,22 @@
 
 #include <sys/zfs_context.h>
 
+/*
+ * Number of caller-defined values whose range is kept over the events
+ * suppressed in an interval.
+ */
+#define	ZFS_RATELIMIT_NVALS	2
+
+typedef struct zfs_ratelimit_summary {
+	uint64_t rs_count;	/* Events suppressed */
+	uint64_t rs_min[ZFS_RATELIMIT_NVALS];
+	uint64_t rs_max[ZFS_RATELIMIT_NVALS];
+} zfs_ratelimit_summary_t;
+
 typedef struct {
 	hrtime_t start;
 	unsigned int count;
+	zfs_ratelimit_summary_t summary;	/* Of the current interval */
 
 	/*
 	 * Pointer to number of events per interval.  We do this to
@@ -37,6 +50,8 @@ typedef struct {
 } zfs_ratelimit_t;
 
 int zfs_ratelimit(zfs_ratelimit_t *rl);
+int zfs_ratelimit_summarize(zfs_ratelimit_t *rl, const uint64_t *vals,
+    zfs_ratelimit_summary_t *prev);
 void zfs_ratelimit_init(zfs_ratelimit_t *rl, unsigned int *burst,
     unsigned int interval);
 void zfs_ratelimit_fini(zfs_ratelimit_t *rl);
@@ -45,9 +45,15 @@ struct locked_range;
 
 typedef void (rangelock_cb_t)(struct locked_range *, void *);
 
+typedef struct rangelock_stripe {
+	kmutex_t rls_lock;
+	avl_tree_t rls_tree; /* contains locked_range_t */
+} rangelock_stripe_t;
+
 typedef struct zfs_rangelock {
-	avl_tree_t rl_tree; /* contains locked_range_t */
-	kmutex_t rl_lock;
+	rangelock_stripe_t rl_stripe0; /* the only stripe, if not striped */
+	rangelock_stripe_t *rl_stripes;
+	uint_t rl_nstripes;
 	rangelock_cb_t *rl_cb;
 	void *rl_arg;
 } rangelock_t;
@@ -64,9 +70,12 @@ typedef struct locked_range {
 	uint8_t lr_proxy;	/* acting for original range */
 	uint8_t lr_write_wanted; /* writer wants to lock this range */
 	uint8_t lr_read_wanted;	/* reader wants to lock this range */
+	uint_t lr_stripe;	/* stripe whose tree holds this lock */
+	struct locked_range *lr_next_piece; /* same lock in next stripe */
 } locked_range_t;
 
 void zfs_rangelock_init(rangelock_t *, rangelock_cb_t *, void *);
+void zfs_rangelock_init_striped(rangelock_t *);
 void zfs_rangelock_fini(rangelock_t *);
 
 locked_range_t *rangelock_enter(rangelock_t *,
@@ -300,12 +300,21 @@ do {								\
 #define	ZPL_VERIFY_ZP(zp)	ZFS_VERIFY_ZP_ERROR(zp, -EIO)
 
 /*
- * Macros for dealing with dmu_buf_hold
+ * Macros for dealing with dmu_buf_hold.  Unless zfs_object_mutex_size is
+ * set, the hold array has ZFS_OBJ_MTX_PER_CPU entries per CPU.
  */
 #define	ZFS_OBJ_MTX_SZ		64
+#define	ZFS_OBJ_MTX_PER_CPU	16
 #define	ZFS_OBJ_MTX_MAX		(1024 * 1024)
 #define	ZFS_OBJ_HASH(zfsvfs, obj)	((obj) & ((zfsvfs->z_hold_size) - 1))
 
+/*
+ * Macros for dealing with the z_all_znodes lists
+ */
+#define	ZFS_ZNODES_PER_CPU	4
+#define	ZFS_ZNODES_MAX		256
+#define	ZFS_ZNODES_HASH(zfsvfs, obj)	((obj) & ((zfsvfs)->z_znodes_size - 1))
+
 extern unsigned int zfs_object_mutex_size;
 
 /*
@@ -357,6 +366,10 @@ extern int	zfs_freesp(znode_t *, uint64_t, uint64_t, int, boolean_t);
 extern void	zfs_znode_init(void);
 extern void	zfs_znode_fini(void);
 extern int	zfs_znode_hold_compare(const void *, const void *);
+extern uint64_t	zfs_znode_hold_size(void);
+extern void	zfs_znode_lists_create(zfsvfs_t *);
+extern void	zfs_znode_lists_destroy(zfsvfs_t *);
+extern void	zfs_znode_list_insert(zfsvfs_t *, znode_t *);
 extern int	zfs_zget(zfsvfs_t *, uint64_t, znode_t **);
 extern int	zfs_rezget(znode_t *);
 extern void	zfs_zinactive(znode_t *);
@@ -453,6 +453,17 @@ typedef struct zil_stats {
 	 */
 	kstat_named_t zil_itx_metaslab_slog_count;
 	kstat_named_t zil_itx_metaslab_slog_bytes;
+
+	/*
+	 * Log blocks allocated, and the bytes allocated to them and
+	 * actually written.  The difference is the space left unused by
+	 * the size prediction, see zil_lwb_plan_size().  Blocks sized
+	 * for a low latency log device are also counted in fast_count.
+	 */
+	kstat_named_t zil_lwb_alloc_count;
+	kstat_named_t zil_lwb_alloc_bytes;
+	kstat_named_t zil_lwb_write_bytes;
+	kstat_named_t zil_lwb_fast_count;
 } zil_stats_t;
 
 extern zil_stats_t zil_stats;
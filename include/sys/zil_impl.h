@@ -43,9 +43,18 @@ extern "C" {
  * transitioning from "closed" to "opened" the zilog's "zl_issuer_lock"
  * must be held.
  *
- * After the lwb is "opened", it can transition into the "issued" state
- * via zil_lwb_write_issue(). Again, the zilog's "zl_issuer_lock" must
- * be held when making this transition.
+ * After the lwb is "opened", it can transition into the "ready" state
+ * via zil_lwb_write_close(). Again, the zilog's "zl_issuer_lock" must
+ * be held when making this transition.  A "ready" lwb accepts no more
+ * itxs, and the block following it has been allocated and linked to it.
+ *
+ * The lwb then transitions into the "issued" state via
+ * zil_lwb_write_issue(), by the thread that closed it, once that thread
+ * has dropped the "zl_issuer_lock".  This way, the zios of the closed
+ * lwbs are issued while another thread fills the next ones, and several
+ * lwbs, possibly on different log devices, can be in flight at once.
+ * The completion order of the lwbs is still the order in which they
+ * were opened, see zil_lwb_set_zio_dependency().
  *
  * After the lwb's write zio completes, it transitions into the "write
  * done" state via zil_lwb_write_done(); and then into the "flush done"
@@ -62,7 +71,8 @@ extern "C" {
  *
  * Additionally, correctness when reading an lwb's state is often
  * achieved by exploiting the fact that these state transitions occur in
- * this specific order; i.e. "closed" to "opened" to "issued" to "done".
+ * this specific order; i.e. "closed" to "opened" to "ready" to "issued"
+ * to "done".
  *
  * Thus, if an lwb is in the "closed" or "opened" state, holding the
  * "zl_issuer_lock" will prevent a concurrent thread from transitioning
@@ -73,6 +83,7 @@ extern "C" {
 typedef enum {
     LWB_STATE_CLOSED,
     LWB_STATE_OPENED,
+    LWB_STATE_READY,
     LWB_STATE_ISSUED,
     LWB_STATE_WRITE_DONE,
     LWB_STATE_FLUSH_DONE,
@@ -82,11 +93,13 @@ typedef enum {
 /*
  * Log write block (lwb)
  *
- * Prior to an lwb being issued to disk via zil_lwb_write_issue(), it
- * will be protected by the zilog's "zl_issuer_lock". Basically, prior
- * to it being issued, it will only be accessed by the thread that's
- * holding the "zl_issuer_lock". After the lwb is issued, the zilog's
- * "zl_lock" is used to protect the lwb against concurrent access.
+ * Prior to an lwb being closed via zil_lwb_write_close(), it will be
+ * protected by the zilog's "zl_issuer_lock". Basically, prior to it
+ * being closed, it will only be accessed by the thread that's holding
+ * the "zl_issuer_lock". A "ready" lwb is only accessed by the thread
+ * that closed it, until it issues it. After the lwb is issued, the
+ * zilog's "zl_lock" is used to protect the lwb against concurrent
+ * access.
  */
 typedef struct lwb {
 	zilog_t		*lwb_zilog;	/* back pointer to log struct */
@@ -102,6 +115,7 @@ typedef struct lwb {
 	dmu_tx_t	*lwb_tx;	/* tx for log block allocation */
 	uint64_t	lwb_max_txg;	/* highest txg in this lwb */
 	list_node_t	lwb_node;	/* zilog->zl_lwb_list linkage */
+	list_node_t	lwb_issue_node;	/* linkage of lwbs to be issued */
 	list_t		lwb_itxs;	/* list of itx's */
 	list_t		lwb_waiters;	/* list of zil_commit_waiter's */
 	avl_tree_t	lwb_vdev_tree;	/* vdevs to flush after lwb write */
@@ -124,6 +138,9 @@ typedef struct lwb {
  * of this. Thus, one must be careful not to acquire the
  * "zl_issuer_lock" or "zl_lock" when already holding the "zcw_lock";
  * e.g. see the zil_commit_waiter_timeout() function.
+ *
+ * Only the zil_commit() thread which allocated the waiter ever waits on
+ * "zcw_cv", so it is signalled rather than broadcast.
  */
 typedef struct zil_commit_waiter {
 	kcondvar_t	zcw_cv;		/* signalled when "done" */
@@ -200,6 +217,7 @@ struct zilog {
 	itxg_t		zl_itxg[TXG_SIZE]; /* intent log txg chains */
 	list_t		zl_itx_commit_list; /* itx list to be committed */
 	uint64_t	zl_cur_used;	/* current commit log size used */
+	uint64_t	zl_burst_avg;	/* moving average of zl_cur_used */
 	list_t		zl_lwb_list;	/* in-flight log write list */
 	avl_tree_t	zl_bp_tree;	/* track bps during log parse */
 	clock_t		zl_replay_time;	/* lbolt of when replay started */
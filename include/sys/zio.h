@@ -86,6 +86,7 @@ enum zio_checksum {
 	ZIO_CHECKSUM_SHA512,
 	ZIO_CHECKSUM_SKEIN,
 	ZIO_CHECKSUM_EDONR,
+	ZIO_CHECKSUM_BLAKE3,
 	ZIO_CHECKSUM_FUNCTIONS
 };
 
@@ -167,6 +168,12 @@ typedef enum zio_suspend_reason {
 	ZIO_SUSPEND_MMP,
 } zio_suspend_reason_t;
 
+typedef enum zio_queue_state {
+	ZIO_QS_NONE = 0,
+	ZIO_QS_QUEUED,
+	ZIO_QS_ACTIVE,
+} zio_queue_state_t;
+
 enum zio_flag {
 	/*
 	 * Flags inherited by gang, ddt, and vdev children,
@@ -359,6 +366,7 @@ typedef struct zio_prop {
 	boolean_t		zp_nopwrite;
 	boolean_t		zp_encrypt;
 	boolean_t		zp_byteorder;
+	boolean_t		zp_early_abort;
 	uint8_t			zp_salt[ZIO_DATA_SALT_LEN];
 	uint8_t			zp_iv[ZIO_DATA_IV_LEN];
 	uint8_t			zp_mac[ZIO_DATA_MAC_LEN];
@@ -436,6 +444,7 @@ typedef zio_t *zio_pipe_stage_t(zio_t *zio);
  */
 enum trim_flag {
 	ZIO_TRIM_SECURE		= 1 << 0,
+	ZIO_TRIM_ZEROES		= 1 << 1,	/* range must read as zeroes */
 };
 
 typedef struct zio_alloc_list {
@@ -468,6 +477,7 @@ struct zio {
 	blkptr_t	io_bp_copy;
 	list_t		io_parent_list;
 	list_t		io_child_list;
+	zio_link_t	io_parent_link;	/* link to the first parent */
 	zio_t		*io_logical;
 	zio_transform_t *io_transform_stack;
 
@@ -501,7 +511,15 @@ struct zio {
 	hrtime_t	io_delta;	/* vdev queue service delta */
 	hrtime_t	io_delay;	/* Device access time (disk or */
 					/* file). */
-	avl_node_t	io_queue_node;
+	hrtime_t	io_dispatch_time; /* handed to a taskq at */
+	hrtime_t	io_stage_time[ZIO_STAGE_CLASSES];
+	union {
+		list_node_t l;	/* FIFO vdev queue class */
+		avl_node_t a;	/* LBA-ordered class or active */
+	} io_queue_node;
+	zio_queue_state_t io_queue_state; /* vdev queue membership */
+	uint_t		io_queue_shard;	/* vdev queue shard */
+	boolean_t	io_queue_bypass; /* issue ahead of the class limits */
 	avl_node_t	io_offset_node;
 	avl_node_t	io_alloc_node;
 	zio_alloc_list_t 	io_alloc_list;
@@ -532,6 +550,7 @@ struct zio {
 	kmutex_t	io_lock;
 	kcondvar_t	io_cv;
 	int		io_allocator;
+	boolean_t	io_config_held;	/* SCL_ZIO taken before io_start */
 
 	/* FMA state */
 	zio_cksum_report_t *io_cksum_report;
@@ -656,6 +675,8 @@ extern void zio_resume_wait(spa_t *spa);
  */
 extern void zio_init(void);
 extern void zio_fini(void);
+extern void zio_bench_init(void);
+extern void zio_bench_fini(void);
 
 /*
  * Fault injection
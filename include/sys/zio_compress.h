@@ -29,6 +29,7 @@
 #define	_SYS_ZIO_COMPRESS_H
 
 #include <sys/abd.h>
+#include <zfeature_common.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -51,9 +52,62 @@ enum zio_compress {
 	ZIO_COMPRESS_GZIP_9,
 	ZIO_COMPRESS_ZLE,
 	ZIO_COMPRESS_LZ4,
+	ZIO_COMPRESS_ZSTD_1,
+	ZIO_COMPRESS_ZSTD_2,
+	ZIO_COMPRESS_ZSTD_3,
+	ZIO_COMPRESS_ZSTD_4,
+	ZIO_COMPRESS_ZSTD_5,
+	ZIO_COMPRESS_ZSTD_6,
+	ZIO_COMPRESS_ZSTD_7,
+	ZIO_COMPRESS_ZSTD_8,
+	ZIO_COMPRESS_ZSTD_9,
+	ZIO_COMPRESS_ZSTD_10,
+	ZIO_COMPRESS_ZSTD_11,
+	ZIO_COMPRESS_ZSTD_12,
+	ZIO_COMPRESS_ZSTD_13,
+	ZIO_COMPRESS_ZSTD_14,
+	ZIO_COMPRESS_ZSTD_15,
+	ZIO_COMPRESS_ZSTD_16,
+	ZIO_COMPRESS_ZSTD_17,
+	ZIO_COMPRESS_ZSTD_18,
+	ZIO_COMPRESS_ZSTD_19,
+	ZIO_COMPRESS_ZSTD_FAST_1,
+	ZIO_COMPRESS_ZSTD_FAST_2,
+	ZIO_COMPRESS_ZSTD_FAST_3,
+	ZIO_COMPRESS_ZSTD_FAST_4,
+	ZIO_COMPRESS_ZSTD_FAST_5,
+	ZIO_COMPRESS_ZSTD_FAST_6,
+	ZIO_COMPRESS_ZSTD_FAST_7,
+	ZIO_COMPRESS_ZSTD_FAST_8,
+	ZIO_COMPRESS_ZSTD_FAST_9,
+	ZIO_COMPRESS_ZSTD_FAST_10,
+	ZIO_COMPRESS_ZSTD_FAST_20,
+	ZIO_COMPRESS_ZSTD_FAST_30,
+	ZIO_COMPRESS_ZSTD_FAST_40,
+	ZIO_COMPRESS_ZSTD_FAST_50,
+	ZIO_COMPRESS_ZSTD_FAST_60,
+	ZIO_COMPRESS_ZSTD_FAST_70,
+	ZIO_COMPRESS_ZSTD_FAST_80,
+	ZIO_COMPRESS_ZSTD_FAST_90,
+	ZIO_COMPRESS_ZSTD_FAST_100,
+	ZIO_COMPRESS_ZSTD_FAST_500,
+	ZIO_COMPRESS_ZSTD_FAST_1000,
+	ZIO_COMPRESS_LZ4_CHUNKED,
 	ZIO_COMPRESS_FUNCTIONS
 };
 
+#define	ZIO_COMPRESS_ZSTD_FIRST		ZIO_COMPRESS_ZSTD_1
+#define	ZIO_COMPRESS_ZSTD_LAST		ZIO_COMPRESS_ZSTD_FAST_1000
+#define	ZIO_COMPRESS_IS_ZSTD(c)					\
+	((c) >= ZIO_COMPRESS_ZSTD_FIRST && (c) <= ZIO_COMPRESS_ZSTD_LAST)
+
+/*
+ * Chunked algorithms compress a large block as independent chunks which
+ * can be decompressed in parallel.  The algorithm used for each chunk is
+ * the ci_level of the chunked algorithm's zio_compress_table entry.
+ */
+#define	ZIO_COMPRESS_IS_CHUNKED(c)	((c) == ZIO_COMPRESS_LZ4_CHUNKED)
+
 /* Common signature for all zio compress functions. */
 typedef size_t zio_compress_func_t(void *src, void *dst,
     size_t s_len, size_t d_len, int);
@@ -86,6 +140,16 @@ extern zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS];
 extern void lz4_init(void);
 extern void lz4_fini(void);
 
+/*
+ * zstd compression init & free
+ */
+extern void zstd_init(void);
+extern void zstd_fini(void);
+extern void zstd_cache_reap_now(void);
+
+extern void zio_chunked_init(void);
+extern void zio_chunked_fini(void);
+
 /*
  * Compression routines.
  */
@@ -105,6 +169,14 @@ extern size_t lz4_compress_zfs(void *src, void *dst, size_t s_len, size_t d_len,
     int level);
 extern int lz4_decompress_zfs(void *src, void *dst, size_t s_len, size_t d_len,
     int level);
+extern size_t zstd_compress_zfs(void *src, void *dst, size_t s_len,
+    size_t d_len, int level);
+extern int zstd_decompress_zfs(void *src, void *dst, size_t s_len,
+    size_t d_len, int level);
+extern size_t zio_chunked_compress(void *src, void *dst, size_t s_len,
+    size_t d_len, int inner);
+extern int zio_chunked_decompress(void *src, void *dst, size_t s_len,
+    size_t d_len, int inner);
 
 /*
  * Compress and decompress data if necessary.
@@ -116,6 +188,18 @@ extern int zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
 extern int zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len);
 
+extern spa_feature_t zio_compress_to_feature(enum zio_compress comp);
+extern enum zio_compress zio_compress_chunked_select(enum zio_compress c,
+    uint64_t lsize);
+
+/*
+ * Early abort of expensive compression for incompressible data.
+ */
+extern int zfs_compress_early_abort;
+extern boolean_t zio_compress_early_abort_eligible(enum zio_compress c);
+extern boolean_t zio_compress_probe(enum zio_compress c, abd_t *src,
+    size_t s_len);
+
 #ifdef	__cplusplus
 }
 #endif
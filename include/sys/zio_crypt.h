@@ -42,6 +42,9 @@ struct zbookmark_phys;
 
 #define	ZIO_CRYPT_KEY_CURRENT_VERSION	1ULL
 
+/* number of keys derived from older salts kept per zio_crypt_key_t */
+#define	ZIO_CRYPT_SALT_KEYS	8
+
 typedef enum zio_crypt_type {
 	ZC_TYPE_NONE = 0,
 	ZC_TYPE_CCM,
@@ -72,6 +75,19 @@ typedef struct zio_crypt_info {
 
 extern zio_crypt_info_t zio_crypt_table[ZIO_CRYPT_FUNCTIONS];
 
+/* encryption key derived from a salt other than the current one */
+typedef struct zio_crypt_salt_key {
+	/* salt the key was derived from */
+	uint8_t zsk_salt[ZIO_DATA_SALT_LEN];
+
+	/* buffer for the derived key, zsk_key.ck_data is NULL if unused */
+	uint8_t zsk_keydata[MASTER_KEY_MAX_LEN];
+
+	/* illumos crypto api key and template */
+	crypto_key_t zsk_key;
+	crypto_ctx_template_t zsk_tmpl;
+} zio_crypt_salt_key_t;
+
 /* in memory representation of an unwrapped key that is loaded into memory */
 typedef struct zio_crypt_key {
 	/* encryption algorithm */
@@ -107,6 +123,10 @@ typedef struct zio_crypt_key {
 #else
 	/* template of current encryption key for illumos crypto api */
 	crypto_ctx_template_t zk_current_tmpl;
+
+	/* recently used keys derived from older salts, round-robin */
+	zio_crypt_salt_key_t zk_salt_keys[ZIO_CRYPT_SALT_KEYS];
+	uint_t zk_salt_keys_next;
 #endif
 
 	/* illumos crypto api current hmac key */
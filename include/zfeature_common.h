@@ -71,6 +71,14 @@ typedef enum spa_feature {
 	SPA_FEATURE_REDACTED_DATASETS,
 	SPA_FEATURE_BOOKMARK_WRITTEN,
 	SPA_FEATURE_LOG_SPACEMAP,
+	SPA_FEATURE_ZSTD_COMPRESS,
+	SPA_FEATURE_DRAID,
+	SPA_FEATURE_DEVICE_REBUILD,
+	SPA_FEATURE_BLAKE3,
+	SPA_FEATURE_DDT_LOG,
+	SPA_FEATURE_RAIDZ_EXPANSION,
+	SPA_FEATURE_LIVELIST,
+	SPA_FEATURE_CHUNKED_COMPRESS,
 	SPA_FEATURES
 } spa_feature_t;
 
@@ -32,6 +32,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <libzfs.h>
 #include <libshare.h>
 #include "libshare_impl.h"
@@ -89,13 +90,23 @@ sa_init(int init_service)
 		return (NULL);
 
 	impl_handle->zfs_libhandle = libzfs_init();
+	(void) pthread_mutex_init(&impl_handle->lock, NULL);
 
 	if (impl_handle->zfs_libhandle != NULL) {
 		libzfs_print_on_error(impl_handle->zfs_libhandle, B_TRUE);
 	}
 
 	parse_sharetab(impl_handle);
+
+	/*
+	 * Checking whether each dataset is mounted would otherwise reread
+	 * the whole mnttab for every one of them.
+	 */
+	if (impl_handle->zfs_libhandle != NULL)
+		libzfs_mnttab_cache(impl_handle->zfs_libhandle, B_TRUE);
 	update_zfs_shares(impl_handle, NULL);
+	if (impl_handle->zfs_libhandle != NULL)
+		libzfs_mnttab_cache(impl_handle->zfs_libhandle, B_FALSE);
 
 	return ((sa_handle_t)impl_handle);
 }
@@ -165,6 +176,19 @@ parse_sharetab(sa_handle_impl_t impl_handle)
 	fclose(fp);
 }
 
+/*
+ * Called with the handle's lock held after a share was enabled or disabled.
+ * Within a batch the sharetab is only rewritten once, by sa_end_batch().
+ */
+static void
+sharetab_changed(sa_handle_impl_t impl_handle)
+{
+	if (impl_handle->batch)
+		impl_handle->sharetab_dirty = B_TRUE;
+	else
+		update_sharetab(impl_handle);
+}
+
 static void
 update_sharetab(sa_handle_impl_t impl_handle)
 {
@@ -224,44 +248,30 @@ typedef struct update_cookie_s {
 	const char *proto;
 } update_cookie_t;
 
-static int
-update_zfs_shares_cb(zfs_handle_t *zhp, void *pcookie)
+/*
+ * Refresh the share of a single mounted filesystem from its sharenfs and
+ * sharesmb properties.
+ */
+static void
+update_zfs_share_one(zfs_handle_t *zhp, update_cookie_t *udata)
 {
-	update_cookie_t *udata = (update_cookie_t *)pcookie;
 	char mountpoint[ZFS_MAXPROPLEN];
 	char shareopts[ZFS_MAXPROPLEN];
 	char *dataset;
-	zfs_type_t type = zfs_get_type(zhp);
-
-	if (type == ZFS_TYPE_FILESYSTEM &&
-	    zfs_iter_filesystems(zhp, update_zfs_shares_cb, pcookie) != 0) {
-		zfs_close(zhp);
-		return (1);
-	}
-
-	if (type != ZFS_TYPE_FILESYSTEM) {
-		zfs_close(zhp);
-		return (0);
-	}
 
 	if (zfs_prop_get(zhp, ZFS_PROP_MOUNTPOINT, mountpoint,
-	    sizeof (mountpoint), NULL, NULL, 0, B_FALSE) != 0) {
-		zfs_close(zhp);
-		return (0);
-	}
+	    sizeof (mountpoint), NULL, NULL, 0, B_FALSE) != 0)
+		return;
 
 	dataset = (char *)zfs_get_name(zhp);
 
-	if (dataset == NULL) {
-		zfs_close(zhp);
-		return (0);
-	}
+	if (dataset == NULL)
+		return;
 
-	if (!zfs_is_mounted(zhp, NULL)) {
-		zfs_close(zhp);
-		return (0);
-	}
+	if (!zfs_is_mounted(zhp, NULL))
+		return;
 
+	pthread_mutex_lock(&udata->handle->lock);
 	if ((udata->proto == NULL || strcmp(udata->proto, "nfs") == 0) &&
 	    zfs_prop_get(zhp, ZFS_PROP_SHARENFS, shareopts,
 	    sizeof (shareopts), NULL, NULL, 0, B_FALSE) == 0 &&
@@ -277,6 +287,23 @@ update_zfs_shares_cb(zfs_handle_t *zhp, void *pcookie)
 		(void) process_share(udata->handle, NULL, mountpoint, NULL,
 		    "smb", shareopts, NULL, dataset, B_FALSE);
 	}
+	pthread_mutex_unlock(&udata->handle->lock);
+}
+
+static int
+update_zfs_shares_cb(zfs_handle_t *zhp, void *pcookie)
+{
+	update_cookie_t *udata = (update_cookie_t *)pcookie;
+	zfs_type_t type = zfs_get_type(zhp);
+
+	if (type == ZFS_TYPE_FILESYSTEM &&
+	    zfs_iter_filesystems(zhp, update_zfs_shares_cb, pcookie) != 0) {
+		zfs_close(zhp);
+		return (1);
+	}
+
+	if (type == ZFS_TYPE_FILESYSTEM)
+		update_zfs_share_one(zhp, udata);
 
 	zfs_close(zhp);
 
@@ -301,9 +328,14 @@ update_zfs_share(sa_share_impl_t impl_share, const char *proto)
 	if (zhp == NULL)
 		return (SA_SYSTEM_ERR);
 
+	/*
+	 * Only this filesystem's share needs refreshing; its descendants
+	 * are refreshed when they are shared themselves.
+	 */
 	udata.handle = impl_handle;
 	udata.proto = proto;
-	(void) update_zfs_shares_cb(zhp, &udata);
+	update_zfs_share_one(zhp, &udata);
+	zfs_close(zhp);
 
 	return (SA_OK);
 }
@@ -463,6 +495,7 @@ sa_fini(sa_handle_t handle)
 		impl_share = next;
 	}
 
+	(void) pthread_mutex_destroy(&impl_handle->lock);
 	free(impl_handle);
 }
 
@@ -486,13 +519,21 @@ find_share(sa_handle_impl_t impl_handle, const char *sharepath)
 sa_share_t
 sa_find_share(sa_handle_t handle, char *sharepath)
 {
-	return ((sa_share_t)find_share((sa_handle_impl_t)handle, sharepath));
+	sa_handle_impl_t impl_handle = (sa_handle_impl_t)handle;
+	sa_share_impl_t impl_share;
+
+	pthread_mutex_lock(&impl_handle->lock);
+	impl_share = find_share(impl_handle, sharepath);
+	pthread_mutex_unlock(&impl_handle->lock);
+
+	return ((sa_share_t)impl_share);
 }
 
 int
 sa_enable_share(sa_share_t share, char *protocol)
 {
 	sa_share_impl_t impl_share = (sa_share_impl_t)share;
+	sa_handle_impl_t impl_handle = impl_share->handle;
 	int rc, ret = SA_OK;
 	boolean_t found_protocol = B_FALSE;
 	sa_fstype_t *fstype;
@@ -504,10 +545,12 @@ sa_enable_share(sa_share_t share, char *protocol)
 
 			rc = fstype->ops->enable_share(impl_share);
 
+			pthread_mutex_lock(&impl_handle->lock);
 			if (rc != SA_OK)
 				ret = rc;
 			else
 				FSINFO(impl_share, fstype)->active = B_TRUE;
+			pthread_mutex_unlock(&impl_handle->lock);
 
 			found_protocol = B_TRUE;
 		}
@@ -515,7 +558,9 @@ sa_enable_share(sa_share_t share, char *protocol)
 		fstype = fstype->next;
 	}
 
-	update_sharetab(impl_share->handle);
+	pthread_mutex_lock(&impl_handle->lock);
+	sharetab_changed(impl_handle);
+	pthread_mutex_unlock(&impl_handle->lock);
 
 	return (found_protocol ? ret : SA_INVALID_PROTOCOL);
 }
@@ -524,6 +569,7 @@ int
 sa_disable_share(sa_share_t share, char *protocol)
 {
 	sa_share_impl_t impl_share = (sa_share_impl_t)share;
+	sa_handle_impl_t impl_handle = impl_share->handle;
 	int rc, ret = SA_OK;
 	boolean_t found_protocol = B_FALSE;
 	sa_fstype_t *fstype;
@@ -533,12 +579,14 @@ sa_disable_share(sa_share_t share, char *protocol)
 		if (protocol == NULL || strcmp(fstype->name, protocol) == 0) {
 			rc = fstype->ops->disable_share(impl_share);
 
+			pthread_mutex_lock(&impl_handle->lock);
 			if (rc == SA_OK) {
 				fstype->ops->clear_shareopts(impl_share);
 
 				FSINFO(impl_share, fstype)->active = B_FALSE;
 			} else
 				ret = rc;
+			pthread_mutex_unlock(&impl_handle->lock);
 
 			found_protocol = B_TRUE;
 		}
@@ -546,11 +594,63 @@ sa_disable_share(sa_share_t share, char *protocol)
 		fstype = fstype->next;
 	}
 
-	update_sharetab(impl_share->handle);
+	pthread_mutex_lock(&impl_handle->lock);
+	sharetab_changed(impl_handle);
+	pthread_mutex_unlock(&impl_handle->lock);
 
 	return (found_protocol ? ret : SA_INVALID_PROTOCOL);
 }
 
+/*
+ * sa_begin_batch(handle)
+ *
+ * Start a batch of sa_enable_share() and sa_disable_share() calls, which may
+ * be issued from several threads.  The sharetab is rewritten once when the
+ * batch ends instead of after every share, and the mnttab is cached while
+ * the shares' properties are refreshed.
+ */
+void
+sa_begin_batch(sa_handle_t handle)
+{
+	sa_handle_impl_t impl_handle = (sa_handle_impl_t)handle;
+
+	if (impl_handle == NULL)
+		return;
+
+	if (impl_handle->zfs_libhandle != NULL)
+		libzfs_mnttab_cache(impl_handle->zfs_libhandle, B_TRUE);
+
+	pthread_mutex_lock(&impl_handle->lock);
+	impl_handle->batch = B_TRUE;
+	pthread_mutex_unlock(&impl_handle->lock);
+}
+
+/*
+ * sa_end_batch(handle)
+ *
+ * End the batch started by sa_begin_batch(), once all of its shares have
+ * been enabled or disabled, and write out the sharetab if it changed.
+ */
+void
+sa_end_batch(sa_handle_t handle)
+{
+	sa_handle_impl_t impl_handle = (sa_handle_impl_t)handle;
+
+	if (impl_handle == NULL)
+		return;
+
+	pthread_mutex_lock(&impl_handle->lock);
+	impl_handle->batch = B_FALSE;
+	if (impl_handle->sharetab_dirty) {
+		impl_handle->sharetab_dirty = B_FALSE;
+		update_sharetab(impl_handle);
+	}
+	pthread_mutex_unlock(&impl_handle->lock);
+
+	if (impl_handle->zfs_libhandle != NULL)
+		libzfs_mnttab_cache(impl_handle->zfs_libhandle, B_FALSE);
+}
+
 /*
  * sa_errorstr(err)
  *
@@ -763,9 +863,14 @@ sa_zfs_process_share(sa_handle_t handle, sa_group_t group, sa_share_t share,
 {
 	sa_handle_impl_t impl_handle = (sa_handle_impl_t)handle;
 	sa_share_impl_t impl_share = (sa_share_impl_t)share;
+	int rc;
 
-	return (process_share(impl_handle, impl_share, mountpoint, NULL,
-	    proto, shareopts, NULL, dataset, B_FALSE));
+	pthread_mutex_lock(&impl_handle->lock);
+	rc = process_share(impl_handle, impl_share, mountpoint, NULL,
+	    proto, shareopts, NULL, dataset, B_FALSE);
+	pthread_mutex_unlock(&impl_handle->lock);
+
+	return (rc);
 }
 
 void
@@ -773,5 +878,7 @@ sa_update_sharetab_ts(sa_handle_t handle)
 {
 	sa_handle_impl_t impl_handle = (sa_handle_impl_t)handle;
 
+	pthread_mutex_lock(&impl_handle->lock);
 	update_sharetab(impl_handle);
+	pthread_mutex_unlock(&impl_handle->lock);
 }
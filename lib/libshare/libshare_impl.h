@@ -64,7 +64,17 @@ typedef struct sa_fstype {
 
 typedef struct sa_handle_impl {
 	libzfs_handle_t *zfs_libhandle;
+
+	/*
+	 * The lock protects the list of shares, their per-fstype information
+	 * and the sharetab, so that shares may be enabled and disabled from
+	 * several threads at once.  It is not held while the fstype's
+	 * enable_share and disable_share callbacks run the external commands.
+	 */
+	pthread_mutex_t lock;
 	sa_share_impl_t shares;
+	boolean_t batch;		/* see sa_begin_batch() */
+	boolean_t sharetab_dirty;	/* sharetab update deferred by batch */
 } *sa_handle_impl_t;
 
 sa_fstype_t *register_fstype(const char *name, const sa_share_ops_t *ops);
@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <libzfs.h>
 #include <libshare.h>
 #include "libshare_impl.h"
@@ -42,9 +43,11 @@ static sa_fstype_t *nfs_fstype;
 
 /*
  * nfs_exportfs_temp_fd refers to a temporary copy of the output
- * from exportfs -v.
+ * from exportfs -v.  It is protected by nfs_exportfs_lock, as shares
+ * may be enabled from several threads.
  */
 static int nfs_exportfs_temp_fd = -1;
+static pthread_mutex_t nfs_exportfs_lock = PTHREAD_MUTEX_INITIALIZER;
 
 typedef int (*nfs_shareopt_callback_t)(const char *opt, const char *value,
     void *cookie);
@@ -529,16 +532,23 @@ nfs_is_share_active(sa_share_impl_t impl_share)
 	if (!nfs_available())
 		return (B_FALSE);
 
-	if ((fd = dup(nfs_exportfs_temp_fd)) == -1)
+	/* the dup()ed descriptor shares its file offset with the original */
+	pthread_mutex_lock(&nfs_exportfs_lock);
+	if ((fd = dup(nfs_exportfs_temp_fd)) == -1) {
+		pthread_mutex_unlock(&nfs_exportfs_lock);
 		return (B_FALSE);
+	}
 
 	nfs_exportfs_temp_fp = fdopen(fd, "r");
 
-	if (nfs_exportfs_temp_fp == NULL)
+	if (nfs_exportfs_temp_fp == NULL) {
+		pthread_mutex_unlock(&nfs_exportfs_lock);
 		return (B_FALSE);
+	}
 
 	if (fseek(nfs_exportfs_temp_fp, 0, SEEK_SET) < 0) {
 		fclose(nfs_exportfs_temp_fp);
+		pthread_mutex_unlock(&nfs_exportfs_lock);
 		return (B_FALSE);
 	}
 
@@ -573,11 +583,13 @@ nfs_is_share_active(sa_share_impl_t impl_share)
 
 		if (strcmp(line, impl_share->sharepath) == 0) {
 			fclose(nfs_exportfs_temp_fp);
+			pthread_mutex_unlock(&nfs_exportfs_lock);
 			return (B_TRUE);
 		}
 	}
 
 	fclose(nfs_exportfs_temp_fp);
+	pthread_mutex_unlock(&nfs_exportfs_lock);
 
 	return (B_FALSE);
 }
@@ -730,10 +742,16 @@ nfs_check_exportfs(void)
 static boolean_t
 nfs_available(void)
 {
+	boolean_t available;
+
+	pthread_mutex_lock(&nfs_exportfs_lock);
 	if (nfs_exportfs_temp_fd == -1)
 		(void) nfs_check_exportfs();
 
-	return ((nfs_exportfs_temp_fd != -1) ? B_TRUE : B_FALSE);
+	available = (nfs_exportfs_temp_fd != -1) ? B_TRUE : B_FALSE;
+	pthread_mutex_unlock(&nfs_exportfs_lock);
+
+	return (available);
 }
 
 /*
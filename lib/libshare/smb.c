@@ -53,6 +53,7 @@
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -65,6 +66,13 @@ static boolean_t smb_available(void);
 
 static sa_fstype_t *smb_fstype;
 
+/*
+ * Shares may be enabled from several threads, each of which reloads
+ * smb_shares.  The replaced lists are never freed, so the lock only needs
+ * to cover loading and storing the list head.
+ */
+static pthread_mutex_t smb_shares_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Retrieve the list of SMB shares.
  */
@@ -203,7 +211,9 @@ out:
 	}
 	closedir(shares_dir);
 
+	pthread_mutex_lock(&smb_shares_lock);
 	smb_shares = new_shares;
+	pthread_mutex_unlock(&smb_shares_lock);
 
 	return (rc);
 }
@@ -316,7 +326,11 @@ smb_disable_share_one(const char *sharename)
 static int
 smb_disable_share(sa_share_impl_t impl_share)
 {
-	smb_share_t *shares = smb_shares;
+	smb_share_t *shares;
+
+	pthread_mutex_lock(&smb_shares_lock);
+	shares = smb_shares;
+	pthread_mutex_unlock(&smb_shares_lock);
 
 	if (!smb_available()) {
 		/*
@@ -355,7 +369,11 @@ smb_validate_shareopts(const char *shareopts)
 static boolean_t
 smb_is_share_active(sa_share_impl_t impl_share)
 {
-	smb_share_t *iter = smb_shares;
+	smb_share_t *iter;
+
+	pthread_mutex_lock(&smb_shares_lock);
+	iter = smb_shares;
+	pthread_mutex_unlock(&smb_shares_lock);
 
 	if (!smb_available())
 		return (B_FALSE);
@@ -82,6 +82,8 @@ extern char *sa_errorstr(int);
 extern sa_share_t sa_find_share(sa_handle_t, char *);
 extern int sa_enable_share(sa_group_t, char *);
 extern int sa_disable_share(sa_share_t, char *);
+extern void sa_begin_batch(sa_handle_t);
+extern void sa_end_batch(sa_handle_t);
 
 /* protocol specific interfaces */
 extern int sa_parse_legacy_options(sa_group_t, char *, char *);
@@ -326,6 +326,84 @@ zpool_refresh_stats(zpool_handle_t *zhp, boolean_t *missing)
 	return (0);
 }
 
+/*
+ * Replace the stats of the vdev nv, and of its children and cache devices,
+ * with those of the same guid in stats, counting the vdevs in *count.
+ * Returns -1 if one of the vdevs has no stats.
+ */
+static int
+refresh_vdev_stats_impl(nvlist_t *nv, nvlist_t *stats, uint_t *count)
+{
+	const char *arrays[] = { ZPOOL_CONFIG_CHILDREN, ZPOOL_CONFIG_L2CACHE };
+	nvlist_t **child, *vdev_stats, *nvx;
+	uint_t c, children, vsc;
+	uint64_t *vs;
+	char guid[32];
+
+	(void) snprintf(guid, sizeof (guid), "%llu",
+	    (u_longlong_t)fnvlist_lookup_uint64(nv, ZPOOL_CONFIG_GUID));
+	if (nvlist_lookup_nvlist(stats, guid, &vdev_stats) != 0 ||
+	    nvlist_lookup_uint64_array(vdev_stats, ZPOOL_CONFIG_VDEV_STATS,
+	    &vs, &vsc) != 0 ||
+	    nvlist_lookup_nvlist(vdev_stats, ZPOOL_CONFIG_VDEV_STATS_EX,
+	    &nvx) != 0)
+		return (-1);
+
+	fnvlist_add_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS, vs, vsc);
+	fnvlist_add_nvlist(nv, ZPOOL_CONFIG_VDEV_STATS_EX, nvx);
+	(*count)++;
+
+	for (int i = 0; i < ARRAY_SIZE(arrays); i++) {
+		if (nvlist_lookup_nvlist_array(nv, arrays[i], &child,
+		    &children) != 0)
+			continue;
+		for (c = 0; c < children; c++) {
+			if (refresh_vdev_stats_impl(child[c], stats,
+			    count) != 0)
+				return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Refresh the stats of the vdevs of the pool, like zpool_refresh_stats()
+ * but without having the kernel generate the whole config of the pool,
+ * which is costly on wide pools when done at short intervals.  Falls back
+ * to zpool_refresh_stats() when the pool is not active, or when its vdevs
+ * no longer match those of the config.
+ */
+int
+zpool_refresh_vdev_stats(zpool_handle_t *zhp, boolean_t *missing)
+{
+	nvlist_t *stats, *config;
+	uint_t count = 0;
+
+	*missing = B_FALSE;
+
+	if (zhp->zpool_config == NULL ||
+	    zhp->zpool_state != POOL_STATE_ACTIVE ||
+	    lzc_pool_vdev_stats(zhp->zpool_name, &stats) != 0)
+		return (zpool_refresh_stats(zhp, missing));
+
+	config = fnvlist_dup(zhp->zpool_config);
+	if (refresh_vdev_stats_impl(fnvlist_lookup_nvlist(config,
+	    ZPOOL_CONFIG_VDEV_TREE), stats, &count) != 0 ||
+	    count != fnvlist_num_pairs(stats)) {
+		fnvlist_free(config);
+		fnvlist_free(stats);
+		return (zpool_refresh_stats(zhp, missing));
+	}
+	fnvlist_free(stats);
+
+	nvlist_free(zhp->zpool_old_config);
+	zhp->zpool_old_config = zhp->zpool_config;
+	zhp->zpool_config = config;
+
+	return (0);
+}
+
 /*
  * The following environment variables are undocumented
  * and should be used for testing purposes only:
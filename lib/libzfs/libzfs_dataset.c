@@ -384,16 +384,17 @@ get_recvd_props_ioctl(zfs_handle_t *zhp)
 	return (0);
 }
 
+/*
+ * Store the stats and the properties of the dataset in the handle, which
+ * takes ownership of allprops.
+ */
 static int
-put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+put_stats_zhdl_impl(zfs_handle_t *zhp, const dmu_objset_stats_t *stats,
+    nvlist_t *allprops)
 {
-	nvlist_t *allprops, *userprops;
+	nvlist_t *userprops;
 
-	zhp->zfs_dmustats = zc->zc_objset_stats; /* structure assignment */
-
-	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
-		return (-1);
-	}
+	zhp->zfs_dmustats = *stats; /* structure assignment */
 
 	/*
 	 * XXX Why do we store the user props separately, in addition to
@@ -413,6 +414,18 @@ put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+static int
+put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	nvlist_t *allprops;
+
+	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
+		return (-1);
+	}
+
+	return (put_stats_zhdl_impl(zhp, &zc->zc_objset_stats, allprops));
+}
+
 static int
 get_stats(zfs_handle_t *zhp)
 {
@@ -439,15 +452,11 @@ zfs_refresh_properties(zfs_handle_t *zhp)
 }
 
 /*
- * Makes a handle from the given dataset name.  Used by zfs_open() and
- * zfs_iter_* to create child handles on the fly.
+ * Determine the types of a handle from its stats.
  */
 static int
-make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+set_dataset_handle_types(zfs_handle_t *zhp)
 {
-	if (put_stats_zhdl(zhp, zc) != 0)
-		return (-1);
-
 	/*
 	 * We've managed to open the dataset and gather statistics.  Determine
 	 * the high-level type.
@@ -476,6 +485,19 @@ make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+/*
+ * Makes a handle from the given dataset name.  Used by zfs_open() and
+ * zfs_iter_* to create child handles on the fly.
+ */
+static int
+make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	if (put_stats_zhdl(zhp, zc) != 0)
+		return (-1);
+
+	return (set_dataset_handle_types(zhp));
+}
+
 zfs_handle_t *
 make_dataset_handle(libzfs_handle_t *hdl, const char *path)
 {
@@ -522,6 +544,36 @@ make_dataset_handle_zc(libzfs_handle_t *hdl, zfs_cmd_t *zc)
 	return (zhp);
 }
 
+/*
+ * Makes a handle from the stats and the properties of a dataset returned
+ * by a batched listing, such as ZFS_IOC_LIST_SNAPSHOTS.  The handle holds
+ * a copy of props, which may be only some of the dataset's properties.
+ */
+zfs_handle_t *
+make_dataset_handle_nvl(libzfs_handle_t *hdl, const char *path,
+    const dmu_objset_stats_t *stats, nvlist_t *props)
+{
+	zfs_handle_t *zhp = calloc(1, sizeof (zfs_handle_t));
+	nvlist_t *allprops;
+
+	if (zhp == NULL)
+		return (NULL);
+
+	zhp->zfs_hdl = hdl;
+	(void) strlcpy(zhp->zfs_name, path, sizeof (zhp->zfs_name));
+	if (nvlist_dup(props, &allprops, 0) != 0) {
+		(void) no_memory(hdl);
+		free(zhp);
+		return (NULL);
+	}
+	if (put_stats_zhdl_impl(zhp, stats, allprops) != 0 ||
+	    set_dataset_handle_types(zhp) != 0) {
+		zfs_close(zhp);
+		return (NULL);
+	}
+	return (zhp);
+}
+
 zfs_handle_t *
 make_dataset_simple_handle_zc(zfs_handle_t *pzhp, zfs_cmd_t *zc)
 {
@@ -862,8 +914,8 @@ libzfs_mnttab_update(libzfs_handle_t *hdl)
 	return (0);
 }
 
-void
-libzfs_mnttab_fini(libzfs_handle_t *hdl)
+static void
+libzfs_mnttab_empty(libzfs_handle_t *hdl)
 {
 	void *cookie = NULL;
 	mnttab_node_t *mtn;
@@ -876,6 +928,12 @@ libzfs_mnttab_fini(libzfs_handle_t *hdl)
 		free(mtn->mtn_mt.mnt_mntopts);
 		free(mtn);
 	}
+}
+
+void
+libzfs_mnttab_fini(libzfs_handle_t *hdl)
+{
+	libzfs_mnttab_empty(hdl);
 	avl_destroy(&hdl->libzfs_mnttab_cache);
 	(void) pthread_mutex_destroy(&hdl->libzfs_mnttab_cache_lock);
 }
@@ -883,6 +941,15 @@ libzfs_mnttab_fini(libzfs_handle_t *hdl)
 void
 libzfs_mnttab_cache(libzfs_handle_t *hdl, boolean_t enable)
 {
+	/*
+	 * Drop the cached entries when disabling the cache, so that they are
+	 * reread if it is enabled again later.
+	 */
+	if (!enable) {
+		pthread_mutex_lock(&hdl->libzfs_mnttab_cache_lock);
+		libzfs_mnttab_empty(hdl);
+		pthread_mutex_unlock(&hdl->libzfs_mnttab_cache_lock);
+	}
 	hdl->libzfs_mnttab_enable = enable;
 }
 
@@ -2931,6 +2998,32 @@ zfs_prop_get(zfs_handle_t *zhp, zfs_prop_t prop, char *propbuf, size_t proplen,
 		zcp_check(zhp, prop, val, NULL);
 		break;
 
+	case ZFS_PROP_READ_BW_LIMIT:
+	case ZFS_PROP_WRITE_BW_LIMIT:
+	case ZFS_PROP_READ_OPS_LIMIT:
+	case ZFS_PROP_WRITE_OPS_LIMIT:
+
+		if (get_numeric_property(zhp, prop, src, &source, &val) != 0)
+			return (-1);
+
+		/*
+		 * A limit of 0 means unlimited, which is shown as 'none'
+		 * unless literal is set.
+		 */
+		if (literal) {
+			(void) snprintf(propbuf, proplen, "%llu",
+			    (u_longlong_t)val);
+		} else if (val == 0) {
+			(void) strlcpy(propbuf, "none", proplen);
+		} else if (prop == ZFS_PROP_READ_BW_LIMIT ||
+		    prop == ZFS_PROP_WRITE_BW_LIMIT) {
+			zfs_nicebytes(val, propbuf, proplen);
+		} else {
+			zfs_nicenum(val, propbuf, proplen);
+		}
+		zcp_check(zhp, prop, val, NULL);
+		break;
+
 	case ZFS_PROP_REFRATIO:
 	case ZFS_PROP_COMPRESSRATIO:
 		if (get_numeric_property(zhp, prop, src, &source, &val) != 0)
@@ -5040,34 +5133,48 @@ zfs_hold_one(zfs_handle_t *zhp, void *arg)
 	return (rv);
 }
 
+/*
+ * Add the holds of zfs_hold() to holds rather than placing them, so that
+ * the holds on many snapshots can be placed at once by zfs_hold_nvl().
+ */
 int
-zfs_hold(zfs_handle_t *zhp, const char *snapname, const char *tag,
-    boolean_t recursive, int cleanup_fd)
+zfs_hold_add(zfs_handle_t *zhp, const char *snapname, const char *tag,
+    boolean_t recursive, nvlist_t *holds)
 {
-	int ret;
 	struct holdarg ha;
+	uint_t before = fnvlist_num_pairs(holds);
 
-	ha.nvl = fnvlist_alloc();
+	ha.nvl = holds;
 	ha.snapname = snapname;
 	ha.tag = tag;
 	ha.recursive = recursive;
 	(void) zfs_hold_one(zfs_handle_dup(zhp), &ha);
 
-	if (nvlist_empty(ha.nvl)) {
+	if (fnvlist_num_pairs(holds) == before) {
 		char errbuf[1024];
 
-		fnvlist_free(ha.nvl);
-		ret = ENOENT;
 		(void) snprintf(errbuf, sizeof (errbuf),
 		    dgettext(TEXT_DOMAIN,
 		    "cannot hold snapshot '%s@%s'"),
 		    zhp->zfs_name, snapname);
-		(void) zfs_standard_error(zhp->zfs_hdl, ret, errbuf);
-		return (ret);
+		(void) zfs_standard_error(zhp->zfs_hdl, ENOENT, errbuf);
+		return (ENOENT);
 	}
 
-	ret = zfs_hold_nvl(zhp, cleanup_fd, ha.nvl);
-	fnvlist_free(ha.nvl);
+	return (0);
+}
+
+int
+zfs_hold(zfs_handle_t *zhp, const char *snapname, const char *tag,
+    boolean_t recursive, int cleanup_fd)
+{
+	nvlist_t *holds = fnvlist_alloc();
+	int ret;
+
+	ret = zfs_hold_add(zhp, snapname, tag, recursive, holds);
+	if (ret == 0)
+		ret = zfs_hold_nvl(zhp, cleanup_fd, holds);
+	fnvlist_free(holds);
 
 	return (ret);
 }
@@ -5171,41 +5278,74 @@ zfs_release_one(zfs_handle_t *zhp, void *arg)
 	return (rv);
 }
 
+/*
+ * Add the releases of zfs_release() to holds rather than releasing them,
+ * so that the holds on many snapshots can be released at once by
+ * zfs_release_nvl().
+ */
 int
-zfs_release(zfs_handle_t *zhp, const char *snapname, const char *tag,
-    boolean_t recursive)
+zfs_release_add(zfs_handle_t *zhp, const char *snapname, const char *tag,
+    boolean_t recursive, nvlist_t *holds)
 {
-	int ret;
 	struct holdarg ha;
-	nvlist_t *errors = NULL;
-	nvpair_t *elem;
-	libzfs_handle_t *hdl = zhp->zfs_hdl;
-	char errbuf[1024];
+	uint_t before = fnvlist_num_pairs(holds);
 
-	ha.nvl = fnvlist_alloc();
+	ha.nvl = holds;
 	ha.snapname = snapname;
 	ha.tag = tag;
 	ha.recursive = recursive;
 	ha.error = 0;
 	(void) zfs_release_one(zfs_handle_dup(zhp), &ha);
 
-	if (nvlist_empty(ha.nvl)) {
-		fnvlist_free(ha.nvl);
-		ret = ha.error;
+	if (fnvlist_num_pairs(holds) == before) {
+		char errbuf[1024];
+
 		(void) snprintf(errbuf, sizeof (errbuf),
 		    dgettext(TEXT_DOMAIN,
 		    "cannot release hold from snapshot '%s@%s'"),
 		    zhp->zfs_name, snapname);
-		if (ret == ESRCH) {
-			(void) zfs_error(hdl, EZFS_REFTAG_RELE, errbuf);
+		if (ha.error == ESRCH) {
+			(void) zfs_error(zhp->zfs_hdl, EZFS_REFTAG_RELE,
+			    errbuf);
 		} else {
-			(void) zfs_standard_error(hdl, ret, errbuf);
+			(void) zfs_standard_error(zhp->zfs_hdl, ha.error,
+			    errbuf);
 		}
-		return (ret);
+		return (ha.error);
 	}
 
-	ret = lzc_release(ha.nvl, &errors);
-	fnvlist_free(ha.nvl);
+	return (0);
+}
+
+int
+zfs_release(zfs_handle_t *zhp, const char *snapname, const char *tag,
+    boolean_t recursive)
+{
+	nvlist_t *holds = fnvlist_alloc();
+	int ret;
+
+	ret = zfs_release_add(zhp, snapname, tag, recursive, holds);
+	if (ret == 0)
+		ret = zfs_release_nvl(zhp, holds);
+	fnvlist_free(holds);
+
+	return (ret);
+}
+
+/*
+ * Release holds, an nvlist of snapshot names to nvlists of the tags of the
+ * holds to release, in a single ioctl.
+ */
+int
+zfs_release_nvl(zfs_handle_t *zhp, nvlist_t *holds)
+{
+	int ret;
+	nvlist_t *errors = NULL;
+	nvpair_t *elem;
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	char errbuf[1024];
+
+	ret = lzc_release(holds, &errors);
 
 	if (ret == 0) {
 		/* There may be errors even in the success case. */
@@ -5536,7 +5676,8 @@ volsize_from_vdevs(zpool_handle_t *zhp, uint64_t nblocks, uint64_t blksize)
 		uint64_t volsize;
 
 		if (nvlist_lookup_string(vdevs[v], ZPOOL_CONFIG_TYPE,
-		    &type) != 0 || strcmp(type, VDEV_TYPE_RAIDZ) != 0 ||
+		    &type) != 0 || (strcmp(type, VDEV_TYPE_RAIDZ) != 0 &&
+		    strcmp(type, VDEV_TYPE_DRAID) != 0) ||
 		    nvlist_lookup_uint64(vdevs[v], ZPOOL_CONFIG_NPARITY,
 		    &nparity) != 0 ||
 		    nvlist_lookup_uint64(vdevs[v], ZPOOL_CONFIG_ASHIFT,
@@ -5546,6 +5687,16 @@ volsize_from_vdevs(zpool_handle_t *zhp, uint64_t nblocks, uint64_t blksize)
 			continue;
 		}
 
+		/* dRAID blocks are laid out across one redundancy group */
+		if (strcmp(type, VDEV_TYPE_DRAID) == 0) {
+			uint64_t ndata;
+
+			if (nvlist_lookup_uint64(vdevs[v],
+			    ZPOOL_CONFIG_DRAID_NDATA, &ndata) != 0)
+				continue;
+			ndisks = ndata + nparity;
+		}
+
 		/* allocation size for the "typical" 128k block */
 		tsize = vdev_raidz_asize(ndisks, nparity, ashift,
 		    SPA_OLD_MAXBLOCKSIZE);
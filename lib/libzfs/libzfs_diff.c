@@ -56,6 +56,21 @@
 #define	ZDIFF_REMOVED	'-'
 #define	ZDIFF_RENAMED	'R'
 
+/*
+ * Objects whose stats are looked up ahead of printing, in parallel, and
+ * the most threads used to do so.
+ */
+#define	ZDIFF_BATCH		256
+#define	ZDIFF_MAX_THREADS	16
+
+/* Result of a ZFS_IOC_OBJ_TO_STATS lookup */
+typedef struct differ_stat {
+	int		ds_error;
+	int		ds_zerr;
+	zfs_stat_t	ds_sb;
+	char		ds_name[MAXPATHLEN];
+} differ_stat_t;
+
 typedef struct differ_info {
 	zfs_handle_t *zhp;
 	char *fromsnap;
@@ -75,14 +90,22 @@ typedef struct differ_info {
 	int cleanupfd;
 	int outputfd;
 	int datafd;
+
+	/* Looked up stats of objects [pf_first, pf_first + pf_count) */
+	differ_stat_t *pf_stats[2];	/* fromsnap, tosnap */
+	uint64_t pf_first;
+	uint64_t pf_count;
+	int pf_threads;
 } differ_info_t;
 
-/*
- * Given a {dsname, object id}, get the object path
- */
+typedef struct differ_prefetch_arg {
+	differ_info_t *dpa_di;
+	int dpa_thread;
+} differ_prefetch_arg_t;
+
 static int
-get_stats_for_obj(differ_info_t *di, const char *dsname, uint64_t obj,
-    char *pn, int maxlen, zfs_stat_t *sb)
+lookup_stats_for_obj(libzfs_handle_t *hdl, const char *dsname, uint64_t obj,
+    char *pn, int maxlen, zfs_stat_t *sb, int *zerr)
 {
 	zfs_cmd_t zc = {"\0"};
 	int error;
@@ -91,14 +114,118 @@ get_stats_for_obj(differ_info_t *di, const char *dsname, uint64_t obj,
 	zc.zc_obj = obj;
 
 	errno = 0;
-	error = ioctl(di->zhp->zfs_hdl->libzfs_fd, ZFS_IOC_OBJ_TO_STATS, &zc);
-	di->zerr = errno;
+	error = ioctl(hdl->libzfs_fd, ZFS_IOC_OBJ_TO_STATS, &zc);
+	*zerr = errno;
 
 	/* we can get stats even if we failed to get a path */
 	(void) memcpy(sb, &zc.zc_stat, sizeof (zfs_stat_t));
+	if (error == 0)
+		(void) strlcpy(pn, zc.zc_value, maxlen);
+
+	return (error);
+}
+
+/*
+ * Each thread looks up every pf_threads'th object of the batch, on both
+ * sides of the diff.
+ */
+static void *
+differ_prefetch_thread(void *arg)
+{
+	differ_prefetch_arg_t *dpa = arg;
+	differ_info_t *di = dpa->dpa_di;
+	libzfs_handle_t *hdl = di->zhp->zfs_hdl;
+
+	for (uint64_t i = dpa->dpa_thread; i < di->pf_count;
+	    i += di->pf_threads) {
+		for (int side = 0; side < 2; side++) {
+			differ_stat_t *ds = &di->pf_stats[side][i];
+
+			ds->ds_error = lookup_stats_for_obj(hdl,
+			    side == 0 ? di->fromsnap : di->tosnap,
+			    di->pf_first + i, ds->ds_name,
+			    sizeof (ds->ds_name), &ds->ds_sb, &ds->ds_zerr);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Look up the stats of objects [first, first + count) on both sides ahead
+ * of printing them.  Resolving a path takes an ioctl per object and side,
+ * which dominates the time taken by diffs of many files, so spread them
+ * over several threads.  If that is not possible the objects are looked
+ * up one at a time by get_stats_for_obj().
+ */
+static void
+differ_prefetch(differ_info_t *di, uint64_t first, uint64_t count)
+{
+	pthread_t tids[ZDIFF_MAX_THREADS];
+	differ_prefetch_arg_t args[ZDIFF_MAX_THREADS];
+	int started = 0;
+
+	di->pf_count = 0;
+	if (di->pf_threads <= 1 || count < 2)
+		return;
+
+	if (di->pf_stats[0] == NULL) {
+		for (int side = 0; side < 2; side++) {
+			di->pf_stats[side] =
+			    calloc(ZDIFF_BATCH, sizeof (differ_stat_t));
+			if (di->pf_stats[side] == NULL) {
+				di->pf_threads = 1;
+				return;
+			}
+		}
+	}
+
+	ASSERT3U(count, <=, ZDIFF_BATCH);
+	di->pf_first = first;
+	di->pf_count = count;
+
+	for (int t = 0; t < MIN(di->pf_threads, count); t++) {
+		args[t].dpa_di = di;
+		args[t].dpa_thread = t;
+		if (pthread_create(&tids[t], NULL, differ_prefetch_thread,
+		    &args[t]) != 0)
+			break;
+		started++;
+	}
+	for (int t = 0; t < started; t++)
+		(void) pthread_join(tids[t], NULL);
+
+	if (started < MIN(di->pf_threads, count))
+		di->pf_count = 0;
+}
+
+/*
+ * Given a {dsname, object id}, get the object path
+ */
+static int
+get_stats_for_obj(differ_info_t *di, const char *dsname, uint64_t obj,
+    char *pn, int maxlen, zfs_stat_t *sb)
+{
+	int side = (dsname == di->fromsnap) ? 0 :
+	    (dsname == di->tosnap) ? 1 : -1;
+	int error;
+
+	if (side >= 0 && obj >= di->pf_first &&
+	    obj - di->pf_first < di->pf_count) {
+		differ_stat_t *ds = &di->pf_stats[side][obj - di->pf_first];
+
+		error = ds->ds_error;
+		di->zerr = ds->ds_zerr;
+		(void) memcpy(sb, &ds->ds_sb, sizeof (zfs_stat_t));
+		if (error == 0)
+			(void) strlcpy(pn, ds->ds_name, maxlen);
+	} else {
+		error = lookup_stats_for_obj(di->zhp->zfs_hdl, dsname, obj,
+		    pn, maxlen, sb, &di->zerr);
+	}
+
 	if (error == 0) {
 		ASSERT(di->zerr == 0);
-		(void) strlcpy(pn, zc.zc_value, maxlen);
 		return (0);
 	}
 
@@ -350,13 +477,18 @@ static int
 write_inuse_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
 {
 	uint64_t o;
-	int err;
+	int err = 0;
 
 	for (o = dr->ddr_first; o <= dr->ddr_last; o++) {
+		if ((o - dr->ddr_first) % ZDIFF_BATCH == 0) {
+			differ_prefetch(di, o,
+			    MIN(dr->ddr_last - o + 1, ZDIFF_BATCH));
+		}
 		if ((err = write_inuse_diffs_one(fp, di, o)) != 0)
-			return (err);
+			break;
 	}
-	return (0);
+	di->pf_count = 0;
+	return (err);
 }
 
 static int
@@ -552,6 +684,8 @@ teardown_differ_info(differ_info_t *di)
 	free(di->tosnap);
 	free(di->tmpsnap);
 	free(di->tomnt);
+	free(di->pf_stats[0]);
+	free(di->pf_stats[1]);
 	(void) close(di->cleanupfd);
 }
 
@@ -753,6 +887,9 @@ setup_differ_info(zfs_handle_t *zhp, const char *fromsnap,
 	if (find_shares_object(di) != 0)
 		return (-1);
 
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	di->pf_threads = (int)MIN(MAX(ncpus, 1), ZDIFF_MAX_THREADS);
+
 	return (0);
 }
 
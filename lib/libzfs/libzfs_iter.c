@@ -137,10 +137,10 @@ zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 }
 
 /*
- * Iterate over all snapshots
+ * Iterate over all snapshots, one ZFS_IOC_SNAPSHOT_LIST_NEXT at a time
  */
-int
-zfs_iter_snapshots(zfs_handle_t *zhp, boolean_t simple, zfs_iter_f func,
+static int
+zfs_iter_snapshots_next(zfs_handle_t *zhp, boolean_t simple, zfs_iter_f func,
     void *data, uint64_t min_txg, uint64_t max_txg)
 {
 	zfs_cmd_t zc = {"\0"};
@@ -195,6 +195,156 @@ zfs_iter_snapshots(zfs_handle_t *zhp, boolean_t simple, zfs_iter_f func,
 	return ((ret < 0) ? ret : 0);
 }
 
+/*
+ * Issue ZFS_IOC_LIST_SNAPSHOTS for the next batch of snapshots.  The
+ * destination buffer in zc is kept from one batch to the next, and
+ * *dstsize tracks its size.  Returns 0 with the output nvlist in *resultp,
+ * -1 if it could not be read, or the errno of the ioctl.
+ */
+static int
+zfs_list_snapshots_ioctl(zfs_handle_t *zhp, zfs_cmd_t *zc, size_t *dstsize,
+    nvlist_t *args, nvlist_t **resultp)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+
+	free((void *)(uintptr_t)zc->zc_nvlist_src);
+	zc->zc_nvlist_src = 0;
+	if (zcmd_write_src_nvlist(hdl, zc, args) != 0)
+		return (-1);
+
+	(void) strlcpy(zc->zc_name, zhp->zfs_name, sizeof (zc->zc_name));
+	zc->zc_nvlist_dst_size = *dstsize;
+	while (zfs_ioctl(hdl, ZFS_IOC_LIST_SNAPSHOTS, zc) != 0) {
+		if (errno != ENOMEM)
+			return (errno);
+		/* expand nvlist memory and try again */
+		if (zcmd_expand_dst_nvlist(hdl, zc) != 0)
+			return (-1);
+		*dstsize = zc->zc_nvlist_dst_size;
+	}
+
+	if (zcmd_read_dst_nvlist(hdl, zc, resultp) != 0)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Iterate over all snapshots, with only the given properties (or all of
+ * them, if props is NULL) in their handles.  The snapshots are listed in
+ * batches with ZFS_IOC_LIST_SNAPSHOTS, which only reads what it needs to
+ * for the requested properties.  Callers passing props must only get those
+ * properties from the handles, as with zfs_prune_proplist().
+ */
+int
+zfs_iter_snapshots_props(zfs_handle_t *zhp, nvlist_t *props, zfs_iter_f func,
+    void *data, uint64_t min_txg, uint64_t max_txg)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	zfs_cmd_t zc = {"\0"};
+	size_t dstsize = 128 * 1024;
+	boolean_t fallback = B_FALSE;
+	uint64_t cookie = 0;
+	nvlist_t *args;
+	int ret = 0;
+
+	if (zhp->zfs_type == ZFS_TYPE_SNAPSHOT ||
+	    zhp->zfs_type == ZFS_TYPE_BOOKMARK)
+		return (0);
+
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, dstsize) != 0)
+		return (-1);
+
+	args = fnvlist_alloc();
+	if (props != NULL)
+		fnvlist_add_nvlist(args, "props", props);
+	if (min_txg != 0)
+		fnvlist_add_uint64(args, SNAP_ITER_MIN_TXG, min_txg);
+	if (max_txg != 0)
+		fnvlist_add_uint64(args, SNAP_ITER_MAX_TXG, max_txg);
+
+	for (;;) {
+		nvlist_t *result, *snaps;
+		nvpair_t *pair;
+		int err;
+
+		err = zfs_list_snapshots_ioctl(zhp, &zc, &dstsize, args,
+		    &result);
+		if (err == ZFS_ERR_IOC_CMD_UNAVAIL && cookie == 0) {
+			/* an older kernel, list them one at a time */
+			fallback = B_TRUE;
+			break;
+		} else if (err == ESRCH || err == ENOENT) {
+			/* the dataset has been removed since it was opened */
+			break;
+		} else if (err < 0) {
+			ret = -1;
+			break;
+		} else if (err != 0) {
+			ret = zfs_standard_error(hdl, err, dgettext(TEXT_DOMAIN,
+			    "cannot iterate filesystems"));
+			break;
+		}
+
+		snaps = fnvlist_lookup_nvlist(result, "snaps");
+		for (pair = nvlist_next_nvpair(snaps, NULL); pair != NULL;
+		    pair = nvlist_next_nvpair(snaps, pair)) {
+			nvlist_t *snapnv = fnvpair_value_nvlist(pair);
+			dmu_objset_stats_t stats;
+			zfs_handle_t *nzhp;
+			uint8_t *statsp;
+			uint_t len;
+
+			statsp = fnvlist_lookup_uint8_array(snapnv, "stats",
+			    &len);
+			if (len != sizeof (stats))
+				continue;
+			(void) memcpy(&stats, statsp, sizeof (stats));
+
+			/*
+			 * Silently ignore errors, as in zfs_iter_filesystems().
+			 */
+			nzhp = make_dataset_handle_nvl(hdl, nvpair_name(pair),
+			    &stats, fnvlist_lookup_nvlist(snapnv, "props"));
+			if (nzhp == NULL)
+				continue;
+
+			if ((ret = func(nzhp, data)) != 0)
+				break;
+		}
+
+		if (ret != 0 ||
+		    nvlist_lookup_uint64(result, "cookie", &cookie) != 0) {
+			fnvlist_free(result);
+			break;
+		}
+		fnvlist_free(result);
+		fnvlist_add_uint64(args, "cookie", cookie);
+	}
+	zcmd_free_nvlists(&zc);
+	fnvlist_free(args);
+
+	if (fallback) {
+		return (zfs_iter_snapshots_next(zhp, B_FALSE, func, data,
+		    min_txg, max_txg));
+	}
+	return (ret);
+}
+
+/*
+ * Iterate over all snapshots
+ */
+int
+zfs_iter_snapshots(zfs_handle_t *zhp, boolean_t simple, zfs_iter_f func,
+    void *data, uint64_t min_txg, uint64_t max_txg)
+{
+	if (simple) {
+		return (zfs_iter_snapshots_next(zhp, B_TRUE, func, data,
+		    min_txg, max_txg));
+	}
+	return (zfs_iter_snapshots_props(zhp, NULL, func, data,
+	    min_txg, max_txg));
+}
+
 /*
  * Iterate over all bookmarks
  */
@@ -131,86 +131,116 @@ zfs_share_proto_t share_all_proto[] = {
 
 #ifdef __linux__
 /*
- * Search the sharetab for the given mountpoint and protocol, returning
- * a zfs_share_type_t value.
+ * Parse a line of the sharetab in place, returning the mountpoint it shares
+ * and the protocol it is shared with.
  */
-static zfs_share_type_t
-is_shared(libzfs_handle_t *hdl, const char *mountpoint, zfs_share_proto_t proto)
+static boolean_t
+sharetab_parse(char *buf, char **mountpoint, zfs_share_proto_t *proto)
 {
-	char buf[MAXPATHLEN], *tab;
-	char *ptr;
-
-	if (hdl->libzfs_sharetab == NULL)
-		return (SHARED_NOT_SHARED);
-
-	/* Reopen ZFS_SHARETAB to prevent reading stale data from open file */
-	if (freopen(ZFS_SHARETAB, "r", hdl->libzfs_sharetab) == NULL)
-		return (SHARED_NOT_SHARED);
+	char *tab, *ptr;
 
-	(void) fseek(hdl->libzfs_sharetab, 0, SEEK_SET);
+	/* the mountpoint is the first entry on each line */
+	if ((tab = strchr(buf, '\t')) == NULL)
+		return (B_FALSE);
 
-	while (fgets(buf, sizeof (buf), hdl->libzfs_sharetab) != NULL) {
+	*tab = '\0';
+	*mountpoint = buf;
 
-		/* the mountpoint is the first entry on each line */
-		if ((tab = strchr(buf, '\t')) == NULL)
-			continue;
+	/*
+	 * the protocol field is the third field
+	 * skip over second field
+	 */
+	ptr = ++tab;
+	if ((tab = strchr(ptr, '\t')) == NULL)
+		return (B_FALSE);
+	ptr = ++tab;
+	if ((tab = strchr(ptr, '\t')) == NULL)
+		return (B_FALSE);
+	*tab = '\0';
 
-		*tab = '\0';
-		if (strcmp(buf, mountpoint) == 0) {
-			/*
-			 * the protocol field is the third field
-			 * skip over second field
-			 */
-			ptr = ++tab;
-			if ((tab = strchr(ptr, '\t')) == NULL)
-				continue;
-			ptr = ++tab;
-			if ((tab = strchr(ptr, '\t')) == NULL)
-				continue;
-			*tab = '\0';
-			if (strcmp(ptr,
-			    proto_table[proto].p_name) == 0) {
-				switch (proto) {
-				case PROTO_NFS:
-					return (SHARED_NFS);
-				case PROTO_SMB:
-					return (SHARED_SMB);
-				default:
-					return (0);
-				}
-			}
+	for (int i = 0; i < PROTO_END; i++) {
+		if (strcmp(ptr, proto_table[i].p_name) == 0) {
+			*proto = i;
+			return (B_TRUE);
 		}
 	}
 
-	return (SHARED_NOT_SHARED);
+	return (B_FALSE);
 }
 #else
-static zfs_share_type_t
-is_shared(libzfs_handle_t *hdl, const char *mountpoint, zfs_share_proto_t proto)
+static boolean_t
+sharetab_parse(char *buf, char **mountpoint, zfs_share_proto_t *proto)
 {
-	char buf[MAXPATHLEN], *tab;
+	char *tab;
+
+	/* the mountpoint is the first entry on each line */
+	if ((tab = strchr(buf, '\t')) == NULL)
+		return (B_FALSE);
+
+	*tab = '\0';
+	*mountpoint = buf;
+	*proto = PROTO_NFS;
+
+	return (B_TRUE);
+}
+#endif
 
+static boolean_t
+sharetab_rewind(libzfs_handle_t *hdl)
+{
 	if (hdl->libzfs_sharetab == NULL)
-		return (SHARED_NOT_SHARED);
+		return (B_FALSE);
+
+#ifdef __linux__
+	/* Reopen ZFS_SHARETAB to prevent reading stale data from open file */
+	if (freopen(ZFS_SHARETAB, "r", hdl->libzfs_sharetab) == NULL)
+		return (B_FALSE);
+#endif
 
 	(void) fseek(hdl->libzfs_sharetab, 0, SEEK_SET);
 
-	while (fgets(buf, sizeof (buf), hdl->libzfs_sharetab) != NULL) {
+	return (B_TRUE);
+}
+
+/*
+ * Search the sharetab for the given mountpoint and protocol, returning
+ * a zfs_share_type_t value.
+ */
+static zfs_share_type_t
+is_shared(libzfs_handle_t *hdl, const char *mountpoint, zfs_share_proto_t proto)
+{
+	char buf[MAXPATHLEN], *mntpt;
+	zfs_share_proto_t shared_proto;
+	zfs_share_type_t ret = SHARED_NOT_SHARED;
+
+	pthread_mutex_lock(&hdl->libzfs_sharetab_lock);
+	if (!sharetab_rewind(hdl)) {
+		pthread_mutex_unlock(&hdl->libzfs_sharetab_lock);
+		return (SHARED_NOT_SHARED);
+	}
 
-		/* the mountpoint is the first entry on each line */
-		if ((tab = strchr(buf, '\t')) == NULL)
+	while (fgets(buf, sizeof (buf), hdl->libzfs_sharetab) != NULL) {
+		if (!sharetab_parse(buf, &mntpt, &shared_proto) ||
+		    shared_proto != proto || strcmp(mntpt, mountpoint) != 0)
 			continue;
 
-		*tab = '\0';
-		if (strcmp(buf, mountpoint) == 0) {
-			if (proto == PROTO_NFS)
-				return (SHARED_NFS);
+		switch (proto) {
+		case PROTO_NFS:
+			ret = SHARED_NFS;
+			break;
+		case PROTO_SMB:
+			ret = SHARED_SMB;
+			break;
+		default:
+			ret = 0;
+			break;
 		}
+		break;
 	}
+	pthread_mutex_unlock(&hdl->libzfs_sharetab_lock);
 
-	return (SHARED_NOT_SHARED);
+	return (ret);
 }
-#endif
 
 #ifdef __linux__
 static boolean_t
@@ -1072,6 +1102,14 @@ zfs_init_libshare(libzfs_handle_t *zhandle, int service)
 	int ret = SA_OK;
 
 #ifndef __FreeBSD__
+	/*
+	 * Shares may be in use by other threads during a batch, so the
+	 * handle must not be reinitialized under them.
+	 */
+	if (zhandle->libzfs_sharehdl != NULL &&
+	    (zhandle->libzfs_shareflags & ZFSSHARE_BATCH))
+		return (SA_OK);
+
 	if (ret == SA_OK && zhandle->libzfs_shareflags & ZFSSHARE_MISS) {
 		/*
 		 * We had a cache miss. Most likely it is a new ZFS
@@ -1097,6 +1135,49 @@ zfs_init_libshare(libzfs_handle_t *zhandle, int service)
 	return (ret);
 }
 
+/*
+ * zfs_share_batch_begin(zhandle)
+ *
+ * Start a batch of zfs_share() and zfs_unshare() calls, such as when all the
+ * filesystems of a pool are shared.  libshare is initialized once for the
+ * whole batch and the sharetab is only rewritten by zfs_share_batch_end().
+ * Returns B_TRUE if the calls of the batch may be issued from several
+ * threads at once.
+ */
+boolean_t
+zfs_share_batch_begin(libzfs_handle_t *zhandle)
+{
+#ifndef __FreeBSD__
+	if (zfs_init_libshare(zhandle, SA_INIT_SHARE_API) != SA_OK)
+		return (B_FALSE);
+
+	zhandle->libzfs_shareflags |= ZFSSHARE_BATCH;
+	sa_begin_batch(zhandle->libzfs_sharehdl);
+
+	return (B_TRUE);
+#else
+	return (B_FALSE);
+#endif
+}
+
+/*
+ * zfs_share_batch_end(zhandle)
+ *
+ * End the batch started by zfs_share_batch_begin(), once all of its calls
+ * have returned.
+ */
+void
+zfs_share_batch_end(libzfs_handle_t *zhandle)
+{
+#ifndef __FreeBSD__
+	if (!(zhandle->libzfs_shareflags & ZFSSHARE_BATCH))
+		return;
+
+	sa_end_batch(zhandle->libzfs_sharehdl);
+	zhandle->libzfs_shareflags &= ~ZFSSHARE_BATCH;
+#endif
+}
+
 /*
  * zfs_uninit_libshare(zhandle)
  *
@@ -1200,7 +1281,8 @@ zfs_share_proto(zfs_handle_t *zhp, zfs_share_proto_t *proto)
 				    zfs_get_name(zhp));
 				return (-1);
 			}
-			hdl->libzfs_shareflags |= ZFSSHARE_MISS;
+			if (!(hdl->libzfs_shareflags & ZFSSHARE_BATCH))
+				hdl->libzfs_shareflags |= ZFSSHARE_MISS;
 			share = sa_find_share(hdl->libzfs_sharehdl,
 			    mountpoint);
 		}
@@ -1853,6 +1935,29 @@ zfs_foreach_mountpoint(libzfs_handle_t *hdl, zfs_handle_t **handles,
 	tpool_destroy(tp);
 }
 
+/*
+ * Returns B_TRUE if any of the filesystems has sharenfs or sharesmb set, so
+ * that libshare is only initialized when there is something to share.
+ */
+static boolean_t
+any_shareable(zfs_handle_t **handles, size_t num_handles)
+{
+	char shareopts[ZFS_MAXPROPLEN];
+
+	for (size_t i = 0; i < num_handles; i++) {
+		for (zfs_share_proto_t *curr_proto = share_all_proto;
+		    *curr_proto != PROTO_END; curr_proto++) {
+			if (zfs_prop_get(handles[i],
+			    proto_table[*curr_proto].p_prop, shareopts,
+			    sizeof (shareopts), NULL, NULL, 0, B_FALSE) == 0 &&
+			    strcmp(shareopts, "off") != 0)
+				return (B_TRUE);
+		}
+	}
+
+	return (B_FALSE);
+}
+
 /*
  * Mount and share all datasets within the given pool.  This assumes that no
  * datasets within the pool are currently mounted.
@@ -1864,6 +1969,7 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 	get_all_cb_t cb = { 0 };
 	mount_state_t ms = { 0 };
 	zfs_handle_t *zfsp;
+	boolean_t parallel;
 	int ret = 0;
 
 	if ((zfsp = zfs_open(zhp->zpool_hdl, zhp->zpool_name,
@@ -1890,13 +1996,16 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 		ret = ms.ms_mntstatus;
 
 	/*
-	 * Share all filesystems that need to be shared. This needs to be
-	 * a separate pass because libshare is not mt-safe, and so we need
-	 * to share serially.
+	 * Share all filesystems that need to be shared.  This is a separate
+	 * pass so that libshare is initialized once all of them are mounted,
+	 * and the shares are only issued in parallel if libshare allows it.
 	 */
 	ms.ms_mntstatus = 0;
+	parallel = any_shareable(cb.cb_handles, cb.cb_used) &&
+	    zfs_share_batch_begin(zhp->zpool_hdl);
 	zfs_foreach_mountpoint(zhp->zpool_hdl, cb.cb_handles, cb.cb_used,
-	    zfs_share_one, &ms, B_FALSE);
+	    zfs_share_one, &ms, parallel);
+	zfs_share_batch_end(zhp->zpool_hdl);
 	if (ms.ms_mntstatus != 0)
 		ret = ms.ms_mntstatus;
 
@@ -1917,6 +2026,99 @@ mountpoint_compare(const void *a, const void *b)
 	return (strcmp(mountb, mounta));
 }
 
+/*
+ * A filesystem to unshare and unmount in zpool_disable_datasets().
+ */
+typedef struct unmount_task {
+	libzfs_handle_t	*ut_hdl;
+	const char	*ut_mountpoint;
+	int		ut_depth;	/* number of components of mountpoint */
+	uint_t		ut_shared;	/* protocols it is shared with */
+	int		ut_flags;
+	/*
+	 * Set to -1 if any unshare or unmount fails. While multiple threads
+	 * could update this variable concurrently, no synchronization is
+	 * needed as it's only ever set to -1.
+	 */
+	int		*ut_error;
+} unmount_task_t;
+
+/*
+ * Read the sharetab once to find the protocols each of the mountpoints,
+ * sorted by mountpoint_compare(), is shared with, and count the components
+ * of each mountpoint.
+ */
+static void
+sharetab_lookup(libzfs_handle_t *hdl, char **mountpoints, int used,
+    unmount_task_t *tasks)
+{
+	char buf[MAXPATHLEN], *mntpt, **found;
+	zfs_share_proto_t proto;
+
+	for (int i = 0; i < used; i++) {
+		tasks[i].ut_shared = 0;
+		tasks[i].ut_depth = 0;
+		for (const char *c = mountpoints[i]; *c != '\0'; c++) {
+			if (*c == '/' && c[1] != '\0')
+				tasks[i].ut_depth++;
+		}
+	}
+
+	if (used == 0)
+		return;
+
+	pthread_mutex_lock(&hdl->libzfs_sharetab_lock);
+	if (!sharetab_rewind(hdl)) {
+		pthread_mutex_unlock(&hdl->libzfs_sharetab_lock);
+		return;
+	}
+
+	while (fgets(buf, sizeof (buf), hdl->libzfs_sharetab) != NULL) {
+		if (!sharetab_parse(buf, &mntpt, &proto))
+			continue;
+
+		found = bsearch(&mntpt, mountpoints, used, sizeof (char *),
+		    mountpoint_compare);
+		if (found != NULL)
+			tasks[found - mountpoints].ut_shared |= 1 << proto;
+	}
+	pthread_mutex_unlock(&hdl->libzfs_sharetab_lock);
+}
+
+static void
+zfs_unshare_task(void *arg)
+{
+	unmount_task_t *ut = arg;
+
+	for (zfs_share_proto_t *curr_proto = share_all_proto;
+	    *curr_proto != PROTO_END; curr_proto++) {
+		if ((ut->ut_shared & (1 << *curr_proto)) &&
+		    unshare_one(ut->ut_hdl, ut->ut_mountpoint,
+		    ut->ut_mountpoint, *curr_proto) != 0)
+			*ut->ut_error = -1;
+	}
+}
+
+static void
+zfs_unmount_task(void *arg)
+{
+	unmount_task_t *ut = arg;
+
+	if (unmount_one(ut->ut_hdl, ut->ut_mountpoint, ut->ut_flags) != 0)
+		*ut->ut_error = -1;
+}
+
+/*
+ * Run func on the task in the thread pool, or in this thread if there is
+ * no pool or the task could not be dispatched to it.
+ */
+static void
+zfs_dispatch_unmount(tpool_t *tp, void (*func)(void *), unmount_task_t *ut)
+{
+	if (tp == NULL || tpool_dispatch(tp, func, ut) != 0)
+		func(ut);
+}
+
 /* alias for 2002/240 */
 #pragma weak zpool_unmount_datasets = zpool_disable_datasets
 /*
@@ -1934,9 +2136,13 @@ zpool_disable_datasets(zpool_handle_t *zhp, boolean_t force)
 	size_t namelen;
 	char **mountpoints = NULL;
 	zfs_handle_t **datasets = NULL;
+	unmount_task_t *tasks = NULL;
+	tpool_t *tp = NULL;
 	libzfs_handle_t *hdl = zhp->zpool_hdl;
 	int i;
 	int ret = -1;
+	int error = 0;
+	int max_depth = 0;
 	int flags = (force ? MS_FORCE : 0);
 
 	namelen = strlen(zhp->zpool_name);
@@ -2017,26 +2223,63 @@ zpool_disable_datasets(zpool_handle_t *zhp, boolean_t force)
 	 */
 	qsort(mountpoints, used, sizeof (char *), mountpoint_compare);
 
+	if ((tasks = zfs_alloc(hdl, MAX(used, 1) *
+	    sizeof (unmount_task_t))) == NULL)
+		goto out;
+
+	for (i = 0; i < used; i++) {
+		tasks[i].ut_hdl = hdl;
+		tasks[i].ut_mountpoint = mountpoints[i];
+		tasks[i].ut_flags = flags;
+		tasks[i].ut_error = &error;
+	}
+	sharetab_lookup(hdl, mountpoints, used, tasks);
+
+	if (getenv("ZFS_SERIAL_MOUNT") == NULL)
+		tp = tpool_create(1, mount_tp_nthr, 0, NULL);
+
 	/*
 	 * Walk through and first unshare everything.
 	 */
 	for (i = 0; i < used; i++) {
-		zfs_share_proto_t *curr_proto;
-		for (curr_proto = share_all_proto; *curr_proto != PROTO_END;
-		    curr_proto++) {
-			if (is_shared(hdl, mountpoints[i], *curr_proto) &&
-			    unshare_one(hdl, mountpoints[i],
-			    mountpoints[i], *curr_proto) != 0)
-				goto out;
+		if (tasks[i].ut_shared != 0)
+			break;
+	}
+	if (i < used) {
+		boolean_t parallel = zfs_share_batch_begin(hdl);
+
+		for (i = 0; i < used; i++) {
+			if (tasks[i].ut_shared != 0)
+				zfs_dispatch_unmount(parallel ? tp : NULL,
+				    zfs_unshare_task, &tasks[i]);
 		}
+		if (tp != NULL)
+			tpool_wait(tp);
+		zfs_share_batch_end(hdl);
+		if (error != 0)
+			goto out;
 	}
 
 	/*
 	 * Now unmount everything, removing the underlying directories as
-	 * appropriate.
+	 * appropriate.  A filesystem's mountpoint is always deeper than the
+	 * ones it is mounted under, so unmounting the deepest mountpoints
+	 * first, one depth at a time, unmounts every filesystem before the
+	 * ones it is mounted under, while unmounting the filesystems of the
+	 * same depth in parallel.
 	 */
-	for (i = 0; i < used; i++) {
-		if (unmount_one(hdl, mountpoints[i], flags) != 0)
+	for (i = 0; i < used; i++)
+		max_depth = MAX(max_depth, tasks[i].ut_depth);
+
+	for (int depth = max_depth; depth >= 0; depth--) {
+		for (i = 0; i < used; i++) {
+			if (tasks[i].ut_depth == depth)
+				zfs_dispatch_unmount(tp, zfs_unmount_task,
+				    &tasks[i]);
+		}
+		if (tp != NULL)
+			tpool_wait(tp);
+		if (error != 0)
 			goto out;
 	}
 
@@ -2047,6 +2290,9 @@ zpool_disable_datasets(zpool_handle_t *zhp, boolean_t force)
 
 	ret = 0;
 out:
+	if (tp != NULL)
+		tpool_destroy(tp);
+	free(tasks);
 	for (i = 0; i < used; i++) {
 		if (datasets[i])
 			zfs_close(datasets[i]);
@@ -351,8 +351,22 @@ zpool_get_prop(zpool_handle_t *zhp, zpool_prop_t prop, char *buf,
 				(void) zfs_nicenum(intval, buf, len);
 			break;
 
+		case ZPOOL_PROP_DEDUP_TABLE_QUOTA:
+			if (intval == 0) {
+				(void) strlcpy(buf, "none", len);
+			} else if (intval == UINT64_MAX) {
+				(void) strlcpy(buf, "auto", len);
+			} else if (literal) {
+				(void) snprintf(buf, len, "%llu",
+				    (u_longlong_t)intval);
+			} else {
+				(void) zfs_nicebytes(intval, buf, len);
+			}
+			break;
+
 		case ZPOOL_PROP_EXPANDSZ:
 		case ZPOOL_PROP_CHECKPOINT:
+		case ZPOOL_PROP_DEDUP_TABLE_SIZE:
 			if (intval == 0) {
 				(void) strlcpy(buf, "-", len);
 			} else if (literal) {
@@ -2316,6 +2330,17 @@ zpool_trim(zpool_handle_t *zhp, pool_trim_func_t cmd_type, nvlist_t *vds,
  */
 int
 zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func, pool_scrub_cmd_t cmd)
+{
+	return (zpool_scan_range(zhp, func, cmd, NULL));
+}
+
+/*
+ * Scan the pool, restricting a scrub to the txg range given by the
+ * ZPOOL_SCAN_* entries of args, if not NULL.
+ */
+int
+zpool_scan_range(zpool_handle_t *zhp, pool_scan_func_t func,
+    pool_scrub_cmd_t cmd, nvlist_t *args)
 {
 	zfs_cmd_t zc = {"\0"};
 	char msg[1024];
@@ -2326,7 +2351,12 @@ zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func, pool_scrub_cmd_t cmd)
 	zc.zc_cookie = func;
 	zc.zc_flags = cmd;
 
-	if (zfs_ioctl(hdl, ZFS_IOC_POOL_SCAN, &zc) == 0)
+	if (args != NULL && zcmd_write_src_nvlist(hdl, &zc, args) != 0)
+		return (-1);
+
+	err = zfs_ioctl(hdl, ZFS_IOC_POOL_SCAN, &zc);
+	zcmd_free_nvlists(&zc);
+	if (err == 0)
 		return (0);
 
 	err = errno;
@@ -2589,6 +2619,23 @@ zpool_find_vdev_by_physpath(zpool_handle_t *zhp, const char *ppath,
 	return (ret);
 }
 
+/*
+ * Return B_TRUE if the name is that of a dRAID distributed spare, which
+ * has the form draid<parity>-<top-level vdev id>-<spare id>.
+ */
+boolean_t
+zpool_is_draid_spare(const char *name)
+{
+	u_longlong_t nparity, top_id, spare_id;
+	int n = 0;
+
+	if (sscanf(name, VDEV_DRAID_SPARE_PATH_FMT "%n", &nparity, &top_id,
+	    &spare_id, &n) != 3 || name[n] != '\0')
+		return (B_FALSE);
+
+	return (nparity >= 1 && nparity <= VDEV_DRAID_MAXPARITY);
+}
+
 /*
  * Determine if we have an "interior" top-level vdev (i.e mirror/raidz).
  */
@@ -2596,6 +2643,8 @@ static boolean_t
 zpool_vdev_is_interior(const char *name)
 {
 	if (strncmp(name, VDEV_TYPE_RAIDZ, strlen(VDEV_TYPE_RAIDZ)) == 0 ||
+	    (strncmp(name, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) == 0 &&
+	    !zpool_is_draid_spare(name)) ||
 	    strncmp(name, VDEV_TYPE_SPARE, strlen(VDEV_TYPE_SPARE)) == 0 ||
 	    strncmp(name,
 	    VDEV_TYPE_REPLACING, strlen(VDEV_TYPE_REPLACING)) == 0 ||
@@ -2725,6 +2774,7 @@ vdev_get_physpaths(nvlist_t *nv, char *physpath, size_t phypath_size,
 		}
 	} else if (strcmp(type, VDEV_TYPE_MIRROR) == 0 ||
 	    strcmp(type, VDEV_TYPE_RAIDZ) == 0 ||
+	    strcmp(type, VDEV_TYPE_DRAID) == 0 ||
 	    strcmp(type, VDEV_TYPE_REPLACING) == 0 ||
 	    (is_spare = (strcmp(type, VDEV_TYPE_SPARE) == 0))) {
 		nvlist_t **child;
@@ -3104,8 +3154,8 @@ is_replacing_spare(nvlist_t *search, nvlist_t *tgt, int which)
  * If 'replacing' is specified, the new disk will replace the old one.
  */
 int
-zpool_vdev_attach(zpool_handle_t *zhp,
-    const char *old_disk, const char *new_disk, nvlist_t *nvroot, int replacing)
+zpool_vdev_attach(zpool_handle_t *zhp, const char *old_disk,
+    const char *new_disk, nvlist_t *nvroot, int replacing, boolean_t rebuild)
 {
 	zfs_cmd_t zc = {"\0"};
 	char msg[1024];
@@ -3140,6 +3190,7 @@ zpool_vdev_attach(zpool_handle_t *zhp,
 
 	verify(nvlist_lookup_uint64(tgt, ZPOOL_CONFIG_GUID, &zc.zc_guid) == 0);
 	zc.zc_cookie = replacing;
+	zc.zc_simple = rebuild;
 
 	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
 	    &child, &children) != 0 || children != 1) {
@@ -3196,7 +3247,12 @@ zpool_vdev_attach(zpool_handle_t *zhp,
 		/*
 		 * Can't attach to or replace this type of vdev.
 		 */
-		if (replacing) {
+		if (rebuild) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "sequential reconstruction requires the "
+			    "device_rebuild feature and is only supported "
+			    "for mirror vdevs"));
+		} else if (replacing) {
 			uint64_t version = zpool_get_prop_int(zhp,
 			    ZPOOL_PROP_VERSION, NULL);
 
@@ -3212,8 +3268,9 @@ zpool_vdev_attach(zpool_handle_t *zhp,
 				    "cannot replace a replacing device"));
 		} else {
 			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "can only attach to mirrors and top-level "
-			    "disks"));
+			    "can only attach to mirrors, top-level disks "
+			    "and raidz vdevs, attaching to a raidz vdev "
+			    "requires the raidz_expansion feature"));
 		}
 		(void) zfs_error(hdl, EZFS_BADTARGET, msg);
 		break;
@@ -4081,9 +4138,11 @@ zpool_vdev_name(libzfs_handle_t *hdl, zpool_handle_t *zhp, nvlist_t *nv,
 		path = type;
 
 		/*
-		 * If it's a raidz device, we need to stick in the parity level.
+		 * If it's a raidz or draid device, we need to stick in the
+		 * parity level.
 		 */
-		if (strcmp(path, VDEV_TYPE_RAIDZ) == 0) {
+		if (strcmp(path, VDEV_TYPE_RAIDZ) == 0 ||
+		    strcmp(path, VDEV_TYPE_DRAID) == 0) {
 			verify(nvlist_lookup_uint64(nv, ZPOOL_CONFIG_NPARITY,
 			    &value) == 0);
 			(void) snprintf(buf, sizeof (buf), "%s%llu", path,
@@ -4115,27 +4174,87 @@ zbookmark_mem_compare(const void *a, const void *b)
 }
 
 /*
- * Retrieve the persistent error log, uniquify the members, and return to the
- * caller.
+ * Retrieve the raw error list from the kernel a page at a time, so that the
+ * pool's error log is never locked for long.  Returns the errno, with
+ * *zbp allocated to hold *countp bookmarks on success.
  */
-int
-zpool_get_errlog(zpool_handle_t *zhp, nvlist_t **nverrlistp)
+static int
+zpool_get_errlog_paged(zpool_handle_t *zhp, zbookmark_phys_t **zbp,
+    uint64_t *countp)
 {
-	zfs_cmd_t zc = {"\0"};
 	libzfs_handle_t *hdl = zhp->zpool_hdl;
-	uint64_t count;
+	nvlist_t *args = fnvlist_alloc();
 	zbookmark_phys_t *zb = NULL;
-	int i;
+	uint64_t count = 0, alloc = 0;
+	int error;
+
+	for (;;) {
+		nvlist_t *result;
+		uint64_t *bookmarks, *cookie;
+		uint_t nbookmarks, ncookie;
+
+		error = lzc_pool_error_log(zhp->zpool_name, args, &result);
+		if (error != 0)
+			break;
+
+		bookmarks = fnvlist_lookup_uint64_array(result, "bookmarks",
+		    &nbookmarks);
+		nbookmarks /= 4;
+		if (count + nbookmarks > alloc) {
+			uint64_t newalloc = MAX(2 * alloc, count + nbookmarks);
+			void *newzb = zfs_realloc(hdl, zb,
+			    alloc * sizeof (zbookmark_phys_t),
+			    newalloc * sizeof (zbookmark_phys_t));
+			if (newzb == NULL) {
+				nvlist_free(result);
+				error = ENOMEM;
+				break;
+			}
+			zb = newzb;
+			alloc = newalloc;
+		}
+		for (uint_t i = 0; i < nbookmarks; i++, count++) {
+			zb[count].zb_objset = bookmarks[4 * i];
+			zb[count].zb_object = bookmarks[4 * i + 1];
+			zb[count].zb_level = bookmarks[4 * i + 2];
+			zb[count].zb_blkid = bookmarks[4 * i + 3];
+		}
+
+		if (nvlist_lookup_uint64_array(result, "cookie", &cookie,
+		    &ncookie) != 0) {
+			nvlist_free(result);
+			break;
+		}
+		fnvlist_add_uint64_array(args, "cookie", cookie, ncookie);
+		nvlist_free(result);
+	}
+	fnvlist_free(args);
+
+	if (error != 0) {
+		free(zb);
+		return (error);
+	}
+
+	*zbp = zb;
+	*countp = count;
+	return (0);
+}
+
+/*
+ * Retrieve the raw error list from a kernel without ZFS_IOC_POOL_ERROR_LOG.
+ * If the number of errors has increased, allocate more space and continue
+ * until we get the entire list.
+ */
+static int
+zpool_get_errlog_legacy(zpool_handle_t *zhp, zbookmark_phys_t **zbp,
+    uint64_t *countp)
+{
+	zfs_cmd_t zc = {"\0"};
+	uint64_t count;
+	zbookmark_phys_t *zb;
 
-	/*
-	 * Retrieve the raw error list from the kernel.  If the number of errors
-	 * has increased, allocate more space and continue until we get the
-	 * entire list.
-	 */
 	verify(nvlist_lookup_uint64(zhp->zpool_config, ZPOOL_CONFIG_ERRCOUNT,
 	    &count) == 0);
-	if (count == 0)
-		return (0);
 	zc.zc_nvlist_dst = (uintptr_t)zfs_alloc(zhp->zpool_hdl,
 	    count * sizeof (zbookmark_phys_t));
 	zc.zc_nvlist_dst_size = count;
@@ -4152,9 +4271,7 @@ zpool_get_errlog(zpool_handle_t *zhp, nvlist_t **nverrlistp)
 				    sizeof (zbookmark_phys_t));
 				zc.zc_nvlist_dst = (uintptr_t)dst;
 			} else {
-				return (zpool_standard_error_fmt(hdl, errno,
-				    dgettext(TEXT_DOMAIN, "errors: List of "
-				    "errors unavailable")));
+				return (errno);
 			}
 		} else {
 			break;
@@ -4162,16 +4279,52 @@ zpool_get_errlog(zpool_handle_t *zhp, nvlist_t **nverrlistp)
 	}
 
 	/*
-	 * Sort the resulting bookmarks.  This is a little confusing due to the
-	 * implementation of ZFS_IOC_ERROR_LOG.  The bookmarks are copied last
-	 * to first, and 'zc_nvlist_dst_size' indicates the number of boomarks
-	 * _not_ copied as part of the process.  So we point the start of our
-	 * array appropriate and decrement the total number of elements.
+	 * This is a little confusing due to the implementation of
+	 * ZFS_IOC_ERROR_LOG.  The bookmarks are copied last to first, and
+	 * 'zc_nvlist_dst_size' indicates the number of boomarks _not_ copied
+	 * as part of the process.  So we move the copied bookmarks to the
+	 * start of our array and decrement the total number of elements.
 	 */
-	zb = ((zbookmark_phys_t *)(uintptr_t)zc.zc_nvlist_dst) +
-	    zc.zc_nvlist_dst_size;
+	zb = (zbookmark_phys_t *)(uintptr_t)zc.zc_nvlist_dst;
 	count -= zc.zc_nvlist_dst_size;
+	(void) memmove(zb, zb + zc.zc_nvlist_dst_size,
+	    count * sizeof (zbookmark_phys_t));
 
+	*zbp = zb;
+	*countp = count;
+	return (0);
+}
+
+/*
+ * Retrieve the persistent error log, uniquify the members, and return to the
+ * caller.
+ */
+int
+zpool_get_errlog(zpool_handle_t *zhp, nvlist_t **nverrlistp)
+{
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+	uint64_t count;
+	zbookmark_phys_t *zb = NULL;
+	int error;
+	int i;
+
+	verify(nvlist_lookup_uint64(zhp->zpool_config, ZPOOL_CONFIG_ERRCOUNT,
+	    &count) == 0);
+	if (count == 0)
+		return (0);
+
+	error = zpool_get_errlog_paged(zhp, &zb, &count);
+	if (error == ZFS_ERR_IOC_CMD_UNAVAIL)
+		error = zpool_get_errlog_legacy(zhp, &zb, &count);
+	if (error != 0) {
+		return (zpool_standard_error_fmt(hdl, error,
+		    dgettext(TEXT_DOMAIN, "errors: List of errors "
+		    "unavailable")));
+	}
+
+	/*
+	 * Sort the resulting bookmarks, so that duplicates are adjacent.
+	 */
 	qsort(zb, count, sizeof (zbookmark_phys_t), zbookmark_mem_compare);
 
 	verify(nvlist_alloc(nverrlistp, 0, KM_SLEEP) == 0);
@@ -4206,11 +4359,11 @@ zpool_get_errlog(zpool_handle_t *zhp, nvlist_t **nverrlistp)
 		nvlist_free(nv);
 	}
 
-	free((void *)(uintptr_t)zc.zc_nvlist_dst);
+	free(zb);
 	return (0);
 
 nomem:
-	free((void *)(uintptr_t)zc.zc_nvlist_dst);
+	free(zb);
 	return (no_memory(zhp->zpool_hdl));
 }
 
@@ -4371,20 +4524,9 @@ zpool_get_history(zpool_handle_t *zhp, nvlist_t **nvhisp)
 	return (err);
 }
 
-/*
- * Retrieve the next event given the passed 'zevent_fd' file descriptor.
- * If there is a new event available 'nvp' will contain a newly allocated
- * nvlist and 'dropped' will be set to the number of missed events since
- * the last call to this function.  When 'nvp' is set to NULL it indicates
- * no new events are available.  In either case the function returns 0 and
- * it is up to the caller to free 'nvp'.  In the case of a fatal error the
- * function will return a non-zero value.  When the function is called in
- * blocking mode (the default, unless the ZEVENT_NONBLOCK flag is passed),
- * it will not return until a new event is available.
- */
-int
-zpool_events_next(libzfs_handle_t *hdl, nvlist_t **nvp,
-    int *dropped, unsigned flags, int zevent_fd)
+static int
+zpool_events_get(libzfs_handle_t *hdl, nvlist_t **nvp,
+    int *dropped, unsigned flags, int zevent_fd, size_t size)
 {
 	zfs_cmd_t zc = {"\0"};
 	int error = 0;
@@ -4392,11 +4534,9 @@ zpool_events_next(libzfs_handle_t *hdl, nvlist_t **nvp,
 	*nvp = NULL;
 	*dropped = 0;
 	zc.zc_cleanup_fd = zevent_fd;
+	zc.zc_guid = flags & (ZEVENT_NONBLOCK | ZEVENT_BATCH);
 
-	if (flags & ZEVENT_NONBLOCK)
-		zc.zc_guid = ZEVENT_NONBLOCK;
-
-	if (zcmd_alloc_dst_nvlist(hdl, &zc, ZEVENT_SIZE) != 0)
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, size) != 0)
 		return (-1);
 
 retry:
@@ -4439,6 +4579,60 @@ out:
 	return (error);
 }
 
+/*
+ * Retrieve the next event given the passed 'zevent_fd' file descriptor.
+ * If there is a new event available 'nvp' will contain a newly allocated
+ * nvlist and 'dropped' will be set to the number of missed events since
+ * the last call to this function.  When 'nvp' is set to NULL it indicates
+ * no new events are available.  In either case the function returns 0 and
+ * it is up to the caller to free 'nvp'.  In the case of a fatal error the
+ * function will return a non-zero value.  When the function is called in
+ * blocking mode (the default, unless the ZEVENT_NONBLOCK flag is passed),
+ * it will not return until a new event is available.
+ */
+int
+zpool_events_next(libzfs_handle_t *hdl, nvlist_t **nvp,
+    int *dropped, unsigned flags, int zevent_fd)
+{
+	return (zpool_events_get(hdl, nvp, dropped, flags & ~ZEVENT_BATCH,
+	    zevent_fd, ZEVENT_SIZE));
+}
+
+/*
+ * As zpool_events_next(), but retrieve all the events available at once,
+ * up to a buffer of ZEVENT_BATCH_SIZE, which saves an ioctl per event when
+ * they are coming in quickly.  'nvp' holds the events as nvlists in the
+ * order they were posted, and 'dropped' is the number missed before the
+ * last of them.  A kernel module which predates batching returns a single
+ * event, which is handed back the same way.
+ */
+int
+zpool_events_next_batch(libzfs_handle_t *hdl, nvlist_t **nvp,
+    int *dropped, unsigned flags, int zevent_fd)
+{
+	nvlist_t *event, *batch = NULL;
+	int error;
+
+	*nvp = NULL;
+	error = zpool_events_get(hdl, &event, dropped, flags | ZEVENT_BATCH,
+	    zevent_fd, ZEVENT_BATCH_SIZE);
+	if (error != 0 || event == NULL || !nvlist_exists(event, "class")) {
+		*nvp = event;
+		return (error);
+	}
+
+	if (nvlist_alloc(&batch, NV_UNIQUE_NAME, 0) != 0 ||
+	    nvlist_add_nvlist(batch, "0", event) != 0) {
+		nvlist_free(batch);
+		nvlist_free(event);
+		return (no_memory(hdl));
+	}
+	nvlist_free(event);
+	*nvp = batch;
+
+	return (0);
+}
+
 /*
  * Clear all events.
  */
@@ -2792,8 +2792,18 @@ zfs_send_one(zfs_handle_t *zhp, const char *from, int fd, sendflags_t *flags,
 		}
 	}
 
-	err = lzc_send_redacted(zhp->zfs_name, from, fd,
-	    lzc_flags_from_sendflags(flags), redactbook);
+	if (flags->stream_compress != 0) {
+		err = lzc_send_stream_compressed(zhp->zfs_name, from, fd,
+		    lzc_flags_from_sendflags(flags), flags->chunk,
+		    flags->nchunks, redactbook, flags->stream_compress);
+	} else if (flags->nchunks != 0) {
+		err = lzc_send_chunk(zhp->zfs_name, from, fd,
+		    lzc_flags_from_sendflags(flags), flags->chunk,
+		    flags->nchunks);
+	} else {
+		err = lzc_send_redacted(zhp->zfs_name, from, fd,
+		    lzc_flags_from_sendflags(flags), redactbook);
+	}
 
 	if (flags->progress) {
 		void *status = NULL;
@@ -4571,6 +4581,12 @@ zfs_receive_one(libzfs_handle_t *hdl, int infd, const char *tosnap,
 	    DMU_BACKUP_FEATURE_RAW;
 	boolean_t embedded = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo) &
 	    DMU_BACKUP_FEATURE_EMBED_DATA;
+	/*
+	 * Every chunk of a chunked send but the last leaves the receive
+	 * resumable at the start of the next one, so it must be resumable.
+	 */
+	boolean_t chunked = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo) &
+	    DMU_BACKUP_FEATURE_CHUNKED;
 	stream_wantsnewfs = (drrb->drr_fromguid == 0 ||
 	    (drrb->drr_flags & DRR_FLAG_CLONE) || originsnap) && !resuming;
 
@@ -4874,9 +4890,9 @@ zfs_receive_one(libzfs_handle_t *hdl, int infd, const char *tosnap,
 	}
 
 	err = ioctl_err = lzc_receive_with_cmdprops(destsnap, rcvprops,
-	    oxprops, wkeydata, wkeylen, origin, flags->force, flags->resumable,
-	    raw, infd, drr_noswap, cleanup_fd, &read_bytes, &errflags,
-	    action_handlep, &prop_errors);
+	    oxprops, wkeydata, wkeylen, origin, flags->force,
+	    flags->resumable || chunked, raw, infd, drr_noswap, cleanup_fd,
+	    &read_bytes, &errflags, action_handlep, &prop_errors);
 	ioctl_errno = ioctl_err;
 	prop_errflags = errflags;
 
@@ -5094,7 +5110,7 @@ zfs_receive_one(libzfs_handle_t *hdl, int infd, const char *tosnap,
 	 * receive (indicated by stream_avl being non-NULL).
 	 */
 	cp = strchr(destsnap, '@');
-	if (cp && (ioctl_err == 0 || !newfs) && !redacted) {
+	if (cp && (ioctl_err == 0 || !newfs) && !redacted && !chunked) {
 		zfs_handle_t *h;
 
 		*cp = '\0';
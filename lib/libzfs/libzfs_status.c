@@ -183,6 +183,31 @@ find_vdev_problem(nvlist_t *vdev, int (*func)(uint64_t, uint64_t, uint64_t))
 	return (B_FALSE);
 }
 
+/*
+ * Returns B_TRUE if a sequential resilver is in progress on any of the
+ * top-level vdevs.
+ */
+static boolean_t
+find_vdev_rebuilding(nvlist_t *nvroot)
+{
+	nvlist_t **child;
+	uint_t children, c, i;
+	vdev_rebuild_stat_t *vrs;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (B_FALSE);
+
+	for (c = 0; c < children; c++) {
+		if (nvlist_lookup_uint64_array(child[c],
+		    ZPOOL_CONFIG_REBUILD_STATS, (uint64_t **)&vrs, &i) == 0 &&
+		    vrs->vrs_state == VDEV_REBUILD_ACTIVE)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
 /*
  * Active pool health status.
  *
@@ -233,6 +258,12 @@ check_status(nvlist_t *config, boolean_t isimport, zpool_errata_t *erratap)
 	    ps->pss_state == DSS_SCANNING)
 		return (ZPOOL_STATUS_RESILVERING);
 
+	/*
+	 * Currently rebuilding a vdev, check top-level vdevs.
+	 */
+	if (find_vdev_rebuilding(nvroot))
+		return (ZPOOL_STATUS_RESILVERING);
+
 	/*
 	 * The multihost property is set and the pool may be active.
 	 */
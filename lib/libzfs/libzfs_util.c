@@ -320,6 +320,8 @@ libzfs_error_description(libzfs_handle_t *hdl)
 		    "resilver_defer feature"));
 	case EZFS_EXPORT_IN_PROGRESS:
 		return (dgettext(TEXT_DOMAIN, "pool export in progress"));
+	case EZFS_RAIDZ_EXPAND_IN_PROGRESS:
+		return (dgettext(TEXT_DOMAIN, "raidz expansion in progress"));
 	case EZFS_UNKNOWN:
 		return (dgettext(TEXT_DOMAIN, "unknown error"));
 	default:
@@ -619,6 +621,9 @@ zpool_standard_error_fmt(libzfs_handle_t *hdl, int error, const char *fmt, ...)
 	case ZFS_ERR_EXPORT_IN_PROGRESS:
 		zfs_verror(hdl, EZFS_EXPORT_IN_PROGRESS, fmt, ap);
 		break;
+	case ZFS_ERR_RAIDZ_EXPAND_IN_PROGRESS:
+		zfs_verror(hdl, EZFS_RAIDZ_EXPAND_IN_PROGRESS, fmt, ap);
+		break;
 	case ZFS_ERR_IOC_CMD_UNAVAIL:
 		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN, "the loaded zfs "
 		    "module does not support this operation. A reboot may "
@@ -1048,6 +1053,7 @@ libzfs_init(void)
 	zpool_prop_init();
 	zpool_feature_init();
 	libzfs_mnttab_init(hdl);
+	(void) pthread_mutex_init(&hdl->libzfs_sharetab_lock, NULL);
 	fletcher_4_init();
 
 	if (getenv("ZFS_PROP_DEBUG") != NULL) {
@@ -1089,6 +1095,7 @@ libzfs_fini(libzfs_handle_t *hdl)
 	zpool_free_handles(hdl);
 	namespace_clear(hdl);
 	libzfs_mnttab_fini(hdl);
+	(void) pthread_mutex_destroy(&hdl->libzfs_sharetab_lock);
 	libzfs_core_fini();
 	fletcher_4_fini();
 	free(hdl);
@@ -1680,12 +1687,27 @@ zprop_parse_value(libzfs_handle_t *hdl, nvpair_t *elem, int prop,
 			*ivalp = UINT64_MAX;
 		}
 
+		/*
+		 * Special handling for setting 'dedup_table_quota' to 'auto',
+		 * which is UINT64_MAX, and sizes the quota after the dedup or
+		 * special allocation class.
+		 */
+		if (isauto && type == ZFS_TYPE_POOL) {
+			if (prop != ZPOOL_PROP_DEDUP_TABLE_QUOTA) {
+				zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+				    "'auto' is invalid value for '%s'"),
+				    nvpair_name(elem));
+				goto error;
+			}
+			*ivalp = UINT64_MAX;
+		}
+
 		/*
 		 * Special handling for setting 'refreservation' to 'auto'.  Use
 		 * UINT64_MAX to tell the caller to use zfs_fix_auto_resv().
 		 * 'auto' is only allowed on volumes.
 		 */
-		if (isauto) {
+		if (isauto && type != ZFS_TYPE_POOL) {
 			switch (prop) {
 			case ZFS_PROP_REFRESERVATION:
 				if ((type & ZFS_TYPE_VOLUME) == 0) {
@@ -483,6 +483,86 @@ lzc_sync(const char *pool_name, nvlist_t *innvl, nvlist_t **outnvl)
 	return (lzc_ioctl(ZFS_IOC_POOL_SYNC, pool_name, innvl, NULL));
 }
 
+/*
+ * Get the stats of the vdevs of a pool, without the rest of its config.
+ *
+ * The format of the returned nvlist is as follows, with an entry for each
+ * vdev of the pool, including its root vdev and its cache devices:
+ * <vdev guid> -> {
+ *     ZPOOL_CONFIG_VDEV_STATS -> uint64 array (vdev_stat_t)
+ *     ZPOOL_CONFIG_VDEV_STATS_EX -> nvlist
+ * }
+ */
+int
+lzc_pool_vdev_stats(const char *pool_name, nvlist_t **stats)
+{
+	int error;
+
+	nvlist_t *innvl = fnvlist_alloc();
+	error = lzc_ioctl(ZFS_IOC_POOL_VDEV_STATS, pool_name, innvl, stats);
+	fnvlist_free(innvl);
+
+	return (error);
+}
+
+/*
+ * List the ranges of the objects in a snapshot that changed since an
+ * earlier one, without reading any file data.  The time taken is
+ * proportional to the amount of change, not to the size of the dataset.
+ *
+ * The following are the valid properties in args, all of them optional:
+ * "from" -> string, the earlier snapshot (default: report everything)
+ * "object" -> uint64, only report this object
+ * "cookie" -> uint64 array[2], the "cookie" from a previous call
+ * "count" -> uint64, max number of extents to return
+ *
+ * The returned nvlist has "extents", a uint64 array of (object, offset,
+ * length) triples, and "cookie" if there are more extents to get.  The
+ * ranges may include some that did not actually change, but no range that
+ * changed is ever left out.
+ */
+int
+lzc_diff_blocks(const char *snapname, nvlist_t *args, nvlist_t **outnvl)
+{
+	int error;
+
+	if (args != NULL)
+		return (lzc_ioctl(ZFS_IOC_DIFF_BLOCKS, snapname, args, outnvl));
+
+	args = fnvlist_alloc();
+	error = lzc_ioctl(ZFS_IOC_DIFF_BLOCKS, snapname, args, outnvl);
+	fnvlist_free(args);
+
+	return (error);
+}
+
+/*
+ * Get a page of the persistent error log of a pool.
+ *
+ * The following are the valid properties in args, all of them optional:
+ * "cookie" -> uint64 array[3], the "cookie" from a previous call
+ * "count" -> uint64, max number of errors to return
+ *
+ * The returned nvlist has "bookmarks", a uint64 array of (objset, object,
+ * level, blkid) tuples, and "cookie" if there are more errors to get.  The
+ * same error may be returned more than once if the log changes between
+ * calls.
+ */
+int
+lzc_pool_error_log(const char *pool, nvlist_t *args, nvlist_t **outnvl)
+{
+	int error;
+
+	if (args != NULL)
+		return (lzc_ioctl(ZFS_IOC_POOL_ERROR_LOG, pool, args, outnvl));
+
+	args = fnvlist_alloc();
+	error = lzc_ioctl(ZFS_IOC_POOL_ERROR_LOG, pool, args, outnvl);
+	fnvlist_free(args);
+
+	return (error);
+}
+
 /*
  * Create "user holds" on snapshots.  If there is a hold on a snapshot,
  * the snapshot can not be destroyed.  (However, it can be marked for deletion
@@ -645,22 +725,10 @@ lzc_send_resume(const char *snapname, const char *from, int fd,
 	    resumeoff, NULL));
 }
 
-/*
- * snapname: The name of the "tosnap", or the snapshot whose contents we are
- * sending.
- * from: The name of the "fromsnap", or the incremental source.
- * fd: File descriptor to write the stream to.
- * flags: flags that determine features to be used by the stream.
- * resumeobj: Object to resume from, for resuming send
- * resumeoff: Offset to resume from, for resuming send.
- * redactnv: nvlist of string -> boolean(ignored) containing the names of all
- * the snapshots that we should redact with respect to.
- * redactbook: Name of the redaction bookmark to create.
- */
-int
-lzc_send_resume_redacted(const char *snapname, const char *from, int fd,
+static int
+lzc_send_impl(const char *snapname, const char *from, int fd,
     enum lzc_send_flags flags, uint64_t resumeobj, uint64_t resumeoff,
-    const char *redactbook)
+    uint64_t chunk, uint64_t nchunks, uint64_t compress, const char *redactbook)
 {
 	nvlist_t *args;
 	int err;
@@ -681,6 +749,12 @@ lzc_send_resume_redacted(const char *snapname, const char *from, int fd,
 		fnvlist_add_uint64(args, "resume_object", resumeobj);
 		fnvlist_add_uint64(args, "resume_offset", resumeoff);
 	}
+	if (nchunks != 0) {
+		fnvlist_add_uint64(args, "chunk", chunk);
+		fnvlist_add_uint64(args, "num_chunks", nchunks);
+	}
+	if (compress != ZIO_COMPRESS_OFF)
+		fnvlist_add_uint64(args, "stream_compress", compress);
 	if (redactbook != NULL)
 		fnvlist_add_string(args, "redactbook", redactbook);
 
@@ -689,6 +763,60 @@ lzc_send_resume_redacted(const char *snapname, const char *from, int fd,
 	return (err);
 }
 
+/*
+ * Generates only chunk "chunk" of "nchunks" of the stream of "snapname".
+ * The objects of the snapshot are split in "nchunks" ranges, and each chunk
+ * is a stream of one of them which can be generated independently of, and
+ * in parallel with, the others.  The chunks must be received in order into
+ * a resumable receive, each one but the last leaving the receive resumable
+ * at the first object of the next one.
+ */
+int
+lzc_send_chunk(const char *snapname, const char *from, int fd,
+    enum lzc_send_flags flags, uint64_t chunk, uint64_t nchunks)
+{
+	return (lzc_send_impl(snapname, from, fd, flags, 0, 0, chunk,
+	    nchunks, ZIO_COMPRESS_OFF, NULL));
+}
+
+/*
+ * Like lzc_send_chunk() or lzc_send_redacted(), but the payloads of the
+ * WRITE records of the stream are compressed with "compress" (an enum
+ * zio_compress, e.g. ZIO_COMPRESS_LZ4), unless they are sent compressed
+ * already.  The blocks are compressed in parallel as the stream is
+ * generated, and are decompressed by the receiving system.  "nchunks" is
+ * zero to send the whole snapshot.
+ */
+int
+lzc_send_stream_compressed(const char *snapname, const char *from, int fd,
+    enum lzc_send_flags flags, uint64_t chunk, uint64_t nchunks,
+    const char *redactbook, uint64_t compress)
+{
+	return (lzc_send_impl(snapname, from, fd, flags, 0, 0, chunk,
+	    nchunks, compress, redactbook));
+}
+
+/*
+ * snapname: The name of the "tosnap", or the snapshot whose contents we are
+ * sending.
+ * from: The name of the "fromsnap", or the incremental source.
+ * fd: File descriptor to write the stream to.
+ * flags: flags that determine features to be used by the stream.
+ * resumeobj: Object to resume from, for resuming send
+ * resumeoff: Offset to resume from, for resuming send.
+ * redactnv: nvlist of string -> boolean(ignored) containing the names of all
+ * the snapshots that we should redact with respect to.
+ * redactbook: Name of the redaction bookmark to create.
+ */
+int
+lzc_send_resume_redacted(const char *snapname, const char *from, int fd,
+    enum lzc_send_flags flags, uint64_t resumeobj, uint64_t resumeoff,
+    const char *redactbook)
+{
+	return (lzc_send_impl(snapname, from, fd, flags, resumeobj, resumeoff,
+	    0, 0, ZIO_COMPRESS_OFF, redactbook));
+}
+
 /*
  * "from" can be NULL, a snapshot, or a bookmark.
  *
@@ -1227,6 +1355,44 @@ lzc_get_bookmark_props(const char *bookmark, nvlist_t **props)
 	return (error);
 }
 
+/*
+ * List a batch of the snapshots of a filesystem or volume, with their stats
+ * and properties.
+ *
+ * The following are the valid arguments in the args nvlist:
+ *
+ * "cookie" -> uint64, the position to resume listing from, as returned by
+ *     the previous call (default: the first snapshot)
+ * "count" -> uint64, the most snapshots to return; the kernel may return
+ *     fewer
+ * SNAP_ITER_MIN_TXG, SNAP_ITER_MAX_TXG -> uint64, only list the snapshots
+ *     created within this range of txgs
+ * "props" -> nvlist, the names of the properties to return (default: all)
+ *
+ * The format of the returned nvlist is as follows:
+ * {
+ *     "snaps" -> {
+ *         <full name of snapshot> -> {
+ *             "stats" -> dmu_objset_stats_t (uint8 array)
+ *             "props" -> {
+ *                 <name of property> -> {
+ *                     "value" -> uint64 or string
+ *                     "source" -> string
+ *                 }
+ *                 ...
+ *             }
+ *         }
+ *         ...
+ *     }
+ *     "cookie" -> uint64, only present if there may be more snapshots
+ * }
+ */
+int
+lzc_list_snapshots(const char *fsname, nvlist_t *args, nvlist_t **snaps)
+{
+	return (lzc_ioctl(ZFS_IOC_LIST_SNAPSHOTS, fsname, args, snaps));
+}
+
 /*
  * Destroys bookmarks.
  *
@@ -1264,7 +1430,8 @@ lzc_destroy_bookmarks(nvlist_t *bmarks, nvlist_t **errlist)
 
 static int
 lzc_channel_program_impl(const char *pool, const char *program, boolean_t sync,
-    uint64_t instrlimit, uint64_t memlimit, nvlist_t *argnvl, nvlist_t **outnvl)
+    uint64_t instrlimit, uint64_t txg_instrlimit, uint64_t memlimit,
+    int outfd, nvlist_t *argnvl, nvlist_t **outnvl)
 {
 	int error;
 	nvlist_t *args;
@@ -1275,6 +1442,11 @@ lzc_channel_program_impl(const char *pool, const char *program, boolean_t sync,
 	fnvlist_add_boolean_value(args, ZCP_ARG_SYNC, sync);
 	fnvlist_add_uint64(args, ZCP_ARG_INSTRLIMIT, instrlimit);
 	fnvlist_add_uint64(args, ZCP_ARG_MEMLIMIT, memlimit);
+	if (txg_instrlimit != 0)
+		fnvlist_add_uint64(args, ZCP_ARG_TXG_INSTRLIMIT,
+		    txg_instrlimit);
+	if (outfd != -1)
+		fnvlist_add_int32(args, ZCP_ARG_OUTPUT_FD, outfd);
 	error = lzc_ioctl(ZFS_IOC_CHANNEL_PROGRAM, pool, args, outnvl);
 	fnvlist_free(args);
 
@@ -1319,7 +1491,58 @@ lzc_channel_program(const char *pool, const char *program, uint64_t instrlimit,
     uint64_t memlimit, nvlist_t *argnvl, nvlist_t **outnvl)
 {
 	return (lzc_channel_program_impl(pool, program, B_TRUE, instrlimit,
-	    memlimit, argnvl, outnvl));
+	    0, memlimit, -1, argnvl, outnvl));
+}
+
+/*
+ * Executes a channel program which may span several txgs.
+ *
+ * The program is suspended each time it has executed 'txg_instrlimit'
+ * instructions in the current txg and resumed in the next one, so a long
+ * running program does not hold up the txg sync. It is therefore not atomic:
+ * other changes to the pool may be made between the steps, and the program
+ * must cope with that. Calling coroutine.yield() ends the current txg early.
+ * 'instrlimit' bounds the total number of instructions and may exceed the
+ * zfs_lua_max_instrlimit tunable, which only bounds 'txg_instrlimit'.
+ *
+ * The return values of this function (and their meaning) are the same as
+ * the ones described in lzc_channel_program(), and EINTR if the program was
+ * interrupted while waiting for the next txg.
+ */
+int
+lzc_channel_program_yielding(const char *pool, const char *program,
+    uint64_t instrlimit, uint64_t txg_instrlimit, uint64_t memlimit,
+    nvlist_t *argnvl, nvlist_t **outnvl)
+{
+	return (lzc_channel_program_impl(pool, program, B_TRUE, instrlimit,
+	    txg_instrlimit, memlimit, -1, argnvl, outnvl));
+}
+
+/*
+ * Executes a channel program which streams output to a file descriptor.
+ *
+ * Values the program passes to zfs.stream() are written to 'outfd' as they
+ * are produced, rather than returned in 'outnvl' at the end, each as a
+ * native-endian uint64_t length followed by a packed nvlist of that length
+ * holding the value under ZCP_RET_RETURN. They are written between txgs
+ * and when the program ends, so 'outfd' should be drained by another
+ * thread, as for lzc_send(). A non-zero 'txg_instrlimit' is as for
+ * lzc_channel_program_yielding(), and also lets the program wait for the
+ * output buffer to be drained when it fills up instead of failing. If
+ * 'sync' is B_FALSE the program runs as for lzc_channel_program_nosync()
+ * and 'txg_instrlimit' must be 0.
+ *
+ * The return values of this function (and their meaning) are the same as
+ * the ones described in lzc_channel_program_yielding(), and EBADF if
+ * 'outfd' is not open, or the error from writing to it.
+ */
+int
+lzc_channel_program_stream(const char *pool, const char *program,
+    boolean_t sync, uint64_t instrlimit, uint64_t txg_instrlimit,
+    uint64_t memlimit, int outfd, nvlist_t *argnvl, nvlist_t **outnvl)
+{
+	return (lzc_channel_program_impl(pool, program, sync, instrlimit,
+	    txg_instrlimit, memlimit, outfd, argnvl, outnvl));
 }
 
 /*
@@ -1407,7 +1630,7 @@ lzc_channel_program_nosync(const char *pool, const char *program,
     uint64_t timeout, uint64_t memlimit, nvlist_t *argnvl, nvlist_t **outnvl)
 {
 	return (lzc_channel_program_impl(pool, program, B_FALSE, timeout,
-	    memlimit, argnvl, outnvl));
+	    0, memlimit, -1, argnvl, outnvl));
 }
 
 /*
@@ -1582,3 +1805,437 @@ lzc_redact(const char *snapshot, const char *bookname, nvlist_t *snapnv)
 	fnvlist_free(args);
 	return (error);
 }
+
+/*
+ * Asynchronous snapshot creation and destruction.
+ *
+ * Each ZFS_IOC_SNAPSHOT or ZFS_IOC_DESTROY_SNAPS ioctl waits for a txg to
+ * sync, so a consumer issuing many small requests one at a time spends
+ * most of its time waiting.  An lzc_async_t runs requests on a few threads
+ * of its own, and a thread taking a request from the queue also takes every
+ * other queued request of the same kind on the same pool, up to
+ * LZC_ASYNC_BATCH_MAX snapshots, and issues them as one ioctl so that they
+ * complete in a single txg.  Snapshot requests are only combined when
+ * neither sets properties and no filesystem is snapshotted twice.  If a
+ * combined ioctl fails its requests are reissued one at a time, so each
+ * request still succeeds or fails atomically on its own.
+ *
+ * A request's callback is called with its error and errlist, as returned
+ * by lzc_snapshot() or lzc_destroy_snaps(); the errlist is freed when the
+ * callback returns.  Callbacks are called from the lzc_async_t's threads,
+ * unless it was created with LZC_ASYNC_FD, in which case lzc_async_fd()
+ * becomes readable when requests have completed and the callbacks are
+ * called by lzc_async_complete() in the caller's thread.
+ */
+#define	LZC_ASYNC_BATCH_MAX	4096
+
+typedef enum lzc_async_type {
+	LZC_ASYNC_SNAPSHOT,
+	LZC_ASYNC_DESTROY_SNAPS,
+} lzc_async_type_t;
+
+typedef struct lzc_async_op {
+	struct lzc_async_op	*lao_next;
+	lzc_async_type_t	lao_type;
+	char			lao_pool[ZFS_MAX_DATASET_NAME_LEN];
+	nvlist_t		*lao_snaps;
+	nvlist_t		*lao_props;
+	boolean_t		lao_defer;
+	lzc_async_cb_t		*lao_cb;
+	void			*lao_arg;
+	int			lao_error;
+	nvlist_t		*lao_errlist;
+} lzc_async_op_t;
+
+struct lzc_async {
+	pthread_mutex_t	la_lock;
+	pthread_cond_t	la_cv;		/* work queued, or exiting */
+	pthread_cond_t	la_done_cv;	/* a request completed */
+	lzc_async_op_t	*la_pending;
+	lzc_async_op_t	**la_pending_tailp;
+	lzc_async_op_t	*la_done;	/* callbacks to run, LZC_ASYNC_FD */
+	uint64_t	la_outstanding;	/* submitted, callback not yet run */
+	boolean_t	la_exiting;
+	int		la_flags;
+	int		la_pipe[2];
+	uint_t		la_nthreads;
+	pthread_t	*la_threads;
+};
+
+static void
+lzc_async_op_free(lzc_async_op_t *op)
+{
+	nvlist_free(op->lao_snaps);
+	nvlist_free(op->lao_props);
+	nvlist_free(op->lao_errlist);
+	free(op);
+}
+
+/*
+ * Add the filesystems of the snapshots of op to fsset, unless one of them
+ * is already there.
+ */
+static boolean_t
+lzc_async_fs_add(nvlist_t *fsset, lzc_async_op_t *op)
+{
+	char fs[ZFS_MAX_DATASET_NAME_LEN];
+	nvpair_t *elem;
+
+	for (elem = nvlist_next_nvpair(op->lao_snaps, NULL); elem != NULL;
+	    elem = nvlist_next_nvpair(op->lao_snaps, elem)) {
+		(void) strlcpy(fs, nvpair_name(elem), sizeof (fs));
+		fs[strcspn(fs, "@")] = '\0';
+		if (nvlist_exists(fsset, fs))
+			return (B_FALSE);
+	}
+	for (elem = nvlist_next_nvpair(op->lao_snaps, NULL); elem != NULL;
+	    elem = nvlist_next_nvpair(op->lao_snaps, elem)) {
+		(void) strlcpy(fs, nvpair_name(elem), sizeof (fs));
+		fs[strcspn(fs, "@")] = '\0';
+		fnvlist_add_boolean(fsset, fs);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Take the oldest queued request, and any others which can be issued in
+ * the same ioctl, off the queue.
+ */
+static lzc_async_op_t *
+lzc_async_take(lzc_async_t *la)
+{
+	lzc_async_op_t *batch = la->la_pending;
+	lzc_async_op_t **prevp, **tailp, *op;
+	nvlist_t *fsset = NULL;
+	uint_t count;
+
+	la->la_pending = batch->lao_next;
+	if (la->la_pending == NULL)
+		la->la_pending_tailp = &la->la_pending;
+	batch->lao_next = NULL;
+	tailp = &batch->lao_next;
+	count = fnvlist_num_pairs(batch->lao_snaps);
+
+	if (batch->lao_props != NULL)
+		return (batch);
+	if (batch->lao_type == LZC_ASYNC_SNAPSHOT) {
+		fsset = fnvlist_alloc();
+		VERIFY(lzc_async_fs_add(fsset, batch));
+	}
+
+	prevp = &la->la_pending;
+	while ((op = *prevp) != NULL && count < LZC_ASYNC_BATCH_MAX) {
+		if (op->lao_type != batch->lao_type || op->lao_props != NULL ||
+		    op->lao_defer != batch->lao_defer ||
+		    strcmp(op->lao_pool, batch->lao_pool) != 0 ||
+		    (fsset != NULL && !lzc_async_fs_add(fsset, op))) {
+			prevp = &op->lao_next;
+			continue;
+		}
+		*prevp = op->lao_next;
+		op->lao_next = NULL;
+		*tailp = op;
+		tailp = &op->lao_next;
+		count += fnvlist_num_pairs(op->lao_snaps);
+	}
+	if (op == NULL)
+		la->la_pending_tailp = prevp;
+
+	nvlist_free(fsset);
+	return (batch);
+}
+
+static void
+lzc_async_issue(lzc_async_op_t *op, nvlist_t *snaps)
+{
+	if (op->lao_type == LZC_ASYNC_SNAPSHOT) {
+		op->lao_error = lzc_snapshot(snaps, op->lao_props,
+		    &op->lao_errlist);
+	} else {
+		op->lao_error = lzc_destroy_snaps(snaps, op->lao_defer,
+		    &op->lao_errlist);
+	}
+}
+
+static void
+lzc_async_run(lzc_async_op_t *batch)
+{
+	lzc_async_op_t *op;
+	nvlist_t *snaps;
+	nvpair_t *elem;
+
+	if (batch->lao_next == NULL) {
+		lzc_async_issue(batch, batch->lao_snaps);
+		return;
+	}
+
+	snaps = fnvlist_alloc();
+	for (op = batch; op != NULL; op = op->lao_next) {
+		for (elem = nvlist_next_nvpair(op->lao_snaps, NULL);
+		    elem != NULL;
+		    elem = nvlist_next_nvpair(op->lao_snaps, elem))
+			fnvlist_add_boolean(snaps, nvpair_name(elem));
+	}
+	lzc_async_issue(batch, snaps);
+	fnvlist_free(snaps);
+
+	if (batch->lao_error == 0) {
+		nvlist_free(batch->lao_errlist);
+		batch->lao_errlist = NULL;
+		return;
+	}
+
+	/* Find out which of the requests failed */
+	for (op = batch; op != NULL; op = op->lao_next) {
+		nvlist_free(op->lao_errlist);
+		op->lao_errlist = NULL;
+		lzc_async_issue(op, op->lao_snaps);
+	}
+}
+
+static void *
+lzc_async_thread(void *arg)
+{
+	lzc_async_t *la = arg;
+	lzc_async_op_t *batch, *op;
+	char c = 0;
+
+	(void) pthread_mutex_lock(&la->la_lock);
+	for (;;) {
+		while (la->la_pending == NULL && !la->la_exiting)
+			(void) pthread_cond_wait(&la->la_cv, &la->la_lock);
+		if (la->la_pending == NULL)
+			break;
+
+		batch = lzc_async_take(la);
+		(void) pthread_mutex_unlock(&la->la_lock);
+		lzc_async_run(batch);
+
+		while ((op = batch) != NULL) {
+			batch = op->lao_next;
+			if (la->la_flags & LZC_ASYNC_FD) {
+				(void) pthread_mutex_lock(&la->la_lock);
+				op->lao_next = la->la_done;
+				la->la_done = op;
+				(void) pthread_cond_broadcast(&la->la_done_cv);
+				(void) pthread_mutex_unlock(&la->la_lock);
+				(void) write(la->la_pipe[1], &c, 1);
+				continue;
+			}
+			op->lao_cb(op->lao_error, op->lao_errlist,
+			    op->lao_arg);
+			lzc_async_op_free(op);
+			(void) pthread_mutex_lock(&la->la_lock);
+			la->la_outstanding--;
+			(void) pthread_cond_broadcast(&la->la_done_cv);
+			(void) pthread_mutex_unlock(&la->la_lock);
+		}
+		(void) pthread_mutex_lock(&la->la_lock);
+	}
+	(void) pthread_mutex_unlock(&la->la_lock);
+
+	return (NULL);
+}
+
+/*
+ * Create an lzc_async_t running requests on nthreads threads.  Returns
+ * NULL and sets errno on failure.
+ */
+lzc_async_t *
+lzc_async_create(uint_t nthreads, int flags)
+{
+	lzc_async_t *la;
+	int error;
+
+	if (nthreads == 0 || (flags & ~LZC_ASYNC_FD) != 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((la = calloc(1, sizeof (lzc_async_t))) == NULL)
+		return (NULL);
+	if ((la->la_threads = calloc(nthreads, sizeof (pthread_t))) == NULL) {
+		free(la);
+		return (NULL);
+	}
+
+	la->la_flags = flags;
+	la->la_pending_tailp = &la->la_pending;
+	la->la_pipe[0] = la->la_pipe[1] = -1;
+	if ((flags & LZC_ASYNC_FD) &&
+	    pipe2(la->la_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+		free(la->la_threads);
+		free(la);
+		return (NULL);
+	}
+
+	(void) pthread_mutex_init(&la->la_lock, NULL);
+	(void) pthread_cond_init(&la->la_cv, NULL);
+	(void) pthread_cond_init(&la->la_done_cv, NULL);
+	for (; la->la_nthreads < nthreads; la->la_nthreads++) {
+		error = pthread_create(&la->la_threads[la->la_nthreads], NULL,
+		    lzc_async_thread, la);
+		if (error != 0) {
+			lzc_async_free(la);
+			errno = error;
+			return (NULL);
+		}
+	}
+
+	return (la);
+}
+
+/*
+ * Wait for all submitted requests to complete and free the lzc_async_t.
+ */
+void
+lzc_async_free(lzc_async_t *la)
+{
+	lzc_async_wait(la);
+
+	(void) pthread_mutex_lock(&la->la_lock);
+	la->la_exiting = B_TRUE;
+	(void) pthread_cond_broadcast(&la->la_cv);
+	(void) pthread_mutex_unlock(&la->la_lock);
+	for (uint_t i = 0; i < la->la_nthreads; i++)
+		(void) pthread_join(la->la_threads[i], NULL);
+
+	if (la->la_pipe[0] != -1) {
+		(void) close(la->la_pipe[0]);
+		(void) close(la->la_pipe[1]);
+	}
+	(void) pthread_cond_destroy(&la->la_done_cv);
+	(void) pthread_cond_destroy(&la->la_cv);
+	(void) pthread_mutex_destroy(&la->la_lock);
+	free(la->la_threads);
+	free(la);
+}
+
+/*
+ * The descriptor to poll for completions of an LZC_ASYNC_FD lzc_async_t,
+ * or -1.
+ */
+int
+lzc_async_fd(lzc_async_t *la)
+{
+	return (la->la_pipe[0]);
+}
+
+/*
+ * Call the callbacks of the requests which have completed, and return how
+ * many there were.  Only needed with LZC_ASYNC_FD.
+ */
+int
+lzc_async_complete(lzc_async_t *la)
+{
+	lzc_async_op_t *done, *op, *prev = NULL;
+	char buf[64];
+	int n = 0;
+
+	if (!(la->la_flags & LZC_ASYNC_FD))
+		return (0);
+
+	while (read(la->la_pipe[0], buf, sizeof (buf)) > 0)
+		continue;
+
+	(void) pthread_mutex_lock(&la->la_lock);
+	done = la->la_done;
+	la->la_done = NULL;
+	(void) pthread_mutex_unlock(&la->la_lock);
+
+	/* Completions are pushed, so reverse them into completion order */
+	while ((op = done) != NULL) {
+		done = op->lao_next;
+		op->lao_next = prev;
+		prev = op;
+	}
+	while ((op = prev) != NULL) {
+		prev = op->lao_next;
+		op->lao_cb(op->lao_error, op->lao_errlist, op->lao_arg);
+		lzc_async_op_free(op);
+		n++;
+	}
+
+	(void) pthread_mutex_lock(&la->la_lock);
+	la->la_outstanding -= n;
+	(void) pthread_cond_broadcast(&la->la_done_cv);
+	(void) pthread_mutex_unlock(&la->la_lock);
+
+	return (n);
+}
+
+/*
+ * Wait for all submitted requests to complete and their callbacks to
+ * have been called.
+ */
+void
+lzc_async_wait(lzc_async_t *la)
+{
+	(void) pthread_mutex_lock(&la->la_lock);
+	while (la->la_outstanding > 0) {
+		if (la->la_done != NULL) {
+			(void) pthread_mutex_unlock(&la->la_lock);
+			(void) lzc_async_complete(la);
+			(void) pthread_mutex_lock(&la->la_lock);
+			continue;
+		}
+		(void) pthread_cond_wait(&la->la_done_cv, &la->la_lock);
+	}
+	(void) pthread_mutex_unlock(&la->la_lock);
+}
+
+static int
+lzc_async_submit(lzc_async_t *la, lzc_async_type_t type, nvlist_t *snaps,
+    nvlist_t *props, boolean_t defer, lzc_async_cb_t *cb, void *arg)
+{
+	lzc_async_op_t *op;
+	nvpair_t *elem;
+
+	if ((elem = nvlist_next_nvpair(snaps, NULL)) == NULL || cb == NULL)
+		return (EINVAL);
+	if ((op = calloc(1, sizeof (lzc_async_op_t))) == NULL)
+		return (ENOMEM);
+
+	op->lao_type = type;
+	(void) strlcpy(op->lao_pool, nvpair_name(elem), sizeof (op->lao_pool));
+	op->lao_pool[strcspn(op->lao_pool, "/@")] = '\0';
+	op->lao_snaps = fnvlist_dup(snaps);
+	if (props != NULL && !nvlist_empty(props))
+		op->lao_props = fnvlist_dup(props);
+	op->lao_defer = defer;
+	op->lao_cb = cb;
+	op->lao_arg = arg;
+
+	(void) pthread_mutex_lock(&la->la_lock);
+	*la->la_pending_tailp = op;
+	la->la_pending_tailp = &op->lao_next;
+	la->la_outstanding++;
+	(void) pthread_cond_signal(&la->la_cv);
+	(void) pthread_mutex_unlock(&la->la_lock);
+
+	return (0);
+}
+
+/*
+ * Queue the creation of the snapshots in snaps, as by lzc_snapshot().  The
+ * nvlists are copied, so may be freed once this returns.
+ */
+int
+lzc_async_snapshot(lzc_async_t *la, nvlist_t *snaps, nvlist_t *props,
+    lzc_async_cb_t *cb, void *arg)
+{
+	return (lzc_async_submit(la, LZC_ASYNC_SNAPSHOT, snaps, props,
+	    B_FALSE, cb, arg));
+}
+
+/*
+ * Queue the destruction of the snapshots in snaps, as by
+ * lzc_destroy_snaps().  The nvlist is copied, so may be freed once this
+ * returns.
+ */
+int
+lzc_async_destroy_snaps(lzc_async_t *la, nvlist_t *snaps, boolean_t defer,
+    lzc_async_cb_t *cb, void *arg)
+{
+	return (lzc_async_submit(la, LZC_ASYNC_DESTROY_SNAPS, snaps, NULL,
+	    defer, cb, arg));
+}
@@ -154,6 +154,80 @@ taskq_init_ent(taskq_ent_t *t)
 	t->tqent_flags = 0;
 }
 
+/*
+ * Preallocated tasks dispatched to a TASKQ_STEAL taskq are queued on one of
+ * the per-thread queues without taking the tq_lock, unless a thread has to
+ * be woken up.  There is no cheap notion of the current CPU here so the
+ * queues are used in turn.
+ */
+static void
+taskq_ws_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
+    taskq_ent_t *t)
+{
+	taskq_deque_t *tqd;
+
+	tqd = &tq->tq_deques[atomic_inc_32_nv(&tq->tq_ws_next) %
+	    tq->tq_ndeques];
+
+	mutex_enter(&tqd->tqd_lock);
+	if (flags & TQ_FRONT) {
+		t->tqent_next = tqd->tqd_task.tqent_next;
+		t->tqent_prev = &tqd->tqd_task;
+	} else {
+		t->tqent_next = &tqd->tqd_task;
+		t->tqent_prev = tqd->tqd_task.tqent_prev;
+	}
+	t->tqent_next->tqent_prev = t;
+	t->tqent_prev->tqent_next = t;
+	t->tqent_func = func;
+	t->tqent_arg = arg;
+	atomic_inc_32(&tq->tq_ws_queued);
+	mutex_exit(&tqd->tqd_lock);
+
+	/* Pairs with the update of tq_ws_idle in taskq_thread() */
+	if (atomic_add_32_nv(&tq->tq_ws_idle, 0) != 0) {
+		mutex_enter(&tq->tq_lock);
+		cv_signal(&tq->tq_dispatch_cv);
+		mutex_exit(&tq->tq_lock);
+	}
+}
+
+/*
+ * Runs the tasks of the per-thread queues until they are all empty,
+ * starting with the queue of the calling thread.
+ */
+static void
+taskq_ws_run(taskq_t *tq, int self)
+{
+	taskq_deque_t *tqd;
+	taskq_ent_t *t;
+	int i;
+
+	for (i = 0; i < tq->tq_ndeques; ) {
+		tqd = &tq->tq_deques[(self + i) % tq->tq_ndeques];
+
+		mutex_enter(&tqd->tqd_lock);
+		if ((t = tqd->tqd_task.tqent_next) == &tqd->tqd_task) {
+			mutex_exit(&tqd->tqd_lock);
+			i++;
+			continue;
+		}
+		t->tqent_prev->tqent_next = t->tqent_next;
+		t->tqent_next->tqent_prev = t->tqent_prev;
+		t->tqent_next = NULL;
+		t->tqent_prev = NULL;
+		atomic_dec_32(&tq->tq_ws_queued);
+		mutex_exit(&tqd->tqd_lock);
+
+		rw_enter(&tq->tq_threadlock, RW_READER);
+		t->tqent_func(t->tqent_arg);
+		rw_exit(&tq->tq_threadlock);
+
+		/* Check the own queue first again */
+		i = 0;
+	}
+}
+
 void
 taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
     taskq_ent_t *t)
@@ -165,6 +239,12 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 	 * to ensure that we don't free it later.
 	 */
 	t->tqent_flags |= TQENT_FLAG_PREALLOC;
+
+	if (tq->tq_flags & TASKQ_STEAL) {
+		taskq_ws_dispatch_ent(tq, func, arg, flags, t);
+		return;
+	}
+
 	/*
 	 * Enqueue the task to the underlying queue.
 	 */
@@ -189,7 +269,8 @@ void
 taskq_wait(taskq_t *tq)
 {
 	mutex_enter(&tq->tq_lock);
-	while (tq->tq_task.tqent_next != &tq->tq_task || tq->tq_active != 0)
+	while (tq->tq_task.tqent_next != &tq->tq_task || tq->tq_active != 0 ||
+	    atomic_add_32_nv(&tq->tq_ws_queued, 0) != 0)
 		cv_wait(&tq->tq_wait_cv, &tq->tq_lock);
 	mutex_exit(&tq->tq_lock);
 }
@@ -212,13 +293,30 @@ taskq_thread(void *arg)
 	taskq_t *tq = arg;
 	taskq_ent_t *t;
 	boolean_t prealloc;
+	int self = 0;
+
+	if (tq->tq_ndeques != 0)
+		self = atomic_inc_32_nv(&tq->tq_ws_next) % tq->tq_ndeques;
 
 	mutex_enter(&tq->tq_lock);
 	while (tq->tq_flags & TASKQ_ACTIVE) {
+		if (atomic_add_32_nv(&tq->tq_ws_queued, 0) != 0) {
+			mutex_exit(&tq->tq_lock);
+			taskq_ws_run(tq, self);
+			mutex_enter(&tq->tq_lock);
+			continue;
+		}
 		if ((t = tq->tq_task.tqent_next) == &tq->tq_task) {
 			if (--tq->tq_active == 0)
 				cv_broadcast(&tq->tq_wait_cv);
-			cv_wait(&tq->tq_dispatch_cv, &tq->tq_lock);
+			/*
+			 * Tasks are queued on the per-thread queues without
+			 * the tq_lock, recheck once counted as idle.
+			 */
+			atomic_inc_32(&tq->tq_ws_idle);
+			if (atomic_add_32_nv(&tq->tq_ws_queued, 0) == 0)
+				cv_wait(&tq->tq_dispatch_cv, &tq->tq_lock);
+			atomic_dec_32(&tq->tq_ws_idle);
 			tq->tq_active++;
 			continue;
 		}
@@ -280,6 +378,19 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 	tq->tq_threadlist = kmem_alloc(nthreads * sizeof (kthread_t *),
 	    KM_SLEEP);
 
+	if (flags & TASKQ_STEAL) {
+		tq->tq_ndeques = nthreads;
+		tq->tq_deques = kmem_zalloc(nthreads * sizeof (taskq_deque_t),
+		    KM_SLEEP);
+		for (t = 0; t < nthreads; t++) {
+			taskq_deque_t *tqd = &tq->tq_deques[t];
+
+			mutex_init(&tqd->tqd_lock, NULL, MUTEX_DEFAULT, NULL);
+			tqd->tqd_task.tqent_next = &tqd->tqd_task;
+			tqd->tqd_task.tqent_prev = &tqd->tqd_task;
+		}
+	}
+
 	if (flags & TASKQ_PREPOPULATE) {
 		mutex_enter(&tq->tq_lock);
 		while (minalloc-- > 0)
@@ -319,6 +430,13 @@ taskq_destroy(taskq_t *tq)
 
 	kmem_free(tq->tq_threadlist, nthreads * sizeof (kthread_t *));
 
+	for (int i = 0; i < tq->tq_ndeques; i++)
+		mutex_destroy(&tq->tq_deques[i].tqd_lock);
+	if (tq->tq_deques != NULL) {
+		kmem_free(tq->tq_deques,
+		    tq->tq_ndeques * sizeof (taskq_deque_t));
+	}
+
 	rw_destroy(&tq->tq_threadlock);
 	mutex_destroy(&tq->tq_lock);
 	cv_destroy(&tq->tq_dispatch_cv);
@@ -46,6 +46,7 @@
  * using our derived config, and record the results.
  */
 
+#include <aio.h>
 #include <ctype.h>
 #include <devid.h>
 #include <dirent.h>
@@ -1374,6 +1375,57 @@ label_offset(uint64_t size, int l)
 	    0 : size - VDEV_LABELS * sizeof (vdev_label_t)));
 }
 
+/*
+ * Read all the labels of the device into the labels array, returning the
+ * number of bytes read for each of them in nread.  The reads are issued
+ * concurrently, as the two labels at the end of the device are usually far
+ * from the two at its start, falling back to reading them one at a time if
+ * the asynchronous reads cannot be issued.
+ */
+static void
+read_labels(int fd, uint64_t size, vdev_label_t *labels, ssize_t *nread)
+{
+	struct aiocb aiocbs[VDEV_LABELS];
+	struct aiocb *aiocbps[VDEV_LABELS];
+	int l;
+
+	memset(aiocbs, 0, sizeof (aiocbs));
+	for (l = 0; l < VDEV_LABELS; l++) {
+		aiocbs[l].aio_fildes = fd;
+		aiocbs[l].aio_offset = label_offset(size, l);
+		aiocbs[l].aio_buf = &labels[l];
+		aiocbs[l].aio_nbytes = sizeof (vdev_label_t);
+		aiocbs[l].aio_lio_opcode = LIO_READ;
+		aiocbps[l] = &aiocbs[l];
+	}
+
+	if (lio_listio(LIO_WAIT, aiocbps, VDEV_LABELS, NULL) == 0) {
+		for (l = 0; l < VDEV_LABELS; l++)
+			nread[l] = aio_return(&aiocbs[l]);
+		return;
+	}
+
+	/*
+	 * Some of the reads may have been issued, and have to be reaped
+	 * before their control blocks go out of scope.
+	 */
+	if (errno == EAGAIN || errno == EINTR || errno == EIO) {
+		for (l = 0; l < VDEV_LABELS; l++) {
+			while (aio_error(&aiocbs[l]) == EINPROGRESS) {
+				const struct aiocb *list[1] = { &aiocbs[l] };
+				(void) aio_suspend(list, 1, NULL);
+			}
+			if (aio_error(&aiocbs[l]) != EINVAL)
+				(void) aio_return(&aiocbs[l]);
+		}
+	}
+
+	for (l = 0; l < VDEV_LABELS; l++) {
+		nread[l] = pread64(fd, &labels[l], sizeof (vdev_label_t),
+		    label_offset(size, l));
+	}
+}
+
 /*
  * Given a file descriptor, read the label information and return an nvlist
  * describing the configuration, if there is one.  The number of valid
@@ -1384,7 +1436,8 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 {
 	struct stat64 statbuf;
 	int l, count = 0;
-	vdev_label_t *label;
+	vdev_label_t *labels, *label;
+	ssize_t nread[VDEV_LABELS];
 	nvlist_t *expected_config = NULL;
 	uint64_t expected_guid = 0, size;
 	int error;
@@ -1395,17 +1448,21 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 		return (0);
 	size = P2ALIGN_TYPED(statbuf.st_size, sizeof (vdev_label_t), uint64_t);
 
-	error = posix_memalign((void **)&label, PAGESIZE, sizeof (*label));
+	error = posix_memalign((void **)&labels, PAGESIZE,
+	    VDEV_LABELS * sizeof (*labels));
 	if (error)
 		return (-1);
 
+	read_labels(fd, size, labels, nread);
+
 	for (l = 0; l < VDEV_LABELS; l++) {
 		uint64_t state, guid, txg;
 
-		if (pread64(fd, label, sizeof (vdev_label_t),
-		    label_offset(size, l)) != sizeof (vdev_label_t))
+		if (nread[l] != sizeof (vdev_label_t))
 			continue;
 
+		label = &labels[l];
+
 		if (nvlist_unpack(label->vl_vdev_phys.vp_nvlist,
 		    sizeof (label->vl_vdev_phys.vp_nvlist), config, 0) != 0)
 			continue;
@@ -1444,7 +1501,7 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 	if (num_labels != NULL)
 		*num_labels = count;
 
-	free(label);
+	free(labels);
 	*config = expected_config;
 
 	return (0);
@@ -1566,6 +1623,60 @@ label_paths(libpc_handle_t *hdl, nvlist_t *label, char **path, char **devid)
 	    devid));
 }
 
+static boolean_t
+dir_is_empty(const char *dirname)
+{
+	struct dirent64 *dp;
+	DIR *dirp;
+
+	if ((dirp = opendir(dirname)) == NULL)
+		return (B_TRUE);
+
+	while ((dp = readdir64(dirp)) != NULL) {
+		if (strcmp(dp->d_name, ".") != 0 &&
+		    strcmp(dp->d_name, "..") != 0) {
+			(void) closedir(dirp);
+			return (B_FALSE);
+		}
+	}
+
+	(void) closedir(dirp);
+	return (B_TRUE);
+}
+
+/*
+ * Returns B_TRUE if the block device, or the whole disk of a partition, is
+ * held by another block device such as a multipath device.  Its label will
+ * also be found through the holder, so reading it through each of the paths
+ * of a multipath device would only find duplicates of the same vdev, which
+ * could not be opened exclusively anyway.
+ */
+static boolean_t
+zpool_dev_is_held(const char *path)
+{
+	char devpath[MAXPATHLEN], syspath[MAXPATHLEN], buf[MAXPATHLEN];
+	char *name;
+
+	if (realpath(path, devpath) == NULL ||
+	    (name = strrchr(devpath, '/')) == NULL)
+		return (B_FALSE);
+
+	(void) snprintf(buf, sizeof (buf), "/sys/class/block/%s", name + 1);
+	if (realpath(buf, syspath) == NULL)
+		return (B_FALSE);
+
+	(void) snprintf(buf, sizeof (buf), "%s/holders", syspath);
+	if (!dir_is_empty(buf))
+		return (B_TRUE);
+
+	(void) snprintf(buf, sizeof (buf), "%s/partition", syspath);
+	if (access(buf, F_OK) != 0)
+		return (B_FALSE);
+
+	(void) snprintf(buf, sizeof (buf), "%s/../holders", syspath);
+	return (!dir_is_empty(buf));
+}
+
 static void
 zpool_open_func(void *arg)
 {
@@ -1600,6 +1711,9 @@ zpool_open_func(void *arg)
 	    (!S_ISREG(statbuf.st_mode) && !S_ISBLK(statbuf.st_mode)))
 		return;
 
+	if (S_ISBLK(statbuf.st_mode) && zpool_dev_is_held(rn->rn_name))
+		return;
+
 	/*
 	 * Preferentially open using O_DIRECT to bypass the block device
 	 * cache which may be stale for multipath devices.  An EINVAL errno
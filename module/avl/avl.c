@@ -639,6 +639,61 @@ avl_add(avl_tree_t *tree, void *new_node)
 	avl_insert(tree, new_node, where);
 }
 
+/*
+ * Build the subtree of the numnodes sorted nodes as the given child of parent
+ * and return its root.  The middle node becomes the root and the halves on
+ * either side its subtrees, so the left subtree is never smaller than the
+ * right, and their heights differ by at most one.
+ */
+static avl_node_t *
+avl_build_subtree(avl_tree_t *tree, void **nodes, ulong_t numnodes,
+    avl_node_t *parent, int which)
+{
+	ulong_t left = numnodes / 2;
+	ulong_t right = numnodes - left - 1;
+	int lheight = 0, rheight = 0;
+	avl_node_t *node;
+
+	if (numnodes == 0)
+		return (NULL);
+
+	/* a subtree of n nodes built like this is highbit(n) high */
+	for (ulong_t n = left; n != 0; n >>= 1)
+		lheight++;
+	for (ulong_t n = right; n != 0; n >>= 1)
+		rheight++;
+
+	node = AVL_DATA2NODE(nodes[left], tree->avl_offset);
+	AVL_SETPARENT(node, parent);
+	AVL_SETCHILD(node, which);
+	AVL_SETBALANCE(node, rheight - lheight);
+	node->avl_child[0] = avl_build_subtree(tree, nodes, left, node, 0);
+	node->avl_child[1] = avl_build_subtree(tree, nodes + left + 1, right,
+	    node, 1);
+
+	return (node);
+}
+
+/*
+ * Fill an empty tree from an array of nodes in ascending order.  As the
+ * order is known there are no comparisons and no rotations: the tree is
+ * built perfectly balanced in one pass over the array.
+ */
+void
+avl_build_sorted(avl_tree_t *tree, void **nodes, ulong_t numnodes)
+{
+	ASSERT(tree != NULL);
+	ASSERT(tree->avl_root == NULL);
+	ASSERT0(tree->avl_numnodes);
+#ifdef DEBUG
+	for (ulong_t i = 1; i < numnodes; i++)
+		ASSERT(tree->avl_compar(nodes[i - 1], nodes[i]) < 0);
+#endif
+
+	tree->avl_root = avl_build_subtree(tree, nodes, numnodes, NULL, 0);
+	tree->avl_numnodes = numnodes;
+}
+
 /*
  * Delete a node from the AVL tree.  Deletion is similar to insertion, but
  * with 2 complications.
@@ -1023,6 +1078,7 @@ EXPORT_SYMBOL(avl_first);
 EXPORT_SYMBOL(avl_last);
 EXPORT_SYMBOL(avl_nearest);
 EXPORT_SYMBOL(avl_add);
+EXPORT_SYMBOL(avl_build_sorted);
 EXPORT_SYMBOL(avl_swap);
 EXPORT_SYMBOL(avl_is_empty);
 EXPORT_SYMBOL(avl_remove);
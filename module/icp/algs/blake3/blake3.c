@@ -0,0 +1,497 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * BLAKE3 hashing, derived from the public domain reference implementation.
+ *
+ * The input is split into 1 KiB chunks which form the leaves of a binary
+ * tree.  Runs of whole chunks are hashed in parallel by the selected
+ * implementation, the chaining values of completed subtrees are kept on a
+ * stack and merged into their parents once it is known that they are not
+ * the root of the tree.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/blake3.h>
+#include <blake3/blake3_impl.h>
+
+/*
+ * Output of a compression whose chaining value or root bytes have not
+ * been computed yet.
+ */
+typedef struct blake3_output {
+	uint32_t	input_cv[8];
+	uint64_t	counter;
+	uint8_t		block[BLAKE3_BLOCK_LEN];
+	uint8_t		block_len;
+	uint8_t		flags;
+} blake3_output_t;
+
+static inline void
+store_cv_words(uint8_t bytes_out[BLAKE3_OUT_LEN], const uint32_t cv[8])
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		bytes_out[4 * i + 0] = (uint8_t)(cv[i] >> 0);
+		bytes_out[4 * i + 1] = (uint8_t)(cv[i] >> 8);
+		bytes_out[4 * i + 2] = (uint8_t)(cv[i] >> 16);
+		bytes_out[4 * i + 3] = (uint8_t)(cv[i] >> 24);
+	}
+}
+
+static inline void
+load_key_words(const uint8_t key[BLAKE3_KEY_LEN], uint32_t key_words[8])
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		key_words[i] = ((uint32_t)key[4 * i + 0] << 0) |
+		    ((uint32_t)key[4 * i + 1] << 8) |
+		    ((uint32_t)key[4 * i + 2] << 16) |
+		    ((uint32_t)key[4 * i + 3] << 24);
+	}
+}
+
+static inline uint64_t
+round_down_to_power_of_2(uint64_t x)
+{
+	while ((x & (x - 1)) != 0)
+		x &= x - 1;
+
+	return (x);
+}
+
+static inline size_t
+popcount64(uint64_t x)
+{
+	size_t count = 0;
+
+	for (; x != 0; x &= x - 1)
+		count++;
+
+	return (count);
+}
+
+static void
+chunk_state_init(blake3_chunk_state_t *cs, const uint32_t key[8],
+    uint8_t flags)
+{
+	memcpy(cs->cv, key, BLAKE3_KEY_LEN);
+	cs->chunk_counter = 0;
+	bzero(cs->buf, BLAKE3_BLOCK_LEN);
+	cs->buf_len = 0;
+	cs->blocks_compressed = 0;
+	cs->flags = flags;
+}
+
+static void
+chunk_state_reset(blake3_chunk_state_t *cs, const uint32_t key[8],
+    uint64_t chunk_counter)
+{
+	memcpy(cs->cv, key, BLAKE3_KEY_LEN);
+	cs->chunk_counter = chunk_counter;
+	cs->blocks_compressed = 0;
+	bzero(cs->buf, BLAKE3_BLOCK_LEN);
+	cs->buf_len = 0;
+}
+
+static inline size_t
+chunk_state_len(const blake3_chunk_state_t *cs)
+{
+	return ((BLAKE3_BLOCK_LEN * (size_t)cs->blocks_compressed) +
+	    ((size_t)cs->buf_len));
+}
+
+static size_t
+chunk_state_fill_buf(blake3_chunk_state_t *cs, const uint8_t *input,
+    size_t input_len)
+{
+	size_t take = MIN(BLAKE3_BLOCK_LEN - (size_t)cs->buf_len, input_len);
+
+	memcpy(&cs->buf[cs->buf_len], input, take);
+	cs->buf_len += (uint8_t)take;
+
+	return (take);
+}
+
+static inline uint8_t
+chunk_state_maybe_start_flag(const blake3_chunk_state_t *cs)
+{
+	return (cs->blocks_compressed == 0 ? BLAKE3_CHUNK_START : 0);
+}
+
+static void
+chunk_state_update(blake3_chunk_state_t *cs, const uint8_t *input,
+    size_t input_len)
+{
+	size_t take;
+
+	if (cs->buf_len > 0) {
+		take = chunk_state_fill_buf(cs, input, input_len);
+		input += take;
+		input_len -= take;
+		if (input_len > 0) {
+			blake3_compress_in_place_generic(cs->cv, cs->buf,
+			    BLAKE3_BLOCK_LEN, cs->chunk_counter,
+			    cs->flags | chunk_state_maybe_start_flag(cs));
+			cs->blocks_compressed += 1;
+			cs->buf_len = 0;
+			bzero(cs->buf, BLAKE3_BLOCK_LEN);
+		}
+	}
+
+	/* The last block is kept, it may need the CHUNK_END flag */
+	while (input_len > BLAKE3_BLOCK_LEN) {
+		blake3_compress_in_place_generic(cs->cv, input,
+		    BLAKE3_BLOCK_LEN, cs->chunk_counter,
+		    cs->flags | chunk_state_maybe_start_flag(cs));
+		cs->blocks_compressed += 1;
+		input += BLAKE3_BLOCK_LEN;
+		input_len -= BLAKE3_BLOCK_LEN;
+	}
+
+	(void) chunk_state_fill_buf(cs, input, input_len);
+}
+
+static void
+make_output(blake3_output_t *out, const uint32_t input_cv[8],
+    const uint8_t block[BLAKE3_BLOCK_LEN], uint8_t block_len,
+    uint64_t counter, uint8_t flags)
+{
+	memcpy(out->input_cv, input_cv, sizeof (out->input_cv));
+	memcpy(out->block, block, BLAKE3_BLOCK_LEN);
+	out->block_len = block_len;
+	out->counter = counter;
+	out->flags = flags;
+}
+
+static void
+chunk_state_output(const blake3_chunk_state_t *cs, blake3_output_t *out)
+{
+	uint8_t block_flags =
+	    cs->flags | chunk_state_maybe_start_flag(cs) | BLAKE3_CHUNK_END;
+
+	make_output(out, cs->cv, cs->buf, cs->buf_len, cs->chunk_counter,
+	    block_flags);
+}
+
+static void
+parent_output(blake3_output_t *out, const uint8_t block[BLAKE3_BLOCK_LEN],
+    const uint32_t key[8], uint8_t flags)
+{
+	make_output(out, key, block, BLAKE3_BLOCK_LEN, 0,
+	    flags | BLAKE3_PARENT);
+}
+
+static void
+output_chaining_value(const blake3_output_t *out, uint8_t cv[BLAKE3_OUT_LEN])
+{
+	uint32_t cv_words[8];
+
+	memcpy(cv_words, out->input_cv, sizeof (cv_words));
+	blake3_compress_in_place_generic(cv_words, out->block, out->block_len,
+	    out->counter, out->flags);
+	store_cv_words(cv, cv_words);
+}
+
+static void
+output_root_bytes(const blake3_output_t *out, uint64_t seek, uint8_t *buf,
+    size_t len)
+{
+	uint64_t output_block_counter = seek / 64;
+	size_t offset_within_block = seek % 64;
+	uint8_t wide_buf[64];
+
+	while (len > 0) {
+		size_t available = 64 - offset_within_block;
+		size_t memcpy_len = MIN(len, available);
+
+		blake3_compress_xof_generic(out->input_cv, out->block,
+		    out->block_len, output_block_counter,
+		    out->flags | BLAKE3_ROOT, wide_buf);
+		memcpy(buf, &wide_buf[offset_within_block], memcpy_len);
+		buf += memcpy_len;
+		len -= memcpy_len;
+		output_block_counter++;
+		offset_within_block = 0;
+	}
+}
+
+/*
+ * Hashes pairs of chaining values into their parents.  Returns the number
+ * of chaining values written to out.
+ */
+static size_t
+compress_parents_parallel(const blake3_impl_ops_t *ops,
+    const uint8_t *child_cvs, size_t num_cvs, const uint32_t key[8],
+    uint8_t flags, uint8_t *out)
+{
+	const uint8_t *parents[BLAKE3_MAX_SIMD_DEGREE];
+	size_t num_parents = 0;
+
+	ASSERT0(num_cvs % 2);
+	ASSERT3U(num_cvs / 2, <=, BLAKE3_MAX_SIMD_DEGREE);
+
+	while (num_cvs - 2 * num_parents >= 2) {
+		parents[num_parents] =
+		    &child_cvs[2 * num_parents * BLAKE3_OUT_LEN];
+		num_parents += 1;
+	}
+
+	ops->hash_many(parents, num_parents, 1, key, 0, B_FALSE,
+	    flags | BLAKE3_PARENT, 0, 0, out);
+
+	return (num_parents);
+}
+
+/*
+ * Hashes a subtree of num_chunks whole chunks, a power of two no larger
+ * than the degree of the implementation, down to the two chaining values
+ * of the children of its root.  The root itself is not computed since it
+ * may need the ROOT flag.
+ */
+static void
+compress_subtree_to_parent_node(const blake3_impl_ops_t *ops,
+    const uint8_t *input, size_t num_chunks, const uint32_t key[8],
+    uint64_t chunk_counter, uint8_t flags, uint8_t out[2 * BLAKE3_OUT_LEN])
+{
+	const uint8_t *chunks[BLAKE3_MAX_SIMD_DEGREE];
+	uint8_t cv_array[BLAKE3_MAX_SIMD_DEGREE * BLAKE3_OUT_LEN];
+	uint8_t out_array[BLAKE3_MAX_SIMD_DEGREE * BLAKE3_OUT_LEN / 2];
+	size_t num_cvs = num_chunks;
+	size_t i;
+
+	ASSERT3U(num_chunks, >=, 2);
+	ASSERT3U(num_chunks, <=, BLAKE3_MAX_SIMD_DEGREE);
+	ASSERT(ISP2(num_chunks));
+
+	for (i = 0; i < num_chunks; i++)
+		chunks[i] = &input[i * BLAKE3_CHUNK_LEN];
+
+	ops->hash_many(chunks, num_chunks, BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN,
+	    key, chunk_counter, B_TRUE, flags, BLAKE3_CHUNK_START,
+	    BLAKE3_CHUNK_END, cv_array);
+
+	while (num_cvs > 2) {
+		num_cvs = compress_parents_parallel(ops, cv_array, num_cvs,
+		    key, flags, out_array);
+		memcpy(cv_array, out_array, num_cvs * BLAKE3_OUT_LEN);
+	}
+
+	memcpy(out, cv_array, 2 * BLAKE3_OUT_LEN);
+}
+
+/*
+ * Merges the chaining values on the stack into their parents until the
+ * stack holds one entry per set bit of total_chunks.  The merge is done
+ * lazily, when more input arrives, since the last parent must be
+ * finalized with the ROOT flag instead.
+ */
+static void
+hasher_merge_cv_stack(BLAKE3_CTX *ctx, uint64_t total_chunks)
+{
+	size_t post_merge_stack_len = popcount64(total_chunks);
+	blake3_output_t output;
+	uint8_t *parent_node;
+
+	while (ctx->cv_stack_len > post_merge_stack_len) {
+		parent_node =
+		    &ctx->cv_stack[(ctx->cv_stack_len - 2) * BLAKE3_OUT_LEN];
+		parent_output(&output, parent_node, ctx->key, ctx->chunk.flags);
+		output_chaining_value(&output, parent_node);
+		ctx->cv_stack_len -= 1;
+	}
+}
+
+static void
+hasher_push_cv(BLAKE3_CTX *ctx, const uint8_t new_cv[BLAKE3_OUT_LEN],
+    uint64_t chunk_counter)
+{
+	hasher_merge_cv_stack(ctx, chunk_counter);
+	ASSERT3U(ctx->cv_stack_len, <=, BLAKE3_MAX_DEPTH);
+	memcpy(&ctx->cv_stack[ctx->cv_stack_len * BLAKE3_OUT_LEN], new_cv,
+	    BLAKE3_OUT_LEN);
+	ctx->cv_stack_len += 1;
+}
+
+static void
+hasher_init_base(BLAKE3_CTX *ctx, const uint32_t key[8], uint8_t flags)
+{
+	memcpy(ctx->key, key, BLAKE3_KEY_LEN);
+	chunk_state_init(&ctx->chunk, key, flags);
+	ctx->cv_stack_len = 0;
+}
+
+void
+Blake3_Init(BLAKE3_CTX *ctx)
+{
+	hasher_init_base(ctx, blake3_iv, 0);
+}
+
+/*
+ * Keyed hashing, used to compute salted checksums.
+ */
+void
+Blake3_InitKeyed(BLAKE3_CTX *ctx, const uint8_t key[BLAKE3_KEY_LEN])
+{
+	uint32_t key_words[8];
+
+	load_key_words(key, key_words);
+	hasher_init_base(ctx, key_words, BLAKE3_KEYED_HASH);
+}
+
+void
+Blake3_Update(BLAKE3_CTX *ctx, const void *input, size_t input_len)
+{
+	const blake3_impl_ops_t *ops = blake3_impl_get_ops();
+	const uint8_t *input_bytes = (const uint8_t *)input;
+	blake3_output_t output;
+	uint8_t chunk_cv[BLAKE3_OUT_LEN];
+	uint8_t cv_pair[2 * BLAKE3_OUT_LEN];
+	size_t max_subtree_len;
+
+	if (input_len == 0)
+		return;
+
+	/* Complete the partial chunk left by the previous call, if any */
+	if (chunk_state_len(&ctx->chunk) > 0) {
+		size_t take = BLAKE3_CHUNK_LEN - chunk_state_len(&ctx->chunk);
+
+		take = MIN(take, input_len);
+		chunk_state_update(&ctx->chunk, input_bytes, take);
+		input_bytes += take;
+		input_len -= take;
+		if (input_len == 0)
+			return;
+
+		chunk_state_output(&ctx->chunk, &output);
+		output_chaining_value(&output, chunk_cv);
+		hasher_push_cv(ctx, chunk_cv, ctx->chunk.chunk_counter);
+		chunk_state_reset(&ctx->chunk, ctx->key,
+		    ctx->chunk.chunk_counter + 1);
+	}
+
+	/*
+	 * Hash whole subtrees while more than a chunk of input remains; the
+	 * last chunk is kept in the chunk state since it may be the root.
+	 * A subtree must be a power of two chunks which is aligned to its
+	 * size within the input.  Subtrees are limited to what the
+	 * implementation can hash in a single pass, larger ones are built
+	 * by merging the chaining values on the stack.
+	 */
+	max_subtree_len = MAX(ops->degree, 2) * BLAKE3_CHUNK_LEN;
+	while (input_len > BLAKE3_CHUNK_LEN) {
+		uint64_t subtree_len = round_down_to_power_of_2(input_len);
+		uint64_t count_so_far =
+		    ctx->chunk.chunk_counter * BLAKE3_CHUNK_LEN;
+		uint64_t subtree_chunks;
+
+		subtree_len = MIN(subtree_len, max_subtree_len);
+		while (((subtree_len - 1) & count_so_far) != 0)
+			subtree_len /= 2;
+		subtree_chunks = subtree_len / BLAKE3_CHUNK_LEN;
+
+		if (subtree_len <= BLAKE3_CHUNK_LEN) {
+			blake3_chunk_state_t chunk_state;
+
+			chunk_state_init(&chunk_state, ctx->key,
+			    ctx->chunk.flags);
+			chunk_state.chunk_counter = ctx->chunk.chunk_counter;
+			chunk_state_update(&chunk_state, input_bytes,
+			    subtree_len);
+			chunk_state_output(&chunk_state, &output);
+			output_chaining_value(&output, chunk_cv);
+			hasher_push_cv(ctx, chunk_cv, ctx->chunk.chunk_counter);
+		} else {
+			compress_subtree_to_parent_node(ops, input_bytes,
+			    subtree_chunks, ctx->key, ctx->chunk.chunk_counter,
+			    ctx->chunk.flags, cv_pair);
+			hasher_push_cv(ctx, cv_pair, ctx->chunk.chunk_counter);
+			hasher_push_cv(ctx, &cv_pair[BLAKE3_OUT_LEN],
+			    ctx->chunk.chunk_counter + (subtree_chunks / 2));
+		}
+		ctx->chunk.chunk_counter += subtree_chunks;
+		input_bytes += subtree_len;
+		input_len -= subtree_len;
+	}
+
+	if (input_len > 0) {
+		chunk_state_update(&ctx->chunk, input_bytes, input_len);
+		hasher_merge_cv_stack(ctx, ctx->chunk.chunk_counter);
+	}
+}
+
+/*
+ * Produces len bytes of extended output starting at byte seek.
+ */
+void
+Blake3_FinalSeek(const BLAKE3_CTX *ctx, uint64_t seek, uint8_t *out,
+    size_t len)
+{
+	blake3_output_t output;
+	uint8_t parent_block[BLAKE3_BLOCK_LEN];
+	size_t cvs_remaining;
+
+	if (len == 0)
+		return;
+
+	/* If the subtree stack is empty the root is the current chunk */
+	if (ctx->cv_stack_len == 0) {
+		chunk_state_output(&ctx->chunk, &output);
+		output_root_bytes(&output, seek, out, len);
+		return;
+	}
+
+	/*
+	 * Otherwise merge the current chunk, or the two topmost subtrees
+	 * when no partial chunk is pending, with everything on the stack.
+	 */
+	if (chunk_state_len(&ctx->chunk) > 0) {
+		cvs_remaining = ctx->cv_stack_len;
+		chunk_state_output(&ctx->chunk, &output);
+	} else {
+		cvs_remaining = ctx->cv_stack_len - 2;
+		parent_output(&output, &ctx->cv_stack[cvs_remaining *
+		    BLAKE3_OUT_LEN], ctx->key, ctx->chunk.flags);
+	}
+
+	while (cvs_remaining > 0) {
+		cvs_remaining -= 1;
+		memcpy(parent_block, &ctx->cv_stack[cvs_remaining *
+		    BLAKE3_OUT_LEN], BLAKE3_OUT_LEN);
+		output_chaining_value(&output, &parent_block[BLAKE3_OUT_LEN]);
+		parent_output(&output, parent_block, ctx->key,
+		    ctx->chunk.flags);
+	}
+
+	output_root_bytes(&output, seek, out, len);
+}
+
+/*
+ * Produces the BLAKE3_OUT_LEN byte digest.  The context is left unchanged
+ * and more input may be added afterwards.
+ */
+void
+Blake3_Final(const BLAKE3_CTX *ctx, uint8_t *out)
+{
+	Blake3_FinalSeek(ctx, 0, out, BLAKE3_OUT_LEN);
+}
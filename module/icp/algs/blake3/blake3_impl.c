@@ -0,0 +1,294 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/crypto/icp.h>
+#include <blake3/blake3_impl.h>
+#include <linux/simd.h>
+
+/*
+ * Only the bulk hashing of whole chunks and of parent nodes is done by
+ * the selected implementation.  Since each implementation hashes more
+ * inputs in parallel than the previous one, the widest supported
+ * implementation is selected as the fastest without running a benchmark.
+ */
+
+/* All compiled in implementations, ordered by increasing degree */
+static const blake3_impl_ops_t *blake3_all_impl[] = {
+	&blake3_generic_impl,
+#if defined(__x86_64) && defined(HAVE_SSE2)
+	&blake3_sse2_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_SSE4_1)
+	&blake3_sse41_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_SSE4_1) && defined(HAVE_AVX2)
+	&blake3_avx2_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_SSE4_1) && defined(HAVE_AVX2) && \
+	defined(HAVE_AVX512F)
+	&blake3_avx512_impl,
+#endif
+#if defined(__aarch64__) && defined(_LITTLE_ENDIAN)
+	&blake3_neon_impl,
+#endif
+};
+
+/* Indicate that implementation selection is complete */
+static boolean_t blake3_impl_initialized = B_FALSE;
+
+/* Select blake3 implementation */
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX-1)
+
+#define	BLAKE3_IMPL_READ(i) (*(volatile uint32_t *) &(i))
+
+/* Implementation that contains the fastest methods */
+static const blake3_impl_ops_t *blake3_fastest_impl = &blake3_generic_impl;
+
+/* Hold all supported implementations */
+static size_t blake3_supp_impl_cnt = 0;
+static const blake3_impl_ops_t *blake3_supp_impl[ARRAY_SIZE(blake3_all_impl)];
+
+static uint32_t icp_blake3_impl = IMPL_FASTEST;
+static uint32_t user_sel_impl = IMPL_FASTEST;
+
+/*
+ * Returns the implementation to use.  Until the supported implementations
+ * are known, or when a SIMD implementation is not allowed in the current
+ * context, the generic implementation is used.
+ */
+const blake3_impl_ops_t *
+blake3_impl_get_ops(void)
+{
+	if (!blake3_impl_initialized || !kfpu_allowed())
+		return (&blake3_generic_impl);
+
+	const blake3_impl_ops_t *ops = NULL;
+	const uint32_t impl = BLAKE3_IMPL_READ(icp_blake3_impl);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		ops = blake3_fastest_impl;
+		break;
+	case IMPL_CYCLE:
+		/* Cycle through supported implementations */
+		ASSERT3U(blake3_supp_impl_cnt, >, 0);
+		static size_t cycle_impl_idx = 0;
+		size_t idx = (++cycle_impl_idx) % blake3_supp_impl_cnt;
+		ops = blake3_supp_impl[idx];
+		break;
+	default:
+		ASSERT3U(impl, <, blake3_supp_impl_cnt);
+		ASSERT3U(blake3_supp_impl_cnt, >, 0);
+		if (impl < blake3_supp_impl_cnt)
+			ops = blake3_supp_impl[impl];
+		break;
+	}
+
+	ASSERT3P(ops, !=, NULL);
+
+	return (ops);
+}
+
+/*
+ * Initialize all supported implementations.
+ */
+void
+blake3_impl_init(void)
+{
+	const blake3_impl_ops_t *curr_impl;
+	int i, c;
+
+	/* Move supported implementations into blake3_supp_impl */
+	for (i = 0, c = 0; i < ARRAY_SIZE(blake3_all_impl); i++) {
+		curr_impl = blake3_all_impl[i];
+
+		if (curr_impl->is_supported())
+			blake3_supp_impl[c++] = curr_impl;
+	}
+	blake3_supp_impl_cnt = c;
+	blake3_fastest_impl = blake3_supp_impl[c - 1];
+
+	/* Finish initialization */
+	atomic_swap_32(&icp_blake3_impl, user_sel_impl);
+	membar_producer();
+	blake3_impl_initialized = B_TRUE;
+}
+
+void
+blake3_impl_fini(void)
+{
+	blake3_impl_initialized = B_FALSE;
+}
+
+int
+blake3_mod_init(void)
+{
+	blake3_impl_init();
+	return (0);
+}
+
+int
+blake3_mod_fini(void)
+{
+	blake3_impl_fini();
+	return (0);
+}
+
+/*
+ * Returns the number of supported implementations.
+ */
+uint32_t
+blake3_impl_getcnt(void)
+{
+	return (blake3_supp_impl_cnt);
+}
+
+/*
+ * Returns the name of supported implementation id, or NULL.
+ */
+const char *
+blake3_impl_getname(uint32_t id)
+{
+	if (id >= blake3_supp_impl_cnt)
+		return (NULL);
+
+	return (blake3_supp_impl[id]->name);
+}
+
+/*
+ * Selects supported implementation id.
+ */
+int
+blake3_impl_setid(uint32_t id)
+{
+	if (!blake3_impl_initialized || id >= blake3_supp_impl_cnt)
+		return (-EINVAL);
+
+	atomic_swap_32(&icp_blake3_impl, id);
+	return (0);
+}
+
+static const struct {
+	char *name;
+	uint32_t sel;
+} blake3_impl_opts[] = {
+		{ "cycle",	IMPL_CYCLE },
+		{ "fastest",	IMPL_FASTEST },
+};
+
+/*
+ * Function sets desired blake3 implementation.
+ *
+ * If we are called before init(), user preference will be saved in
+ * user_sel_impl, and applied in later init() call. This occurs when module
+ * parameter is specified on module load. Otherwise, directly update
+ * icp_blake3_impl.
+ *
+ * @val		Name of blake3 implementation to use
+ */
+int
+blake3_impl_set(const char *val)
+{
+	int err = -EINVAL;
+	char req_name[BLAKE3_IMPL_NAME_MAX];
+	uint32_t impl = BLAKE3_IMPL_READ(user_sel_impl);
+	size_t i;
+
+	/* sanitize input */
+	i = strnlen(val, BLAKE3_IMPL_NAME_MAX);
+	if (i == 0 || i >= BLAKE3_IMPL_NAME_MAX)
+		return (err);
+
+	strlcpy(req_name, val, BLAKE3_IMPL_NAME_MAX);
+	while (i > 0 && isspace(req_name[i-1]))
+		i--;
+	req_name[i] = '\0';
+
+	/* Check mandatory options */
+	for (i = 0; i < ARRAY_SIZE(blake3_impl_opts); i++) {
+		if (strcmp(req_name, blake3_impl_opts[i].name) == 0) {
+			impl = blake3_impl_opts[i].sel;
+			err = 0;
+			break;
+		}
+	}
+
+	/* check all supported impl if init() was already called */
+	if (err != 0 && blake3_impl_initialized) {
+		/* check all supported implementations */
+		for (i = 0; i < blake3_supp_impl_cnt; i++) {
+			if (strcmp(req_name, blake3_supp_impl[i]->name) == 0) {
+				impl = i;
+				err = 0;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		if (blake3_impl_initialized)
+			atomic_swap_32(&icp_blake3_impl, impl);
+		else
+			atomic_swap_32(&user_sel_impl, impl);
+	}
+
+	return (err);
+}
+
+#if defined(_KERNEL)
+#include <linux/mod_compat.h>
+
+static int
+icp_blake3_impl_set(const char *val, zfs_kernel_param_t *kp)
+{
+	return (blake3_impl_set(val));
+}
+
+static int
+icp_blake3_impl_get(char *buffer, zfs_kernel_param_t *kp)
+{
+	int i, cnt = 0;
+	char *fmt;
+	const uint32_t impl = BLAKE3_IMPL_READ(icp_blake3_impl);
+
+	ASSERT(blake3_impl_initialized);
+
+	/* list mandatory options */
+	for (i = 0; i < ARRAY_SIZE(blake3_impl_opts); i++) {
+		fmt = (impl == blake3_impl_opts[i].sel) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt, blake3_impl_opts[i].name);
+	}
+
+	/* list all supported implementations */
+	for (i = 0; i < blake3_supp_impl_cnt; i++) {
+		fmt = (i == impl) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt, blake3_supp_impl[i]->name);
+	}
+
+	return (cnt);
+}
+
+module_param_call(icp_blake3_impl, icp_blake3_impl_set, icp_blake3_impl_get,
+    NULL, 0644);
+MODULE_PARM_DESC(icp_blake3_impl, "Select blake3 implementation.");
+#endif
@@ -0,0 +1,230 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <blake3/blake3_impl.h>
+
+#if defined(__aarch64__) && defined(_LITTLE_ENDIAN)
+
+#include <linux/simd_aarch64.h>
+
+/*
+ * Four inputs are compressed in parallel, lane i of every vector belongs
+ * to input i.  The state is kept in v0-v15, the transposed message words
+ * in a buffer on the stack and v16-v18 are scratch registers.
+ */
+
+/*
+ * The G function applied to one column or diagonal of the four states.
+ * The message words x and y are loaded from the buffer by index.
+ */
+#define	BLAKE3_NEON_G(a, b, c, d, x, y)				\
+	"ldr	q16, [%[msg], #(" #x " * 16)]\n"		\
+	"ldr	q17, [%[msg], #(" #y " * 16)]\n"		\
+	"add	" a ".4s, " a ".4s, " b ".4s\n"			\
+	"add	" a ".4s, " a ".4s, v16.4s\n"			\
+	"eor	" d ".16b, " d ".16b, " a ".16b\n"		\
+	"rev32	" d ".8h, " d ".8h\n"				\
+	"add	" c ".4s, " c ".4s, " d ".4s\n"			\
+	"eor	v18.16b, " b ".16b, " c ".16b\n"		\
+	"ushr	" b ".4s, v18.4s, #12\n"			\
+	"sli	" b ".4s, v18.4s, #20\n"			\
+	"add	" a ".4s, " a ".4s, " b ".4s\n"			\
+	"add	" a ".4s, " a ".4s, v17.4s\n"			\
+	"eor	v18.16b, " d ".16b, " a ".16b\n"		\
+	"ushr	" d ".4s, v18.4s, #8\n"				\
+	"sli	" d ".4s, v18.4s, #24\n"			\
+	"add	" c ".4s, " c ".4s, " d ".4s\n"			\
+	"eor	v18.16b, " b ".16b, " c ".16b\n"		\
+	"ushr	" b ".4s, v18.4s, #7\n"				\
+	"sli	" b ".4s, v18.4s, #25\n"
+
+#define	BLAKE3_NEON_ROUND(m0, m1, m2, m3, m4, m5, m6, m7,		\
+	    m8, m9, m10, m11, m12, m13, m14, m15)			\
+	BLAKE3_NEON_G("v0", "v4", "v8", "v12", m0, m1)			\
+	BLAKE3_NEON_G("v1", "v5", "v9", "v13", m2, m3)			\
+	BLAKE3_NEON_G("v2", "v6", "v10", "v14", m4, m5)			\
+	BLAKE3_NEON_G("v3", "v7", "v11", "v15", m6, m7)			\
+	BLAKE3_NEON_G("v0", "v5", "v10", "v15", m8, m9)			\
+	BLAKE3_NEON_G("v1", "v6", "v11", "v12", m10, m11)		\
+	BLAKE3_NEON_G("v2", "v7", "v8", "v13", m12, m13)		\
+	BLAKE3_NEON_G("v3", "v4", "v9", "v14", m14, m15)
+
+/*
+ * Loads 16 bytes at offset off of the four inputs and stores them
+ * transposed, as message words w to w + 3.
+ */
+#define	BLAKE3_NEON_LOAD_MSG(off, w)				\
+	"ldr	q16, [%[in0], #" #off "]\n"			\
+	"ldr	q17, [%[in1], #" #off "]\n"			\
+	"ldr	q18, [%[in2], #" #off "]\n"			\
+	"ldr	q19, [%[in3], #" #off "]\n"			\
+	"trn1	v20.4s, v16.4s, v17.4s\n"			\
+	"trn2	v21.4s, v16.4s, v17.4s\n"			\
+	"trn1	v22.4s, v18.4s, v19.4s\n"			\
+	"trn2	v23.4s, v18.4s, v19.4s\n"			\
+	"trn1	v16.2d, v20.2d, v22.2d\n"			\
+	"trn1	v17.2d, v21.2d, v23.2d\n"			\
+	"trn2	v18.2d, v20.2d, v22.2d\n"			\
+	"trn2	v19.2d, v21.2d, v23.2d\n"			\
+	"stp	q16, q17, [%[msg], #(" #w " * 16)]\n"		\
+	"stp	q18, q19, [%[msg], #((" #w " + 2) * 16)]\n"
+
+/*
+ * Compresses the block at offset of each of the four inputs into the
+ * transposed chaining values cv, word j of input i is cv[j * 4 + i].  The
+ * low and high counter words are transposed in the same way in ctr.
+ */
+static void
+blake3_compress4_neon(uint32_t cv[8 * 4], const uint8_t * const *inputs,
+    size_t offset, const uint32_t ctr[2 * 4], uint32_t flags)
+{
+	uint32_t msg[16 * 4] __attribute__((aligned(16)));
+	const uint8_t *in0 = inputs[0] + offset;
+	const uint8_t *in1 = inputs[1] + offset;
+	const uint8_t *in2 = inputs[2] + offset;
+	const uint8_t *in3 = inputs[3] + offset;
+	uint64_t tmp;
+
+	__asm__ __volatile__(
+	    BLAKE3_NEON_LOAD_MSG(0, 0)
+	    BLAKE3_NEON_LOAD_MSG(16, 4)
+	    BLAKE3_NEON_LOAD_MSG(32, 8)
+	    BLAKE3_NEON_LOAD_MSG(48, 12)
+	    "ld1	{v0.4s-v3.4s}, [%[cv]]\n"
+	    "add	%[tmp], %[cv], #64\n"
+	    "ld1	{v4.4s-v7.4s}, [%[tmp]]\n"
+	    "ld1r	{v8.4s}, [%[iv]]\n"
+	    "add	%[tmp], %[iv], #4\n"
+	    "ld1r	{v9.4s}, [%[tmp]]\n"
+	    "add	%[tmp], %[iv], #8\n"
+	    "ld1r	{v10.4s}, [%[tmp]]\n"
+	    "add	%[tmp], %[iv], #12\n"
+	    "ld1r	{v11.4s}, [%[tmp]]\n"
+	    "ld1	{v12.4s-v13.4s}, [%[ctr]]\n"
+	    "movi	v14.4s, #64\n"
+	    "dup	v15.4s, %w[flags]\n"
+	    BLAKE3_NEON_ROUND(0, 1, 2, 3, 4, 5, 6, 7,
+	    8, 9, 10, 11, 12, 13, 14, 15)
+	    BLAKE3_NEON_ROUND(2, 6, 3, 10, 7, 0, 4, 13,
+	    1, 11, 12, 5, 9, 14, 15, 8)
+	    BLAKE3_NEON_ROUND(3, 4, 10, 12, 13, 2, 7, 14,
+	    6, 5, 9, 0, 11, 15, 8, 1)
+	    BLAKE3_NEON_ROUND(10, 7, 12, 9, 14, 3, 13, 15,
+	    4, 0, 11, 2, 5, 8, 1, 6)
+	    BLAKE3_NEON_ROUND(12, 13, 9, 11, 15, 10, 14, 8,
+	    7, 2, 5, 3, 0, 1, 6, 4)
+	    BLAKE3_NEON_ROUND(9, 14, 11, 5, 8, 12, 15, 1,
+	    13, 3, 0, 10, 2, 6, 4, 7)
+	    BLAKE3_NEON_ROUND(11, 15, 5, 0, 1, 9, 8, 6,
+	    14, 10, 2, 12, 3, 4, 7, 13)
+	    "eor	v0.16b, v0.16b, v8.16b\n"
+	    "eor	v1.16b, v1.16b, v9.16b\n"
+	    "eor	v2.16b, v2.16b, v10.16b\n"
+	    "eor	v3.16b, v3.16b, v11.16b\n"
+	    "eor	v4.16b, v4.16b, v12.16b\n"
+	    "eor	v5.16b, v5.16b, v13.16b\n"
+	    "eor	v6.16b, v6.16b, v14.16b\n"
+	    "eor	v7.16b, v7.16b, v15.16b\n"
+	    "st1	{v0.4s-v3.4s}, [%[cv]]\n"
+	    "add	%[tmp], %[cv], #64\n"
+	    "st1	{v4.4s-v7.4s}, [%[tmp]]\n"
+	    : [tmp] "=&r" (tmp)
+	    : [cv] "r" (cv), [ctr] "r" (ctr), [flags] "r" (flags),
+	    [msg] "r" (msg), [iv] "r" (blake3_iv),
+	    [in0] "r" (in0), [in1] "r" (in1), [in2] "r" (in2), [in3] "r" (in3)
+	    : "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",
+	    "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15",
+	    "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23",
+	    "memory");
+}
+
+static void
+blake3_hash4_neon(const uint8_t * const *inputs, size_t blocks,
+    const uint32_t key[8], uint64_t counter, boolean_t increment_counter,
+    uint8_t flags, uint8_t flags_start, uint8_t flags_end, uint8_t *out)
+{
+	uint32_t cv[8 * 4];
+	uint32_t ctr[2 * 4];
+	uint8_t block_flags = flags | flags_start;
+	size_t i, j, b;
+
+	for (i = 0; i < 4; i++) {
+		uint64_t c = counter + (increment_counter ? i : 0);
+
+		for (j = 0; j < 8; j++)
+			cv[j * 4 + i] = key[j];
+		ctr[i] = (uint32_t)c;
+		ctr[4 + i] = (uint32_t)(c >> 32);
+	}
+
+	for (b = 0; b < blocks; b++) {
+		if (b + 1 == blocks)
+			block_flags |= flags_end;
+		blake3_compress4_neon(cv, inputs, b * BLAKE3_BLOCK_LEN, ctr,
+		    block_flags);
+		block_flags = flags;
+	}
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 8; j++) {
+			memcpy(&out[i * BLAKE3_OUT_LEN + j * 4],
+			    &cv[j * 4 + i], 4);
+		}
+	}
+}
+
+static void
+blake3_hash_many_neon(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	kfpu_begin();
+	while (num_inputs >= 4) {
+		blake3_hash4_neon(inputs, blocks, key, counter,
+		    increment_counter, flags, flags_start, flags_end, out);
+		if (increment_counter)
+			counter += 4;
+		inputs += 4;
+		num_inputs -= 4;
+		out = &out[4 * BLAKE3_OUT_LEN];
+	}
+	kfpu_end();
+
+	blake3_hash_many_generic(inputs, num_inputs, blocks, key, counter,
+	    increment_counter, flags, flags_start, flags_end, out);
+}
+
+static boolean_t
+blake3_neon_will_work(void)
+{
+	return (kfpu_allowed());
+}
+
+const blake3_impl_ops_t blake3_neon_impl = {
+	.hash_many = &blake3_hash_many_neon,
+	.is_supported = &blake3_neon_will_work,
+	.degree = 4,
+	.name = "neon"
+};
+
+#endif /* defined(__aarch64__) && defined(_LITTLE_ENDIAN) */
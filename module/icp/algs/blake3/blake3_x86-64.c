@@ -0,0 +1,255 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#if defined(__x86_64) && defined(HAVE_SSE2)
+
+#include <sys/zfs_context.h>
+#include <blake3/blake3_impl.h>
+#include <linux/simd_x86.h>
+
+/*
+ * Compresses one block of each of the N inputs, see
+ * module/icp/asm-x86_64/blake3/blake3_sse2.S.
+ */
+typedef void (*blake3_compress_n_f)(uint32_t *cv,
+    const uint8_t * const *inputs, size_t offset, const uint32_t *ctr,
+    uint32_t flags, uint32_t *msg);
+
+extern void zfs_blake3_compress4_sse2(uint32_t *cv,
+    const uint8_t * const *inputs, size_t offset, const uint32_t *ctr,
+    uint32_t flags, uint32_t *msg);
+extern void zfs_blake3_compress4_sse41(uint32_t *cv,
+    const uint8_t * const *inputs, size_t offset, const uint32_t *ctr,
+    uint32_t flags, uint32_t *msg);
+extern void zfs_blake3_compress8_avx2(uint32_t *cv,
+    const uint8_t * const *inputs, size_t offset, const uint32_t *ctr,
+    uint32_t flags, uint32_t *msg);
+extern void zfs_blake3_compress16_avx512(uint32_t *cv,
+    const uint8_t * const *inputs, size_t offset, const uint32_t *ctr,
+    uint32_t flags, uint32_t *msg);
+
+typedef struct blake3_x86_kernel {
+	blake3_compress_n_f	compress;
+	size_t			degree;
+} blake3_x86_kernel_t;
+
+/*
+ * Hashes degree inputs with the given kernel.  The chaining values and
+ * counters are kept transposed, word j of input i at index j * degree + i,
+ * for the whole run.  msg is scratch space for the kernel, large enough
+ * for 17 vectors.
+ */
+static void
+blake3_hash_n_x86(const blake3_x86_kernel_t *kernel,
+    const uint8_t * const *inputs, size_t blocks, const uint32_t key[8],
+    uint64_t counter, boolean_t increment_counter, uint8_t flags,
+    uint8_t flags_start, uint8_t flags_end, uint8_t *out, uint32_t *msg)
+{
+	const size_t n = kernel->degree;
+	uint32_t cv[8 * BLAKE3_MAX_SIMD_DEGREE];
+	uint32_t ctr[2 * BLAKE3_MAX_SIMD_DEGREE];
+	uint8_t block_flags = flags | flags_start;
+	size_t i, j, b;
+
+	for (i = 0; i < n; i++) {
+		uint64_t c = counter + (increment_counter ? i : 0);
+
+		for (j = 0; j < 8; j++)
+			cv[j * n + i] = key[j];
+		ctr[i] = (uint32_t)c;
+		ctr[n + i] = (uint32_t)(c >> 32);
+	}
+
+	for (b = 0; b < blocks; b++) {
+		if (b + 1 == blocks)
+			block_flags |= flags_end;
+		kernel->compress(cv, inputs, b * BLAKE3_BLOCK_LEN, ctr,
+		    block_flags, msg);
+		block_flags = flags;
+	}
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 8; j++) {
+			memcpy(&out[i * BLAKE3_OUT_LEN + j * 4],
+			    &cv[j * n + i], 4);
+		}
+	}
+}
+
+/*
+ * Hashes as many inputs as possible with the widest kernel, then with the
+ * narrower ones.  The few inputs left are hashed by the generic code.
+ */
+static void
+blake3_hash_many_x86(const blake3_x86_kernel_t *kernels,
+    const uint8_t * const *inputs, size_t num_inputs, size_t blocks,
+    const uint32_t key[8], uint64_t counter, boolean_t increment_counter,
+    uint8_t flags, uint8_t flags_start, uint8_t flags_end, uint8_t *out)
+{
+	uint32_t msg[17 * 8] __attribute__((aligned(32)));
+	const blake3_x86_kernel_t *k;
+
+	kfpu_begin();
+	for (k = kernels; k->compress != NULL; k++) {
+		while (num_inputs >= k->degree) {
+			blake3_hash_n_x86(k, inputs, blocks, key, counter,
+			    increment_counter, flags, flags_start, flags_end,
+			    out, msg);
+			if (increment_counter)
+				counter += k->degree;
+			inputs += k->degree;
+			num_inputs -= k->degree;
+			out = &out[k->degree * BLAKE3_OUT_LEN];
+		}
+	}
+	kfpu_end();
+
+	blake3_hash_many_generic(inputs, num_inputs, blocks, key, counter,
+	    increment_counter, flags, flags_start, flags_end, out);
+}
+
+static const blake3_x86_kernel_t blake3_sse2_kernels[] = {
+	{ zfs_blake3_compress4_sse2, 4 },
+	{ NULL, 0 }
+};
+
+static void
+blake3_hash_many_sse2(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	blake3_hash_many_x86(blake3_sse2_kernels, inputs, num_inputs, blocks,
+	    key, counter, increment_counter, flags, flags_start, flags_end,
+	    out);
+}
+
+static boolean_t
+blake3_sse2_will_work(void)
+{
+	return (kfpu_allowed() && zfs_sse2_available());
+}
+
+const blake3_impl_ops_t blake3_sse2_impl = {
+	.hash_many = &blake3_hash_many_sse2,
+	.is_supported = &blake3_sse2_will_work,
+	.degree = 4,
+	.name = "sse2"
+};
+
+#if defined(HAVE_SSE4_1)
+static const blake3_x86_kernel_t blake3_sse41_kernels[] = {
+	{ zfs_blake3_compress4_sse41, 4 },
+	{ NULL, 0 }
+};
+
+static void
+blake3_hash_many_sse41(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	blake3_hash_many_x86(blake3_sse41_kernels, inputs, num_inputs, blocks,
+	    key, counter, increment_counter, flags, flags_start, flags_end,
+	    out);
+}
+
+static boolean_t
+blake3_sse41_will_work(void)
+{
+	return (kfpu_allowed() && zfs_ssse3_available() &&
+	    zfs_sse4_1_available());
+}
+
+const blake3_impl_ops_t blake3_sse41_impl = {
+	.hash_many = &blake3_hash_many_sse41,
+	.is_supported = &blake3_sse41_will_work,
+	.degree = 4,
+	.name = "sse41"
+};
+#endif /* defined(HAVE_SSE4_1) */
+
+#if defined(HAVE_SSE4_1) && defined(HAVE_AVX2)
+static const blake3_x86_kernel_t blake3_avx2_kernels[] = {
+	{ zfs_blake3_compress8_avx2, 8 },
+	{ zfs_blake3_compress4_sse41, 4 },
+	{ NULL, 0 }
+};
+
+static void
+blake3_hash_many_avx2(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	blake3_hash_many_x86(blake3_avx2_kernels, inputs, num_inputs, blocks,
+	    key, counter, increment_counter, flags, flags_start, flags_end,
+	    out);
+}
+
+static boolean_t
+blake3_avx2_will_work(void)
+{
+	return (blake3_sse41_will_work() && zfs_avx2_available());
+}
+
+const blake3_impl_ops_t blake3_avx2_impl = {
+	.hash_many = &blake3_hash_many_avx2,
+	.is_supported = &blake3_avx2_will_work,
+	.degree = 8,
+	.name = "avx2"
+};
+#endif /* defined(HAVE_SSE4_1) && defined(HAVE_AVX2) */
+
+#if defined(HAVE_SSE4_1) && defined(HAVE_AVX2) && defined(HAVE_AVX512F)
+static const blake3_x86_kernel_t blake3_avx512_kernels[] = {
+	{ zfs_blake3_compress16_avx512, 16 },
+	{ zfs_blake3_compress8_avx2, 8 },
+	{ zfs_blake3_compress4_sse41, 4 },
+	{ NULL, 0 }
+};
+
+static void
+blake3_hash_many_avx512(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	blake3_hash_many_x86(blake3_avx512_kernels, inputs, num_inputs, blocks,
+	    key, counter, increment_counter, flags, flags_start, flags_end,
+	    out);
+}
+
+static boolean_t
+blake3_avx512_will_work(void)
+{
+	return (blake3_avx2_will_work() && zfs_avx512f_available());
+}
+
+const blake3_impl_ops_t blake3_avx512_impl = {
+	.hash_many = &blake3_hash_many_avx512,
+	.is_supported = &blake3_avx512_will_work,
+	.degree = 16,
+	.name = "avx512"
+};
+#endif /* defined(HAVE_SSE4_1) && defined(HAVE_AVX2) && ... */
+
+#endif /* defined(__x86_64) && defined(HAVE_SSE2) */
@@ -36,6 +36,56 @@
 	(o)->mul((uint64_t *)(void *)(c)->gcm_ghash, (c)->gcm_H, \
 	(uint64_t *)(void *)(t));
 
+/*
+ * Encrypts and hashes as many whole blocks of len bytes at datap as the
+ * bulk method of the implementation takes, writing the ciphertext straight
+ * to the output.  Only the output contiguous at its current offset is
+ * used.  Returns the number of bytes processed.
+ */
+static size_t
+gcm_encrypt_bulk(gcm_ctx_t *ctx, uint8_t *datap, size_t len,
+    crypto_data_t *out, const gcm_impl_ops_t *gops)
+{
+	iovec_t *iov;
+	offset_t offset = out->cd_offset;
+	size_t done;
+
+	switch (out->cd_format) {
+	case CRYPTO_DATA_RAW:
+		iov = &out->cd_raw;
+		break;
+
+	case CRYPTO_DATA_UIO: {
+		uio_t *uiop = out->cd_uio;
+		uintptr_t vec_idx;
+
+		for (vec_idx = 0; vec_idx < uiop->uio_iovcnt &&
+		    offset >= uiop->uio_iov[vec_idx].iov_len;
+		    offset -= uiop->uio_iov[vec_idx++].iov_len)
+			;
+		if (vec_idx == uiop->uio_iovcnt)
+			return (0);
+
+		iov = (iovec_t *)&uiop->uio_iov[vec_idx];
+		break;
+	}
+
+	default:
+		return (0);
+	}
+
+	if (offset >= iov->iov_len)
+		return (0);
+
+	done = gops->encrypt_blocks(ctx, datap,
+	    (uint8_t *)iov->iov_base + offset,
+	    MIN(len, iov->iov_len - offset));
+	ctx->gcm_processed_data_len += done;
+	out->cd_offset += done;
+
+	return (done);
+}
+
 /*
  * Encrypt multiple blocks of data in GCM mode.  Decrypt for GCM mode
  * is done in another function.
@@ -77,6 +127,20 @@ gcm_mode_encrypt_contiguous_blocks(gcm_ctx_t *ctx, char *data, size_t length,
 
 	gops = gcm_impl_get_ops();
 	do {
+		/* Whole blocks, if the implementation has a bulk method. */
+		if (ctx->gcm_remainder_len == 0 && out != NULL &&
+		    gops->encrypt_blocks != NULL) {
+			size_t done = gcm_encrypt_bulk(ctx, datap, remainder,
+			    out, gops);
+			if (done > 0) {
+				crypto_init_ptrs(out, &iov_or_mp, &offset);
+				datap += done;
+				remainder -= done;
+				if (remainder < block_size)
+					goto tail;
+			}
+		}
+
 		/* Unprocessed data from last call. */
 		if (ctx->gcm_remainder_len > 0) {
 			need = block_size - ctx->gcm_remainder_len;
@@ -147,7 +211,7 @@ gcm_mode_encrypt_contiguous_blocks(gcm_ctx_t *ctx, char *data, size_t length,
 		}
 
 		remainder = (size_t)&data[length] - (size_t)datap;
-
+tail:
 		/* Incomplete last block. */
 		if (remainder > 0 && remainder < block_size) {
 			bcopy(datap, ctx->gcm_remainder, remainder);
@@ -338,6 +402,13 @@ gcm_decrypt_final(gcm_ctx_t *ctx, crypto_data_t *out, size_t block_size,
 	ghash = (uint8_t *)ctx->gcm_ghash;
 	blockp = ctx->gcm_pt_buf;
 	remainder = pt_len;
+	if (gops->decrypt_blocks != NULL) {
+		size_t done = gops->decrypt_blocks(ctx, blockp, blockp,
+		    remainder);
+		processed += done;
+		blockp += done;
+		remainder -= done;
+	}
 	while (remainder > 0) {
 		/* Incomplete last block */
 		if (remainder < block_size) {
@@ -642,6 +713,15 @@ const gcm_impl_ops_t *gcm_all_impl[] = {
 #if defined(__x86_64) && defined(HAVE_PCLMULQDQ)
 	&gcm_pclmulqdq_impl,
 #endif
+#if defined(__x86_64) && defined(HAVE_AVX) && defined(HAVE_AES) && \
+	defined(HAVE_PCLMULQDQ)
+	&gcm_avx_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2) && defined(HAVE_AES) && \
+	defined(HAVE_PCLMULQDQ) && defined(HAVE_VAES) && \
+	defined(HAVE_VPCLMULQDQ)
+	&gcm_vaes_impl,
+#endif
 };
 
 /* Indicate that benchmark has been completed */
@@ -721,8 +801,24 @@ gcm_impl_init(void *arg)
 
 	/*
 	 * Set the fastest implementation given the assumption that the
-	 * hardware accelerated version is the fastest.
+	 * hardware accelerated version is the fastest, and that the bulk
+	 * implementations processing more blocks at once are faster.
 	 */
+#if defined(__x86_64) && defined(HAVE_AVX2) && defined(HAVE_AES) && \
+	defined(HAVE_PCLMULQDQ) && defined(HAVE_VAES) && \
+	defined(HAVE_VPCLMULQDQ)
+	if (gcm_vaes_impl.is_supported()) {
+		memcpy(&gcm_fastest_impl, &gcm_vaes_impl,
+		    sizeof (gcm_fastest_impl));
+	} else
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX) && defined(HAVE_AES) && \
+	defined(HAVE_PCLMULQDQ)
+	if (gcm_avx_impl.is_supported()) {
+		memcpy(&gcm_fastest_impl, &gcm_avx_impl,
+		    sizeof (gcm_fastest_impl));
+	} else
+#endif
 #if defined(__x86_64) && defined(HAVE_PCLMULQDQ)
 	if (gcm_pclmulqdq_impl.is_supported()) {
 		memcpy(&gcm_fastest_impl, &gcm_pclmulqdq_impl,
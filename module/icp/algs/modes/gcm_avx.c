@@ -0,0 +1,198 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#if defined(__x86_64) && defined(HAVE_AVX) && defined(HAVE_AES) && \
+	defined(HAVE_PCLMULQDQ)
+
+#include <linux/simd_x86.h>
+#include <sys/byteorder.h>
+#include <modes/modes.h>
+#include <modes/gcm_impl.h>
+#include <aes/aes_impl.h>
+
+/*
+ * Bulk AES-GCM with the AES rounds of a batch of blocks interleaved with
+ * the GHASH multiplications of the previous one, see aesni_gcm_avx.S.
+ * The single block operations, as used for the AAD, the IV and partial
+ * blocks, are those of the pclmulqdq implementation.
+ */
+
+typedef void (*aesni_gcm_f)(const uint8_t *, uint8_t *, size_t,
+    const uint32_t *, int, uint64_t *, uint64_t *, const uint64_t *);
+
+extern void gcm_mul_pclmulqdq(uint64_t *, uint64_t *, uint64_t *);
+extern void aesni_gcm_encrypt_avx(const uint8_t *, uint8_t *, size_t,
+    const uint32_t *, int, uint64_t *, uint64_t *, const uint64_t *);
+extern void aesni_gcm_decrypt_avx(const uint8_t *, uint8_t *, size_t,
+    const uint32_t *, int, uint64_t *, uint64_t *, const uint64_t *);
+#if defined(HAVE_AVX2) && defined(HAVE_VAES) && defined(HAVE_VPCLMULQDQ)
+extern void aesni_gcm_encrypt_vaes(const uint8_t *, uint8_t *, size_t,
+    const uint32_t *, int, uint64_t *, uint64_t *, const uint64_t *);
+extern void aesni_gcm_decrypt_vaes(const uint8_t *, uint8_t *, size_t,
+    const uint32_t *, int, uint64_t *, uint64_t *, const uint64_t *);
+#endif
+
+/* Blocks hashed per reduction, and size of the table of powers of H */
+#define	GCM_AVX_MAX_BLOCKS	(16)
+
+/*
+ * Bytes processed per FPU section, a multiple of the batch size of all
+ * implementations.  This bounds the time preemption is disabled for.
+ */
+#define	GCM_AVX_CHUNK_SIZE	(32 * 1024)
+
+/*
+ * Stores the powers H^n .. H^1 of the hash key at the end of htab, in the
+ * form used by the assembly: bit reflected, that is as the 128 bit
+ * integer whose most significant byte is the first byte of the block,
+ * and multiplied by x modulo the reflected GHASH polynomial.  The latter
+ * saves a shift of every product.  Each entry is stored low quad first.
+ */
+static void
+gcm_avx_init_htab(uint64_t *htab, const uint64_t *H, int n)
+{
+	uint64_t p[2] = { H[0], H[1] };
+	uint64_t hi, lo, carry;
+	int k;
+
+	for (k = 1; k <= n; k++) {
+		hi = ntohll(p[0]);
+		lo = ntohll(p[1]);
+		carry = hi >> 63;
+		hi = (hi << 1) | (lo >> 63);
+		lo <<= 1;
+		if (carry) {
+			hi ^= 0xc200000000000000ULL;
+			lo ^= 1ULL;
+		}
+		htab[2 * (GCM_AVX_MAX_BLOCKS - k)] = lo;
+		htab[2 * (GCM_AVX_MAX_BLOCKS - k) + 1] = hi;
+
+		if (k < n)
+			gcm_mul_pclmulqdq(p, (uint64_t *)H, p);
+	}
+}
+
+/*
+ * Runs crypt over the largest multiple of batch blocks in len bytes of
+ * input, in chunks of GCM_AVX_CHUNK_SIZE bytes each.  The expanded key
+ * must have been generated by the AES-NI implementation, since it is used
+ * by the assembly as is.
+ */
+static size_t
+gcm_avx_crypt(gcm_ctx_t *ctx, const uint8_t *in, uint8_t *out, size_t len,
+    aesni_gcm_f crypt, size_t batch)
+{
+	const aes_key_t *ks = (aes_key_t *)ctx->gcm_keysched;
+	uint64_t htab[2 * GCM_AVX_MAX_BLOCKS];
+	size_t done, chunk;
+
+	/* ks->ops may be a copy, as for the fastest implementation */
+	if (ks == NULL || ks->ops->generate != aes_aesni_impl.generate)
+		return (0);
+
+	len = P2ALIGN(len, batch * AES_BLOCK_LEN);
+	for (done = 0; done < len; done += chunk) {
+		chunk = MIN(len - done, GCM_AVX_CHUNK_SIZE);
+
+		kfpu_begin();
+		if (done == 0)
+			gcm_avx_init_htab(htab, ctx->gcm_H, batch);
+		crypt(in + done, out + done, chunk / AES_BLOCK_LEN,
+		    ks->encr_ks.ks32, ks->nr, ctx->gcm_cb, ctx->gcm_ghash,
+		    htab);
+		kfpu_end();
+	}
+
+	return (len);
+}
+
+static void
+gcm_avx_mul(uint64_t *x_in, uint64_t *y, uint64_t *res)
+{
+	kfpu_begin();
+	gcm_mul_pclmulqdq(x_in, y, res);
+	kfpu_end();
+}
+
+static size_t
+gcm_avx_encrypt_blocks(gcm_ctx_t *ctx, const uint8_t *in, uint8_t *out,
+    size_t len)
+{
+	return (gcm_avx_crypt(ctx, in, out, len, aesni_gcm_encrypt_avx, 8));
+}
+
+static size_t
+gcm_avx_decrypt_blocks(gcm_ctx_t *ctx, const uint8_t *in, uint8_t *out,
+    size_t len)
+{
+	return (gcm_avx_crypt(ctx, in, out, len, aesni_gcm_decrypt_avx, 8));
+}
+
+static boolean_t
+gcm_avx_will_work(void)
+{
+	return (kfpu_allowed() && zfs_avx_available() &&
+	    zfs_aes_available() && zfs_pclmulqdq_available());
+}
+
+const gcm_impl_ops_t gcm_avx_impl = {
+	.mul = &gcm_avx_mul,
+	.encrypt_blocks = &gcm_avx_encrypt_blocks,
+	.decrypt_blocks = &gcm_avx_decrypt_blocks,
+	.is_supported = &gcm_avx_will_work,
+	.name = "avx"
+};
+
+#if defined(HAVE_AVX2) && defined(HAVE_VAES) && defined(HAVE_VPCLMULQDQ)
+
+static size_t
+gcm_vaes_encrypt_blocks(gcm_ctx_t *ctx, const uint8_t *in, uint8_t *out,
+    size_t len)
+{
+	return (gcm_avx_crypt(ctx, in, out, len, aesni_gcm_encrypt_vaes, 16));
+}
+
+static size_t
+gcm_vaes_decrypt_blocks(gcm_ctx_t *ctx, const uint8_t *in, uint8_t *out,
+    size_t len)
+{
+	return (gcm_avx_crypt(ctx, in, out, len, aesni_gcm_decrypt_vaes, 16));
+}
+
+static boolean_t
+gcm_vaes_will_work(void)
+{
+	return (gcm_avx_will_work() && zfs_avx2_available() &&
+	    zfs_vaes_available() && zfs_vpclmulqdq_available());
+}
+
+const gcm_impl_ops_t gcm_vaes_impl = {
+	.mul = &gcm_avx_mul,
+	.encrypt_blocks = &gcm_vaes_encrypt_blocks,
+	.decrypt_blocks = &gcm_vaes_decrypt_blocks,
+	.is_supported = &gcm_vaes_will_work,
+	.name = "vaes"
+};
+
+#endif /* defined(HAVE_AVX2) && defined(HAVE_VAES) && ... */
+
+#endif /* defined(__x86_64) && defined(HAVE_AVX) && defined(HAVE_AES) && ... */
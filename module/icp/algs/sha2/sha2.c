@@ -40,6 +40,7 @@
 #define	_SHA2_IMPL
 #include <sys/sha2.h>
 #include <sha2/sha2_consts.h>
+#include <sha2/sha2_impl.h>
 
 #define	_RESTRICT_KYWD
 
@@ -52,18 +53,8 @@
 static void Encode(uint8_t *, uint32_t *, size_t);
 static void Encode64(uint8_t *, uint64_t *, size_t);
 
-/* userspace only supports the generic version */
-#if	defined(__amd64) && defined(_KERNEL)
-#define	SHA512Transform(ctx, in) SHA512TransformBlocks((ctx), (in), 1)
-#define	SHA256Transform(ctx, in) SHA256TransformBlocks((ctx), (in), 1)
-
-void SHA512TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
-void SHA256TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
-
-#else
 static void SHA256Transform(SHA2_CTX *, const uint8_t *);
 static void SHA512Transform(SHA2_CTX *, const uint8_t *);
-#endif	/* __amd64 && _KERNEL */
 
 static uint8_t PADDING[128] = { 0x80, /* all zeros */ };
 
@@ -143,7 +134,6 @@ static uint8_t PADDING[128] = { 0x80, /* all zeros */ };
 #endif	/* _BIG_ENDIAN */
 
 
-#if	!defined(__amd64) || !defined(_KERNEL)
 /* SHA256 Transform */
 
 static void
@@ -601,7 +591,46 @@ SHA512Transform(SHA2_CTX *ctx, const uint8_t *blk)
 	ctx->state.s64[7] += h;
 
 }
-#endif	/* !__amd64 || !_KERNEL */
+
+/*
+ * Generic block transforms, used when no faster implementation is
+ * available or allowed in the current context.
+ */
+static void
+sha256_generic_transform(SHA2_CTX *ctx, const void *in, size_t num)
+{
+	const uint8_t *blk = in;
+
+	for (; num > 0; num--, blk += 64)
+		SHA256Transform(ctx, blk);
+}
+
+static void
+sha512_generic_transform(SHA2_CTX *ctx, const void *in, size_t num)
+{
+	const uint8_t *blk = in;
+
+	for (; num > 0; num--, blk += 128)
+		SHA512Transform(ctx, blk);
+}
+
+static boolean_t
+sha2_generic_will_work(void)
+{
+	return (B_TRUE);
+}
+
+const sha2_impl_ops_t sha256_generic_impl = {
+	.transform = &sha256_generic_transform,
+	.is_supported = &sha2_generic_will_work,
+	.name = "generic"
+};
+
+const sha2_impl_ops_t sha512_generic_impl = {
+	.transform = &sha512_generic_transform,
+	.is_supported = &sha2_generic_will_work,
+	.name = "generic"
+};
 
 
 /*
@@ -781,15 +810,17 @@ SHA512Init(SHA512_CTX *ctx)
 void
 SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 {
-	uint32_t	i, buf_index, buf_len, buf_limit;
+	uint32_t	i, buf_index, buf_len, buf_limit, block_count;
 	const uint8_t	*input = inptr;
 	uint32_t	algotype = ctx->algotype;
+	const sha2_impl_ops_t *ops;
 
 	/* check for noop */
 	if (input_len == 0)
 		return;
 
 	if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
+		ops = sha256_impl_get_ops();
 		buf_limit = 64;
 
 		/* compute number of bytes mod 64 */
@@ -802,6 +833,7 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 		ctx->count.c32[0] += (input_len >> 29);
 
 	} else {
+		ops = sha512_impl_get_ops();
 		buf_limit = 128;
 
 		/* compute number of bytes mod 128 */
@@ -831,43 +863,16 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 		 */
 		if (buf_index) {
 			bcopy(input, &ctx->buf_un.buf8[buf_index], buf_len);
-			if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE)
-				SHA256Transform(ctx, ctx->buf_un.buf8);
-			else
-				SHA512Transform(ctx, ctx->buf_un.buf8);
+			ops->transform(ctx, ctx->buf_un.buf8, 1);
 
 			i = buf_len;
 		}
 
-#if !defined(__amd64) || !defined(_KERNEL)
-		if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
-			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
-				SHA256Transform(ctx, &input[i]);
-			}
-		} else {
-			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
-				SHA512Transform(ctx, &input[i]);
-			}
-		}
-
-#else
-		uint32_t block_count;
-		if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
-			block_count = (input_len - i) >> 6;
-			if (block_count > 0) {
-				SHA256TransformBlocks(ctx, &input[i],
-				    block_count);
-				i += block_count << 6;
-			}
-		} else {
-			block_count = (input_len - i) >> 7;
-			if (block_count > 0) {
-				SHA512TransformBlocks(ctx, &input[i],
-				    block_count);
-				i += block_count << 7;
-			}
+		block_count = (input_len - i) / buf_limit;
+		if (block_count > 0) {
+			ops->transform(ctx, &input[i], block_count);
+			i += block_count * buf_limit;
 		}
-#endif	/* !__amd64 || !_KERNEL */
 
 		/*
 		 * general optimization:
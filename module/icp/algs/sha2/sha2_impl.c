@@ -0,0 +1,495 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#define	_SHA2_IMPL
+#include <sys/sha2.h>
+#include <sys/crypto/icp.h>
+#include <sha2/sha2_impl.h>
+#include <linux/simd.h>
+
+/*
+ * SHA256 and SHA512 each have their own set of implementations.  The
+ * selection logic is shared and operates on one of the classes below.
+ */
+#define	SHA2_IMPL_MAX		(4)
+
+/* Select sha2 implementation */
+#define	IMPL_FASTEST		(UINT32_MAX)
+#define	IMPL_CYCLE		(UINT32_MAX-1)
+
+#define	SHA2_IMPL_READ(i) (*(volatile uint32_t *) &(i))
+
+#define	SHA2_BENCH_NS		(MSEC2NSEC(50))		/* 50ms */
+#define	SHA2_BENCH_SIZE		(1ULL << 17)		/* 128KiB */
+
+/*
+ * Benchmark results, one per supported implementation followed by one
+ * naming the implementation selected as fastest.
+ */
+typedef struct sha2_impl_stat {
+	const char		*name;
+	const char		*fastest;
+	uint64_t		bw;		/* B/s */
+} sha2_impl_stat_t;
+
+typedef struct sha2_impl_class {
+	const char		*kstat_name;	/* benchmark kstat */
+	size_t			blksz;		/* bytes per block */
+	const sha2_impl_ops_t	**all_impl;	/* all compiled in */
+	size_t			all_impl_cnt;
+	const sha2_impl_ops_t	*nofpu_impl;	/* when SIMD is not allowed */
+	sha2_impl_ops_t		fastest_impl;
+	const sha2_impl_ops_t	*supp_impl[SHA2_IMPL_MAX];
+	size_t			supp_impl_cnt;
+	sha2_impl_stat_t	stat[SHA2_IMPL_MAX + 1];
+	uint32_t		impl_sel;
+	uint32_t		user_sel_impl;
+	boolean_t		initialized;
+#if defined(_KERNEL)
+	kstat_t			*kstat;
+#endif
+} sha2_impl_class_t;
+
+/* All compiled in implementations, the fastest is expected last */
+static const sha2_impl_ops_t *sha256_all_impl[] = {
+	&sha256_generic_impl,
+#if defined(__x86_64)
+	&sha256_x86_64_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+	&sha256_shani_impl,
+#endif
+#if defined(__aarch64__) && defined(_LITTLE_ENDIAN)
+	&sha256_armv8_impl,
+#endif
+};
+
+static const sha2_impl_ops_t *sha512_all_impl[] = {
+	&sha512_generic_impl,
+#if defined(__x86_64)
+	&sha512_x86_64_impl,
+#endif
+};
+
+CTASSERT_GLOBAL(ARRAY_SIZE(sha256_all_impl) <= SHA2_IMPL_MAX);
+CTASSERT_GLOBAL(ARRAY_SIZE(sha512_all_impl) <= SHA2_IMPL_MAX);
+
+static sha2_impl_class_t sha256_impl_class = {
+	.kstat_name = "sha256_bench",
+	.blksz = 64,
+	.all_impl = sha256_all_impl,
+	.all_impl_cnt = ARRAY_SIZE(sha256_all_impl),
+#if defined(__x86_64)
+	.nofpu_impl = &sha256_x86_64_impl,
+#else
+	.nofpu_impl = &sha256_generic_impl,
+#endif
+	.fastest_impl = { .name = "fastest" },
+	.impl_sel = IMPL_FASTEST,
+	.user_sel_impl = IMPL_FASTEST,
+};
+
+static sha2_impl_class_t sha512_impl_class = {
+	.kstat_name = "sha512_bench",
+	.blksz = 128,
+	.all_impl = sha512_all_impl,
+	.all_impl_cnt = ARRAY_SIZE(sha512_all_impl),
+#if defined(__x86_64)
+	.nofpu_impl = &sha512_x86_64_impl,
+#else
+	.nofpu_impl = &sha512_generic_impl,
+#endif
+	.fastest_impl = { .name = "fastest" },
+	.impl_sel = IMPL_FASTEST,
+	.user_sel_impl = IMPL_FASTEST,
+};
+
+/*
+ * Returns the block transform to use.  Until the implementations have
+ * been benchmarked, or when a SIMD implementation is not allowed in the
+ * current context, fallback to an implementation which does not use the FPU.
+ */
+static const sha2_impl_ops_t *
+sha2_impl_get_ops(sha2_impl_class_t *cls)
+{
+	if (!cls->initialized || !kfpu_allowed())
+		return (cls->nofpu_impl);
+
+	const sha2_impl_ops_t *ops = NULL;
+	const uint32_t impl = SHA2_IMPL_READ(cls->impl_sel);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		ops = &cls->fastest_impl;
+		break;
+	case IMPL_CYCLE:
+		/* Cycle through supported implementations */
+		ASSERT3U(cls->supp_impl_cnt, >, 0);
+		static size_t cycle_impl_idx = 0;
+		size_t idx = (++cycle_impl_idx) % cls->supp_impl_cnt;
+		ops = cls->supp_impl[idx];
+		break;
+	default:
+		ASSERT3U(impl, <, cls->supp_impl_cnt);
+		ASSERT3U(cls->supp_impl_cnt, >, 0);
+		if (impl < cls->supp_impl_cnt)
+			ops = cls->supp_impl[impl];
+		break;
+	}
+
+	ASSERT3P(ops, !=, NULL);
+
+	return (ops);
+}
+
+const sha2_impl_ops_t *
+sha256_impl_get_ops(void)
+{
+	return (sha2_impl_get_ops(&sha256_impl_class));
+}
+
+const sha2_impl_ops_t *
+sha512_impl_get_ops(void)
+{
+	return (sha2_impl_get_ops(&sha512_impl_class));
+}
+
+#if defined(_KERNEL)
+/*
+ * Measure the throughput of each supported implementation over the
+ * provided buffer and select the fastest one.
+ */
+static void
+sha2_impl_benchmark(sha2_impl_class_t *cls, const void *data, size_t size)
+{
+	sha2_impl_stat_t *fastest_stat = &cls->stat[cls->supp_impl_cnt];
+	const sha2_impl_ops_t *best_impl = cls->supp_impl[0];
+	uint64_t best_bw = 0;
+	SHA2_CTX ctx;
+
+	for (int i = 0; i < cls->supp_impl_cnt; i++) {
+		const sha2_impl_ops_t *ops = cls->supp_impl[i];
+		uint64_t run_count = 0, run_time_ns, run_bw;
+		hrtime_t start;
+
+		bzero(&ctx, sizeof (ctx));
+
+		kpreempt_disable();
+		start = gethrtime();
+		do {
+			for (int l = 0; l < 8; l++, run_count++)
+				ops->transform(&ctx, data,
+				    size / cls->blksz);
+
+			run_time_ns = gethrtime() - start;
+		} while (run_time_ns < SHA2_BENCH_NS);
+		kpreempt_enable();
+
+		run_bw = size * run_count * NANOSEC;
+		run_bw /= run_time_ns;	/* B/s */
+		cls->stat[i].name = ops->name;
+		cls->stat[i].bw = run_bw;
+
+		if (run_bw > best_bw) {
+			best_bw = run_bw;
+			best_impl = ops;
+		}
+	}
+
+	memcpy(&cls->fastest_impl, best_impl, sizeof (cls->fastest_impl));
+	fastest_stat->name = "fastest";
+	fastest_stat->fastest = best_impl->name;
+}
+
+/*
+ * SHA2 benchmark kstats
+ */
+static int
+sha2_impl_kstat_headers(char *buf, size_t size)
+{
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size, "%-17s", "implementation");
+	(void) snprintf(buf + off, size - off, "%-15s\n", "bandwidth");
+
+	return (0);
+}
+
+static int
+sha2_impl_kstat_data(char *buf, size_t size, void *data)
+{
+	sha2_impl_stat_t *stat = (sha2_impl_stat_t *)data;
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size - off, "%-17s", stat->name);
+	if (stat->fastest != NULL) {
+		(void) snprintf(buf + off, size - off, "%-15s\n",
+		    stat->fastest);
+	} else {
+		(void) snprintf(buf + off, size - off, "%-15llu\n",
+		    (u_longlong_t)stat->bw);
+	}
+
+	return (0);
+}
+
+static void *
+sha2_impl_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	sha2_impl_class_t *cls = ksp->ks_data;
+
+	if (n <= cls->supp_impl_cnt)
+		ksp->ks_private = (void *) (cls->stat + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+#endif /* _KERNEL */
+
+/*
+ * Initialize all supported implementations for a class.
+ */
+static void
+sha2_impl_class_init(sha2_impl_class_t *cls, const void *data, size_t size)
+{
+	const sha2_impl_ops_t *curr_impl;
+	int i, c;
+
+	/* Move supported implementations into supp_impl */
+	for (i = 0, c = 0; i < cls->all_impl_cnt; i++) {
+		curr_impl = cls->all_impl[i];
+
+		if (curr_impl->is_supported())
+			cls->supp_impl[c++] = curr_impl;
+	}
+	cls->supp_impl_cnt = c;
+
+#if defined(_KERNEL)
+	sha2_impl_benchmark(cls, data, size);
+#else
+	/*
+	 * Skip the benchmark in user space to avoid impacting libzpool
+	 * consumers.  The last implementation is assumed to be the fastest.
+	 */
+	memcpy(&cls->fastest_impl, cls->supp_impl[c - 1],
+	    sizeof (cls->fastest_impl));
+#endif
+	strcpy(cls->fastest_impl.name, "fastest");
+
+#if defined(_KERNEL)
+	cls->kstat = kstat_create("zfs", 0, cls->kstat_name, "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (cls->kstat != NULL) {
+		cls->kstat->ks_data = cls;
+		cls->kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(cls->kstat,
+		    sha2_impl_kstat_headers,
+		    sha2_impl_kstat_data,
+		    sha2_impl_kstat_addr);
+		kstat_install(cls->kstat);
+	}
+#endif
+
+	/* Finish initialization */
+	atomic_swap_32(&cls->impl_sel, cls->user_sel_impl);
+	membar_producer();
+	cls->initialized = B_TRUE;
+}
+
+/*
+ * Benchmark and select the fastest SHA256 and SHA512 implementations.
+ */
+/* ARGSUSED */
+void
+sha2_impl_init(void *arg)
+{
+	void *data = NULL;
+	size_t size = SHA2_BENCH_SIZE;
+
+#if defined(_KERNEL)
+	data = vmem_alloc(size, KM_SLEEP);
+	for (int i = 0; i < size / sizeof (uint64_t); i++)
+		((uint64_t *)data)[i] = (uintptr_t)data + i;	/* warm-up */
+#endif
+
+	sha2_impl_class_init(&sha256_impl_class, data, size);
+	sha2_impl_class_init(&sha512_impl_class, data, size);
+
+#if defined(_KERNEL)
+	vmem_free(data, size);
+#endif
+}
+
+void
+sha2_impl_fini(void)
+{
+#if defined(_KERNEL)
+	if (sha256_impl_class.kstat != NULL) {
+		kstat_delete(sha256_impl_class.kstat);
+		sha256_impl_class.kstat = NULL;
+	}
+	if (sha512_impl_class.kstat != NULL) {
+		kstat_delete(sha512_impl_class.kstat);
+		sha512_impl_class.kstat = NULL;
+	}
+#endif
+}
+
+static const struct {
+	char *name;
+	uint32_t sel;
+} sha2_impl_opts[] = {
+		{ "cycle",	IMPL_CYCLE },
+		{ "fastest",	IMPL_FASTEST },
+};
+
+/*
+ * Function sets desired sha2 implementation.
+ *
+ * If we are called before init(), user preference will be saved in
+ * user_sel_impl, and applied in later init() call. This occurs when module
+ * parameter is specified on module load. Otherwise, directly update
+ * impl_sel.
+ *
+ * @val		Name of sha2 implementation to use
+ */
+static int
+sha2_impl_set(sha2_impl_class_t *cls, const char *val)
+{
+	int err = -EINVAL;
+	char req_name[SHA2_IMPL_NAME_MAX];
+	uint32_t impl = SHA2_IMPL_READ(cls->user_sel_impl);
+	size_t i;
+
+	/* sanitize input */
+	i = strnlen(val, SHA2_IMPL_NAME_MAX);
+	if (i == 0 || i >= SHA2_IMPL_NAME_MAX)
+		return (err);
+
+	strlcpy(req_name, val, SHA2_IMPL_NAME_MAX);
+	while (i > 0 && isspace(req_name[i-1]))
+		i--;
+	req_name[i] = '\0';
+
+	/* Check mandatory options */
+	for (i = 0; i < ARRAY_SIZE(sha2_impl_opts); i++) {
+		if (strcmp(req_name, sha2_impl_opts[i].name) == 0) {
+			impl = sha2_impl_opts[i].sel;
+			err = 0;
+			break;
+		}
+	}
+
+	/* check all supported impl if init() was already called */
+	if (err != 0 && cls->initialized) {
+		/* check all supported implementations */
+		for (i = 0; i < cls->supp_impl_cnt; i++) {
+			if (strcmp(req_name, cls->supp_impl[i]->name) == 0) {
+				impl = i;
+				err = 0;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		if (cls->initialized)
+			atomic_swap_32(&cls->impl_sel, impl);
+		else
+			atomic_swap_32(&cls->user_sel_impl, impl);
+	}
+
+	return (err);
+}
+
+int
+sha256_impl_set(const char *val)
+{
+	return (sha2_impl_set(&sha256_impl_class, val));
+}
+
+int
+sha512_impl_set(const char *val)
+{
+	return (sha2_impl_set(&sha512_impl_class, val));
+}
+
+#if defined(_KERNEL)
+#include <linux/mod_compat.h>
+
+static int
+sha2_impl_get(sha2_impl_class_t *cls, char *buffer)
+{
+	int i, cnt = 0;
+	char *fmt;
+	const uint32_t impl = SHA2_IMPL_READ(cls->impl_sel);
+
+	ASSERT(cls->initialized);
+
+	/* list mandatory options */
+	for (i = 0; i < ARRAY_SIZE(sha2_impl_opts); i++) {
+		fmt = (impl == sha2_impl_opts[i].sel) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt, sha2_impl_opts[i].name);
+	}
+
+	/* list all supported implementations */
+	for (i = 0; i < cls->supp_impl_cnt; i++) {
+		fmt = (i == impl) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt, cls->supp_impl[i]->name);
+	}
+
+	return (cnt);
+}
+
+static int
+icp_sha256_impl_set(const char *val, zfs_kernel_param_t *kp)
+{
+	return (sha256_impl_set(val));
+}
+
+static int
+icp_sha256_impl_get(char *buffer, zfs_kernel_param_t *kp)
+{
+	return (sha2_impl_get(&sha256_impl_class, buffer));
+}
+
+static int
+icp_sha512_impl_set(const char *val, zfs_kernel_param_t *kp)
+{
+	return (sha512_impl_set(val));
+}
+
+static int
+icp_sha512_impl_get(char *buffer, zfs_kernel_param_t *kp)
+{
+	return (sha2_impl_get(&sha512_impl_class, buffer));
+}
+
+module_param_call(icp_sha256_impl, icp_sha256_impl_set, icp_sha256_impl_get,
+    NULL, 0644);
+MODULE_PARM_DESC(icp_sha256_impl, "Select sha256 implementation.");
+
+module_param_call(icp_sha512_impl, icp_sha512_impl_set, icp_sha512_impl_get,
+    NULL, 0644);
+MODULE_PARM_DESC(icp_sha512_impl, "Select sha512 implementation.");
+#endif
@@ -0,0 +1,138 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#define	_SHA2_IMPL
+#include <sys/sha2.h>
+#include <sha2/sha2_impl.h>
+
+#if defined(__aarch64__) && defined(_LITTLE_ENDIAN)
+
+#include <linux/simd_aarch64.h>
+
+static const uint32_t sha256_armv8_k[64] __attribute__((aligned(16))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * Four rounds of SHA256.  The message words for these rounds are in w0;
+ * w1, w2 and w3 hold the next twelve words.  When scheduling, w0 is then
+ * replaced with the message words needed four groups later.
+ *
+ * v0 holds abcd, v1 holds efgh, v2 is scratch for the old abcd and v6
+ * holds the message words with the round constants added.
+ */
+#define	SHA256_ARMV8_ROUNDS(w0)					\
+	"ld1	{v6.4s}, [%[k]], #16\n"				\
+	"add	v6.4s, " w0 ".4s, v6.4s\n"			\
+	"mov	v2.16b, v0.16b\n"				\
+	"sha256h	q0, q1, v6.4s\n"			\
+	"sha256h2	q1, q2, v6.4s\n"
+
+#define	SHA256_ARMV8_ROUNDS_SCHED(w0, w1, w2, w3)		\
+	"ld1	{v6.4s}, [%[k]], #16\n"				\
+	"add	v6.4s, " w0 ".4s, v6.4s\n"			\
+	"sha256su0	" w0 ".4s, " w1 ".4s\n"			\
+	"mov	v2.16b, v0.16b\n"				\
+	"sha256h	q0, q1, v6.4s\n"			\
+	"sha256h2	q1, q2, v6.4s\n"			\
+	"sha256su1	" w0 ".4s, " w2 ".4s, " w3 ".4s\n"
+
+/*
+ * Process num blocks using the ARMv8 Cryptographic Extension.
+ */
+static void
+sha256_armv8_transform(SHA2_CTX *ctx, const void *in, size_t num)
+{
+	const uint32_t *k;
+
+	if (num == 0)
+		return;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    ".arch_extension crypto\n"
+	    "ld1	{v0.4s, v1.4s}, [%[state]]\n"
+	    "1:\n"
+	    "ld1	{v16.16b-v19.16b}, [%[in]], #64\n"
+	    "mov	%[k], %[ktab]\n"
+	    "rev32	v16.16b, v16.16b\n"
+	    "rev32	v17.16b, v17.16b\n"
+	    "rev32	v18.16b, v18.16b\n"
+	    "rev32	v19.16b, v19.16b\n"
+	    "mov	v4.16b, v0.16b\n"
+	    "mov	v5.16b, v1.16b\n"
+	    SHA256_ARMV8_ROUNDS_SCHED("v16", "v17", "v18", "v19")
+	    SHA256_ARMV8_ROUNDS_SCHED("v17", "v18", "v19", "v16")
+	    SHA256_ARMV8_ROUNDS_SCHED("v18", "v19", "v16", "v17")
+	    SHA256_ARMV8_ROUNDS_SCHED("v19", "v16", "v17", "v18")
+	    SHA256_ARMV8_ROUNDS_SCHED("v16", "v17", "v18", "v19")
+	    SHA256_ARMV8_ROUNDS_SCHED("v17", "v18", "v19", "v16")
+	    SHA256_ARMV8_ROUNDS_SCHED("v18", "v19", "v16", "v17")
+	    SHA256_ARMV8_ROUNDS_SCHED("v19", "v16", "v17", "v18")
+	    SHA256_ARMV8_ROUNDS_SCHED("v16", "v17", "v18", "v19")
+	    SHA256_ARMV8_ROUNDS_SCHED("v17", "v18", "v19", "v16")
+	    SHA256_ARMV8_ROUNDS_SCHED("v18", "v19", "v16", "v17")
+	    SHA256_ARMV8_ROUNDS_SCHED("v19", "v16", "v17", "v18")
+	    SHA256_ARMV8_ROUNDS("v16")
+	    SHA256_ARMV8_ROUNDS("v17")
+	    SHA256_ARMV8_ROUNDS("v18")
+	    SHA256_ARMV8_ROUNDS("v19")
+	    "add	v0.4s, v0.4s, v4.4s\n"
+	    "add	v1.4s, v1.4s, v5.4s\n"
+	    "subs	%[num], %[num], #1\n"
+	    "b.ne	1b\n"
+	    "st1	{v0.4s, v1.4s}, [%[state]]\n"
+	    : [in] "+r" (in), [num] "+r" (num), [k] "=&r" (k)
+	    : [state] "r" (ctx->state.s32), [ktab] "r" (sha256_armv8_k)
+	    : "v0", "v1", "v2", "v4", "v5", "v6",
+	    "v16", "v17", "v18", "v19", "cc", "memory");
+	kfpu_end();
+}
+
+static boolean_t
+sha256_armv8_will_work(void)
+{
+	return (kfpu_allowed() && zfs_sha2_available());
+}
+
+const sha2_impl_ops_t sha256_armv8_impl = {
+	.transform = &sha256_armv8_transform,
+	.is_supported = &sha256_armv8_will_work,
+	.name = "armv8"
+};
+
+#endif /* defined(__aarch64__) && defined(_LITTLE_ENDIAN) */
@@ -0,0 +1,55 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+
+#include <sys/zfs_context.h>
+#define	_SHA2_IMPL
+#include <sys/sha2.h>
+#include <linux/simd_x86.h>
+#include <sha2/sha2_impl.h>
+
+/* Process num blocks using the Intel SHA Extensions */
+extern void SHA256TransformBlocks_shani(SHA2_CTX *ctx, const void *in,
+    size_t num);
+
+static void
+sha256_shani_transform(SHA2_CTX *ctx, const void *in, size_t num)
+{
+	kfpu_begin();
+	SHA256TransformBlocks_shani(ctx, in, num);
+	kfpu_end();
+}
+
+static boolean_t
+sha256_shani_will_work(void)
+{
+	return (kfpu_allowed() && zfs_sse4_1_available() &&
+	    zfs_shani_available());
+}
+
+const sha2_impl_ops_t sha256_shani_impl = {
+	.transform = &sha256_shani_transform,
+	.is_supported = &sha256_shani_will_work,
+	.name = "shani"
+};
+
+#endif /* defined(__x86_64) && defined(HAVE_SHA_NI) */
@@ -0,0 +1,111 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_BLAKE3_IMPL_H
+#define	_BLAKE3_IMPL_H
+
+#include <sys/types.h>
+#include <sys/blake3.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Domain separation flags */
+#define	BLAKE3_CHUNK_START	(1 << 0)
+#define	BLAKE3_CHUNK_END	(1 << 1)
+#define	BLAKE3_PARENT		(1 << 2)
+#define	BLAKE3_ROOT		(1 << 3)
+#define	BLAKE3_KEYED_HASH	(1 << 4)
+
+/* Largest number of inputs hashed in parallel by any implementation */
+#define	BLAKE3_MAX_SIMD_DEGREE	(16)
+
+extern const uint32_t blake3_iv[8];
+
+/*
+ * Methods used to define BLAKE3 implementations
+ *
+ * @blake3_hash_many_f Hashes num_inputs inputs of blocks blocks each and
+ * stores their chaining values, BLAKE3_OUT_LEN bytes each, in out.  The
+ * counter of input i is counter + i when increment_counter is set and
+ * counter otherwise.  flags_start and flags_end are added to the flags of
+ * the first and last block of each input.
+ * @blake3_will_work_f Function tests whether implementation will function
+ */
+typedef void (*blake3_hash_many_f)(const uint8_t * const *inputs,
+    size_t num_inputs, size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out);
+typedef boolean_t (*blake3_will_work_f)(void);
+
+#define	BLAKE3_IMPL_NAME_MAX (16)
+
+typedef struct blake3_impl_ops {
+	blake3_hash_many_f hash_many;
+	blake3_will_work_f is_supported;
+	size_t degree;		/* inputs hashed in parallel */
+	char name[BLAKE3_IMPL_NAME_MAX];
+} blake3_impl_ops_t;
+
+extern const blake3_impl_ops_t blake3_generic_impl;
+#if defined(__x86_64) && defined(HAVE_SSE2)
+extern const blake3_impl_ops_t blake3_sse2_impl;
+#endif
+#if defined(__x86_64) && defined(HAVE_SSE4_1)
+extern const blake3_impl_ops_t blake3_sse41_impl;
+#endif
+#if defined(__x86_64) && defined(HAVE_SSE4_1) && defined(HAVE_AVX2)
+extern const blake3_impl_ops_t blake3_avx2_impl;
+#endif
+#if defined(__x86_64) && defined(HAVE_SSE4_1) && defined(HAVE_AVX2) && \
+	defined(HAVE_AVX512F)
+extern const blake3_impl_ops_t blake3_avx512_impl;
+#endif
+#if defined(__aarch64__) && defined(_LITTLE_ENDIAN)
+extern const blake3_impl_ops_t blake3_neon_impl;
+#endif
+
+/*
+ * Portable single block compression, used for the parts of the tree
+ * which are not hashed in parallel.
+ */
+void blake3_compress_in_place_generic(uint32_t cv[8],
+    const uint8_t block[BLAKE3_BLOCK_LEN], uint8_t block_len,
+    uint64_t counter, uint8_t flags);
+void blake3_compress_xof_generic(const uint32_t cv[8],
+    const uint8_t block[BLAKE3_BLOCK_LEN], uint8_t block_len,
+    uint64_t counter, uint8_t flags, uint8_t out[64]);
+void blake3_hash_many_generic(const uint8_t * const *inputs,
+    size_t num_inputs, size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out);
+
+/*
+ * Returns the optimal allowed BLAKE3 implementation
+ */
+const blake3_impl_ops_t *blake3_impl_get_ops(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _BLAKE3_IMPL_H */
@@ -36,19 +36,30 @@ extern "C" {
 #include <sys/zfs_context.h>
 #include <sys/crypto/common.h>
 
+struct gcm_ctx;
+
 /*
  * Methods used to define GCM implementation
  *
  * @gcm_mul_f Perform carry-less multiplication
+ * @gcm_crypt_f Encrypt (decrypt) and hash a multiple of the implementation
+ * specific number of blocks from the start of len bytes of input, advancing
+ * the counter and the GHASH of the context.  Returns the number of bytes
+ * processed, which is zero if the key schedule of the context is not
+ * supported.  The input and output may be the same buffer.
  * @gcm_will_work_f Function tests whether implementation will function
  */
 typedef void		(*gcm_mul_f)(uint64_t *, uint64_t *, uint64_t *);
+typedef size_t		(*gcm_crypt_f)(struct gcm_ctx *, const uint8_t *,
+    uint8_t *, size_t);
 typedef boolean_t	(*gcm_will_work_f)(void);
 
 #define	GCM_IMPL_NAME_MAX (16)
 
 typedef struct gcm_impl_ops {
 	gcm_mul_f mul;
+	gcm_crypt_f encrypt_blocks;	/* optional, may be NULL */
+	gcm_crypt_f decrypt_blocks;	/* optional, may be NULL */
 	gcm_will_work_f is_supported;
 	char name[GCM_IMPL_NAME_MAX];
 } gcm_impl_ops_t;
@@ -57,6 +68,15 @@ extern const gcm_impl_ops_t gcm_generic_impl;
 #if defined(__x86_64) && defined(HAVE_PCLMULQDQ)
 extern const gcm_impl_ops_t gcm_pclmulqdq_impl;
 #endif
+#if defined(__x86_64) && defined(HAVE_AVX) && defined(HAVE_AES) && \
+	defined(HAVE_PCLMULQDQ)
+extern const gcm_impl_ops_t gcm_avx_impl;
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2) && defined(HAVE_AES) && \
+	defined(HAVE_PCLMULQDQ) && defined(HAVE_VAES) && \
+	defined(HAVE_VPCLMULQDQ)
+extern const gcm_impl_ops_t gcm_vaes_impl;
+#endif
 
 /*
  * Initializes fastest implementation
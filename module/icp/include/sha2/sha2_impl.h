@@ -57,6 +57,51 @@ typedef struct sha2_hmac_ctx {
 	SHA2_CTX		hc_ocontext;	/* outer SHA2 context */
 } sha2_hmac_ctx_t;
 
+/*
+ * Methods used to define SHA2 implementations
+ *
+ * @sha2_transform_f Processes num consecutive blocks of input
+ * @sha2_will_work_f Function tests whether implementation will function
+ */
+typedef void (*sha2_transform_f)(SHA2_CTX *ctx, const void *in, size_t num);
+typedef boolean_t (*sha2_will_work_f)(void);
+
+#define	SHA2_IMPL_NAME_MAX (16)
+
+typedef struct sha2_impl_ops {
+	sha2_transform_f transform;
+	sha2_will_work_f is_supported;
+	char name[SHA2_IMPL_NAME_MAX];
+} sha2_impl_ops_t;
+
+extern const sha2_impl_ops_t sha256_generic_impl;
+extern const sha2_impl_ops_t sha512_generic_impl;
+#if defined(__x86_64)
+extern const sha2_impl_ops_t sha256_x86_64_impl;
+extern const sha2_impl_ops_t sha512_x86_64_impl;
+#endif
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+extern const sha2_impl_ops_t sha256_shani_impl;
+#endif
+#if defined(__aarch64__) && defined(_LITTLE_ENDIAN)
+extern const sha2_impl_ops_t sha256_armv8_impl;
+#endif
+
+/*
+ * Benchmarks and selects the fastest SHA256 and SHA512 implementations
+ */
+void sha2_impl_init(void *arg);
+void sha2_impl_fini(void);
+
+/*
+ * Returns the optimal allowed SHA256 or SHA512 implementation
+ */
+const sha2_impl_ops_t *sha256_impl_get_ops(void);
+const sha2_impl_ops_t *sha512_impl_get_ops(void);
+
+int sha256_impl_set(const char *val);
+int sha512_impl_set(const char *val);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -216,6 +216,22 @@ sha2_mod_init(void)
 {
 	int ret;
 
+#if defined(_KERNEL)
+	/*
+	 * Benchmark the SHA2 implementations in a dedicated kernel thread
+	 * to allow the use of SIMD operations, see the comment in aes.c.
+	 */
+	taskqid_t id = taskq_dispatch(system_taskq, sha2_impl_init,
+	    NULL, TQ_SLEEP);
+	if (id != TASKQID_INVALID) {
+		taskq_wait_id(system_taskq, id);
+	} else {
+		sha2_impl_init(NULL);
+	}
+#else
+	sha2_impl_init(NULL);
+#endif
+
 	if ((ret = mod_install(&modlinkage)) != 0)
 		return (ret);
 
@@ -248,6 +264,8 @@ sha2_mod_fini(void)
 		sha2_prov_handle = 0;
 	}
 
+	sha2_impl_fini();
+
 	return (mod_remove(&modlinkage));
 }
 
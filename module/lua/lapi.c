@@ -1011,6 +1011,12 @@ LUA_API int lua_status (lua_State *L) {
 }
 
 
+/* backported from Lua 5.3 */
+LUA_API int lua_isyieldable (lua_State *L) {
+  return (L->nny == 0);
+}
+
+
 /*
 ** Garbage-collection function
 */
@@ -2287,12 +2287,26 @@ nvlist_merge(nvlist_t *dst, nvlist_t *nvl, int flag)
 
 typedef struct nvs_ops nvs_ops_t;
 
+/*
+ * Encoded sizes of embedded nvlists, recorded while sizing a subtree during
+ * an XDR encode so the encode of that subtree does not size it again.  See
+ * nvs_xdr_nvp_size().
+ */
+#define	NVS_XDR_SIZES	32
+
+typedef struct {
+	uint32_t	nxs_size[NVS_XDR_SIZES];
+	uint_t		nxs_next;	/* next size to consume */
+	uint_t		nxs_count;	/* number of sizes recorded */
+} nvs_xdr_sizes_t;
+
 typedef struct {
 	int		nvs_op;
 	const nvs_ops_t	*nvs_ops;
 	void		*nvs_private;
 	nvpriv_t	*nvs_priv;
 	int		nvs_recursion;
+	nvs_xdr_sizes_t	*nvs_xdr_sizes;
 } nvstream_t;
 
 /*
@@ -2568,6 +2582,7 @@ nvlist_common(nvlist_t *nvl, char *buf, size_t *buflen, int encoding,
 
 	nvs.nvs_op = nvs_op;
 	nvs.nvs_recursion = 0;
+	nvs.nvs_xdr_sizes = NULL;
 
 	/*
 	 * For NVS_OP_ENCODE and NVS_OP_DECODE make sure an nvlist and
@@ -3457,10 +3472,32 @@ nvs_xdr_nvp_size(nvstream_t *nvs, nvpair_t *nvp, size_t *size)
 
 	case DATA_TYPE_NVLIST:
 	case DATA_TYPE_NVLIST_ARRAY: {
+		nvs_xdr_sizes_t *sizes = nvs->nvs_xdr_sizes;
 		size_t nvsize = 0;
 		int old_nvs_op = nvs->nvs_op;
+		int slot = -1;
 		int err;
 
+		/*
+		 * Encoding an embedded nvlist first needs its encoded size,
+		 * and encoding each nvlist nested within it needs that one's
+		 * size again, which makes encoding deep trees such as vdev
+		 * configs O(depth * size).  Sizing a subtree visits the
+		 * nested nvlists in the same order the subsequent encode of
+		 * that subtree asks for them, so the sizes are recorded in
+		 * that order and consumed one by one.  Once they run out
+		 * (or overflow), sizing starts over from the current pair.
+		 */
+		if (sizes != NULL && old_nvs_op == NVS_OP_ENCODE) {
+			if (sizes->nxs_next < sizes->nxs_count) {
+				nvp_sz += sizes->nxs_size[sizes->nxs_next++];
+				break;
+			}
+			sizes->nxs_next = sizes->nxs_count = 0;
+		} else if (sizes != NULL && sizes->nxs_count < NVS_XDR_SIZES) {
+			slot = sizes->nxs_count++;
+		}
+
 		nvs->nvs_op = NVS_OP_GETSIZE;
 		if (type == DATA_TYPE_NVLIST)
 			err = nvs_operation(nvs, EMBEDDED_NVL(nvp), &nvsize);
@@ -3468,9 +3505,12 @@ nvs_xdr_nvp_size(nvstream_t *nvs, nvpair_t *nvp, size_t *size)
 			err = nvs_embedded_nvl_array(nvs, nvp, &nvsize);
 		nvs->nvs_op = old_nvs_op;
 
-		if (err != 0)
+		if (err != 0 || nvsize > INT32_MAX)
 			return (EINVAL);
 
+		if (slot >= 0)
+			sizes->nxs_size[slot] = nvsize;
+
 		nvp_sz += nvsize;
 		break;
 	}
@@ -3574,10 +3614,16 @@ static int
 nvs_xdr(nvstream_t *nvs, nvlist_t *nvl, char *buf, size_t *buflen)
 {
 	XDR xdr;
+	nvs_xdr_sizes_t sizes;
 	int err;
 
 	nvs->nvs_ops = &nvs_xdr_ops;
 
+	if (nvs->nvs_op == NVS_OP_ENCODE) {
+		sizes.nxs_next = sizes.nxs_count = 0;
+		nvs->nvs_xdr_sizes = &sizes;
+	}
+
 	if ((err = nvs_xdr_create(nvs, &xdr, buf + sizeof (nvs_header_t),
 	    *buflen - sizeof (nvs_header_t))) != 0)
 		return (err);
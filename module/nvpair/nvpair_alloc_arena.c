@@ -0,0 +1,166 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/nvpair.h>
+#include <sys/kmem.h>
+#include <sys/vmem.h>
+#include <sys/sysmacros.h>
+
+/*
+ * Arena allocator for short lived nvlists.
+ *  - memory is carved sequentially out of chunks allocated on demand.
+ *  - individual frees are ignored, everything is released at once by
+ *    nv_alloc_reset() or nv_alloc_fini().
+ *
+ * This suits nvlists which are unpacked, consulted and then discarded as a
+ * whole, such as ioctl input.  A large unpack otherwise makes one kmem
+ * allocation per nvpair, nvlist and hash table and the same number of frees
+ * again in nvlist_free().  Allocations which do not fit comfortably in a
+ * chunk are given a chunk of their own.
+ */
+
+#define	NV_ARENA_CHUNK_SIZE	(16 * 1024)
+
+typedef struct nv_arena_chunk {
+	struct nv_arena_chunk	*nac_next;	/* next chunk in the arena */
+	size_t			nac_size;	/* size including this header */
+} nv_arena_chunk_t;
+
+typedef struct nv_arena {
+	nv_arena_chunk_t	*nva_chunks;	/* most recent chunk first */
+	uintptr_t		nva_cur;	/* next free address */
+	uintptr_t		nva_lim;	/* limit of the current chunk */
+} nv_arena_t;
+
+#define	NV_ARENA_HDRSZ	P2ROUNDUP(sizeof (nv_arena_chunk_t), sizeof (uint64_t))
+
+static nv_arena_chunk_t *
+nv_arena_chunk_alloc(nv_arena_t *arena, size_t size)
+{
+	nv_arena_chunk_t *nac = vmem_alloc(size, KM_SLEEP);
+
+	nac->nac_size = size;
+	nac->nac_next = arena->nva_chunks;
+	arena->nva_chunks = nac;
+
+	return (nac);
+}
+
+static void
+nv_arena_chunk_free(nv_arena_chunk_t *nac)
+{
+	vmem_free(nac, nac->nac_size);
+}
+
+/*ARGSUSED*/
+static int
+nv_arena_init(nv_alloc_t *nva, va_list valist)
+{
+	nva->nva_arg = kmem_zalloc(sizeof (nv_arena_t), KM_SLEEP);
+
+	return (0);
+}
+
+static void
+nv_arena_fini(nv_alloc_t *nva)
+{
+	nv_arena_t *arena = nva->nva_arg;
+	nv_arena_chunk_t *nac;
+
+	while ((nac = arena->nva_chunks) != NULL) {
+		arena->nva_chunks = nac->nac_next;
+		nv_arena_chunk_free(nac);
+	}
+
+	kmem_free(arena, sizeof (nv_arena_t));
+	nva->nva_arg = NULL;
+}
+
+static void *
+nv_arena_alloc(nv_alloc_t *nva, size_t size)
+{
+	nv_arena_t *arena = nva->nva_arg;
+	nv_arena_chunk_t *nac;
+	uintptr_t new;
+
+	if (size == 0)
+		return (NULL);
+
+	size = P2ROUNDUP(size, sizeof (uint64_t));
+
+	if (arena->nva_cur + size <= arena->nva_lim && arena->nva_cur != 0) {
+		new = arena->nva_cur;
+		arena->nva_cur += size;
+		return ((void *)new);
+	}
+
+	/*
+	 * Large requests get a dedicated chunk so they don't cause the
+	 * remainder of the current chunk to be abandoned.
+	 */
+	if (size > NV_ARENA_CHUNK_SIZE / 4) {
+		nac = nv_arena_chunk_alloc(arena, NV_ARENA_HDRSZ + size);
+		return ((void *)((uintptr_t)nac + NV_ARENA_HDRSZ));
+	}
+
+	nac = nv_arena_chunk_alloc(arena, NV_ARENA_CHUNK_SIZE);
+	new = (uintptr_t)nac + NV_ARENA_HDRSZ;
+	arena->nva_cur = new + size;
+	arena->nva_lim = (uintptr_t)nac + NV_ARENA_CHUNK_SIZE;
+
+	return ((void *)new);
+}
+
+/*ARGSUSED*/
+static void
+nv_arena_free(nv_alloc_t *nva, void *buf, size_t size)
+{
+	/* memory is only returned when the arena is reset or destroyed */
+}
+
+static void
+nv_arena_reset(nv_alloc_t *nva)
+{
+	nv_arena_t *arena = nva->nva_arg;
+	nv_arena_chunk_t *nac;
+
+	while ((nac = arena->nva_chunks) != NULL) {
+		arena->nva_chunks = nac->nac_next;
+		nv_arena_chunk_free(nac);
+	}
+
+	arena->nva_cur = 0;
+	arena->nva_lim = 0;
+}
+
+const nv_alloc_ops_t nv_arena_ops_def = {
+	.nv_ao_init = nv_arena_init,
+	.nv_ao_fini = nv_arena_fini,
+	.nv_ao_alloc = nv_arena_alloc,
+	.nv_ao_free = nv_arena_free,
+	.nv_ao_reset = nv_arena_reset
+};
+
+const nv_alloc_ops_t *nv_arena_ops = &nv_arena_ops_def;
+
+#if defined(_KERNEL)
+EXPORT_SYMBOL(nv_arena_ops);
+#endif
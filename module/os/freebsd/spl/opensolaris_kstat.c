@@ -162,13 +162,26 @@ __kstat_create(const char *module, int instance, const char *name, const char *c
 static int
 kstat_sysctl(SYSCTL_HANDLER_ARGS)
 {
-	kstat_named_t *ksent = arg1;
+	kstat_t *ksp = arg1;
+	kstat_named_t *ksent = (kstat_named_t *)ksp->ks_data + arg2;
 	uint64_t val;
 
+	(void) ksp->ks_update(ksp, KSTAT_READ);
 	val = ksent->value.ui64;
 	return sysctl_handle_64(oidp, &val, 0, req);
 }
 
+static int
+kstat_sysctl_string(SYSCTL_HANDLER_ARGS)
+{
+	kstat_t *ksp = arg1;
+	kstat_named_t *ksent = (kstat_named_t *)ksp->ks_data + arg2;
+
+	(void) ksp->ks_update(ksp, KSTAT_READ);
+	return sysctl_handle_string(oidp, KSTAT_NAMED_STR_PTR(ksent),
+	    KSTAT_NAMED_STR_BUFLEN(ksent), req);
+}
+
 void
 kstat_install(kstat_t *ksp)
 {
@@ -198,27 +211,33 @@ kstat_install(kstat_t *ksp)
 			case KSTAT_DATA_INT32:
 				SYSCTL_ADD_PROC(&ksp->ks_sysctl_ctx,
 				    SYSCTL_CHILDREN(ksp->ks_sysctl_root), OID_AUTO, namelast,
-				    CTLTYPE_S32 | CTLFLAG_RD, ksent, sizeof (*ksent),
+				    CTLTYPE_S32 | CTLFLAG_RD, ksp, i,
 					kstat_sysctl, "I", namelast);
 				break;
 			case KSTAT_DATA_UINT32:
 				SYSCTL_ADD_PROC(&ksp->ks_sysctl_ctx,
 				    SYSCTL_CHILDREN(ksp->ks_sysctl_root), OID_AUTO, namelast,
-				    CTLTYPE_U32 | CTLFLAG_RD, ksent, sizeof (*ksent),
+				    CTLTYPE_U32 | CTLFLAG_RD, ksp, i,
 					kstat_sysctl, "IU", namelast);
 				break;
 			case KSTAT_DATA_INT64:
 				SYSCTL_ADD_PROC(&ksp->ks_sysctl_ctx,
 				    SYSCTL_CHILDREN(ksp->ks_sysctl_root), OID_AUTO, namelast,
-				    CTLTYPE_S64 | CTLFLAG_RD, ksent, sizeof (*ksent),
+				    CTLTYPE_S64 | CTLFLAG_RD, ksp, i,
 					kstat_sysctl, "Q", namelast);
 				break;
 			case KSTAT_DATA_UINT64:
 				SYSCTL_ADD_PROC(&ksp->ks_sysctl_ctx,
 				    SYSCTL_CHILDREN(ksp->ks_sysctl_root), OID_AUTO, namelast,
-				    CTLTYPE_U64 | CTLFLAG_RD, ksent, sizeof (*ksent),
+				    CTLTYPE_U64 | CTLFLAG_RD, ksp, i,
 					kstat_sysctl, "QU", namelast);
 				break;
+			case KSTAT_DATA_STRING:
+				SYSCTL_ADD_PROC(&ksp->ks_sysctl_ctx,
+				    SYSCTL_CHILDREN(ksp->ks_sysctl_root), OID_AUTO, namelast,
+				    CTLTYPE_STRING | CTLFLAG_RD, ksp, i,
+					kstat_sysctl_string, "A", namelast);
+				break;
 			default:
 				panic("unsupported type: %d", typelast);
 		}
@@ -90,6 +90,9 @@
 #include <sys/zio.h>
 #include <sys/zfs_context.h>
 #include <sys/zfs_znode.h>
+#include <vm/vm.h>
+#include <vm/pmap.h>
+#include <vm/vm_page.h>
 
 typedef struct abd_stats {
 	kstat_named_t abdstat_struct_size;
@@ -133,6 +136,15 @@ static abd_stats_t abd_stats = {
 #define	ABDSTAT_BUMP(stat)	ABDSTAT_INCR(stat, 1)
 #define	ABDSTAT_BUMPDOWN(stat)	ABDSTAT_INCR(stat, -1)
 
+#define	ABD_GANG(abd)		(abd->abd_u.abd_gang)
+
+/*
+ * Gang ABDs have no chunks, but their chain does not fit in the space of
+ * the chunk offset and size of a scatter ABD.
+ */
+#define	ABD_GANG_STRUCT_SIZE	\
+	(offsetof(abd_t, abd_u.abd_gang) + sizeof (struct abd_gang))
+
 /*
  * It is possible to make all future ABDs be linear by setting this to B_FALSE.
  * Otherwise, ABDs are allocated scattered by default unless the caller uses
@@ -163,6 +175,7 @@ kmem_cache_t *abd_chunk_cache;
 static kstat_t *abd_ksp;
 
 extern inline boolean_t abd_is_linear(abd_t *abd);
+extern inline boolean_t abd_is_gang(abd_t *abd);
 extern inline void abd_copy(abd_t *dabd, abd_t *sabd, size_t size);
 extern inline void abd_copy_from_buf(abd_t *abd, const void *buf, size_t size);
 extern inline void abd_copy_to_buf(void* buf, abd_t *abd, size_t size);
@@ -197,6 +210,16 @@ abd_init(void)
 	}
 }
 
+/*
+ * The chunk cache keeps free chunks in per-CPU buckets of its own, release
+ * them when the ARC reaps its caches.
+ */
+void
+abd_cache_reap_now(void)
+{
+	kmem_cache_reap_now(abd_chunk_cache);
+}
+
 void
 abd_fini(void)
 {
@@ -219,6 +242,7 @@ static inline size_t
 abd_scatter_chunkcnt(abd_t *abd)
 {
 	ASSERT(!abd_is_linear(abd));
+	ASSERT(!abd_is_gang(abd));
 	return (abd_chunkcnt_for_bytes(
 	    abd->abd_u.abd_scatter.abd_offset + abd->abd_size));
 }
@@ -226,14 +250,27 @@ abd_scatter_chunkcnt(abd_t *abd)
 static inline void
 abd_verify(abd_t *abd)
 {
-	ASSERT3U(abd->abd_size, >, 0);
+	ASSERT(abd->abd_size > 0 || abd_is_gang(abd));
 	ASSERT3U(abd->abd_size, <=, SPA_MAXBLOCKSIZE);
 	ASSERT3U(abd->abd_flags, ==, abd->abd_flags & (ABD_FLAG_LINEAR |
-	    ABD_FLAG_OWNER | ABD_FLAG_META));
+	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_GANG |
+	    ABD_FLAG_GANG_FREE));
 	IMPLY(abd->abd_parent != NULL, !(abd->abd_flags & ABD_FLAG_OWNER));
 	IMPLY(abd->abd_flags & ABD_FLAG_META, abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd)) {
 		ASSERT3P(abd->abd_u.abd_linear.abd_buf, !=, NULL);
+	} else if (abd_is_gang(abd)) {
+		uint_t child_sizes = 0;
+		abd_t *cabd;
+
+		for (cabd = list_head(&ABD_GANG(abd).abd_gang_chain);
+		    cabd != NULL;
+		    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+			ASSERT(!abd_is_gang(cabd));
+			child_sizes += cabd->abd_size;
+			abd_verify(cabd);
+		}
+		ASSERT3U(abd->abd_size, ==, child_sizes);
 	} else {
 		ASSERT3U(abd->abd_u.abd_scatter.abd_offset, <,
 		    zfs_abd_chunk_size);
@@ -246,21 +283,36 @@ abd_verify(abd_t *abd)
 }
 
 static inline abd_t *
-abd_alloc_struct(size_t chunkcnt)
+abd_alloc_struct_size(size_t size)
 {
-	size_t size = offsetof(abd_t, abd_u.abd_scatter.abd_chunks[chunkcnt]);
 	abd_t *abd = kmem_alloc(size, KM_PUSHPAGE);
 	ASSERT3P(abd, !=, NULL);
+	list_link_init(&abd->abd_gang_link);
 	ABDSTAT_INCR(abdstat_struct_size, size);
 
 	return (abd);
 }
 
+static inline abd_t *
+abd_alloc_struct(size_t chunkcnt)
+{
+	return (abd_alloc_struct_size(
+	    offsetof(abd_t, abd_u.abd_scatter.abd_chunks[chunkcnt])));
+}
+
 static inline void
 abd_free_struct(abd_t *abd)
 {
-	size_t chunkcnt = abd_is_linear(abd) ? 0 : abd_scatter_chunkcnt(abd);
-	int size = offsetof(abd_t, abd_u.abd_scatter.abd_chunks[chunkcnt]);
+	int size;
+
+	ASSERT(!list_link_active(&abd->abd_gang_link));
+	if (abd_is_gang(abd)) {
+		size = ABD_GANG_STRUCT_SIZE;
+	} else {
+		size_t chunkcnt = abd_is_linear(abd) ? 0 :
+		    abd_scatter_chunkcnt(abd);
+		size = offsetof(abd_t, abd_u.abd_scatter.abd_chunks[chunkcnt]);
+	}
 	kmem_free(abd, size);
 	ABDSTAT_INCR(abdstat_struct_size, -size);
 }
@@ -371,8 +423,181 @@ abd_free_linear(abd_t *abd)
 }
 
 /*
- * Free an ABD. Only use this on ABDs allocated with abd_alloc() or
- * abd_alloc_linear().
+ * Allocate a gang ABD, which chains together other ABDs, its children,
+ * without copying their data.  It starts out empty and grows as children
+ * are added with abd_gang_add().  Use abd_free() to free it.
+ */
+abd_t *
+abd_alloc_gang_abd(void)
+{
+	abd_t *abd = abd_alloc_struct_size(ABD_GANG_STRUCT_SIZE);
+
+	abd->abd_flags = ABD_FLAG_GANG | ABD_FLAG_OWNER;
+	abd->abd_size = 0;
+	abd->abd_parent = NULL;
+	list_create(&ABD_GANG(abd).abd_gang_chain,
+	    sizeof (abd_t), offsetof(abd_t, abd_gang_link));
+	zfs_refcount_create(&abd->abd_children);
+
+	return (abd);
+}
+
+/*
+ * The children of a gang ABD added to another gang ABD are added in its
+ * place, so the children of a gang ABD are never gang ABDs themselves.
+ * If the gang ABD is to be freed with pabd, its children are moved over
+ * and it is freed right away.
+ */
+static void
+abd_gang_add_gang(abd_t *pabd, abd_t *cabd, boolean_t free_on_free)
+{
+	abd_t *c;
+
+	if (!free_on_free) {
+		for (c = list_head(&ABD_GANG(cabd).abd_gang_chain); c != NULL;
+		    c = list_next(&ABD_GANG(cabd).abd_gang_chain, c))
+			abd_gang_add(pabd, c, B_FALSE);
+		return;
+	}
+
+	while ((c = list_remove_head(&ABD_GANG(cabd).abd_gang_chain)) !=
+	    NULL) {
+		boolean_t c_free = (c->abd_flags & ABD_FLAG_GANG_FREE) != 0;
+
+		cabd->abd_size -= c->abd_size;
+		c->abd_flags &= ~ABD_FLAG_GANG_FREE;
+		if (!c_free) {
+			(void) zfs_refcount_remove_many(&c->abd_children,
+			    c->abd_size, cabd);
+		}
+		abd_gang_add(pabd, c, c_free);
+	}
+
+	if (cabd->abd_flags & ABD_FLAG_OWNER)
+		abd_free(cabd);
+	else
+		abd_put(cabd);
+}
+
+/*
+ * Add cabd to the end of the gang ABD pabd.  If free_on_free is set,
+ * cabd is freed along with pabd, otherwise it must not be freed before
+ * pabd.  An ABD can only be the child of one gang ABD at a time, so if
+ * it already is one, a view of it is added instead.
+ */
+void
+abd_gang_add(abd_t *pabd, abd_t *cabd, boolean_t free_on_free)
+{
+	ASSERT(abd_is_gang(pabd));
+	abd_verify(cabd);
+
+	if (abd_is_gang(cabd)) {
+		abd_gang_add_gang(pabd, cabd, free_on_free);
+		return;
+	}
+
+	if (list_link_active(&cabd->abd_gang_link)) {
+		ASSERT(!free_on_free);
+		cabd = abd_get_offset(cabd, 0);
+		free_on_free = B_TRUE;
+	}
+
+	if (free_on_free) {
+		cabd->abd_flags |= ABD_FLAG_GANG_FREE;
+	} else {
+		(void) zfs_refcount_add_many(&cabd->abd_children,
+		    cabd->abd_size, pabd);
+	}
+
+	list_insert_tail(&ABD_GANG(pabd).abd_gang_chain, cabd);
+	pabd->abd_size += cabd->abd_size;
+}
+
+/*
+ * Return the child of a gang ABD which contains offset *off, and update
+ * *off to be the offset in that child.  Returns NULL if *off is past the
+ * end of the gang ABD.
+ */
+static abd_t *
+abd_gang_get_offset(abd_t *abd, size_t *off)
+{
+	abd_t *cabd;
+
+	ASSERT(abd_is_gang(abd));
+	for (cabd = list_head(&ABD_GANG(abd).abd_gang_chain); cabd != NULL;
+	    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+		if (*off < cabd->abd_size)
+			break;
+		*off -= cabd->abd_size;
+	}
+
+	return (cabd);
+}
+
+/*
+ * Remove all children of a gang ABD, freeing the ones added with
+ * free_on_free set.
+ */
+static void
+abd_gang_remove_children(abd_t *abd)
+{
+	abd_t *cabd;
+
+	while ((cabd = list_remove_head(&ABD_GANG(abd).abd_gang_chain)) !=
+	    NULL) {
+		abd->abd_size -= cabd->abd_size;
+		if (cabd->abd_flags & ABD_FLAG_GANG_FREE) {
+			cabd->abd_flags &= ~ABD_FLAG_GANG_FREE;
+			if (cabd->abd_flags & ABD_FLAG_OWNER)
+				abd_free(cabd);
+			else
+				abd_put(cabd);
+		} else {
+			(void) zfs_refcount_remove_many(&cabd->abd_children,
+			    cabd->abd_size, abd);
+		}
+	}
+	ASSERT0(abd->abd_size);
+	list_destroy(&ABD_GANG(abd).abd_gang_chain);
+}
+
+/*
+ * A view of part of a gang ABD is a new gang ABD of views of the children
+ * covering that part.  Only the children are referenced by the view, so it
+ * has no parent.
+ */
+static abd_t *
+abd_get_offset_gang(abd_t *sabd, size_t off, size_t size)
+{
+	abd_t *abd = abd_alloc_gang_abd();
+	abd_t *cabd;
+
+	abd->abd_flags &= ~ABD_FLAG_OWNER;
+	for (cabd = abd_gang_get_offset(sabd, &off); cabd != NULL && size > 0;
+	    cabd = list_next(&ABD_GANG(sabd).abd_gang_chain, cabd)) {
+		size_t csize = MIN(size, cabd->abd_size - off);
+
+		abd_gang_add(abd, abd_get_offset_size(cabd, off, csize),
+		    B_TRUE);
+		size -= csize;
+		off = 0;
+	}
+	ASSERT0(size);
+
+	return (abd);
+}
+
+static void
+abd_free_gang_abd(abd_t *abd)
+{
+	abd_gang_remove_children(abd);
+	zfs_refcount_destroy(&abd->abd_children);
+	abd_free_struct(abd);
+}
+
+/*
+ * Free an ABD. Only use this on ABDs allocated with abd_alloc(),
+ * abd_alloc_linear() or abd_alloc_gang_abd().
  */
 void
 abd_free(abd_t *abd)
@@ -385,6 +610,8 @@ abd_free(abd_t *abd)
 	ASSERT(abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd))
 		abd_free_linear(abd);
+	else if (abd_is_gang(abd))
+		abd_free_gang_abd(abd);
 	else
 		abd_free_scatter(abd);
 }
@@ -434,6 +661,11 @@ abd_get_offset_impl(abd_t *sabd, size_t off, size_t size)
 	abd_verify(sabd);
 	ASSERT3U(off, <=, sabd->abd_size);
 
+	if (abd_is_gang(sabd)) {
+		return (abd_get_offset_gang(sabd, off,
+		    size == 0 ? sabd->abd_size - off : size));
+	}
+
 	if (abd_is_linear(sabd)) {
 		abd = abd_alloc_struct(0);
 
@@ -541,6 +773,9 @@ abd_put(abd_t *abd)
 		    abd->abd_size, abd);
 	}
 
+	if (abd_is_gang(abd))
+		abd_gang_remove_children(abd);
+
 	zfs_refcount_destroy(&abd->abd_children);
 	abd_free_struct(abd);
 }
@@ -556,6 +791,43 @@ abd_to_buf(abd_t *abd)
 	return (abd->abd_u.abd_linear.abd_buf);
 }
 
+/*
+ * Describe [off, off + size) of a scatter ABD as an array of pages for an
+ * unmapped bio, so that the I/O needs neither a borrowed buffer nor a KVA
+ * mapping.  This only works when every chunk is a whole, page aligned page,
+ * as it is with the default zfs_abd_chunk_size.  Returns the number of
+ * pages filled in, with the offset into the first one in *pgoff, or 0 if
+ * the ABD cannot be described this way.  ma must have room for
+ * howmany(size, PAGE_SIZE) + 1 pages.
+ */
+int
+abd_unmapped_pages_off(abd_t *abd, size_t off, size_t size,
+    struct vm_page **ma, int *pgoff)
+{
+	size_t start, first, last;
+
+	if (abd_is_linear(abd) || abd_is_gang(abd) ||
+	    abd->abd_u.abd_scatter.abd_chunk_size != PAGE_SIZE)
+		return (0);
+
+	ASSERT3U(off + size, <=, abd->abd_size);
+
+	start = abd->abd_u.abd_scatter.abd_offset + off;
+	first = start >> PAGE_SHIFT;
+	last = (start + size - 1) >> PAGE_SHIFT;
+
+	for (size_t i = first; i <= last; i++) {
+		void *c = abd->abd_u.abd_scatter.abd_chunks[i];
+
+		if (((uintptr_t)c & PAGE_MASK) != 0)
+			return (0);
+		ma[i - first] = PHYS_TO_VM_PAGE(pmap_kextract((vm_offset_t)c));
+	}
+
+	*pgoff = start & PAGE_MASK;
+	return (last - first + 1);
+}
+
 /*
  * Borrow a raw buffer from an ABD without copying the contents of the ABD
  * into the buffer. If the ABD is scattered, this will allocate a raw buffer
@@ -655,7 +927,8 @@ abd_release_ownership_of_buf(abd_t *abd)
 }
 
 struct abd_iter {
-	abd_t		*iter_abd;	/* ABD being iterated through */
+	abd_t		*iter_gang;	/* gang ABD being iterated through */
+	abd_t		*iter_abd;	/* ABD (or gang child) being iterated */
 	size_t		iter_pos;	/* position (relative to abd_offset) */
 	void		*iter_mapaddr;	/* addr corresponding to iter_pos */
 	size_t		iter_mapsize;	/* length of data valid at mapaddr */
@@ -678,12 +951,19 @@ abd_iter_scatter_chunk_index(struct abd_iter *aiter)
 }
 
 /*
- * Initialize the abd_iter.
+ * Initialize the abd_iter.  A gang ABD is iterated through one child at a
+ * time, so no chunk mapped by the abd_iter spans two children.
  */
 static void
 abd_iter_init(struct abd_iter *aiter, abd_t *abd)
 {
 	abd_verify(abd);
+	aiter->iter_gang = NULL;
+	if (abd_is_gang(abd) &&
+	    !list_is_empty(&ABD_GANG(abd).abd_gang_chain)) {
+		aiter->iter_gang = abd;
+		abd = list_head(&ABD_GANG(abd).abd_gang_chain);
+	}
 	aiter->iter_abd = abd;
 	aiter->iter_pos = 0;
 	aiter->iter_mapaddr = NULL;
@@ -705,6 +985,19 @@ abd_iter_advance(struct abd_iter *aiter, size_t amount)
 	if (aiter->iter_pos == aiter->iter_abd->abd_size)
 		return;
 
+	/* Step over the rest of the current child of a gang ABD */
+	while (aiter->iter_gang != NULL &&
+	    amount >= aiter->iter_abd->abd_size - aiter->iter_pos) {
+		abd_t *cabd = list_next(&ABD_GANG(aiter->iter_gang).
+		    abd_gang_chain, aiter->iter_abd);
+
+		if (cabd == NULL)
+			break;
+		amount -= aiter->iter_abd->abd_size - aiter->iter_pos;
+		aiter->iter_abd = cabd;
+		aiter->iter_pos = 0;
+	}
+
 	aiter->iter_pos += amount;
 }
 
@@ -722,7 +1015,8 @@ abd_iter_map(struct abd_iter *aiter)
 	ASSERT0(aiter->iter_mapsize);
 
 	/* Panic if someone has changed zfs_abd_chunk_size */
-	IMPLY(!abd_is_linear(aiter->iter_abd), zfs_abd_chunk_size ==
+	IMPLY(!abd_is_linear(aiter->iter_abd) &&
+	    !abd_is_gang(aiter->iter_abd), zfs_abd_chunk_size ==
 	    aiter->iter_abd->abd_u.abd_scatter.abd_chunk_size);
 
 	/* There's nothing left to iterate over, so do nothing */
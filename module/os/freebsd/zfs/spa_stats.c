@@ -24,6 +24,11 @@ spa_iostats_trim_add(spa_t *spa, trim_type_t type,
 {
 }
 
+void
+spa_iostats_mmp_add(spa_t *spa, hrtime_t duration, int error)
+{
+}
+
 void
 spa_read_history_add(spa_t *spa, const zbookmark_phys_t *zb, uint32_t aflags)
 {
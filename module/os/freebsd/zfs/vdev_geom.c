@@ -36,6 +36,7 @@
 #include <sys/zio.h>
 #include <geom/geom.h>
 #include <geom/geom_int.h>
+#include <sys/buf.h>
 
 /*
  * Virtual device vector for GEOM.
@@ -69,6 +70,10 @@ SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, bio_flush_disable, CTLFLAG_RWTUN,
 static int vdev_geom_bio_delete_disable;
 SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, bio_delete_disable, CTLFLAG_RWTUN,
     &vdev_geom_bio_delete_disable, 0, "Disable BIO_DELETE");
+/* Issue scatter ABDs as unmapped bios where the provider accepts them. */
+static int vdev_geom_bio_unmapped = 1;
+SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, bio_unmapped, CTLFLAG_RWTUN,
+    &vdev_geom_bio_unmapped, 0, "Use unmapped bios for scatter ABDs");
 
 /* Declare local functions */
 static void vdev_geom_detach(struct g_consumer *cp, boolean_t open_for_read);
@@ -1020,6 +1025,42 @@ vdev_geom_io_intr(struct bio *bp)
 	zio_delay_interrupt(zio);
 }
 
+static inline size_t
+vdev_geom_bio_ma_size(zio_t *zio)
+{
+	return ((howmany(zio->io_size, PAGE_SIZE) + 1) * sizeof (vm_page_t));
+}
+
+/*
+ * Point the bio straight at the pages of a scatter ABD, rather than at a
+ * borrowed linear buffer that the data has to be copied through.
+ */
+static boolean_t
+vdev_geom_bio_map_unmapped(struct bio *bp, struct g_consumer *cp, zio_t *zio)
+{
+	vm_page_t *ma;
+	int n, pgoff;
+
+	if (!vdev_geom_bio_unmapped || abd_is_linear(zio->io_abd) ||
+	    (cp->provider->flags & G_PF_ACCEPT_UNMAPPED) == 0)
+		return (B_FALSE);
+
+	ma = kmem_alloc(vdev_geom_bio_ma_size(zio), KM_SLEEP);
+	n = abd_unmapped_pages_off(zio->io_abd, 0, zio->io_size, ma, &pgoff);
+	if (n == 0) {
+		kmem_free(ma, vdev_geom_bio_ma_size(zio));
+		return (B_FALSE);
+	}
+
+	bp->bio_ma = ma;
+	bp->bio_ma_n = n;
+	bp->bio_ma_offset = pgoff;
+	bp->bio_data = unmapped_buf;
+	bp->bio_flags |= BIO_UNMAPPED;
+
+	return (B_TRUE);
+}
+
 static void
 vdev_geom_io_start(zio_t *zio)
 {
@@ -1085,12 +1126,16 @@ sendreq:
 		bp->bio_length = zio->io_size;
 		if (zio->io_type == ZIO_TYPE_READ) {
 			bp->bio_cmd = BIO_READ;
-			bp->bio_data =
-			    abd_borrow_buf(zio->io_abd, zio->io_size);
+			if (!vdev_geom_bio_map_unmapped(bp, cp, zio)) {
+				bp->bio_data =
+				    abd_borrow_buf(zio->io_abd, zio->io_size);
+			}
 		} else {
 			bp->bio_cmd = BIO_WRITE;
-			bp->bio_data =
-			    abd_borrow_buf_copy(zio->io_abd, zio->io_size);
+			if (!vdev_geom_bio_map_unmapped(bp, cp, zio)) {
+				bp->bio_data = abd_borrow_buf_copy(zio->io_abd,
+				    zio->io_size);
+			}
 		}
 		break;
 	case ZIO_TYPE_TRIM:
@@ -1130,7 +1175,9 @@ vdev_geom_io_done(zio_t *zio)
 		return;
 	}
 
-	if (zio->io_type == ZIO_TYPE_READ)
+	if (bp->bio_flags & BIO_UNMAPPED)
+		kmem_free(bp->bio_ma, vdev_geom_bio_ma_size(zio));
+	else if (zio->io_type == ZIO_TYPE_READ)
 		abd_return_buf_copy(zio->io_abd, bp->bio_data, zio->io_size);
 	else
 		abd_return_buf(zio->io_abd, bp->bio_data, zio->io_size);
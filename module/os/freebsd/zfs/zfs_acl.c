@@ -2072,6 +2072,53 @@ zfs_zaccess_dataset_check(znode_t *zp, uint32_t v4_mode)
 	return (0);
 }
 
+/*
+ * Compute the access bits that a cached ACL grants to every caller: those
+ * allowed by an everyone@ ACE that no earlier DENY ACE could take away,
+ * whoever that DENY ACE applies to.  Since ACE evaluation is first-match
+ * per bit, any request confined to these bits is granted without having
+ * to resolve the caller's identity against each entry.  Returns 0 for
+ * ACLs containing unknown entry types so they always take the slow path.
+ */
+static uint32_t
+zfs_acl_everyone_allowed(zfs_acl_t *aclp, boolean_t isdir)
+{
+	zfs_ace_hdr_t	*acep = NULL;
+	uint64_t	who;
+	uint32_t	access_mask;
+	uint32_t	maybe_denied = 0;
+	uint32_t	allowed = 0;
+	uint16_t	type, iflags, entry_type;
+
+	while ((acep = zfs_acl_next_ace(aclp, acep, &who, &access_mask,
+	    &iflags, &type))) {
+		if (!zfs_acl_valid_ace_type(type, iflags))
+			continue;
+
+		if (isdir && (iflags & ACE_INHERIT_ONLY_ACE))
+			continue;
+
+		entry_type = (iflags & ACE_TYPE_FLAGS);
+		switch (entry_type) {
+		case ACE_OWNER:
+		case OWNING_GROUP:
+		case ACE_IDENTIFIER_GROUP:
+		case ACE_EVERYONE:
+		case 0:
+			break;
+		default:
+			return (0);
+		}
+
+		if (type == DENY)
+			maybe_denied |= access_mask;
+		else if (entry_type == ACE_EVERYONE)
+			allowed |= (access_mask & ~maybe_denied);
+	}
+
+	return (allowed);
+}
+
 /*
  * The primary usage of this function is to loop through all of the
  * ACEs in the znode, determining what accesses of interest (AoI) to
@@ -2128,6 +2175,23 @@ zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
 
 	ASSERT(zp->z_acl_cached);
 
+	/*
+	 * Fast path: requests satisfied entirely by the everyone@ grants
+	 * need no per-ACE evaluation.  The summary lives with the cached
+	 * ACL, so it is discarded whenever the ACL changes.
+	 */
+	if (!aclp->z_everyone_valid) {
+		aclp->z_everyone_allow = zfs_acl_everyone_allowed(aclp,
+		    ZTOV(zp)->v_type == VDIR);
+		aclp->z_everyone_valid = B_TRUE;
+	}
+	if ((anyaccess && (*working_mode & aclp->z_everyone_allow)) ||
+	    (*working_mode & ~aclp->z_everyone_allow) == 0) {
+		mutex_exit(&zp->z_acl_lock);
+		*working_mode = 0;
+		return (0);
+	}
+
 	while ((acep = zfs_acl_next_ace(aclp, acep, &who, &access_mask,
 		&iflags, &type))) {
 		uint32_t mask_matched;
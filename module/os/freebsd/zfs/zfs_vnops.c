@@ -662,7 +662,7 @@ mappedread(vnode_t *vp, int nbytes, uio_t *uio)
 		} else {
 			zfs_vmobject_wunlock(obj);
 			error = dmu_read_uio_dbuf(sa_get_db(zp->z_sa_hdl),
-			    uio, bytes);
+			    uio, bytes, 0);
 			zfs_vmobject_wlock(obj);
 		}
 		len -= bytes;
@@ -702,6 +702,7 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	ssize_t		n, nbytes;
 	int		error = 0;
 	locked_range_t		*lr;
+	hrtime_t	start = gethrtime();
 
 	ZFS_ENTER(zfsvfs);
 	ZFS_VERIFY_ZP(zp);
@@ -751,6 +752,7 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 
 	ASSERT(uio->uio_loffset < zp->z_size);
 	n = MIN(uio->uio_resid, zp->z_size - uio->uio_loffset);
+	ssize_t start_resid = n;
 
 	while (n > 0) {
 		nbytes = MIN(n, zfs_read_chunk_size -
@@ -762,7 +764,7 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 			error = mappedread(vp, nbytes, uio);
 		} else {
 			error = dmu_read_uio_dbuf(sa_get_db(zp->z_sa_hdl),
-			    uio, nbytes);
+			    uio, nbytes, 0);
 		}
 		if (error) {
 			/* convert checksum errors into IO errors */
@@ -773,6 +775,10 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 
 		n -= nbytes;
 	}
+
+	dataset_kstats_update_read_kstats(&zfsvfs->z_kstat, start_resid - n);
+	dataset_kstats_update_latency(&zfsvfs->z_kstat, DATASET_OP_READ,
+	    start);
 out:
 	rangelock_exit(lr);
 
@@ -827,6 +833,7 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	int		count = 0;
 	sa_bulk_attr_t	bulk[4];
 	uint64_t	mtime[2], ctime[2];
+	hrtime_t	start = gethrtime();
 
 	/*
 	 * Fasttrack empty write
@@ -1033,7 +1040,7 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		if (abuf == NULL) {
 			tx_bytes = uio->uio_resid;
 			error = dmu_write_uio_dbuf(sa_get_db(zp->z_sa_hdl),
-			    uio, nbytes, tx);
+			    uio, nbytes, tx, 0);
 			tx_bytes -= uio->uio_resid;
 		} else {
 			tx_bytes = nbytes;
@@ -1159,6 +1166,11 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	    zfsvfs->z_os->os_sync == ZFS_SYNC_ALWAYS)
 		zil_commit(zilog, zp->z_id);
 
+	dataset_kstats_update_write_kstats(&zfsvfs->z_kstat,
+	    start_resid - uio->uio_resid);
+	dataset_kstats_update_latency(&zfsvfs->z_kstat, DATASET_OP_WRITE,
+	    start);
+
 	ZFS_EXIT(zfsvfs);
 	return (0);
 }
@@ -2248,6 +2260,8 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp, int *ncookies, u_lon
 	int		ncooks;
 	u_long		*cooks = NULL;
 	int		flags = 0;
+	uint64_t	*pfobjs = NULL;
+	int		npf = 0;
 
 	ZFS_ENTER(zfsvfs);
 	ZFS_VERIFY_ZP(zp);
@@ -2285,6 +2299,10 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp, int *ncookies, u_lon
 	os = zfsvfs->z_os;
 	offset = uio->uio_loffset;
 	prefetch = zp->z_zn_prefetch;
+	if (prefetch) {
+		pfobjs = kmem_alloc(DMU_PREFETCH_DNODES_BATCH *
+		    sizeof (uint64_t), KM_SLEEP);
+	}
 
 	/*
 	 * Initialize the iterator cursor.
@@ -2469,10 +2487,15 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp, int *ncookies, u_lon
 
 		ASSERT(outcount <= bufsize);
 
-		/* Prefetch znode */
-		if (prefetch)
-			dmu_prefetch(os, objnum, 0, 0, 0,
-			    ZIO_PRIORITY_SYNC_READ);
+		/* Prefetch znodes, a batch at a time */
+		if (prefetch) {
+			pfobjs[npf++] = objnum;
+			if (npf == DMU_PREFETCH_DNODES_BATCH) {
+				dmu_prefetch_dnodes(os, pfobjs, npf,
+				    ZIO_PRIORITY_SYNC_READ);
+				npf = 0;
+			}
+		}
 
 	skip_entry:
 		/*
@@ -2513,6 +2536,13 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp, int *ncookies, u_lon
 
 update:
 	zap_cursor_fini(&zc);
+	if (pfobjs != NULL) {
+		if (npf > 0)
+			dmu_prefetch_dnodes(os, pfobjs, npf,
+			    ZIO_PRIORITY_SYNC_READ);
+		kmem_free(pfobjs, DMU_PREFETCH_DNODES_BATCH *
+		    sizeof (uint64_t));
+	}
 	if (uio->uio_segflg != UIO_SYSSPACE || uio->uio_iovcnt != 1)
 		kmem_free(outbuf, bufsize);
 
@@ -2542,9 +2572,13 @@ zfs_fsync(vnode_t *vp, int syncflag, cred_t *cr, caller_context_t *ct)
 	(void) tsd_set(zfs_fsyncer_key, (void *)zfs_fsync_sync_cnt);
 
 	if (zfsvfs->z_os->os_sync != ZFS_SYNC_DISABLED) {
+		hrtime_t start = gethrtime();
+
 		ZFS_ENTER(zfsvfs);
 		ZFS_VERIFY_ZP(zp);
 		zil_commit(zfsvfs->z_log, zp->z_id);
+		dataset_kstats_update_latency(&zfsvfs->z_kstat,
+		    DATASET_OP_FSYNC, start);
 		ZFS_EXIT(zfsvfs);
 	}
 	return (0);
@@ -110,7 +110,7 @@ extern struct vop_vector zfs_shareops;
  * This callback is invoked when acquiring a RL_WRITER or RL_APPEND lock on
  * z_rangelock. It will modify the offset and length of the lock to reflect
  * znode-specific information, and convert RL_APPEND to RL_WRITER.  This is
- * called with the rangelock_t's rl_lock held, which avoids races.
+ * called with the rangelock_t's rls_lock held, which avoids races.
  */
 static void
 zfs_rangelock_cb(locked_range_t *new, void *arg)
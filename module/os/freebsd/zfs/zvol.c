@@ -161,6 +161,7 @@ struct zvol_state {
 	rangelock_t	zv_rangelock;	/* range lock */
 	dnode_t		*zv_dn;		/* dnode hold */
 	int		zv_state;
+	int		zv_workers;	/* running GEOM worker threads */
 	int		zv_volmode;	/* Provide GEOM or cdev */
 	struct bio_queue_head zv_queue;
 	struct mtx	zv_queue_mtx;	/* zv_queue mutex */
@@ -218,6 +219,15 @@ SYSCTL_INT(_vfs_zfs_vol, OID_AUTO, unmap_sync_enabled, CTLFLAG_RWTUN,
     &zvol_unmap_sync_enabled, 0,
     "UNMAPs requested as sync are executed synchronously");
 
+/*
+ * Number of threads serving the bios of a GEOM zvol which could not be
+ * handled directly in the context of zvol_geom_start().
+ */
+static int zvol_geom_workers = 4;
+SYSCTL_INT(_vfs_zfs_vol, OID_AUTO, geom_workers, CTLFLAG_RWTUN,
+    &zvol_geom_workers, 0,
+    "Number of worker threads of each GEOM zvol");
+
 static d_open_t		zvol_d_open;
 static d_close_t	zvol_d_close;
 static d_read_t		zvol_read;
@@ -588,7 +598,7 @@ zvol_create_minor_impl(const char *name)
 	zv->zv_objset = os;
 	if (dmu_objset_is_snapshot(os) || !spa_writeable(dmu_objset_spa(os)))
 		zv->zv_flags |= ZVOL_RDONLY;
-	zfs_rangelock_init(&zv->zv_rangelock, NULL, NULL);
+	zfs_rangelock_init_striped(&zv->zv_rangelock);
 	list_create(&zv->zv_extents, sizeof (zvol_extent_t),
 	    offsetof(zvol_extent_t, ze_node));
 	if (spa_writeable(dmu_objset_spa(os))) {
@@ -1306,7 +1316,7 @@ zvol_strategy(struct bio *bp)
 			    DMU_READ_PREFETCH);
 		} else {
 			dmu_tx_t *tx = dmu_tx_create(os);
-			dmu_tx_hold_write(tx, ZVOL_OBJ, off, size);
+			dmu_tx_hold_write_by_dnode(tx, zv->zv_dn, off, size);
 			error = dmu_tx_assign(tx, TXG_WAIT);
 			if (error) {
 				dmu_tx_abort(tx);
@@ -1411,7 +1421,7 @@ zvol_write(struct cdev *dev, struct uio *uio, int ioflag)
 		if (bytes > volsize - off)	/* don't write past the end */
 			bytes = volsize - off;
 
-		dmu_tx_hold_write(tx, ZVOL_OBJ, off, bytes);
+		dmu_tx_hold_write_by_dnode(tx, zv->zv_dn, off, bytes);
 		error = dmu_tx_assign(tx, TXG_WAIT);
 		if (error) {
 			dmu_tx_abort(tx);
@@ -1642,8 +1652,11 @@ zvol_geom_run(zvol_state_t *zv)
 	pp = zv->zv_provider;
 	g_error_provider(pp, 0);
 
-	kproc_kthread_add(zvol_geom_worker, zv, &zfsproc, NULL, 0, 0,
-	    "zfskern", "zvol %s", pp->name + sizeof (ZVOL_DRIVER));
+	zv->zv_workers = MIN(MAX(zvol_geom_workers, 1), 64);
+	for (int i = 0; i < zv->zv_workers; i++) {
+		kproc_kthread_add(zvol_geom_worker, zv, &zfsproc, NULL, 0, 0,
+		    "zfskern", "zvol %s", pp->name + sizeof (ZVOL_DRIVER));
+	}
 }
 
 static void
@@ -1655,8 +1668,8 @@ zvol_geom_destroy(zvol_state_t *zv)
 
 	mtx_lock(&zv->zv_queue_mtx);
 	zv->zv_state = 1;
-	wakeup_one(&zv->zv_queue);
-	while (zv->zv_state != 2)
+	wakeup(&zv->zv_queue);
+	while (zv->zv_workers != 0)
 		msleep(&zv->zv_state, &zv->zv_queue_mtx, 0, "zvol:w", 0);
 	mtx_unlock(&zv->zv_queue_mtx);
 	mtx_destroy(&zv->zv_queue_mtx);
@@ -1720,7 +1733,6 @@ static void
 zvol_geom_start(struct bio *bp)
 {
 	zvol_state_t *zv;
-	boolean_t first;
 
 	zv = bp->bio_to->private;
 	ASSERT(zv != NULL);
@@ -1777,12 +1789,14 @@ zvol_geom_start(struct bio *bp)
 	return;
 
 enqueue:
+	/*
+	 * Wake a worker for every queued bio, not only for the first one,
+	 * so that a burst of bios is spread over all of the workers.
+	 */
 	mtx_lock(&zv->zv_queue_mtx);
-	first = (bioq_first(&zv->zv_queue) == NULL);
 	bioq_insert_tail(&zv->zv_queue, bp);
 	mtx_unlock(&zv->zv_queue_mtx);
-	if (first)
-		wakeup_one(&zv->zv_queue);
+	wakeup_one(&zv->zv_queue);
 }
 
 static void
@@ -1801,8 +1815,8 @@ zvol_geom_worker(void *arg)
 		bp = bioq_takefirst(&zv->zv_queue);
 		if (bp == NULL) {
 			if (zv->zv_state == 1) {
-				zv->zv_state = 2;
-				wakeup(&zv->zv_state);
+				if (--zv->zv_workers == 0)
+					wakeup(&zv->zv_state);
 				mtx_unlock(&zv->zv_queue_mtx);
 				kthread_exit();
 			}
@@ -39,6 +39,7 @@
 #include <sys/debug.h>
 #include <sys/proc.h>
 #include <sys/kstat.h>
+#include <sys/lockstat.h>
 #include <sys/file.h>
 #include <linux/ctype.h>
 #include <sys/disp.h>
@@ -714,11 +715,16 @@ spl_init(void)
 	if ((rc = spl_kstat_init()))
 		goto out7;
 
-	if ((rc = spl_zlib_init()))
+	if ((rc = spl_lockstat_init()))
 		goto out8;
 
+	if ((rc = spl_zlib_init()))
+		goto out9;
+
 	return (rc);
 
+out9:
+	spl_lockstat_fini();
 out8:
 	spl_kstat_fini();
 out7:
@@ -741,6 +747,7 @@ static void __exit
 spl_fini(void)
 {
 	spl_zlib_fini();
+	spl_lockstat_fini();
 	spl_kstat_fini();
 	spl_proc_fini();
 	spl_vn_fini();
@@ -0,0 +1,269 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/lockstat.h>
+#include <sys/atomic.h>
+#include <sys/kstat.h>
+#include <sys/sysmacros.h>
+#include <linux/spinlock.h>
+
+/*
+ * The registered lock classes.  The classes themselves are static data of
+ * the modules which use them, so a module's classes are dropped from the
+ * list when it is unloaded.  The list is protected by a spinlock rather
+ * than a kmutex_t so that registering a kmutex_t's class can't recurse.
+ */
+static LIST_HEAD(spl_lockstat_classes);
+static DEFINE_SPINLOCK(spl_lockstat_lock);
+static kstat_t *spl_lockstat_ksp;
+
+/* Snapshot of the class being formatted by the kstat */
+static spl_lockstat_class_t spl_lockstat_snap;
+
+int spl_lockstat_enabled = 0;
+EXPORT_SYMBOL(spl_lockstat_enabled);
+module_param(spl_lockstat_enabled, int, 0644);
+MODULE_PARM_DESC(spl_lockstat_enabled,
+	"Account lock wait and hold times per lock class");
+
+static int
+spl_lockstat_bucket(hrtime_t ns)
+{
+	uint64_t us = MAX(ns, 0) / (NANOSEC / MICROSEC);
+
+	return (MIN(highbit64(us), SPL_LOCKSTAT_BUCKETS - 1));
+}
+
+static void
+spl_lockstat_register(spl_lockstat_class_t *lsc)
+{
+	if (atomic_cas_32((uint32_t *)&lsc->lsc_registered, 0, 1) != 0)
+		return;
+
+	spin_lock(&spl_lockstat_lock);
+	list_add_tail(&lsc->lsc_list, &spl_lockstat_classes);
+	spin_unlock(&spl_lockstat_lock);
+}
+
+/*
+ * Account an acquisition of a lock of class lsc, which has had to wait
+ * since start unless that is 0.
+ */
+void
+spl_lockstat_acquired(spl_lockstat_class_t *lsc, hrtime_t start)
+{
+	if (lsc == NULL || !spl_lockstat_enabled)
+		return;
+
+	if (unlikely(!lsc->lsc_registered))
+		spl_lockstat_register(lsc);
+
+	atomic_inc_64(&lsc->lsc_acquires);
+	if (start != 0) {
+		hrtime_t wait = gethrtime() - start;
+
+		atomic_inc_64(&lsc->lsc_contended);
+		atomic_add_64(&lsc->lsc_wait_ns, wait);
+		atomic_inc_64(&lsc->lsc_wait[spl_lockstat_bucket(wait)]);
+	}
+}
+EXPORT_SYMBOL(spl_lockstat_acquired);
+
+/*
+ * Account the release of a lock of class lsc which was acquired at start.
+ */
+void
+spl_lockstat_released(spl_lockstat_class_t *lsc, hrtime_t start)
+{
+	hrtime_t hold;
+
+	if (lsc == NULL || start == 0)
+		return;
+
+	if (unlikely(!lsc->lsc_registered))
+		spl_lockstat_register(lsc);
+
+	hold = gethrtime() - start;
+	atomic_add_64(&lsc->lsc_hold_ns, hold);
+	atomic_inc_64(&lsc->lsc_hold[spl_lockstat_bucket(hold)]);
+}
+EXPORT_SYMBOL(spl_lockstat_released);
+
+static int
+spl_lockstat_module_notify(struct notifier_block *nb, unsigned long action,
+    void *data)
+{
+	struct module *mod = data;
+	spl_lockstat_class_t *lsc, *next;
+
+	if (action != MODULE_STATE_GOING)
+		return (NOTIFY_DONE);
+
+	spin_lock(&spl_lockstat_lock);
+	list_for_each_entry_safe(lsc, next, &spl_lockstat_classes, lsc_list) {
+		if (lsc->lsc_module == mod)
+			list_del(&lsc->lsc_list);
+	}
+	spin_unlock(&spl_lockstat_lock);
+
+	return (NOTIFY_OK);
+}
+
+static struct notifier_block spl_lockstat_module_nb = {
+	.notifier_call = spl_lockstat_module_notify,
+};
+
+static int
+spl_lockstat_kstat_headers(char *buf, size_t size)
+{
+	int n;
+
+	n = snprintf(buf, size, "%-40s %-32s %-5s %12s %12s %16s %16s",
+	    "class", "function", "type", "acquires", "contended", "total_ns",
+	    "avg_ns");
+	for (int b = 0; b < SPL_LOCKSTAT_BUCKETS && n < size; b++) {
+		if (b == 0)
+			n += snprintf(buf + n, size - n, " %10s", "<1us");
+		else
+			n += snprintf(buf + n, size - n, " %8lluus",
+			    1ULL << (b - 1));
+	}
+	if (n < size)
+		n += snprintf(buf + n, size - n, "\n");
+
+	return (n < size ? 0 : ENOMEM);
+}
+
+/*
+ * Each class is shown as two lines, one for the time spent waiting for the
+ * lock and one for the time it was held, each followed by its histogram.
+ */
+static int
+spl_lockstat_kstat_data(char *buf, size_t size, void *data)
+{
+	spl_lockstat_class_t *lsc = data;
+	int n = 0;
+
+	for (int hold = 0; hold <= 1 && n < size; hold++) {
+		uint64_t count = hold ? lsc->lsc_acquires : lsc->lsc_contended;
+		uint64_t total = hold ? lsc->lsc_hold_ns : lsc->lsc_wait_ns;
+		uint64_t *hist = hold ? lsc->lsc_hold : lsc->lsc_wait;
+
+		n += snprintf(buf + n, size - n,
+		    "%-40s %-32s %-5s %12llu %12llu %16llu %16llu",
+		    lsc->lsc_name, lsc->lsc_func, hold ? "hold" : "wait",
+		    (u_longlong_t)lsc->lsc_acquires,
+		    (u_longlong_t)lsc->lsc_contended, (u_longlong_t)total,
+		    (u_longlong_t)(count ? total / count : 0));
+		for (int b = 0; b < SPL_LOCKSTAT_BUCKETS && n < size; b++) {
+			n += snprintf(buf + n, size - n, " %10llu",
+			    (u_longlong_t)hist[b]);
+		}
+		if (n < size)
+			n += snprintf(buf + n, size - n, "\n");
+	}
+
+	return (n < size ? 0 : ENOMEM);
+}
+
+/*
+ * The class is copied while the list is locked, since the module it lives
+ * in may be unloaded before it is formatted.
+ */
+static void *
+spl_lockstat_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	spl_lockstat_class_t *lsc;
+
+	ksp->ks_private = NULL;
+
+	spin_lock(&spl_lockstat_lock);
+	list_for_each_entry(lsc, &spl_lockstat_classes, lsc_list) {
+		if (n-- == 0) {
+			spl_lockstat_snap = *lsc;
+			ksp->ks_private = &spl_lockstat_snap;
+			break;
+		}
+	}
+	spin_unlock(&spl_lockstat_lock);
+
+	return (ksp->ks_private);
+}
+
+/*
+ * Writing to the kstat clears the accounting of every class.
+ */
+static int
+spl_lockstat_kstat_update(kstat_t *ksp, int rw)
+{
+	spl_lockstat_class_t *lsc;
+
+	if (rw != KSTAT_WRITE)
+		return (0);
+
+	spin_lock(&spl_lockstat_lock);
+	list_for_each_entry(lsc, &spl_lockstat_classes, lsc_list) {
+		lsc->lsc_acquires = 0;
+		lsc->lsc_contended = 0;
+		lsc->lsc_wait_ns = 0;
+		lsc->lsc_hold_ns = 0;
+		memset(lsc->lsc_wait, 0, sizeof (lsc->lsc_wait));
+		memset(lsc->lsc_hold, 0, sizeof (lsc->lsc_hold));
+	}
+	spin_unlock(&spl_lockstat_lock);
+
+	return (0);
+}
+
+int
+spl_lockstat_init(void)
+{
+	int rc;
+
+	if ((rc = register_module_notifier(&spl_lockstat_module_nb)) != 0)
+		return (rc);
+
+	spl_lockstat_ksp = kstat_create("spl", 0, "lockstat", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL | KSTAT_FLAG_WRITABLE);
+	if (spl_lockstat_ksp != NULL) {
+		spl_lockstat_ksp->ks_data = NULL;
+		spl_lockstat_ksp->ks_ndata = UINT32_MAX;
+		spl_lockstat_ksp->ks_update = spl_lockstat_kstat_update;
+		kstat_set_raw_ops(spl_lockstat_ksp,
+		    spl_lockstat_kstat_headers,
+		    spl_lockstat_kstat_data,
+		    spl_lockstat_kstat_addr);
+		kstat_install(spl_lockstat_ksp);
+	}
+
+	return (0);
+}
+
+void
+spl_lockstat_fini(void)
+{
+	if (spl_lockstat_ksp != NULL) {
+		kstat_delete(spl_lockstat_ksp);
+		spl_lockstat_ksp = NULL;
+	}
+
+	(void) unregister_module_notifier(&spl_lockstat_module_nb);
+}
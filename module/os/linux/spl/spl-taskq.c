@@ -464,7 +464,8 @@ taskq_wait_check(taskq_t *tq)
 	unsigned long flags;
 
 	spin_lock_irqsave_nested(&tq->tq_lock, flags, tq->tq_lock_class);
-	rc = (tq->tq_lowest_id == tq->tq_next_id);
+	rc = (tq->tq_lowest_id == tq->tq_next_id &&
+	    atomic_read(&tq->tq_ws_outstanding) == 0);
 	spin_unlock_irqrestore(&tq->tq_lock, flags);
 
 	return (rc);
@@ -657,6 +658,95 @@ out:
 }
 EXPORT_SYMBOL(taskq_dispatch_delay);
 
+/*
+ * Preallocated tasks dispatched to a TASKQ_STEAL taskq are queued on one of
+ * the per-thread queues, selected by the current CPU, without taking the
+ * tq_lock.  They are not assigned a task id, so only taskq_wait() waits for
+ * them, and they cannot be canceled.
+ */
+static void
+taskq_ws_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
+    taskq_ent_t *t)
+{
+	taskq_deque_t *tqd;
+	unsigned long irqflags;
+
+	tqd = &tq->tq_deques[raw_smp_processor_id() % tq->tq_ndeques];
+
+	spin_lock_irqsave(&tqd->tqd_lock, irqflags);
+	ASSERT(taskq_empty_ent(t));
+	t->tqent_flags |= TQENT_FLAG_PREALLOC;
+	t->tqent_id = TASKQID_INVALID;
+	t->tqent_func = func;
+	t->tqent_arg = arg;
+	t->tqent_taskq = tq;
+	t->tqent_birth = jiffies;
+	atomic_inc(&tq->tq_ws_outstanding);
+	atomic_inc(&tq->tq_ws_queued);
+	if (flags & TQ_FRONT)
+		list_add(&t->tqent_list, &tqd->tqd_list);
+	else
+		list_add_tail(&t->tqent_list, &tqd->tqd_list);
+	spin_unlock_irqrestore(&tqd->tqd_lock, irqflags);
+
+	/* Pairs with the barrier in taskq_thread() before sleeping */
+	smp_mb();
+	if (waitqueue_active(&tq->tq_work_waitq))
+		wake_up(&tq->tq_work_waitq);
+}
+
+/*
+ * Takes the oldest task from the per-thread queues, starting with the
+ * queue of the current CPU and stealing from the others when it is empty.
+ */
+static taskq_ent_t *
+taskq_ws_next_ent(taskq_t *tq)
+{
+	taskq_deque_t *tqd;
+	taskq_ent_t *t = NULL;
+	unsigned long irqflags;
+	int i, first;
+
+	first = raw_smp_processor_id() % tq->tq_ndeques;
+	for (i = 0; i < tq->tq_ndeques && t == NULL; i++) {
+		tqd = &tq->tq_deques[(first + i) % tq->tq_ndeques];
+		if (list_empty_careful(&tqd->tqd_list))
+			continue;
+
+		spin_lock_irqsave(&tqd->tqd_lock, irqflags);
+		if (!list_empty(&tqd->tqd_list)) {
+			t = list_entry(tqd->tqd_list.next, taskq_ent_t,
+			    tqent_list);
+			list_del_init(&t->tqent_list);
+			atomic_dec(&tq->tq_ws_queued);
+		}
+		spin_unlock_irqrestore(&tqd->tqd_lock, irqflags);
+	}
+
+	return (t);
+}
+
+/*
+ * Runs the tasks of the per-thread queues until they are all empty.
+ */
+static void
+taskq_ws_run(taskq_t *tq)
+{
+	taskq_ent_t *t;
+	task_func_t *func;
+	void *arg;
+
+	while ((t = taskq_ws_next_ent(tq)) != NULL) {
+		/* The entry may be reused or freed by the task function */
+		func = t->tqent_func;
+		arg = t->tqent_arg;
+		func(arg);
+
+		if (atomic_dec_and_test(&tq->tq_ws_outstanding))
+			wake_up_all(&tq->tq_wait_waitq);
+	}
+}
+
 void
 taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
     taskq_ent_t *t)
@@ -665,6 +755,12 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 	ASSERT(tq);
 	ASSERT(func);
 
+	if ((tq->tq_flags & (TASKQ_STEAL | TASKQ_ACTIVE)) ==
+	    (TASKQ_STEAL | TASKQ_ACTIVE) && !(flags & TQ_NOQUEUE)) {
+		taskq_ws_dispatch_ent(tq, func, arg, flags, t);
+		return;
+	}
+
 	spin_lock_irqsave_nested(&tq->tq_lock, irqflags,
 	    tq->tq_lock_class);
 
@@ -878,6 +974,15 @@ taskq_thread(void *args)
 
 	while (!kthread_should_stop()) {
 
+		if (atomic_read(&tq->tq_ws_queued) != 0) {
+			__set_current_state(TASK_RUNNING);
+			spin_unlock_irqrestore(&tq->tq_lock, flags);
+			taskq_ws_run(tq);
+			spin_lock_irqsave_nested(&tq->tq_lock, flags,
+			    tq->tq_lock_class);
+			set_current_state(TASK_INTERRUPTIBLE);
+		}
+
 		if (list_empty(&tq->tq_pend_list) &&
 		    list_empty(&tq->tq_prio_list)) {
 
@@ -889,7 +994,15 @@ taskq_thread(void *args)
 			add_wait_queue_exclusive(&tq->tq_work_waitq, &wait);
 			spin_unlock_irqrestore(&tq->tq_lock, flags);
 
-			schedule();
+			/*
+			 * Tasks are queued on the per-thread queues without
+			 * the tq_lock, recheck once on the wait queue.
+			 */
+			smp_mb();
+			if (atomic_read(&tq->tq_ws_queued) == 0)
+				schedule();
+			else
+				__set_current_state(TASK_RUNNING);
 			seq_tasks = 0;
 
 			spin_lock_irqsave_nested(&tq->tq_lock, flags,
@@ -976,6 +1089,33 @@ error:
 	return (0);
 }
 
+/*
+ * Returns the next online CPU of the node, round-robin.  The threads of a
+ * taskq created on a node are each bound to one of these CPUs.  When the
+ * node has no online CPUs -1 is returned and the thread is left unbound.
+ */
+static int
+taskq_node_next_cpu(int node)
+{
+	static int last_used_idx = 0;
+	int cpu, ncpus = 0, idx;
+
+	for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask) {
+		ncpus++;
+	}
+
+	if (ncpus == 0)
+		return (-1);
+
+	idx = (last_used_idx++) % ncpus;
+	for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask) {
+		if (idx-- == 0)
+			break;
+	}
+
+	return (cpu);
+}
+
 static taskq_thread_t *
 taskq_thread_create(taskq_t *tq)
 {
@@ -995,7 +1135,11 @@ taskq_thread_create(taskq_t *tq)
 		return (NULL);
 	}
 
-	if (spl_taskq_thread_bind) {
+	if (tq->tq_node != NUMA_NO_NODE) {
+		int cpu = taskq_node_next_cpu(tq->tq_node);
+		if (cpu >= 0)
+			kthread_bind(tqt->tqt_thread, cpu);
+	} else if (spl_taskq_thread_bind) {
 		last_used_cpu = (last_used_cpu + 1) % num_online_cpus();
 		kthread_bind(tqt->tqt_thread, last_used_cpu);
 	}
@@ -1008,9 +1152,13 @@ taskq_thread_create(taskq_t *tq)
 	return (tqt);
 }
 
+/*
+ * Same as taskq_create() but the threads of the taskq only run on the CPUs
+ * of the given NUMA node, or anywhere when the node is NUMA_NO_NODE.
+ */
 taskq_t *
-taskq_create(const char *name, int nthreads, pri_t pri,
-    int minalloc, int maxalloc, uint_t flags)
+taskq_create_on_node(const char *name, int nthreads, pri_t pri,
+    int minalloc, int maxalloc, uint_t flags, int node)
 {
 	taskq_t *tq;
 	taskq_thread_t *tqt;
@@ -1021,6 +1169,12 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 	ASSERT(minalloc >= 0);
 	ASSERT(maxalloc <= INT_MAX);
 	ASSERT(!(flags & (TASKQ_CPR_SAFE))); /* Unsupported */
+	ASSERT(node == NUMA_NO_NODE || (node >= 0 && node < nr_node_ids));
+	ASSERT(!(flags & TASKQ_STEAL) || !(flags & TASKQ_DYNAMIC));
+
+	/* The per-thread queues require a fixed number of threads */
+	if (flags & TASKQ_STEAL)
+		flags &= ~TASKQ_DYNAMIC;
 
 	/* Scale the number of threads using nthreads as a percentage */
 	if (flags & TASKQ_THREADS_CPU_PCT) {
@@ -1044,6 +1198,7 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 	tq->tq_nspawn = 0;
 	tq->tq_maxthreads = nthreads;
 	tq->tq_pri = pri;
+	tq->tq_node = node;
 	tq->tq_minalloc = minalloc;
 	tq->tq_maxalloc = maxalloc;
 	tq->tq_nalloc = 0;
@@ -1058,6 +1213,20 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 	init_waitqueue_head(&tq->tq_wait_waitq);
 	tq->tq_lock_class = TQ_LOCK_GENERAL;
 	INIT_LIST_HEAD(&tq->tq_taskqs);
+	tq->tq_deques = NULL;
+	tq->tq_ndeques = 0;
+	atomic_set(&tq->tq_ws_queued, 0);
+	atomic_set(&tq->tq_ws_outstanding, 0);
+
+	if (flags & TASKQ_STEAL) {
+		tq->tq_ndeques = MAX(nthreads, 1);
+		tq->tq_deques = kmem_alloc(tq->tq_ndeques *
+		    sizeof (taskq_deque_t), KM_PUSHPAGE);
+		for (i = 0; i < tq->tq_ndeques; i++) {
+			spin_lock_init(&tq->tq_deques[i].tqd_lock);
+			INIT_LIST_HEAD(&tq->tq_deques[i].tqd_list);
+		}
+	}
 
 	if (flags & TASKQ_PREPOPULATE) {
 		spin_lock_irqsave_nested(&tq->tq_lock, irqflags,
@@ -1101,6 +1270,15 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 
 	return (tq);
 }
+EXPORT_SYMBOL(taskq_create_on_node);
+
+taskq_t *
+taskq_create(const char *name, int nthreads, pri_t pri,
+    int minalloc, int maxalloc, uint_t flags)
+{
+	return (taskq_create_on_node(name, nthreads, pri, minalloc, maxalloc,
+	    flags, NUMA_NO_NODE));
+}
 EXPORT_SYMBOL(taskq_create);
 
 void
@@ -1175,9 +1353,14 @@ taskq_destroy(taskq_t *tq)
 	ASSERT(list_empty(&tq->tq_pend_list));
 	ASSERT(list_empty(&tq->tq_prio_list));
 	ASSERT(list_empty(&tq->tq_delay_list));
+	ASSERT0(atomic_read(&tq->tq_ws_outstanding));
 
 	spin_unlock_irqrestore(&tq->tq_lock, flags);
 
+	if (tq->tq_deques != NULL) {
+		kmem_free(tq->tq_deques,
+		    tq->tq_ndeques * sizeof (taskq_deque_t));
+	}
 	strfree(tq->tq_name);
 	kmem_free(tq, sizeof (taskq_t));
 }
@@ -140,6 +140,9 @@ typedef struct abd_stats {
 	kstat_named_t abdstat_scatter_page_multi_zone;
 	kstat_named_t abdstat_scatter_page_alloc_retry;
 	kstat_named_t abdstat_scatter_sg_table_retry;
+	kstat_named_t abdstat_scatter_magazine_hits;
+	kstat_named_t abdstat_scatter_magazine_misses;
+	kstat_named_t abdstat_scatter_magazine_size;
 } abd_stats_t;
 
 static abd_stats_t abd_stats = {
@@ -194,6 +197,14 @@ static abd_stats_t abd_stats = {
 	 *  allocate the sg table for an ABD.
 	 */
 	{ "scatter_sg_table_retry",		KSTAT_DATA_UINT64 },
+	/*
+	 * The number of chunks which were taken from, or could not be found
+	 * in, the per-CPU magazines of free chunks.
+	 */
+	{ "scatter_magazine_hits",		KSTAT_DATA_UINT64 },
+	{ "scatter_magazine_misses",		KSTAT_DATA_UINT64 },
+	/* Amount of memory held in free chunks by the per-CPU magazines */
+	{ "scatter_magazine_size",		KSTAT_DATA_UINT64 },
 };
 
 #define	ABDSTAT(stat)		(abd_stats.stat.value.ui64)
@@ -204,6 +215,7 @@ static abd_stats_t abd_stats = {
 
 #define	ABD_SCATTER(abd)	(abd->abd_u.abd_scatter)
 #define	ABD_BUF(abd)		(abd->abd_u.abd_linear.abd_buf)
+#define	ABD_GANG(abd)		(abd->abd_u.abd_gang)
 #define	abd_for_each_sg(abd, sg, n, i)	\
 	for_each_sg(ABD_SCATTER(abd).abd_sgl, sg, n, i)
 
@@ -245,6 +257,139 @@ abd_chunkcnt_for_bytes(size_t size)
 }
 
 #ifdef _KERNEL
+/*
+ * Chunks released by scatter ABDs are kept in small per-CPU magazines and
+ * handed out again to the next ABDs allocated on the same CPU.  This keeps
+ * most ARC buffer churn off the page allocator and its zone locks.  Only
+ * chunks from the NUMA node of the CPU are cached, so the chunks taken from
+ * a magazine are always node-local for the allocating thread.  The per-CPU
+ * lock is only contended by abd_cache_reap_now(), which drains all of the
+ * magazines when the ARC reaps its caches under memory pressure.
+ */
+#define	ABD_MAG_MAX_ORDER	5
+#define	ABD_MAG_ROUNDS		8
+
+typedef struct abd_mag {
+	spinlock_t	am_lock;
+	size_t		am_size;
+	int		am_rounds[ABD_MAG_MAX_ORDER + 1];
+	struct page	*am_pages[ABD_MAG_MAX_ORDER + 1][ABD_MAG_ROUNDS];
+} ____cacheline_aligned abd_mag_t;
+
+static abd_mag_t *abd_mags = NULL;
+
+/* Maximum amount of free chunks cached per CPU, 0 disables the magazines */
+unsigned long zfs_abd_magazine_size = 1024 * 1024;
+
+static struct page *
+abd_mag_get(int order)
+{
+	struct page *page = NULL;
+	abd_mag_t *mag;
+
+	if (abd_mags == NULL || order > ABD_MAG_MAX_ORDER)
+		return (NULL);
+
+	mag = &abd_mags[raw_smp_processor_id()];
+	spin_lock(&mag->am_lock);
+	if (mag->am_rounds[order] > 0) {
+		page = mag->am_pages[order][--mag->am_rounds[order]];
+		mag->am_size -= PAGESIZE << order;
+	}
+	spin_unlock(&mag->am_lock);
+
+	if (page != NULL) {
+		ABDSTAT_BUMP(abdstat_scatter_magazine_hits);
+		ABDSTAT_INCR(abdstat_scatter_magazine_size,
+		    -((int)PAGESIZE << order));
+	} else {
+		ABDSTAT_BUMP(abdstat_scatter_magazine_misses);
+	}
+
+	return (page);
+}
+
+static boolean_t
+abd_mag_put(struct page *page, int order)
+{
+	int cpu = raw_smp_processor_id();
+	boolean_t cached = B_FALSE;
+	abd_mag_t *mag;
+
+	if (abd_mags == NULL || order > ABD_MAG_MAX_ORDER ||
+	    page_to_nid(page) != cpu_to_node(cpu))
+		return (B_FALSE);
+
+	mag = &abd_mags[cpu];
+	spin_lock(&mag->am_lock);
+	if (mag->am_rounds[order] < ABD_MAG_ROUNDS &&
+	    mag->am_size + (PAGESIZE << order) <= zfs_abd_magazine_size) {
+		mag->am_pages[order][mag->am_rounds[order]++] = page;
+		mag->am_size += PAGESIZE << order;
+		cached = B_TRUE;
+	}
+	spin_unlock(&mag->am_lock);
+
+	if (cached)
+		ABDSTAT_INCR(abdstat_scatter_magazine_size, PAGESIZE << order);
+
+	return (cached);
+}
+
+static void
+abd_mag_drain(abd_mag_t *mag)
+{
+	struct page *page;
+	int order;
+
+	spin_lock(&mag->am_lock);
+	for (order = 0; order <= ABD_MAG_MAX_ORDER; order++) {
+		while (mag->am_rounds[order] > 0) {
+			page = mag->am_pages[order][--mag->am_rounds[order]];
+			__free_pages(page, order);
+			ABDSTAT_INCR(abdstat_scatter_magazine_size,
+			    -((int)PAGESIZE << order));
+		}
+	}
+	mag->am_size = 0;
+	spin_unlock(&mag->am_lock);
+}
+
+/*
+ * Return all chunks cached in the per-CPU magazines to the page allocator.
+ */
+void
+abd_cache_reap_now(void)
+{
+	int cpu;
+
+	if (abd_mags == NULL)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		abd_mag_drain(&abd_mags[cpu]);
+	}
+}
+
+static void
+abd_mag_init(void)
+{
+	int cpu;
+
+	abd_mags = vmem_zalloc(nr_cpu_ids * sizeof (abd_mag_t), KM_SLEEP);
+	for_each_possible_cpu(cpu) {
+		spin_lock_init(&abd_mags[cpu].am_lock);
+	}
+}
+
+static void
+abd_mag_fini(void)
+{
+	abd_cache_reap_now();
+	vmem_free(abd_mags, nr_cpu_ids * sizeof (abd_mag_t));
+	abd_mags = NULL;
+}
+
 #ifndef CONFIG_HIGHMEM
 
 #ifndef __GFP_RECLAIM
@@ -283,7 +428,10 @@ abd_alloc_pages(abd_t *abd, size_t size)
 		order = MIN(highbit64(nr_pages - alloc_pages) - 1, max_order);
 		chunk_pages = (1U << order);
 
-		page = alloc_pages_node(nid, order ? gfp_comp : gfp, order);
+		page = abd_mag_get(order);
+		if (page == NULL)
+			page = alloc_pages_node(nid, order ? gfp_comp : gfp,
+			    order);
 		if (page == NULL) {
 			if (order == 0) {
 				ABDSTAT_BUMP(abdstat_scatter_page_alloc_retry);
@@ -397,7 +545,8 @@ abd_alloc_pages(abd_t *abd, size_t size)
 	ABD_SCATTER(abd).abd_nents = nr_pages;
 
 	abd_for_each_sg(abd, sg, nr_pages, i) {
-		while ((page = __page_cache_alloc(gfp)) == NULL) {
+		while ((page = abd_mag_get(0)) == NULL &&
+		    (page = __page_cache_alloc(gfp)) == NULL) {
 			ABDSTAT_BUMP(abdstat_scatter_page_alloc_retry);
 			schedule_timeout_interruptible(1);
 		}
@@ -431,9 +580,10 @@ abd_free_pages(abd_t *abd)
 	abd_for_each_sg(abd, sg, nr_pages, i) {
 		page = sg_page(sg);
 		order = compound_order(page);
-		__free_pages(page, order);
 		ASSERT3U(sg->length, <=, PAGE_SIZE << order);
 		ABDSTAT_BUMPDOWN(abdstat_scatter_orders[order]);
+		if (!abd_mag_put(page, order))
+			__free_pages(page, order);
 	}
 
 	table.sgl = ABD_SCATTER(abd).abd_sgl;
@@ -531,6 +681,21 @@ abd_free_pages(abd_t *abd)
 	vmem_free(ABD_SCATTER(abd).abd_sgl, n * sizeof (struct scatterlist));
 }
 
+void
+abd_cache_reap_now(void)
+{
+}
+
+static void
+abd_mag_init(void)
+{
+}
+
+static void
+abd_mag_fini(void)
+{
+}
+
 #endif /* _KERNEL */
 
 void
@@ -554,11 +719,15 @@ abd_init(void)
 			    KSTAT_DATA_UINT64;
 		}
 	}
+
+	abd_mag_init();
 }
 
 void
 abd_fini(void)
 {
+	abd_mag_fini();
+
 	if (abd_ksp != NULL) {
 		kstat_delete(abd_ksp);
 		abd_ksp = NULL;
@@ -573,15 +742,28 @@ abd_fini(void)
 static inline void
 abd_verify(abd_t *abd)
 {
-	ASSERT3U(abd->abd_size, >, 0);
+	ASSERT(abd->abd_size > 0 || abd_is_gang(abd));
 	ASSERT3U(abd->abd_size, <=, SPA_MAXBLOCKSIZE);
 	ASSERT3U(abd->abd_flags, ==, abd->abd_flags & (ABD_FLAG_LINEAR |
 	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_MULTI_ZONE |
-	    ABD_FLAG_MULTI_CHUNK | ABD_FLAG_LINEAR_PAGE));
+	    ABD_FLAG_MULTI_CHUNK | ABD_FLAG_LINEAR_PAGE | ABD_FLAG_GANG |
+	    ABD_FLAG_GANG_FREE));
 	IMPLY(abd->abd_parent != NULL, !(abd->abd_flags & ABD_FLAG_OWNER));
 	IMPLY(abd->abd_flags & ABD_FLAG_META, abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd)) {
 		ASSERT3P(abd->abd_u.abd_linear.abd_buf, !=, NULL);
+	} else if (abd_is_gang(abd)) {
+		uint_t child_sizes = 0;
+		abd_t *cabd;
+
+		for (cabd = list_head(&ABD_GANG(abd).abd_gang_chain);
+		    cabd != NULL;
+		    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+			ASSERT(!abd_is_gang(cabd));
+			child_sizes += cabd->abd_size;
+			abd_verify(cabd);
+		}
+		ASSERT3U(abd->abd_size, ==, child_sizes);
 	} else {
 		size_t n;
 		int i = 0;
@@ -603,6 +785,7 @@ abd_alloc_struct(void)
 	abd_t *abd = kmem_cache_alloc(abd_cache, KM_PUSHPAGE);
 
 	ASSERT3P(abd, !=, NULL);
+	list_link_init(&abd->abd_gang_link);
 	ABDSTAT_INCR(abdstat_struct_size, sizeof (abd_t));
 
 	return (abd);
@@ -611,6 +794,7 @@ abd_alloc_struct(void)
 static inline void
 abd_free_struct(abd_t *abd)
 {
+	ASSERT(!list_link_active(&abd->abd_gang_link));
 	kmem_cache_free(abd_cache, abd);
 	ABDSTAT_INCR(abdstat_struct_size, -(int)sizeof (abd_t));
 }
@@ -722,8 +906,181 @@ abd_free_linear(abd_t *abd)
 }
 
 /*
- * Free an ABD. Only use this on ABDs allocated with abd_alloc() or
- * abd_alloc_linear().
+ * Allocate a gang ABD, which chains together other ABDs, its children,
+ * without copying their data.  It starts out empty and grows as children
+ * are added with abd_gang_add().  Use abd_free() to free it.
+ */
+abd_t *
+abd_alloc_gang_abd(void)
+{
+	abd_t *abd = abd_alloc_struct();
+
+	abd->abd_flags = ABD_FLAG_GANG | ABD_FLAG_OWNER;
+	abd->abd_size = 0;
+	abd->abd_parent = NULL;
+	list_create(&ABD_GANG(abd).abd_gang_chain,
+	    sizeof (abd_t), offsetof(abd_t, abd_gang_link));
+	zfs_refcount_create(&abd->abd_children);
+
+	return (abd);
+}
+
+/*
+ * The children of a gang ABD added to another gang ABD are added in its
+ * place, so the children of a gang ABD are never gang ABDs themselves.
+ * If the gang ABD is to be freed with pabd, its children are moved over
+ * and it is freed right away.
+ */
+static void
+abd_gang_add_gang(abd_t *pabd, abd_t *cabd, boolean_t free_on_free)
+{
+	abd_t *c;
+
+	if (!free_on_free) {
+		for (c = list_head(&ABD_GANG(cabd).abd_gang_chain); c != NULL;
+		    c = list_next(&ABD_GANG(cabd).abd_gang_chain, c))
+			abd_gang_add(pabd, c, B_FALSE);
+		return;
+	}
+
+	while ((c = list_remove_head(&ABD_GANG(cabd).abd_gang_chain)) !=
+	    NULL) {
+		boolean_t c_free = (c->abd_flags & ABD_FLAG_GANG_FREE) != 0;
+
+		cabd->abd_size -= c->abd_size;
+		c->abd_flags &= ~ABD_FLAG_GANG_FREE;
+		if (!c_free) {
+			(void) zfs_refcount_remove_many(&c->abd_children,
+			    c->abd_size, cabd);
+		}
+		abd_gang_add(pabd, c, c_free);
+	}
+
+	if (cabd->abd_flags & ABD_FLAG_OWNER)
+		abd_free(cabd);
+	else
+		abd_put(cabd);
+}
+
+/*
+ * Add cabd to the end of the gang ABD pabd.  If free_on_free is set,
+ * cabd is freed along with pabd, otherwise it must not be freed before
+ * pabd.  An ABD can only be the child of one gang ABD at a time, so if
+ * it already is one, a view of it is added instead.
+ */
+void
+abd_gang_add(abd_t *pabd, abd_t *cabd, boolean_t free_on_free)
+{
+	ASSERT(abd_is_gang(pabd));
+	abd_verify(cabd);
+
+	if (abd_is_gang(cabd)) {
+		abd_gang_add_gang(pabd, cabd, free_on_free);
+		return;
+	}
+
+	if (list_link_active(&cabd->abd_gang_link)) {
+		ASSERT(!free_on_free);
+		cabd = abd_get_offset(cabd, 0);
+		free_on_free = B_TRUE;
+	}
+
+	if (free_on_free) {
+		cabd->abd_flags |= ABD_FLAG_GANG_FREE;
+	} else {
+		(void) zfs_refcount_add_many(&cabd->abd_children,
+		    cabd->abd_size, pabd);
+	}
+
+	list_insert_tail(&ABD_GANG(pabd).abd_gang_chain, cabd);
+	pabd->abd_size += cabd->abd_size;
+}
+
+/*
+ * Return the child of a gang ABD which contains offset *off, and update
+ * *off to be the offset in that child.  Returns NULL if *off is past the
+ * end of the gang ABD.
+ */
+static abd_t *
+abd_gang_get_offset(abd_t *abd, size_t *off)
+{
+	abd_t *cabd;
+
+	ASSERT(abd_is_gang(abd));
+	for (cabd = list_head(&ABD_GANG(abd).abd_gang_chain); cabd != NULL;
+	    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+		if (*off < cabd->abd_size)
+			break;
+		*off -= cabd->abd_size;
+	}
+
+	return (cabd);
+}
+
+/*
+ * Remove all children of a gang ABD, freeing the ones added with
+ * free_on_free set.
+ */
+static void
+abd_gang_remove_children(abd_t *abd)
+{
+	abd_t *cabd;
+
+	while ((cabd = list_remove_head(&ABD_GANG(abd).abd_gang_chain)) !=
+	    NULL) {
+		abd->abd_size -= cabd->abd_size;
+		if (cabd->abd_flags & ABD_FLAG_GANG_FREE) {
+			cabd->abd_flags &= ~ABD_FLAG_GANG_FREE;
+			if (cabd->abd_flags & ABD_FLAG_OWNER)
+				abd_free(cabd);
+			else
+				abd_put(cabd);
+		} else {
+			(void) zfs_refcount_remove_many(&cabd->abd_children,
+			    cabd->abd_size, abd);
+		}
+	}
+	ASSERT0(abd->abd_size);
+	list_destroy(&ABD_GANG(abd).abd_gang_chain);
+}
+
+/*
+ * A view of part of a gang ABD is a new gang ABD of views of the children
+ * covering that part.  Only the children are referenced by the view, so it
+ * has no parent.
+ */
+static abd_t *
+abd_get_offset_gang(abd_t *sabd, size_t off, size_t size)
+{
+	abd_t *abd = abd_alloc_gang_abd();
+	abd_t *cabd;
+
+	abd->abd_flags &= ~ABD_FLAG_OWNER;
+	for (cabd = abd_gang_get_offset(sabd, &off); cabd != NULL && size > 0;
+	    cabd = list_next(&ABD_GANG(sabd).abd_gang_chain, cabd)) {
+		size_t csize = MIN(size, cabd->abd_size - off);
+
+		abd_gang_add(abd, abd_get_offset_size(cabd, off, csize),
+		    B_TRUE);
+		size -= csize;
+		off = 0;
+	}
+	ASSERT0(size);
+
+	return (abd);
+}
+
+static void
+abd_free_gang_abd(abd_t *abd)
+{
+	abd_gang_remove_children(abd);
+	zfs_refcount_destroy(&abd->abd_children);
+	abd_free_struct(abd);
+}
+
+/*
+ * Free an ABD. Only use this on ABDs allocated with abd_alloc(),
+ * abd_alloc_linear() or abd_alloc_gang_abd().
  */
 void
 abd_free(abd_t *abd)
@@ -733,6 +1090,8 @@ abd_free(abd_t *abd)
 	ASSERT(abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd))
 		abd_free_linear(abd);
+	else if (abd_is_gang(abd))
+		abd_free_gang_abd(abd);
 	else
 		abd_free_scatter(abd);
 }
@@ -787,6 +1146,9 @@ abd_get_offset_impl(abd_t *sabd, size_t off, size_t size)
 	abd_verify(sabd);
 	ASSERT3U(off, <=, sabd->abd_size);
 
+	if (abd_is_gang(sabd))
+		return (abd_get_offset_gang(sabd, off, size));
+
 	if (abd_is_linear(sabd)) {
 		abd = abd_alloc_struct();
 
@@ -891,6 +1253,9 @@ abd_put(abd_t *abd)
 		    abd->abd_size, abd);
 	}
 
+	if (abd_is_gang(abd))
+		abd_gang_remove_children(abd);
+
 	zfs_refcount_destroy(&abd->abd_children);
 	abd_free_struct(abd);
 }
@@ -1034,7 +1399,8 @@ struct abd_iter {
 	size_t		iter_mapsize;	/* length of data valid at mapaddr */
 
 	/* private */
-	abd_t		*iter_abd;	/* ABD being iterated through */
+	abd_t		*iter_gang;	/* gang ABD being iterated through */
+	abd_t		*iter_abd;	/* ABD (or gang child) being iterated */
 	size_t		iter_pos;
 	size_t		iter_offset;	/* offset in current sg/abd_buf, */
 					/* abd_offset included */
@@ -1045,23 +1411,40 @@ struct abd_iter {
 };
 
 /*
- * Initialize the abd_iter.
+ * Point the abd_iter at the start of abd, which is either the ABD being
+ * iterated through or a child of the gang ABD being iterated through.
  */
 static void
-abd_iter_init(struct abd_iter *aiter, abd_t *abd, int km_type)
+abd_iter_set_abd(struct abd_iter *aiter, abd_t *abd)
 {
-	abd_verify(abd);
 	aiter->iter_abd = abd;
-	aiter->iter_mapaddr = NULL;
-	aiter->iter_mapsize = 0;
 	aiter->iter_pos = 0;
-	if (abd_is_linear(abd)) {
+	if (abd_is_linear(abd) || abd_is_gang(abd)) {
 		aiter->iter_offset = 0;
 		aiter->iter_sg = NULL;
 	} else {
 		aiter->iter_offset = ABD_SCATTER(abd).abd_offset;
 		aiter->iter_sg = ABD_SCATTER(abd).abd_sgl;
 	}
+}
+
+/*
+ * Initialize the abd_iter.  A gang ABD is iterated through one child at a
+ * time, so no chunk mapped by the abd_iter spans two children.
+ */
+static void
+abd_iter_init(struct abd_iter *aiter, abd_t *abd, int km_type)
+{
+	abd_verify(abd);
+	aiter->iter_gang = NULL;
+	aiter->iter_mapaddr = NULL;
+	aiter->iter_mapsize = 0;
+	if (abd_is_gang(abd) &&
+	    !list_is_empty(&ABD_GANG(abd).abd_gang_chain)) {
+		aiter->iter_gang = abd;
+		abd = list_head(&ABD_GANG(abd).abd_gang_chain);
+	}
+	abd_iter_set_abd(aiter, abd);
 #ifndef HAVE_1ARG_KMAP_ATOMIC
 	ASSERT3U(km_type, <, NR_KM_TYPE);
 	aiter->iter_km = km_type;
@@ -1083,6 +1466,18 @@ abd_iter_advance(struct abd_iter *aiter, size_t amount)
 	if (aiter->iter_pos == aiter->iter_abd->abd_size)
 		return;
 
+	/* Step over the rest of the current child of a gang ABD */
+	while (aiter->iter_gang != NULL &&
+	    amount >= aiter->iter_abd->abd_size - aiter->iter_pos) {
+		abd_t *cabd = list_next(&ABD_GANG(aiter->iter_gang).
+		    abd_gang_chain, aiter->iter_abd);
+
+		if (cabd == NULL)
+			break;
+		amount -= aiter->iter_abd->abd_size - aiter->iter_pos;
+		abd_iter_set_abd(aiter, cabd);
+	}
+
 	aiter->iter_pos += amount;
 	aiter->iter_offset += amount;
 	if (!abd_is_linear(aiter->iter_abd)) {
@@ -1539,6 +1934,23 @@ abd_nr_pages_off(abd_t *abd, unsigned int size, size_t off)
 {
 	unsigned long pos;
 
+	if (abd_is_gang(abd)) {
+		unsigned long count = 0;
+		abd_t *cabd;
+
+		for (cabd = abd_gang_get_offset(abd, &off);
+		    cabd != NULL && size > 0;
+		    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+			unsigned int len = MIN(size, cabd->abd_size - off);
+
+			count += abd_nr_pages_off(cabd, len, off);
+			size -= len;
+			off = 0;
+		}
+
+		return (count);
+	}
+
 	if (abd_is_linear(abd))
 		pos = (unsigned long)abd_to_buf(abd) + off;
 	else
@@ -1549,7 +1961,7 @@ abd_nr_pages_off(abd_t *abd, unsigned int size, size_t off)
 }
 
 /*
- * bio_map for scatter ABD.
+ * bio_map for scatter and gang ABD.
  * @off is the offset in @abd
  * Remaining IO size is returned
  */
@@ -1574,13 +1986,26 @@ abd_scatter_bio_map_off(struct bio *bio, abd_t *abd,
 		if (io_size <= 0)
 			break;
 
-		sg = aiter.iter_sg;
-		sgoff = aiter.iter_offset;
-		pgoff = sgoff & (PAGESIZE - 1);
+		if (abd_is_linear(aiter.iter_abd)) {
+			/* A linear child of a gang ABD */
+			char *buf = (char *)ABD_BUF(aiter.iter_abd) +
+			    aiter.iter_offset;
+
+			pgoff = offset_in_page(buf);
+			if (is_vmalloc_addr(buf))
+				pg = vmalloc_to_page(buf);
+			else
+				pg = virt_to_page(buf);
+		} else {
+			sg = aiter.iter_sg;
+			sgoff = aiter.iter_offset;
+			pgoff = sgoff & (PAGESIZE - 1);
+			pg = nth_page(sg_page(sg), sgoff >> PAGE_SHIFT);
+		}
 		len = MIN(io_size, PAGESIZE - pgoff);
+		len = MIN(len, aiter.iter_abd->abd_size - aiter.iter_pos);
 		ASSERT(len > 0);
 
-		pg = nth_page(sg_page(sg), sgoff >> PAGE_SHIFT);
 		if (bio_add_page(bio, pg, len, pgoff) != len)
 			break;
 
@@ -1602,4 +2027,8 @@ MODULE_PARM_DESC(zfs_abd_scatter_min_size,
 module_param(zfs_abd_scatter_max_order, uint, 0644);
 MODULE_PARM_DESC(zfs_abd_scatter_max_order,
 	"Maximum order allocation used for a scatter ABD.");
+/* CSTYLED */
+module_param(zfs_abd_magazine_size, ulong, 0644);
+MODULE_PARM_DESC(zfs_abd_magazine_size,
+	"Maximum bytes of free chunks cached per CPU.");
 #endif
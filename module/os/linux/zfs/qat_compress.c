@@ -47,6 +47,7 @@
 static CpaInstanceHandle dc_inst_handles[QAT_DC_MAX_INSTANCES];
 static CpaDcSessionHandle session_handles[QAT_DC_MAX_INSTANCES];
 static CpaBufferList **buffer_array[QAT_DC_MAX_INSTANCES];
+static uint32_t inst_inflight[QAT_DC_MAX_INSTANCES];
 static Cpa16U num_inst = 0;
 static Cpa32U inst_num = 0;
 static boolean_t qat_dc_init_done = B_FALSE;
@@ -290,7 +291,7 @@ qat_compress_impl(qat_compress_dir_t dir, char *src, int src_len,
 	    num_add_buf * sizeof (struct page *)) != CPA_STATUS_SUCCESS)
 		goto fail;
 
-	i = (Cpa32U)atomic_inc_32_nv(&inst_num) % num_inst;
+	i = qat_instance_get(inst_inflight, num_inst, &inst_num);
 	dc_inst_handle = dc_inst_handles[i];
 	session_handle = session_handles[i];
 
@@ -405,7 +406,7 @@ qat_compress_impl(qat_compress_dir_t dir, char *src, int src_len,
 
 		/* we now wait until the completion of the operation. */
 		if (!wait_for_completion_interruptible_timeout(&complete,
-		    QAT_TIMEOUT_MS)) {
+		    QAT_TIMEOUT)) {
 			status = CPA_STATUS_FAIL;
 			goto fail;
 		}
@@ -464,7 +465,7 @@ qat_compress_impl(qat_compress_dir_t dir, char *src, int src_len,
 
 		/* we now wait until the completion of the operation. */
 		if (!wait_for_completion_interruptible_timeout(&complete,
-		    QAT_TIMEOUT_MS)) {
+		    QAT_TIMEOUT)) {
 			status = CPA_STATUS_FAIL;
 			goto fail;
 		}
@@ -518,6 +519,8 @@ fail:
 	QAT_PHYS_CONTIG_FREE(buf_list_src);
 	QAT_PHYS_CONTIG_FREE(buf_list_dst);
 
+	qat_instance_put(inst_inflight, i);
+
 	return (status);
 }
 
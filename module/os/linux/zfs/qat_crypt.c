@@ -48,6 +48,7 @@
 
 #define	MAX_PAGE_NUM			1024
 
+static uint32_t inst_inflight[QAT_CRYPT_MAX_INSTANCES];
 static Cpa32U inst_num = 0;
 static Cpa16U num_inst = 0;
 static CpaInstanceHandle cy_inst_handles[QAT_CRYPT_MAX_INSTANCES];
@@ -296,7 +297,7 @@ qat_crypt(qat_encrypt_dir_t dir, uint8_t *src_buf, uint8_t *dst_buf,
     crypto_key_t *key, uint64_t crypt, uint32_t enc_len)
 {
 	CpaStatus status = CPA_STATUS_SUCCESS;
-	Cpa16U i;
+	Cpa16U i, inst;
 	CpaInstanceHandle cy_inst_handle;
 	Cpa16U nr_bufs = (enc_len >> PAGE_SHIFT) + 2;
 	Cpa32U bytes_left = 0;
@@ -325,8 +326,8 @@ qat_crypt(qat_encrypt_dir_t dir, uint8_t *src_buf, uint8_t *dst_buf,
 		QAT_STAT_INCR(decrypt_total_in_bytes, enc_len);
 	}
 
-	i = (Cpa32U)atomic_inc_32_nv(&inst_num) % num_inst;
-	cy_inst_handle = cy_inst_handles[i];
+	inst = qat_instance_get(inst_inflight, num_inst, &inst_num);
+	cy_inst_handle = cy_inst_handles[inst];
 
 	status = qat_init_crypt_session_ctx(dir, cy_inst_handle,
 	    &cy_session_ctx, key, crypt, aad_len);
@@ -334,6 +335,7 @@ qat_crypt(qat_encrypt_dir_t dir, uint8_t *src_buf, uint8_t *dst_buf,
 		/* don't count CCM as a failure since it's not supported */
 		if (zio_crypt_table[crypt].ci_crypt_type == ZC_TYPE_GCM)
 			QAT_STAT_BUMP(crypt_fails);
+		qat_instance_put(inst_inflight, inst);
 		return (status);
 	}
 
@@ -424,7 +426,7 @@ qat_crypt(qat_encrypt_dir_t dir, uint8_t *src_buf, uint8_t *dst_buf,
 		goto fail;
 
 	if (!wait_for_completion_interruptible_timeout(&cb.complete,
-	    QAT_TIMEOUT_MS)) {
+	    QAT_TIMEOUT)) {
 		status = CPA_STATUS_FAIL;
 		goto fail;
 	}
@@ -460,6 +462,7 @@ fail:
 	QAT_PHYS_CONTIG_FREE(cy_session_ctx);
 	QAT_PHYS_CONTIG_FREE(flat_src_buf_array);
 	QAT_PHYS_CONTIG_FREE(flat_dst_buf_array);
+	qat_instance_put(inst_inflight, inst);
 
 	return (status);
 }
@@ -468,7 +471,7 @@ int
 qat_checksum(uint64_t cksum, uint8_t *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	CpaStatus status;
-	Cpa16U i;
+	Cpa16U i, inst;
 	CpaInstanceHandle cy_inst_handle;
 	Cpa16U nr_bufs = (size >> PAGE_SHIFT) + 2;
 	Cpa32U bytes_left = 0;
@@ -487,8 +490,8 @@ qat_checksum(uint64_t cksum, uint8_t *buf, uint64_t size, zio_cksum_t *zcp)
 	QAT_STAT_BUMP(cksum_requests);
 	QAT_STAT_INCR(cksum_total_in_bytes, size);
 
-	i = (Cpa32U)atomic_inc_32_nv(&inst_num) % num_inst;
-	cy_inst_handle = cy_inst_handles[i];
+	inst = qat_instance_get(inst_inflight, num_inst, &inst_num);
+	cy_inst_handle = cy_inst_handles[inst];
 
 	status = qat_init_checksum_session_ctx(cy_inst_handle,
 	    &cy_session_ctx, cksum);
@@ -497,6 +500,7 @@ qat_checksum(uint64_t cksum, uint8_t *buf, uint64_t size, zio_cksum_t *zcp)
 		if (cksum == ZIO_CHECKSUM_SHA256 ||
 		    cksum == ZIO_CHECKSUM_SHA512)
 			QAT_STAT_BUMP(cksum_fails);
+		qat_instance_put(inst_inflight, inst);
 		return (status);
 	}
 
@@ -550,7 +554,7 @@ qat_checksum(uint64_t cksum, uint8_t *buf, uint64_t size, zio_cksum_t *zcp)
 		goto fail;
 
 	if (!wait_for_completion_interruptible_timeout(&cb.complete,
-	    QAT_TIMEOUT_MS)) {
+	    QAT_TIMEOUT)) {
 		status = CPA_STATUS_FAIL;
 		goto fail;
 	}
@@ -573,6 +577,7 @@ fail:
 	QAT_PHYS_CONTIG_FREE(src_buffer_list.pPrivateMetaData);
 	QAT_PHYS_CONTIG_FREE(cy_session_ctx);
 	QAT_PHYS_CONTIG_FREE(flat_src_buf_array);
+	qat_instance_put(inst_inflight, inst);
 
 	return (status);
 }
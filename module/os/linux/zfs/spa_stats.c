@@ -606,6 +606,116 @@ spa_io_history_destroy(spa_t *spa)
 	mutex_destroy(&shk->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA zio Stage Histogram Routines
+ * ==========================================================================
+ */
+
+/*
+ * Latency histograms of the pipeline stages of logical zios, one kstat per
+ * zio_stage_class_t.  They are collected in spa_stage_histo when
+ * zio_stage_histo is set, see zio_stage_histo_update().
+ */
+static const char *const spa_zio_stage_names[ZIO_STAGE_CLASSES] = {
+	"zio_stage_taskq",
+	"zio_stage_compress",
+	"zio_stage_encrypt",
+	"zio_stage_checksum",
+	"zio_stage_alloc",
+	"zio_stage_done",
+};
+
+/*
+ * When the kstat is written zero all buckets.  When the kstat is read
+ * copy in the current counts and trim the trailing empty buckets.
+ */
+static int
+spa_zio_stages_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_history_kstat_t *shk = NULL;
+	kstat_named_t *ks;
+	int c, i;
+
+	for (c = 0; c < ZIO_STAGE_CLASSES; c++) {
+		shk = &spa->spa_stats.zio_stages[c];
+		if (shk->kstat == ksp)
+			break;
+	}
+	ASSERT3S(c, <, ZIO_STAGE_CLASSES);
+	ks = shk->private;
+
+	for (i = 0; i < shk->count; i++) {
+		if (rw == KSTAT_WRITE)
+			spa->spa_stage_histo[c][i] = 0;
+		ks[i].value.ui64 = spa->spa_stage_histo[c][i];
+	}
+
+	for (i = shk->count; i > 0; i--)
+		if (ks[i - 1].value.ui64 != 0)
+			break;
+
+	ksp->ks_ndata = i;
+	ksp->ks_data_size = i * sizeof (kstat_named_t);
+
+	return (0);
+}
+
+static void
+spa_zio_stages_init(spa_t *spa)
+{
+	char *name = kmem_asprintf("zfs/%s", spa_name(spa));
+
+	for (int c = 0; c < ZIO_STAGE_CLASSES; c++) {
+		spa_history_kstat_t *shk = &spa->spa_stats.zio_stages[c];
+		kstat_named_t *ks;
+		kstat_t *ksp;
+
+		mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+		shk->count = VDEV_L_HISTO_BUCKETS;
+		shk->size = shk->count * sizeof (kstat_named_t);
+		shk->private = kmem_zalloc(shk->size, KM_SLEEP);
+
+		for (int i = 0; i < shk->count; i++) {
+			ks = &((kstat_named_t *)shk->private)[i];
+			ks->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(ks->name, KSTAT_STRLEN, "%llu ns",
+			    (u_longlong_t)1 << i);
+		}
+
+		ksp = kstat_create(name, 0, spa_zio_stage_names[c], "misc",
+		    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+		shk->kstat = ksp;
+
+		if (ksp) {
+			ksp->ks_lock = &shk->lock;
+			ksp->ks_data = shk->private;
+			ksp->ks_ndata = shk->count;
+			ksp->ks_data_size = shk->size;
+			ksp->ks_private = spa;
+			ksp->ks_update = spa_zio_stages_update;
+			kstat_install(ksp);
+		}
+	}
+	strfree(name);
+}
+
+static void
+spa_zio_stages_destroy(spa_t *spa)
+{
+	for (int c = 0; c < ZIO_STAGE_CLASSES; c++) {
+		spa_history_kstat_t *shk = &spa->spa_stats.zio_stages[c];
+
+		if (shk->kstat)
+			kstat_delete(shk->kstat);
+
+		kmem_free(shk->private, shk->size);
+		mutex_destroy(&shk->lock);
+	}
+}
+
 /*
  * ==========================================================================
  * SPA MMP History Routines
@@ -903,6 +1013,10 @@ static spa_iostats_t spa_iostats_template = {
 	{ "autotrim_bytes_skipped",		KSTAT_DATA_UINT64 },
 	{ "autotrim_extents_failed",		KSTAT_DATA_UINT64 },
 	{ "autotrim_bytes_failed",		KSTAT_DATA_UINT64 },
+	{ "mmp_writes",				KSTAT_DATA_UINT64 },
+	{ "mmp_writes_failed",			KSTAT_DATA_UINT64 },
+	{ "mmp_write_time_ns",			KSTAT_DATA_UINT64 },
+	{ "mmp_write_time_max_ns",		KSTAT_DATA_UINT64 },
 };
 
 #define	SPA_IOSTATS_ADD(stat, val) \
@@ -939,6 +1053,29 @@ spa_iostats_trim_add(spa_t *spa, trim_type_t type,
 	}
 }
 
+/*
+ * Account a completed MMP write.  Callers serialize on mmp_io_lock, which
+ * keeps the maximum consistent.
+ */
+void
+spa_iostats_mmp_add(spa_t *spa, hrtime_t duration, int error)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.iostats;
+	kstat_t *ksp = shk->kstat;
+	spa_iostats_t *iostats;
+
+	if (ksp == NULL)
+		return;
+
+	iostats = ksp->ks_data;
+	SPA_IOSTATS_ADD(mmp_writes, 1);
+	if (error != 0)
+		SPA_IOSTATS_ADD(mmp_writes_failed, 1);
+	SPA_IOSTATS_ADD(mmp_write_time_ns, duration);
+	if (duration > iostats->mmp_write_time_max_ns.value.ui64)
+		iostats->mmp_write_time_max_ns.value.ui64 = duration;
+}
+
 int
 spa_iostats_update(kstat_t *ksp, int rw)
 {
@@ -999,11 +1136,13 @@ spa_stats_init(spa_t *spa)
 	spa_mmp_history_init(spa);
 	spa_state_init(spa);
 	spa_iostats_init(spa);
+	spa_zio_stages_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
+	spa_zio_stages_destroy(spa);
 	spa_iostats_destroy(spa);
 	spa_health_destroy(spa);
 	spa_tx_assign_destroy(spa);
@@ -348,9 +348,15 @@ vdev_disk_open(vdev_t *v, uint64_t *psize, uint64_t *max_psize,
 	/* Set when device reports it supports secure TRIM. */
 	v->vdev_has_securetrim = !!blk_queue_discard_secure(q);
 
+	/* Set when device can zero a range without a data transfer. */
+	v->vdev_has_zeroes = !!bdev_write_zeroes(vd->vd_bdev);
+
 	/* Inform the ZIO pipeline that we are non-rotational */
 	v->vdev_nonrot = blk_queue_nonrot(q);
 
+	/* Aggregated writes are mapped from their i/os' buffers */
+	v->vdev_agg_nocopy = B_TRUE;
+
 	/* Physical volume size in bytes for the partition */
 	*psize = bdev_capacity(vd->vd_bdev);
 
@@ -519,6 +525,125 @@ bio_map_abd_off(struct bio *bio, abd_t *abd, unsigned int size, size_t off)
 	return (abd_scatter_bio_map_off(bio, abd, size, off));
 }
 
+/*
+ * An aggregated write without a buffer of its own, see
+ * vdev_queue_aggregate(), is mapped from the buffers of the i/os it
+ * aggregates, which are its parents.  They are back to back and collected
+ * here in offset order.  The optional ones have no data and are written
+ * from the zero page.
+ */
+typedef struct vdev_disk_agg {
+	zio_t		*vda_zio;
+	int		vda_count;
+	zio_t		**vda_dios;
+} vdev_disk_agg_t;
+
+static void
+vdev_disk_agg_init(vdev_disk_agg_t *vda, zio_t *zio)
+{
+	zio_link_t *zl = NULL;
+	zio_t *dio;
+	int i;
+
+	vda->vda_zio = zio;
+	vda->vda_count = 0;
+	while (zio_walk_parents(zio, &zl) != NULL)
+		vda->vda_count++;
+
+	vda->vda_dios = kmem_alloc(vda->vda_count * sizeof (zio_t *),
+	    KM_SLEEP);
+
+	/*
+	 * Each i/o was added as the head of the parent list, from the
+	 * first to the last, so the list is in reverse offset order.
+	 */
+	i = vda->vda_count;
+	while ((dio = zio_walk_parents(zio, &zl)) != NULL)
+		vda->vda_dios[--i] = dio;
+	ASSERT0(i);
+
+	for (i = 1; i < vda->vda_count; i++) {
+		ASSERT3U(vda->vda_dios[i - 1]->io_offset +
+		    vda->vda_dios[i - 1]->io_size, ==,
+		    vda->vda_dios[i]->io_offset);
+	}
+}
+
+static void
+vdev_disk_agg_fini(vdev_disk_agg_t *vda)
+{
+	kmem_free(vda->vda_dios, vda->vda_count * sizeof (zio_t *));
+}
+
+static unsigned long
+vdev_disk_agg_nr_pages(vdev_disk_agg_t *vda, unsigned int size, size_t off)
+{
+	uint64_t offset = vda->vda_zio->io_offset + off;
+	unsigned long pages = 0;
+
+	for (int i = 0; i < vda->vda_count && size > 0; i++) {
+		zio_t *dio = vda->vda_dios[i];
+		size_t doff, len;
+
+		if (offset >= dio->io_offset + dio->io_size)
+			continue;
+
+		doff = offset - dio->io_offset;
+		len = MIN(size, dio->io_size - doff);
+		if (dio->io_flags & ZIO_FLAG_NODATA)
+			pages += DIV_ROUND_UP(len, PAGE_SIZE);
+		else
+			pages += abd_nr_pages_off(dio->io_abd, len, doff);
+		offset += len;
+		size -= len;
+	}
+
+	return (pages);
+}
+
+static unsigned int
+bio_map_zero(struct bio *bio, unsigned int size)
+{
+	while (size > 0) {
+		unsigned int len = MIN(size, PAGE_SIZE);
+
+		if (bio_add_page(bio, ZERO_PAGE(0), len, 0) != len)
+			break;
+		size -= len;
+	}
+
+	return (size);
+}
+
+static unsigned int
+bio_map_agg_off(struct bio *bio, vdev_disk_agg_t *vda, unsigned int size,
+    size_t off)
+{
+	uint64_t offset = vda->vda_zio->io_offset + off;
+
+	for (int i = 0; i < vda->vda_count && size > 0; i++) {
+		zio_t *dio = vda->vda_dios[i];
+		unsigned int len, left;
+		size_t doff;
+
+		if (offset >= dio->io_offset + dio->io_size)
+			continue;
+
+		doff = offset - dio->io_offset;
+		len = MIN(size, dio->io_size - doff);
+		if (dio->io_flags & ZIO_FLAG_NODATA)
+			left = bio_map_zero(bio, len);
+		else
+			left = bio_map_abd_off(bio, dio->io_abd, len, doff);
+		offset += len - left;
+		size -= len - left;
+		if (left != 0)
+			break;
+	}
+
+	return (size);
+}
+
 static inline void
 vdev_submit_bio_impl(struct bio *bio)
 {
@@ -577,14 +702,39 @@ vdev_submit_bio(struct bio *bio)
 #endif
 }
 
+/*
+ * The largest bio the request queue accepts as a single request.  Bios are
+ * built up to this size so the block layer does not have to split them
+ * again, counting every page as its own segment to stay under the segment
+ * limit whatever the buffer layout.
+ */
+static unsigned int
+vdev_disk_bio_max_size(struct block_device *bdev)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+	unsigned int max_size = BIO_MAX_PAGES * PAGE_SIZE;
+
+	if (q != NULL) {
+		max_size = MIN(max_size,
+		    (unsigned int)queue_max_sectors(q) << 9);
+		max_size = MIN(max_size,
+		    (unsigned int)queue_max_segments(q) * PAGE_SIZE);
+	}
+
+	return (MAX(P2ALIGN(max_size, PAGE_SIZE), PAGE_SIZE));
+}
+
 static int
 __vdev_disk_physio(struct block_device *bdev, zio_t *zio,
     size_t io_size, uint64_t io_offset, int rw, int flags)
 {
 	dio_request_t *dr;
+	vdev_disk_agg_t vda;
 	uint64_t abd_offset;
 	uint64_t bio_offset;
-	int bio_size, bio_count = 16;
+	unsigned long nr_pages;
+	unsigned int bio_max, map_size, left;
+	int bio_size, bio_count;
 	int i = 0, error = 0;
 #if defined(HAVE_BLK_QUEUE_HAVE_BLK_PLUG)
 	struct blk_plug plug;
@@ -599,10 +749,23 @@ __vdev_disk_physio(struct block_device *bdev, zio_t *zio,
 		return (SET_ERROR(EIO));
 	}
 
+	if (zio->io_abd == NULL)
+		vdev_disk_agg_init(&vda, zio);
+
+	/*
+	 * Size the dio for the expected number of bios up front, with one
+	 * spare for a buffer that does not start on a page boundary.
+	 */
+	bio_max = vdev_disk_bio_max_size(bdev);
+	bio_count = DIV_ROUND_UP(io_size, bio_max) + 1;
+
 retry:
 	dr = vdev_disk_dio_alloc(bio_count);
-	if (dr == NULL)
+	if (dr == NULL) {
+		if (zio->io_abd == NULL)
+			vdev_disk_agg_fini(&vda);
 		return (SET_ERROR(ENOMEM));
+	}
 
 	if (zio && !(zio->io_flags & (ZIO_FLAG_IO_RETRY | ZIO_FLAG_TRYHARD)))
 		bio_set_flags_failfast(bdev, &flags);
@@ -612,9 +775,8 @@ retry:
 	/*
 	 * When the IO size exceeds the maximum bio size for the request
 	 * queue we are forced to break the IO in multiple bio's and wait
-	 * for them all to complete.  Ideally, all pool users will set
-	 * their volume block size to match the maximum request size and
-	 * the common case will be one bio per vdev IO request.
+	 * for them all to complete.  Each bio is filled up to bio_max, so
+	 * the common case is one bio per vdev IO request.
 	 */
 
 	abd_offset = 0;
@@ -637,12 +799,22 @@ retry:
 			goto retry;
 		}
 
+		map_size = MIN(bio_size, bio_max);
+		if (zio->io_abd == NULL) {
+			nr_pages = vdev_disk_agg_nr_pages(&vda, map_size,
+			    abd_offset);
+		} else {
+			nr_pages = abd_nr_pages_off(zio->io_abd, map_size,
+			    abd_offset);
+		}
+
 		/* bio_alloc() with __GFP_WAIT never returns NULL */
 		dr->dr_bio[i] = bio_alloc(GFP_NOIO,
-		    MIN(abd_nr_pages_off(zio->io_abd, bio_size, abd_offset),
-		    BIO_MAX_PAGES));
+		    MIN(nr_pages, BIO_MAX_PAGES));
 		if (unlikely(dr->dr_bio[i] == NULL)) {
 			vdev_disk_dio_free(dr);
+			if (zio->io_abd == NULL)
+				vdev_disk_agg_fini(&vda);
 			return (SET_ERROR(ENOMEM));
 		}
 
@@ -655,15 +827,25 @@ retry:
 		dr->dr_bio[i]->bi_private = dr;
 		bio_set_op_attrs(dr->dr_bio[i], rw, flags);
 
-		/* Remaining size is returned to become the new size */
-		bio_size = bio_map_abd_off(dr->dr_bio[i], zio->io_abd,
-		    bio_size, abd_offset);
+		/* Whatever did not fit is left for the next bio */
+		if (zio->io_abd == NULL) {
+			left = bio_map_agg_off(dr->dr_bio[i], &vda,
+			    map_size, abd_offset);
+		} else {
+			left = bio_map_abd_off(dr->dr_bio[i], zio->io_abd,
+			    map_size, abd_offset);
+		}
+		bio_size -= map_size - left;
 
 		/* Advance in buffer and construct another bio if needed */
 		abd_offset += BIO_BI_SIZE(dr->dr_bio[i]);
 		bio_offset += BIO_BI_SIZE(dr->dr_bio[i]);
 	}
 
+	/* The bios now reference the pages of the aggregated i/os */
+	if (zio->io_abd == NULL)
+		vdev_disk_agg_fini(&vda);
+
 	/* Extra reference to protect dio_request during vdev_submit_bio */
 	vdev_disk_dio_get(dr);
 
@@ -823,6 +1005,18 @@ vdev_disk_io_start(zio_t *zio)
 		break;
 
 	case ZIO_TYPE_TRIM:
+		if (zio->io_trim_flags & ZIO_TRIM_ZEROES) {
+#if defined(HAVE_BLKDEV_ISSUE_ZEROOUT_NOFALLBACK)
+			zio->io_error = -blkdev_issue_zeroout(vd->vd_bdev,
+			    zio->io_offset >> 9, zio->io_size >> 9, GFP_NOFS,
+			    BLKDEV_ZERO_NOUNMAP | BLKDEV_ZERO_NOFALLBACK);
+#else
+			zio->io_error = SET_ERROR(ENOTSUP);
+#endif
+			rw_exit(&vd->vd_lock);
+			zio_interrupt(zio);
+			return;
+		}
 #if defined(BLKDEV_DISCARD_SECURE)
 		if (zio->io_trim_flags & ZIO_TRIM_SECURE)
 			trim_flags |= BLKDEV_DISCARD_SECURE;
@@ -42,6 +42,210 @@
 
 static taskq_t *vdev_file_taskq;
 
+/*
+ * From userland, file and disk vdevs may be driven through io_uring rather
+ * than the synchronous vn_rdwr() path on vdev_file_taskq.  Each open vdev
+ * gets its own ring and a reaper thread which drains completions in batches
+ * of up to VDEV_FILE_URING_BATCH.  Setting vdev_file_uring_sqpoll to an idle
+ * time in milliseconds asks for a kernel-polled submission queue, letting
+ * concurrent submitters share one pass of the poller instead of each making
+ * a system call.  If the ring cannot be set up the taskq path is used.
+ *
+ * vn_rdwr() splits writes to simulate torn writes and mirrors reads to
+ * vn_dumpdir, so ztest disables this and stays on the taskq path.
+ */
+#if !defined(_KERNEL) && defined(HAVE_LIBURING)
+#include <liburing.h>
+
+#define	VDEV_FILE_URING_BATCH	64
+
+int vdev_file_uring = 1;
+int vdev_file_uring_entries = 256;
+int vdev_file_uring_sqpoll = 0;
+
+typedef struct vdev_file_uring {
+	struct io_uring	vfu_ring;
+	kmutex_t	vfu_lock;
+	uint64_t	vfu_inflight;
+	boolean_t	vfu_exiting;
+	kthread_t	*vfu_reaper;
+} vdev_file_uring_t;
+
+typedef struct vdev_file_uio {
+	zio_t		*vuio_zio;
+	void		*vuio_buf;
+} vdev_file_uio_t;
+
+static void
+vdev_file_uring_complete(vdev_file_uio_t *vuio, int res)
+{
+	zio_t *zio = vuio->vuio_zio;
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		abd_return_buf_copy(zio->io_abd, vuio->vuio_buf, zio->io_size);
+	else
+		abd_return_buf(zio->io_abd, vuio->vuio_buf, zio->io_size);
+	kmem_free(vuio, sizeof (vdev_file_uio_t));
+
+	if (res < 0)
+		zio->io_error = SET_ERROR(-res);
+	else if (res != zio->io_size)
+		zio->io_error = SET_ERROR(ENOSPC);
+	else
+		zio->io_error = 0;
+
+	zio_delay_interrupt(zio);
+}
+
+static void
+vdev_file_uring_reaper(void *arg)
+{
+	vdev_file_uring_t *vfu = arg;
+	struct io_uring_cqe *cqes[VDEV_FILE_URING_BATCH];
+
+	for (;;) {
+		unsigned int n, i, done = 0;
+		int error;
+
+		error = io_uring_wait_cqe(&vfu->vfu_ring, &cqes[0]);
+		if (error == -EINTR || error == -EAGAIN)
+			continue;
+		VERIFY0(error);
+
+		n = io_uring_peek_batch_cqe(&vfu->vfu_ring, cqes,
+		    VDEV_FILE_URING_BATCH);
+		for (i = 0; i < n; i++) {
+			vdev_file_uio_t *vuio = io_uring_cqe_get_data(cqes[i]);
+
+			/* A NULL cookie is the wakeup posted at close. */
+			if (vuio != NULL) {
+				vdev_file_uring_complete(vuio, cqes[i]->res);
+				done++;
+			}
+		}
+		io_uring_cq_advance(&vfu->vfu_ring, n);
+
+		mutex_enter(&vfu->vfu_lock);
+		vfu->vfu_inflight -= done;
+		if (vfu->vfu_exiting && vfu->vfu_inflight == 0) {
+			mutex_exit(&vfu->vfu_lock);
+			break;
+		}
+		mutex_exit(&vfu->vfu_lock);
+	}
+
+	thread_exit();
+}
+
+/*
+ * Return a free submission queue entry, pushing everything queued so far to
+ * the kernel if the queue is full.  Called with vfu_lock held.
+ */
+static struct io_uring_sqe *
+vdev_file_uring_get_sqe(vdev_file_uring_t *vfu)
+{
+	struct io_uring_sqe *sqe;
+
+	ASSERT(MUTEX_HELD(&vfu->vfu_lock));
+
+	while ((sqe = io_uring_get_sqe(&vfu->vfu_ring)) == NULL)
+		(void) io_uring_submit(&vfu->vfu_ring);
+
+	return (sqe);
+}
+
+static vdev_file_uring_t *
+vdev_file_uring_init(vnode_t *vp)
+{
+	vdev_file_uring_t *vfu;
+	struct io_uring_params params;
+	unsigned int entries;
+	int error;
+
+	if (!vdev_file_uring || vp->v_dump_fd != -1)
+		return (NULL);
+
+	vfu = kmem_zalloc(sizeof (vdev_file_uring_t), KM_SLEEP);
+	bzero(&params, sizeof (params));
+	if (vdev_file_uring_sqpoll) {
+		params.flags = IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = vdev_file_uring_sqpoll;
+	}
+
+	/*
+	 * A polled submission queue needs privileges on older kernels, so
+	 * quietly retry with an ordinary ring if it is refused.
+	 */
+	entries = MAX(vdev_file_uring_entries, VDEV_FILE_URING_BATCH);
+	error = io_uring_queue_init_params(entries, &vfu->vfu_ring, &params);
+	if (error != 0 && params.flags != 0)
+		error = io_uring_queue_init(entries, &vfu->vfu_ring, 0);
+	if (error != 0) {
+		kmem_free(vfu, sizeof (vdev_file_uring_t));
+		return (NULL);
+	}
+	mutex_init(&vfu->vfu_lock, NULL, MUTEX_DEFAULT, NULL);
+	vfu->vfu_reaper = thread_create(NULL, 0, vdev_file_uring_reaper,
+	    vfu, 0, &p0, TS_RUN | TS_JOINABLE, maxclsyspri);
+
+	return (vfu);
+}
+
+static void
+vdev_file_uring_fini(vdev_file_uring_t *vfu)
+{
+	struct io_uring_sqe *sqe;
+
+	mutex_enter(&vfu->vfu_lock);
+	vfu->vfu_exiting = B_TRUE;
+	sqe = vdev_file_uring_get_sqe(vfu);
+	io_uring_prep_nop(sqe);
+	io_uring_sqe_set_data(sqe, NULL);
+	VERIFY3S(io_uring_submit(&vfu->vfu_ring), >=, 0);
+	mutex_exit(&vfu->vfu_lock);
+
+	thread_join(vfu->vfu_reaper);
+
+	io_uring_queue_exit(&vfu->vfu_ring);
+	mutex_destroy(&vfu->vfu_lock);
+	kmem_free(vfu, sizeof (vdev_file_uring_t));
+}
+
+static void
+vdev_file_uring_io_start(vdev_file_uring_t *vfu, zio_t *zio)
+{
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+	vdev_file_uio_t *vuio;
+	struct io_uring_sqe *sqe;
+	int fd = vf->vf_vnode->v_fd;
+
+	vuio = kmem_alloc(sizeof (vdev_file_uio_t), KM_SLEEP);
+	vuio->vuio_zio = zio;
+
+	mutex_enter(&vfu->vfu_lock);
+	sqe = vdev_file_uring_get_sqe(vfu);
+	if (zio->io_type == ZIO_TYPE_READ) {
+		vuio->vuio_buf = abd_borrow_buf(zio->io_abd, zio->io_size);
+		io_uring_prep_read(sqe, fd, vuio->vuio_buf, zio->io_size,
+		    zio->io_offset);
+	} else {
+		vuio->vuio_buf = abd_borrow_buf_copy(zio->io_abd,
+		    zio->io_size);
+		io_uring_prep_write(sqe, fd, vuio->vuio_buf, zio->io_size,
+		    zio->io_offset);
+	}
+	io_uring_sqe_set_data(sqe, vuio);
+	vfu->vfu_inflight++;
+
+	/*
+	 * With a polled submission queue this only publishes the new tail
+	 * and enters the kernel when the poller thread has gone idle.
+	 */
+	VERIFY3S(io_uring_submit(&vfu->vfu_ring), >=, 0);
+	mutex_exit(&vfu->vfu_lock);
+}
+#endif
+
 static void
 vdev_file_hold(vdev_t *vd)
 {
@@ -117,6 +321,9 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	}
 
 	vf->vf_vnode = vp;
+#if !defined(_KERNEL) && defined(HAVE_LIBURING)
+	vf->vf_uring = vdev_file_uring_init(vp);
+#endif
 
 #ifdef _KERNEL
 	/*
@@ -153,6 +360,11 @@ vdev_file_close(vdev_t *vd)
 	if (vd->vdev_reopening || vf == NULL)
 		return;
 
+#if !defined(_KERNEL) && defined(HAVE_LIBURING)
+	if (vf->vf_uring != NULL)
+		vdev_file_uring_fini(vf->vf_uring);
+#endif
+
 	if (vf->vf_vnode != NULL) {
 		(void) VOP_PUTPAGE(vf->vf_vnode, 0, 0, B_INVAL, kcred, NULL);
 		(void) VOP_CLOSE(vf->vf_vnode, spa_mode(vd->vdev_spa), 1, 0,
@@ -266,6 +478,13 @@ vdev_file_io_start(zio_t *zio)
 
 	zio->io_target_timestamp = zio_handle_io_delay(zio);
 
+#if !defined(_KERNEL) && defined(HAVE_LIBURING)
+	if (vf->vf_uring != NULL) {
+		vdev_file_uring_io_start(vf->vf_uring, zio);
+		return;
+	}
+#endif
+
 	VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_strategy, zio,
 	    TQ_SLEEP), !=, TASKQID_INVALID);
 }
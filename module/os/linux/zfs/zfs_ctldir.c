@@ -110,6 +110,7 @@ static krwlock_t zfs_snapshot_lock;
  */
 int zfs_expire_snapshot = ZFSCTL_EXPIRE_SNAPSHOT;
 int zfs_admin_snapshot = 0;
+int zfs_snapshot_automount_max = 0;
 
 typedef struct {
 	char		*se_name;	/* full snapshot name */
@@ -118,6 +119,8 @@ typedef struct {
 	uint64_t	se_objsetid;	/* snapshot objset id */
 	struct dentry   *se_root_dentry; /* snapshot root dentry */
 	taskqid_t	se_taskqid;	/* scheduled unmount taskqid */
+	hrtime_t	se_mounted;	/* time of the automount */
+	boolean_t	se_evicting;	/* unmount forced by the limit */
 	avl_node_t	se_node_name;	/* zfs_snapshots_by_name link */
 	avl_node_t	se_node_objsetid; /* zfs_snapshots_by_objsetid link */
 	zfs_refcount_t	se_refcount;	/* reference count */
@@ -143,6 +146,7 @@ zfsctl_snapshot_alloc(char *full_name, char *full_path, spa_t *spa,
 	se->se_objsetid = objsetid;
 	se->se_root_dentry = root_dentry;
 	se->se_taskqid = TASKQID_INVALID;
+	se->se_mounted = gethrtime();
 
 	zfs_refcount_create(&se->se_refcount);
 
@@ -329,7 +333,7 @@ snapentry_expire(void *data)
 	spa_t *spa = se->se_spa;
 	uint64_t objsetid = se->se_objsetid;
 
-	if (zfs_expire_snapshot <= 0) {
+	if (zfs_expire_snapshot <= 0 && !se->se_evicting) {
 		zfsctl_snapshot_rele(se);
 		return;
 	}
@@ -380,6 +384,47 @@ zfsctl_snapshot_unmount_delay_impl(zfs_snapentry_t *se, int delay)
 	    snapentry_expire, se, TQ_SLEEP, ddi_get_lbolt() + delay * HZ);
 }
 
+/*
+ * Keep the number of automounted snapshots within zfs_snapshot_automount_max
+ * by unmounting the oldest automount as soon as the limit is exceeded,
+ * rather than waiting for zfs_expire_snapshot.  Each automount pins its own
+ * zfsvfs_t, objset and cached dbufs, so browsing through many snapshots
+ * would otherwise let that memory accumulate for the whole expiry period.
+ * Busy snapshots fail to unmount and fall back to the regular expiry.
+ */
+static void
+zfsctl_snapshot_enforce_limit(void)
+{
+	zfs_snapentry_t *se, *oldest = NULL;
+
+	ASSERT(RW_WRITE_HELD(&zfs_snapshot_lock));
+
+	if (zfs_snapshot_automount_max <= 0 ||
+	    avl_numnodes(&zfs_snapshots_by_name) <=
+	    zfs_snapshot_automount_max)
+		return;
+
+	for (se = avl_first(&zfs_snapshots_by_name); se != NULL;
+	    se = AVL_NEXT(&zfs_snapshots_by_name, se)) {
+		if (se->se_evicting)
+			continue;
+		if (oldest == NULL || se->se_mounted < oldest->se_mounted)
+			oldest = se;
+	}
+
+	if (oldest == NULL)
+		return;
+
+	zfsctl_snapshot_unmount_cancel(oldest);
+	if (oldest->se_taskqid != TASKQID_INVALID)
+		return;
+
+	oldest->se_evicting = B_TRUE;
+	zfsctl_snapshot_hold(oldest);
+	oldest->se_taskqid = taskq_dispatch_delay(system_delay_taskq,
+	    snapentry_expire, oldest, TQ_SLEEP, ddi_get_lbolt());
+}
+
 /*
  * Schedule an automatic unmount of objset id to occur in delay seconds from
  * now.  Any previous delayed unmount will be cancelled in favor of the
@@ -500,11 +545,7 @@ zfsctl_inode_alloc(zfsvfs_t *zfsvfs, uint64_t id,
 		return (NULL);
 	}
 
-	mutex_enter(&zfsvfs->z_znodes_lock);
-	list_insert_tail(&zfsvfs->z_all_znodes, zp);
-	zfsvfs->z_nr_znodes++;
-	membar_producer();
-	mutex_exit(&zfsvfs->z_znodes_lock);
+	zfs_znode_list_insert(zfsvfs, zp);
 
 	unlock_new_inode(ip);
 
@@ -1117,6 +1158,7 @@ zfsctl_snapshot_mount(struct path *path, int flags)
 		    dentry);
 		zfsctl_snapshot_add(se);
 		zfsctl_snapshot_unmount_delay_impl(se, zfs_expire_snapshot);
+		zfsctl_snapshot_enforce_limit();
 		rw_exit(&zfs_snapshot_lock);
 	}
 	path_put(&spath);
@@ -1238,3 +1280,7 @@ MODULE_PARM_DESC(zfs_admin_snapshot, "Enable mkdir/rmdir/mv in .zfs/snapshot");
 
 module_param(zfs_expire_snapshot, int, 0644);
 MODULE_PARM_DESC(zfs_expire_snapshot, "Seconds to expire .zfs/snapshot");
+
+module_param(zfs_snapshot_automount_max, int, 0644);
+MODULE_PARM_DESC(zfs_snapshot_automount_max,
+	"Max automounted .zfs/snapshot entries before the oldest is unmounted");
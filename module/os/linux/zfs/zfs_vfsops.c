@@ -1171,16 +1171,13 @@ zfsvfs_create_impl(zfsvfs_t **zfvp, zfsvfs_t *zfsvfs, objset_t *os)
 	zfsvfs->z_sb = NULL;
 	zfsvfs->z_parent = zfsvfs;
 
-	mutex_init(&zfsvfs->z_znodes_lock, NULL, MUTEX_DEFAULT, NULL);
+	zfs_znode_lists_create(zfsvfs);
 	mutex_init(&zfsvfs->z_lock, NULL, MUTEX_DEFAULT, NULL);
-	list_create(&zfsvfs->z_all_znodes, sizeof (znode_t),
-	    offsetof(znode_t, z_link_node));
 	rrm_init(&zfsvfs->z_teardown_lock, B_FALSE);
 	rw_init(&zfsvfs->z_teardown_inactive_lock, NULL, RW_DEFAULT, NULL);
 	rw_init(&zfsvfs->z_fuid_lock, NULL, RW_DEFAULT, NULL);
 
-	int size = MIN(1 << (highbit64(zfs_object_mutex_size) - 1),
-	    ZFS_OBJ_MTX_MAX);
+	int size = zfs_znode_hold_size();
 	zfsvfs->z_hold_size = size;
 	zfsvfs->z_hold_trees = vmem_zalloc(sizeof (avl_tree_t) * size,
 	    KM_SLEEP);
@@ -1306,9 +1303,8 @@ zfsvfs_free(zfsvfs_t *zfsvfs)
 
 	zfs_fuid_destroy(zfsvfs);
 
-	mutex_destroy(&zfsvfs->z_znodes_lock);
+	zfs_znode_lists_destroy(zfsvfs);
 	mutex_destroy(&zfsvfs->z_lock);
-	list_destroy(&zfsvfs->z_all_znodes);
 	rrm_destroy(&zfsvfs->z_teardown_lock);
 	rw_destroy(&zfsvfs->z_teardown_inactive_lock);
 	rw_destroy(&zfsvfs->z_fuid_lock);
@@ -1540,40 +1536,47 @@ zfs_root(zfsvfs_t *zfsvfs, struct inode **ipp)
  * attempting to prune dentries in order to be able to drop the inodes.
  *
  * To avoid scanning the same znodes multiple times they are always rotated
- * to the end of the z_all_znodes list.  New znodes are inserted at the
- * end of the list so we're always scanning the oldest znodes first.
+ * to the end of their z_all_znodes list.  New znodes are inserted at the
+ * end of the lists so we're always scanning the oldest znodes first.  Each
+ * list is given an equal share of nr_to_scan.
  */
 static int
 zfs_prune_aliases(zfsvfs_t *zfsvfs, unsigned long nr_to_scan)
 {
 	znode_t **zp_array, *zp;
 	int max_array = MIN(nr_to_scan, PAGE_SIZE * 8 / sizeof (znode_t *));
+	unsigned long nr_per_list = nr_to_scan / zfsvfs->z_znodes_size + 1;
 	int objects = 0;
-	int i = 0, j = 0;
+	int i, j = 0;
 
 	zp_array = kmem_zalloc(max_array * sizeof (znode_t *), KM_SLEEP);
 
-	mutex_enter(&zfsvfs->z_znodes_lock);
-	while ((zp = list_head(&zfsvfs->z_all_znodes)) != NULL) {
+	for (int l = 0; l < zfsvfs->z_znodes_size && j < max_array; l++) {
+		list_t *list = &zfsvfs->z_all_znodes[l];
 
-		if ((i++ > nr_to_scan) || (j >= max_array))
-			break;
+		i = 0;
+		mutex_enter(&zfsvfs->z_znodes_locks[l]);
+		while ((zp = list_head(list)) != NULL) {
 
-		ASSERT(list_link_active(&zp->z_link_node));
-		list_remove(&zfsvfs->z_all_znodes, zp);
-		list_insert_tail(&zfsvfs->z_all_znodes, zp);
+			if ((i++ > nr_per_list) || (j >= max_array))
+				break;
 
-		/* Skip active znodes and .zfs entries */
-		if (MUTEX_HELD(&zp->z_lock) || zp->z_is_ctldir)
-			continue;
+			ASSERT(list_link_active(&zp->z_link_node));
+			list_remove(list, zp);
+			list_insert_tail(list, zp);
 
-		if (igrab(ZTOI(zp)) == NULL)
-			continue;
+			/* Skip active znodes and .zfs entries */
+			if (MUTEX_HELD(&zp->z_lock) || zp->z_is_ctldir)
+				continue;
 
-		zp_array[j] = zp;
-		j++;
+			if (igrab(ZTOI(zp)) == NULL)
+				continue;
+
+			zp_array[j] = zp;
+			j++;
+		}
+		mutex_exit(&zfsvfs->z_znodes_locks[l]);
 	}
-	mutex_exit(&zfsvfs->z_znodes_lock);
 
 	for (i = 0; i < j; i++) {
 		zp = zp_array[i];
@@ -1686,7 +1689,7 @@ zfsvfs_teardown(zfsvfs_t *zfsvfs, boolean_t unmounting)
 		 *
 		 * We can safely read z_nr_znodes without locking because the
 		 * VFS has already blocked operations which add to the
-		 * z_all_znodes list and thus increment z_nr_znodes.
+		 * z_all_znodes lists and thus increment z_nr_znodes.
 		 */
 		int round = 0;
 		while (zfsvfs->z_nr_znodes > 0) {
@@ -1740,13 +1743,17 @@ zfsvfs_teardown(zfsvfs_t *zfsvfs, boolean_t unmounting)
 	 * Release all holds on dbufs.
 	 */
 	if (!unmounting) {
-		mutex_enter(&zfsvfs->z_znodes_lock);
-		for (zp = list_head(&zfsvfs->z_all_znodes); zp != NULL;
-		    zp = list_next(&zfsvfs->z_all_znodes, zp)) {
-			if (zp->z_sa_hdl)
-				zfs_znode_dmu_fini(zp);
+		for (int i = 0; i < zfsvfs->z_znodes_size; i++) {
+			list_t *list = &zfsvfs->z_all_znodes[i];
+
+			mutex_enter(&zfsvfs->z_znodes_locks[i]);
+			for (zp = list_head(list); zp != NULL;
+			    zp = list_next(list, zp)) {
+				if (zp->z_sa_hdl)
+					zfs_znode_dmu_fini(zp);
+			}
+			mutex_exit(&zfsvfs->z_znodes_locks[i]);
 		}
-		mutex_exit(&zfsvfs->z_znodes_lock);
 	}
 
 	/*
@@ -2185,16 +2192,19 @@ zfs_resume_fs(zfsvfs_t *zfsvfs, dsl_dataset_t *ds)
 	 * VFS prunes the dentry holding the remaining references
 	 * on the stale inode.
 	 */
-	mutex_enter(&zfsvfs->z_znodes_lock);
-	for (zp = list_head(&zfsvfs->z_all_znodes); zp;
-	    zp = list_next(&zfsvfs->z_all_znodes, zp)) {
-		err2 = zfs_rezget(zp);
-		if (err2) {
-			remove_inode_hash(ZTOI(zp));
-			zp->z_is_stale = B_TRUE;
+	for (int i = 0; i < zfsvfs->z_znodes_size; i++) {
+		list_t *list = &zfsvfs->z_all_znodes[i];
+
+		mutex_enter(&zfsvfs->z_znodes_locks[i]);
+		for (zp = list_head(list); zp; zp = list_next(list, zp)) {
+			err2 = zfs_rezget(zp);
+			if (err2) {
+				remove_inode_hash(ZTOI(zp));
+				zp->z_is_stale = B_TRUE;
+			}
 		}
+		mutex_exit(&zfsvfs->z_znodes_locks[i]);
 	}
-	mutex_exit(&zfsvfs->z_znodes_lock);
 
 	if (!zfs_is_readonly(zfsvfs) && !zfsvfs->z_unmounted) {
 		/*
@@ -402,7 +402,7 @@ mappedread(struct inode *ip, int nbytes, uio_t *uio)
 			put_page(pp);
 		} else {
 			error = dmu_read_uio_dbuf(sa_get_db(zp->z_sa_hdl),
-			    uio, bytes);
+			    uio, bytes, 0);
 		}
 
 		len -= bytes;
@@ -416,6 +416,31 @@ mappedread(struct inode *ip, int nbytes, uio_t *uio)
 
 unsigned long zfs_read_chunk_size = 1024 * 1024; /* Tunable */
 unsigned long zfs_delete_blocks = DMU_MAX_DELETEBLKCNT;
+int zfs_dio_enabled = 1; /* Tunable */
+int zfs_mmap_uncached = 0; /* Tunable */
+
+/*
+ * O_DIRECT requests which start and end on a block boundary of the file
+ * are passed down with DMU_DIRECTIO, so blocks which are not already
+ * cached do not displace the contents of the dbuf cache and the ARC.
+ * They still go through the dbufs, which keeps them coherent with any
+ * cached copy.  Files which are mmap'ed are excluded since their pages
+ * must be kept in sync with the ARC.
+ */
+static uint32_t
+zfs_dio_flags(znode_t *zp, offset_t off, ssize_t len, int ioflag)
+{
+	uint32_t blksz = zp->z_blksz;
+
+	if (!zfs_dio_enabled || !(ioflag & O_DIRECT) || zp->z_is_mapped)
+		return (0);
+
+	if (!ISP2(blksz) || blksz < ZTOZSB(zp)->z_max_blksz ||
+	    P2PHASE(off, blksz) != 0 || P2PHASE(len, blksz) != 0)
+		return (0);
+
+	return (DMU_DIRECTIO);
+}
 
 /*
  * Read bytes from specified file into supplied buffer.
@@ -440,6 +465,7 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 {
 	int error = 0;
 	boolean_t frsync = B_FALSE;
+	hrtime_t start = gethrtime();
 
 	znode_t *zp = ITOZ(ip);
 	zfsvfs_t *zfsvfs = ITOZSB(ip);
@@ -498,9 +524,14 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 	}
 
 	ASSERT(uio->uio_loffset < zp->z_size);
+	uint32_t dio_flags = zfs_dio_flags(zp, uio->uio_loffset,
+	    uio->uio_resid, ioflag);
 	ssize_t n = MIN(uio->uio_resid, zp->z_size - uio->uio_loffset);
 	ssize_t start_resid = n;
 
+	if (dio_flags != 0)
+		dio_flags |= DMU_READ_NO_PREFETCH;
+
 #ifdef HAVE_UIO_ZEROCOPY
 	xuio_t *xuio = NULL;
 	if ((uio->uio_extflg == UIO_XUIO) &&
@@ -541,7 +572,7 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 			error = mappedread(ip, nbytes, uio);
 		} else {
 			error = dmu_read_uio_dbuf(sa_get_db(zp->z_sa_hdl),
-			    uio, nbytes);
+			    uio, nbytes, dio_flags);
 		}
 
 		if (error) {
@@ -556,6 +587,8 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 
 	int64_t nread = start_resid - n;
 	dataset_kstats_update_read_kstats(&zfsvfs->z_kstat, nread);
+	dataset_kstats_update_latency(&zfsvfs->z_kstat, DATASET_OP_READ,
+	    start);
 	task_io_account_read(nread);
 out:
 	rangelock_exit(lr);
@@ -589,6 +622,7 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 {
 	int error = 0;
 	ssize_t start_resid = uio->uio_resid;
+	hrtime_t start = gethrtime();
 
 	/*
 	 * Fasttrack empty write
@@ -706,6 +740,7 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 
 	uint64_t end_size = MAX(zp->z_size, woff + n);
 	zilog_t *zilog = zfsvfs->z_log;
+	uint32_t dio_flags = zfs_dio_flags(zp, woff, n, ioflag);
 #ifdef HAVE_UIO_ZEROCOPY
 	int		i_iov = 0;
 	const iovec_t	*iovp = uio->uio_iov;
@@ -746,7 +781,8 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 			    aiov->iov_len == arc_buf_size(abuf)));
 			i_iov++;
 #endif
-		} else if (n >= max_blksz && woff >= zp->z_size &&
+		} else if (dio_flags == 0 &&
+		    n >= max_blksz && woff >= zp->z_size &&
 		    P2PHASE(woff, max_blksz) == 0 &&
 		    zp->z_blksz == max_blksz) {
 			/*
@@ -821,7 +857,7 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 			tx_bytes = uio->uio_resid;
 			uio->uio_fault_disable = B_TRUE;
 			error = dmu_write_uio_dbuf(sa_get_db(zp->z_sa_hdl),
-			    uio, nbytes, tx);
+			    uio, nbytes, tx, dio_flags);
 			uio->uio_fault_disable = B_FALSE;
 			if (error == EFAULT) {
 				dmu_tx_commit(tx);
@@ -963,6 +999,8 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 
 	int64_t nwritten = start_resid - uio->uio_resid;
 	dataset_kstats_update_write_kstats(&zfsvfs->z_kstat, nwritten);
+	dataset_kstats_update_latency(&zfsvfs->z_kstat, DATASET_OP_WRITE,
+	    start);
 	task_io_account_write(nwritten);
 
 	ZFS_EXIT(zfsvfs);
@@ -2270,6 +2308,8 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 	int		done = 0;
 	uint64_t	parent;
 	uint64_t	offset; /* must be unsigned; checks for < 1 */
+	uint64_t	*pfobjs = NULL;
+	int		npf = 0;
 
 	ZFS_ENTER(zfsvfs);
 	ZFS_VERIFY_ZP(zp);
@@ -2288,6 +2328,10 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 	os = zfsvfs->z_os;
 	offset = ctx->pos;
 	prefetch = zp->z_zn_prefetch;
+	if (prefetch) {
+		pfobjs = kmem_alloc(DMU_PREFETCH_DNODES_BATCH *
+		    sizeof (uint64_t), KM_SLEEP);
+	}
 
 	/*
 	 * Initialize the iterator cursor.
@@ -2367,10 +2411,14 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 		if (done)
 			break;
 
-		/* Prefetch znode */
+		/* Prefetch znodes, a batch at a time */
 		if (prefetch) {
-			dmu_prefetch(os, objnum, 0, 0, 0,
-			    ZIO_PRIORITY_SYNC_READ);
+			pfobjs[npf++] = objnum;
+			if (npf == DMU_PREFETCH_DNODES_BATCH) {
+				dmu_prefetch_dnodes(os, pfobjs, npf,
+				    ZIO_PRIORITY_SYNC_READ);
+				npf = 0;
+			}
 		}
 
 		/*
@@ -2388,6 +2436,13 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 
 update:
 	zap_cursor_fini(&zc);
+	if (pfobjs != NULL) {
+		if (npf > 0)
+			dmu_prefetch_dnodes(os, pfobjs, npf,
+			    ZIO_PRIORITY_SYNC_READ);
+		kmem_free(pfobjs, DMU_PREFETCH_DNODES_BATCH *
+		    sizeof (uint64_t));
+	}
 	if (error == ENOENT)
 		error = 0;
 out:
@@ -2407,9 +2462,13 @@ zfs_fsync(struct inode *ip, int syncflag, cred_t *cr)
 	(void) tsd_set(zfs_fsyncer_key, (void *)zfs_fsync_sync_cnt);
 
 	if (zfsvfs->z_os->os_sync != ZFS_SYNC_DISABLED) {
+		hrtime_t start = gethrtime();
+
 		ZFS_ENTER(zfsvfs);
 		ZFS_VERIFY_ZP(zp);
 		zil_commit(zfsvfs->z_log, zp->z_id);
+		dataset_kstats_update_latency(&zfsvfs->z_kstat,
+		    DATASET_OP_FSYNC, start);
 		ZFS_EXIT(zfsvfs);
 	}
 	tsd_set(zfs_fsyncer_key, NULL);
@@ -4610,6 +4669,200 @@ zfs_putpage(struct inode *ip, struct page *pp, struct writeback_control *wbc)
 	return (err);
 }
 
+/*
+ * Drops the references taken on the pages of zfs_putpages(), after waiting
+ * for the writeback of those which were already under writeback.
+ */
+static void
+zfs_putpages_rele(struct page *pl[], int count, struct page *wl[], int nwait,
+    int nr_pages)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		put_page(pl[i]);
+
+	for (i = 0; i < nwait; i++) {
+		if (PageWriteback(wl[i]))
+			wait_on_page_bit(wl[i], PG_writeback);
+		put_page(wl[i]);
+	}
+
+	if (wl != NULL)
+		kmem_free(wl, nr_pages * sizeof (struct page *));
+}
+
+/*
+ * Push out a batch of pages which were collected in increasing index order
+ * by zpl_writepages(), with one range lock, tx and SA update for all of
+ * them rather than one per page.  As for zfs_putpage() each page is
+ * completed by the commit callback once it is on stable storage.  The
+ * caller has redirtied each page for writepage, taken a reference on it
+ * and unlocked it, which allows the range lock to be taken first, see the
+ * comment in zfs_putpage() on the lock ordering.  The references are
+ * dropped before returning.
+ *
+ *	IN:	ip	- page mapped for inode.
+ *		pl	- pages to push
+ *		nr_pages - number of pages
+ *		wbc	- writeback control data
+ *
+ *	RETURN:	0 if success
+ *		error code if failure
+ *
+ * Timestamps:
+ *	ip - ctime|mtime updated
+ */
+int
+zfs_putpages(struct inode *ip, struct page *pl[], int nr_pages,
+    struct writeback_control *wbc)
+{
+	znode_t		*zp = ITOZ(ip);
+	zfsvfs_t	*zfsvfs = ITOZSB(ip);
+	struct address_space *mapping = ip->i_mapping;
+	loff_t		start, end, isize;
+	struct page	**wl = NULL;
+	dmu_tx_t	*tx;
+	int		err = 0;
+	int		i, count = 0, nwait = 0;
+	uint64_t	mtime[2], ctime[2];
+	sa_bulk_attr_t	bulk[3];
+	int		cnt = 0;
+
+	ASSERT3S(nr_pages, >, 0);
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(zp);
+
+	isize = i_size_read(ip);
+	start = page_offset(pl[0]);
+	end = MIN(page_offset(pl[nr_pages - 1]) + PAGE_SIZE, isize);
+
+	/* Pages are beyond end of file */
+	if (start >= isize) {
+		for (i = 0; i < nr_pages; i++)
+			put_page(pl[i]);
+		ZFS_EXIT(zfsvfs);
+		return (0);
+	}
+
+	locked_range_t *lr = rangelock_enter(&zp->z_rangelock,
+	    start, end - start, RL_WRITER);
+
+	/*
+	 * Recheck the state of each page now that the range lock is held,
+	 * and drop those which no longer need to be written out by us.
+	 */
+	for (i = 0; i < nr_pages; i++) {
+		struct page *pp = pl[i];
+
+		lock_page(pp);
+		if (unlikely(mapping != pp->mapping || !PageDirty(pp) ||
+		    page_offset(pp) >= isize)) {
+			unlock_page(pp);
+			put_page(pp);
+			continue;
+		}
+		if (PageWriteback(pp)) {
+			unlock_page(pp);
+			if (wbc->sync_mode != WB_SYNC_NONE) {
+				/* Waited for once the range lock is dropped */
+				if (wl == NULL) {
+					wl = kmem_alloc(nr_pages *
+					    sizeof (struct page *), KM_SLEEP);
+				}
+				wl[nwait++] = pp;
+			} else {
+				put_page(pp);
+			}
+			continue;
+		}
+		if (!clear_page_dirty_for_io(pp)) {
+			unlock_page(pp);
+			put_page(pp);
+			continue;
+		}
+
+		/* See the counterpart comment in zfs_putpage() */
+		wbc->pages_skipped--;
+		set_page_writeback(pp);
+		unlock_page(pp);
+		pl[count++] = pp;
+	}
+
+	if (count == 0) {
+		rangelock_exit(lr);
+		zfs_putpages_rele(pl, count, wl, nwait, nr_pages);
+		ZFS_EXIT(zfsvfs);
+		return (0);
+	}
+
+	tx = dmu_tx_create(zfsvfs->z_os);
+	dmu_tx_hold_write(tx, zp->z_id, start, end - start);
+	dmu_tx_hold_sa(tx, zp->z_sa_hdl, B_FALSE);
+	zfs_sa_upgrade_txholds(tx, zp);
+
+	err = dmu_tx_assign(tx, TXG_NOWAIT);
+	if (err != 0) {
+		if (err == ERESTART)
+			dmu_tx_wait(tx);
+
+		dmu_tx_abort(tx);
+		for (i = 0; i < count; i++) {
+			__set_page_dirty_nobuffers(pl[i]);
+			ClearPageError(pl[i]);
+			end_page_writeback(pl[i]);
+		}
+		rangelock_exit(lr);
+		zfs_putpages_rele(pl, count, wl, nwait, nr_pages);
+		ZFS_EXIT(zfsvfs);
+		return (err);
+	}
+
+	for (i = 0; i < count; i++) {
+		struct page *pp = pl[i];
+		loff_t pgoff = page_offset(pp);
+		unsigned int pglen = MIN(PAGE_SIZE, isize - pgoff);
+		caddr_t va;
+
+		va = kmap(pp);
+		dmu_write(zfsvfs->z_os, zp->z_id, pgoff, pglen, va, tx);
+		kunmap(pp);
+	}
+
+	SA_ADD_BULK_ATTR(bulk, cnt, SA_ZPL_MTIME(zfsvfs), NULL, &mtime, 16);
+	SA_ADD_BULK_ATTR(bulk, cnt, SA_ZPL_CTIME(zfsvfs), NULL, &ctime, 16);
+	SA_ADD_BULK_ATTR(bulk, cnt, SA_ZPL_FLAGS(zfsvfs), NULL,
+	    &zp->z_pflags, 8);
+
+	/* Preserve the mtime and ctime provided by the inode */
+	ZFS_TIME_ENCODE(&ip->i_mtime, mtime);
+	ZFS_TIME_ENCODE(&ip->i_ctime, ctime);
+	zp->z_atime_dirty = 0;
+	zp->z_seq++;
+
+	err = sa_bulk_update(zp->z_sa_hdl, bulk, cnt, tx);
+
+	for (i = 0; i < count; i++) {
+		struct page *pp = pl[i];
+		loff_t pgoff = page_offset(pp);
+
+		zfs_log_write(zfsvfs->z_log, tx, TX_WRITE, zp, pgoff,
+		    MIN(PAGE_SIZE, isize - pgoff), 0,
+		    zfs_putpage_commit_cb, pp);
+	}
+	dmu_tx_commit(tx);
+
+	rangelock_exit(lr);
+	zfs_putpages_rele(pl, count, wl, nwait, nr_pages);
+
+	if (wbc->sync_mode != WB_SYNC_NONE)
+		zil_commit(zfsvfs->z_log, zp->z_id);
+
+	ZFS_EXIT(zfsvfs);
+	return (err);
+}
+
 /*
  * Update the system attributes when the inode has been dirtied.  For the
  * moment we only update the mode, atime, mtime, and ctime.
@@ -4745,6 +4998,88 @@ zfs_seek(struct inode *ip, offset_t ooff, offset_t *noffp)
 	return ((*noffp < 0 || *noffp > MAXOFFSET_T) ? EINVAL : 0);
 }
 
+/*
+ * Fills the pages of the whole block containing pp with a single read of
+ * the block, which does not retain it in the ARC unless it was already
+ * cached there.  The block's data is then only cached once, in the page
+ * cache, rather than in both the page cache and the ARC.  Reading the
+ * whole block avoids rereading it from disk for each of its other pages;
+ * those of them which are not already cached and can be added to the page
+ * cache without blocking are filled along with pp.
+ */
+static int
+zfs_fillpage_block(struct inode *ip, struct page *pp)
+{
+	znode_t *zp = ITOZ(ip);
+	zfsvfs_t *zfsvfs = ITOZSB(ip);
+	struct address_space *mp = ip->i_mapping;
+	uint64_t blksz = zp->z_blksz;
+	uint64_t start, end;
+	struct page **pl;
+	int npages, i, err;
+	char *buf;
+
+	start = P2ALIGN_TYPED(page_offset(pp), blksz, uint64_t);
+	end = MIN(start + blksz, P2ROUNDUP(i_size_read(ip), PAGESIZE));
+	if (end <= page_offset(pp))
+		end = page_offset(pp) + PAGESIZE;
+	npages = (end - start) >> PAGE_SHIFT;
+
+	/*
+	 * The pages are locked before the block is read, so a concurrent
+	 * write updating them through update_pages() waits until they are
+	 * filled, rather than the fill overwriting its update.
+	 */
+	pl = kmem_alloc(npages * sizeof (struct page *), KM_SLEEP);
+	for (i = 0; i < npages; i++) {
+		pgoff_t index = (start >> PAGE_SHIFT) + i;
+
+		if (index == pp->index) {
+			pl[i] = pp;
+			continue;
+		}
+		pl[i] = grab_cache_page_nowait(mp, index);
+		if (pl[i] != NULL && PageUptodate(pl[i])) {
+			unlock_page(pl[i]);
+			put_page(pl[i]);
+			pl[i] = NULL;
+		}
+	}
+
+	buf = vmem_alloc(end - start, KM_SLEEP);
+	err = dmu_read(zfsvfs->z_os, zp->z_id, start, end - start, buf,
+	    DMU_READ_NO_PREFETCH | DMU_DIRECTIO);
+	/* convert checksum errors into IO errors */
+	if (err == ECKSUM)
+		err = SET_ERROR(EIO);
+
+	for (i = 0; i < npages; i++) {
+		if (pl[i] == NULL)
+			continue;
+
+		if (err == 0) {
+			caddr_t va = kmap(pl[i]);
+			bcopy(buf + ((uint64_t)i << PAGE_SHIFT), va, PAGESIZE);
+			kunmap(pl[i]);
+		}
+
+		/* The caller completes pp itself */
+		if (pl[i] != pp) {
+			if (err == 0) {
+				SetPageUptodate(pl[i]);
+				flush_dcache_page(pl[i]);
+			}
+			unlock_page(pl[i]);
+			put_page(pl[i]);
+		}
+	}
+
+	vmem_free(buf, end - start);
+	kmem_free(pl, npages * sizeof (struct page *));
+
+	return (err);
+}
+
 /*
  * Fill pages with data from the disk.
  */
@@ -4761,6 +5096,10 @@ zfs_fillpage(struct inode *ip, struct page *pl[], int nr_pages)
 	unsigned page_idx;
 	int err;
 
+	if (zfs_mmap_uncached && nr_pages == 1 && zp->z_blksz > PAGESIZE &&
+	    ISP2(zp->z_blksz))
+		return (zfs_fillpage_block(ip, pl[0]));
+
 	os = zfsvfs->z_os;
 	io_len = nr_pages << PAGE_SHIFT;
 	i_size = i_size_read(ip);
@@ -5265,6 +5604,14 @@ module_param(zfs_delete_blocks, ulong, 0644);
 MODULE_PARM_DESC(zfs_delete_blocks, "Delete files larger than N blocks async");
 module_param(zfs_read_chunk_size, ulong, 0644);
 MODULE_PARM_DESC(zfs_read_chunk_size, "Bytes to read per chunk");
+
+module_param(zfs_dio_enabled, int, 0644);
+MODULE_PARM_DESC(zfs_dio_enabled,
+	"Bypass the ARC for block aligned O_DIRECT requests");
+
+module_param(zfs_mmap_uncached, int, 0644);
+MODULE_PARM_DESC(zfs_mmap_uncached,
+	"Cache pages read through mmap only in the page cache");
 /* END CSTYLED */
 
 #endif
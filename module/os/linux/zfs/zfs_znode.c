@@ -75,7 +75,7 @@
 
 static kmem_cache_t *znode_cache = NULL;
 static kmem_cache_t *znode_hold_cache = NULL;
-unsigned int zfs_object_mutex_size = ZFS_OBJ_MTX_SZ;
+unsigned int zfs_object_mutex_size = 0;
 
 /*
  * This is used by the test suite so that it can delay znodes from being
@@ -87,7 +87,7 @@ int zfs_unlink_suspend_progress = 0;
  * This callback is invoked when acquiring a RL_WRITER or RL_APPEND lock on
  * z_rangelock. It will modify the offset and length of the lock to reflect
  * znode-specific information, and convert RL_APPEND to RL_WRITER.  This is
- * called with the rangelock_t's rl_lock held, which avoids races.
+ * called with the rangelock_t's rls_lock held, which avoids races.
  */
 static void
 zfs_rangelock_cb(locked_range_t *new, void *arg)
@@ -321,6 +321,71 @@ zfs_znode_hold_exit(zfsvfs_t *zfsvfs, znode_hold_t *zh)
 		kmem_cache_free(znode_hold_cache, zh);
 }
 
+/*
+ * The size of the hold array of a new file system.
+ */
+uint64_t
+zfs_znode_hold_size(void)
+{
+	uint64_t size = zfs_object_mutex_size;
+
+	if (size == 0)
+		size = MAX(ZFS_OBJ_MTX_SZ, ZFS_OBJ_MTX_PER_CPU * boot_ncpus);
+
+	return (MIN(1ULL << (highbit64(size) - 1), ZFS_OBJ_MTX_MAX));
+}
+
+/*
+ * The znodes of a file system are spread by object over z_znodes_size
+ * lists, each with its own lock, since every inode brought into or evicted
+ * from the cache is added to or removed from one of them.  With a single
+ * list and lock scans of many files serialize on it however many threads
+ * run them.
+ */
+void
+zfs_znode_lists_create(zfsvfs_t *zfsvfs)
+{
+	uint64_t size = MAX(ZFS_ZNODES_PER_CPU * boot_ncpus, 1);
+
+	size = MIN(1ULL << (highbit64(size) - 1), ZFS_ZNODES_MAX);
+	zfsvfs->z_znodes_size = size;
+	zfsvfs->z_all_znodes = vmem_zalloc(sizeof (list_t) * size, KM_SLEEP);
+	zfsvfs->z_znodes_locks = vmem_zalloc(sizeof (kmutex_t) * size,
+	    KM_SLEEP);
+	for (int i = 0; i != size; i++) {
+		list_create(&zfsvfs->z_all_znodes[i], sizeof (znode_t),
+		    offsetof(znode_t, z_link_node));
+		mutex_init(&zfsvfs->z_znodes_locks[i], NULL, MUTEX_DEFAULT,
+		    NULL);
+	}
+	zfsvfs->z_nr_znodes = 0;
+}
+
+void
+zfs_znode_lists_destroy(zfsvfs_t *zfsvfs)
+{
+	int size = zfsvfs->z_znodes_size;
+
+	for (int i = 0; i != size; i++) {
+		list_destroy(&zfsvfs->z_all_znodes[i]);
+		mutex_destroy(&zfsvfs->z_znodes_locks[i]);
+	}
+	vmem_free(zfsvfs->z_all_znodes, sizeof (list_t) * size);
+	vmem_free(zfsvfs->z_znodes_locks, sizeof (kmutex_t) * size);
+}
+
+void
+zfs_znode_list_insert(zfsvfs_t *zfsvfs, znode_t *zp)
+{
+	int i = ZFS_ZNODES_HASH(zfsvfs, zp->z_id);
+
+	mutex_enter(&zfsvfs->z_znodes_locks[i]);
+	list_insert_tail(&zfsvfs->z_all_znodes[i], zp);
+	atomic_inc_64(&zfsvfs->z_nr_znodes);
+	membar_producer();
+	mutex_exit(&zfsvfs->z_znodes_locks[i]);
+}
+
 static void
 zfs_znode_sa_init(zfsvfs_t *zfsvfs, znode_t *zp,
     dmu_buf_t *db, dmu_object_type_t obj_type, sa_handle_t *sa_hdl)
@@ -377,12 +442,14 @@ zfs_inode_destroy(struct inode *ip)
 	znode_t *zp = ITOZ(ip);
 	zfsvfs_t *zfsvfs = ZTOZSB(zp);
 
-	mutex_enter(&zfsvfs->z_znodes_lock);
 	if (list_link_active(&zp->z_link_node)) {
-		list_remove(&zfsvfs->z_all_znodes, zp);
-		zfsvfs->z_nr_znodes--;
+		int i = ZFS_ZNODES_HASH(zfsvfs, zp->z_id);
+
+		mutex_enter(&zfsvfs->z_znodes_locks[i]);
+		list_remove(&zfsvfs->z_all_znodes[i], zp);
+		atomic_dec_64(&zfsvfs->z_nr_znodes);
+		mutex_exit(&zfsvfs->z_znodes_locks[i]);
 	}
-	mutex_exit(&zfsvfs->z_znodes_lock);
 
 	if (zp->z_acl_cached) {
 		zfs_acl_free(zp->z_acl_cached);
@@ -610,11 +677,7 @@ zfs_znode_alloc(zfsvfs_t *zfsvfs, dmu_buf_t *db, int blksz,
 	 */
 	VERIFY3S(insert_inode_locked(ip), ==, 0);
 
-	mutex_enter(&zfsvfs->z_znodes_lock);
-	list_insert_tail(&zfsvfs->z_all_znodes, zp);
-	zfsvfs->z_nr_znodes++;
-	membar_producer();
-	mutex_exit(&zfsvfs->z_znodes_lock);
+	zfs_znode_list_insert(zfsvfs, zp);
 
 	unlock_new_inode(ip);
 	return (zp);
@@ -1914,11 +1977,9 @@ zfs_create_fs(objset_t *os, cred_t *cr, nvlist_t *zplprops, dmu_tx_t *tx)
 	if (sense == ZFS_CASE_INSENSITIVE || sense == ZFS_CASE_MIXED)
 		zfsvfs->z_norm |= U8_TEXTPREP_TOUPPER;
 
-	mutex_init(&zfsvfs->z_znodes_lock, NULL, MUTEX_DEFAULT, NULL);
-	list_create(&zfsvfs->z_all_znodes, sizeof (znode_t),
-	    offsetof(znode_t, z_link_node));
+	zfs_znode_lists_create(zfsvfs);
 
-	size = MIN(1 << (highbit64(zfs_object_mutex_size)-1), ZFS_OBJ_MTX_MAX);
+	size = zfs_znode_hold_size();
 	zfsvfs->z_hold_size = size;
 	zfsvfs->z_hold_trees = vmem_zalloc(sizeof (avl_tree_t) * size,
 	    KM_SLEEP);
@@ -1946,7 +2007,7 @@ zfs_create_fs(objset_t *os, cred_t *cr, nvlist_t *zplprops, dmu_tx_t *tx)
 		mutex_destroy(&zfsvfs->z_hold_locks[i]);
 	}
 
-	mutex_destroy(&zfsvfs->z_znodes_lock);
+	zfs_znode_lists_destroy(zfsvfs);
 
 	vmem_free(zfsvfs->z_hold_trees, sizeof (avl_tree_t) * size);
 	vmem_free(zfsvfs->z_hold_locks, sizeof (kmutex_t) * size);
@@ -2226,7 +2287,8 @@ EXPORT_SYMBOL(zfs_obj_to_path);
 
 /* CSTYLED */
 module_param(zfs_object_mutex_size, uint, 0644);
-MODULE_PARM_DESC(zfs_object_mutex_size, "Size of znode hold array");
+MODULE_PARM_DESC(zfs_object_mutex_size,
+	"Size of znode hold array, 0 to scale it with the CPUs");
 module_param(zfs_unlink_suspend_progress, int, 0644);
 MODULE_PARM_DESC(zfs_unlink_suspend_progress, "Set to prevent async unlinks "
 "(debug - leaks space into the unlinked set)");
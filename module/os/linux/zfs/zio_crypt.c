@@ -192,7 +192,7 @@ unsigned long zfs_key_max_salt_uses = ZFS_KEY_MAX_SALT_USES_DEFAULT;
 
 typedef struct blkptr_auth_buf {
 	uint64_t bab_prop;			/* blk_prop - portable mask */
-	uint8_t bab_mac[ZIO_DATA_MAC_LEN];	/* MAC from blk_cksum */
+	uint8_t bab_mac[ZIO_DATA_MAC_LEN];	/* MAC from blk_cksum */
 	uint64_t bab_pad;			/* reserved for future use */
 } blkptr_auth_buf_t;
 
@@ -208,6 +208,59 @@ zio_crypt_info_t zio_crypt_table[ZIO_CRYPT_FUNCTIONS] = {
 	{SUN_CKM_AES_GCM,	ZC_TYPE_GCM,	32,	"aes-256-gcm"}
 };
 
+/*
+ * Blocks written before the last salt rotation, or received from another
+ * pool, are encrypted with keys derived from other salts.  Deriving such
+ * a key takes an HKDF and leaves the ICP without a context template, which
+ * costs more than the AES work itself on small blocks.  Since the blocks
+ * sharing a salt tend to be read together, keep the last few derived keys
+ * around together with their templates.  The cache needs no invalidation
+ * because a derived key only depends on the master key, which never
+ * changes for a loaded key (zfs change-key only rewraps it).
+ *
+ * Both functions must be called with zk_salt_lock held.
+ */
+static zio_crypt_salt_key_t *
+zio_crypt_salt_key_lookup(zio_crypt_key_t *key, uint8_t *salt)
+{
+	for (int i = 0; i < ZIO_CRYPT_SALT_KEYS; i++) {
+		zio_crypt_salt_key_t *zsk = &key->zk_salt_keys[i];
+
+		if (zsk->zsk_key.ck_data != NULL &&
+		    bcmp(salt, zsk->zsk_salt, ZIO_DATA_SALT_LEN) == 0)
+			return (zsk);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Remember the key derived from the given salt, replacing the oldest entry.
+ * The template, which may be NULL, is handed over to the cache.
+ */
+static zio_crypt_salt_key_t *
+zio_crypt_salt_key_insert(zio_crypt_key_t *key, uint8_t *salt,
+    uint8_t *keydata, crypto_ctx_template_t tmpl)
+{
+	uint_t keydata_len = zio_crypt_table[key->zk_crypt].ci_keylen;
+	zio_crypt_salt_key_t *zsk = &key->zk_salt_keys[key->zk_salt_keys_next];
+
+	ASSERT(RW_WRITE_HELD(&key->zk_salt_lock));
+
+	key->zk_salt_keys_next =
+	    (key->zk_salt_keys_next + 1) % ZIO_CRYPT_SALT_KEYS;
+
+	crypto_destroy_ctx_template(zsk->zsk_tmpl);
+	bcopy(salt, zsk->zsk_salt, ZIO_DATA_SALT_LEN);
+	bcopy(keydata, zsk->zsk_keydata, keydata_len);
+	zsk->zsk_key.ck_format = CRYPTO_KEY_RAW;
+	zsk->zsk_key.ck_data = zsk->zsk_keydata;
+	zsk->zsk_key.ck_length = CRYPTO_BYTES2BITS(keydata_len);
+	zsk->zsk_tmpl = tmpl;
+
+	return (zsk);
+}
+
 void
 zio_crypt_key_destroy(zio_crypt_key_t *key)
 {
@@ -216,6 +269,8 @@ zio_crypt_key_destroy(zio_crypt_key_t *key)
 	/* free crypto templates */
 	crypto_destroy_ctx_template(key->zk_current_tmpl);
 	crypto_destroy_ctx_template(key->zk_hmac_tmpl);
+	for (int i = 0; i < ZIO_CRYPT_SALT_KEYS; i++)
+		crypto_destroy_ctx_template(key->zk_salt_keys[i].zsk_tmpl);
 
 	/* zero out sensitive data */
 	bzero(key, sizeof (zio_crypt_key_t));
@@ -314,6 +369,14 @@ zio_crypt_key_change_salt(zio_crypt_key_t *key)
 	if (key->zk_salt_count < ZFS_CURRENT_MAX_SALT_USES)
 		goto out_unlock;
 
+	/*
+	 * The blocks just written with the outgoing salt are the likeliest
+	 * to be read back soon, so keep its key and template around.
+	 */
+	(void) zio_crypt_salt_key_insert(key, key->zk_salt,
+	    key->zk_current_keydata, key->zk_current_tmpl);
+	key->zk_current_tmpl = NULL;
+
 	/* derive the current key from the master key and the new salt */
 	ret = hkdf_sha512(key->zk_master_keydata, keydata_len, NULL, 0,
 	    salt, ZIO_DATA_SALT_LEN, key->zk_current_keydata, keydata_len);
@@ -324,8 +387,9 @@ zio_crypt_key_change_salt(zio_crypt_key_t *key)
 	bcopy(salt, key->zk_salt, ZIO_DATA_SALT_LEN);
 	key->zk_salt_count = 0;
 
-	/* destroy the old context template and create the new one */
-	crypto_destroy_ctx_template(key->zk_current_tmpl);
+	/* create the context template for the new key */
+	mech.cm_type =
+	    crypto_mech2id(zio_crypt_table[key->zk_crypt].ci_mechname);
 	ret = crypto_create_ctx_template(&mech, &key->zk_current_key,
 	    &key->zk_current_tmpl, KM_SLEEP);
 	if (ret != CRYPTO_SUCCESS)
@@ -1877,11 +1941,14 @@ zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
 	uint8_t enc_keydata[MASTER_KEY_MAX_LEN];
 	crypto_key_t tmp_ckey, *ckey = NULL;
 	crypto_ctx_template_t tmpl;
+	crypto_mechanism_t mech;
+	zio_crypt_salt_key_t *zsk;
 	uint8_t *authbuf = NULL;
 
 	/*
-	 * If the needed key is the current one, just use it. Otherwise we
-	 * need to generate a temporary one from the given salt + master key.
+	 * If the needed key is the current one or a cached one, just use
+	 * it. Otherwise we need to generate a temporary one from the given
+	 * salt + master key, and try to cache it for the next block.
 	 * If we are encrypting, we must return a copy of the current salt
 	 * so that it can be stored in the blkptr_t.
 	 */
@@ -1891,6 +1958,9 @@ zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
 	if (bcmp(salt, key->zk_salt, ZIO_DATA_SALT_LEN) == 0) {
 		ckey = &key->zk_current_key;
 		tmpl = key->zk_current_tmpl;
+	} else if ((zsk = zio_crypt_salt_key_lookup(key, salt)) != NULL) {
+		ckey = &zsk->zsk_key;
+		tmpl = zsk->zsk_tmpl;
 	} else {
 		rw_exit(&key->zk_salt_lock);
 		locked = B_FALSE;
@@ -1906,6 +1976,29 @@ zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
 
 		ckey = &tmp_ckey;
 		tmpl = NULL;
+
+		/*
+		 * Caching is an optimization, so don't wait for the lock if
+		 * other threads are busy with the key.
+		 */
+		if (rw_tryenter(&key->zk_salt_lock, RW_WRITER)) {
+			zsk = zio_crypt_salt_key_lookup(key, salt);
+			if (zsk == NULL) {
+				mech.cm_type = crypto_mech2id(
+				    zio_crypt_table[crypt].ci_mechname);
+				if (crypto_create_ctx_template(&mech, &tmp_ckey,
+				    &tmpl, KM_SLEEP) != CRYPTO_SUCCESS)
+					tmpl = NULL;
+				zsk = zio_crypt_salt_key_insert(key, salt,
+				    enc_keydata, tmpl);
+			}
+			rw_downgrade(&key->zk_salt_lock);
+			locked = B_TRUE;
+
+			bzero(enc_keydata, keydata_len);
+			ckey = &zsk->zsk_key;
+			tmpl = zsk->zsk_tmpl;
+		}
 	}
 #ifdef __linux__
 	/*
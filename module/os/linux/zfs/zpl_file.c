@@ -283,14 +283,33 @@ zpl_read_common(struct inode *ip, const char *buf, size_t len, loff_t *ppos,
 	    flags, cr, 0));
 }
 
+/*
+ * If relatime is enabled, call file_accessed() only if
+ * zfs_relatime_need_update() is true.  This is needed since datasets
+ * with inherited "relatime" property aren't necessarily mounted with
+ * MNT_RELATIME flag (e.g. after `zfs set relatime=...`), which is what
+ * relatime test in VFS by relatime_need_update() is based on.
+ */
+static void
+zpl_file_accessed(struct file *filp)
+{
+	struct inode *ip = filp->f_mapping->host;
+	zfsvfs_t *zfsvfs = ZTOZSB(ITOZ(ip));
+
+	if (!IS_NOATIME(ip) && zfsvfs->z_relatime) {
+		if (zfs_relatime_need_update(ip))
+			file_accessed(filp);
+	} else {
+		file_accessed(filp);
+	}
+}
+
 static ssize_t
 zpl_iter_read_common(struct kiocb *kiocb, const struct iovec *iovp,
     unsigned long nr_segs, size_t count, uio_seg_t seg, size_t skip)
 {
 	cred_t *cr = CRED();
 	struct file *filp = kiocb->ki_filp;
-	struct inode *ip = filp->f_mapping->host;
-	zfsvfs_t *zfsvfs = ZTOZSB(ITOZ(ip));
 	ssize_t read;
 	unsigned int f_flags = filp->f_flags;
 
@@ -300,29 +319,64 @@ zpl_iter_read_common(struct kiocb *kiocb, const struct iovec *iovp,
 	    nr_segs, &kiocb->ki_pos, seg, f_flags, cr, skip);
 	crfree(cr);
 
-	/*
-	 * If relatime is enabled, call file_accessed() only if
-	 * zfs_relatime_need_update() is true.  This is needed since datasets
-	 * with inherited "relatime" property aren't necessarily mounted with
-	 * MNT_RELATIME flag (e.g. after `zfs set relatime=...`), which is what
-	 * relatime test in VFS by relatime_need_update() is based on.
-	 */
-	if (!IS_NOATIME(ip) && zfsvfs->z_relatime) {
-		if (zfs_relatime_need_update(ip))
-			file_accessed(filp);
-	} else {
-		file_accessed(filp);
-	}
+	zpl_file_accessed(filp);
 
 	return (read);
 }
 
+#if defined(HAVE_VFS_IOV_ITER)
+/*
+ * Read directly into a pipe for splice(2) and sendfile(2).  The pipe
+ * pages cannot be described by an iovec, so the iov_iter is handed down
+ * to uiomove() which copies the ARC buffers straight into the pipe with
+ * copy_to_iter().  This avoids the bounce through a separately allocated
+ * kernel buffer, and allows nfsd to splice its replies from ZFS files.
+ */
+static ssize_t
+zpl_iter_read_pipe(struct kiocb *kiocb, struct iov_iter *to)
+{
+	cred_t *cr = CRED();
+	struct file *filp = kiocb->ki_filp;
+	uio_t uio = { { 0 }, 0 };
+	size_t count = iov_iter_count(to);
+	fstrans_cookie_t cookie;
+	int error;
+
+	uio.uio_iter = to;
+	uio.uio_iovcnt = 1;
+	uio.uio_loffset = kiocb->ki_pos;
+	uio.uio_segflg = UIO_ITER;
+	uio.uio_limit = MAXOFFSET_T;
+	uio.uio_resid = count;
+
+	crhold(cr);
+	cookie = spl_fstrans_mark();
+	error = -zfs_read(filp->f_mapping->host, &uio,
+	    filp->f_flags | zfs_io_flags(kiocb), cr);
+	spl_fstrans_unmark(cookie);
+	crfree(cr);
+
+	/* Data already copied into the pipe is returned as a short read. */
+	if (error < 0 && uio.uio_resid == count)
+		return (error);
+
+	kiocb->ki_pos += count - uio.uio_resid;
+	zpl_file_accessed(filp);
+
+	return (count - uio.uio_resid);
+}
+#endif /* HAVE_VFS_IOV_ITER */
+
 #if defined(HAVE_VFS_RW_ITERATE)
 static ssize_t
 zpl_iter_read(struct kiocb *kiocb, struct iov_iter *to)
 {
 	ssize_t ret;
 	uio_seg_t seg = UIO_USERSPACE;
+#if defined(HAVE_VFS_IOV_ITER)
+	if (iov_iter_type(to) == ITER_PIPE)
+		return (zpl_iter_read_pipe(kiocb, to));
+#endif
 	if (to->type & ITER_KVEC)
 		seg = UIO_SYSSPACE;
 	if (to->type & ITER_BVEC)
@@ -695,6 +749,98 @@ zpl_putpage(struct page *pp, struct writeback_control *wbc, void *data)
 	return (0);
 }
 
+/*
+ * Contiguous dirty pages collected by zpl_putpage_batch(), to be pushed
+ * out together by zfs_putpages().
+ */
+#define	ZPL_PUTPAGE_BATCH	256
+
+typedef struct zpl_putpage_batch {
+	struct inode	*zpb_ip;
+	int		zpb_count;
+	struct page	*zpb_pages[ZPL_PUTPAGE_BATCH];
+} zpl_putpage_batch_t;
+
+static void
+zpl_putpage_batch_flush(zpl_putpage_batch_t *zpb,
+    struct writeback_control *wbc)
+{
+	fstrans_cookie_t cookie;
+
+	if (zpb->zpb_count == 0)
+		return;
+
+	cookie = spl_fstrans_mark();
+	(void) zfs_putpages(zpb->zpb_ip, zpb->zpb_pages, zpb->zpb_count, wbc);
+	spl_fstrans_unmark(cookie);
+
+	zpb->zpb_count = 0;
+}
+
+/*
+ * Adds a page to the batch, first pushing out the batch when the page does
+ * not directly follow its last page or it is full.  As in zfs_putpage()
+ * the page is redirtied and unlocked, so that zfs_putpages() can take the
+ * range lock before the page locks.
+ */
+static int
+zpl_putpage_batch(struct page *pp, struct writeback_control *wbc, void *data)
+{
+	zpl_putpage_batch_t *zpb = data;
+
+	ASSERT(PageLocked(pp));
+	ASSERT(!PageWriteback(pp));
+
+	if (page_offset(pp) >= i_size_read(zpb->zpb_ip)) {
+		unlock_page(pp);
+		return (0);
+	}
+
+	if (zpb->zpb_count == ZPL_PUTPAGE_BATCH || (zpb->zpb_count > 0 &&
+	    zpb->zpb_pages[zpb->zpb_count - 1]->index + 1 != pp->index)) {
+		/* Pushing out the batch may block on the page locks */
+		redirty_page_for_writepage(wbc, pp);
+		unlock_page(pp);
+		zpl_putpage_batch_flush(zpb, wbc);
+		lock_page(pp);
+		if (pp->mapping != zpb->zpb_ip->i_mapping ||
+		    PageWriteback(pp) || !clear_page_dirty_for_io(pp)) {
+			unlock_page(pp);
+			return (0);
+		}
+		wbc->pages_skipped--;
+	}
+
+	redirty_page_for_writepage(wbc, pp);
+	get_page(pp);
+	unlock_page(pp);
+	zpb->zpb_pages[zpb->zpb_count++] = pp;
+
+	return (0);
+}
+
+/*
+ * Runs write_cache_pages() over the mapping, pushing out the contiguous
+ * dirty pages it finds in batches.
+ */
+static int
+zpl_write_cache_pages(struct address_space *mapping,
+    struct writeback_control *wbc)
+{
+	zpl_putpage_batch_t *zpb;
+	int result;
+
+	zpb = kmem_alloc(sizeof (zpl_putpage_batch_t), KM_SLEEP);
+	zpb->zpb_ip = mapping->host;
+	zpb->zpb_count = 0;
+
+	result = write_cache_pages(mapping, wbc, zpl_putpage_batch, zpb);
+	zpl_putpage_batch_flush(zpb, wbc);
+
+	kmem_free(zpb, sizeof (zpl_putpage_batch_t));
+	return (result);
+}
+
 static int
 zpl_writepages(struct address_space *mapping, struct writeback_control *wbc)
 {
@@ -717,7 +863,7 @@ zpl_writepages(struct address_space *mapping, struct writeback_control *wbc)
 	 * and then we commit it all in one go.
 	 */
 	wbc->sync_mode = WB_SYNC_NONE;
-	result = write_cache_pages(mapping, wbc, zpl_putpage, mapping);
+	result = zpl_write_cache_pages(mapping, wbc);
 	if (sync_mode != wbc->sync_mode) {
 		ZFS_ENTER(zfsvfs);
 		ZFS_VERIFY_ZP(zp);
@@ -733,7 +879,7 @@ zpl_writepages(struct address_space *mapping, struct writeback_control *wbc)
 		 * details). That being said, this is a no-op in most cases.
 		 */
 		wbc->sync_mode = sync_mode;
-		result = write_cache_pages(mapping, wbc, zpl_putpage, mapping);
+		result = zpl_write_cache_pages(mapping, wbc);
 	}
 	return (result);
 }
@@ -814,6 +960,73 @@ zpl_fallocate(struct file *filp, int mode, loff_t offset, loff_t len)
 }
 #endif /* HAVE_FILE_FALLOCATE */
 
+#ifdef HAVE_VFS_COPY_FILE_RANGE
+/*
+ * Copy a range between two files of the same pool within the kernel, one
+ * record of the destination at a time.  The data is still read and written
+ * again, since blocks cannot be shared between files, but it is not passed
+ * through the pipe of the generic splice based copy.  Copies to another
+ * pool are left to the generic copy by failing with EXDEV.
+ */
+static ssize_t
+zpl_copy_file_range(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, size_t len, unsigned int flags)
+{
+	struct inode *src_ip = file_inode(src_file);
+	struct inode *dst_ip = file_inode(dst_file);
+	cred_t *cr = CRED();
+	ssize_t copied = 0, error = 0;
+	size_t blksz, bufsize;
+	char *buf;
+
+	if (flags != 0)
+		return (-EINVAL);
+
+	if (dmu_objset_spa(ITOZSB(src_ip)->z_os) !=
+	    dmu_objset_spa(ITOZSB(dst_ip)->z_os))
+		return (-EXDEV);
+
+	blksz = ITOZSB(dst_ip)->z_max_blksz;
+	bufsize = MIN(len, blksz);
+	if (bufsize == 0)
+		return (0);
+
+	buf = vmem_alloc(bufsize, KM_SLEEP);
+	crhold(cr);
+	while (len > 0) {
+		size_t n = MIN(MIN(len, bufsize),
+		    blksz - P2PHASE(dst_off, blksz));
+		ssize_t nread, nwritten;
+
+		nread = zpl_read_common(src_ip, buf, n, &src_off,
+		    UIO_SYSSPACE, src_file->f_flags, cr);
+		if (nread <= 0) {
+			error = nread;
+			break;
+		}
+
+		nwritten = zpl_write_common(dst_ip, buf, nread, &dst_off,
+		    UIO_SYSSPACE, dst_file->f_flags & ~O_APPEND, cr);
+		if (nwritten < 0) {
+			error = nwritten;
+			break;
+		}
+
+		copied += nwritten;
+		len -= nwritten;
+		if (nwritten < nread || fatal_signal_pending(current))
+			break;
+	}
+	crfree(cr);
+	vmem_free(buf, bufsize);
+
+	if (copied > 0)
+		zpl_file_accessed(src_file);
+
+	return (copied > 0 ? copied : error);
+}
+#endif /* HAVE_VFS_COPY_FILE_RANGE */
+
 #define	ZFS_FL_USER_VISIBLE	(FS_FL_USER_VISIBLE | ZFS_PROJINHERIT_FL)
 #define	ZFS_FL_USER_MODIFIABLE	(FS_FL_USER_MODIFIABLE | ZFS_PROJINHERIT_FL)
 
@@ -1037,6 +1250,10 @@ const struct file_operations zpl_file_operations = {
 #endif
 	.read_iter	= zpl_iter_read,
 	.write_iter	= zpl_iter_write,
+#ifdef HAVE_VFS_IOV_ITER
+	.splice_read	= generic_file_splice_read,
+	.splice_write	= iter_file_splice_write,
+#endif
 #else
 	.read		= do_sync_read,
 	.write		= do_sync_write,
@@ -1051,6 +1268,9 @@ const struct file_operations zpl_file_operations = {
 #ifdef HAVE_FILE_FALLOCATE
 	.fallocate	= zpl_fallocate,
 #endif /* HAVE_FILE_FALLOCATE */
+#ifdef HAVE_VFS_COPY_FILE_RANGE
+	.copy_file_range = zpl_copy_file_range,
+#endif
 	.unlocked_ioctl	= zpl_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= zpl_compat_ioctl,
@@ -182,6 +182,30 @@ zpl_xattr_readdir(struct inode *dxip, xattr_filldir_t *xf)
 	return (error);
 }
 
+/*
+ * Returns B_FALSE when the inode is known to have no xattr directory.  With
+ * xattr=sa most files never get one, yet every get or list of a name missing
+ * from the SA would otherwise pay for a full LOOKUP_XATTR zfs_lookup() just
+ * to be told ENOENT.  Reading the SA_ZPL_XATTR object number is enough to
+ * answer that from the cached znode.
+ */
+static boolean_t
+zpl_xattr_dir_exists(struct inode *ip)
+{
+	znode_t *zp = ITOZ(ip);
+	uint64_t xattr_obj = 0;
+
+	/* Let zfs_lookup() reject recursive attributes as before */
+	if (zp->z_pflags & ZFS_XATTR)
+		return (B_TRUE);
+
+	if (sa_lookup(zp->z_sa_hdl, SA_ZPL_XATTR(ZTOZSB(zp)), &xattr_obj,
+	    sizeof (xattr_obj)) != 0)
+		return (B_TRUE);
+
+	return (xattr_obj != 0);
+}
+
 static ssize_t
 zpl_xattr_list_dir(xattr_filldir_t *xf, cred_t *cr)
 {
@@ -189,6 +213,9 @@ zpl_xattr_list_dir(xattr_filldir_t *xf, cred_t *cr)
 	struct inode *dxip = NULL;
 	int error;
 
+	if (!zpl_xattr_dir_exists(ip))
+		return (0);
+
 	/* Lookup the xattr directory */
 	error = -zfs_lookup(ip, NULL, &dxip, LOOKUP_XATTR, cr, NULL, NULL);
 	if (error) {
@@ -279,6 +306,9 @@ zpl_xattr_get_dir(struct inode *ip, const char *name, void *value,
 	loff_t pos = 0;
 	int error;
 
+	if (!zpl_xattr_dir_exists(ip))
+		return (-ENOENT);
+
 	/* Lookup the xattr directory */
 	error = -zfs_lookup(ip, NULL, &dxip, LOOKUP_XATTR, cr, NULL, NULL);
 	if (error)
@@ -91,16 +91,37 @@
 
 #include <linux/blkdev_compat.h>
 #include <linux/task_io_accounting_ops.h>
+#ifdef HAVE_BLK_MQ
+#include <linux/blk-mq.h>
+#endif
 
 unsigned int zvol_inhibit_dev = 0;
 unsigned int zvol_major = ZVOL_MAJOR;
 unsigned int zvol_threads = 32;
+unsigned int zvol_num_taskqs = 0;
 unsigned int zvol_request_sync = 0;
+unsigned int zvol_discard_async = 1;
 unsigned int zvol_prefetch_bytes = (128 * 1024);
 unsigned long zvol_max_discard_blocks = 16384;
 unsigned int zvol_volmode = ZFS_VOLMODE_GEOM;
+#ifdef HAVE_BLK_MQ
+unsigned int zvol_use_blk_mq = 0;
+unsigned int zvol_blk_mq_queue_depth = 128;
+unsigned int zvol_blk_mq_inline_reads = 0;
+#endif
 
-static taskq_t *zvol_taskq;
+/*
+ * Requests are spread over several taskqs, rather than all of them being
+ * funneled through a single one, to keep the dispatch lock of any one of
+ * them from being shared by every CPU submitting zvol I/O.  The bio path
+ * picks the taskq of the submitting CPU, the blk-mq path that of the
+ * hardware queue, of which there is one per taskq.
+ */
+static taskq_t **zvol_taskqs;
+static uint_t zvol_taskq_count;
+
+/* Taskq freeing the ranges of discards acknowledged by zvol_discard() */
+static taskq_t *zvol_free_taskq;
 static krwlock_t zvol_state_lock;
 static list_t zvol_state_list;
 
@@ -127,6 +148,10 @@ struct zvol_state {
 	dev_t			zv_dev;		/* device id */
 	struct gendisk		*zv_disk;	/* generic disk */
 	struct request_queue	*zv_queue;	/* request queue */
+#ifdef HAVE_BLK_MQ
+	boolean_t		zv_blk_mq;	/* queue is blk-mq */
+	struct blk_mq_tag_set	zv_tag_set;	/* blk-mq tag set */
+#endif
 	dataset_kstats_t	zv_kstat;	/* zvol kstats */
 	list_node_t		zv_next;	/* next zvol_state_t linkage */
 	uint64_t		zv_hash;	/* name hash */
@@ -134,6 +159,8 @@ struct zvol_state {
 	kmutex_t		zv_state_lock;	/* protects zvol_state_t */
 	atomic_t		zv_suspend_ref;	/* refcount for suspend */
 	krwlock_t		zv_suspend_lock;	/* suspend lock */
+	uint64_t		zv_frees_pending; /* deferred discards */
+	kcondvar_t		zv_frees_cv;	/* frees pending drained */
 };
 
 typedef enum {
@@ -717,12 +744,115 @@ zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, uint64_t offset,
 	}
 }
 
+/*
+ * A request is either a single bio, submitted through zvol_request(), or a
+ * blk-mq request made up of one or more merged bios, submitted through
+ * zvol_queue_rq().  In the latter case zv_request_t is the per request
+ * driver data of the blk-mq request and is not allocated separately.
+ */
 typedef struct zv_request {
 	zvol_state_t	*zv;
 	struct bio	*bio;
+#ifdef HAVE_BLK_MQ
+	struct request	*rq;
+#endif
 	locked_range_t	*lr;
 } zv_request_t;
 
+static inline uint64_t
+zvr_offset(zv_request_t *zvr)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL)
+		return (blk_rq_pos(zvr->rq) << 9);
+#endif
+	return (BIO_BI_SECTOR(zvr->bio) << 9);
+}
+
+static inline uint64_t
+zvr_size(zv_request_t *zvr)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL)
+		return (blk_rq_bytes(zvr->rq));
+#endif
+	return (BIO_BI_SIZE(zvr->bio));
+}
+
+static inline boolean_t
+zvr_is_fua(zv_request_t *zvr)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL)
+		return ((zvr->rq->cmd_flags & REQ_FUA) != 0);
+#endif
+	return (bio_is_fua(zvr->bio));
+}
+
+static inline boolean_t
+zvr_is_secure_erase(zv_request_t *zvr)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL)
+		return (req_op(zvr->rq) == REQ_OP_SECURE_ERASE);
+#endif
+	return (bio_is_secure_erase(zvr->bio));
+}
+
+/*
+ * Returns the bio following bio in the request, or NULL.
+ */
+static inline struct bio *
+zvr_next_bio(zv_request_t *zvr, struct bio *bio)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL)
+		return (bio->bi_next);
+#endif
+	return (NULL);
+}
+
+/*
+ * The block layer accounts for blk-mq requests itself.
+ */
+static inline void
+zvr_start_io_acct(zv_request_t *zvr, int rw)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL)
+		return;
+#endif
+	blk_generic_start_io_acct(zvr->zv->zv_queue, rw,
+	    bio_sectors(zvr->bio), &zvr->zv->zv_disk->part0);
+}
+
+static inline void
+zvr_end_io_acct(zv_request_t *zvr, int rw, unsigned long start_jif)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL)
+		return;
+#endif
+	blk_generic_end_io_acct(zvr->zv->zv_queue, rw,
+	    &zvr->zv->zv_disk->part0, start_jif);
+}
+
+/*
+ * Completes the request with the given error and releases zvr.
+ */
+static void
+zvol_request_done(zv_request_t *zvr, int error)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL) {
+		blk_mq_end_request(zvr->rq, errno_to_blk_status(-error));
+		return;
+	}
+#endif
+	BIO_END_IO(zvr->bio, -error);
+	kmem_free(zvr, sizeof (zv_request_t));
+}
+
 static void
 uio_from_bio(uio_t *uio, struct bio *bio)
 {
@@ -741,32 +871,37 @@ zvol_write(void *arg)
 	int error = 0;
 
 	zv_request_t *zvr = arg;
-	struct bio *bio = zvr->bio;
+	struct bio *bio;
 	uio_t uio = { { 0 }, 0 };
-	uio_from_bio(&uio, bio);
 
 	zvol_state_t *zv = zvr->zv;
 	ASSERT(zv && zv->zv_open_count > 0);
 	ASSERT(zv->zv_zilog != NULL);
 
-	ssize_t start_resid = uio.uio_resid;
+	int64_t nwritten = 0;
 	unsigned long start_jif = jiffies;
-	blk_generic_start_io_acct(zv->zv_queue, WRITE, bio_sectors(bio),
-	    &zv->zv_disk->part0);
+	zvr_start_io_acct(zvr, WRITE);
 
 	boolean_t sync =
-	    bio_is_fua(bio) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
+	    zvr_is_fua(zvr) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
 
-	uint64_t volsize = zv->zv_volsize;
-	while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
-		uint64_t bytes = MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
-		uint64_t off = uio.uio_loffset;
-		dmu_tx_t *tx = dmu_tx_create(zv->zv_objset);
+	/*
+	 * The bios of a request are contiguous, so rather than assigning a
+	 * tx to each of them, as many as fit are written in one tx and
+	 * logged as a single range.  The dnode is already held, so the tx
+	 * hold is placed on it directly instead of looking it up again.
+	 */
+	uint64_t off = zvr_offset(zvr);
+	uint64_t end = MIN(off + zvr_size(zvr), zv->zv_volsize);
 
-		if (bytes > volsize - off)	/* don't write past the end */
-			bytes = volsize - off;
+	bio = zvr->bio;
+	uio_from_bio(&uio, bio);
+	while (off < end) {
+		uint64_t bytes = MIN(end - off, DMU_MAX_ACCESS >> 1);
+		uint64_t done = 0;
+		dmu_tx_t *tx = dmu_tx_create(zv->zv_objset);
 
-		dmu_tx_hold_write(tx, ZVOL_OBJ, off, bytes);
+		dmu_tx_hold_write_by_dnode(tx, zv->zv_dn, off, bytes);
 
 		/* This will only fail for ENOSPC */
 		error = dmu_tx_assign(tx, TXG_WAIT);
@@ -774,18 +909,31 @@ zvol_write(void *arg)
 			dmu_tx_abort(tx);
 			break;
 		}
-		error = dmu_write_uio_dnode(zv->zv_dn, &uio, bytes, tx);
-		if (error == 0) {
-			zvol_log_write(zv, tx, off, bytes, sync);
+		while (done < bytes) {
+			if (uio.uio_resid == 0) {
+				bio = zvr_next_bio(zvr, bio);
+				ASSERT3P(bio, !=, NULL);
+				uio_from_bio(&uio, bio);
+			}
+			ASSERT3U(uio.uio_loffset, ==, off + done);
+
+			uint64_t n = MIN(uio.uio_resid, bytes - done);
+			error = dmu_write_uio_dnode(zv->zv_dn, &uio, n, tx);
+			if (error)
+				break;
+			done += n;
 		}
+		if (done > 0)
+			zvol_log_write(zv, tx, off, done, sync);
 		dmu_tx_commit(tx);
 
+		off += done;
+		nwritten += done;
 		if (error)
 			break;
 	}
 	rangelock_exit(zvr->lr);
 
-	int64_t nwritten = start_resid - uio.uio_resid;
 	dataset_kstats_update_write_kstats(&zv->zv_kstat, nwritten);
 	task_io_account_write(nwritten);
 
@@ -793,10 +941,8 @@ zvol_write(void *arg)
 		zil_commit(zv->zv_zilog, ZVOL_OBJ);
 
 	rw_exit(&zv->zv_suspend_lock);
-	blk_generic_end_io_acct(zv->zv_queue, WRITE, &zv->zv_disk->part0,
-	    start_jif);
-	BIO_END_IO(bio, -error);
-	kmem_free(zvr, sizeof (zv_request_t));
+	zvr_end_io_acct(zvr, WRITE, start_jif);
+	zvol_request_done(zvr, error);
 }
 
 /*
@@ -823,16 +969,49 @@ zvol_log_truncate(zvol_state_t *zv, dmu_tx_t *tx, uint64_t off, uint64_t len,
 	zil_itx_assign(zilog, itx, tx);
 }
 
+typedef struct zv_free {
+	zvol_state_t	*zvf_zv;
+	locked_range_t	*zvf_lr;
+	uint64_t	zvf_off;
+	uint64_t	zvf_len;
+} zv_free_t;
+
+/*
+ * Frees the range of a discard which has already been acknowledged.  The
+ * range lock and zv_suspend_lock taken for the request are held until the
+ * range is freed, so that later writes to the range are ordered after the
+ * free and the zvol cannot be suspended or closed underneath it.  The free
+ * is advisory, as is the discard, so its error is not reported: the range
+ * then still reads back as its former contents.
+ */
+static void
+zvol_free_range(void *arg)
+{
+	zv_free_t *zvf = arg;
+	zvol_state_t *zv = zvf->zvf_zv;
+
+	(void) dmu_free_long_range(zv->zv_objset, ZVOL_OBJ, zvf->zvf_off,
+	    zvf->zvf_len);
+
+	rangelock_exit(zvf->zvf_lr);
+	rw_exit(&zv->zv_suspend_lock);
+	kmem_free(zvf, sizeof (zv_free_t));
+
+	mutex_enter(&zv->zv_state_lock);
+	if (--zv->zv_frees_pending == 0)
+		cv_broadcast(&zv->zv_frees_cv);
+	mutex_exit(&zv->zv_state_lock);
+}
+
 static void
 zvol_discard(void *arg)
 {
 	zv_request_t *zvr = arg;
-	struct bio *bio = zvr->bio;
 	zvol_state_t *zv = zvr->zv;
-	uint64_t start = BIO_BI_SECTOR(bio) << 9;
-	uint64_t size = BIO_BI_SIZE(bio);
+	uint64_t start = zvr_offset(zvr);
+	uint64_t size = zvr_size(zvr);
 	uint64_t end = start + size;
-	boolean_t sync;
+	boolean_t sync, deferred = B_FALSE;
 	int error = 0;
 	dmu_tx_t *tx;
 	unsigned long start_jif;
@@ -841,10 +1020,9 @@ zvol_discard(void *arg)
 	ASSERT(zv->zv_zilog != NULL);
 
 	start_jif = jiffies;
-	blk_generic_start_io_acct(zv->zv_queue, WRITE, bio_sectors(bio),
-	    &zv->zv_disk->part0);
+	zvr_start_io_acct(zvr, WRITE);
 
-	sync = bio_is_fua(bio) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
+	sync = zvr_is_fua(zvr) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
 
 	if (end > zv->zv_volsize) {
 		error = SET_ERROR(EIO);
@@ -857,7 +1035,7 @@ zvol_discard(void *arg)
 	 * the unaligned parts which is slow (read-modify-write) and useless
 	 * since we are not freeing any space by doing so.
 	 */
-	if (!bio_is_secure_erase(bio)) {
+	if (!zvr_is_secure_erase(zvr)) {
 		start = P2ROUNDUP(start, zv->zv_volblocksize);
 		end = P2ALIGN(end, zv->zv_volblocksize);
 		size = end - start;
@@ -871,6 +1049,30 @@ zvol_discard(void *arg)
 	error = dmu_tx_assign(tx, TXG_WAIT);
 	if (error != 0) {
 		dmu_tx_abort(tx);
+	} else if (zvol_discard_async && !zvr_is_secure_erase(zvr)) {
+		/*
+		 * Acknowledge the discard once it is logged, and leave the
+		 * free, which can take several txgs for a large range, to
+		 * zvol_free_taskq.  The range lock and zv_suspend_lock are
+		 * handed over to it.
+		 */
+		zv_free_t *zvf = kmem_alloc(sizeof (zv_free_t), KM_SLEEP);
+		zvf->zvf_zv = zv;
+		zvf->zvf_lr = zvr->lr;
+		zvf->zvf_off = start;
+		zvf->zvf_len = size;
+
+		zvol_log_truncate(zv, tx, start, size, B_TRUE);
+		dmu_tx_commit(tx);
+
+		mutex_enter(&zv->zv_state_lock);
+		zv->zv_frees_pending++;
+		mutex_exit(&zv->zv_state_lock);
+
+		deferred = B_TRUE;
+		if (taskq_dispatch(zvol_free_taskq, zvol_free_range, zvf,
+		    TQ_SLEEP) == TASKQID_INVALID)
+			zvol_free_range(zvf);
 	} else {
 		zvol_log_truncate(zv, tx, start, size, B_TRUE);
 		dmu_tx_commit(tx);
@@ -878,16 +1080,16 @@ zvol_discard(void *arg)
 		    ZVOL_OBJ, start, size);
 	}
 unlock:
-	rangelock_exit(zvr->lr);
+	if (!deferred)
+		rangelock_exit(zvr->lr);
 
 	if (error == 0 && sync)
 		zil_commit(zv->zv_zilog, ZVOL_OBJ);
 
-	rw_exit(&zv->zv_suspend_lock);
-	blk_generic_end_io_acct(zv->zv_queue, WRITE, &zv->zv_disk->part0,
-	    start_jif);
-	BIO_END_IO(bio, -error);
-	kmem_free(zvr, sizeof (zv_request_t));
+	if (!deferred)
+		rw_exit(&zv->zv_suspend_lock);
+	zvr_end_io_acct(zvr, WRITE, start_jif);
+	zvol_request_done(zvr, error);
 }
 
 static void
@@ -896,45 +1098,48 @@ zvol_read(void *arg)
 	int error = 0;
 
 	zv_request_t *zvr = arg;
-	struct bio *bio = zvr->bio;
+	struct bio *bio;
 	uio_t uio = { { 0 }, 0 };
-	uio_from_bio(&uio, bio);
 
 	zvol_state_t *zv = zvr->zv;
 	ASSERT(zv && zv->zv_open_count > 0);
 
-	ssize_t start_resid = uio.uio_resid;
+	int64_t nread = 0;
 	unsigned long start_jif = jiffies;
-	blk_generic_start_io_acct(zv->zv_queue, READ, bio_sectors(bio),
-	    &zv->zv_disk->part0);
+	zvr_start_io_acct(zvr, READ);
 
 	uint64_t volsize = zv->zv_volsize;
-	while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
-		uint64_t bytes = MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
-
-		/* don't read past the end */
-		if (bytes > volsize - uio.uio_loffset)
-			bytes = volsize - uio.uio_loffset;
-
-		error = dmu_read_uio_dnode(zv->zv_dn, &uio, bytes);
-		if (error) {
-			/* convert checksum errors into IO errors */
-			if (error == ECKSUM)
-				error = SET_ERROR(EIO);
-			break;
+	for (bio = zvr->bio; bio != NULL && error == 0;
+	    bio = zvr_next_bio(zvr, bio)) {
+		uio_from_bio(&uio, bio);
+		ssize_t start_resid = uio.uio_resid;
+
+		while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
+			uint64_t bytes =
+			    MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
+
+			/* don't read past the end */
+			if (bytes > volsize - uio.uio_loffset)
+				bytes = volsize - uio.uio_loffset;
+
+			error = dmu_read_uio_dnode(zv->zv_dn, &uio, bytes);
+			if (error) {
+				/* convert checksum errors into IO errors */
+				if (error == ECKSUM)
+					error = SET_ERROR(EIO);
+				break;
+			}
 		}
+		nread += start_resid - uio.uio_resid;
 	}
 	rangelock_exit(zvr->lr);
 
-	int64_t nread = start_resid - uio.uio_resid;
 	dataset_kstats_update_read_kstats(&zv->zv_kstat, nread);
 	task_io_account_read(nread);
 
 	rw_exit(&zv->zv_suspend_lock);
-	blk_generic_end_io_acct(zv->zv_queue, READ, &zv->zv_disk->part0,
-	    start_jif);
-	BIO_END_IO(bio, -error);
-	kmem_free(zvr, sizeof (zv_request_t));
+	zvr_end_io_acct(zvr, READ, start_jif);
+	zvol_request_done(zvr, error);
 }
 
 /* ARGSUSED */
@@ -1017,33 +1222,25 @@ zvol_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb, zio_t *zio)
 	return (SET_ERROR(error));
 }
 
-static MAKE_REQUEST_FN_RET
-zvol_request(struct request_queue *q, struct bio *bio)
+/*
+ * Queues or executes a request once it has been checked against the volume
+ * size.  The request is executed synchronously when so configured, when it
+ * cannot be dispatched to tq, or for reads when inline_read is set.
+ */
+static void
+zvol_submit(zv_request_t *zvr, taskq_t *tq, int rw, boolean_t flush,
+    boolean_t discard, boolean_t inline_read)
 {
-	zvol_state_t *zv = q->queuedata;
-	fstrans_cookie_t cookie = spl_fstrans_mark();
-	uint64_t offset = BIO_BI_SECTOR(bio) << 9;
-	uint64_t size = BIO_BI_SIZE(bio);
-	int rw = bio_data_dir(bio);
-	zv_request_t *zvr;
-
-	if (bio_has_data(bio) && offset + size > zv->zv_volsize) {
-		printk(KERN_INFO
-		    "%s: bad access: offset=%llu, size=%lu\n",
-		    zv->zv_disk->disk_name,
-		    (long long unsigned)offset,
-		    (long unsigned)size);
-
-		BIO_END_IO(bio, -SET_ERROR(EIO));
-		goto out;
-	}
+	zvol_state_t *zv = zvr->zv;
+	uint64_t offset = zvr_offset(zvr);
+	uint64_t size = zvr_size(zvr);
 
 	if (rw == WRITE) {
 		boolean_t need_sync = B_FALSE;
 
 		if (unlikely(zv->zv_flags & ZVOL_RDONLY)) {
-			BIO_END_IO(bio, -SET_ERROR(EROFS));
-			goto out;
+			zvol_request_done(zvr, SET_ERROR(EROFS));
+			return;
 		}
 
 		/*
@@ -1069,21 +1266,17 @@ zvol_request(struct request_queue *q, struct bio *bio)
 			rw_downgrade(&zv->zv_suspend_lock);
 		}
 
-		/* bio marked as FLUSH need to flush before write */
-		if (bio_is_flush(bio))
+		/* requests marked as FLUSH need to flush before write */
+		if (flush)
 			zil_commit(zv->zv_zilog, ZVOL_OBJ);
 
 		/* Some requests are just for flush and nothing else. */
 		if (size == 0) {
 			rw_exit(&zv->zv_suspend_lock);
-			BIO_END_IO(bio, 0);
-			goto out;
+			zvol_request_done(zvr, 0);
+			return;
 		}
 
-		zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
-		zvr->zv = zv;
-		zvr->bio = bio;
-
 		/*
 		 * To be released in the I/O function. Since the I/O functions
 		 * are asynchronous, we take it here synchronously to make
@@ -1096,18 +1289,18 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		 * to take a RL_READER lock on the whole block being modified
 		 * via its zillog->zl_get_data(): to avoid circular dependency
 		 * issues with taskq threads execute these requests
-		 * synchronously here in zvol_request().
+		 * synchronously here in zvol_submit().
 		 */
-		need_sync = bio_is_fua(bio) ||
+		need_sync = zvr_is_fua(zvr) ||
 		    zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
-		if (bio_is_discard(bio) || bio_is_secure_erase(bio)) {
+		if (discard) {
 			if (zvol_request_sync || need_sync ||
-			    taskq_dispatch(zvol_taskq, zvol_discard, zvr,
+			    taskq_dispatch(tq, zvol_discard, zvr,
 			    TQ_SLEEP) == TASKQID_INVALID)
 				zvol_discard(zvr);
 		} else {
 			if (zvol_request_sync || need_sync ||
-			    taskq_dispatch(zvol_taskq, zvol_write, zvr,
+			    taskq_dispatch(tq, zvol_write, zvr,
 			    TQ_SLEEP) == TASKQID_INVALID)
 				zvol_write(zvr);
 		}
@@ -1118,22 +1311,50 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		 * data and require no additional handling.
 		 */
 		if (size == 0) {
-			BIO_END_IO(bio, 0);
-			goto out;
+			zvol_request_done(zvr, 0);
+			return;
 		}
 
-		zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
-		zvr->zv = zv;
-		zvr->bio = bio;
-
 		rw_enter(&zv->zv_suspend_lock, RW_READER);
 
 		zvr->lr = rangelock_enter(&zv->zv_rangelock, offset, size,
 		    RL_READER);
-		if (zvol_request_sync || taskq_dispatch(zvol_taskq,
+		if (zvol_request_sync || inline_read || taskq_dispatch(tq,
 		    zvol_read, zvr, TQ_SLEEP) == TASKQID_INVALID)
 			zvol_read(zvr);
 	}
+}
+
+static MAKE_REQUEST_FN_RET
+zvol_request(struct request_queue *q, struct bio *bio)
+{
+	zvol_state_t *zv = q->queuedata;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+	uint64_t offset = BIO_BI_SECTOR(bio) << 9;
+	uint64_t size = BIO_BI_SIZE(bio);
+	zv_request_t *zvr;
+
+	if (bio_has_data(bio) && offset + size > zv->zv_volsize) {
+		printk(KERN_INFO
+		    "%s: bad access: offset=%llu, size=%lu\n",
+		    zv->zv_disk->disk_name,
+		    (long long unsigned)offset,
+		    (long unsigned)size);
+
+		BIO_END_IO(bio, -SET_ERROR(EIO));
+		goto out;
+	}
+
+	zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
+	zvr->zv = zv;
+	zvr->bio = bio;
+#ifdef HAVE_BLK_MQ
+	zvr->rq = NULL;
+#endif
+	zvol_submit(zvr,
+	    zvol_taskqs[raw_smp_processor_id() % zvol_taskq_count],
+	    bio_data_dir(bio), bio_is_flush(bio),
+	    bio_is_discard(bio) || bio_is_secure_erase(bio), B_FALSE);
 
 out:
 	spl_fstrans_unmark(cookie);
@@ -1144,6 +1365,71 @@ out:
 #endif
 }
 
+#ifdef HAVE_BLK_MQ
+/*
+ * Each hardware context is served by its own taskq.  Since the tag set is
+ * created with BLK_MQ_F_BLOCKING this may sleep, which allows reads to be
+ * executed here rather than being handed off when
+ * zvol_blk_mq_inline_reads is set.  Reads of cached data then complete
+ * without a context switch, at the cost of blocking the submitter on ARC
+ * misses.  Adjacent bios are merged into a single request by the block
+ * layer, which amortizes the range lock and dispatch over all of them.
+ */
+static blk_status_t
+zvol_queue_rq(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data *bd)
+{
+	struct request *rq = bd->rq;
+	zvol_state_t *zv = hctx->queue->queuedata;
+	zv_request_t *zvr = blk_mq_rq_to_pdu(rq);
+	uint64_t offset = blk_rq_pos(rq) << 9;
+	uint64_t size = blk_rq_bytes(rq);
+	fstrans_cookie_t cookie;
+
+	switch (req_op(rq)) {
+	case REQ_OP_READ:
+	case REQ_OP_WRITE:
+	case REQ_OP_FLUSH:
+	case REQ_OP_DISCARD:
+	case REQ_OP_SECURE_ERASE:
+		break;
+	default:
+		return (BLK_STS_NOTSUPP);
+	}
+
+	if ((req_op(rq) == REQ_OP_READ || req_op(rq) == REQ_OP_WRITE) &&
+	    offset + size > zv->zv_volsize) {
+		printk(KERN_INFO
+		    "%s: bad access: offset=%llu, size=%lu\n",
+		    zv->zv_disk->disk_name,
+		    (long long unsigned)offset,
+		    (long unsigned)size);
+
+		return (BLK_STS_IOERR);
+	}
+
+	blk_mq_start_request(rq);
+
+	zvr->zv = zv;
+	zvr->bio = rq->bio;
+	zvr->rq = rq;
+	zvr->lr = NULL;
+
+	cookie = spl_fstrans_mark();
+	zvol_submit(zvr, zvol_taskqs[hctx->queue_num % zvol_taskq_count],
+	    op_is_write(req_op(rq)) ? WRITE : READ,
+	    req_op(rq) == REQ_OP_FLUSH,
+	    req_op(rq) == REQ_OP_DISCARD || req_op(rq) == REQ_OP_SECURE_ERASE,
+	    zvol_blk_mq_inline_reads != 0);
+	spl_fstrans_unmark(cookie);
+
+	return (BLK_STS_OK);
+}
+
+static const struct blk_mq_ops zvol_blk_mq_ops = {
+	.queue_rq	= zvol_queue_rq,
+};
+#endif /* HAVE_BLK_MQ */
+
 /*
  * The zvol_state_t's are inserted into zvol_state_list and zvol_htable.
  */
@@ -1373,6 +1659,10 @@ zvol_last_close(zvol_state_t *zv)
 	ASSERT(RW_READ_HELD(&zv->zv_suspend_lock));
 	ASSERT(MUTEX_HELD(&zv->zv_state_lock));
 
+	/* Wait for the frees of discards acknowledged by zvol_discard() */
+	while (zv->zv_frees_pending != 0)
+		cv_wait(&zv->zv_frees_cv, &zv->zv_state_lock);
+
 	zvol_shutdown_zv(zv);
 
 	dmu_objset_disown(zv->zv_objset, 1, zv);
@@ -1678,6 +1968,58 @@ static struct block_device_operations zvol_ops = {
 	.owner			= THIS_MODULE,
 };
 
+/*
+ * Allocate the request queue of a new zvol, which is backed by blk-mq when
+ * zvol_use_blk_mq is set and the kernel supports it.
+ */
+static struct request_queue *
+zvol_alloc_queue(zvol_state_t *zv)
+{
+	struct request_queue *q;
+
+#ifdef HAVE_BLK_MQ
+	zv->zv_blk_mq = (zvol_use_blk_mq != 0);
+	if (zv->zv_blk_mq) {
+		struct blk_mq_tag_set *set = &zv->zv_tag_set;
+
+		set->ops = &zvol_blk_mq_ops;
+		set->nr_hw_queues = zvol_taskq_count;
+		set->queue_depth = MIN(MAX(zvol_blk_mq_queue_depth, 1),
+		    BLK_MQ_MAX_DEPTH);
+		set->numa_node = NUMA_NO_NODE;
+		set->cmd_size = sizeof (zv_request_t);
+		set->flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+		set->driver_data = zv;
+
+		if (blk_mq_alloc_tag_set(set) != 0)
+			return (NULL);
+
+		q = blk_mq_init_queue(set);
+		if (IS_ERR(q)) {
+			blk_mq_free_tag_set(set);
+			return (NULL);
+		}
+
+		return (q);
+	}
+#endif
+	q = blk_alloc_queue(GFP_ATOMIC);
+	if (q != NULL)
+		blk_queue_make_request(q, zvol_request);
+
+	return (q);
+}
+
+static void
+zvol_free_queue(zvol_state_t *zv)
+{
+	blk_cleanup_queue(zv->zv_queue);
+#ifdef HAVE_BLK_MQ
+	if (zv->zv_blk_mq)
+		blk_mq_free_tag_set(&zv->zv_tag_set);
+#endif
+}
+
 /*
  * Allocate memory for a new zvol_state_t and setup the required
  * request queue and generic disk structures for the block device.
@@ -1702,19 +2044,26 @@ zvol_alloc(dev_t dev, const char *name)
 	list_link_init(&zv->zv_next);
 
 	mutex_init(&zv->zv_state_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zv->zv_frees_cv, NULL, CV_DEFAULT, NULL);
 
-	zv->zv_queue = blk_alloc_queue(GFP_ATOMIC);
+	zv->zv_queue = zvol_alloc_queue(zv);
 	if (zv->zv_queue == NULL)
 		goto out_kmem;
 
-	blk_queue_make_request(zv->zv_queue, zvol_request);
 	blk_queue_set_write_cache(zv->zv_queue, B_TRUE, B_TRUE);
 
 	/* Limit read-ahead to a single page to prevent over-prefetching. */
 	blk_queue_set_read_ahead(zv->zv_queue, 1);
 
-	/* Disable write merging in favor of the ZIO pipeline. */
-	blk_queue_flag_set(QUEUE_FLAG_NOMERGES, zv->zv_queue);
+	/*
+	 * Disable write merging in favor of the ZIO pipeline.  A blk-mq
+	 * queue keeps merging enabled so that adjacent bios are submitted
+	 * as a single request.
+	 */
+#ifdef HAVE_BLK_MQ
+	if (!zv->zv_blk_mq)
+#endif
+		blk_queue_flag_set(QUEUE_FLAG_NOMERGES, zv->zv_queue);
 
 	zv->zv_disk = alloc_disk(ZVOL_MINORS);
 	if (zv->zv_disk == NULL)
@@ -1725,7 +2074,7 @@ zvol_alloc(dev_t dev, const char *name)
 	zv->zv_open_count = 0;
 	strlcpy(zv->zv_name, name, MAXNAMELEN);
 
-	zfs_rangelock_init(&zv->zv_rangelock, NULL, NULL);
+	zfs_rangelock_init_striped(&zv->zv_rangelock);
 	rw_init(&zv->zv_suspend_lock, NULL, RW_DEFAULT, NULL);
 
 	zv->zv_disk->major = zvol_major;
@@ -1759,7 +2108,7 @@ zvol_alloc(dev_t dev, const char *name)
 	return (zv);
 
 out_queue:
-	blk_cleanup_queue(zv->zv_queue);
+	zvol_free_queue(zv);
 out_kmem:
 	kmem_free(zv, sizeof (zvol_state_t));
 
@@ -1786,11 +2135,12 @@ zvol_free(void *arg)
 	zfs_rangelock_fini(&zv->zv_rangelock);
 
 	del_gendisk(zv->zv_disk);
-	blk_cleanup_queue(zv->zv_queue);
+	zvol_free_queue(zv);
 	put_disk(zv->zv_disk);
 
 	ida_simple_remove(&zvol_ida, MINOR(zv->zv_dev) >> ZVOL_MINOR_BITS);
 
+	cv_destroy(&zv->zv_frees_cv);
 	mutex_destroy(&zv->zv_state_lock);
 	dataset_kstats_destroy(&zv->zv_kstat);
 
@@ -2680,23 +3030,59 @@ zvol_rename_minors(spa_t *spa, const char *name1, const char *name2,
 		taskq_wait_id(spa->spa_zvol_taskq, id);
 }
 
+static void
+zvol_taskqs_destroy(void)
+{
+	for (int i = 0; i < zvol_taskq_count; i++) {
+		if (zvol_taskqs[i] != NULL)
+			taskq_destroy(zvol_taskqs[i]);
+	}
+	kmem_free(zvol_taskqs, zvol_taskq_count * sizeof (taskq_t *));
+	zvol_taskqs = NULL;
+
+	if (zvol_free_taskq != NULL) {
+		taskq_destroy(zvol_free_taskq);
+		zvol_free_taskq = NULL;
+	}
+}
+
 int
 zvol_init(void)
 {
 	int threads = MIN(MAX(zvol_threads, 1), 1024);
 	int i, error;
 
+	/* By default use one taskq per eight CPUs */
+	zvol_taskq_count = zvol_num_taskqs;
+	if (zvol_taskq_count == 0)
+		zvol_taskq_count = (boot_ncpus + 7) / 8;
+	zvol_taskq_count = MIN(MAX(zvol_taskq_count, 1), boot_ncpus);
+	threads = MAX(threads / zvol_taskq_count, 1);
+
 	list_create(&zvol_state_list, sizeof (zvol_state_t),
 	    offsetof(zvol_state_t, zv_next));
 	rw_init(&zvol_state_lock, NULL, RW_DEFAULT, NULL);
 	ida_init(&zvol_ida);
 
-	zvol_taskq = taskq_create(ZVOL_DRIVER, threads, maxclsyspri,
-	    threads * 2, INT_MAX, TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
-	if (zvol_taskq == NULL) {
+	zvol_taskqs = kmem_zalloc(zvol_taskq_count * sizeof (taskq_t *),
+	    KM_SLEEP);
+	for (i = 0; i < zvol_taskq_count; i++) {
+		zvol_taskqs[i] = taskq_create(ZVOL_DRIVER, threads,
+		    maxclsyspri, threads * 2, INT_MAX,
+		    TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
+		if (zvol_taskqs[i] == NULL) {
+			printk(KERN_INFO "ZFS: taskq_create() failed\n");
+			error = -ENOMEM;
+			goto out_taskq;
+		}
+	}
+
+	zvol_free_taskq = taskq_create("zvol_free", 8, defclsyspri, 1,
+	    INT_MAX, TASKQ_DYNAMIC);
+	if (zvol_free_taskq == NULL) {
 		printk(KERN_INFO "ZFS: taskq_create() failed\n");
 		error = -ENOMEM;
-		goto out;
+		goto out_taskq;
 	}
 
 	zvol_htable = kmem_alloc(ZVOL_HT_SIZE * sizeof (struct hlist_head),
@@ -2722,8 +3108,7 @@ zvol_init(void)
 out_free:
 	kmem_free(zvol_htable, ZVOL_HT_SIZE * sizeof (struct hlist_head));
 out_taskq:
-	taskq_destroy(zvol_taskq);
-out:
+	zvol_taskqs_destroy();
 	ida_destroy(&zvol_ida);
 	rw_destroy(&zvol_state_lock);
 	list_destroy(&zvol_state_list);
@@ -2740,7 +3125,7 @@ zvol_fini(void)
 	unregister_blkdev(zvol_major, ZVOL_DRIVER);
 	kmem_free(zvol_htable, ZVOL_HT_SIZE * sizeof (struct hlist_head));
 
-	taskq_destroy(zvol_taskq);
+	zvol_taskqs_destroy();
 	list_destroy(&zvol_state_list);
 	rw_destroy(&zvol_state_lock);
 
@@ -2757,9 +3142,15 @@ MODULE_PARM_DESC(zvol_major, "Major number for zvol device");
 module_param(zvol_threads, uint, 0444);
 MODULE_PARM_DESC(zvol_threads, "Max number of threads to handle I/O requests");
 
+module_param(zvol_num_taskqs, uint, 0444);
+MODULE_PARM_DESC(zvol_num_taskqs, "Number of taskqs to handle I/O requests");
+
 module_param(zvol_request_sync, uint, 0644);
 MODULE_PARM_DESC(zvol_request_sync, "Synchronously handle bio requests");
 
+module_param(zvol_discard_async, uint, 0644);
+MODULE_PARM_DESC(zvol_discard_async, "Free discarded ranges asynchronously");
+
 module_param(zvol_max_discard_blocks, ulong, 0444);
 MODULE_PARM_DESC(zvol_max_discard_blocks, "Max number of blocks to discard");
 
@@ -2768,4 +3159,16 @@ MODULE_PARM_DESC(zvol_prefetch_bytes, "Prefetch N bytes at zvol start+end");
 
 module_param(zvol_volmode, uint, 0644);
 MODULE_PARM_DESC(zvol_volmode, "Default volmode property value");
+
+#ifdef HAVE_BLK_MQ
+module_param(zvol_use_blk_mq, uint, 0644);
+MODULE_PARM_DESC(zvol_use_blk_mq, "Use a blk-mq queue for new zvols");
+
+module_param(zvol_blk_mq_queue_depth, uint, 0644);
+MODULE_PARM_DESC(zvol_blk_mq_queue_depth, "Queue depth of blk-mq zvols");
+
+module_param(zvol_blk_mq_inline_reads, uint, 0644);
+MODULE_PARM_DESC(zvol_blk_mq_inline_reads,
+	"Handle blk-mq zvol reads in the submitting context");
+#endif
 /* END CSTYLED */
@@ -1904,6 +1904,28 @@ u8_strcmp(const char *s1, const char *s2, size_t n, int flag, size_t uv,
 	    flag, errnum));
 }
 
+/*
+ * Return the number of 7-bit ASCII bytes at the start of [s, end), checking
+ * a word at a time.
+ */
+static size_t
+u8_ascii_span(const uchar_t *s, const uchar_t *end)
+{
+	const uchar_t *p = s;
+	uint64_t w;
+
+	while (end - p >= sizeof (w)) {
+		bcopy(p, &w, sizeof (w));
+		if (w & 0x8080808080808080ULL)
+			break;
+		p += sizeof (w);
+	}
+	while (p < end && U8_ISASCII(*p))
+		p++;
+
+	return (p - s);
+}
+
 size_t
 u8_textprep_str(char *inarray, size_t *inlen, char *outarray, size_t *outlen,
     int flag, size_t unicode_version, int *errnum)
@@ -1966,13 +1988,38 @@ u8_textprep_str(char *inarray, size_t *inlen, char *outarray, size_t *outlen,
 	ret_val = 0;
 
 	/*
-	 * If we don't have a normalization flag set, we do the simple case
-	 * conversion based text preparation separately below. Text
-	 * preparation involving Normalization will be done in the false task
-	 * block, again, separately since it will take much more time and
-	 * resource than doing simple case conversions.
+	 * Text made up entirely of 7-bit ASCII characters, which nearly all
+	 * file names are, is left alone by every form of normalization and
+	 * only needs the ASCII case conversion.  So we do that directly
+	 * rather than a character at a time through the tables.
+	 *
+	 * Otherwise, if we don't have a normalization flag set, we do the
+	 * simple case conversion based text preparation separately below.
+	 * Text preparation involving Normalization will be done in the false
+	 * task block, again, separately since it will take much more time
+	 * and resource than doing simple case conversions.
 	 */
-	if (f == 0) {
+	if (u8_ascii_span(ib, ibtail) == ibtail - ib) {
+		while (ib < ibtail) {
+			if (*ib == '\0' && do_not_ignore_null)
+				break;
+
+			if (ob >= obtail) {
+				*errnum = E2BIG;
+				ret_val = (size_t)-1;
+				break;
+			}
+
+			if (is_it_toupper)
+				*ob = U8_ASCII_TOUPPER(*ib);
+			else if (is_it_tolower)
+				*ob = U8_ASCII_TOLOWER(*ib);
+			else
+				*ob = *ib;
+			ib++;
+			ob++;
+		}
+	} else if (f == 0) {
 		while (ib < ibtail) {
 			if (*ib == '\0' && do_not_ignore_null)
 				break;
@@ -576,6 +576,31 @@ fletcher_4_incremental_impl(boolean_t native, const void *buf, uint64_t size,
 	}
 }
 
+/*
+ * Extends the checksum zcp of a buffer with the checksum nzcp of the size
+ * bytes that follow it, as if both had been checksummed in a single pass.
+ * Unlike fletcher_4_incremental_combine() the coefficients are computed
+ * without overflow, so size may be as large as SPA_MAXBLOCKSIZE.
+ */
+void
+fletcher_4_combine(zio_cksum_t *zcp, uint64_t size, const zio_cksum_t *nzcp)
+{
+	const uint64_t c1 = size / sizeof (uint32_t);
+	const uint64_t c2 = c1 * (c1 + 1) / 2;
+	const uint64_t c3 = (c1 % 3 == 1) ?
+	    c2 * ((c1 + 2) / 3) : (c2 / 3) * (c1 + 2);
+
+	ASSERT3U(size, <=, SPA_MAXBLOCKSIZE);
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint32_t)));
+
+	zcp->zc_word[3] += nzcp->zc_word[3] + c1 * zcp->zc_word[2] +
+	    c2 * zcp->zc_word[1] + c3 * zcp->zc_word[0];
+	zcp->zc_word[2] += nzcp->zc_word[2] + c1 * zcp->zc_word[1] +
+	    c2 * zcp->zc_word[0];
+	zcp->zc_word[1] += nzcp->zc_word[1] + c1 * zcp->zc_word[0];
+	zcp->zc_word[0] += nzcp->zc_word[0];
+}
+
 int
 fletcher_4_incremental_native(void *buf, size_t size, void *data)
 {
@@ -952,5 +977,6 @@ EXPORT_SYMBOL(fletcher_4_native_varsize);
 EXPORT_SYMBOL(fletcher_4_byteswap);
 EXPORT_SYMBOL(fletcher_4_incremental_native);
 EXPORT_SYMBOL(fletcher_4_incremental_byteswap);
+EXPORT_SYMBOL(fletcher_4_combine);
 EXPORT_SYMBOL(fletcher_4_abd_ops);
 #endif
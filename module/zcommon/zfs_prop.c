@@ -87,6 +87,7 @@ zfs_prop_init(void)
 		{ "sha512",	ZIO_CHECKSUM_SHA512 },
 		{ "skein",	ZIO_CHECKSUM_SKEIN },
 		{ "edonr",	ZIO_CHECKSUM_EDONR },
+		{ "blake3",	ZIO_CHECKSUM_BLAKE3 },
 		{ NULL }
 	};
 
@@ -105,6 +106,9 @@ zfs_prop_init(void)
 				ZIO_CHECKSUM_SKEIN | ZIO_CHECKSUM_VERIFY },
 		{ "edonr,verify",
 				ZIO_CHECKSUM_EDONR | ZIO_CHECKSUM_VERIFY },
+		{ "blake3",	ZIO_CHECKSUM_BLAKE3 },
+		{ "blake3,verify",
+				ZIO_CHECKSUM_BLAKE3 | ZIO_CHECKSUM_VERIFY },
 		{ NULL }
 	};
 
@@ -124,6 +128,49 @@ zfs_prop_init(void)
 		{ "gzip-9",	ZIO_COMPRESS_GZIP_9 },
 		{ "zle",	ZIO_COMPRESS_ZLE },
 		{ "lz4",	ZIO_COMPRESS_LZ4 },
+		{ "lz4-chunked",	ZIO_COMPRESS_LZ4_CHUNKED },
+		{ "zstd",	ZIO_COMPRESS_ZSTD_3 },	/* zstd default */
+		{ "zstd-1",	ZIO_COMPRESS_ZSTD_1 },
+		{ "zstd-2",	ZIO_COMPRESS_ZSTD_2 },
+		{ "zstd-3",	ZIO_COMPRESS_ZSTD_3 },
+		{ "zstd-4",	ZIO_COMPRESS_ZSTD_4 },
+		{ "zstd-5",	ZIO_COMPRESS_ZSTD_5 },
+		{ "zstd-6",	ZIO_COMPRESS_ZSTD_6 },
+		{ "zstd-7",	ZIO_COMPRESS_ZSTD_7 },
+		{ "zstd-8",	ZIO_COMPRESS_ZSTD_8 },
+		{ "zstd-9",	ZIO_COMPRESS_ZSTD_9 },
+		{ "zstd-10",	ZIO_COMPRESS_ZSTD_10 },
+		{ "zstd-11",	ZIO_COMPRESS_ZSTD_11 },
+		{ "zstd-12",	ZIO_COMPRESS_ZSTD_12 },
+		{ "zstd-13",	ZIO_COMPRESS_ZSTD_13 },
+		{ "zstd-14",	ZIO_COMPRESS_ZSTD_14 },
+		{ "zstd-15",	ZIO_COMPRESS_ZSTD_15 },
+		{ "zstd-16",	ZIO_COMPRESS_ZSTD_16 },
+		{ "zstd-17",	ZIO_COMPRESS_ZSTD_17 },
+		{ "zstd-18",	ZIO_COMPRESS_ZSTD_18 },
+		{ "zstd-19",	ZIO_COMPRESS_ZSTD_19 },
+		{ "zstd-fast",	ZIO_COMPRESS_ZSTD_FAST_1 },	/* zstd-fast default */
+		{ "zstd-fast-1",	ZIO_COMPRESS_ZSTD_FAST_1 },
+		{ "zstd-fast-2",	ZIO_COMPRESS_ZSTD_FAST_2 },
+		{ "zstd-fast-3",	ZIO_COMPRESS_ZSTD_FAST_3 },
+		{ "zstd-fast-4",	ZIO_COMPRESS_ZSTD_FAST_4 },
+		{ "zstd-fast-5",	ZIO_COMPRESS_ZSTD_FAST_5 },
+		{ "zstd-fast-6",	ZIO_COMPRESS_ZSTD_FAST_6 },
+		{ "zstd-fast-7",	ZIO_COMPRESS_ZSTD_FAST_7 },
+		{ "zstd-fast-8",	ZIO_COMPRESS_ZSTD_FAST_8 },
+		{ "zstd-fast-9",	ZIO_COMPRESS_ZSTD_FAST_9 },
+		{ "zstd-fast-10",	ZIO_COMPRESS_ZSTD_FAST_10 },
+		{ "zstd-fast-20",	ZIO_COMPRESS_ZSTD_FAST_20 },
+		{ "zstd-fast-30",	ZIO_COMPRESS_ZSTD_FAST_30 },
+		{ "zstd-fast-40",	ZIO_COMPRESS_ZSTD_FAST_40 },
+		{ "zstd-fast-50",	ZIO_COMPRESS_ZSTD_FAST_50 },
+		{ "zstd-fast-60",	ZIO_COMPRESS_ZSTD_FAST_60 },
+		{ "zstd-fast-70",	ZIO_COMPRESS_ZSTD_FAST_70 },
+		{ "zstd-fast-80",	ZIO_COMPRESS_ZSTD_FAST_80 },
+		{ "zstd-fast-90",	ZIO_COMPRESS_ZSTD_FAST_90 },
+		{ "zstd-fast-100",	ZIO_COMPRESS_ZSTD_FAST_100 },
+		{ "zstd-fast-500",	ZIO_COMPRESS_ZSTD_FAST_500 },
+		{ "zstd-fast-1000",	ZIO_COMPRESS_ZSTD_FAST_1000 },
 		{ NULL }
 	};
 
@@ -256,6 +303,16 @@ zfs_prop_init(void)
 		{ NULL }
 	};
 
+	static zprop_index_t secondary_cache_table[] = {
+		{ "none",		ZFS_CACHE_NONE },
+		{ "metadata",		ZFS_CACHE_METADATA },
+		{ "all",		ZFS_CACHE_ALL },
+		{ "mfu",		ZFS_CACHE_MFU },
+		{ "metadata-mfu",	ZFS_CACHE_METADATA_MFU },
+		{ "prefetch",		ZFS_CACHE_PREFETCH },
+		{ NULL }
+	};
+
 	static zprop_index_t sync_table[] = {
 		{ "standard",	ZFS_SYNC_STANDARD },
 		{ "always",	ZFS_SYNC_ALWAYS },
@@ -311,15 +368,19 @@ zfs_prop_init(void)
 	    ZIO_CHECKSUM_DEFAULT, PROP_INHERIT, ZFS_TYPE_FILESYSTEM |
 	    ZFS_TYPE_VOLUME,
 	    "on | off | fletcher2 | fletcher4 | sha256 | sha512 | "
-	    "skein | edonr", "CHECKSUM", checksum_table);
+	    "skein | edonr | blake3", "CHECKSUM", checksum_table);
 	zprop_register_index(ZFS_PROP_DEDUP, "dedup", ZIO_CHECKSUM_OFF,
 	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
 	    "on | off | verify | sha256[,verify], sha512[,verify], "
-	    "skein[,verify], edonr,verify", "DEDUP", dedup_table);
+	    "skein[,verify], edonr,verify, blake3[,verify]", "DEDUP",
+	    dedup_table);
 	zprop_register_index(ZFS_PROP_COMPRESSION, "compression",
 	    ZIO_COMPRESS_DEFAULT, PROP_INHERIT,
 	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
-	    "on | off | lzjb | gzip | gzip-[1-9] | zle | lz4", "COMPRESS",
+	    "on | off | lzjb | gzip | gzip-[1-9] | zle | lz4 | lz4-chunked | "
+	    "zstd | zstd-[1-19] | "
+	    "zstd-fast | zstd-fast-[1-10,20,30,40,50,60,70,80,90,100,500,1000]",
+	    "COMPRESS",
 	    compress_table);
 	zprop_register_index(ZFS_PROP_SNAPDIR, "snapdir", ZFS_SNAPDIR_HIDDEN,
 	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM,
@@ -348,7 +409,8 @@ zfs_prop_init(void)
 	zprop_register_index(ZFS_PROP_SECONDARYCACHE, "secondarycache",
 	    ZFS_CACHE_ALL, PROP_INHERIT,
 	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_SNAPSHOT | ZFS_TYPE_VOLUME,
-	    "all | none | metadata", "SECONDARYCACHE", cache_table);
+	    "all | none | metadata | mfu | metadata-mfu | prefetch",
+	    "SECONDARYCACHE", secondary_cache_table);
 	zprop_register_index(ZFS_PROP_LOGBIAS, "logbias", ZFS_LOGBIAS_LATENCY,
 	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
 	    "latency | throughput", "LOGBIAS", logbias_table);
@@ -567,6 +629,18 @@ zfs_prop_init(void)
 	zprop_register_number(ZFS_PROP_SPECIAL_SMALL_BLOCKS,
 	    "special_small_blocks", 0, PROP_INHERIT, ZFS_TYPE_FILESYSTEM,
 	    "zero or 512 to 128K, power of 2", "SPECIAL_SMALL_BLOCKS");
+	zprop_register_number(ZFS_PROP_READ_BW_LIMIT, "read_bw_limit", 0,
+	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "<bytes/s> | none", "RBWLIMIT");
+	zprop_register_number(ZFS_PROP_WRITE_BW_LIMIT, "write_bw_limit", 0,
+	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "<bytes/s> | none", "WBWLIMIT");
+	zprop_register_number(ZFS_PROP_READ_OPS_LIMIT, "read_ops_limit", 0,
+	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "<ops/s> | none", "ROPSLIMIT");
+	zprop_register_number(ZFS_PROP_WRITE_OPS_LIMIT, "write_ops_limit", 0,
+	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "<ops/s> | none", "WOPSLIMIT");
 
 	/* hidden properties */
 	zprop_register_hidden(ZFS_PROP_NUMCLONES, "numclones", PROP_TYPE_NUMBER,
@@ -156,13 +156,49 @@ uiomove_bvec(void *p, size_t n, enum uio_rw rw, struct uio *uio)
 	return (0);
 }
 
+#if defined(HAVE_VFS_IOV_ITER)
+/*
+ * Move data through a native Linux iov_iter.  This is used for iterators
+ * which cannot be expressed as an iovec or bio_vec array, such as the
+ * ITER_PIPE iterators passed by splice(2) and sendfile(2).  Data is
+ * copied straight into the pipe pages, the iov_iter is advanced by the
+ * copy itself and uio_skip is unused.
+ */
+static int
+uiomove_iter(void *p, size_t n, enum uio_rw rw, struct uio *uio)
+{
+	size_t cnt = MIN(n, uio->uio_resid);
+	size_t copied;
+
+	if (rw == UIO_READ)
+		copied = copy_to_iter(p, cnt, uio->uio_iter);
+	else
+		copied = copy_from_iter(p, cnt, uio->uio_iter);
+
+	uio->uio_resid -= copied;
+	uio->uio_loffset += copied;
+
+	/* A short copy means the pipe is full or the pages were not ready. */
+	if (copied != cnt)
+		return (EFAULT);
+
+	return (0);
+}
+#endif
+
 int
 uiomove(void *p, size_t n, enum uio_rw rw, struct uio *uio)
 {
-	if (uio->uio_segflg != UIO_BVEC)
-		return (uiomove_iov(p, n, rw, uio));
-	else
+	switch (uio->uio_segflg) {
+	case UIO_BVEC:
 		return (uiomove_bvec(p, n, rw, uio));
+#if defined(HAVE_VFS_IOV_ITER)
+	case UIO_ITER:
+		return (uiomove_iter(p, n, rw, uio));
+#endif
+	default:
+		return (uiomove_iov(p, n, rw, uio));
+	}
 }
 EXPORT_SYMBOL(uiomove);
 
@@ -188,6 +224,7 @@ uio_prefaultpages(ssize_t n, struct uio *uio)
 	switch (uio->uio_segflg) {
 		case UIO_SYSSPACE:
 		case UIO_BVEC:
+		case UIO_ITER:
 			return (0);
 		case UIO_USERSPACE:
 		case UIO_USERISPACE:
@@ -239,6 +276,9 @@ uiocopy(void *p, size_t n, enum uio_rw rw, struct uio *uio, size_t *cbytes)
 	struct uio uio_copy;
 	int ret;
 
+	/* The iov_iter is shared with the copy and would be advanced. */
+	ASSERT3U(uio->uio_segflg, !=, UIO_ITER);
+
 	bcopy(uio, &uio_copy, sizeof (struct uio));
 	ret = uiomove(p, n, rw, &uio_copy);
 	*cbytes = uio->uio_resid - uio_copy.uio_resid;
@@ -255,6 +295,15 @@ uioskip(uio_t *uiop, size_t n)
 	if (n > uiop->uio_resid)
 		return;
 
+#if defined(HAVE_VFS_IOV_ITER)
+	if (uiop->uio_segflg == UIO_ITER) {
+		iov_iter_advance(uiop->uio_iter, n);
+		uiop->uio_loffset += n;
+		uiop->uio_resid -= n;
+		return;
+	}
+#endif
+
 	uiop->uio_skip += n;
 	if (uiop->uio_segflg != UIO_BVEC) {
 		while (uiop->uio_iovcnt &&
@@ -70,6 +70,12 @@
  * zeroing out the borrowed value (forcing that thread to borrow on its next
  * request, which will also be expensive).  This is what makes aggsums well
  * suited for write-many read-rarely operations.
+ *
+ * Frequent readers which can live with an error should use aggsum_approx(),
+ * which takes no locks.  Its error is at most half the distance between the
+ * bounds, which only widen as buckets borrow, so such readers should also
+ * fold the buckets back in from time to time with aggsum_value(), away from
+ * their hot path.
  */
 
 /*
@@ -115,6 +121,19 @@ aggsum_upper_bound(aggsum_t *as)
 	return (as->as_upper_bound);
 }
 
+/*
+ * Return the midpoint of the bounds, which is off the value by no more than
+ * half their distance.
+ */
+int64_t
+aggsum_approx(aggsum_t *as)
+{
+	int64_t lower = as->as_lower_bound;
+	int64_t upper = as->as_upper_bound;
+
+	return (lower + (upper - lower) / 2);
+}
+
 static void
 aggsum_flush_bucket(aggsum_t *as, struct aggsum_bucket *asb)
 {
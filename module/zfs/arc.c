@@ -88,7 +88,8 @@
  *
  * buf_hash_find() returns the appropriate mutex (held) when it
  * locates the requested buffer in the hash table.  It returns
- * NULL for the mutex if the buffer was not in the table.
+ * NULL for the mutex if the buffer was not in the table.  Lookups
+ * which hash to an empty bucket return without taking the mutex.
  *
  * buf_hash_remove() expects the appropriate hash mutex to be
  * already held before it is invoked.
@@ -311,6 +312,7 @@
 #endif
 #include <sys/aggsum.h>
 #include <sys/cityhash.h>
+#include <sys/btree.h>
 
 #ifndef _KERNEL
 /* set with ZFS_DEBUG=watch, to enable watchpoints on frozen buffers */
@@ -430,6 +432,12 @@ unsigned long zfs_arc_pool_dirty_percent = 20;	/* each pool's anon allowance */
  */
 int zfs_arc_compression_enabled = B_TRUE;
 
+/*
+ * Decompressed copies of compressed blocks are cached up to arc_c >> shift
+ * bytes (0 disables the cache).
+ */
+int zfs_arc_dcache_shift = 7;
+
 /*
  * ARC will evict meta buffers that exceed arc_meta_limit. This
  * tunable make arc_meta_limit adjustable for different workloads.
@@ -445,6 +453,7 @@ unsigned long zfs_arc_dnode_limit_percent = 10;
  * These tunables are Linux specific
  */
 unsigned long zfs_arc_sys_free = 0;
+uint_t zfs_arc_shrink_ahead_percent = 0;
 int zfs_arc_min_prefetch_ms = 0;
 int zfs_arc_min_prescient_prefetch_ms = 0;
 int zfs_arc_p_dampener_disable = 1;
@@ -487,6 +496,9 @@ arc_stats_t arc_stats = {
 	{ "evict_l2_eligible",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_ineligible",	KSTAT_DATA_UINT64 },
 	{ "evict_l2_skip",		KSTAT_DATA_UINT64 },
+	{ "evict_mru",			KSTAT_DATA_UINT64 },
+	{ "evict_mfu",			KSTAT_DATA_UINT64 },
+	{ "adapt_prefetch_skip",	KSTAT_DATA_UINT64 },
 	{ "hash_elements",		KSTAT_DATA_UINT64 },
 	{ "hash_elements_max",		KSTAT_DATA_UINT64 },
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
@@ -500,6 +512,8 @@ arc_stats_t arc_stats = {
 	{ "compressed_size",		KSTAT_DATA_UINT64 },
 	{ "uncompressed_size",		KSTAT_DATA_UINT64 },
 	{ "overhead_size",		KSTAT_DATA_UINT64 },
+	{ "dcache_size",		KSTAT_DATA_UINT64 },
+	{ "dcache_hits",		KSTAT_DATA_UINT64 },
 	{ "hdr_size",			KSTAT_DATA_UINT64 },
 	{ "data_size",			KSTAT_DATA_UINT64 },
 	{ "metadata_size",		KSTAT_DATA_UINT64 },
@@ -541,6 +555,17 @@ arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "memory_direct_count",	KSTAT_DATA_UINT64 },
 	{ "memory_indirect_count",	KSTAT_DATA_UINT64 },
@@ -559,6 +584,8 @@ arc_stats_t arc_stats = {
 	{ "async_upgrade_sync",		KSTAT_DATA_UINT64 },
 	{ "demand_hit_predictive_prefetch", KSTAT_DATA_UINT64 },
 	{ "demand_hit_prescient_prefetch", KSTAT_DATA_UINT64 },
+	{ "evict_predictive_prefetch_unread", KSTAT_DATA_UINT64 },
+	{ "evict_predictive_prefetch_unread_bytes", KSTAT_DATA_UINT64 },
 	{ "arc_need_free",		KSTAT_DATA_UINT64 },
 	{ "arc_sys_free",		KSTAT_DATA_UINT64 },
 	{ "arc_raw_size",		KSTAT_DATA_UINT64 }
@@ -603,6 +630,7 @@ arc_stats_t arc_stats = {
 	}
 
 kstat_t			*arc_ksp;
+static kstat_t		*arc_raw_ksp;
 static arc_state_t	*arc_anon;
 static arc_state_t	*arc_mru;
 static arc_state_t	*arc_mru_ghost;
@@ -649,6 +677,11 @@ static arc_state_t	*arc_l2c_only;
  * instead, but still be able to export the kstat in the same way as before.
  * The solution is to always use the aggsum version, except in the kstat update
  * callback.
+ *
+ * The exact value is only read where eviction depends on it.  Heuristics on
+ * the allocation and memory pressure paths use aggsum_approx(), which stays
+ * close since arc_adjust_cb_check() folds them every second by updating the
+ * kstat.
  */
 aggsum_t arc_size;
 aggsum_t arc_meta_used;
@@ -679,6 +712,8 @@ static taskq_t *arc_prune_taskq;
 	((hdr)->b_flags & ARC_FLAG_COMPRESSED_ARC)
 
 #define	HDR_L2CACHE(hdr)	((hdr)->b_flags & ARC_FLAG_L2CACHE)
+#define	HDR_L2_MFUONLY(hdr)	((hdr)->b_flags & ARC_FLAG_L2_MFUONLY)
+#define	HDR_L2_PREFETCH(hdr)	((hdr)->b_flags & ARC_FLAG_L2_PREFETCH)
 #define	HDR_L2_READING(hdr)	\
 	(((hdr)->b_flags & ARC_FLAG_IO_IN_PROGRESS) &&	\
 	((hdr)->b_flags & ARC_FLAG_HAS_L2HDR))
@@ -738,18 +773,26 @@ struct ht_lock {
 #endif
 };
 
-#define	BUF_LOCKS 8192
+/*
+ * The hash locks are striped over the buckets.  The number of locks is
+ * sized in buf_init() to scale with both the number of CPUs and the size
+ * of the hash table, with a floor of BUF_LOCKS_MIN.
+ */
+#define	BUF_LOCKS_MIN		8192
+#define	BUF_LOCKS_PER_CPU	1024
 typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
-	struct ht_lock ht_locks[BUF_LOCKS];
+	uint64_t ht_lock_mask;
+	struct ht_lock *ht_locks;
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
 
 #define	BUF_HASH_INDEX(spa, dva, birth) \
 	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
-#define	BUF_HASH_LOCK_NTRY(idx) (buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
+#define	BUF_HASH_LOCK_NTRY(idx) \
+	(buf_hash_table.ht_locks[(idx) & buf_hash_table.ht_lock_mask])
 #define	BUF_HASH_LOCK(idx)	(&(BUF_HASH_LOCK_NTRY(idx).ht_lock))
 #define	HDR_LOCK(hdr) \
 	(BUF_HASH_LOCK(BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
@@ -771,25 +814,22 @@ uint64_t zfs_crc64_table[256];
 #define	L2ARC_FEED_SECS		1		/* caching interval secs */
 #define	L2ARC_FEED_MIN_MS	200		/* min caching interval ms */
 
-/*
- * We can feed L2ARC from two states of ARC buffers, mru and mfu,
- * and each of the state has two types: data and metadata.
- */
-#define	L2ARC_FEED_TYPES	4
-
 #define	l2arc_writes_sent	ARCSTAT(arcstat_l2_writes_sent)
 #define	l2arc_writes_done	ARCSTAT(arcstat_l2_writes_done)
 
 /* L2ARC Performance Tunables */
 unsigned long l2arc_write_max = L2ARC_WRITE_SIZE;	/* def max write size */
 unsigned long l2arc_write_boost = L2ARC_WRITE_SIZE;	/* extra warmup write */
+unsigned long l2arc_write_scale = 8;		/* max multiple of write_max */
 unsigned long l2arc_headroom = L2ARC_HEADROOM;		/* # of dev writes */
 unsigned long l2arc_headroom_boost = L2ARC_HEADROOM_BOOST;
 unsigned long l2arc_feed_secs = L2ARC_FEED_SECS;	/* interval seconds */
 unsigned long l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval msecs */
 int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
+int l2arc_exclusive = B_FALSE;			/* drop L2 copy on L2 hit */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
 int l2arc_norw = B_FALSE;			/* no reads during writes */
+int l2arc_rebuild_enabled = B_TRUE;		/* rebuild from log blocks */
 
 /*
  * L2ARC Internals
@@ -797,7 +837,6 @@ int l2arc_norw = B_FALSE;			/* no reads during writes */
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
 static kmutex_t l2arc_dev_mtx;			/* device list mutex */
-static l2arc_dev_t *l2arc_dev_last;		/* last device used */
 static list_t L2ARC_free_on_write;		/* free after write buf list */
 static list_t *l2arc_free_on_write;		/* free after write list ptr */
 static kmutex_t l2arc_free_on_write_mtx;	/* mutex for list */
@@ -828,8 +867,17 @@ typedef enum arc_fill_flags {
 } arc_fill_flags_t;
 
 static kmutex_t l2arc_feed_thr_lock;
-static kcondvar_t l2arc_feed_thr_cv;
-static uint8_t l2arc_thread_exit;
+
+static kmutex_t l2arc_rebuild_thr_lock;
+static kcondvar_t l2arc_rebuild_thr_cv;
+
+/* Persistent L2ARC */
+static void l2arc_dev_rebuild_thread(void *arg);
+static void l2arc_dev_hdr_update(l2arc_dev_t *dev);
+static boolean_t l2arc_log_blk_insert(l2arc_dev_t *dev,
+    const arc_buf_hdr_t *hdr);
+static void l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio);
+static uint64_t l2arc_log_blk_overhead(uint64_t write_sz, l2arc_dev_t *dev);
 
 static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, void *);
 static void *arc_get_data_buf(arc_buf_hdr_t *, uint64_t, void *);
@@ -894,6 +942,18 @@ buf_hash_find(uint64_t spa, const blkptr_t *bp, kmutex_t **lockp)
 	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
 	arc_buf_hdr_t *hdr;
 
+	/*
+	 * The table is sized such that most buckets are empty, so check
+	 * for an empty bucket before taking the lock.  Observing a stale
+	 * empty bucket is equivalent to the lookup having completed just
+	 * before a racing insert, which callers must already handle as
+	 * buf_hash_insert() detects duplicates under the lock.
+	 */
+	if (((arc_buf_hdr_t *volatile *)buf_hash_table.ht_table)[idx] == NULL) {
+		*lockp = NULL;
+		return (NULL);
+	}
+
 	mutex_enter(hash_lock);
 	for (hdr = buf_hash_table.ht_table[idx]; hdr != NULL;
 	    hdr = hdr->b_hash_next) {
@@ -1009,8 +1069,10 @@ buf_fini(void)
 	kmem_free(buf_hash_table.ht_table,
 	    (buf_hash_table.ht_mask + 1) * sizeof (void *));
 #endif
-	for (i = 0; i < BUF_LOCKS; i++)
+	for (i = 0; i <= buf_hash_table.ht_lock_mask; i++)
 		mutex_destroy(&buf_hash_table.ht_locks[i].ht_lock);
+	vmem_free(buf_hash_table.ht_locks,
+	    (buf_hash_table.ht_lock_mask + 1) * sizeof (struct ht_lock));
 	kmem_cache_destroy(hdr_full_cache);
 	kmem_cache_destroy(hdr_full_crypt_cache);
 	kmem_cache_destroy(hdr_l2only_cache);
@@ -1093,6 +1155,8 @@ hdr_full_dest(void *vbuf, void *unused)
 	zfs_refcount_destroy(&hdr->b_l1hdr.b_refcnt);
 	mutex_destroy(&hdr->b_l1hdr.b_freeze_lock);
 	ASSERT(!multilist_link_active(&hdr->b_l1hdr.b_arc_node));
+	ASSERT3P(hdr->b_l1hdr.b_dcache, ==, NULL);
+	ASSERT3P(hdr->b_l1hdr.b_os, ==, NULL);
 	arc_space_return(HDR_FULL_SIZE, ARC_SPACE_HDRS);
 }
 
@@ -1147,6 +1211,7 @@ buf_init(void)
 {
 	uint64_t *ct = NULL;
 	uint64_t hsize = 1ULL << 12;
+	uint64_t nlocks = BUF_LOCKS_MIN;
 	int i, j;
 
 	/*
@@ -1191,7 +1256,21 @@ retry:
 		for (ct = zfs_crc64_table + i, *ct = i, j = 8; j > 0; j--)
 			*ct = (*ct >> 1) ^ (-(*ct & 1) & ZFS_CRC64_POLY);
 
-	for (i = 0; i < BUF_LOCKS; i++) {
+	/*
+	 * Scale the number of hash locks with the number of CPUs, which
+	 * bounds the number of concurrent lookups, and with the portion of
+	 * the hash table which can be populated by a full cache of
+	 * arc_c_max bytes.  There is no benefit to more locks than buckets.
+	 */
+	while (nlocks < (uint64_t)max_ncpus * BUF_LOCKS_PER_CPU ||
+	    nlocks * BUF_LOCKS_PER_CPU * zfs_arc_average_blocksize < arc_c_max)
+		nlocks <<= 1;
+	nlocks = MIN(nlocks, hsize);
+
+	buf_hash_table.ht_lock_mask = nlocks - 1;
+	buf_hash_table.ht_locks =
+	    vmem_zalloc(nlocks * sizeof (struct ht_lock), KM_SLEEP);
+	for (i = 0; i < nlocks; i++) {
 		mutex_init(&buf_hash_table.ht_locks[i].ht_lock,
 		    NULL, MUTEX_DEFAULT, NULL);
 	}
@@ -1545,6 +1624,20 @@ arc_hdr_clear_flags(arc_buf_hdr_t *hdr, arc_flags_t flags)
 	hdr->b_flags &= ~flags;
 }
 
+/*
+ * Apply the secondarycache policy carried by the flags of a read or a
+ * write to the header, replacing the restrictions of any earlier one.
+ */
+static inline void
+arc_hdr_set_l2cache(arc_buf_hdr_t *hdr, arc_flags_t flags)
+{
+	if (!(flags & ARC_FLAG_L2CACHE))
+		return;
+
+	arc_hdr_clear_flags(hdr, ARC_FLAG_L2_MFUONLY | ARC_FLAG_L2_PREFETCH);
+	arc_hdr_set_flags(hdr, flags & ARC_FLAG_L2CACHE_MASK);
+}
+
 /*
  * Setting the compression bits in the arc_buf_hdr_t's b_flags is
  * done in a special way since we have to clear and set bits
@@ -1612,6 +1705,276 @@ arc_buf_try_copy_decompressed_data(arc_buf_t *buf)
 	return (copied);
 }
 
+/*
+ * Decompressed Buffer Cache
+ *
+ * A hot compressed block is often read by many consumers which each get
+ * their own arc_buf_t.  As long as one of those bufs is alive the others
+ * copy from it (see arc_buf_try_copy_decompressed_data()), but once the last
+ * one is released the next reader has to decompress b_pabd again.  To avoid
+ * this, arc_buf_fill() keeps a copy of the decompressed (and byteswapped)
+ * data on the hdr.  At most one copy exists per hdr, and all copies are kept
+ * on a global LRU list which is trimmed to arc_c >> zfs_arc_dcache_shift
+ * bytes.
+ *
+ * Fills of the same hdr are serialized by its hash lock, so when several
+ * readers miss at once only the first decompresses; the others find its
+ * buf or cached copy once they get the lock.
+ *
+ * A copy only exists while the hdr is in arc_mru or arc_mfu with a b_pabd,
+ * which guarantees that the hdr's identity, and thus its hash lock, is
+ * stable.  It is dropped, with the hash lock held, as soon as either
+ * condition stops being true.  b_dcache may only change with both the hash
+ * lock and arc_dcache_lock held, so the data can be copied out under the
+ * hash lock alone.  The LRU list can only free an entry once it obtains the
+ * hdr's hash lock.
+ */
+static kmutex_t arc_dcache_lock;
+static list_t arc_dcache_list;
+static uint64_t arc_dcache_size;
+
+static void
+arc_dcache_entry_free(arc_dcache_entry_t *de)
+{
+	arc_buf_hdr_t *hdr = de->de_hdr;
+	uint64_t size = HDR_GET_LSIZE(hdr);
+
+	ASSERT(MUTEX_HELD(&arc_dcache_lock));
+	ASSERT3P(hdr->b_l1hdr.b_dcache, ==, de);
+
+	list_remove(&arc_dcache_list, de);
+	hdr->b_l1hdr.b_dcache = NULL;
+	arc_dcache_size -= size;
+	ARCSTAT_INCR(arcstat_dcache_size, -size);
+
+	if (arc_buf_type(hdr) == ARC_BUFC_METADATA) {
+		zio_buf_free(de->de_data, size);
+		arc_space_return(size, ARC_SPACE_META);
+	} else {
+		zio_data_buf_free(de->de_data, size);
+		arc_space_return(size, ARC_SPACE_DATA);
+	}
+	kmem_free(de, sizeof (arc_dcache_entry_t));
+}
+
+/*
+ * Free entries from the cold end of the LRU list until the cache fits in
+ * its limit.  Entries whose hash lock is busy are skipped.  The caller may
+ * already hold one hash lock, which is passed as held_lock.
+ */
+static void
+arc_dcache_trim(kmutex_t *held_lock)
+{
+	uint64_t limit = (zfs_arc_dcache_shift > 0) ?
+	    arc_c >> zfs_arc_dcache_shift : 0;
+	arc_dcache_entry_t *de, *prev;
+
+	mutex_enter(&arc_dcache_lock);
+	for (de = list_tail(&arc_dcache_list);
+	    de != NULL && arc_dcache_size > limit; de = prev) {
+		kmutex_t *hash_lock = HDR_LOCK(de->de_hdr);
+
+		prev = list_prev(&arc_dcache_list, de);
+		if (hash_lock == held_lock) {
+			arc_dcache_entry_free(de);
+		} else if (mutex_tryenter(hash_lock)) {
+			arc_dcache_entry_free(de);
+			mutex_exit(hash_lock);
+		}
+	}
+	mutex_exit(&arc_dcache_lock);
+}
+
+/*
+ * Drop the hdr's decompressed copy, if it has one.
+ */
+static void
+arc_dcache_remove(arc_buf_hdr_t *hdr)
+{
+	ASSERT(HDR_HAS_L1HDR(hdr));
+
+	if (hdr->b_l1hdr.b_dcache == NULL)
+		return;
+
+	ASSERT(MUTEX_HELD(HDR_LOCK(hdr)));
+	mutex_enter(&arc_dcache_lock);
+	arc_dcache_entry_free(hdr->b_l1hdr.b_dcache);
+	mutex_exit(&arc_dcache_lock);
+}
+
+/*
+ * Fill the buf from the hdr's decompressed copy and mark that copy as
+ * recently used.  Returns false if the hdr has no copy.
+ */
+static boolean_t
+arc_dcache_lookup(arc_buf_t *buf)
+{
+	arc_buf_hdr_t *hdr = buf->b_hdr;
+	arc_dcache_entry_t *de = hdr->b_l1hdr.b_dcache;
+
+	ASSERT(!ARC_BUF_COMPRESSED(buf));
+
+	if (de == NULL)
+		return (B_FALSE);
+
+	ASSERT(MUTEX_HELD(HDR_LOCK(hdr)));
+	bcopy(de->de_data, buf->b_data, HDR_GET_LSIZE(hdr));
+	ARCSTAT_BUMP(arcstat_dcache_hits);
+
+	mutex_enter(&arc_dcache_lock);
+	if (de != list_head(&arc_dcache_list)) {
+		list_remove(&arc_dcache_list, de);
+		list_insert_head(&arc_dcache_list, de);
+	}
+	mutex_exit(&arc_dcache_lock);
+
+	return (B_TRUE);
+}
+
+/*
+ * Keep a copy of the buf's freshly decompressed data on its hdr.
+ */
+static void
+arc_dcache_insert(arc_buf_t *buf)
+{
+	arc_buf_hdr_t *hdr = buf->b_hdr;
+	kmutex_t *hash_lock = HDR_LOCK(hdr);
+	uint64_t size = HDR_GET_LSIZE(hdr);
+	arc_dcache_entry_t *de;
+
+	ASSERT(!ARC_BUF_COMPRESSED(buf));
+
+	if (zfs_arc_dcache_shift <= 0 || hdr->b_l1hdr.b_dcache != NULL ||
+	    hdr->b_l1hdr.b_pabd == NULL || HDR_PROTECTED(hdr) ||
+	    (hdr->b_l1hdr.b_state != arc_mru &&
+	    hdr->b_l1hdr.b_state != arc_mfu))
+		return;
+
+	ASSERT(MUTEX_HELD(hash_lock));
+
+	de = kmem_alloc(sizeof (arc_dcache_entry_t), KM_SLEEP);
+	de->de_hdr = hdr;
+	if (arc_buf_type(hdr) == ARC_BUFC_METADATA) {
+		de->de_data = zio_buf_alloc(size);
+		arc_space_consume(size, ARC_SPACE_META);
+	} else {
+		de->de_data = zio_data_buf_alloc(size);
+		arc_space_consume(size, ARC_SPACE_DATA);
+	}
+	bcopy(buf->b_data, de->de_data, size);
+
+	mutex_enter(&arc_dcache_lock);
+	list_insert_head(&arc_dcache_list, de);
+	hdr->b_l1hdr.b_dcache = de;
+	arc_dcache_size += size;
+	ARCSTAT_INCR(arcstat_dcache_size, size);
+	mutex_exit(&arc_dcache_lock);
+
+	arc_dcache_trim(hash_lock);
+}
+
+/*
+ * Per-Objset Residency
+ *
+ * To show how much of the cache each dataset takes, an L1 hdr read or
+ * written for an objset points to the arc_os_stat_t shared by all the hdrs
+ * of that objset.  arc_change_state() adds the hdr's logical size to
+ * aos_mru_size or aos_mfu_size as it enters arc_mru or arc_mfu and takes it
+ * off as it leaves, which only costs an atomic add next to the state size
+ * updates it already does.  The sizes are those of the blocks cached, not of
+ * the memory they use: compression and extra arc_buf_t copies are ignored.
+ * A hdr stays charged to the first objset it was read or written for, so a
+ * block shared by a clone and its origin only counts for one of them.
+ *
+ * The entries are kept on hashed lists, referenced by their hdrs, and the
+ * unreferenced ones are freed when the arcstats_objset kstat is read.
+ */
+#define	ARC_OS_BUCKETS		256
+
+typedef struct arc_os_bucket {
+	kmutex_t		aob_lock;
+	list_t			aob_list;
+} arc_os_bucket_t;
+
+static arc_os_bucket_t arc_os_buckets[ARC_OS_BUCKETS];
+
+static arc_os_bucket_t *
+arc_os_bucket(uint64_t spa, uint64_t objset)
+{
+	uint64_t h = spa ^ (objset * 0x9e3779b97f4a7c15ULL);
+
+	return (&arc_os_buckets[(h ^ (h >> 32)) & (ARC_OS_BUCKETS - 1)]);
+}
+
+static arc_os_stat_t *
+arc_os_hold(uint64_t spa, uint64_t objset)
+{
+	arc_os_bucket_t *aob = arc_os_bucket(spa, objset);
+	arc_os_stat_t *aos;
+
+	mutex_enter(&aob->aob_lock);
+	for (aos = list_head(&aob->aob_list); aos != NULL;
+	    aos = list_next(&aob->aob_list, aos)) {
+		if (aos->aos_spa == spa && aos->aos_objset == objset)
+			break;
+	}
+	if (aos == NULL) {
+		aos = kmem_zalloc(sizeof (arc_os_stat_t), KM_SLEEP);
+		aos->aos_spa = spa;
+		aos->aos_objset = objset;
+		list_insert_head(&aob->aob_list, aos);
+	}
+	atomic_inc_64(&aos->aos_refcnt);
+	mutex_exit(&aob->aob_lock);
+
+	return (aos);
+}
+
+static void
+arc_os_size_update(arc_buf_hdr_t *hdr, arc_state_t *state, boolean_t add)
+{
+	arc_os_stat_t *aos = hdr->b_l1hdr.b_os;
+	int64_t delta = add ? HDR_GET_LSIZE(hdr) : -HDR_GET_LSIZE(hdr);
+
+	if (aos == NULL)
+		return;
+
+	if (state == arc_mru)
+		atomic_add_64(&aos->aos_mru_size, delta);
+	else if (state == arc_mfu)
+		atomic_add_64(&aos->aos_mfu_size, delta);
+}
+
+/*
+ * Charge hdr, which is private or whose hash lock is held, to the objset
+ * of zb unless it already is charged to one.
+ */
+static void
+arc_hdr_set_os(arc_buf_hdr_t *hdr, const zbookmark_phys_t *zb)
+{
+	ASSERT(HDR_HAS_L1HDR(hdr));
+
+	if (zb == NULL || hdr->b_l1hdr.b_os != NULL)
+		return;
+
+	hdr->b_l1hdr.b_os = arc_os_hold(hdr->b_spa, zb->zb_objset);
+	arc_os_size_update(hdr, hdr->b_l1hdr.b_state, B_TRUE);
+}
+
+static void
+arc_hdr_clear_os(arc_buf_hdr_t *hdr)
+{
+	arc_os_stat_t *aos = hdr->b_l1hdr.b_os;
+
+	if (aos == NULL)
+		return;
+
+	ASSERT(hdr->b_l1hdr.b_state != arc_mru &&
+	    hdr->b_l1hdr.b_state != arc_mfu);
+	hdr->b_l1hdr.b_os = NULL;
+	atomic_dec_64(&aos->aos_refcnt);
+}
+
 /*
  * Return the size of the block, b_pabd, that is stored in the arc_buf_hdr_t.
  */
@@ -1862,6 +2225,7 @@ arc_buf_fill(arc_buf_t *buf, spa_t *spa, const zbookmark_phys_t *zb,
 	    (arc_hdr_get_compress(hdr) != ZIO_COMPRESS_OFF);
 	boolean_t compressed = (flags & ARC_FILL_COMPRESSED) != 0;
 	boolean_t encrypted = (flags & ARC_FILL_ENCRYPTED) != 0;
+	boolean_t decompressed = B_FALSE;
 	dmu_object_byteswap_t bswap = hdr->b_l1hdr.b_byteswap;
 	kmutex_t *hash_lock = (flags & ARC_FILL_LOCKED) ? NULL : HDR_LOCK(hdr);
 
@@ -1983,12 +2347,25 @@ arc_buf_fill(arc_buf_t *buf, spa_t *spa, const zbookmark_phys_t *zb,
 
 		/*
 		 * Try copying the data from another buf which already has a
-		 * decompressed version. If that's not possible, it's time to
-		 * bite the bullet and decompress the data from the hdr.
+		 * decompressed version, or from the hdr's cached decompressed
+		 * copy. If that's not possible, it's time to bite the bullet
+		 * and decompress the data from the hdr.
 		 */
 		if (arc_buf_try_copy_decompressed_data(buf)) {
 			/* Skip byteswapping and checksumming (already done) */
 			return (0);
+		}
+
+		if (hash_lock != NULL)
+			mutex_enter(hash_lock);
+		boolean_t cached = arc_dcache_lookup(buf);
+		if (hash_lock != NULL)
+			mutex_exit(hash_lock);
+
+		if (cached) {
+			/* Skip byteswapping (already done) */
+			arc_cksum_compute(buf);
+			return (0);
 		} else {
 			error = zio_decompress_data(HDR_GET_COMPRESS(hdr),
 			    hdr->b_l1hdr.b_pabd, buf->b_data,
@@ -2010,6 +2387,7 @@ arc_buf_fill(arc_buf_t *buf, spa_t *spa, const zbookmark_phys_t *zb,
 					mutex_exit(hash_lock);
 				return (SET_ERROR(EIO));
 			}
+			decompressed = B_TRUE;
 		}
 	}
 
@@ -2021,6 +2399,15 @@ byteswap:
 		dmu_ot_byteswap[bswap].ob_func(buf->b_data, HDR_GET_LSIZE(hdr));
 	}
 
+	/* Keep the result around for the next reader of this hdr */
+	if (decompressed) {
+		if (hash_lock != NULL)
+			mutex_enter(hash_lock);
+		arc_dcache_insert(buf);
+		if (hash_lock != NULL)
+			mutex_exit(hash_lock);
+	}
+
 	/* Compute the hdr's checksum if necessary */
 	arc_cksum_compute(buf);
 
@@ -2242,7 +2629,7 @@ arc_buf_info(arc_buf_t *ab, arc_buf_info_t *abi, int state_index)
 
 	if (l2hdr) {
 		abi->abi_l2arc_dattr = l2hdr->b_daddr;
-		abi->abi_l2arc_hits = l2hdr->b_hits;
+		abi->abi_l2arc_hits = hdr->b_l2hits;
 	}
 
 	abi->abi_state_type = state ? state->arcs_state : ARC_STATE_ANON;
@@ -2290,6 +2677,15 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 	ASSERT(!GHOST_STATE(new_state) || bufcnt == 0);
 	ASSERT(old_state != arc_anon || bufcnt <= 1);
 
+	/* Decompressed copies are only kept for cached hdrs */
+	if (HDR_HAS_L1HDR(hdr) && new_state != arc_mru && new_state != arc_mfu)
+		arc_dcache_remove(hdr);
+
+	if (HDR_HAS_L1HDR(hdr)) {
+		arc_os_size_update(hdr, old_state, B_FALSE);
+		arc_os_size_update(hdr, new_state, B_TRUE);
+	}
+
 	/*
 	 * If this buffer is evictable, transfer it from the
 	 * old state list to the new state list.
@@ -3080,6 +3476,9 @@ arc_hdr_free_abd(arc_buf_hdr_t *hdr, boolean_t free_rdata)
 	ASSERT(hdr->b_l1hdr.b_pabd != NULL || HDR_HAS_RABD(hdr));
 	IMPLY(free_rdata, HDR_HAS_RABD(hdr));
 
+	if (!free_rdata)
+		arc_dcache_remove(hdr);
+
 	/*
 	 * If the hdr is currently being written to the l2arc then
 	 * we defer freeing the data by adding it to the l2arc_free_on_write
@@ -3222,6 +3621,7 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 		VERIFY3P(hdr->b_l1hdr.b_pabd, ==, NULL);
 		ASSERT(!HDR_HAS_RABD(hdr));
 
+		arc_hdr_clear_os(hdr);
 		arc_hdr_clear_flags(nhdr, ARC_FLAG_HAS_L1HDR);
 	}
 	/*
@@ -3328,6 +3728,7 @@ arc_hdr_realloc_crypt(arc_buf_hdr_t *hdr, boolean_t need_crypt)
 	nhdr->b_l1hdr.b_l2_hits = hdr->b_l1hdr.b_l2_hits;
 	nhdr->b_l1hdr.b_acb = hdr->b_l1hdr.b_acb;
 	nhdr->b_l1hdr.b_pabd = hdr->b_l1hdr.b_pabd;
+	nhdr->b_l1hdr.b_os = hdr->b_l1hdr.b_os;
 
 	/*
 	 * This zfs_refcount_add() exists only to ensure that the individual
@@ -3373,6 +3774,7 @@ arc_hdr_realloc_crypt(arc_buf_hdr_t *hdr, boolean_t need_crypt)
 	hdr->b_l1hdr.b_l2_hits = 0;
 	hdr->b_l1hdr.b_acb = NULL;
 	hdr->b_l1hdr.b_pabd = NULL;
+	hdr->b_l1hdr.b_os = NULL;
 
 	if (ocache == hdr_full_crypt_cache) {
 		ASSERT(!HDR_HAS_RABD(hdr));
@@ -3599,6 +4001,8 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 
 		if (HDR_HAS_RABD(hdr))
 			arc_hdr_free_abd(hdr, B_TRUE);
+
+		arc_hdr_clear_os(hdr);
 	}
 
 	ASSERT3P(hdr->b_hash_next, ==, NULL);
@@ -3763,20 +4167,44 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 		if (HDR_HAS_RABD(hdr))
 			arc_hdr_free_abd(hdr, B_TRUE);
 
+		/*
+		 * The first demand read of a predictively prefetched buffer
+		 * clears the flag, so one still set was prefetched in vain.
+		 */
+		if (hdr->b_flags & ARC_FLAG_PREDICTIVE_PREFETCH) {
+			ARCSTAT_BUMP(arcstat_evict_predictive_prefetch_unread);
+			ARCSTAT_INCR(
+			    arcstat_evict_predictive_prefetch_unread_bytes,
+			    HDR_GET_LSIZE(hdr));
+			arc_hdr_clear_flags(hdr, ARC_FLAG_PREDICTIVE_PREFETCH);
+		}
+
 		arc_change_state(evicted_state, hdr, hash_lock);
 		ASSERT(HDR_IN_HASH_TABLE(hdr));
 		arc_hdr_set_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 		DTRACE_PROBE1(arc__evict, arc_buf_hdr_t *, hdr);
 	}
 
+	if (state == arc_mru)
+		ARCSTAT_INCR(arcstat_evict_mru, bytes_evicted);
+	else
+		ARCSTAT_INCR(arcstat_evict_mfu, bytes_evicted);
+
 	return (bytes_evicted);
 }
 
+/*
+ * Evict from sublist idx of ml.  If ghost_ml is given, it is the list of the
+ * ghost state the evicted headers move to.  A header's sublist is a hash of
+ * its identity, so they all land on sublist idx of ghost_ml, which is held
+ * for the whole batch rather than taken by arc_change_state() once for each
+ * of them.  Nothing takes a ghost sublist lock before that of a live state.
+ */
 static uint64_t
-arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
-    uint64_t spa, int64_t bytes)
+arc_evict_state_impl(multilist_t *ml, multilist_t *ghost_ml, int idx,
+    arc_buf_hdr_t *marker, uint64_t spa, int64_t bytes)
 {
-	multilist_sublist_t *mls;
+	multilist_sublist_t *mls, *ghost_mls = NULL;
 	uint64_t bytes_evicted = 0;
 	arc_buf_hdr_t *hdr;
 	kmutex_t *hash_lock;
@@ -3786,6 +4214,8 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
 
 	mls = multilist_sublist_lock(ml, idx);
+	if (ghost_ml != NULL)
+		ghost_mls = multilist_sublist_lock(ghost_ml, idx);
 
 	for (hdr = multilist_sublist_prev(mls, marker); hdr != NULL;
 	    hdr = multilist_sublist_prev(mls, marker)) {
@@ -3810,10 +4240,11 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 		/*
 		 * The only case where the b_spa field should ever be
 		 * zero, is the marker headers inserted by
-		 * arc_evict_state(). It's possible for multiple threads
-		 * to be calling arc_evict_state() concurrently (e.g.
-		 * dsl_pool_close() and zio_inject_fault()), so we must
-		 * skip any markers we see from these other threads.
+		 * arc_evict_state() and by the L2ARC feed threads. It's
+		 * possible for multiple threads to be calling
+		 * arc_evict_state() concurrently (e.g. dsl_pool_close()
+		 * and zio_inject_fault()), so we must skip any markers
+		 * we see from these other threads.
 		 */
 		if (hdr->b_spa == 0)
 			continue;
@@ -3879,6 +4310,8 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 		}
 	}
 
+	if (ghost_mls != NULL)
+		multilist_sublist_unlock(ghost_mls);
 	multilist_sublist_unlock(mls);
 
 	return (bytes_evicted);
@@ -3903,6 +4336,7 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 {
 	uint64_t total_evicted = 0;
 	multilist_t *ml = state->arcs_list[type];
+	multilist_t *ghost_ml = NULL;
 	int num_sublists;
 	arc_buf_hdr_t **markers;
 
@@ -3910,6 +4344,14 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 
 	num_sublists = multilist_get_num_sublists(ml);
 
+	if (state == arc_mru)
+		ghost_ml = arc_mru_ghost->arcs_list[type];
+	else if (state == arc_mfu)
+		ghost_ml = arc_mfu_ghost->arcs_list[type];
+	if (ghost_ml != NULL &&
+	    multilist_get_num_sublists(ghost_ml) != num_sublists)
+		ghost_ml = NULL;
+
 	/*
 	 * If we've tried to evict from each sublist, made some
 	 * progress, but still have not hit the target number of bytes
@@ -3948,11 +4390,14 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		 * Request that 10% of the LRUs be scanned by the superblock
 		 * shrinker.
 		 */
-		if (type == ARC_BUFC_DATA && aggsum_compare(&astat_dnode_size,
-		    arc_dnode_size_limit) > 0) {
-			arc_prune_async((aggsum_upper_bound(&astat_dnode_size) -
-			    arc_dnode_size_limit) / sizeof (dnode_t) /
-			    zfs_arc_dnode_reduce_percent);
+		if (type == ARC_BUFC_DATA) {
+			int64_t dnode_size = aggsum_approx(&astat_dnode_size);
+
+			if (dnode_size > (int64_t)arc_dnode_size_limit) {
+				arc_prune_async((dnode_size -
+				    arc_dnode_size_limit) / sizeof (dnode_t) /
+				    zfs_arc_dnode_reduce_percent);
+			}
 		}
 
 		/*
@@ -3973,8 +4418,9 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 			else
 				break;
 
-			bytes_evicted = arc_evict_state_impl(ml, sublist_idx,
-			    markers[sublist_idx], spa, bytes_remaining);
+			bytes_evicted = arc_evict_state_impl(ml, ghost_ml,
+			    sublist_idx, markers[sublist_idx], spa,
+			    bytes_remaining);
 
 			scan_evicted += bytes_evicted;
 			total_evicted += bytes_evicted;
@@ -4353,7 +4799,8 @@ arc_adjust_type(arc_state_t *state)
 
 	/*
 	 * These two loops are to ensure we skip any markers that
-	 * might be at the tail of the lists due to arc_evict_state().
+	 * might be at the tail of the lists due to arc_evict_state()
+	 * or the L2ARC feed threads.
 	 */
 
 	for (data_hdr = multilist_sublist_tail(data_mls); data_hdr != NULL;
@@ -4583,7 +5030,7 @@ arc_flush(spa_t *spa, boolean_t retry)
 static void
 arc_reduce_target_size(int64_t to_free)
 {
-	uint64_t asize = aggsum_value(&arc_size);
+	uint64_t asize = aggsum_approx(&arc_size);
 	uint64_t c = arc_c;
 
 	if (c > to_free && c - to_free > arc_c_min) {
@@ -4915,10 +5362,9 @@ arc_kmem_reap_soon(void)
 	kmem_cache_t		*prev_data_cache = NULL;
 	extern kmem_cache_t	*zio_buf_cache[];
 	extern kmem_cache_t	*zio_data_buf_cache[];
-	extern kmem_cache_t	*range_seg_cache;
 
 #ifdef _KERNEL
-	if ((aggsum_compare(&arc_meta_used, arc_meta_limit) >= 0) &&
+	if (aggsum_approx(&arc_meta_used) >= (int64_t)arc_meta_limit &&
 	    zfs_arc_meta_prune) {
 		/*
 		 * We are exceeding our meta-data cache limit.
@@ -4952,7 +5398,9 @@ arc_kmem_reap_soon(void)
 	kmem_cache_reap_now(buf_cache);
 	kmem_cache_reap_now(hdr_full_cache);
 	kmem_cache_reap_now(hdr_l2only_cache);
-	kmem_cache_reap_now(range_seg_cache);
+	zfs_btree_reap();
+	zstd_cache_reap_now();
+	abd_cache_reap_now();
 
 	if (zio_arena != NULL) {
 		/*
@@ -5053,6 +5501,42 @@ arc_adjust_cb(void *arg, zthr_t *zthr)
 	spl_fstrans_unmark(cookie);
 }
 
+#ifdef __linux__
+static uint64_t arc_shrink_ahead_direct;
+
+/*
+ * With zfs_arc_shrink_ahead_percent set, the ARC gives memory back before
+ * the kernel has to reclaim it.  Once free memory drops below arc_sys_free
+ * plus that percentage of all memory, growth is paused and arc_c is lowered
+ * on every reap check by a quarter of the shortfall; by half of it when the
+ * shrinker has seen direct reclaim since the previous check, i.e. when this
+ * was not early enough.  The ARC thereby converges on the soft limit in
+ * small steps, rather than in swings once the shrinker or arc_reap_cb()
+ * have to catch up with a deficit.
+ */
+static void
+arc_shrink_ahead(void)
+{
+	uint64_t direct = ARCSTAT(arcstat_memory_direct_count);
+	boolean_t stalled = (direct != arc_shrink_ahead_direct);
+	int64_t shortfall;
+
+	arc_shrink_ahead_direct = direct;
+	if (zfs_arc_shrink_ahead_percent == 0)
+		return;
+
+	shortfall = (int64_t)(arc_sys_free + arc_all_memory() / 100 *
+	    MIN(zfs_arc_shrink_ahead_percent, 50)) -
+	    (int64_t)arc_free_memory();
+	if (shortfall <= 0)
+		return;
+
+	arc_no_grow = B_TRUE;
+	arc_growtime = gethrtime() + SEC2NSEC(arc_grow_retry);
+	arc_reduce_target_size(shortfall >> (stalled ? 1 : 2));
+}
+#endif
+
 /* ARGSUSED */
 static boolean_t
 arc_reap_cb_check(void *arg, zthr_t *zthr)
@@ -5060,6 +5544,10 @@ arc_reap_cb_check(void *arg, zthr_t *zthr)
 	if (!arc_initialized)
 		return (B_FALSE);
 
+#ifdef __linux__
+	arc_shrink_ahead();
+#endif
+
 	int64_t free_memory = arc_available_memory();
 
 	/*
@@ -5106,6 +5594,12 @@ arc_reap_cb(void *arg, zthr_t *zthr)
 	 */
 	arc_kmem_reap_soon();
 
+	/*
+	 * Bring the decompressed buffer cache back within its limit, which
+	 * shrinks along with arc_c.
+	 */
+	arc_dcache_trim(NULL);
+
 	/*
 	 * Wait at least arc_kmem_cache_reap_retry_ms between
 	 * arc_kmem_reap_soon() calls. Without this check it is possible to
@@ -5188,7 +5682,7 @@ arc_reap_cb(void *arg, zthr_t *zthr)
 static uint64_t
 arc_evictable_memory(void)
 {
-	int64_t asize = aggsum_value(&arc_size);
+	int64_t asize = aggsum_approx(&arc_size);
 	uint64_t arc_clean =
 	    zfs_refcount_count(&arc_mru->arcs_esize[ARC_BUFC_DATA]) +
 	    zfs_refcount_count(&arc_mru->arcs_esize[ARC_BUFC_METADATA]) +
@@ -5292,30 +5786,27 @@ SPL_SHRINKER_DECLARE(arc_shrinker, arc_shrinker_func, DEFAULT_SEEKS);
 #endif /* _KERNEL */
 
 /*
- * Adapt arc info given the number of bytes we are trying to add and
- * the state that we are coming from.  This function is only called
- * when we are adding new content to the cache.
+ * Adapt the target size of the MRU list given a hit of the given number
+ * of bytes in one of the ghost states:
+ *	- if we just hit in the MRU ghost list, then increase
+ *	  the target size of the MRU list.
+ *	- if we just hit in the MFU ghost list, then increase
+ *	  the target size of the MFU list by decreasing the
+ *	  target size of the MRU list.
+ *
+ * This must be called from arc_access() while the header is still in
+ * the ghost state, since by the time the buffer is allocated it has
+ * already been moved to the MRU or MFU state.
  */
 static void
-arc_adapt(int bytes, arc_state_t *state)
+arc_adapt_p(uint64_t bytes, arc_state_t *state)
 {
 	int mult;
 	uint64_t arc_p_min = (arc_c >> arc_p_min_shift);
 	int64_t mrug_size = zfs_refcount_count(&arc_mru_ghost->arcs_size);
 	int64_t mfug_size = zfs_refcount_count(&arc_mfu_ghost->arcs_size);
 
-	if (state == arc_l2c_only)
-		return;
-
 	ASSERT(bytes > 0);
-	/*
-	 * Adapt the target size of the MRU list:
-	 *	- if we just hit in the MRU ghost list, then increase
-	 *	  the target size of the MRU list.
-	 *	- if we just hit in the MFU ghost list, then increase
-	 *	  the target size of the MFU list by decreasing the
-	 *	  target size of the MRU list.
-	 */
 	if (state == arc_mru_ghost) {
 		mult = (mrug_size >= mfug_size) ? 1 : (mfug_size / mrug_size);
 		if (!zfs_arc_p_dampener_disable)
@@ -5333,6 +5824,20 @@ arc_adapt(int bytes, arc_state_t *state)
 		arc_p = MAX(arc_p_min, arc_p - delta);
 	}
 	ASSERT((int64_t)arc_p >= 0);
+}
+
+/*
+ * Adapt arc info given the number of bytes we are trying to add and
+ * the state that we are coming from.  This function is only called
+ * when we are adding new content to the cache.
+ */
+static void
+arc_adapt(int bytes, arc_state_t *state)
+{
+	if (state == arc_l2c_only)
+		return;
+
+	ASSERT(bytes > 0);
 
 	/*
 	 * Wake reap thread if we do not have any available memory
@@ -5353,8 +5858,8 @@ arc_adapt(int bytes, arc_state_t *state)
 	 * cache size, increment the target cache size
 	 */
 	ASSERT3U(arc_c, >=, 2ULL << SPA_MAXBLOCKSHIFT);
-	if (aggsum_compare(&arc_size, arc_c - (2ULL << SPA_MAXBLOCKSHIFT)) >=
-	    0) {
+	if (aggsum_approx(&arc_size) >=
+	    (int64_t)(arc_c - (2ULL << SPA_MAXBLOCKSHIFT))) {
 		atomic_add_64(&arc_c, (int64_t)bytes);
 		if (arc_c > arc_c_max)
 			arc_c = arc_c_max;
@@ -5559,6 +6064,28 @@ arc_free_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 	}
 }
 
+/*
+ * Adapt arc_p for a hit on a header in one of the ghost states.  Headers
+ * which were only ever prefetched before being evicted are ignored; a
+ * streaming reader which runs ahead of the cache would otherwise generate
+ * a steady stream of MRU ghost hits and grow arc_p at the expense of the
+ * MFU, even though none of that data was accessed by a consumer.
+ */
+static void
+arc_adapt_ghost(arc_buf_hdr_t *hdr)
+{
+	arc_state_t *state = hdr->b_l1hdr.b_state;
+
+	ASSERT(GHOST_STATE(state));
+
+	if (HDR_PREFETCH(hdr) || HDR_PRESCIENT_PREFETCH(hdr)) {
+		ARCSTAT_BUMP(arcstat_adapt_prefetch_skip);
+		return;
+	}
+
+	arc_adapt_p(HDR_GET_LSIZE(hdr), state);
+}
+
 /*
  * This routine is called whenever a buffer is accessed.
  * NOTE: the hash lock is dropped in this function.
@@ -5636,6 +6163,7 @@ arc_access(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 		 * MFU state.
 		 */
 
+		arc_adapt_ghost(hdr);
 		if (HDR_PREFETCH(hdr) || HDR_PRESCIENT_PREFETCH(hdr)) {
 			new_state = arc_mru;
 			if (zfs_refcount_count(&hdr->b_l1hdr.b_refcnt) > 0) {
@@ -5676,6 +6204,7 @@ arc_access(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 		 * MFU state.
 		 */
 
+		arc_adapt_ghost(hdr);
 		if (HDR_PREFETCH(hdr) || HDR_PRESCIENT_PREFETCH(hdr)) {
 			/*
 			 * This is a prefetch access...
@@ -5748,6 +6277,26 @@ arc_buf_access(arc_buf_t *buf)
 	    demand, prefetch, !HDR_ISTYPE_METADATA(hdr), data, metadata, hits);
 }
 
+/*
+ * Returns how many times the data of the buffer was found in the ARC or
+ * the L2ARC, as a measure of how hot it is.
+ */
+uint32_t
+arc_buf_hits(arc_buf_t *buf)
+{
+	uint32_t hits = 0;
+
+	mutex_enter(&buf->b_evict_lock);
+	arc_buf_hdr_t *hdr = buf->b_hdr;
+	if (HDR_HAS_L1HDR(hdr)) {
+		hits = hdr->b_l1hdr.b_mru_hits + hdr->b_l1hdr.b_mfu_hits +
+		    hdr->b_l1hdr.b_l2_hits;
+	}
+	mutex_exit(&buf->b_evict_lock);
+
+	return (hits);
+}
+
 /* a generic arc_read_done_func_t which you can use */
 /* ARGSUSED */
 void
@@ -5866,7 +6415,7 @@ arc_read_done(zio_t *zio)
 	}
 
 	arc_hdr_clear_flags(hdr, ARC_FLAG_L2_EVICTED);
-	if (l2arc_noprefetch && HDR_PREFETCH(hdr))
+	if (l2arc_noprefetch && HDR_PREFETCH(hdr) && !HDR_L2_PREFETCH(hdr))
 		arc_hdr_clear_flags(hdr, ARC_FLAG_L2CACHE);
 
 	callback_list = hdr->b_l1hdr.b_acb;
@@ -6198,11 +6747,11 @@ top:
 			arc_hdr_set_flags(hdr, ARC_FLAG_PREFETCH);
 		}
 		DTRACE_PROBE1(arc__hit, arc_buf_hdr_t *, hdr);
+		arc_hdr_set_os(hdr, zb);
 		arc_access(hdr, hash_lock);
 		if (*arc_flags & ARC_FLAG_PRESCIENT_PREFETCH)
 			arc_hdr_set_flags(hdr, ARC_FLAG_PRESCIENT_PREFETCH);
-		if (*arc_flags & ARC_FLAG_L2CACHE)
-			arc_hdr_set_flags(hdr, ARC_FLAG_L2CACHE);
+		arc_hdr_set_l2cache(hdr, *arc_flags);
 		mutex_exit(hash_lock);
 		ARCSTAT_BUMP(arcstat_hits);
 		ARCSTAT_CONDSTAT(!HDR_PREFETCH(hdr),
@@ -6253,6 +6802,7 @@ top:
 				arc_hdr_destroy(hdr);
 				goto top; /* restart the IO request */
 			}
+			arc_hdr_set_os(hdr, zb);
 		} else {
 			/*
 			 * This block is in the ghost cache or encrypted data
@@ -6298,6 +6848,7 @@ top:
 			 * do this after we've called arc_access() to
 			 * avoid hitting an assert in remove_reference().
 			 */
+			arc_hdr_set_os(hdr, zb);
 			arc_access(hdr, hash_lock);
 			arc_hdr_alloc_abd(hdr, encrypted_read);
 		}
@@ -6332,8 +6883,7 @@ top:
 			arc_hdr_set_flags(hdr, ARC_FLAG_PREFETCH);
 		if (*arc_flags & ARC_FLAG_PRESCIENT_PREFETCH)
 			arc_hdr_set_flags(hdr, ARC_FLAG_PRESCIENT_PREFETCH);
-		if (*arc_flags & ARC_FLAG_L2CACHE)
-			arc_hdr_set_flags(hdr, ARC_FLAG_L2CACHE);
+		arc_hdr_set_l2cache(hdr, *arc_flags);
 		if (BP_IS_AUTHENTICATED(bp))
 			arc_hdr_set_flags(hdr, ARC_FLAG_NOAUTH);
 		if (BP_GET_LEVEL(bp) > 0)
@@ -6406,18 +6956,20 @@ top:
 			 * 3. This buffer isn't currently writing to the L2ARC.
 			 * 4. The L2ARC entry wasn't evicted, which may
 			 *    also have invalidated the vdev.
-			 * 5. This isn't prefetch and l2arc_noprefetch is set.
+			 * 5. This isn't prefetch and l2arc_noprefetch is set,
+			 *    unless secondarycache=prefetch asks for it.
 			 */
 			if (HDR_HAS_L2HDR(hdr) &&
 			    !HDR_L2_WRITING(hdr) && !HDR_L2_EVICTED(hdr) &&
-			    !(l2arc_noprefetch && HDR_PREFETCH(hdr))) {
+			    !(l2arc_noprefetch && HDR_PREFETCH(hdr) &&
+			    !HDR_L2_PREFETCH(hdr))) {
 				l2arc_read_callback_t *cb;
 				abd_t *abd;
 				uint64_t asize;
 
 				DTRACE_PROBE1(l2arc__hit, arc_buf_hdr_t *, hdr);
 				ARCSTAT_BUMP(arcstat_l2_hits);
-				atomic_inc_32(&hdr->b_l2hdr.b_hits);
+				atomic_inc_32(&hdr->b_l2hits);
 
 				cb = kmem_zalloc(sizeof (l2arc_read_callback_t),
 				    KM_SLEEP);
@@ -7120,7 +7672,7 @@ arc_write_done(zio_t *zio)
 
 zio_t *
 arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
-    blkptr_t *bp, arc_buf_t *buf, boolean_t l2arc,
+    blkptr_t *bp, arc_buf_t *buf, arc_flags_t l2arc_flags,
     const zio_prop_t *zp, arc_write_done_func_t *ready,
     arc_write_done_func_t *children_ready, arc_write_done_func_t *physdone,
     arc_write_done_func_t *done, void *private, zio_priority_t priority,
@@ -7137,8 +7689,9 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 	ASSERT(!HDR_IO_IN_PROGRESS(hdr));
 	ASSERT3P(hdr->b_l1hdr.b_acb, ==, NULL);
 	ASSERT3U(hdr->b_l1hdr.b_bufcnt, >, 0);
-	if (l2arc)
-		arc_hdr_set_flags(hdr, ARC_FLAG_L2CACHE);
+	arc_hdr_set_l2cache(hdr, l2arc_flags);
+
+	arc_hdr_set_os(hdr, zb);
 
 	if (ARC_BUF_ENCRYPTED(buf)) {
 		ASSERT(ARC_BUF_COMPRESSED(buf));
@@ -7405,13 +7958,193 @@ arc_kstat_update(kstat_t *ksp, int rw)
 }
 
 /*
- * This function *must* return indices evenly distributed between all
- * sublists of the multilist. This is needed due to how the ARC eviction
- * code is laid out; arc_evict_state() assumes ARC buffers are evenly
- * distributed between all sublists and uses this assumption when
- * deciding which sublist to evict from and how much to evict from it.
+ * The arcstats_raw kstat has the same contents as arcstats, as a line of
+ * names followed by a line of values, so that tools sampling it often can
+ * read it with a single split.  It shares the lock and update function of
+ * arcstats.
  */
-unsigned int
+static int
+arc_raw_kstat_headers(char *buf, size_t size)
+{
+	kstat_named_t *kn = (kstat_named_t *)&arc_stats;
+	int n = 0;
+
+	for (int i = 0; i < arc_ksp->ks_ndata && n < size; i++) {
+		n += snprintf(buf + n, size - n, "%s%s", i == 0 ? "" : " ",
+		    kn[i].name);
+	}
+	if (n < size)
+		n += snprintf(buf + n, size - n, "\n");
+
+	return (n < size ? 0 : ENOMEM);
+}
+
+static int
+arc_raw_kstat_data(char *buf, size_t size, void *data)
+{
+	kstat_named_t *kn = data;
+	int n = 0;
+
+	for (int i = 0; i < arc_ksp->ks_ndata && n < size; i++) {
+		const char *sep = (i == 0) ? "" : " ";
+
+		if (kn[i].data_type == KSTAT_DATA_INT64) {
+			n += snprintf(buf + n, size - n, "%s%lld", sep,
+			    (longlong_t)kn[i].value.i64);
+		} else {
+			n += snprintf(buf + n, size - n, "%s%llu", sep,
+			    (u_longlong_t)kn[i].value.ui64);
+		}
+	}
+	if (n < size)
+		n += snprintf(buf + n, size - n, "\n");
+
+	return (n < size ? 0 : ENOMEM);
+}
+
+static void *
+arc_raw_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	return (n == 0 ? &arc_stats : NULL);
+}
+
+/*
+ * The arcstats_objset kstat shows the residency of every objset with
+ * blocks in arc_mru or arc_mfu, from a snapshot taken when it is read.
+ */
+typedef struct arc_os_kstat {
+	char		aok_pool[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t	aok_spa;
+	uint64_t	aok_objset;
+	uint64_t	aok_mru_size;
+	uint64_t	aok_mfu_size;
+} arc_os_kstat_t;
+
+static kstat_t *arc_os_ksp;
+static arc_os_kstat_t *arc_os_snap;
+static int arc_os_nsnap;
+static int arc_os_nalloc;
+
+static void
+arc_os_kstat_snapshot(void)
+{
+	int count = 0, n = 0;
+
+	if (arc_os_snap != NULL) {
+		vmem_free(arc_os_snap, arc_os_nalloc * sizeof (arc_os_kstat_t));
+		arc_os_snap = NULL;
+		arc_os_nsnap = arc_os_nalloc = 0;
+	}
+
+	/* Free the unreferenced entries and count the others */
+	for (int i = 0; i < ARC_OS_BUCKETS; i++) {
+		arc_os_bucket_t *aob = &arc_os_buckets[i];
+		arc_os_stat_t *aos, *next;
+
+		mutex_enter(&aob->aob_lock);
+		for (aos = list_head(&aob->aob_list); aos != NULL; aos = next) {
+			next = list_next(&aob->aob_list, aos);
+			if (aos->aos_refcnt == 0) {
+				list_remove(&aob->aob_list, aos);
+				kmem_free(aos, sizeof (arc_os_stat_t));
+			} else if (aos->aos_mru_size + aos->aos_mfu_size != 0) {
+				count++;
+			}
+		}
+		mutex_exit(&aob->aob_lock);
+	}
+	if (count == 0)
+		return;
+
+	arc_os_snap = vmem_zalloc(count * sizeof (arc_os_kstat_t), KM_SLEEP);
+	arc_os_nalloc = count;
+	for (int i = 0; i < ARC_OS_BUCKETS && n < count; i++) {
+		arc_os_bucket_t *aob = &arc_os_buckets[i];
+
+		mutex_enter(&aob->aob_lock);
+		for (arc_os_stat_t *aos = list_head(&aob->aob_list);
+		    aos != NULL && n < count;
+		    aos = list_next(&aob->aob_list, aos)) {
+			if (aos->aos_mru_size + aos->aos_mfu_size == 0)
+				continue;
+
+			arc_os_snap[n].aok_spa = aos->aos_spa;
+			arc_os_snap[n].aok_objset = aos->aos_objset;
+			arc_os_snap[n].aok_mru_size = aos->aos_mru_size;
+			arc_os_snap[n].aok_mfu_size = aos->aos_mfu_size;
+			n++;
+		}
+		mutex_exit(&aob->aob_lock);
+	}
+	arc_os_nsnap = n;
+
+	/* Pools only know their load guid while they are imported */
+	mutex_enter(&spa_namespace_lock);
+	for (n = 0; n < arc_os_nsnap; n++) {
+		arc_os_kstat_t *aok = &arc_os_snap[n];
+		spa_t *spa = NULL;
+
+		while ((spa = spa_next(spa)) != NULL) {
+			if (spa_load_guid(spa) == aok->aok_spa)
+				break;
+		}
+		if (spa != NULL) {
+			(void) strlcpy(aok->aok_pool, spa_name(spa),
+			    sizeof (aok->aok_pool));
+		} else {
+			(void) snprintf(aok->aok_pool, sizeof (aok->aok_pool),
+			    "%llx", (u_longlong_t)aok->aok_spa);
+		}
+	}
+	mutex_exit(&spa_namespace_lock);
+}
+
+static int
+arc_os_kstat_update(kstat_t *ksp, int rw)
+{
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	arc_os_kstat_snapshot();
+
+	return (0);
+}
+
+static int
+arc_os_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-24s %-20s %-20s %-20s\n",
+	    "pool", "objset", "mru_size", "mfu_size");
+
+	return (0);
+}
+
+static int
+arc_os_kstat_data(char *buf, size_t size, void *data)
+{
+	arc_os_kstat_t *aok = data;
+
+	(void) snprintf(buf, size, "%-24s %-20llu %-20llu %-20llu\n",
+	    aok->aok_pool, (u_longlong_t)aok->aok_objset,
+	    (u_longlong_t)aok->aok_mru_size, (u_longlong_t)aok->aok_mfu_size);
+
+	return (0);
+}
+
+static void *
+arc_os_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	return (n < arc_os_nsnap ? &arc_os_snap[n] : NULL);
+}
+
+/*
+ * This function *must* return indices evenly distributed between all
+ * sublists of the multilist. This is needed due to how the ARC eviction
+ * code is laid out; arc_evict_state() assumes ARC buffers are evenly
+ * distributed between all sublists and uses this assumption when
+ * deciding which sublist to evict from and how much to evict from it.
+ */
+unsigned int
 arc_state_multilist_index_func(multilist_t *ml, void *obj)
 {
 	arc_buf_hdr_t *hdr = obj;
@@ -7710,6 +8443,15 @@ arc_init(void)
 	uint64_t percent, allmem = arc_all_memory();
 	mutex_init(&arc_adjust_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&arc_adjust_waiters_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&arc_dcache_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&arc_dcache_list, sizeof (arc_dcache_entry_t),
+	    offsetof(arc_dcache_entry_t, de_node));
+	for (int i = 0; i < ARC_OS_BUCKETS; i++) {
+		mutex_init(&arc_os_buckets[i].aob_lock, NULL, MUTEX_DEFAULT,
+		    NULL);
+		list_create(&arc_os_buckets[i].aob_list,
+		    sizeof (arc_os_stat_t), offsetof(arc_os_stat_t, aos_node));
+	}
 
 	arc_min_prefetch_ms = 1000;
 	arc_min_prescient_prefetch_ms = 6000;
@@ -7792,6 +8534,29 @@ arc_init(void)
 		arc_ksp->ks_data = &arc_stats;
 		arc_ksp->ks_update = arc_kstat_update;
 		kstat_install(arc_ksp);
+
+		arc_raw_ksp = kstat_create("zfs", 0, "arcstats_raw", "misc",
+		    KSTAT_TYPE_RAW, 1, KSTAT_FLAG_VIRTUAL);
+	}
+
+	if (arc_raw_ksp != NULL) {
+		arc_raw_ksp->ks_data = &arc_stats;
+		arc_raw_ksp->ks_lock = arc_ksp->ks_lock;
+		arc_raw_ksp->ks_update = arc_kstat_update;
+		kstat_set_raw_ops(arc_raw_ksp, arc_raw_kstat_headers,
+		    arc_raw_kstat_data, arc_raw_kstat_addr);
+		kstat_install(arc_raw_ksp);
+	}
+
+	arc_os_ksp = kstat_create("zfs", 0, "arcstats_objset", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (arc_os_ksp != NULL) {
+		arc_os_ksp->ks_data = NULL;
+		arc_os_ksp->ks_ndata = UINT32_MAX;
+		arc_os_ksp->ks_update = arc_os_kstat_update;
+		kstat_set_raw_ops(arc_os_ksp, arc_os_kstat_headers,
+		    arc_os_kstat_data, arc_os_kstat_addr);
+		kstat_install(arc_os_ksp);
 	}
 
 	arc_adjust_zthr = zthr_create_timer(arc_adjust_cb_check,
@@ -7845,6 +8610,16 @@ arc_fini(void)
 
 	arc_initialized = B_FALSE;
 
+	if (arc_os_ksp != NULL) {
+		kstat_delete(arc_os_ksp);
+		arc_os_ksp = NULL;
+	}
+
+	if (arc_raw_ksp != NULL) {
+		kstat_delete(arc_raw_ksp);
+		arc_raw_ksp = NULL;
+	}
+
 	if (arc_ksp != NULL) {
 		kstat_delete(arc_ksp);
 		arc_ksp = NULL;
@@ -7871,6 +8646,20 @@ arc_fini(void)
 	mutex_destroy(&arc_adjust_lock);
 	cv_destroy(&arc_adjust_waiters_cv);
 
+	/* Every cached hdr was evicted by arc_flush() above */
+	ASSERT0(arc_dcache_size);
+	list_destroy(&arc_dcache_list);
+	mutex_destroy(&arc_dcache_lock);
+
+	/* Only L2-only hdrs, which don't reference an objset, remain */
+	arc_os_kstat_snapshot();
+	ASSERT0(arc_os_nsnap);
+	for (int i = 0; i < ARC_OS_BUCKETS; i++) {
+		ASSERT(list_is_empty(&arc_os_buckets[i].aob_list));
+		list_destroy(&arc_os_buckets[i].aob_list);
+		mutex_destroy(&arc_os_buckets[i].aob_lock);
+	}
+
 	/*
 	 * buf_fini() must proceed arc_state_fini() because buf_fin() may
 	 * trigger the release of kmem magazines, which can callback to
@@ -7952,7 +8741,11 @@ arc_fini(void)
  * sure we adapt to compression effects (which might significantly reduce
  * the data volume we write to L2ARC). The thread that does this is
  * l2arc_feed_thread(), illustrated below; example sizes are included to
- * provide a better sense of ratio than this diagram:
+ * provide a better sense of ratio than this diagram.  Every cache device
+ * has its own feed thread, so that several devices fill in parallel, and
+ * each of them keeps a marker in every sublist it scans, so that its next
+ * scan picks up where the previous one stopped rather than passing over
+ * the same buffers at the tail again:
  *
  *	       head -->                        tail
  *	        +---------------------+----------+
@@ -7980,7 +8773,10 @@ arc_fini(void)
  * the ARC lists have moved there due to inactivity.
  *
  * 4. If the ARC evicts faster than the L2ARC can maintain a headroom,
- * then the L2ARC simply misses copying some buffers.  This serves as a
+ * then the L2ARC simply misses copying some buffers.  Devices which write
+ * quickly enough grow their write size in steps of l2arc_write_max, up to
+ * l2arc_write_scale times that, for as long as the ARC keeps evicting more
+ * eligible data than they are fed.  This serves as a
  * pressure valve to prevent heavy read workloads from both stalling the ARC
  * with waits and clogging the L2ARC with writes.  This also helps prevent
  * the potential for the L2ARC to churn if it attempts to cache content too
@@ -8013,7 +8809,9 @@ arc_fini(void)
  *
  *	l2arc_write_max		max write bytes per interval
  *	l2arc_write_boost	extra write bytes during device warmup
+ *	l2arc_write_scale	max multiple of l2arc_write_max per device
  *	l2arc_noprefetch	skip caching prefetched buffers
+ *	l2arc_exclusive		drop the L2ARC copy of buffers read back
  *	l2arc_headroom		number of max device writes to precache
  *	l2arc_headroom_boost	when we find compressed buffers during ARC
  *				scanning, we multiply headroom by this
@@ -8031,8 +8829,28 @@ arc_fini(void)
  *	l2arc_write_size()	calculate how much to write
  *	l2arc_write_interval()	calculate sleep delay between writes
  *
- * These three functions determine what to write, how much, and how quickly
- * to send writes.
+ * l2arc_feed_adapt() then adjusts the write size of each device for its
+ * next feed.  These functions determine what to write, how much, and how
+ * quickly to send writes.
+ *
+ * L2ARC persistence:
+ *
+ * When writing buffers to L2ARC, we periodically add some metadata to
+ * make sure we can pick them up after reboot, thus dramatically reducing
+ * the impact that any downtime has on the performance of storage systems
+ * with large caches.  Every buffer written is appended to a log block,
+ * which is written out between the buffers once it is full and linked to
+ * the previous log block; a small device header at the start of the
+ * device points to the newest one.  After reboot or pool import, a
+ * rebuild thread per device walks this chain and recreates the L2-only
+ * ARC headers, see l2arc_rebuild() for the details.  The on-disk format
+ * is described in arc_impl.h.
+ *
+ * Log blocks are never evicted explicitly.  A log block, and everything
+ * older than it, is considered stale as soon as it or any of the buffers
+ * it describes falls between the write hand and the evict hand, which are
+ * both recorded in the device header.  Persistence can be disabled with
+ * the l2arc_rebuild_enabled tunable.
  */
 
 static boolean_t
@@ -8044,18 +8862,24 @@ l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *hdr)
 	 * 2. is already cached on the L2ARC.
 	 * 3. has an I/O in progress (it may be an incomplete read).
 	 * 4. is flagged not eligible (zfs property).
+	 * 5. is only to be cached once it is in the MFU state (zfs
+	 *    property), and is not.
 	 */
 	if (hdr->b_spa != spa_guid || HDR_HAS_L2HDR(hdr) ||
 	    HDR_IO_IN_PROGRESS(hdr) || !HDR_L2CACHE(hdr))
 		return (B_FALSE);
 
+	if (HDR_L2_MFUONLY(hdr) && HDR_HAS_L1HDR(hdr) &&
+	    hdr->b_l1hdr.b_state != arc_mfu)
+		return (B_FALSE);
+
 	return (B_TRUE);
 }
 
 static uint64_t
-l2arc_write_size(void)
+l2arc_write_size(l2arc_dev_t *dev)
 {
-	uint64_t size;
+	uint64_t size, dev_size;
 
 	/*
 	 * Make sure our globals have meaningful values in case the user
@@ -8069,13 +8893,75 @@ l2arc_write_size(void)
 		size = l2arc_write_max = L2ARC_WRITE_SIZE;
 	}
 
+	/*
+	 * Scale the write size by the multiplier l2arc_feed_adapt() has
+	 * settled on for this device.
+	 */
+	dev->l2ad_feed_mult = MAX(1, MIN(dev->l2ad_feed_mult,
+	    l2arc_write_scale));
+	size *= dev->l2ad_feed_mult;
+
 	if (arc_warm == B_FALSE)
 		size += l2arc_write_boost;
 
+	/*
+	 * Make sure the write size, plus the worst case log block overhead,
+	 * fits on the cache device.  l2arc_evict() relies on this to not
+	 * wrap around the device more than once per feed cycle.  A scaled
+	 * up write size is simply dropped back to l2arc_write_max first.
+	 */
+	dev_size = dev->l2ad_end - dev->l2ad_start;
+	if (dev->l2ad_feed_mult > 1 &&
+	    size + l2arc_log_blk_overhead(size, dev) >= dev_size) {
+		dev->l2ad_feed_mult = 1;
+		size = l2arc_write_max;
+		if (arc_warm == B_FALSE)
+			size += l2arc_write_boost;
+	}
+	if (size + l2arc_log_blk_overhead(size, dev) >= dev_size) {
+		cmn_err(CE_NOTE, "l2arc_write_max or l2arc_write_boost plus "
+		    "the log block overhead exceeds the size of the cache "
+		    "device (guid %llu), resetting them to the default (%d)",
+		    (u_longlong_t)dev->l2ad_vdev->vdev_guid, L2ARC_WRITE_SIZE);
+		size = l2arc_write_max = l2arc_write_boost = L2ARC_WRITE_SIZE;
+
+		if (arc_warm == B_FALSE)
+			size += l2arc_write_boost;
+	}
+
 	return (size);
 
 }
 
+/*
+ * Adjust the write size of a device for its next feed.  The ARC evicting
+ * more L2ARC eligible data since the last feed than its share that was
+ * written to this device means that the L2ARC is falling behind; if the
+ * write also completed within half of the shortest feed interval, the
+ * device has bandwidth to spare and the write size grows by another
+ * l2arc_write_max.  Once less than half of the wanted size can be found
+ * on the ARC lists, it shrinks again.
+ */
+static void
+l2arc_feed_adapt(l2arc_dev_t *dev, uint64_t wanted, uint64_t wrote,
+    clock_t took)
+{
+	uint64_t eligible = ARCSTAT(arcstat_evict_l2_eligible);
+	uint64_t evicted = (eligible - dev->l2ad_feed_evicted) /
+	    MAX(l2arc_ndev, 1);
+
+	dev->l2ad_feed_evicted = eligible;
+
+	if (wrote > wanted / 2) {
+		if (evicted > wrote &&
+		    took < (hz * l2arc_feed_min_ms) / 2000 &&
+		    dev->l2ad_feed_mult < l2arc_write_scale)
+			dev->l2ad_feed_mult++;
+	} else if (dev->l2ad_feed_mult > 1) {
+		dev->l2ad_feed_mult--;
+	}
+}
+
 static clock_t
 l2arc_write_interval(clock_t began, uint64_t wanted, uint64_t wrote)
 {
@@ -8098,67 +8984,6 @@ l2arc_write_interval(clock_t began, uint64_t wanted, uint64_t wrote)
 	return (next);
 }
 
-/*
- * Cycle through L2ARC devices.  This is how L2ARC load balances.
- * If a device is returned, this also returns holding the spa config lock.
- */
-static l2arc_dev_t *
-l2arc_dev_get_next(void)
-{
-	l2arc_dev_t *first, *next = NULL;
-
-	/*
-	 * Lock out the removal of spas (spa_namespace_lock), then removal
-	 * of cache devices (l2arc_dev_mtx).  Once a device has been selected,
-	 * both locks will be dropped and a spa config lock held instead.
-	 */
-	mutex_enter(&spa_namespace_lock);
-	mutex_enter(&l2arc_dev_mtx);
-
-	/* if there are no vdevs, there is nothing to do */
-	if (l2arc_ndev == 0)
-		goto out;
-
-	first = NULL;
-	next = l2arc_dev_last;
-	do {
-		/* loop around the list looking for a non-faulted vdev */
-		if (next == NULL) {
-			next = list_head(l2arc_dev_list);
-		} else {
-			next = list_next(l2arc_dev_list, next);
-			if (next == NULL)
-				next = list_head(l2arc_dev_list);
-		}
-
-		/* if we have come back to the start, bail out */
-		if (first == NULL)
-			first = next;
-		else if (next == first)
-			break;
-
-	} while (vdev_is_dead(next->l2ad_vdev));
-
-	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
-		next = NULL;
-
-	l2arc_dev_last = next;
-
-out:
-	mutex_exit(&l2arc_dev_mtx);
-
-	/*
-	 * Grab the config lock to prevent the 'next' device from being
-	 * removed while we are writing to it.
-	 */
-	if (next != NULL)
-		spa_config_enter(next->l2ad_spa, SCL_L2ARC, next, RW_READER);
-	mutex_exit(&spa_namespace_lock);
-
-	return (next);
-}
-
 /*
  * Free buffers that were tagged for destruction.
  */
@@ -8406,6 +9231,7 @@ l2arc_read_done(zio_t *zio)
 	arc_buf_hdr_t *hdr;
 	kmutex_t *hash_lock;
 	boolean_t valid_cksum;
+	boolean_t fused_cksum = B_FALSE;
 	boolean_t using_rdata = (BP_IS_ENCRYPTED(&cb->l2rcb_bp) &&
 	    (cb->l2rcb_flags & ZIO_FLAG_RAW_ENCRYPT));
 
@@ -8432,6 +9258,24 @@ l2arc_read_done(zio_t *zio)
 			if (using_rdata) {
 				abd_copy(hdr->b_crypt_hdr.b_rabd,
 				    cb->l2rcb_abd, arc_hdr_size(hdr));
+			} else if (BP_GET_CHECKSUM(&cb->l2rcb_bp) ==
+			    ZIO_CHECKSUM_FLETCHER_4 &&
+			    !BP_USES_CRYPT(&cb->l2rcb_bp)) {
+				/*
+				 * Verify the checksum while moving the data
+				 * out of the temporary buffer, instead of
+				 * reading it again in arc_cksum_is_equal().
+				 */
+				zio_cksum_t zc;
+
+				ASSERT3U(BP_GET_PSIZE(&cb->l2rcb_bp), ==,
+				    arc_hdr_size(hdr));
+				abd_copy_fletcher_4(hdr->b_l1hdr.b_pabd,
+				    cb->l2rcb_abd, arc_hdr_size(hdr),
+				    BP_SHOULD_BYTESWAP(&cb->l2rcb_bp), &zc);
+				valid_cksum = ZIO_CHECKSUM_EQUAL(zc,
+				    cb->l2rcb_bp.blk_cksum);
+				fused_cksum = B_TRUE;
 			} else {
 				abd_copy(hdr->b_l1hdr.b_pabd,
 				    cb->l2rcb_abd, arc_hdr_size(hdr));
@@ -8472,7 +9316,8 @@ l2arc_read_done(zio_t *zio)
 	zio->io_bp_copy = cb->l2rcb_bp;	/* XXX fix in L2ARC 2.0	*/
 	zio->io_bp = &zio->io_bp_copy;	/* XXX fix in L2ARC 2.0	*/
 
-	valid_cksum = arc_cksum_is_equal(hdr, zio);
+	if (!fused_cksum)
+		valid_cksum = arc_cksum_is_equal(hdr, zio);
 
 	/*
 	 * b_rabd will always match the data as it exists on disk if it is
@@ -8484,6 +9329,20 @@ l2arc_read_done(zio_t *zio)
 
 	if (valid_cksum && tfm_error == 0 && zio->io_error == 0 &&
 	    !HDR_L2_EVICTED(hdr)) {
+		/*
+		 * In exclusive mode a block read back from the L2ARC lives
+		 * in the ARC only.  The L2ARC copy is dropped rather than
+		 * kept as a duplicate, and the block may be fed to the
+		 * L2ARC again once it nears eviction.
+		 */
+		if (l2arc_exclusive && HDR_HAS_L2HDR(hdr)) {
+			l2arc_dev_t *dev = hdr->b_l2hdr.b_dev;
+
+			mutex_enter(&dev->l2ad_mtx);
+			if (HDR_HAS_L2HDR(hdr))
+				arc_hdr_l2hdr_destroy(hdr);
+			mutex_exit(&dev->l2ad_mtx);
+		}
 		mutex_exit(hash_lock);
 		zio->io_private = hdr;
 		arc_read_done(zio);
@@ -8530,14 +9389,12 @@ l2arc_read_done(zio_t *zio)
  * performance.
  *
  * Currently the metadata lists are hit first, MFU then MRU, followed by
- * the data lists.  This function returns a locked list, and also returns
- * the lock pointer.
+ * the data lists.
  */
-static multilist_sublist_t *
-l2arc_sublist_lock(int list_num)
+static multilist_t *
+l2arc_feed_list(int list_num)
 {
 	multilist_t *ml = NULL;
-	unsigned int idx;
 
 	ASSERT(list_num >= 0 && list_num < L2ARC_FEED_TYPES);
 
@@ -8558,6 +9415,19 @@ l2arc_sublist_lock(int list_num)
 		return (NULL);
 	}
 
+	return (ml);
+}
+
+/*
+ * Returns a locked sublist of the given feed list, along with the marker
+ * of the device in that sublist.
+ */
+static multilist_sublist_t *
+l2arc_sublist_lock(l2arc_dev_t *dev, int list_num, arc_buf_hdr_t **marker)
+{
+	multilist_t *ml = l2arc_feed_list(list_num);
+	unsigned int idx;
+
 	/*
 	 * Return a randomly-selected sublist. This is acceptable
 	 * because the caller feeds only a little bit of data for each
@@ -8565,14 +9435,73 @@ l2arc_sublist_lock(int list_num)
 	 * sublists being selected.
 	 */
 	idx = multilist_get_random_index(ml);
+	*marker = dev->l2ad_markers[list_num][idx];
 	return (multilist_sublist_lock(ml, idx));
 }
 
+/*
+ * Allocate the markers of a device, one per sublist of each feed list.
+ * They start out at the tails of the sublists.  A b_spa of 0 marks them
+ * as markers, just like those of arc_evict_state().
+ */
+static void
+l2arc_markers_alloc(l2arc_dev_t *dev)
+{
+	for (int try = 0; try < L2ARC_FEED_TYPES; try++) {
+		multilist_t *ml = l2arc_feed_list(try);
+		int num_sublists = multilist_get_num_sublists(ml);
+
+		dev->l2ad_markers[try] = kmem_zalloc(num_sublists *
+		    sizeof (arc_buf_hdr_t *), KM_SLEEP);
+		for (int i = 0; i < num_sublists; i++) {
+			arc_buf_hdr_t *marker;
+			multilist_sublist_t *mls;
+
+			marker = kmem_cache_alloc(hdr_full_cache, KM_SLEEP);
+			marker->b_spa = 0;
+			dev->l2ad_markers[try][i] = marker;
+
+			mls = multilist_sublist_lock(ml, i);
+			multilist_sublist_insert_tail(mls, marker);
+			multilist_sublist_unlock(mls);
+		}
+	}
+}
+
+static void
+l2arc_markers_free(l2arc_dev_t *dev)
+{
+	for (int try = 0; try < L2ARC_FEED_TYPES; try++) {
+		multilist_t *ml = l2arc_feed_list(try);
+		int num_sublists = multilist_get_num_sublists(ml);
+
+		for (int i = 0; i < num_sublists; i++) {
+			arc_buf_hdr_t *marker = dev->l2ad_markers[try][i];
+			multilist_sublist_t *mls;
+
+			mls = multilist_sublist_lock(ml, i);
+			multilist_sublist_remove(mls, marker);
+			multilist_sublist_unlock(mls);
+
+			kmem_cache_free(hdr_full_cache, marker);
+		}
+		kmem_free(dev->l2ad_markers[try],
+		    num_sublists * sizeof (arc_buf_hdr_t *));
+		dev->l2ad_markers[try] = NULL;
+	}
+}
+
 /*
  * Evict buffers from the device write hand to the distance specified in
  * bytes.  This distance may span populated buffers, it may span nothing.
  * This is clearing a region on the L2ARC device ready for writing.
  * If the 'all' boolean is set, every buffer is evicted.
+ *
+ * When there is not enough room left before the end of the device, the
+ * remainder of the device is evicted and the write hand is moved back to
+ * the start of the device, after which the eviction is repeated from
+ * there.  The distance of that second pass can never reach the end of the
+ * device again, l2arc_write_size() makes sure of that.
  */
 static void
 l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
@@ -8581,30 +9510,42 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	arc_buf_hdr_t *hdr, *hdr_prev;
 	kmutex_t *hash_lock;
 	uint64_t taddr;
+	boolean_t rerun;
 
 	buflist = &dev->l2ad_buflist;
 
-	if (!all && dev->l2ad_first) {
-		/*
-		 * This is the first sweep through the device.  There is
-		 * nothing to evict.
-		 */
-		return;
-	}
+	/*
+	 * Log blocks are written in between the buffers, so make room for
+	 * the worst case number of them as well.
+	 */
+	if (!all)
+		distance += l2arc_log_blk_overhead(distance, dev);
 
-	if (dev->l2ad_hand >= (dev->l2ad_end - (2 * distance))) {
+top:
+	rerun = B_FALSE;
+	if (!all && dev->l2ad_hand >= (dev->l2ad_end - distance)) {
 		/*
 		 * When nearing the end of the device, evict to the end
 		 * before the device write hand jumps to the start.
 		 */
+		rerun = B_TRUE;
 		taddr = dev->l2ad_end;
 	} else {
 		taddr = dev->l2ad_hand + distance;
 	}
+
+	if (!all && dev->l2ad_first) {
+		/*
+		 * This is the first sweep through the device.  There is
+		 * nothing to evict.
+		 */
+		goto out;
+	}
+
 	DTRACE_PROBE4(l2arc__evict, l2arc_dev_t *, dev, list_t *, buflist,
 	    uint64_t, taddr, boolean_t, all);
 
-top:
+retry:
 	mutex_enter(&dev->l2ad_mtx);
 	for (hdr = list_tail(buflist); hdr; hdr = hdr_prev) {
 		hdr_prev = list_prev(buflist, hdr);
@@ -8625,7 +9566,7 @@ top:
 			mutex_exit(&dev->l2ad_mtx);
 			mutex_enter(hash_lock);
 			mutex_exit(hash_lock);
-			goto top;
+			goto retry;
 		}
 
 		/*
@@ -8674,6 +9615,23 @@ top:
 		mutex_exit(hash_lock);
 	}
 	mutex_exit(&dev->l2ad_mtx);
+
+out:
+	if (all)
+		return;
+
+	if (rerun) {
+		/*
+		 * The end of the device has been evicted, move both hands
+		 * back to the start and evict ahead of the write hand again.
+		 */
+		dev->l2ad_hand = dev->l2ad_start;
+		dev->l2ad_evict = dev->l2ad_start;
+		dev->l2ad_first = B_FALSE;
+		goto top;
+	}
+
+	dev->l2ad_evict = MAX(dev->l2ad_evict, taddr);
 }
 
 /*
@@ -8826,8 +9784,11 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	 * Copy buffers for L2ARC writing.
 	 */
 	for (int try = 0; try < L2ARC_FEED_TYPES; try++) {
-		multilist_sublist_t *mls = l2arc_sublist_lock(try);
+		arc_buf_hdr_t *marker;
+		multilist_sublist_t *mls = l2arc_sublist_lock(dev, try,
+		    &marker);
 		uint64_t passed_sz = 0;
+		boolean_t warm = arc_warm;
 
 		VERIFY3P(mls, !=, NULL);
 
@@ -8835,12 +9796,14 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		 * L2ARC fast warmup.
 		 *
 		 * Until the ARC is warm and starts to evict, read from the
-		 * head of the ARC lists rather than the tail.
+		 * head of the ARC lists rather than the tail.  Once it is,
+		 * continue from the device's marker in the sublist, which
+		 * sits where the previous scan of this sublist stopped.
 		 */
-		if (arc_warm == B_FALSE)
+		if (warm == B_FALSE)
 			hdr = multilist_sublist_head(mls);
 		else
-			hdr = multilist_sublist_tail(mls);
+			hdr = multilist_sublist_prev(mls, marker);
 
 		headroom = target_sz * l2arc_headroom;
 		if (zfs_arc_compression_enabled)
@@ -8850,11 +9813,15 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			kmutex_t *hash_lock;
 			abd_t *to_write = NULL;
 
-			if (arc_warm == B_FALSE)
+			if (warm == B_FALSE)
 				hdr_prev = multilist_sublist_next(mls, hdr);
 			else
 				hdr_prev = multilist_sublist_prev(mls, hdr);
 
+			/* Skip the markers of the eviction and of devices. */
+			if (hdr->b_spa == 0)
+				continue;
+
 			hash_lock = HDR_LOCK(hdr);
 			if (!mutex_tryenter(hash_lock)) {
 				/*
@@ -8969,7 +9936,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			}
 
 			hdr->b_l2hdr.b_dev = dev;
-			hdr->b_l2hdr.b_hits = 0;
+			hdr->b_l2hits = 0;
 
 			hdr->b_l2hdr.b_daddr = dev->l2ad_hand;
 			arc_hdr_set_flags(hdr, ARC_FLAG_HAS_L2HDR);
@@ -8996,9 +9963,36 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			dev->l2ad_hand += asize;
 			vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
 
+			/*
+			 * Record the buffer in the current log block, so
+			 * that it can be found again after a reboot.
+			 */
+			boolean_t commit = l2arc_log_blk_insert(dev, hdr);
+
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
+
+			if (commit)
+				l2arc_log_blk_commit(dev, pio);
+		}
+
+		/*
+		 * Move the marker up to the header the scan stopped at, so
+		 * the next scan starts with it.  The sublist lock has been
+		 * held throughout, so that header is still on the sublist.
+		 * A scan that reached the head starts over from the tail.
+		 */
+		if (warm == B_TRUE) {
+			if (hdr == NULL) {
+				multilist_sublist_remove(mls, marker);
+				multilist_sublist_insert_tail(mls, marker);
+			} else {
+				while (multilist_sublist_prev(mls, marker) !=
+				    hdr)
+					multilist_sublist_move_forward(mls,
+					    marker);
+			}
 		}
 
 		multilist_sublist_unlock(mls);
@@ -9021,119 +10015,128 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	ARCSTAT_INCR(arcstat_l2_lsize, write_lsize);
 	ARCSTAT_INCR(arcstat_l2_psize, write_psize);
 
-	/*
-	 * Bump device hand to the device start if it is approaching the end.
-	 * l2arc_evict() will already have evicted ahead for this case.
-	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
-		dev->l2ad_hand = dev->l2ad_start;
-		dev->l2ad_first = B_FALSE;
-	}
-
 	dev->l2ad_writing = B_TRUE;
 	(void) zio_wait(pio);
 	dev->l2ad_writing = B_FALSE;
 
+	/*
+	 * Only point the device header at the log blocks written above
+	 * once they are known to be on stable storage.
+	 */
+	l2arc_dev_hdr_update(dev);
+
 	return (write_asize);
 }
 
 /*
- * This thread feeds the L2ARC at regular intervals.  This is the beating
- * heart of the L2ARC.
+ * Feed a device once: evict what is about to be overwritten and write
+ * ARC buffers in its place.  Returns when the next feed is due.
  */
-/* ARGSUSED */
-static void
-l2arc_feed_thread(void *unused)
+static clock_t
+l2arc_feed(l2arc_dev_t *dev)
 {
-	callb_cpr_t cpr;
-	l2arc_dev_t *dev;
-	spa_t *spa;
+	spa_t *spa = dev->l2ad_spa;
 	uint64_t size, wrote;
-	clock_t begin, next = ddi_get_lbolt();
-	fstrans_cookie_t cookie;
+	clock_t begin = ddi_get_lbolt();
+	clock_t next = begin + hz;
 
-	CALLB_CPR_INIT(&cpr, &l2arc_feed_thr_lock, callb_generic_cpr, FTAG);
+	/*
+	 * Devices which are still being rebuilt are left alone; their
+	 * hands are not known until the rebuild has read the device header.
+	 */
+	if (dev->l2ad_rebuild)
+		return (next);
 
-	mutex_enter(&l2arc_feed_thr_lock);
+	/*
+	 * Grab the config lock to prevent the device from being removed
+	 * while we are writing to it.  It is only tried, since the removal
+	 * may hold it as writer while it waits for this thread to exit.
+	 */
+	if (!spa_config_tryenter(spa, SCL_L2ARC, dev, RW_READER))
+		return (next);
 
-	cookie = spl_fstrans_mark();
-	while (l2arc_thread_exit == 0) {
-		CALLB_CPR_SAFE_BEGIN(&cpr);
-		(void) cv_timedwait_sig(&l2arc_feed_thr_cv,
-		    &l2arc_feed_thr_lock, next);
-		CALLB_CPR_SAFE_END(&cpr, &l2arc_feed_thr_lock);
-		next = ddi_get_lbolt() + hz;
+	if (vdev_is_dead(dev->l2ad_vdev)) {
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		return (next);
+	}
 
-		/*
-		 * Quick check for L2ARC devices.
-		 */
-		mutex_enter(&l2arc_dev_mtx);
-		if (l2arc_ndev == 0) {
-			mutex_exit(&l2arc_dev_mtx);
-			continue;
-		}
-		mutex_exit(&l2arc_dev_mtx);
-		begin = ddi_get_lbolt();
+	/*
+	 * If the pool is read-only then force the feed thread to
+	 * sleep a little longer.
+	 */
+	if (!spa_writeable(spa)) {
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		return (ddi_get_lbolt() + 5 * l2arc_feed_secs * hz);
+	}
 
-		/*
-		 * This selects the next l2arc device to write to, and in
-		 * doing so the next spa to feed from: dev->l2ad_spa.   This
-		 * will return NULL if there are now no l2arc devices or if
-		 * they are all faulted.
-		 *
-		 * If a device is returned, its spa's config lock is also
-		 * held to prevent device removal.  l2arc_dev_get_next()
-		 * will grab and release l2arc_dev_mtx.
-		 */
-		if ((dev = l2arc_dev_get_next()) == NULL)
-			continue;
+	/*
+	 * Avoid contributing to memory pressure.
+	 */
+	if (arc_reclaim_needed()) {
+		ARCSTAT_BUMP(arcstat_l2_abort_lowmem);
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		return (next);
+	}
 
-		spa = dev->l2ad_spa;
-		ASSERT3P(spa, !=, NULL);
+	ARCSTAT_BUMP(arcstat_l2_feeds);
 
-		/*
-		 * If the pool is read-only then force the feed thread to
-		 * sleep a little longer.
-		 */
-		if (!spa_writeable(spa)) {
-			next = ddi_get_lbolt() + 5 * l2arc_feed_secs * hz;
-			spa_config_exit(spa, SCL_L2ARC, dev);
-			continue;
-		}
+	size = l2arc_write_size(dev);
 
-		/*
-		 * Avoid contributing to memory pressure.
-		 */
-		if (arc_reclaim_needed()) {
-			ARCSTAT_BUMP(arcstat_l2_abort_lowmem);
-			spa_config_exit(spa, SCL_L2ARC, dev);
-			continue;
-		}
+	/*
+	 * Evict L2ARC buffers that will be overwritten.
+	 */
+	l2arc_evict(dev, size, B_FALSE);
 
-		ARCSTAT_BUMP(arcstat_l2_feeds);
+	/*
+	 * Write ARC buffers.
+	 */
+	wrote = l2arc_write_buffers(spa, dev, size);
 
-		size = l2arc_write_size();
+	/*
+	 * Calculate interval between writes, and the size of the next one.
+	 */
+	l2arc_feed_adapt(dev, size, wrote, ddi_get_lbolt() - begin);
+	next = l2arc_write_interval(begin, size, wrote);
+	spa_config_exit(spa, SCL_L2ARC, dev);
 
-		/*
-		 * Evict L2ARC buffers that will be overwritten.
-		 */
-		l2arc_evict(dev, size, B_FALSE);
+	return (next);
+}
 
-		/*
-		 * Write ARC buffers.
-		 */
-		wrote = l2arc_write_buffers(spa, dev, size);
+/*
+ * This thread feeds the L2ARC at regular intervals.  This is the beating
+ * heart of the L2ARC.  Every cache device has its own feed thread, started
+ * by l2arc_add_vdev() and stopped by l2arc_remove_vdev(), so that several
+ * devices are written to in parallel.
+ */
+static void
+l2arc_feed_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+	callb_cpr_t cpr;
+	clock_t next = ddi_get_lbolt();
+	fstrans_cookie_t cookie;
 
-		/*
-		 * Calculate interval between writes.
-		 */
-		next = l2arc_write_interval(begin, size, wrote);
-		spa_config_exit(spa, SCL_L2ARC, dev);
+	CALLB_CPR_INIT(&cpr, &l2arc_feed_thr_lock, callb_generic_cpr, FTAG);
+
+	mutex_enter(&l2arc_feed_thr_lock);
+
+	cookie = spl_fstrans_mark();
+	while (!dev->l2ad_feed_exit) {
+		CALLB_CPR_SAFE_BEGIN(&cpr);
+		(void) cv_timedwait_sig(&dev->l2ad_feed_cv,
+		    &l2arc_feed_thr_lock, next);
+		CALLB_CPR_SAFE_END(&cpr, &l2arc_feed_thr_lock);
+		if (dev->l2ad_feed_exit)
+			break;
+
+		mutex_exit(&l2arc_feed_thr_lock);
+		next = l2arc_feed(dev);
+		mutex_enter(&l2arc_feed_thr_lock);
 	}
 	spl_fstrans_unmark(cookie);
 
-	l2arc_thread_exit = 0;
-	cv_broadcast(&l2arc_feed_thr_cv);
+	dev->l2ad_feeding = B_FALSE;
+	cv_broadcast(&dev->l2ad_feed_cv);
 	CALLB_CPR_EXIT(&cpr);		/* drops l2arc_feed_thr_lock */
 	thread_exit();
 }
@@ -9162,24 +10165,40 @@ void
 l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 {
 	l2arc_dev_t *adddev;
+	uint64_t l2dhdr_asize;
 
 	ASSERT(!l2arc_vdev_present(vd));
 
 	vdev_ashift_optimize(vd);
 
 	/*
-	 * Create a new l2arc device entry.
+	 * Create a new l2arc device entry.  It embeds the log block under
+	 * construction, which is too large for kmem_zalloc().
 	 */
-	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
+	adddev = vmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	/* leave room for the device header */
+	l2dhdr_asize = adddev->l2ad_dev_hdr_asize =
+	    MAX(sizeof (*adddev->l2ad_dev_hdr), 1ULL << vd->vdev_ashift);
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE + l2dhdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
+	ASSERT3U(adddev->l2ad_start, <, adddev->l2ad_end);
 	adddev->l2ad_hand = adddev->l2ad_start;
+	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	adddev->l2ad_dev_hdr = kmem_zalloc(l2dhdr_asize, KM_SLEEP);
 	list_link_init(&adddev->l2ad_node);
 
+	/*
+	 * Feeding the device is held off until the rebuild thread has
+	 * either restored its previous contents or decided that there
+	 * is nothing to restore.
+	 */
+	adddev->l2ad_rebuild = B_TRUE;
+	adddev->l2ad_rebuild_cancel = B_FALSE;
+
 	mutex_init(&adddev->l2ad_mtx, NULL, MUTEX_DEFAULT, NULL);
 	/*
 	 * This is a list of all ARC buffers that are still valid on the
@@ -9191,6 +10210,11 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_hand);
 	zfs_refcount_create(&adddev->l2ad_alloc);
 
+	cv_init(&adddev->l2ad_feed_cv, NULL, CV_DEFAULT, NULL);
+	adddev->l2ad_feed_mult = 1;
+	adddev->l2ad_feed_evicted = ARCSTAT(arcstat_evict_l2_eligible);
+	l2arc_markers_alloc(adddev);
+
 	/*
 	 * Add device to global list
 	 */
@@ -9198,6 +10222,15 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread, adddev, 0, &p0,
+	    TS_RUN, minclsyspri);
+
+	if (spa_mode_global & FWRITE) {
+		adddev->l2ad_feeding = B_TRUE;
+		(void) thread_create(NULL, 0, l2arc_feed_thread, adddev, 0,
+		    &p0, TS_RUN, defclsyspri);
+	}
 }
 
 /*
@@ -9225,30 +10258,51 @@ l2arc_remove_vdev(vdev_t *vd)
 	 * Remove device from global list
 	 */
 	list_remove(l2arc_dev_list, remdev);
-	l2arc_dev_last = NULL;		/* may have been invalidated */
 	atomic_dec_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
 
+	/*
+	 * Stop the feed thread of the device and wait for it to exit.
+	 */
+	mutex_enter(&l2arc_feed_thr_lock);
+	remdev->l2ad_feed_exit = B_TRUE;
+	cv_broadcast(&remdev->l2ad_feed_cv);
+	while (remdev->l2ad_feeding)
+		cv_wait(&remdev->l2ad_feed_cv, &l2arc_feed_thr_lock);
+	mutex_exit(&l2arc_feed_thr_lock);
+
+	/*
+	 * Cancel any ongoing rebuild and wait for the thread to exit.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild)
+		cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
 	l2arc_evict(remdev, 0, B_TRUE);
+	l2arc_markers_free(remdev);
+	cv_destroy(&remdev->l2ad_feed_cv);
 	list_destroy(&remdev->l2ad_buflist);
 	mutex_destroy(&remdev->l2ad_mtx);
 	zfs_refcount_destroy(&remdev->l2ad_alloc);
-	kmem_free(remdev, sizeof (l2arc_dev_t));
+	kmem_free(remdev->l2ad_dev_hdr, remdev->l2ad_dev_hdr_asize);
+	vmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
 void
 l2arc_init(void)
 {
-	l2arc_thread_exit = 0;
 	l2arc_ndev = 0;
 	l2arc_writes_sent = 0;
 	l2arc_writes_done = 0;
 
 	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
-	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&l2arc_rebuild_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
 
@@ -9272,7 +10326,8 @@ l2arc_fini(void)
 	l2arc_do_free_on_write();
 
 	mutex_destroy(&l2arc_feed_thr_lock);
-	cv_destroy(&l2arc_feed_thr_cv);
+	mutex_destroy(&l2arc_rebuild_thr_lock);
+	cv_destroy(&l2arc_rebuild_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
 
@@ -9280,28 +10335,614 @@ l2arc_fini(void)
 	list_destroy(l2arc_free_on_write);
 }
 
-void
-l2arc_start(void)
+/*
+ * Persistent L2ARC
+ *
+ * See the block comment above l2arc_dev_hdr_phys_t in arc_impl.h for the
+ * on-disk layout.  When a cache device is added to the L2ARC, either at
+ * pool import or by "zpool add", a rebuild thread is started for it.  The
+ * thread reads the device header and walks the chain of log blocks from
+ * the newest to the oldest, recreating an L2-only ARC header for every
+ * buffer it finds.  The feed thread leaves the device alone until the
+ * rebuild has finished, because the write and evict hands of the device
+ * are only known once the device header has been read.
+ *
+ * The rebuild holds SCL_L2ARC as reader while it issues I/O to the device,
+ * just like the feed thread, but only ever tries to acquire it.  Removal of
+ * the device cancels the rebuild and waits for the thread to exit.
+ */
+
+/*
+ * Allocates an L2-only header for a buffer described by a log entry.  The
+ * header is not yet discoverable, and is not on the device's buflist.
+ */
+static arc_buf_hdr_t *
+arc_buf_alloc_l2only(size_t size, arc_buf_contents_t type, l2arc_dev_t *dev,
+    dva_t dva, uint64_t daddr, int32_t psize, uint64_t birth,
+    enum zio_compress compress, boolean_t protected)
 {
-	if (!(spa_mode_global & FWRITE))
-		return;
+	arc_buf_hdr_t *hdr;
 
-	(void) thread_create(NULL, 0, l2arc_feed_thread, NULL, 0, &p0,
-	    TS_RUN, defclsyspri);
+	ASSERT(size != 0);
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	ASSERT(HDR_EMPTY(hdr));
+	ASSERT3P(hdr->b_hash_next, ==, NULL);
+
+	hdr->b_flags = 0;
+	hdr->b_type = type;
+	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type));
+	HDR_SET_LSIZE(hdr, size);
+	HDR_SET_PSIZE(hdr, psize);
+	arc_hdr_set_compress(hdr, compress);
+	if (protected)
+		arc_hdr_set_flags(hdr, ARC_FLAG_PROTECTED);
+
+	hdr->b_spa = spa_load_guid(dev->l2ad_vdev->vdev_spa);
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = daddr;
+	hdr->b_l2hits = 0;
+
+	/*
+	 * The identity is set last; the flag manipulation above relies
+	 * on the header still being empty.
+	 */
+	hdr->b_dva = dva;
+	hdr->b_birth = birth;
+
+	return (hdr);
 }
 
-void
-l2arc_stop(void)
+/*
+ * Restores a single buffer described by a log entry, unless the ARC
+ * already knows about it.
+ */
+static void
+l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev)
 {
-	if (!(spa_mode_global & FWRITE))
+	arc_buf_hdr_t *hdr, *exists;
+	kmutex_t *hash_lock;
+	arc_buf_contents_t type = L2BLK_GET_TYPE((le)->le_prop);
+	uint64_t psize = L2BLK_GET_PSIZE((le)->le_prop);
+	uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+
+	hdr = arc_buf_alloc_l2only(L2BLK_GET_LSIZE((le)->le_prop), type,
+	    dev, le->le_dva, le->le_daddr, psize, le->le_birth,
+	    L2BLK_GET_COMPRESS((le)->le_prop),
+	    L2BLK_GET_PROTECTED((le)->le_prop));
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* Buffer was already cached, no need to restore it. */
+		mutex_exit(hash_lock);
+		arc_hdr_destroy(hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
 		return;
+	}
 
-	mutex_enter(&l2arc_feed_thr_lock);
-	cv_signal(&l2arc_feed_thr_cv);	/* kick thread out of startup */
-	l2arc_thread_exit = 1;
-	while (l2arc_thread_exit != 0)
-		cv_wait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock);
-	mutex_exit(&l2arc_feed_thr_lock);
+	arc_hdr_set_flags(hdr, ARC_FLAG_HAS_L2HDR);
+
+	/*
+	 * Buffers are restored from the newest to the oldest, so appending
+	 * them to the buflist keeps it ordered like l2arc_write_buffers()
+	 * would have left it.
+	 */
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) zfs_refcount_add_many(&dev->l2ad_alloc, arc_hdr_size(hdr), hdr);
+	mutex_exit(&dev->l2ad_mtx);
+
+	ARCSTAT_INCR(arcstat_l2_lsize, HDR_GET_LSIZE(hdr));
+	ARCSTAT_INCR(arcstat_l2_psize, psize);
+	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
+
+	mutex_exit(hash_lock);
+}
+
+/*
+ * Returns the worst case number of bytes taken up by the log blocks which
+ * describe a write of write_sz bytes to the device.  Every buffer takes
+ * at least one sector on the device, and thus one log entry.
+ */
+static uint64_t
+l2arc_log_blk_overhead(uint64_t write_sz, l2arc_dev_t *dev)
+{
+	uint64_t ashift = MAX(dev->l2ad_vdev->vdev_ashift, SPA_MINBLOCKSHIFT);
+	uint64_t log_blocks = DIV_ROUND_UP(write_sz >> ashift,
+	    L2ARC_LOG_BLK_MAX_ENTRIES);
+
+	return (log_blocks * vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t)));
+}
+
+/*
+ * Appends a buffer which is about to be written to the device to the log
+ * block under construction.  Returns B_TRUE when the log block is full
+ * and should be committed with l2arc_log_blk_commit().
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, const arc_buf_hdr_t *hdr)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_log_ent_phys_t *le;
+	int index = dev->l2ad_log_ent_idx++;
+
+	ASSERT3S(index, <, L2ARC_LOG_BLK_MAX_ENTRIES);
+	ASSERT(HDR_HAS_L2HDR(hdr));
+
+	le = &lb->lb_entries[index];
+	bzero(le, sizeof (*le));
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+	if (index == 0)
+		dev->l2ad_log_blk_payload_start = le->le_daddr;
+	L2BLK_SET_LSIZE((le)->le_prop, HDR_GET_LSIZE(hdr));
+	L2BLK_SET_PSIZE((le)->le_prop, HDR_GET_PSIZE(hdr));
+	L2BLK_SET_COMPRESS((le)->le_prop, HDR_GET_COMPRESS(hdr));
+	L2BLK_SET_TYPE((le)->le_prop, hdr->b_type);
+	L2BLK_SET_PROTECTED((le)->le_prop, !!(HDR_PROTECTED(hdr)));
+
+	dev->l2ad_log_blk_payload_asize += vdev_psize_to_asize(dev->l2ad_vdev,
+	    HDR_GET_PSIZE(hdr));
+
+	return (dev->l2ad_log_ent_idx == L2ARC_LOG_BLK_MAX_ENTRIES);
+}
+
+/*
+ * Writes out the full log block under construction at the write hand, as
+ * a child of the feed thread's write zio, and starts a new log block
+ * which points back to it.  The device header is pointed at the new log
+ * block by l2arc_dev_hdr_update() once the write zio has completed.
+ */
+static void
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_log_blkptr_t lbp;
+	uint64_t asize;
+	abd_t *abd;
+
+	ASSERT3S(dev->l2ad_log_ent_idx, ==, L2ARC_LOG_BLK_MAX_ENTRIES);
+
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, sizeof (*lb));
+	ASSERT3U(asize, ==, sizeof (*lb));
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+
+	bzero(&lbp, sizeof (lbp));
+	lbp.lbp_daddr = dev->l2ad_hand;
+	lbp.lbp_payload_asize = dev->l2ad_log_blk_payload_asize;
+	lbp.lbp_payload_start = dev->l2ad_log_blk_payload_start;
+	L2BLK_SET_LSIZE(lbp.lbp_prop, sizeof (*lb));
+	L2BLK_SET_PSIZE(lbp.lbp_prop, asize);
+	L2BLK_SET_CHECKSUM(lbp.lbp_prop, ZIO_CHECKSUM_FLETCHER_4);
+	fletcher_4_native(lb, sizeof (*lb), NULL, &lbp.lbp_cksum);
+
+	/*
+	 * The log block under construction is reused right away, so write
+	 * out a copy of it.  The copy is freed by l2arc_write_done().
+	 */
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_copy_from_buf(abd, lb, sizeof (*lb));
+	l2arc_free_abd_on_write(abd, asize, ARC_BUFC_METADATA);
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev, lbp.lbp_daddr,
+	    asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+
+	dev->l2ad_dev_hdr->dh_start_lbp = lbp;
+	lb->lb_prev_lbp = lbp;
+	dev->l2ad_hand += asize;
+	dev->l2ad_log_ent_idx = 0;
+	dev->l2ad_log_blk_payload_asize = 0;
+	dev->l2ad_log_blk_payload_start = 0;
+
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+}
+
+/*
+ * Writes the in-memory device header out to the device.  Failures are
+ * not fatal, they only mean that the device contents cannot be rebuilt
+ * after the next import.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	const uint64_t l2dhdr_asize = dev->l2ad_dev_hdr_asize;
+	abd_t *abd;
+	int err;
+
+	l2dhdr->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	l2dhdr->dh_version = L2ARC_PERSISTENT_VERSION;
+	l2dhdr->dh_spa_guid = spa_guid(dev->l2ad_vdev->vdev_spa);
+	l2dhdr->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	l2dhdr->dh_log_entries = L2ARC_LOG_BLK_MAX_ENTRIES;
+	l2dhdr->dh_evict = dev->l2ad_evict;
+	l2dhdr->dh_start = dev->l2ad_start;
+	l2dhdr->dh_end = dev->l2ad_end;
+	l2dhdr->dh_flags = 0;
+	if (dev->l2ad_first)
+		l2dhdr->dh_flags |= L2ARC_DEV_HDR_EVICT_FIRST;
+
+	abd = abd_get_from_buf(l2dhdr, l2dhdr_asize);
+	err = zio_wait(zio_write_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, l2dhdr_asize, abd, ZIO_CHECKSUM_LABEL, NULL,
+	    NULL, ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+	abd_put(abd);
+
+	if (err != 0) {
+		zfs_dbgmsg("L2ARC IO error (%d) while writing device header, "
+		    "vdev guid: %llu", err,
+		    (u_longlong_t)dev->l2ad_vdev->vdev_guid);
+	}
+}
+
+/*
+ * Reads and validates the device header.  On success the header is left
+ * in dev->l2ad_dev_hdr; it is only trusted if it was written by this very
+ * pool and device, and describes the device as it is currently sized.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	const uint64_t l2dhdr_asize = dev->l2ad_dev_hdr_asize;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_for_io(l2dhdr_asize, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, l2dhdr_asize, abd, ZIO_CHECKSUM_LABEL, NULL,
+	    NULL, ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE |
+	    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY |
+	    ZIO_FLAG_SPECULATIVE, B_FALSE));
+	abd_copy_to_buf(l2dhdr, abd, l2dhdr_asize);
+	abd_free(abd);
+
+	if (err == ECKSUM) {
+		/* A new device, or one that was never written by us. */
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (err);
+	} else if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		return (err);
+	}
+
+	if (l2dhdr->dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    l2dhdr->dh_version != L2ARC_PERSISTENT_VERSION ||
+	    l2dhdr->dh_spa_guid != spa_guid(dev->l2ad_vdev->vdev_spa) ||
+	    l2dhdr->dh_vdev_guid != dev->l2ad_vdev->vdev_guid ||
+	    l2dhdr->dh_log_entries != L2ARC_LOG_BLK_MAX_ENTRIES ||
+	    l2dhdr->dh_start != dev->l2ad_start ||
+	    l2dhdr->dh_end != dev->l2ad_end ||
+	    l2dhdr->dh_evict < dev->l2ad_start ||
+	    l2dhdr->dh_evict > dev->l2ad_end) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	return (0);
+}
+
+/*
+ * Returns B_TRUE if check lies within the range [bottom, top] on the
+ * device.  A range with bottom > top wraps around the end of the device.
+ */
+static boolean_t
+l2arc_range_check_overlap(uint64_t bottom, uint64_t top, uint64_t check)
+{
+	if (bottom < top)
+		return (bottom <= check && check <= top);
+	else if (bottom > top)
+		return (check <= top || bottom <= check);
+	else
+		return (check == top);
+}
+
+/*
+ * Determines whether a log block pointer points to a log block which can
+ * still be trusted: it must fit on the device, be of the expected size,
+ * and neither it nor the buffers it describes may have been evicted by
+ * l2arc_evict() since it was written, i.e. it must not overlap the range
+ * between the write hand and the evict hand.
+ */
+static boolean_t
+l2arc_log_blkptr_valid(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t asize = L2BLK_GET_PSIZE((lbp)->lbp_prop);
+	uint64_t start = lbp->lbp_payload_start;
+	uint64_t end = lbp->lbp_daddr + asize - 1;
+	boolean_t evicted;
+
+	if (lbp->lbp_daddr < dev->l2ad_start ||
+	    lbp->lbp_daddr + asize > dev->l2ad_end ||
+	    start < dev->l2ad_start || start >= dev->l2ad_end ||
+	    asize != sizeof (l2arc_log_blk_phys_t) ||
+	    L2BLK_GET_LSIZE((lbp)->lbp_prop) != sizeof (l2arc_log_blk_phys_t) ||
+	    L2BLK_GET_CHECKSUM((lbp)->lbp_prop) != ZIO_CHECKSUM_FLETCHER_4)
+		return (B_FALSE);
+
+	/* Nothing has been evicted yet during the first pass. */
+	if (dev->l2ad_first)
+		return (B_TRUE);
+
+	evicted =
+	    l2arc_range_check_overlap(start, end, dev->l2ad_hand) ||
+	    l2arc_range_check_overlap(start, end, dev->l2ad_evict) ||
+	    l2arc_range_check_overlap(dev->l2ad_hand, dev->l2ad_evict, start) ||
+	    l2arc_range_check_overlap(dev->l2ad_hand, dev->l2ad_evict, end);
+
+	return (!evicted);
+}
+
+static void
+l2arc_log_blk_fetch_done(zio_t *zio)
+{
+	abd_put(zio->io_private);
+}
+
+/*
+ * Starts reading the log block pointed to by lbp into lb.  The returned
+ * zio must be waited for with l2arc_log_blk_read().  The caller must hold
+ * SCL_L2ARC.
+ */
+static zio_t *
+l2arc_log_blk_fetch(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    l2arc_log_blk_phys_t *lb)
+{
+	uint64_t asize = L2BLK_GET_PSIZE((lbp)->lbp_prop);
+	abd_t *abd;
+	zio_t *pio;
+
+	ASSERT3U(asize, ==, sizeof (*lb));
+
+	abd = abd_get_from_buf(lb, asize);
+	pio = zio_root(dev->l2ad_spa, l2arc_log_blk_fetch_done, abd,
+	    ZIO_FLAG_CANFAIL);
+	(void) zio_nowait(zio_read_phys(pio, dev->l2ad_vdev, lbp->lbp_daddr,
+	    asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
+	    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_RETRY,
+	    B_FALSE));
+
+	return (pio);
+}
+
+/*
+ * Waits for a log block read started by l2arc_log_blk_fetch() and
+ * verifies its contents against the log block pointer.
+ */
+static int
+l2arc_log_blk_read(const l2arc_log_blkptr_t *lbp, l2arc_log_blk_phys_t *lb,
+    zio_t *zio)
+{
+	zio_cksum_t cksum;
+	int err;
+
+	err = zio_wait(zio);
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		return (err);
+	}
+
+	fletcher_4_native(lb, sizeof (*lb), NULL, &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, lbp->lbp_cksum) ||
+	    lb->lb_magic != L2ARC_LOG_BLK_MAGIC) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		return (SET_ERROR(ECKSUM));
+	}
+
+	return (0);
+}
+
+/*
+ * Restores all buffers described by a log block, newest first.
+ */
+static void
+l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb)
+{
+	uint64_t size = 0, asize = 0, bufs = 0;
+
+	for (int i = L2ARC_LOG_BLK_MAX_ENTRIES - 1; i >= 0; i--) {
+		const l2arc_log_ent_phys_t *le = &lb->lb_entries[i];
+		uint64_t psize = L2BLK_GET_PSIZE((le)->le_prop);
+
+		/*
+		 * The log block is checksummed, so this only guards
+		 * against entries written by a buggy or future version.
+		 */
+		if (DVA_IS_EMPTY(&le->le_dva) || le->le_birth == 0 ||
+		    L2BLK_GET_COMPRESS((le)->le_prop) >=
+		    ZIO_COMPRESS_FUNCTIONS ||
+		    L2BLK_GET_TYPE((le)->le_prop) >= ARC_BUFC_NUMTYPES ||
+		    le->le_daddr < dev->l2ad_start ||
+		    le->le_daddr + vdev_psize_to_asize(dev->l2ad_vdev, psize) >
+		    dev->l2ad_end)
+			continue;
+
+		size += L2BLK_GET_LSIZE((le)->le_prop);
+		asize += vdev_psize_to_asize(dev->l2ad_vdev, psize);
+		bufs++;
+		l2arc_hdr_restore(le, dev);
+	}
+
+	ARCSTAT_INCR(arcstat_l2_rebuild_size, size);
+	ARCSTAT_INCR(arcstat_l2_rebuild_asize, asize);
+	ARCSTAT_INCR(arcstat_l2_rebuild_bufs, bufs);
+	ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+}
+
+/*
+ * Acquires SCL_L2ARC as reader for the rebuild, unless the rebuild has
+ * been cancelled.  The lock is only ever tried, since the device removal
+ * which cancels us may be holding it as writer while waiting for us.
+ */
+static int
+l2arc_rebuild_lock(l2arc_dev_t *dev)
+{
+	for (;;) {
+		mutex_enter(&l2arc_rebuild_thr_lock);
+		if (dev->l2ad_rebuild_cancel) {
+			mutex_exit(&l2arc_rebuild_thr_lock);
+			return (SET_ERROR(ECANCELED));
+		}
+		mutex_exit(&l2arc_rebuild_thr_lock);
+
+		if (spa_config_tryenter(dev->l2ad_spa, SCL_L2ARC, dev,
+		    RW_READER))
+			return (0);
+
+		delay(1);
+	}
+}
+
+/*
+ * Resets the device to an empty log, and records that on the device so
+ * that stale log blocks are never picked up by a later rebuild.
+ */
+static void
+l2arc_dev_hdr_reset(l2arc_dev_t *dev)
+{
+	bzero(dev->l2ad_dev_hdr, dev->l2ad_dev_hdr_asize);
+	bzero(&dev->l2ad_log_blk.lb_prev_lbp, sizeof (l2arc_log_blkptr_t));
+	dev->l2ad_hand = dev->l2ad_start;
+	dev->l2ad_evict = dev->l2ad_start;
+	dev->l2ad_first = B_TRUE;
+
+	if (spa_writeable(dev->l2ad_spa))
+		l2arc_dev_hdr_update(dev);
+}
+
+/*
+ * Rebuilds the L2ARC contents of a device from its device header and log
+ * blocks.  The log blocks are read one step ahead of the one whose
+ * buffers are being restored, to overlap the I/O with the restore.
+ */
+static int
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	vdev_t *vd = dev->l2ad_vdev;
+	spa_t *spa = dev->l2ad_spa;
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	l2arc_log_blk_phys_t *this_lb, *next_lb;
+	zio_t *this_io = NULL, *next_io = NULL;
+	l2arc_log_blkptr_t lbp;
+	uint64_t nblks = 0, max_blks;
+	boolean_t lock_held;
+	int err;
+
+	if ((err = l2arc_rebuild_lock(dev)) != 0)
+		return (err);
+	lock_held = B_TRUE;
+
+	if (!l2arc_rebuild_enabled || (err = l2arc_dev_hdr_read(dev)) != 0) {
+		l2arc_dev_hdr_reset(dev);
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		return (err);
+	}
+
+	/*
+	 * Pick up where the device was left: the write hand follows the
+	 * newest log block, and new log blocks will link back to it.
+	 */
+	lbp = l2dhdr->dh_start_lbp;
+	dev->l2ad_first = !!(l2dhdr->dh_flags & L2ARC_DEV_HDR_EVICT_FIRST);
+	dev->l2ad_evict = l2dhdr->dh_evict;
+	dev->l2ad_hand = MAX(lbp.lbp_daddr + L2BLK_GET_PSIZE((&lbp)->lbp_prop),
+	    dev->l2ad_start);
+	dev->l2ad_log_blk.lb_prev_lbp = lbp;
+
+	this_lb = vmem_zalloc(sizeof (*this_lb), KM_SLEEP);
+	next_lb = vmem_zalloc(sizeof (*next_lb), KM_SLEEP);
+
+	/* A corrupted chain must not be able to loop forever. */
+	max_blks = (dev->l2ad_end - dev->l2ad_start) / sizeof (*this_lb);
+
+	for (;;) {
+		l2arc_log_blk_phys_t *tmp_lb;
+
+		if (!l2arc_log_blkptr_valid(dev, &lbp) || nblks >= max_blks)
+			break;
+
+		if (this_io == NULL)
+			this_io = l2arc_log_blk_fetch(dev, &lbp, this_lb);
+		err = l2arc_log_blk_read(&lbp, this_lb, this_io);
+		this_io = NULL;
+		if (err != 0)
+			break;
+
+		/* Start reading the previous log block ahead of time. */
+		lbp = this_lb->lb_prev_lbp;
+		if (l2arc_log_blkptr_valid(dev, &lbp))
+			next_io = l2arc_log_blk_fetch(dev, &lbp, next_lb);
+
+		/* Don't add to memory pressure by restoring more headers. */
+		if (arc_reclaim_needed()) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			err = SET_ERROR(ENOMEM);
+			break;
+		}
+
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		lock_held = B_FALSE;
+
+		l2arc_log_blk_restore(dev, this_lb);
+		nblks++;
+
+		tmp_lb = this_lb;
+		this_lb = next_lb;
+		next_lb = tmp_lb;
+		this_io = next_io;
+		next_io = NULL;
+
+		if ((err = l2arc_rebuild_lock(dev)) != 0)
+			break;
+		lock_held = B_TRUE;
+	}
+
+	/* Outstanding reads must finish before their buffers are freed. */
+	if (this_io != NULL)
+		(void) zio_wait(this_io);
+	if (next_io != NULL)
+		(void) zio_wait(next_io);
+
+	vmem_free(this_lb, sizeof (*this_lb));
+	vmem_free(next_lb, sizeof (*next_lb));
+
+	if (lock_held)
+		spa_config_exit(spa, SCL_L2ARC, dev);
+
+	if (err == 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+		zfs_dbgmsg("L2ARC rebuild successful, restored %llu log "
+		    "blocks, vdev guid: %llu", (u_longlong_t)nblks,
+		    (u_longlong_t)vd->vdev_guid);
+	} else {
+		zfs_dbgmsg("L2ARC rebuild aborted (%d), restored %llu log "
+		    "blocks, vdev guid: %llu", err, (u_longlong_t)nblks,
+		    (u_longlong_t)vd->vdev_guid);
+	}
+
+	return (err);
+}
+
+/*
+ * Rebuild thread, started by l2arc_add_vdev() for every new device.
+ */
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+
+	VERIFY(dev->l2ad_rebuild);
+	(void) l2arc_rebuild(dev);
+
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_thr_cv);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
+	thread_exit();
 }
 
 #if defined(_KERNEL)
@@ -9350,6 +10991,9 @@ ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, average_blocksize, UINT, ZMOD_RD, "Target av
 
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, compression_enabled, UINT, ZMOD_RW,"Disable compressed arc buffers");
 
+ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, dcache_shift, INT, ZMOD_RW,
+	"log2(fraction of arc for cached decompressed buffers)");
+
 ZFS_MODULE_PARAM(zfs_arc, arc_, min_prefetch_ms, UINT, ZMOD_RW,
 	"Min life of prefetch block in ms");
 
@@ -9362,6 +11006,9 @@ ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, write_max, UQUAD, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, write_boost, UQUAD, ZMOD_RW,
 	"Extra write bytes during device warmup");
 
+ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, write_scale, UQUAD, ZMOD_RW,
+	"Max multiple of l2arc_write_max a device's write size may grow to");
+
 ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, headroom, UQUAD, ZMOD_RW,
 	"Number of max device writes to precache");
 
@@ -9376,16 +11023,25 @@ ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, feed_min_ms, UQUAD, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, noprefetch, UINT, ZMOD_RW, "Skip caching prefetched buffers");
 
+ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, exclusive, INT, ZMOD_RW,
+	"Drop the L2ARC copy of buffers read back into the ARC");
+
 ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, feed_again, UINT, ZMOD_RW, "Turbo L2ARC warmup");
 
 ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, norw, UINT, ZMOD_RW, "No reads during writes");
 
+ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, rebuild_enabled, INT, ZMOD_RW,
+	"Rebuild the L2ARC when importing a pool");
+
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, lotsfree_percent, UINT, ZMOD_RW,
 	"System free memory I/O throttle in bytes");
 
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, sys_free, UQUAD, ZMOD_RW,
     "System free memory target size in bytes");
 
+ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, shrink_ahead_percent, UINT, ZMOD_RW,
+    "Percent of memory above arc_sys_free to start shrinking the arc at");
+
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, dnode_limit, UQUAD, ZMOD_RW, "Minimum bytes of dnodes in arc");
 
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, dnode_limit_percent, UQUAD, ZMOD_RW,
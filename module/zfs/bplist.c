@@ -75,3 +75,14 @@ bplist_iterate(bplist_t *bpl, bplist_itor_t *func, void *arg, dmu_tx_t *tx)
 	}
 	mutex_exit(&bpl->bpl_lock);
 }
+
+void
+bplist_clear(bplist_t *bpl)
+{
+	bplist_entry_t *bpe;
+
+	mutex_enter(&bpl->bpl_lock);
+	while ((bpe = list_remove_head(&bpl->bpl_list)))
+		kmem_free(bpe, sizeof (*bpe));
+	mutex_exit(&bpl->bpl_lock);
+}
@@ -31,6 +31,14 @@
 #include <sys/zfeature.h>
 #include <sys/zap.h>
 
+/*
+ * Number of blocks of block pointers, and of subobjs, that bpobj_iterate()
+ * prefetches ahead of the ones it is visiting.  Without it, the async
+ * destroy of a big dataset frees blocks only as fast as it can read its
+ * bpobjs one block at a time.
+ */
+int zfs_bpobj_prefetch_depth = 16;
+
 /*
  * Return an empty bpobj, preferably the empty dummy one (dp_empty_bpobj).
  */
@@ -225,6 +233,8 @@ typedef struct bpobj_info {
 	uint64_t bpi_unprocessed_subobjs;
 	/* True after having visited this bpo's directly referenced BPs. */
 	boolean_t bpi_visited;
+	/* Lowest index of the subobjs prefetched by bpobj_iterate() */
+	uint64_t bpi_subobjs_prefetched;
 	list_node_t bpi_node;
 } bpobj_info_t;
 
@@ -238,9 +248,61 @@ bpi_alloc(bpobj_t *bpo, bpobj_info_t *parent, uint64_t index)
 	if (bpo->bpo_havesubobj && bpo->bpo_phys->bpo_subobjs != 0) {
 		bpi->bpi_unprocessed_subobjs = bpo->bpo_phys->bpo_num_subobjs;
 	}
+	bpi->bpi_subobjs_prefetched = bpi->bpi_unprocessed_subobjs;
 	return (bpi);
 }
 
+/*
+ * The blocks of block pointers are visited from the last one down, so
+ * prefetch the ones before the block at 'offset'.
+ */
+static void
+bpobj_prefetch_blkptrs(bpobj_t *bpo, uint64_t offset, uint64_t blksz)
+{
+	uint64_t len;
+
+	if (zfs_bpobj_prefetch_depth <= 0 || offset == 0)
+		return;
+
+	len = MIN(offset, blksz * zfs_bpobj_prefetch_depth);
+	dmu_prefetch(bpo->bpo_os, bpo->bpo_object, 0, offset - len, len,
+	    ZIO_PRIORITY_ASYNC_READ);
+}
+
+/*
+ * The subobjs are also visited from the last one down.  Before subobj 'i'
+ * is opened, prefetch the dnodes of the subobjs below it, once half of
+ * the ones prefetched before have been visited.
+ */
+static void
+bpobj_prefetch_subobjs(bpobj_info_t *bpi, uint64_t i)
+{
+	bpobj_t *bpo = bpi->bpi_bpo;
+	uint64_t depth, lo, hi, *objs;
+
+	if (zfs_bpobj_prefetch_depth <= 0)
+		return;
+
+	depth = zfs_bpobj_prefetch_depth;
+	if (i > bpi->bpi_subobjs_prefetched + depth / 2)
+		return;
+
+	lo = (i > depth) ? i - depth : 0;
+	hi = MIN(i, bpi->bpi_subobjs_prefetched);
+	if (lo >= hi)
+		return;
+
+	objs = kmem_alloc((hi - lo) * sizeof (uint64_t), KM_SLEEP);
+	if (dmu_read(bpo->bpo_os, bpo->bpo_phys->bpo_subobjs,
+	    lo * sizeof (uint64_t), (hi - lo) * sizeof (uint64_t), objs,
+	    DMU_READ_PREFETCH) == 0) {
+		dmu_prefetch_dnodes(bpo->bpo_os, objs, hi - lo,
+		    ZIO_PRIORITY_ASYNC_READ);
+	}
+	kmem_free(objs, (hi - lo) * sizeof (uint64_t));
+	bpi->bpi_subobjs_prefetched = lo;
+}
+
 /*
  * Update bpobj and all of its parents with new space accounting.
  */
@@ -281,6 +343,8 @@ bpobj_iterate_blkptrs(bpobj_info_t *bpi, bpobj_itor_t func, void *arg,
 			    FTAG, &dbuf, 0);
 			if (err)
 				break;
+			bpobj_prefetch_blkptrs(bpo, dbuf->db_offset,
+			    dbuf->db_size);
 		}
 
 		ASSERT3U(offset, >=, dbuf->db_offset);
@@ -438,6 +502,8 @@ bpobj_iterate_impl(bpobj_t *initial_bpo, bpobj_itor_t func, void *arg,
 			int64_t i = bpi->bpi_unprocessed_subobjs - 1;
 			uint64_t offset = i * sizeof (uint64_t);
 
+			bpobj_prefetch_subobjs(bpi, i);
+
 			uint64_t obj_from_sublist;
 			err = dmu_read(bpo->bpo_os, bpo->bpo_phys->bpo_subobjs,
 			    offset, sizeof (uint64_t), &obj_from_sublist,
@@ -863,3 +929,8 @@ bpobj_space_range(bpobj_t *bpo, uint64_t mintxg, uint64_t maxtxg,
 	*uncompp = sra.uncomp;
 	return (err);
 }
+
+#if defined(_KERNEL)
+ZFS_MODULE_PARAM(zfs, zfs_, bpobj_prefetch_depth, INT, ZMOD_RW,
+	"Blocks and subobjs of a bpobj prefetched ahead while iterating it");
+#endif
@@ -19,12 +19,28 @@
 #include	<sys/bqueue.h>
 #include	<sys/zfs_context.h>
 
+/*
+ * Items are moved on and off the shared list this many at a time at most,
+ * so that the queue's lock is taken once per batch rather than per item.
+ */
+#define	BQUEUE_BATCH	16
+
 static inline bqueue_node_t *
 obj2node(bqueue_t *q, void *data)
 {
 	return ((bqueue_node_t *)((char *)data + q->bq_node_offset));
 }
 
+/*
+ * The number of units which, once queued, wake a blocked consumer, and
+ * which, once free, wake a blocked producer.
+ */
+static inline uint64_t
+bqueue_threshold(bqueue_t *q)
+{
+	return (q->bq_maxsize / q->bq_fill_fraction);
+}
+
 /*
  * Initialize a blocking queue  The maximum capacity of the queue is set to
  * size.  Types that are stored in a bqueue must contain a bqueue_node_t,
@@ -39,6 +55,11 @@ obj2node(bqueue_t *q, void *data)
  * currently blocked and that enqueue does not cause them to be awoken.
  * Alternatively, this behavior can be disabled (causing signaling to happen
  * immediately) by setting fill_fraction to any value larger than size.
+ *
+ * A queue has a single producer and a single consumer, which lets both of
+ * them move items in batches: the producer stages up to BQUEUE_BATCH items,
+ * or 1/fill_fraction of the queue, before publishing them together, and the
+ * consumer takes as many at once.  Flushing publishes the staged items.
  * Return 0 on success, or -1 on failure.
  */
 int
@@ -50,6 +71,10 @@ bqueue_init(bqueue_t *q, uint64_t fill_fraction, uint64_t size,
 	}
 	list_create(&q->bq_list, node_offset + sizeof (bqueue_node_t),
 	    node_offset + offsetof(bqueue_node_t, bqn_node));
+	list_create(&q->bq_stage, node_offset + sizeof (bqueue_node_t),
+	    node_offset + offsetof(bqueue_node_t, bqn_node));
+	list_create(&q->bq_take, node_offset + sizeof (bqueue_node_t),
+	    node_offset + offsetof(bqueue_node_t, bqn_node));
 	cv_init(&q->bq_add_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&q->bq_pop_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&q->bq_lock, NULL, MUTEX_DEFAULT, NULL);
@@ -57,6 +82,13 @@ bqueue_init(bqueue_t *q, uint64_t fill_fraction, uint64_t size,
 	q->bq_size = 0;
 	q->bq_maxsize = size;
 	q->bq_fill_fraction = fill_fraction;
+	q->bq_bytes = 0;
+	q->bq_enqueue_wait = 0;
+	q->bq_dequeue_wait = 0;
+	q->bq_add_waiters = 0;
+	q->bq_pop_waiters = 0;
+	q->bq_stage_size = 0;
+	q->bq_stage_count = 0;
 	return (0);
 }
 
@@ -70,31 +102,78 @@ bqueue_destroy(bqueue_t *q)
 {
 	mutex_enter(&q->bq_lock);
 	ASSERT0(q->bq_size);
+	ASSERT0(q->bq_stage_size);
 	cv_destroy(&q->bq_add_cv);
 	cv_destroy(&q->bq_pop_cv);
 	list_destroy(&q->bq_list);
+	list_destroy(&q->bq_stage);
+	list_destroy(&q->bq_take);
 	mutex_exit(&q->bq_lock);
 	mutex_destroy(&q->bq_lock);
 }
 
+/*
+ * Move the producer's staged items onto the queue, waiting for the
+ * capacity to take all of them, and wake the consumer if it's waiting
+ * for them.  Called with the queue's lock held.
+ */
+static void
+bqueue_publish(bqueue_t *q, boolean_t flush)
+{
+	uint64_t size = q->bq_stage_size;
+
+	ASSERT(MUTEX_HELD(&q->bq_lock));
+	ASSERT3U(size, <=, q->bq_maxsize);
+
+	if (q->bq_size + size > q->bq_maxsize) {
+		hrtime_t start = gethrtime();
+		q->bq_add_waiters++;
+		while (q->bq_size + size > q->bq_maxsize) {
+			cv_wait_sig(&q->bq_add_cv, &q->bq_lock);
+		}
+		q->bq_add_waiters--;
+		q->bq_enqueue_wait += gethrtime() - start;
+	}
+	q->bq_size += size;
+	q->bq_bytes += size;
+	list_move_tail(&q->bq_list, &q->bq_stage);
+	q->bq_stage_size = 0;
+	q->bq_stage_count = 0;
+	if (flush)
+		cv_broadcast(&q->bq_pop_cv);
+	else if (q->bq_pop_waiters > 0 && q->bq_size >= bqueue_threshold(q))
+		cv_signal(&q->bq_pop_cv);
+}
+
 static void
 bqueue_enqueue_impl(bqueue_t *q, void *data, uint64_t item_size,
     boolean_t flush)
 {
 	ASSERT3U(item_size, >, 0);
 	ASSERT3U(item_size, <=, q->bq_maxsize);
-	mutex_enter(&q->bq_lock);
+
+	/*
+	 * Staged items are only ever touched by the producer, so staging
+	 * one only takes the lock when the batch is published.  A batch
+	 * never exceeds the queue's capacity, so that it can always be
+	 * published once the consumer has drained the queue.
+	 */
+	if (q->bq_stage_size + item_size > q->bq_maxsize) {
+		mutex_enter(&q->bq_lock);
+		bqueue_publish(q, B_FALSE);
+		mutex_exit(&q->bq_lock);
+	}
 	obj2node(q, data)->bqn_size = item_size;
-	while (q->bq_size + item_size > q->bq_maxsize) {
-		cv_wait_sig(&q->bq_add_cv, &q->bq_lock);
+	list_insert_tail(&q->bq_stage, data);
+	q->bq_stage_size += item_size;
+	q->bq_stage_count++;
+
+	if (flush || q->bq_stage_count >= BQUEUE_BATCH ||
+	    q->bq_stage_size >= bqueue_threshold(q)) {
+		mutex_enter(&q->bq_lock);
+		bqueue_publish(q, flush);
+		mutex_exit(&q->bq_lock);
 	}
-	q->bq_size += item_size;
-	list_insert_tail(&q->bq_list, data);
-	if (q->bq_size >= q->bq_maxsize / q->bq_fill_fraction)
-		cv_signal(&q->bq_pop_cv);
-	if (flush)
-		cv_broadcast(&q->bq_pop_cv);
-	mutex_exit(&q->bq_lock);
 }
 
 /*
@@ -122,34 +201,104 @@ bqueue_enqueue_flush(bqueue_t *q, void *data, uint64_t item_size)
 	bqueue_enqueue_impl(q, data, item_size, B_TRUE);
 }
 
+/*
+ * Publish the staged entries and force the popping threads to wake up, even
+ * if we're below the fill fraction.  Only the producer may call this, and it
+ * must ensure that the queue is not destroyed concurrently.
+ */
+void
+bqueue_flush(bqueue_t *q)
+{
+	mutex_enter(&q->bq_lock);
+	bqueue_publish(q, B_TRUE);
+	mutex_exit(&q->bq_lock);
+}
+
 /*
  * Take the first element off of q.  If there are no elements on the queue, wait
  * until one is put there.  Return the removed element.
+ *
+ * Elements are taken off the queue in batches of up to BQUEUE_BATCH, or
+ * 1/fill_fraction of the queue, and then handed out without the lock.  Their
+ * capacity is given back to the producer as soon as the batch is taken.
  */
 void *
 bqueue_dequeue(bqueue_t *q)
 {
-	void *ret = NULL;
-	uint64_t item_size;
+	uint64_t taken = 0;
+	void *ret;
+
+	if ((ret = list_remove_head(&q->bq_take)) != NULL)
+		return (ret);
+
 	mutex_enter(&q->bq_lock);
-	while (q->bq_size == 0) {
-		cv_wait_sig(&q->bq_pop_cv, &q->bq_lock);
+	if (q->bq_size == 0) {
+		hrtime_t start = gethrtime();
+		q->bq_pop_waiters++;
+		while (q->bq_size == 0) {
+			cv_wait_sig(&q->bq_pop_cv, &q->bq_lock);
+		}
+		q->bq_pop_waiters--;
+		q->bq_dequeue_wait += gethrtime() - start;
 	}
-	ret = list_remove_head(&q->bq_list);
-	ASSERT3P(ret, !=, NULL);
-	item_size = obj2node(q, ret)->bqn_size;
-	q->bq_size -= item_size;
-	if (q->bq_size <= q->bq_maxsize - (q->bq_maxsize / q->bq_fill_fraction))
+	for (int n = 0; n < BQUEUE_BATCH &&
+	    (n == 0 || taken < bqueue_threshold(q)); n++) {
+		void *data = list_remove_head(&q->bq_list);
+
+		if (data == NULL)
+			break;
+		taken += obj2node(q, data)->bqn_size;
+		list_insert_tail(&q->bq_take, data);
+	}
+	ASSERT3U(taken, >, 0);
+	q->bq_size -= taken;
+	if (q->bq_add_waiters > 0 &&
+	    q->bq_size <= q->bq_maxsize - bqueue_threshold(q))
 		cv_signal(&q->bq_add_cv);
 	mutex_exit(&q->bq_lock);
-	return (ret);
+
+	return (list_remove_head(&q->bq_take));
 }
 
 /*
- * Returns true if the space used is 0.
+ * Returns true if the space used is 0.  Only the consumer may call this.
  */
 boolean_t
 bqueue_empty(bqueue_t *q)
 {
-	return (q->bq_size == 0);
+	return (q->bq_size == 0 && list_is_empty(&q->bq_take));
+}
+
+/*
+ * Initialize the BQUEUE_KSTAT_COUNT named kstats, starting at knp, which
+ * describe the queue feeding the given stage of a pipeline: how full it
+ * is, the total size of the items which went through it, and how long
+ * its producers and consumers were blocked on it.
+ */
+void
+bqueue_kstat_init(kstat_named_t *knp, const char *stage)
+{
+	static const char *suffix[BQUEUE_KSTAT_COUNT] = {
+		"fill", "bytes", "enqueue_wait_ns", "dequeue_wait_ns"
+	};
+
+	for (int i = 0; i < BQUEUE_KSTAT_COUNT; i++) {
+		(void) snprintf(knp[i].name, sizeof (knp[i].name), "%s_%s",
+		    stage, suffix[i]);
+		knp[i].data_type = KSTAT_DATA_UINT64;
+		knp[i].value.ui64 = 0;
+	}
+}
+
+/*
+ * Update the named kstats initialized by bqueue_kstat_init().  The values
+ * are read without the queue's lock, so they may be slightly stale.
+ */
+void
+bqueue_kstat_update(bqueue_t *q, kstat_named_t *knp)
+{
+	knp[0].value.ui64 = q->bq_size;
+	knp[1].value.ui64 = q->bq_bytes;
+	knp[2].value.ui64 = q->bq_enqueue_wait;
+	knp[3].value.ui64 = q->bq_dequeue_wait;
 }
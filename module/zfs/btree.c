@@ -0,0 +1,841 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * B-Tree implementation.
+ *
+ * This is a classic B-Tree: every element is stored exactly once, either
+ * in a leaf or in a core (interior) node, where it separates the subtrees
+ * of its two neighbouring children.  Because the separators are real
+ * elements rather than copies, modifying an element in place (without
+ * changing its position in the sort order) never leaves stale keys behind,
+ * which the range tree relies on when it grows or shrinks a segment.
+ *
+ * Leaves are BTREE_LEAF_SIZE bytes and hold as many elements as fit; core
+ * nodes hold BTREE_CORE_ELEMS elements.  All nodes except the root are
+ * kept at least half full.  When an insertion overflows a node it is split
+ * in two around its median element, which moves up into the parent.  When
+ * a removal leaves a node under-full it borrows an element from a sibling
+ * through the parent, or is merged with a sibling.
+ */
+
+#include	<sys/btree.h>
+#include	<sys/zfs_context.h>
+
+kmem_cache_t *zfs_btree_leaf_cache;
+
+/*
+ * Control the extent of the verification that occurs when zfs_btree_verify
+ * is called.  0 disables it, 1 checks the node counts and parent pointers,
+ * 2 also verifies the ordering of every element.
+ */
+int zfs_btree_verify_intensity = 0;
+
+#define	BT_CORE_SIZE(tree)	\
+	(sizeof (zfs_btree_core_t) + BTREE_CORE_ELEMS * (tree)->bt_elem_size)
+#define	BT_MIN_CORE		((BTREE_CORE_ELEMS - 1) / 2)
+#define	BT_MIN_LEAF(tree)	(((tree)->bt_leaf_cap - 1) / 2)
+
+static inline uint8_t *
+bt_elems(zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core)
+		return (((zfs_btree_core_t *)hdr)->btc_elems);
+	return (((zfs_btree_leaf_t *)hdr)->btl_elems);
+}
+
+static inline uint8_t *
+bt_elem(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, uint32_t idx)
+{
+	return (bt_elems(hdr) + idx * tree->bt_elem_size);
+}
+
+static inline zfs_btree_hdr_t *
+bt_child(zfs_btree_hdr_t *hdr, uint32_t idx)
+{
+	ASSERT(hdr->bth_core);
+	return (((zfs_btree_core_t *)hdr)->btc_children[idx]);
+}
+
+void
+zfs_btree_init(void)
+{
+	zfs_btree_leaf_cache = kmem_cache_create("zfs_btree_leaf_cache",
+	    BTREE_LEAF_SIZE, 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+zfs_btree_fini(void)
+{
+	kmem_cache_destroy(zfs_btree_leaf_cache);
+}
+
+void
+zfs_btree_reap(void)
+{
+	kmem_cache_reap_now(zfs_btree_leaf_cache);
+}
+
+void
+zfs_btree_create(zfs_btree_t *tree, int (*compar) (const void *, const void *),
+    size_t size)
+{
+	/* Leaves must be able to hold a meaningful number of elements. */
+	ASSERT3U(size, <=, (BTREE_LEAF_SIZE - sizeof (zfs_btree_hdr_t)) / 4);
+
+	bzero(tree, sizeof (*tree));
+	tree->bt_compar = compar;
+	tree->bt_elem_size = size;
+	tree->bt_leaf_cap = (BTREE_LEAF_SIZE - sizeof (zfs_btree_hdr_t)) / size;
+	tree->bt_height = -1;
+	tree->bt_root = NULL;
+}
+
+static zfs_btree_hdr_t *
+zfs_btree_node_alloc(zfs_btree_t *tree, boolean_t core)
+{
+	zfs_btree_hdr_t *hdr;
+
+	if (core) {
+		hdr = kmem_alloc(BT_CORE_SIZE(tree), KM_SLEEP);
+	} else {
+		hdr = kmem_cache_alloc(zfs_btree_leaf_cache, KM_SLEEP);
+	}
+	hdr->bth_parent = NULL;
+	hdr->bth_core = core;
+	hdr->bth_count = 0;
+	tree->bt_num_nodes++;
+
+	return (hdr);
+}
+
+static void
+zfs_btree_node_free(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	ASSERT3U(tree->bt_num_nodes, >, 0);
+	tree->bt_num_nodes--;
+
+	if (hdr->bth_core)
+		kmem_free(hdr, BT_CORE_SIZE(tree));
+	else
+		kmem_cache_free(zfs_btree_leaf_cache, hdr);
+}
+
+/*
+ * Binary search for "value" in the elements of a node.  On a match returns
+ * the element and sets where->bti_offset to its position; otherwise returns
+ * NULL and sets where->bti_offset to the insertion point.
+ */
+static void *
+zfs_btree_find_in_node(zfs_btree_t *tree, zfs_btree_hdr_t *hdr,
+    const void *value, zfs_btree_index_t *where)
+{
+	uint32_t min = 0, max = hdr->bth_count;
+	uint8_t *elems = bt_elems(hdr);
+	size_t size = tree->bt_elem_size;
+
+	while (max > min) {
+		uint32_t idx = (min + max) / 2;
+		uint8_t *cur = elems + idx * size;
+		int comp = tree->bt_compar(cur, value);
+
+		if (comp < 0) {
+			min = idx + 1;
+		} else if (comp > 0) {
+			max = idx;
+		} else {
+			where->bti_node = hdr;
+			where->bti_offset = idx;
+			where->bti_before = B_FALSE;
+			return (cur);
+		}
+	}
+
+	where->bti_node = hdr;
+	where->bti_offset = max;
+	where->bti_before = B_TRUE;
+	return (NULL);
+}
+
+void *
+zfs_btree_find(zfs_btree_t *tree, const void *value, zfs_btree_index_t *where)
+{
+	zfs_btree_index_t idx;
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (tree->bt_height == -1) {
+		if (where != NULL) {
+			where->bti_node = NULL;
+			where->bti_offset = 0;
+			where->bti_before = B_TRUE;
+		}
+		return (NULL);
+	}
+
+	for (;;) {
+		void *d = zfs_btree_find_in_node(tree, hdr, value, &idx);
+
+		if (d != NULL || !hdr->bth_core) {
+			if (where != NULL)
+				*where = idx;
+			return (d);
+		}
+		hdr = bt_child(hdr, idx.bti_offset);
+	}
+}
+
+/*
+ * Return the position of "child" within its parent's children array.
+ */
+static uint32_t
+zfs_btree_child_idx(zfs_btree_hdr_t *child)
+{
+	zfs_btree_core_t *parent = child->bth_parent;
+
+	ASSERT3P(parent, !=, NULL);
+	for (uint32_t i = 0; i <= parent->btc_hdr.bth_count; i++) {
+		if (parent->btc_children[i] == child)
+			return (i);
+	}
+	panic("btree child %p not found in parent %p", (void *)child,
+	    (void *)parent);
+	return (0);
+}
+
+/*
+ * Insert "value" into a node at position "idx", shifting the following
+ * elements (and for core nodes, children after idx) up by one.  The node
+ * must have room.  "child" is the new right-hand child of the element for
+ * core nodes and ignored for leaves.
+ */
+static void
+zfs_btree_insert_into_node(zfs_btree_t *tree, zfs_btree_hdr_t *hdr,
+    uint32_t idx, const void *value, zfs_btree_hdr_t *child)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t count = hdr->bth_count;
+	uint8_t *elems = bt_elems(hdr);
+
+	ASSERT3U(idx, <=, count);
+	memmove(elems + (idx + 1) * size, elems + idx * size,
+	    (count - idx) * size);
+	bcopy(value, elems + idx * size, size);
+
+	if (hdr->bth_core) {
+		zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+
+		ASSERT3U(count, <, BTREE_CORE_ELEMS);
+		memmove(&core->btc_children[idx + 2],
+		    &core->btc_children[idx + 1],
+		    (count - idx) * sizeof (zfs_btree_hdr_t *));
+		core->btc_children[idx + 1] = child;
+		child->bth_parent = core;
+	} else {
+		ASSERT3U(count, <, tree->bt_leaf_cap);
+	}
+	hdr->bth_count++;
+}
+
+/*
+ * After "old" has been split, insert the median element "value" and the new
+ * right-hand node "new" into old's parent, splitting it in turn if needed.
+ */
+static void
+zfs_btree_insert_into_parent(zfs_btree_t *tree, zfs_btree_hdr_t *old,
+    const void *value, zfs_btree_hdr_t *new)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_core_t *parent = old->bth_parent;
+
+	if (parent == NULL) {
+		/* Splitting the root grows the tree by one level. */
+		zfs_btree_core_t *root =
+		    (zfs_btree_core_t *)zfs_btree_node_alloc(tree, B_TRUE);
+
+		bcopy(value, root->btc_elems, size);
+		root->btc_children[0] = old;
+		root->btc_children[1] = new;
+		root->btc_hdr.bth_count = 1;
+		old->bth_parent = root;
+		new->bth_parent = root;
+		tree->bt_root = &root->btc_hdr;
+		tree->bt_height++;
+		return;
+	}
+
+	uint32_t idx = zfs_btree_child_idx(old);
+	uint32_t count = parent->btc_hdr.bth_count;
+
+	if (count < BTREE_CORE_ELEMS) {
+		zfs_btree_insert_into_node(tree, &parent->btc_hdr, idx, value,
+		    new);
+		return;
+	}
+
+	/*
+	 * The parent is full.  Build the combined element and child arrays
+	 * in scratch space, then redistribute them over the parent and a new
+	 * sibling around the median element, which moves up a level.
+	 */
+	uint32_t n = count + 1;
+	uint32_t mid = n / 2;
+	uint8_t *elems = kmem_alloc(n * size, KM_SLEEP);
+	zfs_btree_hdr_t **kids = kmem_alloc((n + 1) * sizeof (*kids),
+	    KM_SLEEP);
+
+	bcopy(parent->btc_elems, elems, idx * size);
+	bcopy(value, elems + idx * size, size);
+	bcopy(parent->btc_elems + idx * size, elems + (idx + 1) * size,
+	    (count - idx) * size);
+	bcopy(parent->btc_children, kids, (idx + 1) * sizeof (*kids));
+	kids[idx + 1] = new;
+	bcopy(&parent->btc_children[idx + 1], &kids[idx + 2],
+	    (count - idx) * sizeof (*kids));
+
+	zfs_btree_core_t *sibling =
+	    (zfs_btree_core_t *)zfs_btree_node_alloc(tree, B_TRUE);
+
+	bcopy(elems, parent->btc_elems, mid * size);
+	bcopy(kids, parent->btc_children, (mid + 1) * sizeof (*kids));
+	parent->btc_hdr.bth_count = mid;
+	for (uint32_t i = 0; i <= mid; i++)
+		kids[i]->bth_parent = parent;
+
+	bcopy(elems + (mid + 1) * size, sibling->btc_elems,
+	    (n - mid - 1) * size);
+	bcopy(&kids[mid + 1], sibling->btc_children,
+	    (n - mid) * sizeof (*kids));
+	sibling->btc_hdr.bth_count = n - mid - 1;
+	for (uint32_t i = mid + 1; i <= n; i++)
+		kids[i]->bth_parent = sibling;
+
+	uint8_t *median = kmem_alloc(size, KM_SLEEP);
+	bcopy(elems + mid * size, median, size);
+	kmem_free(elems, n * size);
+	kmem_free(kids, (n + 1) * sizeof (*kids));
+
+	zfs_btree_insert_into_parent(tree, &parent->btc_hdr, median,
+	    &sibling->btc_hdr);
+	kmem_free(median, size);
+}
+
+void
+zfs_btree_add_idx(zfs_btree_t *tree, const void *value,
+    const zfs_btree_index_t *where)
+{
+	size_t size = tree->bt_elem_size;
+
+	if (tree->bt_height == -1) {
+		ASSERT3P(where->bti_node, ==, NULL);
+		zfs_btree_hdr_t *leaf = zfs_btree_node_alloc(tree, B_FALSE);
+
+		bcopy(value, bt_elems(leaf), size);
+		leaf->bth_count = 1;
+		tree->bt_root = leaf;
+		tree->bt_height = 0;
+		tree->bt_num_elems = 1;
+		return;
+	}
+
+	zfs_btree_hdr_t *leaf = where->bti_node;
+	uint32_t idx = where->bti_offset;
+	uint32_t cap = tree->bt_leaf_cap;
+
+	ASSERT(where->bti_before);
+	ASSERT(!leaf->bth_core);
+	tree->bt_num_elems++;
+
+	if (leaf->bth_count < cap) {
+		zfs_btree_insert_into_node(tree, leaf, idx, value, NULL);
+		return;
+	}
+
+	/*
+	 * The leaf is full; split it.  The combined sequence of cap + 1
+	 * elements is divided into the leaf's new contents, a median that
+	 * moves up into the parent, and the new right-hand leaf.
+	 */
+	uint32_t n = cap + 1;
+	uint32_t mid = n / 2;
+	uint8_t *elems = kmem_alloc(n * size, KM_SLEEP);
+	uint8_t *lelems = bt_elems(leaf);
+
+	bcopy(lelems, elems, idx * size);
+	bcopy(value, elems + idx * size, size);
+	bcopy(lelems + idx * size, elems + (idx + 1) * size,
+	    (cap - idx) * size);
+
+	zfs_btree_hdr_t *sibling = zfs_btree_node_alloc(tree, B_FALSE);
+
+	bcopy(elems, lelems, mid * size);
+	leaf->bth_count = mid;
+	bcopy(elems + (mid + 1) * size, bt_elems(sibling),
+	    (n - mid - 1) * size);
+	sibling->bth_count = n - mid - 1;
+
+	zfs_btree_insert_into_parent(tree, leaf, elems + mid * size, sibling);
+	kmem_free(elems, n * size);
+}
+
+void
+zfs_btree_add(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where;
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), ==, NULL);
+	zfs_btree_add_idx(tree, value, &where);
+}
+
+static zfs_btree_hdr_t *
+zfs_btree_leftmost_leaf(zfs_btree_hdr_t *hdr)
+{
+	while (hdr->bth_core)
+		hdr = bt_child(hdr, 0);
+	return (hdr);
+}
+
+static zfs_btree_hdr_t *
+zfs_btree_rightmost_leaf(zfs_btree_hdr_t *hdr)
+{
+	while (hdr->bth_core)
+		hdr = bt_child(hdr, hdr->bth_count);
+	return (hdr);
+}
+
+void *
+zfs_btree_first(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	if (tree->bt_height == -1) {
+		ASSERT0(tree->bt_num_elems);
+		return (NULL);
+	}
+
+	zfs_btree_hdr_t *leaf = zfs_btree_leftmost_leaf(tree->bt_root);
+	if (where != NULL) {
+		where->bti_node = leaf;
+		where->bti_offset = 0;
+		where->bti_before = B_FALSE;
+	}
+	return (bt_elem(tree, leaf, 0));
+}
+
+void *
+zfs_btree_last(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	if (tree->bt_height == -1) {
+		ASSERT0(tree->bt_num_elems);
+		return (NULL);
+	}
+
+	zfs_btree_hdr_t *leaf = zfs_btree_rightmost_leaf(tree->bt_root);
+	if (where != NULL) {
+		where->bti_node = leaf;
+		where->bti_offset = leaf->bth_count - 1;
+		where->bti_before = B_FALSE;
+	}
+	return (bt_elem(tree, leaf, leaf->bth_count - 1));
+}
+
+void *
+zfs_btree_next(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t offset = idx->bti_offset;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (hdr->bth_core) {
+		/* The successor is the first element of the right subtree. */
+		ASSERT(!idx->bti_before);
+		zfs_btree_hdr_t *leaf =
+		    zfs_btree_leftmost_leaf(bt_child(hdr, offset + 1));
+		out_idx->bti_node = leaf;
+		out_idx->bti_offset = 0;
+		out_idx->bti_before = B_FALSE;
+		return (bt_elem(tree, leaf, 0));
+	}
+
+	uint32_t new_off = idx->bti_before ? offset : offset + 1;
+	if (new_off < hdr->bth_count) {
+		out_idx->bti_node = hdr;
+		out_idx->bti_offset = new_off;
+		out_idx->bti_before = B_FALSE;
+		return (bt_elem(tree, hdr, new_off));
+	}
+
+	/*
+	 * We ran off the end of the leaf; the successor is the separator
+	 * to the right of the first ancestor we are not the last child of.
+	 */
+	zfs_btree_hdr_t *prev = hdr;
+	for (zfs_btree_core_t *core = hdr->bth_parent; core != NULL;
+	    prev = &core->btc_hdr, core = core->btc_hdr.bth_parent) {
+		uint32_t i = zfs_btree_child_idx(prev);
+		if (i < core->btc_hdr.bth_count) {
+			out_idx->bti_node = &core->btc_hdr;
+			out_idx->bti_offset = i;
+			out_idx->bti_before = B_FALSE;
+			return (bt_elem(tree, &core->btc_hdr, i));
+		}
+	}
+
+	return (NULL);
+}
+
+void *
+zfs_btree_prev(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t offset = idx->bti_offset;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (hdr->bth_core) {
+		/* The predecessor is the last element of the left subtree. */
+		ASSERT(!idx->bti_before);
+		zfs_btree_hdr_t *leaf =
+		    zfs_btree_rightmost_leaf(bt_child(hdr, offset));
+		out_idx->bti_node = leaf;
+		out_idx->bti_offset = leaf->bth_count - 1;
+		out_idx->bti_before = B_FALSE;
+		return (bt_elem(tree, leaf, leaf->bth_count - 1));
+	}
+
+	if (offset > 0) {
+		out_idx->bti_node = hdr;
+		out_idx->bti_offset = offset - 1;
+		out_idx->bti_before = B_FALSE;
+		return (bt_elem(tree, hdr, offset - 1));
+	}
+
+	zfs_btree_hdr_t *prev = hdr;
+	for (zfs_btree_core_t *core = hdr->bth_parent; core != NULL;
+	    prev = &core->btc_hdr, core = core->btc_hdr.bth_parent) {
+		uint32_t i = zfs_btree_child_idx(prev);
+		if (i > 0) {
+			out_idx->bti_node = &core->btc_hdr;
+			out_idx->bti_offset = i - 1;
+			out_idx->bti_before = B_FALSE;
+			return (bt_elem(tree, &core->btc_hdr, i - 1));
+		}
+	}
+
+	return (NULL);
+}
+
+void *
+zfs_btree_get(zfs_btree_t *tree, zfs_btree_index_t *idx)
+{
+	ASSERT(!idx->bti_before);
+	ASSERT3U(idx->bti_offset, <, idx->bti_node->bth_count);
+	return (bt_elem(tree, idx->bti_node, idx->bti_offset));
+}
+
+/*
+ * Merge "right" into "left", its immediate left sibling, pulling down the
+ * separating element at position "sep" of their parent, and free "right".
+ */
+static void
+zfs_btree_merge(zfs_btree_t *tree, zfs_btree_hdr_t *left,
+    zfs_btree_hdr_t *right, uint32_t sep)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_core_t *parent = left->bth_parent;
+	uint32_t lcount = left->bth_count, rcount = right->bth_count;
+
+	ASSERT3P(right->bth_parent, ==, parent);
+	ASSERT3P(parent->btc_children[sep], ==, left);
+	ASSERT3P(parent->btc_children[sep + 1], ==, right);
+
+	bcopy(parent->btc_elems + sep * size, bt_elem(tree, left, lcount),
+	    size);
+	bcopy(bt_elems(right), bt_elem(tree, left, lcount + 1),
+	    rcount * size);
+
+	if (left->bth_core) {
+		zfs_btree_core_t *lcore = (zfs_btree_core_t *)left;
+		zfs_btree_core_t *rcore = (zfs_btree_core_t *)right;
+
+		ASSERT3U(lcount + rcount + 1, <=, BTREE_CORE_ELEMS);
+		for (uint32_t i = 0; i <= rcount; i++) {
+			lcore->btc_children[lcount + 1 + i] =
+			    rcore->btc_children[i];
+			rcore->btc_children[i]->bth_parent = lcore;
+		}
+	} else {
+		ASSERT3U(lcount + rcount + 1, <=, tree->bt_leaf_cap);
+	}
+	left->bth_count = lcount + rcount + 1;
+	zfs_btree_node_free(tree, right);
+
+	/* Remove the separator and the right child from the parent. */
+	uint32_t pcount = parent->btc_hdr.bth_count;
+	memmove(parent->btc_elems + sep * size,
+	    parent->btc_elems + (sep + 1) * size, (pcount - sep - 1) * size);
+	memmove(&parent->btc_children[sep + 1], &parent->btc_children[sep + 2],
+	    (pcount - sep - 1) * sizeof (zfs_btree_hdr_t *));
+	parent->btc_hdr.bth_count--;
+}
+
+/*
+ * Restore the minimum fill of a node that has become too small, by either
+ * borrowing an element from a sibling or merging with it.
+ */
+static void
+zfs_btree_rebalance(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_core_t *parent = hdr->bth_parent;
+	uint32_t min = hdr->bth_core ? BT_MIN_CORE : BT_MIN_LEAF(tree);
+
+	if (parent == NULL) {
+		/* The root may be arbitrarily small, but not empty. */
+		if (hdr->bth_count > 0)
+			return;
+		if (hdr->bth_core) {
+			zfs_btree_hdr_t *child = bt_child(hdr, 0);
+
+			child->bth_parent = NULL;
+			tree->bt_root = child;
+			tree->bt_height--;
+		} else {
+			tree->bt_root = NULL;
+			tree->bt_height = -1;
+		}
+		zfs_btree_node_free(tree, hdr);
+		return;
+	}
+
+	if (hdr->bth_count >= min)
+		return;
+
+	uint32_t idx = zfs_btree_child_idx(hdr);
+	uint32_t pcount = parent->btc_hdr.bth_count;
+	zfs_btree_hdr_t *left = idx > 0 ? parent->btc_children[idx - 1] : NULL;
+	zfs_btree_hdr_t *right = idx < pcount ?
+	    parent->btc_children[idx + 1] : NULL;
+	uint8_t *elems = bt_elems(hdr);
+	uint32_t count = hdr->bth_count;
+
+	if (left != NULL && left->bth_count > min) {
+		/* Rotate the parent separator down and left's last one up. */
+		memmove(elems + size, elems, count * size);
+		bcopy(parent->btc_elems + (idx - 1) * size, elems, size);
+		bcopy(bt_elem(tree, left, left->bth_count - 1),
+		    parent->btc_elems + (idx - 1) * size, size);
+		if (hdr->bth_core) {
+			zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+			zfs_btree_core_t *lcore = (zfs_btree_core_t *)left;
+
+			memmove(&core->btc_children[1], &core->btc_children[0],
+			    (count + 1) * sizeof (zfs_btree_hdr_t *));
+			core->btc_children[0] =
+			    lcore->btc_children[left->bth_count];
+			core->btc_children[0]->bth_parent = core;
+		}
+		left->bth_count--;
+		hdr->bth_count++;
+		return;
+	}
+
+	if (right != NULL && right->bth_count > min) {
+		/* Rotate the parent separator down and right's first one up. */
+		uint8_t *relems = bt_elems(right);
+		uint32_t rcount = right->bth_count;
+
+		bcopy(parent->btc_elems + idx * size, elems + count * size,
+		    size);
+		bcopy(relems, parent->btc_elems + idx * size, size);
+		memmove(relems, relems + size, (rcount - 1) * size);
+		if (hdr->bth_core) {
+			zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+			zfs_btree_core_t *rcore = (zfs_btree_core_t *)right;
+
+			core->btc_children[count + 1] = rcore->btc_children[0];
+			core->btc_children[count + 1]->bth_parent = core;
+			memmove(&rcore->btc_children[0],
+			    &rcore->btc_children[1],
+			    rcount * sizeof (zfs_btree_hdr_t *));
+		}
+		right->bth_count--;
+		hdr->bth_count++;
+		return;
+	}
+
+	if (left != NULL)
+		zfs_btree_merge(tree, left, hdr, idx - 1);
+	else
+		zfs_btree_merge(tree, hdr, right, idx);
+
+	zfs_btree_rebalance(tree, &parent->btc_hdr);
+}
+
+void
+zfs_btree_remove_idx(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_hdr_t *hdr = where->bti_node;
+	uint32_t idx = where->bti_offset;
+
+	ASSERT(!where->bti_before);
+	ASSERT3U(idx, <, hdr->bth_count);
+	ASSERT3U(tree->bt_num_elems, >, 0);
+
+	if (hdr->bth_core) {
+		/*
+		 * Replace the element with its predecessor, which is always
+		 * the last element of a leaf, and remove that instead.
+		 */
+		zfs_btree_hdr_t *leaf =
+		    zfs_btree_rightmost_leaf(bt_child(hdr, idx));
+
+		bcopy(bt_elem(tree, leaf, leaf->bth_count - 1),
+		    bt_elem(tree, hdr, idx), size);
+		hdr = leaf;
+		idx = leaf->bth_count - 1;
+	}
+
+	uint8_t *elems = bt_elems(hdr);
+	memmove(elems + idx * size, elems + (idx + 1) * size,
+	    (hdr->bth_count - idx - 1) * size);
+	hdr->bth_count--;
+	tree->bt_num_elems--;
+
+	zfs_btree_rebalance(tree, hdr);
+}
+
+void
+zfs_btree_remove(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where;
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), !=, NULL);
+	zfs_btree_remove_idx(tree, &where);
+}
+
+ulong_t
+zfs_btree_numnodes(zfs_btree_t *tree)
+{
+	return (tree->bt_num_elems);
+}
+
+static void
+zfs_btree_clear_helper(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core) {
+		for (uint32_t i = 0; i <= hdr->bth_count; i++)
+			zfs_btree_clear_helper(tree, bt_child(hdr, i));
+	}
+	zfs_btree_node_free(tree, hdr);
+}
+
+void
+zfs_btree_clear(zfs_btree_t *tree)
+{
+	if (tree->bt_root != NULL)
+		zfs_btree_clear_helper(tree, tree->bt_root);
+
+	ASSERT0(tree->bt_num_nodes);
+	tree->bt_root = NULL;
+	tree->bt_height = -1;
+	tree->bt_num_elems = 0;
+}
+
+void
+zfs_btree_destroy(zfs_btree_t *tree)
+{
+	ASSERT0(tree->bt_num_elems);
+	ASSERT3P(tree->bt_root, ==, NULL);
+	ASSERT0(tree->bt_num_nodes);
+}
+
+/*
+ * Verify a subtree, returning the number of elements in it.  "lo" and "hi"
+ * bound the elements of the subtree (exclusive) and may be NULL.
+ */
+static uint64_t
+zfs_btree_verify_helper(zfs_btree_t *tree, zfs_btree_hdr_t *hdr,
+    const void *lo, const void *hi, int64_t depth)
+{
+	uint64_t elems = hdr->bth_count;
+
+	if (hdr != tree->bt_root) {
+		VERIFY3U(hdr->bth_count, >=, hdr->bth_core ? BT_MIN_CORE :
+		    BT_MIN_LEAF(tree));
+	}
+	VERIFY3U(hdr->bth_count, <=, hdr->bth_core ? BTREE_CORE_ELEMS :
+	    tree->bt_leaf_cap);
+	VERIFY3S(hdr->bth_core, ==, depth < tree->bt_height);
+
+	if (zfs_btree_verify_intensity >= 2) {
+		for (uint32_t i = 0; i < hdr->bth_count; i++) {
+			void *cur = bt_elem(tree, hdr, i);
+			void *prev = i > 0 ? bt_elem(tree, hdr, i - 1) :
+			    (void *)lo;
+
+			if (prev != NULL)
+				VERIFY3S(tree->bt_compar(prev, cur), <, 0);
+		}
+		if (hi != NULL && hdr->bth_count > 0) {
+			VERIFY3S(tree->bt_compar(bt_elem(tree, hdr,
+			    hdr->bth_count - 1), hi), <, 0);
+		}
+	}
+
+	if (!hdr->bth_core)
+		return (elems);
+
+	for (uint32_t i = 0; i <= hdr->bth_count; i++) {
+		zfs_btree_hdr_t *child = bt_child(hdr, i);
+
+		VERIFY3P(child->bth_parent, ==, hdr);
+		elems += zfs_btree_verify_helper(tree, child,
+		    i > 0 ? bt_elem(tree, hdr, i - 1) : lo,
+		    i < hdr->bth_count ? bt_elem(tree, hdr, i) : hi,
+		    depth + 1);
+	}
+	return (elems);
+}
+
+void
+zfs_btree_verify(zfs_btree_t *tree)
+{
+	if (zfs_btree_verify_intensity == 0)
+		return;
+
+	if (tree->bt_height == -1) {
+		VERIFY3P(tree->bt_root, ==, NULL);
+		VERIFY0(tree->bt_num_elems);
+		return;
+	}
+	VERIFY3P(tree->bt_root->bth_parent, ==, NULL);
+	VERIFY3U(zfs_btree_verify_helper(tree, tree->bt_root, NULL, NULL, 0),
+	    ==, tree->bt_num_elems);
+}
+
+#if defined(_KERNEL)
+ZFS_MODULE_PARAM(zfs, zfs_, btree_verify_intensity, INT, ZMOD_RW,
+	"Enable btree verification: 1 checks structure, 2 also ordering");
+#endif
@@ -49,6 +49,7 @@
 #endif
 #include <sys/callb.h>
 #include <sys/abd.h>
+#include <sys/aggsum.h>
 #include <sys/vdev.h>
 #include <sys/cityhash.h>
 #include <sys/spa_impl.h>
@@ -251,12 +252,16 @@ static boolean_t dbuf_evict_thread_exit;
  *
  * If a given dbuf meets the requirements for the metadata cache, it will go
  * there, otherwise it will be considered for the generic LRU dbuf cache. The
- * caches and the refcounts tracking their sizes are stored in an array indexed
+ * caches and the aggsums tracking their sizes are stored in an array indexed
  * by those caches' matching enum values (from dbuf_cached_state_t).
+ *
+ * Each CPU inserts released dbufs into its own sublist of a cache, and the
+ * sizes are per-CPU aggsums, so that releasing dbufs on different CPUs does
+ * not contend on a shared lock or counter.  Each sublist is still an LRU.
  */
 typedef struct dbuf_cache {
 	multilist_t *cache;
-	zfs_refcount_t size;
+	aggsum_t size;
 } dbuf_cache_t;
 dbuf_cache_t dbuf_caches[DB_CACHE_MAX];
 
@@ -312,6 +317,16 @@ int dbuf_cache_metadata_shift = 6;
 uint_t dbuf_cache_hiwater_pct = 10;
 uint_t dbuf_cache_lowater_pct = 10;
 
+/*
+ * Number of threads evicting from the dbuf cache once it is above its
+ * maximum size, each working through a different set of sublists.  Zero
+ * selects one thread per eight CPUs.  Only read when the module is loaded.
+ */
+int dbuf_evict_threads = 0;
+static int dbuf_evict_nthreads;
+static taskq_t *dbuf_evict_taskq;
+static unsigned int dbuf_evict_start;
+
 /* ARGSUSED */
 static int
 dbuf_cons(void *vdb, void *unused, int kmflag)
@@ -374,18 +389,18 @@ dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid)
 	hv = dbuf_hash(os, obj, level, blkid);
 	idx = hv & h->hash_table_mask;
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
+	rw_enter(DBUF_HASH_RWLOCK(h, idx), RW_READER);
 	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
 		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
 			mutex_enter(&db->db_mtx);
 			if (db->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				rw_exit(DBUF_HASH_RWLOCK(h, idx));
 				return (db);
 			}
 			mutex_exit(&db->db_mtx);
 		}
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	rw_exit(DBUF_HASH_RWLOCK(h, idx));
 	return (NULL);
 }
 
@@ -428,13 +443,13 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	hv = dbuf_hash(os, obj, level, blkid);
 	idx = hv & h->hash_table_mask;
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
+	rw_enter(DBUF_HASH_RWLOCK(h, idx), RW_WRITER);
 	for (dbf = h->hash_table[idx], i = 0; dbf != NULL;
 	    dbf = dbf->db_hash_next, i++) {
 		if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
 			mutex_enter(&dbf->db_mtx);
 			if (dbf->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				rw_exit(DBUF_HASH_RWLOCK(h, idx));
 				return (dbf);
 			}
 			mutex_exit(&dbf->db_mtx);
@@ -452,7 +467,7 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	mutex_enter(&db->db_mtx);
 	db->db_hash_next = h->hash_table[idx];
 	h->hash_table[idx] = db;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	rw_exit(DBUF_HASH_RWLOCK(h, idx));
 	atomic_inc_64(&dbuf_hash_count);
 	DBUF_STAT_MAX(hash_elements_max, dbuf_hash_count);
 
@@ -480,9 +495,8 @@ dbuf_include_in_metadata_cache(dmu_buf_impl_t *db)
 		 * Sanity check for small-memory systems: don't allocate too
 		 * much memory for this purpose.
 		 */
-		if (zfs_refcount_count(
-		    &dbuf_caches[DB_DBUF_METADATA_CACHE].size) >
-		    dbuf_cache_metadata_max_bytes) {
+		if (aggsum_compare(&dbuf_caches[DB_DBUF_METADATA_CACHE].size,
+		    dbuf_cache_metadata_max_bytes) > 0) {
 			DBUF_STAT_BUMP(metadata_cache_overflow);
 			return (B_FALSE);
 		}
@@ -509,13 +523,13 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 
 	/*
 	 * We mustn't hold db_mtx to maintain lock ordering:
-	 * DBUF_HASH_MUTEX > db_mtx.
+	 * DBUF_HASH_RWLOCK > db_mtx.
 	 */
 	ASSERT(zfs_refcount_is_zero(&db->db_holds));
 	ASSERT(db->db_state == DB_EVICTING);
 	ASSERT(!MUTEX_HELD(&db->db_mtx));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
+	rw_enter(DBUF_HASH_RWLOCK(h, idx), RW_WRITER);
 	dbp = &h->hash_table[idx];
 	while ((dbf = *dbp) != db) {
 		dbp = &dbf->db_hash_next;
@@ -526,7 +540,7 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	if (h->hash_table[idx] &&
 	    h->hash_table[idx]->db_hash_next == NULL)
 		DBUF_STAT_BUMPDOWN(hash_chains);
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	rw_exit(DBUF_HASH_RWLOCK(h, idx));
 	atomic_dec_64(&dbuf_hash_count);
 }
 
@@ -632,32 +646,18 @@ dbuf_is_metadata(dmu_buf_impl_t *db)
 
 
 /*
- * This function *must* return indices evenly distributed between all
- * sublists of the multilist. This is needed due to how the dbuf eviction
- * code is laid out; dbuf_evict_thread() assumes dbufs are evenly
- * distributed between all sublists and uses this assumption when
- * deciding which sublist to evict from and how much to evict from it.
+ * The sublist of a dbuf is chosen by dbuf_rele_and_unlock() from the CPU
+ * releasing it, and stored in the dbuf until it is removed.  The eviction
+ * threads go round all sublists, so an uneven distribution only changes
+ * which sublists they find dbufs in.
  */
 unsigned int
 dbuf_cache_multilist_index_func(multilist_t *ml, void *obj)
 {
 	dmu_buf_impl_t *db = obj;
 
-	/*
-	 * The assumption here, is the hash value for a given
-	 * dmu_buf_impl_t will remain constant throughout it's lifetime
-	 * (i.e. it's objset, object, level and blkid fields don't change).
-	 * Thus, we don't need to store the dbuf's sublist index
-	 * on insertion, as this index can be recalculated on removal.
-	 *
-	 * Also, the low order bits of the hash value are thought to be
-	 * distributed evenly. Otherwise, in the case that the multilist
-	 * has a power of two number of sublists, each sublists' usage
-	 * would not be evenly distributed.
-	 */
-	return (dbuf_hash(db->db_objset, db->db.db_object,
-	    db->db_level, db->db_blkid) %
-	    multilist_get_num_sublists(ml));
+	ASSERT3U(db->db_cache_sublist, <, multilist_get_num_sublists(ml));
+	return (db->db_cache_sublist);
 }
 
 static inline unsigned long
@@ -686,24 +686,23 @@ dbuf_cache_lowater_bytes(void)
 static inline boolean_t
 dbuf_cache_above_hiwater(void)
 {
-	return (zfs_refcount_count(&dbuf_caches[DB_DBUF_CACHE].size) >
-	    dbuf_cache_hiwater_bytes());
+	return (aggsum_compare(&dbuf_caches[DB_DBUF_CACHE].size,
+	    dbuf_cache_hiwater_bytes()) > 0);
 }
 
 static inline boolean_t
 dbuf_cache_above_lowater(void)
 {
-	return (zfs_refcount_count(&dbuf_caches[DB_DBUF_CACHE].size) >
-	    dbuf_cache_lowater_bytes());
+	return (aggsum_compare(&dbuf_caches[DB_DBUF_CACHE].size,
+	    dbuf_cache_lowater_bytes()) > 0);
 }
 
 /*
- * Evict the oldest eligible dbuf from the dbuf cache.
+ * Evict the oldest eligible dbuf from the given sublist of the dbuf cache.
  */
 static void
-dbuf_evict_one(void)
+dbuf_evict_one(unsigned int idx)
 {
-	int idx = multilist_get_random_index(dbuf_caches[DB_DBUF_CACHE].cache);
 	multilist_sublist_t *mls = multilist_sublist_lock(
 	    dbuf_caches[DB_DBUF_CACHE].cache, idx);
 
@@ -720,8 +719,8 @@ dbuf_evict_one(void)
 	if (db != NULL) {
 		multilist_sublist_remove(mls, db);
 		multilist_sublist_unlock(mls);
-		(void) zfs_refcount_remove_many(
-		    &dbuf_caches[DB_DBUF_CACHE].size, db->db.db_size, db);
+		aggsum_add(&dbuf_caches[DB_DBUF_CACHE].size,
+		    -(int64_t)db->db.db_size);
 		DBUF_STAT_BUMPDOWN(cache_levels[db->db_level]);
 		DBUF_STAT_BUMPDOWN(cache_count);
 		DBUF_STAT_DECR(cache_levels_bytes[db->db_level],
@@ -729,20 +728,38 @@ dbuf_evict_one(void)
 		ASSERT3U(db->db_caching_status, ==, DB_DBUF_CACHE);
 		db->db_caching_status = DB_NO_CACHE;
 		dbuf_destroy(db);
-		DBUF_STAT_MAX(cache_size_bytes_max,
-		    zfs_refcount_count(&dbuf_caches[DB_DBUF_CACHE].size));
 		DBUF_STAT_BUMP(cache_total_evicts);
 	} else {
 		multilist_sublist_unlock(mls);
 	}
 }
 
+/*
+ * Evict from every dbuf_evict_nthreads'th sublist, starting at the given
+ * offset from dbuf_evict_start, until the cache is below its low water
+ * mark.
+ */
+static void
+dbuf_evict_task(void *arg)
+{
+	multilist_t *ml = dbuf_caches[DB_DBUF_CACHE].cache;
+	unsigned int num = multilist_get_num_sublists(ml);
+	unsigned int idx = dbuf_evict_start + (uintptr_t)arg;
+
+	while (dbuf_cache_above_lowater() && !dbuf_evict_thread_exit) {
+		dbuf_evict_one(idx % num);
+		idx += dbuf_evict_nthreads;
+	}
+}
+
 /*
  * The dbuf evict thread is responsible for aging out dbufs from the
  * cache. Once the cache has reached it's maximum size, dbufs are removed
  * and destroyed. The eviction thread will continue running until the size
- * of the dbuf cache is at or below the maximum size. Once the dbuf is aged
- * out of the cache it is destroyed and becomes eligible for arc eviction.
+ * of the dbuf cache is at or below the maximum size, with the help of
+ * dbuf_evict_nthreads - 1 tasks evicting from other sublists. Once the
+ * dbuf is aged out of the cache it is destroyed and becomes eligible for
+ * arc eviction.
  */
 /* ARGSUSED */
 static void
@@ -767,8 +784,16 @@ dbuf_evict_thread(void *unused)
 		 * for the cache. We do this without holding the locks to
 		 * minimize lock contention.
 		 */
-		while (dbuf_cache_above_lowater() && !dbuf_evict_thread_exit) {
-			dbuf_evict_one();
+		if (dbuf_cache_above_lowater() && !dbuf_evict_thread_exit) {
+			dbuf_evict_start = multilist_get_random_index(
+			    dbuf_caches[DB_DBUF_CACHE].cache);
+			for (int i = 1; i < dbuf_evict_nthreads; i++) {
+				(void) taskq_dispatch(dbuf_evict_taskq,
+				    dbuf_evict_task, (void *)(uintptr_t)i,
+				    TQ_SLEEP);
+			}
+			dbuf_evict_task((void *)(uintptr_t)0);
+			taskq_wait(dbuf_evict_taskq);
 		}
 
 		mutex_enter(&dbuf_evict_lock);
@@ -793,10 +818,13 @@ dbuf_evict_notify(void)
 	 * because it's OK to occasionally make the wrong decision here,
 	 * and grabbing the lock results in massive lock contention.
 	 */
-	if (zfs_refcount_count(&dbuf_caches[DB_DBUF_CACHE].size) >
-	    dbuf_cache_target_bytes()) {
-		if (dbuf_cache_above_hiwater())
-			dbuf_evict_one();
+	if (aggsum_compare(&dbuf_caches[DB_DBUF_CACHE].size,
+	    dbuf_cache_target_bytes()) > 0) {
+		/* our sublist, into which we have just inserted */
+		if (dbuf_cache_above_hiwater()) {
+			dbuf_evict_one(CPU_SEQID % multilist_get_num_sublists(
+			    dbuf_caches[DB_DBUF_CACHE].cache));
+		}
 		cv_signal(&dbuf_evict_cv);
 	}
 }
@@ -809,10 +837,10 @@ dbuf_kstat_update(kstat_t *ksp, int rw)
 	if (rw == KSTAT_WRITE) {
 		return (SET_ERROR(EACCES));
 	} else {
-		ds->metadata_cache_size_bytes.value.ui64 = zfs_refcount_count(
+		ds->metadata_cache_size_bytes.value.ui64 = aggsum_value(
 		    &dbuf_caches[DB_DBUF_METADATA_CACHE].size);
 		ds->cache_size_bytes.value.ui64 =
-		    zfs_refcount_count(&dbuf_caches[DB_DBUF_CACHE].size);
+		    aggsum_value(&dbuf_caches[DB_DBUF_CACHE].size);
 		ds->cache_target_bytes.value.ui64 = dbuf_cache_target_bytes();
 		ds->cache_hiwater_bytes.value.ui64 = dbuf_cache_hiwater_bytes();
 		ds->cache_lowater_bytes.value.ui64 = dbuf_cache_lowater_bytes();
@@ -860,8 +888,8 @@ retry:
 	    sizeof (dmu_buf_impl_t),
 	    0, dbuf_cons, dbuf_dest, NULL, NULL, NULL, 0);
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_DEFAULT, NULL);
+	for (i = 0; i < DBUF_RWLOCKS; i++)
+		rw_init(&h->hash_rwlocks[i], NULL, RW_DEFAULT, NULL);
 
 	dbuf_stats_init(h);
 
@@ -893,9 +921,14 @@ retry:
 		    multilist_create(sizeof (dmu_buf_impl_t),
 		    offsetof(dmu_buf_impl_t, db_cache_link),
 		    dbuf_cache_multilist_index_func);
-		zfs_refcount_create(&dbuf_caches[dcs].size);
+		aggsum_init(&dbuf_caches[dcs].size, 0);
 	}
 
+	dbuf_evict_nthreads = (dbuf_evict_threads > 0) ? dbuf_evict_threads :
+	    MAX(1, boot_ncpus / 8);
+	dbuf_evict_taskq = taskq_create("dbuf_evict", dbuf_evict_nthreads,
+	    minclsyspri, dbuf_evict_nthreads, INT_MAX, TASKQ_PREPOPULATE);
+
 	dbuf_evict_thread_exit = B_FALSE;
 	mutex_init(&dbuf_evict_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&dbuf_evict_cv, NULL, CV_DEFAULT, NULL);
@@ -931,8 +964,8 @@ dbuf_fini(void)
 
 	dbuf_stats_destroy();
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_destroy(&h->hash_mutexes[i]);
+	for (i = 0; i < DBUF_RWLOCKS; i++)
+		rw_destroy(&h->hash_rwlocks[i]);
 #if defined(_KERNEL)
 	/*
 	 * Large allocations which do not require contiguous pages
@@ -955,9 +988,10 @@ dbuf_fini(void)
 
 	mutex_destroy(&dbuf_evict_lock);
 	cv_destroy(&dbuf_evict_cv);
+	taskq_destroy(dbuf_evict_taskq);
 
 	for (dbuf_cached_state_t dcs = 0; dcs < DB_CACHE_MAX; dcs++) {
-		zfs_refcount_destroy(&dbuf_caches[dcs].size);
+		aggsum_fini(&dbuf_caches[dcs].size);
 		multilist_destroy(dbuf_caches[dcs].cache);
 	}
 
@@ -1486,8 +1520,7 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
 	db->db_state = DB_READ;
 	mutex_exit(&db->db_mtx);
 
-	if (DBUF_IS_L2CACHEABLE(db))
-		aflags |= ARC_FLAG_L2CACHE;
+	aflags |= DBUF_L2CACHE_FLAGS(db);
 
 	dbuf_add_ref(db, NULL);
 
@@ -1614,6 +1647,13 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	if (db->db_state == DB_CACHED) {
 		spa_t *spa = dn->dn_objset->os_spa;
 
+		/*
+		 * A cached access to a buffer which was brought in by a
+		 * direct I/O makes it worth keeping after all.
+		 */
+		if ((flags & DB_RF_NOCACHE) == 0)
+			db->db_uncached = FALSE;
+
 		/*
 		 * Ensure that this block's dnode has been decrypted if
 		 * the caller has requested decrypted data.
@@ -1658,6 +1698,7 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 			zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
 			need_wait = B_TRUE;
 		}
+		db->db_uncached = ((flags & DB_RF_NOCACHE) != 0);
 		err = dbuf_read_impl(db, zio, flags, dblt, FTAG);
 		/*
 		 * dbuf_read_impl has dropped db_mtx and our parent's rwlock
@@ -1719,6 +1760,23 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	return (err);
 }
 
+/*
+ * Called before a direct I/O write fills a held dbuf.  If the block was
+ * not already cached it is dropped from the dbuf cache and the ARC once
+ * the write has been synced and the last hold is released.  Blocks which
+ * were cached beforehand are left alone, since other consumers want them.
+ */
+void
+dbuf_set_uncached(dmu_buf_impl_t *db)
+{
+	ASSERT(!zfs_refcount_is_zero(&db->db_holds));
+
+	mutex_enter(&db->db_mtx);
+	if (db->db_state == DB_UNCACHED)
+		db->db_uncached = TRUE;
+	mutex_exit(&db->db_mtx);
+}
+
 static void
 dbuf_noread(dmu_buf_impl_t *db)
 {
@@ -1923,6 +1981,8 @@ dbuf_new_size(dmu_buf_impl_t *db, int size, dmu_tx_t *tx)
 	dbuf_set_data(db, buf);
 	arc_buf_destroy(obuf, db);
 	db->db.db_size = size;
+	atomic_add_64(&db->db_objset->os_dbuf_size[db->db_level],
+	    (int64_t)size - osize);
 
 	if (db->db_level == 0) {
 		ASSERT3U(db->db_last_dirty->dr_txg, ==, tx->tx_txg);
@@ -2659,6 +2719,20 @@ dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx)
 	dmu_buf_fill_done(&db->db, tx);
 }
 
+/*
+ * Account for the creation (count 1) or destruction (count -1) of db in the
+ * dbuf totals of its objset.
+ */
+static void
+dbuf_objset_count(dmu_buf_impl_t *db, int64_t count)
+{
+	objset_t *os = db->db_objset;
+
+	atomic_add_64(&os->os_dbuf_count[db->db_level], count);
+	atomic_add_64(&os->os_dbuf_size[db->db_level],
+	    count * (int64_t)db->db.db_size);
+}
+
 void
 dbuf_destroy(dmu_buf_impl_t *db)
 {
@@ -2691,9 +2765,8 @@ dbuf_destroy(dmu_buf_impl_t *db)
 		    db->db_caching_status == DB_DBUF_METADATA_CACHE);
 
 		multilist_remove(dbuf_caches[db->db_caching_status].cache, db);
-		(void) zfs_refcount_remove_many(
-		    &dbuf_caches[db->db_caching_status].size,
-		    db->db.db_size, db);
+		aggsum_add(&dbuf_caches[db->db_caching_status].size,
+		    -(int64_t)db->db.db_size);
 
 		if (db->db_caching_status == DB_DBUF_METADATA_CACHE) {
 			DBUF_STAT_BUMPDOWN(metadata_cache_count);
@@ -2712,6 +2785,9 @@ dbuf_destroy(dmu_buf_impl_t *db)
 	db->db_state = DB_EVICTING;
 	db->db_blkptr = NULL;
 
+	/* While the dnode hold still keeps the objset around */
+	dbuf_objset_count(db, -1);
+
 	/*
 	 * Now that db_state is DB_EVICTING, nobody else can find this via
 	 * the hash table.  We can now drop db_mtx, which allows us to
@@ -2898,6 +2974,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_user_immediate_evict = FALSE;
 	db->db_freed_in_flight = FALSE;
 	db->db_pending_evict = FALSE;
+	db->db_uncached = FALSE;
 
 	if (blkid == DMU_BONUS_BLKID) {
 		ASSERT3P(parent, ==, dn->dn_dbuf);
@@ -2909,6 +2986,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 		db->db_caching_status = DB_NO_CACHE;
 		/* the bonus dbuf is not placed in the hash table */
 		arc_space_consume(sizeof (dmu_buf_impl_t), ARC_SPACE_DBUF);
+		dbuf_objset_count(db, 1);
 		return (db);
 	} else if (blkid == DMU_SPILL_BLKID) {
 		db->db.db_size = (blkptr != NULL) ?
@@ -2943,6 +3021,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_caching_status = DB_NO_CACHE;
 	mutex_exit(&dn->dn_dbufs_mtx);
 	arc_space_consume(sizeof (dmu_buf_impl_t), ARC_SPACE_DBUF);
+	dbuf_objset_count(db, 1);
 
 	if (parent && parent != dn->dn_dbuf)
 		dbuf_add_ref(parent, db);
@@ -3108,8 +3187,7 @@ dbuf_prefetch_indirect_done(zio_t *zio, const zbookmark_phys_t *zb,
 		zbookmark_phys_t zb;
 
 		/* flag if L2ARC eligible, l2arc_noprefetch then decides */
-		if (dpa->dpa_aflags & ARC_FLAG_L2CACHE)
-			iter_aflags |= ARC_FLAG_L2CACHE;
+		iter_aflags |= dpa->dpa_aflags & ARC_FLAG_L2CACHE_MASK;
 
 		ASSERT3U(dpa->dpa_curlevel, ==, BP_GET_LEVEL(bp));
 
@@ -3225,8 +3303,7 @@ dbuf_prefetch(dnode_t *dn, int64_t level, uint64_t blkid, zio_priority_t prio,
 	dpa->dpa_zio = pio;
 
 	/* flag if L2ARC eligible, l2arc_noprefetch then decides */
-	if (DNODE_LEVEL_IS_L2CACHEABLE(dn, level))
-		dpa->dpa_aflags |= ARC_FLAG_L2CACHE;
+	dpa->dpa_aflags |= DNODE_LEVEL_L2CACHE_FLAGS(dn, level);
 
 	/*
 	 * If we have the indirect just above us, no need to do the asynchronous
@@ -3244,8 +3321,7 @@ dbuf_prefetch(dnode_t *dn, int64_t level, uint64_t blkid, zio_priority_t prio,
 		zbookmark_phys_t zb;
 
 		/* flag if L2ARC eligible, l2arc_noprefetch then decides */
-		if (DNODE_LEVEL_IS_L2CACHEABLE(dn, level))
-			iter_aflags |= ARC_FLAG_L2CACHE;
+		iter_aflags |= DNODE_LEVEL_L2CACHE_FLAGS(dn, level);
 
 		SET_BOOKMARK(&zb, ds != NULL ? ds->ds_object : DMU_META_OBJSET,
 		    dn->dn_object, curlevel, curblkid);
@@ -3384,9 +3460,8 @@ dbuf_hold_impl_arg(struct dbuf_hold_arg *dh)
 		multilist_remove(
 		    dbuf_caches[dh->dh_db->db_caching_status].cache,
 		    dh->dh_db);
-		(void) zfs_refcount_remove_many(
-		    &dbuf_caches[dh->dh_db->db_caching_status].size,
-		    dh->dh_db->db.db_size, dh->dh_db);
+		aggsum_add(&dbuf_caches[dh->dh_db->db_caching_status].size,
+		    -(int64_t)dh->dh_db->db.db_size);
 
 		if (dh->dh_db->db_caching_status == DB_DBUF_METADATA_CACHE) {
 			DBUF_STAT_BUMPDOWN(metadata_cache_count);
@@ -3657,7 +3732,7 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag, boolean_t evicting)
 			blkptr_t bp;
 			spa_t *spa = dmu_objset_spa(db->db_objset);
 
-			if (!DBUF_IS_CACHEABLE(db) &&
+			if ((!DBUF_IS_CACHEABLE(db) || db->db_uncached) &&
 			    db->db_blkptr != NULL &&
 			    !BP_IS_HOLE(db->db_blkptr) &&
 			    !BP_IS_EMBEDDED(db->db_blkptr)) {
@@ -3665,7 +3740,7 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag, boolean_t evicting)
 				bp = *db->db_blkptr;
 			}
 
-			if (!DBUF_IS_CACHEABLE(db) ||
+			if (!DBUF_IS_CACHEABLE(db) || db->db_uncached ||
 			    db->db_pending_evict) {
 				dbuf_destroy(db);
 			} else if (!multilist_link_active(&db->db_cache_link)) {
@@ -3676,17 +3751,24 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag, boolean_t evicting)
 				    dbuf_include_in_metadata_cache(db) ?
 				    DB_DBUF_METADATA_CACHE : DB_DBUF_CACHE;
 				db->db_caching_status = dcs;
+				db->db_cache_sublist = CPU_SEQID %
+				    multilist_get_num_sublists(
+				    dbuf_caches[dcs].cache);
 
 				multilist_insert(dbuf_caches[dcs].cache, db);
-				(void) zfs_refcount_add_many(
-				    &dbuf_caches[dcs].size,
-				    db->db.db_size, db);
+				aggsum_add(&dbuf_caches[dcs].size,
+				    db->db.db_size);
 
+				/*
+				 * The maximums are tracked from the upper
+				 * bound of the aggsums, which is cheap to
+				 * read but may overestimate slightly.
+				 */
 				if (dcs == DB_DBUF_METADATA_CACHE) {
 					DBUF_STAT_BUMP(metadata_cache_count);
 					DBUF_STAT_MAX(
 					    metadata_cache_size_bytes_max,
-					    zfs_refcount_count(
+					    aggsum_upper_bound(
 					    &dbuf_caches[dcs].size));
 				} else {
 					DBUF_STAT_BUMP(
@@ -3696,7 +3778,7 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag, boolean_t evicting)
 					    cache_levels_bytes[db->db_level],
 					    db->db.db_size);
 					DBUF_STAT_MAX(cache_size_bytes_max,
-					    zfs_refcount_count(
+					    aggsum_upper_bound(
 					    &dbuf_caches[dcs].size));
 				}
 				mutex_exit(&db->db_mtx);
@@ -3907,6 +3989,65 @@ dbuf_prepare_encrypted_dnode_leaf(dbuf_dirty_record_t *dr)
 	}
 }
 
+/*
+ * Dirty records are added to their parent's list in the order in which the
+ * blocks were dirtied, which for scattered writes to a large object is no
+ * order at all.  Syncing the children of an indirect block in block order
+ * issues their writes, and so their allocations, in file order, which lets
+ * the writes be aggregated and lays the blocks out to be read back
+ * sequentially.  Lists that are already in order, as after sequential
+ * writes, are left as they are.
+ */
+static void
+dbuf_sort_dirty_records(list_t *list)
+{
+	dbuf_dirty_record_t *dr, *prev = NULL;
+	dbuf_dirty_record_t **drs, **src, **dst, **swap;
+	boolean_t sorted = B_TRUE;
+	uint64_t n = 0;
+
+	for (dr = list_head(list); dr != NULL; dr = list_next(list, dr)) {
+		if (prev != NULL &&
+		    dr->dr_dbuf->db_blkid < prev->dr_dbuf->db_blkid)
+			sorted = B_FALSE;
+		prev = dr;
+		n++;
+	}
+	if (sorted)
+		return;
+
+	drs = kmem_alloc(2 * n * sizeof (dbuf_dirty_record_t *), KM_SLEEP);
+	src = drs;
+	dst = drs + n;
+	for (uint64_t i = 0; (dr = list_remove_head(list)) != NULL; i++)
+		src[i] = dr;
+
+	/* Bottom-up merge sort */
+	for (uint64_t width = 1; width < n; width *= 2) {
+		for (uint64_t lo = 0; lo < n; lo += 2 * width) {
+			uint64_t mid = MIN(lo + width, n);
+			uint64_t hi = MIN(lo + 2 * width, n);
+			uint64_t i = lo, j = mid;
+
+			for (uint64_t k = lo; k < hi; k++) {
+				if (i < mid && (j >= hi ||
+				    src[i]->dr_dbuf->db_blkid <=
+				    src[j]->dr_dbuf->db_blkid))
+					dst[k] = src[i++];
+				else
+					dst[k] = src[j++];
+			}
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	for (uint64_t i = 0; i < n; i++)
+		list_insert_tail(list, src[i]);
+	kmem_free(drs, 2 * n * sizeof (dbuf_dirty_record_t *));
+}
+
 /*
  * dbuf_sync_indirect() is called recursively from dbuf_sync_list() so it
  * is critical the we not allow the compiler to inline this function in to
@@ -3953,6 +4094,7 @@ dbuf_sync_indirect(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 
 	zio = dr->dr_zio;
 	mutex_enter(&dr->dt.di.dr_mtx);
+	dbuf_sort_dirty_records(&dr->dt.di.dr_children);
 	dbuf_sync_list(&dr->dt.di.dr_children, db->db_level - 1, tx);
 	ASSERT(list_head(&dr->dt.di.dr_children) == NULL);
 	mutex_exit(&dr->dt.di.dr_mtx);
@@ -4201,6 +4343,15 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 	dnode_diduse_space(dn, delta - zio->io_prev_space_delta);
 	zio->io_prev_space_delta = delta;
 
+	/* Feed the per-objset compression early abort heuristic. */
+	if (db->db_level == 0 && !BP_IS_HOLE(bp) &&
+	    !(zio->io_flags & ZIO_FLAG_RAW_COMPRESS) &&
+	    zio_compress_early_abort_eligible(zio->io_prop.zp_compress)) {
+		dmu_objset_compress_account(db->db_objset,
+		    BP_IS_EMBEDDED(bp) ||
+		    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF);
+	}
+
 	if (bp->blk_birth != 0) {
 		ASSERT((db->db_blkid != DMU_SPILL_BLKID &&
 		    BP_GET_TYPE(bp) == dn->dn_type) ||
@@ -4637,6 +4788,17 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 	dmu_write_policy(os, dn, db->db_level, wp_flag, &zp);
 	DB_DNODE_EXIT(db);
 
+	/*
+	 * A promoted block is rewritten as is on the special class, so it
+	 * must not be left where it is by a nopwrite or by dedup.
+	 */
+	if (db->db_level == 0 && dr->dt.dl.dr_promote) {
+		zp.zp_zpl_smallblk = SPA_MAXBLOCKSIZE;
+		zp.zp_dedup = B_FALSE;
+		zp.zp_dedup_verify = B_FALSE;
+		zp.zp_nopwrite = B_FALSE;
+	}
+
 	/*
 	 * We copy the blkptr now (rather than when we instantiate the dirty
 	 * record), because its value can change between open context and
@@ -4686,7 +4848,7 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 			children_ready_cb = dbuf_write_children_ready;
 
 		dr->dr_zio = arc_write(zio, os->os_spa, txg,
-		    &dr->dr_bp_copy, data, DBUF_IS_L2CACHEABLE(db),
+		    &dr->dr_bp_copy, data, DBUF_L2CACHE_FLAGS(db),
 		    &zp, dbuf_write_ready,
 		    children_ready_cb, dbuf_write_physdone,
 		    dbuf_write_done, db, ZIO_PRIORITY_ASYNC_WRITE,
@@ -4752,5 +4914,8 @@ ZFS_MODULE_PARAM(zfs_dbuf_cache, dbuf_cache_, shift, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_dbuf_cache, dbuf_cache_, metadata_shift, UINT, ZMOD_RW,
 	"Set the size of the dbuf metadata cache to a log2 fraction of "
 	"arc size.");
+
+ZFS_MODULE_PARAM(zfs_dbuf_cache, dbuf_, evict_threads, INT, ZMOD_RD,
+	"Number of threads evicting from the dbuf cache (0 = ncpus / 8).");
 /* END CSTYLED */
 #endif
@@ -136,7 +136,7 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 	ASSERT3S(dsh->idx, <=, h->hash_table_mask);
 	memset(buf, 0, size);
 
-	mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
+	rw_enter(DBUF_HASH_RWLOCK(h, dsh->idx), RW_READER);
 	for (db = h->hash_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
 		/*
 		 * Returning ENOMEM will cause the data and header functions
@@ -157,7 +157,7 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 
 		mutex_exit(&db->db_mtx);
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+	rw_exit(DBUF_HASH_RWLOCK(h, dsh->idx));
 
 	return (error);
 }
@@ -213,15 +213,197 @@ dbuf_stats_hash_table_destroy(void)
 	mutex_destroy(&dsh->lock);
 }
 
+/*
+ * ==========================================================================
+ * Dbuf Objset Summary Routines
+ * ==========================================================================
+ *
+ * Walking the hash table for the dbufs kstat takes every bucket lock and
+ * formats every dbuf, which is far too slow to sample regularly on systems
+ * with millions of dbufs.  Instead, dbuf_create() and dbuf_destroy() keep
+ * the number and size of the dbufs of each objset by level in the objset,
+ * and the dbufs_summary kstat reports them for every open objset.
+ */
+typedef struct dbuf_summary_row {
+	char		dsr_pool[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t	dsr_objset;
+	int		dsr_level;
+	uint64_t	dsr_count;
+	uint64_t	dsr_size;
+} dbuf_summary_row_t;
+
+typedef struct dbuf_summary {
+	kmutex_t		lock;		/* kstat lock */
+	kstat_t			*kstat;
+	dbuf_summary_row_t	*rows;		/* protected by lock */
+	int			nrows;
+	int			nalloc;
+	kmutex_t		objsets_lock;
+	list_t			objsets;	/* protected by objsets_lock */
+	int			nobjsets;
+} dbuf_summary_t;
+
+static dbuf_summary_t dbuf_stats_summary;
+
+void
+dbuf_stats_objset_add(objset_t *os)
+{
+	dbuf_summary_t *dss = &dbuf_stats_summary;
+
+	mutex_enter(&dss->objsets_lock);
+	list_insert_tail(&dss->objsets, os);
+	dss->nobjsets++;
+	mutex_exit(&dss->objsets_lock);
+}
+
+void
+dbuf_stats_objset_remove(objset_t *os)
+{
+	dbuf_summary_t *dss = &dbuf_stats_summary;
+
+	mutex_enter(&dss->objsets_lock);
+	list_remove(&dss->objsets, os);
+	dss->nobjsets--;
+	mutex_exit(&dss->objsets_lock);
+}
+
+static int
+dbuf_stats_summary_update(kstat_t *ksp, int rw)
+{
+	dbuf_summary_t *dss = ksp->ks_private;
+	objset_t *os;
+	int n = 0;
+
+	ASSERT(MUTEX_HELD(&dss->lock));
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	if (dss->rows != NULL) {
+		vmem_free(dss->rows, dss->nalloc * sizeof (dbuf_summary_row_t));
+		dss->rows = NULL;
+		dss->nrows = dss->nalloc = 0;
+	}
+
+	/*
+	 * The list can grow while the rows are allocated, in which case the
+	 * objsets which don't fit are left out of this snapshot.
+	 */
+	dss->nalloc = dss->nobjsets * DN_MAX_LEVELS;
+	if (dss->nalloc == 0)
+		return (0);
+	dss->rows = vmem_zalloc(dss->nalloc * sizeof (dbuf_summary_row_t),
+	    KM_SLEEP);
+
+	mutex_enter(&dss->objsets_lock);
+	for (os = list_head(&dss->objsets); os != NULL;
+	    os = list_next(&dss->objsets, os)) {
+		for (int l = 0; l < DN_MAX_LEVELS && n < dss->nalloc; l++) {
+			dbuf_summary_row_t *dsr = &dss->rows[n];
+
+			if (os->os_dbuf_count[l] == 0)
+				continue;
+
+			(void) strlcpy(dsr->dsr_pool, spa_name(os->os_spa),
+			    sizeof (dsr->dsr_pool));
+			dsr->dsr_objset = dmu_objset_id(os);
+			dsr->dsr_level = l;
+			dsr->dsr_count = os->os_dbuf_count[l];
+			dsr->dsr_size = os->os_dbuf_size[l];
+			n++;
+		}
+	}
+	mutex_exit(&dss->objsets_lock);
+	dss->nrows = n;
+
+	return (0);
+}
+
+static int
+dbuf_stats_summary_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-16s %-8s %-5s %-12s %-16s\n",
+	    "pool", "objset", "level", "dbufs", "cached");
+
+	return (0);
+}
+
+static int
+dbuf_stats_summary_data(char *buf, size_t size, void *data)
+{
+	dbuf_summary_row_t *dsr = data;
+
+	(void) snprintf(buf, size, "%-16s %-8llu %-5d %-12llu %-16llu\n",
+	    dsr->dsr_pool, (u_longlong_t)dsr->dsr_objset, dsr->dsr_level,
+	    (u_longlong_t)dsr->dsr_count, (u_longlong_t)dsr->dsr_size);
+
+	return (0);
+}
+
+static void *
+dbuf_stats_summary_addr(kstat_t *ksp, loff_t n)
+{
+	dbuf_summary_t *dss = ksp->ks_private;
+
+	ASSERT(MUTEX_HELD(&dss->lock));
+
+	return (n < dss->nrows ? &dss->rows[n] : NULL);
+}
+
+static void
+dbuf_stats_summary_init(void)
+{
+	dbuf_summary_t *dss = &dbuf_stats_summary;
+	kstat_t *ksp;
+
+	mutex_init(&dss->lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&dss->objsets_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&dss->objsets, sizeof (objset_t),
+	    offsetof(objset_t, os_dbuf_stats_node));
+
+	ksp = kstat_create("zfs", 0, "dbufs_summary", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	dss->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &dss->lock;
+		ksp->ks_ndata = UINT32_MAX;
+		ksp->ks_private = dss;
+		ksp->ks_update = dbuf_stats_summary_update;
+		kstat_set_raw_ops(ksp, dbuf_stats_summary_headers,
+		    dbuf_stats_summary_data, dbuf_stats_summary_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+dbuf_stats_summary_destroy(void)
+{
+	dbuf_summary_t *dss = &dbuf_stats_summary;
+
+	if (dss->kstat)
+		kstat_delete(dss->kstat);
+
+	if (dss->rows != NULL)
+		vmem_free(dss->rows, dss->nalloc * sizeof (dbuf_summary_row_t));
+
+	ASSERT0(dss->nobjsets);
+	list_destroy(&dss->objsets);
+	mutex_destroy(&dss->objsets_lock);
+	mutex_destroy(&dss->lock);
+}
+
 void
 dbuf_stats_init(dbuf_hash_table_t *hash)
 {
 	dbuf_stats_hash_table_init(hash);
+	dbuf_stats_summary_init();
 }
 
 void
 dbuf_stats_destroy(void)
 {
+	dbuf_stats_summary_destroy();
 	dbuf_stats_hash_table_destroy();
 }
 
@@ -37,6 +37,8 @@
 #include <sys/zio_compress.h>
 #include <sys/dsl_scan.h>
 #include <sys/abd.h>
+#include <sys/zfeature.h>
+#include <sys/metaslab.h>
 
 static kmem_cache_t *ddt_cache;
 static kmem_cache_t *ddt_entry_cache;
@@ -46,6 +48,17 @@ static kmem_cache_t *ddt_entry_cache;
  */
 int zfs_dedup_prefetch = 0;
 
+/*
+ * Percentage of the unique entries removed, oldest first, each time the
+ * dedup tables reach their quota, see ddt_prune().
+ */
+unsigned int zfs_dedup_prune_percent = 10;
+
+/*
+ * Maximum number of unique entries the pruning visits per txg.
+ */
+unsigned int zfs_dedup_prune_entries_per_txg = 10000;
+
 static const ddt_ops_t *ddt_ops[DDT_TYPES] = {
 	&ddt_zap_ops,
 };
@@ -192,6 +205,17 @@ ddt_object_prefetch(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
 	    ddt->ddt_object[type][class], dde);
 }
 
+static void
+ddt_object_prefetch_batch(ddt_t *ddt, enum ddt_type type,
+    enum ddt_class class, const ddt_key_t *keys, uint_t count)
+{
+	if (!ddt_object_exists(ddt, type, class))
+		return;
+
+	ddt_ops[type]->ddt_op_prefetch_batch(ddt->ddt_os,
+	    ddt->ddt_object[type][class], keys, count);
+}
+
 int
 ddt_object_update(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
     ddt_entry_t *dde, dmu_tx_t *tx)
@@ -202,6 +226,16 @@ ddt_object_update(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
 	    ddt->ddt_object[type][class], dde, tx));
 }
 
+static int
+ddt_object_update_batch(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
+    ddt_entry_t **ddes, uint_t count, dmu_tx_t *tx)
+{
+	ASSERT(ddt_object_exists(ddt, type, class));
+
+	return (ddt_ops[type]->ddt_op_update_batch(ddt->ddt_os,
+	    ddt->ddt_object[type][class], ddes, count, tx));
+}
+
 static int
 ddt_object_remove(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
     ddt_entry_t *dde, dmu_tx_t *tx)
@@ -552,6 +586,82 @@ ddt_get_pool_dedup_ratio(spa_t *spa)
 	return (dds_total.dds_ref_dsize * 100 / dds_total.dds_dsize);
 }
 
+/*
+ * Returns the quota the on-disk size of the dedup tables is held to.  With
+ * "auto" it is the size of the dedup class, or if there is none that of
+ * the special class, so that the tables never spill over to the normal
+ * class.  Zero means no quota.
+ */
+static uint64_t
+ddt_get_quota(spa_t *spa)
+{
+	uint64_t quota = spa->spa_dedup_table_quota;
+
+	if (quota == UINT64_MAX) {
+		quota = metaslab_class_get_space(spa_dedup_class(spa));
+		if (quota == 0) {
+			quota = metaslab_class_get_space(
+			    spa_special_class(spa));
+		}
+	}
+
+	return (quota == 0 ? UINT64_MAX : quota);
+}
+
+/*
+ * Recomputes the cached size of the dedup tables, and whether they are
+ * over quota.  Since the leaves of a ZAP are never freed, the size does
+ * not drop as entries are removed.  So once the quota is reached, the
+ * tables are held to the number of entries they had at that point
+ * instead, until the size is under the quota again.
+ */
+static void
+ddt_quota_update(spa_t *spa)
+{
+	uint64_t quota = ddt_get_quota(spa);
+	uint64_t dsize = 0, count = 0;
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt == NULL)
+			continue;
+		for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
+			for (enum ddt_class class = 0; class < DDT_CLASSES;
+			    class++) {
+				ddt_object_t *ddo =
+				    &ddt->ddt_object_stats[type][class];
+				dsize += ddo->ddo_dspace;
+				count += ddo->ddo_count;
+			}
+		}
+	}
+
+	if (dsize < quota)
+		spa->spa_dedup_quota_count = 0;
+	else if (spa->spa_dedup_quota_count == 0)
+		spa->spa_dedup_quota_count = count;
+
+	spa->spa_dedup_dsize = dsize;
+	spa->spa_dedup_over_quota = (dsize >= quota &&
+	    count >= spa->spa_dedup_quota_count);
+}
+
+uint64_t
+ddt_get_ddt_dsize(spa_t *spa)
+{
+	return (spa->spa_dedup_dsize);
+}
+
+/*
+ * Returns true if new entries should not be added to the dedup tables,
+ * see zio_ddt_write().  This is updated as the tables are synced.
+ */
+boolean_t
+ddt_over_quota(spa_t *spa)
+{
+	return (spa->spa_dedup_over_quota);
+}
+
 size_t
 ddt_compress(void *src, uchar_t *dst, size_t s_len, size_t d_len)
 {
@@ -625,11 +735,13 @@ ddt_init(void)
 	    sizeof (ddt_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	ddt_entry_cache = kmem_cache_create("ddt_entry_cache",
 	    sizeof (ddt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	ddt_log_init();
 }
 
 void
 ddt_fini(void)
 {
+	ddt_log_fini();
 	kmem_cache_destroy(ddt_entry_cache);
 	kmem_cache_destroy(ddt_cache);
 }
@@ -699,6 +811,27 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 	if (dde->dde_loaded)
 		return (dde);
 
+	/*
+	 * The dedup log holds the latest state of the entries it has
+	 * records for, which may not have been applied to the ZAPs yet.
+	 */
+	if (ddt_log_find(ddt, &dde->dde_key, dde->dde_phys)) {
+		uint64_t refcnt = ddt_phys_total_refcnt(dde);
+
+		if (refcnt != 0) {
+			dde->dde_type = DDT_TYPE_CURRENT;
+			dde->dde_class = refcnt > 1 ?
+			    DDT_CLASS_DUPLICATE : DDT_CLASS_UNIQUE;
+			ddt_stat_update(ddt, dde, -1ULL);
+		} else {
+			dde->dde_type = DDT_TYPES;
+			dde->dde_class = DDT_CLASSES;
+		}
+		dde->dde_loaded = B_TRUE;
+
+		return (dde);
+	}
+
 	dde->dde_loading = B_TRUE;
 
 	ddt_exit(ddt);
@@ -735,11 +868,26 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 	return (dde);
 }
 
+void
+ddt_prefetch_key(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	ddt_entry_t dde;
+
+	dde.dde_key = *ddk;
+
+	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
+		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
+			ddt_object_prefetch(ddt, type, class, &dde);
+		}
+	}
+}
+
 void
 ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 {
 	ddt_t *ddt;
-	ddt_entry_t dde;
+	ddt_key_t ddk;
+	boolean_t logged;
 
 	if (!zfs_dedup_prefetch || bp == NULL || !BP_GET_DEDUP(bp))
 		return;
@@ -748,15 +896,68 @@ ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 	 * We only remove the DDT once all tables are empty and only
 	 * prefetch dedup blocks when there are entries in the DDT.
 	 * Thus no locking is required as the DDT can't disappear on us.
+	 * The dedup log is changed as txgs sync, so it is searched under
+	 * the lock; the entries it holds are in core already.
 	 */
 	ddt = ddt_select(spa, bp);
-	ddt_key_fill(&dde.dde_key, bp);
+	ddt_key_fill(&ddk, bp);
 
-	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
-		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
-			ddt_object_prefetch(ddt, type, class, &dde);
+	ddt_enter(ddt);
+	logged = ddt_log_find(ddt, &ddk, NULL);
+	ddt_exit(ddt);
+
+	if (!logged)
+		ddt_prefetch_key(ddt, &ddk);
+}
+
+/*
+ * Prefetches the entries of a batch of block pointers, such as those freed
+ * in a txg.  The keys of each table are checked against the dedup log under
+ * a single hold of its lock, and the ZAP leaves they hash to are then read
+ * in parallel, each once and in order, see zap_prefetch_uint64_batch().
+ */
+void
+ddt_prefetch_batch(spa_t *spa, const blkptr_t *bps, uint_t count)
+{
+	ddt_key_t *keys;
+
+	if (count == 0)
+		return;
+
+	keys = kmem_alloc(count * sizeof (ddt_key_t), KM_SLEEP);
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		uint_t n = 0;
+
+		if (ddt == NULL)
+			continue;
+
+		ddt_enter(ddt);
+		for (uint_t i = 0; i < count; i++) {
+			const blkptr_t *bp = &bps[i];
+
+			if (!BP_GET_DEDUP(bp) || BP_GET_CHECKSUM(bp) != c)
+				continue;
+			ddt_key_fill(&keys[n], bp);
+			if (!ddt_log_find(ddt, &keys[n], NULL))
+				n++;
+		}
+		ddt_exit(ddt);
+
+		if (n == 0)
+			continue;
+
+		for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
+			for (enum ddt_class class = 0; class < DDT_CLASSES;
+			    class++) {
+				ddt_object_prefetch_batch(ddt, type, class,
+				    keys, n);
+			}
 		}
 	}
+
+	kmem_free(keys, count * sizeof (ddt_key_t));
 }
 
 /*
@@ -769,12 +970,10 @@ typedef struct ddt_key_cmp {
 } ddt_key_cmp_t;
 
 int
-ddt_entry_compare(const void *x1, const void *x2)
+ddt_key_compare(const ddt_key_t *ddk1, const ddt_key_t *ddk2)
 {
-	const ddt_entry_t *dde1 = x1;
-	const ddt_entry_t *dde2 = x2;
-	const ddt_key_cmp_t *k1 = (const ddt_key_cmp_t *)&dde1->dde_key;
-	const ddt_key_cmp_t *k2 = (const ddt_key_cmp_t *)&dde2->dde_key;
+	const ddt_key_cmp_t *k1 = (const ddt_key_cmp_t *)ddk1;
+	const ddt_key_cmp_t *k2 = (const ddt_key_cmp_t *)ddk2;
 	int32_t cmp = 0;
 
 	for (int i = 0; i < DDT_KEY_CMP_LEN; i++) {
@@ -786,6 +985,15 @@ ddt_entry_compare(const void *x1, const void *x2)
 	return (AVL_ISIGN(cmp));
 }
 
+int
+ddt_entry_compare(const void *x1, const void *x2)
+{
+	const ddt_entry_t *dde1 = x1;
+	const ddt_entry_t *dde2 = x2;
+
+	return (ddt_key_compare(&dde1->dde_key, &dde2->dde_key));
+}
+
 static ddt_t *
 ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 {
@@ -799,6 +1007,7 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
 	avl_create(&ddt->ddt_repair_tree, ddt_entry_compare,
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	ddt_log_alloc(ddt);
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
 	ddt->ddt_os = spa->spa_meta_objset;
@@ -813,6 +1022,7 @@ ddt_table_free(ddt_t *ddt)
 	ASSERT(avl_numnodes(&ddt->ddt_repair_tree) == 0);
 	avl_destroy(&ddt->ddt_tree);
 	avl_destroy(&ddt->ddt_repair_tree);
+	ddt_log_free(ddt);
 	mutex_destroy(&ddt->ddt_lock);
 	kmem_cache_free(ddt_cache, ddt);
 }
@@ -840,6 +1050,12 @@ ddt_load(spa_t *spa)
 	if (error)
 		return (error == ENOENT ? 0 : error);
 
+	error = zap_lookup(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_DDT_PRUNED, sizeof (uint64_t), 1,
+	    &spa->spa_dedup_pruned);
+	if (error != 0 && error != ENOENT)
+		return (error);
+
 	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
 		ddt_t *ddt = spa->spa_ddt[c];
 		for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
@@ -851,6 +1067,10 @@ ddt_load(spa_t *spa)
 			}
 		}
 
+		error = ddt_log_load(ddt);
+		if (error != 0)
+			return (error);
+
 		/*
 		 * Seed the cached histograms.
 		 */
@@ -859,6 +1079,8 @@ ddt_load(spa_t *spa)
 		spa->spa_dedup_dspace = ~0ULL;
 	}
 
+	ddt_quota_update(spa);
+
 	return (0);
 }
 
@@ -882,7 +1104,8 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 	if (!BP_GET_DEDUP(bp))
 		return (B_FALSE);
 
-	if (max_class == DDT_CLASS_UNIQUE)
+	/* Every dedup block has an entry, unless some were pruned */
+	if (max_class == DDT_CLASS_UNIQUE && spa->spa_dedup_pruned == 0)
 		return (B_TRUE);
 
 	ddt = spa->spa_ddt[BP_GET_CHECKSUM(bp)];
@@ -908,11 +1131,22 @@ ddt_repair_start(ddt_t *ddt, const blkptr_t *bp)
 {
 	ddt_key_t ddk;
 	ddt_entry_t *dde;
+	boolean_t logged;
 
 	ddt_key_fill(&ddk, bp);
 
 	dde = ddt_alloc(&ddk);
 
+	ddt_enter(ddt);
+	logged = ddt_log_find(ddt, &ddk, dde->dde_phys);
+	ddt_exit(ddt);
+
+	if (logged) {
+		if (ddt_phys_total_refcnt(dde) <= 1)
+			bzero(dde->dde_phys, sizeof (dde->dde_phys));
+		return (dde);
+	}
+
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
 			/*
@@ -1007,8 +1241,42 @@ ddt_repair_table(ddt_t *ddt, zio_t *rio)
 	ddt_exit(ddt);
 }
 
+/*
+ * Entries whose update in their new ZAP is deferred by ddt_sync_entry(),
+ * so that ddt_sync_batch_flush() can apply them with one hold of the ZAP,
+ * in batches of up to DDT_SYNC_BATCH entries per object.
+ */
+#define	DDT_SYNC_BATCH	256
+
+typedef struct ddt_sync_batch {
+	uint_t		dsb_count[DDT_TYPES][DDT_CLASSES];
+	ddt_entry_t	*dsb_ddes[DDT_TYPES][DDT_CLASSES][DDT_SYNC_BATCH];
+} ddt_sync_batch_t;
+
 static void
-ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
+ddt_sync_batch_flush(ddt_t *ddt, ddt_sync_batch_t *dsb, enum ddt_type type,
+    enum ddt_class class, dmu_tx_t *tx)
+{
+	uint_t count = dsb->dsb_count[type][class];
+
+	if (count == 0)
+		return;
+
+	VERIFY0(ddt_object_update_batch(ddt, type, class,
+	    dsb->dsb_ddes[type][class], count, tx));
+	for (uint_t i = 0; i < count; i++)
+		ddt_free(dsb->dsb_ddes[type][class][i]);
+	dsb->dsb_count[type][class] = 0;
+}
+
+/*
+ * Returns true if the update of the entry was deferred to dsb, which then
+ * owns the entry.  Every entry is synced once per txg, so the deferred
+ * updates cannot race with a removal of the same key.
+ */
+static boolean_t
+ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg,
+    ddt_log_update_t *dlu, ddt_sync_batch_t *dsb)
 {
 	dsl_pool_t *dp = ddt->ddt_spa->spa_dsl_pool;
 	ddt_phys_t *ddp = dde->dde_phys;
@@ -1048,6 +1316,25 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	else
 		nclass = DDT_CLASS_UNIQUE;
 
+	/*
+	 * Logged entries are applied to the ZAPs by ddt_flush_entry(), but
+	 * the object of their class is created now so that the histogram
+	 * is kept with the others.
+	 */
+	if (dlu != NULL) {
+		if (otype == DDT_TYPES && total_refcnt == 0)
+			return (B_FALSE);
+		if (total_refcnt != 0) {
+			dde->dde_type = ntype;
+			dde->dde_class = nclass;
+			ddt_stat_update(ddt, dde, 0);
+			if (!ddt_object_exists(ddt, ntype, nclass))
+				ddt_object_create(ddt, ntype, nclass, tx);
+		}
+		ddt_log_entry(ddt, dlu, dde);
+		return (B_FALSE);
+	}
+
 	if (otype != DDT_TYPES &&
 	    (otype != ntype || oclass != nclass || total_refcnt == 0)) {
 		VERIFY(ddt_object_remove(ddt, otype, oclass, dde, tx) == 0);
@@ -1060,7 +1347,6 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 		ddt_stat_update(ddt, dde, 0);
 		if (!ddt_object_exists(ddt, ntype, nclass))
 			ddt_object_create(ddt, ntype, nclass, tx);
-		VERIFY(ddt_object_update(ddt, ntype, nclass, dde, tx) == 0);
 
 		/*
 		 * If the class changes, the order that we scan this bp
@@ -1073,6 +1359,212 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 			dsl_scan_ddt_entry(dp->dp_scan,
 			    ddt->ddt_checksum, dde, tx);
 		}
+
+		if (dsb->dsb_count[ntype][nclass] == DDT_SYNC_BATCH)
+			ddt_sync_batch_flush(ddt, dsb, ntype, nclass, tx);
+		dsb->dsb_ddes[ntype][nclass][dsb->dsb_count[ntype][nclass]++] =
+		    dde;
+		return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Applies the state of an entry from the dedup log to the ZAPs, moving it
+ * to the class matching its references.  The log is not used while a
+ * scan is running, so unlike ddt_sync_entry() this has no entries to
+ * rescan.
+ */
+void
+ddt_flush_entry(ddt_t *ddt, const ddt_key_t *ddk, const ddt_phys_t *ddp,
+    dmu_tx_t *tx)
+{
+	ddt_entry_t *dde;
+	enum ddt_type otype;
+	enum ddt_type ntype = DDT_TYPE_CURRENT;
+	enum ddt_class oclass = 0;
+	enum ddt_class nclass;
+	uint64_t total_refcnt;
+	int error = ENOENT;
+
+	dde = kmem_cache_alloc(ddt_entry_cache, KM_SLEEP);
+	dde->dde_key = *ddk;
+
+	for (otype = 0; otype < DDT_TYPES; otype++) {
+		for (oclass = 0; oclass < DDT_CLASSES; oclass++) {
+			error = ddt_object_lookup(ddt, otype, oclass, dde);
+			if (error != ENOENT) {
+				ASSERT0(error);
+				break;
+			}
+		}
+		if (error != ENOENT)
+			break;
+	}
+
+	bcopy(ddp, dde->dde_phys, sizeof (dde->dde_phys));
+	total_refcnt = ddt_phys_total_refcnt(dde);
+	if (total_refcnt > 1)
+		nclass = DDT_CLASS_DUPLICATE;
+	else
+		nclass = DDT_CLASS_UNIQUE;
+
+	if (otype != DDT_TYPES &&
+	    (otype != ntype || oclass != nclass || total_refcnt == 0))
+		VERIFY0(ddt_object_remove(ddt, otype, oclass, dde, tx));
+
+	if (total_refcnt != 0) {
+		if (!ddt_object_exists(ddt, ntype, nclass))
+			ddt_object_create(ddt, ntype, nclass, tx);
+		VERIFY0(ddt_object_update(ddt, ntype, nclass, dde, tx));
+	}
+
+	kmem_cache_free(ddt_entry_cache, dde);
+}
+
+/*
+ * Returns true if the unique entries of the table should be walked by
+ * ddt_prune() in this txg.
+ */
+static boolean_t
+ddt_prune_pending(ddt_t *ddt)
+{
+	spa_t *spa = ddt->ddt_spa;
+	dsl_pool_t *dp = spa->spa_dsl_pool;
+
+	if (dsl_scan_scrubbing(dp) || dsl_scan_resilvering(dp))
+		return (B_FALSE);
+
+	return (ddt->ddt_prune.dpr_state != DDT_PRUNE_NONE ||
+	    (ddt_over_quota(spa) &&
+	    ddt_object_exists(ddt, DDT_TYPE_CURRENT, DDT_CLASS_UNIQUE)));
+}
+
+/*
+ * Sets the birth txg up to which the oldest zfs_dedup_prune_percent of
+ * the counted entries were born, interpolating within the power of two
+ * range of ages the cutoff falls in.  Returns false if there is nothing
+ * to remove.
+ */
+static boolean_t
+ddt_prune_cutoff(ddt_prune_t *dpr)
+{
+	uint64_t target, seen = 0, age = 0;
+	int b;
+
+	target = dpr->dpr_total * MIN(zfs_dedup_prune_percent, 100) / 100;
+	if (target == 0)
+		return (B_FALSE);
+
+	for (b = 64; b > 0; b--) {
+		if (seen + dpr->dpr_hist[b] >= target)
+			break;
+		seen += dpr->dpr_hist[b];
+	}
+
+	/* The ages counted in bucket b are in [2^(b-1), 2^b) */
+	if (b > 0) {
+		uint64_t width = 1ULL << (b - 1);
+		uint64_t need = target - seen;
+		uint64_t n = dpr->dpr_hist[b];
+
+		age = width + width - (width >= n ?
+		    width / n * need : width * need / n);
+	}
+
+	dpr->dpr_cutoff = dpr->dpr_txg - MIN(age, dpr->dpr_txg);
+	return (B_TRUE);
+}
+
+/*
+ * Once the dedup tables reach their quota, new unique blocks are written
+ * without an entry, see zio_ddt_write().  To make room for the blocks
+ * that are more likely to be deduplicated, the oldest unique entries are
+ * removed as well.  The unique class is walked twice, a bounded number
+ * of entries per txg: first to count the entries by age, then to remove
+ * those born before the cutoff.  The blocks of the removed entries keep
+ * their dedup bit, and are freed as ordinary blocks, see zio_ddt_free().
+ */
+static void
+ddt_prune(ddt_t *ddt, dmu_tx_t *tx)
+{
+	spa_t *spa = ddt->ddt_spa;
+	ddt_prune_t *dpr = &ddt->ddt_prune;
+	enum ddt_type type = DDT_TYPE_CURRENT;
+	enum ddt_class class = DDT_CLASS_UNIQUE;
+	ddt_entry_t *dde;
+	uint64_t pruned = 0;
+
+	if (!ddt_object_exists(ddt, type, class)) {
+		bzero(dpr, sizeof (ddt_prune_t));
+		return;
+	}
+
+	if (dpr->dpr_state == DDT_PRUNE_NONE) {
+		if (!ddt_over_quota(spa))
+			return;
+		bzero(dpr, sizeof (ddt_prune_t));
+		dpr->dpr_state = DDT_PRUNE_COUNT;
+		dpr->dpr_txg = dmu_tx_get_txg(tx);
+	}
+
+	dde = kmem_cache_alloc(ddt_entry_cache, KM_SLEEP);
+
+	for (uint64_t n = 0; n < zfs_dedup_prune_entries_per_txg; n++) {
+		uint64_t birth = 0;
+		int error;
+
+		error = ddt_object_walk(ddt, type, class, &dpr->dpr_cursor,
+		    dde);
+		if (error == ENOENT) {
+			dpr->dpr_cursor = 0;
+			if (dpr->dpr_state == DDT_PRUNE_REMOVE ||
+			    !ddt_prune_cutoff(dpr)) {
+				dpr->dpr_state = DDT_PRUNE_NONE;
+				break;
+			}
+			dpr->dpr_state = DDT_PRUNE_REMOVE;
+			continue;
+		}
+		VERIFY0(error);
+
+		for (int p = 0; p < DDT_PHYS_TYPES; p++)
+			birth = MAX(birth, dde->dde_phys[p].ddp_phys_birth);
+
+		/*
+		 * Entries with a record in the log, or being updated, are
+		 * not in their final state in the ZAP.  The lock keeps them
+		 * from being looked up while one is removed.
+		 */
+		ddt_enter(ddt);
+		if (ddt_log_find(ddt, &dde->dde_key, NULL) ||
+		    avl_find(&ddt->ddt_tree, dde, NULL) != NULL) {
+			ddt_exit(ddt);
+			continue;
+		}
+
+		if (dpr->dpr_state == DDT_PRUNE_COUNT) {
+			uint64_t age = dpr->dpr_txg - MIN(birth, dpr->dpr_txg);
+			dpr->dpr_hist[highbit64(age)]++;
+			dpr->dpr_total++;
+		} else if (birth <= dpr->dpr_cutoff) {
+			dde->dde_type = type;
+			dde->dde_class = class;
+			ddt_stat_update(ddt, dde, -1ULL);
+			VERIFY0(ddt_object_remove(ddt, type, class, dde, tx));
+			pruned++;
+		}
+		ddt_exit(ddt);
+	}
+
+	kmem_cache_free(ddt_entry_cache, dde);
+
+	if (pruned != 0) {
+		spa->spa_dedup_pruned += pruned;
+		VERIFY0(zap_update(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_DDT_PRUNED, sizeof (uint64_t), 1,
+		    &spa->spa_dedup_pruned, tx));
 	}
 }
 
@@ -1080,10 +1572,19 @@ static void
 ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 {
 	spa_t *spa = ddt->ddt_spa;
+	dsl_pool_t *dp = spa->spa_dsl_pool;
+	ddt_log_update_t dlu, *dlup = NULL;
+	ddt_sync_batch_t *dsb;
 	ddt_entry_t *dde;
 	void *cookie = NULL;
+	boolean_t uselog, objects = B_FALSE;
 
-	if (avl_numnodes(&ddt->ddt_tree) == 0)
+	/*
+	 * The dedup log is only flushed in the first pass, since every
+	 * flush dirties the MOS again.
+	 */
+	if (avl_numnodes(&ddt->ddt_tree) == 0 && (spa_sync_pass(spa) > 1 ||
+	    (!ddt_log_pending(ddt) && !ddt_prune_pending(ddt))))
 		return;
 
 	ASSERT(spa->spa_uberblock.ub_version >= SPA_VERSION_DEDUP);
@@ -1094,10 +1595,38 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 		    DMU_POOL_DDT_STATS, tx);
 	}
 
+	/*
+	 * Scans walk the ZAPs and rescan the entries whose class decreases
+	 * as they are synced, see dsl_scan_ddt().  So while one is running
+	 * the dedup log is applied in full first, and then bypassed.  It is
+	 * also applied in full when the pool is being exported, so that the
+	 * next import does not have to replay it.
+	 */
+	uselog = spa_feature_is_enabled(spa, SPA_FEATURE_DDT_LOG) &&
+	    !dsl_scan_scrubbing(dp) && !dsl_scan_resilvering(dp);
+	if (!uselog || spa_flush_all_logs_requested(spa))
+		ddt_log_flush(ddt, tx, B_TRUE);
+	else if (avl_numnodes(&ddt->ddt_tree) != 0)
+		ddt_log_begin(ddt, (dlup = &dlu), tx);
+
+	dsb = kmem_zalloc(sizeof (ddt_sync_batch_t), KM_SLEEP);
 	while ((dde = avl_destroy_nodes(&ddt->ddt_tree, &cookie)) != NULL) {
-		ddt_sync_entry(ddt, dde, tx, txg);
-		ddt_free(dde);
+		if (!ddt_sync_entry(ddt, dde, tx, txg, dlup, dsb))
+			ddt_free(dde);
+	}
+	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
+		for (enum ddt_class class = 0; class < DDT_CLASSES; class++)
+			ddt_sync_batch_flush(ddt, dsb, type, class, tx);
 	}
+	kmem_free(dsb, sizeof (ddt_sync_batch_t));
+
+	if (dlup != NULL)
+		ddt_log_commit(ddt, dlup);
+	if (uselog && spa_sync_pass(spa) == 1)
+		ddt_log_flush(ddt, tx, B_FALSE);
+	if (spa_sync_pass(spa) == 1 && !dsl_scan_scrubbing(dp) &&
+	    !dsl_scan_resilvering(dp))
+		ddt_prune(ddt, tx);
 
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		uint64_t add, count = 0;
@@ -1109,12 +1638,23 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 				count += add;
 			}
 		}
+		/*
+		 * The histograms of the classes are current, but the ZAPs
+		 * may lag behind until the log is applied.
+		 */
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
-			if (count == 0 && ddt_object_exists(ddt, type, class))
+			if (!ddt_object_exists(ddt, type, class))
+				continue;
+			if (count == 0 && ddt_log_empty(ddt))
 				ddt_object_destroy(ddt, type, class, tx);
+			else
+				objects = B_TRUE;
 		}
 	}
 
+	if (!objects)
+		ddt_log_destroy(ddt, tx);
+
 	bcopy(ddt->ddt_histogram, &ddt->ddt_histogram_cache,
 	    sizeof (ddt->ddt_histogram));
 	spa->spa_dedup_dspace = ~0ULL;
@@ -1154,9 +1694,28 @@ ddt_sync(spa_t *spa, uint64_t txg)
 	(void) zio_wait(rio);
 	scn->scn_zio_root = NULL;
 
+	ddt_quota_update(spa);
+
 	dmu_tx_commit(tx);
 }
 
+static boolean_t
+ddt_logged(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	boolean_t logged;
+
+	ddt_enter(ddt);
+	logged = ddt_log_find(ddt, ddk, NULL);
+	ddt_exit(ddt);
+
+	return (logged);
+}
+
+/*
+ * Walks the entries of the ZAPs.  Those with a record in the dedup log
+ * are skipped, since ddt_log_walk() returns their current state.  The log
+ * is always empty while a scan is running.
+ */
 int
 ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 {
@@ -1167,9 +1726,13 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 				int error = ENOENT;
 				if (ddt_object_exists(ddt, ddb->ddb_type,
 				    ddb->ddb_class)) {
-					error = ddt_object_walk(ddt,
-					    ddb->ddb_type, ddb->ddb_class,
-					    &ddb->ddb_cursor, dde);
+					do {
+						error = ddt_object_walk(ddt,
+						    ddb->ddb_type,
+						    ddb->ddb_class,
+						    &ddb->ddb_cursor, dde);
+					} while (error == 0 &&
+					    ddt_logged(ddt, &dde->dde_key));
 				}
 				dde->dde_type = ddb->ddb_type;
 				dde->dde_class = ddb->ddb_class;
@@ -1190,4 +1753,10 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 #if defined(_KERNEL)
 ZFS_MODULE_PARAM(zfs, zfs_, dedup_prefetch, UINT, ZMOD_RW,
 	"Enable prefetching dedup-ed blks");
+
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_prune_percent, UINT, ZMOD_RW,
+	"Percentage of unique dedup entries pruned at the quota");
+
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_prune_entries_per_txg, UINT, ZMOD_RW,
+	"Max unique dedup entries visited by pruning per txg");
 #endif
@@ -0,0 +1,607 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/zio.h>
+#include <sys/ddt.h>
+#include <sys/zap.h>
+#include <sys/dmu_tx.h>
+#include <sys/zio_checksum.h>
+#include <sys/zfeature.h>
+
+/*
+ * Dedup log
+ *
+ * Without the log, every entry of the dedup table changed in a txg is
+ * rewritten in the ZAP objects when the txg syncs.  Since the entries are
+ * keyed by checksum, each of them is in a different leaf block, so a
+ * txg which changes N entries reads and writes about N random blocks of
+ * the table, which quickly dominates once the table is larger than the
+ * ARC.
+ *
+ * With the log, the changed entries are instead appended to the active
+ * log object as fixed size records, and kept in an in-core tree indexed
+ * by key which ddt_lookup() consults before the ZAPs.  When the flushing
+ * log is empty, the roles of the two logs are swapped once the active one
+ * holds zfs_dedup_log_txg_max txgs of records.  The entries of the
+ * flushing log are then applied to the ZAPs in key order, at least
+ * zfs_dedup_log_flush_entries_min per txg and enough to be done before
+ * the new active log is due to be swapped.  The ZAP blocks of a batch are
+ * prefetched together, and an entry changed several times over the life
+ * of a log is only written once.
+ *
+ * The key of the last entry flushed is kept in the header of the
+ * flushing log, so that when the logs are replayed at import the records
+ * already applied are skipped.  Later records of a key replace earlier
+ * ones, and the records of the active log replace those of the flushing
+ * one.
+ *
+ * Scans walk the ZAPs, see dsl_scan_ddt(), so while one is running the
+ * log is applied in full and changes go to the ZAPs directly.
+ */
+
+/*
+ * Maximum number of txgs of records the active log holds before it is
+ * flushed.
+ */
+unsigned int zfs_dedup_log_txg_max = 8;
+
+/*
+ * Minimum number of entries applied to the ZAPs per txg while a log is
+ * flushed.
+ */
+unsigned int zfs_dedup_log_flush_entries_min = 1000;
+
+static kmem_cache_t *ddt_log_entry_cache;
+
+/* Records buffered before they are written to the active log */
+#define	DDT_LOG_BUF_RECORDS	\
+	(SPA_OLD_MAXBLOCKSIZE / sizeof (ddt_log_record_t))
+
+void
+ddt_log_init(void)
+{
+	ddt_log_entry_cache = kmem_cache_create("ddt_log_entry_cache",
+	    sizeof (ddt_log_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+ddt_log_fini(void)
+{
+	kmem_cache_destroy(ddt_log_entry_cache);
+}
+
+static int
+ddt_log_entry_compare(const void *x1, const void *x2)
+{
+	const ddt_log_entry_t *dle1 = x1;
+	const ddt_log_entry_t *dle2 = x2;
+
+	return (ddt_key_compare(&dle1->dle_key, &dle2->dle_key));
+}
+
+static void
+ddt_log_name(ddt_t *ddt, uint_t n, char *name)
+{
+	(void) sprintf(name, DMU_POOL_DDT_LOG,
+	    zio_checksum_table[ddt->ddt_checksum].ci_name, n);
+}
+
+static uint64_t
+ddt_log_entry_refcnt(const ddt_log_entry_t *dle)
+{
+	uint64_t refcnt = 0;
+
+	for (int p = DDT_PHYS_SINGLE; p <= DDT_PHYS_TRIPLE; p++)
+		refcnt += dle->dle_phys[p].ddp_refcnt;
+
+	return (refcnt);
+}
+
+void
+ddt_log_alloc(ddt_t *ddt)
+{
+	for (int n = 0; n < 2; n++) {
+		avl_create(&ddt->ddt_log[n].ddl_tree, ddt_log_entry_compare,
+		    sizeof (ddt_log_entry_t),
+		    offsetof(ddt_log_entry_t, dle_node));
+	}
+
+	ddt->ddt_log_active = &ddt->ddt_log[0];
+	ddt->ddt_log_flushing = &ddt->ddt_log[1];
+}
+
+static void
+ddt_log_clear(ddt_log_t *ddl)
+{
+	ddt_log_entry_t *dle;
+	void *cookie = NULL;
+
+	while ((dle = avl_destroy_nodes(&ddl->ddl_tree, &cookie)) != NULL)
+		kmem_cache_free(ddt_log_entry_cache, dle);
+}
+
+void
+ddt_log_free(ddt_t *ddt)
+{
+	for (int n = 0; n < 2; n++) {
+		ddt_log_clear(&ddt->ddt_log[n]);
+		avl_destroy(&ddt->ddt_log[n].ddl_tree);
+	}
+}
+
+/*
+ * Records the latest state of a key in the in-core tree of a log.
+ */
+static void
+ddt_log_insert(ddt_log_t *ddl, const ddt_key_t *ddk, const ddt_phys_t *ddp)
+{
+	ddt_log_entry_t *dle, dle_search;
+	avl_index_t where;
+
+	dle_search.dle_key = *ddk;
+	dle = avl_find(&ddl->ddl_tree, &dle_search, &where);
+	if (dle == NULL) {
+		dle = kmem_cache_alloc(ddt_log_entry_cache, KM_SLEEP);
+		dle->dle_key = *ddk;
+		avl_insert(&ddl->ddl_tree, dle, where);
+	}
+
+	bcopy(ddp, dle->dle_phys, sizeof (dle->dle_phys));
+}
+
+static void
+ddt_log_sync_phys(ddt_t *ddt, ddt_log_t *ddl, dmu_tx_t *tx)
+{
+	dmu_buf_t *db;
+
+	VERIFY0(dmu_bonus_hold(ddt->ddt_os, ddl->ddl_object, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	bcopy(&ddl->ddl_phys, db->db_data, sizeof (ddt_log_phys_t));
+	dmu_buf_rele(db, FTAG);
+}
+
+static int
+ddt_log_load_one(ddt_t *ddt, uint_t n)
+{
+	ddt_log_t *ddl = &ddt->ddt_log[n];
+	ddt_log_phys_t *dlp = &ddl->ddl_phys;
+	ddt_log_record_t *buf;
+	char name[DDT_NAMELEN];
+	dmu_buf_t *db;
+	int error;
+
+	ddt_log_name(ddt, n, name);
+
+	error = zap_lookup(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), 1, &ddl->ddl_object);
+	if (error != 0)
+		return (error);
+
+	error = dmu_bonus_hold(ddt->ddt_os, ddl->ddl_object, FTAG, &db);
+	if (error != 0)
+		return (error);
+	bcopy(db->db_data, dlp, sizeof (ddt_log_phys_t));
+	dmu_buf_rele(db, FTAG);
+
+	buf = vmem_alloc(DDT_LOG_BUF_RECORDS * sizeof (ddt_log_record_t),
+	    KM_SLEEP);
+
+	for (uint64_t r = 0; r < dlp->dlp_length; r += DDT_LOG_BUF_RECORDS) {
+		uint64_t count = MIN(dlp->dlp_length - r, DDT_LOG_BUF_RECORDS);
+
+		error = dmu_read(ddt->ddt_os, ddl->ddl_object,
+		    r * sizeof (ddt_log_record_t),
+		    count * sizeof (ddt_log_record_t), buf, DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		for (uint64_t i = 0; i < count; i++) {
+			ddt_log_record_t *dlr = &buf[i];
+
+			if ((dlp->dlp_flags & DDT_LOG_FLAG_CHECKPOINT) &&
+			    ddt_key_compare(&dlr->dlr_key,
+			    &dlp->dlp_checkpoint) <= 0)
+				continue;
+
+			ddt_log_insert(ddl, &dlr->dlr_key, dlr->dlr_phys);
+		}
+	}
+
+	vmem_free(buf, DDT_LOG_BUF_RECORDS * sizeof (ddt_log_record_t));
+
+	return (error);
+}
+
+int
+ddt_log_load(ddt_t *ddt)
+{
+	int error;
+
+	for (uint_t n = 0; n < 2; n++) {
+		error = ddt_log_load_one(ddt, n);
+		if (error == ENOENT && n == 0)
+			return (0);
+		if (error != 0)
+			return (error);
+	}
+
+	if (ddt->ddt_log[0].ddl_phys.dlp_flags & DDT_LOG_FLAG_FLUSHING) {
+		ddt->ddt_log_active = &ddt->ddt_log[1];
+		ddt->ddt_log_flushing = &ddt->ddt_log[0];
+	}
+
+	return (0);
+}
+
+static void
+ddt_log_create(ddt_t *ddt, dmu_tx_t *tx)
+{
+	objset_t *os = ddt->ddt_os;
+	char name[DDT_NAMELEN];
+
+	for (uint_t n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		ASSERT0(ddl->ddl_object);
+		ddl->ddl_object = dmu_object_alloc(os, DMU_OTN_UINT64_METADATA,
+		    SPA_OLD_MAXBLOCKSIZE, DMU_OTN_UINT64_METADATA,
+		    sizeof (ddt_log_phys_t), tx);
+
+		bzero(&ddl->ddl_phys, sizeof (ddt_log_phys_t));
+		if (ddl == ddt->ddt_log_flushing)
+			ddl->ddl_phys.dlp_flags = DDT_LOG_FLAG_FLUSHING;
+		ddt_log_sync_phys(ddt, ddl, tx);
+
+		ddt_log_name(ddt, n, name);
+		VERIFY0(zap_add(os, DMU_POOL_DIRECTORY_OBJECT, name,
+		    sizeof (uint64_t), 1, &ddl->ddl_object, tx));
+	}
+
+	spa_feature_incr(ddt->ddt_spa, SPA_FEATURE_DDT_LOG, tx);
+}
+
+void
+ddt_log_destroy(ddt_t *ddt, dmu_tx_t *tx)
+{
+	objset_t *os = ddt->ddt_os;
+	char name[DDT_NAMELEN];
+
+	if (ddt->ddt_log[0].ddl_object == 0)
+		return;
+
+	ASSERT(ddt_log_empty(ddt));
+
+	for (uint_t n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		ddt_log_name(ddt, n, name);
+		VERIFY0(zap_remove(os, DMU_POOL_DIRECTORY_OBJECT, name, tx));
+		VERIFY0(dmu_object_free(os, ddl->ddl_object, tx));
+
+		ddl->ddl_object = 0;
+		bzero(&ddl->ddl_phys, sizeof (ddt_log_phys_t));
+	}
+
+	ddt->ddt_log_active = &ddt->ddt_log[0];
+	ddt->ddt_log_flushing = &ddt->ddt_log[1];
+
+	spa_feature_decr(ddt->ddt_spa, SPA_FEATURE_DDT_LOG, tx);
+}
+
+/*
+ * Returns whether the logs hold the key, and copies its latest state to
+ * ddp when they do.  An entry without references has been removed from
+ * the table.
+ */
+boolean_t
+ddt_log_find(ddt_t *ddt, const ddt_key_t *ddk, ddt_phys_t *ddp)
+{
+	ddt_log_entry_t *dle, dle_search;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	dle_search.dle_key = *ddk;
+	dle = avl_find(&ddt->ddt_log_active->ddl_tree, &dle_search, NULL);
+	if (dle == NULL) {
+		dle = avl_find(&ddt->ddt_log_flushing->ddl_tree, &dle_search,
+		    NULL);
+	}
+	if (dle == NULL)
+		return (B_FALSE);
+
+	if (ddp != NULL)
+		bcopy(dle->dle_phys, ddp, sizeof (dle->dle_phys));
+
+	return (B_TRUE);
+}
+
+/*
+ * Returns whether all the logged entries have been applied to the ZAPs.
+ */
+boolean_t
+ddt_log_empty(ddt_t *ddt)
+{
+	return (avl_numnodes(&ddt->ddt_log[0].ddl_tree) == 0 &&
+	    avl_numnodes(&ddt->ddt_log[1].ddl_tree) == 0);
+}
+
+/*
+ * Returns whether the logs need to be synced, either to apply entries or
+ * to truncate a log whose entries have all been applied.
+ */
+boolean_t
+ddt_log_pending(ddt_t *ddt)
+{
+	return (!ddt_log_empty(ddt) ||
+	    ddt->ddt_log[0].ddl_phys.dlp_length != 0 ||
+	    ddt->ddt_log[1].ddl_phys.dlp_length != 0);
+}
+
+void
+ddt_log_begin(ddt_t *ddt, ddt_log_update_t *dlu, dmu_tx_t *tx)
+{
+	if (ddt->ddt_log_active->ddl_object == 0)
+		ddt_log_create(ddt, tx);
+
+	dlu->dlu_max = DDT_LOG_BUF_RECORDS;
+	dlu->dlu_buf = vmem_alloc(dlu->dlu_max * sizeof (ddt_log_record_t),
+	    KM_SLEEP);
+	dlu->dlu_count = 0;
+	dlu->dlu_tx = tx;
+}
+
+static void
+ddt_log_write(ddt_t *ddt, ddt_log_update_t *dlu)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	ddt_log_phys_t *dlp = &ddl->ddl_phys;
+
+	if (dlu->dlu_count == 0)
+		return;
+
+	dmu_write(ddt->ddt_os, ddl->ddl_object,
+	    dlp->dlp_length * sizeof (ddt_log_record_t),
+	    dlu->dlu_count * sizeof (ddt_log_record_t), dlu->dlu_buf,
+	    dlu->dlu_tx);
+
+	if (dlp->dlp_length == 0)
+		dlp->dlp_first_txg = dmu_tx_get_txg(dlu->dlu_tx);
+	dlp->dlp_length += dlu->dlu_count;
+	dlu->dlu_count = 0;
+}
+
+/*
+ * Appends the state of a synced entry to the active log.
+ */
+void
+ddt_log_entry(ddt_t *ddt, ddt_log_update_t *dlu, const ddt_entry_t *dde)
+{
+	ddt_log_record_t *dlr = &dlu->dlu_buf[dlu->dlu_count++];
+
+	dlr->dlr_key = dde->dde_key;
+	bcopy(dde->dde_phys, dlr->dlr_phys, sizeof (dlr->dlr_phys));
+
+	ddt_enter(ddt);
+	ddt_log_insert(ddt->ddt_log_active, &dde->dde_key, dde->dde_phys);
+	ddt_exit(ddt);
+
+	if (dlu->dlu_count == dlu->dlu_max)
+		ddt_log_write(ddt, dlu);
+}
+
+void
+ddt_log_commit(ddt_t *ddt, ddt_log_update_t *dlu)
+{
+	ddt_log_write(ddt, dlu);
+	ddt_log_sync_phys(ddt, ddt->ddt_log_active, dlu->dlu_tx);
+
+	vmem_free(dlu->dlu_buf, dlu->dlu_max * sizeof (ddt_log_record_t));
+	dlu->dlu_buf = NULL;
+}
+
+/*
+ * Applies up to count entries of a log to the ZAPs in key order, and
+ * returns the key of the last one in last.  The ZAP blocks of the whole
+ * batch are prefetched first so that they are read concurrently.  An
+ * entry is removed from the tree only once the ZAPs hold its state, so
+ * that lookups find it in either place.
+ */
+static void
+ddt_log_flush_entries(ddt_t *ddt, ddt_log_t *ddl, uint64_t count,
+    dmu_tx_t *tx, ddt_key_t *last)
+{
+	avl_tree_t *t = &ddl->ddl_tree;
+	ddt_log_entry_t *dle, *dle_next;
+	uint64_t n;
+
+	for (dle = avl_first(t), n = 0; dle != NULL && n < count;
+	    dle = AVL_NEXT(t, dle), n++)
+		ddt_prefetch_key(ddt, &dle->dle_key);
+
+	for (dle = avl_first(t); dle != NULL && count > 0;
+	    dle = dle_next, count--) {
+		dle_next = AVL_NEXT(t, dle);
+
+		ddt_flush_entry(ddt, &dle->dle_key, dle->dle_phys, tx);
+		if (last != NULL)
+			*last = dle->dle_key;
+
+		ddt_enter(ddt);
+		avl_remove(t, dle);
+		ddt_exit(ddt);
+		kmem_cache_free(ddt_log_entry_cache, dle);
+	}
+}
+
+static void
+ddt_log_truncate(ddt_t *ddt, ddt_log_t *ddl, dmu_tx_t *tx)
+{
+	ddt_log_phys_t *dlp = &ddl->ddl_phys;
+
+	ASSERT0(avl_numnodes(&ddl->ddl_tree));
+
+	if (dlp->dlp_length == 0 && !(dlp->dlp_flags & DDT_LOG_FLAG_CHECKPOINT))
+		return;
+
+	VERIFY0(dmu_free_range(ddt->ddt_os, ddl->ddl_object, 0,
+	    DMU_OBJECT_END, tx));
+
+	dlp->dlp_flags &= ~DDT_LOG_FLAG_CHECKPOINT;
+	dlp->dlp_length = 0;
+	dlp->dlp_first_txg = 0;
+	bzero(&dlp->dlp_checkpoint, sizeof (ddt_key_t));
+	ddt_log_sync_phys(ddt, ddl, tx);
+}
+
+static void
+ddt_log_swap(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *active = ddt->ddt_log_active;
+	ddt_log_t *flushing = ddt->ddt_log_flushing;
+
+	ASSERT0(avl_numnodes(&flushing->ddl_tree));
+	ASSERT0(flushing->ddl_phys.dlp_length);
+
+	active->ddl_phys.dlp_flags |= DDT_LOG_FLAG_FLUSHING;
+	flushing->ddl_phys.dlp_flags &= ~DDT_LOG_FLAG_FLUSHING;
+	ddt_log_sync_phys(ddt, active, tx);
+	ddt_log_sync_phys(ddt, flushing, tx);
+
+	ddt_enter(ddt);
+	ddt->ddt_log_active = flushing;
+	ddt->ddt_log_flushing = active;
+	ddt_exit(ddt);
+}
+
+/*
+ * Applies a batch of the flushing log to the ZAPs, or all the entries of
+ * both logs when all is set.  Once the flushing log is empty it is
+ * truncated, and swapped with the active log when that one is due.
+ */
+void
+ddt_log_flush(ddt_t *ddt, dmu_tx_t *tx, boolean_t all)
+{
+	ddt_log_t *active = ddt->ddt_log_active;
+	ddt_log_t *flushing = ddt->ddt_log_flushing;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	uint64_t txg_max = MAX(zfs_dedup_log_txg_max, 1);
+
+	if (flushing->ddl_object == 0)
+		return;
+
+	if (all) {
+		/* The records of the active log are the most recent */
+		ddt_log_flush_entries(ddt, flushing, UINT64_MAX, tx, NULL);
+		ddt_log_flush_entries(ddt, active, UINT64_MAX, tx, NULL);
+		ddt_log_truncate(ddt, flushing, tx);
+		ddt_log_truncate(ddt, active, tx);
+		return;
+	}
+
+	if (avl_numnodes(&flushing->ddl_tree) != 0) {
+		uint64_t age = 0, count;
+
+		/*
+		 * Spread the flush over the txgs left until the active log
+		 * is due to be swapped.
+		 */
+		if (active->ddl_phys.dlp_length != 0)
+			age = txg - active->ddl_phys.dlp_first_txg;
+		count = howmany(avl_numnodes(&flushing->ddl_tree),
+		    txg_max > age ? txg_max - age : 1);
+		count = MAX(count, zfs_dedup_log_flush_entries_min);
+
+		ddt_log_flush_entries(ddt, flushing, count, tx,
+		    &flushing->ddl_phys.dlp_checkpoint);
+
+		if (avl_numnodes(&flushing->ddl_tree) != 0) {
+			flushing->ddl_phys.dlp_flags |= DDT_LOG_FLAG_CHECKPOINT;
+			ddt_log_sync_phys(ddt, flushing, tx);
+			return;
+		}
+	}
+
+	ddt_log_truncate(ddt, flushing, tx);
+
+	if (active->ddl_phys.dlp_length != 0 &&
+	    txg - active->ddl_phys.dlp_first_txg >= txg_max)
+		ddt_log_swap(ddt, tx);
+}
+
+/*
+ * Returns the next entry of the logs which has references in dde, for
+ * consumers which walk the whole table such as zdb.  The on-disk tables
+ * may hold stale copies of these entries, which ddt_walk() skips.  The
+ * cookie must be NULL for the first call.
+ */
+int
+ddt_log_walk(ddt_t *ddt, void **cookie, ddt_entry_t *dde)
+{
+	avl_tree_t *active = &ddt->ddt_log_active->ddl_tree;
+	avl_tree_t *flushing = &ddt->ddt_log_flushing->ddl_tree;
+	ddt_log_entry_t *dle = *cookie;
+	avl_tree_t *t = active;
+	uint64_t refcnt;
+
+	if (dle == NULL) {
+		dle = avl_first(t);
+	} else {
+		if (avl_find(active, dle, NULL) != dle)
+			t = flushing;
+		dle = AVL_NEXT(t, dle);
+	}
+
+	for (;;) {
+		if (dle == NULL) {
+			if (t == flushing)
+				return (SET_ERROR(ENOENT));
+			t = flushing;
+			dle = avl_first(t);
+			continue;
+		}
+
+		refcnt = ddt_log_entry_refcnt(dle);
+		if (refcnt != 0 &&
+		    (t == active || avl_find(active, dle, NULL) == NULL))
+			break;
+
+		dle = AVL_NEXT(t, dle);
+	}
+
+	*cookie = dle;
+
+	dde->dde_key = dle->dle_key;
+	bcopy(dle->dle_phys, dde->dde_phys, sizeof (dde->dde_phys));
+	dde->dde_type = DDT_TYPE_CURRENT;
+	dde->dde_class = refcnt > 1 ? DDT_CLASS_DUPLICATE : DDT_CLASS_UNIQUE;
+
+	return (0);
+}
+
+#if defined(_KERNEL)
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_log_txg_max, UINT, ZMOD_RW,
+	"Max txgs of dedup table changes the active dedup log holds");
+
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_log_flush_entries_min, UINT, ZMOD_RW,
+	"Min dedup log entries applied to the dedup table per txg");
+#endif
@@ -91,6 +91,14 @@ ddt_zap_prefetch(objset_t *os, uint64_t object, ddt_entry_t *dde)
 	    DDT_KEY_WORDS);
 }
 
+static void
+ddt_zap_prefetch_batch(objset_t *os, uint64_t object, const ddt_key_t *keys,
+    uint_t count)
+{
+	(void) zap_prefetch_uint64_batch(os, object, (const uint64_t *)keys,
+	    DDT_KEY_WORDS, count);
+}
+
 static int
 ddt_zap_update(objset_t *os, uint64_t object, ddt_entry_t *dde, dmu_tx_t *tx)
 {
@@ -104,6 +112,35 @@ ddt_zap_update(objset_t *os, uint64_t object, ddt_entry_t *dde, dmu_tx_t *tx)
 	    DDT_KEY_WORDS, 1, csize, cbuf, tx));
 }
 
+static int
+ddt_zap_update_batch(objset_t *os, uint64_t object, ddt_entry_t **ddes,
+    uint_t count, dmu_tx_t *tx)
+{
+	size_t cbsize = sizeof (ddes[0]->dde_phys) + 1;
+	uchar_t *cbufs = kmem_alloc(count * cbsize, KM_SLEEP);
+	zap_batch_ent_t *zbes = kmem_alloc(count * sizeof (zap_batch_ent_t),
+	    KM_SLEEP);
+	int error;
+
+	for (uint_t i = 0; i < count; i++) {
+		ddt_entry_t *dde = ddes[i];
+		uchar_t *cbuf = cbufs + i * cbsize;
+
+		zbes[i].zbe_key = &dde->dde_key;
+		zbes[i].zbe_integer_size = 1;
+		zbes[i].zbe_num_integers = ddt_compress(dde->dde_phys, cbuf,
+		    sizeof (dde->dde_phys), cbsize);
+		zbes[i].zbe_val = cbuf;
+	}
+
+	error = zap_update_uint64_batch(os, object, DDT_KEY_WORDS, zbes, count,
+	    tx);
+
+	kmem_free(zbes, count * sizeof (zap_batch_ent_t));
+	kmem_free(cbufs, count * cbsize);
+	return (error);
+}
+
 static int
 ddt_zap_remove(objset_t *os, uint64_t object, ddt_entry_t *dde, dmu_tx_t *tx)
 {
@@ -161,7 +198,9 @@ const ddt_ops_t ddt_zap_ops = {
 	ddt_zap_destroy,
 	ddt_zap_lookup,
 	ddt_zap_prefetch,
+	ddt_zap_prefetch_batch,
 	ddt_zap_update,
+	ddt_zap_update_batch,
 	ddt_zap_remove,
 	ddt_zap_walk,
 	ddt_zap_count,
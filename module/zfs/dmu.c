@@ -76,6 +76,13 @@ unsigned long zfs_per_txg_dirty_frees_percent = 5;
  */
 int zfs_dmu_offset_next_sync = 0;
 
+/*
+ * Number of hits in the ARC after which a block of a file or volume is
+ * rewritten on the special allocation class when it is read, see
+ * dmu_promote().  0 disables this.
+ */
+uint_t zfs_special_promote_hits = 0;
+
 /*
  * Limit the amount we can prefetch with one call to this amount.  This
  * helps to limit the amount of memory that can be used by prefetching.
@@ -510,6 +517,8 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
 	 */
 	dbuf_flags = DB_RF_CANFAIL | DB_RF_NEVERWAIT | DB_RF_HAVESTRUCT |
 	    DB_RF_NOPREFETCH;
+	if (flags & DMU_DIRECTIO)
+		dbuf_flags |= DB_RF_NOCACHE;
 
 	rw_enter(&dn->dn_struct_rwlock, RW_READER);
 	if (dn->dn_datablkshift) {
@@ -708,6 +717,46 @@ dmu_prefetch(objset_t *os, uint64_t object, int64_t level, uint64_t offset,
 	dnode_rele(dn, FTAG);
 }
 
+/*
+ * Prefetch the dnodes (and so the bonus buffers) of a batch of objects.
+ * Calling dmu_prefetch() for each object looks up the same block of
+ * dnodes once per object, in whatever order the objects come in.  Here
+ * the objects are sorted first, so that each block of dnodes is looked up
+ * and prefetched once, in ascending order.
+ */
+void
+dmu_prefetch_dnodes(objset_t *os, uint64_t *objs, int count,
+    zio_priority_t pri)
+{
+	dnode_t *dn = DMU_META_DNODE(os);
+	uint64_t last_blkid = UINT64_MAX;
+
+	/* the batches are small, so an insertion sort will do */
+	for (int i = 1; i < count; i++) {
+		uint64_t obj = objs[i];
+		int j;
+
+		for (j = i; j > 0 && objs[j - 1] > obj; j--)
+			objs[j] = objs[j - 1];
+		objs[j] = obj;
+	}
+
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	for (int i = 0; i < count; i++) {
+		uint64_t blkid;
+
+		if (objs[i] == 0 || objs[i] >= DN_MAX_OBJECT)
+			continue;
+
+		blkid = dbuf_whichblock(dn, 0, objs[i] * sizeof (dnode_phys_t));
+		if (blkid != last_blkid) {
+			dbuf_prefetch(dn, 0, blkid, pri, 0);
+			last_blkid = blkid;
+		}
+	}
+	rw_exit(&dn->dn_struct_rwlock);
+}
+
 /*
  * Get the next "chunk" of file data to free.  We traverse the file from
  * the end so that the file gets shorter over time (if we crashes in the
@@ -1313,8 +1362,106 @@ xuio_stat_wbuf_nocopy(void)
 }
 
 #ifdef _KERNEL
-int
-dmu_read_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size)
+/*
+ * Returns whether the block of a buffer which was just read is hot enough
+ * to be promoted to the special class, and can be without using more space:
+ * blocks shared with a snapshot, or deduplicated, are left where they are.
+ */
+static boolean_t
+dmu_promote_eligible(dnode_t *dn, dmu_buf_impl_t *db)
+{
+	spa_t *spa = dn->dn_objset->os_spa;
+	dsl_dataset_t *ds = dn->dn_objset->os_dsl_dataset;
+	blkptr_t bp;
+
+	if (db->db_level != 0 || db->db_blkid == DMU_BONUS_BLKID ||
+	    db->db_blkid == DMU_SPILL_BLKID)
+		return (B_FALSE);
+
+	mutex_enter(&db->db_mtx);
+	if (db->db_state != DB_CACHED || db->db_buf == NULL ||
+	    db->db_blkptr == NULL || db->db_last_dirty != NULL ||
+	    arc_buf_hits(db->db_buf) < zfs_special_promote_hits) {
+		mutex_exit(&db->db_mtx);
+		return (B_FALSE);
+	}
+	bp = *db->db_blkptr;
+	mutex_exit(&db->db_mtx);
+
+	return (!BP_IS_HOLE(&bp) && !BP_IS_EMBEDDED(&bp) && !BP_IS_GANG(&bp) &&
+	    !BP_GET_DEDUP(&bp) &&
+	    bp.blk_birth > dsl_dataset_phys(ds)->ds_prev_snap_txg &&
+	    spa_bp_class(spa, &bp) != spa_special_class(spa));
+}
+
+/*
+ * Rewrite the hot blocks among the buffers just read from a file or a
+ * volume, so that they move to the special class.  This is only done while
+ * the pool has little dirty data, and gives up rather than wait for a txg,
+ * so that it does not slow the reads down.  Note that the rewritten blocks
+ * are born again, and are sent again by incremental sends.
+ */
+static void
+dmu_promote(dnode_t *dn, dmu_buf_t **dbp, int numbufs)
+{
+	objset_t *os = dn->dn_objset;
+	spa_t *spa = os->os_spa;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	boolean_t *promote;
+	uint64_t start = UINT64_MAX, end = 0;
+	dmu_tx_t *tx;
+
+	if (zfs_special_promote_hits == 0 || !DMU_OT_IS_FILE(dn->dn_type) ||
+	    !spa_writeable(spa) || os->os_dsl_dataset == NULL ||
+	    dmu_objset_is_snapshot(os) ||
+	    dp->dp_dirty_total >=
+	    dsl_pool_dirty_max(dp) * zfs_dirty_data_sync_percent / 100)
+		return;
+
+	/*
+	 * The special class may be missing, or be short of the space it
+	 * reserves for metadata, see spa_preferred_class().
+	 */
+	if (spa_preferred_class(spa, dn->dn_datablksz, dn->dn_type, 0,
+	    SPA_MAXBLOCKSIZE) != spa_special_class(spa))
+		return;
+
+	promote = kmem_zalloc(numbufs * sizeof (boolean_t), KM_SLEEP);
+	for (int i = 0; i < numbufs; i++) {
+		if (!dmu_promote_eligible(dn, (dmu_buf_impl_t *)dbp[i]))
+			continue;
+		promote[i] = B_TRUE;
+		start = MIN(start, dbp[i]->db_offset);
+		end = MAX(end, dbp[i]->db_offset + dbp[i]->db_size);
+	}
+
+	if (start < end) {
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_write_by_dnode(tx, dn, start, end - start);
+		if (dmu_tx_assign(tx, TXG_NOWAIT) != 0) {
+			dmu_tx_abort(tx);
+		} else {
+			for (int i = 0; i < numbufs; i++) {
+				dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbp[i];
+				dbuf_dirty_record_t *dr;
+
+				if (!promote[i])
+					continue;
+				dmu_buf_will_dirty(dbp[i], tx);
+				dr = dbuf_dirty(db, tx);
+				mutex_enter(&db->db_mtx);
+				dr->dt.dl.dr_promote = B_TRUE;
+				mutex_exit(&db->db_mtx);
+			}
+			dmu_tx_commit(tx);
+		}
+	}
+
+	kmem_free(promote, numbufs * sizeof (boolean_t));
+}
+
+static int
+dmu_read_uio_impl(dnode_t *dn, uio_t *uio, uint64_t size, uint32_t flags)
 {
 	dmu_buf_t **dbp;
 	int numbufs, i, err;
@@ -1322,12 +1469,14 @@ dmu_read_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size)
 	xuio_t *xuio = NULL;
 #endif
 
+	dmu_objset_iolimit(dn->dn_objset, B_FALSE, size);
+
 	/*
 	 * NB: we could do this block-at-a-time, but it's nice
 	 * to be reading in parallel.
 	 */
 	err = dmu_buf_hold_array_by_dnode(dn, uio->uio_loffset, size,
-	    TRUE, FTAG, &numbufs, &dbp, 0);
+	    TRUE, FTAG, &numbufs, &dbp, flags);
 	if (err)
 		return (err);
 
@@ -1365,11 +1514,19 @@ dmu_read_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size)
 
 		size -= tocpy;
 	}
+	if (err == 0)
+		dmu_promote(dn, dbp, numbufs);
 	dmu_buf_rele_array(dbp, numbufs, FTAG);
 
 	return (err);
 }
 
+int
+dmu_read_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size)
+{
+	return (dmu_read_uio_impl(dn, uio, size, DMU_READ_PREFETCH));
+}
+
 /*
  * Read 'size' bytes into the uio buffer.
  * From object zdb->db_object.
@@ -1378,9 +1535,12 @@ dmu_read_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size)
  * If the caller already has a dbuf in the target object
  * (e.g. its bonus buffer), this routine is faster than dmu_read_uio(),
  * because we don't have to find the dnode_t for the object.
+ *
+ * With DMU_DIRECTIO, blocks which are not already cached are read
+ * without prefetch and are not retained in the dbuf cache or the ARC.
  */
 int
-dmu_read_uio_dbuf(dmu_buf_t *zdb, uio_t *uio, uint64_t size)
+dmu_read_uio_dbuf(dmu_buf_t *zdb, uio_t *uio, uint64_t size, uint32_t flags)
 {
 	dmu_buf_impl_t *db = (dmu_buf_impl_t *)zdb;
 	dnode_t *dn;
@@ -1391,7 +1551,7 @@ dmu_read_uio_dbuf(dmu_buf_t *zdb, uio_t *uio, uint64_t size)
 
 	DB_DNODE_ENTER(db);
 	dn = DB_DNODE(db);
-	err = dmu_read_uio_dnode(dn, uio, size);
+	err = dmu_read_uio_impl(dn, uio, size, flags);
 	DB_DNODE_EXIT(db);
 
 	return (err);
@@ -1422,8 +1582,9 @@ dmu_read_uio(objset_t *os, uint64_t object, uio_t *uio, uint64_t size)
 	return (err);
 }
 
-int
-dmu_write_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx)
+static int
+dmu_write_uio_impl(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx,
+    uint32_t flags)
 {
 	dmu_buf_t **dbp;
 	int numbufs;
@@ -1447,6 +1608,9 @@ dmu_write_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx)
 
 		ASSERT(i == 0 || i == numbufs-1 || tocpy == db->db_size);
 
+		if (flags & DMU_DIRECTIO)
+			dbuf_set_uncached((dmu_buf_impl_t *)db);
+
 		if (tocpy == db->db_size)
 			dmu_buf_will_fill(db, tx);
 		else
@@ -1474,6 +1638,12 @@ dmu_write_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx)
 	return (err);
 }
 
+int
+dmu_write_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx)
+{
+	return (dmu_write_uio_impl(dn, uio, size, tx, 0));
+}
+
 /*
  * Write 'size' bytes from the uio buffer.
  * To object zdb->db_object.
@@ -1482,10 +1652,13 @@ dmu_write_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx)
  * If the caller already has a dbuf in the target object
  * (e.g. its bonus buffer), this routine is faster than dmu_write_uio(),
  * because we don't have to find the dnode_t for the object.
+ *
+ * With DMU_DIRECTIO, blocks which are not already cached are dropped
+ * from the dbuf cache and the ARC once they have been synced.
  */
 int
 dmu_write_uio_dbuf(dmu_buf_t *zdb, uio_t *uio, uint64_t size,
-    dmu_tx_t *tx)
+    dmu_tx_t *tx, uint32_t flags)
 {
 	dmu_buf_impl_t *db = (dmu_buf_impl_t *)zdb;
 	dnode_t *dn;
@@ -1496,7 +1669,7 @@ dmu_write_uio_dbuf(dmu_buf_t *zdb, uio_t *uio, uint64_t size,
 
 	DB_DNODE_ENTER(db);
 	dn = DB_DNODE(db);
-	err = dmu_write_uio_dnode(dn, uio, size, tx);
+	err = dmu_write_uio_impl(dn, uio, size, tx, flags);
 	DB_DNODE_EXIT(db);
 
 	return (err);
@@ -2004,7 +2177,7 @@ dmu_sync(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
 	dsa->dsa_tx = NULL;
 
 	zio_nowait(arc_write(pio, os->os_spa, txg,
-	    zgd->zgd_bp, dr->dt.dl.dr_data, DBUF_IS_L2CACHEABLE(db),
+	    zgd->zgd_bp, dr->dt.dl.dr_data, DBUF_L2CACHE_FLAGS(db),
 	    &zp, dmu_sync_ready, NULL, NULL, dmu_sync_done, dsa,
 	    ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL, &zb));
 
@@ -2237,6 +2410,8 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	zp->zp_nopwrite = nopwrite;
 	zp->zp_encrypt = encrypt;
 	zp->zp_byteorder = ZFS_HOST_BYTEORDER;
+	zp->zp_early_abort = zio_compress_early_abort_eligible(compress) &&
+	    dmu_objset_compress_probe(os);
 	bzero(zp->zp_salt, ZIO_DATA_SALT_LEN);
 	bzero(zp->zp_iv, ZIO_DATA_IV_LEN);
 	bzero(zp->zp_mac, ZIO_DATA_MAC_LEN);
@@ -2483,6 +2658,7 @@ EXPORT_SYMBOL(dmu_bonus_hold_by_dnode);
 EXPORT_SYMBOL(dmu_buf_hold_array_by_bonus);
 EXPORT_SYMBOL(dmu_buf_rele_array);
 EXPORT_SYMBOL(dmu_prefetch);
+EXPORT_SYMBOL(dmu_prefetch_dnodes);
 EXPORT_SYMBOL(dmu_free_range);
 EXPORT_SYMBOL(dmu_free_long_range);
 EXPORT_SYMBOL(dmu_free_long_object);
@@ -2519,6 +2695,9 @@ ZFS_MODULE_PARAM(zfs, zfs_, per_txg_dirty_frees_percent, UQUAD, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, dmu_offset_next_sync, UINT, ZMOD_RW,
 	"Enable forcing txg sync to find holes");
 
+ZFS_MODULE_PARAM(zfs, zfs_, special_promote_hits, UINT, ZMOD_RW,
+	"Hits in the ARC after which a read block moves to the special class");
+
 module_param(dmu_prefetch_max, int, 0644);
 MODULE_PARM_DESC(dmu_prefetch_max,
 	"Limit one prefetch call to this size");
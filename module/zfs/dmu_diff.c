@@ -277,3 +277,176 @@ dmu_diff(const char *tosnap_name, const char *fromsnap_name,
 
 	return (da.da_err);
 }
+
+typedef struct diff_blocks_arg {
+	uint64_t	dba_object;	/* only report this object, if not 0 */
+	uint64_t	*dba_extents;	/* (object, offset, length) triples */
+	uint64_t	dba_max;
+	uint64_t	dba_count;
+	boolean_t	dba_full;	/* stopped for lack of room */
+} diff_blocks_arg_t;
+
+static int
+diff_blocks_add(diff_blocks_arg_t *dba, uint64_t object, uint64_t offset,
+    uint64_t length)
+{
+	if (dba->dba_count > 0) {
+		uint64_t *last = &dba->dba_extents[3 * (dba->dba_count - 1)];
+
+		if (last[0] == object && last[1] + last[2] == offset) {
+			last[2] += length;
+			return (0);
+		}
+	}
+
+	if (dba->dba_count == dba->dba_max) {
+		dba->dba_full = B_TRUE;
+		return (SET_ERROR(ECANCELED));
+	}
+
+	uint64_t *ext = &dba->dba_extents[3 * dba->dba_count++];
+	ext[0] = object;
+	ext[1] = offset;
+	ext[2] = length;
+	return (0);
+}
+
+/* ARGSUSED */
+static int
+diff_blocks_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
+    const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg)
+{
+	diff_blocks_arg_t *dba = arg;
+
+	if (issig(JUSTLOOKING) && issig(FORREAL))
+		return (SET_ERROR(EINTR));
+
+	if (zb->zb_level == ZB_DNODE_LEVEL ||
+	    zb->zb_object == DMU_META_DNODE_OBJECT ||
+	    DMU_OBJECT_IS_SPECIAL(zb->zb_object) ||
+	    zb->zb_blkid == DMU_SPILL_BLKID || BP_IS_REDACTED(bp))
+		return (0);
+
+	if (dba->dba_object != 0 && zb->zb_object != dba->dba_object) {
+		/* Objects are visited in order, we are done. */
+		if (zb->zb_object > dba->dba_object)
+			return (SET_ERROR(ECANCELED));
+		return (0);
+	}
+
+	uint64_t datablksz = (uint64_t)dnp->dn_datablkszsec <<
+	    SPA_MINBLOCKSHIFT;
+	uint64_t end = (dnp->dn_maxblkid + 1) * datablksz;
+
+	if (BP_IS_HOLE(bp)) {
+		uint64_t span = DBP_SPAN(dnp, zb->zb_level);
+		uint64_t offset = zb->zb_blkid * span;
+
+		/* Holes past the end of the object are of no interest. */
+		if (offset >= end)
+			return (0);
+		return (diff_blocks_add(dba, zb->zb_object, offset,
+		    MIN(span, end - offset)));
+	} else if (zb->zb_level == 0) {
+		return (diff_blocks_add(dba, zb->zb_object,
+		    zb->zb_blkid * datablksz, datablksz));
+	}
+
+	return (0);
+}
+
+/*
+ * Report the byte ranges of the objects in tosnap that were written or
+ * freed since fromsnap (or all of them if fromsnap is NULL), as
+ * (object, offset, length) triples in extents.  The traversal only visits
+ * blocks born after fromsnap and reads no file data, so it takes time
+ * proportional to the amount of change.
+ *
+ * At most *nextents triples are returned and *nextents is set to the
+ * number returned.  If there may be more, *more is set and cookie[2]
+ * holds the position to pass back in to continue from; a zeroed cookie
+ * starts at the beginning.  Ranges may be reported that did not actually
+ * change (e.g. holes under a rewritten indirect block), but a range that
+ * changed is never left out.  If object is not 0, only that object is
+ * reported.
+ */
+int
+dmu_diff_blocks(const char *tosnap_name, const char *fromsnap_name,
+    uint64_t object, uint64_t *cookie, uint64_t *extents,
+    uint64_t *nextents, boolean_t *more)
+{
+	diff_blocks_arg_t dba = { 0 };
+	dsl_dataset_t *tosnap, *fromsnap;
+	zbookmark_phys_t resume = { 0 };
+	uint64_t fromtxg = 0;
+	dsl_pool_t *dp;
+	int error;
+
+	if (strchr(tosnap_name, '@') == NULL ||
+	    (fromsnap_name != NULL && strchr(fromsnap_name, '@') == NULL))
+		return (SET_ERROR(EINVAL));
+
+	error = dsl_pool_hold(tosnap_name, FTAG, &dp);
+	if (error != 0)
+		return (error);
+
+	error = dsl_dataset_hold(dp, tosnap_name, FTAG, &tosnap);
+	if (error != 0) {
+		dsl_pool_rele(dp, FTAG);
+		return (error);
+	}
+
+	if (fromsnap_name != NULL) {
+		error = dsl_dataset_hold(dp, fromsnap_name, FTAG, &fromsnap);
+		if (error != 0) {
+			dsl_dataset_rele(tosnap, FTAG);
+			dsl_pool_rele(dp, FTAG);
+			return (error);
+		}
+
+		if (!dsl_dataset_is_before(tosnap, fromsnap, 0)) {
+			dsl_dataset_rele(fromsnap, FTAG);
+			dsl_dataset_rele(tosnap, FTAG);
+			dsl_pool_rele(dp, FTAG);
+			return (SET_ERROR(EXDEV));
+		}
+
+		fromtxg = dsl_dataset_phys(fromsnap)->ds_creation_txg;
+		dsl_dataset_rele(fromsnap, FTAG);
+	}
+
+	dsl_dataset_long_hold(tosnap, FTAG);
+	dsl_pool_rele(dp, FTAG);
+
+	if (cookie[0] != 0) {
+		SET_BOOKMARK(&resume, tosnap->ds_object, cookie[0], 0,
+		    cookie[1]);
+	} else if (object != 0) {
+		SET_BOOKMARK(&resume, tosnap->ds_object, object, 0, 0);
+	}
+
+	dba.dba_object = object;
+	dba.dba_extents = extents;
+	dba.dba_max = *nextents;
+
+	/* As with dmu_diff(), only dnodes are read, no need to decrypt. */
+	error = traverse_dataset_resume(tosnap, fromtxg, &resume,
+	    TRAVERSE_PRE | TRAVERSE_PREFETCH_METADATA | TRAVERSE_NO_DECRYPT,
+	    diff_blocks_cb, &dba);
+
+	if (error == ECANCELED)
+		error = 0;
+	*nextents = dba.dba_count;
+	*more = dba.dba_full;
+	if (dba.dba_full) {
+		cookie[0] = resume.zb_object;
+		cookie[1] = resume.zb_blkid;
+	} else {
+		cookie[0] = cookie[1] = 0;
+	}
+
+	dsl_dataset_long_rele(tosnap, FTAG);
+	dsl_dataset_rele(tosnap, FTAG);
+
+	return (error);
+}
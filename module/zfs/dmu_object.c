@@ -39,8 +39,33 @@
  * grab 128 slots, which is 4 blocks worth.  This was experimentally
  * determined to be the lowest value that eliminates the measurable effect
  * of lock contention from this code path.
+ *
+ * Whenever an allocator finds another one getting a new chunk, the chunks
+ * of that objset are doubled, up to 2^dmu_object_alloc_chunk_shift_max
+ * slots, so that objsets in which files are created at very high rates
+ * go to the shared os_obj_lock less often.
  */
 int dmu_object_alloc_chunk_shift = 7;
+int dmu_object_alloc_chunk_shift_max = 10;
+
+/*
+ * The current chunk size of the objset.  It needs to be at least one
+ * block's worth, to avoid lock contention on the dbuf, and it can be at
+ * most one L1 block's worth, so that the "rescan after polishing off a
+ * L1's worth" logic in dmu_object_alloc_impl() will be sure to kick in.
+ */
+static int
+dmu_object_alloc_chunk(objset_t *os, uint64_t L1_dnode_count)
+{
+	int shift = MAX(dmu_object_alloc_chunk_shift, os->os_obj_chunk_shift);
+	uint64_t dnodes_per_chunk = 1ULL << MIN(shift, 30);
+
+	if (dnodes_per_chunk < DNODES_PER_BLOCK)
+		dnodes_per_chunk = DNODES_PER_BLOCK;
+	if (dnodes_per_chunk > L1_dnode_count)
+		dnodes_per_chunk = L1_dnode_count;
+	return (dnodes_per_chunk);
+}
 
 static uint64_t
 dmu_object_alloc_impl(objset_t *os, dmu_object_type_t ot, int blocksize,
@@ -54,7 +79,7 @@ dmu_object_alloc_impl(objset_t *os, dmu_object_type_t ot, int blocksize,
 	int dn_slots = dnodesize >> DNODE_SHIFT;
 	boolean_t restarted = B_FALSE;
 	uint64_t *cpuobj = NULL;
-	int dnodes_per_chunk = 1 << dmu_object_alloc_chunk_shift;
+	int dnodes_per_chunk = dmu_object_alloc_chunk(os, L1_dnode_count);
 	int error;
 
 	kpreempt_disable();
@@ -69,18 +94,6 @@ dmu_object_alloc_impl(objset_t *os, dmu_object_type_t ot, int blocksize,
 		ASSERT3S(dn_slots, <=, DNODE_MAX_SLOTS);
 	}
 
-	/*
-	 * The "chunk" of dnodes that is assigned to a CPU-specific
-	 * allocator needs to be at least one block's worth, to avoid
-	 * lock contention on the dbuf.  It can be at most one L1 block's
-	 * worth, so that the "rescan after polishing off a L1's worth"
-	 * logic below will be sure to kick in.
-	 */
-	if (dnodes_per_chunk < DNODES_PER_BLOCK)
-		dnodes_per_chunk = DNODES_PER_BLOCK;
-	if (dnodes_per_chunk > L1_dnode_count)
-		dnodes_per_chunk = L1_dnode_count;
-
 	/*
 	 * The caller requested the dnode be returned as a performance
 	 * optimization in order to avoid releasing the hold only to
@@ -104,9 +117,30 @@ dmu_object_alloc_impl(objset_t *os, dmu_object_type_t ot, int blocksize,
 		    (P2PHASE(object + dn_slots - 1, dnodes_per_chunk) <
 		    dn_slots)) {
 			DNODE_STAT_BUMP(dnode_alloc_next_chunk);
-			mutex_enter(&os->os_obj_lock);
-			ASSERT0(P2PHASE(os->os_obj_next_chunk,
-			    dnodes_per_chunk));
+			if (!mutex_tryenter(&os->os_obj_lock)) {
+				DNODE_STAT_BUMP(dnode_alloc_chunk_contended);
+				mutex_enter(&os->os_obj_lock);
+				if (os->os_obj_chunk_shift <
+				    dmu_object_alloc_chunk_shift_max) {
+					os->os_obj_chunk_shift = MAX(
+					    os->os_obj_chunk_shift,
+					    dmu_object_alloc_chunk_shift) + 1;
+				}
+			}
+
+			/*
+			 * The chunk size may have grown, here or on another
+			 * CPU, since we looked at it.  Chunks are aligned to
+			 * their size, so skip to the next aligned one; the
+			 * skipped objects are backfilled by a later rescan.
+			 * Other CPUs notice the new size at the end of their
+			 * current chunk, until then they may briefly share
+			 * dnode blocks, which the races below deal with.
+			 */
+			dnodes_per_chunk = dmu_object_alloc_chunk(os,
+			    L1_dnode_count);
+			os->os_obj_next_chunk = P2ROUNDUP(
+			    os->os_obj_next_chunk, dnodes_per_chunk);
 			object = os->os_obj_next_chunk;
 
 			/*
@@ -522,5 +556,8 @@ EXPORT_SYMBOL(dmu_object_free_zapified);
 /* BEGIN CSTYLED */
 ZFS_MODULE_PARAM(zfs, , dmu_object_alloc_chunk_shift, UINT, ZMOD_RW,
 	"CPU-specific allocator grabs 2^N objects at once");
+
+ZFS_MODULE_PARAM(zfs, , dmu_object_alloc_chunk_shift_max, UINT, ZMOD_RW,
+	"Max 2^N objects grabbed at once when the allocator is contended");
 /* END CSTYLED */
 #endif
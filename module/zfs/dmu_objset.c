@@ -46,6 +46,7 @@
 #include <sys/dsl_deleg.h>
 #include <sys/dnode.h>
 #include <sys/dbuf.h>
+#include <sys/dmu_zfetch.h>
 #include <sys/zvol.h>
 #include <sys/dmu_tx.h>
 #include <sys/zap.h>
@@ -84,6 +85,29 @@ int dmu_find_threads = 0;
  */
 int dmu_rescan_dnode_threshold = 1 << DN_MAX_INDBLKSHIFT;
 
+/*
+ * In adaptive early abort mode (zfs_compress_early_abort=1) an objset is
+ * probed before expensive compression when at least this percentage of
+ * its recent compressed writes ended up stored uncompressed.  The history
+ * is halved every dmu_compress_history_len writes so the heuristic follows
+ * changes in the workload.
+ */
+int dmu_compress_probe_pct = 10;
+int dmu_compress_history_len = 1024;
+
+/*
+ * The user/group/project accounting upgrade dirties every object in the
+ * objset, dmu_upgrade_batch objects to a tx.  An objset of more than
+ * DMU_UPGRADE_RANGE_MIN objects is split into ranges which are upgraded by
+ * up to dmu_upgrade_threads threads in parallel.  So that the upgrade only
+ * uses capacity the pool's own workload leaves idle, each thread pauses
+ * between batches while the pool's dirty data exceeds dmu_upgrade_dirty_pct
+ * percent of zfs_dirty_data_max.
+ */
+int dmu_upgrade_batch = 128;
+int dmu_upgrade_threads = 4;
+int dmu_upgrade_dirty_pct = 30;
+
 static char *upgrade_tag = "upgrade_tag";
 
 static void dmu_objset_find_dp_cb(void *arg);
@@ -252,7 +276,8 @@ secondary_cache_changed_cb(void *arg, uint64_t newval)
 	 * Inheritance and range checking should have been done by now.
 	 */
 	ASSERT(newval == ZFS_CACHE_ALL || newval == ZFS_CACHE_NONE ||
-	    newval == ZFS_CACHE_METADATA);
+	    newval == ZFS_CACHE_METADATA || newval == ZFS_CACHE_MFU ||
+	    newval == ZFS_CACHE_METADATA_MFU || newval == ZFS_CACHE_PREFETCH);
 
 	os->os_secondary_cache = newval;
 }
@@ -329,6 +354,38 @@ smallblk_changed_cb(void *arg, uint64_t newval)
 	os->os_zpl_special_smallblock = newval;
 }
 
+static void
+read_bw_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_iolimit[OS_IOLIMIT_BW_READ].oil_rate = newval;
+}
+
+static void
+write_bw_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_iolimit[OS_IOLIMIT_BW_WRITE].oil_rate = newval;
+}
+
+static void
+read_ops_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_iolimit[OS_IOLIMIT_OPS_READ].oil_rate = newval;
+}
+
+static void
+write_ops_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_iolimit[OS_IOLIMIT_OPS_WRITE].oil_rate = newval;
+}
+
 static void
 logbias_changed_cb(void *arg, uint64_t newval)
 {
@@ -437,8 +494,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		SET_BOOKMARK(&zb, ds ? ds->ds_object : DMU_META_OBJSET,
 		    ZB_ROOT_OBJECT, ZB_ROOT_LEVEL, ZB_ROOT_BLKID);
 
-		if (DMU_OS_IS_L2CACHEABLE(os))
-			aflags |= ARC_FLAG_L2CACHE;
+		aflags |= dmu_objset_l2cache_flags(os, B_TRUE);
 
 		if (ds != NULL && ds->ds_dir->dd_crypto_obj != 0) {
 			ASSERT3U(BP_GET_COMPRESS(bp), ==, ZIO_COMPRESS_OFF);
@@ -578,6 +634,26 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 				    ZFS_PROP_SPECIAL_SMALL_BLOCKS),
 				    smallblk_changed_cb, os);
 			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_READ_BW_LIMIT),
+				    read_bw_limit_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_WRITE_BW_LIMIT),
+				    write_bw_limit_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_READ_OPS_LIMIT),
+				    read_ops_limit_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_WRITE_OPS_LIMIT),
+				    write_ops_limit_changed_cb, os);
+			}
 		}
 		if (needlock)
 			dsl_pool_config_exit(dmu_objset_pool(os), FTAG);
@@ -621,6 +697,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	mutex_init(&os->os_userused_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_obj_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_user_ptr_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&os->os_iolimit_lock, NULL, MUTEX_DEFAULT, NULL);
 	os->os_obj_next_percpu_len = boot_ncpus;
 	os->os_obj_next_percpu = kmem_zalloc(os->os_obj_next_percpu_len *
 	    sizeof (os->os_obj_next_percpu[0]), KM_SLEEP);
@@ -639,6 +716,8 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	}
 
 	mutex_init(&os->os_upgrade_lock, NULL, MUTEX_DEFAULT, NULL);
+	dmu_zfetch_objset_init(os);
+	dbuf_stats_objset_add(os);
 
 	*osp = os;
 	return (0);
@@ -968,7 +1047,9 @@ dmu_objset_evict_done(objset_t *os)
 		dnode_special_close(&os->os_userused_dnode);
 		dnode_special_close(&os->os_groupused_dnode);
 	}
+	dbuf_stats_objset_remove(os);
 	zil_free(os->os_zil);
+	dmu_zfetch_objset_fini(os);
 
 	arc_buf_destroy(os->os_phys_buf, &os->os_phys_buf);
 
@@ -988,6 +1069,7 @@ dmu_objset_evict_done(objset_t *os)
 	mutex_destroy(&os->os_userused_lock);
 	mutex_destroy(&os->os_obj_lock);
 	mutex_destroy(&os->os_user_ptr_lock);
+	mutex_destroy(&os->os_iolimit_lock);
 	mutex_destroy(&os->os_upgrade_lock);
 	for (int i = 0; i < TXG_SIZE; i++) {
 		multilist_destroy(os->os_dirty_dnodes[i]);
@@ -1648,7 +1730,7 @@ dmu_objset_sync(objset_t *os, zio_t *pio, dmu_tx_t *tx)
 	}
 
 	zio = arc_write(pio, os->os_spa, tx->tx_txg,
-	    blkptr_copy, os->os_phys_buf, DMU_OS_IS_L2CACHEABLE(os),
+	    blkptr_copy, os->os_phys_buf, dmu_objset_l2cache_flags(os, B_TRUE),
 	    &zp, dmu_objset_write_ready, NULL, NULL, dmu_objset_write_done,
 	    os, ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_MUSTSUCCEED, &zb);
 
@@ -1737,6 +1819,31 @@ dmu_objset_is_dirty(objset_t *os, uint64_t txg)
 	return (!multilist_is_empty(os->os_dirty_dnodes[txg & TXG_MASK]));
 }
 
+/*
+ * Returns the ARC flags that carry the secondarycache property of the
+ * objset for one of its blocks, or 0 if the block is not to be cached in
+ * the L2ARC at all.
+ */
+arc_flags_t
+dmu_objset_l2cache_flags(objset_t *os, boolean_t metadata)
+{
+	switch (os->os_secondary_cache) {
+	case ZFS_CACHE_ALL:
+		return (ARC_FLAG_L2CACHE);
+	case ZFS_CACHE_METADATA:
+		return (metadata ? ARC_FLAG_L2CACHE : 0);
+	case ZFS_CACHE_MFU:
+		return (ARC_FLAG_L2CACHE | ARC_FLAG_L2_MFUONLY);
+	case ZFS_CACHE_METADATA_MFU:
+		return (metadata ? ARC_FLAG_L2CACHE :
+		    ARC_FLAG_L2CACHE | ARC_FLAG_L2_MFUONLY);
+	case ZFS_CACHE_PREFETCH:
+		return (ARC_FLAG_L2CACHE | ARC_FLAG_L2_PREFETCH);
+	default:
+		return (0);
+	}
+}
+
 static objset_used_cb_t *used_cbs[DMU_OST_NUMTYPES];
 
 void
@@ -1775,12 +1882,6 @@ typedef struct userquota_node {
 	avl_node_t	uqn_node;
 } userquota_node_t;
 
-typedef struct userquota_cache {
-	avl_tree_t uqc_user_deltas;
-	avl_tree_t uqc_group_deltas;
-	avl_tree_t uqc_project_deltas;
-} userquota_cache_t;
-
 static int
 userquota_compare(const void *l, const void *r)
 {
@@ -1798,52 +1899,79 @@ userquota_compare(const void *l, const void *r)
 }
 
 static void
-do_userquota_cacheflush(objset_t *os, userquota_cache_t *cache, dmu_tx_t *tx)
+userquota_cache_create(objset_t *os, userquota_cache_t *cache)
 {
-	void *cookie;
-	userquota_node_t *uqn;
+	avl_create(&cache->uqc_user_deltas, userquota_compare,
+	    sizeof (userquota_node_t), offsetof(userquota_node_t, uqn_node));
+	avl_create(&cache->uqc_group_deltas, userquota_compare,
+	    sizeof (userquota_node_t), offsetof(userquota_node_t, uqn_node));
+	if (dmu_objset_projectquota_enabled(os))
+		avl_create(&cache->uqc_project_deltas, userquota_compare,
+		    sizeof (userquota_node_t), offsetof(userquota_node_t,
+		    uqn_node));
+}
 
-	ASSERT(dmu_tx_is_syncing(tx));
+/*
+ * Apply the deltas of one of the trees of a userquota cache, in the order
+ * of the ids, and destroy the tree.
+ */
+static void
+do_userquota_treeflush(objset_t *os, uint64_t obj, avl_tree_t *avl,
+    dmu_tx_t *tx)
+{
+	userquota_node_t *uqn, *next;
 
-	cookie = NULL;
-	while ((uqn = avl_destroy_nodes(&cache->uqc_user_deltas,
-	    &cookie)) != NULL) {
-		/*
-		 * os_userused_lock protects against concurrent calls to
-		 * zap_increment_int().  It's needed because zap_increment_int()
-		 * is not thread-safe (i.e. not atomic).
-		 */
-		mutex_enter(&os->os_userused_lock);
-		VERIFY0(zap_increment(os, DMU_USERUSED_OBJECT,
-		    uqn->uqn_id, uqn->uqn_delta, tx));
-		mutex_exit(&os->os_userused_lock);
+	for (uqn = avl_first(avl); uqn != NULL; uqn = next) {
+		next = AVL_NEXT(avl, uqn);
+		VERIFY0(zap_increment(os, obj, uqn->uqn_id, uqn->uqn_delta,
+		    tx));
+		avl_remove(avl, uqn);
 		kmem_free(uqn, sizeof (*uqn));
 	}
-	avl_destroy(&cache->uqc_user_deltas);
+	avl_destroy(avl);
+}
 
-	cookie = NULL;
-	while ((uqn = avl_destroy_nodes(&cache->uqc_group_deltas,
-	    &cookie)) != NULL) {
-		mutex_enter(&os->os_userused_lock);
-		VERIFY0(zap_increment(os, DMU_GROUPUSED_OBJECT,
-		    uqn->uqn_id, uqn->uqn_delta, tx));
-		mutex_exit(&os->os_userused_lock);
-		kmem_free(uqn, sizeof (*uqn));
-	}
-	avl_destroy(&cache->uqc_group_deltas);
+/*
+ * Only the last userquota_updates_task() of an objset calls this, with the
+ * deltas of all of them, so each id is updated once per txg and nothing
+ * else can be changing the ZAPs.
+ */
+static void
+do_userquota_cacheflush(objset_t *os, userquota_cache_t *cache, dmu_tx_t *tx)
+{
+	ASSERT(dmu_tx_is_syncing(tx));
 
+	do_userquota_treeflush(os, DMU_USERUSED_OBJECT,
+	    &cache->uqc_user_deltas, tx);
+	do_userquota_treeflush(os, DMU_GROUPUSED_OBJECT,
+	    &cache->uqc_group_deltas, tx);
 	if (dmu_objset_projectquota_enabled(os)) {
-		cookie = NULL;
-		while ((uqn = avl_destroy_nodes(&cache->uqc_project_deltas,
-		    &cookie)) != NULL) {
-			mutex_enter(&os->os_userused_lock);
-			VERIFY0(zap_increment(os, DMU_PROJECTUSED_OBJECT,
-			    uqn->uqn_id, uqn->uqn_delta, tx));
-			mutex_exit(&os->os_userused_lock);
+		do_userquota_treeflush(os, DMU_PROJECTUSED_OBJECT,
+		    &cache->uqc_project_deltas, tx);
+	}
+}
+
+/*
+ * Move the deltas of the src tree into the dst tree, adding up those of
+ * the same id, and destroy the src tree.
+ */
+static void
+userquota_tree_merge(avl_tree_t *dst, avl_tree_t *src)
+{
+	userquota_node_t *uqn, *found;
+	void *cookie = NULL;
+	avl_index_t idx;
+
+	while ((uqn = avl_destroy_nodes(src, &cookie)) != NULL) {
+		found = avl_find(dst, uqn, &idx);
+		if (found != NULL) {
+			found->uqn_delta += uqn->uqn_delta;
 			kmem_free(uqn, sizeof (*uqn));
+		} else {
+			avl_insert(dst, uqn, idx);
 		}
-		avl_destroy(&cache->uqc_project_deltas);
 	}
+	avl_destroy(src);
 }
 
 static void
@@ -1932,20 +2060,14 @@ userquota_updates_task(void *arg)
 	dmu_tx_t *tx = uua->uua_tx;
 	dnode_t *dn;
 	userquota_cache_t cache = { { 0 } };
+	boolean_t last;
 
 	multilist_sublist_t *list =
 	    multilist_sublist_lock(os->os_synced_dnodes, uua->uua_sublist_idx);
 
 	ASSERT(multilist_sublist_head(list) == NULL ||
 	    dmu_objset_userused_enabled(os));
-	avl_create(&cache.uqc_user_deltas, userquota_compare,
-	    sizeof (userquota_node_t), offsetof(userquota_node_t, uqn_node));
-	avl_create(&cache.uqc_group_deltas, userquota_compare,
-	    sizeof (userquota_node_t), offsetof(userquota_node_t, uqn_node));
-	if (dmu_objset_projectquota_enabled(os))
-		avl_create(&cache.uqc_project_deltas, userquota_compare,
-		    sizeof (userquota_node_t), offsetof(userquota_node_t,
-		    uqn_node));
+	userquota_cache_create(os, &cache);
 
 	while ((dn = multilist_sublist_head(list)) != NULL) {
 		int flags;
@@ -1995,8 +2117,28 @@ userquota_updates_task(void *arg)
 		multilist_sublist_remove(list, dn);
 		dnode_rele(dn, os->os_synced_dnodes);
 	}
-	do_userquota_cacheflush(os, &cache, tx);
 	multilist_sublist_unlock(list);
+
+	/*
+	 * Rather than each task updating the ZAPs for the ids it has seen,
+	 * serialized by a lock, the deltas of all the tasks are merged and
+	 * the last task to finish applies them.
+	 */
+	mutex_enter(&os->os_userused_lock);
+	userquota_tree_merge(&os->os_userquota_cache.uqc_user_deltas,
+	    &cache.uqc_user_deltas);
+	userquota_tree_merge(&os->os_userquota_cache.uqc_group_deltas,
+	    &cache.uqc_group_deltas);
+	if (dmu_objset_projectquota_enabled(os)) {
+		userquota_tree_merge(&os->os_userquota_cache.uqc_project_deltas,
+		    &cache.uqc_project_deltas);
+	}
+	ASSERT3U(os->os_userquota_tasks, >, 0);
+	last = (--os->os_userquota_tasks == 0);
+	mutex_exit(&os->os_userused_lock);
+
+	if (last)
+		do_userquota_cacheflush(os, &os->os_userquota_cache, tx);
 	kmem_free(uua, sizeof (*uua));
 }
 
@@ -2038,6 +2180,18 @@ dmu_objset_do_userquota_updates(objset_t *os, dmu_tx_t *tx)
 	}
 
 	num_sublists = multilist_get_num_sublists(os->os_synced_dnodes);
+	uint_t ntasks = 0;
+	for (int i = 0; i < num_sublists; i++) {
+		if (!multilist_sublist_is_empty_idx(os->os_synced_dnodes, i))
+			ntasks++;
+	}
+	if (ntasks == 0)
+		return;
+
+	ASSERT0(os->os_userquota_tasks);
+	userquota_cache_create(os, &os->os_userquota_cache);
+	os->os_userquota_tasks = ntasks;
+
 	for (int i = 0; i < num_sublists; i++) {
 		if (multilist_sublist_is_empty_idx(os->os_synced_dnodes, i))
 			continue;
@@ -2233,51 +2387,202 @@ dmu_objset_projectquota_present(objset_t *os)
 	    OBJSET_FLAG_PROJECTQUOTA_COMPLETE);
 }
 
+#define	DMU_UPGRADE_RANGE_MIN	(1ULL << 16)
+#define	DMU_UPGRADE_PAUSE_MS	10
+
+typedef struct dmu_upgrade_arg {
+	objset_t	*ua_os;
+	kmutex_t	ua_lock;
+	kcondvar_t	ua_cv;
+	boolean_t	ua_exit;	/* interrupted, stop all ranges */
+	int		ua_pending;	/* ranges not yet finished */
+	int		ua_err;		/* first error from any range */
+} dmu_upgrade_arg_t;
+
+typedef struct dmu_upgrade_range {
+	dmu_upgrade_arg_t *ur_arg;
+	uint64_t	ur_start;	/* first object of the range */
+	uint64_t	ur_end;		/* first object past the range */
+} dmu_upgrade_range_t;
+
+static boolean_t
+dmu_objset_space_upgrade_exiting(dmu_upgrade_arg_t *ua)
+{
+	objset_t *os = ua->ua_os;
+	boolean_t exit;
+
+	mutex_enter(&os->os_upgrade_lock);
+	exit = os->os_upgrade_exit;
+	mutex_exit(&os->os_upgrade_lock);
+
+	return (exit || ua->ua_exit);
+}
+
+/*
+ * Wait while the pool's dirty data is over the upgrade's share of
+ * zfs_dirty_data_max, so that the upgrade backs off whenever the pool
+ * is busy with other writes.
+ */
+static void
+dmu_objset_space_upgrade_throttle(dmu_upgrade_arg_t *ua)
+{
+	dsl_pool_t *dp = dmu_objset_pool(ua->ua_os);
+	uint64_t limit = zfs_dirty_data_max * dmu_upgrade_dirty_pct / 100;
+
+	while (dp->dp_dirty_total > limit &&
+	    !dmu_objset_space_upgrade_exiting(ua))
+		delay(MAX(MSEC_TO_TICK(DMU_UPGRADE_PAUSE_MS), 1));
+}
+
+/*
+ * Mark every object in [start, end) dirty, so that it will be synced out
+ * and now accounted.  If this is called concurrently, or if we already
+ * did some work before crashing, that's fine, since we track each
+ * object's accounted state independently.
+ */
 static int
-dmu_objset_space_upgrade(objset_t *os)
+dmu_objset_space_upgrade_impl(dmu_upgrade_arg_t *ua, uint64_t start,
+    uint64_t end, boolean_t interruptible)
 {
-	uint64_t obj;
+	objset_t *os = ua->ua_os;
+	int batch = MAX(dmu_upgrade_batch, 1);
+	dmu_buf_t **dbs = kmem_alloc(batch * sizeof (dmu_buf_t *), KM_SLEEP);
+	uint64_t obj = start;
 	int err = 0;
 
-	/*
-	 * We simply need to mark every object dirty, so that it will be
-	 * synced out and now accounted.  If this is called
-	 * concurrently, or if we already did some work before crashing,
-	 * that's fine, since we track each object's accounted state
-	 * independently.
-	 */
+	/* dmu_object_next() returns the object after obj */
+	if (obj != 0)
+		obj--;
 
-	for (obj = 0; err == 0; err = dmu_object_next(os, &obj, FALSE, 0)) {
+	while (err == 0) {
 		dmu_tx_t *tx;
-		dmu_buf_t *db;
-		int objerr;
+		int n = 0;
 
-		mutex_enter(&os->os_upgrade_lock);
-		if (os->os_upgrade_exit)
+		if (dmu_objset_space_upgrade_exiting(ua) ||
+		    (interruptible && issig(JUSTLOOKING) && issig(FORREAL))) {
 			err = SET_ERROR(EINTR);
-		mutex_exit(&os->os_upgrade_lock);
-		if (err != 0)
-			return (err);
-
-		if (issig(JUSTLOOKING) && issig(FORREAL))
-			return (SET_ERROR(EINTR));
+			break;
+		}
 
-		objerr = dmu_bonus_hold(os, obj, FTAG, &db);
-		if (objerr != 0)
+		while (n < batch &&
+		    (err = dmu_object_next(os, &obj, B_FALSE, 0)) == 0 &&
+		    obj < end) {
+			if (dmu_bonus_hold(os, obj, FTAG, &dbs[n]) == 0)
+				n++;
+		}
+		if (err == 0 && obj >= end)
+			err = SET_ERROR(ESRCH);
+		if (n == 0)
 			continue;
+
 		tx = dmu_tx_create(os);
-		dmu_tx_hold_bonus(tx, obj);
-		objerr = dmu_tx_assign(tx, TXG_WAIT);
-		if (objerr != 0) {
-			dmu_buf_rele(db, FTAG);
+		for (int i = 0; i < n; i++)
+			dmu_tx_hold_bonus(tx, dbs[i]->db_object);
+		if (dmu_tx_assign(tx, TXG_WAIT) == 0) {
+			for (int i = 0; i < n; i++)
+				dmu_buf_will_dirty(dbs[i], tx);
+			dmu_tx_commit(tx);
+		} else {
 			dmu_tx_abort(tx);
-			continue;
 		}
-		dmu_buf_will_dirty(db, tx);
-		dmu_buf_rele(db, FTAG);
-		dmu_tx_commit(tx);
+		for (int i = 0; i < n; i++)
+			dmu_buf_rele(dbs[i], FTAG);
+
+		dmu_objset_space_upgrade_throttle(ua);
 	}
-	return (0);
+	kmem_free(dbs, batch * sizeof (dmu_buf_t *));
+
+	/* Running off the end of the range or objset is success */
+	return (err == EINTR ? err : 0);
+}
+
+static void
+dmu_objset_space_upgrade_range_cb(void *arg)
+{
+	dmu_upgrade_range_t *ur = arg;
+	dmu_upgrade_arg_t *ua = ur->ur_arg;
+	int err;
+
+	err = dmu_objset_space_upgrade_impl(ua, ur->ur_start, ur->ur_end,
+	    B_FALSE);
+
+	mutex_enter(&ua->ua_lock);
+	if (ua->ua_err == 0)
+		ua->ua_err = err;
+	if (--ua->ua_pending == 0)
+		cv_broadcast(&ua->ua_cv);
+	mutex_exit(&ua->ua_lock);
+	kmem_free(ur, sizeof (*ur));
+}
+
+static int
+dmu_objset_space_upgrade(objset_t *os)
+{
+	dnode_t *mdn = DMU_META_DNODE(os);
+	uint64_t nobjs, span;
+	dmu_upgrade_arg_t ua = { 0 };
+	taskq_t *tq;
+	int nranges;
+
+	ua.ua_os = os;
+
+	/*
+	 * Size the objset from its meta dnode, and only go parallel when
+	 * there is enough of it to be worth the threads.  The ranges start
+	 * on dnode block boundaries so that no two threads share a block,
+	 * and there are a few per thread to even out sparse objsets.
+	 */
+	nobjs = (mdn->dn_maxblkid + 1) * (mdn->dn_datablksz >> DNODE_SHIFT);
+	nranges = MIN(MAX(dmu_upgrade_threads, 1) * 4,
+	    nobjs / DMU_UPGRADE_RANGE_MIN);
+	if (dmu_upgrade_threads <= 1 || nranges <= 1)
+		return (dmu_objset_space_upgrade_impl(&ua, 0, UINT64_MAX,
+		    B_TRUE));
+
+	tq = taskq_create("z_upgrade_range", dmu_upgrade_threads, minclsyspri,
+	    dmu_upgrade_threads, INT_MAX, 0);
+	if (tq == NULL)
+		return (dmu_objset_space_upgrade_impl(&ua, 0, UINT64_MAX,
+		    B_TRUE));
+
+	mutex_init(&ua.ua_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&ua.ua_cv, NULL, CV_DEFAULT, NULL);
+	ua.ua_pending = nranges;
+
+	span = P2ROUNDUP(nobjs / nranges, DNODES_PER_BLOCK);
+	for (int i = 0; i < nranges; i++) {
+		dmu_upgrade_range_t *ur = kmem_alloc(sizeof (*ur), KM_SLEEP);
+
+		ur->ur_arg = &ua;
+		ur->ur_start = i * span;
+		ur->ur_end = (i == nranges - 1) ? UINT64_MAX : (i + 1) * span;
+		VERIFY(taskq_dispatch(tq, dmu_objset_space_upgrade_range_cb,
+		    ur, TQ_SLEEP) != TASKQID_INVALID);
+	}
+
+	/*
+	 * The ranges can't see our signals, so stop them if we're
+	 * interrupted and then wait for them to notice.
+	 */
+	mutex_enter(&ua.ua_lock);
+	while (ua.ua_pending > 0) {
+		if (cv_wait_sig(&ua.ua_cv, &ua.ua_lock) == 0 && !ua.ua_exit) {
+			ua.ua_exit = B_TRUE;
+			if (ua.ua_err == 0)
+				ua.ua_err = SET_ERROR(EINTR);
+		}
+		if (ua.ua_exit) {
+			while (ua.ua_pending > 0)
+				cv_wait(&ua.ua_cv, &ua.ua_lock);
+		}
+	}
+	mutex_exit(&ua.ua_lock);
+
+	taskq_destroy(tq);
+	cv_destroy(&ua.ua_cv);
+	mutex_destroy(&ua.ua_lock);
+
+	return (ua.ua_err);
 }
 
 int
@@ -2913,6 +3218,123 @@ dmu_fsname(const char *snapname, char *buf)
 	return (0);
 }
 
+/*
+ * Should writes to this objset test the data with a cheap compressor
+ * before running the configured (expensive) one?
+ */
+boolean_t
+dmu_objset_compress_probe(objset_t *os)
+{
+	uint64_t tries = os->os_compress_tries;
+	uint64_t fails = os->os_compress_fails;
+
+	if (zfs_compress_early_abort == 0)
+		return (B_FALSE);
+	if (zfs_compress_early_abort > 1)
+		return (B_TRUE);
+
+	/* Not enough history yet; probe until we know better. */
+	if (tries < 32)
+		return (B_TRUE);
+
+	return (fails * 100 >= tries * dmu_compress_probe_pct);
+}
+
+/*
+ * Record whether a block written with compression enabled actually ended
+ * up compressed.
+ */
+void
+dmu_objset_compress_account(objset_t *os, boolean_t compressed)
+{
+	uint64_t tries = atomic_inc_64_nv(&os->os_compress_tries);
+
+	if (!compressed)
+		atomic_inc_64(&os->os_compress_fails);
+
+	/*
+	 * Decay the history.  Concurrent updates may be lost here, which
+	 * only makes the statistics slightly less precise.
+	 */
+	if (tries >= dmu_compress_history_len) {
+		os->os_compress_tries = tries / 2;
+		os->os_compress_fails /= 2;
+	}
+}
+
+/*
+ * Takes amount from the token bucket, which is refilled at oil_rate per
+ * second and holds at most one second worth of tokens.  A request larger
+ * than the tokens available is admitted anyway and leaves the bucket in
+ * debt, so the caller does not starve behind smaller requests.  Returns
+ * the time until the debt is paid off, or 0 if the request is within the
+ * limit.  Called with os_iolimit_lock held.
+ */
+static hrtime_t
+dmu_objset_iolimit_charge(os_iolimit_t *oil, uint64_t amount, hrtime_t now)
+{
+	uint64_t rate = oil->oil_rate;
+	hrtime_t elapsed = now - oil->oil_last;
+
+	if (rate == 0)
+		return (0);
+
+	/* Limit the rate so that the arithmetic below can't overflow. */
+	rate = MIN(rate, INT64_MAX / MICROSEC);
+	amount = MIN(amount, INT64_MAX / MICROSEC);
+
+	if (elapsed >= NANOSEC || elapsed < 0) {
+		oil->oil_tokens = rate;
+		oil->oil_last = now;
+	} else {
+		uint64_t refill = NSEC2USEC(elapsed) * rate / MICROSEC;
+
+		/*
+		 * Only advance the refill time by the tokens added, so that
+		 * low rates aren't lost to rounding on frequent calls.
+		 */
+		oil->oil_tokens = MIN((int64_t)rate,
+		    oil->oil_tokens + (int64_t)refill);
+		if (oil->oil_tokens == rate)
+			oil->oil_last = now;
+		else
+			oil->oil_last += USEC2NSEC(refill * MICROSEC / rate);
+	}
+	oil->oil_tokens -= amount;
+
+	if (oil->oil_tokens >= 0)
+		return (0);
+	return (USEC2NSEC(-oil->oil_tokens * MICROSEC / rate));
+}
+
+/*
+ * Enforces the read or write bandwidth and IOPS limits of the objset by
+ * charging one operation of size bytes to its token buckets, and delaying
+ * the caller until it fits within the limits.  Only called in open
+ * context, without any locks held that the sync thread may need.
+ */
+void
+dmu_objset_iolimit(objset_t *os, boolean_t write, uint64_t size)
+{
+	os_iolimit_t *bw = &os->os_iolimit[write ?
+	    OS_IOLIMIT_BW_WRITE : OS_IOLIMIT_BW_READ];
+	os_iolimit_t *ops = &os->os_iolimit[write ?
+	    OS_IOLIMIT_OPS_WRITE : OS_IOLIMIT_OPS_READ];
+	hrtime_t now, delay;
+
+	if (bw->oil_rate == 0 && ops->oil_rate == 0)
+		return;
+
+	now = gethrtime();
+	mutex_enter(&os->os_iolimit_lock);
+	delay = MAX(dmu_objset_iolimit_charge(bw, size, now),
+	    dmu_objset_iolimit_charge(ops, 1, now));
+	mutex_exit(&os->os_iolimit_lock);
+
+	if (delay > 0)
+		zfs_sleep_until(now + delay);
+}
+
 /*
  * Call when we think we're going to write/free space in open context to track
  * the amount of dirty data in the open txg, which is also the amount
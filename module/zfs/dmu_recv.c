@@ -64,6 +64,12 @@
 
 int zfs_recv_queue_length = SPA_MAXBLOCKSIZE;
 int zfs_recv_queue_ff = 20;
+int zfs_recv_write_threads = 4;
+int zfs_recv_write_batch_size = 1024 * 1024;
+int zfs_recv_cksum_threads = 4;
+
+/* Smallest piece of a payload checksummed by one thread */
+#define	RECV_CKSUM_MIN_CHUNK	(64 * 1024)
 
 static char *dmu_recv_tag = "dmu_recv_tag";
 const char *recv_clone_name = "%recv";
@@ -85,20 +91,86 @@ struct receive_record_arg {
 	bqueue_node_t node;
 };
 
+static void receive_record_position(struct receive_record_arg *rrd,
+    uint64_t *object, uint64_t *offset);
+
+/*
+ * The records are applied by several writer threads.  Each one applies, in
+ * stream order, the records of the objects of a set of dnode blocks, so that
+ * the records of an object, and the large dnodes which may span several
+ * slots of a block, are always handled by the same writer.  The records
+ * which may touch the objects of several dnode blocks are only applied once
+ * all the writers are idle.
+ */
+struct receive_writers {
+	/*
+	 * These are used to signal to the main thread that the writers are
+	 * idle, or done, and protect the pending state of the writers.
+	 */
+	kmutex_t mutex;
+	kcondvar_t cv;
+	int done;	/* number of writers which have exited */
+
+	int err;
+	int count;
+	struct receive_writer_arg *writers;
+};
+
+/*
+ * The kstats of a receive in progress, exported as zfs/<pool>/recv-<id>:
+ * RECV_KSTAT_FIXED entries describing the input, then the bqueue kstats of
+ * the queue of each writer.  A writer which cannot keep up shows as a long
+ * enqueue wait on its queue, a stream which is not read fast enough as
+ * long dequeue waits on all of them.
+ */
+#define	RECV_KSTAT_FIXED	3
+
+typedef struct recv_kstat {
+	kstat_t			*rk_kstat;
+	kstat_named_t		*rk_data;
+	uint_t			rk_ndata;
+	char			rk_ds_name[ZFS_MAX_DATASET_NAME_LEN];
+	dmu_recv_cookie_t	*rk_drc;
+	struct receive_writers	*rk_rws;
+} recv_kstat_t;
+
+static const kstat_named_t empty_recv_kstats[RECV_KSTAT_FIXED] = {
+	{ "dataset_name",	KSTAT_DATA_STRING },
+	{ "input_bytes",	KSTAT_DATA_UINT64 },
+	{ "input_wait_ns",	KSTAT_DATA_UINT64 },
+};
+
+static uint64_t recv_kstat_id = 0;
+
 struct receive_writer_arg {
 	objset_t *os;
 	boolean_t byteswap;
 	bqueue_t q;
+	struct receive_writers *rws;
 
 	/*
-	 * These three args are used to signal to the main thread that we're
-	 * done.
+	 * The number of records queued to this writer and not yet applied,
+	 * a lower bound of the position in the stream of the oldest of them,
+	 * and the open txg when the last record was applied, along with the
+	 * position of the oldest record that may have been applied in that
+	 * txg rather than an earlier one.  Protected by the mutex of the
+	 * receive_writers.
 	 */
-	kmutex_t mutex;
-	kcondvar_t cv;
-	boolean_t done;
+	uint64_t pending;
+	uint64_t pending_object;
+	uint64_t pending_offset;
+	uint64_t pending_bytes;
+	uint64_t applied_txg;
+	uint64_t applied_object;
+	uint64_t applied_offset;
+	uint64_t applied_bytes;
+
+	/*
+	 * Consecutive DRR_WRITE records of an object, applied in a single
+	 * transaction by flush_write_batch().
+	 */
+	list_t write_batch;
 
-	int err;
 	/* A map from guid to dataset to help handle dedup'd streams. */
 	avl_tree_t *guid_to_ds_map;
 	boolean_t resumable;
@@ -525,6 +597,12 @@ recv_begin_check_feature_flags_impl(uint64_t featureflags, spa_t *spa)
 	if ((featureflags & DMU_BACKUP_FEATURE_LARGE_DNODE) &&
 	    !spa_feature_is_enabled(spa, SPA_FEATURE_LARGE_DNODE))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_ZSTD) &&
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_ZSTD_COMPRESS))
+		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_CHUNKED_COMPRESS) &&
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_CHUNKED_COMPRESS))
+		return (SET_ERROR(ENOTSUP));
 
 	/*
 	 * Receiving redacted streams requires that redacted datasets are
@@ -1164,6 +1242,42 @@ dmu_recv_begin(char *tofs, char *tosnap, dmu_replay_record_t *drr_begin,
 		}
 	}
 
+	/*
+	 * A chunk which is not the last one of a chunked send leaves the
+	 * receive resumable at its end, so the receive must be resumable.
+	 */
+	if (drc->drc_featureflags & DMU_BACKUP_FEATURE_CHUNKED) {
+		if (!resumable || drc->drc_begin_nvl == NULL ||
+		    nvlist_lookup_uint64(drc->drc_begin_nvl,
+		    BEGINNV_END_OBJECT, &drc->drc_end_object) != 0 ||
+		    drc->drc_end_object == 0) {
+			nvlist_free(drc->drc_begin_nvl);
+			kmem_free(drc->drc_next_rrd,
+			    sizeof (*drc->drc_next_rrd));
+			return (SET_ERROR(EINVAL));
+		}
+	}
+
+	/*
+	 * The payloads of WRITE records may be compressed for the stream,
+	 * with the algorithm named in the BEGIN record's payload.
+	 */
+	if (drc->drc_featureflags & DMU_BACKUP_FEATURE_STREAM_COMPRESS) {
+		uint64_t compress;
+
+		if (drc->drc_begin_nvl == NULL ||
+		    nvlist_lookup_uint64(drc->drc_begin_nvl,
+		    BEGINNV_STREAM_COMPRESS, &compress) != 0 ||
+		    compress >= ZIO_COMPRESS_FUNCTIONS ||
+		    zio_compress_table[compress].ci_decompress == NULL) {
+			nvlist_free(drc->drc_begin_nvl);
+			kmem_free(drc->drc_next_rrd,
+			    sizeof (*drc->drc_next_rrd));
+			return (SET_ERROR(EINVAL));
+		}
+		drc->drc_stream_compress = compress;
+	}
+
 	if (drc->drc_drrb->drr_flags & DRR_FLAG_SPILL_BLOCK)
 		drc->drc_spill = B_TRUE;
 
@@ -1278,6 +1392,7 @@ receive_read(dmu_recv_cookie_t *drc, int len, void *buf)
 
 	while (done < len) {
 		ssize_t resid;
+		hrtime_t start = gethrtime();
 
 #if defined(__FreeBSD__) && defined(_KERNEL)
 		drc->drc_err = restore_bytes(drc, ((char *)buf + done),
@@ -1288,6 +1403,7 @@ receive_read(dmu_recv_cookie_t *drc, int len, void *buf)
 		    drc->drc_voff, UIO_SYSSPACE, FAPPEND,
 		    RLIM64_INFINITY, CRED(), &resid);
 #endif
+		drc->drc_input_wait += gethrtime() - start;
 		if (resid == len - done) {
 			/*
 			 * Note: ECKSUM indicates that the receive
@@ -1323,7 +1439,11 @@ static void
 save_resume_state(struct receive_writer_arg *rwa,
     uint64_t object, uint64_t offset, dmu_tx_t *tx)
 {
-	int txgoff = dmu_tx_get_txg(tx) & TXG_MASK;
+	struct receive_writers *rws = rwa->rws;
+	dsl_dataset_t *ds = rwa->os->os_dsl_dataset;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	int txgoff = txg & TXG_MASK;
+	uint64_t bytes = rwa->bytes_read;
 
 	if (!rwa->resumable)
 		return;
@@ -1341,19 +1461,57 @@ save_resume_state(struct receive_writer_arg *rwa,
 	ASSERT(object != 0);
 
 	/*
-	 * For resuming to work correctly, we must receive records in order,
-	 * sorted by object,offset.  This is checked by the callers, but
-	 * assert it here for good measure.
+	 * With several writers, the records before this one are not all
+	 * applied, so we resume from the oldest record pending in any writer
+	 * instead.  All the records before it must be synced with this txg,
+	 * so for a writer which may have applied records in the next txg we
+	 * resume from the oldest of those instead.  We don't save anything
+	 * if a writer failed to apply a record, or is further ahead, which
+	 * can't happen while this tx holds its txg open.  The state saved by
+	 * a later txg will cover this one.
 	 */
-	ASSERT3U(object, >=, rwa->os->os_dsl_dataset->ds_resume_object[txgoff]);
-	ASSERT(object != rwa->os->os_dsl_dataset->ds_resume_object[txgoff] ||
-	    offset >= rwa->os->os_dsl_dataset->ds_resume_offset[txgoff]);
-	ASSERT3U(rwa->bytes_read, >=,
-	    rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff]);
-
-	rwa->os->os_dsl_dataset->ds_resume_object[txgoff] = object;
-	rwa->os->os_dsl_dataset->ds_resume_offset[txgoff] = offset;
-	rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff] = rwa->bytes_read;
+	mutex_enter(&rws->mutex);
+	for (int i = 0; i < rws->count; i++) {
+		struct receive_writer_arg *w = &rws->writers[i];
+		uint64_t wobject, woffset, wbytes;
+
+		if (w->applied_txg > txg + 1 || rws->err != 0) {
+			mutex_exit(&rws->mutex);
+			return;
+		}
+		if (w->applied_txg > txg) {
+			wobject = w->applied_object;
+			woffset = w->applied_offset;
+			wbytes = w->applied_bytes;
+		} else if (w->pending != 0) {
+			wobject = w->pending_object;
+			woffset = w->pending_offset;
+			wbytes = w->pending_bytes;
+		} else {
+			continue;
+		}
+		if (wobject < object ||
+		    (wobject == object && woffset < offset)) {
+			object = wobject;
+			offset = woffset;
+			bytes = wbytes;
+		}
+	}
+
+	/*
+	 * For resuming to work correctly, the resume point must only move
+	 * forward, sorted by object,offset.  The records of each writer are
+	 * received in order, which is checked by the callers.
+	 */
+	if (object != 0 && (object > ds->ds_resume_object[txgoff] ||
+	    (object == ds->ds_resume_object[txgoff] &&
+	    offset >= ds->ds_resume_offset[txgoff]))) {
+		ds->ds_resume_object[txgoff] = object;
+		ds->ds_resume_offset[txgoff] = offset;
+		ds->ds_resume_bytes[txgoff] = MAX(bytes,
+		    ds->ds_resume_bytes[txgoff]);
+	}
+	mutex_exit(&rws->mutex);
 }
 
 noinline static int
@@ -1726,13 +1884,154 @@ receive_freeobjects(struct receive_writer_arg *rwa,
 	return (0);
 }
 
-noinline static int
-receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
-    arc_buf_t *abuf)
+/*
+ * Called once count records of the writer, the oldest of which is oldest,
+ * have been applied, or discarded after an error.
+ */
+static void
+receive_writer_applied(struct receive_writer_arg *rwa, uint64_t count,
+    int err, struct receive_record_arg *oldest)
 {
-	int err;
+	struct receive_writers *rws = rwa->rws;
+
+	/*
+	 * Any transaction of the records was assigned to the open txg or an
+	 * earlier one.  Records applied before were all assigned to an
+	 * earlier txg if the open txg changed since, so the oldest of these
+	 * records is the oldest which may be in the open txg.
+	 */
+	uint64_t txg = dmu_objset_pool(rwa->os)->dp_tx.tx_open_txg;
+	uint64_t object, offset;
+
+	receive_record_position(oldest, &object, &offset);
+
+	mutex_enter(&rws->mutex);
+	if (err != 0 && rws->err == 0)
+		rws->err = err;
+	if (txg != rwa->applied_txg) {
+		rwa->applied_txg = txg;
+		rwa->applied_object = object;
+		rwa->applied_offset = offset;
+		rwa->applied_bytes = oldest->bytes_read;
+	}
+	ASSERT3U(rwa->pending, >=, count);
+	rwa->pending -= count;
+	if (rwa->pending == 0)
+		cv_broadcast(&rws->cv);
+	mutex_exit(&rws->mutex);
+}
+
+static int
+flush_write_batch_impl(struct receive_writer_arg *rwa)
+{
+	struct receive_record_arg *first = list_head(&rwa->write_batch);
+	struct receive_record_arg *last = list_tail(&rwa->write_batch);
+	struct drr_write *first_drrw = &first->header.drr_u.drr_write;
+	struct drr_write *last_drrw = &last->header.drr_u.drr_write;
 	dmu_tx_t *tx;
 	dnode_t *dn;
+	int err;
+
+	if (dnode_hold(rwa->os, first_drrw->drr_object, FTAG, &dn) != 0)
+		return (SET_ERROR(EINVAL));
+
+	tx = dmu_tx_create(rwa->os);
+	dmu_tx_hold_write_by_dnode(tx, dn, first_drrw->drr_offset,
+	    last_drrw->drr_offset - first_drrw->drr_offset +
+	    last_drrw->drr_logical_size);
+	err = dmu_tx_assign(tx, TXG_WAIT);
+	if (err != 0) {
+		dmu_tx_abort(tx);
+		dnode_rele(dn, FTAG);
+		return (err);
+	}
+
+	for (struct receive_record_arg *rrd = first; rrd != NULL;
+	    rrd = list_next(&rwa->write_batch, rrd)) {
+		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+		arc_buf_t *abuf = rrd->arc_buf;
+
+		if (rwa->byteswap && !arc_is_encrypted(abuf) &&
+		    arc_get_compression(abuf) == ZIO_COMPRESS_OFF) {
+			dmu_object_byteswap_t byteswap =
+			    DMU_OT_BYTESWAP(drrw->drr_type);
+			dmu_ot_byteswap[byteswap].ob_func(abuf->b_data,
+			    DRR_WRITE_PAYLOAD_SIZE(drrw));
+		}
+
+		err = dmu_assign_arcbuf_by_dnode(dn, drrw->drr_offset, abuf,
+		    tx);
+		if (err != 0)
+			break;
+		/* dmu_assign_arcbuf_by_dnode() consumed the arc_buf */
+		rrd->arc_buf = NULL;
+		rrd->payload = NULL;
+	}
+
+	if (err == 0) {
+		/*
+		 * The last record of the batch is now the oldest one which
+		 * may not be synced.
+		 *
+		 * Note: If the receive fails, we want the resume stream to
+		 * start with the same record that we last successfully
+		 * received (as opposed to the next record), so that we can
+		 * verify that we are resuming from the correct location.
+		 */
+		mutex_enter(&rwa->rws->mutex);
+		rwa->pending_object = last_drrw->drr_object;
+		rwa->pending_offset = last_drrw->drr_offset;
+		rwa->pending_bytes = last->bytes_read;
+		mutex_exit(&rwa->rws->mutex);
+		save_resume_state(rwa, last_drrw->drr_object,
+		    last_drrw->drr_offset, tx);
+	}
+	dmu_tx_commit(tx);
+	dnode_rele(dn, FTAG);
+
+	return (err);
+}
+
+/*
+ * Apply the DRR_WRITE records of the write batch in a single transaction,
+ * instead of assigning one per record, which dominates the cost of
+ * receiving small blocks.
+ */
+static int
+flush_write_batch(struct receive_writer_arg *rwa)
+{
+	struct receive_record_arg *first, *rrd;
+	uint64_t count = 1;
+	int err = 0;
+
+	if (list_is_empty(&rwa->write_batch))
+		return (0);
+
+	if (rwa->rws->err == 0)
+		err = flush_write_batch_impl(rwa);
+
+	first = list_remove_head(&rwa->write_batch);
+	while ((rrd = list_remove_head(&rwa->write_batch)) != NULL) {
+		if (rrd->arc_buf != NULL)
+			dmu_return_arcbuf(rrd->arc_buf);
+		kmem_free(rrd, sizeof (*rrd));
+		count++;
+	}
+	receive_writer_applied(rwa, count, err, first);
+	if (first->arc_buf != NULL)
+		dmu_return_arcbuf(first->arc_buf);
+	kmem_free(first, sizeof (*first));
+
+	return (err);
+}
+
+/*
+ * Check a DRR_WRITE record, and add it to the write batch.
+ */
+noinline static int
+receive_write(struct receive_writer_arg *rwa, struct receive_record_arg *rrd)
+{
+	struct drr_write *drrw = &rrd->header.drr_u.drr_write;
 
 	if (drrw->drr_offset + drrw->drr_logical_size < drrw->drr_offset ||
 	    !DMU_OT_IS_VALID(drrw->drr_type))
@@ -1756,43 +2055,10 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	if (dmu_object_info(rwa->os, drrw->drr_object, NULL) != 0)
 		return (SET_ERROR(EINVAL));
 
-	tx = dmu_tx_create(rwa->os);
-	dmu_tx_hold_write(tx, drrw->drr_object,
-	    drrw->drr_offset, drrw->drr_logical_size);
-	err = dmu_tx_assign(tx, TXG_WAIT);
-	if (err != 0) {
-		dmu_tx_abort(tx);
-		return (err);
-	}
-
-	if (rwa->byteswap && !arc_is_encrypted(abuf) &&
-	    arc_get_compression(abuf) == ZIO_COMPRESS_OFF) {
-		dmu_object_byteswap_t byteswap =
-		    DMU_OT_BYTESWAP(drrw->drr_type);
-		dmu_ot_byteswap[byteswap].ob_func(abuf->b_data,
-		    DRR_WRITE_PAYLOAD_SIZE(drrw));
-	}
-
-	/* use the bonus buf to look up the dnode in dmu_assign_arcbuf */
-	VERIFY0(dnode_hold(rwa->os, drrw->drr_object, FTAG, &dn));
-	err = dmu_assign_arcbuf_by_dnode(dn, drrw->drr_offset, abuf, tx);
-	if (err != 0) {
-		dnode_rele(dn, FTAG);
-		dmu_tx_commit(tx);
-		return (err);
-	}
-	dnode_rele(dn, FTAG);
+	list_insert_tail(&rwa->write_batch, rrd);
 
-	/*
-	 * Note: If the receive fails, we want the resume stream to start
-	 * with the same record that we last successfully received (as opposed
-	 * to the next record), so that we can verify that we are
-	 * resuming from the correct location.
-	 */
-	save_resume_state(rwa, drrw->drr_object, drrw->drr_offset, tx);
-	dmu_tx_commit(tx);
-
-	return (0);
+	/* The record is now owned by the write batch */
+	return (EAGAIN);
 }
 
 /*
@@ -2115,9 +2381,71 @@ dmu_recv_cleanup_ds(dmu_recv_cookie_t *drc)
 	}
 }
 
+struct receive_cksum_arg {
+	void		*rca_buf;
+	int		rca_len;
+	boolean_t	rca_byteswap;
+	zio_cksum_t	rca_cksum;
+};
+
+static void
+receive_cksum_func(void *arg)
+{
+	struct receive_cksum_arg *rca = arg;
+
+	if (rca->rca_byteswap)
+		fletcher_4_byteswap(rca->rca_buf, rca->rca_len, NULL,
+		    &rca->rca_cksum);
+	else
+		fletcher_4_native(rca->rca_buf, rca->rca_len, NULL,
+		    &rca->rca_cksum);
+}
+
+/*
+ * Checksumming every byte of the stream is the main work left to the thread
+ * reading it, which keeps it from feeding the writers at link speed.  So
+ * large payloads are split into chunks checksummed concurrently by the
+ * drc_cksum_tq threads and this one, and the chunk checksums are combined in
+ * order into the running checksum of the stream.
+ */
+static boolean_t
+receive_cksum_parallel(dmu_recv_cookie_t *drc, int len, void *buf)
+{
+	struct receive_cksum_arg *rca = drc->drc_cksum_args;
+	int nchunks, chunk;
+
+	if (drc->drc_cksum_tq == NULL || len < 2 * RECV_CKSUM_MIN_CHUNK ||
+	    !IS_P2ALIGNED(len, SPA_MINBLOCKSIZE))
+		return (B_FALSE);
+
+	nchunks = MIN(len / RECV_CKSUM_MIN_CHUNK, drc->drc_cksum_nargs);
+	chunk = P2ROUNDUP(len / nchunks, SPA_MINBLOCKSIZE);
+	for (int i = 0; i < nchunks; i++) {
+		rca[i].rca_buf = (char *)buf + i * chunk;
+		rca[i].rca_len = (i == nchunks - 1) ? len - i * chunk : chunk;
+		rca[i].rca_byteswap = drc->drc_byteswap;
+		if (i != 0) {
+			VERIFY3U(taskq_dispatch(drc->drc_cksum_tq,
+			    receive_cksum_func, &rca[i], TQ_SLEEP), !=,
+			    TASKQID_INVALID);
+		}
+	}
+	receive_cksum_func(&rca[0]);
+	taskq_wait(drc->drc_cksum_tq);
+
+	for (int i = 0; i < nchunks; i++)
+		fletcher_4_combine(&drc->drc_cksum, rca[i].rca_len,
+		    &rca[i].rca_cksum);
+
+	return (B_TRUE);
+}
+
 static void
 receive_cksum(dmu_recv_cookie_t *drc, int len, void *buf)
 {
+	if (receive_cksum_parallel(drc, len, buf))
+		return;
+
 	if (drc->drc_byteswap) {
 		(void) fletcher_4_incremental_byteswap(buf, len,
 		    &drc->drc_cksum);
@@ -2231,6 +2559,49 @@ receive_read_prefetch(dmu_recv_cookie_t *drc, uint64_t object, uint64_t offset,
 	}
 }
 
+/*
+ * Read the payload of a WRITE record which the sender compressed for the
+ * stream only, and decompress it into a loaned arc buf.  A payload of size
+ * zero stands for a block of zeroes.
+ */
+static int
+receive_read_stream_compressed(dmu_recv_cookie_t *drc, struct drr_write *drrw,
+    arc_buf_t **abufp)
+{
+	uint64_t csize = drrw->drr_compressed_size;
+	uint64_t lsize = drrw->drr_logical_size;
+	void *cbuf = NULL;
+	arc_buf_t *abuf;
+	int err;
+
+	if (!(drc->drc_featureflags & DMU_BACKUP_FEATURE_STREAM_COMPRESS) ||
+	    drc->drc_raw || DRR_WRITE_COMPRESSED(drrw) ||
+	    lsize > SPA_MAXBLOCKSIZE || csize >= lsize)
+		return (SET_ERROR(EINVAL));
+
+	abuf = arc_loan_buf(dmu_objset_spa(drc->drc_os),
+	    DMU_OT_IS_METADATA(drrw->drr_type), lsize);
+	if (csize != 0)
+		cbuf = zio_data_buf_alloc(csize);
+
+	err = receive_read_payload_and_next_header(drc, csize, cbuf);
+	if (err == 0 && csize == 0) {
+		bzero(abuf->b_data, lsize);
+	} else if (err == 0 && zio_decompress_data_buf(drc->drc_stream_compress,
+	    cbuf, abuf->b_data, csize, lsize) != 0) {
+		err = SET_ERROR(ECKSUM);
+	}
+
+	if (cbuf != NULL)
+		zio_data_buf_free(cbuf, csize);
+	if (err != 0) {
+		dmu_return_arcbuf(abuf);
+		return (err);
+	}
+	*abufp = abuf;
+	return (0);
+}
+
 /*
  * Read records off the stream, issuing any necessary prefetches.
  */
@@ -2280,6 +2651,16 @@ receive_read_record(dmu_recv_cookie_t *drc)
 		arc_buf_t *abuf;
 		boolean_t is_meta = DMU_OT_IS_METADATA(drrw->drr_type);
 
+		if (DRR_IS_STREAM_COMPRESSED(drrw->drr_flags)) {
+			err = receive_read_stream_compressed(drc, drrw, &abuf);
+			if (err != 0)
+				return (err);
+			drc->drc_rrd->arc_buf = abuf;
+			receive_read_prefetch(drc, drrw->drr_object,
+			    drrw->drr_offset, drrw->drr_logical_size);
+			return (0);
+		}
+
 		if (drc->drc_raw) {
 			boolean_t byteorder = ZFS_HOST_BYTEORDER ^
 			    !!DRR_IS_RAW_BYTESWAPPED(drrw->drr_flags) ^
@@ -2497,8 +2878,22 @@ dprintf_drr(struct receive_record_arg *rrd, int err)
 #endif
 }
 
+static void
+receive_free_payload(struct receive_record_arg *rrd)
+{
+	if (rrd->arc_buf != NULL) {
+		dmu_return_arcbuf(rrd->arc_buf);
+		rrd->arc_buf = NULL;
+		rrd->payload = NULL;
+	} else if (rrd->payload != NULL) {
+		kmem_free(rrd->payload, rrd->payload_size);
+		rrd->payload = NULL;
+	}
+}
+
 /*
- * Commit the records to the pool.
+ * Commit the records to the pool.  Returns EAGAIN if the record was added to
+ * the write batch, which then owns it.
  */
 static int
 receive_process_record(struct receive_writer_arg *rwa,
@@ -2508,6 +2903,28 @@ receive_process_record(struct receive_writer_arg *rwa,
 
 	/* Processing in order, therefore bytes_read should be increasing. */
 	ASSERT3U(rrd->bytes_read, >=, rwa->bytes_read);
+
+	/*
+	 * The write batch only holds consecutive writes to an object, up to
+	 * zfs_recv_write_batch_size bytes.
+	 */
+	if (!list_is_empty(&rwa->write_batch)) {
+		struct drr_write *first_drrw =
+		    &((struct receive_record_arg *)
+		    list_head(&rwa->write_batch))->header.drr_u.drr_write;
+		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+
+		if (rrd->header.drr_type != DRR_WRITE ||
+		    drrw->drr_object != first_drrw->drr_object ||
+		    drrw->drr_offset >= first_drrw->drr_offset +
+		    zfs_recv_write_batch_size) {
+			err = flush_write_batch(rwa);
+			if (err != 0) {
+				receive_free_payload(rrd);
+				return (err);
+			}
+		}
+	}
 	rwa->bytes_read = rrd->bytes_read;
 
 	switch (rrd->header.drr_type) {
@@ -2528,13 +2945,13 @@ receive_process_record(struct receive_writer_arg *rwa,
 	}
 	case DRR_WRITE:
 	{
-		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
-		err = receive_write(rwa, drrw, rrd->arc_buf);
-		/* if receive_write() is successful, it consumes the arc_buf */
-		if (err != 0)
+		err = receive_write(rwa, rrd);
+		/* if receive_write() is successful, the batch owns the rrd */
+		if (err != EAGAIN) {
 			dmu_return_arcbuf(rrd->arc_buf);
-		rrd->arc_buf = NULL;
-		rrd->payload = NULL;
+			rrd->arc_buf = NULL;
+			rrd->payload = NULL;
+		}
 		break;
 	}
 	case DRR_WRITE_BYREF:
@@ -2586,47 +3003,212 @@ receive_process_record(struct receive_writer_arg *rwa,
 		err = (SET_ERROR(EINVAL));
 	}
 
-	if (err != 0)
+	if (err != 0 && err != EAGAIN)
 		dprintf_drr(rrd, err);
 
 	return (err);
 }
 
 /*
- * dmu_recv_stream's worker thread; pull records off the queue, and then call
+ * Returns the position of the record in the stream, in which records are
+ * sorted by object and offset.
+ */
+static void
+receive_record_position(struct receive_record_arg *rrd, uint64_t *object,
+    uint64_t *offset)
+{
+	dmu_replay_record_t *drr = &rrd->header;
+
+	*object = 0;
+	*offset = 0;
+	switch (drr->drr_type) {
+	case DRR_OBJECT:
+		*object = drr->drr_u.drr_object.drr_object;
+		break;
+	case DRR_FREEOBJECTS:
+		*object = drr->drr_u.drr_freeobjects.drr_firstobj;
+		break;
+	case DRR_WRITE:
+		*object = drr->drr_u.drr_write.drr_object;
+		*offset = drr->drr_u.drr_write.drr_offset;
+		break;
+	case DRR_WRITE_BYREF:
+		*object = drr->drr_u.drr_write_byref.drr_object;
+		*offset = drr->drr_u.drr_write_byref.drr_offset;
+		break;
+	case DRR_WRITE_EMBEDDED:
+		*object = drr->drr_u.drr_write_embedded.drr_object;
+		*offset = drr->drr_u.drr_write_embedded.drr_offset;
+		break;
+	case DRR_FREE:
+		*object = drr->drr_u.drr_free.drr_object;
+		*offset = drr->drr_u.drr_free.drr_offset;
+		break;
+	case DRR_SPILL:
+		*object = drr->drr_u.drr_spill.drr_object;
+		break;
+	case DRR_OBJECT_RANGE:
+		*object = drr->drr_u.drr_object_range.drr_firstobj;
+		break;
+	case DRR_REDACT:
+		*object = drr->drr_u.drr_redact.drr_object;
+		*offset = drr->drr_u.drr_redact.drr_offset;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Returns the writer which applies the record, or -1 if the record may touch
+ * the objects of several dnode blocks and must be applied alone.  A
+ * DRR_WRITE_BYREF may reference a block of any object written before it.
+ */
+static int
+receive_record_writer(struct receive_record_arg *rrd, int count)
+{
+	uint64_t object, offset;
+
+	if (count == 1)
+		return (0);
+
+	receive_record_position(rrd, &object, &offset);
+	switch (rrd->header.drr_type) {
+	case DRR_FREEOBJECTS:
+		if (rrd->header.drr_u.drr_freeobjects.drr_numobjs >
+		    DNODES_PER_BLOCK - P2PHASE(object, DNODES_PER_BLOCK))
+			return (-1);
+		break;
+	case DRR_WRITE_BYREF:
+		return (-1);
+	default:
+		break;
+	}
+
+	return ((object >> DNODES_PER_BLOCK_SHIFT) % count);
+}
+
+static void
+receive_writer_enqueue(struct receive_writers *rws, int i,
+    struct receive_record_arg *rrd, boolean_t flush)
+{
+	struct receive_writer_arg *rwa = &rws->writers[i];
+	uint64_t size = sizeof (struct receive_record_arg) + rrd->payload_size;
+
+	mutex_enter(&rws->mutex);
+	if (rwa->pending++ == 0) {
+		receive_record_position(rrd, &rwa->pending_object,
+		    &rwa->pending_offset);
+		rwa->pending_bytes = rrd->bytes_read;
+	}
+	mutex_exit(&rws->mutex);
+
+	if (flush)
+		bqueue_enqueue_flush(&rwa->q, rrd, size);
+	else
+		bqueue_enqueue(&rwa->q, rrd, size);
+}
+
+/*
+ * Wait until the writers applied all the records queued to them.
+ */
+static void
+receive_writers_wait(struct receive_writers *rws)
+{
+	for (int i = 0; i < rws->count; i++)
+		bqueue_flush(&rws->writers[i].q);
+
+	mutex_enter(&rws->mutex);
+	for (int i = 0; i < rws->count; i++) {
+		while (rws->writers[i].pending != 0) {
+			/*
+			 * We need to use cv_wait_sig() so that any process
+			 * that may be sleeping here can still fork.
+			 */
+			(void) cv_wait_sig(&rws->cv, &rws->mutex);
+		}
+	}
+	mutex_exit(&rws->mutex);
+}
+
+/*
+ * Hand the record to the writer which applies it.
+ */
+static void
+receive_writers_dispatch(struct receive_writers *rws,
+    struct receive_record_arg *rrd)
+{
+	int i = receive_record_writer(rrd, rws->count);
+
+	if (i >= 0) {
+		receive_writer_enqueue(rws, i, rrd, B_FALSE);
+	} else {
+		receive_writers_wait(rws);
+		receive_writer_enqueue(rws, 0, rrd, B_TRUE);
+		receive_writers_wait(rws);
+	}
+}
+
+/*
+ * dmu_recv_stream's worker threads; pull records off the queue, and then call
  * receive_process_record  When we're done, signal the main thread and exit.
  */
 static void
 receive_writer_thread(void *arg)
 {
 	struct receive_writer_arg *rwa = arg;
+	struct receive_writers *rws = rwa->rws;
 	struct receive_record_arg *rrd;
 	fstrans_cookie_t cookie = spl_fstrans_mark();
+	int err;
+
+	for (;;) {
+		/*
+		 * Don't let the write batch wait for more records, which
+		 * may only come after the main thread saw this writer idle.
+		 */
+		if (!list_is_empty(&rwa->write_batch) && bqueue_empty(&rwa->q))
+			(void) flush_write_batch(rwa);
+
+		rrd = bqueue_dequeue(&rwa->q);
+		if (rrd->eos_marker)
+			break;
+
+		/*
+		 * Unless the write batch holds older records, the record we
+		 * dequeued is now the oldest pending one, which is only needed
+		 * to save the resume state.
+		 */
+		if (rwa->resumable && list_is_empty(&rwa->write_batch)) {
+			mutex_enter(&rws->mutex);
+			receive_record_position(rrd, &rwa->pending_object,
+			    &rwa->pending_offset);
+			rwa->pending_bytes = rrd->bytes_read;
+			mutex_exit(&rws->mutex);
+		}
 
-	for (rrd = bqueue_dequeue(&rwa->q); !rrd->eos_marker;
-	    rrd = bqueue_dequeue(&rwa->q)) {
 		/*
 		 * If there's an error, the main thread will stop putting things
 		 * on the queue, but we need to clear everything in it before we
 		 * can exit.
 		 */
-		if (rwa->err == 0) {
-			rwa->err = receive_process_record(rwa, rrd);
-		} else if (rrd->arc_buf != NULL) {
-			dmu_return_arcbuf(rrd->arc_buf);
-			rrd->arc_buf = NULL;
-			rrd->payload = NULL;
-		} else if (rrd->payload != NULL) {
-			kmem_free(rrd->payload, rrd->payload_size);
-			rrd->payload = NULL;
+		err = 0;
+		if (rws->err == 0) {
+			err = receive_process_record(rwa, rrd);
+			if (err == EAGAIN)
+				continue;
+		} else {
+			receive_free_payload(rrd);
 		}
+		receive_writer_applied(rwa, 1, err, rrd);
 		kmem_free(rrd, sizeof (*rrd));
 	}
 	kmem_free(rrd, sizeof (*rrd));
-	mutex_enter(&rwa->mutex);
-	rwa->done = B_TRUE;
-	cv_signal(&rwa->cv);
-	mutex_exit(&rwa->mutex);
+	(void) flush_write_batch(rwa);
+	mutex_enter(&rws->mutex);
+	rws->done++;
+	cv_broadcast(&rws->cv);
+	mutex_exit(&rws->mutex);
 	spl_fstrans_unmark(cookie);
 	thread_exit();
 }
@@ -2657,6 +3239,106 @@ resume_check(dmu_recv_cookie_t *drc, nvlist_t *begin_nvl)
 	return (0);
 }
 
+/*
+ * Records the end of a chunk as the point to resume the receive from.  This
+ * runs after the dataset sync of its txg, which writes out the resume state
+ * of the last records received.
+ */
+static void
+dmu_recv_chunk_end_sync(void *arg, dmu_tx_t *tx)
+{
+	dmu_recv_cookie_t *drc = arg;
+	objset_t *mos = dmu_tx_pool(tx)->dp_meta_objset;
+	uint64_t dsobj = drc->drc_ds->ds_object;
+	uint64_t zero = 0;
+
+	VERIFY0(zap_update(mos, dsobj, DS_FIELD_RESUME_OBJECT,
+	    8, 1, &drc->drc_end_object, tx));
+	VERIFY0(zap_update(mos, dsobj, DS_FIELD_RESUME_OFFSET,
+	    8, 1, &zero, tx));
+	VERIFY0(zap_update(mos, dsobj, DS_FIELD_RESUME_BYTES,
+	    8, 1, &drc->drc_bytes_read, tx));
+}
+
+static int
+recv_kstat_update(kstat_t *ksp, int rw)
+{
+	recv_kstat_t *rk = ksp->ks_private;
+	kstat_named_t *knp = rk->rk_data;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	knp[1].value.ui64 = rk->rk_drc->drc_bytes_read;
+	knp[2].value.ui64 = rk->rk_drc->drc_input_wait;
+	knp += RECV_KSTAT_FIXED;
+	for (int i = 0; i < rk->rk_rws->count; i++) {
+		bqueue_kstat_update(&rk->rk_rws->writers[i].q, knp);
+		knp += BQUEUE_KSTAT_COUNT;
+	}
+
+	return (0);
+}
+
+/*
+ * Export the kstats of a receive.  Failing to create the kstat is not an
+ * error.
+ */
+static recv_kstat_t *
+recv_kstat_create(dmu_recv_cookie_t *drc, struct receive_writers *rws)
+{
+	char kstat_module_name[KSTAT_STRLEN];
+	char kstat_name[KSTAT_STRLEN];
+	uint_t ndata = RECV_KSTAT_FIXED + rws->count * BQUEUE_KSTAT_COUNT;
+
+	if (snprintf(kstat_module_name, sizeof (kstat_module_name), "zfs/%s",
+	    spa_name(dmu_objset_spa(drc->drc_os))) >= KSTAT_STRLEN)
+		return (NULL);
+	(void) snprintf(kstat_name, sizeof (kstat_name), "recv-%llu",
+	    (u_longlong_t)atomic_inc_64_nv(&recv_kstat_id));
+
+	kstat_t *ksp = kstat_create(kstat_module_name, 0, kstat_name,
+	    "misc", KSTAT_TYPE_NAMED, ndata, KSTAT_FLAG_VIRTUAL);
+	if (ksp == NULL)
+		return (NULL);
+
+	recv_kstat_t *rk = kmem_zalloc(sizeof (*rk), KM_SLEEP);
+	rk->rk_data = kmem_zalloc(ndata * sizeof (kstat_named_t), KM_SLEEP);
+	rk->rk_ndata = ndata;
+	bcopy(empty_recv_kstats, rk->rk_data, sizeof (empty_recv_kstats));
+	for (int i = 0; i < rws->count; i++) {
+		char stage[KSTAT_STRLEN];
+
+		(void) snprintf(stage, sizeof (stage), "writer%d", i);
+		bqueue_kstat_init(rk->rk_data + RECV_KSTAT_FIXED +
+		    i * BQUEUE_KSTAT_COUNT, stage);
+	}
+	dsl_dataset_name(drc->drc_ds, rk->rk_ds_name);
+	KSTAT_NAMED_STR_PTR(&rk->rk_data[0]) = rk->rk_ds_name;
+	KSTAT_NAMED_STR_BUFLEN(&rk->rk_data[0]) = sizeof (rk->rk_ds_name);
+	rk->rk_drc = drc;
+	rk->rk_rws = rws;
+
+	ksp->ks_data = rk->rk_data;
+	ksp->ks_update = recv_kstat_update;
+	ksp->ks_private = rk;
+	rk->rk_kstat = ksp;
+	kstat_install(ksp);
+
+	return (rk);
+}
+
+static void
+recv_kstat_destroy(recv_kstat_t *rk)
+{
+	if (rk == NULL)
+		return;
+
+	kstat_delete(rk->rk_kstat);
+	kmem_free(rk->rk_data, rk->rk_ndata * sizeof (kstat_named_t));
+	kmem_free(rk, sizeof (*rk));
+}
+
 /*
  * Read in the stream's records, one by one, and apply them to the pool.  There
  * are two threads involved; the thread that calls this function will spin up a
@@ -2667,14 +3349,20 @@ resume_check(dmu_recv_cookie_t *drc, nvlist_t *begin_nvl)
  * thread doesn't have to wait for reads to complete, since everything it needs
  * (the indirect blocks) will be prefetched.
  *
- * NB: callers *must* call dmu_recv_end() if this succeeds.
+ * NB: callers *must* call dmu_recv_end() if this succeeds, unless this is
+ * a chunk of a chunked stream (drc_end_object != 0).  Those are left for
+ * the next chunk to resume.
  */
 int
 dmu_recv_stream(dmu_recv_cookie_t *drc, int cleanup_fd,
     uint64_t *action_handlep, offset_t *voffp)
 {
 	int err = 0;
-	struct receive_writer_arg *rwa = kmem_zalloc(sizeof (*rwa), KM_SLEEP);
+	struct receive_writers *rws = kmem_zalloc(sizeof (*rws), KM_SLEEP);
+	struct receive_writer_arg *rwa;
+	recv_kstat_t *rk;
+	avl_tree_t *guid_to_ds_map = NULL;
+	uint64_t max_object = 0;
 
 	if (dsl_dataset_is_zapified(drc->drc_ds)) {
 		uint64_t bytes;
@@ -2714,24 +3402,24 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, int cleanup_fd,
 		}
 
 		if (*action_handlep == 0) {
-			rwa->guid_to_ds_map =
+			guid_to_ds_map =
 			    kmem_alloc(sizeof (avl_tree_t), KM_SLEEP);
-			avl_create(rwa->guid_to_ds_map, guid_compare,
+			avl_create(guid_to_ds_map, guid_compare,
 			    sizeof (guid_map_entry_t),
 			    offsetof(guid_map_entry_t, avlnode));
 			err = zfs_onexit_add_cb(minor,
-			    free_guid_map_onexit, rwa->guid_to_ds_map,
+			    free_guid_map_onexit, guid_to_ds_map,
 			    action_handlep);
 			if (err != 0)
 				goto out;
 		} else {
 			err = zfs_onexit_cb_data(minor, *action_handlep,
-			    (void **)&rwa->guid_to_ds_map);
+			    (void **)&guid_to_ds_map);
 			if (err != 0)
 				goto out;
 		}
 
-		drc->drc_guid_to_ds_map = rwa->guid_to_ds_map;
+		drc->drc_guid_to_ds_map = guid_to_ds_map;
 	}
 
 	/* handle DSL encryption key payload */
@@ -2773,36 +3461,59 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, int cleanup_fd,
 			goto out;
 	}
 
-	(void) bqueue_init(&rwa->q, zfs_recv_queue_ff,
-	    MAX(zfs_recv_queue_length, 2 * zfs_max_recordsize),
-	    offsetof(struct receive_record_arg, node));
-	cv_init(&rwa->cv, NULL, CV_DEFAULT, NULL);
-	mutex_init(&rwa->mutex, NULL, MUTEX_DEFAULT, NULL);
-	rwa->os = drc->drc_os;
-	rwa->byteswap = drc->drc_byteswap;
-	rwa->resumable = drc->drc_resumable;
-	rwa->raw = drc->drc_raw;
-	rwa->spill = drc->drc_spill;
-	rwa->os->os_raw_receive = drc->drc_raw;
-
-	(void) thread_create(NULL, 0, receive_writer_thread, rwa, 0, curproc,
-	    TS_RUN, minclsyspri);
+	cv_init(&rws->cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&rws->mutex, NULL, MUTEX_DEFAULT, NULL);
+	rws->count = MAX(zfs_recv_write_threads, 1);
+	rws->writers = kmem_zalloc(rws->count * sizeof (*rwa), KM_SLEEP);
+	drc->drc_os->os_raw_receive = drc->drc_raw;
+
+	for (int i = 0; i < rws->count; i++) {
+		rwa = &rws->writers[i];
+		(void) bqueue_init(&rwa->q, zfs_recv_queue_ff,
+		    MAX(zfs_recv_queue_length / rws->count,
+		    2 * zfs_max_recordsize),
+		    offsetof(struct receive_record_arg, node));
+		rwa->rws = rws;
+		rwa->os = drc->drc_os;
+		rwa->byteswap = drc->drc_byteswap;
+		rwa->guid_to_ds_map = guid_to_ds_map;
+		rwa->resumable = drc->drc_resumable;
+		rwa->raw = drc->drc_raw;
+		rwa->spill = drc->drc_spill;
+		list_create(&rwa->write_batch,
+		    sizeof (struct receive_record_arg),
+		    offsetof(struct receive_record_arg, node.bqn_node));
+	}
+	for (int i = 0; i < rws->count; i++) {
+		(void) thread_create(NULL, 0, receive_writer_thread,
+		    &rws->writers[i], 0, curproc, TS_RUN, minclsyspri);
+	}
+	if (zfs_recv_cksum_threads > 0) {
+		int nthreads = zfs_recv_cksum_threads;
+
+		drc->drc_cksum_nargs = nthreads + 1;
+		drc->drc_cksum_args = kmem_alloc(drc->drc_cksum_nargs *
+		    sizeof (struct receive_cksum_arg), KM_SLEEP);
+		drc->drc_cksum_tq = taskq_create("recv_cksum", nthreads,
+		    minclsyspri, nthreads, INT_MAX, TASKQ_PREPOPULATE);
+	}
+	rk = recv_kstat_create(drc, rws);
 	/*
-	 * We're reading rwa->err without locks, which is safe since we are the
-	 * only reader, and the worker thread is the only writer.  It's ok if we
+	 * We're reading rws->err without locks, which is safe since we are the
+	 * only reader, and the worker threads only set it once.  It's ok if we
 	 * miss a write for an iteration or two of the loop, since the writer
-	 * thread will keep freeing records we send it until we send it an eos
-	 * marker.
+	 * threads will keep freeing records we send them until we send them
+	 * an eos marker.
 	 *
-	 * We can leave this loop in 3 ways:  First, if rwa->err is
-	 * non-zero.  In that case, the writer thread will free the rrd we just
-	 * pushed.  Second, if  we're interrupted; in that case, either it's the
-	 * first loop and drc->drc_rrd was never allocated, or it's later, and
-	 * drc->drc_rrd has been handed off to the writer thread who will free
-	 * it.  Finally, if receive_read_record fails or we're at the end of the
-	 * stream, then we free drc->drc_rrd and exit.
+	 * We can leave this loop in 3 ways:  First, if rws->err is
+	 * non-zero.  In that case, the writer threads will free the rrd we
+	 * just pushed.  Second, if  we're interrupted; in that case, either
+	 * it's the first loop and drc->drc_rrd was never allocated, or it's
+	 * later, and drc->drc_rrd has been handed off to a writer thread who
+	 * will free it.  Finally, if receive_read_record fails or we're at the
+	 * end of the stream, then we free drc->drc_rrd and exit.
 	 */
-	while (rwa->err == 0) {
+	while (rws->err == 0) {
 		if (issig(JUSTLOOKING) && issig(FORREAL)) {
 			err = SET_ERROR(EINTR);
 			break;
@@ -2820,26 +3531,42 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, int cleanup_fd,
 			break;
 		}
 
-		bqueue_enqueue(&rwa->q, drc->drc_rrd,
-		    sizeof (struct receive_record_arg) +
-		    drc->drc_rrd->payload_size);
+		receive_writers_dispatch(rws, drc->drc_rrd);
 		drc->drc_rrd = NULL;
 	}
 
 	ASSERT3P(drc->drc_rrd, ==, NULL);
-	drc->drc_rrd = kmem_zalloc(sizeof (*drc->drc_rrd), KM_SLEEP);
-	drc->drc_rrd->eos_marker = B_TRUE;
-	bqueue_enqueue_flush(&rwa->q, drc->drc_rrd, 1);
+	if (drc->drc_cksum_tq != NULL) {
+		taskq_destroy(drc->drc_cksum_tq);
+		kmem_free(drc->drc_cksum_args, drc->drc_cksum_nargs *
+		    sizeof (struct receive_cksum_arg));
+		drc->drc_cksum_tq = NULL;
+	}
+	for (int i = 0; i < rws->count; i++) {
+		struct receive_record_arg *eos;
 
-	mutex_enter(&rwa->mutex);
-	while (!rwa->done) {
+		eos = kmem_zalloc(sizeof (*eos), KM_SLEEP);
+		eos->eos_marker = B_TRUE;
+		bqueue_enqueue_flush(&rws->writers[i].q, eos, 1);
+	}
+
+	mutex_enter(&rws->mutex);
+	while (rws->done != rws->count) {
 		/*
 		 * We need to use cv_wait_sig() so that any process that may
 		 * be sleeping here can still fork.
 		 */
-		(void) cv_wait_sig(&rwa->cv, &rwa->mutex);
+		(void) cv_wait_sig(&rws->cv, &rws->mutex);
+	}
+	mutex_exit(&rws->mutex);
+	recv_kstat_destroy(rk);
+
+	for (int i = 0; i < rws->count; i++) {
+		rwa = &rws->writers[i];
+		max_object = MAX(max_object, rwa->max_object);
+		bqueue_destroy(&rwa->q);
+		list_destroy(&rwa->write_batch);
 	}
-	mutex_exit(&rwa->mutex);
 
 	/*
 	 * If we are receiving a full stream as a clone, all object IDs which
@@ -2847,16 +3574,16 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, int cleanup_fd,
 	 * by definition unused and must be freed.
 	 */
 	if (drc->drc_clone && drc->drc_drrb->drr_fromguid == 0) {
-		uint64_t obj = rwa->max_object + 1;
+		uint64_t obj = max_object + 1;
 		int free_err = 0;
 		int next_err = 0;
 
 		while (next_err == 0) {
-			free_err = dmu_free_long_object(rwa->os, obj);
+			free_err = dmu_free_long_object(drc->drc_os, obj);
 			if (free_err != 0 && free_err != ENOENT)
 				break;
 
-			next_err = dmu_object_next(rwa->os, &obj, FALSE, 0);
+			next_err = dmu_object_next(drc->drc_os, &obj, FALSE, 0);
 		}
 
 		if (err == 0) {
@@ -2867,11 +3594,17 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, int cleanup_fd,
 		}
 	}
 
-	cv_destroy(&rwa->cv);
-	mutex_destroy(&rwa->mutex);
-	bqueue_destroy(&rwa->q);
+	cv_destroy(&rws->cv);
+	mutex_destroy(&rws->mutex);
+	kmem_free(rws->writers, rws->count * sizeof (*rwa));
 	if (err == 0)
-		err = rwa->err;
+		err = rws->err;
+
+	if (err == 0 && drc->drc_end_object != 0) {
+		err = dsl_sync_task(spa_name(dmu_objset_spa(drc->drc_os)),
+		    NULL, dmu_recv_chunk_end_sync, drc, 1,
+		    ZFS_SPACE_CHECK_NONE);
+	}
 
 out:
 	/*
@@ -2882,7 +3615,7 @@ out:
 	if (drc->drc_next_rrd != NULL)
 		kmem_free(drc->drc_next_rrd, sizeof (*drc->drc_next_rrd));
 
-	kmem_free(rwa, sizeof (*rwa));
+	kmem_free(rws, sizeof (*rws));
 	nvlist_free(drc->drc_begin_nvl);
 	if ((drc->drc_featureflags & DMU_BACKUP_FEATURE_DEDUP) &&
 	    (cleanup_fd != -1))
@@ -2896,6 +3629,10 @@ out:
 		 */
 		dmu_recv_cleanup_ds(drc);
 		nvlist_free(drc->drc_keynvl);
+	} else if (drc->drc_end_object != 0) {
+		/* Leave the dataset to be resumed by the next chunk */
+		dmu_recv_cleanup_ds(drc);
+		nvlist_free(drc->drc_keynvl);
 	}
 
 	objlist_destroy(drc->drc_ignore_objlist);
@@ -3241,4 +3978,16 @@ MODULE_PARM_DESC(zfs_recv_queue_length, "Maximum receive queue length");
 
 module_param(zfs_recv_queue_ff, int, 0644);
 MODULE_PARM_DESC(zfs_recv_queue_ff, "Receive queue fill fraction");
+
+module_param(zfs_recv_write_threads, int, 0644);
+MODULE_PARM_DESC(zfs_recv_write_threads,
+	"Number of threads applying the records of a receive");
+
+module_param(zfs_recv_cksum_threads, int, 0644);
+MODULE_PARM_DESC(zfs_recv_cksum_threads,
+	"Number of threads checksumming large records of a receive");
+
+module_param(zfs_recv_write_batch_size, int, 0644);
+MODULE_PARM_DESC(zfs_recv_write_batch_size,
+	"Maximum amount of writes to batch into one transaction");
 #endif
@@ -67,6 +67,21 @@ int zfs_redact_queue_length = 1024 * 1024;
  */
 uint64_t zfs_redact_queue_ff = 20;
 
+/*
+ * The number of threads that traverse each redaction snapshot.  Each of them
+ * covers a range of the snapshot's objects, and the merge reads their
+ * records range by range as they come, so the traversals of a large dataset
+ * overlap rather than running one after the other.  Each of these threads
+ * has its own queue of zfs_redact_queue_length.
+ */
+int zfs_redact_traverse_stripes = 4;
+
+/*
+ * Datasets with fewer objects than this per stripe are traversed by fewer
+ * threads.
+ */
+#define	REDACT_STRIPE_MIN_OBJECTS	(1ULL << 14)
+
 struct redact_record {
 	bqueue_node_t		ln;
 	boolean_t		eos_marker; /* Marks the end of the stream */
@@ -89,6 +104,9 @@ struct redact_thread_arg {
 	uint64_t	*num_blocks_visited;
 	uint64_t	ignore_object;	/* ignore further callbacks on this */
 	uint64_t	txg; /* txg to traverse since */
+	uint64_t	first_object;	/* range of objects to traverse */
+	uint64_t	last_object;
+	struct redact_thread_arg *next;	/* next range of the same snapshot */
 };
 
 /*
@@ -265,6 +283,11 @@ redact_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	if (rta->ignore_object == zb->zb_object)
 		return (0);
 
+	/* The thread for the next range of objects takes it from here. */
+	if (zb->zb_object != DMU_META_DNODE_OBJECT &&
+	    zb->zb_object > rta->last_object)
+		return (SET_ERROR(EINTR));
+
 	/*
 	 * If we're visiting a dnode, we need to handle the case where the
 	 * object has been deleted.
@@ -334,6 +357,22 @@ redact_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 			    1) * ((SPA_MINBLOCKSIZE * dnp->dn_datablkszsec) /
 			    sizeof (dnode_phys_t))) - 1;
 			record->end_blkid = UINT64_MAX;
+
+			/* Only report the objects in our range. */
+			if (record->end_object < rta->first_object) {
+				kmem_free(record, sizeof (*record));
+				return (0);
+			}
+			if (record->start_object > rta->last_object) {
+				kmem_free(record, sizeof (*record));
+				return (SET_ERROR(EINTR));
+			}
+			if (record->start_object < rta->first_object) {
+				record->start_object = rta->first_object;
+				record->start_blkid = 0;
+			}
+			if (record->end_object > rta->last_object)
+				record->end_object = rta->last_object;
 		}
 	} else if (zb->zb_level != 0 ||
 	    zb->zb_object == DMU_META_DNODE_OBJECT) {
@@ -488,6 +527,25 @@ get_next_redact_record(bqueue_t *bq, struct redact_record *prev)
 	return (next);
 }
 
+/*
+ * When the thread for one range of a snapshot's objects is done, carry on
+ * with the records of the next range, so that the merge sees a single stream
+ * of records for each snapshot.  If the thread failed, stop at its end of
+ * stream record so that the error is noticed.
+ */
+static void
+redact_node_next_range(struct redact_node *redact_node)
+{
+	struct redact_thread_arg *rta = redact_node->rt_arg;
+
+	while (redact_node->record->eos_marker && rta->error_code == 0 &&
+	    rta->next != NULL) {
+		kmem_free(redact_node->record, sizeof (struct redact_record));
+		rta = redact_node->rt_arg = rta->next;
+		redact_node->record = bqueue_dequeue(&rta->q);
+	}
+}
+
 /*
  * Remove the given redaction node from both trees, pull a new redaction record
  * off the queue, free the old redaction record, update the redaction node, and
@@ -501,6 +559,7 @@ update_avl_trees(avl_tree_t *start_tree, avl_tree_t *end_tree,
 	avl_remove(end_tree, redact_node);
 	redact_node->record = get_next_redact_record(&redact_node->rt_arg->q,
 	    redact_node->record);
+	redact_node_next_range(redact_node);
 	avl_add(end_tree, redact_node);
 	avl_add(start_tree, redact_node);
 	return (redact_node->rt_arg->error_code);
@@ -765,6 +824,7 @@ perform_thread_merge(bqueue_t *q, uint32_t num_threads,
 		node->record = bqueue_dequeue(&targ->q);
 		node->rt_arg = targ;
 		node->thread_num = i;
+		redact_node_next_range(node);
 		avl_add(&start_tree, node);
 		avl_add(&end_tree, node);
 	}
@@ -808,11 +868,24 @@ perform_thread_merge(bqueue_t *q, uint32_t num_threads,
 	 */
 	for (int i = 0; i < num_threads; i++) {
 		if (err != 0) {
-			thread_args[i].cancel = B_TRUE;
+			struct redact_thread_arg *rta;
+			for (rta = &thread_args[i]; rta != NULL;
+			    rta = rta->next)
+				rta->cancel = B_TRUE;
 			while (!redact_nodes[i].record->eos_marker) {
 				(void) update_avl_trees(&start_tree, &end_tree,
 				    &redact_nodes[i]);
 			}
+			/* Ranges after one that failed were never read. */
+			for (rta = redact_nodes[i].rt_arg->next; rta != NULL;
+			    rta = rta->next) {
+				record = bqueue_dequeue(&rta->q);
+				while (!record->eos_marker) {
+					kmem_free(record, sizeof (*record));
+					record = bqueue_dequeue(&rta->q);
+				}
+				kmem_free(record, sizeof (*record));
+			}
 		}
 		avl_remove(&start_tree, &redact_nodes[i]);
 		avl_remove(&end_tree, &redact_nodes[i]);
@@ -1008,6 +1081,7 @@ dmu_redact_snap(const char *snapname, nvlist_t *redactnvl,
 	int numsnaps = 0;
 	dsl_dataset_t **redactsnaparr = NULL;
 	struct redact_thread_arg *args = NULL;
+	int stripes = MAX(zfs_redact_traverse_stripes, 1);
 	redaction_list_t *new_rl = NULL;
 
 	if ((err = dsl_pool_hold(snapname, FTAG, &dp)) != 0)
@@ -1099,7 +1173,8 @@ dmu_redact_snap(const char *snapname, nvlist_t *redactnvl,
 			}
 		}
 		if (numsnaps > 0)
-			args = kmem_zalloc(numsnaps * sizeof (*args), KM_SLEEP);
+			args = kmem_zalloc(numsnaps * stripes *
+			    sizeof (*args), KM_SLEEP);
 		if (new_rl->rl_phys->rlp_last_blkid == UINT64_MAX &&
 		    new_rl->rl_phys->rlp_last_object == UINT64_MAX) {
 			err = EEXIST;
@@ -1112,7 +1187,8 @@ dmu_redact_snap(const char *snapname, nvlist_t *redactnvl,
 		if (numsnaps > 0) {
 			guids = kmem_zalloc(numsnaps * sizeof (uint64_t),
 			    KM_SLEEP);
-			args = kmem_zalloc(numsnaps * sizeof (*args), KM_SLEEP);
+			args = kmem_zalloc(numsnaps * stripes *
+			    sizeof (*args), KM_SLEEP);
 		}
 		for (int i = 0; i < numsnaps; i++)
 			guids[i] = dsl_dataset_phys(redactsnaparr[i])->ds_guid;
@@ -1127,20 +1203,50 @@ dmu_redact_snap(const char *snapname, nvlist_t *redactnvl,
 		}
 	}
 
+	/*
+	 * Start the threads for each range of each snapshot's objects.  The
+	 * first numsnaps entries of args are for the first range of each
+	 * snapshot, which is what the merge thread starts with.
+	 */
+	uint64_t first_object = 0;
+	if (resuming)
+		first_object = new_rl->rl_phys->rlp_last_object;
 	for (int i = 0; i < numsnaps; i++) {
-		args[i].ds = redactsnaparr[i];
-		(void) bqueue_init(&args[i].q, zfs_redact_queue_ff,
-		    zfs_redact_queue_length,
-		    offsetof(struct redact_record, ln));
-		if (resuming) {
-			args[i].resume.zb_blkid =
-			    new_rl->rl_phys->rlp_last_blkid;
-			args[i].resume.zb_object =
-			    new_rl->rl_phys->rlp_last_object;
+		objset_t *ros;
+		VERIFY0(dmu_objset_from_ds(redactsnaparr[i], &ros));
+		uint64_t nobjs = (DMU_META_DNODE(ros)->dn_maxblkid + 1) <<
+		    DNODES_PER_BLOCK_SHIFT;
+		uint64_t stripe = P2ROUNDUP(MAX((nobjs - MIN(first_object,
+		    nobjs)) / stripes, REDACT_STRIPE_MIN_OBJECTS),
+		    DNODES_PER_BLOCK);
+		uint64_t object = first_object;
+
+		for (int s = 0; s < stripes; s++) {
+			struct redact_thread_arg *rta = &args[s * numsnaps + i];
+
+			rta->ds = redactsnaparr[i];
+			(void) bqueue_init(&rta->q, zfs_redact_queue_ff,
+			    zfs_redact_queue_length,
+			    offsetof(struct redact_record, ln));
+			rta->txg = dsl_dataset_phys(ds)->ds_creation_txg;
+			rta->first_object = object;
+			rta->resume.zb_object = object;
+			if (s == 0 && resuming) {
+				rta->resume.zb_blkid =
+				    new_rl->rl_phys->rlp_last_blkid;
+			}
+			if (s == stripes - 1 || object + stripe >= nobjs) {
+				rta->last_object = UINT64_MAX;
+			} else {
+				object += stripe;
+				rta->last_object = object - 1;
+				rta->next = &args[(s + 1) * numsnaps + i];
+			}
+			(void) thread_create(NULL, 0, redact_traverse_thread,
+			    rta, 0, curproc, TS_RUN, minclsyspri);
+			if (rta->next == NULL)
+				break;
 		}
-		args[i].txg = dsl_dataset_phys(ds)->ds_creation_txg;
-		(void) thread_create(NULL, 0, redact_traverse_thread, &args[i],
-		    0, curproc, TS_RUN, minclsyspri);
 	}
 	struct redact_merge_thread_arg rmta = { { {0} } };
 	(void) bqueue_init(&rmta.q, zfs_redact_queue_ff,
@@ -1153,7 +1259,7 @@ dmu_redact_snap(const char *snapname, nvlist_t *redactnvl,
 	err = perform_redaction(os, new_rl, &rmta);
 out:
 	if (args != NULL) {
-		kmem_free(args, numsnaps * sizeof (*args));
+		kmem_free(args, numsnaps * stripes * sizeof (*args));
 	}
 	if (new_rl != NULL) {
 		dsl_redaction_list_long_rele(new_rl, FTAG);
@@ -107,6 +107,22 @@ int zfs_send_set_freerecords_bit = B_TRUE;
 /* Set this tunable to FALSE is disable sending unmodified spill blocks. */
 int zfs_send_unmodified_spill_blocks = B_TRUE;
 
+/*
+ * Number of threads which read and compress the payloads of WRITE records
+ * ahead of the main thread when the stream itself is compressed.
+ */
+int zfs_send_compress_threads = 4;
+
+/*
+ * Bytes of a full send whose prefetches are issued at once, sorted by their
+ * location on disk, instead of in the logical order of the stream.  This
+ * turns the reads of a fragmented dataset into mostly sequential I/O.  The
+ * records are held back until the window is full, so setting this larger
+ * than zfs_send_queue_length may starve the main thread.  Zero disables the
+ * sorting.
+ */
+int zfs_send_prefetch_sort_window = 8 * 1024 * 1024;
+
 static inline boolean_t
 overflow_multiply(uint64_t a, uint64_t b, uint64_t *c)
 {
@@ -180,6 +196,26 @@ struct send_merge_thread_arg {
 	boolean_t			bookmark_before;
 };
 
+/*
+ * The payload of a WRITE record which is read and compressed for the stream
+ * by the compress taskq, while the main thread is still busy with earlier
+ * records.
+ */
+typedef struct send_compress {
+	kmutex_t		sc_lock;
+	kcondvar_t		sc_cv;
+	boolean_t		sc_done;
+	int			sc_err;
+	spa_t			*sc_spa;
+	zbookmark_phys_t	sc_zb;
+	const blkptr_t		*sc_bp;
+	enum zio_compress	sc_compress;
+	uint64_t		sc_lsize;
+	arc_buf_t		*sc_abuf;	/* the block's data */
+	void			*sc_cbuf;	/* compressed, if smaller */
+	uint64_t		sc_csize;
+} send_compress_t;
+
 struct send_range {
 	boolean_t		eos_marker; /* Marks the end of the stream */
 	uint64_t		object;
@@ -193,6 +229,8 @@ struct send_range {
 			dmu_object_type_t	obj_type;
 			uint32_t		datablksz;
 			blkptr_t		bp;
+			send_compress_t		*sc;
+			avl_node_t		sort_node;
 		} data;
 		struct srh {
 			uint32_t		datablksz;
@@ -246,10 +284,79 @@ typedef struct dmu_send_cookie {
 	uint64_t dsc_resume_offset;
 	boolean_t dsc_sent_begin;
 	boolean_t dsc_sent_end;
+	hrtime_t dsc_output_wait;	/* time spent in dso_outfunc */
 } dmu_send_cookie_t;
 
+/*
+ * The stages of the send pipeline, named after the thread which fills
+ * the queue the stage's kstats describe.
+ */
+typedef enum send_stage {
+	SEND_STAGE_TRAVERSE,
+	SEND_STAGE_FROM,
+	SEND_STAGE_REDACT,
+	SEND_STAGE_MERGE,
+	SEND_STAGE_PREFETCH,
+	SEND_STAGES
+} send_stage_t;
+
+static const char *send_stage_names[SEND_STAGES] = {
+	"traverse", "from", "redact", "merge", "prefetch"
+};
+
+typedef struct send_kstat_values {
+	kstat_named_t	skv_ds_name;
+	kstat_named_t	skv_output_bytes;
+	kstat_named_t	skv_output_wait_ns;
+	kstat_named_t	skv_queues[SEND_STAGES][BQUEUE_KSTAT_COUNT];
+} send_kstat_values_t;
+
+static send_kstat_values_t empty_send_kstats = {
+	{ "dataset_name",	KSTAT_DATA_STRING },
+	{ "output_bytes",	KSTAT_DATA_UINT64 },
+	{ "output_wait_ns",	KSTAT_DATA_UINT64 },
+};
+
+/*
+ * The kstats of a send in progress, exported as zfs/<pool>/send-<id>.
+ * A stage which cannot keep up shows as a long enqueue wait of the stage
+ * feeding it, one which is starved as a long dequeue wait on its queue.
+ */
+typedef struct send_kstat {
+	kstat_t			*sk_kstat;
+	send_kstat_values_t	sk_values;
+	char			sk_ds_name[ZFS_MAX_DATASET_NAME_LEN];
+	bqueue_t		*sk_queues[SEND_STAGES];
+	dmu_send_cookie_t	*sk_dsc;
+} send_kstat_t;
+
+static uint64_t send_kstat_id = 0;
+
 static int do_dump(dmu_send_cookie_t *dscp, struct send_range *range);
 
+static int
+send_compress_wait(send_compress_t *sc)
+{
+	mutex_enter(&sc->sc_lock);
+	while (!sc->sc_done)
+		cv_wait(&sc->sc_cv, &sc->sc_lock);
+	mutex_exit(&sc->sc_lock);
+	return (sc->sc_err);
+}
+
+static void
+send_compress_free(send_compress_t *sc)
+{
+	(void) send_compress_wait(sc);
+	if (sc->sc_abuf != NULL)
+		arc_buf_destroy(sc->sc_abuf, &sc->sc_abuf);
+	if (sc->sc_cbuf != NULL)
+		zio_data_buf_free(sc->sc_cbuf, sc->sc_lsize);
+	mutex_destroy(&sc->sc_lock);
+	cv_destroy(&sc->sc_cv);
+	kmem_free(sc, sizeof (*sc));
+}
+
 static void
 range_free(struct send_range *range)
 {
@@ -257,6 +364,8 @@ range_free(struct send_range *range)
 		size_t size = sizeof (dnode_phys_t) *
 		    (range->sru.object.dnp->dn_extra_slots + 1);
 		kmem_free(range->sru.object.dnp, size);
+	} else if (range->type == DATA && range->sru.data.sc != NULL) {
+		send_compress_free(range->sru.data.sc);
 	}
 	kmem_free(range, sizeof (*range));
 }
@@ -289,8 +398,10 @@ dump_record(dmu_send_cookie_t *dscp, void *payload, int payload_len)
 	    drr_u.drr_checksum.drr_checksum,
 	    sizeof (zio_cksum_t), &dscp->dsc_zc);
 	*dscp->dsc_off += sizeof (dmu_replay_record_t);
+	hrtime_t start = gethrtime();
 	dscp->dsc_err = dso->dso_outfunc(dscp->dsc_os, dscp->dsc_drr,
 	    sizeof (dmu_replay_record_t), dso->dso_arg);
+	dscp->dsc_output_wait += gethrtime() - start;
 	if (dscp->dsc_err != 0)
 		return (SET_ERROR(EINTR));
 	if (payload_len != 0) {
@@ -318,8 +429,10 @@ dump_record(dmu_send_cookie_t *dscp, void *payload, int payload_len)
 		ASSERT((payload_len % 8 == 0) ||
 		    (dscp->dsc_featureflags & DMU_BACKUP_FEATURE_RAW));
 
+		start = gethrtime();
 		dscp->dsc_err = dso->dso_outfunc(dscp->dsc_os, payload,
 		    payload_len, dso->dso_arg);
+		dscp->dsc_output_wait += gethrtime() - start;
 		if (dscp->dsc_err != 0)
 			return (SET_ERROR(EINTR));
 	}
@@ -461,9 +574,14 @@ dump_redact(dmu_send_cookie_t *dscp, uint64_t object, uint64_t offset,
 	return (0);
 }
 
+/*
+ * If stream_compressed is set, data is the block compressed for the stream
+ * alone, and psize is its compressed size.
+ */
 static int
 dmu_dump_write(dmu_send_cookie_t *dscp, dmu_object_type_t type, uint64_t object,
-    uint64_t offset, int lsize, int psize, const blkptr_t *bp, void *data)
+    uint64_t offset, int lsize, int psize, const blkptr_t *bp, void *data,
+    boolean_t stream_compressed)
 {
 	uint64_t payload_size;
 	boolean_t raw = (dscp->dsc_featureflags & DMU_BACKUP_FEATURE_RAW);
@@ -500,7 +618,16 @@ dmu_dump_write(dmu_send_cookie_t *dscp, dmu_object_type_t type, uint64_t object,
 	drrw->drr_logical_size = lsize;
 
 	/* only set the compression fields if the buf is compressed or raw */
-	if (raw || lsize != psize) {
+	if (stream_compressed) {
+		ASSERT(dscp->dsc_featureflags &
+		    DMU_BACKUP_FEATURE_STREAM_COMPRESS);
+		ASSERT(!raw);
+		ASSERT3S(lsize, >, psize);
+
+		drrw->drr_flags |= DRR_STREAM_COMPRESSED;
+		drrw->drr_compressed_size = psize;
+		payload_size = drrw->drr_compressed_size;
+	} else if (raw || lsize != psize) {
 		ASSERT(raw || dscp->dsc_featureflags &
 		    DMU_BACKUP_FEATURE_COMPRESSED);
 		ASSERT(!BP_IS_EMBEDDED(bp));
@@ -877,6 +1004,14 @@ send_do_embed(dmu_send_cookie_t *dscp, const blkptr_t *bp)
 	    !(dscp->dsc_featureflags & DMU_BACKUP_FEATURE_LZ4)))
 		return (B_FALSE);
 
+	if (ZIO_COMPRESS_IS_ZSTD(BP_GET_COMPRESS(bp)) &&
+	    !(dscp->dsc_featureflags & DMU_BACKUP_FEATURE_ZSTD))
+		return (B_FALSE);
+
+	if (ZIO_COMPRESS_IS_CHUNKED(BP_GET_COMPRESS(bp)) &&
+	    !(dscp->dsc_featureflags & DMU_BACKUP_FEATURE_CHUNKED_COMPRESS))
+		return (B_FALSE);
+
 	/*
 	 * Embed type must be explicitly enabled.
 	 */
@@ -970,6 +1105,23 @@ do_dump(dmu_send_cookie_t *dscp, struct send_range *range)
 		    (range->object == dscp->dsc_resume_object &&
 		    range->start_blkid * srdp->datablksz >=
 		    dscp->dsc_resume_offset));
+
+		/*
+		 * The block may already have been read, and compressed for
+		 * the stream, by the compress taskq.  If that failed, it is
+		 * read again below, where read errors are handled.
+		 */
+		if (srdp->sc != NULL && send_compress_wait(srdp->sc) == 0) {
+			send_compress_t *sc = srdp->sc;
+			boolean_t compressed = (sc->sc_cbuf != NULL);
+
+			return (dmu_dump_write(dscp, srdp->obj_type,
+			    range->object, range->start_blkid * srdp->datablksz,
+			    srdp->datablksz, compressed ? sc->sc_csize :
+			    srdp->datablksz, bp, compressed ? sc->sc_cbuf :
+			    sc->sc_abuf->b_data, compressed));
+		}
+
 		/* it's a level-0 block of a regular object */
 		arc_flags_t aflags = ARC_FLAG_WAIT;
 		arc_buf_t *abuf = NULL;
@@ -1054,7 +1206,8 @@ do_dump(dmu_send_cookie_t *dscp, struct send_range *range)
 				int n = MIN(srdp->datablksz,
 				    SPA_OLD_MAXBLOCKSIZE);
 				err = dmu_dump_write(dscp, srdp->obj_type,
-				    range->object, offset, n, n, NULL, buf);
+				    range->object, offset, n, n, NULL, buf,
+				    B_FALSE);
 				offset += n;
 				buf += n;
 				srdp->datablksz -= n;
@@ -1075,7 +1228,7 @@ do_dump(dmu_send_cookie_t *dscp, struct send_range *range)
 			err = dmu_dump_write(dscp, srdp->obj_type,
 			    range->object,
 			    offset, srdp->datablksz, psize, bp,
-			    (abuf == NULL ? NULL : abuf->b_data));
+			    (abuf == NULL ? NULL : abuf->b_data), B_FALSE);
 		}
 		if (abuf != NULL)
 			arc_buf_destroy(abuf, &abuf);
@@ -1123,6 +1276,8 @@ range_alloc(enum type type, uint64_t object, uint64_t start_blkid,
 	range->start_blkid = start_blkid;
 	range->end_blkid = end_blkid;
 	range->eos_marker = eos;
+	if (type == DATA)
+		range->sru.data.sc = NULL;
 	return (range);
 }
 
@@ -1639,13 +1794,203 @@ struct send_prefetch_thread_arg {
 	boolean_t cancel;
 	boolean_t issue_prefetches;
 	int error;
+	uint64_t featureflags;
+	enum zio_compress stream_compress;
+	taskq_t *compress_tq;	/* NULL unless the stream is compressed */
+
+	/*
+	 * The ranges held back until their prefetches are issued, when
+	 * sort_window is not zero: in the order of the stream, and the DATA
+	 * ones by the address of their block.  See send_prefetch_enqueue().
+	 */
+	uint64_t sort_window;
+	uint64_t window_size;
+	list_t window;
+	avl_tree_t window_by_addr;
 };
 
+static void
+send_compress_func(void *arg)
+{
+	send_compress_t *sc = arg;
+	arc_flags_t aflags = ARC_FLAG_WAIT;
+	int err;
+
+	err = arc_read(NULL, sc->sc_spa, sc->sc_bp, arc_getbuf_func,
+	    &sc->sc_abuf, ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL, &aflags,
+	    &sc->sc_zb);
+	if (err == 0) {
+		ASSERT3U(arc_buf_size(sc->sc_abuf), ==, sc->sc_lsize);
+		abd_t *abd = abd_get_from_buf(sc->sc_abuf->b_data,
+		    sc->sc_lsize);
+		void *cbuf = zio_data_buf_alloc(sc->sc_lsize);
+		size_t csize = zio_compress_data(sc->sc_compress, abd, cbuf,
+		    sc->sc_lsize);
+		abd_put(abd);
+
+		/*
+		 * Payloads are kept a multiple of 8 bytes long, see
+		 * dump_record().  The decompressors ignore the padding, as
+		 * they do for blocks padded to the sector size on disk.
+		 */
+		if (csize < sc->sc_lsize) {
+			size_t padded = P2ROUNDUP(csize, 8);
+			bzero((char *)cbuf + csize, padded - csize);
+			csize = padded;
+		}
+		if (csize < sc->sc_lsize) {
+			sc->sc_cbuf = cbuf;
+			sc->sc_csize = csize;
+		} else {
+			zio_data_buf_free(cbuf, sc->sc_lsize);
+		}
+	}
+
+	mutex_enter(&sc->sc_lock);
+	sc->sc_err = err;
+	sc->sc_done = B_TRUE;
+	cv_broadcast(&sc->sc_cv);
+	mutex_exit(&sc->sc_lock);
+}
+
+/*
+ * Hand the block of a DATA range to the compress taskq, if it will be sent
+ * in a WRITE record which may be compressed for the stream.  Spill and
+ * embedded blocks are sent in other records, raw and already compressed
+ * blocks aren't compressed again, and large blocks which have to be split
+ * are sent in pieces.
+ */
+static void
+send_compress_dispatch(struct send_prefetch_thread_arg *spta, objset_t *os,
+    struct send_range *range)
+{
+	struct srd *srdp = &range->sru.data;
+	blkptr_t *bp = &srdp->bp;
+
+	if (spta->compress_tq == NULL || BP_IS_REDACTED(bp) ||
+	    BP_IS_EMBEDDED(bp) || range->start_blkid == DMU_SPILL_BLKID ||
+	    (spta->featureflags & DMU_BACKUP_FEATURE_RAW) ||
+	    (srdp->datablksz > SPA_OLD_MAXBLOCKSIZE &&
+	    !(spta->featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS)) ||
+	    ((spta->featureflags & DMU_BACKUP_FEATURE_COMPRESSED) &&
+	    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF))
+		return;
+
+	send_compress_t *sc = kmem_zalloc(sizeof (*sc), KM_SLEEP);
+	mutex_init(&sc->sc_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&sc->sc_cv, NULL, CV_DEFAULT, NULL);
+	sc->sc_spa = os->os_spa;
+	SET_BOOKMARK(&sc->sc_zb, dmu_objset_id(os), range->object, 0,
+	    range->start_blkid);
+	sc->sc_bp = bp;
+	sc->sc_compress = spta->stream_compress;
+	sc->sc_lsize = srdp->datablksz;
+	srdp->sc = sc;
+
+	VERIFY3U(taskq_dispatch(spta->compress_tq, send_compress_func, sc,
+	    TQ_SLEEP), !=, TASKQID_INVALID);
+}
+
+/*
+ * Issue the prefetch of the data of a DATA range, and start compressing it
+ * if the stream is compressed.
+ */
+static void
+send_prefetch_issue(struct send_prefetch_thread_arg *spta, objset_t *os,
+    struct send_range *range)
+{
+	blkptr_t *bp = &range->sru.data.bp;
+
+	ASSERT3U(range->type, ==, DATA);
+	if (spta->issue_prefetches && !BP_IS_REDACTED(bp) &&
+	    !BP_IS_EMBEDDED(bp)) {
+		zbookmark_phys_t zb;
+		arc_flags_t aflags = ARC_FLAG_NOWAIT | ARC_FLAG_PREFETCH;
+
+		SET_BOOKMARK(&zb, dmu_objset_id(os), range->object, 0,
+		    range->start_blkid);
+		(void) arc_read(NULL, os->os_spa, bp, NULL, NULL,
+		    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL |
+		    ZIO_FLAG_SPECULATIVE, &aflags, &zb);
+	}
+	send_compress_dispatch(spta, os, range);
+}
+
+/*
+ * Order DATA ranges by the address of their block, as dsl_scan does for
+ * the blocks of a sorted scan.  Ranges of the same block, which can only
+ * happen with dedup, are ordered by their position in the stream.
+ */
+static int
+send_range_addr_compare(const void *x, const void *y)
+{
+	const struct send_range *a = x;
+	const struct send_range *b = y;
+	const dva_t *da = &a->sru.data.bp.blk_dva[0];
+	const dva_t *db = &b->sru.data.bp.blk_dva[0];
+
+	int cmp = AVL_CMP(DVA_GET_VDEV(da), DVA_GET_VDEV(db));
+	if (likely(cmp))
+		return (cmp);
+	cmp = AVL_CMP(DVA_GET_OFFSET(da), DVA_GET_OFFSET(db));
+	if (likely(cmp))
+		return (cmp);
+	cmp = AVL_CMP(a->object, b->object);
+	if (likely(cmp))
+		return (cmp);
+	return (AVL_CMP(a->start_blkid, b->start_blkid));
+}
+
+/*
+ * Issue the prefetches of the ranges held back, in the order of their
+ * blocks on disk, then hand the ranges to the main thread in the order of
+ * the stream.
+ */
+static void
+send_prefetch_flush(struct send_prefetch_thread_arg *spta, objset_t *os)
+{
+	struct send_range *range;
+
+	while ((range = avl_first(&spta->window_by_addr)) != NULL) {
+		avl_remove(&spta->window_by_addr, range);
+		send_prefetch_issue(spta, os, range);
+	}
+	while ((range = list_remove_head(&spta->window)) != NULL)
+		bqueue_enqueue(&spta->q, range, range->ln.bqn_size);
+	spta->window_size = 0;
+}
+
+/*
+ * Hand a range to the main thread, once the prefetch of its data has been
+ * issued.  When sorting the prefetches, ranges are held back until the
+ * window is full.
+ */
+static void
+send_prefetch_enqueue(struct send_prefetch_thread_arg *spta, objset_t *os,
+    struct send_range *range, uint64_t size)
+{
+	if (spta->sort_window == 0) {
+		if (range->type == DATA)
+			send_prefetch_issue(spta, os, range);
+		bqueue_enqueue(&spta->q, range, size);
+		return;
+	}
+
+	/* The size is set again when the range is enqueued */
+	range->ln.bqn_size = size;
+	list_insert_tail(&spta->window, range);
+	if (range->type == DATA)
+		avl_add(&spta->window_by_addr, range);
+	spta->window_size += size;
+	if (spta->window_size >= spta->sort_window)
+		send_prefetch_flush(spta, os);
+}
+
 /*
  * Create a new record with the given values.
  */
 static void
-enqueue_range(struct send_prefetch_thread_arg *spta, bqueue_t *q, dnode_t *dn,
+enqueue_range(struct send_prefetch_thread_arg *spta, dnode_t *dn,
     uint64_t blkid, uint64_t count, const blkptr_t *bp, uint32_t datablksz)
 {
 	enum type range_type = (bp == NULL || BP_IS_HOLE(bp) ? HOLE :
@@ -1666,18 +2011,6 @@ enqueue_range(struct send_prefetch_thread_arg *spta, bqueue_t *q, dnode_t *dn,
 		range->sru.data.datablksz = datablksz;
 		range->sru.data.obj_type = dn->dn_type;
 		range->sru.data.bp = *bp;
-		if (spta->issue_prefetches) {
-			zbookmark_phys_t zb = {0};
-			zb.zb_objset = dmu_objset_id(dn->dn_objset);
-			zb.zb_object = dn->dn_object;
-			zb.zb_level = 0;
-			zb.zb_blkid = blkid;
-			arc_flags_t aflags = ARC_FLAG_NOWAIT |
-			    ARC_FLAG_PREFETCH;
-			(void) arc_read(NULL, dn->dn_objset->os_spa, bp, NULL,
-			    NULL, ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL |
-			    ZIO_FLAG_SPECULATIVE, &aflags, &zb);
-		}
 		break;
 	case REDACT:
 		range->sru.redact.datablksz = datablksz;
@@ -1685,7 +2018,7 @@ enqueue_range(struct send_prefetch_thread_arg *spta, bqueue_t *q, dnode_t *dn,
 	default:
 		break;
 	}
-	bqueue_enqueue(q, range, datablksz);
+	send_prefetch_enqueue(spta, dn->dn_objset, range, datablksz);
 }
 
 /*
@@ -1720,32 +2053,18 @@ send_prefetch_thread(void *arg)
 	while (!range->eos_marker && !spta->cancel && smta->error == 0 &&
 	    err == 0) {
 		switch (range->type) {
-		case DATA: {
-			zbookmark_phys_t zb;
-			zb.zb_objset = dmu_objset_id(os);
-			zb.zb_object = range->object;
-			zb.zb_level = 0;
-			zb.zb_blkid = range->start_blkid;
+		case DATA:
 			ASSERT3U(range->start_blkid + 1, ==, range->end_blkid);
-			if (!BP_IS_REDACTED(&range->sru.data.bp) &&
-			    spta->issue_prefetches &&
-			    !BP_IS_EMBEDDED(&range->sru.data.bp)) {
-				arc_flags_t aflags = ARC_FLAG_NOWAIT |
-				    ARC_FLAG_PREFETCH;
-				(void) arc_read(NULL, os->os_spa,
-				    &range->sru.data.bp, NULL, NULL,
-				    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL |
-				    ZIO_FLAG_SPECULATIVE, &aflags, &zb);
-			}
-			bqueue_enqueue(outq, range, range->sru.data.datablksz);
+			send_prefetch_enqueue(spta, os, range,
+			    range->sru.data.datablksz);
 			range = get_next_range_nofree(inq, range);
 			break;
-		}
 		case HOLE:
 		case OBJECT:
 		case OBJECT_RANGE:
 		case REDACT: // Redacted blocks must exist
-			bqueue_enqueue(outq, range, sizeof (*range));
+			send_prefetch_enqueue(spta, os, range,
+			    sizeof (*range));
 			range = get_next_range_nofree(inq, range);
 			break;
 		case PREVIOUSLY_REDACTED: {
@@ -1842,8 +2161,8 @@ send_prefetch_thread(void *arg)
 					    datablksz);
 					uint64_t nblks = (offset / datablksz) -
 					    blkid;
-					enqueue_range(spta, outq, dn, blkid,
-					    nblks, NULL, datablksz);
+					enqueue_range(spta, dn, blkid, nblks,
+					    NULL, datablksz);
 					blkid += nblks;
 				}
 				if (blkid >= file_max)
@@ -1853,7 +2172,7 @@ send_prefetch_thread(void *arg)
 				if (err != 0)
 					break;
 				ASSERT(!BP_IS_HOLE(&bp));
-				enqueue_range(spta, outq, dn, blkid, 1, &bp,
+				enqueue_range(spta, dn, blkid, 1, &bp,
 				    datablksz);
 			}
 			rw_exit(&dn->dn_struct_rwlock);
@@ -1871,6 +2190,7 @@ send_prefetch_thread(void *arg)
 	while (!range->eos_marker)
 		range = get_next_range(inq, range);
 
+	send_prefetch_flush(spta, os);
 	bqueue_enqueue_flush(outq, range, 1);
 	spl_fstrans_unmark(cookie);
 	thread_exit();
@@ -1897,6 +2217,10 @@ struct dmu_send_params {
 	boolean_t compressok;
 	uint64_t resumeobj;
 	uint64_t resumeoff;
+	uint64_t chunk;
+	uint64_t nchunks;
+	uint64_t endobj;	/* stop before this object, if nonzero */
+	enum zio_compress stream_compress;	/* or ZIO_COMPRESS_OFF */
 	zfs_bookmark_phys_t *redactbook;
 	/* Stream output params */
 	dmu_send_outparams_t *dso;
@@ -1949,10 +2273,38 @@ setup_featureflags(struct dmu_send_params *dspp, objset_t *os,
 		*featureflags |= DMU_BACKUP_FEATURE_LZ4;
 	}
 
+	/*
+	 * zstd blocks only end up in the stream verbatim when they are sent
+	 * embedded, compressed or raw.
+	 */
+	if ((*featureflags &
+	    (DMU_BACKUP_FEATURE_EMBED_DATA | DMU_BACKUP_FEATURE_COMPRESSED |
+	    DMU_BACKUP_FEATURE_RAW)) != 0 &&
+	    dsl_dataset_feature_is_active(to_ds, SPA_FEATURE_ZSTD_COMPRESS)) {
+		*featureflags |= DMU_BACKUP_FEATURE_ZSTD;
+	}
+
+	/* Likewise for chunked blocks */
+	if ((*featureflags &
+	    (DMU_BACKUP_FEATURE_EMBED_DATA | DMU_BACKUP_FEATURE_COMPRESSED |
+	    DMU_BACKUP_FEATURE_RAW)) != 0 &&
+	    dsl_dataset_feature_is_active(to_ds,
+	    SPA_FEATURE_CHUNKED_COMPRESS)) {
+		*featureflags |= DMU_BACKUP_FEATURE_CHUNKED_COMPRESS;
+	}
+
 	if (dspp->resumeobj != 0 || dspp->resumeoff != 0) {
 		*featureflags |= DMU_BACKUP_FEATURE_RESUMING;
 	}
 
+	if (dspp->endobj != 0) {
+		*featureflags |= DMU_BACKUP_FEATURE_CHUNKED;
+	}
+
+	if (dspp->stream_compress != ZIO_COMPRESS_OFF) {
+		*featureflags |= DMU_BACKUP_FEATURE_STREAM_COMPRESS;
+	}
+
 	if (dspp->redactbook != NULL) {
 		*featureflags |= DMU_BACKUP_FEATURE_REDACTED;
 	}
@@ -2082,13 +2434,29 @@ setup_merge_thread(struct send_merge_thread_arg *smt_arg,
 
 static void
 setup_prefetch_thread(struct send_prefetch_thread_arg *spt_arg,
-    struct dmu_send_params *dspp, struct send_merge_thread_arg *smt_arg)
+    struct dmu_send_params *dspp, struct send_merge_thread_arg *smt_arg,
+    uint64_t featureflags)
 {
 	VERIFY0(bqueue_init(&spt_arg->q, zfs_send_queue_ff,
 	    MAX(zfs_send_queue_length, 2 * zfs_max_recordsize),
 	    offsetof(struct send_range, ln)));
 	spt_arg->smta = smt_arg;
 	spt_arg->issue_prefetches = !dspp->dso->dso_dryrun;
+	spt_arg->featureflags = featureflags;
+	spt_arg->stream_compress = dspp->stream_compress;
+	if (spt_arg->issue_prefetches && dspp->ancestor_zb.zbm_guid == 0)
+		spt_arg->sort_window = MAX(zfs_send_prefetch_sort_window, 0);
+	list_create(&spt_arg->window, sizeof (struct send_range),
+	    offsetof(struct send_range, ln.bqn_node));
+	avl_create(&spt_arg->window_by_addr, send_range_addr_compare,
+	    sizeof (struct send_range), offsetof(struct send_range,
+	    sru.data.sort_node));
+	if (dspp->stream_compress != ZIO_COMPRESS_OFF &&
+	    !dspp->dso->dso_dryrun) {
+		int nthreads = MAX(zfs_send_compress_threads, 1);
+		spt_arg->compress_tq = taskq_create("send_compress", nthreads,
+		    minclsyspri, nthreads, INT_MAX, TASKQ_PREPOPULATE);
+	}
 	(void) thread_create(NULL, 0, send_prefetch_thread, spt_arg, 0,
 	    curproc, TS_RUN, minclsyspri);
 }
@@ -2107,6 +2475,12 @@ setup_resume_points(struct dmu_send_params *dspp,
 	uint64_t blkid = 0;
 	if (resuming) {
 		obj = dspp->resumeobj;
+	}
+	/*
+	 * The start of a chunk may be a free object, it doesn't need the
+	 * block size since it starts at offset 0.
+	 */
+	if (dspp->resumeoff != 0) {
 		dmu_object_info_t to_doi;
 		err = dmu_object_info(os, obj, &to_doi);
 		if (err != 0)
@@ -2150,6 +2524,52 @@ setup_resume_points(struct dmu_send_params *dspp,
 	return (0);
 }
 
+/*
+ * A chunked send covers one of nchunks ranges of objects of the dataset,
+ * so that the chunks can be generated and transferred in parallel.  The
+ * ranges are whole blocks of dnodes, and each chunk but the first resumes
+ * at the start of its range like an interrupted send would.  The receiver
+ * applies them in order; a chunk which isn't the last one leaves the
+ * receive resumable at the end of its range instead of completing it.
+ */
+static void
+setup_chunk_bounds(struct dmu_send_params *dspp, objset_t *os)
+{
+	uint64_t nobjs = (DMU_META_DNODE(os)->dn_maxblkid + 1) <<
+	    DNODES_PER_BLOCK_SHIFT;
+	uint64_t per_chunk = nobjs / dspp->nchunks;
+
+	ASSERT3U(dspp->chunk, <, dspp->nchunks);
+
+	if (dspp->chunk != 0) {
+		dspp->resumeobj = MAX(P2ROUNDUP(per_chunk * dspp->chunk,
+		    DNODES_PER_BLOCK), DNODES_PER_BLOCK);
+		dspp->resumeoff = 0;
+	}
+	if (dspp->chunk + 1 < dspp->nchunks) {
+		dspp->endobj = MAX(P2ROUNDUP(per_chunk * (dspp->chunk + 1),
+		    DNODES_PER_BLOCK), DNODES_PER_BLOCK);
+	}
+}
+
+/*
+ * Returns B_TRUE if the range lies beyond the end of a chunked send,
+ * trimming a range of free dnodes which straddles it.
+ */
+static boolean_t
+send_range_past_end(struct send_range *range, uint64_t endobj)
+{
+	if (range->object != DMU_META_DNODE_OBJECT)
+		return (range->object >= endobj);
+
+	uint64_t endblk = endobj >> DNODES_PER_BLOCK_SHIFT;
+	if (range->start_blkid >= endblk)
+		return (B_TRUE);
+	if (range->end_blkid > endblk)
+		range->end_blkid = endblk;
+	return (B_FALSE);
+}
+
 static dmu_sendstatus_t *
 setup_send_progress(struct dmu_send_params *dspp)
 {
@@ -2163,6 +2583,83 @@ setup_send_progress(struct dmu_send_params *dspp)
 	return (dssp);
 }
 
+static int
+send_kstat_update(kstat_t *ksp, int rw)
+{
+	send_kstat_t *sk = ksp->ks_private;
+	send_kstat_values_t *skv = &sk->sk_values;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	skv->skv_output_bytes.value.ui64 = *sk->sk_dsc->dsc_off;
+	skv->skv_output_wait_ns.value.ui64 = sk->sk_dsc->dsc_output_wait;
+	for (int i = 0; i < SEND_STAGES; i++) {
+		if (sk->sk_queues[i] != NULL) {
+			bqueue_kstat_update(sk->sk_queues[i],
+			    skv->skv_queues[i]);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Export the kstats of a send.  The queues of stages which are not part
+ * of this send are NULL.  Failing to create the kstat is not an error.
+ */
+static send_kstat_t *
+send_kstat_create(dsl_dataset_t *ds, dmu_send_cookie_t *dscp,
+    bqueue_t **queues)
+{
+	char kstat_module_name[KSTAT_STRLEN];
+	char kstat_name[KSTAT_STRLEN];
+
+	if (snprintf(kstat_module_name, sizeof (kstat_module_name), "zfs/%s",
+	    spa_name(ds->ds_dir->dd_pool->dp_spa)) >= KSTAT_STRLEN)
+		return (NULL);
+	(void) snprintf(kstat_name, sizeof (kstat_name), "send-%llu",
+	    (u_longlong_t)atomic_inc_64_nv(&send_kstat_id));
+
+	kstat_t *ksp = kstat_create(kstat_module_name, 0, kstat_name,
+	    "misc", KSTAT_TYPE_NAMED,
+	    sizeof (send_kstat_values_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (ksp == NULL)
+		return (NULL);
+
+	send_kstat_t *sk = kmem_zalloc(sizeof (*sk), KM_SLEEP);
+	bcopy(&empty_send_kstats, &sk->sk_values, sizeof (empty_send_kstats));
+	for (int i = 0; i < SEND_STAGES; i++) {
+		bqueue_kstat_init(sk->sk_values.skv_queues[i],
+		    send_stage_names[i]);
+		sk->sk_queues[i] = queues[i];
+	}
+	dsl_dataset_name(ds, sk->sk_ds_name);
+	KSTAT_NAMED_STR_PTR(&sk->sk_values.skv_ds_name) = sk->sk_ds_name;
+	KSTAT_NAMED_STR_BUFLEN(&sk->sk_values.skv_ds_name) =
+	    sizeof (sk->sk_ds_name);
+	sk->sk_dsc = dscp;
+
+	ksp->ks_data = &sk->sk_values;
+	ksp->ks_update = send_kstat_update;
+	ksp->ks_private = sk;
+	sk->sk_kstat = ksp;
+	kstat_install(ksp);
+
+	return (sk);
+}
+
+static void
+send_kstat_destroy(send_kstat_t *sk)
+{
+	if (sk == NULL)
+		return;
+
+	kstat_delete(sk->sk_kstat);
+	kmem_free(sk, sizeof (*sk));
+}
+
 /*
  * Actually do the bulk of the work in a zfs send.
  *
@@ -2299,8 +2796,9 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	struct send_range *range;
 	redaction_list_t *from_rl = NULL;
 	redaction_list_t *redact_rl = NULL;
-	boolean_t resuming = (dspp->resumeobj != 0 || dspp->resumeoff != 0);
-	boolean_t book_resuming = resuming;
+	boolean_t resuming, book_resuming;
+	boolean_t chunk_done = B_FALSE;
+	send_kstat_t *sk = NULL;
 
 	dsl_dataset_t *to_ds = dspp->to_ds;
 	zfs_bookmark_phys_t *ancestor_zb = &dspp->ancestor_zb;
@@ -2334,6 +2832,11 @@ dmu_send_impl(struct dmu_send_params *dspp)
 		ASSERT0(arc_is_unauthenticated(os->os_phys_buf));
 	}
 
+	if (dspp->nchunks != 0)
+		setup_chunk_bounds(dspp, os);
+	resuming = (dspp->resumeobj != 0 || dspp->resumeoff != 0);
+	book_resuming = resuming;
+
 	if ((err = setup_featureflags(dspp, os, &featureflags)) != 0) {
 		dsl_pool_rele(dp, tag);
 		return (err);
@@ -2452,6 +2955,14 @@ dmu_send_impl(struct dmu_send_params *dspp)
 			goto out;
 	}
 
+	if (dspp->endobj != 0)
+		fnvlist_add_uint64(nvl, BEGINNV_END_OBJECT, dspp->endobj);
+
+	if (featureflags & DMU_BACKUP_FEATURE_STREAM_COMPRESS) {
+		fnvlist_add_uint64(nvl, BEGINNV_STREAM_COMPRESS,
+		    dspp->stream_compress);
+	}
+
 	if (featureflags & DMU_BACKUP_FEATURE_RAW) {
 		uint64_t ivset_guid = (ancestor_zb != NULL) ?
 		    ancestor_zb->zbm_ivset_guid : 0;
@@ -2486,10 +2997,27 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	setup_from_thread(from_arg, from_rl, dssp);
 	setup_redact_list_thread(rlt_arg, dspp, redact_rl, dssp);
 	setup_merge_thread(smt_arg, dspp, from_arg, to_arg, rlt_arg, os);
-	setup_prefetch_thread(spt_arg, dspp, smt_arg);
+	setup_prefetch_thread(spt_arg, dspp, smt_arg, featureflags);
+
+	if (!dspp->dso->dso_dryrun) {
+		bqueue_t *queues[SEND_STAGES] = {
+			[SEND_STAGE_TRAVERSE] = &to_arg->q,
+			[SEND_STAGE_FROM] = &from_arg->q,
+			[SEND_STAGE_REDACT] = dspp->redactbook != NULL ?
+			    &rlt_arg->q : NULL,
+			[SEND_STAGE_MERGE] = &smt_arg->q,
+			[SEND_STAGE_PREFETCH] = &spt_arg->q,
+		};
+		sk = send_kstat_create(to_ds, &dsc, queues);
+	}
 
 	range = bqueue_dequeue(&spt_arg->q);
 	while (err == 0 && !range->eos_marker) {
+		if (dspp->endobj != 0 &&
+		    send_range_past_end(range, dspp->endobj)) {
+			chunk_done = B_TRUE;
+			break;
+		}
 		err = do_dump(&dsc, range);
 		range = get_next_range(&spt_arg->q, range);
 		if (issig(JUSTLOOKING) && issig(FORREAL))
@@ -2500,16 +3028,23 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	 * If we hit an error or are interrupted, cancel our worker threads and
 	 * clear the queue of any pending records.  The threads will pass the
 	 * cancel up the tree of worker threads, and each one will clean up any
-	 * pending records before exiting.
+	 * pending records before exiting.  The same is done once a chunked
+	 * send reaches the end of its chunk.
 	 */
-	if (err != 0) {
+	if (err != 0 || chunk_done) {
 		spt_arg->cancel = B_TRUE;
 		while (!range->eos_marker) {
 			range = get_next_range(&spt_arg->q, range);
 		}
 	}
 	range_free(range);
+	send_kstat_destroy(sk);
 
+	/* All the ranges handed to the compress taskq have been freed */
+	if (spt_arg->compress_tq != NULL)
+		taskq_destroy(spt_arg->compress_tq);
+	list_destroy(&spt_arg->window);
+	avl_destroy(&spt_arg->window_by_addr);
 	bqueue_destroy(&spt_arg->q);
 	bqueue_destroy(&smt_arg->q);
 	if (dspp->redactbook != NULL)
@@ -2517,7 +3052,7 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	bqueue_destroy(&to_arg->q);
 	bqueue_destroy(&from_arg->q);
 
-	if (err == 0 && spt_arg->error != 0)
+	if (err == 0 && !chunk_done && spt_arg->error != 0)
 		err = spt_arg->error;
 
 	if (err != 0)
@@ -2585,6 +3120,7 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 	dspp.dso = dsop;
 	dspp.tag = FTAG;
 	dspp.rawok = rawok;
+	dspp.stream_compress = ZIO_COMPRESS_OFF;
 
 	err = dsl_pool_hold(pool, FTAG, &dspp.dp);
 	if (err != 0)
@@ -2651,7 +3187,8 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 int
 dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
     boolean_t large_block_ok, boolean_t compressok, boolean_t rawok,
-    uint64_t resumeobj, uint64_t resumeoff, const char *redactbook, int outfd,
+    uint64_t resumeobj, uint64_t resumeoff, uint64_t chunk, uint64_t nchunks,
+    enum zio_compress stream_compress, const char *redactbook, int outfd,
     offset_t *off, dmu_send_outparams_t *dsop)
 {
 	int err = 0;
@@ -2670,6 +3207,9 @@ dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
 	dspp.tag = FTAG;
 	dspp.resumeobj = resumeobj;
 	dspp.resumeoff = resumeoff;
+	dspp.chunk = chunk;
+	dspp.nchunks = nchunks;
+	dspp.stream_compress = stream_compress;
 	dspp.rawok = rawok;
 
 	if (fromsnap != NULL && strpbrk(fromsnap, "@#") == NULL)
@@ -2933,6 +3473,14 @@ module_param(zfs_send_unmodified_spill_blocks, int, 0644);
 MODULE_PARM_DESC(zfs_send_unmodified_spill_blocks,
 	"Send unmodified spill blocks");
 
+module_param(zfs_send_compress_threads, int, 0644);
+MODULE_PARM_DESC(zfs_send_compress_threads,
+	"Number of threads compressing the payloads of a compressed stream");
+
+module_param(zfs_send_prefetch_sort_window, int, 0644);
+MODULE_PARM_DESC(zfs_send_prefetch_sort_window,
+	"Bytes of a full send prefetched in the order of their location");
+
 module_param(zfs_send_no_prefetch_queue_length, int, 0644);
 MODULE_PARM_DESC(zfs_send_no_prefetch_queue_length,
 	"Maximum send queue length for non-prefetch queues");
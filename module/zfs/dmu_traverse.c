@@ -713,6 +713,17 @@ traverse_dataset_destroyed(spa_t *spa, blkptr_t *blkptr,
 	    blkptr, txg_start, resume, flags, func, arg));
 }
 
+/*
+ * Visit the MOS only, for callers which traverse the datasets themselves.
+ */
+int
+traverse_mos(spa_t *spa, uint64_t txg_start, int flags,
+    blkptr_cb_t func, void *arg)
+{
+	return (traverse_impl(spa, NULL, 0, spa_get_rootblkptr(spa),
+	    txg_start, NULL, flags, func, arg));
+}
+
 /*
  * NB: pool must not be changing on-disk (eg, from zdb or sync context).
  */
@@ -726,8 +737,7 @@ traverse_pool(spa_t *spa, uint64_t txg_start, int flags,
 	boolean_t hard = (flags & TRAVERSE_HARD);
 
 	/* visit the MOS */
-	err = traverse_impl(spa, NULL, 0, spa_get_rootblkptr(spa),
-	    txg_start, NULL, flags, func, arg);
+	err = traverse_mos(spa, txg_start, flags, func, arg);
 	if (err != 0)
 		return (err);
 
@@ -771,6 +781,7 @@ traverse_pool(spa_t *spa, uint64_t txg_start, int flags,
 #if defined(_KERNEL)
 EXPORT_SYMBOL(traverse_dataset);
 EXPORT_SYMBOL(traverse_pool);
+EXPORT_SYMBOL(traverse_mos);
 
 module_param(zfs_pd_bytes_max, int, 0644);
 MODULE_PARM_DESC(zfs_pd_bytes_max, "Max number of bytes to prefetch");
@@ -131,7 +131,10 @@ dmu_tx_hold_dnode_impl(dmu_tx_t *tx, dnode_t *dn, enum dmu_tx_hold_type type,
 		}
 	}
 
-	txh = kmem_zalloc(sizeof (dmu_tx_hold_t), KM_SLEEP);
+	if (tx->tx_nprealloc_holds < DMU_TX_PREALLOC_HOLDS)
+		txh = &tx->tx_prealloc_holds[tx->tx_nprealloc_holds++];
+	else
+		txh = kmem_zalloc(sizeof (dmu_tx_hold_t), KM_SLEEP);
 	txh->txh_tx = tx;
 	txh->txh_dnode = dn;
 	zfs_refcount_create(&txh->txh_space_towrite);
@@ -779,13 +782,17 @@ int zfs_delay_resolution_ns = 100 * 1000; /* 100 microseconds */
  * ensuring that the appropriate limits are set for the I/O scheduler to reach
  * optimal throughput on the backend storage, and then by changing the value
  * of zfs_delay_scale to increase the steepness of the curve.
+ *
+ * When zfs_dirty_data_target_ms is set, the limit of the pool as returned
+ * by dsl_pool_dirty_max() takes the place of zfs_dirty_data_max above, so
+ * that the curve follows the write bandwidth of the pool.
  */
 static void
-dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty)
+dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty, uint64_t dirty_max)
 {
 	dsl_pool_t *dp = tx->tx_pool;
 	uint64_t delay_min_bytes =
-	    zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100;
+	    dirty_max * zfs_delay_min_dirty_percent / 100;
 	hrtime_t wakeup, min_tx_time, now;
 
 	if (dirty <= delay_min_bytes)
@@ -797,11 +804,11 @@ dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty)
 	 * have to handle the case of it being >= the max, which could
 	 * cause a divide-by-zero if it's == the max.
 	 */
-	ASSERT3U(dirty, <, zfs_dirty_data_max);
+	ASSERT3U(dirty, <, dirty_max);
 
 	now = gethrtime();
 	min_tx_time = zfs_delay_scale *
-	    (dirty - delay_min_bytes) / (zfs_dirty_data_max - dirty);
+	    (dirty - delay_min_bytes) / (dirty_max - dirty);
 	min_tx_time = MIN(min_tx_time, zfs_delay_max_ns);
 	if (now > tx->tx_start + min_tx_time)
 		return;
@@ -1033,6 +1040,22 @@ dmu_tx_assign(dmu_tx_t *tx, uint64_t txg_how)
 	if ((txg_how & TXG_NOTHROTTLE))
 		tx->tx_dirty_delayed = B_TRUE;
 
+	/*
+	 * Enforce the write limits of the objset before the tx is assigned,
+	 * so that a throttled dataset doesn't hold up the txg.  Callers which
+	 * can't wait, or have already waited, aren't delayed again.
+	 */
+	if (tx->tx_objset != NULL && (txg_how & TXG_WAIT) &&
+	    !(txg_how & TXG_NOTHROTTLE)) {
+		uint64_t towrite = 0;
+
+		for (dmu_tx_hold_t *txh = list_head(&tx->tx_holds);
+		    txh != NULL; txh = list_next(&tx->tx_holds, txh)) {
+			towrite += zfs_refcount_count(&txh->txh_space_towrite);
+		}
+		dmu_objset_iolimit(tx->tx_objset, B_TRUE, towrite);
+	}
+
 	while ((err = dmu_tx_try_assign(tx, txg_how)) != 0) {
 		dmu_tx_unassign(tx);
 
@@ -1060,7 +1083,7 @@ dmu_tx_wait(dmu_tx_t *tx)
 	before = gethrtime();
 
 	if (tx->tx_wait_dirty) {
-		uint64_t dirty;
+		uint64_t dirty, dirty_max;
 
 		/*
 		 * dmu_tx_try_assign() has determined that we need to wait
@@ -1068,14 +1091,15 @@ dmu_tx_wait(dmu_tx_t *tx)
 		 * space.
 		 */
 		mutex_enter(&dp->dp_lock);
-		if (dp->dp_dirty_total >= zfs_dirty_data_max)
+		if (dp->dp_dirty_total >= dsl_pool_dirty_max(dp))
 			DMU_TX_STAT_BUMP(dmu_tx_dirty_over_max);
-		while (dp->dp_dirty_total >= zfs_dirty_data_max)
+		while (dp->dp_dirty_total >=
+		    (dirty_max = dsl_pool_dirty_max(dp)))
 			cv_wait(&dp->dp_spaceavail_cv, &dp->dp_lock);
 		dirty = dp->dp_dirty_total;
 		mutex_exit(&dp->dp_lock);
 
-		dmu_tx_delay(tx, dirty);
+		dmu_tx_delay(tx, dirty, dirty_max);
 
 		tx->tx_wait_dirty = B_FALSE;
 
@@ -1128,7 +1152,9 @@ dmu_tx_destroy(dmu_tx_t *tx)
 		    zfs_refcount_count(&txh->txh_space_towrite));
 		zfs_refcount_destroy_many(&txh->txh_memory_tohold,
 		    zfs_refcount_count(&txh->txh_memory_tohold));
-		kmem_free(txh, sizeof (dmu_tx_hold_t));
+		if (txh < &tx->tx_prealloc_holds[0] ||
+		    txh >= &tx->tx_prealloc_holds[DMU_TX_PREALLOC_HOLDS])
+			kmem_free(txh, sizeof (dmu_tx_hold_t));
 		if (dn != NULL)
 			dnode_rele(dn, tx);
 	}
@@ -1217,6 +1243,36 @@ dmu_tx_callback_register(dmu_tx_t *tx, dmu_tx_callback_func_t *func, void *data)
 	list_insert_tail(&tx->tx_callbacks, dcb);
 }
 
+uint64_t
+dmu_tx_callback_register_txg(objset_t *os, dmu_tx_callback_func_t *func,
+    void *data)
+{
+	dsl_pool_t *dp = dmu_objset_pool(os);
+	dmu_tx_callback_t *dcb;
+	txg_handle_t th;
+	list_t cb_list;
+	uint64_t txg;
+
+	ASSERT(!dsl_pool_sync_context(dp));
+
+	dcb = kmem_alloc(sizeof (dmu_tx_callback_t), KM_SLEEP);
+	dcb->dcb_func = func;
+	dcb->dcb_data = data;
+
+	list_create(&cb_list, sizeof (dmu_tx_callback_t),
+	    offsetof(dmu_tx_callback_t, dcb_node));
+	list_insert_tail(&cb_list, dcb);
+
+	txg = txg_hold_open(dp, &th);
+	txg_register_callbacks(&th, &cb_list);
+	txg_rele_to_quiesce(&th);
+	txg_rele_to_sync(&th);
+
+	list_destroy(&cb_list);
+
+	return (txg);
+}
+
 /*
  * Call all the commit callbacks on a list, with a given error code.
  */
@@ -55,20 +55,47 @@ unsigned int	zfetch_max_idistance = 64 * 1024 * 1024;
 /* max number of bytes in an array_read in which we allow prefetching (1MB) */
 unsigned long	zfetch_array_rd_sz = 1024 * 1024;
 
+/*
+ * Streams are counted by how long they lived, from creation to their last
+ * hit, in decades of milliseconds: under 10ms, 100ms, 1s, 10s, 100s, and
+ * 100s or more.
+ */
+#define	ZFETCH_LIFETIME_BUCKETS	6
+
 typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_hits;
 	kstat_named_t zfetchstat_misses;
 	kstat_named_t zfetchstat_max_streams;
+	kstat_named_t zfetchstat_stride_hits;
+	/* data prefetched, and how much of it the streams then accessed */
+	kstat_named_t zfetchstat_issued_bytes;
+	kstat_named_t zfetchstat_used_bytes;
+	kstat_named_t zfetchstat_wasted_bytes;
+	kstat_named_t zfetchstat_lifetime[ZFETCH_LIFETIME_BUCKETS];
 } zfetch_stats_t;
 
 static zfetch_stats_t zfetch_stats = {
 	{ "hits",			KSTAT_DATA_UINT64 },
 	{ "misses",			KSTAT_DATA_UINT64 },
 	{ "max_streams",		KSTAT_DATA_UINT64 },
+	{ "stride_hits",		KSTAT_DATA_UINT64 },
+	{ "issued_bytes",		KSTAT_DATA_UINT64 },
+	{ "used_bytes",			KSTAT_DATA_UINT64 },
+	{ "wasted_bytes",		KSTAT_DATA_UINT64 },
+	{
+		{ "lifetime_lt_10ms",	KSTAT_DATA_UINT64 },
+		{ "lifetime_lt_100ms",	KSTAT_DATA_UINT64 },
+		{ "lifetime_lt_1s",	KSTAT_DATA_UINT64 },
+		{ "lifetime_lt_10s",	KSTAT_DATA_UINT64 },
+		{ "lifetime_lt_100s",	KSTAT_DATA_UINT64 },
+		{ "lifetime_ge_100s",	KSTAT_DATA_UINT64 },
+	},
 };
 
 #define	ZFETCHSTAT_BUMP(stat) \
 	atomic_inc_64(&zfetch_stats.stat.value.ui64);
+#define	ZFETCHSTAT_INCR(stat, val) \
+	atomic_add_64(&zfetch_stats.stat.value.ui64, (val));
 
 kstat_t		*zfetch_ksp;
 
@@ -94,10 +121,88 @@ zfetch_fini(void)
 	}
 }
 
+typedef struct zfetch_objset_stats {
+	kstat_named_t zos_issued_bytes;
+	kstat_named_t zos_used_bytes;
+	kstat_named_t zos_wasted_bytes;
+} zfetch_objset_stats_t;
+
+static const zfetch_objset_stats_t empty_zfetch_objset_stats = {
+	{ "issued_bytes",		KSTAT_DATA_UINT64 },
+	{ "used_bytes",			KSTAT_DATA_UINT64 },
+	{ "wasted_bytes",		KSTAT_DATA_UINT64 },
+};
+
+static int
+dmu_zfetch_objset_kstat_update(kstat_t *ksp, int rw)
+{
+	objset_t *os = ksp->ks_private;
+	zfetch_objset_stats_t *zos = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	zos->zos_issued_bytes.value.ui64 = os->os_prefetch_issued;
+	zos->zos_used_bytes.value.ui64 = os->os_prefetch_used;
+	zos->zos_wasted_bytes.value.ui64 = os->os_prefetch_wasted;
+	return (0);
+}
+
+/*
+ * Create the kstat of the prefetch counters of an objset, named after the
+ * objset id like the dataset kstats.  Snapshots are skipped, as they are
+ * by the dataset kstats; the counters are still maintained.
+ */
+void
+dmu_zfetch_objset_init(objset_t *os)
+{
+	char kstat_module_name[KSTAT_STRLEN];
+	char kstat_name[KSTAT_STRLEN];
+	zfetch_objset_stats_t *zos;
+	kstat_t *ksp;
+
+	if (os->os_dsl_dataset != NULL && dmu_objset_is_snapshot(os))
+		return;
+
+	if (snprintf(kstat_module_name, sizeof (kstat_module_name),
+	    "zfs/%s", spa_name(os->os_spa)) >= KSTAT_STRLEN)
+		return;
+	(void) snprintf(kstat_name, sizeof (kstat_name), "prefetch-0x%llx",
+	    (unsigned long long)dmu_objset_id(os));
+
+	ksp = kstat_create(kstat_module_name, 0, kstat_name, "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zfetch_objset_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (ksp == NULL)
+		return;
+
+	zos = kmem_alloc(sizeof (zfetch_objset_stats_t), KM_SLEEP);
+	bcopy(&empty_zfetch_objset_stats, zos, sizeof (*zos));
+	ksp->ks_data = zos;
+	ksp->ks_update = dmu_zfetch_objset_kstat_update;
+	ksp->ks_private = os;
+	kstat_install(ksp);
+	os->os_prefetch_ksp = ksp;
+}
+
+void
+dmu_zfetch_objset_fini(objset_t *os)
+{
+	kstat_t *ksp = os->os_prefetch_ksp;
+
+	if (ksp == NULL)
+		return;
+
+	kstat_delete(ksp);
+	kmem_free(ksp->ks_data, sizeof (zfetch_objset_stats_t));
+	os->os_prefetch_ksp = NULL;
+}
+
 /*
  * This takes a pointer to a zfetch structure and a dnode.  It performs the
  * necessary setup for the zfetch structure, grokking data from the
- * associated dnode.
+ * associated dnode.  The streams themselves are only allocated once the
+ * dnode is accessed in a way that could start a stream.
  */
 void
 dmu_zfetch_init(zfetch_t *zf, dnode_t *dno)
@@ -106,20 +211,59 @@ dmu_zfetch_init(zfetch_t *zf, dnode_t *dno)
 		return;
 
 	zf->zf_dnode = dno;
+	zf->zf_streams = NULL;
+	zf->zf_nstreams = 0;
 
-	list_create(&zf->zf_stream, sizeof (zstream_t),
-	    offsetof(zstream_t, zs_node));
+	mutex_init(&zf->zf_lock, NULL, MUTEX_DEFAULT, NULL);
+}
+
+/*
+ * Account for data blocks that a stream prefetched, or for prefetched
+ * blocks that were then accessed, both globally and in the objset.
+ */
+static void
+dmu_zfetch_account(zfetch_t *zf, uint64_t issued, uint64_t used)
+{
+	objset_t *os = zf->zf_dnode->dn_objset;
+	uint64_t blksz = zf->zf_dnode->dn_datablksz;
 
-	rw_init(&zf->zf_rwlock, NULL, RW_DEFAULT, NULL);
+	if (issued != 0) {
+		ZFETCHSTAT_INCR(zfetchstat_issued_bytes, issued * blksz);
+		atomic_add_64(&os->os_prefetch_issued, issued * blksz);
+	}
+	if (used != 0) {
+		ZFETCHSTAT_INCR(zfetchstat_used_bytes, used * blksz);
+		atomic_add_64(&os->os_prefetch_used, used * blksz);
+	}
 }
 
+/*
+ * Retire a stream: whatever it prefetched and was not accessed through it
+ * is counted as wasted, and its lifetime is added to the histogram.
+ */
 static void
-dmu_zfetch_stream_remove(zfetch_t *zf, zstream_t *zs)
+dmu_zfetch_stream_done(zfetch_t *zf, zstream_t *zs)
 {
-	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
-	list_remove(&zf->zf_stream, zs);
-	mutex_destroy(&zs->zs_lock);
-	kmem_free(zs, sizeof (*zs));
+	objset_t *os = zf->zf_dnode->dn_objset;
+	uint64_t wasted = (zs->zs_pf_issued - zs->zs_pf_used) *
+	    zf->zf_dnode->dn_datablksz;
+	uint64_t life_ms = NSEC2MSEC(zs->zs_atime - zs->zs_ctime);
+	int b = 0;
+
+	ASSERT(MUTEX_HELD(&zf->zf_lock));
+	ASSERT3U(zs->zs_atime, !=, 0);
+	ASSERT3U(zs->zs_pf_used, <=, zs->zs_pf_issued);
+
+	if (wasted != 0) {
+		ZFETCHSTAT_INCR(zfetchstat_wasted_bytes, wasted);
+		atomic_add_64(&os->os_prefetch_wasted, wasted);
+	}
+	for (uint64_t t = 10; life_ms >= t &&
+	    b < ZFETCH_LIFETIME_BUCKETS - 1; t *= 10)
+		b++;
+	ZFETCHSTAT_BUMP(zfetchstat_lifetime[b]);
+
+	zs->zs_atime = 0;
 }
 
 /*
@@ -129,45 +273,62 @@ dmu_zfetch_stream_remove(zfetch_t *zf, zstream_t *zs)
 void
 dmu_zfetch_fini(zfetch_t *zf)
 {
-	zstream_t *zs;
-
-	ASSERT(!RW_LOCK_HELD(&zf->zf_rwlock));
+	ASSERT(MUTEX_NOT_HELD(&zf->zf_lock));
 
-	rw_enter(&zf->zf_rwlock, RW_WRITER);
-	while ((zs = list_head(&zf->zf_stream)) != NULL)
-		dmu_zfetch_stream_remove(zf, zs);
-	rw_exit(&zf->zf_rwlock);
-	list_destroy(&zf->zf_stream);
-	rw_destroy(&zf->zf_rwlock);
+	if (zf->zf_streams != NULL) {
+		mutex_enter(&zf->zf_lock);
+		for (uint_t i = 0; i < zf->zf_nstreams; i++) {
+			if (zf->zf_streams[i].zs_atime != 0)
+				dmu_zfetch_stream_done(zf, &zf->zf_streams[i]);
+		}
+		mutex_exit(&zf->zf_lock);
+		kmem_free(zf->zf_streams,
+		    zf->zf_nstreams * sizeof (zstream_t));
+		zf->zf_streams = NULL;
+		zf->zf_nstreams = 0;
+	}
+	mutex_destroy(&zf->zf_lock);
 
 	zf->zf_dnode = NULL;
 }
 
 /*
  * If there aren't too many streams already, create a new stream.
- * The "blkid" argument is the next block that we expect this stream to access.
+ * The "blkid" argument is the next block that we expect this stream to
+ * access, and "last_blkid" the first block of the access that created it.
  * While we're here, clean up old streams (which haven't been
  * accessed for at least zfetch_min_sec_reap seconds).
  */
 static void
-dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
+dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid, uint64_t last_blkid)
 {
-	zstream_t *zs_next;
+	zstream_t *free_zs = NULL;
 	int numstreams = 0;
+	hrtime_t now = gethrtime();
 
-	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
+	ASSERT(MUTEX_HELD(&zf->zf_lock));
+
+	if (zf->zf_streams == NULL) {
+		zf->zf_nstreams = MAX(1, zfetch_max_streams);
+		zf->zf_streams = kmem_zalloc(zf->zf_nstreams *
+		    sizeof (zstream_t), KM_SLEEP);
+	}
 
 	/*
 	 * Clean up old streams.
 	 */
-	for (zstream_t *zs = list_head(&zf->zf_stream);
-	    zs != NULL; zs = zs_next) {
-		zs_next = list_next(&zf->zf_stream, zs);
-		if (((gethrtime() - zs->zs_atime) / NANOSEC) >
-		    zfetch_min_sec_reap)
-			dmu_zfetch_stream_remove(zf, zs);
-		else
+	for (uint_t i = 0; i < zf->zf_nstreams; i++) {
+		zstream_t *zs = &zf->zf_streams[i];
+
+		if (zs->zs_atime != 0 &&
+		    (now - zs->zs_atime) / NANOSEC > zfetch_min_sec_reap)
+			dmu_zfetch_stream_done(zf, zs);
+		if (zs->zs_atime == 0) {
+			if (free_zs == NULL)
+				free_zs = zs;
+		} else {
 			numstreams++;
+		}
 	}
 
 	/*
@@ -181,19 +342,68 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
 	uint32_t max_streams = MAX(1, MIN(zfetch_max_streams,
 	    zf->zf_dnode->dn_maxblkid * zf->zf_dnode->dn_datablksz /
 	    zfetch_max_distance));
-	if (numstreams >= max_streams) {
+	if (numstreams >= max_streams || free_zs == NULL) {
 		ZFETCHSTAT_BUMP(zfetchstat_max_streams);
 		return;
 	}
 
-	zstream_t *zs = kmem_zalloc(sizeof (*zs), KM_SLEEP);
-	zs->zs_blkid = blkid;
-	zs->zs_pf_blkid = blkid;
-	zs->zs_ipf_blkid = blkid;
-	zs->zs_atime = gethrtime();
-	mutex_init(&zs->zs_lock, NULL, MUTEX_DEFAULT, NULL);
+	bzero(free_zs, sizeof (*free_zs));
+	free_zs->zs_blkid = blkid;
+	free_zs->zs_pf_blkid = blkid;
+	free_zs->zs_ipf_blkid = blkid;
+	free_zs->zs_last_blkid = last_blkid;
+	free_zs->zs_atime = now;
+	free_zs->zs_ctime = now;
+}
 
-	list_insert_head(&zf->zf_stream, zs);
+/*
+ * Called for an access that matched no stream.  If it is close to the
+ * previous access of a stream that has not seen a sequential hit, that
+ * stream becomes (or is re-anchored as) a strided stream, expecting the
+ * next access one stride further.  A strided stream that has to be
+ * re-anchored halves its depth.  Returns B_FALSE if no stream qualified.
+ */
+static boolean_t
+dmu_zfetch_stream_restride(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
+{
+	int64_t max_dist_blks =
+	    zfetch_max_distance >> zf->zf_dnode->dn_datablkshift;
+	zstream_t *best = NULL;
+	int64_t best_stride = 0;
+
+	ASSERT(MUTEX_HELD(&zf->zf_lock));
+
+	for (uint_t i = 0; i < zf->zf_nstreams; i++) {
+		zstream_t *zs = &zf->zf_streams[i];
+		int64_t stride = (int64_t)(blkid - zs->zs_last_blkid);
+
+		if (zs->zs_atime == 0 || stride == 0 ||
+		    ABS(stride) > max_dist_blks)
+			continue;
+		/* leave established sequential streams alone */
+		if (zs->zs_stride == 0 && zs->zs_pf_blkid != zs->zs_blkid)
+			continue;
+		if (best == NULL || ABS(stride) < ABS(best_stride)) {
+			best = zs;
+			best_stride = stride;
+		}
+	}
+
+	if (best == NULL || (best_stride < 0 && (int64_t)blkid < -best_stride))
+		return (B_FALSE);
+
+	if (best->zs_stride != 0)
+		best->zs_depth = MAX(1, best->zs_depth / 2);
+	else
+		best->zs_depth = MAX(1, max_dist_blks / nblks);
+	best->zs_stride = best_stride;
+	best->zs_nblks = nblks;
+	best->zs_last_blkid = blkid;
+	best->zs_blkid = blkid + best_stride;
+	best->zs_pf_blkid = best->zs_blkid;
+	best->zs_atime = gethrtime();
+
+	return (B_TRUE);
 }
 
 /*
@@ -208,14 +418,14 @@ void
 dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
     boolean_t have_lock)
 {
-	zstream_t *zs;
+	zstream_t *zs = NULL;
 	int64_t pf_start, ipf_start, ipf_istart, ipf_iend;
-	int64_t pf_ahead_blks, max_blks;
+	int64_t pf_ahead_blks, max_blks, stride = 0;
+	uint64_t used = 0;
 	int epbs, max_dist_blks, pf_nblks, ipf_nblks;
 	uint64_t end_of_access_blkid;
 	end_of_access_blkid = blkid + nblks;
 	spa_t *spa = zf->zf_dnode->dn_objset->os_spa;
-	krw_t rw = RW_READER;
 
 	if (zfs_prefetch_disable)
 		return;
@@ -236,63 +446,111 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
 	if (blkid == 0)
 		return;
 
-retry:
 	if (!have_lock)
 		rw_enter(&zf->zf_dnode->dn_struct_rwlock, RW_READER);
-	rw_enter(&zf->zf_rwlock, rw);
+	mutex_enter(&zf->zf_lock);
 
 	/*
 	 * Find matching prefetch stream.  Depending on whether the accesses
 	 * are block-aligned, first block of the new access may either follow
-	 * the last block of the previous access, or be equal to it.
+	 * the last block of the previous access, or be equal to it.  Strided
+	 * streams only match the exact start of the expected access.
 	 */
-	for (zs = list_head(&zf->zf_stream); zs != NULL;
-	    zs = list_next(&zf->zf_stream, zs)) {
-		if (blkid == zs->zs_blkid || blkid + 1 == zs->zs_blkid) {
-			mutex_enter(&zs->zs_lock);
-			/*
-			 * zs_blkid could have changed before we
-			 * acquired zs_lock; re-check them here.
-			 */
-			if (blkid == zs->zs_blkid) {
-				break;
-			} else if (blkid + 1 == zs->zs_blkid) {
-				blkid++;
-				nblks--;
-				if (nblks == 0) {
-					/* Already prefetched this before. */
-					mutex_exit(&zs->zs_lock);
-					rw_exit(&zf->zf_rwlock);
-					if (!have_lock) {
-						rw_exit(&zf->zf_dnode->
-						    dn_struct_rwlock);
-					}
-					return;
+	for (uint_t i = 0; i < zf->zf_nstreams; i++) {
+		zstream_t *s = &zf->zf_streams[i];
+
+		if (s->zs_atime == 0)
+			continue;
+		if (blkid == s->zs_blkid) {
+			zs = s;
+			break;
+		}
+		if (s->zs_stride == 0 && blkid + 1 == s->zs_blkid) {
+			blkid++;
+			nblks--;
+			if (nblks == 0) {
+				/* Already prefetched this before. */
+				mutex_exit(&zf->zf_lock);
+				if (!have_lock) {
+					rw_exit(&zf->zf_dnode->
+					    dn_struct_rwlock);
 				}
-				break;
+				return;
 			}
-			mutex_exit(&zs->zs_lock);
+			zs = s;
+			break;
 		}
 	}
 
 	if (zs == NULL) {
 		/*
-		 * This access is not part of any existing stream.  Create
-		 * a new stream for it.
+		 * This access is not part of any existing stream.  Either
+		 * it reveals the stride of a recent stream, or it starts a
+		 * new stream.
 		 */
 		ZFETCHSTAT_BUMP(zfetchstat_misses);
-		if (rw == RW_READER && !rw_tryupgrade(&zf->zf_rwlock)) {
-			rw_exit(&zf->zf_rwlock);
-			if (!have_lock)
-				rw_exit(&zf->zf_dnode->dn_struct_rwlock);
-			rw = RW_WRITER;
-			goto retry;
+		if (!dmu_zfetch_stream_restride(zf, blkid, nblks)) {
+			dmu_zfetch_stream_create(zf, end_of_access_blkid,
+			    blkid);
 		}
+		mutex_exit(&zf->zf_lock);
+		if (!have_lock)
+			rw_exit(&zf->zf_dnode->dn_struct_rwlock);
+		return;
+	}
 
-		dmu_zfetch_stream_create(zf, end_of_access_blkid);
-		rw_exit(&zf->zf_rwlock);
+	if (zs->zs_stride != 0) {
+		/*
+		 * A strided stream hit.  Prefetch the following accesses,
+		 * doubling the number of accesses ahead of the reader up to
+		 * the depth of the stream, which grows back by one for each
+		 * hit.  zs_pf_blkid is the start of the next access to
+		 * prefetch.
+		 */
+		int64_t ahead, target;
+
+		stride = zs->zs_stride;
+		max_blks = MAX(1, (zfetch_max_distance >>
+		    zf->zf_dnode->dn_datablkshift) / zs->zs_nblks);
+		zs->zs_depth = MIN(zs->zs_depth + 1, max_blks);
+
+		ahead = ((int64_t)(zs->zs_pf_blkid - blkid)) / stride;
+		used = (ahead > 0) ? MIN(zs->zs_nblks,
+		    zs->zs_pf_issued - zs->zs_pf_used) : 0;
+		ahead = MAX(0, ahead - 1);
+		target = MIN(2 * (ahead + 1), zs->zs_depth);
+		pf_start = blkid + (ahead + 1) * stride;
+		pf_nblks = fetch_data ? MAX(0, target - ahead) : 0;
+
+		/* don't prefetch before the start of the object */
+		if (stride < 0 && pf_nblks > 0)
+			pf_nblks = MIN(pf_nblks, (pf_start / -stride) + 1);
+		if (pf_start < 0)
+			pf_nblks = 0;
+
+		nblks = zs->zs_nblks;
+		zs->zs_pf_issued += pf_nblks * nblks;
+		zs->zs_pf_used += used;
+		zs->zs_pf_blkid = pf_start + pf_nblks * stride;
+		zs->zs_last_blkid = blkid;
+		zs->zs_blkid = (stride < 0 && (int64_t)blkid < -stride) ?
+		    UINT64_MAX : blkid + stride;
+		zs->zs_atime = gethrtime();
+		mutex_exit(&zf->zf_lock);
+
+		for (int i = 0; i < pf_nblks; i++) {
+			for (uint64_t j = 0; j < nblks; j++) {
+				dbuf_prefetch(zf->zf_dnode, 0,
+				    pf_start + i * stride + j,
+				    ZIO_PRIORITY_ASYNC_READ,
+				    ARC_FLAG_PREDICTIVE_PREFETCH);
+			}
+		}
+		dmu_zfetch_account(zf, pf_nblks * nblks, used);
 		if (!have_lock)
 			rw_exit(&zf->zf_dnode->dn_struct_rwlock);
+		ZFETCHSTAT_BUMP(zfetchstat_hits);
+		ZFETCHSTAT_BUMP(zfetchstat_stride_hits);
 		return;
 	}
 
@@ -308,6 +566,15 @@ retry:
 	 */
 	pf_start = MAX(zs->zs_pf_blkid, end_of_access_blkid);
 
+	/*
+	 * The blocks of this access below zs_pf_blkid were prefetched by
+	 * this stream.
+	 */
+	if (zs->zs_pf_blkid > blkid) {
+		used = MIN(MIN(end_of_access_blkid, zs->zs_pf_blkid) - blkid,
+		    zs->zs_pf_issued - zs->zs_pf_used);
+	}
+
 	/*
 	 * Double our amount of prefetched data, but don't let the
 	 * prefetch get further ahead than zfetch_max_distance.
@@ -329,6 +596,8 @@ retry:
 	}
 
 	zs->zs_pf_blkid = pf_start + pf_nblks;
+	zs->zs_pf_issued += MAX(pf_nblks, 0);
+	zs->zs_pf_used += used;
 
 	/*
 	 * Do the same for indirects, starting from where we stopped last,
@@ -354,9 +623,9 @@ retry:
 	ipf_iend = P2ROUNDUP(zs->zs_ipf_blkid, 1 << epbs) >> epbs;
 
 	zs->zs_atime = gethrtime();
+	zs->zs_last_blkid = blkid;
 	zs->zs_blkid = end_of_access_blkid;
-	mutex_exit(&zs->zs_lock);
-	rw_exit(&zf->zf_rwlock);
+	mutex_exit(&zf->zf_lock);
 
 	/*
 	 * dbuf_prefetch() is asynchronous (even when it needs to read
@@ -372,6 +641,7 @@ retry:
 		dbuf_prefetch(zf->zf_dnode, 1, iblk,
 		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
 	}
+	dmu_zfetch_account(zf, MAX(pf_nblks, 0), used);
 	if (!have_lock)
 		rw_exit(&zf->zf_dnode->dn_struct_rwlock);
 	ZFETCHSTAT_BUMP(zfetchstat_hits);
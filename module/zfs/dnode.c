@@ -55,6 +55,7 @@ dnode_stats_t dnode_stats = {
 	{ "dnode_hold_alloc_type_none",		KSTAT_DATA_UINT64 },
 	{ "dnode_hold_free_hits",		KSTAT_DATA_UINT64 },
 	{ "dnode_hold_free_misses",		KSTAT_DATA_UINT64 },
+	{ "dnode_hold_free_peek_misses",	KSTAT_DATA_UINT64 },
 	{ "dnode_hold_free_lock_misses",	KSTAT_DATA_UINT64 },
 	{ "dnode_hold_free_lock_retry",		KSTAT_DATA_UINT64 },
 	{ "dnode_hold_free_overflow",		KSTAT_DATA_UINT64 },
@@ -65,6 +66,7 @@ dnode_stats_t dnode_stats = {
 	{ "dnode_reallocate",			KSTAT_DATA_UINT64 },
 	{ "dnode_buf_evict",			KSTAT_DATA_UINT64 },
 	{ "dnode_alloc_next_chunk",		KSTAT_DATA_UINT64 },
+	{ "dnode_alloc_chunk_contended",	KSTAT_DATA_UINT64 },
 	{ "dnode_alloc_race",			KSTAT_DATA_UINT64 },
 	{ "dnode_alloc_next_block",		KSTAT_DATA_UINT64 },
 	{ "dnode_move_invalid",			KSTAT_DATA_UINT64 },
@@ -758,7 +760,7 @@ dnode_move_impl(dnode_t *odn, dnode_t *ndn)
 	ASSERT(!RW_LOCK_HELD(&odn->dn_struct_rwlock));
 	ASSERT(MUTEX_NOT_HELD(&odn->dn_mtx));
 	ASSERT(MUTEX_NOT_HELD(&odn->dn_dbufs_mtx));
-	ASSERT(!RW_LOCK_HELD(&odn->dn_zfetch.zf_rwlock));
+	ASSERT(MUTEX_NOT_HELD(&odn->dn_zfetch.zf_lock));
 
 	/* Copy fields. */
 	ndn->dn_objset = odn->dn_objset;
@@ -827,7 +829,10 @@ dnode_move_impl(dnode_t *odn, dnode_t *ndn)
 	ndn->dn_newprojid = odn->dn_newprojid;
 	ndn->dn_id_flags = odn->dn_id_flags;
 	dmu_zfetch_init(&ndn->dn_zfetch, NULL);
-	list_move_tail(&ndn->dn_zfetch.zf_stream, &odn->dn_zfetch.zf_stream);
+	ndn->dn_zfetch.zf_streams = odn->dn_zfetch.zf_streams;
+	ndn->dn_zfetch.zf_nstreams = odn->dn_zfetch.zf_nstreams;
+	odn->dn_zfetch.zf_streams = NULL;
+	odn->dn_zfetch.zf_nstreams = 0;
 	ndn->dn_zfetch.zf_dnode = odn->dn_zfetch.zf_dnode;
 
 	/*
@@ -1469,6 +1474,24 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag, int slots,
 			return (SET_ERROR(ENOSPC));
 		}
 
+		/*
+		 * Most misses are on slots that are plainly allocated, which
+		 * can be seen without touching the zrlocks of the slots.  A
+		 * stale value only costs the caller another attempt; a slot
+		 * that looks free or holds a dnode is checked below.
+		 */
+		for (int i = idx; i < idx + slots; i++) {
+			dnode_t *sdn = dnc->dnc_children[i].dnh_dnode;
+
+			if (sdn == DN_SLOT_ALLOCATED ||
+			    sdn == DN_SLOT_INTERIOR) {
+				DNODE_STAT_BUMP(dnode_hold_free_misses);
+				DNODE_STAT_BUMP(dnode_hold_free_peek_misses);
+				dbuf_rele(db, FTAG);
+				return (SET_ERROR(ENOSPC));
+			}
+		}
+
 		dnode_slots_hold(dnc, idx, slots);
 
 		if (!dnode_check_slots_free(dnc, idx, slots)) {
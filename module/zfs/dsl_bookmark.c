@@ -480,7 +480,7 @@ dsl_bookmark_fetch_props(dsl_pool_t *dp, zfs_bookmark_phys_t *bmark_phys,
 	ASSERT3P(dp, !=, NULL);
 	ASSERT3P(bmark_phys, !=, NULL);
 	ASSERT3P(out_props, !=, NULL);
-	ASSERT(RRW_LOCK_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_LOCK_HELD(&dp->dp_config_rwlock));
 
 	if (props == NULL || nvlist_exists(props,
 	    zfs_prop_to_name(ZFS_PROP_GUID))) {
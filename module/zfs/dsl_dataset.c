@@ -144,6 +144,7 @@ dsl_dataset_block_born(dsl_dataset_t *ds, const blkptr_t *bp, dmu_tx_t *tx)
 	}
 
 	ASSERT3U(bp->blk_birth, >, dsl_dataset_phys(ds)->ds_prev_snap_txg);
+	dsl_livelist_append_alloc(&ds->ds_dir->dd_livelist, bp);
 	dmu_buf_will_dirty(ds->ds_dbuf, tx);
 	mutex_enter(&ds->ds_lock);
 	delta = parent_delta(ds, used);
@@ -164,6 +165,13 @@ dsl_dataset_block_born(dsl_dataset_t *ds, const blkptr_t *bp, dmu_tx_t *tx)
 		ds->ds_feature_activation[f] = (void *)B_TRUE;
 	}
 
+	f = zio_compress_to_feature(BP_GET_COMPRESS(bp));
+	if (f != SPA_FEATURE_NONE) {
+		ASSERT3S(spa_feature_table[f].fi_type, ==,
+		    ZFEATURE_TYPE_BOOLEAN);
+		ds->ds_feature_activation[f] = (void *)B_TRUE;
+	}
+
 	mutex_exit(&ds->ds_lock);
 	dsl_dir_diduse_space(ds->ds_dir, DD_USED_HEAD, delta,
 	    compressed, uncompressed, tx);
@@ -244,6 +252,8 @@ dsl_dataset_block_kill(dsl_dataset_t *ds, const blkptr_t *bp, dmu_tx_t *tx,
 
 		dprintf_bp(bp, "freeing ds=%llu", ds->ds_object);
 		dsl_free(tx->tx_pool, tx->tx_txg, bp);
+		dsl_livelist_append_free(&ds->ds_dir->dd_livelist, bp,
+		    async, tx);
 
 		mutex_enter(&ds->ds_lock);
 		ASSERT(dsl_dataset_phys(ds)->ds_unique_bytes >= used ||
@@ -1190,6 +1200,10 @@ dsl_dataset_create_sync_dd(dsl_dir_t *dd, dsl_dataset_t *origin,
 			    dsl_dir_phys(origin->ds_dir)->dd_clones,
 			    dsobj, tx));
 		}
+
+		if (dsl_dir_is_clone(dd) &&
+		    spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LIVELIST))
+			dsl_dir_create_livelist(dd, tx);
 	}
 
 	/* handle encryption */
@@ -1630,7 +1644,7 @@ dsl_dataset_snapshot_sync_impl(dsl_dataset_t *ds, const char *snapname,
 	ASSERTV(static zil_header_t zero_zil);
 	ASSERTV(objset_t *os);
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 
 	/*
 	 * If we are on an old pool, the zil must not be active, in which
@@ -1647,6 +1661,9 @@ dsl_dataset_snapshot_sync_impl(dsl_dataset_t *ds, const char *snapname,
 
 	dsl_fs_ss_count_adjust(ds->ds_dir, 1, DD_FIELD_SNAPSHOT_COUNT, tx);
 
+	/* The blocks of a clone are no longer its own once snapshotted */
+	dsl_dir_remove_livelist(ds->ds_dir, B_FALSE, tx);
+
 	/*
 	 * The origin's ds_creation_txg has to be < TXG_INITIAL
 	 */
@@ -2062,6 +2079,8 @@ dsl_dataset_sync_done(dsl_dataset_t *ds, dmu_tx_t *tx)
 	bplist_iterate(&ds->ds_pending_deadlist,
 	    deadlist_enqueue_cb, &ds->ds_deadlist, tx);
 
+	dsl_livelist_sync(&ds->ds_dir->dd_livelist, tx);
+
 	dsl_bookmark_sync_done(ds, tx);
 
 	if (os->os_synced_dnodes != NULL) {
@@ -3366,6 +3385,10 @@ dsl_dataset_promote_sync(void *arg, dmu_tx_t *tx)
 
 	dsl_dataset_promote_crypt_sync(hds->ds_dir, odd, tx);
 
+	/* The blocks of the datasets are moving between the dirs */
+	dsl_dir_remove_livelist(dd, B_FALSE, tx);
+	dsl_dir_remove_livelist(odd, B_FALSE, tx);
+
 	/* change origin's next snap */
 	dmu_buf_will_dirty(origin_ds->ds_dbuf, tx);
 	oldnext_obj = dsl_dataset_phys(origin_ds)->ds_next_snap_obj;
@@ -3838,6 +3861,10 @@ dsl_dataset_clone_swap_sync_impl(dsl_dataset_t *clone,
 	    DMU_MAX_ACCESS * spa_asize_inflation);
 	ASSERT3P(clone->ds_prev, ==, origin_head->ds_prev);
 
+	/* The blocks of the datasets are swapped between the dirs */
+	dsl_dir_remove_livelist(clone->ds_dir, B_FALSE, tx);
+	dsl_dir_remove_livelist(origin_head->ds_dir, B_FALSE, tx);
+
 	/*
 	 * Swap per-dataset feature flags.
 	 */
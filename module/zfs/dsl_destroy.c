@@ -306,7 +306,7 @@ dsl_destroy_snapshot_sync_impl(dsl_dataset_t *ds, boolean_t defer, dmu_tx_t *tx)
 	dsl_dataset_t *ds_prev = NULL;
 	uint64_t obj;
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 	rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
 	ASSERT3U(dsl_dataset_phys(ds)->ds_bp.blk_birth, <=, tx->tx_txg);
 	rrw_exit(&ds->ds_bp_rwlock, FTAG);
@@ -579,6 +579,15 @@ dsl_destroy_snapshot_sync(void *arg, dmu_tx_t *tx)
  * On success, all snaps will be destroyed and this will return 0.
  * On failure, no snaps will be destroyed, the errlist will be filled in,
  * and this will return an errno.
+ *
+ * The snapshots are destroyed from the newest to the oldest.  When a range
+ * of consecutive snapshots is destroyed, the deadlist of each of them is
+ * then merged only once, directly into the snapshot (or head) that follows
+ * the range, and each block that dies with the range is moved to the
+ * pool's free bpobj once, to be freed in bulk by dsl_scan.  Destroying
+ * them from the oldest instead would merge the deadlist of the first
+ * snapshot into each of the following ones in turn, copying its block
+ * pointers again and again while its bpobjs are small.
  */
 int
 dsl_destroy_snapshots_nvl(nvlist_t *snaps, boolean_t defer,
@@ -632,7 +641,15 @@ dsl_destroy_snapshots_nvl(nvlist_t *snaps, boolean_t defer,
 	    "if has_errors then\n"
 	    "    return errors\n"
 	    "end\n"
+	    "sorted = { }\n"
+	    "txgs = { }\n"
 	    "for snap, v in pairs(snaps) do\n"
+	    "    sorted[#sorted + 1] = snap\n"
+	    "    txgs[snap] = zfs.get_prop(snap, 'createtxg')\n"
+	    "end\n"
+	    "table.sort(sorted,\n"
+	    "    function(a, b) return txgs[a] > txgs[b] end)\n"
+	    "for i, snap in ipairs(sorted) do\n"
 	    "    errno = zfs.sync.destroy{snap, defer=defer}\n"
 	    "    assert(errno == 0)\n"
 	    "end\n"
@@ -643,7 +660,9 @@ dsl_destroy_snapshots_nvl(nvlist_t *snaps, boolean_t defer,
 	    program,
 	    B_TRUE,
 	    0,
+	    0,
 	    zfs_lua_max_memlimit,
+	    NULL,
 	    nvlist_next_nvpair(wrapper, NULL), result);
 	if (error != 0) {
 		char *errorstr = NULL;
@@ -812,7 +831,7 @@ dsl_dir_destroy_sync(uint64_t ddobj, dmu_tx_t *tx)
 	objset_t *mos = dp->dp_meta_objset;
 	dd_used_t t;
 
-	ASSERT(RRW_WRITE_HELD(&dmu_tx_pool(tx)->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dmu_tx_pool(tx)->dp_config_rwlock));
 
 	VERIFY0(dsl_dir_hold_obj(dp, ddobj, NULL, FTAG, &dd));
 
@@ -866,7 +885,7 @@ dsl_destroy_head_sync_impl(dsl_dataset_t *ds, dmu_tx_t *tx)
 	rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
 	ASSERT3U(dsl_dataset_phys(ds)->ds_bp.blk_birth, <=, tx->tx_txg);
 	rrw_exit(&ds->ds_bp_rwlock, FTAG);
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 
 	/* We need to log before removing it from the namespace. */
 	spa_history_log_internal_ds(ds, "destroy", tx, " ");
@@ -927,7 +946,29 @@ dsl_destroy_head_sync_impl(dsl_dataset_t *ds, dmu_tx_t *tx)
 	objset_t *os;
 	VERIFY0(dmu_objset_from_ds(ds, &os));
 
-	if (!spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ASYNC_DESTROY)) {
+	if (dsl_livelist_is_open(&ds->ds_dir->dd_livelist)) {
+		/*
+		 * The blocks of the clone are freed from its livelist by
+		 * dsl_process_async_destroys(), without traversing it.
+		 */
+		uint64_t used, comp, uncomp;
+
+		zil_destroy_sync(dmu_objset_zil(os), tx);
+		dsl_dir_remove_livelist(ds->ds_dir, B_TRUE, tx);
+
+		used = dsl_dir_phys(ds->ds_dir)->dd_used_bytes;
+		comp = dsl_dir_phys(ds->ds_dir)->dd_compressed_bytes;
+		uncomp = dsl_dir_phys(ds->ds_dir)->dd_uncompressed_bytes;
+
+		ASSERT(!DS_UNIQUE_IS_ACCURATE(ds) ||
+		    dsl_dataset_phys(ds)->ds_unique_bytes == used);
+
+		dsl_dir_diduse_space(ds->ds_dir, DD_USED_HEAD,
+		    -used, -comp, -uncomp, tx);
+		dsl_dir_diduse_space(dp->dp_free_dir, DD_USED_HEAD,
+		    used, comp, uncomp, tx);
+	} else if (!spa_feature_is_enabled(dp->dp_spa,
+	    SPA_FEATURE_ASYNC_DESTROY)) {
 		old_synchronous_dataset_destroy(ds, tx);
 	} else {
 		/*
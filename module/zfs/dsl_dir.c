@@ -155,6 +155,9 @@ dsl_dir_evict_async(void *dbu)
 
 	spa_async_close(dd->dd_pool->dp_spa, dd);
 
+	if (dsl_livelist_is_open(&dd->dd_livelist))
+		dsl_livelist_close(&dd->dd_livelist);
+	dsl_livelist_fini(&dd->dd_livelist);
 	dsl_prop_fini(dd);
 	mutex_destroy(&dd->dd_lock);
 	kmem_free(dd, sizeof (dsl_dir_t));
@@ -167,6 +170,7 @@ dsl_dir_hold_obj(dsl_pool_t *dp, uint64_t ddobj,
 	dmu_buf_t *dbuf;
 	dsl_dir_t *dd;
 	dmu_object_info_t doi;
+	uint64_t llobj;
 	int err;
 
 	ASSERT(dsl_pool_config_held(dp));
@@ -205,6 +209,16 @@ dsl_dir_hold_obj(dsl_pool_t *dp, uint64_t ddobj,
 		mutex_init(&dd->dd_lock, NULL, MUTEX_DEFAULT, NULL);
 		dsl_prop_init(dd);
 
+		dsl_livelist_init(&dd->dd_livelist, ddobj);
+		if (dsl_dir_is_zapified(dd) &&
+		    zap_lookup(dp->dp_meta_objset, ddobj, DD_FIELD_LIVELIST,
+		    sizeof (uint64_t), 1, &llobj) == 0) {
+			err = dsl_livelist_open(&dd->dd_livelist,
+			    dp->dp_meta_objset, llobj);
+			if (err != 0)
+				goto errout;
+		}
+
 		dsl_dir_snap_cmtime_update(dd);
 
 		if (dsl_dir_phys(dd)->dd_parent_obj) {
@@ -263,6 +277,9 @@ dsl_dir_hold_obj(dsl_pool_t *dp, uint64_t ddobj,
 		if (winner != NULL) {
 			if (dd->dd_parent)
 				dsl_dir_rele(dd->dd_parent, dd);
+			if (dsl_livelist_is_open(&dd->dd_livelist))
+				dsl_livelist_close(&dd->dd_livelist);
+			dsl_livelist_fini(&dd->dd_livelist);
 			dsl_prop_fini(dd);
 			mutex_destroy(&dd->dd_lock);
 			kmem_free(dd, sizeof (dsl_dir_t));
@@ -291,6 +308,9 @@ dsl_dir_hold_obj(dsl_pool_t *dp, uint64_t ddobj,
 errout:
 	if (dd->dd_parent)
 		dsl_dir_rele(dd->dd_parent, dd);
+	if (dsl_livelist_is_open(&dd->dd_livelist))
+		dsl_livelist_close(&dd->dd_livelist);
+	dsl_livelist_fini(&dd->dd_livelist);
 	dsl_prop_fini(dd);
 	mutex_destroy(&dd->dd_lock);
 	kmem_free(dd, sizeof (dsl_dir_t));
@@ -2084,6 +2104,7 @@ dsl_dir_rename_sync(void *arg, dmu_tx_t *tx)
 	dsl_dir_phys(dd)->dd_parent_obj = newparent->dd_object;
 	VERIFY0(dsl_dir_hold_obj(dp,
 	    newparent->dd_object, NULL, dd, &dd->dd_parent));
+	dsl_prop_cache_invalidate(dp);
 
 	/* add to new parent zapobj */
 	VERIFY0(zap_add(mos, dsl_dir_phys(newparent)->dd_child_dir_zapobj,
@@ -2181,6 +2202,55 @@ dsl_dir_is_zapified(dsl_dir_t *dd)
 	return (doi.doi_type == DMU_OTN_ZAP_METADATA);
 }
 
+/*
+ * Starts tracking the blocks born and freed in the clone dd in a livelist,
+ * see dsl_livelist.c.
+ */
+void
+dsl_dir_create_livelist(dsl_dir_t *dd, dmu_tx_t *tx)
+{
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+	uint64_t obj;
+
+	ASSERT(dsl_dir_is_clone(dd));
+	ASSERT(!dsl_livelist_is_open(&dd->dd_livelist));
+
+	obj = dsl_livelist_alloc(mos, tx);
+	dsl_dir_zapify(dd, tx);
+	VERIFY0(zap_add(mos, dd->dd_object, DD_FIELD_LIVELIST,
+	    sizeof (obj), 1, &obj, tx));
+	spa_feature_incr(dd->dd_pool->dp_spa, SPA_FEATURE_LIVELIST, tx);
+	VERIFY0(dsl_livelist_open(&dd->dd_livelist, mos, obj));
+}
+
+/*
+ * Stops tracking the blocks of dd, if it has a livelist.  If the clone is
+ * being destroyed, its livelist is handed to the pool for its live blocks
+ * to be freed, otherwise it is freed.
+ */
+void
+dsl_dir_remove_livelist(dsl_dir_t *dd, boolean_t destroyed, dmu_tx_t *tx)
+{
+	objset_t *mos = dd->dd_pool->dp_meta_objset;
+	uint64_t obj = dd->dd_livelist.ll_object;
+
+	if (!dsl_livelist_is_open(&dd->dd_livelist))
+		return;
+
+	if (destroyed)
+		dsl_livelist_sync(&dd->dd_livelist, tx);
+	dsl_livelist_close(&dd->dd_livelist);
+	VERIFY0(zap_remove(mos, dd->dd_object, DD_FIELD_LIVELIST, tx));
+
+	if (destroyed) {
+		dsl_livelist_delete(dd->dd_pool, obj, tx);
+	} else {
+		dsl_livelist_free(mos, obj, tx);
+		spa_feature_decr(dd->dd_pool->dp_spa, SPA_FEATURE_LIVELIST,
+		    tx);
+	}
+}
+
 #if defined(_KERNEL)
 EXPORT_SYMBOL(dsl_dir_set_quota);
 EXPORT_SYMBOL(dsl_dir_set_reservation);
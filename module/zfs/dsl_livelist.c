@@ -0,0 +1,942 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/dmu.h>
+#include <sys/dmu_tx.h>
+#include <sys/zap.h>
+#include <sys/zfeature.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_dir.h>
+#include <sys/dsl_synctask.h>
+#include <sys/dsl_livelist.h>
+
+/*
+ * Livelists
+ *
+ * Without livelists, a destroyed clone is freed by traversing its block
+ * tree for the blocks born after its origin, see the bptree in
+ * dsl_destroy_head_sync_impl().  The traversal has to read every indirect
+ * block of the clone, including those it shares with the origin, so
+ * destroying a clone which changed a few blocks of a large dataset reads
+ * most of the metadata of the dataset.
+ *
+ * Instead, while a clone has no snapshots, the blocks born in it are
+ * appended to a livelist in its dsl_dir, and appended a second time when
+ * they are freed.  The live blocks of the clone are those appended once,
+ * so when the clone is destroyed its livelist is all that is needed to
+ * free them, without reading anything else.  The livelist is dropped when
+ * the clone is snapshotted, promoted, or swapped with another dataset by a
+ * receive or a rollback, since its blocks are then no longer its own, and
+ * the clone is destroyed by traversal as before.
+ *
+ * A livelist is split in sublists by birth txg, each of them a bpobj of
+ * the blocks born and a bpobj of the blocks freed.  A block and its free
+ * are always in the same sublist, so that the sublists can be processed
+ * one at a time, with memory bounded by their size.  A sublist is started
+ * in the first txg that the last one holds zfs_livelist_max_entries
+ * blocks.  Once zfs_livelist_condense_pct percent of the blocks of a
+ * sublist have been freed, the livelist condense zthr rewrites it with
+ * the blocks still live only, merging it with the next one if both are
+ * mostly freed, so that the livelist of a clone with a lot of churn stays
+ * proportional to its live blocks.
+ *
+ * On disk, a livelist is a ZAP from the first birth txg of each sublist,
+ * in hex, to the object numbers of its two bpobjs.  When a clone is
+ * destroyed its livelist is moved to the deleted clones ZAP of the pool,
+ * and dsl_process_async_destroys() frees the live blocks of one sublist
+ * at a time.
+ */
+
+/*
+ * Number of blocks born in the last sublist of a livelist before a new one
+ * is started.  This bounds the memory needed to condense or to free a
+ * sublist.
+ */
+int zfs_livelist_max_entries = 100000;
+
+/*
+ * Percentage of the blocks of a sublist which must have been freed for it
+ * to be condensed.
+ */
+int zfs_livelist_condense_pct = 50;
+
+/* Indices of the bpobjs of a sublist in its ZAP entry */
+#define	LIVELIST_ALLOCS		0
+#define	LIVELIST_FREES		1
+#define	LIVELIST_NBPOBJS	2
+
+/*
+ * A block freed, counted since the same block pointer may be allocated and
+ * freed more than once in a txg with dedup.  Blocks are compared by their
+ * first DVA, birth txg and properties, the latter for embedded blocks
+ * which have no DVA.
+ */
+typedef struct livelist_free {
+	avl_node_t	lf_node;
+	blkptr_t	lf_bp;
+	uint64_t	lf_count;
+} livelist_free_t;
+
+/* Cancels the blocks of a sublist with their frees */
+typedef struct livelist_cancel {
+	avl_tree_t	lcn_frees;
+	bplist_t	*lcn_live;	/* blocks not freed */
+} livelist_cancel_t;
+
+static int
+livelist_sublist_compare(const void *x1, const void *x2)
+{
+	const livelist_sublist_t *l1 = x1;
+	const livelist_sublist_t *l2 = x2;
+
+	return (AVL_CMP(l1->ls_mintxg, l2->ls_mintxg));
+}
+
+static int
+livelist_free_compare(const void *x1, const void *x2)
+{
+	const blkptr_t *bp1 = &((const livelist_free_t *)x1)->lf_bp;
+	const blkptr_t *bp2 = &((const livelist_free_t *)x2)->lf_bp;
+	int cmp;
+
+	cmp = AVL_CMP(DVA_GET_OFFSET(&bp1->blk_dva[0]),
+	    DVA_GET_OFFSET(&bp2->blk_dva[0]));
+	if (likely(cmp))
+		return (cmp);
+
+	cmp = AVL_CMP(DVA_GET_VDEV(&bp1->blk_dva[0]),
+	    DVA_GET_VDEV(&bp2->blk_dva[0]));
+	if (likely(cmp))
+		return (cmp);
+
+	cmp = AVL_CMP(bp1->blk_birth, bp2->blk_birth);
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_CMP(bp1->blk_prop, bp2->blk_prop));
+}
+
+static void
+livelist_sublist_name(uint64_t mintxg, char *name, size_t len)
+{
+	(void) snprintf(name, len, "%llx", (u_longlong_t)mintxg);
+}
+
+/*
+ * Calls func on the entries first to last - 1 of the bpobj obj.  The
+ * entries are read directly, so that this can be used in open context
+ * while the bpobj is appended to.
+ */
+static int
+livelist_bpobj_read(objset_t *os, uint64_t obj, uint64_t first,
+    uint64_t last, bpobj_itor_t func, void *arg, dmu_tx_t *tx)
+{
+	const uint64_t per_buf = SPA_OLD_MAXBLOCKSIZE / sizeof (blkptr_t);
+	blkptr_t *buf;
+	uint64_t i, j, n;
+	int err = 0;
+
+	buf = vmem_alloc(per_buf * sizeof (blkptr_t), KM_SLEEP);
+	for (i = first; err == 0 && i < last; i += n) {
+		n = MIN(per_buf, last - i);
+		err = dmu_read(os, obj, i * sizeof (blkptr_t),
+		    n * sizeof (blkptr_t), buf, DMU_READ_PREFETCH);
+		for (j = 0; err == 0 && j < n; j++)
+			err = func(arg, &buf[j], tx);
+	}
+	vmem_free(buf, per_buf * sizeof (blkptr_t));
+
+	return (err);
+}
+
+static int
+livelist_bpobj_count(objset_t *os, uint64_t obj, uint64_t *countp)
+{
+	bpobj_t bpo;
+	int err;
+
+	err = bpobj_open(&bpo, os, obj);
+	if (err != 0)
+		return (err);
+	*countp = bpo.bpo_phys->bpo_num_blkptrs;
+	bpobj_close(&bpo);
+
+	return (0);
+}
+
+static void
+livelist_cancel_init(livelist_cancel_t *lcn, bplist_t *live)
+{
+	avl_create(&lcn->lcn_frees, livelist_free_compare,
+	    sizeof (livelist_free_t), offsetof(livelist_free_t, lf_node));
+	lcn->lcn_live = live;
+}
+
+/*
+ * Destroys the frees left without their block, appending them to left
+ * unless it is NULL.
+ */
+static void
+livelist_cancel_fini(livelist_cancel_t *lcn, bplist_t *left)
+{
+	livelist_free_t *lf;
+	void *cookie = NULL;
+
+	while ((lf = avl_destroy_nodes(&lcn->lcn_frees, &cookie)) != NULL) {
+		while (left != NULL && lf->lf_count-- > 0)
+			bplist_append(left, &lf->lf_bp);
+		kmem_free(lf, sizeof (*lf));
+	}
+	avl_destroy(&lcn->lcn_frees);
+}
+
+/* ARGSUSED */
+static int
+livelist_cancel_add_free(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	livelist_cancel_t *lcn = arg;
+	livelist_free_t search, *lf;
+	avl_index_t where;
+
+	search.lf_bp = *bp;
+	lf = avl_find(&lcn->lcn_frees, &search, &where);
+	if (lf == NULL) {
+		lf = kmem_alloc(sizeof (*lf), KM_SLEEP);
+		lf->lf_bp = *bp;
+		lf->lf_count = 0;
+		avl_insert(&lcn->lcn_frees, lf, where);
+	}
+	lf->lf_count++;
+
+	return (0);
+}
+
+/* ARGSUSED */
+static int
+livelist_cancel_alloc(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	livelist_cancel_t *lcn = arg;
+	livelist_free_t search, *lf;
+
+	search.lf_bp = *bp;
+	lf = avl_find(&lcn->lcn_frees, &search, NULL);
+	if (lf == NULL) {
+		bplist_append(lcn->lcn_live, bp);
+	} else if (--lf->lf_count == 0) {
+		avl_remove(&lcn->lcn_frees, lf);
+		kmem_free(lf, sizeof (*lf));
+	}
+
+	return (0);
+}
+
+/*
+ * Appends the blocks of the sublist with the bpobjs objs which have not
+ * been freed to live.
+ */
+static int
+livelist_sublist_live(objset_t *os, const uint64_t *objs, bplist_t *live)
+{
+	livelist_cancel_t lcn;
+	uint64_t count;
+	int err;
+
+	livelist_cancel_init(&lcn, live);
+	err = livelist_bpobj_count(os, objs[LIVELIST_FREES], &count);
+	if (err == 0) {
+		err = livelist_bpobj_read(os, objs[LIVELIST_FREES], 0, count,
+		    livelist_cancel_add_free, &lcn, NULL);
+	}
+	if (err == 0)
+		err = livelist_bpobj_count(os, objs[LIVELIST_ALLOCS], &count);
+	if (err == 0) {
+		err = livelist_bpobj_read(os, objs[LIVELIST_ALLOCS], 0, count,
+		    livelist_cancel_alloc, &lcn, NULL);
+	}
+	livelist_cancel_fini(&lcn, NULL);
+
+	return (err);
+}
+
+static int
+livelist_enqueue_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	bpobj_enqueue(arg, bp, tx);
+	return (0);
+}
+
+void
+dsl_livelist_init(dsl_livelist_t *ll, uint64_t dir_obj)
+{
+	mutex_init(&ll->ll_lock, NULL, MUTEX_DEFAULT, NULL);
+	ll->ll_dir_obj = dir_obj;
+	ll->ll_os = NULL;
+	ll->ll_object = 0;
+	avl_create(&ll->ll_sublists, livelist_sublist_compare,
+	    sizeof (livelist_sublist_t), offsetof(livelist_sublist_t, ls_node));
+	bplist_create(&ll->ll_pending_allocs);
+	bplist_create(&ll->ll_pending_frees);
+}
+
+void
+dsl_livelist_fini(dsl_livelist_t *ll)
+{
+	ASSERT(!dsl_livelist_is_open(ll));
+
+	bplist_destroy(&ll->ll_pending_allocs);
+	bplist_destroy(&ll->ll_pending_frees);
+	avl_destroy(&ll->ll_sublists);
+	mutex_destroy(&ll->ll_lock);
+}
+
+/* Allocates the bpobjs of a sublist starting at mintxg on disk */
+static void
+livelist_sublist_alloc(objset_t *os, uint64_t obj, uint64_t mintxg,
+    uint64_t *objs, dmu_tx_t *tx)
+{
+	char name[32];
+
+	objs[LIVELIST_ALLOCS] = bpobj_alloc(os, SPA_OLD_MAXBLOCKSIZE, tx);
+	objs[LIVELIST_FREES] = bpobj_alloc(os, SPA_OLD_MAXBLOCKSIZE, tx);
+	livelist_sublist_name(mintxg, name, sizeof (name));
+	VERIFY0(zap_add(os, obj, name, sizeof (uint64_t), LIVELIST_NBPOBJS,
+	    objs, tx));
+}
+
+static int
+livelist_sublist_open(dsl_livelist_t *ll, uint64_t mintxg,
+    const uint64_t *objs)
+{
+	livelist_sublist_t *ls;
+	int err;
+
+	ls = kmem_zalloc(sizeof (livelist_sublist_t), KM_SLEEP);
+	ls->ls_mintxg = mintxg;
+	err = bpobj_open(&ls->ls_allocs, ll->ll_os, objs[LIVELIST_ALLOCS]);
+	if (err != 0) {
+		kmem_free(ls, sizeof (livelist_sublist_t));
+		return (err);
+	}
+	err = bpobj_open(&ls->ls_frees, ll->ll_os, objs[LIVELIST_FREES]);
+	if (err != 0) {
+		bpobj_close(&ls->ls_allocs);
+		kmem_free(ls, sizeof (livelist_sublist_t));
+		return (err);
+	}
+	avl_add(&ll->ll_sublists, ls);
+
+	return (0);
+}
+
+static void
+livelist_sublist_close(dsl_livelist_t *ll, livelist_sublist_t *ls)
+{
+	avl_remove(&ll->ll_sublists, ls);
+	bpobj_close(&ls->ls_allocs);
+	bpobj_close(&ls->ls_frees);
+	kmem_free(ls, sizeof (livelist_sublist_t));
+}
+
+uint64_t
+dsl_livelist_alloc(objset_t *os, dmu_tx_t *tx)
+{
+	uint64_t obj, objs[LIVELIST_NBPOBJS];
+
+	obj = zap_create(os, DMU_OTN_ZAP_METADATA, DMU_OT_NONE, 0, tx);
+	livelist_sublist_alloc(os, obj, 0, objs, tx);
+
+	return (obj);
+}
+
+void
+dsl_livelist_free(objset_t *os, uint64_t obj, dmu_tx_t *tx)
+{
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	uint64_t objs[LIVELIST_NBPOBJS];
+
+	for (zap_cursor_init(&zc, os, obj);
+	    zap_cursor_retrieve(&zc, &za) == 0;
+	    zap_cursor_advance(&zc)) {
+		VERIFY0(zap_lookup(os, obj, za.za_name, sizeof (uint64_t),
+		    LIVELIST_NBPOBJS, objs));
+		bpobj_free(os, objs[LIVELIST_ALLOCS], tx);
+		bpobj_free(os, objs[LIVELIST_FREES], tx);
+	}
+	zap_cursor_fini(&zc);
+	VERIFY0(zap_destroy(os, obj, tx));
+}
+
+int
+dsl_livelist_open(dsl_livelist_t *ll, objset_t *os, uint64_t obj)
+{
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	uint64_t objs[LIVELIST_NBPOBJS];
+	int err;
+
+	ASSERT(!dsl_livelist_is_open(ll));
+
+	mutex_enter(&ll->ll_lock);
+	ll->ll_os = os;
+	ll->ll_object = obj;
+	for (zap_cursor_init(&zc, os, obj);
+	    (err = zap_cursor_retrieve(&zc, &za)) == 0;
+	    zap_cursor_advance(&zc)) {
+		err = zap_lookup(os, obj, za.za_name, sizeof (uint64_t),
+		    LIVELIST_NBPOBJS, objs);
+		if (err == 0) {
+			err = livelist_sublist_open(ll,
+			    zfs_strtonum(za.za_name, NULL), objs);
+		}
+		if (err != 0)
+			break;
+	}
+	zap_cursor_fini(&zc);
+	mutex_exit(&ll->ll_lock);
+
+	if (err != ENOENT) {
+		dsl_livelist_close(ll);
+		return (err);
+	}
+	VERIFY0(((livelist_sublist_t *)avl_first(&ll->ll_sublists))->ls_mintxg);
+
+	return (0);
+}
+
+void
+dsl_livelist_close(dsl_livelist_t *ll)
+{
+	livelist_sublist_t *ls;
+
+	bplist_clear(&ll->ll_pending_allocs);
+	bplist_clear(&ll->ll_pending_frees);
+
+	mutex_enter(&ll->ll_lock);
+	while ((ls = avl_first(&ll->ll_sublists)) != NULL)
+		livelist_sublist_close(ll, ls);
+	ll->ll_os = NULL;
+	ll->ll_object = 0;
+	mutex_exit(&ll->ll_lock);
+}
+
+boolean_t
+dsl_livelist_is_open(dsl_livelist_t *ll)
+{
+	return (ll->ll_object != 0);
+}
+
+/* Returns the sublist of the blocks born in txg */
+static livelist_sublist_t *
+livelist_sublist_find(dsl_livelist_t *ll, uint64_t txg)
+{
+	livelist_sublist_t search, *ls;
+	avl_index_t where;
+
+	search.ls_mintxg = txg;
+	ls = avl_find(&ll->ll_sublists, &search, &where);
+	if (ls == NULL)
+		ls = avl_nearest(&ll->ll_sublists, where, AVL_BEFORE);
+	ASSERT3P(ls, !=, NULL);
+
+	return (ls);
+}
+
+static void
+livelist_condense_request(dsl_livelist_t *ll, livelist_sublist_t *ls)
+{
+	spa_t *spa = dmu_objset_spa(ll->ll_os);
+	spa_livelist_condense_t *lc = &spa->spa_livelist_to_condense;
+	uint64_t allocs = ls->ls_allocs.bpo_phys->bpo_num_blkptrs;
+	uint64_t frees = ls->ls_frees.bpo_phys->bpo_num_blkptrs;
+
+	if (lc->lc_dir_obj != 0 || spa->spa_livelist_condense_zthr == NULL)
+		return;
+	if (frees < zfs_livelist_max_entries / 100 ||
+	    frees * 100 < allocs * zfs_livelist_condense_pct)
+		return;
+
+	lc->lc_mintxg = ls->ls_mintxg;
+	membar_producer();
+	lc->lc_dir_obj = ll->ll_dir_obj;
+	zthr_wakeup(spa->spa_livelist_condense_zthr);
+}
+
+static int
+livelist_flush_alloc_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	dsl_livelist_t *ll = arg;
+
+	bpobj_enqueue(&livelist_sublist_find(ll, bp->blk_birth)->ls_allocs,
+	    bp, tx);
+	return (0);
+}
+
+static int
+livelist_flush_free_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	dsl_livelist_t *ll = arg;
+	livelist_sublist_t *ls = livelist_sublist_find(ll, bp->blk_birth);
+
+	bpobj_enqueue(&ls->ls_frees, bp, tx);
+	livelist_condense_request(ll, ls);
+	return (0);
+}
+
+void
+dsl_livelist_append_alloc(dsl_livelist_t *ll, const blkptr_t *bp)
+{
+	if (dsl_livelist_is_open(ll))
+		bplist_append(&ll->ll_pending_allocs, bp);
+}
+
+/*
+ * Blocks freed from the zio callbacks, or born in this txg and so possibly
+ * not yet in their sublist, are appended in dsl_livelist_sync().  Others
+ * are appended now, since dsl_livelist_sync() may already have run.
+ */
+void
+dsl_livelist_append_free(dsl_livelist_t *ll, const blkptr_t *bp,
+    boolean_t async, dmu_tx_t *tx)
+{
+	if (!dsl_livelist_is_open(ll))
+		return;
+
+	if (async || bp->blk_birth == dmu_tx_get_txg(tx)) {
+		bplist_append(&ll->ll_pending_frees, bp);
+	} else {
+		mutex_enter(&ll->ll_lock);
+		(void) livelist_flush_free_cb(ll, bp, tx);
+		mutex_exit(&ll->ll_lock);
+	}
+}
+
+/*
+ * Appends the blocks born and freed in the txg to their sublists, first
+ * starting a sublist for the txg if the last one is full.
+ */
+void
+dsl_livelist_sync(dsl_livelist_t *ll, dmu_tx_t *tx)
+{
+	livelist_sublist_t *last;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	uint64_t objs[LIVELIST_NBPOBJS];
+
+	if (!dsl_livelist_is_open(ll))
+		return;
+
+	mutex_enter(&ll->ll_lock);
+	last = avl_last(&ll->ll_sublists);
+	if (last->ls_allocs.bpo_phys->bpo_num_blkptrs >=
+	    zfs_livelist_max_entries && last->ls_mintxg < txg) {
+		livelist_sublist_alloc(ll->ll_os, ll->ll_object, txg, objs, tx);
+		VERIFY0(livelist_sublist_open(ll, txg, objs));
+	}
+	bplist_iterate(&ll->ll_pending_allocs, livelist_flush_alloc_cb, ll, tx);
+	bplist_iterate(&ll->ll_pending_frees, livelist_flush_free_cb, ll, tx);
+	mutex_exit(&ll->ll_lock);
+}
+
+/*
+ * Queues the livelist of a destroyed clone for its live blocks to be
+ * freed by dsl_process_async_destroys().
+ */
+void
+dsl_livelist_delete(dsl_pool_t *dp, uint64_t obj, dmu_tx_t *tx)
+{
+	objset_t *mos = dp->dp_meta_objset;
+
+	if (dp->dp_deleted_clones_obj == 0) {
+		dp->dp_deleted_clones_obj = zap_create(mos,
+		    DMU_OTN_ZAP_METADATA, DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_DELETED_CLONES, sizeof (uint64_t), 1,
+		    &dp->dp_deleted_clones_obj, tx));
+	}
+	VERIFY0(zap_add_int(mos, dp->dp_deleted_clones_obj, obj, tx));
+}
+
+boolean_t
+dsl_livelist_deleting(dsl_pool_t *dp)
+{
+	return (dp->dp_deleted_clones_obj != 0);
+}
+
+/*
+ * Calls func on the live blocks of one sublist of a deleted livelist and
+ * frees the sublist.  Returns ENOENT once all of them have been freed.
+ */
+int
+dsl_livelist_delete_sublist(dsl_pool_t *dp, bpobj_itor_t func, void *arg,
+    dmu_tx_t *tx)
+{
+	objset_t *mos = dp->dp_meta_objset;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	uint64_t obj, objs[LIVELIST_NBPOBJS];
+	bplist_t live;
+	int err;
+
+	if (dp->dp_deleted_clones_obj == 0)
+		return (SET_ERROR(ENOENT));
+
+	zap_cursor_init(&zc, mos, dp->dp_deleted_clones_obj);
+	err = zap_cursor_retrieve(&zc, &za);
+	zap_cursor_fini(&zc);
+	if (err == ENOENT) {
+		VERIFY0(zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_DELETED_CLONES, tx));
+		VERIFY0(zap_destroy(mos, dp->dp_deleted_clones_obj, tx));
+		dp->dp_deleted_clones_obj = 0;
+		return (SET_ERROR(ENOENT));
+	} else if (err != 0) {
+		return (err);
+	}
+	obj = za.za_first_integer;
+
+	zap_cursor_init(&zc, mos, obj);
+	err = zap_cursor_retrieve(&zc, &za);
+	zap_cursor_fini(&zc);
+	if (err == ENOENT) {
+		VERIFY0(zap_destroy(mos, obj, tx));
+		VERIFY0(zap_remove_int(mos, dp->dp_deleted_clones_obj,
+		    obj, tx));
+		spa_feature_decr(dp->dp_spa, SPA_FEATURE_LIVELIST, tx);
+		return (0);
+	} else if (err != 0) {
+		return (err);
+	}
+
+	err = zap_lookup(mos, obj, za.za_name, sizeof (uint64_t),
+	    LIVELIST_NBPOBJS, objs);
+	if (err != 0)
+		return (err);
+
+	/*
+	 * Nothing is freed until the whole sublist has been read, so that
+	 * it can be retried after an error.
+	 */
+	bplist_create(&live);
+	err = livelist_sublist_live(mos, objs, &live);
+	if (err == 0)
+		bplist_iterate(&live, func, arg, tx);
+	bplist_clear(&live);
+	bplist_destroy(&live);
+	if (err != 0)
+		return (err);
+
+	bpobj_free(mos, objs[LIVELIST_ALLOCS], tx);
+	bpobj_free(mos, objs[LIVELIST_FREES], tx);
+	VERIFY0(zap_remove(mos, obj, za.za_name, tx));
+
+	return (0);
+}
+
+/* Calls func on the blocks of the deleted livelists not yet freed */
+int
+dsl_livelist_iterate_deleted(dsl_pool_t *dp, bpobj_itor_t func, void *arg)
+{
+	objset_t *mos = dp->dp_meta_objset;
+	zap_cursor_t zc, llzc;
+	zap_attribute_t za, llza;
+	uint64_t objs[LIVELIST_NBPOBJS];
+	bplist_t live;
+	int err = 0;
+
+	if (dp->dp_deleted_clones_obj == 0)
+		return (0);
+
+	bplist_create(&live);
+	for (zap_cursor_init(&zc, mos, dp->dp_deleted_clones_obj);
+	    err == 0 && zap_cursor_retrieve(&zc, &za) == 0;
+	    zap_cursor_advance(&zc)) {
+		for (zap_cursor_init(&llzc, mos, za.za_first_integer);
+		    err == 0 && zap_cursor_retrieve(&llzc, &llza) == 0;
+		    zap_cursor_advance(&llzc)) {
+			err = zap_lookup(mos, za.za_first_integer,
+			    llza.za_name, sizeof (uint64_t),
+			    LIVELIST_NBPOBJS, objs);
+			if (err == 0)
+				err = livelist_sublist_live(mos, objs, &live);
+			if (err == 0)
+				bplist_iterate(&live, func, arg, NULL);
+			bplist_clear(&live);
+		}
+		zap_cursor_fini(&llzc);
+	}
+	zap_cursor_fini(&zc);
+	bplist_destroy(&live);
+
+	return (err);
+}
+
+/*
+ * The sublists to condense, as of when the livelist condense zthr looked
+ * at them in open context.  Entries appended since are copied as they are.
+ */
+typedef struct livelist_condense_arg {
+	uint64_t	lca_dir_obj;
+	uint64_t	lca_ll_obj;
+	uint64_t	lca_mintxg[2];
+	uint64_t	lca_objs[2][LIVELIST_NBPOBJS];
+	uint64_t	lca_counts[2][LIVELIST_NBPOBJS];
+	int		lca_nsublists;
+	bplist_t	lca_allocs;	/* blocks not freed */
+	bplist_t	lca_frees;	/* frees without their block */
+} livelist_condense_arg_t;
+
+static int
+livelist_condense_hold(dsl_pool_t *dp, uint64_t obj, void *tag,
+    dsl_dir_t **ddp)
+{
+	dmu_object_info_t doi;
+	int err;
+
+	/* The clone may have been destroyed and its object reused */
+	err = dmu_object_info(dp->dp_meta_objset, obj, &doi);
+	if (err != 0)
+		return (err);
+	if (doi.doi_bonus_type != DMU_OT_DSL_DIR)
+		return (SET_ERROR(ENOENT));
+
+	return (dsl_dir_hold_obj(dp, obj, NULL, tag, ddp));
+}
+
+static uint64_t
+livelist_sublist_nlive(livelist_sublist_t *ls)
+{
+	uint64_t allocs = ls->ls_allocs.bpo_phys->bpo_num_blkptrs;
+	uint64_t frees = ls->ls_frees.bpo_phys->bpo_num_blkptrs;
+
+	return (allocs - MIN(allocs, frees));
+}
+
+static void
+livelist_condense_save(livelist_condense_arg_t *lca, livelist_sublist_t *ls)
+{
+	int i = lca->lca_nsublists++;
+
+	lca->lca_mintxg[i] = ls->ls_mintxg;
+	lca->lca_objs[i][LIVELIST_ALLOCS] = ls->ls_allocs.bpo_object;
+	lca->lca_objs[i][LIVELIST_FREES] = ls->ls_frees.bpo_object;
+	lca->lca_counts[i][LIVELIST_ALLOCS] =
+	    ls->ls_allocs.bpo_phys->bpo_num_blkptrs;
+	lca->lca_counts[i][LIVELIST_FREES] =
+	    ls->ls_frees.bpo_phys->bpo_num_blkptrs;
+}
+
+static boolean_t
+livelist_condense_saved(livelist_condense_arg_t *lca, int i,
+    livelist_sublist_t *ls)
+{
+	return (ls != NULL && ls->ls_mintxg == lca->lca_mintxg[i] &&
+	    ls->ls_allocs.bpo_object == lca->lca_objs[i][LIVELIST_ALLOCS] &&
+	    ls->ls_frees.bpo_object == lca->lca_objs[i][LIVELIST_FREES]);
+}
+
+/*
+ * Picks the sublists to condense and cancels the blocks freed in them, in
+ * open context.
+ */
+static int
+livelist_condense_prepare(dsl_pool_t *dp, livelist_condense_arg_t *lca,
+    zthr_t *zthr)
+{
+	objset_t *mos = dp->dp_meta_objset;
+	livelist_sublist_t search, *ls, *next;
+	livelist_cancel_t lcn;
+	dsl_livelist_t *ll;
+	dsl_dir_t *dd;
+	int i, err;
+
+	dsl_pool_config_enter(dp, FTAG);
+	err = livelist_condense_hold(dp, lca->lca_dir_obj, FTAG, &dd);
+	if (err != 0) {
+		dsl_pool_config_exit(dp, FTAG);
+		return (err);
+	}
+	ll = &dd->dd_livelist;
+	mutex_enter(&ll->ll_lock);
+	search.ls_mintxg = lca->lca_mintxg[0];
+	ls = avl_find(&ll->ll_sublists, &search, NULL);
+	if (ls == NULL) {
+		err = SET_ERROR(ENOENT);
+	} else {
+		lca->lca_ll_obj = ll->ll_object;
+		livelist_condense_save(lca, ls);
+		next = AVL_NEXT(&ll->ll_sublists, ls);
+		if (next != NULL && livelist_sublist_nlive(ls) +
+		    livelist_sublist_nlive(next) <=
+		    zfs_livelist_max_entries / 2)
+			livelist_condense_save(lca, next);
+	}
+	mutex_exit(&ll->ll_lock);
+	dsl_dir_rele(dd, FTAG);
+	dsl_pool_config_exit(dp, FTAG);
+	if (err != 0)
+		return (err);
+
+	livelist_cancel_init(&lcn, &lca->lca_allocs);
+	for (i = 0; err == 0 && i < lca->lca_nsublists; i++) {
+		err = livelist_bpobj_read(mos, lca->lca_objs[i][LIVELIST_FREES],
+		    0, lca->lca_counts[i][LIVELIST_FREES],
+		    livelist_cancel_add_free, &lcn, NULL);
+	}
+	for (i = 0; err == 0 && i < lca->lca_nsublists; i++) {
+		if (zthr_iscancelled(zthr))
+			err = SET_ERROR(EINTR);
+		else
+			err = livelist_bpobj_read(mos,
+			    lca->lca_objs[i][LIVELIST_ALLOCS], 0,
+			    lca->lca_counts[i][LIVELIST_ALLOCS],
+			    livelist_cancel_alloc, &lcn, NULL);
+	}
+	livelist_cancel_fini(&lcn, &lca->lca_frees);
+
+	return (err);
+}
+
+/*
+ * Replaces the bpobjs of the first sublist with ones holding the blocks
+ * not freed, and removes the second one if it was merged into it.  This is
+ * skipped if the sublists changed since they were read.
+ */
+static void
+livelist_condense_sync(void *arg, dmu_tx_t *tx)
+{
+	livelist_condense_arg_t *lca = arg;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	objset_t *mos = dp->dp_meta_objset;
+	livelist_sublist_t search, *ls[2];
+	dsl_livelist_t *ll;
+	dsl_dir_t *dd;
+	bpobj_t allocs, frees;
+	uint64_t objs[LIVELIST_NBPOBJS];
+	char name[32];
+	int i;
+
+	if (livelist_condense_hold(dp, lca->lca_dir_obj, FTAG, &dd) != 0)
+		return;
+	ll = &dd->dd_livelist;
+	mutex_enter(&ll->ll_lock);
+
+	search.ls_mintxg = lca->lca_mintxg[0];
+	ls[0] = (ll->ll_object == lca->lca_ll_obj) ?
+	    avl_find(&ll->ll_sublists, &search, NULL) : NULL;
+	ls[1] = (ls[0] != NULL) ? AVL_NEXT(&ll->ll_sublists, ls[0]) : NULL;
+	for (i = 0; i < lca->lca_nsublists; i++) {
+		if (!livelist_condense_saved(lca, i, ls[i])) {
+			mutex_exit(&ll->ll_lock);
+			dsl_dir_rele(dd, FTAG);
+			return;
+		}
+	}
+
+	objs[LIVELIST_ALLOCS] = bpobj_alloc(mos, SPA_OLD_MAXBLOCKSIZE, tx);
+	objs[LIVELIST_FREES] = bpobj_alloc(mos, SPA_OLD_MAXBLOCKSIZE, tx);
+	VERIFY0(bpobj_open(&allocs, mos, objs[LIVELIST_ALLOCS]));
+	VERIFY0(bpobj_open(&frees, mos, objs[LIVELIST_FREES]));
+	bplist_iterate(&lca->lca_allocs, livelist_enqueue_cb, &allocs, tx);
+	bplist_iterate(&lca->lca_frees, livelist_enqueue_cb, &frees, tx);
+	for (i = 0; i < lca->lca_nsublists; i++) {
+		VERIFY0(livelist_bpobj_read(mos, ls[i]->ls_allocs.bpo_object,
+		    lca->lca_counts[i][LIVELIST_ALLOCS],
+		    ls[i]->ls_allocs.bpo_phys->bpo_num_blkptrs,
+		    livelist_enqueue_cb, &allocs, tx));
+		VERIFY0(livelist_bpobj_read(mos, ls[i]->ls_frees.bpo_object,
+		    lca->lca_counts[i][LIVELIST_FREES],
+		    ls[i]->ls_frees.bpo_phys->bpo_num_blkptrs,
+		    livelist_enqueue_cb, &frees, tx));
+	}
+	bpobj_close(&allocs);
+	bpobj_close(&frees);
+
+	for (i = lca->lca_nsublists - 1; i >= 0; i--) {
+		livelist_sublist_name(ls[i]->ls_mintxg, name, sizeof (name));
+		bpobj_free(mos, ls[i]->ls_allocs.bpo_object, tx);
+		bpobj_free(mos, ls[i]->ls_frees.bpo_object, tx);
+		livelist_sublist_close(ll, ls[i]);
+		if (i > 0)
+			VERIFY0(zap_remove(mos, ll->ll_object, name, tx));
+	}
+	VERIFY0(zap_update(mos, ll->ll_object, name, sizeof (uint64_t),
+	    LIVELIST_NBPOBJS, objs, tx));
+	VERIFY0(livelist_sublist_open(ll, lca->lca_mintxg[0], objs));
+
+	mutex_exit(&ll->ll_lock);
+	dsl_dir_rele(dd, FTAG);
+}
+
+/* ARGSUSED */
+boolean_t
+spa_livelist_condense_thread_check(void *arg, zthr_t *zthr)
+{
+	spa_t *spa = arg;
+
+	return (spa->spa_livelist_to_condense.lc_dir_obj != 0);
+}
+
+void
+spa_livelist_condense_thread(void *arg, zthr_t *zthr)
+{
+	spa_t *spa = arg;
+	spa_livelist_condense_t *lc = &spa->spa_livelist_to_condense;
+	livelist_condense_arg_t lca;
+	int err;
+
+	bzero(&lca, sizeof (lca));
+	lca.lca_dir_obj = lc->lc_dir_obj;
+	membar_consumer();
+	lca.lca_mintxg[0] = lc->lc_mintxg;
+	bplist_create(&lca.lca_allocs);
+	bplist_create(&lca.lca_frees);
+
+	err = livelist_condense_prepare(spa_get_dsl(spa), &lca, zthr);
+	if (err == 0) {
+		err = dsl_sync_task(spa_name(spa), NULL,
+		    livelist_condense_sync, &lca, 0, ZFS_SPACE_CHECK_NONE);
+	}
+	if (err != 0 && err != ENOENT && err != EINTR) {
+		zfs_dbgmsg("livelist condense of dir %llu txg %llu "
+		    "failed with error %d", (u_longlong_t)lca.lca_dir_obj,
+		    (u_longlong_t)lca.lca_mintxg[0], err);
+	}
+
+	bplist_clear(&lca.lca_allocs);
+	bplist_clear(&lca.lca_frees);
+	bplist_destroy(&lca.lca_allocs);
+	bplist_destroy(&lca.lca_frees);
+
+	/* Retried once resumed if cancelled */
+	if (err != EINTR)
+		lc->lc_dir_obj = 0;
+}
+
+#if defined(_KERNEL)
+ZFS_MODULE_PARAM(zfs_livelist, zfs_livelist_, max_entries, INT, ZMOD_RW,
+	"Blocks born in a livelist sublist before a new one is started");
+
+ZFS_MODULE_PARAM(zfs_livelist, zfs_livelist_, condense_pct, INT, ZMOD_RW,
+	"Percentage of the blocks of a livelist sublist freed to condense it");
+#endif
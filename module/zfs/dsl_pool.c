@@ -115,6 +115,17 @@ int zfs_dirty_data_max_max_percent = 25;
  */
 int zfs_dirty_data_sync_percent = 20;
 
+/*
+ * When set, the dirty data limit of each pool adapts to its write
+ * bandwidth: it is sized to the dirty data which the pool was measured to
+ * sync in this many milliseconds, but never more than zfs_dirty_data_max.
+ * All the thresholds which are percentages of zfs_dirty_data_max, those of
+ * the write throttle and of the I/O scheduler in particular, are then
+ * relative to the pool's limit instead, see dsl_pool_dirty_max().  Zero
+ * disables.
+ */
+int zfs_dirty_data_target_ms = 0;
+
 /*
  * Once there is this amount of dirty data, the dmu_tx_delay() will kick in
  * and delay each transaction.
@@ -196,7 +207,7 @@ dsl_pool_open_impl(spa_t *spa, uint64_t txg)
 	dp = kmem_zalloc(sizeof (dsl_pool_t), KM_SLEEP);
 	dp->dp_spa = spa;
 	dp->dp_meta_rootbp = *bp;
-	rrw_init(&dp->dp_config_rwlock, B_TRUE);
+	rrm_init(&dp->dp_config_rwlock, B_TRUE);
 	txg_init(dp, txg);
 	mmp_init(spa);
 
@@ -270,7 +281,7 @@ dsl_pool_open(dsl_pool_t *dp)
 	dsl_dataset_t *ds;
 	uint64_t obj;
 
-	rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+	rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
 	    DMU_POOL_ROOT_DATASET, sizeof (uint64_t), 1,
 	    &dp->dp_root_dir_obj);
@@ -356,6 +367,16 @@ dsl_pool_open(dsl_pool_t *dp)
 			goto out;
 	}
 
+	if (spa_feature_is_active(dp->dp_spa, SPA_FEATURE_LIVELIST)) {
+		err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_DELETED_CLONES, sizeof (uint64_t), 1,
+		    &dp->dp_deleted_clones_obj);
+		if (err == ENOENT)
+			err = 0;
+		else if (err != 0)
+			goto out;
+	}
+
 	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
 	    DMU_POOL_TMP_USERREFS, sizeof (uint64_t), 1,
 	    &dp->dp_tmp_userrefs_obj);
@@ -367,7 +388,7 @@ dsl_pool_open(dsl_pool_t *dp)
 	err = dsl_scan_init(dp, dp->dp_tx.tx_open_txg);
 
 out:
-	rrw_exit(&dp->dp_config_rwlock, FTAG);
+	rrm_exit(&dp->dp_config_rwlock, FTAG);
 	return (err);
 }
 
@@ -421,7 +442,7 @@ dsl_pool_close(dsl_pool_t *dp)
 	dsl_scan_fini(dp);
 	dmu_buf_user_evict_wait();
 
-	rrw_destroy(&dp->dp_config_rwlock);
+	rrm_destroy(&dp->dp_config_rwlock);
 	mutex_destroy(&dp->dp_lock);
 	cv_destroy(&dp->dp_spaceavail_cv);
 	taskq_destroy(dp->dp_unlinked_drain_taskq);
@@ -477,7 +498,7 @@ dsl_pool_create(spa_t *spa, nvlist_t *zplprops, dsl_crypto_params_t *dcp,
 	dsl_dataset_t *ds;
 	uint64_t obj;
 
-	rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+	rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 
 	/* create and open the MOS (meta-objset) */
 	dp->dp_meta_objset = dmu_objset_create_impl(spa,
@@ -548,7 +569,7 @@ dsl_pool_create(spa_t *spa, nvlist_t *zplprops, dsl_crypto_params_t *dcp,
 
 	dmu_tx_commit(tx);
 
-	rrw_exit(&dp->dp_config_rwlock, FTAG);
+	rrm_exit(&dp->dp_config_rwlock, FTAG);
 
 	return (dp);
 }
@@ -592,10 +613,66 @@ dsl_pool_dirty_delta(dsl_pool_t *dp, int64_t delta)
 	 * Note: we signal even when increasing dp_dirty_total.
 	 * This ensures forward progress -- each thread wakes the next waiter.
 	 */
-	if (dp->dp_dirty_total < zfs_dirty_data_max)
+	if (dp->dp_dirty_total < dsl_pool_dirty_max(dp))
 		cv_signal(&dp->dp_spaceavail_cv);
 }
 
+/*
+ * Returns the dirty data limit of the pool, see zfs_dirty_data_target_ms.
+ */
+uint64_t
+dsl_pool_dirty_max(dsl_pool_t *dp)
+{
+	uint64_t dirty_max = dp->dp_dirty_max;
+
+	if (zfs_dirty_data_target_ms == 0 || dirty_max == 0)
+		return (zfs_dirty_data_max);
+
+	return (MIN(dirty_max, zfs_dirty_data_max));
+}
+
+/*
+ * Called by the sync thread once a txg which held dirty bytes of dirty
+ * data took delta nanoseconds to sync.  Updates the moving average of the
+ * sync rate of the pool, and the limit derived from it.
+ */
+void
+dsl_pool_sync_done_rate(dsl_pool_t *dp, uint64_t dirty, hrtime_t delta)
+{
+	uint64_t usecs = NSEC2USEC(delta);
+
+	/*
+	 * Txgs which were synced before enough dirty data accumulated to
+	 * start a sync are mostly fixed costs, like the uberblock updates,
+	 * and would make the pool look slower than it is.
+	 */
+	if (zfs_dirty_data_target_ms == 0 || usecs == 0 ||
+	    dirty < dsl_pool_dirty_max(dp) * zfs_dirty_data_sync_percent / 100)
+		return;
+
+	uint64_t rate = dirty * MICROSEC / usecs;
+
+	mutex_enter(&dp->dp_lock);
+	if (dp->dp_sync_rate == 0)
+		dp->dp_sync_rate = rate;
+	else
+		dp->dp_sync_rate = (dp->dp_sync_rate * 7 + rate) / 8;
+
+	/*
+	 * The limit is not allowed to shrink below 1/16th of
+	 * zfs_dirty_data_max, so that a few slow txgs can not starve
+	 * the pool of the dirty data needed to measure it again.
+	 */
+	uint64_t dirty_max = dp->dp_sync_rate * zfs_dirty_data_target_ms /
+	    MILLISEC;
+	dirty_max = MAX(dirty_max, zfs_dirty_data_max / 16);
+	dp->dp_dirty_max = MIN(dirty_max, zfs_dirty_data_max);
+
+	if (dp->dp_dirty_total < dp->dp_dirty_max)
+		cv_broadcast(&dp->dp_spaceavail_cv);
+	mutex_exit(&dp->dp_lock);
+}
+
 #if defined(ZFS_DEBUG) && !defined(NDEBUG)
 static boolean_t
 dsl_early_sync_task_verify(dsl_pool_t *dp, uint64_t txg)
@@ -893,10 +970,11 @@ dsl_pool_unreserved_space(dsl_pool_t *dp, zfs_space_check_t slop_policy)
 boolean_t
 dsl_pool_need_dirty_delay(dsl_pool_t *dp)
 {
+	uint64_t dirty_max = dsl_pool_dirty_max(dp);
 	uint64_t delay_min_bytes =
-	    zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100;
+	    dirty_max * zfs_delay_min_dirty_percent / 100;
 	uint64_t dirty_min_bytes =
-	    zfs_dirty_data_max * zfs_dirty_data_sync_percent / 100;
+	    dirty_max * zfs_dirty_data_sync_percent / 100;
 	boolean_t rv;
 
 	mutex_enter(&dp->dp_lock);
@@ -1091,7 +1169,7 @@ dsl_pool_create_origin(dsl_pool_t *dp, dmu_tx_t *tx)
 
 	ASSERT(dmu_tx_is_syncing(tx));
 	ASSERT(dp->dp_origin_snap == NULL);
-	ASSERT(rrw_held(&dp->dp_config_rwlock, RW_WRITER));
+	ASSERT(rrm_held(&dp->dp_config_rwlock, RW_WRITER));
 
 	/* create the origin dir, ds, & snap-ds */
 	dsobj = dsl_dataset_create_sync(dp->dp_root_dir, ORIGIN_DIR_NAME,
@@ -1277,6 +1355,11 @@ dsl_pool_user_release(dsl_pool_t *dp, uint64_t dsobj, const char *tag,
  * information from the dataset, then release the pool and dataset.
  * dmu_objset_{hold,rele}() are convenience routines that also do the pool
  * hold/rele.
+ *
+ * Nearly every operation on the pool takes the lock for read, while it is
+ * only taken for write in syncing context, so it is a reader-mostly
+ * rrmlock_t: readers are spread over its component locks by thread, and
+ * only the occasional writer has to take them all.
  */
 
 int
@@ -1315,33 +1398,33 @@ dsl_pool_config_enter(dsl_pool_t *dp, void *tag)
 	 * read, but not *which* threads, so rw_held(RW_READER) returns TRUE
 	 * if any thread holds it for read, even if this thread doesn't).
 	 */
-	ASSERT(!rrw_held(&dp->dp_config_rwlock, RW_READER));
-	rrw_enter(&dp->dp_config_rwlock, RW_READER, tag);
+	ASSERT(!rrm_held(&dp->dp_config_rwlock, RW_READER));
+	rrm_enter(&dp->dp_config_rwlock, RW_READER, tag);
 }
 
 void
 dsl_pool_config_enter_prio(dsl_pool_t *dp, void *tag)
 {
-	ASSERT(!rrw_held(&dp->dp_config_rwlock, RW_READER));
-	rrw_enter_read_prio(&dp->dp_config_rwlock, tag);
+	ASSERT(!rrm_held(&dp->dp_config_rwlock, RW_READER));
+	rrm_enter_read_prio(&dp->dp_config_rwlock, tag);
 }
 
 void
 dsl_pool_config_exit(dsl_pool_t *dp, void *tag)
 {
-	rrw_exit(&dp->dp_config_rwlock, tag);
+	rrm_exit(&dp->dp_config_rwlock, tag);
 }
 
 boolean_t
 dsl_pool_config_held(dsl_pool_t *dp)
 {
-	return (RRW_LOCK_HELD(&dp->dp_config_rwlock));
+	return (RRM_LOCK_HELD(&dp->dp_config_rwlock));
 }
 
 boolean_t
 dsl_pool_config_held_writer(dsl_pool_t *dp)
 {
-	return (RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	return (RRM_WRITE_HELD(&dp->dp_config_rwlock));
 }
 
 #if defined(_KERNEL)
@@ -1367,6 +1450,9 @@ ZFS_MODULE_PARAM(zfs, zfs_, dirty_data_max_max, UQUAD, ZMOD_RD,
 ZFS_MODULE_PARAM(zfs, zfs_, dirty_data_sync_percent, UINT, ZMOD_RW,
 	"dirty data txg sync threshold as a percentage of zfs_dirty_data_max");
 
+ZFS_MODULE_PARAM(zfs, zfs_, dirty_data_target_ms, INT, ZMOD_RW,
+	"size the dirty data limit to what each pool syncs in this many ms");
+
 ZFS_MODULE_PARAM(zfs, zfs_, delay_scale, UQUAD, ZMOD_RW,
     "how quickly delay approaches infinity");
 
@@ -69,6 +69,69 @@ dodefault(zfs_prop_t prop, int intsz, int numints, void *buf)
 	return (0);
 }
 
+/*
+ * Looking up an inherited property means looking for it at every level up
+ * to where it is set, so the effective values of integer properties are
+ * cached in each dsl_dir.  Rather than finding every descendant affected
+ * by a change, any change to a property or to the hierarchy bumps the
+ * pool's dp_prop_gen, which invalidates all of the cached values.  Since
+ * changes only happen in syncing context, they are rare compared to the
+ * lookups.
+ */
+void
+dsl_prop_cache_invalidate(dsl_pool_t *dp)
+{
+	atomic_inc_64(&dp->dp_prop_gen);
+}
+
+static boolean_t
+dsl_prop_cache_lookup(dsl_dir_t *dd, const char *propname,
+    boolean_t snapshot, uint64_t gen, uint64_t *valuep)
+{
+	dsl_prop_cache_entry_t *pce;
+	boolean_t found = B_FALSE;
+
+	mutex_enter(&dd->dd_lock);
+	for (pce = list_head(&dd->dd_prop_cache); pce != NULL;
+	    pce = list_next(&dd->dd_prop_cache, pce)) {
+		if (pce->pce_snapshot == snapshot &&
+		    strcmp(pce->pce_propname, propname) == 0) {
+			if (pce->pce_gen == gen) {
+				*valuep = pce->pce_value;
+				found = B_TRUE;
+			}
+			break;
+		}
+	}
+	mutex_exit(&dd->dd_lock);
+
+	return (found);
+}
+
+static void
+dsl_prop_cache_update(dsl_dir_t *dd, const char *propname,
+    boolean_t snapshot, uint64_t gen, uint64_t value)
+{
+	dsl_prop_cache_entry_t *pce;
+
+	mutex_enter(&dd->dd_lock);
+	for (pce = list_head(&dd->dd_prop_cache); pce != NULL;
+	    pce = list_next(&dd->dd_prop_cache, pce)) {
+		if (pce->pce_snapshot == snapshot &&
+		    strcmp(pce->pce_propname, propname) == 0)
+			break;
+	}
+	if (pce == NULL) {
+		pce = kmem_alloc(sizeof (dsl_prop_cache_entry_t), KM_SLEEP);
+		pce->pce_propname = spa_strdup(propname);
+		pce->pce_snapshot = snapshot;
+		list_insert_head(&dd->dd_prop_cache, pce);
+	}
+	pce->pce_gen = gen;
+	pce->pce_value = value;
+	mutex_exit(&dd->dd_lock);
+}
+
 int
 dsl_prop_get_dd(dsl_dir_t *dd, const char *propname,
     int intsz, int numints, void *buf, char *setpoint, boolean_t snapshot)
@@ -87,6 +150,16 @@ dsl_prop_get_dd(dsl_dir_t *dd, const char *propname,
 	if (setpoint)
 		setpoint[0] = '\0';
 
+	/*
+	 * The generation is sampled before the lookup, so that a change
+	 * made while we look is sure to invalidate what we cache.
+	 */
+	boolean_t cacheable = (setpoint == NULL && intsz == 8 && numints == 1);
+	uint64_t gen = dd->dd_pool->dp_prop_gen;
+	if (cacheable &&
+	    dsl_prop_cache_lookup(dd, propname, snapshot, gen, buf))
+		return (0);
+
 	prop = zfs_name_to_prop(propname);
 	inheritable = (prop == ZPROP_INVAL || zfs_prop_inheritable(prop));
 	inheritstr = kmem_asprintf("%s%s", propname, ZPROP_INHERIT_SUFFIX);
@@ -150,6 +223,11 @@ dsl_prop_get_dd(dsl_dir_t *dd, const char *propname,
 	if (err == ENOENT)
 		err = dodefault(prop, intsz, numints, buf);
 
+	if (cacheable && err == 0) {
+		dsl_prop_cache_update(target, propname, snapshot, gen,
+		    *(uint64_t *)buf);
+	}
+
 	strfree(inheritstr);
 	strfree(recvdstr);
 
@@ -252,6 +330,8 @@ dsl_prop_init(dsl_dir_t *dd)
 {
 	list_create(&dd->dd_props, sizeof (dsl_prop_record_t),
 	    offsetof(dsl_prop_record_t, pr_node));
+	list_create(&dd->dd_prop_cache, sizeof (dsl_prop_cache_entry_t),
+	    offsetof(dsl_prop_cache_entry_t, pce_node));
 }
 
 void
@@ -265,6 +345,13 @@ dsl_prop_fini(dsl_dir_t *dd)
 		kmem_free(pr, sizeof (dsl_prop_record_t));
 	}
 	list_destroy(&dd->dd_props);
+
+	dsl_prop_cache_entry_t *pce;
+	while ((pce = list_remove_head(&dd->dd_prop_cache)) != NULL) {
+		spa_strfree((char *)pce->pce_propname);
+		kmem_free(pce, sizeof (dsl_prop_cache_entry_t));
+	}
+	list_destroy(&dd->dd_prop_cache);
 }
 
 /*
@@ -563,7 +650,7 @@ void
 dsl_prop_notify_all(dsl_dir_t *dd)
 {
 	dsl_pool_t *dp = dd->dd_pool;
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 	(void) dmu_objset_find_dp(dp, dd->dd_object, dsl_prop_notify_all_cb,
 	    NULL, DS_FIND_CHILDREN);
 }
@@ -580,7 +667,7 @@ dsl_prop_changed_notify(dsl_pool_t *dp, uint64_t ddobj,
 	zap_attribute_t *za;
 	int err;
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 	err = dsl_dir_hold_obj(dp, ddobj, NULL, FTAG, &dd);
 	if (err)
 		return;
@@ -752,6 +839,8 @@ dsl_prop_set_sync_impl(dsl_dataset_t *ds, const char *propname,
 		cmn_err(CE_PANIC, "unexpected property source: %d", source);
 	}
 
+	dsl_prop_cache_invalidate(ds->ds_dir->dd_pool);
+
 	strfree(inheritstr);
 	strfree(recvdstr);
 
@@ -109,6 +109,20 @@
  * bookmark, indicating that we have scanned everything logically before it.
  * If the pool is imported on a machine without the new sorting algorithm,
  * the scan simply resumes from the last checkpoint using the legacy algorithm.
+ *
+ * Spilling queues to the pool
+ *
+ * On large pools, the memory limit can be reached long before a checkpoint
+ * is due, after which issuing the largest extents first degrades towards
+ * random I/O. If zfs_scan_spill_max is set, then when the memory limit is
+ * reached the queues are instead written out in LBA order to a temporary
+ * MOS object (see dsl_scan_spill()), and scanning of metadata continues.
+ * Each spill adds one sorted run per queue. When the scan checkpoints, the
+ * runs are merged back into the queues in LBA order as the queues are
+ * issued (see scan_io_queue_refill()), so that a whole checkpoint interval
+ * worth of I/O is issued sequentially. Since all queued I/O is issued
+ * before a checkpoint is written, the spill object is never needed after
+ * an export or a crash, and is simply freed.
  */
 
 typedef int (scan_cb_t)(dsl_pool_t *, const blkptr_t *,
@@ -179,6 +193,7 @@ uint64_t zfs_scan_mem_lim_min = 16 << 20;	/* bytes */
 uint64_t zfs_scan_mem_lim_soft_max = 128 << 20;	/* bytes */
 int zfs_scan_mem_lim_fact = 20;		/* fraction of physmem */
 int zfs_scan_mem_lim_soft_fact = 20;	/* fraction of mem lim above */
+unsigned long zfs_scan_spill_max = 0;	/* max bytes spilled, 0 disables */
 
 int zfs_scrub_min_time_ms = 1000; /* min millisecs to scrub per txg */
 int zfs_obsolete_min_time_ms = 500; /* min millisecs to obsolete per txg */
@@ -193,6 +208,7 @@ enum ddt_class zfs_scrub_ddt_class_max = DDT_CLASS_DUPLICATE;
 unsigned long zfs_async_block_max_blocks = 100000;
 
 int zfs_resilver_disable_defer = 0; /* set to disable resilver deferring */
+int zfs_resilver_prioritize = 1; /* resilver metadata and at-risk first */
 
 /*
  * We wait a few txgs after importing a pool to begin scanning so that
@@ -288,16 +304,54 @@ typedef struct scan_io {
 #define	SIO_GET_MUSED(sio)		\
 	(sizeof (scan_io_t) + ((sio)->sio_nr_dvas * sizeof (dva_t)))
 
+/*
+ * The form of a scan_io_t spilled to the pool by dsl_scan_spill(). The
+ * records are only read back by the same system, so they are written in
+ * native byte order.
+ */
+typedef struct scan_spill_rec {
+	uint64_t		sr_blk_prop;
+	uint64_t		sr_phys_birth;
+	uint64_t		sr_birth;
+	zio_cksum_t		sr_cksum;
+	uint32_t		sr_nr_dvas;
+	uint32_t		sr_flags;
+	zbookmark_phys_t	sr_zb;
+	dva_t			sr_dva[SPA_DVAS_PER_BP];
+} scan_spill_rec_t;
+
+/* Records written or read back at once */
+#define	SCAN_SPILL_CHUNK_RECS	\
+	(SPA_OLD_MAXBLOCKSIZE / sizeof (scan_spill_rec_t))
+#define	SCAN_SPILL_RUN_BUF_RECS	64
+
+/* A sorted run of records in the spill object, and its read ahead */
+typedef struct scan_spill_run {
+	list_node_t		srun_node;
+	uint64_t		srun_off;	/* next record to read */
+	uint64_t		srun_end;	/* end of the run */
+	uint64_t		srun_bytes;	/* asize of records left */
+	scan_spill_rec_t	*srun_buf;
+	uint32_t		srun_buf_idx;
+	uint32_t		srun_buf_cnt;
+} scan_spill_run_t;
+
 struct dsl_scan_io_queue {
 	dsl_scan_t	*q_scn; /* associated dsl_scan_t */
 	vdev_t		*q_vd; /* top-level vdev that this queue represents */
 
 	/* trees used for sorting I/Os and extents of I/Os */
 	range_tree_t	*q_exts_by_addr;
-	avl_tree_t	q_exts_by_size;
+	zfs_btree_t	q_exts_by_size;
 	avl_tree_t	q_sios_by_addr;
 	uint64_t	q_sio_memused;
 
+	/* sorted runs spilled to the pool, see dsl_scan_spill() */
+	list_t		q_spill_runs;
+	uint64_t	q_spill_recs;	/* records not yet merged back */
+	uint64_t	q_spill_next;	/* lowest offset still spilled */
+	range_tree_t	*q_spill_freed;	/* ranges freed since spilled */
+
 	/* members for zio rate limiting */
 	uint64_t	q_maxinflight_bytes;
 	uint64_t	q_inflight_bytes;
@@ -334,6 +388,9 @@ static void scan_io_queue_insert_impl(dsl_scan_io_queue_t *queue,
 
 static dsl_scan_io_queue_t *scan_io_queue_create(vdev_t *vd);
 static void scan_io_queues_destroy(dsl_scan_t *scn);
+static void count_block(dsl_scan_t *scn, zfs_all_blkstats_t *zab,
+    const blkptr_t *bp);
+static void dsl_scan_spill_destroy(dsl_scan_t *scn, dmu_tx_t *tx);
 
 static kmem_cache_t *sio_cache[SPA_DVAS_PER_BP];
 
@@ -471,6 +528,13 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 	    sizeof (scan_prefetch_issue_ctx_t),
 	    offsetof(scan_prefetch_issue_ctx_t, spic_avl_node));
 
+	/* a spill object left behind is freed by dsl_scan_sync() */
+	(void) zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_SCAN_SPILL, sizeof (uint64_t), 1, &scn->scn_spill_obj);
+	(void) zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LAST_SCRUBBED_TXG, sizeof (uint64_t), 1,
+	    &scn->scn_last_scrubbed_txg);
+
 	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
 	    "scrub_func", sizeof (uint64_t), 1, &f);
 	if (err == 0) {
@@ -661,8 +725,9 @@ dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx, state_sync_type_t sync_type)
 
 			mutex_enter(&vd->vdev_scan_io_queue_lock);
 			ASSERT3P(avl_first(&q->q_sios_by_addr), ==, NULL);
-			ASSERT3P(avl_first(&q->q_exts_by_size), ==, NULL);
+			ASSERT0(zfs_btree_numnodes(&q->q_exts_by_size));
 			ASSERT3P(range_tree_first(q->q_exts_by_addr), ==, NULL);
+			ASSERT(list_is_empty(&q->q_spill_runs));
 			mutex_exit(&vd->vdev_scan_io_queue_lock);
 		}
 
@@ -688,15 +753,25 @@ dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx, state_sync_type_t sync_type)
 	}
 }
 
-/* ARGSUSED */
+typedef struct dsl_scan_setup_arg {
+	pool_scan_func_t	dssa_func;
+	uint64_t		dssa_txg_start;	/* scrub blocks born from */
+	uint64_t		dssa_txg_end;	/* to before, 0 for all */
+} dsl_scan_setup_arg_t;
+
 static int
 dsl_scan_setup_check(void *arg, dmu_tx_t *tx)
 {
 	dsl_scan_t *scn = dmu_tx_pool(tx)->dp_scan;
+	dsl_scan_setup_arg_t *dssa = arg;
 
 	if (dsl_scan_is_running(scn))
 		return (SET_ERROR(EBUSY));
 
+	if (dssa->dssa_txg_end != 0 &&
+	    dssa->dssa_txg_start >= dssa->dssa_txg_end)
+		return (SET_ERROR(EINVAL));
+
 	return (0);
 }
 
@@ -704,15 +779,16 @@ static void
 dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 {
 	dsl_scan_t *scn = dmu_tx_pool(tx)->dp_scan;
-	pool_scan_func_t *funcp = arg;
+	dsl_scan_setup_arg_t *dssa = arg;
 	dmu_object_type_t ot = 0;
 	dsl_pool_t *dp = scn->scn_dp;
 	spa_t *spa = dp->dp_spa;
 
 	ASSERT(!dsl_scan_is_running(scn));
-	ASSERT(*funcp > POOL_SCAN_NONE && *funcp < POOL_SCAN_FUNCS);
+	ASSERT(dssa->dssa_func > POOL_SCAN_NONE &&
+	    dssa->dssa_func < POOL_SCAN_FUNCS);
 	bzero(&scn->scn_phys, sizeof (scn->scn_phys));
-	scn->scn_phys.scn_func = *funcp;
+	scn->scn_phys.scn_func = dssa->dssa_func;
 	scn->scn_phys.scn_state = DSS_SCANNING;
 	scn->scn_phys.scn_min_txg = 0;
 	scn->scn_phys.scn_max_txg = tx->tx_txg;
@@ -721,6 +797,7 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 	scn->scn_phys.scn_errors = 0;
 	scn->scn_phys.scn_to_examine = spa->spa_root_vdev->vdev_stat.vs_alloc;
 	scn->scn_issued_before_pass = 0;
+	scn->scn_prio_issued = 0;
 	scn->scn_restart_txg = 0;
 	scn->scn_done_txg = 0;
 	scn->scn_last_checkpoint = 0;
@@ -738,6 +815,18 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 			spa_event_notify(spa, NULL, NULL,
 			    ESC_ZFS_RESILVER_START);
 		} else {
+			/*
+			 * Blocks born at or before scn_min_txg, or at or
+			 * after scn_max_txg, are not visited.
+			 */
+			if (dssa->dssa_txg_start > 0) {
+				scn->scn_phys.scn_min_txg =
+				    dssa->dssa_txg_start - 1;
+			}
+			if (dssa->dssa_txg_end != 0) {
+				scn->scn_phys.scn_max_txg = MIN(
+				    dssa->dssa_txg_end, tx->tx_txg);
+			}
 			spa_event_notify(spa, NULL, NULL, ESC_ZFS_SCRUB_START);
 		}
 
@@ -774,19 +863,23 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 
 	spa_history_log_internal(spa, "scan setup", tx,
 	    "func=%u mintxg=%llu maxtxg=%llu",
-	    *funcp, (longlong_t)scn->scn_phys.scn_min_txg,
+	    dssa->dssa_func, (longlong_t)scn->scn_phys.scn_min_txg,
 	    (longlong_t)scn->scn_phys.scn_max_txg);
 }
 
 /*
  * Called by the ZFS_IOC_POOL_SCAN ioctl to start a scrub or resilver.
- * Can also be called to resume a paused scrub.
+ * Can also be called to resume a paused scrub. A scrub only examines the
+ * blocks born in txgs [txg_start, txg_end), or up to the current txg if
+ * txg_end is 0.
  */
 int
-dsl_scan(dsl_pool_t *dp, pool_scan_func_t func)
+dsl_scan(dsl_pool_t *dp, pool_scan_func_t func, uint64_t txg_start,
+    uint64_t txg_end)
 {
 	spa_t *spa = dp->dp_spa;
 	dsl_scan_t *scn = dp->dp_scan;
+	dsl_scan_setup_arg_t dssa = { func, txg_start, txg_end };
 
 	/*
 	 * Purge all vdev caches and probe all devices.  We do this here
@@ -819,7 +912,7 @@ dsl_scan(dsl_pool_t *dp, pool_scan_func_t func)
 	}
 
 	return (dsl_sync_task(spa_name(spa), dsl_scan_setup_check,
-	    dsl_scan_setup_sync, &func, 0, ZFS_SPACE_CHECK_EXTRA_RESERVED));
+	    dsl_scan_setup_sync, &dssa, 0, ZFS_SPACE_CHECK_EXTRA_RESERVED));
 }
 
 /*
@@ -904,6 +997,7 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 
 	if (scn->scn_is_sorted) {
 		scan_io_queues_destroy(scn);
+		dsl_scan_spill_destroy(scn, tx);
 		scn->scn_is_sorted = B_FALSE;
 
 		if (scn->scn_taskq != NULL) {
@@ -924,6 +1018,20 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		spa_history_log_internal(spa, "scan done", tx,
 		    "errors=%llu", (longlong_t)spa_get_errlog_size(spa));
 
+	/*
+	 * A completed scrub that left no gap after the blocks covered by
+	 * earlier scrubs moves the starting point of "zpool scrub -C".
+	 */
+	if (complete && scn->scn_phys.scn_func == POOL_SCAN_SCRUB &&
+	    (scn->scn_phys.scn_min_txg == 0 ||
+	    scn->scn_phys.scn_min_txg < scn->scn_last_scrubbed_txg) &&
+	    scn->scn_phys.scn_max_txg > scn->scn_last_scrubbed_txg) {
+		scn->scn_last_scrubbed_txg = scn->scn_phys.scn_max_txg;
+		VERIFY0(zap_update(dp->dp_meta_objset,
+		    DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_LAST_SCRUBBED_TXG,
+		    sizeof (uint64_t), 1, &scn->scn_last_scrubbed_txg, tx));
+	}
+
 	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
 		spa->spa_scrub_started = B_FALSE;
 		spa->spa_scrub_active = B_FALSE;
@@ -941,14 +1049,14 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		if (complete &&
 		    !spa_feature_is_active(spa, SPA_FEATURE_POOL_CHECKPOINT)) {
 			vdev_dtl_reassess(spa->spa_root_vdev, tx->tx_txg,
-			    scn->scn_phys.scn_max_txg, B_TRUE);
+			    scn->scn_phys.scn_max_txg, B_TRUE, B_FALSE);
 
 			spa_event_notify(spa, NULL, NULL,
 			    scn->scn_phys.scn_min_txg ?
 			    ESC_ZFS_RESILVER_FINISH : ESC_ZFS_SCRUB_FINISH);
 		} else {
 			vdev_dtl_reassess(spa->spa_root_vdev, tx->tx_txg,
-			    0, B_TRUE);
+			    0, B_TRUE, B_FALSE);
 		}
 		spa_errlog_rotate(spa);
 
@@ -1230,20 +1338,36 @@ scan_ds_queue_sync(dsl_scan_t *scn, dmu_tx_t *tx)
  *	worth of queues is about 1.2 GiB of on-pool data, so scanning
  *	that should take at least a decent fraction of a second).
  */
-static boolean_t
-dsl_scan_should_clear(dsl_scan_t *scn)
+static void
+dsl_scan_mem_lim(dsl_scan_t *scn, uint64_t *mlim_hard, uint64_t *mlim_soft)
 {
-	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
-	uint64_t mlim_hard, mlim_soft, mused;
 	uint64_t alloc = metaslab_class_get_alloc(spa_normal_class(
 	    scn->scn_dp->dp_spa));
 
-	mlim_hard = MAX((physmem / zfs_scan_mem_lim_fact) * PAGESIZE,
+	*mlim_hard = MAX((physmem / zfs_scan_mem_lim_fact) * PAGESIZE,
 	    zfs_scan_mem_lim_min);
-	mlim_hard = MIN(mlim_hard, alloc / 20);
-	mlim_soft = mlim_hard - MIN(mlim_hard / zfs_scan_mem_lim_soft_fact,
+	*mlim_hard = MIN(*mlim_hard, alloc / 20);
+	*mlim_soft = *mlim_hard - MIN(*mlim_hard / zfs_scan_mem_lim_soft_fact,
 	    zfs_scan_mem_lim_soft_max);
+}
+
+static uint64_t
+scan_io_queue_mused(dsl_scan_io_queue_t *queue)
+{
+	/* # extents in exts_by_size = # in exts_by_addr */
+	return (zfs_btree_numnodes(&queue->q_exts_by_size) *
+	    sizeof (range_seg_t) + queue->q_sio_memused);
+}
+
+static boolean_t
+dsl_scan_should_clear(dsl_scan_t *scn)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	uint64_t mlim_hard, mlim_soft, mused, spilled;
+
+	dsl_scan_mem_lim(scn, &mlim_hard, &mlim_soft);
 	mused = 0;
+	spilled = 0;
 	for (uint64_t i = 0; i < rvd->vdev_children; i++) {
 		vdev_t *tvd = rvd->vdev_child[i];
 		dsl_scan_io_queue_t *queue;
@@ -1251,16 +1375,16 @@ dsl_scan_should_clear(dsl_scan_t *scn)
 		mutex_enter(&tvd->vdev_scan_io_queue_lock);
 		queue = tvd->vdev_scan_io_queue;
 		if (queue != NULL) {
-			/* # extents in exts_by_size = # in exts_by_addr */
-			mused += avl_numnodes(&queue->q_exts_by_size) *
-			    sizeof (range_seg_t) + queue->q_sio_memused;
+			mused += scan_io_queue_mused(queue);
+			spilled += queue->q_spill_recs;
 		}
 		mutex_exit(&tvd->vdev_scan_io_queue_lock);
 	}
 
-	dprintf("current scan memory usage: %llu bytes\n", (longlong_t)mused);
+	dprintf("current scan memory usage: %llu bytes, %llu spilled sios\n",
+	    (longlong_t)mused, (longlong_t)spilled);
 
-	if (mused == 0)
+	if (mused == 0 && spilled == 0)
 		ASSERT0(scn->scn_bytes_pending);
 
 	/*
@@ -1311,7 +1435,8 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 	uint64_t scan_time_ns = curr_time_ns - scn->scn_sync_start_time;
 	uint64_t sync_time_ns = curr_time_ns -
 	    scn->scn_dp->dp_spa->spa_sync_starttime;
-	int dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
+	int dirty_pct = scn->scn_dp->dp_dirty_total * 100 /
+	    dsl_pool_dirty_max(scn->scn_dp);
 	int mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
 	    zfs_resilver_min_time_ms : zfs_scrub_min_time_ms;
 
@@ -2741,7 +2866,8 @@ scan_io_queue_check_suspend(dsl_scan_t *scn)
 	uint64_t scan_time_ns = curr_time_ns - scn->scn_sync_start_time;
 	uint64_t sync_time_ns = curr_time_ns -
 	    scn->scn_dp->dp_spa->spa_sync_starttime;
-	int dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
+	int dirty_pct = scn->scn_dp->dp_dirty_total * 100 /
+	    dsl_pool_dirty_max(scn->scn_dp);
 	int mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
 	    zfs_resilver_min_time_ms : zfs_scrub_min_time_ms;
 
@@ -2857,6 +2983,22 @@ scan_io_queue_gather(dsl_scan_io_queue_t *queue, range_seg_t *rs, list_t *list)
 	}
 }
 
+/*
+ * Return the q_exts_by_addr segment matching the largest-scoring extent in
+ * q_exts_by_size.  The caller modifies the segment it is given through the
+ * range tree, so it must not be the copy held by the size-ordered tree.
+ */
+static range_seg_t *
+scan_io_queue_largest_ext(dsl_scan_io_queue_t *queue)
+{
+	range_seg_t *rs = zfs_btree_first(&queue->q_exts_by_size, NULL);
+
+	if (rs == NULL)
+		return (NULL);
+	return (range_tree_find(queue->q_exts_by_addr, rs->rs_start,
+	    rs->rs_end - rs->rs_start));
+}
+
 /*
  * This is called from the queue emptying thread and selects the next
  * extent from which we are to issue I/Os. The behavior of this function
@@ -2881,7 +3023,7 @@ scan_io_queue_fetch_ext(dsl_scan_io_queue_t *queue)
 		if (zfs_scan_issue_strategy == 1) {
 			return (range_tree_first(queue->q_exts_by_addr));
 		} else if (zfs_scan_issue_strategy == 2) {
-			return (avl_first(&queue->q_exts_by_size));
+			return (scan_io_queue_largest_ext(queue));
 		}
 	}
 
@@ -2897,12 +3039,366 @@ scan_io_queue_fetch_ext(dsl_scan_io_queue_t *queue)
 	if (scn->scn_checkpointing) {
 		return (range_tree_first(queue->q_exts_by_addr));
 	} else if (scn->scn_clearing) {
-		return (avl_first(&queue->q_exts_by_size));
+		return (scan_io_queue_largest_ext(queue));
 	} else {
 		return (NULL);
 	}
 }
 
+static inline void
+sio2rec(const scan_io_t *sio, scan_spill_rec_t *rec)
+{
+	bzero(rec, sizeof (*rec));
+	rec->sr_blk_prop = sio->sio_blk_prop;
+	rec->sr_phys_birth = sio->sio_phys_birth;
+	rec->sr_birth = sio->sio_birth;
+	rec->sr_cksum = sio->sio_cksum;
+	rec->sr_nr_dvas = sio->sio_nr_dvas;
+	rec->sr_flags = sio->sio_flags;
+	rec->sr_zb = sio->sio_zb;
+	bcopy(sio->sio_dva, rec->sr_dva, sio->sio_nr_dvas * sizeof (dva_t));
+}
+
+static inline scan_io_t *
+rec2sio(const scan_spill_rec_t *rec)
+{
+	scan_io_t *sio = sio_alloc(rec->sr_nr_dvas);
+
+	sio->sio_blk_prop = rec->sr_blk_prop;
+	sio->sio_phys_birth = rec->sr_phys_birth;
+	sio->sio_birth = rec->sr_birth;
+	sio->sio_cksum = rec->sr_cksum;
+	sio->sio_nr_dvas = rec->sr_nr_dvas;
+	sio->sio_flags = rec->sr_flags;
+	sio->sio_zb = rec->sr_zb;
+	bcopy(rec->sr_dva, sio->sio_dva, rec->sr_nr_dvas * sizeof (dva_t));
+
+	return (sio);
+}
+
+/*
+ * Frees the spill object. This is done once all runs have been merged
+ * back, and on the first sync after an import, when the runs are gone.
+ */
+static void
+dsl_scan_spill_destroy(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+
+	if (scn->scn_spill_obj == 0)
+		return;
+
+	ASSERT0(scn->scn_spill_runs);
+	VERIFY0(dmu_object_free(mos, scn->scn_spill_obj, tx));
+	VERIFY0(zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_SCAN_SPILL, tx));
+	zfs_dbgmsg("freed scan spill object %llu of %llu bytes",
+	    (longlong_t)scn->scn_spill_obj, (longlong_t)scn->scn_spill_size);
+	scn->scn_spill_obj = 0;
+	scn->scn_spill_size = 0;
+}
+
+/*
+ * Removes a run from its queue. Any records of it not merged back yet
+ * are dropped and their blocks are not scanned.
+ */
+static void
+scan_spill_run_destroy(dsl_scan_io_queue_t *queue, scan_spill_run_t *srun)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	uint64_t recs = (srun->srun_end - srun->srun_off) /
+	    sizeof (scan_spill_rec_t) + srun->srun_buf_cnt - srun->srun_buf_idx;
+
+	ASSERT3U(queue->q_spill_recs, >=, recs);
+	queue->q_spill_recs -= recs;
+	atomic_add_64(&scn->scn_bytes_pending, -srun->srun_bytes);
+	atomic_dec_64(&scn->scn_spill_runs);
+
+	list_remove(&queue->q_spill_runs, srun);
+	if (srun->srun_buf != NULL) {
+		kmem_free(srun->srun_buf,
+		    SCAN_SPILL_RUN_BUF_RECS * sizeof (scan_spill_rec_t));
+	}
+	kmem_free(srun, sizeof (*srun));
+
+	if (list_is_empty(&queue->q_spill_runs)) {
+		ASSERT0(queue->q_spill_recs);
+		range_tree_vacate(queue->q_spill_freed, NULL, NULL);
+	}
+}
+
+/*
+ * Writes all sios of a queue to the spill object as a new sorted run and
+ * frees them. The blocks remain accounted for in scn_bytes_pending until
+ * they are merged back and issued.
+ */
+static void
+scan_io_queue_spill(dsl_scan_io_queue_t *queue, dmu_tx_t *tx)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+	kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+	scan_spill_rec_t *buf;
+	scan_spill_run_t *srun;
+	scan_io_t *sio;
+	uint64_t n;
+
+	buf = vmem_alloc(SCAN_SPILL_CHUNK_RECS * sizeof (*buf), KM_SLEEP);
+	srun = kmem_zalloc(sizeof (*srun), KM_SLEEP);
+	srun->srun_off = scn->scn_spill_size;
+
+	mutex_enter(q_lock);
+	queue->q_spill_next = 0;
+	do {
+		n = 0;
+		while (n < SCAN_SPILL_CHUNK_RECS &&
+		    (sio = avl_first(&queue->q_sios_by_addr)) != NULL) {
+			avl_remove(&queue->q_sios_by_addr, sio);
+			queue->q_sio_memused -= SIO_GET_MUSED(sio);
+			queue->q_spill_recs++;
+			srun->srun_bytes += SIO_GET_ASIZE(sio);
+			sio2rec(sio, &buf[n++]);
+			sio_free(sio);
+		}
+		if (n == 0)
+			break;
+
+		/*
+		 * From here on, frees of the blocks written out are recorded
+		 * in q_spill_freed by dsl_scan_freed_dva(), so the lock can
+		 * be dropped for the write.
+		 */
+		mutex_exit(q_lock);
+		dmu_write(mos, scn->scn_spill_obj, scn->scn_spill_size,
+		    n * sizeof (*buf), buf, tx);
+		scn->scn_spill_size += n * sizeof (*buf);
+		mutex_enter(q_lock);
+	} while (n == SCAN_SPILL_CHUNK_RECS);
+
+	ASSERT0(queue->q_sio_memused);
+	range_tree_vacate(queue->q_exts_by_addr, NULL, queue);
+	srun->srun_end = scn->scn_spill_size;
+
+	if (srun->srun_end == srun->srun_off) {
+		kmem_free(srun, sizeof (*srun));
+	} else {
+		list_insert_tail(&queue->q_spill_runs, srun);
+		atomic_inc_64(&scn->scn_spill_runs);
+	}
+	mutex_exit(q_lock);
+
+	vmem_free(buf, SCAN_SPILL_CHUNK_RECS * sizeof (*buf));
+}
+
+/*
+ * Called instead of clearing the queues when they reach the memory limit.
+ * All queues are written out to the spill object, so that metadata can be
+ * scanned further without issuing any I/O. Returns B_FALSE if spilling is
+ * disabled, or if the spill object would grow too large, either for
+ * zfs_scan_spill_max or for the free space of the pool.
+ */
+static boolean_t
+dsl_scan_spill(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	objset_t *mos = dp->dp_meta_objset;
+	vdev_t *rvd = dp->dp_spa->spa_root_vdev;
+	metaslab_class_t *mc = spa_normal_class(dp->dp_spa);
+	uint64_t nsios = 0, size, avail;
+
+	if (zfs_scan_spill_max == 0 || scn->scn_checkpointing)
+		return (B_FALSE);
+
+	for (uint64_t i = 0; i < rvd->vdev_children; i++) {
+		vdev_t *tvd = rvd->vdev_child[i];
+
+		mutex_enter(&tvd->vdev_scan_io_queue_lock);
+		if (tvd->vdev_scan_io_queue != NULL) {
+			nsios += avl_numnodes(
+			    &tvd->vdev_scan_io_queue->q_sios_by_addr);
+		}
+		mutex_exit(&tvd->vdev_scan_io_queue_lock);
+	}
+
+	size = scn->scn_spill_size + nsios * sizeof (scan_spill_rec_t);
+	avail = metaslab_class_get_space(mc) - metaslab_class_get_alloc(mc);
+	if (nsios == 0 || size > zfs_scan_spill_max || size > avail / 32)
+		return (B_FALSE);
+
+	if (scn->scn_spill_obj == 0) {
+		scn->scn_spill_obj = dmu_object_alloc(mos,
+		    DMU_OTN_UINT8_METADATA, SPA_OLD_MAXBLOCKSIZE,
+		    DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_SCAN_SPILL, sizeof (uint64_t), 1,
+		    &scn->scn_spill_obj, tx));
+	}
+
+	for (uint64_t i = 0; i < rvd->vdev_children; i++) {
+		dsl_scan_io_queue_t *queue = rvd->vdev_child[i]->
+		    vdev_scan_io_queue;
+
+		/* queues are only created and destroyed in syncing context */
+		if (queue != NULL)
+			scan_io_queue_spill(queue, tx);
+	}
+
+	zfs_dbgmsg("spilled %llu scan sios in txg %llu, spill object "
+	    "%llu bytes", (longlong_t)nsios, (longlong_t)tx->tx_txg,
+	    (longlong_t)scn->scn_spill_size);
+
+	return (B_TRUE);
+}
+
+/*
+ * Reads ahead the runs of a queue whose buffered records were all merged,
+ * and removes the runs that are done or cannot be read.
+ */
+static void
+scan_io_queue_spill_readahead(dsl_scan_io_queue_t *queue)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+	kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+	scan_spill_run_t *srun, *next;
+	uint64_t n;
+	int err;
+
+	ASSERT(MUTEX_HELD(q_lock));
+
+	for (srun = list_head(&queue->q_spill_runs); srun != NULL;
+	    srun = next) {
+		next = list_next(&queue->q_spill_runs, srun);
+
+		if (srun->srun_buf_idx < srun->srun_buf_cnt)
+			continue;
+		if (srun->srun_off == srun->srun_end) {
+			scan_spill_run_destroy(queue, srun);
+			continue;
+		}
+
+		if (srun->srun_buf == NULL) {
+			srun->srun_buf = kmem_alloc(SCAN_SPILL_RUN_BUF_RECS *
+			    sizeof (scan_spill_rec_t), KM_SLEEP);
+		}
+		n = MIN(SCAN_SPILL_RUN_BUF_RECS, (srun->srun_end -
+		    srun->srun_off) / sizeof (scan_spill_rec_t));
+
+		/* the runs are only modified by the syncing thread */
+		mutex_exit(q_lock);
+		err = dmu_read(mos, scn->scn_spill_obj, srun->srun_off,
+		    n * sizeof (scan_spill_rec_t), srun->srun_buf,
+		    DMU_READ_PREFETCH);
+		mutex_enter(q_lock);
+
+		if (err != 0) {
+			zfs_dbgmsg("failed to read scan spill object %llu "
+			    "at offset %llu, error %d; skipping %llu bytes",
+			    (longlong_t)scn->scn_spill_obj,
+			    (longlong_t)srun->srun_off, err,
+			    (longlong_t)srun->srun_bytes);
+			scan_spill_run_destroy(queue, srun);
+			continue;
+		}
+		srun->srun_off += n * sizeof (scan_spill_rec_t);
+		srun->srun_buf_idx = 0;
+		srun->srun_buf_cnt = n;
+	}
+}
+
+/*
+ * Moves the next record of a run back into the queue, unless its block
+ * was freed after it was spilled. Since only blocks born before the scan
+ * started are queued, a block reallocated at the same offset is never
+ * mistaken for a spilled one.
+ */
+static void
+scan_io_queue_merge_rec(dsl_scan_io_queue_t *queue, scan_spill_run_t *srun)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	scan_io_t *sio = rec2sio(&srun->srun_buf[srun->srun_buf_idx++]);
+	uint64_t asize = SIO_GET_ASIZE(sio);
+
+	queue->q_spill_recs--;
+	srun->srun_bytes -= asize;
+
+	if (range_tree_contains(queue->q_spill_freed, SIO_GET_OFFSET(sio),
+	    asize)) {
+		blkptr_t tmpbp;
+
+		/* count the block as though we issued it */
+		atomic_add_64(&scn->scn_bytes_pending, -asize);
+		sio2bp(sio, &tmpbp);
+		count_block(scn, scn->scn_dp->dp_blkstats, &tmpbp);
+		sio_free(sio);
+		return;
+	}
+
+	scan_io_queue_insert_impl(queue, sio);
+}
+
+/*
+ * Merges spilled records back into a checkpointing queue in LBA order,
+ * until the queue holds its share of the soft memory limit or all runs
+ * are merged. Afterwards, q_spill_next is the lowest offset still
+ * spilled, and the queue can be issued in LBA order up to it.
+ */
+static void
+scan_io_queue_refill(dsl_scan_io_queue_t *queue)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	uint64_t mlim_hard, mlim_soft, budget;
+	boolean_t merged = B_FALSE;
+
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+
+	dsl_scan_mem_lim(scn, &mlim_hard, &mlim_soft);
+	budget = mlim_soft / MAX(rvd->vdev_children, 1);
+
+	for (;;) {
+		scan_spill_run_t *srun, *min;
+
+		scan_io_queue_spill_readahead(queue);
+		if (list_is_empty(&queue->q_spill_runs))
+			break;
+		if (merged && scan_io_queue_mused(queue) >= budget)
+			break;
+
+		/* merge until a run needs to read ahead */
+		for (;;) {
+			min = NULL;
+			for (srun = list_head(&queue->q_spill_runs);
+			    srun != NULL;
+			    srun = list_next(&queue->q_spill_runs, srun)) {
+				if (srun->srun_buf_idx == srun->srun_buf_cnt) {
+					min = NULL;
+					break;
+				}
+				if (min == NULL || DVA_GET_OFFSET(
+				    &srun->srun_buf[srun->srun_buf_idx].
+				    sr_dva[0]) < DVA_GET_OFFSET(
+				    &min->srun_buf[min->srun_buf_idx].
+				    sr_dva[0])) {
+					min = srun;
+				}
+			}
+			if (min == NULL ||
+			    (merged && scan_io_queue_mused(queue) >= budget))
+				break;
+			scan_io_queue_merge_rec(queue, min);
+			merged = B_TRUE;
+		}
+	}
+
+	queue->q_spill_next = UINT64_MAX;
+	for (scan_spill_run_t *srun = list_head(&queue->q_spill_runs);
+	    srun != NULL; srun = list_next(&queue->q_spill_runs, srun)) {
+		queue->q_spill_next = MIN(queue->q_spill_next, DVA_GET_OFFSET(
+		    &srun->srun_buf[srun->srun_buf_idx].sr_dva[0]));
+	}
+}
+
 static void
 scan_io_queues_run_one(void *arg)
 {
@@ -2932,10 +3428,21 @@ scan_io_queues_run_one(void *arg)
 	queue->q_zios_this_txg = 0;
 
 	/* loop until we run out of time or sios */
-	while ((rs = scan_io_queue_fetch_ext(queue)) != NULL) {
+	for (;;) {
 		uint64_t seg_start = 0, seg_end = 0;
 		boolean_t more_left = B_TRUE;
 
+		/* merge back spilled sios that sort before the next extent */
+		rs = scan_io_queue_fetch_ext(queue);
+		if (queue->q_scn->scn_checkpointing &&
+		    !list_is_empty(&queue->q_spill_runs) &&
+		    (rs == NULL || rs->rs_start >= queue->q_spill_next)) {
+			scan_io_queue_refill(queue);
+			rs = scan_io_queue_fetch_ext(queue);
+		}
+		if (rs == NULL)
+			break;
+
 		ASSERT(list_is_empty(&sio_list));
 
 		/* loop while we still have sios left to process in this rs */
@@ -3064,17 +3571,15 @@ dsl_scan_async_block_should_pause(dsl_scan_t *scn)
 	    spa_shutting_down(scn->scn_dp->dp_spa));
 }
 
+/*
+ * The blocks of a livelist are freed a sublist at a time, so this does not
+ * pause, see dsl_livelist_delete_sublist().
+ */
 static int
-dsl_scan_free_block_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+dsl_scan_free_livelist_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 {
 	dsl_scan_t *scn = arg;
 
-	if (!scn->scn_is_bptree ||
-	    (BP_GET_LEVEL(bp) == 0 && BP_GET_TYPE(bp) != DMU_OT_OBJSET)) {
-		if (dsl_scan_async_block_should_pause(scn))
-			return (SET_ERROR(ERESTART));
-	}
-
 	zio_nowait(zio_free_sync(scn->scn_zio_root, scn->scn_dp->dp_spa,
 	    dmu_tx_get_txg(tx), bp, 0));
 	dsl_dir_diduse_space(tx->tx_pool->dp_free_dir, DD_USED_HEAD,
@@ -3084,6 +3589,20 @@ dsl_scan_free_block_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 	return (0);
 }
 
+static int
+dsl_scan_free_block_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	dsl_scan_t *scn = arg;
+
+	if (!scn->scn_is_bptree ||
+	    (BP_GET_LEVEL(bp) == 0 && BP_GET_TYPE(bp) != DMU_OT_OBJSET)) {
+		if (dsl_scan_async_block_should_pause(scn))
+			return (SET_ERROR(ERESTART));
+	}
+
+	return (dsl_scan_free_livelist_cb(arg, bp, tx));
+}
+
 static void
 dsl_scan_update_stats(dsl_scan_t *scn)
 {
@@ -3146,7 +3665,8 @@ dsl_scan_active(dsl_scan_t *scn)
 	if (spa_shutting_down(spa))
 		return (B_FALSE);
 	if ((dsl_scan_is_running(scn) && !dsl_scan_is_paused_scrub(scn)) ||
-	    (scn->scn_async_destroying && !scn->scn_async_stalled))
+	    (scn->scn_async_destroying && !scn->scn_async_stalled) ||
+	    dsl_livelist_deleting(scn->scn_dp))
 		return (B_TRUE);
 
 	if (spa_version(scn->scn_dp->dp_spa) >= SPA_VERSION_DEADLISTS) {
@@ -3301,9 +3821,31 @@ dsl_process_async_destroys(dsl_pool_t *dp, dmu_tx_t *tx)
 			    (scn->scn_visited_this_txg == 0);
 		}
 	}
+	if (err == 0 && dsl_livelist_deleting(dp)) {
+		scn->scn_async_block_min_time_ms = zfs_free_min_time_ms;
+		scn->scn_zio_root = zio_root(spa, NULL,
+		    NULL, ZIO_FLAG_MUSTSUCCEED);
+		do {
+			if (dsl_scan_async_block_should_pause(scn)) {
+				err = SET_ERROR(ERESTART);
+				break;
+			}
+			err = dsl_livelist_delete_sublist(dp,
+			    dsl_scan_free_livelist_cb, scn, tx);
+		} while (err == 0);
+		VERIFY0(zio_wait(scn->scn_zio_root));
+		scn->scn_zio_root = NULL;
+
+		if (err == ENOENT) {
+			err = 0;
+		} else if (err != ERESTART) {
+			zfs_panic_recover("error %u from "
+			    "dsl_livelist_delete_sublist()", err);
+		}
+	}
 	if (scn->scn_visited_this_txg) {
 		zfs_dbgmsg("freed %llu blocks in %llums from "
-		    "free_bpobj/bptree txg %llu; err=%u",
+		    "free_bpobj/bptree/livelists txg %llu; err=%u",
 		    (longlong_t)scn->scn_visited_this_txg,
 		    (longlong_t)
 		    NSEC2MSEC(gethrtime() - scn->scn_sync_start_time),
@@ -3320,7 +3862,7 @@ dsl_process_async_destroys(dsl_pool_t *dp, dmu_tx_t *tx)
 	if (err != 0)
 		return (err);
 	if (dp->dp_free_dir != NULL && !scn->scn_async_destroying &&
-	    zfs_free_leak_on_eio &&
+	    !dsl_livelist_deleting(dp) && zfs_free_leak_on_eio &&
 	    (dsl_dir_phys(dp->dp_free_dir)->dd_used_bytes != 0 ||
 	    dsl_dir_phys(dp->dp_free_dir)->dd_compressed_bytes != 0 ||
 	    dsl_dir_phys(dp->dp_free_dir)->dd_uncompressed_bytes != 0)) {
@@ -3330,12 +3872,12 @@ dsl_process_async_destroys(dsl_pool_t *dp, dmu_tx_t *tx)
 		 * space to the dp_leak_dir.
 		 */
 		if (dp->dp_leak_dir == NULL) {
-			rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+			rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 			(void) dsl_dir_create_sync(dp, dp->dp_root_dir,
 			    LEAK_DIR_NAME, tx);
 			VERIFY0(dsl_pool_open_special_dir(dp,
 			    LEAK_DIR_NAME, &dp->dp_leak_dir));
-			rrw_exit(&dp->dp_config_rwlock, FTAG);
+			rrm_exit(&dp->dp_config_rwlock, FTAG);
 		}
 		dsl_dir_diduse_space(dp->dp_leak_dir, DD_USED_HEAD,
 		    dsl_dir_phys(dp->dp_free_dir)->dd_used_bytes,
@@ -3347,7 +3889,8 @@ dsl_process_async_destroys(dsl_pool_t *dp, dmu_tx_t *tx)
 		    -dsl_dir_phys(dp->dp_free_dir)->dd_uncompressed_bytes, tx);
 	}
 
-	if (dp->dp_free_dir != NULL && !scn->scn_async_destroying) {
+	if (dp->dp_free_dir != NULL && !scn->scn_async_destroying &&
+	    !dsl_livelist_deleting(dp)) {
 		/* finished; verify that space accounting went to zero */
 		ASSERT0(dsl_dir_phys(dp->dp_free_dir)->dd_used_bytes);
 		ASSERT0(dsl_dir_phys(dp->dp_free_dir)->dd_compressed_bytes);
@@ -3403,13 +3946,20 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	 */
 	if (dsl_scan_restarting(scn, tx) ||
 	    (spa->spa_resilver_deferred && zfs_resilver_disable_defer)) {
-		pool_scan_func_t func = POOL_SCAN_SCRUB;
+		dsl_scan_setup_arg_t dssa = { POOL_SCAN_SCRUB, 0, 0 };
 		dsl_scan_done(scn, B_FALSE, tx);
 		if (vdev_resilver_needed(spa->spa_root_vdev, NULL, NULL))
-			func = POOL_SCAN_RESILVER;
+			dssa.dssa_func = POOL_SCAN_RESILVER;
 		zfs_dbgmsg("restarting scan func=%u txg=%llu",
-		    func, (longlong_t)tx->tx_txg);
-		dsl_scan_setup_sync(&func, tx);
+		    dssa.dssa_func, (longlong_t)tx->tx_txg);
+		dsl_scan_setup_sync(&dssa, tx);
+
+		/*
+		 * The DDT walk reads the on-disk tables, which lag behind
+		 * the dedup log until ddt_sync() applies it in the next txg.
+		 */
+		if (spa_feature_is_active(spa, SPA_FEATURE_DDT_LOG))
+			return;
 	}
 
 	/*
@@ -3426,6 +3976,13 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	if (spa_shutting_down(spa))
 		return;
 
+	/*
+	 * Free the spill object once all of its runs are merged back, or
+	 * when it was left behind by an export or a crash.
+	 */
+	if (scn->scn_spill_obj != 0 && scn->scn_spill_runs == 0)
+		dsl_scan_spill_destroy(scn, tx);
+
 	/*
 	 * If the scan is inactive due to a stalled async destroy, try again.
 	 */
@@ -3526,6 +4083,10 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 			scn->scn_clearing = B_TRUE;
 		} else {
 			boolean_t should_clear = dsl_scan_should_clear(scn);
+			if (should_clear && !scn->scn_clearing &&
+			    dsl_scan_spill(scn, tx)) {
+				should_clear = B_FALSE;
+			}
 			if (should_clear && !scn->scn_clearing) {
 				zfs_dbgmsg("begin scan clearing");
 				scn->scn_clearing = B_TRUE;
@@ -3789,7 +4350,7 @@ scan_io_queue_insert(dsl_scan_io_queue_t *queue, const blkptr_t *bp, int dva_i,
  */
 static void
 dsl_scan_enqueue(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
-    const zbookmark_phys_t *zb)
+    const zbookmark_phys_t *zb, boolean_t prio)
 {
 	spa_t *spa = dp->dp_spa;
 
@@ -3797,9 +4358,10 @@ dsl_scan_enqueue(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
 
 	/*
 	 * Gang blocks are hard to issue sequentially, so we just issue them
-	 * here immediately instead of queuing them.
+	 * here immediately instead of queuing them. The same goes for
+	 * priority blocks, see dsl_scan_is_prio().
 	 */
-	if (!dp->dp_scan->scn_is_sorted || BP_IS_GANG(bp)) {
+	if (!dp->dp_scan->scn_is_sorted || BP_IS_GANG(bp) || prio) {
 		scan_exec_io(dp, bp, zio_flags, zb, NULL);
 		return;
 	}
@@ -3822,6 +4384,57 @@ dsl_scan_enqueue(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
 	}
 }
 
+/*
+ * Returns B_TRUE if the DVA is on a top-level vdev which has lost all of
+ * its redundancy for the txg the block was born in, so that one more
+ * failure would lose the block.
+ */
+static boolean_t
+dsl_scan_dva_at_risk(spa_t *spa, const dva_t *dva, uint64_t phys_birth)
+{
+	vdev_t *vd = vdev_lookup_top(spa, DVA_GET_VDEV(dva));
+	uint64_t redundancy, missing = 0;
+
+	if (vd->vdev_ops == &vdev_mirror_ops) {
+		redundancy = vd->vdev_children - 1;
+	} else if (vd->vdev_ops == &vdev_raidz_ops ||
+	    vd->vdev_ops == &vdev_draid_ops) {
+		redundancy = vd->vdev_nparity;
+	} else {
+		return (B_FALSE);
+	}
+
+	for (uint64_t c = 0; c < vd->vdev_children && missing < redundancy;
+	    c++) {
+		if (vdev_dtl_contains(vd->vdev_child[c], DTL_MISSING,
+		    phys_birth, 1))
+			missing++;
+	}
+
+	return (missing >= redundancy);
+}
+
+/*
+ * During a sorted resilver, metadata and blocks with no redundancy left
+ * are issued as soon as they are found instead of being sorted with the
+ * bulk of the data, which is issued much later. This shortens the window
+ * in which a further failure loses pool metadata or at-risk data.
+ */
+static boolean_t
+dsl_scan_is_prio(spa_t *spa, const blkptr_t *bp, const zbookmark_phys_t *zb)
+{
+	if (BP_IS_METADATA(bp) || zb->zb_objset == DMU_META_OBJSET)
+		return (B_TRUE);
+
+	for (int d = 0; d < BP_GET_NDVAS(bp); d++) {
+		if (!dsl_scan_dva_at_risk(spa, &bp->blk_dva[d],
+		    BP_PHYSICAL_BIRTH(bp)))
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
 static int
 dsl_scan_scrub_cb(dsl_pool_t *dp,
     const blkptr_t *bp, const zbookmark_phys_t *zb)
@@ -3874,7 +4487,15 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	}
 
 	if (needs_io && !zfs_no_scrub_io) {
-		dsl_scan_enqueue(dp, bp, zio_flags, zb);
+		boolean_t prio = B_FALSE;
+
+		if ((zio_flags & ZIO_FLAG_RESILVER) &&
+		    zfs_resilver_prioritize &&
+		    dsl_scan_is_prio(spa, bp, zb)) {
+			prio = B_TRUE;
+			atomic_add_64(&scn->scn_prio_issued, BP_GET_PSIZE(bp));
+		}
+		dsl_scan_enqueue(dp, bp, zio_flags, zb, prio);
 	} else {
 		count_block(scn, dp->dp_blkstats, bp);
 	}
@@ -4043,10 +4664,13 @@ scan_io_queue_create(vdev_t *vd)
 	q->q_vd = vd;
 	q->q_sio_memused = 0;
 	cv_init(&q->q_zio_cv, NULL, CV_DEFAULT, NULL);
-	q->q_exts_by_addr = range_tree_create_impl(&rt_avl_ops,
+	q->q_exts_by_addr = range_tree_create_impl(&rt_btree_ops,
 	    &q->q_exts_by_size, ext_size_compare, zfs_scan_max_ext_gap);
 	avl_create(&q->q_sios_by_addr, sio_addr_compare,
 	    sizeof (scan_io_t), offsetof(scan_io_t, sio_nodes.sio_addr_node));
+	list_create(&q->q_spill_runs, sizeof (scan_spill_run_t),
+	    offsetof(scan_spill_run_t, srun_node));
+	q->q_spill_freed = range_tree_create(NULL, NULL);
 
 	return (q);
 }
@@ -4061,6 +4685,7 @@ dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue)
 {
 	dsl_scan_t *scn = queue->q_scn;
 	scan_io_t *sio;
+	scan_spill_run_t *srun;
 	void *cookie = NULL;
 	int64_t bytes_dequeued = 0;
 
@@ -4077,8 +4702,12 @@ dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue)
 
 	ASSERT0(queue->q_sio_memused);
 	atomic_add_64(&scn->scn_bytes_pending, -bytes_dequeued);
+	while ((srun = list_head(&queue->q_spill_runs)) != NULL)
+		scan_spill_run_destroy(queue, srun);
 	range_tree_vacate(queue->q_exts_by_addr, NULL, queue);
 	range_tree_destroy(queue->q_exts_by_addr);
+	range_tree_destroy(queue->q_spill_freed);
+	list_destroy(&queue->q_spill_runs);
 	avl_destroy(&queue->q_sios_by_addr);
 	cv_destroy(&queue->q_zio_cv);
 
@@ -4196,6 +4825,13 @@ dsl_scan_freed_dva(spa_t *spa, const blkptr_t *bp, int dva_i)
 		count_block(scn, dp->dp_blkstats, &tmpbp);
 
 		sio_free(sio);
+	} else if (queue->q_spill_recs != 0 && start >= queue->q_spill_next) {
+		/*
+		 * The block may be spilled, in which case it is skipped when
+		 * merged back. Everything below q_spill_next is merged.
+		 */
+		range_tree_clear(queue->q_spill_freed, start, size);
+		range_tree_add(queue->q_spill_freed, start, size);
 	}
 	mutex_exit(q_lock);
 }
@@ -4276,9 +4912,15 @@ ZFS_MODULE_PARAM(zfs, zfs_, scan_mem_lim_soft_fact, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, scan_strict_mem_lim, UINT, ZMOD_RW,
 	"Tunable to attempt to reduce lock contention");
 
+ZFS_MODULE_PARAM(zfs, zfs_, scan_spill_max, ULONG, ZMOD_RW,
+	"Max bytes of sorted scan queues spilled to the pool");
+
 ZFS_MODULE_PARAM(zfs, zfs_, scan_fill_weight, UINT, ZMOD_RW,
 	"Tunable to adjust bias towards more filled segments during scans");
 
 ZFS_MODULE_PARAM(zfs, zfs_, resilver_disable_defer, UINT, ZMOD_RW,
 	"Process all resilvers immediately");
+
+ZFS_MODULE_PARAM(zfs, zfs_, resilver_prioritize, INT, ZMOD_RW,
+	"Resilver metadata and blocks without redundancy first");
 #endif
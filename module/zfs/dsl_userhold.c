@@ -159,7 +159,7 @@ dsl_dataset_user_hold_sync_one_impl(nvlist_t *tmpholds, dsl_dataset_t *ds,
 	objset_t *mos = dp->dp_meta_objset;
 	uint64_t zapobj;
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 
 	if (dsl_dataset_phys(ds)->ds_userrefs_obj == 0) {
 		/*
@@ -452,7 +452,7 @@ dsl_dataset_user_release_check(void *arg, dmu_tx_t *tx)
 
 	dp = dmu_tx_pool(tx);
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 
 	ddura = arg;
 	holdfunc = ddura->ddura_holdfunc;
@@ -523,7 +523,7 @@ dsl_dataset_user_release_sync(void *arg, dmu_tx_t *tx)
 	dsl_holdfunc_t *holdfunc = ddura->ddura_holdfunc;
 	dsl_pool_t *dp = dmu_tx_pool(tx);
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 
 	for (nvpair_t *pair = nvlist_next_nvpair(ddura->ddura_chkholds, NULL);
 	    pair != NULL; pair = nvlist_next_nvpair(ddura->ddura_chkholds,
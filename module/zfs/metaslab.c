@@ -36,6 +36,10 @@
 #include <sys/zfeature.h>
 #include <sys/vdev_indirect_mapping.h>
 #include <sys/zap.h>
+#include <sys/arc.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_synctask.h>
+#include <sys/zthr.h>
 
 #define	WITH_DF_BLOCK_ALLOCATOR
 
@@ -95,6 +99,18 @@ int zfs_condense_pct = 200;
  */
 int zfs_metaslab_condense_block_threshold = 4;
 
+/*
+ * When enabled, a loaded metaslab whose space map should be condensed is
+ * not condensed in metaslab_sync(), which would write the whole condensed
+ * space map in the tail of spa_sync().  Instead the new space map is
+ * written by the spa_ms_condense_zthr, zfs_metaslab_condense_bg_segments
+ * segments per txg, and replaces the old one once it is complete.  Only
+ * one metaslab per pool is condensed that way at a time.  Empty metaslabs
+ * and forced condenses are still done synchronously.
+ */
+int zfs_metaslab_condense_bg = 0;
+int zfs_metaslab_condense_bg_segments = 65536;
+
 /*
  * The zfs_mg_noalloc_threshold defines which metaslab groups should
  * be eligible for allocation. The value is defined as a percentage of
@@ -214,6 +230,88 @@ int metaslab_preload_limit = SPA_DVAS_PER_BP;
  */
 int metaslab_preload_enabled = B_TRUE;
 
+/*
+ * Beyond metaslab_preload_limit, enough metaslabs are preloaded to hold
+ * the allocations expected in this many txgs at the recent allocation
+ * rate of the group, up to metaslab_preload_max metaslabs per group.
+ * Zero limits preloading to metaslab_preload_limit metaslabs.  This is
+ * not done while the ARC reports memory pressure.
+ */
+int metaslab_preload_txgs = TXG_SIZE;
+int metaslab_preload_max = 16;
+
+/*
+ * Weight of a txg in the moving average of the allocation rate of a
+ * metaslab group, as a power of two (1/8).
+ */
+#define	METASLAB_ALLOC_RATE_SHIFT	3
+
+/*
+ * Metaslab kstats
+ */
+static kstat_t *metaslab_ksp = NULL;
+
+typedef struct metaslab_stats {
+	kstat_named_t metaslab_stat_loads;
+	kstat_named_t metaslab_stat_preloads;
+	kstat_named_t metaslab_stat_preloads_predicted;
+	kstat_named_t metaslab_stat_unloads;
+	kstat_named_t metaslab_stat_unloads_pressure;
+	kstat_named_t metaslab_stat_gang_blocks;
+	kstat_named_t metaslab_stat_gang_avoided;
+} metaslab_stats_t;
+
+static metaslab_stats_t metaslab_stats = {
+	/* Metaslabs loaded, on demand or by the preloader */
+	{ "loads",				KSTAT_DATA_UINT64 },
+	/* Metaslabs loaded by the preloader */
+	{ "preloads",				KSTAT_DATA_UINT64 },
+	/* Preloads beyond metaslab_preload_limit for the predicted need */
+	{ "preloads_predicted",			KSTAT_DATA_UINT64 },
+	/* Metaslabs unloaded */
+	{ "unloads",				KSTAT_DATA_UINT64 },
+	/* Idle metaslabs unloaded early because of memory pressure */
+	{ "unloads_pressure",			KSTAT_DATA_UINT64 },
+	/* Blocks written as gang blocks for lack of contiguous space */
+	{ "gang_blocks",			KSTAT_DATA_UINT64 },
+	/* Blocks that would have been ganged but fit in another class */
+	{ "gang_avoided",			KSTAT_DATA_UINT64 },
+};
+
+#define	METASLAB_STAT(stat)	(metaslab_stats.stat.value.ui64)
+#define	METASLAB_BUMP(stat)	atomic_inc_64(&METASLAB_STAT(stat))
+
+void
+metaslab_stat_init(void)
+{
+	metaslab_ksp = kstat_create("zfs", 0, "metaslab_stats",
+	    "misc", KSTAT_TYPE_NAMED,
+	    sizeof (metaslab_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (metaslab_ksp != NULL) {
+		metaslab_ksp->ks_data = &metaslab_stats;
+		kstat_install(metaslab_ksp);
+	}
+}
+
+void
+metaslab_stat_gang(boolean_t avoided)
+{
+	if (avoided)
+		METASLAB_BUMP(metaslab_stat_gang_avoided);
+	else
+		METASLAB_BUMP(metaslab_stat_gang_blocks);
+}
+
+void
+metaslab_stat_fini(void)
+{
+	if (metaslab_ksp != NULL) {
+		kstat_delete(metaslab_ksp);
+		metaslab_ksp = NULL;
+	}
+}
+
 /*
  * Enable/disable fragmentation weighting on metaslabs.
  */
@@ -229,6 +327,20 @@ int metaslab_lba_weighting_enabled = B_TRUE;
  */
 int metaslab_bias_enabled = B_TRUE;
 
+/*
+ * Enable/disable biasing metaslab groups by the write throughput of their
+ * vdevs.  Each group keeps a moving average of the rate at which its
+ * throttled asynchronous writes complete, and gets a share of the rotor
+ * in proportion to its rate relative to the average of the class, within
+ * a factor of METASLAB_PERF_BIAS_MAX either way.  So in a pool with vdevs
+ * of different speeds, the faster ones take more of each txg's writes and
+ * the slower ones hold up its sync less.
+ */
+int metaslab_perf_bias_enabled = B_TRUE;
+
+#define	METASLAB_PERF_BIAS_MAX		4
+#define	METASLAB_RATE_SHIFT		4	/* 1/16 weight per sample */
+
 /*
  * Enable/disable remapping of indirect DVAs to their concrete vdevs.
  */
@@ -246,6 +358,23 @@ int zfs_metaslab_segment_weight_enabled = B_TRUE;
  */
 int zfs_metaslab_switch_threshold = 2;
 
+/*
+ * Milliseconds after which the fastwrite latency of a vdev that was not
+ * written to is forgotten.  Fastwrite (ZIL) allocations are then allowed
+ * to probe that vdev again, so that a log device which was slow for a
+ * while is not avoided forever.
+ */
+int metaslab_fastwrite_latency_expire_ms = 1000;
+
+/*
+ * Size of the chunk of free space that each allocator reserves from its
+ * primary metaslab.  Allocations of up to metaslab_chunk_max_alloc bytes
+ * are then carved off the chunk without taking the mg_lock or the ms_lock
+ * and without touching the range trees.  Zero disables the chunks.
+ */
+int metaslab_chunk_size = 0;
+int metaslab_chunk_max_alloc = 16 << 10;
+
 /*
  * Internal switch to enable/disable the metaslab allocation tracing
  * facility.
@@ -280,6 +409,7 @@ static void metaslab_check_free_impl(vdev_t *, uint64_t, uint64_t);
 static void metaslab_passivate(metaslab_t *msp, uint64_t weight);
 static uint64_t metaslab_weight_from_range_tree(metaslab_t *msp);
 static void metaslab_flush_update(metaslab_t *, dmu_tx_t *);
+static void metaslab_condense_bg_abort(spa_t *, dmu_tx_t *);
 #ifdef _METASLAB_TRACING
 kmem_cache_t *metaslab_alloc_trace_cache;
 #endif
@@ -596,9 +726,15 @@ metaslab_group_alloc_update(metaslab_group_t *mg)
 	mg->mg_initialized = metaslab_group_initialized(mg);
 	if (!was_initialized && mg->mg_initialized) {
 		mc->mc_groups++;
+		if (vd->vdev_ops == &vdev_raidz_ops)
+			mc->mc_raidz_groups++;
 	} else if (was_initialized && !mg->mg_initialized) {
 		ASSERT3U(mc->mc_groups, >, 0);
 		mc->mc_groups--;
+		if (vd->vdev_ops == &vdev_raidz_ops) {
+			ASSERT3U(mc->mc_raidz_groups, >, 0);
+			mc->mc_raidz_groups--;
+		}
 	}
 	if (mg->mg_initialized)
 		mg->mg_no_free_space = B_FALSE;
@@ -670,6 +806,12 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd, int allocators)
 	    KM_SLEEP);
 	mg->mg_secondaries = kmem_zalloc(allocators * sizeof (metaslab_t *),
 	    KM_SLEEP);
+	mg->mg_chunks = kmem_zalloc(allocators * sizeof (metaslab_chunk_t),
+	    KM_SLEEP);
+	for (int i = 0; i < allocators; i++) {
+		mutex_init(&mg->mg_chunks[i].mck_lock, NULL, MUTEX_DEFAULT,
+		    NULL);
+	}
 	avl_create(&mg->mg_metaslab_tree, metaslab_compare,
 	    sizeof (metaslab_t), offsetof(metaslab_t, ms_group_node));
 	mg->mg_vd = vd;
@@ -711,6 +853,12 @@ metaslab_group_destroy(metaslab_group_t *mg)
 	kmem_free(mg->mg_primaries, mg->mg_allocators * sizeof (metaslab_t *));
 	kmem_free(mg->mg_secondaries, mg->mg_allocators *
 	    sizeof (metaslab_t *));
+	for (int i = 0; i < mg->mg_allocators; i++) {
+		ASSERT3P(mg->mg_chunks[i].mck_msp, ==, NULL);
+		mutex_destroy(&mg->mg_chunks[i].mck_lock);
+	}
+	kmem_free(mg->mg_chunks, mg->mg_allocators *
+	    sizeof (metaslab_chunk_t));
 	mutex_destroy(&mg->mg_lock);
 	mutex_destroy(&mg->mg_ms_disabled_lock);
 	cv_destroy(&mg->mg_ms_disabled_cv);
@@ -898,8 +1046,8 @@ metaslab_group_histogram_add(metaslab_group_t *mg, metaslab_t *msp)
 	for (int i = 0; i < SPACE_MAP_HISTOGRAM_SIZE; i++) {
 		mg->mg_histogram[i + ashift] +=
 		    msp->ms_sm->sm_phys->smp_histogram[i];
-		mc->mc_histogram[i + ashift] +=
-		    msp->ms_sm->sm_phys->smp_histogram[i];
+		atomic_add_64(&mc->mc_histogram[i + ashift],
+		    msp->ms_sm->sm_phys->smp_histogram[i]);
 	}
 	mutex_exit(&mg->mg_lock);
 }
@@ -923,8 +1071,8 @@ metaslab_group_histogram_remove(metaslab_group_t *mg, metaslab_t *msp)
 
 		mg->mg_histogram[i + ashift] -=
 		    msp->ms_sm->sm_phys->smp_histogram[i];
-		mc->mc_histogram[i + ashift] -=
-		    msp->ms_sm->sm_phys->smp_histogram[i];
+		atomic_sub_64(&mc->mc_histogram[i + ashift],
+		    msp->ms_sm->sm_phys->smp_histogram[i]);
 	}
 	mutex_exit(&mg->mg_lock);
 }
@@ -1155,6 +1303,108 @@ metaslab_rangesize_compare(const void *x1, const void *x2)
 	return (AVL_CMP(r1->rs_start, r2->rs_start));
 }
 
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+/*
+ * Range tree callbacks for the ms_allocatable of the segregated fit
+ * allocator.  Besides the size-ordered tree, they file every segment in
+ * the offset-ordered tree of its power of two size bucket, and keep the
+ * bitmap of non-empty buckets up to date.
+ */
+static int
+metaslab_bucket_compare(const void *x1, const void *x2)
+{
+	const range_seg_t *r1 = x1;
+	const range_seg_t *r2 = x2;
+
+	return (AVL_CMP(r1->rs_start, r2->rs_start));
+}
+
+static int
+metaslab_bucket(const range_seg_t *rs)
+{
+	return (highbit64(rs->rs_end - rs->rs_start) - 1);
+}
+
+static void
+metaslab_sf_rt_create(range_tree_t *rt, void *arg)
+{
+	metaslab_t *msp = arg;
+
+	rt_btree_create(rt, &msp->ms_allocatable_by_size);
+	msp->ms_allocatable_by_bucket = kmem_alloc(RANGE_TREE_HISTOGRAM_SIZE *
+	    sizeof (zfs_btree_t), KM_SLEEP);
+	for (int b = 0; b < RANGE_TREE_HISTOGRAM_SIZE; b++) {
+		zfs_btree_create(&msp->ms_allocatable_by_bucket[b],
+		    metaslab_bucket_compare, sizeof (range_seg_t));
+	}
+	msp->ms_allocatable_buckets = 0;
+}
+
+static void
+metaslab_sf_rt_destroy(range_tree_t *rt, void *arg)
+{
+	metaslab_t *msp = arg;
+
+	rt_btree_destroy(rt, &msp->ms_allocatable_by_size);
+	for (int b = 0; b < RANGE_TREE_HISTOGRAM_SIZE; b++) {
+		ASSERT0(zfs_btree_numnodes(&msp->ms_allocatable_by_bucket[b]));
+		zfs_btree_destroy(&msp->ms_allocatable_by_bucket[b]);
+	}
+	kmem_free(msp->ms_allocatable_by_bucket, RANGE_TREE_HISTOGRAM_SIZE *
+	    sizeof (zfs_btree_t));
+	msp->ms_allocatable_by_bucket = NULL;
+	ASSERT0(msp->ms_allocatable_buckets);
+}
+
+static void
+metaslab_sf_rt_add(range_tree_t *rt, range_seg_t *rs, void *arg)
+{
+	metaslab_t *msp = arg;
+	int b = metaslab_bucket(rs);
+
+	rt_btree_add(rt, rs, &msp->ms_allocatable_by_size);
+	zfs_btree_add(&msp->ms_allocatable_by_bucket[b], rs);
+	msp->ms_allocatable_buckets |= 1ULL << b;
+}
+
+static void
+metaslab_sf_rt_remove(range_tree_t *rt, range_seg_t *rs, void *arg)
+{
+	metaslab_t *msp = arg;
+	int b = metaslab_bucket(rs);
+
+	rt_btree_remove(rt, rs, &msp->ms_allocatable_by_size);
+	zfs_btree_remove(&msp->ms_allocatable_by_bucket[b], rs);
+	if (zfs_btree_numnodes(&msp->ms_allocatable_by_bucket[b]) == 0)
+		msp->ms_allocatable_buckets &= ~(1ULL << b);
+}
+
+static void
+metaslab_sf_rt_vacate(range_tree_t *rt, void *arg)
+{
+	metaslab_t *msp = arg;
+
+	rt_btree_vacate(rt, &msp->ms_allocatable_by_size);
+	for (int b = 0; b < RANGE_TREE_HISTOGRAM_SIZE; b++) {
+		zfs_btree_t *t = &msp->ms_allocatable_by_bucket[b];
+
+		zfs_btree_clear(t);
+		zfs_btree_destroy(t);
+		zfs_btree_create(t, metaslab_bucket_compare,
+		    sizeof (range_seg_t));
+	}
+	msp->ms_allocatable_buckets = 0;
+}
+
+static range_tree_ops_t metaslab_sf_rt_ops = {
+	.rtop_create = metaslab_sf_rt_create,
+	.rtop_destroy = metaslab_sf_rt_destroy,
+	.rtop_add = metaslab_sf_rt_add,
+	.rtop_remove = metaslab_sf_rt_remove,
+	.rtop_vacate = metaslab_sf_rt_vacate,
+};
+#endif /* WITH_SF_BLOCK_ALLOCATOR */
+
 /*
  * ==========================================================================
  * Common allocator routines
@@ -1167,27 +1417,27 @@ metaslab_rangesize_compare(const void *x1, const void *x2)
 uint64_t
 metaslab_block_maxsize(metaslab_t *msp)
 {
-	avl_tree_t *t = &msp->ms_allocatable_by_size;
+	zfs_btree_t *t = &msp->ms_allocatable_by_size;
 	range_seg_t *rs;
 
-	if (t == NULL || (rs = avl_last(t)) == NULL)
+	if (t == NULL || (rs = zfs_btree_last(t, NULL)) == NULL)
 		return (0ULL);
 
 	return (rs->rs_end - rs->rs_start);
 }
 
 static range_seg_t *
-metaslab_block_find(avl_tree_t *t, uint64_t start, uint64_t size)
+metaslab_block_find(zfs_btree_t *t, uint64_t start, uint64_t size,
+    zfs_btree_index_t *where)
 {
 	range_seg_t *rs, rsearch;
-	avl_index_t where;
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = start + size;
 
-	rs = avl_find(t, &rsearch, &where);
+	rs = zfs_btree_find(t, &rsearch, where);
 	if (rs == NULL) {
-		rs = avl_nearest(t, where, AVL_AFTER);
+		rs = zfs_btree_next(t, where, where);
 	}
 
 	return (rs);
@@ -1197,14 +1447,15 @@ metaslab_block_find(avl_tree_t *t, uint64_t start, uint64_t size)
     defined(WITH_CF_BLOCK_ALLOCATOR)
 /*
  * This is a helper function that can be used by the allocator to find
- * a suitable block to allocate. This will search the specified AVL
- * tree looking for a block that matches the specified criteria.
+ * a suitable block to allocate. This will search the specified b-tree
+ * looking for a block that matches the specified criteria.
  */
 static uint64_t
-metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
+metaslab_block_picker(zfs_btree_t *t, uint64_t *cursor, uint64_t size,
     uint64_t max_search)
 {
-	range_seg_t *rs = metaslab_block_find(t, *cursor, size);
+	zfs_btree_index_t where;
+	range_seg_t *rs = metaslab_block_find(t, *cursor, size, &where);
 	uint64_t first_found;
 
 	if (rs != NULL)
@@ -1216,7 +1467,7 @@ metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
 			*cursor = offset + size;
 			return (offset);
 		}
-		rs = AVL_NEXT(t, rs);
+		rs = zfs_btree_next(t, &where, &where);
 	}
 
 	*cursor = 0;
@@ -1262,8 +1513,8 @@ metaslab_df_alloc(metaslab_t *msp, uint64_t size)
 	uint64_t offset;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(&rt->rt_root), ==,
-	    avl_numnodes(&msp->ms_allocatable_by_size));
+	ASSERT3U(zfs_btree_numnodes(&rt->rt_root), ==,
+	    zfs_btree_numnodes(&msp->ms_allocatable_by_size));
 
 	/*
 	 * If we're running low on space, find a segment based on size,
@@ -1281,11 +1532,12 @@ metaslab_df_alloc(metaslab_t *msp, uint64_t size)
 		range_seg_t *rs;
 		if (metaslab_df_use_largest_segment) {
 			/* use largest free segment */
-			rs = avl_last(&msp->ms_allocatable_by_size);
+			rs = zfs_btree_last(&msp->ms_allocatable_by_size, NULL);
 		} else {
+			zfs_btree_index_t where;
 			/* use segment of this size, or next largest */
 			rs = metaslab_block_find(&msp->ms_allocatable_by_size,
-			    0, size);
+			    0, size, &where);
 		}
 		if (rs != NULL && rs->rs_start + size <= rs->rs_end) {
 			offset = rs->rs_start;
@@ -1317,20 +1569,20 @@ static uint64_t
 metaslab_cf_alloc(metaslab_t *msp, uint64_t size)
 {
 	range_tree_t *rt = msp->ms_allocatable;
-	avl_tree_t *t = &msp->ms_allocatable_by_size;
+	zfs_btree_t *t = &msp->ms_allocatable_by_size;
 	uint64_t *cursor = &msp->ms_lbas[0];
 	uint64_t *cursor_end = &msp->ms_lbas[1];
 	uint64_t offset = 0;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&rt->rt_root));
+	ASSERT3U(zfs_btree_numnodes(t), ==, zfs_btree_numnodes(&rt->rt_root));
 
 	ASSERT3U(*cursor_end, >=, *cursor);
 
 	if ((*cursor + size) > *cursor_end) {
 		range_seg_t *rs;
 
-		rs = avl_last(&msp->ms_allocatable_by_size);
+		rs = zfs_btree_last(t, NULL);
 		if (rs == NULL || (rs->rs_end - rs->rs_start) < size)
 			return (-1ULL);
 
@@ -1370,16 +1622,16 @@ uint64_t metaslab_ndf_clump_shift = 4;
 static uint64_t
 metaslab_ndf_alloc(metaslab_t *msp, uint64_t size)
 {
-	avl_tree_t *t = &msp->ms_allocatable->rt_root;
-	avl_index_t where;
+	zfs_btree_t *t = &msp->ms_allocatable->rt_root;
+	zfs_btree_index_t where;
 	range_seg_t *rs, rsearch;
 	uint64_t hbit = highbit64(size);
 	uint64_t *cursor = &msp->ms_lbas[hbit - 1];
 	uint64_t max_size = metaslab_block_maxsize(msp);
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==,
-	    avl_numnodes(&msp->ms_allocatable_by_size));
+	ASSERT3U(zfs_btree_numnodes(t), ==,
+	    zfs_btree_numnodes(&msp->ms_allocatable_by_size));
 
 	if (max_size < size)
 		return (-1ULL);
@@ -1387,16 +1639,16 @@ metaslab_ndf_alloc(metaslab_t *msp, uint64_t size)
 	rsearch.rs_start = *cursor;
 	rsearch.rs_end = *cursor + size;
 
-	rs = avl_find(t, &rsearch, &where);
+	rs = zfs_btree_find(t, &rsearch, &where);
 	if (rs == NULL || (rs->rs_end - rs->rs_start) < size) {
 		t = &msp->ms_allocatable_by_size;
 
 		rsearch.rs_start = 0;
 		rsearch.rs_end = MIN(max_size,
 		    1ULL << (hbit + metaslab_ndf_clump_shift));
-		rs = avl_find(t, &rsearch, &where);
+		rs = zfs_btree_find(t, &rsearch, &where);
 		if (rs == NULL)
-			rs = avl_nearest(t, where, AVL_AFTER);
+			rs = zfs_btree_next(t, &where, &where);
 		ASSERT(rs != NULL);
 	}
 
@@ -1414,6 +1666,58 @@ static metaslab_ops_t metaslab_ndf_ops = {
 metaslab_ops_t *zfs_metaslab_ops = &metaslab_ndf_ops;
 #endif /* WITH_NDF_BLOCK_ALLOCATOR */
 
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+/*
+ * ==========================================================================
+ * Segregated fit (sf) block allocator -
+ * Allocate from the lowest offset segment of the smallest power of two size
+ * bucket whose segments are all large enough, which the bitmap of non-empty
+ * buckets yields in constant time.  This is a good fit that does not hunt
+ * through a fragmented metaslab, and that keeps allocations of similar sizes
+ * to the low end of the metaslab.  Only if no such bucket exists, the best
+ * fitting segment is looked up in the size-ordered tree, as it may be in the
+ * bucket of the requested size itself.
+ * ==========================================================================
+ */
+static uint64_t
+metaslab_sf_alloc(metaslab_t *msp, uint64_t size)
+{
+	range_tree_t *rt = msp->ms_allocatable;
+	range_seg_t *rs;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT3U(zfs_btree_numnodes(&rt->rt_root), ==,
+	    zfs_btree_numnodes(&msp->ms_allocatable_by_size));
+	ASSERT3P(msp->ms_allocatable_by_bucket, !=, NULL);
+
+	/* The segments of bucket b and above are at least 2^b bytes long */
+	int b = highbit64(size - 1);
+	uint64_t buckets = (b < RANGE_TREE_HISTOGRAM_SIZE) ?
+	    msp->ms_allocatable_buckets & ~((1ULL << b) - 1) : 0;
+
+	if (buckets != 0) {
+		b = lowbit64(buckets) - 1;
+		rs = zfs_btree_first(&msp->ms_allocatable_by_bucket[b], NULL);
+		ASSERT3P(rs, !=, NULL);
+		ASSERT3U(rs->rs_end - rs->rs_start, >=, size);
+		return (rs->rs_start);
+	}
+
+	zfs_btree_index_t where;
+	rs = metaslab_block_find(&msp->ms_allocatable_by_size, 0, size, &where);
+	if (rs != NULL && rs->rs_start + size <= rs->rs_end)
+		return (rs->rs_start);
+
+	return (-1ULL);
+}
+
+static metaslab_ops_t metaslab_sf_ops = {
+	metaslab_sf_alloc
+};
+
+metaslab_ops_t *zfs_metaslab_ops = &metaslab_sf_ops;
+#endif /* WITH_SF_BLOCK_ALLOCATOR */
+
 
 /*
  * ==========================================================================
@@ -1946,6 +2250,8 @@ metaslab_load(metaslab_t *msp)
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 	msp->ms_loading = B_FALSE;
 	cv_broadcast(&msp->ms_load_cv);
+	if (error == 0)
+		METASLAB_BUMP(metaslab_stat_loads);
 
 	return (error);
 }
@@ -1957,6 +2263,8 @@ metaslab_unload(metaslab_t *msp)
 
 	metaslab_verify_weight_and_frag(msp);
 
+	if (msp->ms_loaded)
+		METASLAB_BUMP(metaslab_stat_unloads);
 	range_tree_vacate(msp->ms_allocatable, NULL, NULL);
 	msp->ms_loaded = B_FALSE;
 
@@ -2012,6 +2320,9 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object,
 	ms->ms_id = id;
 	ms->ms_start = id << vd->vdev_ms_shift;
 	ms->ms_size = 1ULL << vd->vdev_ms_shift;
+	if (vd->vdev_ops->vdev_op_metaslab_init != NULL)
+		vd->vdev_ops->vdev_op_metaslab_init(vd, &ms->ms_start,
+		    &ms->ms_size);
 	ms->ms_allocator = -1;
 	ms->ms_new = B_TRUE;
 
@@ -2047,8 +2358,13 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object,
 	 * we'd data fault on any attempt to use this metaslab before
 	 * it's ready.
 	 */
-	ms->ms_allocatable = range_tree_create_impl(&rt_avl_ops,
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+	ms->ms_allocatable = range_tree_create_impl(&metaslab_sf_rt_ops,
+	    ms, metaslab_rangesize_compare, 0);
+#else
+	ms->ms_allocatable = range_tree_create_impl(&rt_btree_ops,
 	    &ms->ms_allocatable_by_size, metaslab_rangesize_compare, 0);
+#endif
 
 	ms->ms_trim = range_tree_create(NULL, NULL);
 
@@ -2115,6 +2431,10 @@ metaslab_fini(metaslab_t *msp)
 	vdev_t *vd = mg->mg_vd;
 	spa_t *spa = vd->vdev_spa;
 
+	if (spa->spa_ms_condense != NULL &&
+	    spa->spa_ms_condense->msc_msp == msp)
+		metaslab_condense_bg_abort(spa, NULL);
+
 	metaslab_fini_flush_data(msp);
 
 	metaslab_group_remove(mg, msp);
@@ -2710,6 +3030,50 @@ metaslab_activate(metaslab_t *msp, int allocator, uint64_t activation_weight)
 	return (0);
 }
 
+/*
+ * Returns the part of the chunk that was not handed out to its metaslab.
+ * Since the whole chunk was allocated in mck_txg, this undoes the
+ * allocation of that part, like metaslab_unalloc_dva() does.
+ */
+static void
+metaslab_chunk_retire(metaslab_chunk_t *mck)
+{
+	metaslab_t *msp = mck->mck_msp;
+	uint64_t size = mck->mck_end - mck->mck_start;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT(MUTEX_HELD(&mck->mck_lock));
+
+	if (size != 0) {
+		range_tree_remove(msp->ms_allocating[mck->mck_txg & TXG_MASK],
+		    mck->mck_start, size);
+		range_tree_add(msp->ms_allocatable, mck->mck_start, size);
+		msp->ms_max_size = metaslab_block_maxsize(msp);
+	}
+	mck->mck_msp = NULL;
+	mck->mck_txg = 0;
+	mck->mck_start = mck->mck_end = 0;
+}
+
+/*
+ * Retires the chunk that allocator carved from msp, if any, or only one
+ * carved in the given txg when txg is non-zero.  An allocator carves its
+ * chunk from its primary metaslab only, so this is done when the metaslab
+ * is passivated and before its allocations of a txg are synced.
+ */
+static void
+metaslab_chunk_retire_msp(metaslab_t *msp, int allocator, uint64_t txg)
+{
+	metaslab_chunk_t *mck = &msp->ms_group->mg_chunks[allocator];
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	mutex_enter(&mck->mck_lock);
+	if (mck->mck_msp == msp && (txg == 0 || mck->mck_txg == txg))
+		metaslab_chunk_retire(mck);
+	mutex_exit(&mck->mck_lock);
+}
+
 static void
 metaslab_passivate_allocator(metaslab_group_t *mg, metaslab_t *msp,
     uint64_t weight)
@@ -2731,6 +3095,7 @@ metaslab_passivate_allocator(metaslab_group_t *mg, metaslab_t *msp,
 		ASSERT3P(mg->mg_primaries[msp->ms_allocator], ==, msp);
 		ASSERT(msp->ms_weight & METASLAB_WEIGHT_PRIMARY);
 		mg->mg_primaries[msp->ms_allocator] = NULL;
+		metaslab_chunk_retire_msp(msp, msp->ms_allocator, 0);
 	} else {
 		ASSERT3P(mg->mg_secondaries[msp->ms_allocator], ==, msp);
 		ASSERT(msp->ms_weight & METASLAB_WEIGHT_SECONDARY);
@@ -2804,12 +3169,57 @@ metaslab_preload(void *arg)
 	ASSERT(!MUTEX_HELD(&msp->ms_group->mg_lock));
 
 	mutex_enter(&msp->ms_lock);
-	(void) metaslab_load(msp);
+	if (!msp->ms_loaded && metaslab_load(msp) == 0)
+		METASLAB_BUMP(metaslab_stat_preloads);
 	msp->ms_selected_txg = spa_syncing_txg(spa);
 	mutex_exit(&msp->ms_lock);
 	spl_fstrans_unmark(cookie);
 }
 
+/*
+ * Returns the part of the free space of msp that is expected to be
+ * allocated from it before it is passivated.  This is its free space
+ * discounted by its fragmentation, which is derived from its free space
+ * histogram, or by that of its group when it has none.
+ */
+static uint64_t
+metaslab_usable_space(metaslab_t *msp)
+{
+	uint64_t fragmentation = msp->ms_fragmentation;
+	uint64_t space = msp->ms_size - metaslab_allocated_space(msp);
+
+	if (fragmentation == ZFS_FRAG_INVALID)
+		fragmentation = msp->ms_group->mg_fragmentation;
+	if (fragmentation != ZFS_FRAG_INVALID)
+		space = space / 100 * (100 - MIN(fragmentation, 100));
+
+	return (space);
+}
+
+/*
+ * Updates the moving average of the bytes allocated from the group per
+ * txg with those synced in this txg.  The txgs in which the vdev was not
+ * dirty count as txgs without allocations.
+ */
+static void
+metaslab_group_alloc_rate_update(metaslab_group_t *mg, uint64_t txg)
+{
+	for (uint64_t t = mg->mg_alloc_rate_txg + 1; t < txg &&
+	    mg->mg_alloc_rate != 0; t++) {
+		mg->mg_alloc_rate -= mg->mg_alloc_rate >>
+		    METASLAB_ALLOC_RATE_SHIFT;
+		if (t - mg->mg_alloc_rate_txg > 64) {
+			mg->mg_alloc_rate = 0;
+			break;
+		}
+	}
+	mg->mg_alloc_rate = mg->mg_alloc_rate -
+	    (mg->mg_alloc_rate >> METASLAB_ALLOC_RATE_SHIFT) +
+	    (mg->mg_alloc_txg_bytes >> METASLAB_ALLOC_RATE_SHIFT);
+	mg->mg_alloc_rate_txg = txg;
+	mg->mg_alloc_txg_bytes = 0;
+}
+
 static void
 metaslab_group_preload(metaslab_group_t *mg)
 {
@@ -2823,6 +3233,17 @@ metaslab_group_preload(metaslab_group_t *mg)
 		return;
 	}
 
+	/*
+	 * The space expected to be allocated from this group before the
+	 * next reassessments can preload more metaslabs.  Loading a
+	 * metaslab with a large space map takes long enough that it should
+	 * be done before an allocation has to wait for it.
+	 */
+	uint64_t need = 0;
+	if (metaslab_preload_txgs > 0 && arc_available_memory() >= 0)
+		need = mg->mg_alloc_rate * metaslab_preload_txgs;
+	uint64_t covered = 0;
+
 	mutex_enter(&mg->mg_lock);
 
 	/*
@@ -2832,14 +3253,20 @@ metaslab_group_preload(metaslab_group_t *mg)
 		ASSERT3P(msp->ms_group, ==, mg);
 
 		/*
-		 * We preload only the maximum number of metaslabs specified
-		 * by metaslab_preload_limit. If a metaslab is being forced
+		 * We preload the maximum number of metaslabs specified
+		 * by metaslab_preload_limit, and more of them, up to
+		 * metaslab_preload_max, while their usable space does not
+		 * cover the predicted need. If a metaslab is being forced
 		 * to condense then we preload it too. This will ensure
 		 * that force condensing happens in the next txg.
 		 */
 		if (++m > metaslab_preload_limit && !msp->ms_condense_wanted) {
-			continue;
+			if (covered >= need || m > metaslab_preload_max)
+				continue;
+			if (!msp->ms_loaded)
+				METASLAB_BUMP(metaslab_stat_preloads_predicted);
 		}
+		covered += metaslab_usable_space(msp);
 
 		VERIFY(taskq_dispatch(mg->mg_taskq, metaslab_preload,
 		    msp, TQ_SLEEP) != TASKQID_INVALID);
@@ -2880,11 +3307,15 @@ metaslab_should_condense(metaslab_t *msp)
 	ASSERT(sm != NULL);
 	ASSERT3U(spa_sync_pass(vd->vdev_spa), ==, 1);
 
+	/* Its new space map is already being written */
+	if (msp->ms_condensing_bg)
+		return (B_FALSE);
+
 	/*
 	 * We always condense metaslabs that are empty and metaslabs for
 	 * which a condense request has been made.
 	 */
-	if (avl_is_empty(&msp->ms_allocatable_by_size) ||
+	if (zfs_btree_numnodes(&msp->ms_allocatable_by_size) == 0 ||
 	    msp->ms_condense_wanted)
 		return (B_TRUE);
 
@@ -2897,6 +3328,33 @@ metaslab_should_condense(metaslab_t *msp)
 	    object_size > zfs_metaslab_condense_block_threshold * record_size);
 }
 
+/*
+ * Returns a range tree of the space which is allocated as of the end of
+ * the previous txg, except for the segments which are also free in
+ * ms_allocatable, see the comment in metaslab_condense().
+ */
+static range_tree_t *
+metaslab_condense_tree(metaslab_t *msp, uint64_t txg)
+{
+	range_tree_t *condense_tree = range_tree_create(NULL, NULL);
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	range_tree_add(condense_tree, msp->ms_start, msp->ms_size);
+
+	for (int t = 0; t < TXG_DEFER_SIZE; t++) {
+		range_tree_walk(msp->ms_defer[t],
+		    range_tree_remove, condense_tree);
+	}
+
+	for (int t = 0; t < TXG_CONCURRENT_STATES; t++) {
+		range_tree_walk(msp->ms_allocating[(txg + t) & TXG_MASK],
+		    range_tree_remove, condense_tree);
+	}
+
+	return (condense_tree);
+}
+
 /*
  * Condense the on-disk space map representation to its minimized form.
  * The minimized form consists of a small number of allocations followed
@@ -2965,28 +3423,19 @@ metaslab_condense(metaslab_t *msp, dmu_tx_t *tx)
 	    "spa %s, smp size %llu, segments %lu, forcing condense=%s", txg,
 	    msp->ms_id, msp, msp->ms_group->mg_vd->vdev_id,
 	    spa->spa_name, space_map_length(msp->ms_sm),
-	    avl_numnodes(&msp->ms_allocatable->rt_root),
+	    zfs_btree_numnodes(&msp->ms_allocatable->rt_root),
 	    msp->ms_condense_wanted ? "TRUE" : "FALSE");
 
 	msp->ms_condense_wanted = B_FALSE;
 
-	condense_tree = range_tree_create(NULL, NULL);
-	range_tree_add(condense_tree, msp->ms_start, msp->ms_size);
-
-	for (int t = 0; t < TXG_DEFER_SIZE; t++) {
-		range_tree_walk(msp->ms_defer[t],
-		    range_tree_remove, condense_tree);
-	}
-
-	for (int t = 0; t < TXG_CONCURRENT_STATES; t++) {
-		range_tree_walk(msp->ms_allocating[(txg + t) & TXG_MASK],
-		    range_tree_remove, condense_tree);
-	}
+	condense_tree = metaslab_condense_tree(msp, txg);
 
+	mutex_enter(&spa->spa_vdev_sync_lock);
 	ASSERT3U(spa->spa_unflushed_stats.sus_memused, >=,
 	    metaslab_unflushed_changes_memused(msp));
 	spa->spa_unflushed_stats.sus_memused -=
 	    metaslab_unflushed_changes_memused(msp);
+	mutex_exit(&spa->spa_vdev_sync_lock);
 	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
 	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
 
@@ -3078,6 +3527,12 @@ metaslab_flush_update(metaslab_t *msp, dmu_tx_t *tx)
 
 	VERIFY3U(tx->tx_txg, <=, spa_final_dirty_txg(spa));
 
+	/*
+	 * The log space map state is shared by all vdevs, which may be
+	 * synced concurrently when we get here from metaslab_condense().
+	 */
+	mutex_enter(&spa->spa_vdev_sync_lock);
+
 	/* update metaslab's position in our flushing tree */
 	uint64_t ms_prev_flushed_txg = metaslab_unflushed_txg(msp);
 	mutex_enter(&spa->spa_flushed_ms_lock);
@@ -3101,6 +3556,7 @@ metaslab_flush_update(metaslab_t *msp, dmu_tx_t *tx)
 	spa_log_summary_add_flushed_metaslab(spa);
 	spa_log_summary_decrement_mscount(spa, ms_prev_flushed_txg);
 	spa_log_summary_decrement_blkcount(spa, blocks_gone);
+	mutex_exit(&spa->spa_vdev_sync_lock);
 }
 
 boolean_t
@@ -3227,6 +3683,342 @@ metaslab_flush(metaslab_t *msp, dmu_tx_t *tx)
 	return (B_TRUE);
 }
 
+/*
+ * Frees the space map object of a background condense which did not
+ * complete, e.g. because the pool was exported in the middle of it.
+ */
+void
+metaslab_condense_free_orphan(vdev_t *vd, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(vd->vdev_spa);
+	uint64_t object;
+
+	if (vd->vdev_top_zap == 0 || zap_lookup(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_CONDENSE_SM, sizeof (object), 1, &object) != 0)
+		return;
+
+	space_map_free_obj(mos, object, tx);
+	VERIFY0(zap_remove(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_CONDENSE_SM, tx));
+}
+
+static void
+metaslab_condense_bg_destroy(spa_t *spa)
+{
+	metaslab_condense_t *msc = spa->spa_ms_condense;
+	metaslab_t *msp = msc->msc_msp;
+
+	mutex_enter(&msp->ms_lock);
+	msp->ms_condensing_bg = B_FALSE;
+	mutex_exit(&msp->ms_lock);
+
+	if (msc->msc_sm != NULL)
+		space_map_close(msc->msc_sm);
+	range_tree_vacate(msc->msc_alloc, NULL, NULL);
+	range_tree_destroy(msc->msc_alloc);
+	range_tree_vacate(msc->msc_free, NULL, NULL);
+	range_tree_destroy(msc->msc_free);
+	range_tree_vacate(msc->msc_allocs, NULL, NULL);
+	range_tree_destroy(msc->msc_allocs);
+	range_tree_vacate(msc->msc_frees, NULL, NULL);
+	range_tree_destroy(msc->msc_frees);
+	kmem_free(msc, sizeof (*msc));
+	spa->spa_ms_condense = NULL;
+}
+
+/*
+ * Abandons the background condense.  Outside of syncing context (tx is
+ * NULL) the new space map object is left behind, to be freed by the next
+ * metaslab_condense_free_orphan() of its vdev.
+ */
+static void
+metaslab_condense_bg_abort(spa_t *spa, dmu_tx_t *tx)
+{
+	vdev_t *vd = spa->spa_ms_condense->msc_msp->ms_group->mg_vd;
+
+	zfs_dbgmsg("condensing in background aborted: msp[%llu] %px, "
+	    "vdev id %llu, spa %s",
+	    spa->spa_ms_condense->msc_msp->ms_id,
+	    spa->spa_ms_condense->msc_msp, vd->vdev_id, spa->spa_name);
+
+	metaslab_condense_bg_destroy(spa);
+	if (tx != NULL)
+		metaslab_condense_free_orphan(vd, tx);
+}
+
+/*
+ * Starts to condense the metaslab in the background, see
+ * zfs_metaslab_condense_bg.  Returns B_FALSE if it should be condensed
+ * synchronously instead.  If another metaslab is being condensed in the
+ * background, this one is left alone and reconsidered the next time it
+ * is synced.
+ */
+static boolean_t
+metaslab_condense_bg_start(metaslab_t *msp, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa_meta_objset(spa);
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT(msp->ms_loaded);
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+
+	if (!zfs_metaslab_condense_bg || spa->spa_ms_condense_zthr == NULL ||
+	    vd->vdev_top_zap == 0 || vd->vdev_removing ||
+	    msp->ms_condense_wanted ||
+	    zfs_btree_numnodes(&msp->ms_allocatable_by_size) == 0)
+		return (B_FALSE);
+
+	/* Other vdevs may be synced concurrently */
+	mutex_enter(&spa->spa_vdev_sync_lock);
+	boolean_t busy = (spa->spa_ms_condense != NULL);
+	if (!busy)
+		spa->spa_ms_condense = kmem_zalloc(sizeof (metaslab_condense_t),
+		    KM_SLEEP);
+	mutex_exit(&spa->spa_vdev_sync_lock);
+	if (busy)
+		return (B_TRUE);
+
+	zfs_dbgmsg("condensing in background: txg %llu, msp[%llu] %px, "
+	    "vdev id %llu, spa %s, smp size %llu, segments %lu", txg,
+	    msp->ms_id, msp, vd->vdev_id, spa->spa_name,
+	    space_map_length(msp->ms_sm),
+	    zfs_btree_numnodes(&msp->ms_allocatable->rt_root));
+
+	/*
+	 * The new space map starts out as the state of the metaslab as of
+	 * the end of the previous txg, written as in metaslab_condense().
+	 * Everything synced from this txg on is accumulated by
+	 * metaslab_sync() in msc_allocs and msc_frees.
+	 */
+	metaslab_condense_t *msc = spa->spa_ms_condense;
+	msc->msc_msp = msp;
+	msc->msc_alloc = metaslab_condense_tree(msp, txg);
+	msc->msc_free = range_tree_create(NULL, NULL);
+	range_tree_walk(msp->ms_allocatable, range_tree_add, msc->msc_free);
+	msc->msc_allocs = range_tree_create(NULL, NULL);
+	msc->msc_frees = range_tree_create(NULL, NULL);
+
+	msp->ms_condensing_bg = B_TRUE;
+
+	/*
+	 * The object is recorded in the vdev's ZAP until it replaces the
+	 * old space map, so that it can be freed if the pool is exported
+	 * before that.
+	 */
+	mutex_exit(&msp->ms_lock);
+	metaslab_condense_free_orphan(vd, tx);
+	uint64_t object = space_map_alloc(mos,
+	    spa_feature_is_enabled(spa, SPA_FEATURE_LOG_SPACEMAP) ?
+	    zfs_metaslab_sm_blksz_with_log : zfs_metaslab_sm_blksz_no_log, tx);
+	VERIFY3U(object, !=, 0);
+	VERIFY0(space_map_open(&msc->msc_sm, mos, object,
+	    msp->ms_start, msp->ms_size, vd->vdev_ashift));
+	VERIFY0(zap_add(mos, vd->vdev_top_zap, VDEV_TOP_ZAP_MS_CONDENSE_SM,
+	    sizeof (object), 1, &object, tx));
+	mutex_enter(&msp->ms_lock);
+
+	zthr_wakeup(spa->spa_ms_condense_zthr);
+	return (B_TRUE);
+}
+
+/*
+ * Moves up to max segments from the start of rt to the new space map.
+ * Returns the number of segments written.
+ */
+static uint64_t
+metaslab_condense_bg_write(metaslab_condense_t *msc, range_tree_t *rt,
+    maptype_t maptype, uint64_t max, dmu_tx_t *tx)
+{
+	range_tree_t *batch = range_tree_create(NULL, NULL);
+	range_seg_t *rs;
+	uint64_t n;
+
+	for (n = 0; n < max && (rs = range_tree_first(rt)) != NULL; n++) {
+		uint64_t start = rs->rs_start;
+		uint64_t size = rs->rs_end - rs->rs_start;
+
+		range_tree_remove(rt, start, size);
+		range_tree_add(batch, start, size);
+	}
+
+	space_map_write(msc->msc_sm, batch, maptype, SM_NO_VDEVID, tx);
+	range_tree_vacate(batch, NULL, NULL);
+	range_tree_destroy(batch);
+
+	return (n);
+}
+
+/*
+ * Replaces the metaslab's space map with the one which was written in the
+ * background.  This completes as a flush would, see metaslab_flush().
+ */
+static void
+metaslab_condense_bg_complete(spa_t *spa, dmu_tx_t *tx)
+{
+	metaslab_condense_t *msc = spa->spa_ms_condense;
+	metaslab_t *msp = msc->msc_msp;
+	metaslab_group_t *mg = msp->ms_group;
+	vdev_t *vd = mg->mg_vd;
+	objset_t *mos = spa_meta_objset(spa);
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	/*
+	 * The histograms are rebuilt from the in-core range trees, so an
+	 * unloaded metaslab has to be condensed again from scratch.
+	 */
+	if (!msp->ms_loaded) {
+		metaslab_condense_bg_abort(spa, tx);
+		return;
+	}
+
+	/*
+	 * Metaslab flushes expect a syncing log space map, and we get here
+	 * from dsl_pool_sync(), before metaslab_sync() would create it.
+	 */
+	spa_generate_syncing_log_sm(spa, tx);
+
+	space_map_write(msc->msc_sm, msc->msc_allocs, SM_ALLOC,
+	    SM_NO_VDEVID, tx);
+	space_map_write(msc->msc_sm, msc->msc_frees, SM_FREE,
+	    SM_NO_VDEVID, tx);
+
+	uint64_t object = space_map_object(msc->msc_sm);
+	uint64_t old_object = space_map_object(msp->ms_sm);
+	dmu_write(mos, vd->vdev_ms_array, sizeof (uint64_t) * msp->ms_id,
+	    sizeof (uint64_t), &object, tx);
+	VERIFY0(zap_remove(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_CONDENSE_SM, tx));
+
+	mutex_enter(&msp->ms_sync_lock);
+	mutex_enter(&msp->ms_lock);
+	ASSERT(range_tree_is_empty(msp->ms_freed)); /* since it is pass 1 */
+
+	zfs_dbgmsg("condensed in background: txg %llu, msp[%llu] %px, "
+	    "vdev id %llu, spa %s, smp size %llu -> %llu", txg, msp->ms_id,
+	    msp, vd->vdev_id, spa->spa_name, space_map_length(msp->ms_sm),
+	    space_map_length(msc->msc_sm));
+
+	/*
+	 * For all histogram operations below refer to the comments of
+	 * metaslab_sync() where we follow a similar procedure.
+	 */
+	metaslab_group_histogram_verify(mg);
+	metaslab_class_histogram_verify(mg->mg_class);
+	metaslab_group_histogram_remove(mg, msp);
+
+	space_map_t *old_sm = msp->ms_sm;
+	msp->ms_sm = msc->msc_sm;
+	msc->msc_sm = NULL;
+
+	space_map_histogram_clear(msp->ms_sm);
+	space_map_histogram_add(msp->ms_sm, msp->ms_allocatable, tx);
+	for (int t = 0; t < TXG_DEFER_SIZE; t++)
+		space_map_histogram_add(msp->ms_sm, msp->ms_defer[t], tx);
+	metaslab_aux_histograms_update(msp);
+
+	metaslab_group_histogram_add(mg, msp);
+	metaslab_group_histogram_verify(mg);
+	metaslab_class_histogram_verify(mg->mg_class);
+
+	/* The new space map includes all of the unflushed changes */
+	ASSERT3U(spa->spa_unflushed_stats.sus_memused, >=,
+	    metaslab_unflushed_changes_memused(msp));
+	spa->spa_unflushed_stats.sus_memused -=
+	    metaslab_unflushed_changes_memused(msp);
+	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+	metaslab_flush_update(msp, tx);
+
+	metaslab_verify_space(msp, txg);
+	metaslab_recalculate_weight_and_sort(msp);
+	mutex_exit(&msp->ms_lock);
+	mutex_exit(&msp->ms_sync_lock);
+
+	space_map_close(old_sm);
+	space_map_free_obj(mos, old_object, tx);
+
+	metaslab_condense_bg_destroy(spa);
+}
+
+/*
+ * Writes the next batch of the new space map, called from syncing context
+ * once per txg while a background condense is active.
+ */
+static void
+metaslab_condense_bg_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = arg;
+	metaslab_condense_t *msc = spa->spa_ms_condense;
+
+	if (msc == NULL)
+		return;
+
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+
+	if (msc->msc_msp->ms_group->mg_vd->vdev_removing) {
+		metaslab_condense_bg_abort(spa, tx);
+		return;
+	}
+
+	/*
+	 * All of the allocated segments have to precede the free ones in
+	 * the new space map, as they overlap.
+	 */
+	uint64_t max = MAX(zfs_metaslab_condense_bg_segments, 1);
+	max -= metaslab_condense_bg_write(msc, msc->msc_alloc, SM_ALLOC,
+	    max, tx);
+	if (range_tree_is_empty(msc->msc_alloc)) {
+		(void) metaslab_condense_bg_write(msc, msc->msc_free, SM_FREE,
+		    max, tx);
+	}
+
+	if (range_tree_is_empty(msc->msc_alloc) &&
+	    range_tree_is_empty(msc->msc_free))
+		metaslab_condense_bg_complete(spa, tx);
+}
+
+static boolean_t
+metaslab_condense_thread_check(void *arg, zthr_t *zthr)
+{
+	spa_t *spa = arg;
+
+	return (spa->spa_ms_condense != NULL);
+}
+
+/*
+ * Queues one batch of the background condense per txg, without forcing
+ * txgs to sync any sooner than they otherwise would.
+ */
+static void
+metaslab_condense_thread(void *arg, zthr_t *zthr)
+{
+	spa_t *spa = arg;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+
+	while (spa->spa_ms_condense != NULL && !zthr_iscancelled(zthr)) {
+		dmu_tx_t *tx = dmu_tx_create_dd(dp->dp_mos_dir);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		uint64_t txg = dmu_tx_get_txg(tx);
+
+		dsl_sync_task_nowait(dp, metaslab_condense_bg_sync, spa,
+		    0, ZFS_SPACE_CHECK_NONE, tx);
+		dmu_tx_commit(tx);
+
+		txg_wait_open(dp, txg + 1, B_FALSE);
+	}
+}
+
+void
+metaslab_start_condense_thread(spa_t *spa)
+{
+	ASSERT3P(spa->spa_ms_condense_zthr, ==, NULL);
+	spa->spa_ms_condense_zthr = zthr_create(metaslab_condense_thread_check,
+	    metaslab_condense_thread, spa);
+}
+
 /*
  * Write a metaslab to disk in the context of the specified transaction group.
  */
@@ -3256,6 +4048,15 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	ASSERT3P(msp->ms_checkpointing, !=, NULL);
 	ASSERT3P(msp->ms_trim, !=, NULL);
 
+	/*
+	 * Give back what was not handed out of the chunks carved in this
+	 * txg, so that only the allocated space is synced as such.
+	 */
+	mutex_enter(&msp->ms_lock);
+	for (int i = 0; i < mg->mg_allocators; i++)
+		metaslab_chunk_retire_msp(msp, i, txg);
+	mutex_exit(&msp->ms_lock);
+
 	/*
 	 * Normally, we don't want to process a metaslab if there are no
 	 * allocations or frees to perform. However, if the metaslab is being
@@ -3270,6 +4071,9 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	VERIFY(txg <= spa_final_dirty_txg(spa));
 
+	/* Feed the allocation rate used by metaslab_group_preload() */
+	mg->mg_alloc_txg_bytes += range_tree_space(alloctree);
+
 	/*
 	 * The only state that can actually be changing concurrently
 	 * with metaslab_sync() is the metaslab's ms_allocatable. No
@@ -3286,9 +4090,13 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	tx = dmu_tx_create_assigned(spa_get_dsl(spa), txg);
 
 	/*
-	 * Generate a log space map if one doesn't exist already.
+	 * Generate a log space map if one doesn't exist already.  Like
+	 * all of the pool-wide state below, it is protected against the
+	 * concurrent syncing of other vdevs by the spa_vdev_sync_lock.
 	 */
+	mutex_enter(&spa->spa_vdev_sync_lock);
 	spa_generate_syncing_log_sm(spa, tx);
+	mutex_exit(&spa->spa_vdev_sync_lock);
 
 	if (msp->ms_sm == NULL) {
 		uint64_t new_object = space_map_alloc(mos,
@@ -3314,8 +4122,10 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		ASSERT(spa_syncing_log_sm(spa) != NULL);
 
 		metaslab_set_unflushed_txg(msp, spa_syncing_txg(spa), tx);
+		mutex_enter(&spa->spa_vdev_sync_lock);
 		spa_log_sm_increment_current_mscount(spa);
 		spa_log_summary_add_flushed_metaslab(spa);
+		mutex_exit(&spa->spa_vdev_sync_lock);
 
 		ASSERT(msp->ms_sm != NULL);
 		mutex_enter(&spa->spa_flushed_ms_lock);
@@ -3361,7 +4171,8 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	metaslab_group_histogram_remove(mg, msp);
 
 	if (spa->spa_sync_pass == 1 && msp->ms_loaded &&
-	    metaslab_should_condense(msp))
+	    metaslab_should_condense(msp) &&
+	    !metaslab_condense_bg_start(msp, tx))
 		metaslab_condense(msp, tx);
 
 	/*
@@ -3374,12 +4185,15 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	if (log_sm != NULL) {
 		ASSERT(spa_feature_is_enabled(spa, SPA_FEATURE_LOG_SPACEMAP));
 
+		mutex_enter(&spa->spa_vdev_sync_lock);
 		space_map_write(log_sm, alloctree, SM_ALLOC,
 		    vd->vdev_id, tx);
 		space_map_write(log_sm, msp->ms_freeing, SM_FREE,
 		    vd->vdev_id, tx);
+		mutex_exit(&spa->spa_vdev_sync_lock);
 		mutex_enter(&msp->ms_lock);
 
+		mutex_enter(&spa->spa_vdev_sync_lock);
 		ASSERT3U(spa->spa_unflushed_stats.sus_memused, >=,
 		    metaslab_unflushed_changes_memused(msp));
 		spa->spa_unflushed_stats.sus_memused -=
@@ -3390,6 +4204,7 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		    msp->ms_unflushed_allocs, msp->ms_unflushed_frees);
 		spa->spa_unflushed_stats.sus_memused +=
 		    metaslab_unflushed_changes_memused(msp);
+		mutex_exit(&spa->spa_vdev_sync_lock);
 	} else {
 		ASSERT(!spa_feature_is_enabled(spa, SPA_FEATURE_LOG_SPACEMAP));
 
@@ -3400,6 +4215,20 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		mutex_enter(&msp->ms_lock);
 	}
 
+	/*
+	 * Keep track of what the space map being written in the background
+	 * still misses.
+	 */
+	if (msp->ms_condensing_bg) {
+		metaslab_condense_t *msc = spa->spa_ms_condense;
+		ASSERT3P(msc->msc_msp, ==, msp);
+
+		range_tree_remove_xor_add(alloctree,
+		    msc->msc_frees, msc->msc_allocs);
+		range_tree_remove_xor_add(msp->ms_freeing,
+		    msc->msc_allocs, msc->msc_frees);
+	}
+
 	msp->ms_allocated_space += range_tree_space(alloctree);
 	ASSERT3U(msp->ms_allocated_space, >=,
 	    range_tree_space(msp->ms_freeing));
@@ -3420,8 +4249,10 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		    msp->ms_checkpointing, SM_FREE, SM_NO_VDEVID, tx);
 		mutex_enter(&msp->ms_lock);
 
+		mutex_enter(&spa->spa_vdev_sync_lock);
 		spa->spa_checkpoint_info.sci_dspace +=
 		    range_tree_space(msp->ms_checkpointing);
+		mutex_exit(&spa->spa_vdev_sync_lock);
 		vd->vdev_stat.vs_checkpoint_space +=
 		    range_tree_space(msp->ms_checkpointing);
 		ASSERT3U(vd->vdev_stat.vs_checkpoint_space, ==,
@@ -3522,11 +4353,22 @@ metaslab_potentially_unload(metaslab_t *msp, uint64_t txg)
 {
 	/*
 	 * If the metaslab is loaded and we've not tried to load or allocate
-	 * from it in 'metaslab_unload_delay' txgs, then unload it.
+	 * from it in 'metaslab_unload_delay' txgs, then unload it.  While the
+	 * ARC reports memory pressure, an inactive metaslab is unloaded as
+	 * soon as it was not used or preloaded in the previous txg.
 	 */
-	if (msp->ms_loaded &&
-	    msp->ms_disabled == 0 &&
-	    msp->ms_selected_txg + metaslab_unload_delay < txg) {
+	if (!msp->ms_loaded || msp->ms_disabled != 0 || msp->ms_condensing_bg)
+		return;
+
+	boolean_t unload = (msp->ms_selected_txg + metaslab_unload_delay < txg);
+	if (!unload && msp->ms_allocator == -1 &&
+	    msp->ms_selected_txg + 1 < txg && !metaslab_debug_unload &&
+	    arc_available_memory() < 0) {
+		METASLAB_BUMP(metaslab_stat_unloads_pressure);
+		unload = B_TRUE;
+	}
+
+	if (unload) {
 		for (int t = 1; t < TXG_CONCURRENT_STATES; t++) {
 			VERIFY0(range_tree_space(
 			    msp->ms_allocating[(txg + t) & TXG_MASK]));
@@ -3706,6 +4548,7 @@ metaslab_sync_reassess(metaslab_group_t *mg)
 	spa_config_enter(spa, SCL_ALLOC, FTAG, RW_READER);
 	metaslab_group_alloc_update(mg);
 	mg->mg_fragmentation = metaslab_group_fragmentation(mg);
+	metaslab_group_alloc_rate_update(mg, spa_syncing_txg(spa));
 
 	/*
 	 * Preload the next potential metaslabs but only on active
@@ -3931,6 +4774,56 @@ metaslab_group_alloc_decrement(spa_t *spa, uint64_t vdev, void *tag, int flags,
 		metaslab_group_increment_qdepth(mg, allocator);
 }
 
+static uint64_t
+metaslab_rate_update(uint64_t avg, uint64_t sample)
+{
+	if (avg == 0)
+		return (sample);
+	return (avg - (avg >> METASLAB_RATE_SHIFT) +
+	    (sample >> METASLAB_RATE_SHIFT));
+}
+
+/*
+ * Account a throttled asynchronous write of size bytes allocated from vd,
+ * which took delay from being issued to the vdev to completing.  The
+ * averages are updated without locking; a lost sample doesn't matter.
+ */
+void
+metaslab_group_write_done(vdev_t *vd, uint64_t size, hrtime_t delay)
+{
+	metaslab_group_t *mg = vd->vdev_mg;
+	uint64_t rate;
+
+	if (mg == NULL || delay <= 0)
+		return;
+
+	rate = size * NANOSEC / delay;
+	mg->mg_write_rate = metaslab_rate_update(mg->mg_write_rate, rate);
+	mg->mg_class->mc_write_rate =
+	    metaslab_rate_update(mg->mg_class->mc_write_rate, rate);
+}
+
+/*
+ * Return how much more or less than its aliquot to allocate from mg in one
+ * turn of the rotor, given its write rate relative to the class.
+ */
+static int64_t
+metaslab_group_perf_bias(metaslab_group_t *mg)
+{
+	uint64_t mg_rate = mg->mg_write_rate;
+	uint64_t mc_rate = mg->mg_class->mc_write_rate;
+	int64_t ratio;
+
+	if (mg_rate == 0 || mc_rate == 0)
+		return (0);
+
+	ratio = (mg_rate * 100) / mc_rate;
+	ratio = MIN(MAX(ratio, 100 / METASLAB_PERF_BIAS_MAX),
+	    100 * METASLAB_PERF_BIAS_MAX);
+
+	return (((ratio - 100) * (int64_t)mg->mg_aliquot) / 100);
+}
+
 void
 metaslab_group_alloc_verify(spa_t *spa, const blkptr_t *bp, void *tag,
     int allocator)
@@ -3988,6 +4881,71 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 	return (start);
 }
 
+/*
+ * Allocates asize bytes from the chunk of the allocator, if it was carved
+ * in this txg and has enough room left.  The chunk is already accounted
+ * for in ms_allocating, the metaslab is dirty in txg and the chunk was
+ * taken out of ms_trim, so only the chunk cursor has to be advanced.
+ */
+static uint64_t
+metaslab_chunk_alloc(metaslab_group_t *mg, uint64_t asize, uint64_t txg,
+    int allocator, metaslab_t **mspp)
+{
+	metaslab_chunk_t *mck = &mg->mg_chunks[allocator];
+	uint64_t offset = -1ULL;
+
+	mutex_enter(&mck->mck_lock);
+	if (mck->mck_msp != NULL && mck->mck_txg == txg &&
+	    mck->mck_end - mck->mck_start >= asize) {
+		offset = mck->mck_start;
+		mck->mck_start += asize;
+		*mspp = mck->mck_msp;
+	}
+	mutex_exit(&mck->mck_lock);
+
+	return (offset);
+}
+
+/*
+ * Carves a new chunk for the allocator out of msp, its primary metaslab,
+ * unless its current one can still serve allocations in this txg.  The
+ * chunk is allocated as a whole in txg, what is left of it is given back
+ * by metaslab_chunk_retire().
+ */
+static void
+metaslab_chunk_carve(metaslab_t *msp, uint64_t txg, int allocator)
+{
+	metaslab_group_t *mg = msp->ms_group;
+	metaslab_chunk_t *mck = &mg->mg_chunks[allocator];
+	uint64_t size = metaslab_chunk_size;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (!msp->ms_primary || msp->ms_allocator != allocator ||
+	    !IS_P2ALIGNED(size, 1ULL << mg->mg_vd->vdev_ashift) ||
+	    msp->ms_max_size < size)
+		return;
+
+	mutex_enter(&mck->mck_lock);
+	ASSERT(mck->mck_msp == NULL || mck->mck_msp == msp);
+	if (mck->mck_msp == msp && mck->mck_txg == txg &&
+	    mck->mck_end - mck->mck_start >= metaslab_chunk_max_alloc) {
+		mutex_exit(&mck->mck_lock);
+		return;
+	}
+	if (mck->mck_msp != NULL)
+		metaslab_chunk_retire(mck);
+
+	uint64_t start = metaslab_block_alloc(msp, size, txg);
+	if (start != -1ULL) {
+		mck->mck_msp = msp;
+		mck->mck_txg = txg;
+		mck->mck_start = start;
+		mck->mck_end = start + size;
+	}
+	mutex_exit(&mck->mck_lock);
+}
+
 /*
  * Find the metaslab with the highest weight that is less than what we've
  * already tried.  In the common case, this means that we will examine each
@@ -4119,6 +5077,21 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 
 	ASSERT3U(mg->mg_vd->vdev_ms_count, >=, 2);
 
+	/*
+	 * Small allocations of the first copy are made from the chunk of
+	 * the allocator when possible, see metaslab_chunk_alloc().
+	 */
+	boolean_t chunk = (metaslab_chunk_size != 0 && d == 0 &&
+	    asize <= metaslab_chunk_max_alloc);
+	if (chunk) {
+		offset = metaslab_chunk_alloc(mg, asize, txg, allocator, &msp);
+		if (offset != -1ULL) {
+			metaslab_trace_add(zal, mg, msp, asize, d, offset,
+			    allocator);
+			return (offset);
+		}
+	}
+
 	metaslab_t *search = kmem_alloc(sizeof (*search), KM_SLEEP);
 	search->ms_weight = UINT64_MAX;
 	search->ms_start = 0;
@@ -4315,6 +5288,8 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			/* Proactively passivate the metaslab, if needed */
 			if (activated)
 				metaslab_segment_may_passivate(msp);
+			if (chunk)
+				metaslab_chunk_carve(msp, txg, allocator);
 			break;
 		}
 next:
@@ -4404,8 +5379,8 @@ metaslab_group_alloc(metaslab_group_t *mg, zio_alloc_list_t *zal,
 	offset = metaslab_group_alloc_normal(mg, zal, asize, txg, want_unique,
 	    dva, d, allocator);
 
-	mutex_enter(&mg->mg_lock);
 	if (offset == -1ULL) {
+		mutex_enter(&mg->mg_lock);
 		mg->mg_failed_allocations++;
 		metaslab_trace_add(zal, mg, NULL, asize, d,
 		    TRACE_GROUP_FAILURE, allocator);
@@ -4423,12 +5398,34 @@ metaslab_group_alloc(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			 */
 			mg->mg_no_free_space = B_TRUE;
 		}
+		mutex_exit(&mg->mg_lock);
 	}
-	mg->mg_allocations++;
-	mutex_exit(&mg->mg_lock);
+	atomic_inc_64(&mg->mg_allocations);
 	return (offset);
 }
 
+/*
+ * Returns the relative cost of a fastwrite of psize bytes to the top-level
+ * vdev vd: the fastwrite bytes already in flight to it plus ours, weighted
+ * by its recent fastwrite latency.  Several log devices are thus striped
+ * over by their queue depth as long as they are equally fast, while one
+ * that became slow, e.g. behind a degraded controller, is only used when
+ * the others are backed up.  A vdev with no recent latency sample costs
+ * the least, so it gets probed by the next fastwrite.
+ */
+static uint64_t
+metaslab_fastwrite_cost(vdev_t *vd, uint64_t psize, hrtime_t now)
+{
+	hrtime_t latency = vd->vdev_fastwrite_latency;
+
+	if (now - vd->vdev_fastwrite_sampled >
+	    MSEC2NSEC(metaslab_fastwrite_latency_expire_ms))
+		latency = 0;
+
+	return ((vd->vdev_pending_fastwrite + psize) *
+	    MIN(MAX(latency, 1), UINT32_MAX));
+}
+
 /*
  * Allocate a block for the specified i/o.
  */
@@ -4500,13 +5497,20 @@ metaslab_alloc_dva(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
 		vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d - 1]));
 		mg = vd->vdev_mg->mg_next;
 	} else if (flags & METASLAB_FASTWRITE) {
+		hrtime_t now = gethrtime();
+		uint64_t cost, fast_cost;
+
 		mg = fast_mg = mc->mc_rotor;
+		cost = metaslab_fastwrite_cost(mg->mg_vd, psize, now);
 
-		do {
-			if (fast_mg->mg_vd->vdev_pending_fastwrite <
-			    mg->mg_vd->vdev_pending_fastwrite)
+		while ((fast_mg = fast_mg->mg_next) != mc->mc_rotor) {
+			fast_cost = metaslab_fastwrite_cost(fast_mg->mg_vd,
+			    psize, now);
+			if (fast_cost < cost) {
 				mg = fast_mg;
-		} while ((fast_mg = fast_mg->mg_next) != mc->mc_rotor);
+				cost = fast_cost;
+			}
+		}
 
 	} else {
 		ASSERT(mc->mc_rotor != NULL);
@@ -4574,7 +5578,7 @@ top:
 
 		ASSERT(mg->mg_class == mc);
 
-		uint64_t asize = vdev_psize_to_asize(vd, psize);
+		uint64_t asize = vdev_psize_to_asize_txg(vd, psize, txg);
 		ASSERT(P2PHASE(asize, 1ULL << vd->vdev_ashift) == 0);
 
 		/*
@@ -4594,13 +5598,16 @@ top:
 			 * and set an allocation bias to even it out.
 			 *
 			 * Bias is also used to compensate for unequally
-			 * sized vdevs so that space is allocated fairly.
+			 * sized vdevs so that space is allocated fairly,
+			 * and, see metaslab_perf_bias_enabled, to favor
+			 * the faster vdevs.
 			 */
-			if (mc->mc_aliquot == 0 && metaslab_bias_enabled) {
+			if (mc->mc_aliquot == 0 && (metaslab_bias_enabled ||
+			    metaslab_perf_bias_enabled)) {
 				vdev_stat_t *vs = &vd->vdev_stat;
 				int64_t vs_free = vs->vs_space - vs->vs_alloc;
 				int64_t mc_free = mc->mc_space - mc->mc_alloc;
-				int64_t ratio;
+				int64_t ratio, bias = 0;
 
 				/*
 				 * Calculate how much more or less we should
@@ -4625,11 +5632,18 @@ top:
 				 *  vdev V2 = 64M/512M
 				 *  ratio(V1) =  40% ratio(V2) = 160%
 				 */
-				ratio = (vs_free * mc->mc_alloc_groups * 100) /
-				    (mc_free + 1);
-				mg->mg_bias = ((ratio - 100) *
-				    (int64_t)mg->mg_aliquot) / 100;
-			} else if (!metaslab_bias_enabled) {
+				if (metaslab_bias_enabled) {
+					ratio = (vs_free * mc->mc_alloc_groups *
+					    100) / (mc_free + 1);
+					bias = ((ratio - 100) *
+					    (int64_t)mg->mg_aliquot) / 100;
+				}
+				if (metaslab_perf_bias_enabled)
+					bias += metaslab_group_perf_bias(mg);
+				mg->mg_bias = MAX(bias,
+				    -(int64_t)mg->mg_aliquot);
+			} else if (!metaslab_bias_enabled &&
+			    !metaslab_perf_bias_enabled) {
 				mg->mg_bias = 0;
 			}
 
@@ -5331,6 +6345,38 @@ metaslab_fastwrite_unmark(spa_t *spa, const blkptr_t *bp)
 	spa_config_exit(spa, SCL_VDEV, FTAG);
 }
 
+/*
+ * Records the latency of a completed fastwrite of bp in the moving average
+ * of the vdevs it was written to.  The average is only advisory, so it is
+ * updated without locking.
+ */
+void
+metaslab_fastwrite_latency(spa_t *spa, const blkptr_t *bp, hrtime_t latency)
+{
+	const dva_t *dva = bp->blk_dva;
+	int ndvas = BP_GET_NDVAS(bp);
+	hrtime_t now = gethrtime();
+	vdev_t *vd;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+
+	for (int d = 0; d < ndvas; d++) {
+		if ((vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d]))) == NULL)
+			continue;
+		if (vd->vdev_fastwrite_latency == 0 ||
+		    now - vd->vdev_fastwrite_sampled >
+		    MSEC2NSEC(metaslab_fastwrite_latency_expire_ms)) {
+			vd->vdev_fastwrite_latency = latency;
+		} else {
+			vd->vdev_fastwrite_latency +=
+			    (latency - vd->vdev_fastwrite_latency) / 8;
+		}
+		vd->vdev_fastwrite_sampled = now;
+	}
+
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+}
+
 /* ARGSUSED */
 static void
 metaslab_check_free_impl_cb(uint64_t inner, vdev_t *vd, uint64_t offset,
@@ -5560,6 +6606,21 @@ ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, debug_unload, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, preload_enabled, UINT, ZMOD_RW,
 	"preload potential metaslabs during reassessment");
 
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, preload_txgs, INT, ZMOD_RW,
+	"txgs of predicted allocations to preload metaslabs for");
+
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, preload_max, INT, ZMOD_RW,
+	"max number of metaslabs per group to preload");
+
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, fastwrite_latency_expire_ms, INT, ZMOD_RW,
+	"ms after which the log write latency of an unused vdev is forgotten");
+
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, chunk_size, INT, ZMOD_RW,
+	"size of the chunk each allocator reserves from its metaslab");
+
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, chunk_max_alloc, INT, ZMOD_RW,
+	"largest allocation made from the chunk of an allocator");
+
 /*
  * The zfs_mg_noalloc_threshold defines which metaslab groups should
  * be eligible for allocation. The value is defined as a percentage of
@@ -5607,12 +6668,21 @@ ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, lba_weighting_enabled, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, bias_enabled, UINT, ZMOD_RW,
 	"enable metaslab group biasing");
 
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, perf_bias_enabled, UINT, ZMOD_RW,
+	"enable metaslab group biasing by vdev write throughput");
+
 ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, segment_weight_enabled, UINT, ZMOD_RW,
 	"enable segment-based metaslab selection");
 
 ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, switch_threshold, UINT, ZMOD_RW,
 	"segment-based metaslab selection maximum buckets before switching");
 
+ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, condense_bg, INT, ZMOD_RW,
+	"condense metaslab space maps in the background");
+
+ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, condense_bg_segments, INT,
+	ZMOD_RW, "segments written per txg when condensing in the background");
+
 ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, force_ganging, UQUAD, ZMOD_RW,
 	"blocks larger than this size are forced to be gang blocks");
 
@@ -186,6 +186,14 @@ uint_t zfs_multihost_import_intervals = MMP_DEFAULT_IMPORT_INTERVALS;
  */
 uint_t zfs_multihost_fail_intervals = MMP_DEFAULT_FAIL_INTERVALS;
 
+/*
+ * Number of writeable leaves, taken in turn, among which each mmp write goes
+ * to the one whose recent mmp writes completed fastest.  This steers the
+ * writes away from leaves that are busy or slow, which would otherwise delay
+ * them enough to suspend the pool.  A value of 1 gives plain round robin.
+ */
+uint_t zfs_multihost_leaf_choices = 2;
+
 char *mmp_tag = "mmp_write_uberblock";
 static void mmp_thread(void *arg);
 
@@ -293,6 +301,8 @@ mmp_next_leaf(spa_t *spa)
 {
 	vdev_t *leaf;
 	vdev_t *starting_leaf;
+	vdev_t *best = NULL;
+	uint_t choices = 0;
 	int fail_mask = 0;
 
 	ASSERT(MUTEX_HELD(&spa->spa_mmp.mmp_io_lock));
@@ -320,11 +330,19 @@ mmp_next_leaf(spa_t *spa)
 		} else if (leaf->vdev_mmp_pending != 0) {
 			fail_mask |= MMP_FAIL_WRITE_PENDING;
 		} else {
-			spa->spa_mmp.mmp_last_leaf = leaf;
-			return (0);
+			if (best == NULL ||
+			    leaf->vdev_mmp_latency < best->vdev_mmp_latency)
+				best = leaf;
+			if (++choices >= MAX(zfs_multihost_leaf_choices, 1))
+				break;
 		}
 	} while (leaf != starting_leaf);
 
+	if (best != NULL) {
+		spa->spa_mmp.mmp_last_leaf = best;
+		return (0);
+	}
+
 	ASSERT(fail_mask);
 
 	return (fail_mask);
@@ -397,6 +415,17 @@ mmp_write_done(zio_t *zio)
 
 	mmp_delay_update(spa, (zio->io_error == 0));
 
+	/*
+	 * Track how long mmp writes to this leaf take, as a decaying
+	 * average (1/4).  A failed write counts as a whole interval so the
+	 * leaf is avoided while others are available.
+	 */
+	hrtime_t latency = (zio->io_error == 0) ? mmp_write_duration :
+	    MAX(mmp_write_duration, MSEC2NSEC(zfs_multihost_interval));
+	vd->vdev_mmp_latency = (vd->vdev_mmp_latency == 0) ? latency :
+	    vd->vdev_mmp_latency + (latency - vd->vdev_mmp_latency) / 4;
+	spa_iostats_mmp_add(spa, mmp_write_duration, zio->io_error);
+
 	vd->vdev_mmp_pending = 0;
 	vd->vdev_mmp_kstat_id = 0;
 
@@ -524,10 +553,19 @@ mmp_write_uberblock(spa_t *spa)
 	offset = VDEV_UBERBLOCK_OFFSET(vd, VDEV_UBERBLOCK_COUNT(vd) -
 	    MMP_BLOCKS_PER_LABEL + spa_get_random(MMP_BLOCKS_PER_LABEL));
 
+	/*
+	 * There is at most one mmp write outstanding per leaf, so let it
+	 * skip the vdev queue rather than wait behind a backlog of sync
+	 * writes for its turn.
+	 */
 	label = spa_get_random(VDEV_LABELS);
-	vdev_label_write(zio, vd, label, ub_abd, offset,
-	    VDEV_UBERBLOCK_SIZE(vd), mmp_write_done, mmp,
-	    flags | ZIO_FLAG_DONT_PROPAGATE);
+	zio_t *cio = zio_write_phys(zio, vd,
+	    vdev_label_offset(vd->vdev_psize, label, offset),
+	    VDEV_UBERBLOCK_SIZE(vd), ub_abd, ZIO_CHECKSUM_LABEL,
+	    mmp_write_done, mmp, ZIO_PRIORITY_SYNC_WRITE,
+	    flags | ZIO_FLAG_DONT_PROPAGATE, B_TRUE);
+	cio->io_queue_bypass = B_TRUE;
+	zio_nowait(cio);
 
 	(void) spa_mmp_history_add(spa, ub->ub_txg, ub->ub_timestamp,
 	    ub->ub_mmp_delay, vd, label, vd->vdev_mmp_kstat_id, 0);
@@ -745,5 +783,8 @@ MODULE_PARM_DESC(zfs_multihost_interval,
 
 ZFS_MODULE_PARAM(zfs_multihost, zfs_multihost_, import_intervals, UINT, ZMOD_RW,
 	"Number of zfs_multihost_interval periods to wait for activity");
+
+ZFS_MODULE_PARAM(zfs_multihost, zfs_multihost_, leaf_choices, UINT, ZMOD_RW,
+	"Leaves to pick the fastest from for each mmp write");
 /* END CSTYLED */
 #endif
@@ -32,6 +32,7 @@
 #include <sys/dnode.h>
 #include <sys/zio.h>
 #include <sys/range_tree.h>
+#include <sys/btree.h>
 
 /*
  * Range trees are tree-based data structures that can be used to
@@ -59,6 +60,14 @@
  * In order to traverse a range tree, use either the range_tree_walk()
  * or range_tree_vacate() functions.
  *
+ * Segments are kept by value in a b-tree (see sys/btree.h) rather than
+ * being allocated individually and linked into an AVL tree.  This packs
+ * many segments into each 4k leaf, which greatly reduces the memory used
+ * by large free-space maps and the number of cache misses needed to walk
+ * them.  The price is that segment pointers are only valid until the next
+ * modification of the tree, so the code below re-finds segments after any
+ * insertion or removal instead of holding on to them.
+ *
  * To obtain more accurate information on individual segment
  * operations that the range tree performs "under the hood", you can
  * specify a set of callbacks by passing a range_tree_ops_t structure
@@ -74,41 +83,25 @@
  * support removing complete segments.
  */
 
-kmem_cache_t *range_seg_cache;
-
-/* Generic ops for managing an AVL tree alongside a range tree */
-struct range_tree_ops rt_avl_ops = {
-	.rtop_create = rt_avl_create,
-	.rtop_destroy = rt_avl_destroy,
-	.rtop_add = rt_avl_add,
-	.rtop_remove = rt_avl_remove,
-	.rtop_vacate = rt_avl_vacate,
+/* Generic ops for managing a b-tree alongside a range tree */
+struct range_tree_ops rt_btree_ops = {
+	.rtop_create = rt_btree_create,
+	.rtop_destroy = rt_btree_destroy,
+	.rtop_add = rt_btree_add,
+	.rtop_remove = rt_btree_remove,
+	.rtop_vacate = rt_btree_vacate,
 };
 
-void
-range_tree_init(void)
-{
-	ASSERT(range_seg_cache == NULL);
-	range_seg_cache = kmem_cache_create("range_seg_cache",
-	    sizeof (range_seg_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
-}
-
-void
-range_tree_fini(void)
-{
-	kmem_cache_destroy(range_seg_cache);
-	range_seg_cache = NULL;
-}
-
 void
 range_tree_stat_verify(range_tree_t *rt)
 {
 	range_seg_t *rs;
+	zfs_btree_index_t where;
 	uint64_t hist[RANGE_TREE_HISTOGRAM_SIZE] = { 0 };
 	int i;
 
-	for (rs = avl_first(&rt->rt_root); rs != NULL;
-	    rs = AVL_NEXT(&rt->rt_root, rs)) {
+	for (rs = zfs_btree_first(&rt->rt_root, &where); rs != NULL;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where)) {
 		uint64_t size = rs->rs_end - rs->rs_start;
 		int idx	= highbit64(size) - 1;
 
@@ -170,17 +163,17 @@ range_tree_seg_compare(const void *x1, const void *x2)
 
 range_tree_t *
 range_tree_create_impl(range_tree_ops_t *ops, void *arg,
-    int (*avl_compare) (const void *, const void *), uint64_t gap)
+    int (*zfs_btree_compare) (const void *, const void *), uint64_t gap)
 {
 	range_tree_t *rt = kmem_zalloc(sizeof (range_tree_t), KM_SLEEP);
 
-	avl_create(&rt->rt_root, range_tree_seg_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_node));
+	zfs_btree_create(&rt->rt_root, range_tree_seg_compare,
+	    sizeof (range_seg_t));
 
 	rt->rt_ops = ops;
 	rt->rt_gap = gap;
 	rt->rt_arg = arg;
-	rt->rt_avl_compare = avl_compare;
+	rt->rt_btree_compare = zfs_btree_compare;
 
 	if (rt->rt_ops != NULL && rt->rt_ops->rtop_create != NULL)
 		rt->rt_ops->rtop_create(rt, rt->rt_arg);
@@ -202,7 +195,7 @@ range_tree_destroy(range_tree_t *rt)
 	if (rt->rt_ops != NULL && rt->rt_ops->rtop_destroy != NULL)
 		rt->rt_ops->rtop_destroy(rt, rt->rt_arg);
 
-	avl_destroy(&rt->rt_root);
+	zfs_btree_destroy(&rt->rt_root);
 	kmem_free(rt, sizeof (*rt));
 }
 
@@ -223,8 +216,9 @@ static void
 range_tree_add_impl(void *arg, uint64_t start, uint64_t size, uint64_t fill)
 {
 	range_tree_t *rt = arg;
-	avl_index_t where;
+	zfs_btree_index_t where;
 	range_seg_t rsearch, *rs_before, *rs_after, *rs;
+	range_seg_t tmp;
 	uint64_t end = start + size, gap = rt->rt_gap;
 	uint64_t bridge_size = 0;
 	boolean_t merge_before, merge_after;
@@ -234,7 +228,7 @@ range_tree_add_impl(void *arg, uint64_t start, uint64_t size, uint64_t fill)
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = end;
-	rs = avl_find(&rt->rt_root, &rsearch, &where);
+	rs = zfs_btree_find(&rt->rt_root, &rsearch, &where);
 
 	if (gap == 0 && rs != NULL &&
 	    rs->rs_start <= start && rs->rs_end >= end) {
@@ -261,7 +255,6 @@ range_tree_add_impl(void *arg, uint64_t start, uint64_t size, uint64_t fill)
 			return;
 		}
 
-		avl_remove(&rt->rt_root, rs);
 		if (rt->rt_ops != NULL && rt->rt_ops->rtop_remove != NULL)
 			rt->rt_ops->rtop_remove(rt, rs, rt->rt_arg);
 
@@ -273,9 +266,9 @@ range_tree_add_impl(void *arg, uint64_t start, uint64_t size, uint64_t fill)
 		end = MAX(end, rs->rs_end);
 		size = end - start;
 
-		range_tree_add_impl(rt, start, size, fill);
+		zfs_btree_remove_idx(&rt->rt_root, &where);
 
-		kmem_cache_free(range_seg_cache, rs);
+		range_tree_add_impl(rt, start, size, fill);
 		return;
 	}
 
@@ -286,8 +279,9 @@ range_tree_add_impl(void *arg, uint64_t start, uint64_t size, uint64_t fill)
 	 * If gap != 0, we might need to merge with our neighbors even if we
 	 * aren't directly touching.
 	 */
-	rs_before = avl_nearest(&rt->rt_root, where, AVL_BEFORE);
-	rs_after = avl_nearest(&rt->rt_root, where, AVL_AFTER);
+	zfs_btree_index_t where_before, where_after;
+	rs_before = zfs_btree_prev(&rt->rt_root, &where, &where_before);
+	rs_after = zfs_btree_next(&rt->rt_root, &where, &where_after);
 
 	merge_before = (rs_before != NULL && rs_before->rs_end >= start - gap);
 	merge_after = (rs_after != NULL && rs_after->rs_start <= end + gap);
@@ -298,7 +292,6 @@ range_tree_add_impl(void *arg, uint64_t start, uint64_t size, uint64_t fill)
 		bridge_size += rs_after->rs_start - end;
 
 	if (merge_before && merge_after) {
-		avl_remove(&rt->rt_root, rs_before);
 		if (rt->rt_ops != NULL && rt->rt_ops->rtop_remove != NULL) {
 			rt->rt_ops->rtop_remove(rt, rs_before, rt->rt_arg);
 			rt->rt_ops->rtop_remove(rt, rs_after, rt->rt_arg);
@@ -307,9 +300,21 @@ range_tree_add_impl(void *arg, uint64_t start, uint64_t size, uint64_t fill)
 		range_tree_stat_decr(rt, rs_before);
 		range_tree_stat_decr(rt, rs_after);
 
-		rs_after->rs_fill += rs_before->rs_fill + fill;
-		rs_after->rs_start = rs_before->rs_start;
-		kmem_cache_free(range_seg_cache, rs_before);
+		tmp = *rs_before;
+		zfs_btree_remove_idx(&rt->rt_root, &where_before);
+
+		/*
+		 * Removing rs_before may have moved rs_after, so look it up
+		 * again before extending it.
+		 */
+		rs_after = zfs_btree_find(&rt->rt_root, &rsearch, &where_after);
+		if (rs_after == NULL)
+			rs_after = zfs_btree_next(&rt->rt_root, &where_after,
+			    &where_after);
+		ASSERT3P(rs_after, !=, NULL);
+
+		rs_after->rs_fill += tmp.rs_fill + fill;
+		rs_after->rs_start = tmp.rs_start;
 		rs = rs_after;
 	} else if (merge_before) {
 		if (rt->rt_ops != NULL && rt->rt_ops->rtop_remove != NULL)
@@ -330,12 +335,11 @@ range_tree_add_impl(void *arg, uint64_t start, uint64_t size, uint64_t fill)
 		rs_after->rs_start = start;
 		rs = rs_after;
 	} else {
-		rs = kmem_cache_alloc(range_seg_cache, KM_SLEEP);
-
-		rs->rs_fill = fill;
-		rs->rs_start = start;
-		rs->rs_end = end;
-		avl_insert(&rt->rt_root, rs, where);
+		tmp.rs_fill = fill;
+		tmp.rs_start = start;
+		tmp.rs_end = end;
+		zfs_btree_add_idx(&rt->rt_root, &tmp, &where);
+		rs = &tmp;
 	}
 
 	if (gap != 0)
@@ -360,8 +364,8 @@ static void
 range_tree_remove_impl(range_tree_t *rt, uint64_t start, uint64_t size,
     boolean_t do_fill)
 {
-	avl_index_t where;
-	range_seg_t rsearch, *rs, *newseg;
+	zfs_btree_index_t where;
+	range_seg_t rsearch, *rs, newseg;
 	uint64_t end = start + size;
 	boolean_t left_over, right_over;
 
@@ -370,7 +374,7 @@ range_tree_remove_impl(range_tree_t *rt, uint64_t start, uint64_t size,
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = end;
-	rs = avl_find(&rt->rt_root, &rsearch, &where);
+	rs = zfs_btree_find(&rt->rt_root, &rsearch, &where);
 
 	/* Make sure we completely overlap with someone */
 	if (rs == NULL) {
@@ -419,24 +423,31 @@ range_tree_remove_impl(range_tree_t *rt, uint64_t start, uint64_t size,
 		rt->rt_ops->rtop_remove(rt, rs, rt->rt_arg);
 
 	if (left_over && right_over) {
-		newseg = kmem_cache_alloc(range_seg_cache, KM_SLEEP);
-		newseg->rs_start = end;
-		newseg->rs_end = rs->rs_end;
-		newseg->rs_fill = newseg->rs_end - newseg->rs_start;
-		range_tree_stat_incr(rt, newseg);
+		newseg.rs_start = end;
+		newseg.rs_end = rs->rs_end;
+		newseg.rs_fill = newseg.rs_end - newseg.rs_start;
+		range_tree_stat_incr(rt, &newseg);
 
 		rs->rs_end = start;
+		rs->rs_fill = rs->rs_end - rs->rs_start;
+		range_tree_stat_incr(rt, rs);
+		if (rt->rt_ops != NULL && rt->rt_ops->rtop_add != NULL)
+			rt->rt_ops->rtop_add(rt, rs, rt->rt_arg);
 
-		avl_insert_here(&rt->rt_root, newseg, rs, AVL_AFTER);
+		/* The insertion may move rs, so it must come last. */
+		zfs_btree_index_t where_after;
+		VERIFY3P(zfs_btree_find(&rt->rt_root, &newseg, &where_after),
+		    ==, NULL);
+		zfs_btree_add_idx(&rt->rt_root, &newseg, &where_after);
 		if (rt->rt_ops != NULL && rt->rt_ops->rtop_add != NULL)
-			rt->rt_ops->rtop_add(rt, newseg, rt->rt_arg);
+			rt->rt_ops->rtop_add(rt, &newseg, rt->rt_arg);
+		rs = NULL;
 	} else if (left_over) {
 		rs->rs_end = start;
 	} else if (right_over) {
 		rs->rs_start = end;
 	} else {
-		avl_remove(&rt->rt_root, rs);
-		kmem_cache_free(range_seg_cache, rs);
+		zfs_btree_remove_idx(&rt->rt_root, &where);
 		rs = NULL;
 	}
 
@@ -498,7 +509,7 @@ range_tree_find_impl(range_tree_t *rt, uint64_t start, uint64_t size)
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = end;
-	return (avl_find(&rt->rt_root, &rsearch, NULL));
+	return (zfs_btree_find(&rt->rt_root, &rsearch, NULL));
 }
 
 range_seg_t *
@@ -549,7 +560,7 @@ range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst)
 	range_tree_t *rt;
 
 	ASSERT0(range_tree_space(*rtdst));
-	ASSERT0(avl_numnodes(&(*rtdst)->rt_root));
+	ASSERT0(zfs_btree_numnodes(&(*rtdst)->rt_root));
 
 	rt = *rtsrc;
 	*rtsrc = *rtdst;
@@ -559,17 +570,13 @@ range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst)
 void
 range_tree_vacate(range_tree_t *rt, range_tree_func_t *func, void *arg)
 {
-	range_seg_t *rs;
-	void *cookie = NULL;
-
 	if (rt->rt_ops != NULL && rt->rt_ops->rtop_vacate != NULL)
 		rt->rt_ops->rtop_vacate(rt, rt->rt_arg);
 
-	while ((rs = avl_destroy_nodes(&rt->rt_root, &cookie)) != NULL) {
-		if (func != NULL)
-			func(arg, rs->rs_start, rs->rs_end - rs->rs_start);
-		kmem_cache_free(range_seg_cache, rs);
-	}
+	if (func != NULL)
+		range_tree_walk(rt, func, arg);
+
+	zfs_btree_clear(&rt->rt_root);
 
 	bzero(rt->rt_histogram, sizeof (rt->rt_histogram));
 	rt->rt_space = 0;
@@ -578,8 +585,9 @@ range_tree_vacate(range_tree_t *rt, range_tree_func_t *func, void *arg)
 void
 range_tree_walk(range_tree_t *rt, range_tree_func_t *func, void *arg)
 {
-	for (range_seg_t *rs = avl_first(&rt->rt_root); rs;
-	    rs = AVL_NEXT(&rt->rt_root, rs)) {
+	zfs_btree_index_t where;
+	for (range_seg_t *rs = zfs_btree_first(&rt->rt_root, &where);
+	    rs != NULL; rs = zfs_btree_next(&rt->rt_root, &where, &where)) {
 		func(arg, rs->rs_start, rs->rs_end - rs->rs_start);
 	}
 }
@@ -587,7 +595,7 @@ range_tree_walk(range_tree_t *rt, range_tree_func_t *func, void *arg)
 range_seg_t *
 range_tree_first(range_tree_t *rt)
 {
-	return (avl_first(&rt->rt_root));
+	return (zfs_btree_first(&rt->rt_root, NULL));
 }
 
 uint64_t
@@ -599,7 +607,7 @@ range_tree_space(range_tree_t *rt)
 uint64_t
 range_tree_numsegs(range_tree_t *rt)
 {
-	return ((rt == NULL) ? 0 : avl_numnodes(&rt->rt_root));
+	return ((rt == NULL) ? 0 : zfs_btree_numnodes(&rt->rt_root));
 }
 
 boolean_t
@@ -609,62 +617,67 @@ range_tree_is_empty(range_tree_t *rt)
 	return (range_tree_space(rt) == 0);
 }
 
-/* Generic range tree functions for maintaining segments in an AVL tree. */
+/*
+ * Generic range tree functions for maintaining segments in a b-tree.
+ * The secondary tree holds its own copies of the segments; since those
+ * are located by value, rtop_remove must be called before the segment in
+ * the range tree is modified.
+ */
 void
-rt_avl_create(range_tree_t *rt, void *arg)
+rt_btree_create(range_tree_t *rt, void *arg)
 {
-	avl_tree_t *tree = arg;
+	zfs_btree_t *tree = arg;
 
-	avl_create(tree, rt->rt_avl_compare, sizeof (range_seg_t),
-	    offsetof(range_seg_t, rs_pp_node));
+	zfs_btree_create(tree, rt->rt_btree_compare, sizeof (range_seg_t));
 }
 
 void
-rt_avl_destroy(range_tree_t *rt, void *arg)
+rt_btree_destroy(range_tree_t *rt, void *arg)
 {
-	avl_tree_t *tree = arg;
+	zfs_btree_t *tree = arg;
 
-	ASSERT0(avl_numnodes(tree));
-	avl_destroy(tree);
+	ASSERT0(zfs_btree_numnodes(tree));
+	zfs_btree_destroy(tree);
 }
 
 void
-rt_avl_add(range_tree_t *rt, range_seg_t *rs, void *arg)
+rt_btree_add(range_tree_t *rt, range_seg_t *rs, void *arg)
 {
-	avl_tree_t *tree = arg;
-	avl_add(tree, rs);
+	zfs_btree_t *tree = arg;
+
+	zfs_btree_add(tree, rs);
 }
 
 void
-rt_avl_remove(range_tree_t *rt, range_seg_t *rs, void *arg)
+rt_btree_remove(range_tree_t *rt, range_seg_t *rs, void *arg)
 {
-	avl_tree_t *tree = arg;
-	avl_remove(tree, rs);
+	zfs_btree_t *tree = arg;
+
+	zfs_btree_remove(tree, rs);
 }
 
 void
-rt_avl_vacate(range_tree_t *rt, void *arg)
+rt_btree_vacate(range_tree_t *rt, void *arg)
 {
-	/*
-	 * Normally one would walk the tree freeing nodes along the way.
-	 * Since the nodes are shared with the range trees we can avoid
-	 * walking all nodes and just reinitialize the avl tree. The nodes
-	 * will be freed by the range tree, so we don't want to free them here.
-	 */
-	rt_avl_create(rt, arg);
+	zfs_btree_t *tree = arg;
+
+	zfs_btree_clear(tree);
+	zfs_btree_destroy(tree);
+
+	rt_btree_create(rt, arg);
 }
 
 uint64_t
 range_tree_min(range_tree_t *rt)
 {
-	range_seg_t *rs = avl_first(&rt->rt_root);
+	range_seg_t *rs = zfs_btree_first(&rt->rt_root, NULL);
 	return (rs != NULL ? rs->rs_start : 0);
 }
 
 uint64_t
 range_tree_max(range_tree_t *rt)
 {
-	range_seg_t *rs = avl_last(&rt->rt_root);
+	range_seg_t *rs = zfs_btree_last(&rt->rt_root, NULL);
 	return (rs != NULL ? rs->rs_end : 0);
 }
 
@@ -682,22 +695,20 @@ void
 range_tree_remove_xor_add_segment(uint64_t start, uint64_t end,
     range_tree_t *removefrom, range_tree_t *addto)
 {
-	avl_index_t where;
+	zfs_btree_index_t where;
 	range_seg_t starting_rs = {
 		.rs_start = start,
 		.rs_end = start + 1
 	};
 
-	range_seg_t *curr = avl_find(&removefrom->rt_root,
+	range_seg_t *curr = zfs_btree_find(&removefrom->rt_root,
 	    &starting_rs, &where);
 
 	if (curr == NULL)
-		curr = avl_nearest(&removefrom->rt_root, where, AVL_AFTER);
+		curr = zfs_btree_next(&removefrom->rt_root, &where, &where);
 
 	range_seg_t *next;
 	for (; curr != NULL; curr = next) {
-		next = AVL_NEXT(&removefrom->rt_root, curr);
-
 		if (start == end)
 			return;
 		VERIFY3U(start, <, end);
@@ -712,12 +723,26 @@ range_tree_remove_xor_add_segment(uint64_t start, uint64_t end,
 		uint64_t overlap_end = MIN(curr->rs_end, end);
 		uint64_t overlap_size = overlap_end - overlap_start;
 		ASSERT3S(overlap_size, >, 0);
+
 		range_tree_remove(removefrom, overlap_start, overlap_size);
 
 		if (start < overlap_start)
 			range_tree_add(addto, start, overlap_start - start);
 
 		start = overlap_end;
+
+		/*
+		 * The removal may have restructured the tree, so find the
+		 * next segment by searching from the end of the overlap.
+		 */
+		range_seg_t rs = {
+			.rs_start = overlap_end,
+			.rs_end = overlap_end + 1
+		};
+		next = zfs_btree_find(&removefrom->rt_root, &rs, &where);
+		if (next == NULL)
+			next = zfs_btree_next(&removefrom->rt_root, &where,
+			    &where);
 	}
 	VERIFY3P(curr, ==, NULL);
 
@@ -737,8 +762,9 @@ void
 range_tree_remove_xor_add(range_tree_t *rt, range_tree_t *removefrom,
     range_tree_t *addto)
 {
-	for (range_seg_t *rs = avl_first(&rt->rt_root); rs;
-	    rs = AVL_NEXT(&rt->rt_root, rs)) {
+	zfs_btree_index_t where;
+	for (range_seg_t *rs = zfs_btree_first(&rt->rt_root, &where); rs;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where)) {
 		range_tree_remove_xor_add_segment(rs->rs_start, rs->rs_end,
 		    removefrom, addto);
 	}
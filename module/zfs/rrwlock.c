@@ -141,7 +141,7 @@ rrn_find_and_remove(rrwlock_t *rrl, void *tag)
 }
 
 void
-rrw_init(rrwlock_t *rrl, boolean_t track_all)
+rrw_init_impl(rrwlock_t *rrl, boolean_t track_all, spl_lockstat_class_t *lsc)
 {
 	mutex_init(&rrl->rr_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&rrl->rr_cv, NULL, CV_DEFAULT, NULL);
@@ -150,6 +150,8 @@ rrw_init(rrwlock_t *rrl, boolean_t track_all)
 	zfs_refcount_create(&rrl->rr_linked_rcount);
 	rrl->rr_writer_wanted = B_FALSE;
 	rrl->rr_track_all = track_all;
+	rrl->rr_class = lsc;
+	rrl->rr_write_start = 0;
 }
 
 void
@@ -165,12 +167,15 @@ rrw_destroy(rrwlock_t *rrl)
 static void
 rrw_enter_read_impl(rrwlock_t *rrl, boolean_t prio, void *tag)
 {
+	hrtime_t start = 0;
+
 	mutex_enter(&rrl->rr_lock);
 #if !defined(DEBUG) && defined(_KERNEL)
 	if (rrl->rr_writer == NULL && !rrl->rr_writer_wanted &&
 	    !rrl->rr_track_all) {
 		rrl->rr_anon_rcount.rc_count++;
 		mutex_exit(&rrl->rr_lock);
+		spl_lockstat_acquired(rrl->rr_class, 0);
 		return;
 	}
 	DTRACE_PROBE(zfs__rrwfastpath__rdmiss);
@@ -180,8 +185,11 @@ rrw_enter_read_impl(rrwlock_t *rrl, boolean_t prio, void *tag)
 
 	while (rrl->rr_writer != NULL || (rrl->rr_writer_wanted &&
 	    zfs_refcount_is_zero(&rrl->rr_anon_rcount) && !prio &&
-	    rrn_find(rrl) == NULL))
+	    rrn_find(rrl) == NULL)) {
+		if (start == 0)
+			start = spl_lockstat_start();
 		cv_wait(&rrl->rr_cv, &rrl->rr_lock);
+	}
 
 	if (rrl->rr_writer_wanted || rrl->rr_track_all) {
 		/* may or may not be a re-entrant enter */
@@ -192,6 +200,7 @@ rrw_enter_read_impl(rrwlock_t *rrl, boolean_t prio, void *tag)
 	}
 	ASSERT(rrl->rr_writer == NULL);
 	mutex_exit(&rrl->rr_lock);
+	spl_lockstat_acquired(rrl->rr_class, start);
 }
 
 void
@@ -216,6 +225,8 @@ rrw_enter_read_prio(rrwlock_t *rrl, void *tag)
 void
 rrw_enter_write(rrwlock_t *rrl)
 {
+	hrtime_t start = 0;
+
 	mutex_enter(&rrl->rr_lock);
 	ASSERT(rrl->rr_writer != curthread);
 
@@ -223,11 +234,15 @@ rrw_enter_write(rrwlock_t *rrl)
 	    zfs_refcount_count(&rrl->rr_linked_rcount) > 0 ||
 	    rrl->rr_writer != NULL) {
 		rrl->rr_writer_wanted = B_TRUE;
+		if (start == 0)
+			start = spl_lockstat_start();
 		cv_wait(&rrl->rr_cv, &rrl->rr_lock);
 	}
 	rrl->rr_writer_wanted = B_FALSE;
 	rrl->rr_writer = curthread;
+	rrl->rr_write_start = spl_lockstat_start();
 	mutex_exit(&rrl->rr_lock);
+	spl_lockstat_acquired(rrl->rr_class, start);
 }
 
 void
@@ -272,6 +287,8 @@ rrw_exit(rrwlock_t *rrl, void *tag)
 		ASSERT(rrl->rr_writer == curthread);
 		ASSERT(zfs_refcount_is_zero(&rrl->rr_anon_rcount) &&
 		    zfs_refcount_is_zero(&rrl->rr_linked_rcount));
+		spl_lockstat_released(rrl->rr_class, rrl->rr_write_start);
+		rrl->rr_write_start = 0;
 		rrl->rr_writer = NULL;
 		cv_broadcast(&rrl->rr_cv);
 	}
@@ -319,17 +336,19 @@ rrw_tsd_destroy(void *arg)
  * of simple hash function.  That proportionally reduces lock congestion.
  * Writer at the same time has to sequentially acquire write on all the locks.
  * That makes write acquisition proportionally slower, but in places where
- * it is used (filesystem unmount) performance is not critical.
+ * it is used (filesystem unmount, pool configuration changes in syncing
+ * context) performance is not critical.
  *
- * All the functions below are direct wrappers around functions above.
+ * Except for rrm_enter_write() the functions below are direct wrappers
+ * around functions above.
  */
 void
-rrm_init(rrmlock_t *rrl, boolean_t track_all)
+rrm_init_impl(rrmlock_t *rrl, boolean_t track_all, spl_lockstat_class_t *lsc)
 {
 	int i;
 
 	for (i = 0; i < RRM_NUM_LOCKS; i++)
-		rrw_init(&rrl->locks[i], track_all);
+		rrw_init_impl(&rrl->locks[i], track_all, lsc);
 }
 
 void
@@ -366,13 +385,95 @@ rrm_enter_read(rrmlock_t *rrl, void *tag)
 	rrw_enter_read(&rrl->locks[RRM_TD_LOCK()], tag);
 }
 
+void
+rrm_enter_read_prio(rrmlock_t *rrl, void *tag)
+{
+	rrw_enter_read_prio(&rrl->locks[RRM_TD_LOCK()], tag);
+}
+
+static boolean_t
+rrm_write_busy(rrwlock_t *rr)
+{
+	return (zfs_refcount_count(&rr->rr_anon_rcount) > 0 ||
+	    zfs_refcount_count(&rr->rr_linked_rcount) > 0 ||
+	    rr->rr_writer != NULL);
+}
+
+/*
+ * Release the first n locks taken by rrm_enter_write(), leaving them wanted.
+ */
+static void
+rrm_drop_write(rrmlock_t *rrl, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		rrwlock_t *rr = &rrl->locks[i];
+
+		mutex_enter(&rr->rr_lock);
+		ASSERT(rr->rr_writer == curthread);
+		rr->rr_writer = NULL;
+		rr->rr_writer_wanted = B_TRUE;
+		cv_broadcast(&rr->rr_cv);
+		mutex_exit(&rr->rr_lock);
+	}
+}
+
+/*
+ * The writer can't simply rrw_enter_write() each lock in turn: a reader
+ * which uses rrm_enter_read_prio() to get ahead of a waiting writer may
+ * hash to a lock the writer already holds, and wait for it while the
+ * writer waits for a related reader, which in turn waits for the first.
+ * So every lock is first marked wanted, which holds off all new readers
+ * but those, and the writer never waits for a lock while holding others.
+ * If the next lock is still busy, the ones taken so far are dropped and
+ * taken again once it has drained.
+ */
 void
 rrm_enter_write(rrmlock_t *rrl)
 {
+	hrtime_t start = 0;
 	int i;
 
-	for (i = 0; i < RRM_NUM_LOCKS; i++)
-		rrw_enter_write(&rrl->locks[i]);
+	for (i = 0; i < RRM_NUM_LOCKS; i++) {
+		rrwlock_t *rr = &rrl->locks[i];
+
+		mutex_enter(&rr->rr_lock);
+		ASSERT(rr->rr_writer != curthread);
+		rr->rr_writer_wanted = B_TRUE;
+		mutex_exit(&rr->rr_lock);
+	}
+
+	for (i = 0; i < RRM_NUM_LOCKS; ) {
+		rrwlock_t *rr = &rrl->locks[i];
+
+		mutex_enter(&rr->rr_lock);
+		if (rrm_write_busy(rr)) {
+			if (start == 0)
+				start = spl_lockstat_start();
+			if (i > 0) {
+				mutex_exit(&rr->rr_lock);
+				rrm_drop_write(rrl, i);
+				i = 0;
+				mutex_enter(&rr->rr_lock);
+			}
+			while (rrm_write_busy(rr)) {
+				rr->rr_writer_wanted = B_TRUE;
+				cv_wait(&rr->rr_cv, &rr->rr_lock);
+			}
+			if (i == 0 && rr != &rrl->locks[0]) {
+				mutex_exit(&rr->rr_lock);
+				continue;
+			}
+		}
+		rr->rr_writer_wanted = B_FALSE;
+		rr->rr_writer = curthread;
+		mutex_exit(&rr->rr_lock);
+		i++;
+	}
+
+	rrl->locks[0].rr_write_start = spl_lockstat_start();
+	spl_lockstat_acquired(rrl->locks[0].rr_class, start);
 }
 
 void
@@ -1714,7 +1714,14 @@ sa_find_idx_tab(objset_t *os, dmu_object_type_t bonustype, sa_hdr_phys_t *hdr)
 
 	search.lot_num = SA_LAYOUT_NUM(hdr, bonustype);
 
-	tb = avl_find(&sa->sa_layout_num_tree, &search, &loc);
+	if (search.lot_num < SA_LAYOUT_NUM_CACHE &&
+	    (tb = sa->sa_layout_num_cache[search.lot_num]) != NULL) {
+		ASSERT3U(tb->lot_num, ==, search.lot_num);
+	} else {
+		tb = avl_find(&sa->sa_layout_num_tree, &search, &loc);
+		if (tb != NULL && search.lot_num < SA_LAYOUT_NUM_CACHE)
+			sa->sa_layout_num_cache[search.lot_num] = tb;
+	}
 
 	/* Verify header size is consistent with layout information */
 	ASSERT(tb);
@@ -1742,6 +1749,15 @@ sa_find_idx_tab(objset_t *os, dmu_object_type_t bonustype, sa_hdr_phys_t *hdr)
 			}
 		}
 		if (valid_idx) {
+			/*
+			 * Keep the most recently used table first, which
+			 * matters for layouts with variable sized
+			 * attributes, whose tables differ by their lengths.
+			 */
+			if (idx_tab != list_head(&tb->lot_idx_tab)) {
+				list_remove(&tb->lot_idx_tab, idx_tab);
+				list_insert_head(&tb->lot_idx_tab, idx_tab);
+			}
 			sa_idx_tab_hold(os, idx_tab);
 			return (idx_tab);
 		}
@@ -2108,6 +2124,51 @@ sa_bulk_lookup(sa_handle_t *hdl, sa_bulk_attr_t *attrs, int count)
 	return (error);
 }
 
+/*
+ * Looks up the same nattrs attributes of count objects, as sa_bulk_lookup()
+ * would for each, for example to stat the files of a directory.  attrs
+ * holds the attributes of the object objs[i] at attrs[i * nattrs], and
+ * errors[i] is set to the error of its lookup.  The dnodes of the objects,
+ * which hold their bonus buffers, are read in first with sorted prefetches
+ * of up to DMU_PREFETCH_DNODES_BATCH objects.  Returns the number of
+ * objects whose lookup failed.
+ */
+int
+sa_bulk_lookup_objects(objset_t *os, const uint64_t *objs, uint_t count,
+    sa_bulk_attr_t *attrs, int nattrs, int *errors)
+{
+	uint64_t *pfobjs;
+	int failed = 0;
+
+	pfobjs = kmem_alloc(DMU_PREFETCH_DNODES_BATCH * sizeof (uint64_t),
+	    KM_SLEEP);
+
+	for (uint_t i = 0; i < count; i++) {
+		sa_handle_t *hdl;
+		int error;
+
+		if (i % DMU_PREFETCH_DNODES_BATCH == 0) {
+			uint_t n = MIN(count - i, DMU_PREFETCH_DNODES_BATCH);
+
+			bcopy(&objs[i], pfobjs, n * sizeof (uint64_t));
+			dmu_prefetch_dnodes(os, pfobjs, n,
+			    ZIO_PRIORITY_SYNC_READ);
+		}
+
+		error = sa_handle_get(os, objs[i], NULL, SA_HDL_PRIVATE, &hdl);
+		if (error == 0) {
+			error = sa_bulk_lookup(hdl, &attrs[i * nattrs], nattrs);
+			sa_handle_destroy(hdl);
+		}
+		errors[i] = error;
+		if (error != 0)
+			failed++;
+	}
+
+	kmem_free(pfobjs, DMU_PREFETCH_DNODES_BATCH * sizeof (uint64_t));
+	return (failed);
+}
+
 int
 sa_bulk_update(sa_handle_t *hdl, sa_bulk_attr_t *attrs, int count, dmu_tx_t *tx)
 {
@@ -2237,6 +2298,7 @@ EXPORT_SYMBOL(sa_lookup);
 EXPORT_SYMBOL(sa_update);
 EXPORT_SYMBOL(sa_remove);
 EXPORT_SYMBOL(sa_bulk_lookup);
+EXPORT_SYMBOL(sa_bulk_lookup_objects);
 EXPORT_SYMBOL(sa_bulk_lookup_locked);
 EXPORT_SYMBOL(sa_bulk_update);
 EXPORT_SYMBOL(sa_size);
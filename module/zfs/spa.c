@@ -53,11 +53,14 @@
 #include <sys/zil.h>
 #include <sys/ddt.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_raidz.h>
 #include <sys/vdev_removal.h>
 #include <sys/vdev_indirect_mapping.h>
 #include <sys/vdev_indirect_births.h>
 #include <sys/vdev_initialize.h>
 #include <sys/vdev_trim.h>
+#include <sys/vdev_rebuild.h>
 #include <sys/vdev_disk.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
@@ -101,6 +104,13 @@
  */
 int zfs_ccw_retry_interval = 300;
 
+/*
+ * Sync the dirty top-level vdevs, and thus their metaslabs, concurrently
+ * in the dp_sync_taskq rather than one after the other, see
+ * spa_sync_vdevs().
+ */
+int spa_sync_vdevs_parallel = 1;
+
 typedef enum zti_modes {
 	ZTI_MODE_FIXED,			/* value is # of threads (min 1) */
 	ZTI_MODE_BATCH,			/* cpu-intensive; value is ignored */
@@ -164,6 +174,17 @@ uint_t		zio_taskq_batch_pct = 75;	/* 1 thread per cpu in pset */
 boolean_t	zio_taskq_sysdc = B_TRUE;	/* use SDC scheduling class */
 uint_t		zio_taskq_basedc = 80;		/* base duty cycle */
 
+/*
+ * When set, the taskqs of the types which have several of them (ZTI_P) are
+ * spread over the NUMA nodes of the system and their threads are bound to
+ * the CPUs of their node.  Work is then dispatched to a taskq of the node
+ * of the dispatching CPU.  For the interrupt taskqs that is the CPU which
+ * handled the completion, usually the one which issued the I/O or one near
+ * the device.  This keeps a zio and its buffers on one node.  Only read at
+ * pool import.
+ */
+int		zio_taskq_numa = 0;
+
 boolean_t	spa_create_process = B_TRUE;	/* no process ==> no sysdc */
 
 /*
@@ -304,6 +325,8 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 
 		spa_prop_add_list(*nvp, ZPOOL_PROP_DEDUPRATIO, NULL,
 		    ddt_get_pool_dedup_ratio(spa), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_DEDUP_TABLE_SIZE, NULL,
+		    ddt_get_ddt_dsize(spa), src);
 
 		spa_prop_add_list(*nvp, ZPOOL_PROP_HEALTH, NULL,
 		    rvd->vdev_state, src);
@@ -948,13 +971,24 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 
 	if (mode == ZTI_MODE_NULL) {
 		tqs->stqs_count = 0;
+		tqs->stqs_nodes = 0;
 		tqs->stqs_taskq = NULL;
 		return;
 	}
 
 	ASSERT3U(count, >, 0);
 
+	/*
+	 * Each node gets the same number of taskqs, taskq i those of node
+	 * (i % nodes).  See spa_taskq_select().
+	 */
+	uint_t nodes = zio_taskq_numa ? taskq_nnodes() : 1;
+	if (nodes < 2 || count < nodes)
+		nodes = 1;
+	count -= count % nodes;
+
 	tqs->stqs_count = count;
+	tqs->stqs_nodes = nodes;
 	tqs->stqs_taskq = kmem_alloc(count * sizeof (taskq_t *), KM_SLEEP);
 
 	switch (mode) {
@@ -965,8 +999,13 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 		break;
 
 	case ZTI_MODE_BATCH:
+		/*
+		 * The write issue taskq does the compression and checksums
+		 * of all writes with one thread per CPU, so dispatch to it
+		 * without going through a single queue lock.
+		 */
 		batch = B_TRUE;
-		flags |= TASKQ_THREADS_CPU_PCT;
+		flags |= TASKQ_THREADS_CPU_PCT | TASKQ_STEAL;
 		value = MIN(zio_taskq_batch_pct, 100);
 		break;
 
@@ -1002,8 +1041,13 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 			if (t == ZIO_TYPE_WRITE && q == ZIO_TASKQ_ISSUE)
 				pri++;
 
-			tq = taskq_create_proc(name, value, pri, 50,
-			    INT_MAX, spa->spa_proc, flags);
+			if (nodes > 1) {
+				tq = taskq_create_on_node(name, value, pri,
+				    50, INT_MAX, flags, i % nodes);
+			} else {
+				tq = taskq_create_proc(name, value, pri, 50,
+				    INT_MAX, spa->spa_proc, flags);
+			}
 		}
 
 		tqs->stqs_taskq[i] = tq;
@@ -1030,26 +1074,40 @@ spa_taskqs_fini(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 }
 
 /*
- * Dispatch a task to the appropriate taskq for the ZFS I/O type and priority.
  * Note that a type may have multiple discrete taskqs to avoid lock contention
  * on the taskq itself. In that case we choose which taskq at random by using
- * the low bits of gethrtime().
+ * the low bits of gethrtime(), among the taskqs of the current NUMA node
+ * when they are spread over the nodes.
  */
-void
-spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
-    task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent)
+static taskq_t *
+spa_taskq_select(spa_taskqs_t *tqs)
 {
-	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
-	taskq_t *tq;
+	uint64_t r;
+	uint_t node;
 
 	ASSERT3P(tqs->stqs_taskq, !=, NULL);
 	ASSERT3U(tqs->stqs_count, !=, 0);
 
-	if (tqs->stqs_count == 1) {
-		tq = tqs->stqs_taskq[0];
-	} else {
-		tq = tqs->stqs_taskq[((uint64_t)gethrtime()) % tqs->stqs_count];
-	}
+	if (tqs->stqs_count == 1)
+		return (tqs->stqs_taskq[0]);
+
+	r = (uint64_t)gethrtime();
+	if (tqs->stqs_nodes == 1)
+		return (tqs->stqs_taskq[r % tqs->stqs_count]);
+
+	node = (uint_t)taskq_curnode() % tqs->stqs_nodes;
+	return (tqs->stqs_taskq[node + tqs->stqs_nodes *
+	    (r % (tqs->stqs_count / tqs->stqs_nodes))]);
+}
+
+/*
+ * Dispatch a task to the appropriate taskq for the ZFS I/O type and priority.
+ */
+void
+spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
+    task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent)
+{
+	taskq_t *tq = spa_taskq_select(&spa->spa_zio_taskq[t][q]);
 
 	taskq_dispatch_ent(tq, func, arg, flags, ent);
 }
@@ -1061,19 +1119,9 @@ void
 spa_taskq_dispatch_sync(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
     task_func_t *func, void *arg, uint_t flags)
 {
-	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
-	taskq_t *tq;
+	taskq_t *tq = spa_taskq_select(&spa->spa_zio_taskq[t][q]);
 	taskqid_t id;
 
-	ASSERT3P(tqs->stqs_taskq, !=, NULL);
-	ASSERT3U(tqs->stqs_count, !=, 0);
-
-	if (tqs->stqs_count == 1) {
-		tq = tqs->stqs_taskq[0];
-	} else {
-		tq = tqs->stqs_taskq[((uint64_t)gethrtime()) % tqs->stqs_count];
-	}
-
 	id = taskq_dispatch(tq, func, arg, flags);
 	if (id)
 		taskq_wait_id(tq, id);
@@ -1423,7 +1471,8 @@ spa_config_parse(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent,
 static boolean_t
 spa_should_flush_logs_on_unload(spa_t *spa)
 {
-	if (!spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP))
+	if (!spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP) &&
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_DDT_LOG))
 		return (B_FALSE);
 
 	if (!spa_writeable(spa))
@@ -1443,7 +1492,8 @@ spa_should_flush_logs_on_unload(spa_t *spa)
 
 /*
  * Opens a transaction that will set the flag that will instruct
- * spa_sync to attempt to flush all the metaslabs for that txg.
+ * spa_sync to attempt to flush all the metaslabs and the dedup logs
+ * for that txg.
  */
 static void
 spa_unload_log_sm_flush_all(spa_t *spa)
@@ -1497,7 +1547,8 @@ spa_unload(spa_t *spa)
 	 * If the log space map feature is enabled and the pool is getting
 	 * exported (but not destroyed), we want to spend some time flushing
 	 * as many metaslabs as we can in an attempt to destroy log space
-	 * maps and save import time.
+	 * maps and save import time.  The dedup logs are applied to the
+	 * DDT ZAPs likewise, so that they need not be replayed at import.
 	 */
 	if (spa_should_flush_logs_on_unload(spa))
 		spa_unload_log_sm_flush_all(spa);
@@ -1512,15 +1563,19 @@ spa_unload(spa_t *spa)
 		vdev_initialize_stop_all(root_vdev, VDEV_INITIALIZE_ACTIVE);
 		vdev_trim_stop_all(root_vdev, VDEV_TRIM_ACTIVE);
 		vdev_autotrim_stop_all(spa);
+		vdev_rebuild_stop_all(spa);
+		vdev_raidz_expand_stop_all(spa);
 	}
 
 	/*
-	 * Stop syncing.
+	 * Stop syncing, writing out any lazily kept history on the way.
 	 */
 	if (spa->spa_sync_on) {
+		spa_history_flush_lazy(spa);
 		txg_sync_stop(spa->spa_dsl_pool);
 		spa->spa_sync_on = B_FALSE;
 	}
+	spa_history_fini(spa);
 
 	/*
 	 * This ensures that there is no async metaslab prefetching
@@ -1562,6 +1617,16 @@ spa_unload(spa_t *spa)
 		spa->spa_checkpoint_discard_zthr = NULL;
 	}
 
+	if (spa->spa_ms_condense_zthr != NULL) {
+		zthr_destroy(spa->spa_ms_condense_zthr);
+		spa->spa_ms_condense_zthr = NULL;
+	}
+
+	if (spa->spa_livelist_condense_zthr != NULL) {
+		zthr_destroy(spa->spa_livelist_condense_zthr);
+		spa->spa_livelist_condense_zthr = NULL;
+	}
+
 	spa_condense_fini(spa);
 
 	bpobj_close(&spa->spa_deferred_bpobj);
@@ -2348,6 +2413,13 @@ spa_spawn_aux_threads(spa_t *spa)
 	spa->spa_checkpoint_discard_zthr =
 	    zthr_create(spa_checkpoint_discard_thread_check,
 	    spa_checkpoint_discard_thread, spa);
+
+	metaslab_start_condense_thread(spa);
+
+	ASSERT3P(spa->spa_livelist_condense_zthr, ==, NULL);
+	spa->spa_livelist_condense_zthr =
+	    zthr_create(spa_livelist_condense_thread_check,
+	    spa_livelist_condense_thread, spa);
 }
 
 /*
@@ -2450,7 +2522,7 @@ spa_load(spa_t *spa, spa_load_state_t state, spa_import_type_t type)
 	 * and are making their way through the eviction process.
 	 */
 	spa_evicting_os_wait(spa);
-	spa->spa_minref = zfs_refcount_count(&spa->spa_refcount);
+	spa->spa_minref = zfs_refcount_pcpu_count(&spa->spa_refcount);
 	if (error) {
 		if (error != EEXIST) {
 			spa->spa_loaded_ts.tv_sec = 0;
@@ -3667,6 +3739,8 @@ spa_ld_get_props(spa_t *spa)
 		spa_prop_find(spa, ZPOOL_PROP_AUTOEXPAND, &spa->spa_autoexpand);
 		spa_prop_find(spa, ZPOOL_PROP_MULTIHOST, &spa->spa_multihost);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOTRIM, &spa->spa_autotrim);
+		spa_prop_find(spa, ZPOOL_PROP_DEDUP_TABLE_QUOTA,
+		    &spa->spa_dedup_table_quota);
 		spa->spa_autoreplace = (autoreplace != 0);
 	}
 
@@ -3803,7 +3877,7 @@ spa_ld_load_vdev_metadata(spa_t *spa)
 	 * Propagate the leaf DTLs we just loaded all the way up the vdev tree.
 	 */
 	spa_config_enter(spa, SCL_ALL, FTAG, RW_WRITER);
-	vdev_dtl_reassess(rvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(rvd, 0, 0, B_FALSE, B_FALSE);
 	spa_config_exit(spa, SCL_ALL, FTAG);
 
 	return (0);
@@ -4428,6 +4502,8 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 		vdev_initialize_restart(spa->spa_root_vdev);
 		vdev_trim_restart(spa->spa_root_vdev);
 		vdev_autotrim_restart(spa);
+		vdev_rebuild_restart(spa);
+		vdev_raidz_expand_restart(spa);
 		spa_config_exit(spa, SCL_CONFIG, FTAG);
 	}
 
@@ -4996,6 +5072,50 @@ spa_get_stats(const char *name, nvlist_t **config,
 	return (error);
 }
 
+/*
+ * Add the stats of vd and of its children to the nvlist, keyed by guid.
+ */
+static void
+spa_add_vdev_stats(vdev_t *vd, nvlist_t *stats)
+{
+	char guid[32];
+	nvlist_t *nv = fnvlist_alloc();
+
+	vdev_config_generate_stats(vd, nv);
+	(void) snprintf(guid, sizeof (guid), "%llu",
+	    (u_longlong_t)vd->vdev_guid);
+	fnvlist_add_nvlist(stats, guid, nv);
+	fnvlist_free(nv);
+
+	for (uint64_t c = 0; c < vd->vdev_children; c++)
+		spa_add_vdev_stats(vd->vdev_child[c], stats);
+}
+
+/*
+ * Get the stats of the vdevs and the cache devices of a pool, without
+ * generating the rest of its config as spa_get_stats() does.  This is
+ * meant for consumers which poll the stats at short intervals, such as
+ * "zpool iostat".
+ */
+int
+spa_get_vdev_stats(const char *name, nvlist_t *stats)
+{
+	spa_t *spa;
+	int error;
+
+	if ((error = spa_open(name, &spa, FTAG)) != 0)
+		return (error);
+
+	spa_config_enter(spa, SCL_CONFIG | SCL_STATE, FTAG, RW_READER);
+	spa_add_vdev_stats(spa->spa_root_vdev, stats);
+	for (int i = 0; i < spa->spa_l2cache.sav_count; i++)
+		spa_add_vdev_stats(spa->spa_l2cache.sav_vdevs[i], stats);
+	spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+
+	spa_close(spa, FTAG);
+	return (0);
+}
+
 /*
  * Validate that the auxiliary device array is well formed.  We must have an
  * array of nvlists, each which describes a valid leaf vdev.  If this is an
@@ -5300,9 +5420,13 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 		error = SET_ERROR(EINVAL);
 
 	if (error == 0 &&
-	    (error = vdev_create(rvd, txg, B_FALSE)) == 0 &&
-	    (error = spa_validate_aux(spa, nvroot, txg,
-	    VDEV_ALLOC_ADD)) == 0) {
+	    (error = vdev_create(rvd, txg, B_FALSE)) == 0) {
+		/* Distributed spares are validated with the other spares */
+		vdev_draid_spare_create(nvroot, rvd, 0);
+		error = spa_validate_aux(spa, nvroot, txg, VDEV_ALLOC_ADD);
+	}
+
+	if (error == 0) {
 		/*
 		 * instantiate the metaslab groups (this will dirty the vdevs)
 		 * we can no longer error exit past this point
@@ -5438,12 +5562,26 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_autoexpand = zpool_prop_default_numeric(ZPOOL_PROP_AUTOEXPAND);
 	spa->spa_multihost = zpool_prop_default_numeric(ZPOOL_PROP_MULTIHOST);
 	spa->spa_autotrim = zpool_prop_default_numeric(ZPOOL_PROP_AUTOTRIM);
+	spa->spa_dedup_table_quota =
+	    zpool_prop_default_numeric(ZPOOL_PROP_DEDUP_TABLE_QUOTA);
 
 	if (props != NULL) {
 		spa_configfile_set(spa, props, B_FALSE);
 		spa_sync_props(props, tx);
 	}
 
+	/*
+	 * dRAID vdevs activate their feature when their top-level ZAP is
+	 * created, so it must be enabled even if it was left out of props.
+	 */
+	for (int c = 0; c < rvd->vdev_children; c++) {
+		if (rvd->vdev_child[c]->vdev_ops == &vdev_draid_ops &&
+		    !spa_feature_is_enabled(spa, SPA_FEATURE_DRAID)) {
+			spa_feature_enable(spa, SPA_FEATURE_DRAID, tx);
+			break;
+		}
+	}
+
 	dmu_tx_commit(tx);
 
 	spa->spa_sync_on = B_TRUE;
@@ -5460,7 +5598,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	 * and are making their way through the eviction process.
 	 */
 	spa_evicting_os_wait(spa);
-	spa->spa_minref = zfs_refcount_count(&spa->spa_refcount);
+	spa->spa_minref = zfs_refcount_pcpu_count(&spa->spa_refcount);
 	spa->spa_load_state = SPA_LOAD_NONE;
 
 	mutex_exit(&spa_namespace_lock);
@@ -5864,6 +6002,8 @@ spa_export_common(char *pool, int new_state, nvlist_t **oldconfig,
 			vdev_initialize_stop_all(rvd, VDEV_INITIALIZE_ACTIVE);
 			vdev_trim_stop_all(rvd, VDEV_TRIM_ACTIVE);
 			vdev_autotrim_stop_all(spa);
+			vdev_rebuild_stop_all(spa);
+			vdev_raidz_expand_stop_all(spa);
 		}
 
 		/*
@@ -5988,6 +6128,17 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	    (error = vdev_create(vd, txg, B_FALSE)) != 0)
 		return (spa_vdev_exit(spa, vd, txg, error));
 
+	/*
+	 * The distributed spares of new dRAID vdevs are added along with
+	 * any other new spares.
+	 */
+	if (vd->vdev_children != 0) {
+		vdev_draid_spare_create(nvroot, vd, rvd->vdev_children);
+		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
+		    &spares, &nspares) != 0)
+			nspares = 0;
+	}
+
 	/*
 	 * We must validate the spares and l2cache devices after checking the
 	 * children.  Otherwise, vdev_inuse() will blindly overwrite the spare.
@@ -6009,8 +6160,9 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 			    tvd->vdev_ashift != spa->spa_max_ashift) {
 				return (spa_vdev_exit(spa, vd, txg, EINVAL));
 			}
-			/* Fail if top level vdev is raidz */
-			if (tvd->vdev_ops == &vdev_raidz_ops) {
+			/* Fail if top level vdev is raidz or draid */
+			if (tvd->vdev_ops == &vdev_raidz_ops ||
+			    tvd->vdev_ops == &vdev_draid_ops) {
 				return (spa_vdev_exit(spa, vd, txg, EINVAL));
 			}
 			/*
@@ -6079,6 +6231,8 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
  * Attach a device to a mirror.  The arguments are the path to any device
  * in the mirror, and the nvroot for the new device.  If the path specifies
  * a device that is not mirrored, we automatically insert the mirror vdev.
+ * If the path specifies a raidz vdev, the new device is added to it and
+ * the vdev is expanded, see vdev_raidz_attach().
  *
  * If 'replacing' is specified, the new device is intended to replace the
  * existing device; in this case the two devices are made into their own
@@ -6089,15 +6243,17 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
  * is automatically detached.
  */
 int
-spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
+spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing,
+    int rebuild)
 {
 	uint64_t txg, dtl_max_txg;
-	ASSERTV(vdev_t *rvd = spa->spa_root_vdev);
+	vdev_t *rvd = spa->spa_root_vdev;
 	vdev_t *oldvd, *newvd, *newrootvd, *pvd, *tvd;
 	vdev_ops_t *pvops;
 	char *oldvdpath, *newvdpath;
 	int newvd_isspare;
 	int error;
+	boolean_t raidz;
 
 	ASSERT(spa_writeable(spa));
 
@@ -6118,8 +6274,60 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	if (oldvd == NULL)
 		return (spa_vdev_exit(spa, NULL, txg, ENODEV));
 
-	if (!oldvd->vdev_ops->vdev_op_leaf)
+	raidz = (oldvd->vdev_ops == &vdev_raidz_ops);
+	if (raidz) {
+		if (!spa_feature_is_enabled(spa, SPA_FEATURE_RAIDZ_EXPANSION) ||
+		    oldvd->vdev_top_zap == 0 || replacing || rebuild)
+			return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+
+		if (spa->spa_raidz_expand != NULL) {
+			return (spa_vdev_exit(spa, NULL, txg,
+			    ZFS_ERR_RAIDZ_EXPAND_IN_PROGRESS));
+		}
+
+		/*
+		 * The reflow reads the sectors from the children directly,
+		 * so all of them must be healthy and complete.
+		 */
+		if (oldvd->vdev_state != VDEV_STATE_HEALTHY ||
+		    !vdev_dtl_empty(oldvd, DTL_MISSING) ||
+		    dsl_scan_resilvering(spa_get_dsl(spa)))
+			return (spa_vdev_exit(spa, NULL, txg, EBUSY));
+
+		/*
+		 * Initializing and TRIM cannot translate the offsets of the
+		 * vdev while it is being expanded, stop them but leave their
+		 * state active.
+		 */
+		spa_vdev_config_exit(spa, NULL, txg, 0, FTAG);
+		vdev_initialize_stop_all(oldvd, VDEV_INITIALIZE_ACTIVE);
+		vdev_trim_stop_all(oldvd, VDEV_TRIM_ACTIVE);
+		vdev_autotrim_stop_wait(oldvd);
+		txg = spa_vdev_config_enter(spa);
+	} else if (!oldvd->vdev_ops->vdev_op_leaf) {
 		return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+	}
+
+	/*
+	 * A sequential rebuild copies the allocated ranges of the top-level
+	 * vdev verbatim, which is only possible when every vdev between it
+	 * and the leaf holds a full copy; i.e. for mirror, replacing and
+	 * spare vdevs.
+	 */
+	if (rebuild) {
+		if (!spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REBUILD) ||
+		    oldvd->vdev_top->vdev_top_zap == 0)
+			return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+
+		for (pvd = oldvd->vdev_parent; pvd != rvd;
+		    pvd = pvd->vdev_parent) {
+			if (pvd->vdev_ops != &vdev_mirror_ops &&
+			    pvd->vdev_ops != &vdev_replacing_ops &&
+			    pvd->vdev_ops != &vdev_spare_ops)
+				return (spa_vdev_exit(spa, NULL, txg,
+				    ENOTSUP));
+		}
+	}
 
 	pvd = oldvd->vdev_parent;
 
@@ -6144,7 +6352,20 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	if (oldvd->vdev_top->vdev_islog && newvd->vdev_isspare)
 		return (spa_vdev_exit(spa, newrootvd, txg, ENOTSUP));
 
-	if (!replacing) {
+	/*
+	 * A distributed spare can only replace a child of its own dRAID vdev.
+	 */
+	if (newvd->vdev_ops == &vdev_draid_spare_ops &&
+	    vdev_draid_spare_get_parent(newvd) != oldvd->vdev_top)
+		return (spa_vdev_exit(spa, newrootvd, txg, ENOTSUP));
+
+	if (raidz) {
+		if (newvd->vdev_isspare)
+			return (spa_vdev_exit(spa, newrootvd, txg, ENOTSUP));
+
+		pvd = oldvd;
+		pvops = &vdev_raidz_ops;
+	} else if (!replacing) {
 		/*
 		 * For attach, the only allowable parent is a mirror or the root
 		 * vdev.
@@ -6189,7 +6410,8 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	/*
 	 * Make sure the new device is big enough.
 	 */
-	if (newvd->vdev_asize < vdev_get_min_asize(oldvd))
+	if (newvd->vdev_asize < vdev_get_min_asize(raidz ?
+	    oldvd->vdev_child[0] : oldvd))
 		return (spa_vdev_exit(spa, newrootvd, txg, EOVERFLOW));
 
 	/*
@@ -6203,7 +6425,7 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	 * If this is an in-place replacement, update oldvd's path and devid
 	 * to make it distinguishable from newvd, and unopenable from now on.
 	 */
-	if (strcmp(oldvd->vdev_path, newvd->vdev_path) == 0) {
+	if (!raidz && strcmp(oldvd->vdev_path, newvd->vdev_path) == 0) {
 		spa_strfree(oldvd->vdev_path);
 		oldvd->vdev_path = kmem_alloc(strlen(newvd->vdev_path) + 5,
 		    KM_SLEEP);
@@ -6215,8 +6437,11 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 		}
 	}
 
-	/* mark the device being resilvered */
-	newvd->vdev_resilver_txg = txg;
+	/* mark the device being resilvered or rebuilt */
+	if (rebuild)
+		newvd->vdev_rebuild_txg = txg;
+	else if (!raidz)
+		newvd->vdev_resilver_txg = txg;
 
 	/*
 	 * If the parent is not a mirror, or if we're replacing, insert the new
@@ -6227,7 +6452,7 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 
 	ASSERT(pvd->vdev_top->vdev_parent == rvd);
 	ASSERT(pvd->vdev_ops == pvops);
-	ASSERT(oldvd->vdev_parent == pvd);
+	ASSERT(raidz || oldvd->vdev_parent == pvd);
 
 	/*
 	 * Extract the new device from its root and add it to pvd.
@@ -6248,6 +6473,29 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 
 	vdev_config_dirty(tvd);
 
+	/*
+	 * The new child of a raidz vdev holds no data yet, it is written by
+	 * the reflow rather than resilvered.
+	 */
+	if (raidz) {
+		dmu_tx_t *tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
+		vdev_raidz_attach(tvd, tx);
+		dmu_tx_commit(tx);
+
+		newvdpath = spa_strdup(newvd->vdev_path);
+		spa_event_notify(spa, newvd, NULL, ESC_ZFS_VDEV_ATTACH);
+
+		(void) spa_vdev_exit(spa, newrootvd, txg, 0);
+
+		spa_history_log_internal(spa, "vdev attach", NULL,
+		    "attach vdev=%s to vdev=%s%llu-%llu", newvdpath,
+		    VDEV_TYPE_RAIDZ, (u_longlong_t)tvd->vdev_nparity,
+		    (u_longlong_t)tvd->vdev_id);
+		spa_strfree(newvdpath);
+
+		return (0);
+	}
+
 	/*
 	 * Set newvd's DTL to [TXG_INITIAL, dtl_max_txg) so that we account
 	 * for any dmu_sync-ed blocks.  It will propagate upward when
@@ -6273,16 +6521,23 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	vdev_dirty(tvd, VDD_DTL, newvd, txg);
 
 	/*
-	 * Schedule the resilver to restart in the future. We do this to
-	 * ensure that dmu_sync-ed blocks have been stitched into the
+	 * For a sequential rebuild request that the top-level vdev be
+	 * rebuilt, the rebuild thread is started by spa_vdev_exit() and
+	 * waits for dtl_max_txg to sync before scanning the space maps.
+	 *
+	 * Otherwise, schedule the resilver to restart in the future. We do
+	 * this to ensure that dmu_sync-ed blocks have been stitched into the
 	 * respective datasets. We do not do this if resilvers have been
 	 * deferred.
 	 */
-	if (dsl_scan_resilvering(spa_get_dsl(spa)) &&
-	    spa_feature_is_enabled(spa, SPA_FEATURE_RESILVER_DEFER))
+	if (rebuild) {
+		vdev_rebuild(tvd);
+	} else if (dsl_scan_resilvering(spa_get_dsl(spa)) &&
+	    spa_feature_is_enabled(spa, SPA_FEATURE_RESILVER_DEFER)) {
 		vdev_set_deferred_resilver(spa, newvd);
-	else
+	} else {
 		dsl_resilver_restart(spa->spa_dsl_pool, dtl_max_txg);
+	}
 
 	if (spa->spa_bootfs)
 		spa_event_notify(spa, newvd, NULL, ESC_ZFS_BOOTFS_VDEV_ATTACH);
@@ -7354,6 +7609,17 @@ spa_scan_stop(spa_t *spa)
 
 int
 spa_scan(spa_t *spa, pool_scan_func_t func)
+{
+	return (spa_scan_range(spa, func, 0, 0));
+}
+
+/*
+ * Like spa_scan(), but a scrub only examines the blocks born in txgs
+ * [txg_start, txg_end), with a txg_end of 0 meaning up to the current txg.
+ */
+int
+spa_scan_range(spa_t *spa, pool_scan_func_t func, uint64_t txg_start,
+    uint64_t txg_end)
 {
 	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == 0);
 
@@ -7374,7 +7640,7 @@ spa_scan(spa_t *spa, pool_scan_func_t func)
 		return (0);
 	}
 
-	return (dsl_scan(spa->spa_dsl_pool, func));
+	return (dsl_scan(spa->spa_dsl_pool, func, txg_start, txg_end));
 }
 
 /*
@@ -7409,15 +7675,58 @@ spa_async_remove(spa_t *spa, vdev_t *vd)
 }
 
 static void
-spa_async_probe(spa_t *spa, vdev_t *vd)
+spa_async_probe_clear(vdev_t *vd)
+{
+	vd->vdev_probe_wanted = B_FALSE;
+
+	for (int c = 0; c < vd->vdev_children; c++)
+		spa_async_probe_clear(vd->vdev_child[c]);
+}
+
+/*
+ * Count the vdevs under vd which want to be probed, and if vds isn't NULL
+ * add them to it, up to max.  The descendants of such a vdev are reopened
+ * with it, so they aren't counted.
+ */
+static int
+spa_async_probe_collect(vdev_t *vd, vdev_t **vds, int n, int max)
 {
 	if (vd->vdev_probe_wanted) {
-		vd->vdev_probe_wanted = B_FALSE;
-		vdev_reopen(vd);	/* vdev_open() does the actual probe */
+		if (vds != NULL && n < max) {
+			spa_async_probe_clear(vd);
+			vds[n] = vd;
+		}
+		return (n + 1);
 	}
 
 	for (int c = 0; c < vd->vdev_children; c++)
-		spa_async_probe(spa, vd->vdev_child[c]);
+		n = spa_async_probe_collect(vd->vdev_child[c], vds, n, max);
+
+	return (n);
+}
+
+/*
+ * Reopen, and so probe, the vdevs which want to be.  A controller reset
+ * can leave dozens of disks to probe, so they're reopened together.
+ */
+static void
+spa_async_probe(spa_t *spa, vdev_t *vd)
+{
+	int count, max;
+	vdev_t **vds;
+
+	max = spa_async_probe_collect(vd, NULL, 0, 0);
+	if (max == 0)
+		return;
+
+	vds = kmem_alloc(max * sizeof (vdev_t *), KM_SLEEP);
+	count = spa_async_probe_collect(vd, vds, 0, max);
+	vdev_reopen_many(spa, vds, MIN(count, max));
+	kmem_free(vds, max * sizeof (vdev_t *));
+
+	/* More probes were wanted meanwhile, do them next time around */
+	if (count > max)
+		spa_async_request(spa, SPA_ASYNC_PROBE);
 }
 
 static void
@@ -7462,7 +7771,7 @@ spa_async_thread(void *arg)
 		old_space += metaslab_class_get_space(spa_special_class(spa));
 		old_space += metaslab_class_get_space(spa_dedup_class(spa));
 
-		spa_config_update(spa, SPA_CONFIG_UPDATE_POOL);
+		spa_config_update_deferred(spa, SPA_CONFIG_UPDATE_POOL);
 
 		new_space = metaslab_class_get_space(spa_normal_class(spa));
 		new_space += metaslab_class_get_space(spa_special_class(spa));
@@ -7516,9 +7825,25 @@ spa_async_thread(void *arg)
 		spa_vdev_resilver_done(spa);
 
 	/*
-	 * Kick off a resilver.
+	 * If any devices are done rebuilding, detach them and when no
+	 * other rebuilds remain scrub the pool to verify the checksums
+	 * of the rebuilt blocks.
+	 */
+	if (tasks & SPA_ASYNC_REBUILD_DONE) {
+		spa_vdev_resilver_done(spa);
+
+		if (zfs_rebuild_scrub_enabled &&
+		    !vdev_rebuild_active(spa->spa_root_vdev) &&
+		    !dsl_scan_scrubbing(dp) && !dsl_scan_resilvering(dp))
+			(void) dsl_scan(dp, POOL_SCAN_SCRUB, 0, 0);
+	}
+
+	/*
+	 * Kick off a resilver.  A sequential rebuild in progress restores
+	 * the missing data itself, so a healing resilver is not started.
 	 */
 	if (tasks & SPA_ASYNC_RESILVER &&
+	    !vdev_rebuild_active(spa->spa_root_vdev) &&
 	    (!dsl_scan_resilvering(dp) ||
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_RESILVER_DEFER)))
 		dsl_resilver_restart(dp, 0);
@@ -7575,6 +7900,14 @@ spa_async_suspend(spa_t *spa)
 	zthr_t *discard_thread = spa->spa_checkpoint_discard_zthr;
 	if (discard_thread != NULL)
 		zthr_cancel(discard_thread);
+
+	zthr_t *ms_condense_thread = spa->spa_ms_condense_zthr;
+	if (ms_condense_thread != NULL)
+		zthr_cancel(ms_condense_thread);
+
+	zthr_t *ll_condense_thread = spa->spa_livelist_condense_zthr;
+	if (ll_condense_thread != NULL)
+		zthr_cancel(ll_condense_thread);
 }
 
 void
@@ -7593,6 +7926,14 @@ spa_async_resume(spa_t *spa)
 	zthr_t *discard_thread = spa->spa_checkpoint_discard_zthr;
 	if (discard_thread != NULL)
 		zthr_resume(discard_thread);
+
+	zthr_t *ms_condense_thread = spa->spa_ms_condense_zthr;
+	if (ms_condense_thread != NULL)
+		zthr_resume(ms_condense_thread);
+
+	zthr_t *ll_condense_thread = spa->spa_livelist_condense_zthr;
+	if (ll_condense_thread != NULL)
+		zthr_resume(ll_condense_thread);
 }
 
 static boolean_t
@@ -7651,10 +7992,65 @@ bpobj_enqueue_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 	return (0);
 }
 
+/*
+ * Dedup blocks are freed in batches, the DDT entries of each batch being
+ * prefetched together first, so that the DDT_FREE stages of the frees do
+ * not each wait in turn for the read of a ZAP leaf.
+ */
+#define	SPA_FREE_DDT_BATCH	128
+
+typedef struct spa_free_arg {
+	zio_t		*sfa_zio;
+	uint_t		sfa_count;
+	blkptr_t	sfa_bps[SPA_FREE_DDT_BATCH];
+} spa_free_arg_t;
+
+static spa_free_arg_t *
+spa_free_arg_alloc(spa_t *spa)
+{
+	spa_free_arg_t *sfa = kmem_alloc(sizeof (spa_free_arg_t), KM_SLEEP);
+
+	sfa->sfa_zio = zio_root(spa, NULL, NULL, 0);
+	sfa->sfa_count = 0;
+	return (sfa);
+}
+
+static void
+spa_free_ddt_batch(spa_free_arg_t *sfa, dmu_tx_t *tx)
+{
+	zio_t *zio = sfa->sfa_zio;
+
+	ddt_prefetch_batch(zio->io_spa, sfa->sfa_bps, sfa->sfa_count);
+	for (uint_t i = 0; i < sfa->sfa_count; i++) {
+		zio_nowait(zio_free_sync(zio, zio->io_spa, dmu_tx_get_txg(tx),
+		    &sfa->sfa_bps[i], zio->io_flags));
+	}
+	sfa->sfa_count = 0;
+}
+
+static int
+spa_free_arg_wait(spa_free_arg_t *sfa, dmu_tx_t *tx)
+{
+	int error;
+
+	spa_free_ddt_batch(sfa, tx);
+	error = zio_wait(sfa->sfa_zio);
+	kmem_free(sfa, sizeof (spa_free_arg_t));
+	return (error);
+}
+
 static int
 spa_free_sync_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 {
-	zio_t *zio = arg;
+	spa_free_arg_t *sfa = arg;
+	zio_t *zio = sfa->sfa_zio;
+
+	if (BP_GET_DEDUP(bp) && !BP_IS_EMBEDDED(bp)) {
+		sfa->sfa_bps[sfa->sfa_count++] = *bp;
+		if (sfa->sfa_count == SPA_FREE_DDT_BATCH)
+			spa_free_ddt_batch(sfa, tx);
+		return (0);
+	}
 
 	zio_nowait(zio_free_sync(zio, zio->io_spa, dmu_tx_get_txg(tx), bp,
 	    zio->io_flags));
@@ -7668,9 +8064,9 @@ spa_free_sync_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 static void
 spa_sync_frees(spa_t *spa, bplist_t *bpl, dmu_tx_t *tx)
 {
-	zio_t *zio = zio_root(spa, NULL, NULL, 0);
-	bplist_iterate(bpl, spa_free_sync_cb, zio, tx);
-	VERIFY(zio_wait(zio) == 0);
+	spa_free_arg_t *sfa = spa_free_arg_alloc(spa);
+	bplist_iterate(bpl, spa_free_sync_cb, sfa, tx);
+	VERIFY(spa_free_arg_wait(sfa, tx) == 0);
 }
 
 /*
@@ -7695,10 +8091,10 @@ spa_sync_deferred_frees(spa_t *spa, dmu_tx_t *tx)
 	 * activated the log space map feature in this TXG but we have
 	 * deferred frees from the previous TXG.
 	 */
-	zio_t *zio = zio_root(spa, NULL, NULL, 0);
+	spa_free_arg_t *sfa = spa_free_arg_alloc(spa);
 	VERIFY3U(bpobj_iterate(&spa->spa_deferred_bpobj,
-	    spa_free_sync_cb, zio, tx), ==, 0);
-	VERIFY0(zio_wait(zio));
+	    spa_free_sync_cb, sfa, tx), ==, 0);
+	VERIFY0(spa_free_arg_wait(sfa, tx));
 }
 
 static void
@@ -8074,6 +8470,9 @@ spa_sync_props(void *arg, dmu_tx_t *tx)
 			case ZPOOL_PROP_MULTIHOST:
 				spa->spa_multihost = intval;
 				break;
+			case ZPOOL_PROP_DEDUP_TABLE_QUOTA:
+				spa->spa_dedup_table_quota = intval;
+				break;
 			default:
 				break;
 			}
@@ -8098,7 +8497,7 @@ spa_sync_upgrades(spa_t *spa, dmu_tx_t *tx)
 		return;
 
 	dsl_pool_t *dp = spa->spa_dsl_pool;
-	rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+	rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 
 	if (spa->spa_ubsync.ub_version < SPA_VERSION_ORIGIN &&
 	    spa->spa_uberblock.ub_version >= SPA_VERSION_ORIGIN) {
@@ -8155,7 +8554,7 @@ spa_sync_upgrades(spa_t *spa, dmu_tx_t *tx)
 		    spa->spa_cksum_salt.zcs_bytes, tx));
 	}
 
-	rrw_exit(&dp->dp_config_rwlock, FTAG);
+	rrm_exit(&dp->dp_config_rwlock, FTAG);
 }
 
 static void
@@ -8268,6 +8667,46 @@ spa_sync_condense_indirect(spa_t *spa, dmu_tx_t *tx)
 	}
 }
 
+static void
+spa_sync_vdev_task(void *arg)
+{
+	vdev_t *vd = arg;
+
+	vdev_sync(vd, spa_syncing_txg(vd->vdev_spa));
+}
+
+/*
+ * Sync the dirty top-level vdevs.  The state they share, e.g. the log
+ * space map, is protected by the spa_vdev_sync_lock, so unless
+ * spa_sync_vdevs_parallel is disabled they are synced concurrently, each
+ * by a task in the dp_sync_taskq, which is idle at this point.
+ */
+static void
+spa_sync_vdevs(spa_t *spa, uint64_t txg)
+{
+	dsl_pool_t *dp = spa->spa_dsl_pool;
+	vdev_t *vd;
+
+	/*
+	 * Verifying the class histograms against those of all the groups
+	 * would race with the syncing of the other vdevs.
+	 */
+	boolean_t parallel = spa_sync_vdevs_parallel &&
+	    !(zfs_flags & ZFS_DEBUG_HISTOGRAM_VERIFY);
+
+	while ((vd = txg_list_remove(&spa->spa_vdev_txg_list, txg)) != NULL) {
+		if (parallel) {
+			(void) taskq_dispatch(dp->dp_sync_taskq,
+			    spa_sync_vdev_task, vd, TQ_SLEEP);
+		} else {
+			vdev_sync(vd, txg);
+		}
+	}
+
+	if (parallel)
+		taskq_wait(dp->dp_sync_taskq);
+}
+
 static void
 spa_sync_iterate_to_convergence(spa_t *spa, dmu_tx_t *tx)
 {
@@ -8286,6 +8725,7 @@ spa_sync_iterate_to_convergence(spa_t *spa, dmu_tx_t *tx)
 		    ZPOOL_CONFIG_L2CACHE, DMU_POOL_L2CACHE);
 		spa_errlog_sync(spa, txg);
 		dsl_pool_sync(dp, txg);
+		spa_history_sync(spa, tx);
 
 		if (pass < zfs_sync_pass_deferred_free ||
 		    spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP)) {
@@ -8312,11 +8752,7 @@ spa_sync_iterate_to_convergence(spa_t *spa, dmu_tx_t *tx)
 		spa_sync_upgrades(spa, tx);
 
 		spa_flush_metaslabs(spa, tx);
-
-		vdev_t *vd = NULL;
-		while ((vd = txg_list_remove(&spa->spa_vdev_txg_list, txg))
-		    != NULL)
-			vdev_sync(vd, txg);
+		spa_sync_vdevs(spa, txg);
 
 		/*
 		 * Note: We need to check if the MOS is dirty because we could
@@ -8874,10 +9310,16 @@ ZFS_MODULE_PARAM(zfs_spa, spa_, load_verify_data, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_spa, spa_, load_print_vdev_tree, UINT, ZMOD_RW,
 	"Print vdev tree to zfs_dbgmsg during pool import");
 
+ZFS_MODULE_PARAM(zfs_spa, spa_, sync_vdevs_parallel, INT, ZMOD_RW,
+	"Sync the dirty top-level vdevs concurrently");
+
 /* CSTYLED */
 ZFS_MODULE_PARAM(zfs_zio, zio_, taskq_batch_pct, UINT, ZMOD_RW,
 	"Percentage of CPUs to run an IO worker thread");
 
+ZFS_MODULE_PARAM(zfs_zio, zio_, taskq_numa, INT, ZMOD_RW,
+	"Spread the IO taskqs over the NUMA nodes");
+
 /* BEGIN CSTYLED */
 ZFS_MODULE_PARAM(zfs, zfs_, max_missing_tvds, UQUAD, ZMOD_RW,
 	"Allow importing pool with up to this number of missing top-level vdevs"
@@ -68,6 +68,15 @@ static uint64_t spa_config_generation = 1;
 char *spa_config_path = ZPOOL_CACHE;
 int zfs_autoimport_disable = 1;
 
+/*
+ * Cachefile updates requested by the async config update are deferred by
+ * this many milliseconds and coalesced; see spa_config_update_deferred().
+ */
+int spa_config_write_delay_ms = 1000;
+
+/* Pending deferred cachefile writer, protected by spa_namespace_lock */
+static taskqid_t spa_config_writer_id = TASKQID_INVALID;
+
 /*
  * Called when the module is first loaded, this routine loads the configuration
  * file into the SPA namespace.  It does not actually open or load the pools; it
@@ -355,6 +364,93 @@ spa_write_cachefile(spa_t *target, boolean_t removing, boolean_t postsysevent)
 		spa_event_notify(target, NULL, NULL, ESC_ZFS_CONFIG_SYNC);
 }
 
+/*
+ * Write out the cachefiles of every pool with a deferred update.  Writing a
+ * cachefile captures the current config of every pool using it, so pools
+ * whose only cachefile was already written by this pass are skipped (their
+ * config was updated before they were marked).  During mass vdev state
+ * changes this turns one full rewrite per pool and per update into one per
+ * cachefile, and keeps the async threads off spa_namespace_lock meanwhile.
+ */
+/* ARGSUSED */
+static void
+spa_config_deferred_write(void *arg)
+{
+	spa_t *spa = NULL;
+	spa_config_dirent_t *dp;
+	nvlist_t *written = fnvlist_alloc();
+
+	mutex_enter(&spa_namespace_lock);
+	spa_config_writer_id = TASKQID_INVALID;
+
+	while ((spa = spa_next(spa)) != NULL) {
+		boolean_t postsysevent = spa->spa_ccw_deferred_event;
+
+		if (!spa->spa_ccw_deferred)
+			continue;
+
+		spa->spa_ccw_deferred = B_FALSE;
+		spa->spa_ccw_deferred_event = B_FALSE;
+
+		dp = list_head(&spa->spa_config_list);
+		if (dp != NULL && dp->scd_path != NULL &&
+		    list_next(&spa->spa_config_list, dp) == NULL &&
+		    nvlist_exists(written, dp->scd_path)) {
+			if (postsysevent) {
+				spa_event_notify(spa, NULL, NULL,
+				    ESC_ZFS_CONFIG_SYNC);
+			}
+			continue;
+		}
+
+		spa_write_cachefile(spa, B_FALSE, postsysevent);
+
+		dp = list_head(&spa->spa_config_list);
+		if (dp != NULL && dp->scd_path != NULL)
+			fnvlist_add_boolean(written, dp->scd_path);
+	}
+
+	mutex_exit(&spa_namespace_lock);
+	fnvlist_free(written);
+}
+
+/*
+ * Mark the pool's cachefile as needing an update and schedule the deferred
+ * writer if it is not pending already.
+ */
+static void
+spa_config_defer_write(spa_t *spa, boolean_t postsysevent)
+{
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	spa->spa_ccw_deferred = B_TRUE;
+	if (postsysevent)
+		spa->spa_ccw_deferred_event = B_TRUE;
+
+	if (spa_config_writer_id == TASKQID_INVALID) {
+		spa_config_writer_id = taskq_dispatch_delay(system_delay_taskq,
+		    spa_config_deferred_write, NULL, TQ_SLEEP,
+		    ddi_get_lbolt() + MSEC_TO_TICK(spa_config_write_delay_ms));
+	}
+}
+
+/*
+ * Called on module unload once all pools have been exported, which wrote
+ * their cachefiles synchronously, so a pending writer has nothing left to do.
+ */
+void
+spa_config_fini(void)
+{
+	taskqid_t id;
+
+	mutex_enter(&spa_namespace_lock);
+	id = spa_config_writer_id;
+	mutex_exit(&spa_namespace_lock);
+
+	if (id != TASKQID_INVALID)
+		(void) taskq_cancel_id(system_delay_taskq, id);
+}
+
 /*
  * Sigh.  Inside a local zone, we don't have access to /etc/zfs/zpool.cache,
  * and we don't want to allow the local zone to see all the pools anyway.
@@ -550,10 +646,11 @@ spa_config_generate(spa_t *spa, vdev_t *vd, uint64_t txg, int getstats)
 /*
  * Update all disk labels, generate a fresh config based on the current
  * in-core state, and sync the global config cache (do not sync the config
- * cache if this is a booting rootpool).
+ * cache if this is a booting rootpool).  When 'defer' is set the config
+ * cache is written by spa_config_deferred_write() shortly afterwards.
  */
-void
-spa_config_update(spa_t *spa, int what)
+static void
+spa_config_update_impl(spa_t *spa, int what, boolean_t defer)
 {
 	vdev_t *rvd = spa->spa_root_vdev;
 	uint64_t txg;
@@ -604,13 +701,32 @@ spa_config_update(spa_t *spa, int what)
 	/*
 	 * Update the global config cache to reflect the new mosconfig.
 	 */
-	if (!spa->spa_is_root) {
+	if (!spa->spa_is_root && defer) {
+		spa_config_defer_write(spa, what != SPA_CONFIG_UPDATE_POOL);
+	} else if (!spa->spa_is_root) {
 		spa_write_cachefile(spa, B_FALSE,
 		    what != SPA_CONFIG_UPDATE_POOL);
 	}
 
 	if (what == SPA_CONFIG_UPDATE_POOL)
-		spa_config_update(spa, SPA_CONFIG_UPDATE_VDEVS);
+		spa_config_update_impl(spa, SPA_CONFIG_UPDATE_VDEVS, defer);
+}
+
+void
+spa_config_update(spa_t *spa, int what)
+{
+	spa_config_update_impl(spa, what, B_FALSE);
+}
+
+/*
+ * As spa_config_update(), but coalesce the config cache write with those of
+ * other pools.  Used by the async config update, whose callers do not depend
+ * on the cachefile being current on return.
+ */
+void
+spa_config_update_deferred(spa_t *spa, int what)
+{
+	spa_config_update_impl(spa, what, B_TRUE);
 }
 
 #if defined(_KERNEL)
@@ -629,4 +745,7 @@ ZFS_MODULE_PARAM(zfs_spa, spa_, config_path, STRING, ZMOD_RD,
 ZFS_MODULE_PARAM(zfs, zfs_, autoimport_disable, UINT, ZMOD_RW,
 	"Disable pool import at module load");
 
+ZFS_MODULE_PARAM(zfs_spa, spa_, config_write_delay_ms, INT, ZMOD_RW,
+	"Delay in ms used to coalesce async config cache updates");
+
 #endif
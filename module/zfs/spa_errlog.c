@@ -46,6 +46,15 @@
  * This log is then shipped into an nvlist where the key is the dataset name and
  * the value is the object name.  Userland is then responsible for uniquifying
  * this list and displaying it to the user.
+ *
+ * Errors are staged in memory until the next txg syncs, and only the staged
+ * entries are written to the log then.  A failing disk can produce errors
+ * faster than that, so once more than zfs_errlog_pending_max errors are
+ * staged, further errors are recorded against their object alone (level and
+ * blkid zero), as that is all userland reports anyway.  The log can be read
+ * a page at a time with spa_get_errlog_page(), which only holds the log lock
+ * while it fills a single page, so that reading a large log does not hold up
+ * spa_errlog_sync().
  */
 
 #include <sys/dmu_tx.h>
@@ -54,6 +63,20 @@
 #include <sys/zap.h>
 #include <sys/zio.h>
 
+/*
+ * Number of staged errors above which errors are only recorded per object.
+ */
+int zfs_errlog_pending_max = 4096;
+
+/*
+ * Phases of spa_get_errlog_page(), kept in cookie[0].  The staged errors come
+ * first, so that any synced out to the logs between pages are seen again
+ * rather than missed.
+ */
+#define	ERRLOG_PAGE_PENDING	0	/* the staged errors */
+#define	ERRLOG_PAGE_SCRUB	1	/* the scrub log object */
+#define	ERRLOG_PAGE_LAST	2	/* the last log object */
+#define	ERRLOG_PAGE_DONE	3
 
 /*
  * Convert a bookmark to a string.
@@ -69,7 +92,6 @@ bookmark_to_name(zbookmark_phys_t *zb, char *buf, size_t len)
 /*
  * Convert a string to a bookmark
  */
-#ifdef _KERNEL
 static void
 name_to_bookmark(char *buf, zbookmark_phys_t *zb)
 {
@@ -82,7 +104,6 @@ name_to_bookmark(char *buf, zbookmark_phys_t *zb)
 	zb->zb_blkid = zfs_strtonum(buf + 1, &buf);
 	ASSERT(*buf == '\0');
 }
-#endif
 
 /*
  * Log an uncorrectable error to the persistent error log.  We add it to the
@@ -116,13 +137,17 @@ spa_log_error(spa_t *spa, const zbookmark_phys_t *zb)
 		tree = &spa->spa_errlist_last;
 
 	search.se_bookmark = *zb;
+	if (avl_numnodes(tree) >= zfs_errlog_pending_max) {
+		search.se_bookmark.zb_level = 0;
+		search.se_bookmark.zb_blkid = 0;
+	}
 	if (avl_find(tree, &search, &where) != NULL) {
 		mutex_exit(&spa->spa_errlist_lock);
 		return;
 	}
 
 	new = kmem_zalloc(sizeof (spa_error_entry_t), KM_SLEEP);
-	new->se_bookmark = *zb;
+	new->se_bookmark = search.se_bookmark;
 	avl_insert(tree, new, where);
 
 	mutex_exit(&spa->spa_errlist_lock);
@@ -257,6 +282,131 @@ spa_get_errlog(spa_t *spa, void *uaddr, size_t *count)
 	return (ret);
 }
 
+/*
+ * Copy up to count bookmarks from the on-disk log obj, resuming at the
+ * serialized zap cursor *pos.  Returns B_TRUE once the log is exhausted,
+ * otherwise saves the position of the next entry in *pos.
+ */
+static boolean_t
+page_error_log(spa_t *spa, uint64_t obj, uint64_t *pos,
+    zbookmark_phys_t *zb, uint64_t count, uint64_t *n)
+{
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	boolean_t done = B_TRUE;
+
+	if (obj == 0)
+		return (B_TRUE);
+
+	for (zap_cursor_init_serialized(&zc, spa->spa_meta_objset, obj, *pos);
+	    zap_cursor_retrieve(&zc, &za) == 0;
+	    zap_cursor_advance(&zc)) {
+		if (*n == count) {
+			*pos = zap_cursor_serialize(&zc);
+			done = B_FALSE;
+			break;
+		}
+		name_to_bookmark(za.za_name, &zb[(*n)++]);
+	}
+	zap_cursor_fini(&zc);
+
+	return (done);
+}
+
+/*
+ * As above for the staged errors, where *pos is the number of them already
+ * returned.  There are few enough of these to simply skip to the position.
+ */
+static boolean_t
+page_error_lists(spa_t *spa, uint64_t *pos, zbookmark_phys_t *zb,
+    uint64_t count, uint64_t *n)
+{
+	avl_tree_t *lists[] = { &spa->spa_errlist_scrub,
+	    &spa->spa_errlist_last };
+	spa_error_entry_t *se;
+	uint64_t skip = *pos;
+
+	mutex_enter(&spa->spa_errlist_lock);
+	for (int i = 0; i < ARRAY_SIZE(lists); i++) {
+		for (se = avl_first(lists[i]); se != NULL;
+		    se = AVL_NEXT(lists[i], se)) {
+			if (skip > 0) {
+				skip--;
+				continue;
+			}
+			if (*n == count) {
+				mutex_exit(&spa->spa_errlist_lock);
+				return (B_FALSE);
+			}
+			zb[(*n)++] = se->se_bookmark;
+			(*pos)++;
+		}
+	}
+	mutex_exit(&spa->spa_errlist_lock);
+
+	return (B_TRUE);
+}
+
+/*
+ * Copy up to *count errors into zb, resuming at cookie, which is all zeros to
+ * start with.  *count is set to the number copied, and *more to whether the
+ * cookie should be passed back in for the rest.
+ *
+ * The log lock is only held for this page, so the logs may be synced or
+ * rotated between calls.  The cookie records which log object it refers to,
+ * and starts over on that log if it has been replaced, so an error may be
+ * returned more than once but none is missed.  As with spa_get_errlog(), the
+ * caller is responsible for uniquifying the list.
+ */
+int
+spa_get_errlog_page(spa_t *spa, uint64_t cookie[3], zbookmark_phys_t *zb,
+    uint64_t *count, boolean_t *more)
+{
+	uint64_t n = 0;
+	boolean_t done;
+
+	if (cookie[0] >= ERRLOG_PAGE_DONE)
+		return (SET_ERROR(EINVAL));
+
+	mutex_enter(&spa->spa_errlog_lock);
+	while (n < *count && cookie[0] != ERRLOG_PAGE_DONE) {
+		uint64_t obj = 0;
+
+		switch (cookie[0]) {
+		case ERRLOG_PAGE_SCRUB:
+			obj = spa->spa_errlog_scrub;
+			break;
+		case ERRLOG_PAGE_LAST:
+			if (!spa->spa_scrub_finished)
+				obj = spa->spa_errlog_last;
+			break;
+		}
+
+		if (cookie[0] == ERRLOG_PAGE_PENDING) {
+			done = page_error_lists(spa, &cookie[2], zb, *count,
+			    &n);
+		} else {
+			if (cookie[1] != obj) {
+				cookie[1] = obj;
+				cookie[2] = 0;
+			}
+			done = page_error_log(spa, obj, &cookie[2], zb, *count,
+			    &n);
+		}
+
+		if (done) {
+			cookie[0]++;
+			cookie[1] = 0;
+			cookie[2] = 0;
+		}
+	}
+	mutex_exit(&spa->spa_errlog_lock);
+
+	*count = n;
+	*more = (cookie[0] != ERRLOG_PAGE_DONE);
+	return (0);
+}
+
 /*
  * Called when a scrub completes.  This simply set a bit which tells which AVL
  * tree to add new errors.  spa_errlog_sync() is responsible for actually
@@ -409,8 +559,12 @@ spa_errlog_sync(spa_t *spa, uint64_t txg)
 EXPORT_SYMBOL(spa_log_error);
 EXPORT_SYMBOL(spa_get_errlog_size);
 EXPORT_SYMBOL(spa_get_errlog);
+EXPORT_SYMBOL(spa_get_errlog_page);
 EXPORT_SYMBOL(spa_errlog_rotate);
 EXPORT_SYMBOL(spa_errlog_drain);
 EXPORT_SYMBOL(spa_errlog_sync);
 EXPORT_SYMBOL(spa_get_errlists);
+
+ZFS_MODULE_PARAM(zfs, zfs_, errlog_pending_max, INT, ZMOD_RW,
+	"Max staged errors before they are only recorded per object");
 #endif
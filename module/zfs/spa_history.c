@@ -70,8 +70,19 @@
  *
  * 'sh_records_lost' keeps track of how many records have been overwritten
  * and permanently lost.
+ *
+ * Records are not written to the log as they are logged, but collected in
+ * 'spa_history_pending' and appended together by spa_history_sync(), so that
+ * a txg which logs many records (e.g. destroying many snapshots) makes a
+ * single append and dirties the bonus buffer once.  If zfs_history_lazy_max
+ * is set, internal events are kept in 'spa_history_lazy' across txgs instead,
+ * and only written out ahead of the next command, once that many bytes of
+ * them have collected, or when the history is read or the pool exported.
+ * They are lost if the system crashes before then.
  */
 
+unsigned long zfs_history_lazy_max = 0;
+
 /* convert a logical offset to physical */
 static uint64_t
 spa_history_log_to_phys(uint64_t log_off, spa_history_phys_t *shpp)
@@ -180,6 +191,174 @@ spa_history_write(spa_t *spa, void *buf, uint64_t len, spa_history_phys_t *shpp,
 	return (0);
 }
 
+/*
+ * Write out the whole records in buf, in as few writes as possible without
+ * any one of them taking more than half of the ring.
+ */
+static int
+spa_history_write_records(spa_t *spa, char *buf, uint64_t len,
+    spa_history_phys_t *shpp, dmu_tx_t *tx)
+{
+	uint64_t max = (shpp->sh_phys_max_off - shpp->sh_pool_create_len) / 2;
+	int err = 0;
+
+	while (err == 0 && len > 0) {
+		uint64_t chunk = 0;
+
+		while (chunk < len) {
+			uint64_t le_len;
+
+			bcopy(buf + chunk, &le_len, sizeof (le_len));
+			if (chunk != 0 && chunk + sizeof (le_len) +
+			    LE_64(le_len) > max)
+				break;
+			chunk += sizeof (le_len) + LE_64(le_len);
+		}
+		ASSERT3U(chunk, <=, len);
+
+		err = spa_history_write(spa, buf, chunk, shpp, tx);
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return (err);
+}
+
+static void
+spa_history_buf_append(spa_history_buf_t *shb, const void *data, uint64_t len)
+{
+	if (shb->shb_len + len > shb->shb_size) {
+		uint64_t size = MAX(2 * shb->shb_size, shb->shb_len + len);
+		char *newdata = vmem_alloc(size, KM_SLEEP);
+
+		if (shb->shb_data != NULL) {
+			bcopy(shb->shb_data, newdata, shb->shb_len);
+			vmem_free(shb->shb_data, shb->shb_size);
+		}
+		shb->shb_data = newdata;
+		shb->shb_size = size;
+	}
+
+	bcopy(data, shb->shb_data + shb->shb_len, len);
+	shb->shb_len += len;
+}
+
+static void
+spa_history_buf_free(spa_history_buf_t *shb)
+{
+	if (shb->shb_data != NULL)
+		vmem_free(shb->shb_data, shb->shb_size);
+	bzero(shb, sizeof (spa_history_buf_t));
+}
+
+/*
+ * Move the lazily written records to the pending ones, ahead of any record
+ * logged after them.
+ */
+static void
+spa_history_move_lazy(spa_t *spa)
+{
+	ASSERT(MUTEX_HELD(&spa->spa_history_lock));
+
+	if (spa->spa_history_lazy.shb_len != 0) {
+		spa_history_buf_append(&spa->spa_history_pending,
+		    spa->spa_history_lazy.shb_data,
+		    spa->spa_history_lazy.shb_len);
+		spa_history_buf_free(&spa->spa_history_lazy);
+	}
+	spa->spa_history_lazy_flush = B_FALSE;
+}
+
+/*
+ * Append the records logged since the last call to the on-disk log.  Called
+ * from each pass of spa_sync(), after the sync tasks have run, so records
+ * are written in the txg that logged them.
+ */
+void
+spa_history_sync(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	spa_history_buf_t *shb = &spa->spa_history_pending;
+	spa_history_phys_t *shpp;
+	dmu_buf_t *dbp;
+	uint64_t create_end;
+	char *buf;
+	uint64_t len;
+
+	mutex_enter(&spa->spa_history_lock);
+	if (spa->spa_history_lazy_flush)
+		spa_history_move_lazy(spa);
+
+	if (shb->shb_len == 0) {
+		mutex_exit(&spa->spa_history_lock);
+		return;
+	}
+	ASSERT(spa->spa_history != 0);
+
+	/*
+	 * Get the offset of where we need to write via the bonus buffer.
+	 * Update the offset when the write completes.
+	 */
+	VERIFY0(dmu_bonus_hold(mos, spa->spa_history, FTAG, &dbp));
+	shpp = dbp->db_data;
+
+	dmu_buf_will_dirty(dbp, tx);
+
+#ifdef ZFS_DEBUG
+	{
+		dmu_object_info_t doi;
+		dmu_object_info_from_db(dbp, &doi);
+		ASSERT3U(doi.doi_bonus_type, ==, DMU_OT_SPA_HISTORY_OFFSETS);
+	}
+#endif
+
+	buf = shb->shb_data;
+	len = shb->shb_len;
+	create_end = spa->spa_history_create_end;
+
+	/* The first command is the create, which we keep forever */
+	if (create_end != 0 && shpp->sh_pool_create_len == 0) {
+		if (spa_history_write_records(spa, buf, create_end, shpp,
+		    tx) == 0)
+			shpp->sh_pool_create_len = shpp->sh_bof = shpp->sh_eof;
+		buf += create_end;
+		len -= create_end;
+	}
+	(void) spa_history_write_records(spa, buf, len, shpp, tx);
+
+	spa_history_buf_free(shb);
+	spa->spa_history_create_end = 0;
+
+	mutex_exit(&spa->spa_history_lock);
+	dmu_buf_rele(dbp, FTAG);
+}
+
+/*
+ * Have the next txg write out the lazily written records.
+ */
+void
+spa_history_flush_lazy(spa_t *spa)
+{
+	mutex_enter(&spa->spa_history_lock);
+	if (spa->spa_history_lazy.shb_len != 0)
+		spa->spa_history_lazy_flush = B_TRUE;
+	mutex_exit(&spa->spa_history_lock);
+}
+
+/*
+ * Discard any records not yet written, when the pool is unloaded.
+ */
+void
+spa_history_fini(spa_t *spa)
+{
+	mutex_enter(&spa->spa_history_lock);
+	spa_history_buf_free(&spa->spa_history_pending);
+	spa_history_buf_free(&spa->spa_history_lazy);
+	spa->spa_history_create_end = 0;
+	spa->spa_history_lazy_flush = B_FALSE;
+	mutex_exit(&spa->spa_history_lock);
+}
+
 static char *
 spa_history_zone(void)
 {
@@ -256,7 +435,7 @@ spa_history_log_notify(spa_t *spa, nvlist_t *nvl)
 }
 
 /*
- * Write out a history event.
+ * Queue a history event to be written out by spa_history_sync().
  */
 /*ARGSUSED*/
 static void
@@ -264,13 +443,10 @@ spa_history_log_sync(void *arg, dmu_tx_t *tx)
 {
 	nvlist_t	*nvl = arg;
 	spa_t		*spa = dmu_tx_pool(tx)->dp_spa;
-	objset_t	*mos = spa->spa_meta_objset;
-	dmu_buf_t	*dbp;
-	spa_history_phys_t *shpp;
+	spa_history_buf_t *shb;
 	size_t		reclen;
 	uint64_t	le_len;
 	char		*record_packed = NULL;
-	int		ret;
 
 	/*
 	 * If we have an older pool that doesn't have a command
@@ -281,23 +457,6 @@ spa_history_log_sync(void *arg, dmu_tx_t *tx)
 		spa_history_create_obj(spa, tx);
 	mutex_exit(&spa->spa_history_lock);
 
-	/*
-	 * Get the offset of where we need to write via the bonus buffer.
-	 * Update the offset when the write completes.
-	 */
-	VERIFY0(dmu_bonus_hold(mos, spa->spa_history, FTAG, &dbp));
-	shpp = dbp->db_data;
-
-	dmu_buf_will_dirty(dbp, tx);
-
-#ifdef ZFS_DEBUG
-	{
-		dmu_object_info_t doi;
-		dmu_object_info_from_db(dbp, &doi);
-		ASSERT3U(doi.doi_bonus_type, ==, DMU_OT_SPA_HISTORY_OFFSETS);
-	}
-#endif
-
 	fnvlist_add_uint64(nvl, ZPOOL_HIST_TIME, gethrestime_sec());
 	fnvlist_add_string(nvl, ZPOOL_HIST_HOST, utsname()->nodename);
 
@@ -344,21 +503,29 @@ spa_history_log_sync(void *arg, dmu_tx_t *tx)
 
 	mutex_enter(&spa->spa_history_lock);
 
+	if (zfs_history_lazy_max != 0 &&
+	    nvlist_exists(nvl, ZPOOL_HIST_INT_NAME)) {
+		shb = &spa->spa_history_lazy;
+	} else {
+		spa_history_move_lazy(spa);
+		shb = &spa->spa_history_pending;
+	}
+
 	/* write out the packed length as little endian */
 	le_len = LE_64((uint64_t)reclen);
-	ret = spa_history_write(spa, &le_len, sizeof (le_len), shpp, tx);
-	if (!ret)
-		ret = spa_history_write(spa, record_packed, reclen, shpp, tx);
+	spa_history_buf_append(shb, &le_len, sizeof (le_len));
+	spa_history_buf_append(shb, record_packed, reclen);
 
-	/* The first command is the create, which we keep forever */
-	if (ret == 0 && shpp->sh_pool_create_len == 0 &&
+	if (shb == &spa->spa_history_lazy) {
+		if (shb->shb_len >= zfs_history_lazy_max)
+			spa->spa_history_lazy_flush = B_TRUE;
+	} else if (spa->spa_history_create_end == 0 &&
 	    nvlist_exists(nvl, ZPOOL_HIST_CMD)) {
-		shpp->sh_pool_create_len = shpp->sh_bof = shpp->sh_eof;
+		spa->spa_history_create_end = shb->shb_len;
 	}
 
 	mutex_exit(&spa->spa_history_lock);
 	fnvlist_pack_free(record_packed, reclen);
-	dmu_buf_rele(dbp, FTAG);
 	fnvlist_free(nvl);
 }
 
@@ -439,10 +606,13 @@ spa_history_get(spa_t *spa, uint64_t *offp, uint64_t *len, char *buf)
 	/*
 	 * The history is logged asynchronously, so when they request
 	 * the first chunk of history, make sure everything has been
-	 * synced to disk so that we get it.
+	 * synced to disk so that we get it, including any lazily written
+	 * internal events.
 	 */
-	if (*offp == 0 && spa_writeable(spa))
+	if (*offp == 0 && spa_writeable(spa)) {
+		spa_history_flush_lazy(spa);
 		txg_wait_synced(spa_get_dsl(spa), 0);
+	}
 
 	if ((err = dmu_bonus_hold(mos, spa->spa_history, FTAG, &dbp)) != 0)
 		return (err);
@@ -629,4 +799,7 @@ EXPORT_SYMBOL(spa_history_get);
 EXPORT_SYMBOL(spa_history_log);
 EXPORT_SYMBOL(spa_history_log_internal);
 EXPORT_SYMBOL(spa_history_log_version);
+
+ZFS_MODULE_PARAM(zfs, zfs_, history_lazy_max, ULONG, ZMOD_RW,
+	"Bytes of internal history events to keep in memory before writing");
 #endif
@@ -1087,6 +1087,17 @@ spa_ld_log_sm_data(spa_t *spa)
 	ASSERT0(spa->spa_unflushed_stats.sus_memused);
 
 	hrtime_t read_logs_starttime = gethrtime();
+
+	/*
+	 * Issue the reads of the log space maps' dnodes up front, rather
+	 * than one at a time as each of them is opened below.
+	 */
+	for (spa_log_sm_t *sls = avl_first(&spa->spa_sm_logs_by_txg);
+	    sls; sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls)) {
+		dmu_prefetch(spa_meta_objset(spa), sls->sls_sm_obj, 0, 0, 0,
+		    ZIO_PRIORITY_SYNC_READ);
+	}
+
 	/* this is a no-op when we don't have space map logs */
 	for (spa_log_sm_t *sls = avl_first(&spa->spa_sm_logs_by_txg);
 	    sls; sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls)) {
@@ -1192,6 +1203,10 @@ spa_ld_unflushed_txgs(vdev_t *vd)
 		return (error);
 	}
 
+	dmu_prefetch(mos, object, 0, 0,
+	    vd->vdev_ms_count * sizeof (metaslab_unflushed_phys_t),
+	    ZIO_PRIORITY_SYNC_READ);
+
 	for (uint64_t m = 0; m < vd->vdev_ms_count; m++) {
 		metaslab_t *ms = vd->vdev_ms[m];
 		ASSERT(ms != NULL);
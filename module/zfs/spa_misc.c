@@ -40,12 +40,14 @@
 #include <sys/vdev_impl.h>
 #include <sys/vdev_initialize.h>
 #include <sys/vdev_trim.h>
+#include <sys/vdev_rebuild.h>
 #include <sys/vdev_file.h>
 #include <sys/vdev_raidz.h>
 #include <sys/metaslab.h>
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
 #include <sys/avl.h>
+#include <sys/btree.h>
 #include <sys/unique.h>
 #include <sys/dsl_pool.h>
 #include <sys/dsl_dir.h>
@@ -85,7 +87,7 @@
  *	definition they must have an existing reference, and will never need
  *	to lookup a spa_t by name.
  *
- * spa_refcount (per-spa zfs_refcount_t protected by mutex)
+ * spa_refcount (per-spa zfs_refcount_pcpu_t)
  *
  *	This reference count keep track of any active users of the spa_t.  The
  *	spa_t cannot be destroyed or freed while this is non-zero.  Internally,
@@ -424,6 +426,20 @@ int zfs_user_indirect_is_special = B_TRUE;
  */
 int zfs_special_class_metadata_reserve_pct = 25;
 
+/*
+ * When the normal class cannot satisfy an allocation, try the special
+ * class (within its metadata reserve) before resorting to a gang block.
+ */
+int zfs_special_class_gang_fallback = B_TRUE;
+
+/*
+ * On raidz a data block of only a few sectors still pays for a full set of
+ * parity sectors, plus padding, so when the normal class has raidz vdevs
+ * data blocks up to this size go to the special class like those under a
+ * dataset's special_small_blocks.  Zero disables this.
+ */
+unsigned long zfs_special_class_raidz_small_blocks = 0;
+
 /*
  * ==========================================================================
  * SPA config locking
@@ -486,6 +502,21 @@ spa_config_tryenter(spa_t *spa, int locks, void *tag, krw_t rw)
 	return (1);
 }
 
+/*
+ * Lock contention accounting classes of the spa_config_lock, one per lock.
+ */
+#define	SCL_LOCKSTAT(name)	\
+	SPL_LOCKSTAT_CLASS_INIT(name, "spa_config_enter")
+static spl_lockstat_class_t spa_config_lockstat[SCL_LOCKS] = {
+	SCL_LOCKSTAT("spa_config_lock SCL_CONFIG"),
+	SCL_LOCKSTAT("spa_config_lock SCL_STATE"),
+	SCL_LOCKSTAT("spa_config_lock SCL_L2ARC"),
+	SCL_LOCKSTAT("spa_config_lock SCL_ALLOC"),
+	SCL_LOCKSTAT("spa_config_lock SCL_ZIO"),
+	SCL_LOCKSTAT("spa_config_lock SCL_FREE"),
+	SCL_LOCKSTAT("spa_config_lock SCL_VDEV"),
+};
+
 void
 spa_config_enter(spa_t *spa, int locks, void *tag, krw_t rw)
 {
@@ -499,22 +530,29 @@ spa_config_enter(spa_t *spa, int locks, void *tag, krw_t rw)
 			wlocks_held |= (1 << i);
 		if (!(locks & (1 << i)))
 			continue;
+		hrtime_t start = 0;
 		mutex_enter(&scl->scl_lock);
 		if (rw == RW_READER) {
 			while (scl->scl_writer || scl->scl_write_wanted) {
+				if (start == 0)
+					start = spl_lockstat_start();
 				cv_wait(&scl->scl_cv, &scl->scl_lock);
 			}
 		} else {
 			ASSERT(scl->scl_writer != curthread);
 			while (!zfs_refcount_is_zero(&scl->scl_count)) {
+				if (start == 0)
+					start = spl_lockstat_start();
 				scl->scl_write_wanted++;
 				cv_wait(&scl->scl_cv, &scl->scl_lock);
 				scl->scl_write_wanted--;
 			}
 			scl->scl_writer = curthread;
+			scl->scl_write_start = spl_lockstat_start();
 		}
 		(void) zfs_refcount_add(&scl->scl_count, tag);
 		mutex_exit(&scl->scl_lock);
+		spl_lockstat_acquired(&spa_config_lockstat[i], start);
 	}
 	ASSERT3U(wlocks_held, <=, locks);
 }
@@ -531,6 +569,11 @@ spa_config_exit(spa_t *spa, int locks, void *tag)
 		if (zfs_refcount_remove(&scl->scl_count, tag) == 0) {
 			ASSERT(scl->scl_writer == NULL ||
 			    scl->scl_writer == curthread);
+			if (scl->scl_writer != NULL) {
+				spl_lockstat_released(&spa_config_lockstat[i],
+				    scl->scl_write_start);
+				scl->scl_write_start = 0;
+			}
 			scl->scl_writer = NULL;	/* OK in either case */
 			cv_broadcast(&scl->scl_cv);
 		}
@@ -653,6 +696,7 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	mutex_init(&spa->spa_vdev_top_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_feat_stats_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_flushed_ms_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_vdev_sync_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	cv_init(&spa->spa_async_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_evicting_os_cv, NULL, CV_DEFAULT, NULL);
@@ -676,7 +720,7 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	spa->spa_deadman_ziotime = MSEC2NSEC(zfs_deadman_ziotime_ms);
 	spa_set_deadman_failmode(spa, zfs_deadman_failmode);
 
-	zfs_refcount_create(&spa->spa_refcount);
+	zfs_refcount_pcpu_create(&spa->spa_refcount);
 	spa_config_lock_init(spa);
 	spa_stats_init(spa);
 
@@ -770,7 +814,7 @@ spa_remove(spa_t *spa)
 
 	ASSERT(MUTEX_HELD(&spa_namespace_lock));
 	ASSERT(spa_state(spa) == POOL_STATE_UNINITIALIZED);
-	ASSERT3U(zfs_refcount_count(&spa->spa_refcount), ==, 0);
+	ASSERT3U(zfs_refcount_pcpu_count(&spa->spa_refcount), ==, 0);
 
 	nvlist_free(spa->spa_config_splitting);
 
@@ -808,7 +852,7 @@ spa_remove(spa_t *spa)
 	nvlist_free(spa->spa_feat_stats);
 	spa_config_set(spa, NULL);
 
-	zfs_refcount_destroy(&spa->spa_refcount);
+	zfs_refcount_pcpu_destroy(&spa->spa_refcount);
 
 	spa_stats_destroy(spa);
 	spa_config_lock_destroy(spa);
@@ -825,6 +869,7 @@ spa_remove(spa_t *spa)
 	cv_destroy(&spa->spa_suspend_cv);
 
 	mutex_destroy(&spa->spa_flushed_ms_lock);
+	mutex_destroy(&spa->spa_vdev_sync_lock);
 	mutex_destroy(&spa->spa_async_lock);
 	mutex_destroy(&spa->spa_errlist_lock);
 	mutex_destroy(&spa->spa_errlog_lock);
@@ -869,9 +914,9 @@ spa_next(spa_t *prev)
 void
 spa_open_ref(spa_t *spa, void *tag)
 {
-	ASSERT(zfs_refcount_count(&spa->spa_refcount) >= spa->spa_minref ||
+	ASSERT(zfs_refcount_pcpu_count(&spa->spa_refcount) >= spa->spa_minref ||
 	    MUTEX_HELD(&spa_namespace_lock));
-	(void) zfs_refcount_add(&spa->spa_refcount, tag);
+	zfs_refcount_pcpu_add(&spa->spa_refcount, tag);
 }
 
 /*
@@ -881,9 +926,9 @@ spa_open_ref(spa_t *spa, void *tag)
 void
 spa_close(spa_t *spa, void *tag)
 {
-	ASSERT(zfs_refcount_count(&spa->spa_refcount) > spa->spa_minref ||
+	ASSERT(zfs_refcount_pcpu_count(&spa->spa_refcount) > spa->spa_minref ||
 	    MUTEX_HELD(&spa_namespace_lock));
-	(void) zfs_refcount_remove(&spa->spa_refcount, tag);
+	zfs_refcount_pcpu_remove(&spa->spa_refcount, tag);
 }
 
 /*
@@ -897,7 +942,7 @@ spa_close(spa_t *spa, void *tag)
 void
 spa_async_close(spa_t *spa, void *tag)
 {
-	(void) zfs_refcount_remove(&spa->spa_refcount, tag);
+	zfs_refcount_pcpu_remove(&spa->spa_refcount, tag);
 }
 
 /*
@@ -910,7 +955,7 @@ spa_refcount_zero(spa_t *spa)
 {
 	ASSERT(MUTEX_HELD(&spa_namespace_lock));
 
-	return (zfs_refcount_count(&spa->spa_refcount) == spa->spa_minref);
+	return (zfs_refcount_pcpu_count(&spa->spa_refcount) == spa->spa_minref);
 }
 
 /*
@@ -1157,6 +1202,8 @@ spa_vdev_enter(spa_t *spa)
 	mutex_enter(&spa_namespace_lock);
 
 	vdev_autotrim_stop_all(spa);
+	vdev_rebuild_stop_all(spa);
+	vdev_raidz_expand_stop_all(spa);
 
 	return (spa_vdev_config_enter(spa));
 }
@@ -1194,7 +1241,7 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 	/*
 	 * Reassess the DTLs.
 	 */
-	vdev_dtl_reassess(spa->spa_root_vdev, 0, 0, B_FALSE);
+	vdev_dtl_reassess(spa->spa_root_vdev, 0, 0, B_FALSE, B_FALSE);
 
 	if (error == 0 && !list_is_empty(&spa->spa_config_dirty_list)) {
 		config_changed = B_TRUE;
@@ -1244,6 +1291,7 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 		 * The vdev may be both a leaf and top-level device.
 		 */
 		vdev_autotrim_stop_wait(vd);
+		vdev_rebuild_stop_wait(vd);
 
 		spa_config_enter(spa, SCL_ALL, spa, RW_WRITER);
 		vdev_free(vd);
@@ -1267,6 +1315,8 @@ int
 spa_vdev_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error)
 {
 	vdev_autotrim_restart(spa);
+	vdev_rebuild_restart(spa);
+	vdev_raidz_expand_restart(spa);
 
 	spa_vdev_config_exit(spa, vd, txg, error, FTAG);
 	mutex_exit(&spa_namespace_lock);
@@ -1318,7 +1368,7 @@ spa_vdev_state_exit(spa_t *spa, vdev_t *vd, int error)
 	}
 
 	if (vd != NULL || error == 0)
-		vdev_dtl_reassess(vdev_top, 0, 0, B_FALSE);
+		vdev_dtl_reassess(vdev_top, 0, 0, B_FALSE, B_FALSE);
 
 	if (vd != NULL) {
 		if (vd != spa->spa_root_vdev)
@@ -1890,12 +1940,18 @@ spa_preferred_class(spa_t *spa, uint64_t size, dmu_object_type_t objtype,
 			return (spa_normal_class(spa));
 	}
 
+	if ((DMU_OT_IS_FILE(objtype) || objtype == DMU_OT_ZVOL) &&
+	    spa_normal_class(spa)->mc_raidz_groups != 0) {
+		special_smallblk = MAX(special_smallblk,
+		    zfs_special_class_raidz_small_blocks);
+	}
+
 	/*
 	 * Allow small file blocks in special class in some cases (like
 	 * for the dRAID vdev feature). But always leave a reserve of
 	 * zfs_special_class_metadata_reserve_pct exclusively for metadata.
 	 */
-	if (DMU_OT_IS_FILE(objtype) &&
+	if ((DMU_OT_IS_FILE(objtype) || objtype == DMU_OT_ZVOL) &&
 	    has_special_class && size <= special_smallblk) {
 		metaslab_class_t *special = spa_special_class(spa);
 		uint64_t alloc = metaslab_class_get_alloc(special);
@@ -1911,6 +1967,51 @@ spa_preferred_class(spa_t *spa, uint64_t size, dmu_object_type_t objtype,
 	return (spa_normal_class(spa));
 }
 
+/*
+ * Returns the class to retry an allocation of the given size in when mc
+ * is out of contiguous space, or NULL if the block should be ganged.
+ * Gang blocks cost extra I/Os on every read for the life of the block,
+ * so a block that fits in the special class without eating into its
+ * metadata reserve is better placed there.
+ */
+metaslab_class_t *
+spa_gang_fallback_class(spa_t *spa, metaslab_class_t *mc, uint64_t size)
+{
+	metaslab_class_t *special = spa_special_class(spa);
+
+	if (!zfs_special_class_gang_fallback || mc == special ||
+	    mc != spa_normal_class(spa) || special->mc_groups == 0)
+		return (NULL);
+
+	uint64_t alloc = metaslab_class_get_alloc(special);
+	uint64_t space = metaslab_class_get_space(special);
+	uint64_t limit =
+	    (space * (100 - zfs_special_class_metadata_reserve_pct)) / 100;
+
+	if (alloc + size > limit)
+		return (NULL);
+
+	return (special);
+}
+
+/*
+ * Returns the allocation class of the vdev holding the first copy of a
+ * block, or NULL if that vdev no longer has one.
+ */
+metaslab_class_t *
+spa_bp_class(spa_t *spa, const blkptr_t *bp)
+{
+	metaslab_class_t *mc = NULL;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	vdev_t *vd = vdev_lookup_top(spa, DVA_GET_VDEV(&bp->blk_dva[0]));
+	if (vd != NULL && vd->vdev_mg != NULL)
+		mc = vd->vdev_mg->mg_class;
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	return (mc);
+}
+
 void
 spa_evicting_os_register(spa_t *spa, objset_t *os)
 {
@@ -2358,21 +2459,23 @@ spa_init(int mode)
 	fm_init();
 	zfs_refcount_init();
 	unique_init();
-	range_tree_init();
+	zfs_btree_init();
 	metaslab_alloc_trace_init();
+	metaslab_stat_init();
 	ddt_init();
 	zio_init();
+	zio_bench_init();
 	dmu_init();
 	zil_init();
 	vdev_cache_stat_init();
 	vdev_mirror_stat_init();
+	vdev_queue_stat_init();
 	vdev_raidz_math_init();
 	vdev_file_init();
 	zfs_prop_init();
 	zpool_prop_init();
 	zpool_feature_init();
 	spa_config_load();
-	l2arc_start();
 	scan_init();
 #if defined(__linux__) || !defined(_KERNEL)
 	qat_init();
@@ -2383,20 +2486,22 @@ spa_init(int mode)
 void
 spa_fini(void)
 {
-	l2arc_stop();
-
 	spa_evict_all();
+	spa_config_fini();
 
 	vdev_file_fini();
 	vdev_cache_stat_fini();
 	vdev_mirror_stat_fini();
+	vdev_queue_stat_fini();
 	vdev_raidz_math_fini();
 	zil_fini();
 	dmu_fini();
+	zio_bench_fini();
 	zio_fini();
 	ddt_fini();
+	metaslab_stat_fini();
 	metaslab_alloc_trace_fini();
-	range_tree_fini();
+	zfs_btree_fini();
 	unique_fini();
 	zfs_refcount_fini();
 	fm_fini();
@@ -2540,6 +2645,7 @@ spa_scan_get_stats(spa_t *spa, pool_scan_stat_t *ps)
 	ps->pss_pass_issued = spa->spa_scan_pass_issued;
 	ps->pss_issued =
 	    scn->scn_issued_before_pass + spa->spa_scan_pass_issued;
+	ps->pss_prio_issued = scn->scn_prio_issued;
 
 	return (0);
 }
@@ -2985,5 +3091,11 @@ MODULE_PARM_DESC(zfs_deadman_failmode, "Failmode for deadman timer");
 ZFS_MODULE_PARAM(zfs, zfs_, special_class_metadata_reserve_pct, UINT, ZMOD_RW,				 
 	"Small file blocks in special vdevs depends on this much "
 	"free space available");
+
+ZFS_MODULE_PARAM(zfs, zfs_, special_class_gang_fallback, INT, ZMOD_RW,
+	"Try the special class before ganging a block");
+
+ZFS_MODULE_PARAM(zfs, zfs_, special_class_raidz_small_blocks, ULONG, ZMOD_RW,
+	"Place data blocks up to this size in the special class on raidz pools");
 /* END CSTYLED */
 #endif
@@ -114,6 +114,7 @@ static void txg_sync_thread(void *arg);
 static void txg_quiesce_thread(void *arg);
 
 int zfs_txg_timeout = 5;	/* max seconds worth of delta per txg */
+int zfs_txg_callback_batch = 1024;	/* min commit callbacks per task */
 
 /*
  * Prepare the txg subsystem.
@@ -319,9 +320,7 @@ txg_hold_open(dsl_pool_t *dp, txg_handle_t *th)
 	mutex_enter(&tc->tc_open_lock);
 	txg = tx->tx_open_txg;
 
-	mutex_enter(&tc->tc_lock);
-	tc->tc_count[txg & TXG_MASK]++;
-	mutex_exit(&tc->tc_lock);
+	atomic_inc_64(&tc->tc_count[txg & TXG_MASK]);
 
 	th->th_cpu = tc;
 	th->th_txg = txg;
@@ -355,11 +354,18 @@ txg_rele_to_sync(txg_handle_t *th)
 	tx_cpu_t *tc = th->th_cpu;
 	int g = th->th_txg & TXG_MASK;
 
-	mutex_enter(&tc->tc_lock);
-	ASSERT(tc->tc_count[g] != 0);
-	if (--tc->tc_count[g] == 0)
+	uint64_t count = atomic_dec_64_nv(&tc->tc_count[g]);
+
+	ASSERT3U(count, !=, UINT64_MAX);
+	if (count == 0) {
+		/*
+		 * The quiesce thread checks tc_count with tc_lock held, so
+		 * taking it here ensures the wakeup isn't lost.
+		 */
+		mutex_enter(&tc->tc_lock);
 		cv_broadcast(&tc->tc_cv[g]);
-	mutex_exit(&tc->tc_lock);
+		mutex_exit(&tc->tc_lock);
+	}
 
 	th->th_cpu = NULL;	/* defensive */
 }
@@ -403,9 +409,13 @@ txg_quiesce(dsl_pool_t *dp, uint64_t txg)
 
 	/*
 	 * Quiesce the transaction group by waiting for everyone to txg_exit().
+	 * No new holds can be taken on this txg, so a tx_cpu whose count has
+	 * already dropped to zero needs no locking.
 	 */
 	for (c = 0; c < max_ncpus; c++) {
 		tx_cpu_t *tc = &tx->tx_cpu[c];
+		if (tc->tc_count[g] == 0)
+			continue;
 		mutex_enter(&tc->tc_lock);
 		while (tc->tc_count[g] != 0)
 			cv_wait(&tc->tc_cv[g], &tc->tc_lock);
@@ -428,6 +438,11 @@ txg_do_callbacks(list_t *cb_list)
 /*
  * Dispatch the commit callbacks registered on this txg to worker threads.
  *
+ * The callbacks of all CPUs are gathered into batches of at least
+ * zfs_txg_callback_batch callbacks each, so that a txg with many waiters
+ * registered on it is handled by a few tasks, rather than by one task
+ * per CPU which happened to have a callback registered.
+ *
  * If no callbacks are registered for a given TXG, nothing happens.
  * This function creates a taskq for the associated pool, if needed.
  */
@@ -436,7 +451,9 @@ txg_dispatch_callbacks(dsl_pool_t *dp, uint64_t txg)
 {
 	int c;
 	tx_state_t *tx = &dp->dp_tx;
-	list_t *cb_list;
+	list_t *cb_list = NULL;
+	int cb_count = 0;
+	int g = txg & TXG_MASK;
 
 	for (c = 0; c < max_ncpus; c++) {
 		tx_cpu_t *tc = &tx->tx_cpu[c];
@@ -445,8 +462,6 @@ txg_dispatch_callbacks(dsl_pool_t *dp, uint64_t txg)
 		 * only be called once a txg has been synced.
 		 */
 
-		int g = txg & TXG_MASK;
-
 		if (list_is_empty(&tc->tc_callbacks[g]))
 			continue;
 
@@ -459,14 +474,31 @@ txg_dispatch_callbacks(dsl_pool_t *dp, uint64_t txg)
 			    TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
 		}
 
-		cb_list = kmem_alloc(sizeof (list_t), KM_SLEEP);
-		list_create(cb_list, sizeof (dmu_tx_callback_t),
-		    offsetof(dmu_tx_callback_t, dcb_node));
+		if (cb_list == NULL) {
+			cb_list = kmem_alloc(sizeof (list_t), KM_SLEEP);
+			list_create(cb_list, sizeof (dmu_tx_callback_t),
+			    offsetof(dmu_tx_callback_t, dcb_node));
+		}
+
+		/* The count is only used to size the batches. */
+		for (dmu_tx_callback_t *dcb = list_head(&tc->tc_callbacks[g]);
+		    dcb != NULL && cb_count < zfs_txg_callback_batch;
+		    dcb = list_next(&tc->tc_callbacks[g], dcb))
+			cb_count++;
 
 		list_move_tail(cb_list, &tc->tc_callbacks[g]);
 
-		(void) taskq_dispatch(tx->tx_commit_cb_taskq, (task_func_t *)
-		    txg_do_callbacks, cb_list, TQ_SLEEP);
+		if (cb_count >= zfs_txg_callback_batch) {
+			(void) taskq_dispatch(tx->tx_commit_cb_taskq,
+			    (task_func_t *)txg_do_callbacks, cb_list, TQ_SLEEP);
+			cb_list = NULL;
+			cb_count = 0;
+		}
+	}
+
+	if (cb_list != NULL) {
+		(void) taskq_dispatch(tx->tx_commit_cb_taskq,
+		    (task_func_t *)txg_do_callbacks, cb_list, TQ_SLEEP);
 	}
 }
 
@@ -526,7 +558,7 @@ txg_sync_thread(void *arg)
 		clock_t timer;
 		uint64_t txg;
 		uint64_t dirty_min_bytes =
-		    zfs_dirty_data_max * zfs_dirty_data_sync_percent / 100;
+		    dsl_pool_dirty_max(dp) * zfs_dirty_data_sync_percent / 100;
 
 		/*
 		 * We sync when we're scanning, there's someone waiting
@@ -577,9 +609,12 @@ txg_sync_thread(void *arg)
 		mutex_exit(&tx->tx_sync_lock);
 
 		txg_stat_t *ts = spa_txg_history_init_io(spa, txg, dp);
+		uint64_t dirty = dp->dp_dirty_pertxg[txg & TXG_MASK];
+		hrtime_t sync_start = gethrtime();
 		start = ddi_get_lbolt();
 		spa_sync(spa, txg);
 		delta = ddi_get_lbolt() - start;
+		dsl_pool_sync_done_rate(dp, dirty, gethrtime() - sync_start);
 		spa_txg_history_fini_io(spa, ts);
 
 		mutex_enter(&tx->tx_sync_lock);
@@ -1058,4 +1093,7 @@ EXPORT_SYMBOL(txg_sync_waiting);
 
 ZFS_MODULE_PARAM(zfs, zfs_, txg_timeout, UINT, ZMOD_RW,
 	"Max seconds worth of delta per txg");
+
+ZFS_MODULE_PARAM(zfs, zfs_, txg_callback_batch, INT, ZMOD_RW,
+	"Min commit callbacks run by each commit callback task");
 #endif
@@ -38,6 +38,8 @@
 #include <sys/dmu_tx.h>
 #include <sys/dsl_dir.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_raidz.h>
 #include <sys/uberblock_impl.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
@@ -193,6 +195,8 @@ vdev_dbgmsg_print_tree(vdev_t *vd, int indent)
 static vdev_ops_t *vdev_ops_table[] = {
 	&vdev_root_ops,
 	&vdev_raidz_ops,
+	&vdev_draid_ops,
+	&vdev_draid_spare_ops,
 	&vdev_mirror_ops,
 	&vdev_replacing_ops,
 	&vdev_spare_ops,
@@ -251,13 +255,13 @@ vdev_derive_alloc_bias(const char *bias)
  * all children.  This is what's used by anything other than RAID-Z.
  */
 uint64_t
-vdev_default_asize(vdev_t *vd, uint64_t psize)
+vdev_default_asize(vdev_t *vd, uint64_t psize, uint64_t txg)
 {
 	uint64_t asize = P2ROUNDUP(psize, 1ULL << vd->vdev_top->vdev_ashift);
 	uint64_t csize;
 
 	for (int c = 0; c < vd->vdev_children; c++) {
-		csize = vdev_psize_to_asize(vd->vdev_child[c], psize);
+		csize = vdev_psize_to_asize_txg(vd->vdev_child[c], psize, txg);
 		asize = MAX(asize, csize);
 	}
 
@@ -291,11 +295,21 @@ vdev_get_min_asize(vdev_t *vd)
 
 	/*
 	 * The allocatable space for a raidz vdev is N * sizeof(smallest child),
-	 * so each child must provide at least 1/Nth of its asize.
+	 * so each child must provide at least 1/Nth of its asize.  While the
+	 * vdev is being expanded its space is that of the old width.
 	 */
-	if (pvd->vdev_ops == &vdev_raidz_ops)
-		return ((pvd->vdev_min_asize + pvd->vdev_children - 1) /
-		    pvd->vdev_children);
+	if (pvd->vdev_ops == &vdev_raidz_ops) {
+		uint64_t width = vdev_raidz_asize_width(pvd);
+
+		return ((pvd->vdev_min_asize + width - 1) / width);
+	}
+
+	/*
+	 * A dRAID child must hold its share of every slice which backs the
+	 * vdev's allocatable space.
+	 */
+	if (pvd->vdev_ops == &vdev_draid_ops)
+		return (vdev_draid_min_asize(pvd));
 
 	return (pvd->vdev_min_asize);
 }
@@ -553,6 +567,11 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	mutex_init(&vd->vdev_dtl_lock, NULL, MUTEX_NOLOCKDEP, NULL);
 	mutex_init(&vd->vdev_stat_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_probe_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_flush_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&vd->vdev_flush_riders, sizeof (zio_t),
+	    offsetof(zio_t, io_queue_node));
+	list_create(&vd->vdev_flush_queue, sizeof (zio_t),
+	    offsetof(zio_t, io_queue_node));
 	mutex_init(&vd->vdev_scan_io_queue_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_initialize_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_initialize_io_lock, NULL, MUTEX_DEFAULT, NULL);
@@ -564,6 +583,11 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	cv_init(&vd->vdev_trim_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&vd->vdev_autotrim_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&vd->vdev_trim_io_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&vd->vdev_rebuild_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_rebuild_config.vr_io_lock, NULL,
+	    MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_rebuild_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&vd->vdev_rebuild_config.vr_io_cv, NULL, CV_DEFAULT, NULL);
 
 	for (int t = 0; t < DTL_TYPES; t++) {
 		vd->vdev_dtl[t] = range_tree_create(NULL, NULL);
@@ -594,6 +618,7 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vdev_t *vd;
 	vdev_indirect_config_t *vic;
 	char *tmp = NULL;
+	void *tsd = NULL;
 	int rc;
 	vdev_alloc_bias_t alloc_bias = VDEV_BIAS_NONE;
 	boolean_t top_level = (parent && !parent->vdev_parent);
@@ -678,6 +703,23 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 			 */
 			nparity = 1;
 		}
+	} else if (ops == &vdev_draid_ops) {
+		/*
+		 * dRAID vdevs must be top-level and always specify their
+		 * parity.
+		 */
+		if (!top_level ||
+		    nvlist_lookup_uint64(nv, ZPOOL_CONFIG_NPARITY,
+		    &nparity) != 0 ||
+		    nparity == 0 || nparity > VDEV_DRAID_MAXPARITY)
+			return (SET_ERROR(EINVAL));
+		if (spa_version(spa) < SPA_VERSION_FEATURES)
+			return (SET_ERROR(ENOTSUP));
+		/* spa_create() enables the feature itself */
+		if (alloctype == VDEV_ALLOC_ADD &&
+		    spa->spa_load_state != SPA_LOAD_CREATE &&
+		    !spa_feature_is_enabled(spa, SPA_FEATURE_DRAID))
+			return (SET_ERROR(ENOTSUP));
 	} else {
 		nparity = 0;
 	}
@@ -702,11 +744,30 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		}
 	}
 
+	/*
+	 * dRAID vdevs and distributed spares carry their layout in
+	 * type-specific data, as do raidz vdevs their expansion history.
+	 */
+	if (ops == &vdev_draid_ops) {
+		rc = vdev_draid_config_create(nv, nparity, alloctype, &tsd);
+		if (rc != 0)
+			return (rc);
+	} else if (ops == &vdev_draid_spare_ops) {
+		rc = vdev_draid_spare_config_create(nv, &tsd);
+		if (rc != 0)
+			return (rc);
+	} else if (ops == &vdev_raidz_ops) {
+		rc = vdev_raidz_config_create(nv, &tsd);
+		if (rc != 0)
+			return (rc);
+	}
+
 	vd = vdev_alloc_common(spa, id, guid, ops);
 	vic = &vd->vdev_indirect_config;
 
 	vd->vdev_islog = islog;
 	vd->vdev_nparity = nparity;
+	vd->vdev_tsd = tsd;
 	if (top_level && alloc_bias != VDEV_BIAS_NONE)
 		vd->vdev_alloc_bias = alloc_bias;
 
@@ -837,6 +898,9 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_RESILVER_TXG,
 		    &vd->vdev_resilver_txg);
 
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_REBUILD_TXG,
+		    &vd->vdev_rebuild_txg);
+
 		if (nvlist_exists(nv, ZPOOL_CONFIG_RESILVER_DEFER))
 			vdev_set_deferred_resilver(spa, vd);
 
@@ -892,6 +956,7 @@ vdev_free(vdev_t *vd)
 	ASSERT3P(vd->vdev_initialize_thread, ==, NULL);
 	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
 	ASSERT3P(vd->vdev_autotrim_thread, ==, NULL);
+	ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
 
 	/*
 	 * Scan queues are normally destroyed at the end of a scan. If the
@@ -923,6 +988,12 @@ vdev_free(vdev_t *vd)
 	ASSERT(vd->vdev_child == NULL);
 	ASSERT(vd->vdev_guid_sum == vd->vdev_guid);
 
+	if (vd->vdev_ops == &vdev_draid_ops ||
+	    vd->vdev_ops == &vdev_draid_spare_ops)
+		vdev_draid_config_free(vd);
+	else if (vd->vdev_ops == &vdev_raidz_ops)
+		vdev_raidz_config_free(vd);
+
 	/*
 	 * Discard allocation state.
 	 */
@@ -999,6 +1070,10 @@ vdev_free(vdev_t *vd)
 	mutex_destroy(&vd->vdev_dtl_lock);
 	mutex_destroy(&vd->vdev_stat_lock);
 	mutex_destroy(&vd->vdev_probe_lock);
+	ASSERT3P(vd->vdev_flush_zio, ==, NULL);
+	list_destroy(&vd->vdev_flush_riders);
+	list_destroy(&vd->vdev_flush_queue);
+	mutex_destroy(&vd->vdev_flush_lock);
 	mutex_destroy(&vd->vdev_scan_io_queue_lock);
 	mutex_destroy(&vd->vdev_initialize_lock);
 	mutex_destroy(&vd->vdev_initialize_io_lock);
@@ -1010,6 +1085,10 @@ vdev_free(vdev_t *vd)
 	cv_destroy(&vd->vdev_trim_cv);
 	cv_destroy(&vd->vdev_autotrim_cv);
 	cv_destroy(&vd->vdev_trim_io_cv);
+	mutex_destroy(&vd->vdev_rebuild_lock);
+	mutex_destroy(&vd->vdev_rebuild_config.vr_io_lock);
+	cv_destroy(&vd->vdev_rebuild_cv);
+	cv_destroy(&vd->vdev_rebuild_config.vr_io_cv);
 
 	zfs_ratelimit_fini(&vd->vdev_delay_rl);
 	zfs_ratelimit_fini(&vd->vdev_checksum_rl);
@@ -1044,6 +1123,18 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 	svd->vdev_ms_count = 0;
 	svd->vdev_top_zap = 0;
 
+	/*
+	 * The rebuild state is stored in the top-level ZAP and must follow
+	 * it.  Any rebuild thread was stopped by spa_vdev_enter().
+	 */
+	ASSERT3P(svd->vdev_rebuild_thread, ==, NULL);
+	tvd->vdev_rebuild_config.vr_rebuild_phys =
+	    svd->vdev_rebuild_config.vr_rebuild_phys;
+	tvd->vdev_rebuild_reset_wanted = svd->vdev_rebuild_reset_wanted;
+	bzero(&svd->vdev_rebuild_config.vr_rebuild_phys,
+	    sizeof (vdev_rebuild_phys_t));
+	svd->vdev_rebuild_reset_wanted = B_FALSE;
+
 	if (tvd->vdev_mg)
 		ASSERT3P(tvd->vdev_mg, ==, svd->vdev_mg);
 	tvd->vdev_mg = svd->vdev_mg;
@@ -1669,6 +1760,7 @@ vdev_open(vdev_t *vd)
 	vd->vdev_stat.vs_aux = VDEV_AUX_NONE;
 	vd->vdev_cant_read = B_FALSE;
 	vd->vdev_cant_write = B_FALSE;
+	vd->vdev_label_txg = 0;
 	vd->vdev_min_asize = vdev_get_min_asize(vd);
 
 	/*
@@ -1935,6 +2027,12 @@ vdev_validate(vdev_t *vd)
 	if (!vd->vdev_ops->vdev_op_leaf || !vdev_readable(vd))
 		return (0);
 
+	/*
+	 * Distributed spares have no label to validate.
+	 */
+	if (vd->vdev_ops == &vdev_draid_spare_ops)
+		return (0);
+
 	/*
 	 * If we are performing an extreme rewind, we allow for a label that
 	 * was modified at a point after the current txg.
@@ -2275,18 +2373,14 @@ vdev_rele(vdev_t *vd)
  * on the spa_config_lock.  Instead we only obtain the leaf's physical size.
  * If the leaf has never been opened then open it, as usual.
  */
-void
-vdev_reopen(vdev_t *vd)
+/*
+ * Validate a reopened vdev and reassess its parent's health.
+ */
+static void
+vdev_reopen_done(vdev_t *vd)
 {
 	spa_t *spa = vd->vdev_spa;
 
-	ASSERT(spa_config_held(spa, SCL_STATE_ALL, RW_WRITER) == SCL_STATE_ALL);
-
-	/* set the reopening flag unless we're taking the vdev offline */
-	vd->vdev_reopening = !vd->vdev_offline;
-	vdev_close(vd);
-	(void) vdev_open(vd);
-
 	/*
 	 * Call vdev_validate() here to make sure we have the same device.
 	 * Otherwise, a device with an invalid label could be successfully
@@ -2308,6 +2402,65 @@ vdev_reopen(vdev_t *vd)
 	vdev_propagate_state(vd);
 }
 
+void
+vdev_reopen(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+
+	ASSERT(spa_config_held(spa, SCL_STATE_ALL, RW_WRITER) == SCL_STATE_ALL);
+
+	/* set the reopening flag unless we're taking the vdev offline */
+	vd->vdev_reopening = !vd->vdev_offline;
+	vdev_close(vd);
+	(void) vdev_open(vd);
+	vdev_reopen_done(vd);
+}
+
+/*
+ * Reopen count vdevs, none of which may be a descendant of another.  They
+ * are opened in parallel, like the children in vdev_open_children(), so
+ * that unresponsive devices are waited for together rather than in turn.
+ */
+void
+vdev_reopen_many(spa_t *spa, vdev_t **vds, int count)
+{
+	boolean_t zvols = B_FALSE;
+	taskq_t *tq = NULL;
+
+	ASSERT(spa_config_held(spa, SCL_STATE_ALL, RW_WRITER) == SCL_STATE_ALL);
+
+	if (count == 1) {
+		vdev_reopen(vds[0]);
+		return;
+	}
+
+	for (int i = 0; i < count; i++) {
+		vdev_t *vd = vds[i];
+
+		vd->vdev_reopening = !vd->vdev_offline;
+		vdev_close(vd);
+		zvols |= vdev_uses_zvols(vd);
+	}
+
+	/* See vdev_open_children() for why zvols are opened in turn */
+	if (!zvols) {
+		tq = taskq_create("vdev_reopen", count, minclsyspri,
+		    count, count, TASKQ_PREPOPULATE);
+	}
+	if (tq != NULL) {
+		for (int i = 0; i < count; i++)
+			VERIFY(taskq_dispatch(tq, vdev_open_child, vds[i],
+			    TQ_SLEEP) != TASKQID_INVALID);
+		taskq_destroy(tq);
+	} else {
+		for (int i = 0; i < count; i++)
+			vds[i]->vdev_open_error = vdev_open(vds[i]);
+	}
+
+	for (int i = 0; i < count; i++)
+		vdev_reopen_done(vds[i]);
+}
+
 int
 vdev_create(vdev_t *vd, uint64_t txg, boolean_t isreplacing)
 {
@@ -2396,6 +2549,13 @@ vdev_metaslab_set_size(vdev_t *vd)
 	else
 		ms_shift = zfs_vdev_default_ms_shift;
 
+	/*
+	 * Each dRAID metaslab is backed by a single redundancy group, so
+	 * keep them small enough to spread over many slices of the children.
+	 */
+	if (vd->vdev_ops == &vdev_draid_ops)
+		ms_shift = MIN(ms_shift, vdev_draid_max_ms_shift(vd));
+
 	if (ms_shift < SPA_MAXBLOCKSHIFT) {
 		ms_shift = SPA_MAXBLOCKSHIFT;
 	} else if (ms_shift > zfs_vdev_max_ms_shift) {
@@ -2586,7 +2746,7 @@ vdev_dtl_min(vdev_t *vd)
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_first(&vd->vdev_dtl[DTL_MISSING]->rt_root);
+	rs = zfs_btree_first(&vd->vdev_dtl[DTL_MISSING]->rt_root, NULL);
 	return (rs->rs_start - 1);
 }
 
@@ -2602,7 +2762,7 @@ vdev_dtl_max(vdev_t *vd)
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_last(&vd->vdev_dtl[DTL_MISSING]->rt_root);
+	rs = zfs_btree_last(&vd->vdev_dtl[DTL_MISSING]->rt_root, NULL);
 	return (rs->rs_end);
 }
 
@@ -2615,12 +2775,11 @@ vdev_dtl_max(vdev_t *vd)
  * excise the DTLs.
  */
 static boolean_t
-vdev_dtl_should_excise(vdev_t *vd)
+vdev_dtl_should_excise(vdev_t *vd, boolean_t rebuild_done)
 {
 	spa_t *spa = vd->vdev_spa;
 	dsl_scan_t *scn = spa->spa_dsl_pool->dp_scan;
 
-	ASSERT0(scn->scn_phys.scn_errors);
 	ASSERT0(vd->vdev_children);
 
 	if (vd->vdev_state < VDEV_STATE_DEGRADED)
@@ -2629,6 +2788,25 @@ vdev_dtl_should_excise(vdev_t *vd)
 	if (vd->vdev_resilver_deferred)
 		return (B_FALSE);
 
+	if (rebuild_done) {
+		vdev_rebuild_phys_t *vrp =
+		    &vd->vdev_top->vdev_rebuild_config.vr_rebuild_phys;
+
+		/*
+		 * A sequential rebuild only reconstructs the devices which
+		 * were attached for it.  All ranges missing from such a
+		 * device at or below the rebuild max txg have been copied
+		 * since every allocated range of the top-level vdev was.
+		 */
+		if (vd->vdev_rebuild_txg == 0 ||
+		    range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]))
+			return (B_FALSE);
+
+		return (vdev_dtl_max(vd) <= vrp->vrp_max_txg);
+	}
+
+	ASSERT0(scn->scn_phys.scn_errors);
+
 	if (vd->vdev_resilver_txg == 0 ||
 	    range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]))
 		return (B_TRUE);
@@ -2650,11 +2828,12 @@ vdev_dtl_should_excise(vdev_t *vd)
 }
 
 /*
- * Reassess DTLs after a config change or scrub completion. If txg == 0 no
- * write operations will be issued to the pool.
+ * Reassess DTLs after a config change, scrub or rebuild completion.  If
+ * txg == 0 no write operations will be issued to the pool.
  */
 void
-vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
+vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg,
+    int scrub_done, boolean_t rebuild_done)
 {
 	spa_t *spa = vd->vdev_spa;
 	avl_tree_t reftree;
@@ -2664,13 +2843,14 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 
 	for (int c = 0; c < vd->vdev_children; c++)
 		vdev_dtl_reassess(vd->vdev_child[c], txg,
-		    scrub_txg, scrub_done);
+		    scrub_txg, scrub_done, rebuild_done);
 
 	if (vd == spa->spa_root_vdev || !vdev_is_concrete(vd) || vd->vdev_aux)
 		return;
 
 	if (vd->vdev_ops->vdev_op_leaf) {
 		dsl_scan_t *scn = spa->spa_dsl_pool->dp_scan;
+		boolean_t check_excise;
 
 		mutex_enter(&vd->vdev_dtl_lock);
 
@@ -2680,16 +2860,22 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 		if (zfs_scan_ignore_errors && scn)
 			scn->scn_phys.scn_errors = 0;
 
+		if (rebuild_done) {
+			check_excise = (vd->vdev_top->vdev_rebuild_config.
+			    vr_rebuild_phys.vrp_errors == 0);
+		} else {
+			check_excise = (spa->spa_scrub_started ||
+			    (scn != NULL && scn->scn_phys.scn_errors == 0));
+		}
+
 		/*
-		 * If we've completed a scan cleanly then determine
-		 * if this vdev should remove any DTLs. We only want to
-		 * excise regions on vdevs that were available during
-		 * the entire duration of this scan.
+		 * If we've completed a scan or rebuild cleanly then
+		 * determine if this vdev should remove any DTLs. We only
+		 * want to excise regions on vdevs that were available
+		 * during the entire duration of this scan.
 		 */
-		if (scrub_txg != 0 &&
-		    (spa->spa_scrub_started ||
-		    (scn != NULL && scn->scn_phys.scn_errors == 0)) &&
-		    vdev_dtl_should_excise(vd)) {
+		if (scrub_txg != 0 && check_excise &&
+		    vdev_dtl_should_excise(vd, rebuild_done)) {
 			/*
 			 * We completed a scrub up to scrub_txg.  If we
 			 * did it without rebooting, then the scrub dtl
@@ -2741,6 +2927,16 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 			vdev_config_dirty(vd->vdev_top);
 		}
 
+		/*
+		 * Likewise for a device attached for a sequential rebuild.
+		 */
+		if (txg != 0 && vd->vdev_rebuild_txg != 0 &&
+		    range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]) &&
+		    range_tree_is_empty(vd->vdev_dtl[DTL_OUTAGE])) {
+			vd->vdev_rebuild_txg = 0;
+			vdev_config_dirty(vd->vdev_top);
+		}
+
 		mutex_exit(&vd->vdev_dtl_lock);
 
 		if (txg != 0)
@@ -2868,6 +3064,9 @@ vdev_construct_zaps(vdev_t *vd, dmu_tx_t *tx)
 			vd->vdev_top_zap = vdev_create_link_zap(vd, tx);
 			if (vd->vdev_alloc_bias != VDEV_BIAS_NONE)
 				vdev_zap_allocation_data(vd, tx);
+			if (vd->vdev_ops == &vdev_draid_ops)
+				spa_feature_incr(vd->vdev_spa,
+				    SPA_FEATURE_DRAID, tx);
 		}
 	}
 
@@ -2974,10 +3173,10 @@ vdev_dtl_required(vdev_t *vd)
 	 * If not, we can safely offline/detach/remove the device.
 	 */
 	vd->vdev_cant_read = B_TRUE;
-	vdev_dtl_reassess(tvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(tvd, 0, 0, B_FALSE, B_FALSE);
 	required = !vdev_dtl_empty(tvd, DTL_OUTAGE);
 	vd->vdev_cant_read = cant_read;
-	vdev_dtl_reassess(tvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(tvd, 0, 0, B_FALSE, B_FALSE);
 
 	if (!required && zio_injection_enabled)
 		required = !!zio_handle_device_injection(vd, NULL, ECHILD);
@@ -3050,11 +3249,61 @@ vdev_checkpoint_sm_object(vdev_t *vd, uint64_t *sm_obj)
 	return (error);
 }
 
+/*
+ * Top-level vdevs are loaded one after the other, and each of their
+ * metaslabs reads its space map's dnode in vdev_metaslab_init(), so on a
+ * pool with many metaslabs most of the load time would be spent waiting
+ * for these reads one at a time.  Instead, prefetch the metaslab arrays of
+ * all the top-level vdevs, then the dnodes of all their space maps, so that
+ * these reads are all issued up front.
+ */
+static void
+vdev_load_prefetch(vdev_t *rvd)
+{
+	objset_t *mos = rvd->vdev_spa->spa_meta_objset;
+
+	for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		if (!vdev_is_concrete(vd) || vd->vdev_ms_array == 0 ||
+		    vd->vdev_ms_shift == 0)
+			continue;
+
+		dmu_prefetch(mos, vd->vdev_ms_array, 0, 0,
+		    (vd->vdev_asize >> vd->vdev_ms_shift) * sizeof (uint64_t),
+		    ZIO_PRIORITY_SYNC_READ);
+	}
+
+	for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		if (!vdev_is_concrete(vd) || vd->vdev_ms_array == 0 ||
+		    vd->vdev_ms_shift == 0)
+			continue;
+
+		uint64_t count = vd->vdev_asize >> vd->vdev_ms_shift;
+		uint64_t size = count * sizeof (uint64_t);
+		uint64_t *objects = vmem_alloc(size, KM_SLEEP);
+
+		if (dmu_read(mos, vd->vdev_ms_array, 0, size, objects,
+		    DMU_READ_PREFETCH) == 0) {
+			for (uint64_t m = 0; m < count; m++) {
+				dmu_prefetch(mos, objects[m], 0, 0, 0,
+				    ZIO_PRIORITY_SYNC_READ);
+			}
+		}
+		vmem_free(objects, size);
+	}
+}
+
 int
 vdev_load(vdev_t *vd)
 {
 	int error = 0;
 
+	if (vd == vd->vdev_spa->spa_root_vdev)
+		vdev_load_prefetch(vd);
+
 	/*
 	 * Recursively load all children.
 	 */
@@ -3141,6 +3390,22 @@ vdev_load(vdev_t *vd)
 			    "[error=%d]", error);
 			return (error);
 		}
+
+		error = vdev_rebuild_load(vd);
+		if (error != 0) {
+			vdev_dbgmsg(vd, "vdev_load: vdev_rebuild_load "
+			    "failed [error=%d]", error);
+			return (error);
+		}
+
+		if (vd->vdev_ops == &vdev_raidz_ops) {
+			error = vdev_raidz_load(vd);
+			if (error != 0) {
+				vdev_dbgmsg(vd, "vdev_load: vdev_raidz_load "
+				    "failed [error=%d]", error);
+				return (error);
+			}
+		}
 	}
 
 	/*
@@ -3268,6 +3533,7 @@ vdev_destroy_spacemaps(vdev_t *vd, dmu_tx_t *tx)
 	kmem_free(smobj_array, array_bytes);
 	VERIFY0(dmu_object_free(mos, vd->vdev_ms_array, tx));
 	vdev_destroy_ms_flush_data(vd, tx);
+	metaslab_condense_free_orphan(vd, tx);
 	vd->vdev_ms_array = 0;
 }
 
@@ -3379,10 +3645,22 @@ vdev_sync(vdev_t *vd, uint64_t txg)
 	dmu_tx_commit(tx);
 }
 
+/*
+ * Returns the allocated size of a block of psize bytes written in the
+ * passed txg.  Only raidz vdevs which were expanded allocate different
+ * sizes for blocks of different txgs, a txg of 0 stands for the first
+ * txg of the vdev.
+ */
+uint64_t
+vdev_psize_to_asize_txg(vdev_t *vd, uint64_t psize, uint64_t txg)
+{
+	return (vd->vdev_ops->vdev_op_asize(vd, psize, txg));
+}
+
 uint64_t
 vdev_psize_to_asize(vdev_t *vd, uint64_t psize)
 {
-	return (vd->vdev_ops->vdev_op_asize(vd, psize));
+	return (vdev_psize_to_asize_txg(vd, psize, 0));
 }
 
 /*
@@ -3876,6 +4154,13 @@ vdev_get_child_stat_ex(vdev_t *cvd, vdev_stat_ex_t *vsx, vdev_stat_ex_t *cvsx)
 		}
 	}
 
+	for (t = 0; t < ZIO_STAGE_CLASSES; t++) {
+		for (b = 0; b < ARRAY_SIZE(vsx->vsx_stage_histo[0]); b++) {
+			vsx->vsx_stage_histo[t][b] +=
+			    cvsx->vsx_stage_histo[t][b];
+		}
+	}
+
 	for (t = 0; t < ZIO_PRIORITY_NUM_QUEUEABLE; t++) {
 		for (b = 0; b < ARRAY_SIZE(vsx->vsx_queue_histo[0]); b++) {
 			vsx->vsx_queue_histo[t][b] +=
@@ -3945,6 +4230,21 @@ vdev_get_stats_ex_impl(vdev_t *vd, vdev_stat_t *vs, vdev_stat_ex_t *vsx)
 				vdev_get_child_stat_ex(cvd, vsx, cvsx);
 
 		}
+
+		/*
+		 * The stages of logical zios are only accounted to the pool,
+		 * add them in at the root.
+		 */
+		if (vsx && vd == vd->vdev_spa->spa_root_vdev) {
+			spa_t *spa = vd->vdev_spa;
+
+			for (t = 0; t < ZIO_STAGE_CLASSES; t++) {
+				for (int b = 0; b < VDEV_L_HISTO_BUCKETS; b++) {
+					vsx->vsx_stage_histo[t][b] +=
+					    spa->spa_stage_histo[t][b];
+				}
+			}
+		}
 	} else {
 		/*
 		 * We're a leaf.  Just copy our ZIO active queue stats in.  The
@@ -3955,11 +4255,16 @@ vdev_get_stats_ex_impl(vdev_t *vd, vdev_stat_t *vs, vdev_stat_ex_t *vsx)
 
 		memcpy(vsx, &vd->vdev_stat_ex, sizeof (vd->vdev_stat_ex));
 
-		for (t = 0; t < ARRAY_SIZE(vd->vdev_queue.vq_class); t++) {
-			vsx->vsx_active_queue[t] =
-			    vd->vdev_queue.vq_class[t].vqc_active;
-			vsx->vsx_pend_queue[t] = avl_numnodes(
-			    &vd->vdev_queue.vq_class[t].vqc_queued_tree);
+		for (t = 0; t < ZIO_PRIORITY_NUM_QUEUEABLE; t++) {
+			vsx->vsx_active_queue[t] = 0;
+			vsx->vsx_pend_queue[t] = 0;
+			for (int q = 0; q < vd->vdev_queue_shards; q++) {
+				vdev_queue_class_t *vqc =
+				    &vd->vdev_queue[q].vq_class[t];
+
+				vsx->vsx_active_queue[t] += vqc->vqc_active;
+				vsx->vsx_pend_queue[t] += vqc->vqc_queued;
+			}
 		}
 	}
 }
@@ -4336,9 +4641,10 @@ vdev_config_dirty(vdev_t *vd)
 
 	/*
 	 * The dirty list is protected by the SCL_CONFIG lock.  The caller
-	 * must either hold SCL_CONFIG as writer, or must be the sync thread
-	 * (which holds SCL_CONFIG as reader).  There's only one sync thread,
-	 * so this is sufficient to ensure mutual exclusion.
+	 * must either hold SCL_CONFIG as writer, or must be in syncing
+	 * context (where SCL_CONFIG is held as reader).  The top-level
+	 * vdevs may be synced concurrently by spa_sync_vdevs(), which is
+	 * why insertions also take the spa_vdev_sync_lock.
 	 */
 	ASSERT(spa_config_held(spa, SCL_CONFIG, RW_WRITER) ||
 	    (dsl_pool_sync_context(spa_get_dsl(spa)) &&
@@ -4350,10 +4656,12 @@ vdev_config_dirty(vdev_t *vd)
 	} else {
 		ASSERT(vd == vd->vdev_top);
 
+		mutex_enter(&spa->spa_vdev_sync_lock);
 		if (!list_link_active(&vd->vdev_config_dirty_node) &&
 		    vdev_is_concrete(vd)) {
 			list_insert_head(&spa->spa_config_dirty_list, vd);
 		}
+		mutex_exit(&spa->spa_vdev_sync_lock);
 	}
 }
 
@@ -4740,8 +5048,9 @@ vdev_deadman(vdev_t *vd, char *tag)
 		vdev_deadman(cvd, tag);
 	}
 
-	if (vd->vdev_ops->vdev_op_leaf) {
-		vdev_queue_t *vq = &vd->vdev_queue;
+	for (int q = 0; vd->vdev_ops->vdev_op_leaf &&
+	    q < vd->vdev_queue_shards; q++) {
+		vdev_queue_t *vq = &vd->vdev_queue[q];
 
 		mutex_enter(&vq->vq_lock);
 		if (avl_numnodes(&vq->vq_active_tree) > 0) {
@@ -4817,7 +5126,7 @@ vdev_xlate(vdev_t *vd, const range_seg_t *logical_rs, range_seg_t *physical_rs)
 	 * range into its physical components by calling the
 	 * vdev specific translate function.
 	 */
-	range_seg_t intermediate = { { { 0, 0 } } };
+	range_seg_t intermediate = { 0 };
 	pvd->vdev_ops->vdev_op_xlate(vd, physical_rs, &intermediate);
 
 	physical_rs->rs_start = intermediate.rs_start;
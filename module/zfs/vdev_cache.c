@@ -45,10 +45,20 @@
  * read into a 64k read, which doesn't affect latency all that much but is
  * terribly wasteful of bandwidth.  A more intelligent version of the cache
  * could keep track of access patterns and not do read-ahead unless it sees
- * at least two temporally close I/Os to the same region.  Currently, only
- * metadata I/O is inflated.  A futher enhancement could take advantage of
- * more semantic information about the I/O.  And it could use something
- * faster than an AVL tree; that was chosen solely for convenience.
+ * at least two temporally close I/Os to the same region.  And it could use
+ * something faster than an AVL tree; that was chosen solely for convenience.
+ *
+ * Only metadata reads are inflated: zio_read() marks data blocks (level 0
+ * of a non-metadata type) and DDT ZAP blocks with ZIO_FLAG_DONT_CACHE.
+ * Metadata walks over dnodes and indirect blocks are where read-ahead pays
+ * off, and only on rotational media; on SSDs the inflated read costs more
+ * than the seeks it saves, so non-rotational leaves are skipped unless
+ * zfs_vdev_cache_nonrot is set.
+ *
+ * Every region handed back to a read is going into the ARC, so the cache
+ * does not try to hold on to it as well.  Each entry tracks which 1/64th
+ * slices of it have been served, and is dropped as soon as all of them
+ * have; what stays in the cache is only the read-ahead not yet asked for.
  *
  * There are five cache operations: allocate, fill, read, write, evict.
  *
@@ -71,24 +81,25 @@
  * These tunables are for performance analysis.
  */
 /*
- * All i/os smaller than zfs_vdev_cache_max will be turned into
+ * All metadata i/os smaller than zfs_vdev_cache_max will be turned into
  * 1<<zfs_vdev_cache_bshift byte reads by the vdev_cache (aka software
  * track buffer).  At most zfs_vdev_cache_size bytes will be kept in each
  * vdev's vdev_cache.
- *
- * TODO: Note that with the current ZFS code, it turns out that the
- * vdev cache is not helpful, and in some cases actually harmful.  It
- * is better if we disable this.  Once some time has passed, we should
- * actually remove this to simplify the code.  For now we just disable
- * it by setting the zfs_vdev_cache_size to zero.  Note that Solaris 11
- * has made these same changes.
  */
 int zfs_vdev_cache_max = 1<<14;			/* 16KB */
-int zfs_vdev_cache_size = 0;
+int zfs_vdev_cache_size = 4 << 20;		/* 4MB */
 int zfs_vdev_cache_bshift = 16;
+int zfs_vdev_cache_nonrot = 0;
 
 #define	VCBS (1 << zfs_vdev_cache_bshift)	/* 64KB */
 
+/*
+ * Entries are divided into 64 slices for tracking what has been served.
+ */
+#define	VC_SLICES		64
+#define	VC_SLICE_SHIFT		(zfs_vdev_cache_bshift - 6)
+#define	VC_ALL_SERVED		(-1ULL)
+
 kstat_t	*vdc_ksp = NULL;
 
 typedef struct vdc_stats {
@@ -187,13 +198,19 @@ vdev_cache_allocate(zio_t *zio)
 	return (ve);
 }
 
+/*
+ * Satisfy zio from the entry and mark the slices it covered as served.
+ */
 static void
 vdev_cache_hit(vdev_cache_t *vc, vdev_cache_entry_t *ve, zio_t *zio)
 {
 	uint64_t cache_phase = P2PHASE(zio->io_offset, VCBS);
+	uint64_t first = cache_phase >> VC_SLICE_SHIFT;
+	uint64_t last = (cache_phase + zio->io_size - 1) >> VC_SLICE_SHIFT;
 
 	ASSERT(MUTEX_HELD(&vc->vc_lock));
 	ASSERT3P(ve->ve_fill_io, ==, NULL);
+	ASSERT3U(last, <, VC_SLICES);
 
 	if (ve->ve_lastused != ddi_get_lbolt()) {
 		avl_remove(&vc->vc_lastused_tree, ve);
@@ -203,6 +220,9 @@ vdev_cache_hit(vdev_cache_t *vc, vdev_cache_entry_t *ve, zio_t *zio)
 
 	ve->ve_hits++;
 	abd_copy_off(zio->io_abd, ve->ve_abd, 0, cache_phase, zio->io_size);
+
+	for (uint64_t s = first; s <= last; s++)
+		ve->ve_served |= 1ULL << s;
 }
 
 /*
@@ -238,7 +258,8 @@ vdev_cache_fill(zio_t *fio)
 	while ((pio = zio_walk_parents(fio, &zl)) != NULL)
 		vdev_cache_hit(vc, ve, pio);
 
-	if (fio->io_error || ve->ve_missed_update)
+	if (fio->io_error || ve->ve_missed_update ||
+	    ve->ve_served == VC_ALL_SERVED)
 		vdev_cache_evict(vc, ve);
 
 	mutex_exit(&vc->vc_lock);
@@ -264,6 +285,9 @@ vdev_cache_read(zio_t *zio)
 	if (zio->io_size > zfs_vdev_cache_max)
 		return (B_FALSE);
 
+	if (zio->io_vd->vdev_nonrot && !zfs_vdev_cache_nonrot)
+		return (B_FALSE);
+
 	/*
 	 * If the I/O straddles two or more cache blocks, don't cache it.
 	 */
@@ -295,6 +319,8 @@ vdev_cache_read(zio_t *zio)
 
 		vdev_cache_hit(vc, ve, zio);
 		zio_vdev_io_bypass(zio);
+		if (ve->ve_served == VC_ALL_SERVED)
+			vdev_cache_evict(vc, ve);
 
 		mutex_exit(&vc->vc_lock);
 		VDCSTAT_BUMP(vdc_stat_hits);
@@ -350,15 +376,19 @@ vdev_cache_write(zio_t *zio)
 	while (ve != NULL && ve->ve_offset < max_offset) {
 		uint64_t start = MAX(ve->ve_offset, io_start);
 		uint64_t end = MIN(ve->ve_offset + VCBS, io_end);
+		vdev_cache_entry_t *next = AVL_NEXT(&vc->vc_offset_tree, ve);
 
 		if (ve->ve_fill_io != NULL) {
 			ve->ve_missed_update = 1;
+		} else if (zio->io_abd == NULL) {
+			/* An aggregated write without a buffer of its own */
+			vdev_cache_evict(vc, ve);
 		} else {
 			abd_copy_off(ve->ve_abd, zio->io_abd,
 			    start - ve->ve_offset, start - io_start,
 			    end - start);
 		}
-		ve = AVL_NEXT(&vc->vc_offset_tree, ve);
+		ve = next;
 	}
 	mutex_exit(&vc->vc_lock);
 }
@@ -434,4 +464,7 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, cache_size, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, cache_bshift, UINT, ZMOD_RW,
 	"Shift size to inflate reads too");
+
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, cache_nonrot, INT, ZMOD_RW,
+	"Also inflate reads on non-rotational vdevs");
 #endif
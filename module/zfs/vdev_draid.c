@@ -0,0 +1,912 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+#include <sys/fs/zfs.h>
+
+/*
+ * Virtual device vector for distributed spare RAID (dRAID).
+ *
+ * A RAID-Z vdev stripes every block across all of its children, so a
+ * replacement disk must absorb one column of every block in the vdev and
+ * resilvering is bounded by that one disk's write bandwidth.  dRAID
+ * instead stores each block in a fixed-width redundancy group of
+ * D data and P parity columns, and spreads the groups, as well as some
+ * reserved spare capacity, across a larger number of children.  When a
+ * child fails its columns are rebuilt into the spare capacity, which is
+ * spread over all of the surviving children, so the rebuild reads from
+ * and writes to every disk in parallel.
+ *
+ * Layout
+ *
+ * Let W = D + P be the group width, S the number of distributed spares
+ * and N = children - S the number of children holding data at any given
+ * offset.  Each metaslab is backed by exactly one redundancy group, so a
+ * block never spans groups and is laid out within its group exactly like
+ * a RAID-Z stripe of width W (the RAID-Z map, parity, reconstruction and
+ * self-healing code is shared with vdev_raidz.c).  A group is made of W
+ * columns, each H = (metaslab size / W) bytes tall (rounded down to a
+ * multiple of 64k), on W distinct children.
+ *
+ * Groups are packed onto the children in slices.  A slice is G = N /
+ * gcd(N, W) groups, whose G * W columns exactly fill R = G * W / N rows
+ * of columns on N children; group g of the slice uses logical positions
+ * g * W .. g * W + W - 1, and position p is row p / N of logical child
+ * p % N.  The remaining S children hold R rows of spare space for the
+ * slice.  Logical children are mapped to physical ones through one of
+ * 256 pseudo-random permutations of the children, chosen by slice number,
+ * so data, parity and spare space all end up evenly distributed.
+ *
+ *	slice s	 |  perm[s][0]  ...  perm[s][N - 1] | perm[s][N] ... [N+S-1]
+ *	row 0	 |  group 0 ...   group 0/1 ...     |   spare 0 ... S - 1
+ *	...	 |                                   |
+ *	row R-1	 |  ...           group G - 1       |   spare 0 ... S - 1
+ *
+ * Every child therefore stores R * H bytes per slice, and the capacity of
+ * the vdev is G metaslabs for every full slice that fits on the smallest
+ * child.  The unused tail of each metaslab (its size less W * H) is never
+ * made allocatable.
+ *
+ * Distributed spares
+ *
+ * Spare k of dRAID vdev v is a leaf vdev named "draid<P>-<v>-<k>" which is
+ * automatically added to the pool's spares when the dRAID vdev is created.
+ * It has the same size as a child, and offset x of the spare is stored at
+ * the same offset of the child holding spare space k in the slice that
+ * contains x.  That child never holds data for the slice, so when the
+ * spare replaces a failed child it is never on the same stripe as any
+ * column it stands in for.  The spare has no label of its own; it is
+ * identified by its name and only ever used within its own pool.
+ */
+
+/*
+ * Simple, fast and well distributed PRNG (splitmix64) used to generate the
+ * child permutations.  The permutations are part of the on-disk format,
+ * so this must never change.
+ */
+static uint64_t
+vdev_draid_rand(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (z ^ (z >> 31));
+}
+
+static void
+vdev_draid_generate_perms(vdev_draid_config_t *vdc)
+{
+	uint64_t children = vdc->vdc_children;
+
+	vdc->vdc_nperms = VDEV_DRAID_NPERMS;
+	vdc->vdc_perms = kmem_alloc(vdc->vdc_nperms * children, KM_SLEEP);
+
+	for (uint64_t p = 0; p < vdc->vdc_nperms; p++) {
+		uint8_t *perm = &vdc->vdc_perms[p * children];
+		uint64_t state = vdc->vdc_seed ^ (p * 0xd1342543de82ef95ULL);
+
+		for (uint64_t c = 0; c < children; c++)
+			perm[c] = c;
+
+		/* Fisher-Yates shuffle */
+		for (uint64_t c = children - 1; c > 0; c--) {
+			uint64_t j = vdev_draid_rand(&state) % (c + 1);
+			uint8_t tmp = perm[c];
+
+			perm[c] = perm[j];
+			perm[j] = tmp;
+		}
+	}
+}
+
+static inline const uint8_t *
+vdev_draid_perm(vdev_draid_config_t *vdc, uint64_t slice)
+{
+	return (&vdc->vdc_perms[(slice % vdc->vdc_nperms) *
+	    vdc->vdc_children]);
+}
+
+static uint64_t
+vdev_draid_gcd(uint64_t a, uint64_t b)
+{
+	while (b != 0) {
+		uint64_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return (a);
+}
+
+/*
+ * Parse and validate the layout of a new dRAID vdev from its config.  The
+ * type-specific data is returned in *tsd.
+ */
+int
+vdev_draid_config_create(nvlist_t *nv, uint64_t nparity, int alloctype,
+    void **tsd)
+{
+	uint64_t ndata, nspares, seed;
+	nvlist_t **child;
+	uint_t children;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (SET_ERROR(EINVAL));
+
+	if (nvlist_lookup_uint64(nv, ZPOOL_CONFIG_DRAID_NDATA, &ndata) != 0 ||
+	    nvlist_lookup_uint64(nv, ZPOOL_CONFIG_DRAID_NSPARES,
+	    &nspares) != 0)
+		return (SET_ERROR(EINVAL));
+
+	if (nparity == 0 || nparity > VDEV_DRAID_MAXPARITY || ndata == 0 ||
+	    children > VDEV_DRAID_MAX_CHILDREN ||
+	    ndata + nparity + nspares > children)
+		return (SET_ERROR(EINVAL));
+
+	/*
+	 * New vdevs pick a random seed for their permutations; existing
+	 * ones must have one.
+	 */
+	if (nvlist_lookup_uint64(nv, ZPOOL_CONFIG_DRAID_SEED, &seed) != 0) {
+		if (alloctype == VDEV_ALLOC_LOAD)
+			return (SET_ERROR(EINVAL));
+		(void) random_get_pseudo_bytes((uint8_t *)&seed,
+		    sizeof (seed));
+	}
+
+	vdev_draid_config_t *vdc = kmem_zalloc(sizeof (*vdc), KM_SLEEP);
+	vdc->vdc_ndata = ndata;
+	vdc->vdc_nparity = nparity;
+	vdc->vdc_nspares = nspares;
+	vdc->vdc_children = children;
+	vdc->vdc_ndisks = children - nspares;
+	vdc->vdc_groupwidth = ndata + nparity;
+	vdc->vdc_ngroups = vdc->vdc_ndisks /
+	    vdev_draid_gcd(vdc->vdc_ndisks, vdc->vdc_groupwidth);
+	vdc->vdc_nrows = vdc->vdc_ngroups * vdc->vdc_groupwidth /
+	    vdc->vdc_ndisks;
+	vdc->vdc_seed = seed;
+	vdev_draid_generate_perms(vdc);
+
+	*tsd = vdc;
+
+	return (0);
+}
+
+/*
+ * Parse a decimal number from the name of a distributed spare, returning a
+ * pointer just past it, or NULL if there isn't one.
+ */
+static const char *
+vdev_draid_parse_num(const char *p, uint64_t *valp)
+{
+	uint64_t val = 0;
+
+	if (*p < '0' || *p > '9')
+		return (NULL);
+
+	for (; *p >= '0' && *p <= '9'; p++) {
+		val = val * 10 + (*p - '0');
+		if (val > UINT32_MAX)
+			return (NULL);
+	}
+
+	*valp = val;
+
+	return (p);
+}
+
+/*
+ * Parse the name of a distributed spare.  Its parent dRAID vdev is only
+ * looked up when the spare is opened.
+ */
+int
+vdev_draid_spare_config_create(nvlist_t *nv, void **tsd)
+{
+	uint64_t nparity, top_id, spare_id;
+	const char *p;
+	char *path;
+
+	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &path) != 0 ||
+	    strncmp(path, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) != 0)
+		return (SET_ERROR(EINVAL));
+
+	p = path + strlen(VDEV_TYPE_DRAID);
+	if ((p = vdev_draid_parse_num(p, &nparity)) == NULL || *p != '-' ||
+	    (p = vdev_draid_parse_num(p + 1, &top_id)) == NULL || *p != '-' ||
+	    (p = vdev_draid_parse_num(p + 1, &spare_id)) == NULL || *p != '\0')
+		return (SET_ERROR(EINVAL));
+
+	if (nparity == 0 || nparity > VDEV_DRAID_MAXPARITY ||
+	    spare_id >= VDEV_DRAID_MAX_CHILDREN)
+		return (SET_ERROR(EINVAL));
+
+	vdev_draid_spare_t *vds = kmem_zalloc(sizeof (*vds), KM_SLEEP);
+	vds->vds_nparity = nparity;
+	vds->vds_top_id = top_id;
+	vds->vds_spare_id = spare_id;
+
+	*tsd = vds;
+
+	return (0);
+}
+
+void
+vdev_draid_config_free(vdev_t *vd)
+{
+	if (vd->vdev_tsd == NULL)
+		return;
+
+	if (vd->vdev_ops == &vdev_draid_ops) {
+		vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+		kmem_free(vdc->vdc_perms, vdc->vdc_nperms * vdc->vdc_children);
+		kmem_free(vdc, sizeof (*vdc));
+	} else {
+		ASSERT3P(vd->vdev_ops, ==, &vdev_draid_spare_ops);
+		kmem_free(vd->vdev_tsd, sizeof (vdev_draid_spare_t));
+	}
+
+	vd->vdev_tsd = NULL;
+}
+
+void
+vdev_draid_config_generate(vdev_t *vd, nvlist_t *nv)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_NDATA, vdc->vdc_ndata);
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_NSPARES, vdc->vdc_nspares);
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_SEED, vdc->vdc_seed);
+}
+
+/*
+ * Height in bytes of a redundancy group column on a child.
+ */
+static uint64_t
+vdev_draid_col_height(vdev_t *vd)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	ASSERT3U(vd->vdev_ms_shift, >=, SPA_MAXBLOCKSHIFT);
+
+	return (P2ALIGN((1ULL << vd->vdev_ms_shift) / vdc->vdc_groupwidth,
+	    1ULL << VDEV_DRAID_ROW_SHIFT));
+}
+
+/*
+ * Bytes stored on each child per slice of redundancy groups.
+ */
+static uint64_t
+vdev_draid_slice_size(vdev_t *vd)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	return (vdc->vdc_nrows * vdev_draid_col_height(vd));
+}
+
+/*
+ * Logical capacity provided by children of at least csize bytes each.
+ */
+static uint64_t
+vdev_draid_logical_size(vdev_t *vd, uint64_t csize)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t nslices = csize / vdev_draid_slice_size(vd);
+
+	return ((nslices * vdc->vdc_ngroups) << vd->vdev_ms_shift);
+}
+
+/*
+ * Child capacity needed to back a logical capacity of asize bytes.
+ */
+static uint64_t
+vdev_draid_child_size(vdev_t *vd, uint64_t asize)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t nslices = howmany(asize >> vd->vdev_ms_shift,
+	    vdc->vdc_ngroups);
+
+	return (nslices * vdev_draid_slice_size(vd));
+}
+
+/*
+ * Locate column col of the redundancy group backing the given metaslab:
+ * the index of the child storing it and the column's starting offset.
+ */
+static void
+vdev_draid_map_col(vdev_t *vd, uint64_t chunk, uint64_t col,
+    uint64_t *devidxp, uint64_t *offsetp)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t slice = chunk / vdc->vdc_ngroups;
+	uint64_t pos = (chunk % vdc->vdc_ngroups) * vdc->vdc_groupwidth + col;
+	uint64_t row = slice * vdc->vdc_nrows + pos / vdc->vdc_ndisks;
+
+	ASSERT3U(col, <, vdc->vdc_groupwidth);
+
+	*devidxp = vdev_draid_perm(vdc, slice)[pos % vdc->vdc_ndisks];
+	*offsetp = row * vdev_draid_col_height(vd);
+}
+
+/*
+ * The smallest child asize which can back the vdev's allocatable space.
+ */
+uint64_t
+vdev_draid_min_asize(vdev_t *vd)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+
+	if (vd->vdev_ms_shift == 0)
+		return (howmany(vd->vdev_min_asize, vdc->vdc_ndisks));
+
+	return (vdev_draid_child_size(vd, vd->vdev_min_asize));
+}
+
+/*
+ * Number of children holding data at any offset of the vdev.
+ */
+uint64_t
+vdev_draid_ndisks(vdev_t *vd)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+
+	return (vdc->vdc_ndisks);
+}
+
+/*
+ * Cap the metaslab size so that each child holds at least
+ * VDEV_DRAID_MIN_SLICES slices.
+ */
+uint64_t
+vdev_draid_max_ms_shift(vdev_t *vd)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t msize = vdc->vdc_child_asize * vdc->vdc_groupwidth /
+	    (vdc->vdc_nrows * VDEV_DRAID_MIN_SLICES);
+
+	return (msize == 0 ? 0 : highbit64(msize) - 1);
+}
+
+static int
+vdev_draid_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
+    uint64_t *ashift, uint64_t *pshift)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t nparity = vd->vdev_nparity;
+	uint64_t csize = 0, max_csize = 0;
+	int lasterror = 0;
+	int numerrors = 0;
+
+	ASSERT(nparity > 0);
+
+	if (nparity > VDEV_DRAID_MAXPARITY || vdc == NULL ||
+	    vd->vdev_children != vdc->vdc_children ||
+	    vd != vd->vdev_top) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_BAD_LABEL;
+		return (SET_ERROR(EINVAL));
+	}
+
+	vdev_open_children(vd);
+
+	for (int c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (cvd->vdev_open_error != 0) {
+			lasterror = cvd->vdev_open_error;
+			numerrors++;
+			continue;
+		}
+
+		csize = MIN(csize - 1, cvd->vdev_asize - 1) + 1;
+		max_csize = MIN(max_csize - 1, cvd->vdev_max_asize - 1) + 1;
+		*ashift = MAX(*ashift, cvd->vdev_ashift);
+		*pshift = MAX(*pshift, cvd->vdev_physical_ashift);
+	}
+
+	if (numerrors > nparity) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_NO_REPLICAS;
+		return (lasterror);
+	}
+
+	/*
+	 * The metaslab size determines the column height, so it must be
+	 * known before the capacity is.  The first time a new vdev is opened
+	 * derive it from the raw capacity of the children.  The caller's
+	 * subsequent vdev_metaslab_set_size() call, made with the resulting
+	 * smaller asize, can only keep or shrink it, and a smaller metaslab
+	 * size never leaves a metaslab without backing.
+	 */
+	vdc->vdc_child_asize = csize;
+	if (vd->vdev_ms_shift == 0) {
+		uint64_t asize_saved = vd->vdev_asize;
+
+		vd->vdev_asize = csize * vdc->vdc_ndisks;
+		vdev_metaslab_set_size(vd);
+		vd->vdev_asize = asize_saved;
+	}
+
+	*asize = vdev_draid_logical_size(vd, csize);
+	*max_asize = vdev_draid_logical_size(vd, max_csize);
+
+	if (*asize == 0) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_TOO_SMALL;
+		return (SET_ERROR(EOVERFLOW));
+	}
+
+	return (0);
+}
+
+static void
+vdev_draid_close(vdev_t *vd)
+{
+	for (int c = 0; c < vd->vdev_children; c++)
+		vdev_close(vd->vdev_child[c]);
+}
+
+/*
+ * Blocks are RAID-Z stripes of the group width.
+ */
+static uint64_t
+vdev_draid_asize(vdev_t *vd, uint64_t psize, uint64_t txg)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t asize;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t cols = vdc->vdc_groupwidth;
+	uint64_t nparity = vdc->vdc_nparity;
+
+	asize = ((psize - 1) >> ashift) + 1;
+	asize += nparity * ((asize + cols - nparity - 1) / (cols - nparity));
+	asize = roundup(asize, nparity + 1) << ashift;
+
+	return (asize);
+}
+
+/*
+ * Lay the block out as a RAID-Z stripe within the redundancy group that
+ * backs its metaslab, translate the columns to children and offsets, and
+ * let the RAID-Z code do the rest.
+ */
+static void
+vdev_draid_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t chunk = zio->io_offset >> vd->vdev_ms_shift;
+	uint64_t offset = zio->io_offset - (chunk << vd->vdev_ms_shift);
+	raidz_map_t *rm;
+
+	rm = vdev_raidz_map_alloc_offset(zio, offset, vd->vdev_ashift,
+	    vdc->vdc_groupwidth, vdc->vdc_nparity);
+
+	ASSERT3U(rm->rm_asize, ==, vdev_psize_to_asize(vd, zio->io_size));
+	ASSERT3U(offset + rm->rm_asize, <=,
+	    vdc->vdc_groupwidth * vdev_draid_col_height(vd));
+
+	for (int c = 0; c < rm->rm_scols; c++) {
+		raidz_col_t *rc = &rm->rm_col[c];
+		uint64_t devidx, coff;
+
+		vdev_draid_map_col(vd, chunk, rc->rc_devidx, &devidx, &coff);
+		rc->rc_devidx = devidx;
+		rc->rc_offset += coff;
+	}
+
+	vdev_raidz_io_start_map(zio, rm);
+}
+
+/*
+ * Determine if any portion of the provided block resides on a child vdev
+ * with a dirty DTL.  Unlike RAID-Z only the children of the block's
+ * redundancy group need to be considered.
+ */
+static boolean_t
+vdev_draid_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t chunk = offset >> vd->vdev_ms_shift;
+	uint64_t b = (offset - (chunk << vd->vdev_ms_shift)) >> ashift;
+	uint64_t s = ((psize - 1) >> ashift) + 1;
+	uint64_t width = vdc->vdc_groupwidth;
+	uint64_t f = b % width;
+
+	for (uint64_t c = 0; c < MIN(s + vdc->vdc_nparity, width); c++) {
+		uint64_t devidx, coff;
+
+		vdev_draid_map_col(vd, chunk, (f + c) % width, &devidx, &coff);
+
+		/*
+		 * dsl_scan_need_resilver() already checked vd with
+		 * vdev_dtl_contains(). So here just check cvd with
+		 * vdev_dtl_empty(), cheaper and a good approximation.
+		 */
+		if (!vdev_dtl_empty(vd->vdev_child[devidx], DTL_PARTIAL))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Translate a logical range, which must lie within one metaslab, to the
+ * range of the given child holding it.  If the child holds no column of
+ * the metaslab's redundancy group the result is an empty range at the
+ * start of the slice.
+ */
+static void
+vdev_draid_xlate(vdev_t *cvd, const range_seg_t *in, range_seg_t *res)
+{
+	vdev_t *vd = cvd->vdev_parent;
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t width = vdc->vdc_groupwidth;
+	uint64_t chunk = in->rs_start >> vd->vdev_ms_shift;
+	uint64_t chunk_start = chunk << vd->vdev_ms_shift;
+	uint64_t devidx, coff;
+	uint64_t col;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+	ASSERT3U(in->rs_end, <=, chunk_start + (1ULL << vd->vdev_ms_shift));
+
+	/* make sure the offsets are block-aligned */
+	ASSERT0(in->rs_start % (1 << ashift));
+	ASSERT0(in->rs_end % (1 << ashift));
+
+	for (col = 0; col < width; col++) {
+		vdev_draid_map_col(vd, chunk, col, &devidx, &coff);
+		if (devidx == cvd->vdev_id)
+			break;
+	}
+
+	if (col == width) {
+		res->rs_start = res->rs_end = (chunk / vdc->vdc_ngroups) *
+		    vdev_draid_slice_size(vd);
+		return;
+	}
+
+	uint64_t b_start = (in->rs_start - chunk_start) >> ashift;
+	uint64_t b_end = (in->rs_end - chunk_start) >> ashift;
+
+	uint64_t start_row = 0;
+	if (b_start > col) /* avoid underflow */
+		start_row = ((b_start - col - 1) / width) + 1;
+
+	uint64_t end_row = 0;
+	if (b_end > col)
+		end_row = ((b_end - col - 1) / width) + 1;
+
+	res->rs_start = coff + (start_row << ashift);
+	res->rs_end = coff + (end_row << ashift);
+}
+
+/*
+ * Only the part of each metaslab backed by its redundancy group may be
+ * allocated from.
+ */
+static void
+vdev_draid_metaslab_init(vdev_t *vd, uint64_t *ms_start, uint64_t *ms_size)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	ASSERT0(P2PHASE(*ms_start, 1ULL << vd->vdev_ms_shift));
+
+	*ms_size = MIN(*ms_size,
+	    vdc->vdc_groupwidth * vdev_draid_col_height(vd));
+}
+
+vdev_ops_t vdev_draid_ops = {
+	.vdev_op_open = vdev_draid_open,
+	.vdev_op_close = vdev_draid_close,
+	.vdev_op_asize = vdev_draid_asize,
+	.vdev_op_io_start = vdev_draid_io_start,
+	.vdev_op_io_done = vdev_raidz_io_done,
+	.vdev_op_state_change = vdev_raidz_state_change,
+	.vdev_op_need_resilver = vdev_draid_need_resilver,
+	.vdev_op_hold = NULL,
+	.vdev_op_rele = NULL,
+	.vdev_op_remap = NULL,
+	.vdev_op_xlate = vdev_draid_xlate,
+	.vdev_op_metaslab_init = vdev_draid_metaslab_init,
+	.vdev_op_type = VDEV_TYPE_DRAID,	/* name of this vdev type */
+	.vdev_op_leaf = B_FALSE			/* not a leaf vdev */
+};
+
+/*
+ * Append the distributed spares of any dRAID vdevs among vd's children to
+ * the spares in nvroot.  The children will become top-level vdevs with ids
+ * starting at next_id.
+ */
+void
+vdev_draid_spare_create(nvlist_t *nvroot, vdev_t *vd, uint64_t next_id)
+{
+	nvlist_t **spares, **newspares;
+	uint_t nspares;
+	uint64_t ndspares = 0;
+
+	for (uint64_t c = 0; c < vd->vdev_children; c++) {
+		vdev_t *tvd = vd->vdev_child[c];
+
+		if (tvd->vdev_ops == &vdev_draid_ops) {
+			vdev_draid_config_t *vdc = tvd->vdev_tsd;
+
+			ndspares += vdc->vdc_nspares;
+		}
+	}
+
+	if (ndspares == 0)
+		return;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
+	    &spares, &nspares) != 0)
+		nspares = 0;
+
+	newspares = kmem_alloc((nspares + ndspares) * sizeof (nvlist_t *),
+	    KM_SLEEP);
+	for (uint_t i = 0; i < nspares; i++)
+		newspares[i] = fnvlist_dup(spares[i]);
+
+	uint64_t n = nspares;
+	for (uint64_t c = 0; c < vd->vdev_children; c++) {
+		vdev_t *tvd = vd->vdev_child[c];
+
+		if (tvd->vdev_ops != &vdev_draid_ops)
+			continue;
+
+		vdev_draid_config_t *vdc = tvd->vdev_tsd;
+		for (uint64_t s = 0; s < vdc->vdc_nspares; s++) {
+			char path[MAXNAMELEN];
+			nvlist_t *nv = fnvlist_alloc();
+
+			(void) snprintf(path, sizeof (path),
+			    VDEV_DRAID_SPARE_PATH_FMT,
+			    (u_longlong_t)vdc->vdc_nparity,
+			    (u_longlong_t)(next_id + c), (u_longlong_t)s);
+			fnvlist_add_string(nv, ZPOOL_CONFIG_TYPE,
+			    VDEV_TYPE_DRAID_SPARE);
+			fnvlist_add_string(nv, ZPOOL_CONFIG_PATH, path);
+			newspares[n++] = nv;
+		}
+	}
+	ASSERT3U(n, ==, nspares + ndspares);
+
+	fnvlist_add_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES, newspares, n);
+
+	for (uint64_t i = 0; i < n; i++)
+		nvlist_free(newspares[i]);
+	kmem_free(newspares, n * sizeof (nvlist_t *));
+}
+
+/*
+ * Find the dRAID vdev a distributed spare belongs to.  While vdevs are
+ * being added they are still children of the pending root vdev.
+ */
+vdev_t *
+vdev_draid_spare_get_parent(vdev_t *vd)
+{
+	vdev_draid_spare_t *vds = vd->vdev_tsd;
+	spa_t *spa = vd->vdev_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *pending = spa->spa_pending_vdev;
+	vdev_t *tvd = NULL;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_spare_ops);
+
+	if (vds == NULL || rvd == NULL)
+		return (NULL);
+
+	if (vds->vds_top_id < rvd->vdev_children) {
+		tvd = rvd->vdev_child[vds->vds_top_id];
+	} else if (pending != NULL && pending != rvd &&
+	    vds->vds_top_id - rvd->vdev_children < pending->vdev_children) {
+		tvd = pending->vdev_child[vds->vds_top_id - rvd->vdev_children];
+	}
+
+	if (tvd == NULL || tvd->vdev_ops != &vdev_draid_ops)
+		return (NULL);
+
+	vdev_draid_config_t *vdc = tvd->vdev_tsd;
+	if (vdc->vdc_nparity != vds->vds_nparity ||
+	    vds->vds_spare_id >= vdc->vdc_nspares)
+		return (NULL);
+
+	return (tvd);
+}
+
+/*
+ * Distributed spares have no label.  Generate the label of an inactive
+ * hot spare, using the guid the spare has in the pool's list of spares so
+ * that a spare named by its path when replacing a device is recognized.
+ */
+nvlist_t *
+vdev_draid_read_config_spare(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	spa_aux_vdev_t *sav = &spa->spa_spares;
+	uint64_t guid = vd->vdev_guid;
+	nvlist_t *label;
+
+	for (int i = 0; i < sav->sav_count; i++) {
+		vdev_t *svd = sav->sav_vdevs[i];
+
+		if (svd->vdev_ops == &vdev_draid_spare_ops &&
+		    strcmp(svd->vdev_path, vd->vdev_path) == 0) {
+			guid = svd->vdev_guid;
+			break;
+		}
+	}
+
+	label = fnvlist_alloc();
+	fnvlist_add_uint64(label, ZPOOL_CONFIG_VERSION, spa_version(spa));
+	fnvlist_add_uint64(label, ZPOOL_CONFIG_POOL_STATE, POOL_STATE_SPARE);
+	fnvlist_add_uint64(label, ZPOOL_CONFIG_GUID, guid);
+
+	return (label);
+}
+
+/*
+ * A distributed spare is as large as the children of its dRAID vdev.
+ */
+static int
+vdev_draid_spare_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
+    uint64_t *ashift, uint64_t *pshift)
+{
+	vdev_t *tvd = vdev_draid_spare_get_parent(vd);
+
+	if (tvd == NULL || tvd->vdev_asize == 0) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		return (SET_ERROR(ENXIO));
+	}
+
+	*psize = *max_psize = P2ROUNDUP(vdev_draid_child_size(tvd,
+	    tvd->vdev_asize), sizeof (vdev_label_t)) +
+	    VDEV_LABEL_START_SIZE + VDEV_LABEL_END_SIZE;
+	*ashift = tvd->vdev_ashift;
+	*pshift = tvd->vdev_physical_ashift;
+
+	return (0);
+}
+
+/* ARGSUSED */
+static void
+vdev_draid_spare_close(vdev_t *vd)
+{
+}
+
+static void
+vdev_draid_spare_child_done(zio_t *zio)
+{
+	zio_t *pio = zio->io_private;
+
+	mutex_enter(&pio->io_lock);
+	pio->io_error = zio_worst_error(pio->io_error, zio->io_error);
+	mutex_exit(&pio->io_lock);
+
+	abd_put(zio->io_abd);
+}
+
+/*
+ * Forward I/O to the children holding the spare's space.  An I/O may span
+ * slices, and so several children, after aggregation.
+ */
+static void
+vdev_draid_spare_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_draid_spare_t *vds = vd->vdev_tsd;
+	vdev_t *tvd = vdev_draid_spare_get_parent(vd);
+
+	switch (zio->io_type) {
+	case ZIO_TYPE_IOCTL:
+	case ZIO_TYPE_TRIM:
+		/*
+		 * The physical children are flushed and trimmed as part
+		 * of their own vdev tree.
+		 */
+		zio_execute(zio);
+		return;
+	default:
+		break;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
+
+	if (tvd == NULL) {
+		zio->io_error = SET_ERROR(ENXIO);
+		zio_execute(zio);
+		return;
+	}
+
+	/*
+	 * Label writes are discarded and label reads return zeros.
+	 */
+	if (zio->io_offset < VDEV_LABEL_START_SIZE ||
+	    zio->io_offset >= vd->vdev_psize - VDEV_LABEL_END_SIZE) {
+		if (zio->io_type == ZIO_TYPE_READ)
+			abd_zero(zio->io_abd, zio->io_size);
+		zio_execute(zio);
+		return;
+	}
+
+	vdev_draid_config_t *vdc = tvd->vdev_tsd;
+	uint64_t slicesz = vdev_draid_slice_size(tvd);
+	uint64_t offset = zio->io_offset - VDEV_LABEL_START_SIZE;
+
+	for (uint64_t done = 0; done < zio->io_size; ) {
+		uint64_t off = offset + done;
+		uint64_t slice = off / slicesz;
+		uint64_t size = MIN(zio->io_size - done,
+		    (slice + 1) * slicesz - off);
+		uint64_t devidx =
+		    vdev_draid_perm(vdc, slice)[vdc->vdc_ndisks +
+		    vds->vds_spare_id];
+
+		zio_nowait(zio_vdev_child_io(zio, NULL,
+		    tvd->vdev_child[devidx], off,
+		    abd_get_offset_size(zio->io_abd, done, size), size,
+		    zio->io_type, zio->io_priority, 0,
+		    vdev_draid_spare_child_done, zio));
+
+		done += size;
+	}
+
+	zio_execute(zio);
+}
+
+/* ARGSUSED */
+static void
+vdev_draid_spare_io_done(zio_t *zio)
+{
+}
+
+vdev_ops_t vdev_draid_spare_ops = {
+	.vdev_op_open = vdev_draid_spare_open,
+	.vdev_op_close = vdev_draid_spare_close,
+	.vdev_op_asize = vdev_default_asize,
+	.vdev_op_io_start = vdev_draid_spare_io_start,
+	.vdev_op_io_done = vdev_draid_spare_io_done,
+	.vdev_op_state_change = NULL,
+	.vdev_op_need_resilver = NULL,
+	.vdev_op_hold = NULL,
+	.vdev_op_rele = NULL,
+	.vdev_op_remap = NULL,
+	.vdev_op_xlate = vdev_default_xlate,
+	.vdev_op_type = VDEV_TYPE_DRAID_SPARE,	/* name of this vdev type */
+	.vdev_op_leaf = B_TRUE			/* leaf vdev */
+};
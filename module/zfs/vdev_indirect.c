@@ -835,7 +835,10 @@ vdev_indirect_sync_obsolete(vdev_t *vd, dmu_tx_t *tx)
 		ASSERT0(vdev_obsolete_sm_object(vd, &obsolete_sm_object));
 		ASSERT3U(obsolete_sm_object, !=, 0);
 
+		/* Other vdevs may be synced concurrently */
+		mutex_enter(&spa->spa_vdev_sync_lock);
 		spa_feature_incr(spa, SPA_FEATURE_OBSOLETE_COUNTS, tx);
+		mutex_exit(&spa->spa_vdev_sync_lock);
 		VERIFY0(space_map_open(&vd->vdev_obsolete_sm,
 		    spa->spa_meta_objset, obsolete_sm_object,
 		    0, vd->vdev_asize, 0));
@@ -150,6 +150,18 @@ dva_mapping_overlap_compare(const void *v_key, const void *v_array_elem)
 	}
 }
 
+/*
+ * Hash a source offset into the lookup hint table.  Offsets within the
+ * same maximum-sized block share a slot, which matches the largest
+ * extent a single mapping entry will normally cover.
+ */
+static inline uint_t
+vdev_indirect_mapping_hint_slot(uint64_t offset)
+{
+	return (((offset >> SPA_MAXBLOCKSHIFT) * 0x9E3779B97F4A7C15ULL) >>
+	    (64 - VIM_HINT_SHIFT));
+}
+
 /*
  * Returns the mapping entry for the given offset.
  *
@@ -178,6 +190,19 @@ vdev_indirect_mapping_entry_for_offset_impl(vdev_indirect_mapping_t *vim,
 
 	vdev_indirect_mapping_entry_phys_t *entry = NULL;
 
+	/*
+	 * Reads of adjacent blocks tend to land in the same mapping entry,
+	 * so check the hint table before falling back to a binary search
+	 * of the whole table.  An entry that covers the offset is the
+	 * correct answer regardless of next_if_missing.
+	 */
+	uint_t slot = vdev_indirect_mapping_hint_slot(offset);
+	uint64_t hint = vim->vim_hints[slot];
+	if (hint != 0 && hint <= vim->vim_phys->vimp_num_entries &&
+	    dva_mapping_overlap_compare(&offset,
+	    &vim->vim_entries[hint - 1]) == 0)
+		return (&vim->vim_entries[hint - 1]);
+
 	uint64_t last = vim->vim_phys->vimp_num_entries - 1;
 	uint64_t base = 0;
 
@@ -196,6 +221,8 @@ vdev_indirect_mapping_entry_for_offset_impl(vdev_indirect_mapping_t *vim,
 
 		if (result == 0) {
 			entry = &vim->vim_entries[mid];
+			if (mid < UINT32_MAX)
+				vim->vim_hints[slot] = mid + 1;
 			break;
 		} else if (result < 0) {
 			last = mid - 1;
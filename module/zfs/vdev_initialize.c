@@ -27,6 +27,7 @@
 #include <sys/spa_impl.h>
 #include <sys/txg.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
 #include <sys/refcount.h>
 #include <sys/metaslab_impl.h>
 #include <sys/dsl_synctask.h>
@@ -49,6 +50,13 @@ int zfs_initialize_limit = 1;
 /* size of initializing writes; default 1MiB, see zfs_remove_max_segment */
 uint64_t zfs_initialize_chunk_size = 1024 * 1024;
 
+/*
+ * When zfs_initialize_value is zero and the leaf can zero a range itself
+ * (e.g. SCSI WRITE SAME or NVMe Write Zeroes), no data is transferred,
+ * so initialize in much larger requests; default 128MiB.
+ */
+uint64_t zfs_initialize_zeroes_chunk_size = 128 * 1024 * 1024;
+
 static boolean_t
 vdev_initialize_should_stop(vdev_t *vd)
 {
@@ -176,6 +184,14 @@ vdev_initialize_cb(zio_t *zio)
 		if (zio->io_error != 0)
 			vd->vdev_stat.vs_initialize_errors++;
 
+		/*
+		 * A device may advertise write zeroes and still reject
+		 * it, e.g. a SAN LUN behind a mismatched path; write the
+		 * pattern for the remaining ranges instead.
+		 */
+		if (zio->io_error != 0 && zio->io_type == ZIO_TYPE_TRIM)
+			vd->vdev_has_zeroes = B_FALSE;
+
 		vd->vdev_initialize_bytes_done += zio->io_orig_size;
 	}
 	ASSERT3U(vd->vdev_initialize_inflight, >, 0);
@@ -186,7 +202,11 @@ vdev_initialize_cb(zio_t *zio)
 	spa_config_exit(vd->vdev_spa, SCL_STATE_ALL, vd);
 }
 
-/* Takes care of physical writing and limiting # of concurrent ZIOs. */
+/*
+ * Takes care of physical writing and limiting # of concurrent ZIOs.  A
+ * NULL data buffer zeroes the range with the device's write zeroes
+ * command.
+ */
 static int
 vdev_initialize_write(vdev_t *vd, uint64_t start, uint64_t size, abd_t *data)
 {
@@ -235,9 +255,17 @@ vdev_initialize_write(vdev_t *vd, uint64_t start, uint64_t size, abd_t *data)
 	mutex_exit(&vd->vdev_initialize_lock);
 
 	vd->vdev_initialize_offset[txg & TXG_MASK] = start + size;
-	zio_nowait(zio_write_phys(spa->spa_txg_zio[txg & TXG_MASK], vd, start,
-	    size, data, ZIO_CHECKSUM_OFF, vdev_initialize_cb, NULL,
-	    ZIO_PRIORITY_INITIALIZING, ZIO_FLAG_CANFAIL, B_FALSE));
+	if (data == NULL) {
+		zio_nowait(zio_trim(spa->spa_txg_zio[txg & TXG_MASK], vd,
+		    start, size, vdev_initialize_cb, NULL, ZIO_PRIORITY_TRIM,
+		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_AGGREGATE,
+		    ZIO_TRIM_ZEROES));
+	} else {
+		zio_nowait(zio_write_phys(spa->spa_txg_zio[txg & TXG_MASK],
+		    vd, start, size, data, ZIO_CHECKSUM_OFF,
+		    vdev_initialize_cb, NULL, ZIO_PRIORITY_INITIALIZING,
+		    ZIO_FLAG_CANFAIL, B_FALSE));
+	}
 	/* vdev_initialize_cb releases SCL_STATE_ALL */
 
 	dmu_tx_commit(tx);
@@ -289,24 +317,32 @@ vdev_initialize_block_free(abd_t *data)
 static int
 vdev_initialize_ranges(vdev_t *vd, abd_t *data)
 {
-	avl_tree_t *rt = &vd->vdev_initialize_tree->rt_root;
+	zfs_btree_t *bt = &vd->vdev_initialize_tree->rt_root;
+	zfs_btree_index_t idx;
 
-	for (range_seg_t *rs = avl_first(rt); rs != NULL;
-	    rs = AVL_NEXT(rt, rs)) {
+	for (range_seg_t *rs = zfs_btree_first(bt, &idx); rs != NULL;
+	    rs = zfs_btree_next(bt, &idx, &idx)) {
 		uint64_t size = rs->rs_end - rs->rs_start;
 
+		/*
+		 * Re-check per range, the device may have turned out not
+		 * to support write zeroes after all.
+		 */
+		boolean_t zeroes = zfs_initialize_value == 0 &&
+		    vd->vdev_has_zeroes;
+		uint64_t chunk = zeroes ? zfs_initialize_zeroes_chunk_size :
+		    zfs_initialize_chunk_size;
+
 		/* Split range into legally-sized physical chunks */
-		uint64_t writes_required =
-		    ((size - 1) / zfs_initialize_chunk_size) + 1;
+		uint64_t writes_required = ((size - 1) / chunk) + 1;
 
 		for (uint64_t w = 0; w < writes_required; w++) {
 			int error;
 
 			error = vdev_initialize_write(vd,
-			    VDEV_LABEL_START_SIZE + rs->rs_start +
-			    (w * zfs_initialize_chunk_size),
-			    MIN(size - (w * zfs_initialize_chunk_size),
-			    zfs_initialize_chunk_size), data);
+			    VDEV_LABEL_START_SIZE + rs->rs_start + (w * chunk),
+			    MIN(size - (w * chunk), chunk),
+			    zeroes ? NULL : data);
 			if (error != 0)
 				return (error);
 		}
@@ -333,6 +369,8 @@ vdev_initialize_calculate_progress(vdev_t *vd)
 
 		if (vd->vdev_top->vdev_ops == &vdev_raidz_ops)
 			ms_free /= vd->vdev_top->vdev_children;
+		else if (vd->vdev_top->vdev_ops == &vdev_draid_ops)
+			ms_free /= vdev_draid_ndisks(vd->vdev_top);
 
 		/*
 		 * Convert the metaslab range to a physical range
@@ -363,8 +401,10 @@ vdev_initialize_calculate_progress(vdev_t *vd)
 		 */
 		VERIFY0(metaslab_load(msp));
 
-		for (range_seg_t *rs = avl_first(&msp->ms_allocatable->rt_root);
-		    rs; rs = AVL_NEXT(&msp->ms_allocatable->rt_root, rs)) {
+		zfs_btree_t *bt = &msp->ms_allocatable->rt_root;
+		zfs_btree_index_t idx;
+		for (range_seg_t *rs = zfs_btree_first(bt, &idx);
+		    rs != NULL; rs = zfs_btree_next(bt, &idx, &idx)) {
 			logical_rs.rs_start = rs->rs_start;
 			logical_rs.rs_end = rs->rs_end;
 			vdev_xlate(vd, &logical_rs, &physical_rs);
@@ -142,13 +142,17 @@
 #include <sys/zap.h>
 #include <sys/vdev.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_raidz.h>
 #include <sys/uberblock_impl.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
 #include <sys/zio.h>
+#include <sys/zio_checksum.h>
 #include <sys/dsl_scan.h>
 #include <sys/abd.h>
 #include <sys/fs/zfs.h>
+#include <zfs_fletcher.h>
 
 /*
  * Basic routines to read and write from a vdev label.
@@ -313,6 +317,31 @@ vdev_config_generate_stats(vdev_t *vd, nvlist_t *nv)
 	    vsx->vsx_queue_histo[ZIO_PRIORITY_TRIM],
 	    ARRAY_SIZE(vsx->vsx_queue_histo[ZIO_PRIORITY_TRIM]));
 
+	/* Pipeline stage latencies */
+	fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_TASKQ_LAT_HISTO,
+	    vsx->vsx_stage_histo[ZIO_STAGE_CLASS_TASKQ],
+	    ARRAY_SIZE(vsx->vsx_stage_histo[ZIO_STAGE_CLASS_TASKQ]));
+
+	fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_COMPRESS_LAT_HISTO,
+	    vsx->vsx_stage_histo[ZIO_STAGE_CLASS_COMPRESS],
+	    ARRAY_SIZE(vsx->vsx_stage_histo[ZIO_STAGE_CLASS_COMPRESS]));
+
+	fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_ENCRYPT_LAT_HISTO,
+	    vsx->vsx_stage_histo[ZIO_STAGE_CLASS_ENCRYPT],
+	    ARRAY_SIZE(vsx->vsx_stage_histo[ZIO_STAGE_CLASS_ENCRYPT]));
+
+	fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_CHECKSUM_LAT_HISTO,
+	    vsx->vsx_stage_histo[ZIO_STAGE_CLASS_CHECKSUM],
+	    ARRAY_SIZE(vsx->vsx_stage_histo[ZIO_STAGE_CLASS_CHECKSUM]));
+
+	fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_ALLOC_LAT_HISTO,
+	    vsx->vsx_stage_histo[ZIO_STAGE_CLASS_ALLOC],
+	    ARRAY_SIZE(vsx->vsx_stage_histo[ZIO_STAGE_CLASS_ALLOC]));
+
+	fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_DONE_LAT_HISTO,
+	    vsx->vsx_stage_histo[ZIO_STAGE_CLASS_DONE],
+	    ARRAY_SIZE(vsx->vsx_stage_histo[ZIO_STAGE_CLASS_DONE]));
+
 	/* Request sizes */
 	fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_SYNC_IND_R_HISTO,
 	    vsx->vsx_ind_histo[ZIO_PRIORITY_SYNC_READ],
@@ -396,6 +425,13 @@ root_vdev_actions_getprogress(vdev_t *vd, nvlist_t *nvl)
 		    sizeof (prs) / sizeof (uint64_t));
 	}
 
+	pool_raidz_expand_stat_t pres;
+	if (spa_raidz_expand_get_stats(spa, &pres) == 0) {
+		fnvlist_add_uint64_array(nvl,
+		    ZPOOL_CONFIG_RAIDZ_EXPAND_STATS, (uint64_t *)&pres,
+		    sizeof (pres) / sizeof (uint64_t));
+	}
+
 	pool_checkpoint_stat_t pcs;
 	if (spa_checkpoint_get_stats(spa, &pcs) == 0) {
 		fnvlist_add_uint64_array(nvl,
@@ -439,8 +475,8 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		fnvlist_add_string(nv, ZPOOL_CONFIG_FRU, vd->vdev_fru);
 
 	if (vd->vdev_nparity != 0) {
-		ASSERT(strcmp(vd->vdev_ops->vdev_op_type,
-		    VDEV_TYPE_RAIDZ) == 0);
+		ASSERT(vd->vdev_ops == &vdev_raidz_ops ||
+		    vd->vdev_ops == &vdev_draid_ops);
 
 		/*
 		 * Make sure someone hasn't managed to sneak a fancy new vdev
@@ -460,6 +496,11 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_NPARITY, vd->vdev_nparity);
 	}
 
+	if (vd->vdev_ops == &vdev_draid_ops)
+		vdev_draid_config_generate(vd, nv);
+	else if (vd->vdev_ops == &vdev_raidz_ops)
+		vdev_raidz_config_generate(vd, nv);
+
 	if (vd->vdev_wholedisk != -1ULL)
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_WHOLE_DISK,
 		    vd->vdev_wholedisk);
@@ -574,6 +615,18 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 			    vdev_indirect_mapping_size(vim));
 		}
 		rw_exit(&vd->vdev_indirect_rwlock);
+
+		if (vd == vd->vdev_top) {
+			vdev_rebuild_stat_t vrs;
+
+			if (vdev_rebuild_get_stats(vd, &vrs) == 0) {
+				fnvlist_add_uint64_array(nv,
+				    ZPOOL_CONFIG_REBUILD_STATS,
+				    (uint64_t *)&vrs, sizeof (vrs) /
+				    sizeof (uint64_t));
+			}
+		}
+
 		if (vd->vdev_mg != NULL &&
 		    vd->vdev_mg->mg_fragmentation != ZFS_FRAG_INVALID) {
 			/*
@@ -663,6 +716,9 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		if (vd->vdev_resilver_txg != 0)
 			fnvlist_add_uint64(nv, ZPOOL_CONFIG_RESILVER_TXG,
 			    vd->vdev_resilver_txg);
+		if (vd->vdev_rebuild_txg != 0)
+			fnvlist_add_uint64(nv, ZPOOL_CONFIG_REBUILD_TXG,
+			    vd->vdev_rebuild_txg);
 		if (vd->vdev_faulted)
 			fnvlist_add_uint64(nv, ZPOOL_CONFIG_FAULTED, B_TRUE);
 		if (vd->vdev_degraded)
@@ -765,6 +821,12 @@ vdev_label_read_config(vdev_t *vd, uint64_t txg)
 	if (!vdev_readable(vd))
 		return (NULL);
 
+	/*
+	 * Distributed spares have no on-disk label.
+	 */
+	if (vd->vdev_ops == &vdev_draid_spare_ops)
+		return (vdev_draid_read_config_spare(vd));
+
 	vp_abd = abd_alloc_linear(sizeof (vdev_phys_t), B_TRUE);
 	vp = abd_to_buf(vp_abd);
 
@@ -969,6 +1031,8 @@ vdev_label_init(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason)
 
 	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
 
+	vd->vdev_label_txg = 0;
+
 	for (int c = 0; c < vd->vdev_children; c++)
 		if ((error = vdev_label_init(vd->vdev_child[c],
 		    crtxg, reason)) != 0)
@@ -1234,36 +1298,87 @@ struct ubl_cbdata {
 	vdev_t		*ubl_vd;	/* vdev associated with the above */
 };
 
+static void
+vdev_uberblock_load_found(zio_t *rio, vdev_t *vd, uberblock_t *ub)
+{
+	spa_t *spa = rio->io_spa;
+	struct ubl_cbdata *cbp = rio->io_private;
+
+	mutex_enter(&rio->io_lock);
+	if (ub->ub_txg <= spa->spa_load_max_txg &&
+	    vdev_uberblock_compare(ub, cbp->ubl_ubbest) > 0) {
+		/*
+		 * Keep track of the vdev in which this uberblock
+		 * was found. We will use this information later
+		 * to obtain the config nvlist associated with
+		 * this uberblock.
+		 */
+		*cbp->ubl_ubbest = *ub;
+		cbp->ubl_vd = vd;
+	}
+	mutex_exit(&rio->io_lock);
+}
+
 static void
 vdev_uberblock_load_done(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
-	spa_t *spa = zio->io_spa;
 	zio_t *rio = zio->io_private;
 	uberblock_t *ub = abd_to_buf(zio->io_abd);
-	struct ubl_cbdata *cbp = rio->io_private;
 
 	ASSERT3U(zio->io_size, ==, VDEV_UBERBLOCK_SIZE(vd));
 
-	if (zio->io_error == 0 && uberblock_verify(ub) == 0) {
-		mutex_enter(&rio->io_lock);
-		if (ub->ub_txg <= spa->spa_load_max_txg &&
-		    vdev_uberblock_compare(ub, cbp->ubl_ubbest) > 0) {
-			/*
-			 * Keep track of the vdev in which this uberblock
-			 * was found. We will use this information later
-			 * to obtain the config nvlist associated with
-			 * this uberblock.
-			 */
-			*cbp->ubl_ubbest = *ub;
-			cbp->ubl_vd = vd;
+	if (zio->io_error == 0 && uberblock_verify(ub) == 0)
+		vdev_uberblock_load_found(rio, vd, ub);
+
+	abd_free(zio->io_abd);
+}
+
+/*
+ * The whole uberblock ring of a label has been read.  The ring carries no
+ * checksum of its own, so each slot's label checksum is verified here.  If
+ * the read failed, say on a single bad sector, fall back to reading the
+ * slots one by one so that the good ones are still found.
+ */
+static void
+vdev_uberblock_load_ring_done(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	spa_t *spa = zio->io_spa;
+	zio_t *rio = zio->io_private;
+	uint64_t size = VDEV_UBERBLOCK_SIZE(vd);
+
+	ASSERT3U(zio->io_size, ==, VDEV_UBERBLOCK_RING);
+
+	for (int n = 0; n < VDEV_UBERBLOCK_COUNT(vd); n++) {
+		uint64_t offset = zio->io_offset + n * size;
+
+		if (zio->io_error != 0) {
+			zio_nowait(zio_read_phys(rio, vd, offset, size,
+			    abd_alloc_linear(size, B_TRUE), ZIO_CHECKSUM_LABEL,
+			    vdev_uberblock_load_done, rio,
+			    ZIO_PRIORITY_SYNC_READ, rio->io_orig_flags,
+			    B_TRUE));
+			continue;
 		}
-		mutex_exit(&rio->io_lock);
+
+		abd_t *abd = abd_get_offset_size(zio->io_abd, n * size, size);
+		uberblock_t *ub = abd_to_buf(abd);
+
+		if (zio_checksum_error_impl(spa, NULL, ZIO_CHECKSUM_LABEL,
+		    abd, size, offset, NULL) == 0 && uberblock_verify(ub) == 0)
+			vdev_uberblock_load_found(rio, vd, ub);
+		abd_put(abd);
 	}
 
 	abd_free(zio->io_abd);
 }
 
+/*
+ * Each label's uberblock ring is read with a single I/O rather than one per
+ * slot, so that importing a pool issues VDEV_LABELS reads per leaf vdev
+ * instead of VDEV_LABELS * VDEV_UBERBLOCK_COUNT.
+ */
 static void
 vdev_uberblock_load_impl(zio_t *zio, vdev_t *vd, int flags,
     struct ubl_cbdata *cbp)
@@ -1273,13 +1388,12 @@ vdev_uberblock_load_impl(zio_t *zio, vdev_t *vd, int flags,
 
 	if (vd->vdev_ops->vdev_op_leaf && vdev_readable(vd)) {
 		for (int l = 0; l < VDEV_LABELS; l++) {
-			for (int n = 0; n < VDEV_UBERBLOCK_COUNT(vd); n++) {
-				vdev_label_read(zio, vd, l,
-				    abd_alloc_linear(VDEV_UBERBLOCK_SIZE(vd),
-				    B_TRUE), VDEV_UBERBLOCK_OFFSET(vd, n),
-				    VDEV_UBERBLOCK_SIZE(vd),
-				    vdev_uberblock_load_done, zio, flags);
-			}
+			zio_nowait(zio_read_phys(zio, vd,
+			    vdev_label_offset(vd->vdev_psize, l,
+			    VDEV_UBERBLOCK_OFFSET(vd, 0)), VDEV_UBERBLOCK_RING,
+			    abd_alloc_linear(VDEV_UBERBLOCK_RING, B_TRUE),
+			    ZIO_CHECKSUM_OFF, vdev_uberblock_load_ring_done,
+			    zio, ZIO_PRIORITY_SYNC_READ, flags, B_TRUE));
 		}
 	}
 }
@@ -1478,8 +1592,15 @@ vdev_uberblock_sync_list(vdev_t **svd, int svdcount, uberblock_t *ub, int flags)
 	return (good_writes >= 1 ? 0 : EIO);
 }
 
+/*
+ * Skip rewriting the labels of leaf vdevs whose config is unchanged apart
+ * from the txg; see vdev_label_sync().
+ */
+int zfs_vdev_label_skip_unchanged = 1;
+
 /*
  * On success, increment the count of good writes for our top-level vdev.
+ * On failure, the labels on this leaf are no longer known to be current.
  */
 static void
 vdev_label_sync_done(zio_t *zio)
@@ -1488,6 +1609,8 @@ vdev_label_sync_done(zio_t *zio)
 
 	if (zio->io_error == 0)
 		atomic_inc_64(good_writes);
+	else
+		zio->io_vd->vdev_label_txg = 0;
 }
 
 /*
@@ -1549,7 +1672,48 @@ vdev_label_sync(zio_t *zio, uint64_t *good_writes,
 	buf = vp->vp_nvlist;
 	buflen = sizeof (vp->vp_nvlist);
 
-	if (!nvlist_pack(label, &buf, &buflen, NV_ENCODE_XDR, KM_SLEEP)) {
+	/*
+	 * A config change dirties every top-level vdev whose config may
+	 * have changed, often all of them, yet most leaves end up with the
+	 * same label as before apart from the txg.  On the even pass the
+	 * label is checksummed with the txg zeroed and, if it matches what
+	 * was last written to all four labels in an earlier txg, neither
+	 * pass rewrites it.  The labels already on disk are as good as new
+	 * ones since the label read path takes the newest label not past
+	 * the txg being loaded.  vdev_label_txg is cleared on any write
+	 * error, when the device is reopened and when it is relabeled.
+	 */
+	if ((l & 1) == 0) {
+		zio_cksum_t zc;
+
+		fnvlist_add_uint64(label, ZPOOL_CONFIG_POOL_TXG, 0);
+		if (nvlist_pack(label, &buf, &buflen, NV_ENCODE_XDR,
+		    KM_SLEEP) == 0) {
+			fletcher_4_native(buf, buflen, NULL, &zc);
+			if (zfs_vdev_label_skip_unchanged &&
+			    vd->vdev_label_txg != 0 &&
+			    vd->vdev_label_txg < txg &&
+			    ZIO_CHECKSUM_EQUAL(zc, vd->vdev_label_cksum)) {
+				vd->vdev_label_skip_txg = txg;
+			} else {
+				vd->vdev_label_cksum = zc;
+				vd->vdev_label_txg = txg;
+				vd->vdev_label_skip_txg = 0;
+			}
+		} else {
+			vd->vdev_label_txg = 0;
+			vd->vdev_label_skip_txg = 0;
+		}
+		fnvlist_add_uint64(label, ZPOOL_CONFIG_POOL_TXG, txg);
+
+		abd_zero(vp_abd, sizeof (vdev_phys_t));
+		buflen = sizeof (vp->vp_nvlist);
+	}
+
+	if (vd->vdev_label_skip_txg == txg) {
+		atomic_inc_64(good_writes);
+	} else if (!nvlist_pack(label, &buf, &buflen, NV_ENCODE_XDR,
+	    KM_SLEEP)) {
 		for (; l < VDEV_LABELS; l += 2) {
 			vdev_label_write(zio, vd, l, vp_abd,
 			    offsetof(vdev_label_t, vl_vdev_phys),
@@ -1778,3 +1942,8 @@ retry:
 	abd_free(pad2);
 	return (error);
 }
+
+#if defined(_KERNEL)
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, label_skip_unchanged, INT, ZMOD_RW,
+	"Skip label writes on leaf vdevs whose config is unchanged");
+#endif
@@ -51,6 +51,12 @@ typedef struct mirror_stats {
 
 	kstat_named_t vdev_mirror_stat_preferred_found;
 	kstat_named_t vdev_mirror_stat_preferred_not_found;
+
+	kstat_named_t vdev_mirror_stat_latency_preferred;
+	kstat_named_t vdev_mirror_stat_latency_probe;
+
+	kstat_named_t vdev_mirror_stat_hedge_issued;
+	kstat_named_t vdev_mirror_stat_hedge_won;
 } mirror_stats_t;
 
 static mirror_stats_t mirror_stats = {
@@ -68,7 +74,14 @@ static mirror_stats_t mirror_stats = {
 	{ "preferred_found",			KSTAT_DATA_UINT64 },
 	/* Preferred child vdev not found or equal load  */
 	{ "preferred_not_found",		KSTAT_DATA_UINT64 },
-
+	/* Child picked over one with a shorter queue (latency aware) */
+	{ "latency_preferred",			KSTAT_DATA_UINT64 },
+	/* Child without a recent latency sample considered (latency aware) */
+	{ "latency_probe",			KSTAT_DATA_UINT64 },
+	/* Second read issued for a slow read (hedged reads) */
+	{ "hedge_issued",			KSTAT_DATA_UINT64 },
+	/* Second read completed first (hedged reads) */
+	{ "hedge_won",				KSTAT_DATA_UINT64 },
 };
 
 #define	MIRROR_STAT(stat)		(mirror_stats.stat.value.ui64)
@@ -105,11 +118,31 @@ typedef struct mirror_child {
 	uint64_t	mc_offset;
 	int		mc_error;
 	int		mc_load;
+	int		mc_queue_load;
 	uint8_t		mc_tried;
 	uint8_t		mc_skipped;
 	uint8_t		mc_speculative;
 } mirror_child_t;
 
+/*
+ * State shared by the reads of a hedged read, see vdev_mirror_hedge_start().
+ * The mirror zio is only referenced while mh_zio is set, that is until the
+ * first read succeeds or all of them failed.
+ */
+typedef struct mirror_hedge {
+	kmutex_t	mh_lock;
+	int		mh_refs;	/* reads in flight and pending timer */
+	int		mh_reads;	/* reads in flight */
+	zio_t		*mh_zio;	/* mirror zio, until released */
+	zio_t		*mh_wait;	/* child holding the mirror zio */
+} mirror_hedge_t;
+
+typedef struct mirror_hedge_read {
+	mirror_hedge_t	*mhr_hedge;
+	int		mhr_child;
+	boolean_t	mhr_hedged;	/* issued by the timer */
+} mirror_hedge_read_t;
+
 typedef struct mirror_map {
 	int		*mm_preferred;
 	int		mm_preferred_cnt;
@@ -140,6 +173,30 @@ int zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
 int zfs_vdev_mirror_non_rotating_inc = 0;
 int zfs_vdev_mirror_non_rotating_seek_inc = 1;
 
+/*
+ * When set, the load of each child is also weighted by the moving average
+ * of its read service time, so that a child which is slower than its
+ * siblings, e.g. because of a firmware or media problem, receives fewer
+ * reads than its queue depth alone would give it.  The average of a child
+ * that was not read from for zfs_vdev_mirror_latency_expire_ms is
+ * forgotten, so that it is probed again and can recover its share.
+ */
+int zfs_vdev_mirror_latency_aware = 0;
+int zfs_vdev_mirror_latency_expire_ms = 1000;
+
+/*
+ * When set, a synchronous read of a mirror child which has not completed
+ * after its usual service time, estimated as the moving average plus
+ * zfs_vdev_mirror_hedge_dev_mult times the mean deviation and at least
+ * zfs_vdev_mirror_hedge_min_us, is also issued to another child.  The
+ * first read to succeed completes the mirror read; the other one is left
+ * to finish on its own.  This bounds the latency added by a child which
+ * stalls, e.g. during internal housekeeping, at the cost of extra reads.
+ */
+int zfs_vdev_mirror_hedge_enabled = 0;
+int zfs_vdev_mirror_hedge_dev_mult = 4;
+int zfs_vdev_mirror_hedge_min_us = 10000;
+
 static inline size_t
 vdev_mirror_map_size(int children)
 {
@@ -403,11 +460,52 @@ vdev_mirror_close(vdev_t *vd)
 		vdev_close(vd->vdev_child[c]);
 }
 
+/*
+ * Records the service time of a successful read of a child in its moving
+ * average.  The average is only advisory, so it is updated without locking.
+ */
+static void
+vdev_mirror_latency_update(vdev_t *vd, hrtime_t latency)
+{
+	hrtime_t now = gethrtime();
+
+	if (vd->vdev_mirror_latency == 0 || now - vd->vdev_mirror_sampled >
+	    MSEC2NSEC(zfs_vdev_mirror_latency_expire_ms)) {
+		vd->vdev_mirror_latency = latency;
+		vd->vdev_mirror_latency_dev = latency / 2;
+	} else {
+		hrtime_t err = latency - vd->vdev_mirror_latency;
+
+		vd->vdev_mirror_latency += err / 8;
+		vd->vdev_mirror_latency_dev +=
+		    (ABS(err) - vd->vdev_mirror_latency_dev) / 4;
+	}
+	vd->vdev_mirror_sampled = now;
+}
+
+/*
+ * Returns the moving average read service time of a child, or 0 if it has
+ * no recent sample.
+ */
+static hrtime_t
+vdev_mirror_latency(vdev_t *vd, hrtime_t now)
+{
+	if (now - vd->vdev_mirror_sampled >
+	    MSEC2NSEC(zfs_vdev_mirror_latency_expire_ms))
+		return (0);
+
+	return (vd->vdev_mirror_latency);
+}
+
 static void
 vdev_mirror_child_done(zio_t *zio)
 {
 	mirror_child_t *mc = zio->io_private;
 
+	if (zio->io_type == ZIO_TYPE_READ && zio->io_error == 0 &&
+	    zio->io_delay != 0)
+		vdev_mirror_latency_update(mc->mc_vd, zio->io_delay);
+
 	mc->mc_error = zio->io_error;
 	mc->mc_tried = 1;
 	mc->mc_skipped = 0;
@@ -484,6 +582,49 @@ vdev_mirror_preferred_child_randomize(zio_t *zio)
 	return (mm->mm_preferred[p]);
 }
 
+/*
+ * Returns the lowest recent read service time of the children which may
+ * still be tried, which children without a recent sample are assumed to
+ * have.  They thus get probed with their share of reads, instead of all of
+ * them until the first sample comes back.
+ */
+static hrtime_t
+vdev_mirror_latency_floor(mirror_map_t *mm, hrtime_t now)
+{
+	hrtime_t floor = 0, latency;
+
+	for (int c = 0; c < mm->mm_children; c++) {
+		mirror_child_t *mc = &mm->mm_child[c];
+
+		if (mc->mc_tried || mc->mc_skipped || mc->mc_vd == NULL)
+			continue;
+
+		latency = vdev_mirror_latency(mc->mc_vd, now);
+		if (latency != 0 && (floor == 0 || latency < floor))
+			floor = latency;
+	}
+
+	return (floor);
+}
+
+/*
+ * Weights the queue based load of a child by its read service time, in
+ * microseconds, giving an estimate of how long a read would take on it.
+ */
+static int
+vdev_mirror_latency_load(mirror_child_t *mc, hrtime_t floor, hrtime_t now)
+{
+	hrtime_t latency = vdev_mirror_latency(mc->mc_vd, now);
+
+	if (latency == 0) {
+		MIRROR_BUMP(vdev_mirror_stat_latency_probe);
+		latency = floor;
+	}
+	latency = MAX(NSEC2USEC(latency), 1);
+
+	return (MIN((uint64_t)(mc->mc_queue_load + 1) * latency, INT_MAX - 1));
+}
+
 /*
  * Try to find a vdev whose DTL doesn't contain the block we want to read
  * prefering vdevs based on determined load.
@@ -496,11 +637,20 @@ vdev_mirror_child_select(zio_t *zio)
 {
 	mirror_map_t *mm = zio->io_vsd;
 	uint64_t txg = zio->io_txg;
-	int c, lowest_load;
+	boolean_t latency_aware = zfs_vdev_mirror_latency_aware &&
+	    !mm->mm_root;
+	hrtime_t now = 0, floor = 0;
+	int c, lowest_load, lowest_queue_load;
 
 	ASSERT(zio->io_bp == NULL || BP_PHYSICAL_BIRTH(zio->io_bp) == txg);
 
+	if (latency_aware) {
+		now = gethrtime();
+		floor = vdev_mirror_latency_floor(mm, now);
+	}
+
 	lowest_load = INT_MAX;
+	lowest_queue_load = INT_MAX;
 	mm->mm_preferred_cnt = 0;
 	for (c = 0; c < mm->mm_children; c++) {
 		mirror_child_t *mc;
@@ -524,6 +674,12 @@ vdev_mirror_child_select(zio_t *zio)
 		}
 
 		mc->mc_load = vdev_mirror_load(mm, mc->mc_vd, mc->mc_offset);
+		if (latency_aware) {
+			mc->mc_queue_load = mc->mc_load;
+			lowest_queue_load = MIN(lowest_queue_load,
+			    mc->mc_queue_load);
+			mc->mc_load = vdev_mirror_latency_load(mc, floor, now);
+		}
 		if (mc->mc_load > lowest_load)
 			continue;
 
@@ -537,12 +693,19 @@ vdev_mirror_child_select(zio_t *zio)
 
 	if (mm->mm_preferred_cnt == 1) {
 		MIRROR_BUMP(vdev_mirror_stat_preferred_found);
-		return (mm->mm_preferred[0]);
+		c = mm->mm_preferred[0];
+	} else if (mm->mm_preferred_cnt > 1) {
+		MIRROR_BUMP(vdev_mirror_stat_preferred_not_found);
+		c = vdev_mirror_preferred_child_randomize(zio);
+	} else {
+		c = -1;
 	}
 
-	if (mm->mm_preferred_cnt > 1) {
-		MIRROR_BUMP(vdev_mirror_stat_preferred_not_found);
-		return (vdev_mirror_preferred_child_randomize(zio));
+	if (c != -1) {
+		if (latency_aware &&
+		    mm->mm_child[c].mc_queue_load > lowest_queue_load)
+			MIRROR_BUMP(vdev_mirror_stat_latency_preferred);
+		return (c);
 	}
 
 	/*
@@ -560,6 +723,219 @@ vdev_mirror_child_select(zio_t *zio)
 	return (-1);
 }
 
+static void
+vdev_mirror_hedge_rele(mirror_hedge_t *mh)
+{
+	mutex_enter(&mh->mh_lock);
+	if (--mh->mh_refs > 0) {
+		mutex_exit(&mh->mh_lock);
+		return;
+	}
+	mutex_exit(&mh->mh_lock);
+
+	mutex_destroy(&mh->mh_lock);
+	kmem_free(mh, sizeof (mirror_hedge_t));
+}
+
+/*
+ * Completes one of the reads of a hedged read.  The first successful read
+ * copies its data to the mirror zio and releases it, as does the last read
+ * if all of them failed, in which case vdev_mirror_io_done() retries the
+ * other children as usual.
+ */
+static void
+vdev_mirror_hedge_done(zio_t *zio)
+{
+	mirror_hedge_read_t *mhr = zio->io_private;
+	mirror_hedge_t *mh = mhr->mhr_hedge;
+	zio_t *pio, *wait = NULL;
+
+	if (zio->io_error == 0 && zio->io_delay != 0)
+		vdev_mirror_latency_update(zio->io_vd, zio->io_delay);
+
+	mutex_enter(&mh->mh_lock);
+	mh->mh_reads--;
+	if ((pio = mh->mh_zio) != NULL) {
+		mirror_map_t *mm = pio->io_vsd;
+		mirror_child_t *mc = &mm->mm_child[mhr->mhr_child];
+
+		mc->mc_error = zio->io_error;
+		mc->mc_tried = 1;
+		mc->mc_skipped = 0;
+
+		if (zio->io_error == 0 || mh->mh_reads == 0) {
+			mh->mh_zio = NULL;
+			wait = mh->mh_wait;
+		}
+	}
+	mutex_exit(&mh->mh_lock);
+
+	if (wait != NULL) {
+		if (zio->io_error == 0) {
+			if (mhr->mhr_hedged)
+				MIRROR_BUMP(vdev_mirror_stat_hedge_won);
+			abd_copy(pio->io_abd, zio->io_abd, pio->io_size);
+		}
+		zio_nowait(wait);
+	}
+
+	abd_free(zio->io_abd);
+	kmem_free(mhr, sizeof (mirror_hedge_read_t));
+	vdev_mirror_hedge_rele(mh);
+}
+
+/*
+ * Creates the read of child c of a hedged read into its own buffer.  The
+ * read hangs off a root zio rather than the mirror zio, so that the mirror
+ * zio does not wait for it.  It is returned for the caller to issue, along
+ * with its parents, outside of mh_lock.
+ */
+static zio_t *
+vdev_mirror_hedge_read(mirror_hedge_t *mh, int c, boolean_t hedged)
+{
+	zio_t *zio = mh->mh_zio;
+	mirror_map_t *mm = zio->io_vsd;
+	mirror_child_t *mc = &mm->mm_child[c];
+	mirror_hedge_read_t *mhr;
+	zio_t *root, *pio;
+
+	ASSERT(MUTEX_HELD(&mh->mh_lock));
+
+	mhr = kmem_alloc(sizeof (mirror_hedge_read_t), KM_SLEEP);
+	mhr->mhr_hedge = mh;
+	mhr->mhr_child = c;
+	mhr->mhr_hedged = hedged;
+
+	/* Keep the child from being picked again while the read is pending */
+	mc->mc_skipped = 1;
+	mh->mh_reads++;
+	mh->mh_refs++;
+
+	root = zio_root(zio->io_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	pio = zio_null(root, zio->io_spa, zio->io_vd, NULL, NULL,
+	    zio->io_flags & ZIO_FLAG_VDEV_INHERIT);
+	pio->io_txg = zio->io_txg;
+	pio->io_bookmark = zio->io_bookmark;
+
+	(void) zio_vdev_child_io(pio, zio->io_bp, mc->mc_vd, mc->mc_offset,
+	    abd_alloc_sametype(zio->io_abd, zio->io_size), zio->io_size,
+	    ZIO_TYPE_READ, zio->io_priority, 0, vdev_mirror_hedge_done, mhr);
+
+	return (root);
+}
+
+/*
+ * Issues the reads created by vdev_mirror_hedge_read(), children first.
+ */
+static void
+vdev_mirror_hedge_issue(zio_t *root)
+{
+	zio_t *pio, *cio;
+	zio_link_t *zl = NULL;
+
+	pio = zio_walk_children(root, &zl);
+	zl = NULL;
+	cio = zio_walk_children(pio, &zl);
+
+	zio_nowait(cio);
+	zio_nowait(pio);
+	zio_nowait(root);
+}
+
+/*
+ * Called when the first read of a hedged read did not complete in time:
+ * issues the same read to another child, if there is one left.
+ */
+static void
+vdev_mirror_hedge_fire(void *arg)
+{
+	mirror_hedge_t *mh = arg;
+	zio_t *root = NULL;
+	int c;
+
+	mutex_enter(&mh->mh_lock);
+	if (mh->mh_zio != NULL &&
+	    (c = vdev_mirror_child_select(mh->mh_zio)) != -1) {
+		root = vdev_mirror_hedge_read(mh, c, B_TRUE);
+		MIRROR_BUMP(vdev_mirror_stat_hedge_issued);
+	}
+	mutex_exit(&mh->mh_lock);
+
+	if (root != NULL)
+		vdev_mirror_hedge_issue(root);
+
+	vdev_mirror_hedge_rele(mh);
+}
+
+/*
+ * Returns the time after which a read of the given child is considered
+ * slow enough to be hedged.
+ */
+static hrtime_t
+vdev_mirror_hedge_delay(vdev_t *vd)
+{
+	hrtime_t now = gethrtime();
+	hrtime_t delay = 0;
+
+	if (vdev_mirror_latency(vd, now) != 0) {
+		delay = vd->vdev_mirror_latency +
+		    zfs_vdev_mirror_hedge_dev_mult *
+		    vd->vdev_mirror_latency_dev;
+	}
+
+	return (MAX(delay, USEC2NSEC(zfs_vdev_mirror_hedge_min_us)));
+}
+
+/*
+ * Returns B_TRUE if a read should be hedged: a synchronous, normal read of
+ * a block of a mirror with more than one child.
+ */
+static boolean_t
+vdev_mirror_hedge_wanted(zio_t *zio, mirror_map_t *mm)
+{
+	return (zfs_vdev_mirror_hedge_enabled && !mm->mm_root &&
+	    zio->io_vd->vdev_ops == &vdev_mirror_ops &&
+	    mm->mm_children > 1 && zio->io_bp != NULL &&
+	    zio->io_priority == ZIO_PRIORITY_SYNC_READ &&
+	    !(zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER |
+	    ZIO_FLAG_IO_RETRY)));
+}
+
+/*
+ * Starts a hedged read of child c: the read is issued to it, and a timer
+ * issues it to another child if it is slow.  The mirror zio is held by a
+ * child of its own, which is only issued once a read succeeded or all of
+ * them failed, since a leaf i/o cannot be cancelled.
+ */
+static void
+vdev_mirror_hedge_start(zio_t *zio, int c)
+{
+	mirror_hedge_t *mh;
+	mirror_child_t *mc = &((mirror_map_t *)zio->io_vsd)->mm_child[c];
+	hrtime_t delay = vdev_mirror_hedge_delay(mc->mc_vd);
+	zio_t *root;
+
+	mh = kmem_zalloc(sizeof (mirror_hedge_t), KM_SLEEP);
+	mutex_init(&mh->mh_lock, NULL, MUTEX_DEFAULT, NULL);
+	mh->mh_zio = zio;
+	mh->mh_wait = zio_null(zio, zio->io_spa, zio->io_vd, NULL, NULL, 0);
+
+	/* The reads verify the checksum, as children created for us would */
+	zio->io_pipeline &= ~ZIO_STAGE_CHECKSUM_VERIFY;
+
+	mutex_enter(&mh->mh_lock);
+	root = vdev_mirror_hedge_read(mh, c, B_FALSE);
+	mh->mh_refs++;
+	mutex_exit(&mh->mh_lock);
+
+	if (taskq_dispatch_delay(system_delay_taskq, vdev_mirror_hedge_fire,
+	    mh, TQ_NOSLEEP, ddi_get_lbolt() + MAX(NSEC_TO_TICK(delay), 1)) ==
+	    TASKQID_INVALID)
+		vdev_mirror_hedge_rele(mh);
+
+	vdev_mirror_hedge_issue(root);
+}
+
 static void
 vdev_mirror_io_start(zio_t *zio)
 {
@@ -604,6 +980,12 @@ vdev_mirror_io_start(zio_t *zio)
 		 */
 		c = vdev_mirror_child_select(zio);
 		children = (c >= 0);
+
+		if (children && vdev_mirror_hedge_wanted(zio, mm)) {
+			vdev_mirror_hedge_start(zio, c);
+			zio_execute(zio);
+			return;
+		}
 	} else {
 		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
 
@@ -851,5 +1233,20 @@ ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, non_rotating_inc, UINT, ZMOD
 
 ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, non_rotating_seek_inc, UINT, ZMOD_RW,
 	"Non-rotating media load increment for seeking I/O's");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, latency_aware, INT, ZMOD_RW,
+	"Weight the load of mirror children by their read service time");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, latency_expire_ms, INT, ZMOD_RW,
+	"ms after which the read service time of an unused child is forgotten");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, hedge_enabled, INT, ZMOD_RW,
+	"Reissue slow sync reads to another mirror child");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, hedge_dev_mult, INT, ZMOD_RW,
+	"Mean deviations above the average read time after which to hedge");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, hedge_min_us, INT, ZMOD_RW,
+	"Minimum time in microseconds after which to hedge a read");
 /* END CSTYLED */
 #endif
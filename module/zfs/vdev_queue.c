@@ -117,6 +117,20 @@
  * maximum percentage, this indicates that the rate of incoming data is
  * greater than the rate that the backend storage can handle. In this case, we
  * must further throttle incoming writes (see dmu_tx_delay() for details).
+ *
+ * Deadline Mode
+ *
+ * The limits above are fixed, so on a device that is saturated by a scrub or
+ * a burst of async writes, the latency of synchronous i/os is bounded only by
+ * the depth of the device queue.  When zfs_vdev_deadline_enabled is set, the
+ * I/O scheduler also tracks the moving average latency, from queueing to
+ * completion, of each class with a latency target: the sync read, sync write
+ * and async read classes by default (see zfs_vdev_*_target_us).  Every
+ * VDEV_QUEUE_DEADLINE_INTERVAL, the max_active of the classes without a
+ * target is halved if a class with a target missed it, and is otherwise
+ * raised by VDEV_QUEUE_DEADLINE_STEP percent, back up to its configured
+ * value.  It never drops below the class's min_active, so background work
+ * still makes progress.
  */
 
 /*
@@ -159,6 +173,28 @@ uint32_t zfs_vdev_initializing_max_active = 1;
 uint32_t zfs_vdev_trim_min_active = 1;
 uint32_t zfs_vdev_trim_max_active = 2;
 
+/*
+ * The max_active of removal i/os to the children of the vdev being removed.
+ * The copy reads all come from that one vdev, while its writes are spread
+ * over the remaining ones, so a deeper queue on the source keeps all the
+ * destinations busy.  The source serves no new allocations, so this only
+ * competes with reads of the data not copied yet.
+ */
+uint32_t zfs_vdev_removal_source_max_active = 8;
+
+/*
+ * Latency targets, in microseconds, of the i/o classes when deadline mode
+ * is enabled.  Classes with a zero target are throttled to meet the
+ * targets of the others.
+ */
+int zfs_vdev_deadline_enabled = 0;
+uint32_t zfs_vdev_sync_read_target_us = 10000;
+uint32_t zfs_vdev_sync_write_target_us = 10000;
+uint32_t zfs_vdev_async_read_target_us = 0;
+
+#define	VDEV_QUEUE_DEADLINE_INTERVAL	MSEC2NSEC(10)
+#define	VDEV_QUEUE_DEADLINE_STEP	10
+
 /*
  * When the pool has less than zfs_vdev_async_write_active_min_dirty_percent
  * dirty data, use zfs_vdev_async_write_min_active.  When it has more than
@@ -212,6 +248,96 @@ int zfs_vdev_def_queue_depth = 32;
  */
 int zfs_vdev_aggregate_trim = 0;
 
+/*
+ * On non-rotational vdevs, do not consider synchronous reads and writes
+ * for aggregation.  Such devices gain little from merging the small
+ * latency sensitive i/os of these classes, and skipping the offset tree
+ * makes queueing them an O(1) list operation.  The i/os of the LBA-ordered
+ * classes are still aggregated.
+ */
+int zfs_vdev_nonrot_sync_aggregate = 0;
+
+/*
+ * Number of submission queues, each with its own lock, of the leaf vdevs
+ * created afterwards.  The queue of an i/o to a non-rotational vdev is
+ * selected by the issuing CPU, so that a single fast device can be driven
+ * by many CPUs without all of them contending on one vq_lock.  Rotational
+ * vdevs always use the first queue, to keep i/os in LBA order.
+ *
+ * The class limits (zfs_vdev_*_active) apply to the sum of the queues,
+ * through per-vdev atomic counters of active i/os.  Queues check and then
+ * bump those counters without a common lock, so the limits may be
+ * exceeded by at most one i/o per queue.  A completion first issues from
+ * its own queue, then gives the other queues a chance to use what is left
+ * of the budget, so that no queue is starved.
+ */
+uint_t zfs_vdev_queue_shards = 1;
+
+/*
+ * Aggregate writes without copying their data on the vdevs that support it
+ * (vdev_agg_nocopy).  Such an aggregate has no buffer: the vdev maps the
+ * buffers of the aggregated i/os, its parents, in offset order, and zeros
+ * for the optional ones.
+ */
+int zfs_vdev_aggregate_nocopy = 1;
+
+typedef struct vdev_queue_stats {
+	kstat_named_t vqs_sync_read_ios;
+	kstat_named_t vqs_sync_read_latency;
+	kstat_named_t vqs_sync_write_ios;
+	kstat_named_t vqs_sync_write_latency;
+	kstat_named_t vqs_async_read_ios;
+	kstat_named_t vqs_async_read_latency;
+	kstat_named_t vqs_deadline_missed;
+	kstat_named_t vqs_deadline_met;
+} vdev_queue_stats_t;
+
+/*
+ * Only maintained in deadline mode.  The achieved average latency of a
+ * class, in nanoseconds, is its latency divided by its ios.
+ */
+static vdev_queue_stats_t vdev_queue_stats = {
+	{ "sync_read_ios",			KSTAT_DATA_UINT64 },
+	{ "sync_read_latency",			KSTAT_DATA_UINT64 },
+	{ "sync_write_ios",			KSTAT_DATA_UINT64 },
+	{ "sync_write_latency",			KSTAT_DATA_UINT64 },
+	{ "async_read_ios",			KSTAT_DATA_UINT64 },
+	{ "async_read_latency",			KSTAT_DATA_UINT64 },
+	/* Background classes were throttled */
+	{ "deadline_missed",			KSTAT_DATA_UINT64 },
+	/* Background classes were allowed more i/os */
+	{ "deadline_met",			KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *vdev_queue_ksp;
+
+#define	VDEV_QUEUE_STAT(stat)	(vdev_queue_stats.stat.value.ui64)
+#define	VDEV_QUEUE_INCR(stat, val) \
+	atomic_add_64(&VDEV_QUEUE_STAT(stat), val)
+#define	VDEV_QUEUE_BUMP(stat)	VDEV_QUEUE_INCR(stat, 1)
+
+void
+vdev_queue_stat_init(void)
+{
+	vdev_queue_ksp = kstat_create("zfs", 0, "vdev_queue_stats",
+	    "misc", KSTAT_TYPE_NAMED,
+	    sizeof (vdev_queue_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (vdev_queue_ksp != NULL) {
+		vdev_queue_ksp->ks_data = &vdev_queue_stats;
+		kstat_install(vdev_queue_ksp);
+	}
+}
+
+void
+vdev_queue_stat_fini(void)
+{
+	if (vdev_queue_ksp != NULL) {
+		kstat_delete(vdev_queue_ksp);
+		vdev_queue_ksp = NULL;
+	}
+}
+
 int
 vdev_queue_offset_compare(const void *x1, const void *x2)
 {
@@ -226,10 +352,29 @@ vdev_queue_offset_compare(const void *x1, const void *x2)
 	return (AVL_PCMP(z1, z2));
 }
 
+/*
+ * The synchronous/trim i/o queues are dispatched in FIFO rather than LBA
+ * order.  This provides more consistent latency for these i/os.
+ */
+static inline boolean_t
+vdev_queue_class_fifo(zio_priority_t p)
+{
+	return (p == ZIO_PRIORITY_SYNC_READ || p == ZIO_PRIORITY_SYNC_WRITE ||
+	    p == ZIO_PRIORITY_TRIM);
+}
+
 static inline avl_tree_t *
 vdev_queue_class_tree(vdev_queue_t *vq, zio_priority_t p)
 {
-	return (&vq->vq_class[p].vqc_queued_tree);
+	ASSERT(!vdev_queue_class_fifo(p));
+	return (&vq->vq_class[p].vqc_tree);
+}
+
+static inline list_t *
+vdev_queue_class_list(vdev_queue_t *vq, zio_priority_t p)
+{
+	ASSERT(vdev_queue_class_fifo(p));
+	return (&vq->vq_class[p].vqc_list);
 }
 
 static inline avl_tree_t *
@@ -244,20 +389,6 @@ vdev_queue_type_tree(vdev_queue_t *vq, zio_type_t t)
 		return (&vq->vq_trim_offset_tree);
 }
 
-int
-vdev_queue_timestamp_compare(const void *x1, const void *x2)
-{
-	const zio_t *z1 = (const zio_t *)x1;
-	const zio_t *z2 = (const zio_t *)x2;
-
-	int cmp = AVL_CMP(z1->io_timestamp, z2->io_timestamp);
-
-	if (likely(cmp))
-		return (cmp);
-
-	return (AVL_PCMP(z1, z2));
-}
-
 static int
 vdev_queue_class_min_active(zio_priority_t p)
 {
@@ -290,10 +421,7 @@ vdev_queue_max_async_writes(spa_t *spa)
 	int writes;
 	uint64_t dirty = 0;
 	dsl_pool_t *dp = spa_get_dsl(spa);
-	uint64_t min_bytes = zfs_dirty_data_max *
-	    zfs_vdev_async_write_active_min_dirty_percent / 100;
-	uint64_t max_bytes = zfs_dirty_data_max *
-	    zfs_vdev_async_write_active_max_dirty_percent / 100;
+	uint64_t min_bytes, max_bytes;
 
 	/*
 	 * Async writes may occur before the assignment of the spa's
@@ -310,6 +438,11 @@ vdev_queue_max_async_writes(spa_t *spa)
 	if (spa_has_pending_synctask(spa))
 		return (zfs_vdev_async_write_max_active);
 
+	min_bytes = dsl_pool_dirty_max(dp) *
+	    zfs_vdev_async_write_active_min_dirty_percent / 100;
+	max_bytes = dsl_pool_dirty_max(dp) *
+	    zfs_vdev_async_write_active_max_dirty_percent / 100;
+
 	dirty = dp->dp_dirty_total;
 	if (dirty < min_bytes)
 		return (zfs_vdev_async_write_min_active);
@@ -333,7 +466,7 @@ vdev_queue_max_async_writes(spa_t *spa)
 }
 
 static int
-vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
+vdev_queue_class_max_active_impl(spa_t *spa, zio_priority_t p)
 {
 	switch (p) {
 	case ZIO_PRIORITY_SYNC_READ:
@@ -358,6 +491,130 @@ vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
 	}
 }
 
+static hrtime_t
+vdev_queue_class_target(zio_priority_t p)
+{
+	switch (p) {
+	case ZIO_PRIORITY_SYNC_READ:
+		return (USEC2NSEC(zfs_vdev_sync_read_target_us));
+	case ZIO_PRIORITY_SYNC_WRITE:
+		return (USEC2NSEC(zfs_vdev_sync_write_target_us));
+	case ZIO_PRIORITY_ASYNC_READ:
+		return (USEC2NSEC(zfs_vdev_async_read_target_us));
+	default:
+		return (0);
+	}
+}
+
+static int
+vdev_queue_class_max_active(vdev_queue_t *vq, zio_priority_t p)
+{
+	int max_active, min_active;
+
+	max_active = vdev_queue_class_max_active_impl(vq->vq_vdev->vdev_spa, p);
+	if (p == ZIO_PRIORITY_REMOVAL && vq->vq_vdev->vdev_top->vdev_removing) {
+		max_active = MAX(max_active,
+		    zfs_vdev_removal_source_max_active);
+	}
+	if (!zfs_vdev_deadline_enabled || vdev_queue_class_target(p) != 0)
+		return (max_active);
+
+	min_active = vdev_queue_class_min_active(p);
+	return (MAX(min_active, max_active * vq->vq_deadline_pct / 100));
+}
+
+/*
+ * Accounts the latency of a completed i/o to its class, and throttles or
+ * relaxes the classes without a latency target once per interval, see
+ * "Deadline Mode" above.
+ */
+static void
+vdev_queue_deadline_update(vdev_queue_t *vq, zio_t *zio, hrtime_t now)
+{
+	vdev_queue_class_t *vqc = &vq->vq_class[zio->io_priority];
+	boolean_t missed = B_FALSE;
+	zio_priority_t p;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (vdev_queue_class_target(zio->io_priority) != 0) {
+		hrtime_t delta = zio->io_delta;
+
+		if (vqc->vqc_deadline_ios++ == 0 && vqc->vqc_latency == 0)
+			vqc->vqc_latency = delta;
+		else
+			vqc->vqc_latency += (delta - vqc->vqc_latency) / 8;
+
+		switch (zio->io_priority) {
+		case ZIO_PRIORITY_SYNC_READ:
+			VDEV_QUEUE_BUMP(vqs_sync_read_ios);
+			VDEV_QUEUE_INCR(vqs_sync_read_latency, delta);
+			break;
+		case ZIO_PRIORITY_SYNC_WRITE:
+			VDEV_QUEUE_BUMP(vqs_sync_write_ios);
+			VDEV_QUEUE_INCR(vqs_sync_write_latency, delta);
+			break;
+		case ZIO_PRIORITY_ASYNC_READ:
+			VDEV_QUEUE_BUMP(vqs_async_read_ios);
+			VDEV_QUEUE_INCR(vqs_async_read_latency, delta);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (now - vq->vq_deadline_ts < VDEV_QUEUE_DEADLINE_INTERVAL)
+		return;
+	vq->vq_deadline_ts = now;
+
+	/*
+	 * Only the classes with i/os completed during the interval count, so
+	 * that the stale average of an idle class does not throttle forever.
+	 */
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		hrtime_t target = vdev_queue_class_target(p);
+
+		vqc = &vq->vq_class[p];
+		if (target != 0 && vqc->vqc_deadline_ios != 0 &&
+		    vqc->vqc_latency > target)
+			missed = B_TRUE;
+		vqc->vqc_deadline_ios = 0;
+	}
+
+	if (missed) {
+		vq->vq_deadline_pct /= 2;
+		VDEV_QUEUE_BUMP(vqs_deadline_missed);
+	} else if (vq->vq_deadline_pct < 100) {
+		vq->vq_deadline_pct = MIN(100,
+		    vq->vq_deadline_pct + VDEV_QUEUE_DEADLINE_STEP);
+		VDEV_QUEUE_BUMP(vqs_deadline_met);
+	}
+}
+
+/*
+ * Active i/os of class p, or of all classes, to the vdev of vq.  With a
+ * single queue these are its own counts, maintained under vq_lock.
+ */
+static inline uint32_t
+vdev_queue_class_active(vdev_queue_t *vq, zio_priority_t p)
+{
+	vdev_t *vd = vq->vq_vdev;
+
+	if (vd->vdev_queue_shards == 1)
+		return (vq->vq_class[p].vqc_active);
+	return (vd->vdev_queue_active[p]);
+}
+
+static inline uint32_t
+vdev_queue_active(vdev_queue_t *vq)
+{
+	vdev_t *vd = vq->vq_vdev;
+
+	if (vd->vdev_queue_shards == 1)
+		return (avl_numnodes(&vq->vq_active_tree));
+	return (vd->vdev_queue_active_total);
+}
+
 /*
  * Return the i/o class to issue from, or ZIO_PRIORITY_MAX_QUEUEABLE if
  * there is no eligible class.
@@ -365,16 +622,15 @@ vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
 static zio_priority_t
 vdev_queue_class_to_issue(vdev_queue_t *vq)
 {
-	spa_t *spa = vq->vq_vdev->vdev_spa;
 	zio_priority_t p;
 
-	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
+	if (vdev_queue_active(vq) >= zfs_vdev_max_active)
 		return (ZIO_PRIORITY_NUM_QUEUEABLE);
 
 	/* find a queue that has not reached its minimum # outstanding i/os */
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
-		if (avl_numnodes(vdev_queue_class_tree(vq, p)) > 0 &&
-		    vq->vq_class[p].vqc_active <
+		if (vq->vq_class[p].vqc_queued > 0 &&
+		    vdev_queue_class_active(vq, p) <
 		    vdev_queue_class_min_active(p))
 			return (p);
 	}
@@ -384,9 +640,9 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	 * maximum # outstanding i/os.
 	 */
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
-		if (avl_numnodes(vdev_queue_class_tree(vq, p)) > 0 &&
-		    vq->vq_class[p].vqc_active <
-		    vdev_queue_class_max_active(spa, p))
+		if (vq->vq_class[p].vqc_queued > 0 &&
+		    vdev_queue_class_active(vq, p) <
+		    vdev_queue_class_max_active(vq, p))
 			return (p);
 	}
 
@@ -394,15 +650,14 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	return (ZIO_PRIORITY_NUM_QUEUEABLE);
 }
 
-void
-vdev_queue_init(vdev_t *vd)
+static void
+vdev_queue_init_impl(vdev_t *vd, vdev_queue_t *vq)
 {
-	vdev_queue_t *vq = &vd->vdev_queue;
 	zio_priority_t p;
 
 	mutex_init(&vq->vq_lock, NULL, MUTEX_DEFAULT, NULL);
 	vq->vq_vdev = vd;
-	taskq_init_ent(&vd->vdev_queue.vq_io_search.io_tqent);
+	taskq_init_ent(&vq->vq_io_search.io_tqent);
 
 	avl_create(&vq->vq_active_tree, vdev_queue_offset_compare,
 	    sizeof (zio_t), offsetof(struct zio, io_queue_node));
@@ -417,34 +672,44 @@ vdev_queue_init(vdev_t *vd)
 	    offsetof(struct zio, io_offset_node));
 
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
-		int (*compfn) (const void *, const void *);
-
-		/*
-		 * The synchronous/trim i/o queues are dispatched in FIFO rather
-		 * than LBA order. This provides more consistent latency for
-		 * these i/os.
-		 */
-		if (p == ZIO_PRIORITY_SYNC_READ ||
-		    p == ZIO_PRIORITY_SYNC_WRITE ||
-		    p == ZIO_PRIORITY_TRIM) {
-			compfn = vdev_queue_timestamp_compare;
+		if (vdev_queue_class_fifo(p)) {
+			list_create(vdev_queue_class_list(vq, p),
+			    sizeof (zio_t),
+			    offsetof(struct zio, io_queue_node));
 		} else {
-			compfn = vdev_queue_offset_compare;
+			avl_create(vdev_queue_class_tree(vq, p),
+			    vdev_queue_offset_compare, sizeof (zio_t),
+			    offsetof(struct zio, io_queue_node));
 		}
-		avl_create(vdev_queue_class_tree(vq, p), compfn,
-		    sizeof (zio_t), offsetof(struct zio, io_queue_node));
 	}
 
 	vq->vq_last_offset = 0;
+	vq->vq_deadline_pct = 100;
 }
 
 void
-vdev_queue_fini(vdev_t *vd)
+vdev_queue_init(vdev_t *vd)
 {
-	vdev_queue_t *vq = &vd->vdev_queue;
+	uint_t shards = 1;
 
-	for (zio_priority_t p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
-		avl_destroy(vdev_queue_class_tree(vq, p));
+	if (vd->vdev_ops->vdev_op_leaf)
+		shards = MIN(MAX(zfs_vdev_queue_shards, 1), max_ncpus);
+
+	vd->vdev_queue = kmem_zalloc(shards * sizeof (vdev_queue_t), KM_SLEEP);
+	vd->vdev_queue_shards = shards;
+	for (int q = 0; q < shards; q++)
+		vdev_queue_init_impl(vd, &vd->vdev_queue[q]);
+}
+
+static void
+vdev_queue_fini_impl(vdev_queue_t *vq)
+{
+	for (zio_priority_t p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		if (vdev_queue_class_fifo(p))
+			list_destroy(vdev_queue_class_list(vq, p));
+		else
+			avl_destroy(vdev_queue_class_tree(vq, p));
+	}
 	avl_destroy(&vq->vq_active_tree);
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_READ));
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE));
@@ -453,15 +718,75 @@ vdev_queue_fini(vdev_t *vd)
 	mutex_destroy(&vq->vq_lock);
 }
 
+void
+vdev_queue_fini(vdev_t *vd)
+{
+	for (int q = 0; q < vd->vdev_queue_shards; q++)
+		vdev_queue_fini_impl(&vd->vdev_queue[q]);
+	kmem_free(vd->vdev_queue,
+	    vd->vdev_queue_shards * sizeof (vdev_queue_t));
+	vd->vdev_queue = NULL;
+	vd->vdev_queue_shards = 0;
+}
+
+/*
+ * Returns the queue to submit an i/o to vd from the current CPU.
+ */
+static vdev_queue_t *
+vdev_queue_shard(vdev_t *vd)
+{
+	uint_t q = 0;
+
+	if (vd->vdev_queue_shards > 1 && vd->vdev_nonrot) {
+		kpreempt_disable();
+		q = CPU_SEQID % vd->vdev_queue_shards;
+		kpreempt_enable();
+	}
+	return (&vd->vdev_queue[q]);
+}
+
+static void
+vdev_queue_class_add(vdev_queue_t *vq, zio_t *zio)
+{
+	zio_priority_t p = zio->io_priority;
+
+	ASSERT3U(p, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	if (vdev_queue_class_fifo(p))
+		list_insert_tail(vdev_queue_class_list(vq, p), zio);
+	else
+		avl_add(vdev_queue_class_tree(vq, p), zio);
+	vq->vq_class[p].vqc_queued++;
+}
+
+static void
+vdev_queue_class_remove(vdev_queue_t *vq, zio_t *zio)
+{
+	zio_priority_t p = zio->io_priority;
+
+	ASSERT3U(p, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	ASSERT3U(vq->vq_class[p].vqc_queued, >, 0);
+	if (vdev_queue_class_fifo(p))
+		list_remove(vdev_queue_class_list(vq, p), zio);
+	else
+		avl_remove(vdev_queue_class_tree(vq, p), zio);
+	vq->vq_class[p].vqc_queued--;
+}
+
+/*
+ * Only i/os that can be aggregated are kept in the offset trees, see
+ * vdev_queue_io().
+ */
 static void
 vdev_queue_io_add(vdev_queue_t *vq, zio_t *zio)
 {
 	spa_t *spa = zio->io_spa;
 	spa_history_kstat_t *shk = &spa->spa_stats.io_history;
 
-	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
-	avl_add(vdev_queue_class_tree(vq, zio->io_priority), zio);
-	avl_add(vdev_queue_type_tree(vq, zio->io_type), zio);
+	ASSERT3U(zio->io_queue_state, ==, ZIO_QS_NONE);
+	vdev_queue_class_add(vq, zio);
+	if (!(zio->io_flags & ZIO_FLAG_DONT_AGGREGATE))
+		avl_add(vdev_queue_type_tree(vq, zio->io_type), zio);
+	zio->io_queue_state = ZIO_QS_QUEUED;
 
 	if (shk->kstat != NULL) {
 		mutex_enter(&shk->lock);
@@ -476,9 +801,11 @@ vdev_queue_io_remove(vdev_queue_t *vq, zio_t *zio)
 	spa_t *spa = zio->io_spa;
 	spa_history_kstat_t *shk = &spa->spa_stats.io_history;
 
-	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
-	avl_remove(vdev_queue_class_tree(vq, zio->io_priority), zio);
-	avl_remove(vdev_queue_type_tree(vq, zio->io_type), zio);
+	ASSERT3U(zio->io_queue_state, ==, ZIO_QS_QUEUED);
+	vdev_queue_class_remove(vq, zio);
+	if (!(zio->io_flags & ZIO_FLAG_DONT_AGGREGATE))
+		avl_remove(vdev_queue_type_tree(vq, zio->io_type), zio);
+	zio->io_queue_state = ZIO_QS_NONE;
 
 	if (shk->kstat != NULL) {
 		mutex_enter(&shk->lock);
@@ -497,6 +824,13 @@ vdev_queue_pending_add(vdev_queue_t *vq, zio_t *zio)
 	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
 	vq->vq_class[zio->io_priority].vqc_active++;
 	avl_add(&vq->vq_active_tree, zio);
+	zio->io_queue_state = ZIO_QS_ACTIVE;
+	if (vq->vq_vdev->vdev_queue_shards > 1) {
+		vdev_t *vd = vq->vq_vdev;
+
+		atomic_inc_32(&vd->vdev_queue_active[zio->io_priority]);
+		atomic_inc_32(&vd->vdev_queue_active_total);
+	}
 
 	if (shk->kstat != NULL) {
 		mutex_enter(&shk->lock);
@@ -513,8 +847,16 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 
 	ASSERT(MUTEX_HELD(&vq->vq_lock));
 	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	ASSERT3U(zio->io_queue_state, ==, ZIO_QS_ACTIVE);
 	vq->vq_class[zio->io_priority].vqc_active--;
 	avl_remove(&vq->vq_active_tree, zio);
+	zio->io_queue_state = ZIO_QS_NONE;
+	if (vq->vq_vdev->vdev_queue_shards > 1) {
+		vdev_t *vd = vq->vq_vdev;
+
+		atomic_dec_32(&vd->vdev_queue_active[zio->io_priority]);
+		atomic_dec_32(&vd->vdev_queue_active_total);
+	}
 
 	if (shk->kstat != NULL) {
 		kstat_io_t *ksio = shk->kstat->ks_data;
@@ -535,6 +877,11 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 static void
 vdev_queue_agg_io_done(zio_t *aio)
 {
+	if (aio->io_abd == NULL) {
+		ASSERT3U(aio->io_type, ==, ZIO_TYPE_WRITE);
+		return;
+	}
+
 	if (aio->io_type == ZIO_TYPE_READ) {
 		zio_t *pio;
 		zio_link_t *zl = NULL;
@@ -695,15 +1042,21 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	size = IO_SPAN(first, last);
 	ASSERT3U(size, <=, maxblocksize);
 
-	abd = abd_alloc_for_io(size, B_TRUE);
-	if (abd == NULL)
-		return (NULL);
+	if (zio->io_type == ZIO_TYPE_WRITE && zfs_vdev_aggregate_nocopy &&
+	    vq->vq_vdev->vdev_agg_nocopy) {
+		abd = NULL;
+	} else {
+		abd = abd_alloc_for_io(size, B_TRUE);
+		if (abd == NULL)
+			return (NULL);
+	}
 
 	aio = zio_vdev_delegated_io(first->io_vd, first->io_offset,
 	    abd, size, first->io_type, zio->io_priority,
 	    flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE,
 	    vdev_queue_agg_io_done, NULL);
 	aio->io_timestamp = first->io_timestamp;
+	aio->io_queue_shard = zio->io_queue_shard;
 
 	nio = first;
 	do {
@@ -723,7 +1076,9 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	while ((dio = zio_walk_parents(aio, &zl)) != NULL) {
 		ASSERT3U(dio->io_type, ==, aio->io_type);
 
-		if (dio->io_flags & ZIO_FLAG_NODATA) {
+		if (aio->io_abd == NULL) {
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
+		} else if (dio->io_flags & ZIO_FLAG_NODATA) {
 			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
 			abd_zero_off(aio->io_abd,
 			    dio->io_offset - aio->io_offset, dio->io_size);
@@ -762,15 +1117,19 @@ again:
 	 * For LBA-ordered queues (async / scrub / initializing), issue the
 	 * i/o which follows the most recently issued i/o in LBA (offset) order.
 	 *
-	 * For FIFO queues (sync/trim), issue the i/o with the lowest timestamp.
+	 * For FIFO queues (sync/trim), issue the oldest i/o.
 	 */
-	tree = vdev_queue_class_tree(vq, p);
-	vq->vq_io_search.io_timestamp = 0;
-	vq->vq_io_search.io_offset = vq->vq_last_offset - 1;
-	VERIFY3P(avl_find(tree, &vq->vq_io_search, &idx), ==, NULL);
-	zio = avl_nearest(tree, idx, AVL_AFTER);
-	if (zio == NULL)
-		zio = avl_first(tree);
+	if (vdev_queue_class_fifo(p)) {
+		zio = list_head(vdev_queue_class_list(vq, p));
+	} else {
+		tree = vdev_queue_class_tree(vq, p);
+		vq->vq_io_search.io_timestamp = 0;
+		vq->vq_io_search.io_offset = vq->vq_last_offset - 1;
+		VERIFY3P(avl_find(tree, &vq->vq_io_search, &idx), ==, NULL);
+		zio = avl_nearest(tree, idx, AVL_AFTER);
+		if (zio == NULL)
+			zio = avl_first(tree);
+	}
 	ASSERT3U(zio->io_priority, ==, p);
 
 	aio = vdev_queue_aggregate(vq, zio);
@@ -799,15 +1158,37 @@ again:
 	return (zio);
 }
 
+static boolean_t
+vdev_queue_skip_aggregate(vdev_queue_t *vq, zio_t *zio)
+{
+	uint64_t limit;
+
+	if (vq->vq_vdev->vdev_nonrot) {
+		if (!zfs_vdev_nonrot_sync_aggregate &&
+		    (zio->io_priority == ZIO_PRIORITY_SYNC_READ ||
+		    zio->io_priority == ZIO_PRIORITY_SYNC_WRITE))
+			return (B_TRUE);
+		limit = zfs_vdev_aggregation_limit_non_rotating;
+	} else {
+		limit = zfs_vdev_aggregation_limit;
+	}
+
+	return (!(zio->io_flags & ZIO_FLAG_OPTIONAL) && zio->io_size >= limit);
+}
+
 zio_t *
 vdev_queue_io(zio_t *zio)
 {
-	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
+	vdev_t *vd = zio->io_vd;
+	vdev_queue_t *vq;
 	zio_t *nio;
 
 	if (zio->io_flags & ZIO_FLAG_DONT_QUEUE)
 		return (zio);
 
+	vq = vdev_queue_shard(vd);
+	zio->io_queue_shard = vq - vd->vdev_queue;
+
 	/*
 	 * Children i/os inherent their parent's priority, which might
 	 * not match the child's i/o type.  Fix it up here.
@@ -838,8 +1219,29 @@ vdev_queue_io(zio_t *zio)
 
 	zio->io_flags |= ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE;
 
+	/*
+	 * Keep the i/os that can't be aggregated out of the offset trees:
+	 * mandatory i/os at least as large as the aggregation limit, and
+	 * on non-rotational vdevs the synchronous i/os.
+	 */
+	if (vdev_queue_skip_aggregate(vq, zio))
+		zio->io_flags |= ZIO_FLAG_DONT_AGGREGATE;
+
 	mutex_enter(&vq->vq_lock);
 	zio->io_timestamp = gethrtime();
+
+	/*
+	 * An i/o whose lateness has consequences beyond its own latency,
+	 * such as an MMP write whose absence suspends the pool, is issued
+	 * at once.  It still counts against its class while active.
+	 */
+	if (zio->io_queue_bypass) {
+		zio->io_flags |= ZIO_FLAG_DONT_AGGREGATE;
+		vdev_queue_pending_add(vq, zio);
+		mutex_exit(&vq->vq_lock);
+		return (zio);
+	}
+
 	vdev_queue_io_add(vq, zio);
 	nio = vdev_queue_io_to_issue(vq);
 	mutex_exit(&vq->vq_lock);
@@ -855,19 +1257,15 @@ vdev_queue_io(zio_t *zio)
 	return (nio);
 }
 
-void
-vdev_queue_io_done(zio_t *zio)
+/*
+ * Issues the queued i/os of vq for as long as the class limits allow.
+ */
+static void
+vdev_queue_issue_all(vdev_queue_t *vq)
 {
-	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
 	zio_t *nio;
 
-	mutex_enter(&vq->vq_lock);
-
-	vdev_queue_pending_remove(vq, zio);
-
-	zio->io_delta = gethrtime() - zio->io_timestamp;
-	vq->vq_io_complete_ts = gethrtime();
-	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
@@ -879,15 +1277,70 @@ vdev_queue_io_done(zio_t *zio)
 		}
 		mutex_enter(&vq->vq_lock);
 	}
+}
+
+static boolean_t
+vdev_queue_has_queued(vdev_queue_t *vq)
+{
+	for (zio_priority_t p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		if (vq->vq_class[p].vqc_queued > 0)
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+void
+vdev_queue_io_done(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_queue_t *vq = &vd->vdev_queue[zio->io_queue_shard];
+	zfs_blk_plug_t plug;
+
+	/*
+	 * Everything issued on behalf of this completion, from any of the
+	 * queues, is submitted under one block layer plug where the platform
+	 * has one, and reaches the device as a batch once the locks are gone.
+	 */
+	zfs_blk_start_plug(&plug);
+
+	mutex_enter(&vq->vq_lock);
 
+	vdev_queue_pending_remove(vq, zio);
+
+	zio->io_delta = gethrtime() - zio->io_timestamp;
+	vq->vq_io_complete_ts = gethrtime();
+	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
+
+	if (zfs_vdev_deadline_enabled)
+		vdev_queue_deadline_update(vq, zio, vq->vq_io_complete_ts);
+
+	vdev_queue_issue_all(vq);
 	mutex_exit(&vq->vq_lock);
+
+	/*
+	 * Pass what is left of the class budgets on to the other queues,
+	 * whose i/os may be waiting for the completion of ours.  A queue
+	 * whose lock is held is issuing anyway.
+	 */
+	for (int q = 1; q < vd->vdev_queue_shards; q++) {
+		vdev_queue_t *oq = &vd->vdev_queue[(zio->io_queue_shard + q) %
+		    vd->vdev_queue_shards];
+
+		if (vdev_queue_active(oq) >= zfs_vdev_max_active)
+			break;
+		if (!vdev_queue_has_queued(oq) || !mutex_tryenter(&oq->vq_lock))
+			continue;
+		vdev_queue_issue_all(oq);
+		mutex_exit(&oq->vq_lock);
+	}
+
+	zfs_blk_finish_plug(&plug);
 }
 
 void
 vdev_queue_change_io_priority(zio_t *zio, zio_priority_t priority)
 {
-	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
-	avl_tree_t *tree;
+	vdev_queue_t *vq = &zio->io_vd->vdev_queue[zio->io_queue_shard];
 
 	/*
 	 * ZIO_PRIORITY_NOW is used by the vdev cache code and the aggregate zio
@@ -922,12 +1375,11 @@ vdev_queue_change_io_priority(zio_t *zio, zio_priority_t priority)
 	 * Otherwise, the zio is currently active and we cannot change its
 	 * priority.
 	 */
-	tree = vdev_queue_class_tree(vq, zio->io_priority);
-	if (avl_find(tree, zio, NULL) == zio) {
-		avl_remove(vdev_queue_class_tree(vq, zio->io_priority), zio);
+	if (zio->io_queue_state == ZIO_QS_QUEUED) {
+		vdev_queue_class_remove(vq, zio);
 		zio->io_priority = priority;
-		avl_add(vdev_queue_class_tree(vq, zio->io_priority), zio);
-	} else if (avl_find(&vq->vq_active_tree, zio, NULL) != zio) {
+		vdev_queue_class_add(vq, zio);
+	} else if (zio->io_queue_state == ZIO_QS_NONE) {
 		zio->io_priority = priority;
 	}
 
@@ -943,13 +1395,36 @@ vdev_queue_change_io_priority(zio_t *zio, zio_priority_t priority)
 int
 vdev_queue_length(vdev_t *vd)
 {
-	return (avl_numnodes(&vd->vdev_queue.vq_active_tree));
+	if (vd->vdev_queue_shards == 1)
+		return (avl_numnodes(&vd->vdev_queue->vq_active_tree));
+	return (vd->vdev_queue_active_total);
 }
 
 uint64_t
 vdev_queue_last_offset(vdev_t *vd)
 {
-	return (vd->vdev_queue.vq_last_offset);
+	return (vdev_queue_shard(vd)->vq_last_offset);
+}
+
+/*
+ * Returns B_TRUE while the classes without a latency target are throttled
+ * on vd because a target was recently missed, see "Deadline Mode" above.
+ * Background work which floods the queue in bursts, like automatic TRIM,
+ * holds off its submissions meanwhile.  Read without vq_lock, since a stale
+ * value only shifts the backoff by an interval.
+ */
+boolean_t
+vdev_queue_throttled(vdev_t *vd)
+{
+	if (!zfs_vdev_deadline_enabled)
+		return (B_FALSE);
+
+	for (uint_t q = 0; q < vd->vdev_queue_shards; q++) {
+		if (vd->vdev_queue[q].vq_deadline_pct < 100)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
 }
 
 #if defined(_KERNEL)
@@ -962,6 +1437,9 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, aggregation_limit_non_rotating, UINT,
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, aggregate_trim, UINT, ZMOD_RW,
 	"Allow TRIM I/O to be aggregated");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, aggregate_nocopy, INT, ZMOD_RW,
+	"Aggregate writes without copying their data when supported");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, read_gap_limit, UINT, ZMOD_RW,
 	"Aggregate read I/O over gap");
 
@@ -971,6 +1449,9 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, write_gap_limit, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, max_active, UINT, ZMOD_RW,
 	"Maximum number of active I/Os per vdev");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, nonrot_sync_aggregate, INT, ZMOD_RW,
+	"Aggregate sync I/O on non-rotational vdevs");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, async_write_active_max_dirty_percent,
 	UINT, ZMOD_RW, "Async write concurrency max threshold");
 
@@ -983,12 +1464,18 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, async_read_max_active, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, async_read_min_active, UINT, ZMOD_RW,
 	"Min active async read I/Os per vdev");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, async_read_target_us, UINT, ZMOD_RW,
+	"Async read latency target in deadline mode");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, async_write_max_active, UINT, ZMOD_RW,
 	"Max active async write I/Os per vdev");
 
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, async_write_min_active, UINT, ZMOD_RW,
 	"Min active async write I/Os per vdev");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, deadline_enabled, INT, ZMOD_RW,
+	"Throttle background I/O to meet per-class latency targets");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, initializing_max_active, UINT, ZMOD_RW,
 	"Max active initializing I/Os per vdev");
 
@@ -998,6 +1485,9 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, initializing_min_active, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, removal_max_active, UINT, ZMOD_RW,
 	"Max active removal I/Os per vdev");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, removal_source_max_active, UINT,
+	ZMOD_RW, "Max removal I/Os active to the device being removed");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, removal_min_active, UINT, ZMOD_RW,
 	"Min active removal I/Os per vdev");
 
@@ -1013,12 +1503,18 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_read_max_active, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_read_min_active, UINT, ZMOD_RW,
 	"Min active sync read I/Os per vdev");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_read_target_us, UINT, ZMOD_RW,
+	"Sync read latency target in deadline mode");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_write_max_active, UINT, ZMOD_RW,
 	"Max active sync write I/Os per vdev");
 
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_write_min_active, UINT, ZMOD_RW,
 	"Min active sync write I/Os per vdev");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_write_target_us, UINT, ZMOD_RW,
+	"Sync write latency target in deadline mode");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, trim_max_active, UINT, ZMOD_RW,
 	"Max active trim/discard I/Os per vdev");
 
@@ -1027,4 +1523,7 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, trim_min_active, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, queue_depth_pct, UINT, ZMOD_RW,
 	"Queue depth percentage for each top-level vdev");
+
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, queue_shards, UINT, ZMOD_RW,
+	"Number of I/O submission queues per leaf vdev");
 #endif
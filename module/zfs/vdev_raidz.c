@@ -27,10 +27,18 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
+#include <sys/spa_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <zfs_fletcher.h>
 #include <sys/abd.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_synctask.h>
+#include <sys/metaslab_impl.h>
+#include <sys/zap.h>
+#include <sys/zfeature.h>
 #include <sys/fs/zfs.h>
 #include <sys/fm/fs/zfs.h>
 #include <sys/vdev_raidz.h>
@@ -134,11 +142,100 @@
 	VDEV_RAIDZ_64MUL_2((x), mask); \
 }
 
+/*
+ * RAID-Z expansion.
+ *
+ * A raidz vdev is expanded by attaching a new child to it.  The child is
+ * added to the vdev right away, but the sectors of the vdev are only spread
+ * over it by the reflow thread, vdev_raidz_expand_thread().  It copies the
+ * allocated sectors in offset order from their location with the old
+ * stripe width to their location with the new one.  Sector x of a vdev
+ * of width w is on child x % w, at offset (x / w) << ashift.
+ *
+ * Blocks keep the stripe width, and thus the parity overhead, they were
+ * written with; only their sectors move.  When the width a block was
+ * written with differs from the width its sectors are laid out with,
+ * vdev_raidz_io_start() issues the I/O one row of the block at a time,
+ * each sector at its actual location.  The width of new blocks is that of
+ * the vdev once the expansion completed, see vd_expand_txgs.
+ *
+ * Writing a sector to its new location overwrites the old location of a
+ * lower sector.  Should the system crash, the reflow resumes from the
+ * offset recorded in the last synced uberblock, re-reading the sectors
+ * above it from their old location.  The reflow therefore never moves a
+ * sector onto the old location of a sector which was not reflowed as of
+ * the last synced txg, and writes to sectors which were reflowed after it
+ * go to both their old and new locations.
+ */
+
+/*
+ * Maximum amount of data reflowed at once.  Other I/O to the sectors
+ * being reflowed waits for it to complete.
+ */
+unsigned long zfs_raidz_expand_max_copy_bytes = 16 * 1024 * 1024;
+
+/*
+ * For testing, pause the reflow once this many bytes have been reflowed.
+ */
+unsigned long zfs_raidz_expand_max_reflow_bytes = 0;
+
+/*
+ * Returns the stripe width of the blocks born in the given txg.  Blocks
+ * born in txg 0, which stands for no particular txg, have the width the
+ * vdev was created with.
+ */
+static uint64_t
+vdev_raidz_logical_width(vdev_raidz_t *vdrz, uint64_t txg)
+{
+	uint64_t width = vdrz->vd_original_width;
+
+	if (vdrz->vd_nexpand == 0)
+		return (width);
+
+	rw_enter(&vdrz->vd_expand_lock, RW_READER);
+	for (uint64_t i = 0; i < vdrz->vd_nexpand; i++) {
+		if (txg < vdrz->vd_expand_txgs[2 * i])
+			break;
+		width = vdrz->vd_expand_txgs[2 * i + 1];
+	}
+	rw_exit(&vdrz->vd_expand_lock);
+
+	return (width);
+}
+
+/*
+ * Returns the number of children the space of the vdev is spread over,
+ * which excludes the child being attached by an expansion in progress.
+ */
+uint64_t
+vdev_raidz_asize_width(vdev_t *vd)
+{
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_raidz_ops);
+
+	return (vd->vdev_children - (vdrz->vd_expanding ? 1 : 0));
+}
+
 void
 vdev_raidz_map_free(raidz_map_t *rm)
 {
 	int c;
 
+	for (uint64_t r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = rm->rm_row[r];
+
+		for (c = 0; c < rr->rm_cols; c++) {
+			if (rr->rm_col[c].rc_devidx == UINT64_MAX)
+				abd_free(rr->rm_col[c].rc_abd);
+			else
+				abd_put(rr->rm_col[c].rc_abd);
+		}
+		kmem_free(rr, offsetof(raidz_map_t, rm_col[rr->rm_scols]));
+	}
+	if (rm->rm_row != NULL)
+		kmem_free(rm->rm_row, rm->rm_nrows * sizeof (raidz_map_t *));
+
 	for (c = 0; c < rm->rm_firstdatacol; c++) {
 		abd_free(rm->rm_col[c].rc_abd);
 
@@ -163,6 +260,11 @@ vdev_raidz_map_free_vsd(zio_t *zio)
 	ASSERT0(rm->rm_freed);
 	rm->rm_freed = 1;
 
+	if (rm->rm_lr != NULL) {
+		rangelock_exit(rm->rm_lr);
+		rm->rm_lr = NULL;
+	}
+
 	if (rm->rm_reports == 0)
 		vdev_raidz_map_free(rm);
 }
@@ -328,18 +430,21 @@ static const zio_vsd_ops_t vdev_raidz_vsd_ops = {
 
 /*
  * Divides the IO evenly across all child vdevs; usually, dcols is
- * the number of children in the target vdev.
+ * the number of children in the target vdev.  The layout is computed as
+ * if the I/O started at the given offset rather than zio->io_offset; dRAID
+ * uses this to lay a block out within one of its redundancy groups.
  *
- * Avoid inlining the function to keep vdev_raidz_io_start(), which
- * is this functions only caller, as small as possible on the stack.
+ * Avoid inlining the function to keep vdev_raidz_io_start() and
+ * vdev_draid_io_start(), its only callers, as small as possible on the
+ * stack.
  */
 noinline raidz_map_t *
-vdev_raidz_map_alloc(zio_t *zio, uint64_t ashift, uint64_t dcols,
-    uint64_t nparity)
+vdev_raidz_map_alloc_offset(zio_t *zio, uint64_t offset, uint64_t ashift,
+    uint64_t dcols, uint64_t nparity)
 {
 	raidz_map_t *rm;
 	/* The starting RAIDZ (parent) vdev sector of the block. */
-	uint64_t b = zio->io_offset >> ashift;
+	uint64_t b = offset >> ashift;
 	/* The zio's size in units of the vdev's minimum sector size. */
 	uint64_t s = zio->io_size >> ashift;
 	/* The first column for this stripe. */
@@ -396,6 +501,9 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t ashift, uint64_t dcols,
 	rm->rm_reports = 0;
 	rm->rm_freed = 0;
 	rm->rm_ecksuminjected = 0;
+	rm->rm_nrows = 0;
+	rm->rm_row = NULL;
+	rm->rm_lr = NULL;
 
 	asize = 0;
 
@@ -413,6 +521,9 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t ashift, uint64_t dcols,
 		rm->rm_col[c].rc_error = 0;
 		rm->rm_col[c].rc_tried = 0;
 		rm->rm_col[c].rc_skipped = 0;
+		rm->rm_col[c].rc_shadow_devidx = UINT64_MAX;
+		rm->rm_col[c].rc_shadow_offset = UINT64_MAX;
+		rm->rm_col[c].rc_shadow_error = 0;
 
 		if (c >= acols)
 			rm->rm_col[c].rc_size = 0;
@@ -467,7 +578,7 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t ashift, uint64_t dcols,
 	ASSERT(rm->rm_cols >= 2);
 	ASSERT(rm->rm_col[0].rc_size == rm->rm_col[1].rc_size);
 
-	if (rm->rm_firstdatacol == 1 && (zio->io_offset & (1ULL << 20))) {
+	if (rm->rm_firstdatacol == 1 && (offset & (1ULL << 20))) {
 		devidx = rm->rm_col[0].rc_devidx;
 		o = rm->rm_col[0].rc_offset;
 		rm->rm_col[0].rc_devidx = rm->rm_col[1].rc_devidx;
@@ -488,6 +599,14 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t ashift, uint64_t dcols,
 	return (rm);
 }
 
+raidz_map_t *
+vdev_raidz_map_alloc(zio_t *zio, uint64_t ashift, uint64_t dcols,
+    uint64_t nparity)
+{
+	return (vdev_raidz_map_alloc_offset(zio, zio->io_offset, ashift,
+	    dcols, nparity));
+}
+
 struct pqr_struct {
 	uint64_t *p;
 	uint64_t *q;
@@ -1552,6 +1671,70 @@ vdev_raidz_reconstruct(raidz_map_t *rm, const int *t, int nt)
 	return (code);
 }
 
+/*
+ * Computes the fletcher4 checksum of each data column of the map into
+ * partial[], indexed by column.  The data columns hold consecutive ranges
+ * of the block, so the checksum of the block can be assembled from them.
+ */
+void
+vdev_raidz_cksum_partial(raidz_map_t *rm, boolean_t byteswap,
+    zio_cksum_t *partial)
+{
+	for (int c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+		raidz_col_t *rc = &rm->rm_col[c];
+
+		if (rc->rc_size == 0) {
+			ZIO_SET_CHECKSUM(&partial[c], 0, 0, 0, 0);
+		} else if (byteswap) {
+			abd_fletcher_4_byteswap(rc->rc_abd, rc->rc_size, NULL,
+			    &partial[c]);
+		} else {
+			abd_fletcher_4_native(rc->rc_abd, rc->rc_size, NULL,
+			    &partial[c]);
+		}
+	}
+}
+
+/*
+ * Reconstructs the given targets as vdev_raidz_reconstruct() does, and
+ * returns in zcp the fletcher4 checksum of the resulting block.  Only the
+ * columns which were just reconstructed, and are still in the cache, are
+ * checksummed; the checksums of the other data columns are taken from the
+ * partial[] array filled in by vdev_raidz_cksum_partial().
+ */
+int
+vdev_raidz_reconstruct_cksum(raidz_map_t *rm, const int *t, int nt,
+    boolean_t byteswap, const zio_cksum_t *partial, zio_cksum_t *zcp)
+{
+	int code = vdev_raidz_reconstruct(rm, t, nt);
+	int i = 0;
+
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	for (int c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+		raidz_col_t *rc = &rm->rm_col[c];
+		zio_cksum_t zc;
+
+		while (i < nt && t[i] < c)
+			i++;
+		if (rc->rc_size == 0)
+			continue;
+
+		if ((i < nt && t[i] == c) || rc->rc_error != 0) {
+			if (byteswap)
+				abd_fletcher_4_byteswap(rc->rc_abd,
+				    rc->rc_size, NULL, &zc);
+			else
+				abd_fletcher_4_native(rc->rc_abd,
+				    rc->rc_size, NULL, &zc);
+		} else {
+			zc = partial[c];
+		}
+		fletcher_4_combine(zcp, rc->rc_size, &zc);
+	}
+
+	return (code);
+}
+
 static int
 vdev_raidz_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
     uint64_t *ashift, uint64_t *pshift)
@@ -1588,8 +1771,8 @@ vdev_raidz_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
 		    cvd->vdev_physical_ashift);
 	}
 
-	*asize *= vd->vdev_children;
-	*max_asize *= vd->vdev_children;
+	*asize *= vdev_raidz_asize_width(vd);
+	*max_asize *= vdev_raidz_asize_width(vd);
 
 	if (numerrors > nparity) {
 		vd->vdev_stat.vs_aux = VDEV_AUX_NO_REPLICAS;
@@ -1609,11 +1792,11 @@ vdev_raidz_close(vdev_t *vd)
 }
 
 static uint64_t
-vdev_raidz_asize(vdev_t *vd, uint64_t psize)
+vdev_raidz_asize(vdev_t *vd, uint64_t psize, uint64_t txg)
 {
 	uint64_t asize;
 	uint64_t ashift = vd->vdev_top->vdev_ashift;
-	uint64_t cols = vd->vdev_children;
+	uint64_t cols = vdev_raidz_logical_width(vd->vdev_tsd, txg);
 	uint64_t nparity = vd->vdev_nparity;
 
 	asize = ((psize - 1) >> ashift) + 1;
@@ -1623,6 +1806,18 @@ vdev_raidz_asize(vdev_t *vd, uint64_t psize)
 	return (asize);
 }
 
+/*
+ * Returns the txg whose stripe width the block of a zio was written with.
+ */
+static uint64_t
+vdev_raidz_io_txg(zio_t *zio)
+{
+	if (zio->io_bp != NULL && BP_PHYSICAL_BIRTH(zio->io_bp) != 0)
+		return (BP_PHYSICAL_BIRTH(zio->io_bp));
+
+	return (zio->io_txg);
+}
+
 static void
 vdev_raidz_child_done(zio_t *zio)
 {
@@ -1633,6 +1828,14 @@ vdev_raidz_child_done(zio_t *zio)
 	rc->rc_skipped = 0;
 }
 
+static void
+vdev_raidz_shadow_done(zio_t *zio)
+{
+	raidz_col_t *rc = zio->io_private;
+
+	rc->rc_shadow_error = zio->io_error;
+}
+
 static void
 vdev_raidz_io_verify(zio_t *zio, raidz_map_t *rm, int col)
 {
@@ -1643,7 +1846,8 @@ vdev_raidz_io_verify(zio_t *zio, raidz_map_t *rm, int col)
 	range_seg_t logical_rs, physical_rs;
 	logical_rs.rs_start = zio->io_offset;
 	logical_rs.rs_end = logical_rs.rs_start +
-	    vdev_raidz_asize(zio->io_vd, zio->io_size);
+	    vdev_raidz_asize(zio->io_vd, zio->io_size,
+	    vdev_raidz_io_txg(zio));
 
 	raidz_col_t *rc = &rm->rm_col[col];
 	vdev_t *cvd = vd->vdev_child[rc->rc_devidx];
@@ -1666,6 +1870,225 @@ vdev_raidz_io_verify(zio_t *zio, raidz_map_t *rm, int col)
 #endif
 }
 
+/*
+ * Sets up the per-row maps of a block whose sectors are not all laid out
+ * with the stripe width the block was written with.  Sector x of the
+ * block, as laid out with that width, is at its location with the old
+ * width of an expansion in progress if it is at or above the reflow offset,
+ * and with the width of all children otherwise.  Sectors between the
+ * synced and the in-core reflow offset are also written to their old
+ * location.  Both offsets are in sectors, UINT64_MAX when the vdev is not
+ * being expanded.
+ */
+static void
+vdev_raidz_map_alloc_rows(zio_t *zio, raidz_map_t *rm, uint64_t width,
+    uint64_t reflow, uint64_t synced)
+{
+	vdev_t *vd = zio->io_vd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t children = vd->vdev_children;
+	uint64_t size = 1ULL << ashift;
+
+	rm->rm_nrows = rm->rm_col[0].rc_size >> ashift;
+	rm->rm_row = kmem_alloc(rm->rm_nrows * sizeof (raidz_map_t *),
+	    KM_SLEEP);
+
+	for (uint64_t r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = kmem_zalloc(offsetof(raidz_map_t,
+		    rm_col[rm->rm_cols]), KM_SLEEP);
+
+		rr->rm_cols = rm->rm_cols;
+		rr->rm_scols = rm->rm_cols;
+		rr->rm_firstdatacol = rm->rm_firstdatacol;
+		rr->rm_asize = rm->rm_cols << ashift;
+		rr->rm_ops = rm->rm_ops;
+
+		for (uint64_t c = 0; c < rr->rm_cols; c++) {
+			raidz_col_t *pc = &rm->rm_col[c];
+			raidz_col_t *rc = &rr->rm_col[c];
+
+			rc->rc_size = size;
+			rc->rc_shadow_devidx = UINT64_MAX;
+			rc->rc_shadow_offset = UINT64_MAX;
+
+			/*
+			 * The data columns which are shorter than the parity
+			 * are treated as though they were padded with zeroes,
+			 * as when generating the parity.
+			 */
+			if ((r << ashift) >= pc->rc_size) {
+				rc->rc_devidx = UINT64_MAX;
+				rc->rc_offset = UINT64_MAX;
+				rc->rc_abd = abd_alloc_linear(size, B_FALSE);
+				abd_zero(rc->rc_abd, size);
+				continue;
+			}
+
+			uint64_t x = ((pc->rc_offset >> ashift) + r) * width +
+			    pc->rc_devidx;
+			uint64_t w = (x >= reflow) ? children - 1 : children;
+
+			rc->rc_devidx = x % w;
+			rc->rc_offset = (x / w) << ashift;
+			rc->rc_abd = abd_get_offset_size(pc->rc_abd,
+			    r << ashift, size);
+
+			if (zio->io_type == ZIO_TYPE_WRITE &&
+			    x >= synced && x < reflow &&
+			    (x % (children - 1) != rc->rc_devidx ||
+			    x / (children - 1) != x / children)) {
+				rc->rc_shadow_devidx = x % (children - 1);
+				rc->rc_shadow_offset =
+				    (x / (children - 1)) << ashift;
+			}
+		}
+
+		rm->rm_row[r] = rr;
+	}
+}
+
+/*
+ * Issue the child reads of the columns of a raidz map.  Iterate over the
+ * columns in reverse order so that we hit the parity last -- any errors
+ * along the way will force us to read the parity.
+ */
+static void
+vdev_raidz_io_start_read(zio_t *zio, raidz_map_t *rm)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_t *cvd;
+	raidz_col_t *rc;
+	int c;
+
+	for (c = rm->rm_cols - 1; c >= 0; c--) {
+		rc = &rm->rm_col[c];
+		if (rc->rc_devidx == UINT64_MAX)
+			continue;
+		cvd = vd->vdev_child[rc->rc_devidx];
+		if (!vdev_readable(cvd)) {
+			if (c >= rm->rm_firstdatacol)
+				rm->rm_missingdata++;
+			else
+				rm->rm_missingparity++;
+			rc->rc_error = SET_ERROR(ENXIO);
+			rc->rc_tried = 1;	/* don't even try */
+			rc->rc_skipped = 1;
+			continue;
+		}
+		if (vdev_dtl_contains(cvd, DTL_MISSING, zio->io_txg, 1)) {
+			if (c >= rm->rm_firstdatacol)
+				rm->rm_missingdata++;
+			else
+				rm->rm_missingparity++;
+			rc->rc_error = SET_ERROR(ESTALE);
+			rc->rc_skipped = 1;
+			continue;
+		}
+		if (c >= rm->rm_firstdatacol || rm->rm_missingdata > 0 ||
+		    (zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER))) {
+			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
+			    zio->io_type, zio->io_priority, 0,
+			    vdev_raidz_child_done, rc));
+		}
+	}
+}
+
+/*
+ * Issue the child I/Os of a block described by per-row maps.  The parity
+ * is generated for the whole block, the rows' parity columns being views
+ * of its parity columns.
+ */
+static void
+vdev_raidz_io_start_rows(zio_t *zio, raidz_map_t *rm)
+{
+	vdev_t *vd = zio->io_vd;
+
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		vdev_raidz_generate_parity(rm);
+
+		for (uint64_t r = 0; r < rm->rm_nrows; r++) {
+			raidz_map_t *rr = rm->rm_row[r];
+
+			for (int c = 0; c < rr->rm_cols; c++) {
+				raidz_col_t *rc = &rr->rm_col[c];
+
+				if (rc->rc_devidx == UINT64_MAX)
+					continue;
+
+				zio_nowait(zio_vdev_child_io(zio, NULL,
+				    vd->vdev_child[rc->rc_devidx],
+				    rc->rc_offset, rc->rc_abd, rc->rc_size,
+				    zio->io_type, zio->io_priority, 0,
+				    vdev_raidz_child_done, rc));
+
+				if (rc->rc_shadow_devidx == UINT64_MAX)
+					continue;
+
+				zio_nowait(zio_vdev_child_io(zio, NULL,
+				    vd->vdev_child[rc->rc_shadow_devidx],
+				    rc->rc_shadow_offset, rc->rc_abd,
+				    rc->rc_size, zio->io_type,
+				    zio->io_priority, 0,
+				    vdev_raidz_shadow_done, rc));
+			}
+		}
+
+		zio_execute(zio);
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ);
+
+	for (uint64_t r = 0; r < rm->rm_nrows; r++)
+		vdev_raidz_io_start_read(zio, rm->rm_row[r]);
+
+	zio_execute(zio);
+}
+
+/*
+ * Start an I/O on a raidz vdev which is being expanded, or to a block
+ * which was written with a stripe width other than that of all children.
+ * While the vdev is being expanded the range of the block is locked for
+ * the duration of the I/O, so that the reflow does not move its sectors
+ * meanwhile.
+ */
+static void
+vdev_raidz_io_start_expanded(zio_t *zio, raidz_map_t *rm, uint64_t width)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+	vdev_raidz_expand_t *vre = &vdrz->vd_expand;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t reflow = UINT64_MAX;
+	uint64_t synced = UINT64_MAX;
+
+	if (vdrz->vd_expanding) {
+		rm->rm_lr = rangelock_enter(&vre->vre_rangelock,
+		    zio->io_offset, rm->rm_asize, RL_READER);
+
+		mutex_enter(&vre->vre_lock);
+		reflow = vre->vre_offset;
+		mutex_exit(&vre->vre_lock);
+
+		synced = zio->io_spa->spa_ubsync.ub_raidz_reflow_info >> ashift;
+		reflow = MAX(reflow >> ashift, synced);
+
+		/*
+		 * A block written with the old width which was not reflowed
+		 * yet is laid out as it was written.
+		 */
+		if (width == vd->vdev_children - 1 &&
+		    (zio->io_offset >> ashift) >= reflow) {
+			vdev_raidz_io_start_map(zio, rm);
+			return;
+		}
+	}
+
+	vdev_raidz_map_alloc_rows(zio, rm, width, reflow, synced);
+	vdev_raidz_io_start_rows(zio, rm);
+}
+
 /*
  * Start an IO operation on a RAIDZ VDev
  *
@@ -1688,15 +2111,46 @@ vdev_raidz_io_start(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
 	vdev_t *tvd = vd->vdev_top;
-	vdev_t *cvd;
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+	uint64_t txg = vdev_raidz_io_txg(zio);
+	uint64_t width = vdev_raidz_logical_width(vdrz, txg);
 	raidz_map_t *rm;
-	raidz_col_t *rc;
-	int c, i;
 
-	rm = vdev_raidz_map_alloc(zio, tvd->vdev_ashift, vd->vdev_children,
+	rm = vdev_raidz_map_alloc(zio, tvd->vdev_ashift, width,
 	    vd->vdev_nparity);
 
-	ASSERT3U(rm->rm_asize, ==, vdev_psize_to_asize(vd, zio->io_size));
+	ASSERT3U(rm->rm_asize, ==,
+	    vdev_psize_to_asize_txg(vd, zio->io_size, txg));
+
+	if (vdrz->vd_expanding || width != vd->vdev_children) {
+		vdev_raidz_io_start_expanded(zio, rm, width);
+		return;
+	}
+
+	/*
+	 * Verify physical to logical translation.
+	 */
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		for (int c = 0; c < rm->rm_cols; c++)
+			vdev_raidz_io_verify(zio, rm, c);
+	}
+
+	vdev_raidz_io_start_map(zio, rm);
+}
+
+/*
+ * Issue the child I/Os described by a raidz map.  The column device
+ * indexes and offsets in the map must already refer to the children of
+ * zio->io_vd.  Shared by RAID-Z and dRAID.
+ */
+void
+vdev_raidz_io_start_map(zio_t *zio, raidz_map_t *rm)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_t *tvd = vd->vdev_top;
+	vdev_t *cvd;
+	raidz_col_t *rc;
+	int c, i;
 
 	if (zio->io_type == ZIO_TYPE_WRITE) {
 		vdev_raidz_generate_parity(rm);
@@ -1705,11 +2159,6 @@ vdev_raidz_io_start(zio_t *zio)
 			rc = &rm->rm_col[c];
 			cvd = vd->vdev_child[rc->rc_devidx];
 
-			/*
-			 * Verify physical to logical translation.
-			 */
-			vdev_raidz_io_verify(zio, rm, c);
-
 			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
 			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    zio->io_type, zio->io_priority, 0,
@@ -1739,40 +2188,7 @@ vdev_raidz_io_start(zio_t *zio)
 
 	ASSERT(zio->io_type == ZIO_TYPE_READ);
 
-	/*
-	 * Iterate over the columns in reverse order so that we hit the parity
-	 * last -- any errors along the way will force us to read the parity.
-	 */
-	for (c = rm->rm_cols - 1; c >= 0; c--) {
-		rc = &rm->rm_col[c];
-		cvd = vd->vdev_child[rc->rc_devidx];
-		if (!vdev_readable(cvd)) {
-			if (c >= rm->rm_firstdatacol)
-				rm->rm_missingdata++;
-			else
-				rm->rm_missingparity++;
-			rc->rc_error = SET_ERROR(ENXIO);
-			rc->rc_tried = 1;	/* don't even try */
-			rc->rc_skipped = 1;
-			continue;
-		}
-		if (vdev_dtl_contains(cvd, DTL_MISSING, zio->io_txg, 1)) {
-			if (c >= rm->rm_firstdatacol)
-				rm->rm_missingdata++;
-			else
-				rm->rm_missingparity++;
-			rc->rc_error = SET_ERROR(ESTALE);
-			rc->rc_skipped = 1;
-			continue;
-		}
-		if (c >= rm->rm_firstdatacol || rm->rm_missingdata > 0 ||
-		    (zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER))) {
-			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
-			    rc->rc_offset, rc->rc_abd, rc->rc_size,
-			    zio->io_type, zio->io_priority, 0,
-			    vdev_raidz_child_done, rc));
-		}
-	}
+	vdev_raidz_io_start_read(zio, rm);
 
 	zio_execute(zio);
 }
@@ -1880,8 +2296,33 @@ vdev_raidz_worst_error(raidz_map_t *rm)
 }
 
 /*
- * Iterate over all combinations of bad data and attempt a reconstruction.
- * Note that the algorithm below is non-optimal because it doesn't take into
+ * Returns B_TRUE if the checksum of the block is a plain fletcher4 of the
+ * concatenation of the data columns, in which case vdev_raidz_combrec()
+ * can check each candidate with vdev_raidz_reconstruct_cksum() and run
+ * the full verification only on the one that matches.
+ */
+static boolean_t
+raidz_cksum_is_fletcher4(zio_t *zio, raidz_map_t *rm, boolean_t *byteswap)
+{
+	blkptr_t *bp = zio->io_bp;
+	uint64_t size = 0;
+
+	if (bp == NULL || BP_IS_GANG(bp) || BP_USES_CRYPT(bp) ||
+	    BP_GET_CHECKSUM(bp) != ZIO_CHECKSUM_FLETCHER_4)
+		return (B_FALSE);
+
+	for (int c = rm->rm_firstdatacol; c < rm->rm_cols; c++)
+		size += rm->rm_col[c].rc_size;
+	if (size != BP_GET_PSIZE(bp))
+		return (B_FALSE);
+
+	*byteswap = BP_SHOULD_BYTESWAP(bp);
+	return (B_TRUE);
+}
+
+/*
+ * Iterate over all combinations of bad data and attempt a reconstruction.
+ * Note that the algorithm below is non-optimal because it doesn't take into
  * account how reconstruction is actually performed. For example, with
  * triple-parity RAID-Z the reconstruction procedure is the same if column 4
  * is targeted as invalid as if columns 1 and 4 are targeted since in both
@@ -1897,9 +2338,17 @@ vdev_raidz_combrec(zio_t *zio, int total_errors, int data_errors)
 	int *tgts = &tstore[1];
 	int curr, next, i, c, n;
 	int code, ret = 0;
+	zio_cksum_t *partial = NULL;
+	boolean_t byteswap, ok;
 
 	ASSERT(total_errors < rm->rm_firstdatacol);
 
+	if (raidz_cksum_is_fletcher4(zio, rm, &byteswap)) {
+		partial = kmem_alloc(rm->rm_cols * sizeof (zio_cksum_t),
+		    KM_SLEEP);
+		vdev_raidz_cksum_partial(rm, byteswap, partial);
+	}
+
 	/*
 	 * This simplifies one edge condition.
 	 */
@@ -1968,8 +2417,19 @@ vdev_raidz_combrec(zio_t *zio, int total_errors, int data_errors)
 			 * Attempt a reconstruction and exit the outer loop on
 			 * success.
 			 */
-			code = vdev_raidz_reconstruct(rm, tgts, n);
-			if (raidz_checksum_verify(zio) == 0) {
+			if (partial != NULL) {
+				zio_cksum_t zc;
+
+				code = vdev_raidz_reconstruct_cksum(rm, tgts,
+				    n, byteswap, partial, &zc);
+				ok = ZIO_CHECKSUM_EQUAL(zc,
+				    zio->io_bp->blk_cksum) &&
+				    raidz_checksum_verify(zio) == 0;
+			} else {
+				code = vdev_raidz_reconstruct(rm, tgts, n);
+				ok = (raidz_checksum_verify(zio) == 0);
+			}
+			if (ok) {
 
 				for (i = 0; i < n; i++) {
 					c = tgts[i];
@@ -2030,10 +2490,382 @@ vdev_raidz_combrec(zio_t *zio, int total_errors, int data_errors)
 done:
 	for (i = 0; i < n; i++)
 		abd_free(orig[i]);
+	if (partial != NULL)
+		kmem_free(partial, rm->rm_cols * sizeof (zio_cksum_t));
 
 	return (ret);
 }
 
+/*
+ * Returns whether a column of a per-row map is on one of the n children
+ * in tgts.
+ */
+static boolean_t
+vdev_raidz_col_targeted(const raidz_col_t *rc, const uint64_t *tgts, int n)
+{
+	for (int i = 0; i < n; i++) {
+		if (rc->rc_devidx == tgts[i])
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Attempts to reconstruct a block issued per row assuming that the n
+ * children in tgts, in addition to the columns which returned an error,
+ * silently returned bad data.  The sectors of a child are not in the same
+ * column of every row, so the combinations are of children rather than of
+ * columns.  If the block then verifies, checksum errors are reported for
+ * the targeted sectors so that they get repaired, otherwise they are
+ * restored from orig, which holds nparity sectors per row.
+ */
+static boolean_t
+vdev_raidz_combrec_rows_try(zio_t *zio, const uint64_t *tgts, int n,
+    abd_t *orig)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	int nparity = rm->rm_firstdatacol;
+	uint64_t size = rm->rm_row[0]->rm_col[0].rc_size;
+	boolean_t ok;
+	uint64_t r;
+	int c, i;
+
+	for (r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = rm->rm_row[r];
+		int bad = 0;
+
+		for (c = 0; c < rr->rm_cols; c++) {
+			raidz_col_t *rc = &rr->rm_col[c];
+
+			if (rc->rc_error != 0 ||
+			    vdev_raidz_col_targeted(rc, tgts, n))
+				bad++;
+		}
+		if (bad > nparity)
+			return (B_FALSE);
+	}
+
+	for (r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = rm->rm_row[r];
+		int rtgts[VDEV_RAIDZ_MAXPARITY];
+		boolean_t data = B_FALSE;
+
+		for (c = 0, i = 0; c < rr->rm_cols; c++) {
+			raidz_col_t *rc = &rr->rm_col[c];
+
+			if (rc->rc_error != 0) {
+				if (c >= nparity)
+					data = B_TRUE;
+				continue;
+			}
+			if (!vdev_raidz_col_targeted(rc, tgts, n))
+				continue;
+
+			abd_copy_off(orig, rc->rc_abd,
+			    (r * nparity + i) * size, 0, size);
+			rtgts[i++] = c;
+			if (c >= nparity)
+				data = B_TRUE;
+		}
+
+		if (data)
+			(void) vdev_raidz_reconstruct(rr, rtgts, i);
+	}
+
+	ok = (raidz_checksum_verify(zio) == 0);
+
+	for (r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = rm->rm_row[r];
+
+		for (c = 0, i = 0; c < rr->rm_cols; c++) {
+			raidz_col_t *rc = &rr->rm_col[c];
+			abd_t *bad;
+
+			if (rc->rc_error != 0 ||
+			    !vdev_raidz_col_targeted(rc, tgts, n))
+				continue;
+
+			bad = abd_get_offset_size(orig,
+			    (r * nparity + i++) * size, size);
+			if (!ok) {
+				abd_copy(rc->rc_abd, bad, size);
+			} else if (abd_cmp(rc->rc_abd, bad) != 0) {
+				if (rc->rc_tried)
+					raidz_checksum_error(zio, rc, bad);
+				rc->rc_error = SET_ERROR(ECKSUM);
+			}
+			abd_put(bad);
+		}
+	}
+
+	return (ok);
+}
+
+/*
+ * Combinatorial reconstruction of a block issued per row, trying every set
+ * of up to nparity children in turn.
+ */
+static boolean_t
+vdev_raidz_combrec_rows(zio_t *zio)
+{
+	raidz_map_t *rm = zio->io_vsd;
+	uint64_t children = zio->io_vd->vdev_children;
+	int nparity = rm->rm_firstdatacol;
+	uint64_t size = rm->rm_row[0]->rm_col[0].rc_size;
+	uint64_t tgts[VDEV_RAIDZ_MAXPARITY];
+	boolean_t ok = B_FALSE;
+	abd_t *orig;
+	int n, i, j;
+
+	orig = abd_alloc(rm->rm_nrows * nparity * size, B_FALSE);
+
+	for (n = 1; n <= nparity && n <= children && !ok; n++) {
+		for (i = 0; i < n; i++)
+			tgts[i] = i;
+
+		for (;;) {
+			if ((ok = vdev_raidz_combrec_rows_try(zio, tgts, n,
+			    orig)))
+				break;
+
+			for (i = n - 1; i >= 0 && tgts[i] == children - n + i;
+			    i--)
+				;
+			if (i < 0)
+				break;
+
+			tgts[i]++;
+			for (j = i + 1; j < n; j++)
+				tgts[j] = tgts[j - 1] + 1;
+		}
+	}
+
+	abd_free(orig);
+
+	return (ok);
+}
+
+/*
+ * Complete an I/O issued per row by vdev_raidz_io_start_rows().  The
+ * phases are those of vdev_raidz_io_done(), with each row reconstructed on
+ * its own from its columns.
+ */
+static void
+vdev_raidz_io_done_rows(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	raidz_map_t *rm = zio->io_vsd;
+	int nparity = rm->rm_firstdatacol;
+	int unexpected_errors = 0;
+	boolean_t correctable = B_TRUE;
+	boolean_t redone = B_FALSE;
+	boolean_t uncorrectable = B_FALSE;
+	uint64_t r;
+	int c;
+
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		for (r = 0; r < rm->rm_nrows; r++) {
+			raidz_map_t *rr = rm->rm_row[r];
+			int errors = 0, error = 0;
+
+			for (c = 0; c < rr->rm_cols; c++) {
+				raidz_col_t *rc = &rr->rm_col[c];
+
+				if (rc->rc_error == 0 &&
+				    rc->rc_shadow_error == 0)
+					continue;
+				errors++;
+				error = zio_worst_error(error,
+				    zio_worst_error(rc->rc_error,
+				    rc->rc_shadow_error));
+			}
+
+			/* XXPOLICY, as for a single row */
+			if (errors > nparity)
+				zio->io_error = zio_worst_error(zio->io_error,
+				    error);
+		}
+
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ);
+
+	/*
+	 * Phase 1: reconstruct the rows from the columns read, if every row
+	 * read enough parity to do so.
+	 */
+	for (r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = rm->rm_row[r];
+		int tgts[VDEV_RAIDZ_MAXPARITY];
+		int total = 0, untried = 0, n = 0;
+
+		for (c = 0; c < rr->rm_cols; c++) {
+			raidz_col_t *rc = &rr->rm_col[c];
+
+			if (rc->rc_error != 0) {
+				if (!rc->rc_skipped)
+					unexpected_errors++;
+				total++;
+				if (c >= nparity && n < VDEV_RAIDZ_MAXPARITY)
+					tgts[n++] = c;
+			} else if (c < nparity && !rc->rc_tried) {
+				untried++;
+			}
+		}
+
+		if (total > nparity - untried)
+			correctable = B_FALSE;
+		else if (n > 0)
+			(void) vdev_raidz_reconstruct(rr, tgts, n);
+	}
+
+	if (correctable && raidz_checksum_verify(zio) == 0) {
+		for (r = 0; r < rm->rm_nrows; r++) {
+			raidz_map_t *rr = rm->rm_row[r];
+			int errors = 0, untried = 0;
+
+			for (c = 0; c < rr->rm_cols; c++) {
+				raidz_col_t *rc = &rr->rm_col[c];
+
+				if (rc->rc_error != 0)
+					errors++;
+				else if (c < nparity && !rc->rc_tried)
+					untried++;
+			}
+
+			if (errors + untried < nparity ||
+			    (zio->io_flags & ZIO_FLAG_RESILVER))
+				unexpected_errors += raidz_parity_verify(zio,
+				    rr);
+		}
+		goto done;
+	}
+
+	/*
+	 * Phase 2: read every column not read yet and try again.
+	 */
+	unexpected_errors = 1;
+
+	for (r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = rm->rm_row[r];
+
+		rr->rm_missingdata = 0;
+		rr->rm_missingparity = 0;
+
+		for (c = 0; c < rr->rm_cols; c++) {
+			raidz_col_t *rc = &rr->rm_col[c];
+
+			if (rc->rc_tried || rc->rc_devidx == UINT64_MAX)
+				continue;
+
+			if (!redone) {
+				zio_vdev_io_redone(zio);
+				redone = B_TRUE;
+			}
+			zio_nowait(zio_vdev_child_io(zio, NULL,
+			    vd->vdev_child[rc->rc_devidx],
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
+			    zio->io_type, zio->io_priority, 0,
+			    vdev_raidz_child_done, rc));
+		}
+	}
+
+	if (redone)
+		return;
+
+	/*
+	 * Phase 3: combinatorial reconstruction.
+	 */
+	for (r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = rm->rm_row[r];
+		int errors = 0;
+
+		for (c = 0; c < rr->rm_cols; c++) {
+			if (rr->rm_col[c].rc_error != 0)
+				errors++;
+		}
+		if (errors > nparity) {
+			zio->io_error = zio_worst_error(zio->io_error,
+			    vdev_raidz_worst_error(rr));
+			uncorrectable = B_TRUE;
+		}
+	}
+
+	if (!uncorrectable && !vdev_raidz_combrec_rows(zio)) {
+		boolean_t *reported;
+
+		zio->io_error = SET_ERROR(ECKSUM);
+
+		if (zio->io_flags & ZIO_FLAG_SPECULATIVE)
+			goto done;
+
+		/*
+		 * Report a checksum error once for every child which did
+		 * not fail.
+		 */
+		reported = kmem_zalloc(vd->vdev_children * sizeof (boolean_t),
+		    KM_SLEEP);
+		for (r = 0; r < rm->rm_nrows; r++) {
+			raidz_map_t *rr = rm->rm_row[r];
+
+			for (c = 0; c < rr->rm_cols; c++) {
+				raidz_col_t *rc = &rr->rm_col[c];
+				zio_bad_cksum_t zbc;
+				vdev_t *cvd;
+
+				if (rc->rc_error != 0 ||
+				    rc->rc_devidx == UINT64_MAX ||
+				    reported[rc->rc_devidx])
+					continue;
+
+				reported[rc->rc_devidx] = B_TRUE;
+				cvd = vd->vdev_child[rc->rc_devidx];
+
+				mutex_enter(&cvd->vdev_stat_lock);
+				cvd->vdev_stat.vs_checksum_errors++;
+				mutex_exit(&cvd->vdev_stat_lock);
+
+				zbc.zbc_has_cksum = 0;
+				zbc.zbc_injected = rm->rm_ecksuminjected;
+				(void) zfs_ereport_post_checksum(zio->io_spa,
+				    cvd, &zio->io_bookmark, zio, rc->rc_offset,
+				    rc->rc_size, NULL, rc->rc_abd, &zbc);
+			}
+		}
+		kmem_free(reported, vd->vdev_children * sizeof (boolean_t));
+	}
+
+done:
+	zio_checksum_verified(zio);
+
+	if (zio->io_error != 0 || !spa_writeable(zio->io_spa) ||
+	    (!unexpected_errors && !(zio->io_flags & ZIO_FLAG_RESILVER)))
+		return;
+
+	/*
+	 * Use the good data we have in hand to repair damaged children.
+	 */
+	for (r = 0; r < rm->rm_nrows; r++) {
+		raidz_map_t *rr = rm->rm_row[r];
+
+		for (c = 0; c < rr->rm_cols; c++) {
+			raidz_col_t *rc = &rr->rm_col[c];
+
+			if (rc->rc_error == 0)
+				continue;
+
+			zio_nowait(zio_vdev_child_io(zio, NULL,
+			    vd->vdev_child[rc->rc_devidx],
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
+			    ZIO_TYPE_WRITE, ZIO_PRIORITY_ASYNC_WRITE,
+			    ZIO_FLAG_IO_REPAIR | (unexpected_errors ?
+			    ZIO_FLAG_SELF_HEAL : 0), NULL, NULL));
+		}
+	}
+}
+
 /*
  * Complete an IO operation on a RAIDZ VDev
  *
@@ -2055,7 +2887,7 @@ done:
  *   3. If there were unexpected errors or this is a resilver operation,
  *      rewrite the vdevs that had errors.
  */
-static void
+void
 vdev_raidz_io_done(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
@@ -2073,6 +2905,11 @@ vdev_raidz_io_done(zio_t *zio)
 
 	ASSERT(zio->io_bp != NULL);  /* XXX need to add code to enforce this */
 
+	if (rm->rm_row != NULL) {
+		vdev_raidz_io_done_rows(zio);
+		return;
+	}
+
 	ASSERT(rm->rm_missingparity <= rm->rm_firstdatacol);
 	ASSERT(rm->rm_missingdata <= rm->rm_cols - rm->rm_firstdatacol);
 
@@ -2323,7 +3160,7 @@ done:
 	}
 }
 
-static void
+void
 vdev_raidz_state_change(vdev_t *vd, int faulted, int degraded)
 {
 	if (faulted > vd->vdev_nparity)
@@ -2353,6 +3190,14 @@ vdev_raidz_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
 	uint64_t s = ((psize - 1) >> ashift) + 1;
 	/* The first column for this stripe. */
 	uint64_t f = b % dcols;
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+
+	/*
+	 * The children of the sectors of a block of a vdev which was
+	 * expanded depend on the width the block was written with.
+	 */
+	if (vdrz->vd_nexpand > 0 || vdrz->vd_expanding)
+		return (B_TRUE);
 
 	if (s + nparity >= dcols)
 		return (B_TRUE);
@@ -2379,10 +3224,21 @@ vdev_raidz_xlate(vdev_t *cvd, const range_seg_t *in, range_seg_t *res)
 	vdev_t *raidvd = cvd->vdev_parent;
 	ASSERT(raidvd->vdev_ops == &vdev_raidz_ops);
 
+	vdev_raidz_t *vdrz = raidvd->vdev_tsd;
 	uint64_t width = raidvd->vdev_children;
 	uint64_t tgt_col = cvd->vdev_id;
 	uint64_t ashift = raidvd->vdev_top->vdev_ashift;
 
+	/*
+	 * While the vdev is being expanded the location of a sector depends
+	 * on the progress of the reflow, so no range is translated.
+	 */
+	if (vdrz->vd_expanding) {
+		res->rs_start = 0;
+		res->rs_end = 0;
+		return;
+	}
+
 	/* make sure the offsets are block-aligned */
 	ASSERT0(in->rs_start % (1 << ashift));
 	ASSERT0(in->rs_end % (1 << ashift));
@@ -2404,6 +3260,740 @@ vdev_raidz_xlate(vdev_t *cvd, const range_seg_t *in, range_seg_t *res)
 	ASSERT3U(res->rs_end - res->rs_start, <=, in->rs_end - in->rs_start);
 }
 
+/*
+ * Returns the offset up to which the sectors of a vdev being expanded can
+ * be reflowed, given the offset up to which they were reflowed as of the
+ * last synced txg.  Reflowing sector x writes it over the old location of
+ * the sector on the same row and child with the old width, which must be
+ * below the synced offset so that the reflow can resume from there after a
+ * crash.  The sectors of the first row do not move, except for the one
+ * written to the new child, so that row can always be reflowed.
+ */
+static uint64_t
+vdev_raidz_reflow_bound(vdev_t *vd, uint64_t synced)
+{
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t wp = vd->vdev_children;
+	uint64_t wo = wp - 1;
+	uint64_t s = MAX(synced >> ashift, wo);
+	uint64_t q = (s - 1) / wo;
+	uint64_t r = (s - 1) % wo;
+
+	return ((q * wp + r + 1 + (r == wo - 1 ? 1 : 0)) << ashift);
+}
+
+static void
+vdev_raidz_reflow_done(zio_t *zio)
+{
+	int *errorp = zio->io_private;
+
+	if (zio->io_error != 0)
+		*errorp = zio->io_error;
+}
+
+/*
+ * Copies the sectors between start and end from their location with the
+ * old width of the vdev to their location with the new one.  The sectors
+ * are read from each old child in one I/O, and written to each child in
+ * one I/O.
+ */
+static int
+vdev_raidz_reflow_copy(vdev_t *vd, uint64_t start, uint64_t end)
+{
+	spa_t *spa = vd->vdev_spa;
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t wp = vd->vdev_children;
+	uint64_t wo = wp - 1;
+	uint64_t s = start >> ashift;
+	uint64_t e = end >> ashift;
+	abd_t **rabds = kmem_zalloc(wp * sizeof (abd_t *), KM_SLEEP);
+	abd_t **wabds = kmem_zalloc(wp * sizeof (abd_t *), KM_SLEEP);
+	uint64_t *first = kmem_zalloc(wp * sizeof (uint64_t), KM_SLEEP);
+	int *errors = kmem_zalloc(wp * sizeof (int), KM_SLEEP);
+	int error = 0;
+	zio_t *rio;
+
+	rio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	for (uint64_t c = 0; c < wo; c++) {
+		uint64_t r0 = (s + wo - 1 - c) / wo;
+		uint64_t r1 = (e + wo - 1 - c) / wo;
+
+		first[c] = r0;
+		if (r1 == r0)
+			continue;
+
+		rabds[c] = abd_alloc_for_io((r1 - r0) << ashift, B_FALSE);
+		zio_nowait(zio_vdev_child_io(rio, NULL, vd->vdev_child[c],
+		    r0 << ashift, rabds[c], (r1 - r0) << ashift,
+		    ZIO_TYPE_READ, ZIO_PRIORITY_REMOVAL, ZIO_FLAG_CANFAIL,
+		    vdev_raidz_reflow_done, &errors[c]));
+	}
+	(void) zio_wait(rio);
+
+	for (uint64_t c = 0; c < wo; c++)
+		error = zio_worst_error(error, errors[c]);
+	if (error != 0)
+		goto out;
+
+	rio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	for (uint64_t d = 0; d < wp; d++) {
+		uint64_t r0 = (s + wp - 1 - d) / wp;
+		uint64_t r1 = (e + wp - 1 - d) / wp;
+
+		if (r1 == r0)
+			continue;
+
+		wabds[d] = abd_alloc_for_io((r1 - r0) << ashift, B_FALSE);
+		for (uint64_t r = r0; r < r1; r++) {
+			uint64_t x = r * wp + d;
+			uint64_t c = x % wo;
+
+			abd_copy_off(wabds[d], rabds[c], (r - r0) << ashift,
+			    (x / wo - first[c]) << ashift, 1ULL << ashift);
+		}
+
+		zio_nowait(zio_vdev_child_io(rio, NULL, vd->vdev_child[d],
+		    r0 << ashift, wabds[d], (r1 - r0) << ashift,
+		    ZIO_TYPE_WRITE, ZIO_PRIORITY_REMOVAL, ZIO_FLAG_CANFAIL,
+		    vdev_raidz_reflow_done, &errors[d]));
+	}
+	(void) zio_wait(rio);
+
+	for (uint64_t d = 0; d < wp; d++)
+		error = zio_worst_error(error, errors[d]);
+
+out:
+	for (uint64_t c = 0; c < wp; c++) {
+		if (rabds[c] != NULL)
+			abd_free(rabds[c]);
+		if (wabds[c] != NULL)
+			abd_free(wabds[c]);
+	}
+	kmem_free(rabds, wp * sizeof (abd_t *));
+	kmem_free(wabds, wp * sizeof (abd_t *));
+	kmem_free(first, wp * sizeof (uint64_t));
+	kmem_free(errors, wp * sizeof (int));
+
+	return (error);
+}
+
+/*
+ * Record the reflow offset and progress in the uberblock and the top-level
+ * vdev ZAP.  This is dispatched as a sync task at most once per txg by the
+ * reflow thread.  The vdev is dirtied so that its children are flushed,
+ * and the reflowed copies thus on stable storage, before the uberblock is
+ * written.
+ */
+static void
+vdev_raidz_expand_update_sync(void *arg, dmu_tx_t *tx)
+{
+	/*
+	 * We pass in the vdev id instead of the vdev_t since the vdev may
+	 * have been removed or freed prior to the sync task being processed.
+	 */
+	uint64_t vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_raidz_t *vdrz;
+	vdev_raidz_expand_t *vre;
+
+	if (vd == NULL || vd->vdev_ops != &vdev_raidz_ops)
+		return;
+
+	vdrz = vd->vdev_tsd;
+	vre = &vdrz->vd_expand;
+	if (!vdrz->vd_expanding)
+		return;
+
+	mutex_enter(&vre->vre_lock);
+	spa->spa_uberblock.ub_raidz_reflow_info = vre->vre_offset;
+	VERIFY0(zap_update(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS, sizeof (uint64_t),
+	    RAIDZ_EXPAND_PHYS_ENTRIES, &vre->vre_phys, tx));
+	mutex_exit(&vre->vre_lock);
+
+	vdev_dirty(vd, 0, NULL, dmu_tx_get_txg(tx));
+}
+
+static void
+vdev_raidz_expand_attach_sync(void *arg, dmu_tx_t *tx)
+{
+	uint64_t vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_raidz_expand_t *vre = &((vdev_raidz_t *)vd->vdev_tsd)->vd_expand;
+
+	ASSERT(vd->vdev_top_zap != 0);
+
+	if (!spa_feature_is_active(spa, SPA_FEATURE_RAIDZ_EXPANSION))
+		spa_feature_incr(spa, SPA_FEATURE_RAIDZ_EXPANSION, tx);
+
+	mutex_enter(&vre->vre_lock);
+	VERIFY0(zap_update(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS, sizeof (uint64_t),
+	    RAIDZ_EXPAND_PHYS_ENTRIES, &vre->vre_phys, tx));
+	mutex_exit(&vre->vre_lock);
+
+	spa_history_log_internal(spa, "raidz expansion", tx,
+	    "vdev_id=%llu vdev_guid=%llu width=%llu started",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid,
+	    (u_longlong_t)vd->vdev_children);
+}
+
+/*
+ * Complete the expansion once all sectors were reflowed.  The blocks born
+ * from the first txg which cannot be open yet on are written with the new
+ * width, and the space of the new child becomes allocatable.
+ */
+static void
+vdev_raidz_expand_complete_sync(void *arg, dmu_tx_t *tx)
+{
+	uint64_t vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+	vdev_raidz_expand_t *vre = &vdrz->vd_expand;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	uint64_t n = vdrz->vd_nexpand;
+	uint64_t *txgs, *old = vdrz->vd_expand_txgs;
+
+	ASSERT(vdrz->vd_expanding);
+
+	txgs = kmem_alloc(2 * (n + 1) * sizeof (uint64_t), KM_SLEEP);
+	if (n > 0)
+		bcopy(old, txgs, 2 * n * sizeof (uint64_t));
+	txgs[2 * n] = txg + TXG_CONCURRENT_STATES;
+	txgs[2 * n + 1] = vd->vdev_children;
+
+	rw_enter(&vdrz->vd_expand_lock, RW_WRITER);
+	vdrz->vd_expand_txgs = txgs;
+	vdrz->vd_nexpand = n + 1;
+	vdrz->vd_expanding = B_FALSE;
+	rw_exit(&vdrz->vd_expand_lock);
+
+	if (n > 0)
+		kmem_free(old, 2 * n * sizeof (uint64_t));
+
+	mutex_enter(&vre->vre_lock);
+	vre->vre_phys.vrep_state = DSS_FINISHED;
+	vre->vre_phys.vrep_end_time = gethrestime_sec();
+	VERIFY0(zap_update(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS, sizeof (uint64_t),
+	    RAIDZ_EXPAND_PHYS_ENTRIES, &vre->vre_phys, tx));
+	mutex_exit(&vre->vre_lock);
+
+	spa->spa_uberblock.ub_raidz_reflow_info = 0;
+
+	vd->vdev_asize = vd->vdev_asize / (vd->vdev_children - 1) *
+	    vd->vdev_children;
+	vd->vdev_max_asize = vd->vdev_max_asize / (vd->vdev_children - 1) *
+	    vd->vdev_children;
+
+	vdev_config_dirty(vd);
+	vdev_dirty(vd, 0, NULL, txg);
+	spa_async_request(spa, SPA_ASYNC_CONFIG_UPDATE);
+
+	spa_history_log_internal(spa, "raidz expansion", tx,
+	    "vdev_id=%llu vdev_guid=%llu width=%llu completed",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid,
+	    (u_longlong_t)vd->vdev_children);
+}
+
+static boolean_t
+vdev_raidz_expand_should_stop(vdev_t *vd)
+{
+	vdev_raidz_expand_t *vre = &((vdev_raidz_t *)vd->vdev_tsd)->vd_expand;
+
+	return (vre->vre_exit_wanted || !vdev_writeable(vd) ||
+	    vd->vdev_removing);
+}
+
+/*
+ * Wait for a second, or until the thread is asked to exit.
+ */
+static void
+vdev_raidz_expand_delay(vdev_raidz_expand_t *vre)
+{
+	mutex_enter(&vre->vre_lock);
+	if (!vre->vre_exit_wanted) {
+		(void) cv_timedwait(&vre->vre_cv, &vre->vre_lock,
+		    ddi_get_lbolt() + hz);
+	}
+	mutex_exit(&vre->vre_lock);
+}
+
+/*
+ * Reflow the sectors between the reflow offset and end, copying those
+ * between start and end.  Those below start are free.  The range whose
+ * old location is overwritten is locked, along with the range being
+ * reflowed, so that no I/O to those sectors is in flight meanwhile.
+ */
+static int
+vdev_raidz_expand_step(vdev_t *vd, uint64_t start, uint64_t end,
+    uint64_t *txgp)
+{
+	spa_t *spa = vd->vdev_spa;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	vdev_raidz_expand_t *vre = &((vdev_raidz_t *)vd->vdev_tsd)->vd_expand;
+	uint64_t ashift = vd->vdev_ashift;
+	uint64_t lo = MIN(vre->vre_offset, ((start >> ashift) /
+	    vd->vdev_children * (vd->vdev_children - 1)) << ashift);
+	locked_range_t *lr;
+	int error = 0;
+
+	ASSERT3U(vre->vre_offset, <=, start);
+	ASSERT3U(start, <=, end);
+
+	if (end == vre->vre_offset)
+		return (0);
+
+	spa_config_enter(spa, SCL_STATE_ALL, FTAG, RW_READER);
+	lr = rangelock_enter(&vre->vre_rangelock, lo, end - lo, RL_WRITER);
+
+	if (end > start)
+		error = vdev_raidz_reflow_copy(vd, start, end);
+
+	if (error == 0) {
+		mutex_enter(&vre->vre_lock);
+		vre->vre_offset = end;
+		vre->vre_phys.vrep_bytes_reflowed += end - start;
+		mutex_exit(&vre->vre_lock);
+	}
+
+	rangelock_exit(lr);
+	spa_config_exit(spa, SCL_STATE_ALL, FTAG);
+
+	if (error != 0)
+		return (error);
+
+	dmu_tx_t *tx = dmu_tx_create_dd(dp->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	if (txg != *txgp) {
+		dsl_sync_task_nowait(dp, vdev_raidz_expand_update_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+		*txgp = txg;
+	}
+
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+/*
+ * Reflow a metaslab, copying its allocated ranges in rt.  The reflow offset
+ * cannot pass the bound of the last synced txg, see
+ * vdev_raidz_reflow_bound(), so when it reaches it this waits for the txg
+ * which recorded it to sync.  An I/O error pauses the reflow, which is
+ * then retried.
+ */
+static int
+vdev_raidz_expand_ranges(vdev_t *vd, metaslab_t *msp, range_tree_t *rt,
+    uint64_t *txgp)
+{
+	spa_t *spa = vd->vdev_spa;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	vdev_raidz_expand_t *vre = &((vdev_raidz_t *)vd->vdev_tsd)->vd_expand;
+	uint64_t ms_end = msp->ms_start + msp->ms_size;
+	uint64_t max_copy = MAX(P2ALIGN(zfs_raidz_expand_max_copy_bytes,
+	    1ULL << vd->vdev_ashift), 1ULL << vd->vdev_ashift);
+
+	while (vre->vre_offset < ms_end) {
+		uint64_t bound, start, end;
+		range_seg_t *rs;
+
+		if (vdev_raidz_expand_should_stop(vd))
+			return (SET_ERROR(EINTR));
+
+		if (zfs_raidz_expand_max_reflow_bytes != 0 &&
+		    vre->vre_phys.vrep_bytes_reflowed >=
+		    zfs_raidz_expand_max_reflow_bytes) {
+			vdev_raidz_expand_delay(vre);
+			continue;
+		}
+
+		bound = vdev_raidz_reflow_bound(vd,
+		    spa->spa_ubsync.ub_raidz_reflow_info);
+		if (vre->vre_offset >= bound) {
+			txg_wait_synced(dp, *txgp);
+			continue;
+		}
+
+		rs = range_tree_first(rt);
+		start = (rs != NULL) ? MAX(rs->rs_start, vre->vre_offset) :
+		    ms_end;
+		if (start >= bound)
+			start = end = bound;
+		else if (rs != NULL)
+			end = MIN(MIN(rs->rs_end, start + max_copy), bound);
+		else
+			end = start;
+
+		if (vdev_raidz_expand_step(vd, start, end, txgp) != 0) {
+			vdev_raidz_expand_delay(vre);
+			continue;
+		}
+
+		if (end > start)
+			range_tree_clear(rt, start, end - start);
+	}
+
+	return (0);
+}
+
+/*
+ * The reflow thread of a raidz vdev being expanded.  Like the rebuild
+ * thread it walks the metaslabs in offset order, copying the allocated
+ * ranges of each one with allocations to it disabled.
+ */
+static void
+vdev_raidz_expand_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	vdev_raidz_expand_t *vre = &((vdev_raidz_t *)vd->vdev_tsd)->vd_expand;
+	range_tree_t *rt = range_tree_create(NULL, NULL);
+	uint64_t last_txg = 0;
+	int error = 0;
+
+	mutex_enter(&vre->vre_lock);
+	vre->vre_offset = MAX(vre->vre_offset,
+	    spa->spa_ubsync.ub_raidz_reflow_info);
+	mutex_exit(&vre->vre_lock);
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+	for (uint64_t i = 0; i < vd->vdev_ms_count; i++) {
+		metaslab_t *msp = vd->vdev_ms[i];
+
+		if (msp->ms_start + msp->ms_size <= vre->vre_offset)
+			continue;
+
+		if (vdev_raidz_expand_should_stop(vd)) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		/*
+		 * Disable any new allocations to this metaslab and wait for
+		 * any writes in flight to be synced, so that its allocated
+		 * ranges do not change while they are reflowed.
+		 */
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		metaslab_disable(msp);
+		txg_wait_synced(dp, 0);
+
+		mutex_enter(&msp->ms_lock);
+		if (msp->ms_sm != NULL) {
+			VERIFY0(metaslab_load(msp));
+
+			range_tree_add(rt, msp->ms_start, msp->ms_size);
+			range_tree_walk(msp->ms_allocatable, range_tree_remove,
+			    rt);
+			range_tree_clear(rt, 0, vre->vre_offset);
+		}
+		mutex_exit(&msp->ms_lock);
+
+		error = vdev_raidz_expand_ranges(vd, msp, rt, &last_txg);
+		range_tree_vacate(rt, NULL, NULL);
+
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+		metaslab_enable(msp, B_FALSE);
+
+		if (error != 0)
+			break;
+	}
+
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+	range_tree_destroy(rt);
+
+	if (error == 0) {
+		dmu_tx_t *tx = dmu_tx_create_dd(dp->dp_mos_dir);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		uint64_t txg = dmu_tx_get_txg(tx);
+
+		dsl_sync_task_nowait(dp, vdev_raidz_expand_complete_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+		dmu_tx_commit(tx);
+
+		txg_wait_synced(dp, txg);
+	}
+
+	mutex_enter(&vre->vre_lock);
+	vre->vre_thread = NULL;
+	if (error == 0 && spa->spa_raidz_expand == vre)
+		spa->spa_raidz_expand = NULL;
+	cv_broadcast(&vre->vre_cv);
+	mutex_exit(&vre->vre_lock);
+
+	thread_exit();
+}
+
+/*
+ * Start the expansion of a raidz vdev whose last child was just attached.
+ * Called with the config lock held as writer; the reflow thread is started
+ * by vdev_raidz_expand_restart() once the attach is committed.
+ */
+void
+vdev_raidz_attach(vdev_t *vd, dmu_tx_t *tx)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+	vdev_raidz_expand_t *vre = &vdrz->vd_expand;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_raidz_ops);
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
+	ASSERT3P(spa->spa_raidz_expand, ==, NULL);
+	ASSERT(!vdrz->vd_expanding);
+
+	vdrz->vd_expanding = B_TRUE;
+
+	mutex_enter(&vre->vre_lock);
+	vre->vre_vdev_id = vd->vdev_id;
+	vre->vre_offset = 0;
+	bzero(&vre->vre_phys, sizeof (vre->vre_phys));
+	vre->vre_phys.vrep_state = DSS_SCANNING;
+	vre->vre_phys.vrep_start_time = gethrestime_sec();
+	vre->vre_phys.vrep_bytes_to_reflow = vd->vdev_stat.vs_alloc;
+	mutex_exit(&vre->vre_lock);
+
+	spa->spa_raidz_expand = vre;
+
+	dsl_sync_task_nowait(spa_get_dsl(spa), vdev_raidz_expand_attach_sync,
+	    (void *)(uintptr_t)vd->vdev_id, 0, ZFS_SPACE_CHECK_NONE, tx);
+}
+
+/*
+ * Start the reflow thread of the expansion in progress, if any.
+ */
+void
+vdev_raidz_expand_restart(spa_t *spa)
+{
+	vdev_raidz_expand_t *vre = spa->spa_raidz_expand;
+	vdev_t *vd;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	if (vre == NULL || !spa_writeable(spa))
+		return;
+
+	vd = spa->spa_root_vdev->vdev_child[vre->vre_vdev_id];
+	ASSERT3P(vd->vdev_ops, ==, &vdev_raidz_ops);
+
+	mutex_enter(&vre->vre_lock);
+	if (vre->vre_thread == NULL && vdev_writeable(vd) &&
+	    !vd->vdev_removing &&
+	    ((vdev_raidz_t *)vd->vdev_tsd)->vd_expanding) {
+		vre->vre_thread = thread_create(NULL, 0,
+		    vdev_raidz_expand_thread, vd, 0, &p0, TS_RUN,
+		    maxclsyspri);
+		ASSERT(vre->vre_thread != NULL);
+	}
+	mutex_exit(&vre->vre_lock);
+}
+
+/*
+ * Wait for the reflow thread to be suspended.  The reflow resumes from
+ * where it was when the thread is restarted.
+ */
+void
+vdev_raidz_expand_stop_all(spa_t *spa)
+{
+	vdev_raidz_expand_t *vre = spa->spa_raidz_expand;
+
+	if (vre == NULL)
+		return;
+
+	mutex_enter(&vre->vre_lock);
+	if (vre->vre_thread != NULL) {
+		vre->vre_exit_wanted = B_TRUE;
+		cv_broadcast(&vre->vre_cv);
+
+		while (vre->vre_thread != NULL)
+			cv_wait(&vre->vre_cv, &vre->vre_lock);
+
+		vre->vre_exit_wanted = B_FALSE;
+	}
+	mutex_exit(&vre->vre_lock);
+}
+
+/*
+ * Load the expansion state of a raidz vdev.  The reflow offset of an
+ * expansion in progress is that of the uberblock the pool was loaded from.
+ */
+int
+vdev_raidz_load(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+	vdev_raidz_expand_t *vre = &vdrz->vd_expand;
+	int err = 0;
+
+	mutex_enter(&vre->vre_lock);
+
+	if (vd->vdev_top_zap != 0) {
+		err = zap_lookup(spa->spa_meta_objset, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS, sizeof (uint64_t),
+		    RAIDZ_EXPAND_PHYS_ENTRIES, &vre->vre_phys);
+	}
+
+	/*
+	 * The on-disk state is only used for reporting, a missing or
+	 * damaged one does not prevent the pool from being imported.
+	 */
+	if (vd->vdev_top_zap == 0 ||
+	    err == ENOENT || err == EOVERFLOW || err == ECKSUM) {
+		bzero(&vre->vre_phys, sizeof (vre->vre_phys));
+	} else if (err != 0) {
+		mutex_exit(&vre->vre_lock);
+		return (err);
+	}
+
+	if (vdrz->vd_expanding) {
+		vre->vre_vdev_id = vd->vdev_id;
+		vre->vre_offset = spa->spa_uberblock.ub_raidz_reflow_info;
+		vre->vre_phys.vrep_state = DSS_SCANNING;
+		spa->spa_raidz_expand = vre;
+	}
+
+	mutex_exit(&vre->vre_lock);
+
+	return (0);
+}
+
+int
+vdev_raidz_config_create(nvlist_t *nv, void **tsd)
+{
+	nvlist_t **child;
+	uint_t children, nexpand = 0;
+	uint64_t *txgs = NULL;
+	boolean_t expanding;
+	vdev_raidz_t *vdrz;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (SET_ERROR(EINVAL));
+
+	expanding = nvlist_exists(nv, ZPOOL_CONFIG_RAIDZ_EXPANDING);
+	if (nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_RAIDZ_EXPAND_TXGS,
+	    &txgs, &nexpand) == 0 && nexpand % 2 != 0)
+		return (SET_ERROR(EINVAL));
+	nexpand /= 2;
+
+	if (children < nexpand + (expanding ? 1 : 0) + 2)
+		return (SET_ERROR(EINVAL));
+
+	vdrz = kmem_zalloc(sizeof (*vdrz), KM_SLEEP);
+	vdrz->vd_original_width = children - nexpand - (expanding ? 1 : 0);
+	vdrz->vd_nexpand = nexpand;
+	vdrz->vd_expanding = expanding;
+	if (nexpand > 0) {
+		vdrz->vd_expand_txgs = kmem_alloc(2 * nexpand *
+		    sizeof (uint64_t), KM_SLEEP);
+		bcopy(txgs, vdrz->vd_expand_txgs, 2 * nexpand *
+		    sizeof (uint64_t));
+	}
+	rw_init(&vdrz->vd_expand_lock, NULL, RW_DEFAULT, NULL);
+
+	mutex_init(&vdrz->vd_expand.vre_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vdrz->vd_expand.vre_cv, NULL, CV_DEFAULT, NULL);
+	zfs_rangelock_init(&vdrz->vd_expand.vre_rangelock, NULL, NULL);
+
+	*tsd = vdrz;
+
+	return (0);
+}
+
+void
+vdev_raidz_config_free(vdev_t *vd)
+{
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+
+	if (vdrz == NULL)
+		return;
+
+	ASSERT3P(vdrz->vd_expand.vre_thread, ==, NULL);
+	if (vd->vdev_spa->spa_raidz_expand == &vdrz->vd_expand)
+		vd->vdev_spa->spa_raidz_expand = NULL;
+
+	zfs_rangelock_fini(&vdrz->vd_expand.vre_rangelock);
+	cv_destroy(&vdrz->vd_expand.vre_cv);
+	mutex_destroy(&vdrz->vd_expand.vre_lock);
+	rw_destroy(&vdrz->vd_expand_lock);
+
+	if (vdrz->vd_nexpand > 0) {
+		kmem_free(vdrz->vd_expand_txgs, 2 * vdrz->vd_nexpand *
+		    sizeof (uint64_t));
+	}
+	kmem_free(vdrz, sizeof (*vdrz));
+
+	vd->vdev_tsd = NULL;
+}
+
+void
+vdev_raidz_config_generate(vdev_t *vd, nvlist_t *nv)
+{
+	vdev_raidz_t *vdrz = vd->vdev_tsd;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_raidz_ops);
+
+	if (vdrz->vd_expanding)
+		fnvlist_add_boolean(nv, ZPOOL_CONFIG_RAIDZ_EXPANDING);
+
+	rw_enter(&vdrz->vd_expand_lock, RW_READER);
+	if (vdrz->vd_nexpand > 0) {
+		fnvlist_add_uint64_array(nv, ZPOOL_CONFIG_RAIDZ_EXPAND_TXGS,
+		    vdrz->vd_expand_txgs, 2 * vdrz->vd_nexpand);
+	}
+	rw_exit(&vdrz->vd_expand_lock);
+}
+
+/*
+ * Statistics of the expansion in progress or, if there is none, of the
+ * last one which completed.
+ */
+int
+spa_raidz_expand_get_stats(spa_t *spa, pool_raidz_expand_stat_t *pres)
+{
+	vdev_raidz_expand_t *vre = spa->spa_raidz_expand;
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	if (vre == NULL) {
+		for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+			vdev_t *tvd = rvd->vdev_child[c];
+			vdev_raidz_expand_t *tvre;
+
+			if (tvd->vdev_ops != &vdev_raidz_ops)
+				continue;
+
+			tvre = &((vdev_raidz_t *)tvd->vdev_tsd)->vd_expand;
+			if (tvre->vre_phys.vrep_state != DSS_NONE &&
+			    (vre == NULL || tvre->vre_phys.vrep_end_time >
+			    vre->vre_phys.vrep_end_time))
+				vre = tvre;
+		}
+	}
+
+	if (vre == NULL)
+		return (SET_ERROR(ENOENT));
+
+	mutex_enter(&vre->vre_lock);
+	bzero(pres, sizeof (*pres));
+	pres->pres_state = vre->vre_phys.vrep_state;
+	pres->pres_expanding_vdev = vre->vre_vdev_id;
+	pres->pres_start_time = vre->vre_phys.vrep_start_time;
+	pres->pres_end_time = vre->vre_phys.vrep_end_time;
+	pres->pres_to_reflow = vre->vre_phys.vrep_bytes_to_reflow;
+	pres->pres_reflowed = vre->vre_phys.vrep_bytes_reflowed;
+	mutex_exit(&vre->vre_lock);
+
+	return (0);
+}
+
 vdev_ops_t vdev_raidz_ops = {
 	.vdev_op_open = vdev_raidz_open,
 	.vdev_op_close = vdev_raidz_close,
@@ -2419,3 +4009,13 @@ vdev_ops_t vdev_raidz_ops = {
 	.vdev_op_type = VDEV_TYPE_RAIDZ,	/* name of this vdev type */
 	.vdev_op_leaf = B_FALSE			/* not a leaf vdev */
 };
+
+#if defined(_KERNEL)
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, raidz_expand_max_copy_bytes, ULONG, ZMOD_RW,
+	"Max amount of concurrent i/o for RAIDZ expansion");
+
+ZFS_MODULE_PARAM(zfs, zfs_, raidz_expand_max_reflow_bytes, ULONG, ZMOD_RW,
+	"For testing, pause RAIDZ expansion after reflowing this many bytes");
+/* END CSTYLED */
+#endif
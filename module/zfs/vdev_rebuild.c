@@ -0,0 +1,941 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/vdev_impl.h>
+#include <sys/vdev_rebuild.h>
+#include <sys/spa_impl.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_synctask.h>
+#include <sys/metaslab_impl.h>
+#include <sys/dmu_tx.h>
+#include <sys/zap.h>
+#include <sys/zio.h>
+#include <sys/zfeature.h>
+
+/*
+ * This file contains the sequential reconstruction implementation for
+ * resilvering.  This form of resilvering is internally referred to as
+ * device rebuild to avoid conflating it with the traditional healing
+ * reconstruction performed by the dsl scan code.
+ *
+ * When replacing a device, or scrubbing the pool, ZFS has historically used
+ * a process called resilvering which is a form of healing reconstruction.
+ * This approach has the advantage that as blocks are read from disk their
+ * checksums can be immediately verified and the data repaired.  Unfortunately,
+ * it also results in a random IO pattern to the disk even when extra care
+ * is taken to sequentialize the IO as much as possible.  This substantially
+ * increases the time required to resilver the pool and restore redundancy.
+ *
+ * For mirrored devices it's possible to implement an alternate sequential
+ * reconstruction strategy when resilvering.  Sequential reconstruction
+ * behaves like a traditional RAID rebuild and reconstructs a device in LBA
+ * order without verifying the checksum.  After this phase completes a second
+ * scrub phase is started to verify all of the checksums.  This two phase
+ * process will take longer than the healing reconstruction described above.
+ * However, it has that advantage that after the reconstruction first phase
+ * completes redundancy has been restored.  At this point the pool can incur
+ * another device failure without risking data loss.
+ *
+ * There are a few noteworthy limitations and other advantages of resilvering
+ * using sequential reconstruction vs healing reconstruction.
+ *
+ * Limitations:
+ *
+ *   - Only supported for mirror vdev types.  Due to the variable stripe
+ *     width used by raidz and dRAID sequential reconstruction is not
+ *     possible; the allocated ranges alone do not describe the columns.
+ *
+ *   - Block checksums are not verified during sequential reconstruction.
+ *     Similar to traditional RAID the parity/mirror data is reconstructed
+ *     but cannot be immediately double checked.  For this reason when the
+ *     last active resilver in a pool completes the pool is automatically
+ *     scrubbed.
+ *
+ *   - Deferred resilvers using sequential reconstruction are not currently
+ *     supported.  When adding another vdev to an active top-level resilver
+ *     it must be restarted.
+ *
+ * Advantages:
+ *
+ *   - Sequential reconstruction is performed in LBA order which may be faster
+ *     than healing reconstruction particularly when using HDDs (or
+ *     especially with SMR devices).  Only allocated capacity is resilvered.
+ *
+ *   - Sequential reconstruction is not constrained by ZFS block boundaries.
+ *     This allows it to issue larger IOs to disk which span multiple blocks
+ *     allowing all of these logical blocks to be repaired with a single IO.
+ *
+ *   - Unlike a healing resilver or scrub which are pool wide operations,
+ *     sequential reconstruction is handled by the top-level mirror vdevs.
+ *     This allows for it to be started or canceled on a top-level vdev
+ *     without impacting any other top-level vdevs in the pool.
+ *
+ *   - Data only referenced by a pool checkpoint will be repaired because
+ *     that space is reflected in the space maps.  This differs for a
+ *     healing reconstruction resilver or scrub which will not repair that
+ *     data.
+ */
+
+
+/*
+ * Maximum size of rebuild I/Os.  Larger extents are split in to multiple
+ * I/Os of at most this size; the value is further capped at
+ * SPA_MAXBLOCKSIZE.
+ */
+unsigned long zfs_rebuild_max_segment = 1024 * 1024;
+
+/*
+ * Maximum number of bytes of rebuild I/O allowed to be in flight for each
+ * child of the top-level vdev being rebuilt.  Increasing this value may
+ * improve rebuild performance at the expense of the latency of other
+ * pool I/O.  The number of concurrent I/Os issued to the devices is
+ * controlled by the zfs_vdev_scrub_min_active and zfs_vdev_scrub_max_active
+ * module options.
+ */
+unsigned long zfs_rebuild_vdev_limit = 32 << 20;
+
+/*
+ * Automatically start a pool scrub when the last active sequential
+ * resilver completes in order to verify the checksums of all blocks
+ * which have been resilvered.  This option is enabled by default and
+ * is strongly recommended.
+ */
+int zfs_rebuild_scrub_enabled = 1;
+
+static void vdev_rebuild_thread(void *arg);
+
+/*
+ * Clear the per-pass statistics.  The pass statistics are used to
+ * calculate the current rebuild rate and are not stored on disk.
+ */
+static void
+vdev_rebuild_reset_pass(vdev_rebuild_t *vr)
+{
+	vr->vr_pass_start_time = gethrtime();
+	vr->vr_pass_bytes_scanned = 0;
+	vr->vr_pass_bytes_issued = 0;
+}
+
+/*
+ * Determines whether a vdev_rebuild_thread() should be stopped.
+ */
+static boolean_t
+vdev_rebuild_should_stop(vdev_t *vd)
+{
+	return (vd->vdev_rebuild_exit_wanted || !vdev_writeable(vd) ||
+	    vd->vdev_removing);
+}
+
+/*
+ * Returns true if any leaf of the passed vdev was attached for a sequential
+ * rebuild and has not yet been detached.  When every such leaf has been
+ * detached there is nothing left to rebuild and the rebuild is canceled.
+ */
+static boolean_t
+vdev_rebuild_needed(vdev_t *vd)
+{
+	if (vd->vdev_ops->vdev_op_leaf)
+		return (vd->vdev_rebuild_txg != 0 && !vd->vdev_detached);
+
+	for (uint64_t i = 0; i < vd->vdev_children; i++) {
+		if (vdev_rebuild_needed(vd->vdev_child[i]))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Update the on-disk rebuild state for the passed top-level vdev.  This is
+ * dispatched as a sync task at most once per txg while the rebuild is
+ * issuing I/O, and records the last offset which is known to have been
+ * completely rebuilt in that txg.
+ */
+static void
+vdev_rebuild_zap_update_sync(void *arg, dmu_tx_t *tx)
+{
+	/*
+	 * We pass in the vdev id instead of the vdev_t since the vdev may
+	 * have been removed or freed prior to the sync task being processed.
+	 */
+	uint64_t vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	if (vd == NULL)
+		return;
+
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	if (vd->vdev_top_zap == 0 ||
+	    vrp->vrp_rebuild_state == VDEV_REBUILD_NONE) {
+		vr->vr_scan_offset[txg & TXG_MASK] = 0;
+		mutex_exit(&vd->vdev_rebuild_lock);
+		return;
+	}
+
+	if (vr->vr_scan_offset[txg & TXG_MASK] > 0) {
+		vrp->vrp_last_offset = vr->vr_scan_offset[txg & TXG_MASK];
+		vr->vr_scan_offset[txg & TXG_MASK] = 0;
+	}
+
+	vrp->vrp_scan_time_ms = vr->vr_prev_scan_time_ms +
+	    NSEC2MSEC(gethrtime() - vr->vr_pass_start_time);
+
+	VERIFY0(zap_update(vd->vdev_spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp, tx));
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Initialize the on-disk state for a new rebuild, start the rebuild thread.
+ */
+static void
+vdev_rebuild_initiate_sync(void *arg, dmu_tx_t *tx)
+{
+	uint64_t vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	vdev_rebuild_phys_t old_vrp;
+
+	ASSERT(vd->vdev_top_zap != 0);
+
+	/*
+	 * The feature is reference counted once per active rebuild; a rebuild
+	 * which is being restarted before it completed is already counted.
+	 */
+	if (zap_lookup(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, &old_vrp) != 0 ||
+	    old_vrp.vrp_rebuild_state != VDEV_REBUILD_ACTIVE)
+		spa_feature_incr(spa, SPA_FEATURE_DEVICE_REBUILD, tx);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	VERIFY0(zap_update(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp, tx));
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu started",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+}
+
+/*
+ * Reset the in-core and on-disk rebuild state for the top-level vdev and
+ * wait until it has been written.  Called by the rebuild thread when it
+ * was asked to (re)start the rebuild from the beginning.
+ */
+static void
+vdev_rebuild_initiate(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	ASSERT(vd->vdev_top == vd);
+
+	dmu_tx_t *tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+	vrp->vrp_rebuild_state = VDEV_REBUILD_ACTIVE;
+	vrp->vrp_min_txg = 0;
+	vrp->vrp_max_txg = txg + TXG_CONCURRENT_STATES;
+	vrp->vrp_bytes_est = vd->vdev_stat.vs_alloc;
+	vrp->vrp_start_time = gethrestime_sec();
+
+	for (int i = 0; i < TXG_SIZE; i++)
+		vr->vr_scan_offset[i] = 0;
+	vr->vr_prev_scan_time_ms = 0;
+	vdev_rebuild_reset_pass(vr);
+	uint64_t max_txg = vrp->vrp_max_txg;
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	dsl_sync_task_nowait(spa_get_dsl(spa), vdev_rebuild_initiate_sync,
+	    (void *)(uintptr_t)vd->vdev_id, 0, ZFS_SPACE_CHECK_NONE, tx);
+	dmu_tx_commit(tx);
+
+	/*
+	 * Wait until every txg which may contain blocks missing from the
+	 * new device has synced so all of its allocations are reflected
+	 * in the space maps which are about to be scanned.
+	 */
+	txg_wait_synced(spa_get_dsl(spa), max_txg);
+}
+
+/*
+ * Record the successful completion of the rebuild, excise the rebuilt
+ * ranges from the DTLs of the new devices, and request that any
+ * replaced or spared devices be detached.
+ */
+static void
+vdev_rebuild_complete_sync(void *arg, dmu_tx_t *tx)
+{
+	uint64_t vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vrp->vrp_rebuild_state = VDEV_REBUILD_COMPLETE;
+	vrp->vrp_end_time = gethrestime_sec();
+	vrp->vrp_scan_time_ms = vr->vr_prev_scan_time_ms +
+	    NSEC2MSEC(gethrtime() - vr->vr_pass_start_time);
+
+	VERIFY0(zap_update(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp, tx));
+
+	/*
+	 * Every allocated range at or below vrp_max_txg has now been copied
+	 * to the new devices.  Their DTLs can be excised up to that txg.
+	 */
+	vdev_dtl_reassess(vd, tx->tx_txg, vrp->vrp_max_txg, B_FALSE, B_TRUE);
+	spa_feature_decr(spa, SPA_FEATURE_DEVICE_REBUILD, tx);
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu complete",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+
+	vd->vdev_rebuilding = B_FALSE;
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	spa_async_request(spa, SPA_ASYNC_REBUILD_DONE);
+}
+
+/*
+ * Record that the rebuild was canceled because none of the devices it was
+ * started for remain attached.
+ */
+static void
+vdev_rebuild_cancel_sync(void *arg, dmu_tx_t *tx)
+{
+	uint64_t vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_rebuild_phys_t *vrp = &vd->vdev_rebuild_config.vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vrp->vrp_rebuild_state = VDEV_REBUILD_CANCELED;
+	vrp->vrp_end_time = gethrestime_sec();
+
+	VERIFY0(zap_update(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp, tx));
+	spa_feature_decr(spa, SPA_FEATURE_DEVICE_REBUILD, tx);
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu canceled",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+
+	vd->vdev_rebuilding = B_FALSE;
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * The zio_done_func_t callback for each rebuild I/O issued.  It's
+ * responsible for updating the rebuild stats and limiting the number
+ * of in flight rebuild I/Os.
+ */
+static void
+vdev_rebuild_cb(zio_t *zio)
+{
+	vdev_rebuild_t *vr = zio->io_private;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	vdev_t *vd = vr->vr_top_vdev;
+
+	mutex_enter(&vr->vr_io_lock);
+	if (zio->io_error == ENXIO && !vdev_writeable(vd)) {
+		/*
+		 * The I/O failed because the top-level vdev was unavailable.
+		 * Attempt to roll back to the last completed offset, in order
+		 * resume from the correct location if the pool is resumed.
+		 * (This works because spa_sync waits on spa_txg_zio before
+		 * it runs sync tasks.)
+		 */
+		uint64_t *off = &vr->vr_scan_offset[zio->io_txg & TXG_MASK];
+		*off = MIN(*off, zio->io_offset);
+	} else if (zio->io_error) {
+		vrp->vrp_errors++;
+	} else {
+		vrp->vrp_bytes_rebuilt += zio->io_size;
+	}
+
+	abd_free(zio->io_abd);
+
+	ASSERT3U(vr->vr_bytes_inflight, >, 0);
+	vr->vr_bytes_inflight -= zio->io_size;
+	cv_broadcast(&vr->vr_io_cv);
+	mutex_exit(&vr->vr_io_lock);
+
+	spa_config_exit(vd->vdev_spa, SCL_STATE_ALL, vd);
+}
+
+/*
+ * Rebuild the data in this range by constructing a special dummy block
+ * pointer for the given range.  It has no relation to any existing blocks
+ * in the pool.  But by disabling checksum verification and issuing a scrub
+ * I/O mirrored vdevs will replicate the block using any available mirror
+ * leaf vdevs.
+ */
+static void
+vdev_rebuild_rebuild_block(vdev_rebuild_t *vr, uint64_t start, uint64_t asize,
+    uint64_t txg)
+{
+	vdev_t *vd = vr->vr_top_vdev;
+	spa_t *spa = vd->vdev_spa;
+	uint64_t psize = asize;
+
+	ASSERT(vd->vdev_ops == &vdev_mirror_ops ||
+	    vd->vdev_ops == &vdev_replacing_ops ||
+	    vd->vdev_ops == &vdev_spare_ops);
+
+	blkptr_t blk, *bp = &blk;
+	BP_ZERO(bp);
+
+	DVA_SET_VDEV(&bp->blk_dva[0], vd->vdev_id);
+	DVA_SET_OFFSET(&bp->blk_dva[0], start);
+	DVA_SET_GANG(&bp->blk_dva[0], 0);
+	DVA_SET_ASIZE(&bp->blk_dva[0], asize);
+
+	BP_SET_BIRTH(bp, TXG_INITIAL, TXG_INITIAL);
+	BP_SET_LSIZE(bp, psize);
+	BP_SET_PSIZE(bp, psize);
+	BP_SET_COMPRESS(bp, ZIO_COMPRESS_OFF);
+	BP_SET_CHECKSUM(bp, ZIO_CHECKSUM_OFF);
+	BP_SET_TYPE(bp, DMU_OT_NONE);
+	BP_SET_LEVEL(bp, 0);
+	BP_SET_DEDUP(bp, 0);
+	BP_SET_BYTEORDER(bp, ZFS_HOST_BYTEORDER);
+
+	/*
+	 * We increment the issued bytes by the asize rather than the psize
+	 * so the scanned and issued bytes may be directly compared.  This
+	 * is consistent with the scrub/resilver issued reporting.
+	 */
+	vr->vr_pass_bytes_issued += asize;
+	vr->vr_rebuild_phys.vrp_bytes_issued += asize;
+
+	zio_nowait(zio_read(spa->spa_txg_zio[txg & TXG_MASK], spa, bp,
+	    abd_alloc(psize, B_FALSE), psize, vdev_rebuild_cb, vr,
+	    ZIO_PRIORITY_SCRUB, ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_RESILVER, NULL));
+}
+
+/*
+ * Issues a rebuild I/O and takes care of limiting the number of bytes
+ * of rebuild I/O in flight.
+ */
+static int
+vdev_rebuild_range(vdev_rebuild_t *vr, uint64_t start, uint64_t size)
+{
+	vdev_t *vd = vr->vr_top_vdev;
+	spa_t *spa = vd->vdev_spa;
+
+	/* Limit in flight rebuild I/Os */
+	mutex_enter(&vr->vr_io_lock);
+	while (vr->vr_bytes_inflight >= vr->vr_bytes_inflight_max)
+		cv_wait(&vr->vr_io_cv, &vr->vr_io_lock);
+
+	vr->vr_bytes_inflight += size;
+	mutex_exit(&vr->vr_io_lock);
+
+	dmu_tx_t *tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	spa_config_enter(spa, SCL_STATE_ALL, vd, RW_READER);
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	/* This is the first I/O for this txg. */
+	if (vr->vr_scan_offset[txg & TXG_MASK] == 0) {
+		vr->vr_scan_offset[txg & TXG_MASK] = start;
+		dsl_sync_task_nowait(spa_get_dsl(spa),
+		    vdev_rebuild_zap_update_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+	}
+
+	/*
+	 * We know the vdev_t will still be around since all consumers of
+	 * vdev_free must stop the rebuilding first.
+	 */
+	if (vdev_rebuild_should_stop(vd)) {
+		mutex_enter(&vr->vr_io_lock);
+		vr->vr_bytes_inflight -= size;
+		mutex_exit(&vr->vr_io_lock);
+		spa_config_exit(vd->vdev_spa, SCL_STATE_ALL, vd);
+		mutex_exit(&vd->vdev_rebuild_lock);
+		dmu_tx_commit(tx);
+		return (SET_ERROR(EINTR));
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	vr->vr_scan_offset[txg & TXG_MASK] = start + size;
+	vdev_rebuild_rebuild_block(vr, start, size, txg);
+	/* vdev_rebuild_cb releases SCL_STATE_ALL */
+
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+/*
+ * Issues rebuild I/Os for all ranges in the vr->vr_scan_tree range tree.
+ * Extents larger than zfs_rebuild_max_segment are split.  Ranges are
+ * removed from the tree as they are issued, on error the tree may still
+ * contain unprocessed ranges which the caller must vacate.
+ */
+static int
+vdev_rebuild_ranges(vdev_rebuild_t *vr)
+{
+	uint64_t max_segment = MIN(MAX(zfs_rebuild_max_segment,
+	    SPA_MINBLOCKSIZE), SPA_MAXBLOCKSIZE);
+	range_seg_t *rs;
+	int error = 0;
+
+	while ((rs = range_tree_first(vr->vr_scan_tree)) != NULL) {
+		uint64_t start = rs->rs_start;
+		uint64_t size = rs->rs_end - rs->rs_start;
+
+		range_tree_remove(vr->vr_scan_tree, start, size);
+
+		while (size > 0) {
+			uint64_t chunk = MIN(size, max_segment);
+
+			vr->vr_pass_bytes_scanned += chunk;
+			vr->vr_rebuild_phys.vrp_bytes_scanned += chunk;
+
+			error = vdev_rebuild_range(vr, start, chunk);
+			if (error != 0)
+				return (error);
+
+			start += chunk;
+			size -= chunk;
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Each top-level vdev which requires a rebuild is handled by a separate
+ * vdev_rebuild_thread().  It walks the metaslabs in LBA order, and for
+ * each one constructs the set of allocated ranges which are then read
+ * from the healthy children and written to the devices being rebuilt.
+ */
+static void
+vdev_rebuild_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	boolean_t cancel = B_FALSE;
+	int error = 0;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	ASSERT3P(vd->vdev_top, ==, vd);
+	ASSERT3P(vd->vdev_rebuild_thread, !=, NULL);
+	ASSERT(vd->vdev_rebuilding);
+	boolean_t reset = vd->vdev_rebuild_reset_wanted;
+	vd->vdev_rebuild_reset_wanted = B_FALSE;
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	if (reset)
+		vdev_rebuild_initiate(vd);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vr->vr_top_vdev = vd;
+	vr->vr_scan_msp = NULL;
+	vr->vr_scan_tree = range_tree_create(NULL, NULL);
+	vr->vr_bytes_inflight_max = MAX(1ULL, zfs_rebuild_vdev_limit) *
+	    MAX(1ULL, vd->vdev_children);
+	vr->vr_prev_scan_time_ms = vrp->vrp_scan_time_ms;
+	vdev_rebuild_reset_pass(vr);
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+	for (uint64_t i = 0; i < vd->vdev_ms_count; i++) {
+		metaslab_t *msp = vd->vdev_ms[i];
+
+		/* Skip metaslabs which have already been rebuilt. */
+		if (msp->ms_start + msp->ms_size <= vrp->vrp_last_offset)
+			continue;
+
+		if (vdev_rebuild_should_stop(vd)) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		if (!vdev_rebuild_needed(vd)) {
+			cancel = B_TRUE;
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		/*
+		 * Disable any new allocations to this metaslab and wait for
+		 * any writes in flight to be synced.  This is needed to
+		 * ensure all allocated ranges are rebuilt and that no range
+		 * is overwritten with stale contents.
+		 */
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		metaslab_disable(msp);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+
+		mutex_enter(&msp->ms_lock);
+		vr->vr_scan_msp = msp;
+
+		/*
+		 * The allocated ranges of a metaslab are the complement of
+		 * its allocatable tree.  This includes recently freed or
+		 * deferred ranges which is harmless.  Ranges which have
+		 * already been rebuilt, as recorded by vrp_last_offset, are
+		 * cleared.  This can happen when resuming a rebuild after
+		 * the pool was exported and imported.
+		 */
+		if (msp->ms_sm != NULL) {
+			VERIFY0(metaslab_load(msp));
+
+			range_tree_add(vr->vr_scan_tree, msp->ms_start,
+			    msp->ms_size);
+			range_tree_walk(msp->ms_allocatable, range_tree_remove,
+			    vr->vr_scan_tree);
+			range_tree_clear(vr->vr_scan_tree, 0,
+			    vrp->vrp_last_offset);
+		}
+		mutex_exit(&msp->ms_lock);
+
+		error = vdev_rebuild_ranges(vr);
+		range_tree_vacate(vr->vr_scan_tree, NULL, NULL);
+
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+		metaslab_enable(msp, B_FALSE);
+		vr->vr_scan_msp = NULL;
+
+		if (error != 0)
+			break;
+	}
+
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+	/* Wait for any remaining rebuild I/O to complete */
+	mutex_enter(&vr->vr_io_lock);
+	while (vr->vr_bytes_inflight > 0)
+		cv_wait(&vr->vr_io_cv, &vr->vr_io_lock);
+	mutex_exit(&vr->vr_io_lock);
+
+	range_tree_destroy(vr->vr_scan_tree);
+	vr->vr_scan_tree = NULL;
+
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dmu_tx_t *tx = dmu_tx_create_dd(dp->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	uint64_t txg = dmu_tx_get_txg(tx);
+	boolean_t wait = B_TRUE;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	if (error == 0) {
+		/*
+		 * After a successful rebuild clear the DTLs of all ranges
+		 * which were missing when the rebuild was started.
+		 */
+		dsl_sync_task_nowait(dp, vdev_rebuild_complete_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+	} else if (cancel || vd->vdev_rebuild_cancel_wanted) {
+		/*
+		 * The rebuild was canceled.  This will happen when all the
+		 * devices it was started for have been detached.
+		 */
+		vd->vdev_rebuild_cancel_wanted = B_FALSE;
+		dsl_sync_task_nowait(dp, vdev_rebuild_cancel_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+	} else {
+		/*
+		 * The rebuild was suspended.  This typically happens as a
+		 * result of the pool being exported or vdev configuration
+		 * changes.  The on-disk state remains active and the rebuild
+		 * will be resumed from vrp_last_offset by
+		 * vdev_rebuild_restart().
+		 */
+		vd->vdev_rebuilding = B_FALSE;
+		wait = B_FALSE;
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	dmu_tx_commit(tx);
+
+	/*
+	 * Keep the thread registered until the final state is on disk so
+	 * that vdev_rebuild_restart() cannot observe the still active
+	 * in-core state and start a duplicate rebuild.
+	 */
+	if (wait)
+		txg_wait_synced(dp, txg);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vd->vdev_rebuild_thread = NULL;
+	cv_broadcast(&vd->vdev_rebuild_cv);
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Returns B_TRUE if any top-level vdev below the passed vdev is rebuilding.
+ */
+boolean_t
+vdev_rebuild_active(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	boolean_t ret = B_FALSE;
+
+	if (vd == spa->spa_root_vdev) {
+		for (uint64_t i = 0; i < vd->vdev_children; i++) {
+			ret = vdev_rebuild_active(vd->vdev_child[i]);
+			if (ret)
+				return (ret);
+		}
+	} else if (vd->vdev_top_zap != 0) {
+		vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+		vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+		mutex_enter(&vd->vdev_rebuild_lock);
+		ret = (vrp->vrp_rebuild_state == VDEV_REBUILD_ACTIVE);
+		mutex_exit(&vd->vdev_rebuild_lock);
+	}
+
+	return (ret);
+}
+
+/*
+ * Load the rebuild phys from the top-level vdev ZAP if present.  A missing
+ * entry means no rebuild was ever started and the state is left empty.
+ */
+int
+vdev_rebuild_load(vdev_t *vd)
+{
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	spa_t *spa = vd->vdev_spa;
+	int err = 0;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vd->vdev_rebuilding = B_FALSE;
+
+	if (vd->vdev_top_zap == 0) {
+		bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+		mutex_exit(&vd->vdev_rebuild_lock);
+		return (0);
+	}
+
+	ASSERT(vd->vdev_top == vd);
+
+	err = zap_lookup(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp);
+
+	/*
+	 * A missing or damaged VDEV_TOP_ZAP_VDEV_REBUILD_PHYS should
+	 * not prevent a pool from being imported.  Clear the rebuild
+	 * status allowing a new resilver/rebuild to be started.
+	 */
+	if (err == ENOENT || err == EOVERFLOW || err == ECKSUM) {
+		bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+	} else if (err) {
+		mutex_exit(&vd->vdev_rebuild_lock);
+		return (err);
+	}
+
+	vr->vr_prev_scan_time_ms = vrp->vrp_scan_time_ms;
+	vr->vr_top_vdev = vd;
+	vdev_rebuild_reset_pass(vr);
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	return (0);
+}
+
+/*
+ * Request a new rebuild of the passed top-level vdev.  Any rebuild which
+ * is already active on this vdev is restarted from the beginning so the
+ * newly attached device is included.  The rebuild thread itself is started
+ * by vdev_rebuild_restart() once the configuration change is committed.
+ */
+void
+vdev_rebuild(vdev_t *tvd)
+{
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+	ASSERT(tvd == tvd->vdev_top);
+	ASSERT(tvd->vdev_ops == &vdev_mirror_ops ||
+	    tvd->vdev_ops == &vdev_replacing_ops ||
+	    tvd->vdev_ops == &vdev_spare_ops);
+
+	mutex_enter(&tvd->vdev_rebuild_lock);
+	ASSERT3P(tvd->vdev_rebuild_thread, ==, NULL);
+	tvd->vdev_rebuild_reset_wanted = B_TRUE;
+	mutex_exit(&tvd->vdev_rebuild_lock);
+}
+
+/*
+ * Start a rebuild thread for each top-level vdev which either has a newly
+ * requested rebuild or an active one which was suspended, e.g. by an export
+ * or configuration change.
+ */
+void
+vdev_rebuild_restart(spa_t *spa)
+{
+	vdev_t *root_vd = spa->spa_root_vdev;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	if (!spa_writeable(spa))
+		return;
+
+	for (uint64_t i = 0; i < root_vd->vdev_children; i++) {
+		vdev_t *tvd = root_vd->vdev_child[i];
+		vdev_rebuild_phys_t *vrp =
+		    &tvd->vdev_rebuild_config.vr_rebuild_phys;
+
+		mutex_enter(&tvd->vdev_rebuild_lock);
+		if (vdev_writeable(tvd) && !tvd->vdev_removing &&
+		    tvd->vdev_top_zap != 0 &&
+		    tvd->vdev_rebuild_thread == NULL &&
+		    (tvd->vdev_rebuild_reset_wanted ||
+		    vrp->vrp_rebuild_state == VDEV_REBUILD_ACTIVE)) {
+			ASSERT3P(tvd->vdev_top, ==, tvd);
+
+			tvd->vdev_rebuilding = B_TRUE;
+			tvd->vdev_rebuild_thread = thread_create(NULL, 0,
+			    vdev_rebuild_thread, tvd, 0, &p0, TS_RUN,
+			    maxclsyspri);
+			ASSERT(tvd->vdev_rebuild_thread != NULL);
+		}
+		mutex_exit(&tvd->vdev_rebuild_lock);
+	}
+}
+
+/*
+ * Wait for the vdev_rebuild_thread associated with the passed top-level
+ * vdev to be terminated (suspended or canceled).
+ */
+void
+vdev_rebuild_stop_wait(vdev_t *vd)
+{
+	mutex_enter(&vd->vdev_rebuild_lock);
+	if (vd->vdev_rebuild_thread != NULL) {
+		vd->vdev_rebuild_exit_wanted = B_TRUE;
+
+		while (vd->vdev_rebuild_thread != NULL) {
+			cv_wait(&vd->vdev_rebuild_cv,
+			    &vd->vdev_rebuild_lock);
+		}
+
+		ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
+		vd->vdev_rebuild_exit_wanted = B_FALSE;
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Wait for all of the vdev_rebuild_thread associated with the pool to
+ * be terminated (suspended or canceled).
+ */
+void
+vdev_rebuild_stop_all(spa_t *spa)
+{
+	vdev_t *root_vd = spa->spa_root_vdev;
+
+	for (uint64_t i = 0; i < root_vd->vdev_children; i++)
+		vdev_rebuild_stop_wait(root_vd->vdev_child[i]);
+}
+
+/*
+ * Rebuild statistics reported per top-level vdev.
+ */
+int
+vdev_rebuild_get_stats(vdev_t *tvd, vdev_rebuild_stat_t *vrs)
+{
+	if (tvd != tvd->vdev_top || tvd->vdev_top_zap == 0)
+		return (SET_ERROR(EINVAL));
+
+	mutex_enter(&tvd->vdev_rebuild_lock);
+	vdev_rebuild_t *vr = &tvd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	if (vrp->vrp_rebuild_state == VDEV_REBUILD_NONE) {
+		mutex_exit(&tvd->vdev_rebuild_lock);
+		return (SET_ERROR(ENOENT));
+	}
+
+	bzero(vrs, sizeof (vdev_rebuild_stat_t));
+	vrs->vrs_state = vrp->vrp_rebuild_state;
+	vrs->vrs_start_time = vrp->vrp_start_time;
+	vrs->vrs_end_time = vrp->vrp_end_time;
+	vrs->vrs_scan_time_ms = vrp->vrp_scan_time_ms;
+	vrs->vrs_bytes_scanned = vrp->vrp_bytes_scanned;
+	vrs->vrs_bytes_issued = vrp->vrp_bytes_issued;
+	vrs->vrs_bytes_rebuilt = vrp->vrp_bytes_rebuilt;
+	vrs->vrs_bytes_est = vrp->vrp_bytes_est;
+	vrs->vrs_errors = vrp->vrp_errors;
+	vrs->vrs_pass_time_ms = NSEC2MSEC(gethrtime() -
+	    vr->vr_pass_start_time);
+	vrs->vrs_pass_bytes_scanned = vr->vr_pass_bytes_scanned;
+	vrs->vrs_pass_bytes_issued = vr->vr_pass_bytes_issued;
+	mutex_exit(&tvd->vdev_rebuild_lock);
+
+	return (0);
+}
+
+#if defined(_KERNEL)
+EXPORT_SYMBOL(vdev_rebuild);
+EXPORT_SYMBOL(vdev_rebuild_active);
+EXPORT_SYMBOL(vdev_rebuild_stop_wait);
+EXPORT_SYMBOL(vdev_rebuild_stop_all);
+EXPORT_SYMBOL(vdev_rebuild_restart);
+EXPORT_SYMBOL(vdev_rebuild_load);
+EXPORT_SYMBOL(vdev_rebuild_get_stats);
+
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_max_segment, ULONG, ZMOD_RW,
+	"Max segment size in bytes of rebuild reads");
+
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_vdev_limit, ULONG, ZMOD_RW,
+	"Max bytes in flight per leaf vdev for sequential resilvers");
+
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_scrub_enabled, INT, ZMOD_RW,
+	"Automatically scrub after sequential resilver completes");
+/* END CSTYLED */
+#endif
@@ -46,6 +46,7 @@
 #include <sys/abd.h>
 #include <sys/vdev_initialize.h>
 #include <sys/vdev_trim.h>
+#include <sys/vdev_rebuild.h>
 #ifdef __linux__
 #include <sys/trace_vdev.h>
 #endif
@@ -84,6 +85,10 @@
 typedef struct vdev_copy_arg {
 	metaslab_t	*vca_msp;
 	uint64_t	vca_outstanding_bytes;
+	uint64_t	vca_max_bytes;	/* current limit of outstanding bytes */
+	hrtime_t	vca_latency;	/* moving average copy i/o latency */
+	hrtime_t	vca_min_latency; /* lowest vca_latency seen */
+	uint64_t	vca_ios;	/* copy i/os since the last update */
 	uint64_t	vca_read_error_bytes;
 	uint64_t	vca_write_error_bytes;
 	kcondvar_t	vca_cv;
@@ -97,6 +102,19 @@ typedef struct vdev_copy_arg {
  */
 int zfs_remove_max_copy_bytes = 64 * 1024 * 1024;
 
+/*
+ * The copy starts with zfs_remove_max_copy_bytes in flight, and ramps this
+ * up to zfs_remove_max_copy_bytes_ramp as long as the average latency of
+ * the copy i/os stays within twice the lowest average seen.  When it gets
+ * worse, the limit is halved, down to zfs_remove_max_copy_bytes.  The new
+ * locations are allocated across all the remaining vdevs, so on a pool of
+ * several vdevs this keeps all of them busy rather than just one or two.
+ */
+int zfs_remove_max_copy_bytes_ramp = 512 * 1024 * 1024;
+
+/* Number of copy i/os between updates of the in-flight limit */
+#define	REMOVE_COPY_UPDATE_IOS	16
+
 /*
  * The largest contiguous segment that we will attempt to allocate when
  * removing a device.  This can be no larger than SPA_MAXBLOCKSIZE.  If
@@ -800,6 +818,50 @@ spa_vdev_copy_segment_done(zio_t *zio)
 	spa_config_exit(zio->io_spa, SCL_STATE, zio->io_spa);
 }
 
+/*
+ * Accounts the latency of a completed copy i/o, from its issue.
+ */
+static void
+spa_vdev_copy_latency(vdev_copy_arg_t *vca, zio_t *zio)
+{
+	hrtime_t delta = gethrtime() - zio->io_queued_timestamp;
+
+	ASSERT(MUTEX_HELD(&vca->vca_lock));
+
+	if (vca->vca_latency == 0)
+		vca->vca_latency = delta;
+	else
+		vca->vca_latency += (delta - vca->vca_latency) / 8;
+	vca->vca_ios++;
+}
+
+/*
+ * Ramps the in-flight limit up while the copy i/os keep their latency, or
+ * backs it off once they don't.  See zfs_remove_max_copy_bytes_ramp.
+ */
+static void
+spa_vdev_copy_update_limit(vdev_copy_arg_t *vca)
+{
+	uint64_t min_bytes = zfs_remove_max_copy_bytes;
+	uint64_t max_bytes = MAX(zfs_remove_max_copy_bytes_ramp, min_bytes);
+
+	ASSERT(MUTEX_HELD(&vca->vca_lock));
+
+	if (vca->vca_ios >= REMOVE_COPY_UPDATE_IOS) {
+		vca->vca_ios = 0;
+		if (vca->vca_min_latency == 0 ||
+		    vca->vca_latency < vca->vca_min_latency)
+			vca->vca_min_latency = vca->vca_latency;
+
+		if (vca->vca_latency > 2 * vca->vca_min_latency)
+			vca->vca_max_bytes /= 2;
+		else
+			vca->vca_max_bytes += vca->vca_max_bytes / 8;
+	}
+	vca->vca_max_bytes = MIN(MAX(vca->vca_max_bytes, min_bytes),
+	    max_bytes);
+}
+
 /*
  * The write of the new location is done.
  */
@@ -812,6 +874,7 @@ spa_vdev_copy_segment_write_done(zio_t *zio)
 
 	mutex_enter(&vca->vca_lock);
 	vca->vca_outstanding_bytes -= zio->io_size;
+	spa_vdev_copy_latency(vca, zio);
 
 	if (zio->io_error != 0)
 		vca->vca_write_error_bytes += zio->io_size;
@@ -829,11 +892,11 @@ spa_vdev_copy_segment_read_done(zio_t *zio)
 {
 	vdev_copy_arg_t *vca = zio->io_private;
 
-	if (zio->io_error != 0) {
-		mutex_enter(&vca->vca_lock);
+	mutex_enter(&vca->vca_lock);
+	spa_vdev_copy_latency(vca, zio);
+	if (zio->io_error != 0)
 		vca->vca_read_error_bytes += zio->io_size;
-		mutex_exit(&vca->vca_lock);
-	}
+	mutex_exit(&vca->vca_lock);
 
 	zio_nowait(zio_unique_parent(zio));
 }
@@ -968,15 +1031,12 @@ spa_vdev_copy_segment(vdev_t *vd, range_tree_t *segs,
 		 * additional split blocks.
 		 */
 		range_seg_t search;
-		avl_index_t where;
+		zfs_btree_index_t where;
 		search.rs_start = start + maxalloc;
 		search.rs_end = search.rs_start;
-		range_seg_t *rs = avl_find(&segs->rt_root, &search, &where);
-		if (rs == NULL) {
-			rs = avl_nearest(&segs->rt_root, where, AVL_BEFORE);
-		} else {
-			rs = AVL_PREV(&segs->rt_root, rs);
-		}
+		(void) zfs_btree_find(&segs->rt_root, &search, &where);
+		range_seg_t *rs = zfs_btree_prev(&segs->rt_root, &where,
+		    &where);
 		if (rs != NULL) {
 			size = rs->rs_end - start;
 		} else {
@@ -1013,10 +1073,11 @@ spa_vdev_copy_segment(vdev_t *vd, range_tree_t *segs,
 	 */
 	range_tree_t *obsolete_segs = range_tree_create(NULL, NULL);
 
-	range_seg_t *rs = avl_first(&segs->rt_root);
+	zfs_btree_index_t where;
+	range_seg_t *rs = zfs_btree_first(&segs->rt_root, &where);
 	ASSERT3U(rs->rs_start, ==, start);
 	uint64_t prev_seg_end = rs->rs_end;
-	while ((rs = AVL_NEXT(&segs->rt_root, rs)) != NULL) {
+	while ((rs = zfs_btree_next(&segs->rt_root, &where, &where)) != NULL) {
 		if (rs->rs_start >= start + size) {
 			break;
 		} else {
@@ -1191,6 +1252,7 @@ vdev_remove_complete(spa_t *spa)
 	ASSERT3P(vd->vdev_initialize_thread, ==, NULL);
 	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
 	ASSERT3P(vd->vdev_autotrim_thread, ==, NULL);
+	ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
 
 	sysevent_t *ev = spa_event_create(spa, vd, NULL,
 	    ESC_ZFS_VDEV_REMOVE_DEV);
@@ -1424,6 +1486,10 @@ spa_vdev_remove_thread(void *arg)
 	mutex_init(&vca.vca_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&vca.vca_cv, NULL, CV_DEFAULT, NULL);
 	vca.vca_outstanding_bytes = 0;
+	vca.vca_max_bytes = zfs_remove_max_copy_bytes;
+	vca.vca_latency = 0;
+	vca.vca_min_latency = 0;
+	vca.vca_ios = 0;
 	vca.vca_read_error_bytes = 0;
 	vca.vca_write_error_bytes = 0;
 
@@ -1483,7 +1549,7 @@ spa_vdev_remove_thread(void *arg)
 
 		vca.vca_msp = msp;
 		zfs_dbgmsg("copying %llu segments for metaslab %llu",
-		    avl_numnodes(&svr->svr_allocd_segs->rt_root),
+		    zfs_btree_numnodes(&svr->svr_allocd_segs->rt_root),
 		    msp->ms_id);
 
 		while (!svr->svr_thread_exit &&
@@ -1516,8 +1582,9 @@ spa_vdev_remove_thread(void *arg)
 				delay(hz);
 
 			mutex_enter(&vca.vca_lock);
+			spa_vdev_copy_update_limit(&vca);
 			while (vca.vca_outstanding_bytes >
-			    zfs_remove_max_copy_bytes) {
+			    vca.vca_max_bytes) {
 				cv_wait(&vca.vca_cv, &vca.vca_lock);
 			}
 			mutex_exit(&vca.vca_lock);
@@ -1924,6 +1991,7 @@ spa_vdev_remove_log(vdev_t *vd, uint64_t *txg)
 	vdev_initialize_stop_all(vd, VDEV_INITIALIZE_CANCELED);
 	vdev_trim_stop_all(vd, VDEV_TRIM_CANCELED);
 	vdev_autotrim_stop_wait(vd);
+	vdev_rebuild_stop_wait(vd);
 
 	*txg = spa_vdev_config_enter(spa);
 
@@ -2036,7 +2104,8 @@ spa_vdev_remove_top_check(vdev_t *vd)
 			num_indirect++;
 		if (!vdev_is_concrete(cvd))
 			continue;
-		if (cvd->vdev_ops == &vdev_raidz_ops)
+		if (cvd->vdev_ops == &vdev_raidz_ops ||
+		    cvd->vdev_ops == &vdev_draid_ops)
 			return (SET_ERROR(EINVAL));
 		/*
 		 * Need the mirror to be mirror of leaf vdevs only
@@ -2111,6 +2180,7 @@ spa_vdev_remove_top(vdev_t *vd, uint64_t *txg)
 	vdev_initialize_stop_all(vd, VDEV_INITIALIZE_ACTIVE);
 	vdev_trim_stop_all(vd, VDEV_TRIM_ACTIVE);
 	vdev_autotrim_stop_wait(vd);
+	vdev_rebuild_stop_wait(vd);
 
 	*txg = spa_vdev_config_enter(spa);
 
@@ -2299,6 +2369,9 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_, removal_ignore_errors, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_vdev, zfs_, remove_max_segment, UINT, ZMOD_RW,
 	"Largest contiguous segment to allocate when removing device");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_, remove_max_copy_bytes_ramp, INT, ZMOD_RW,
+	"Max bytes in flight the copy of a device removal ramps up to");
+
 ZFS_MODULE_PARAM(zfs_vdev, vdev_, removal_max_span, UINT, ZMOD_RW,
 	"Largest span of free chunks a remap segment can span");
 
@@ -28,6 +28,7 @@
 #include <sys/spa_impl.h>
 #include <sys/txg.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
 #include <sys/vdev_trim.h>
 #include <sys/refcount.h>
 #include <sys/metaslab_impl.h>
@@ -135,6 +136,22 @@ unsigned int zfs_trim_queue_limit = 10;
  */
 unsigned int zfs_trim_txg_batch = 32;
 
+/*
+ * Maximum rate, in bytes/sec, at which automatic TRIM is issued to each leaf
+ * vdev, or 0 for no limit.  Some devices stall other I/O while processing a
+ * burst of large TRIMs, so this smooths the bursts queued every
+ * zfs_trim_txg_batch txgs over time.
+ */
+unsigned long zfs_trim_auto_rate = 0;
+
+/*
+ * Maximum time, in milliseconds, an automatic TRIM I/O is held back while
+ * the latency targets of the vdev queue are being missed (see "Deadline
+ * Mode" in vdev_queue.c).  The cap keeps automatic TRIM progressing on a
+ * device which is continuously missing its targets.
+ */
+unsigned int zfs_trim_auto_backoff_ms = 1000;
+
 /*
  * The trim_args are a control structure which describe how a leaf vdev
  * should be trimmed.  The core elements are the vdev, the metaslab being
@@ -442,8 +459,9 @@ vdev_trim_range(trim_args_t *ta, uint64_t start, uint64_t size)
 	mutex_enter(&vd->vdev_trim_io_lock);
 
 	/*
-	 * Limit manual TRIM I/Os to the requested rate.  This does not
-	 * apply to automatic TRIM since no per vdev rate can be specified.
+	 * Limit manual TRIM I/Os to the requested rate.  Automatic TRIM is
+	 * limited to zfs_trim_auto_rate, and additionally backs off while
+	 * the foreground I/Os to the vdev are missing their latency targets.
 	 */
 	if (ta->trim_type == TRIM_TYPE_MANUAL) {
 		while (vd->vdev_trim_rate != 0 && !vdev_trim_should_stop(vd) &&
@@ -452,6 +470,18 @@ vdev_trim_range(trim_args_t *ta, uint64_t start, uint64_t size)
 			    &vd->vdev_trim_io_lock, ddi_get_lbolt() +
 			    MSEC_TO_TICK(10));
 		}
+	} else {
+		hrtime_t backoff_end = gethrtime() +
+		    MSEC2NSEC(zfs_trim_auto_backoff_ms);
+
+		while (!vdev_autotrim_should_stop(vd->vdev_top) &&
+		    ((zfs_trim_auto_rate != 0 &&
+		    vdev_trim_calculate_rate(ta) > zfs_trim_auto_rate) ||
+		    (vdev_queue_throttled(vd) && gethrtime() < backoff_end))) {
+			cv_timedwait_sig(&vd->vdev_trim_io_cv,
+			    &vd->vdev_trim_io_lock, ddi_get_lbolt() +
+			    MSEC_TO_TICK(10));
+		}
 	}
 	ta->trim_bytes_done += size;
 
@@ -523,7 +553,8 @@ static int
 vdev_trim_ranges(trim_args_t *ta)
 {
 	vdev_t *vd = ta->trim_vdev;
-	avl_tree_t *rt = &ta->trim_tree->rt_root;
+	zfs_btree_t *t = &ta->trim_tree->rt_root;
+	zfs_btree_index_t idx;
 	uint64_t extent_bytes_max = ta->trim_extent_bytes_max;
 	uint64_t extent_bytes_min = ta->trim_extent_bytes_min;
 	spa_t *spa = vd->vdev_spa;
@@ -531,8 +562,8 @@ vdev_trim_ranges(trim_args_t *ta)
 	ta->trim_start_time = gethrtime();
 	ta->trim_bytes_done = 0;
 
-	for (range_seg_t *rs = avl_first(rt); rs != NULL;
-	    rs = AVL_NEXT(rt, rs)) {
+	for (range_seg_t *rs = zfs_btree_first(t, &idx); rs != NULL;
+	    rs = zfs_btree_next(t, &idx, &idx)) {
 		uint64_t size = rs->rs_end - rs->rs_start;
 
 		if (extent_bytes_min && size < extent_bytes_min) {
@@ -582,6 +613,8 @@ vdev_trim_calculate_progress(vdev_t *vd)
 
 		if (vd->vdev_top->vdev_ops == &vdev_raidz_ops)
 			ms_free /= vd->vdev_top->vdev_children;
+		else if (vd->vdev_top->vdev_ops == &vdev_draid_ops)
+			ms_free /= vdev_draid_ndisks(vd->vdev_top);
 
 		/*
 		 * Convert the metaslab range to a physical range
@@ -611,8 +644,10 @@ vdev_trim_calculate_progress(vdev_t *vd)
 		 */
 		VERIFY0(metaslab_load(msp));
 
-		for (range_seg_t *rs = avl_first(&msp->ms_allocatable->rt_root);
-		    rs; rs = AVL_NEXT(&msp->ms_allocatable->rt_root, rs)) {
+		zfs_btree_t *bt = &msp->ms_allocatable->rt_root;
+		zfs_btree_index_t idx;
+		for (range_seg_t *rs = zfs_btree_first(bt, &idx);
+		    rs != NULL; rs = zfs_btree_next(bt, &idx, &idx)) {
 			logical_rs.rs_start = rs->rs_start;
 			logical_rs.rs_end = rs->rs_end;
 			vdev_xlate(vd, &logical_rs, &physical_rs);
@@ -1449,6 +1484,12 @@ ZFS_MODULE_PARAM(zfs_trim, zfs_trim_, metaslab_skip, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_trim, zfs_trim_, txg_batch, UINT, ZMOD_RW,
     "Min number of txgs to aggregate frees before issuing TRIM");
 
+ZFS_MODULE_PARAM(zfs_trim, zfs_trim_, auto_rate, ULONG, ZMOD_RW,
+    "Max rate of automatic TRIM per leaf vdev in bytes/sec");
+
+ZFS_MODULE_PARAM(zfs_trim, zfs_trim_, auto_backoff_ms, UINT, ZMOD_RW,
+    "Max delay of automatic TRIM I/Os while latency targets are missed");
+
 ZFS_MODULE_PARAM(zfs_trim, zfs_trim_, queue_limit, UINT, ZMOD_RW,
     "Max queued TRIMs outstanding per leaf vdev");
 /* END CSTYLED */
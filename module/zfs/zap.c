@@ -975,21 +975,37 @@ fzap_remove(zap_name_t *zn, dmu_tx_t *tx)
 	return (err);
 }
 
-void
-fzap_prefetch(zap_name_t *zn)
+/*
+ * Returns the block of the leaf the name hashes to.
+ */
+int
+fzap_leaf_blkid(zap_name_t *zn, uint64_t *blkp)
 {
-	uint64_t blk;
 	zap_t *zap = zn->zn_zap;
 
 	uint64_t idx = ZAP_HASH_IDX(zn->zn_hash,
 	    zap_f_phys(zap)->zap_ptrtbl.zt_shift);
-	if (zap_idx_to_blk(zap, idx, &blk) != 0)
-		return;
+	return (zap_idx_to_blk(zap, idx, blkp));
+}
+
+void
+fzap_prefetch_leaf(zap_t *zap, uint64_t blk)
+{
 	int bs = FZAP_BLOCK_SHIFT(zap);
 	dmu_prefetch(zap->zap_objset, zap->zap_object, 0, blk << bs, 1 << bs,
 	    ZIO_PRIORITY_SYNC_READ);
 }
 
+void
+fzap_prefetch(zap_name_t *zn)
+{
+	uint64_t blk;
+
+	if (fzap_leaf_blkid(zn, &blk) != 0)
+		return;
+	fzap_prefetch_leaf(zn->zn_zap, blk);
+}
+
 /*
  * Helper functions for consumers.
  */
@@ -340,16 +340,40 @@ zap_leaf_array_match(zap_leaf_t *l, zap_name_t *zn,
 	int bseen = 0;
 
 	if (zap_getflags(zn->zn_zap) & ZAP_FLAG_UINT64_KEY) {
-		uint64_t *thiskey =
-		    kmem_alloc(array_numints * sizeof (*thiskey), KM_SLEEP);
-		ASSERT(zn->zn_key_intlen == sizeof (*thiskey));
-
-		zap_leaf_array_read(l, chunk, sizeof (*thiskey), array_numints,
-		    sizeof (*thiskey), array_numints, thiskey);
-		boolean_t match = bcmp(thiskey, zn->zn_key_orig,
-		    array_numints * sizeof (*thiskey)) == 0;
-		kmem_free(thiskey, array_numints * sizeof (*thiskey));
-		return (match);
+		const uint64_t *key = zn->zn_key_orig;
+		uint64_t value = 0;
+		int byten = 0;
+
+		ASSERT(zn->zn_key_intlen == sizeof (*key));
+		if (array_numints != zn->zn_key_orig_numints)
+			return (B_FALSE);
+
+		/*
+		 * Compare the key in place, one integer at a time, rather
+		 * than reading the whole array into a temporary buffer.
+		 * This stops at the first chunk that differs, and saves an
+		 * allocation per hash match on the large uint64-keyed ZAPs
+		 * such as the DDT.
+		 */
+		while (array_numints > 0) {
+			struct zap_leaf_array *la =
+			    &ZAP_LEAF_CHUNK(l, chunk).l_array;
+
+			ASSERT3U(chunk, <, ZAP_LEAF_NUMCHUNKS(l));
+			for (int i = 0; i < ZAP_LEAF_ARRAY_BYTES &&
+			    array_numints > 0; i++) {
+				value = (value << 8) | la->la_array[i];
+				if (++byten < sizeof (*key))
+					continue;
+				if (value != *key++)
+					return (B_FALSE);
+				value = 0;
+				byten = 0;
+				array_numints--;
+			}
+			chunk = la->la_next;
+		}
+		return (B_TRUE);
 	}
 
 	ASSERT(zn->zn_key_intlen == 1);
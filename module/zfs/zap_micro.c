@@ -46,6 +46,8 @@ extern inline mzap_phys_t *zap_m_phys(zap_t *zap);
 
 static int mzap_upgrade(zap_t **zapp,
     void *tag, dmu_tx_t *tx, zap_flags_t flags);
+static int zap_update_impl(zap_name_t *zn, int integer_size,
+    uint64_t num_integers, const void *val, void *tag, dmu_tx_t *tx);
 
 uint64_t
 zap_getflags(zap_t *zap)
@@ -1097,6 +1099,180 @@ zap_prefetch_uint64(objset_t *os, uint64_t zapobj, const uint64_t *key,
 	return (err);
 }
 
+typedef struct zap_batch_node {
+	zap_name_t	*zbn_zn;
+	uint_t		zbn_idx;
+	avl_node_t	zbn_node;
+} zap_batch_node_t;
+
+static int
+zap_batch_node_compare(const void *x1, const void *x2)
+{
+	const zap_batch_node_t *zbn1 = x1;
+	const zap_batch_node_t *zbn2 = x2;
+
+	int cmp = AVL_CMP(zbn1->zbn_zn->zn_hash, zbn2->zbn_zn->zn_hash);
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_CMP(zbn1->zbn_idx, zbn2->zbn_idx));
+}
+
+/*
+ * Common code of zap_update_batch() and zap_update_uint64_batch(), the
+ * keys are names if key_numints is 0.  The names are hashed first and
+ * sorted by hash, which is also the order of the leaves in the pointer
+ * table, so that successive updates find their leaf cached and locked
+ * dirty by the one before.
+ */
+static int
+zap_update_batch_impl(objset_t *os, uint64_t zapobj, int key_numints,
+    const zap_batch_ent_t *zbes, uint_t count, dmu_tx_t *tx)
+{
+	zap_t *zap;
+	zap_batch_node_t *zbns, *zbn;
+	avl_tree_t tree;
+	void *cookie = NULL;
+	uint_t n = 0;
+
+	if (count == 0)
+		return (0);
+
+	int err =
+	    zap_lockdir(os, zapobj, tx, RW_WRITER, TRUE, TRUE, FTAG, &zap);
+	if (err != 0)
+		return (err);
+
+	zbns = kmem_alloc(count * sizeof (zap_batch_node_t), KM_SLEEP);
+	avl_create(&tree, zap_batch_node_compare, sizeof (zap_batch_node_t),
+	    offsetof(zap_batch_node_t, zbn_node));
+
+	for (; n < count; n++) {
+		zbn = &zbns[n];
+		if (key_numints == 0) {
+			zbn->zbn_zn = zap_name_alloc(zap, zbes[n].zbe_key, 0);
+		} else {
+			zbn->zbn_zn = zap_name_alloc_uint64(zap,
+			    zbes[n].zbe_key, key_numints);
+		}
+		if (zbn->zbn_zn == NULL) {
+			err = SET_ERROR(ENOTSUP);
+			break;
+		}
+		zbn->zbn_idx = n;
+		avl_add(&tree, zbn);
+	}
+
+	for (zbn = avl_first(&tree); zbn != NULL && err == 0;
+	    zbn = AVL_NEXT(&tree, zbn)) {
+		const zap_batch_ent_t *zbe = &zbes[zbn->zbn_idx];
+		zap_name_t *zn = zbn->zbn_zn;
+
+		zn->zn_zap = zap;
+		if (key_numints == 0) {
+			err = zap_update_impl(zn, zbe->zbe_integer_size,
+			    zbe->zbe_num_integers, zbe->zbe_val, FTAG, tx);
+		} else {
+			err = fzap_update(zn, zbe->zbe_integer_size,
+			    zbe->zbe_num_integers, zbe->zbe_val, FTAG, tx);
+		}
+		zap = zn->zn_zap;	/* the update may change zap */
+		ASSERT(zap != NULL || err != 0);
+	}
+
+	while ((zbn = avl_destroy_nodes(&tree, &cookie)) != NULL)
+		zap_name_free(zbn->zbn_zn);
+	avl_destroy(&tree);
+	kmem_free(zbns, count * sizeof (zap_batch_node_t));
+
+	if (zap != NULL)
+		zap_unlockdir(zap, FTAG);
+	return (err);
+}
+
+int
+zap_update_batch(objset_t *os, uint64_t zapobj, const zap_batch_ent_t *zbes,
+    uint_t count, dmu_tx_t *tx)
+{
+	return (zap_update_batch_impl(os, zapobj, 0, zbes, count, tx));
+}
+
+int
+zap_update_uint64_batch(objset_t *os, uint64_t zapobj, int key_numints,
+    const zap_batch_ent_t *zbes, uint_t count, dmu_tx_t *tx)
+{
+	ASSERT3S(key_numints, >, 0);
+	return (zap_update_batch_impl(os, zapobj, key_numints, zbes, count,
+	    tx));
+}
+
+typedef struct zap_prefetch_blk {
+	uint64_t	zpb_blk;
+	avl_node_t	zpb_node;
+} zap_prefetch_blk_t;
+
+static int
+zap_prefetch_blk_compare(const void *x1, const void *x2)
+{
+	const zap_prefetch_blk_t *zpb1 = x1;
+	const zap_prefetch_blk_t *zpb2 = x2;
+
+	return (AVL_CMP(zpb1->zpb_blk, zpb2->zpb_blk));
+}
+
+/*
+ * Prefetches the leaves holding a batch of count keys, of key_numints
+ * integers each, under a single hold of the ZAP.  The leaves are sorted
+ * first, so that each is read once, and in block order.
+ */
+int
+zap_prefetch_uint64_batch(objset_t *os, uint64_t zapobj, const uint64_t *keys,
+    int key_numints, uint_t count)
+{
+	zap_t *zap;
+	zap_prefetch_blk_t *zpbs, *zpb;
+	avl_tree_t blks;
+	avl_index_t where;
+	void *cookie = NULL;
+	uint_t n = 0;
+
+	int err =
+	    zap_lockdir(os, zapobj, NULL, RW_READER, TRUE, FALSE, FTAG, &zap);
+	if (err != 0)
+		return (err);
+
+	zpbs = kmem_alloc(count * sizeof (zap_prefetch_blk_t), KM_SLEEP);
+	avl_create(&blks, zap_prefetch_blk_compare, sizeof (zap_prefetch_blk_t),
+	    offsetof(zap_prefetch_blk_t, zpb_node));
+
+	for (uint_t i = 0; i < count; i++) {
+		zap_name_t *zn = zap_name_alloc_uint64(zap,
+		    &keys[i * key_numints], key_numints);
+		if (zn == NULL) {
+			err = SET_ERROR(ENOTSUP);
+			break;
+		}
+		zpb = &zpbs[n];
+		if (fzap_leaf_blkid(zn, &zpb->zpb_blk) == 0 &&
+		    avl_find(&blks, zpb, &where) == NULL) {
+			avl_insert(&blks, zpb, where);
+			n++;
+		}
+		zap_name_free(zn);
+	}
+
+	for (zpb = avl_first(&blks); zpb != NULL; zpb = AVL_NEXT(&blks, zpb))
+		fzap_prefetch_leaf(zap, zpb->zpb_blk);
+
+	while (avl_destroy_nodes(&blks, &cookie) != NULL)
+		;
+	avl_destroy(&blks);
+	kmem_free(zpbs, count * sizeof (zap_prefetch_blk_t));
+
+	zap_unlockdir(zap, FTAG);
+	return (err);
+}
+
 int
 zap_lookup_uint64(objset_t *os, uint64_t zapobj, const uint64_t *key,
     int key_numints, uint64_t integer_size, uint64_t num_integers, void *buf)
@@ -1322,36 +1498,32 @@ zap_add_uint64(objset_t *os, uint64_t zapobj, const uint64_t *key,
 	return (err);
 }
 
-int
-zap_update(objset_t *os, uint64_t zapobj, const char *name,
-    int integer_size, uint64_t num_integers, const void *val, dmu_tx_t *tx)
+/*
+ * Updates the entry named by zn, with the ZAP locked as writer.  The ZAP
+ * may be upgraded or relocked, zn->zn_zap is set to the one to unlock,
+ * which may be NULL if fzap_upgrade() failed.
+ */
+static int
+zap_update_impl(zap_name_t *zn, int integer_size, uint64_t num_integers,
+    const void *val, void *tag, dmu_tx_t *tx)
 {
-	zap_t *zap;
+	zap_t *zap = zn->zn_zap;
 	const uint64_t *intval = val;
+	const char *name = zn->zn_key_orig;
+	int err = 0;
 
-	int err =
-	    zap_lockdir(os, zapobj, tx, RW_WRITER, TRUE, TRUE, FTAG, &zap);
-	if (err != 0)
-		return (err);
-	zap_name_t *zn = zap_name_alloc(zap, name, 0);
-	if (zn == NULL) {
-		zap_unlockdir(zap, FTAG);
-		return (SET_ERROR(ENOTSUP));
-	}
 	if (!zap->zap_ismicro) {
 		err = fzap_update(zn, integer_size, num_integers, val,
-		    FTAG, tx);
-		zap = zn->zn_zap;	/* fzap_update() may change zap */
+		    tag, tx);
 	} else if (integer_size != 8 || num_integers != 1 ||
 	    strlen(name) >= MZAP_NAME_LEN) {
 		dprintf("upgrading obj %llu: intsz=%u numint=%llu name=%s\n",
-		    zapobj, integer_size, num_integers, name);
-		err = mzap_upgrade(&zn->zn_zap, FTAG, tx, 0);
+		    zap->zap_object, integer_size, num_integers, name);
+		err = mzap_upgrade(&zn->zn_zap, tag, tx, 0);
 		if (err == 0) {
 			err = fzap_update(zn, integer_size, num_integers,
-			    val, FTAG, tx);
+			    val, tag, tx);
 		}
-		zap = zn->zn_zap;	/* fzap_update() may change zap */
 	} else {
 		mzap_ent_t *mze = mze_find(zn);
 		if (mze != NULL) {
@@ -1360,7 +1532,26 @@ zap_update(objset_t *os, uint64_t zapobj, const char *name,
 			mzap_addent(zn, *intval);
 		}
 	}
-	ASSERT(zap == zn->zn_zap);
+	return (err);
+}
+
+int
+zap_update(objset_t *os, uint64_t zapobj, const char *name,
+    int integer_size, uint64_t num_integers, const void *val, dmu_tx_t *tx)
+{
+	zap_t *zap;
+
+	int err =
+	    zap_lockdir(os, zapobj, tx, RW_WRITER, TRUE, TRUE, FTAG, &zap);
+	if (err != 0)
+		return (err);
+	zap_name_t *zn = zap_name_alloc(zap, name, 0);
+	if (zn == NULL) {
+		zap_unlockdir(zap, FTAG);
+		return (SET_ERROR(ENOTSUP));
+	}
+	err = zap_update_impl(zn, integer_size, num_integers, val, FTAG, tx);
+	zap = zn->zn_zap;	/* zap_update_impl() may change zap */
 	zap_name_free(zn);
 	if (zap != NULL)	/* may be NULL if fzap_upgrade() failed */
 		zap_unlockdir(zap, FTAG);
@@ -1670,11 +1861,14 @@ EXPORT_SYMBOL(zap_lookup_uint64);
 EXPORT_SYMBOL(zap_contains);
 EXPORT_SYMBOL(zap_prefetch);
 EXPORT_SYMBOL(zap_prefetch_uint64);
+EXPORT_SYMBOL(zap_prefetch_uint64_batch);
 EXPORT_SYMBOL(zap_add);
 EXPORT_SYMBOL(zap_add_by_dnode);
 EXPORT_SYMBOL(zap_add_uint64);
 EXPORT_SYMBOL(zap_update);
 EXPORT_SYMBOL(zap_update_uint64);
+EXPORT_SYMBOL(zap_update_batch);
+EXPORT_SYMBOL(zap_update_uint64_batch);
 EXPORT_SYMBOL(zap_length);
 EXPORT_SYMBOL(zap_length_uint64);
 EXPORT_SYMBOL(zap_remove);
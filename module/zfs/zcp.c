@@ -110,6 +110,7 @@
 uint64_t zfs_lua_check_instrlimit_interval = 100;
 unsigned long zfs_lua_max_instrlimit = ZCP_MAX_INSTRLIMIT;
 unsigned long zfs_lua_max_memlimit = ZCP_MAX_MEMLIMIT;
+unsigned long zfs_lua_stream_bufsize = 1024 * 1024;
 
 /*
  * Forward declarations for mutually recursive functions
@@ -702,6 +703,102 @@ zcp_exists(lua_State *state)
 	return (1);
 }
 
+static int zcp_stream(lua_State *);
+static zcp_lib_info_t zcp_stream_info = {
+	.name = "stream",
+	.func = zcp_stream,
+	.pargs = {
+	    {NULL, 0}
+	},
+	.kwargs = {
+	    {NULL, 0}
+	}
+};
+
+/*
+ * zfs.stream(value) hands a value to the caller as the program goes rather
+ * than with its return value, so that a program enumerating many datasets
+ * does not have to build up its whole result within its memory limit.
+ * Each value is packed into zri_stream_buf as a uint64_t length followed
+ * by an nvlist with the value under ZCP_RET_RETURN, and the buffer is
+ * drained to the caller between txgs and when the program ends.  A program
+ * that may span txgs is suspended when the buffer is full, any other fails.
+ */
+static int
+zcp_stream(lua_State *state)
+{
+	zcp_run_info_t *ri = zcp_run_info(state);
+	zcp_lib_info_t *libinfo = &zcp_stream_info;
+	zcp_cleanup_handler_t *zch;
+	nvlist_t *nvl;
+	uint64_t reclen;
+	size_t size;
+	char *buf;
+
+	/* Any type of value may be streamed, so only check the count */
+	if (lua_gettop(state) != 1) {
+		return (luaL_error(state, "%s: expected 1 argument, got %d",
+		    libinfo->name, lua_gettop(state)));
+	}
+	if (ri->zri_stream == NULL)
+		return (luaL_error(state, "no output stream was requested"));
+
+	nvl = fnvlist_alloc();
+	zch = zcp_register_cleanup(state, (zcp_cleanup_t *)&fnvlist_free, nvl);
+	zcp_lua_to_nvlist(state, 1, nvl, ZCP_RET_RETURN);
+	zcp_deregister_cleanup(state, zch);
+	VERIFY0(nvlist_size(nvl, &size, NV_ENCODE_NATIVE));
+
+	if (sizeof (reclen) + size > ri->zri_stream_size) {
+		fnvlist_free(nvl);
+		return (luaL_error(state, "value of %d bytes is too large to "
+		    "stream", (int)size));
+	}
+
+	if (ri->zri_stream_len + sizeof (reclen) + size >
+	    ri->zri_stream_size) {
+		fnvlist_free(nvl);
+		if (state != ri->zri_thread || !lua_isyieldable(state)) {
+			return (luaL_error(state, "output stream buffer "
+			    "full"));
+		}
+
+		/*
+		 * Let zcp_eval() drain the buffer, after which we are called
+		 * again with the same argument.
+		 */
+		return (lua_yieldk(state, 0, 0, zcp_stream));
+	}
+
+	buf = ri->zri_stream_buf + ri->zri_stream_len;
+	reclen = size;
+	bcopy(&reclen, buf, sizeof (reclen));
+	buf += sizeof (reclen);
+	VERIFY0(nvlist_pack(nvl, &buf, &size, NV_ENCODE_NATIVE, KM_SLEEP));
+	ri->zri_stream_len += sizeof (reclen) + size;
+	fnvlist_free(nvl);
+
+	return (0);
+}
+
+/*
+ * Write out what zfs.stream() has staged.
+ */
+static int
+zcp_stream_flush(zcp_run_info_t *ri)
+{
+	int err;
+
+	if (ri->zri_stream == NULL || ri->zri_stream_len == 0)
+		return (0);
+
+	err = ri->zri_stream->zs_func(ri->zri_stream_buf, ri->zri_stream_len,
+	    ri->zri_stream->zs_arg);
+	ri->zri_stream_len = 0;
+
+	return (err);
+}
+
 /*
  * Allocate/realloc/free a buffer for the lua interpreter.
  *
@@ -803,6 +900,21 @@ zcp_lua_counthook(lua_State *state, lua_Debug *ar)
 		(void) lua_error(state);
 		/* Unreachable */
 	}
+
+	/*
+	 * A program allowed to span txgs is suspended once it has used up
+	 * its budget for this one, and zcp_eval() resumes it in the next
+	 * txg.  This is put off while it is inside a C function that cannot
+	 * be resumed, or inside a coroutine of its own, which would only
+	 * yield back to the program.
+	 */
+	ri->zri_txg_curinstrs += zfs_lua_check_instrlimit_interval;
+	if (ri->zri_txg_maxinstrs != 0 &&
+	    ri->zri_txg_curinstrs >= ri->zri_txg_maxinstrs &&
+	    state == ri->zri_thread && lua_isyieldable(state)) {
+		ri->zri_yielded = B_TRUE;
+		(void) lua_yield(state, 0);
+	}
 }
 
 static int
@@ -813,13 +925,59 @@ zcp_panic_cb(lua_State *state)
 	return (0);
 }
 
+/*
+ * Run or resume a channel program in its coroutine, see zcp_eval().  The
+ * stack of the main state is left as lua_pcall() would leave it: the error
+ * handler followed by the return values or the error and its traceback.
+ * If the program was suspended, the stack is left untouched.
+ */
+static int
+zcp_eval_resume(zcp_run_info_t *ri)
+{
+	lua_State *state = ri->zri_state;
+	lua_State *thread = ri->zri_thread;
+	int nargs = (lua_status(thread) == LUA_YIELD) ? 0 : 1;
+	int err;
+
+	ri->zri_yielded = B_FALSE;
+	err = lua_resume(thread, NULL, nargs);
+
+	switch (err) {
+	case LUA_YIELD:
+		/*
+		 * Either we suspended the program at the end of its budget,
+		 * zfs.stream() filled its buffer, or it called
+		 * coroutine.yield() itself, which ends the txg early.
+		 * Anything it yielded is discarded.
+		 */
+		ri->zri_yielded = B_TRUE;
+		lua_settop(thread, 0);
+		return (err);
+	case LUA_OK:
+		lua_xmove(thread, state, lua_gettop(thread));
+		break;
+	case LUA_ERRRUN:
+	case LUA_ERRGCMM:
+		/* What zcp_error_handler() does for lua_pcall() */
+		zcp_cleanup(state);
+		luaL_traceback(state, thread, lua_tostring(thread, -1), 0);
+		break;
+	default:
+		break;
+	}
+
+	/* Drop the coroutine, leaving the error handler and results */
+	lua_remove(state, 2);
+	return (err);
+}
+
 static void
 zcp_eval_impl(dmu_tx_t *tx, zcp_run_info_t *ri)
 {
 	int err;
 	lua_State *state = ri->zri_state;
 
-	VERIFY3U(3, ==, lua_gettop(state));
+	VERIFY3U(ri->zri_thread != NULL ? 2 : 3, ==, lua_gettop(state));
 
 	/* finish initializing our runtime state */
 	ri->zri_pool = dmu_tx_pool(tx);
@@ -834,14 +992,15 @@ zcp_eval_impl(dmu_tx_t *tx, zcp_run_info_t *ri)
 	 */
 	lua_pushlightuserdata(state, ri);
 	lua_setfield(state, LUA_REGISTRYINDEX, ZCP_RUN_INFO_KEY);
-	VERIFY3U(3, ==, lua_gettop(state));
+	VERIFY3U(ri->zri_thread != NULL ? 2 : 3, ==, lua_gettop(state));
 
 	/*
 	 * Tell the Lua interpreter to call our handler every count
 	 * instructions. Channel programs that execute too many instructions
 	 * should die with ETIME.
 	 */
-	(void) lua_sethook(state, zcp_lua_counthook, LUA_MASKCOUNT,
+	(void) lua_sethook(ri->zri_thread != NULL ? ri->zri_thread : state,
+	    zcp_lua_counthook, LUA_MASKCOUNT,
 	    zfs_lua_check_instrlimit_interval);
 
 	/*
@@ -856,7 +1015,10 @@ zcp_eval_impl(dmu_tx_t *tx, zcp_run_info_t *ri)
 	 * function and its input from the stack and pushes any return
 	 * or error values.
 	 */
-	err = lua_pcall(state, 1, LUA_MULTRET, 1);
+	if (ri->zri_thread != NULL)
+		err = zcp_eval_resume(ri);
+	else
+		err = lua_pcall(state, 1, LUA_MULTRET, 1);
 
 	/*
 	 * Let Lua use KM_SLEEP while we interpret the return values.
@@ -864,11 +1026,15 @@ zcp_eval_impl(dmu_tx_t *tx, zcp_run_info_t *ri)
 	ri->zri_allocargs->aa_must_succeed = B_TRUE;
 
 	/*
-	 * Remove the error handler callback from the stack. At this point,
-	 * there shouldn't be any cleanup handler registered in the handler
-	 * list (zri_cleanup_handlers), regardless of whether it ran or not.
+	 * At this point, there shouldn't be any cleanup handler registered
+	 * in the handler list (zri_cleanup_handlers), regardless of whether
+	 * it ran or not.  A suspended program is not inside any callback.
 	 */
 	list_destroy(&ri->zri_cleanup_handlers);
+	if (err == LUA_YIELD)
+		return;
+
+	/* Remove the error handler callback from the stack. */
 	lua_remove(state, 1);
 
 	switch (err) {
@@ -996,8 +1162,11 @@ zcp_eval_sync(void *arg, dmu_tx_t *tx)
 	 * 1: Error handler callback
 	 * 2: Script to run (converted to a Lua function)
 	 * 3: nvlist input to function (converted to Lua table or nil)
+	 * or, for a program that may span txgs, the error handler and the
+	 * coroutine holding the other two.
 	 */
-	VERIFY3U(3, ==, lua_gettop(ri->zri_state));
+	VERIFY3U(ri->zri_thread != NULL ? 2 : 3, ==,
+	    lua_gettop(ri->zri_state));
 
 	zcp_eval_impl(tx, ri);
 }
@@ -1038,15 +1207,27 @@ zcp_eval_open(zcp_run_info_t *ri, const char *poolname)
 	dsl_pool_rele(dp, FTAG);
 }
 
+/*
+ * Evaluate a channel program.  With a txg_instrlimit, the program runs in
+ * a coroutine which is suspended whenever it has executed that many
+ * instructions in the current txg and resumed in the next, so that large
+ * programs do not hold up sync.  The program is then no longer atomic, but
+ * its total instrlimit may exceed zfs_lua_max_instrlimit.  Output passed to
+ * zfs.stream() is written to the stream, if any, in between.
+ */
 int
 zcp_eval(const char *poolname, const char *program, boolean_t sync,
-    uint64_t instrlimit, uint64_t memlimit, nvpair_t *nvarg, nvlist_t *outnvl)
+    uint64_t instrlimit, uint64_t txg_instrlimit, uint64_t memlimit,
+    zcp_stream_t *stream, nvpair_t *nvarg, nvlist_t *outnvl)
 {
-	int err;
+	int err, serr = 0;
 	lua_State *state;
 	zcp_run_info_t runinfo;
 
-	if (instrlimit > zfs_lua_max_instrlimit)
+	if (txg_instrlimit != 0 &&
+	    (!sync || txg_instrlimit > zfs_lua_max_instrlimit))
+		return (SET_ERROR(EINVAL));
+	if (txg_instrlimit == 0 && instrlimit > zfs_lua_max_instrlimit)
 		return (SET_ERROR(EINVAL));
 	if (memlimit == 0 || memlimit > zfs_lua_max_memlimit)
 		return (SET_ERROR(EINVAL));
@@ -1101,6 +1282,8 @@ zcp_eval(const char *poolname, const char *program, boolean_t sync,
 	lua_setfield(state, -2, zcp_debug_info.name);
 	lua_pushcclosure(state, zcp_exists_info.func, 0);
 	lua_setfield(state, -2, zcp_exists_info.name);
+	lua_pushcclosure(state, zcp_stream_info.func, 0);
+	lua_setfield(state, -2, zcp_stream_info.name);
 	lua_setglobal(state, "zfs");
 	VERIFY0(lua_gettop(state));
 
@@ -1144,6 +1327,18 @@ zcp_eval(const char *poolname, const char *program, boolean_t sync,
 	}
 	VERIFY3U(3, ==, lua_gettop(state));
 
+	/*
+	 * Move the function and its input into a coroutine which can be
+	 * suspended between txgs.
+	 */
+	runinfo.zri_thread = NULL;
+	if (txg_instrlimit != 0) {
+		runinfo.zri_thread = lua_newthread(state);
+		lua_insert(state, 2);
+		lua_xmove(state, runinfo.zri_thread, 2);
+		VERIFY3U(2, ==, lua_gettop(state));
+	}
+
 	runinfo.zri_state = state;
 	runinfo.zri_allocargs = &allocargs;
 	runinfo.zri_outnvl = outnvl;
@@ -1155,15 +1350,58 @@ zcp_eval(const char *poolname, const char *program, boolean_t sync,
 	runinfo.zri_space_used = 0;
 	runinfo.zri_curinstrs = 0;
 	runinfo.zri_maxinstrs = instrlimit;
+	runinfo.zri_txg_maxinstrs = txg_instrlimit;
+	runinfo.zri_yielded = B_FALSE;
+	runinfo.zri_stream = stream;
+	runinfo.zri_stream_buf = NULL;
+	runinfo.zri_stream_len = 0;
+	runinfo.zri_stream_size = 0;
+	if (stream != NULL) {
+		runinfo.zri_stream_size = zfs_lua_stream_bufsize;
+		runinfo.zri_stream_buf = vmem_alloc(runinfo.zri_stream_size,
+		    KM_SLEEP);
+	}
 
 	if (sync) {
-		err = dsl_sync_task_sig(poolname, NULL, zcp_eval_sync,
-		    zcp_eval_sig, &runinfo, 0, ZFS_SPACE_CHECK_ZCP_EVAL);
-		if (err != 0)
-			zcp_pool_error(&runinfo, poolname);
+		do {
+			runinfo.zri_txg_curinstrs = 0;
+			err = dsl_sync_task_sig(poolname, NULL, zcp_eval_sync,
+			    zcp_eval_sig, &runinfo, 0,
+			    ZFS_SPACE_CHECK_ZCP_EVAL);
+			if (err != 0) {
+				zcp_pool_error(&runinfo, poolname);
+				break;
+			}
+			if (runinfo.zri_yielded)
+				serr = zcp_stream_flush(&runinfo);
+		} while (serr == 0 && runinfo.zri_yielded &&
+		    !runinfo.zri_canceled);
+
+		/* Canceled, or the stream failed, between txgs */
+		if (err == 0 && runinfo.zri_yielded) {
+			runinfo.zri_result = (serr != 0) ? serr :
+			    SET_ERROR(EINTR);
+			lua_settop(state, 0);
+			(void) lua_pushstring(state, serr != 0 ?
+			    "Channel program output stream failed." :
+			    "Channel program was canceled.");
+			zcp_convert_return_values(state, outnvl,
+			    ZCP_RET_ERROR, &runinfo.zri_result);
+		}
 	} else {
 		zcp_eval_open(&runinfo, poolname);
 	}
+
+	/* Hand over the rest of the output, even if the program failed */
+	if (serr == 0)
+		serr = zcp_stream_flush(&runinfo);
+	if (serr != 0 && runinfo.zri_result == 0) {
+		runinfo.zri_result = SET_ERROR(serr);
+		fnvlist_add_string(outnvl, ZCP_RET_ERROR,
+		    "Channel program output stream failed.");
+	}
+	if (runinfo.zri_stream_buf != NULL)
+		vmem_free(runinfo.zri_stream_buf, runinfo.zri_stream_size);
 	lua_close(state);
 
 	return (runinfo.zri_result);
@@ -1441,5 +1679,8 @@ ZFS_MODULE_PARAM(zfs_lua, zfs_lua_, max_instrlimit, UQUAD, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_lua, zfs_lua_, max_memlimit, UQUAD, ZMOD_RW,
 	"Max memory limit that can be specified for a channel program");
+
+ZFS_MODULE_PARAM(zfs_lua, zfs_lua_, stream_bufsize, UQUAD, ZMOD_RW,
+	"Size of the buffer channel program output is streamed through");
 /* END CSTYLED */
 #endif
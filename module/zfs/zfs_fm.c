@@ -112,29 +112,77 @@ zfs_zevent_post_cb(nvlist_t *nvl, nvlist_t *detector)
 		fm_nvlist_destroy(detector, FM_NVA_FREE);
 }
 
+static boolean_t zfs_ereport_start(nvlist_t **, nvlist_t **, const char *,
+    spa_t *, vdev_t *, const zbookmark_phys_t *, zio_t *, uint64_t, uint64_t);
+
+/*
+ * Post an ereport summarizing the events of this class which were rate
+ * limited on this vdev over the last interval: how many there were, and
+ * the range of their zio delta and offset.
+ */
+static void
+zfs_ereport_post_summary(const char *subclass, spa_t *spa, vdev_t *vd,
+    zfs_ratelimit_summary_t *rs)
+{
+	nvlist_t *ereport = NULL;
+	nvlist_t *detector = NULL;
+
+	if (!zfs_ereport_start(&ereport, &detector, subclass, spa, vd,
+	    NULL, NULL, 0, 0) || ereport == NULL)
+		return;
+
+	fm_payload_set(ereport,
+	    FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED,
+	    DATA_TYPE_UINT64, rs->rs_count,
+	    FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED_DELTA_MIN,
+	    DATA_TYPE_UINT64, rs->rs_min[0],
+	    FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED_DELTA_MAX,
+	    DATA_TYPE_UINT64, rs->rs_max[0],
+	    FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED_OFFSET_MIN,
+	    DATA_TYPE_UINT64, rs->rs_min[1],
+	    FM_EREPORT_PAYLOAD_ZFS_SUPPRESSED_OFFSET_MAX,
+	    DATA_TYPE_UINT64, rs->rs_max[1], NULL);
+
+	(void) zfs_zevent_post(ereport, detector, zfs_zevent_post_cb);
+}
+
 /*
  * We want to rate limit ZIO delay and checksum events so as to not
- * flood ZED when a disk is acting up.
+ * flood ZED when a disk is acting up.  The events dropped are not lost
+ * entirely: once per interval in which some were, a summary of them is
+ * posted along with the next event of the class.
  *
  * Returns 1 if we're ratelimiting, 0 if not.
  */
 static int
-zfs_is_ratelimiting_event(const char *subclass, vdev_t *vd)
+zfs_is_ratelimiting_event(const char *subclass, spa_t *spa, vdev_t *vd,
+    zio_t *zio)
 {
+	zfs_ratelimit_summary_t rs;
+	uint64_t vals[ZFS_RATELIMIT_NVALS];
 	int rc = 0;
+
+	vals[0] = (zio != NULL) ? zio->io_delta : 0;
+	vals[1] = (zio != NULL) ? zio->io_offset : 0;
+
 	/*
 	 * __ratelimit() returns 1 if we're *not* ratelimiting and 0 if we
 	 * are.  Invert it to get our return value.
 	 */
 	if (strcmp(subclass, FM_EREPORT_ZFS_DELAY) == 0) {
-		rc = !zfs_ratelimit(&vd->vdev_delay_rl);
+		rc = !zfs_ratelimit_summarize(&vd->vdev_delay_rl, vals, &rs);
 	} else if (strcmp(subclass, FM_EREPORT_ZFS_CHECKSUM) == 0) {
-		rc = !zfs_ratelimit(&vd->vdev_checksum_rl);
+		rc = !zfs_ratelimit_summarize(&vd->vdev_checksum_rl, vals,
+		    &rs);
+	} else {
+		return (0);
 	}
 
 	if (rc)	{
 		/* We're rate limiting */
 		fm_erpt_dropped_increment();
+	} else if (rs.rs_count != 0) {
+		zfs_ereport_post_summary(subclass, spa, vd, &rs);
 	}
 
 	return (rc);
@@ -224,7 +272,8 @@ zfs_ereport_start(nvlist_t **ereport_out, nvlist_t **detector_out,
 
 	if (vd != NULL) {
 		vdev_t *pvd = vd->vdev_parent;
-		vdev_queue_t *vq = &vd->vdev_queue;
+		vdev_queue_t *vq = &vd->vdev_queue[(zio != NULL &&
+		    zio->io_vd == vd) ? zio->io_queue_shard : 0];
 		vdev_stat_t *vs = &vd->vdev_stat;
 		vdev_t *spare_vd;
 		uint64_t *spare_guids;
@@ -801,7 +850,7 @@ zfs_ereport_post(const char *subclass, spa_t *spa, vdev_t *vd,
 	nvlist_t *ereport = NULL;
 	nvlist_t *detector = NULL;
 
-	if (zfs_is_ratelimiting_event(subclass, vd))
+	if (zfs_is_ratelimiting_event(subclass, spa, vd, zio))
 		return (SET_ERROR(EBUSY));
 
 	if (!zfs_ereport_start(&ereport, &detector, subclass, spa, vd,
@@ -825,7 +874,7 @@ zfs_ereport_start_checksum(spa_t *spa, vdev_t *vd, const zbookmark_phys_t *zb,
 	zio_cksum_report_t *report;
 
 #ifdef _KERNEL
-	if (zfs_is_ratelimiting_event(FM_EREPORT_ZFS_CHECKSUM, vd))
+	if (zfs_is_ratelimiting_event(FM_EREPORT_ZFS_CHECKSUM, spa, vd, zio))
 		return;
 #endif
 
@@ -913,7 +962,7 @@ zfs_ereport_post_checksum(spa_t *spa, vdev_t *vd, const zbookmark_phys_t *zb,
 	nvlist_t *detector = NULL;
 	zfs_ecksum_info_t *info;
 
-	if (zfs_is_ratelimiting_event(FM_EREPORT_ZFS_CHECKSUM, vd))
+	if (zfs_is_ratelimiting_event(FM_EREPORT_ZFS_CHECKSUM, spa, vd, zio))
 		return (EBUSY);
 
 	if (!zfs_ereport_start(&ereport, &detector, FM_EREPORT_ZFS_CHECKSUM,
@@ -120,6 +120,8 @@ zfs_fuid_table_load(objset_t *os, uint64_t fuid_obj, avl_tree_t *idx_tree,
 	if (fuid_size)  {
 		nvlist_t **fuidnvp;
 		nvlist_t *nvp = NULL;
+		fuid_domain_t **domnodes;
+		boolean_t sorted = B_TRUE;
 		uint_t count;
 		char *packed;
 		int i;
@@ -132,6 +134,7 @@ zfs_fuid_table_load(objset_t *os, uint64_t fuid_obj, avl_tree_t *idx_tree,
 		VERIFY(nvlist_lookup_nvlist_array(nvp, FUID_NVP_ARRAY,
 		    &fuidnvp, &count) == 0);
 
+		domnodes = kmem_alloc(count * sizeof (void *), KM_SLEEP);
 		for (i = 0; i != count; i++) {
 			fuid_domain_t *domnode;
 			char *domain;
@@ -147,8 +150,24 @@ zfs_fuid_table_load(objset_t *os, uint64_t fuid_obj, avl_tree_t *idx_tree,
 			domnode->f_idx = idx;
 			domnode->f_ksid = ksid_lookupdomain(domain);
 			avl_add(idx_tree, domnode);
-			avl_add(domain_tree, domnode);
+
+			domnodes[i] = domnode;
+			if (i > 0 &&
+			    domain_compare(domnodes[i - 1], domnode) >= 0)
+				sorted = B_FALSE;
+		}
+
+		/*
+		 * zfs_fuid_sync() writes the table in domain order, so the
+		 * domain tree can normally be built without searching it.
+		 */
+		if (sorted) {
+			avl_build_sorted(domain_tree, (void **)domnodes, count);
+		} else {
+			for (i = 0; i != count; i++)
+				avl_add(domain_tree, domnodes[i]);
 		}
+		kmem_free(domnodes, count * sizeof (void *));
 		nvlist_free(nvp);
 		kmem_free(packed, fuid_size);
 	}
@@ -1348,7 +1348,8 @@ zfs_secpolicy_change_key(zfs_cmd_t *zc, nvlist_t *innvl, cred_t *cr)
  * Returns the nvlist as specified by the user in the zfs_cmd_t.
  */
 static int
-get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
+get_nvlist_impl(uint64_t nvl, uint64_t size, int iflag, nv_alloc_t *nva,
+    nvlist_t **nvp)
 {
 	char *packed;
 	int error;
@@ -1368,7 +1369,7 @@ get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
 		return (SET_ERROR(EFAULT));
 	}
 
-	if ((error = nvlist_unpack(packed, size, &list, 0)) != 0) {
+	if ((error = nvlist_xunpack(packed, size, &list, nva)) != 0) {
 		vmem_free(packed, size);
 		return (error);
 	}
@@ -1379,6 +1380,12 @@ get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
 	return (0);
 }
 
+static int
+get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
+{
+	return (get_nvlist_impl(nvl, size, iflag, nv_alloc_sleep, nvp));
+}
+
 /*
  * Reduce the size of this nvlist until it can be serialized in 'max' bytes.
  * Entries will be removed from the end of the nvlist, and one int32 entry
@@ -1763,25 +1770,46 @@ zfs_ioc_pool_tryimport(zfs_cmd_t *zc)
  * zc_name              name of the pool
  * zc_cookie            scan func (pool_scan_func_t)
  * zc_flags             scrub pause/resume flag (pool_scrub_cmd_t)
+ * zc_nvlist_src{_size}	optional txg range of a scrub (ZPOOL_SCAN_*)
  */
 static int
 zfs_ioc_pool_scan(zfs_cmd_t *zc)
 {
 	spa_t *spa;
+	nvlist_t *args = NULL;
+	uint64_t txg_start = 0, txg_end = 0;
 	int error;
 
 	if (zc->zc_flags >= POOL_SCRUB_FLAGS_END)
 		return (SET_ERROR(EINVAL));
 
-	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0)
+	if (zc->zc_nvlist_src_size != 0) {
+		if (zc->zc_cookie != POOL_SCAN_SCRUB ||
+		    zc->zc_flags != POOL_SCRUB_NORMAL)
+			return (SET_ERROR(EINVAL));
+		if ((error = get_nvlist(zc->zc_nvlist_src,
+		    zc->zc_nvlist_src_size, zc->zc_iflags, &args)) != 0)
+			return (error);
+		(void) nvlist_lookup_uint64(args, ZPOOL_SCAN_TXG_START,
+		    &txg_start);
+		(void) nvlist_lookup_uint64(args, ZPOOL_SCAN_TXG_END, &txg_end);
+	}
+
+	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0) {
+		nvlist_free(args);
 		return (error);
+	}
+
+	if (args != NULL && nvlist_exists(args, ZPOOL_SCAN_CONTINUE))
+		txg_start = spa->spa_dsl_pool->dp_scan->scn_last_scrubbed_txg;
+	nvlist_free(args);
 
 	if (zc->zc_flags == POOL_SCRUB_PAUSE)
 		error = spa_scrub_pause_resume(spa, POOL_SCRUB_PAUSE);
 	else if (zc->zc_cookie == POOL_SCAN_NONE)
 		error = spa_scan_stop(spa);
 	else
-		error = spa_scan(spa, zc->zc_cookie);
+		error = spa_scan_range(spa, zc->zc_cookie, txg_start, txg_end);
 
 	spa_close(spa, FTAG);
 
@@ -2027,6 +2055,7 @@ zfs_ioc_vdev_attach(zfs_cmd_t *zc)
 {
 	spa_t *spa;
 	int replacing = zc->zc_cookie;
+	int rebuild = zc->zc_simple;
 	nvlist_t *config;
 	int error;
 
@@ -2035,7 +2064,8 @@ zfs_ioc_vdev_attach(zfs_cmd_t *zc)
 
 	if ((error = get_nvlist(zc->zc_nvlist_conf, zc->zc_nvlist_conf_size,
 	    zc->zc_iflags, &config)) == 0) {
-		error = spa_vdev_attach(spa, zc->zc_guid, config, replacing);
+		error = spa_vdev_attach(spa, zc->zc_guid, config, replacing,
+		    rebuild);
 		nvlist_free(config);
 	}
 
@@ -2445,6 +2475,210 @@ zfs_ioc_snapshot_list_next(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * Most snapshots returned by one call to zfs_ioc_list_snapshots().  The
+ * pool's config lock is held while they are gathered.
+ */
+#define	ZFS_LIST_SNAPSHOTS_MAX	1024
+
+/*
+ * Returns B_TRUE if every property requested of a snapshot is a read-only
+ * statistic, which dsl_dataset_stats() provides without the snapshot's
+ * objset or the property ZAPs of its ancestors.
+ */
+static boolean_t
+zfs_list_snapshot_props_are_stats(nvlist_t *props)
+{
+	for (nvpair_t *pair = nvlist_next_nvpair(props, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(props, pair)) {
+		zfs_prop_t prop = zfs_name_to_prop(nvpair_name(pair));
+
+		if (prop == ZPROP_INVAL)
+			return (B_FALSE);
+		if (!zfs_prop_valid_for_type(prop, ZFS_TYPE_SNAPSHOT, B_FALSE))
+			continue;
+		if (!zfs_prop_readonly(prop) || zfs_prop_setonce(prop) ||
+		    prop == ZFS_PROP_USERACCOUNTING)
+			return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Add the stats and the requested properties of the snapshot ds of the
+ * objset os to snapnv.  When props is NULL, all of them are added, just
+ * as ZFS_IOC_SNAPSHOT_LIST_NEXT returns them.
+ */
+static int
+zfs_list_snapshot_stats(objset_t *os, dsl_dataset_t *ds, nvlist_t *props,
+    nvlist_t *snapnv)
+{
+	dmu_objset_stats_t stat = { 0 };
+	objset_t *ossnap;
+	nvlist_t *nv;
+	int error;
+
+	if (props != NULL && zfs_list_snapshot_props_are_stats(props)) {
+		stat.dds_type = dmu_objset_type(os);
+		dsl_dataset_fast_stat(ds, &stat);
+		nv = fnvlist_alloc();
+		dsl_dataset_stats(ds, nv);
+		dsl_prop_nvlist_add_uint64(nv, ZFS_PROP_TYPE, stat.dds_type);
+	} else {
+		if ((error = dmu_objset_from_ds(ds, &ossnap)) != 0)
+			return (error);
+		dmu_objset_fast_stat(ossnap, &stat);
+		if ((error = dsl_prop_get_all(ossnap, &nv)) != 0)
+			return (error);
+		dmu_objset_stats(ossnap, nv);
+		/* See zfs_ioc_objset_stats_impl() */
+		if (!stat.dds_inconsistent &&
+		    dmu_objset_type(ossnap) == DMU_OST_ZVOL) {
+			error = zvol_get_stats(ossnap, nv);
+			if (error == EIO) {
+				nvlist_free(nv);
+				return (error);
+			}
+			VERIFY0(error);
+		}
+	}
+
+	if (props != NULL) {
+		nvpair_t *pair, *next;
+
+		for (pair = nvlist_next_nvpair(nv, NULL); pair != NULL;
+		    pair = next) {
+			next = nvlist_next_nvpair(nv, pair);
+			if (!nvlist_exists(props, nvpair_name(pair)))
+				fnvlist_remove_nvpair(nv, pair);
+		}
+	}
+
+	fnvlist_add_uint8_array(snapnv, "stats", (uint8_t *)&stat,
+	    sizeof (stat));
+	fnvlist_add_nvlist(snapnv, "props", nv);
+	nvlist_free(nv);
+	return (0);
+}
+
+/*
+ * List the snapshots of a filesystem or volume in batches, with their
+ * stats and properties.  It returns what many calls to
+ * ZFS_IOC_SNAPSHOT_LIST_NEXT would, but holds the pool's config lock once
+ * per batch instead of once per snapshot.  If only some properties are
+ * requested, and all of them are read-only statistics, the snapshots'
+ * objsets and the property ZAPs of their ancestors are not read at all.
+ *
+ * innvl: {
+ *     "cookie" -> position to resume listing from (uint64) (optional)
+ *     "count" -> most snapshots to return (uint64) (optional)
+ *     SNAP_ITER_MIN_TXG -> lowest createtxg to list (uint64) (optional)
+ *     SNAP_ITER_MAX_TXG -> highest createtxg to list (uint64) (optional)
+ *     "props" -> { prop name 1, prop name 2, ... } (optional)
+ * }
+ *
+ * outnvl: {
+ *     "snaps" -> {
+ *         snapshot name -> {
+ *             "stats" -> dmu_objset_stats_t (uint8 array)
+ *             "props" -> { prop name -> { "value", "source" }, ... }
+ *         }
+ *         ...
+ *     }
+ *     "cookie" -> position to resume listing from (uint64), only present
+ *         if there may be more snapshots to list
+ * }
+ */
+static const zfs_ioc_key_t zfs_keys_list_snapshots[] = {
+	{"cookie",		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{"count",		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{SNAP_ITER_MIN_TXG,	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{SNAP_ITER_MAX_TXG,	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{"props",		DATA_TYPE_NVLIST,	ZK_OPTIONAL},
+};
+
+static int
+zfs_ioc_list_snapshots(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	uint64_t cookie = 0, count = ZFS_LIST_SNAPSHOTS_MAX;
+	uint64_t min_txg = 0, max_txg = 0;
+	nvlist_t *props = NULL;
+	nvlist_t *snaps;
+	objset_t *os;
+	size_t len;
+	int error;
+
+	(void) nvlist_lookup_uint64(innvl, "cookie", &cookie);
+	(void) nvlist_lookup_uint64(innvl, "count", &count);
+	(void) nvlist_lookup_uint64(innvl, SNAP_ITER_MIN_TXG, &min_txg);
+	(void) nvlist_lookup_uint64(innvl, SNAP_ITER_MAX_TXG, &max_txg);
+	(void) nvlist_lookup_nvlist(innvl, "props", &props);
+	count = MIN(count, ZFS_LIST_SNAPSHOTS_MAX);
+
+	/* A dataset name of maximum length cannot have any snapshots. */
+	if (strlcpy(name, fsname, sizeof (name)) >= sizeof (name) ||
+	    strlcat(name, "@", sizeof (name)) >= sizeof (name))
+		return (SET_ERROR(ESRCH));
+	len = strlen(name);
+
+	error = dmu_objset_hold(fsname, FTAG, &os);
+	if (error != 0)
+		return (error == ENOENT ? SET_ERROR(ESRCH) : error);
+
+	snaps = fnvlist_alloc();
+	while (count > 0) {
+		dsl_dataset_t *ds;
+		uint64_t obj;
+
+		if (issig(JUSTLOOKING) && issig(FORREAL)) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		name[len] = '\0';
+		error = dmu_snapshot_list_next(os, sizeof (name) - len,
+		    name + len, &obj, &cookie, NULL);
+		if (error == ENOENT) {
+			error = 0;
+			cookie = 0;
+			break;
+		} else if (error != 0) {
+			break;
+		}
+
+		error = dsl_dataset_hold_obj(dmu_objset_pool(os), obj,
+		    FTAG, &ds);
+		if (error != 0)
+			break;
+
+		if ((min_txg != 0 && dsl_get_creationtxg(ds) < min_txg) ||
+		    (max_txg != 0 && dsl_get_creationtxg(ds) > max_txg)) {
+			dsl_dataset_rele(ds, FTAG);
+			continue;
+		}
+
+		nvlist_t *snapnv = fnvlist_alloc();
+		error = zfs_list_snapshot_stats(os, ds, props, snapnv);
+		dsl_dataset_rele(ds, FTAG);
+		if (error == 0)
+			fnvlist_add_nvlist(snaps, name, snapnv);
+		fnvlist_free(snapnv);
+		if (error != 0)
+			break;
+		count--;
+	}
+	dmu_objset_rele(os, FTAG);
+
+	if (error == 0) {
+		fnvlist_add_nvlist(outnvl, "snaps", snaps);
+		if (cookie != 0)
+			fnvlist_add_uint64(outnvl, "cookie", cookie);
+	}
+	fnvlist_free(snaps);
+	return (error);
+}
+
 static int
 zfs_prop_set_userquota(const char *dsname, nvpair_t *pair)
 {
@@ -3878,16 +4112,24 @@ static const zfs_ioc_key_t zfs_keys_channel_program[] = {
 	{"sync",	DATA_TYPE_BOOLEAN_VALUE,	ZK_OPTIONAL},
 	{"instrlimit",	DATA_TYPE_UINT64,		ZK_OPTIONAL},
 	{"memlimit",	DATA_TYPE_UINT64,		ZK_OPTIONAL},
+	{"txg_instrlimit", DATA_TYPE_UINT64,		ZK_OPTIONAL},
+	{"output_fd",	DATA_TYPE_INT32,		ZK_OPTIONAL},
 };
 
+static zcp_stream_func_t zfs_ioc_channel_program_write;
+
 static int
 zfs_ioc_channel_program(const char *poolname, nvlist_t *innvl,
     nvlist_t *outnvl)
 {
 	char *program;
-	uint64_t instrlimit, memlimit;
+	uint64_t instrlimit, memlimit, txg_instrlimit;
 	boolean_t sync_flag;
 	nvpair_t *nvarg = NULL;
+	zcp_stream_t stream, *streamp = NULL;
+	file_t *fp = NULL;
+	int32_t outfd;
+	int error;
 
 	program = fnvlist_lookup_string(innvl, ZCP_ARG_PROGRAM);
 	if (0 != nvlist_lookup_boolean_value(innvl, ZCP_ARG_SYNC, &sync_flag)) {
@@ -3899,15 +4141,40 @@ zfs_ioc_channel_program(const char *poolname, nvlist_t *innvl,
 	if (0 != nvlist_lookup_uint64(innvl, ZCP_ARG_MEMLIMIT, &memlimit)) {
 		memlimit = ZCP_DEFAULT_MEMLIMIT;
 	}
+	if (0 != nvlist_lookup_uint64(innvl, ZCP_ARG_TXG_INSTRLIMIT,
+	    &txg_instrlimit)) {
+		txg_instrlimit = 0;
+	}
 	nvarg = fnvlist_lookup_nvpair(innvl, ZCP_ARG_ARGLIST);
 
-	if (instrlimit == 0 || instrlimit > zfs_lua_max_instrlimit)
+	/*
+	 * A program which yields between txgs is only bounded per txg by
+	 * zfs_lua_max_instrlimit, see zcp_eval().
+	 */
+	if (instrlimit == 0 ||
+	    (txg_instrlimit == 0 && instrlimit > zfs_lua_max_instrlimit))
 		return (SET_ERROR(EINVAL));
 	if (memlimit == 0 || memlimit > zfs_lua_max_memlimit)
 		return (SET_ERROR(EINVAL));
 
-	return (zcp_eval(poolname, program, sync_flag, instrlimit, memlimit,
-	    nvarg, outnvl));
+	if (nvlist_lookup_int32(innvl, ZCP_ARG_OUTPUT_FD, &outfd) == 0) {
+		if ((fp = getf(outfd)) == NULL)
+			return (SET_ERROR(EBADF));
+		stream.zs_func = zfs_ioc_channel_program_write;
+#if defined(__FreeBSD__) && defined(_KERNEL)
+		stream.zs_arg = fp;
+#else
+		stream.zs_arg = fp->f_vnode;
+#endif
+		streamp = &stream;
+	}
+
+	error = zcp_eval(poolname, program, sync_flag, instrlimit,
+	    txg_instrlimit, memlimit, streamp, nvarg, outnvl);
+
+	if (fp != NULL)
+		releasef(outfd);
+	return (error);
 }
 
 /*
@@ -4428,7 +4695,8 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 			    SPA_VERSION_ZLE_COMPRESSION))
 				return (SET_ERROR(ENOTSUP));
 
-			if (intval == ZIO_COMPRESS_LZ4) {
+			if (intval == ZIO_COMPRESS_LZ4 ||
+			    intval == ZIO_COMPRESS_LZ4_CHUNKED) {
 				spa_t *spa;
 
 				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
@@ -4442,6 +4710,20 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				spa_close(spa, FTAG);
 			}
 
+			spa_feature_t feature = zio_compress_to_feature(intval);
+			if (feature != SPA_FEATURE_NONE) {
+				spa_t *spa;
+
+				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+					return (err);
+
+				if (!spa_feature_is_enabled(spa, feature)) {
+					spa_close(spa, FTAG);
+					return (SET_ERROR(ENOTSUP));
+				}
+				spa_close(spa, FTAG);
+			}
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -4559,7 +4841,8 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 			if (feature == SPA_FEATURE_NONE)
 				break;
 #ifdef __FreeBSD__
-			if (feature == SPA_FEATURE_EDONR)
+			if (feature == SPA_FEATURE_EDONR ||
+			    feature == SPA_FEATURE_BLAKE3)
 				return (SET_ERROR(ENOTSUP));
 #endif
 			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
@@ -4915,7 +5198,7 @@ zfs_ioc_recv_impl(char *tofs, char *tosnap, char *origin, nvlist_t *recvprops,
 
 	error = dmu_recv_stream(&drc, cleanup_fd, action_handle, &off);
 
-	if (error == 0) {
+	if (error == 0 && drc.drc_end_object == 0) {
 		zfsvfs_t *zfsvfs = NULL;
 		zvol_state_t *zv _CC_UNUSED_ = NULL;
 
@@ -5376,6 +5659,23 @@ dump_bytes(objset_t *os, void *buf, int len, void *arg)
 	return (dbi.dbi_err);
 }
 
+/*
+ * Write channel program output streamed with zfs.stream() to output_fd.
+ * This is called between txgs, without the stack depth of sync context.
+ */
+static int
+zfs_ioc_channel_program_write(void *buf, size_t len, void *arg)
+{
+	dump_bytes_io_t dbi;
+
+	dbi.dbi_vpfp = arg;
+	dbi.dbi_buf = buf;
+	dbi.dbi_len = len;
+	dump_bytes_cb(&dbi);
+
+	return (dbi.dbi_err);
+}
+
 /*
  * inputs:
  * zc_name	name of snapshot to send
@@ -6176,13 +6476,70 @@ zfs_ioc_release(const char *pool, nvlist_t *holds, nvlist_t *errlist)
 	return (dsl_dataset_user_release(holds, errlist));
 }
 
+/*
+ * Upper bound on the space an event takes up in a batch beyond its own
+ * packed size: the nvpair header and name, less the packing header.
+ */
+#define	ZEVENT_BATCH_OVERHEAD	128
+
+/*
+ * Place as many pending events as fit in zc_nvlist_dst in one nvlist, each
+ * named by its position in the batch.  As for a single event, ENOENT is
+ * returned if there are none and ENOMEM with the size needed in
+ * zc_nvlist_dst_size if not even the first fits.
+ */
+static int
+zfs_ioc_events_next_batch(zfs_cmd_t *zc, zfs_zevent_t *ze)
+{
+	nvlist_t *batch, *event;
+	uint64_t event_size, dropped, total_dropped = 0;
+	size_t batch_size;
+	char name[16];
+	int n, error = 0;
+
+	batch = fnvlist_alloc();
+	VERIFY0(nvlist_size(batch, &batch_size, NV_ENCODE_NATIVE));
+
+	for (n = 0; batch_size + ZEVENT_BATCH_OVERHEAD <
+	    zc->zc_nvlist_dst_size; n++) {
+		event_size = zc->zc_nvlist_dst_size - batch_size -
+		    ZEVENT_BATCH_OVERHEAD;
+		event = NULL;
+		error = zfs_zevent_next(ze, &event, &event_size, &dropped);
+		if (error != 0) {
+			if (n == 0 && error == ENOMEM) {
+				zc->zc_nvlist_dst_size = batch_size +
+				    event_size + ZEVENT_BATCH_OVERHEAD;
+			}
+			break;
+		}
+
+		total_dropped += dropped;
+		(void) snprintf(name, sizeof (name), "%d", n);
+		fnvlist_add_nvlist(batch, name, event);
+		nvlist_free(event);
+		VERIFY0(nvlist_size(batch, &batch_size, NV_ENCODE_NATIVE));
+		ASSERT3U(batch_size, <=, zc->zc_nvlist_dst_size);
+	}
+
+	/* Whatever stopped the batch, return the events it holds */
+	if (n > 0) {
+		zc->zc_cookie = total_dropped;
+		error = put_nvlist(zc, batch);
+	}
+	nvlist_free(batch);
+
+	return (error);
+}
+
 /*
  * inputs:
- * zc_guid		flags (ZEVENT_NONBLOCK)
+ * zc_guid		flags (ZEVENT_NONBLOCK, ZEVENT_BATCH)
  * zc_cleanup_fd	zevent file descriptor
  *
  * outputs:
- * zc_nvlist_dst	next nvlist event
+ * zc_nvlist_dst	next nvlist event, or with ZEVENT_BATCH an nvlist
+ *			of the next events named "0", "1", ...
  * zc_cookie		dropped events since last get
  */
 static int
@@ -6199,12 +6556,16 @@ zfs_ioc_events_next(zfs_cmd_t *zc)
 		return (error);
 
 	do {
-		error = zfs_zevent_next(ze, &event,
-		    &zc->zc_nvlist_dst_size, &dropped);
-		if (event != NULL) {
-			zc->zc_cookie = dropped;
-			error = put_nvlist(zc, event);
-			nvlist_free(event);
+		if (zc->zc_guid & ZEVENT_BATCH) {
+			error = zfs_ioc_events_next_batch(zc, ze);
+		} else {
+			error = zfs_zevent_next(ze, &event,
+			    &zc->zc_nvlist_dst_size, &dropped);
+			if (event != NULL) {
+				zc->zc_cookie = dropped;
+				error = put_nvlist(zc, event);
+				nvlist_free(event);
+			}
 		}
 
 		if (zc->zc_guid & ZEVENT_NONBLOCK)
@@ -6384,6 +6745,12 @@ zfs_ioc_space_snaps(const char *lastsnap, nvlist_t *innvl, nvlist_t *outnvl)
  *         presence indicates raw encrypted records should be used.
  *     (optional) "resume_object" and "resume_offset" -> (uint64)
  *         if present, resume send stream from specified object and offset.
+ *     (optional) "chunk" and "num_chunks" -> (uint64)
+ *         if present, only send the given one of num_chunks chunks of the
+ *         dataset's objects.  Not allowed with the resume arguments.
+ *     (optional) "stream_compress" -> (uint64)
+ *         if present, the enum zio_compress of the algorithm with which the
+ *         payloads of DRR_WRITE records are compressed in the stream
  *     (optional) "redactbook" -> (string)
  *         if present, use this bookmark's redaction list to generate a redacted
  *         send stream
@@ -6400,6 +6767,9 @@ static const zfs_ioc_key_t zfs_keys_send_new[] = {
 	{"rawok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
 	{"resume_object",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
 	{"resume_offset",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{"chunk",		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{"num_chunks",		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{"stream_compress",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
 	{"redactbook",		DATA_TYPE_STRING,	ZK_OPTIONAL},
 };
 
@@ -6485,6 +6855,9 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	boolean_t rawok;
 	uint64_t resumeobj = 0;
 	uint64_t resumeoff = 0;
+	uint64_t chunk = 0;
+	uint64_t nchunks = 0;
+	uint64_t stream_compress = ZIO_COMPRESS_OFF;
 	char *redactbook = NULL;
 
 	fd = fnvlist_lookup_int32(innvl, "fd");
@@ -6499,6 +6872,18 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	(void) nvlist_lookup_uint64(innvl, "resume_object", &resumeobj);
 	(void) nvlist_lookup_uint64(innvl, "resume_offset", &resumeoff);
 
+	(void) nvlist_lookup_uint64(innvl, "chunk", &chunk);
+	(void) nvlist_lookup_uint64(innvl, "num_chunks", &nchunks);
+	if (nchunks != 0 && (chunk >= nchunks ||
+	    resumeobj != 0 || resumeoff != 0))
+		return (SET_ERROR(EINVAL));
+
+	(void) nvlist_lookup_uint64(innvl, "stream_compress", &stream_compress);
+	if (stream_compress != ZIO_COMPRESS_OFF &&
+	    (stream_compress >= ZIO_COMPRESS_FUNCTIONS ||
+	    zio_compress_table[stream_compress].ci_compress == NULL))
+		return (SET_ERROR(EINVAL));
+
 	(void) nvlist_lookup_string(innvl, "redactbook", &redactbook);
 
 	if ((fp = getf(fd)) == NULL)
@@ -6514,7 +6899,8 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 #endif
 	out.dso_dryrun = B_FALSE;
 	error = dmu_send(snapname, fromname, embedok, largeblockok, compressok,
-	    rawok, resumeobj, resumeoff, redactbook, fd, &off, &out);
+	    rawok, resumeobj, resumeoff, chunk, nchunks, stream_compress,
+	    redactbook, fd, &off, &out);
 
 #ifdef __FreeBSD__
 	if (off >= 0 && off <= MAXOFFSET_T)
@@ -6683,8 +7069,8 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 		dsl_dataset_rele(tosnap, FTAG);
 		dsl_pool_rele(dp, FTAG);
 		error = dmu_send(snapname, fromname, embedok, largeblockok,
-		    compressok, rawok, resumeobj, resumeoff, redactlist_book,
-		    fd, &off, &out);
+		    compressok, rawok, resumeobj, resumeoff, 0, 0,
+		    ZIO_COMPRESS_OFF, redactlist_book, fd, &off, &out);
 	} else {
 		error = dmu_send_estimate_fast(tosnap, fromsnap,
 		    (from && strchr(fromname, '#') != NULL ? &zbm : NULL),
@@ -6745,6 +7131,166 @@ zfs_ioc_pool_sync(const char *pool, nvlist_t *innvl, nvlist_t *onvl)
 	return (err);
 }
 
+/*
+ * Get the stats of the vdevs of a pool, without the rest of its config.
+ *
+ * innvl is unused
+ *
+ * outnvl: {
+ *     "<vdev guid>" -> {
+ *         ZPOOL_CONFIG_VDEV_STATS -> uint64 array (vdev_stat_t)
+ *         ZPOOL_CONFIG_VDEV_STATS_EX -> nvlist
+ *     }
+ *     ...
+ * }
+ */
+static const zfs_ioc_key_t zfs_keys_pool_vdev_stats[] = {
+	/* no nvl keys */
+};
+
+/* ARGSUSED */
+static int
+zfs_ioc_pool_vdev_stats(const char *pool, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	return (spa_get_vdev_stats(pool, outnvl));
+}
+
+/*
+ * List the ranges of the objects in a snapshot that changed since an
+ * earlier snapshot, without reading any file data.
+ *
+ * innvl: {
+ *     (optional) "from" -> earlier snapshot name (default: everything)
+ *     (optional) "object" -> only list this object
+ *     (optional) "cookie" -> uint64 array[2], from a previous call
+ *     (optional) "count" -> max number of extents to return
+ * }
+ *
+ * outnvl: {
+ *     "extents" -> uint64 array of (object, offset, length) triples
+ *     (optional) "cookie" -> pass back in to get the next extents
+ * }
+ */
+#define	ZFS_DIFF_BLOCKS_MAX	65536
+
+static const zfs_ioc_key_t zfs_keys_diff_blocks[] = {
+	{"from",	DATA_TYPE_STRING,	ZK_OPTIONAL},
+	{"object",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{"cookie",	DATA_TYPE_UINT64_ARRAY,	ZK_OPTIONAL},
+	{"count",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+};
+
+static int
+zfs_ioc_diff_blocks(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	char *from = NULL;
+	uint64_t object = 0;
+	uint64_t cookie[2] = { 0, 0 };
+	uint64_t *incookie;
+	uint_t ncookie;
+	uint64_t count = ZFS_DIFF_BLOCKS_MAX;
+	uint64_t *extents;
+	size_t size;
+	boolean_t more;
+	int error;
+
+	(void) nvlist_lookup_string(innvl, "from", &from);
+	(void) nvlist_lookup_uint64(innvl, "object", &object);
+	if (nvlist_lookup_uint64_array(innvl, "cookie", &incookie,
+	    &ncookie) == 0) {
+		if (ncookie != 2)
+			return (SET_ERROR(EINVAL));
+		cookie[0] = incookie[0];
+		cookie[1] = incookie[1];
+	}
+	(void) nvlist_lookup_uint64(innvl, "count", &count);
+	if (count == 0)
+		return (SET_ERROR(EINVAL));
+	count = MIN(count, ZFS_DIFF_BLOCKS_MAX);
+
+	size = 3 * count * sizeof (uint64_t);
+	extents = vmem_alloc(size, KM_SLEEP);
+	error = dmu_diff_blocks(snapname, from, object, cookie, extents,
+	    &count, &more);
+	if (error == 0) {
+		fnvlist_add_uint64_array(outnvl, "extents", extents,
+		    3 * count);
+		if (more)
+			fnvlist_add_uint64_array(outnvl, "cookie", cookie, 2);
+	}
+	vmem_free(extents, size);
+
+	return (error);
+}
+
+/*
+ * Retrieve the persistent error log of a pool a page at a time, rather than
+ * all at once as ZFS_IOC_ERROR_LOG does.
+ *
+ * innvl: {
+ *     (optional) "cookie" -> uint64 array[3], from a previous call
+ *     (optional) "count" -> max number of errors to return
+ * }
+ *
+ * outnvl: {
+ *     "bookmarks" -> uint64 array of (objset, object, level, blkid) tuples
+ *     (optional) "cookie" -> pass back in to get the next errors
+ * }
+ */
+#define	ZFS_ERROR_LOG_MAX	16384
+
+static const zfs_ioc_key_t zfs_keys_pool_error_log[] = {
+	{"cookie",	DATA_TYPE_UINT64_ARRAY,	ZK_OPTIONAL},
+	{"count",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+};
+
+static int
+zfs_ioc_pool_error_log(const char *pool, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	uint64_t cookie[3] = { 0, 0, 0 };
+	uint64_t *incookie;
+	uint_t ncookie;
+	uint64_t count = ZFS_ERROR_LOG_MAX;
+	zbookmark_phys_t *zb;
+	size_t size;
+	boolean_t more;
+	spa_t *spa;
+	int error;
+
+	CTASSERT(sizeof (zbookmark_phys_t) == 4 * sizeof (uint64_t));
+
+	if (nvlist_lookup_uint64_array(innvl, "cookie", &incookie,
+	    &ncookie) == 0) {
+		if (ncookie != 3)
+			return (SET_ERROR(EINVAL));
+		cookie[0] = incookie[0];
+		cookie[1] = incookie[1];
+		cookie[2] = incookie[2];
+	}
+	(void) nvlist_lookup_uint64(innvl, "count", &count);
+	if (count == 0)
+		return (SET_ERROR(EINVAL));
+	count = MIN(count, ZFS_ERROR_LOG_MAX);
+
+	if ((error = spa_open(pool, &spa, FTAG)) != 0)
+		return (error);
+
+	size = count * sizeof (zbookmark_phys_t);
+	zb = vmem_alloc(size, KM_SLEEP);
+	error = spa_get_errlog_page(spa, cookie, zb, &count, &more);
+	spa_close(spa, FTAG);
+
+	if (error == 0) {
+		fnvlist_add_uint64_array(outnvl, "bookmarks", (uint64_t *)zb,
+		    4 * count);
+		if (more)
+			fnvlist_add_uint64_array(outnvl, "cookie", cookie, 3);
+	}
+	vmem_free(zb, size);
+
+	return (error);
+}
+
 /*
  * Load a user's wrapping key into the kernel.
  * innvl: {
@@ -7058,6 +7604,11 @@ zfs_ioctl_init(void)
 	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE,
 	    zfs_keys_get_bookmarks, ARRAY_SIZE(zfs_keys_get_bookmarks));
 
+	zfs_ioctl_register("list_snapshots", ZFS_IOC_LIST_SNAPSHOTS,
+	    zfs_ioc_list_snapshots, zfs_secpolicy_read, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE,
+	    zfs_keys_list_snapshots, ARRAY_SIZE(zfs_keys_list_snapshots));
+
 	zfs_ioctl_register("get_bookmark_props", ZFS_IOC_GET_BOOKMARK_PROPS,
 	    zfs_ioc_get_bookmark_props, zfs_secpolicy_read, ENTITY_NAME,
 	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE, zfs_keys_get_bookmark_props,
@@ -7092,6 +7643,18 @@ zfs_ioctl_init(void)
 	    zfs_ioc_pool_sync, zfs_secpolicy_none, POOL_NAME,
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_FALSE,
 	    zfs_keys_pool_sync, ARRAY_SIZE(zfs_keys_pool_sync));
+	zfs_ioctl_register("vdev_stats", ZFS_IOC_POOL_VDEV_STATS,
+	    zfs_ioc_pool_vdev_stats, zfs_secpolicy_read, POOL_NAME,
+	    POOL_CHECK_NONE, B_FALSE, B_FALSE,
+	    zfs_keys_pool_vdev_stats, ARRAY_SIZE(zfs_keys_pool_vdev_stats));
+	zfs_ioctl_register("diff_blocks", ZFS_IOC_DIFF_BLOCKS,
+	    zfs_ioc_diff_blocks, zfs_secpolicy_diff, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE,
+	    zfs_keys_diff_blocks, ARRAY_SIZE(zfs_keys_diff_blocks));
+	zfs_ioctl_register("error_log", ZFS_IOC_POOL_ERROR_LOG,
+	    zfs_ioc_pool_error_log, zfs_secpolicy_inject, POOL_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE,
+	    zfs_keys_pool_error_log, ARRAY_SIZE(zfs_keys_pool_error_log));
 	zfs_ioctl_register("reopen", ZFS_IOC_POOL_REOPEN, zfs_ioc_pool_reopen,
 	    zfs_secpolicy_config, POOL_NAME, POOL_CHECK_SUSPENDED, B_TRUE,
 	    B_TRUE, zfs_keys_pool_reopen, ARRAY_SIZE(zfs_keys_pool_reopen));
@@ -7577,6 +8140,7 @@ zfsdev_ioctl_common(uint_t vecnum, unsigned long arg)
 	const zfs_ioc_vec_t *vec;
 	char *saved_poolname = NULL;
 	nvlist_t *innvl = NULL;
+	nv_alloc_t innva;
 	fstrans_cookie_t cookie;
 
 	cmd = vecnum;
@@ -7617,10 +8181,18 @@ zfsdev_ioctl_common(uint_t vecnum, unsigned long arg)
 		error = SET_ERROR(EINVAL);	/* User's size too big */
 
 	} else if (zc->zc_nvlist_src_size != 0) {
-		error = get_nvlist(zc->zc_nvlist_src, zc->zc_nvlist_src_size,
-		    zc->zc_iflags, &innvl);
-		if (error != 0)
+		/*
+		 * The input nvlist lives exactly as long as this ioctl, so it
+		 * is unpacked into an arena and released in one go below
+		 * rather than one allocation per nvpair.
+		 */
+		VERIFY0(nv_alloc_init(&innva, nv_arena_ops));
+		error = get_nvlist_impl(zc->zc_nvlist_src,
+		    zc->zc_nvlist_src_size, zc->zc_iflags, &innva, &innvl);
+		if (error != 0) {
+			nv_alloc_fini(&innva);
 			goto out;
+		}
 	}
 
 	/*
@@ -7759,7 +8331,8 @@ zfsdev_ioctl_common(uint_t vecnum, unsigned long arg)
 	}
 
 out:
-	nvlist_free(innvl);
+	if (innvl != NULL)
+		nv_alloc_fini(&innva);
 	rc = ddi_copyout(zc, (void *)arg, sizeof (zfs_cmd_t), flag);
 	if (error == 0 && rc != 0)
 		error = SET_ERROR(EFAULT);
@@ -25,6 +25,16 @@
 
 #include <sys/zfs_ratelimit.h>
 
+static void
+zfs_ratelimit_summary_reset(zfs_ratelimit_summary_t *rs)
+{
+	rs->rs_count = 0;
+	for (int i = 0; i < ZFS_RATELIMIT_NVALS; i++) {
+		rs->rs_min[i] = UINT64_MAX;
+		rs->rs_max[i] = 0;
+	}
+}
+
 /*
  * Initialize rate limit struct
  *
@@ -40,6 +50,7 @@ zfs_ratelimit_init(zfs_ratelimit_t *rl, unsigned int *burst,
 	rl->start = 0;
 	rl->interval = interval;
 	rl->burst = burst;
+	zfs_ratelimit_summary_reset(&rl->summary);
 	mutex_init(&rl->lock, NULL, MUTEX_DEFAULT, NULL);
 }
 
@@ -74,11 +85,29 @@ zfs_ratelimit_fini(zfs_ratelimit_t *rl)
 int
 zfs_ratelimit(zfs_ratelimit_t *rl)
 {
+	return (zfs_ratelimit_summarize(rl, NULL, NULL));
+}
+
+/*
+ * As zfs_ratelimit(), but rather than just dropping the events beyond the
+ * limit, count them and keep the range of the ZFS_RATELIMIT_NVALS values
+ * in 'vals', if given, over them.  When an event starts a new interval and
+ * events were suppressed in the previous one, their summary is returned in
+ * 'prev' so that the caller can report it; otherwise prev->rs_count is 0.
+ */
+int
+zfs_ratelimit_summarize(zfs_ratelimit_t *rl, const uint64_t *vals,
+    zfs_ratelimit_summary_t *prev)
+{
+	zfs_ratelimit_summary_t *rs = &rl->summary;
 	hrtime_t now;
 
 	hrtime_t elapsed;
 	int error = 1;
 
+	if (prev != NULL)
+		prev->rs_count = 0;
+
 	mutex_enter(&rl->lock);
 
 	now = gethrtime();
@@ -88,9 +117,18 @@ zfs_ratelimit(zfs_ratelimit_t *rl)
 	if (NSEC2SEC(elapsed) >= rl->interval) {
 		rl->start = now;
 		rl->count = 0;
+		if (prev != NULL && rs->rs_count != 0)
+			*prev = *rs;
+		zfs_ratelimit_summary_reset(rs);
 	} else {
 		if (rl->count >= *rl->burst) {
 			error = 0; /* We're ratelimiting */
+			rs->rs_count++;
+			for (int i = 0; vals != NULL &&
+			    i < ZFS_RATELIMIT_NVALS; i++) {
+				rs->rs_min[i] = MIN(rs->rs_min[i], vals[i]);
+				rs->rs_max[i] = MAX(rs->rs_max[i], vals[i]);
+			}
 		}
 	}
 	mutex_exit(&rl->lock);
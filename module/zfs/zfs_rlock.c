@@ -94,11 +94,38 @@
  * So if the block size needs to be grown then the whole file is
  * exclusively locked, then later the caller will reduce the lock
  * range to just the range to be written using rangelock_reduce().
+ *
+ * Striping
+ * --------
+ * With a single tree, all locking of a highly parallel workload serialises
+ * on one mutex, even when the ranges never overlap.  A rangelock can be
+ * striped instead: the file is cut in regions of 2^RANGELOCK_REGION_SHIFT
+ * bytes, and the locks within a region go to the tree of stripe
+ * (region % rl_nstripes), each of which has its own mutex.  A lock that
+ * spans regions is a "wide" lock, it is entered in the tree of every
+ * stripe, in increasing order of stripe, as a chain of pieces linked by
+ * lr_next_piece.  A wide lock only ever waits at the stripe after the
+ * ones it already holds, on locks that either do not wait or wait at a
+ * later stripe, so there is no deadlock.  Wide locks hold their pieces
+ * while they wait, so their range must not change, and striped
+ * rangelocks therefore have no callback: they don't support RL_APPEND
+ * nor rangelock_reduce().
  */
 
 #include <sys/zfs_context.h>
 #include <sys/zfs_rlock.h>
 
+/*
+ * Number of stripes of the striped rangelocks, such as those of zvols.
+ * Only read when a rangelock is initialised.
+ */
+uint_t zfs_rangelock_stripes = 16;
+
+#define	RANGELOCK_REGION_SHIFT	20	/* 1MB regions */
+#define	RANGELOCK_MAX_STRIPES	256
+
+#define	RL_STRIPE(rl, lr)	(&(rl)->rl_stripes[(lr)->lr_stripe])
+
 /*
  * AVL comparison function used to order range locks
  * Locks are ordered on the start offset of the range.
@@ -117,21 +144,62 @@ rangelock_compare(const void *arg1, const void *arg2)
  * It must convert RL_APPEND to RL_WRITER (starting at the end of the file),
  * and may increase the range that's locked for RL_WRITER.
  */
+static void
+rangelock_stripe_init(rangelock_stripe_t *rls)
+{
+	mutex_init(&rls->rls_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&rls->rls_tree, rangelock_compare,
+	    sizeof (locked_range_t), offsetof(locked_range_t, lr_node));
+}
+
+static void
+rangelock_stripe_fini(rangelock_stripe_t *rls)
+{
+	mutex_destroy(&rls->rls_lock);
+	avl_destroy(&rls->rls_tree);
+}
+
 void
 zfs_rangelock_init(rangelock_t *rl, rangelock_cb_t *cb, void *arg)
 {
-	mutex_init(&rl->rl_lock, NULL, MUTEX_DEFAULT, NULL);
-	avl_create(&rl->rl_tree, rangelock_compare,
-	    sizeof (locked_range_t), offsetof(locked_range_t, lr_node));
+	rangelock_stripe_init(&rl->rl_stripe0);
+	rl->rl_stripes = &rl->rl_stripe0;
+	rl->rl_nstripes = 1;
 	rl->rl_cb = cb;
 	rl->rl_arg = arg;
 }
 
+/*
+ * Initialise a rangelock with zfs_rangelock_stripes stripes, for users
+ * with lots of concurrent, mostly disjoint, I/O.  See "Striping" above.
+ */
+void
+zfs_rangelock_init_striped(rangelock_t *rl)
+{
+	uint_t n = MIN(MAX(zfs_rangelock_stripes, 1), RANGELOCK_MAX_STRIPES);
+
+	if (n == 1) {
+		zfs_rangelock_init(rl, NULL, NULL);
+		return;
+	}
+
+	rl->rl_stripes = kmem_alloc(n * sizeof (rangelock_stripe_t), KM_SLEEP);
+	for (uint_t i = 0; i < n; i++)
+		rangelock_stripe_init(&rl->rl_stripes[i]);
+	rl->rl_nstripes = n;
+	rl->rl_cb = NULL;
+	rl->rl_arg = NULL;
+}
+
 void
 zfs_rangelock_fini(rangelock_t *rl)
 {
-	mutex_destroy(&rl->rl_lock);
-	avl_destroy(&rl->rl_tree);
+	for (uint_t i = 0; i < rl->rl_nstripes; i++)
+		rangelock_stripe_fini(&rl->rl_stripes[i]);
+	if (rl->rl_stripes != &rl->rl_stripe0) {
+		kmem_free(rl->rl_stripes,
+		    rl->rl_nstripes * sizeof (rangelock_stripe_t));
+	}
 }
 
 /*
@@ -140,7 +208,8 @@ zfs_rangelock_fini(rangelock_t *rl)
 static void
 rangelock_enter_writer(rangelock_t *rl, locked_range_t *new)
 {
-	avl_tree_t *tree = &rl->rl_tree;
+	rangelock_stripe_t *rls = RL_STRIPE(rl, new);
+	avl_tree_t *tree = &rls->rls_tree;
 	locked_range_t *lr;
 	avl_index_t where;
 	uint64_t orig_off = new->lr_offset;
@@ -195,7 +264,7 @@ wait:
 			cv_init(&lr->lr_write_cv, NULL, CV_DEFAULT, NULL);
 			lr->lr_write_wanted = B_TRUE;
 		}
-		cv_wait(&lr->lr_write_cv, &rl->rl_lock);
+		cv_wait(&lr->lr_write_cv, &rls->rls_lock);
 
 		/* reset to original */
 		new->lr_offset = orig_off;
@@ -377,7 +446,8 @@ rangelock_add_reader(avl_tree_t *tree, locked_range_t *new,
 static void
 rangelock_enter_reader(rangelock_t *rl, locked_range_t *new)
 {
-	avl_tree_t *tree = &rl->rl_tree;
+	rangelock_stripe_t *rls = RL_STRIPE(rl, new);
+	avl_tree_t *tree = &rls->rls_tree;
 	locked_range_t *prev, *next;
 	avl_index_t where;
 	uint64_t off = new->lr_offset;
@@ -401,7 +471,7 @@ retry:
 				    NULL, CV_DEFAULT, NULL);
 				prev->lr_read_wanted = B_TRUE;
 			}
-			cv_wait(&prev->lr_read_cv, &rl->rl_lock);
+			cv_wait(&prev->lr_read_cv, &rls->rls_lock);
 			goto retry;
 		}
 		if (off + len < prev->lr_offset + prev->lr_length)
@@ -425,7 +495,7 @@ retry:
 				    NULL, CV_DEFAULT, NULL);
 				next->lr_read_wanted = B_TRUE;
 			}
-			cv_wait(&next->lr_read_cv, &rl->rl_lock);
+			cv_wait(&next->lr_read_cv, &rls->rls_lock);
 			goto retry;
 		}
 		if (off + len <= next->lr_offset + next->lr_length)
@@ -440,6 +510,46 @@ got_lock:
 	rangelock_add_reader(tree, new, prev, where);
 }
 
+/*
+ * Lock the range of new in the tree of its stripe.
+ */
+static void
+rangelock_enter_stripe(rangelock_t *rl, locked_range_t *new)
+{
+	rangelock_stripe_t *rls = RL_STRIPE(rl, new);
+
+	mutex_enter(&rls->rls_lock);
+	if (new->lr_type == RL_READER) {
+		/*
+		 * First check for the usual case of no locks
+		 */
+		if (avl_numnodes(&rls->rls_tree) == 0)
+			avl_add(&rls->rls_tree, new);
+		else
+			rangelock_enter_reader(rl, new);
+	} else
+		rangelock_enter_writer(rl, new); /* RL_WRITER or RL_APPEND */
+	mutex_exit(&rls->rls_lock);
+}
+
+static locked_range_t *
+rangelock_alloc(rangelock_t *rl, uint64_t off, uint64_t len,
+    rangelock_type_t type, uint_t stripe)
+{
+	locked_range_t *new = kmem_alloc(sizeof (locked_range_t), KM_SLEEP);
+	new->lr_rangelock = rl;
+	new->lr_offset = off;
+	new->lr_length = len;
+	new->lr_count = 1; /* assume it's going to be in the tree */
+	new->lr_type = type;
+	new->lr_proxy = B_FALSE;
+	new->lr_write_wanted = B_FALSE;
+	new->lr_read_wanted = B_FALSE;
+	new->lr_stripe = stripe;
+	new->lr_next_piece = NULL;
+	return (new);
+}
+
 /*
  * Lock a range (offset, length) as either shared (RL_READER) or exclusive
  * (RL_WRITER or RL_APPEND).  If RL_APPEND is specified, rl_cb() will convert
@@ -453,31 +563,41 @@ rangelock_enter(rangelock_t *rl, uint64_t off, uint64_t len,
 {
 	ASSERT(type == RL_READER || type == RL_WRITER || type == RL_APPEND);
 
-	locked_range_t *new = kmem_alloc(sizeof (locked_range_t), KM_SLEEP);
-	new->lr_rangelock = rl;
-	new->lr_offset = off;
 	if (len + off < off)	/* overflow */
 		len = UINT64_MAX - off;
-	new->lr_length = len;
-	new->lr_count = 1; /* assume it's going to be in the tree */
-	new->lr_type = type;
-	new->lr_proxy = B_FALSE;
-	new->lr_write_wanted = B_FALSE;
-	new->lr_read_wanted = B_FALSE;
 
-	mutex_enter(&rl->rl_lock);
-	if (type == RL_READER) {
-		/*
-		 * First check for the usual case of no locks
-		 */
-		if (avl_numnodes(&rl->rl_tree) == 0)
-			avl_add(&rl->rl_tree, new);
+	if (rl->rl_nstripes == 1) {
+		locked_range_t *new = rangelock_alloc(rl, off, len, type, 0);
+		rangelock_enter_stripe(rl, new);
+		return (new);
+	}
+
+	/* Striped rangelocks have no callback to convert RL_APPEND */
+	ASSERT3U(type, !=, RL_APPEND);
+	ASSERT3P(rl->rl_cb, ==, NULL);
+
+	uint64_t region = off >> RANGELOCK_REGION_SHIFT;
+	if (len == 0 || region == (off + len - 1) >> RANGELOCK_REGION_SHIFT) {
+		locked_range_t *new = rangelock_alloc(rl, off, len, type,
+		    region % rl->rl_nstripes);
+		rangelock_enter_stripe(rl, new);
+		return (new);
+	}
+
+	/*
+	 * A wide lock: lock the whole range in every stripe, in order.
+	 */
+	locked_range_t *first = NULL, *prev = NULL;
+	for (uint_t i = 0; i < rl->rl_nstripes; i++) {
+		locked_range_t *piece = rangelock_alloc(rl, off, len, type, i);
+		rangelock_enter_stripe(rl, piece);
+		if (prev == NULL)
+			first = piece;
 		else
-			rangelock_enter_reader(rl, new);
-	} else
-		rangelock_enter_writer(rl, new); /* RL_WRITER or RL_APPEND */
-	mutex_exit(&rl->rl_lock);
-	return (new);
+			prev->lr_next_piece = piece;
+		prev = piece;
+	}
+	return (first);
 }
 
 /*
@@ -502,7 +622,7 @@ static void
 rangelock_exit_reader(rangelock_t *rl, locked_range_t *remove,
     list_t *free_list)
 {
-	avl_tree_t *tree = &rl->rl_tree;
+	avl_tree_t *tree = &RL_STRIPE(rl, remove)->rls_tree;
 	uint64_t len;
 
 	/*
@@ -565,11 +685,7 @@ rangelock_exit(locked_range_t *lr)
 {
 	rangelock_t *rl = lr->lr_rangelock;
 	list_t free_list;
-	locked_range_t *free_lr;
-
-	ASSERT(lr->lr_type == RL_WRITER || lr->lr_type == RL_READER);
-	ASSERT(lr->lr_count == 1 || lr->lr_count == 0);
-	ASSERT(!lr->lr_proxy);
+	locked_range_t *free_lr, *next_piece;
 
 	/*
 	 * The free list is used to defer the cv_destroy() and
@@ -578,23 +694,32 @@ rangelock_exit(locked_range_t *lr)
 	list_create(&free_list, sizeof (locked_range_t),
 	    offsetof(locked_range_t, lr_node));
 
-	mutex_enter(&rl->rl_lock);
-	if (lr->lr_type == RL_WRITER) {
-		/* writer locks can't be shared or split */
-		avl_remove(&rl->rl_tree, lr);
-		if (lr->lr_write_wanted)
-			cv_broadcast(&lr->lr_write_cv);
-		if (lr->lr_read_wanted)
-			cv_broadcast(&lr->lr_read_cv);
-		list_insert_tail(&free_list, lr);
-	} else {
-		/*
-		 * lock may be shared, let rangelock_exit_reader()
-		 * release the lock and free the locked_range_t.
-		 */
-		rangelock_exit_reader(rl, lr, &free_list);
+	for (; lr != NULL; lr = next_piece) {
+		rangelock_stripe_t *rls = RL_STRIPE(rl, lr);
+
+		ASSERT(lr->lr_type == RL_WRITER || lr->lr_type == RL_READER);
+		ASSERT(lr->lr_count == 1 || lr->lr_count == 0);
+		ASSERT(!lr->lr_proxy);
+
+		next_piece = lr->lr_next_piece;
+		mutex_enter(&rls->rls_lock);
+		if (lr->lr_type == RL_WRITER) {
+			/* writer locks can't be shared or split */
+			avl_remove(&rls->rls_tree, lr);
+			if (lr->lr_write_wanted)
+				cv_broadcast(&lr->lr_write_cv);
+			if (lr->lr_read_wanted)
+				cv_broadcast(&lr->lr_read_cv);
+			list_insert_tail(&free_list, lr);
+		} else {
+			/*
+			 * lock may be shared, let rangelock_exit_reader()
+			 * release the lock and free the locked_range_t.
+			 */
+			rangelock_exit_reader(rl, lr, &free_list);
+		}
+		mutex_exit(&rls->rls_lock);
 	}
-	mutex_exit(&rl->rl_lock);
 
 	while ((free_lr = list_remove_head(&free_list)) != NULL)
 		rangelock_free(free_lr);
@@ -613,17 +738,18 @@ rangelock_reduce(locked_range_t *lr, uint64_t off, uint64_t len)
 	rangelock_t *rl = lr->lr_rangelock;
 
 	/* Ensure there are no other locks */
-	ASSERT3U(avl_numnodes(&rl->rl_tree), ==, 1);
+	ASSERT3U(rl->rl_nstripes, ==, 1);
+	ASSERT3U(avl_numnodes(&rl->rl_stripe0.rls_tree), ==, 1);
 	ASSERT3U(lr->lr_offset, ==, 0);
 	ASSERT3U(lr->lr_type, ==, RL_WRITER);
 	ASSERT(!lr->lr_proxy);
 	ASSERT3U(lr->lr_length, ==, UINT64_MAX);
 	ASSERT3U(lr->lr_count, ==, 1);
 
-	mutex_enter(&rl->rl_lock);
+	mutex_enter(&rl->rl_stripe0.rls_lock);
 	lr->lr_offset = off;
 	lr->lr_length = len;
-	mutex_exit(&rl->rl_lock);
+	mutex_exit(&rl->rl_stripe0.rls_lock);
 	if (lr->lr_write_wanted)
 		cv_broadcast(&lr->lr_write_cv);
 	if (lr->lr_read_wanted)
@@ -632,8 +758,14 @@ rangelock_reduce(locked_range_t *lr, uint64_t off, uint64_t len)
 
 #if defined(_KERNEL)
 EXPORT_SYMBOL(zfs_rangelock_init);
+EXPORT_SYMBOL(zfs_rangelock_init_striped);
 EXPORT_SYMBOL(zfs_rangelock_fini);
 EXPORT_SYMBOL(rangelock_enter);
 EXPORT_SYMBOL(rangelock_exit);
 EXPORT_SYMBOL(rangelock_reduce);
+
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, rangelock_stripes, UINT, ZMOD_RW,
+	"Number of stripes of the range locks of zvols");
+/* END CSTYLED */
 #endif
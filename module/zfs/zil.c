@@ -111,6 +111,10 @@ zil_stats_t zil_stats = {
 	{ "zil_itx_metaslab_normal_bytes",	KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_count",	KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_bytes",	KSTAT_DATA_UINT64 },
+	{ "zil_lwb_alloc_count",		KSTAT_DATA_UINT64 },
+	{ "zil_lwb_alloc_bytes",		KSTAT_DATA_UINT64 },
+	{ "zil_lwb_write_bytes",		KSTAT_DATA_UINT64 },
+	{ "zil_lwb_fast_count",			KSTAT_DATA_UINT64 },
 };
 
 static kstat_t *zil_ksp;
@@ -135,6 +139,15 @@ int zil_nocacheflush = 0;
  */
 unsigned long zil_slog_bulk = 768 * 1024;
 
+/*
+ * Latency in microseconds of the last log block write, flushes included,
+ * at or below which the log device is considered fast.  Extra log blocks
+ * cost little on such devices, so the next block is sized for the
+ * average burst of commits rather than the largest recent one, see
+ * zil_lwb_plan_size().  Zero disables this.
+ */
+unsigned long zil_lwb_fast_latency = 100;
+
 static kmem_cache_t *zil_lwb_cache;
 static kmem_cache_t *zil_zcw_cache;
 
@@ -988,7 +1001,7 @@ zil_commit_waiter_skip(zil_commit_waiter_t *zcw)
 	mutex_enter(&zcw->zcw_lock);
 	ASSERT3B(zcw->zcw_done, ==, B_FALSE);
 	zcw->zcw_done = B_TRUE;
-	cv_broadcast(&zcw->zcw_cv);
+	cv_signal(&zcw->zcw_cv);
 	mutex_exit(&zcw->zcw_lock);
 }
 
@@ -1012,6 +1025,7 @@ zil_commit_waiter_link_lwb(zil_commit_waiter_t *zcw, lwb_t *lwb)
 	ASSERT3P(zcw->zcw_lwb, ==, NULL);
 	ASSERT3P(lwb, !=, NULL);
 	ASSERT(lwb->lwb_state == LWB_STATE_OPENED ||
+	    lwb->lwb_state == LWB_STATE_READY ||
 	    lwb->lwb_state == LWB_STATE_ISSUED ||
 	    lwb->lwb_state == LWB_STATE_WRITE_DONE);
 
@@ -1178,7 +1192,7 @@ zil_lwb_flush_vdevs_done(zio_t *zio)
 
 		ASSERT3B(zcw->zcw_done, ==, B_FALSE);
 		zcw->zcw_done = B_TRUE;
-		cv_broadcast(&zcw->zcw_cv);
+		cv_signal(&zcw->zcw_cv);
 
 		mutex_exit(&zcw->zcw_lock);
 	}
@@ -1237,6 +1251,11 @@ zil_lwb_write_done(zio_t *zio)
 	nlwb = list_next(&zilog->zl_lwb_list, lwb);
 	mutex_exit(&zilog->zl_lock);
 
+	if (zio->io_error == 0) {
+		metaslab_fastwrite_latency(spa, zio->io_bp,
+		    gethrtime() - lwb->lwb_issued_timestamp);
+	}
+
 	if (avl_numnodes(t) == 0)
 		return;
 
@@ -1307,6 +1326,7 @@ zil_lwb_set_zio_dependency(zilog_t *zilog, lwb_t *lwb)
 	if (last_lwb_opened != NULL &&
 	    last_lwb_opened->lwb_state != LWB_STATE_FLUSH_DONE) {
 		ASSERT(last_lwb_opened->lwb_state == LWB_STATE_OPENED ||
+		    last_lwb_opened->lwb_state == LWB_STATE_READY ||
 		    last_lwb_opened->lwb_state == LWB_STATE_ISSUED ||
 		    last_lwb_opened->lwb_state == LWB_STATE_WRITE_DONE);
 
@@ -1339,6 +1359,7 @@ zil_lwb_set_zio_dependency(zilog_t *zilog, lwb_t *lwb)
 		 */
 		if (last_lwb_opened->lwb_state != LWB_STATE_WRITE_DONE) {
 			ASSERT(last_lwb_opened->lwb_state == LWB_STATE_OPENED ||
+			    last_lwb_opened->lwb_state == LWB_STATE_READY ||
 			    last_lwb_opened->lwb_state == LWB_STATE_ISSUED);
 
 			ASSERT3P(last_lwb_opened->lwb_write_zio, !=, NULL);
@@ -1431,12 +1452,79 @@ uint64_t zil_block_buckets[] = {
  */
 int zil_maxblocksize = SPA_OLD_MAXBLOCKSIZE;
 
+static uint64_t
+zil_lwb_bucket(zilog_t *zilog, uint64_t size)
+{
+	int i;
+
+	for (i = 0; size > zil_block_buckets[i]; i++)
+		continue;
+	return (MIN(zil_block_buckets[i], zilog->zl_max_block_size));
+}
+
 /*
- * Start a log block write and advance to the next log block.
- * Calls are serialized.
+ * Log blocks are pre-allocated. Here we select the size of the next
+ * block, based on the size of the current burst of commits, that is the
+ * bytes committed since a waiter last had to issue a partially filled
+ * block on its timeout.
+ * - first find the smallest bucket that will fit the burst from a
+ *   limited set of block sizes. This is because it's faster to write
+ *   blocks allocated from the same metaslab as they are adjacent or
+ *   close.
+ * - if the log device is fast, extra blocks are cheap, so the size only
+ *   grows up to the moving average of the previous bursts.  Small
+ *   commits are then packed in small blocks, and only bursts that are
+ *   large now get large blocks.
+ * - otherwise find the maximum from the new suggested size and an array
+ *   of previous sizes. This lessens a picket fence effect of wrongly
+ *   guessing the size if we have a stream of say 2k, 64k, 2k, 64k
+ *   requests, each wrong guess costing a slow round trip.
+ *
+ * Note we only write what is used, but we can't just allocate
+ * the maximum block size because we can exhaust the available
+ * pool log space.
+ */
+static uint64_t
+zil_lwb_plan_size(zilog_t *zilog)
+{
+	hrtime_t latency = zilog->zl_last_lwb_latency;
+	uint64_t size;
+
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+
+	size = zil_lwb_bucket(zilog, zilog->zl_cur_used + sizeof (zil_chain_t));
+	zilog->zl_prev_blks[zilog->zl_prev_rotor] = size;
+	zilog->zl_prev_rotor = (zilog->zl_prev_rotor + 1) & (ZIL_PREV_BLKS - 1);
+
+	if (latency != 0 && latency <= USEC2NSEC(zil_lwb_fast_latency)) {
+		ZIL_STAT_BUMP(zil_lwb_fast_count);
+		return (MAX(size, zil_lwb_bucket(zilog,
+		    zilog->zl_burst_avg + sizeof (zil_chain_t))));
+	}
+
+	for (int i = 0; i < ZIL_PREV_BLKS; i++)
+		size = MAX(size, zilog->zl_prev_blks[i]);
+	return (size);
+}
+
+static zil_chain_t *
+zil_lwb_chain(lwb_t *lwb)
+{
+	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2)
+		return ((zil_chain_t *)lwb->lwb_buf);
+	else
+		return ((zil_chain_t *)(lwb->lwb_buf + lwb->lwb_sz));
+}
+
+/*
+ * Close a log block to new records and advance to the next log block,
+ * whose block is allocated and linked to this one.  The closed lwb is
+ * added to the ilwbs list, to be issued by the caller through
+ * zil_lwb_write_issue() once it has dropped the zl_issuer_lock.  Calls
+ * are serialized.
  */
 static lwb_t *
-zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
+zil_lwb_write_close(zilog_t *zilog, lwb_t *lwb, list_t *ilwbs)
 {
 	lwb_t *nlwb = NULL;
 	zil_chain_t *zilc;
@@ -1444,8 +1532,8 @@ zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
 	blkptr_t *bp;
 	dmu_tx_t *tx;
 	uint64_t txg;
-	uint64_t zil_blksz, wsz;
-	int i, error;
+	uint64_t zil_blksz;
+	int error;
 	boolean_t slog;
 
 	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
@@ -1453,13 +1541,8 @@ zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
 	ASSERT3P(lwb->lwb_write_zio, !=, NULL);
 	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
 
-	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
-		zilc = (zil_chain_t *)lwb->lwb_buf;
-		bp = &zilc->zc_next_blk;
-	} else {
-		zilc = (zil_chain_t *)(lwb->lwb_buf + lwb->lwb_sz);
-		bp = &zilc->zc_next_blk;
-	}
+	zilc = zil_lwb_chain(lwb);
+	bp = &zilc->zc_next_blk;
 
 	ASSERT(lwb->lwb_nused <= lwb->lwb_sz);
 
@@ -1488,30 +1571,7 @@ zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
 
 	lwb->lwb_tx = tx;
 
-	/*
-	 * Log blocks are pre-allocated. Here we select the size of the next
-	 * block, based on size used in the last block.
-	 * - first find the smallest bucket that will fit the block from a
-	 *   limited set of block sizes. This is because it's faster to write
-	 *   blocks allocated from the same metaslab as they are adjacent or
-	 *   close.
-	 * - next find the maximum from the new suggested size and an array of
-	 *   previous sizes. This lessens a picket fence effect of wrongly
-	 *   guessing the size if we have a stream of say 2k, 64k, 2k, 64k
-	 *   requests.
-	 *
-	 * Note we only write what is used, but we can't just allocate
-	 * the maximum block size because we can exhaust the available
-	 * pool log space.
-	 */
-	zil_blksz = zilog->zl_cur_used + sizeof (zil_chain_t);
-	for (i = 0; zil_blksz > zil_block_buckets[i]; i++)
-		continue;
-	zil_blksz = MIN(zil_block_buckets[i], zilog->zl_max_block_size);
-	zilog->zl_prev_blks[zilog->zl_prev_rotor] = zil_blksz;
-	for (i = 0; i < ZIL_PREV_BLKS; i++)
-		zil_blksz = MAX(zil_blksz, zilog->zl_prev_blks[i]);
-	zilog->zl_prev_rotor = (zilog->zl_prev_rotor + 1) & (ZIL_PREV_BLKS - 1);
+	zil_blksz = zil_lwb_plan_size(zilog);
 
 	BP_ZERO(bp);
 	error = zio_alloc_zil(spa, zilog->zl_os, txg, bp, zil_blksz, &slog);
@@ -1527,12 +1587,38 @@ zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
 		bp->blk_cksum = lwb->lwb_blk.blk_cksum;
 		bp->blk_cksum.zc_word[ZIL_ZC_SEQ]++;
 
+		ZIL_STAT_BUMP(zil_lwb_alloc_count);
+		ZIL_STAT_INCR(zil_lwb_alloc_bytes, BP_GET_LSIZE(bp));
+
 		/*
 		 * Allocate a new log write block (lwb).
 		 */
 		nlwb = zil_alloc_lwb(zilog, bp, slog, txg, TRUE);
 	}
 
+	lwb->lwb_state = LWB_STATE_READY;
+	list_insert_tail(ilwbs, lwb);
+
+	/*
+	 * If there was an allocation failure then nlwb will be null which
+	 * forces a txg_wait_synced().
+	 */
+	return (nlwb);
+}
+
+/*
+ * Start the write of a log block closed by zil_lwb_write_close().  This
+ * does not need the zl_issuer_lock, so that the lwbs closed by a thread
+ * are issued while other threads commit itxs to the following ones.
+ */
+static void
+zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
+{
+	zil_chain_t *zilc = zil_lwb_chain(lwb);
+	uint64_t wsz;
+
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_READY);
+
 	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
 		/* For Slim ZIL only write what is used. */
 		wsz = P2ROUNDUP_TYPED(lwb->lwb_nused, ZIL_MIN_BLKSZ, uint64_t);
@@ -1551,21 +1637,33 @@ zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
 	 * clear unused data for security
 	 */
 	bzero(lwb->lwb_buf + lwb->lwb_nused, wsz - lwb->lwb_nused);
+	ZIL_STAT_INCR(zil_lwb_write_bytes, wsz);
 
 	spa_config_enter(zilog->zl_spa, SCL_STATE, lwb, RW_READER);
 
 	zil_lwb_add_block(lwb, &lwb->lwb_blk);
 	lwb->lwb_issued_timestamp = gethrtime();
+
+	mutex_enter(&zilog->zl_lock);
 	lwb->lwb_state = LWB_STATE_ISSUED;
+	mutex_exit(&zilog->zl_lock);
 
 	zio_nowait(lwb->lwb_root_zio);
 	zio_nowait(lwb->lwb_write_zio);
+}
 
-	/*
-	 * If there was an allocation failure then nlwb will be null which
-	 * forces a txg_wait_synced().
-	 */
-	return (nlwb);
+/*
+ * Issue the lwbs closed by this thread, in the order they were closed.
+ */
+static void
+zil_lwb_write_issue_list(zilog_t *zilog, list_t *ilwbs)
+{
+	lwb_t *lwb;
+
+	while ((lwb = list_head(ilwbs)) != NULL) {
+		list_remove(ilwbs, lwb);
+		zil_lwb_write_issue(zilog, lwb);
+	}
 }
 
 /*
@@ -1603,7 +1701,7 @@ zil_max_copied_data(zilog_t *zilog)
 }
 
 static lwb_t *
-zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
+zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb, list_t *ilwbs)
 {
 	lr_t *lrcb, *lrc;
 	lr_write_t *lrwb, *lrw;
@@ -1662,7 +1760,7 @@ cont:
 	    lwb_sp < zil_max_waste_space(zilog) &&
 	    (dlen % max_log_data == 0 ||
 	    lwb_sp < reclen + dlen % max_log_data))) {
-		lwb = zil_lwb_write_issue(zilog, lwb);
+		lwb = zil_lwb_write_close(zilog, lwb, ilwbs);
 		if (lwb == NULL)
 			return (NULL);
 		zil_lwb_write_open(zilog, lwb);
@@ -2235,7 +2333,7 @@ zil_commit_writer_stall(zilog_t *zilog)
  * lwb will be issued to the zio layer to be written to disk.
  */
 static void
-zil_process_commit_list(zilog_t *zilog)
+zil_process_commit_list(zilog_t *zilog, list_t *ilwbs)
 {
 	spa_t *spa = zilog->zl_spa;
 	list_t nolwb_itxs;
@@ -2260,6 +2358,7 @@ zil_process_commit_list(zilog_t *zilog)
 	if (lwb == NULL) {
 		lwb = zil_create(zilog);
 	} else {
+		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_READY);
 		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
 		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_WRITE_DONE);
 		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_FLUSH_DONE);
@@ -2330,7 +2429,7 @@ zil_process_commit_list(zilog_t *zilog)
 		 */
 		if (frozen || !synced || lrc->lrc_txtype == TX_COMMIT) {
 			if (lwb != NULL) {
-				lwb = zil_lwb_commit(zilog, itx, lwb);
+				lwb = zil_lwb_commit(zilog, itx, lwb, ilwbs);
 
 				if (lwb == NULL)
 					list_insert_tail(&nolwb_itxs, itx);
@@ -2355,8 +2454,11 @@ zil_process_commit_list(zilog_t *zilog)
 		 * This indicates zio_alloc_zil() failed to allocate the
 		 * "next" lwb on-disk. When this happens, we must stall
 		 * the ZIL write pipeline; see the comment within
-		 * zil_commit_writer_stall() for more details.
+		 * zil_commit_writer_stall() for more details.  The lwbs
+		 * closed so far have to be issued first, for the stall to
+		 * see them complete.
 		 */
+		zil_lwb_write_issue_list(zilog, ilwbs);
 		zil_commit_writer_stall(zilog);
 
 		/*
@@ -2383,6 +2485,7 @@ zil_process_commit_list(zilog_t *zilog)
 	} else {
 		ASSERT(list_is_empty(&nolwb_waiters));
 		ASSERT3P(lwb, !=, NULL);
+		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_READY);
 		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
 		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_WRITE_DONE);
 		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_FLUSH_DONE);
@@ -2454,9 +2557,12 @@ zil_process_commit_list(zilog_t *zilog)
 static void
 zil_commit_writer(zilog_t *zilog, zil_commit_waiter_t *zcw)
 {
+	list_t ilwbs;
+
 	ASSERT(!MUTEX_HELD(&zilog->zl_lock));
 	ASSERT(spa_writeable(zilog->zl_spa));
 
+	list_create(&ilwbs, sizeof (lwb_t), offsetof(lwb_t, lwb_issue_node));
 	mutex_enter(&zilog->zl_issuer_lock);
 
 	if (zcw->zcw_lwb != NULL || zcw->zcw_done) {
@@ -2483,15 +2589,19 @@ zil_commit_writer(zilog_t *zilog, zil_commit_waiter_t *zcw)
 
 	zil_get_commit_list(zilog);
 	zil_prune_commit_list(zilog);
-	zil_process_commit_list(zilog);
+	zil_process_commit_list(zilog, &ilwbs);
 
 out:
 	mutex_exit(&zilog->zl_issuer_lock);
+	zil_lwb_write_issue_list(zilog, &ilwbs);
+	list_destroy(&ilwbs);
 }
 
 static void
 zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 {
+	list_t ilwbs;
+
 	ASSERT(!MUTEX_HELD(&zilog->zl_issuer_lock));
 	ASSERT(MUTEX_HELD(&zcw->zcw_lock));
 	ASSERT3B(zcw->zcw_done, ==, B_FALSE);
@@ -2501,24 +2611,26 @@ zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 	ASSERT3S(lwb->lwb_state, !=, LWB_STATE_CLOSED);
 
 	/*
-	 * If the lwb has already been issued by another thread, we can
+	 * If the lwb has already been closed by another thread, we can
 	 * immediately return since there's no work to be done (the
 	 * point of this function is to issue the lwb). Additionally, we
 	 * do this prior to acquiring the zl_issuer_lock, to avoid
 	 * acquiring it when it's not necessary to do so.
 	 */
-	if (lwb->lwb_state == LWB_STATE_ISSUED ||
+	if (lwb->lwb_state == LWB_STATE_READY ||
+	    lwb->lwb_state == LWB_STATE_ISSUED ||
 	    lwb->lwb_state == LWB_STATE_WRITE_DONE ||
 	    lwb->lwb_state == LWB_STATE_FLUSH_DONE)
 		return;
 
 	/*
-	 * In order to call zil_lwb_write_issue() we must hold the
+	 * In order to call zil_lwb_write_close() we must hold the
 	 * zilog's "zl_issuer_lock". We can't simply acquire that lock,
 	 * since we're already holding the commit waiter's "zcw_lock",
 	 * and those two locks are acquired in the opposite order
 	 * elsewhere.
 	 */
+	list_create(&ilwbs, sizeof (lwb_t), offsetof(lwb_t, lwb_issue_node));
 	mutex_exit(&zcw->zcw_lock);
 	mutex_enter(&zilog->zl_issuer_lock);
 	mutex_enter(&zcw->zcw_lock);
@@ -2542,21 +2654,22 @@ zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 	 * second time while holding the lock.
 	 *
 	 * We don't need to hold the zl_lock since the lwb cannot transition
-	 * from OPENED to ISSUED while we hold the zl_issuer_lock. The lwb
-	 * _can_ transition from ISSUED to DONE, but it's OK to race with
-	 * that transition since we treat the lwb the same, whether it's in
-	 * the ISSUED or DONE states.
+	 * from OPENED to READY while we hold the zl_issuer_lock. The lwb
+	 * _can_ transition from READY to ISSUED to DONE, but it's OK to race
+	 * with those transitions since we treat the lwb the same, whether
+	 * it's in the READY, ISSUED or DONE states.
 	 *
 	 * The important thing, is we treat the lwb differently depending on
-	 * if it's ISSUED or OPENED, and block any other threads that might
-	 * attempt to issue this lwb. For that reason we hold the
+	 * if it's closed or OPENED, and block any other threads that might
+	 * attempt to close this lwb. For that reason we hold the
 	 * zl_issuer_lock when checking the lwb_state; we must not call
-	 * zil_lwb_write_issue() if the lwb had already been issued.
+	 * zil_lwb_write_close() if the lwb had already been closed.
 	 *
 	 * See the comment above the lwb_state_t structure definition for
 	 * more details on the lwb states, and locking requirements.
 	 */
-	if (lwb->lwb_state == LWB_STATE_ISSUED ||
+	if (lwb->lwb_state == LWB_STATE_READY ||
+	    lwb->lwb_state == LWB_STATE_ISSUED ||
 	    lwb->lwb_state == LWB_STATE_WRITE_DONE ||
 	    lwb->lwb_state == LWB_STATE_FLUSH_DONE)
 		goto out;
@@ -2569,9 +2682,9 @@ zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 	 * since we've reached the commit waiter's timeout and it still
 	 * hasn't been issued.
 	 */
-	lwb_t *nlwb = zil_lwb_write_issue(zilog, lwb);
+	lwb_t *nlwb = zil_lwb_write_close(zilog, lwb, &ilwbs);
 
-	IMPLY(nlwb != NULL, lwb->lwb_state != LWB_STATE_OPENED);
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_READY);
 
 	/*
 	 * Since the lwb's zio hadn't been issued by the time this thread
@@ -2585,11 +2698,13 @@ zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 	 * into account, and potentially select a smaller size for the
 	 * next lwb block that is allocated.
 	 */
+	zilog->zl_burst_avg -= zilog->zl_burst_avg / 8;
+	zilog->zl_burst_avg += zilog->zl_cur_used / 8;
 	zilog->zl_cur_used = 0;
 
 	if (nlwb == NULL) {
 		/*
-		 * When zil_lwb_write_issue() returns NULL, this
+		 * When zil_lwb_write_close() returns NULL, this
 		 * indicates zio_alloc_zil() failed to allocate the
 		 * "next" lwb on-disk. When this occurs, the ZIL write
 		 * pipeline must be stalled; see the comment within the
@@ -2611,12 +2726,20 @@ zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 		 *   lock, which occurs prior to calling dmu_tx_commit()
 		 */
 		mutex_exit(&zcw->zcw_lock);
+		zil_lwb_write_issue_list(zilog, &ilwbs);
 		zil_commit_writer_stall(zilog);
 		mutex_enter(&zcw->zcw_lock);
 	}
 
 out:
 	mutex_exit(&zilog->zl_issuer_lock);
+
+	/*
+	 * The lwb can't be freed before it's issued, even if the waiter
+	 * is done, so it can be issued after the lock is dropped.
+	 */
+	zil_lwb_write_issue_list(zilog, &ilwbs);
+	list_destroy(&ilwbs);
 	ASSERT(MUTEX_HELD(&zcw->zcw_lock));
 }
 
@@ -2719,7 +2842,8 @@ zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
 		} else {
 			/*
 			 * If the lwb isn't open, then it must have already
-			 * been issued. In that case, there's no need to
+			 * been closed, and is issued by the thread that
+			 * closed it. In that case, there's no need to
 			 * use a timeout when waiting for the lwb to
 			 * complete.
 			 *
@@ -2730,6 +2854,7 @@ zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
 			 */
 
 			IMPLY(lwb != NULL,
+			    lwb->lwb_state == LWB_STATE_READY ||
 			    lwb->lwb_state == LWB_STATE_ISSUED ||
 			    lwb->lwb_state == LWB_STATE_WRITE_DONE ||
 			    lwb->lwb_state == LWB_STATE_FLUSH_DONE);
@@ -3298,6 +3423,7 @@ zil_close(zilog_t *zilog)
 	lwb = list_head(&zilog->zl_lwb_list);
 	if (lwb != NULL) {
 		ASSERT3P(lwb, ==, list_tail(&zilog->zl_lwb_list));
+		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_READY);
 		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
 
 		if (lwb->lwb_fastwrite)
@@ -3691,6 +3817,9 @@ ZFS_MODULE_PARAM(zfs_zil, zil_, nocacheflush, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_zil, zil_, slog_bulk, UQUAD, ZMOD_RW,
     "Limit in bytes slog sync writes per commit");
 
+ZFS_MODULE_PARAM(zfs_zil, zil_, lwb_fast_latency, ULONG, ZMOD_RW,
+    "Log block latency in usecs below which small blocks are favored");
+
 ZFS_MODULE_PARAM(zfs_zil, zil_, maxblocksize, UINT, ZMOD_RW, "Limit in bytes of ZIL log block size");
 /* END CSTYLED */
 #endif
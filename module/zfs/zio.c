@@ -118,6 +118,14 @@ int zfs_sync_pass_deferred_free = 2; /* defer frees starting in this pass */
 int zfs_sync_pass_dont_compress = 8; /* don't compress starting in this pass */
 int zfs_sync_pass_rewrite = 2; /* rewrite new bps starting in this pass */
 
+/*
+ * Data blocks of up to this logical size are zero-length-encoded when
+ * compression is off, so that the block can be stored in its block
+ * pointer if it is mostly padding.  Tiny files otherwise each occupy a
+ * full sector of the smallest-ashift device.  Zero disables.
+ */
+int zfs_embed_uncompressed_max = 4096;
+
 /*
  * An allocating zio is one that either currently has the DVA allocate
  * stage set or will have it later in its lifetime.
@@ -126,6 +134,29 @@ int zfs_sync_pass_rewrite = 2; /* rewrite new bps starting in this pass */
 
 int zio_requeue_io_start_cut_in_line = 1;
 
+/*
+ * Synchronous writes of up to this size which need no CPU heavy work, that
+ * is no compression, encryption, dedup or cryptographic checksum, are
+ * issued by the calling thread instead of being handed to an issue taskq.
+ * This saves a context switch on the latency sensitive ZIL and O_SYNC
+ * write paths.  Zero hands all writes to the issue taskqs.
+ */
+int zio_issue_inline_size = 32 * 1024;
+
+/*
+ * Time the CPU heavy pipeline stages, the taskq wait and the done callback
+ * of every zio, and keep per pool and per leaf vdev latency histograms of
+ * them.  This costs a few gethrtime() calls per stage so it is off by
+ * default.  See zio_stage_class_t.
+ */
+int zio_stage_histo = 0;
+
+/*
+ * Coalesce cache flushes issued to the same leaf vdev while one is already
+ * in flight; see zio_flush_coalesce().
+ */
+int zio_flush_coalesce = 1;
+
 #ifdef ZFS_DEBUG
 int zio_buf_debug_limit = 16384;
 #else
@@ -229,6 +260,8 @@ zio_init(void)
 	zio_inject_init();
 
 	lz4_init();
+	zstd_init();
+	zio_chunked_init();
 }
 
 void
@@ -273,6 +306,8 @@ zio_fini(void)
 	zio_inject_fini();
 
 	lz4_fini();
+	zstd_fini();
+	zio_chunked_fini();
 }
 
 /*
@@ -596,7 +631,7 @@ zio_unique_parent(zio_t *cio)
 void
 zio_add_child(zio_t *pio, zio_t *cio)
 {
-	zio_link_t *zl = kmem_cache_alloc(zio_link_cache, KM_SLEEP);
+	zio_link_t *zl, *nzl = NULL;
 
 	/*
 	 * Logical I/Os can have logical, gang, or vdev children.
@@ -606,12 +641,33 @@ zio_add_child(zio_t *pio, zio_t *cio)
 	 */
 	ASSERT3S(cio->io_child_type, <=, pio->io_child_type);
 
+	/*
+	 * Nearly all zios only ever have a single parent, so the link to
+	 * the first one is embedded in the child.  Links to any further
+	 * parents are allocated, without holding the locks.
+	 */
+	for (;;) {
+		mutex_enter(&pio->io_lock);
+		mutex_enter(&cio->io_lock);
+
+		if (cio->io_parent_link.zl_parent == NULL) {
+			zl = &cio->io_parent_link;
+			break;
+		}
+		if (nzl != NULL) {
+			zl = nzl;
+			nzl = NULL;
+			break;
+		}
+
+		mutex_exit(&cio->io_lock);
+		mutex_exit(&pio->io_lock);
+		nzl = kmem_cache_alloc(zio_link_cache, KM_SLEEP);
+	}
+
 	zl->zl_parent = pio;
 	zl->zl_child = cio;
 
-	mutex_enter(&pio->io_lock);
-	mutex_enter(&cio->io_lock);
-
 	ASSERT(pio->io_state[ZIO_WAIT_DONE] == 0);
 
 	for (int w = 0; w < ZIO_WAIT_TYPES; w++)
@@ -625,6 +681,9 @@ zio_add_child(zio_t *pio, zio_t *cio)
 
 	mutex_exit(&cio->io_lock);
 	mutex_exit(&pio->io_lock);
+
+	if (nzl != NULL)
+		kmem_cache_free(zio_link_cache, nzl);
 }
 
 static void
@@ -642,9 +701,17 @@ zio_remove_child(zio_t *pio, zio_t *cio, zio_link_t *zl)
 	pio->io_child_count--;
 	cio->io_parent_count--;
 
+	if (zl == &cio->io_parent_link) {
+		zl->zl_parent = NULL;
+		zl->zl_child = NULL;
+		zl = NULL;
+	}
+
 	mutex_exit(&cio->io_lock);
 	mutex_exit(&pio->io_lock);
-	kmem_cache_free(zio_link_cache, zl);
+
+	if (zl != NULL)
+		kmem_cache_free(zio_link_cache, zl);
 }
 
 static boolean_t
@@ -1608,6 +1675,37 @@ zio_write_compress(zio_t *zio)
 		    spa_max_replication(spa)) == BP_GET_NDVAS(bp));
 	}
 
+	if (!(zio->io_flags & ZIO_FLAG_RAW_COMPRESS))
+		compress = zio_compress_chunked_select(compress, lsize);
+
+	/*
+	 * For expensive algorithms, first check with a cheap one whether
+	 * the block is worth compressing at all.
+	 */
+	if (compress != ZIO_COMPRESS_OFF && zp->zp_early_abort &&
+	    !(zio->io_flags & ZIO_FLAG_RAW_COMPRESS) &&
+	    !zio_compress_probe(compress, zio->io_abd, lsize)) {
+		compress = ZIO_COMPRESS_OFF;
+		psize = lsize;
+	}
+
+	/*
+	 * With compression off, still try to embed small level 0 blocks.
+	 * If the block doesn't fit in the block pointer it is written
+	 * uncompressed as requested.
+	 */
+	boolean_t embed_only = B_FALSE;
+	if (compress == ZIO_COMPRESS_OFF &&
+	    zp->zp_compress == ZIO_COMPRESS_OFF &&
+	    lsize <= zfs_embed_uncompressed_max && zp->zp_level == 0 &&
+	    pass < zfs_sync_pass_dont_compress &&
+	    !(zio->io_flags & ZIO_FLAG_RAW_COMPRESS) &&
+	    !zp->zp_dedup && !zp->zp_encrypt && !DMU_OT_HAS_FILL(zp->zp_type) &&
+	    spa_feature_is_enabled(spa, SPA_FEATURE_EMBEDDED_DATA)) {
+		compress = ZIO_COMPRESS_ZLE;
+		embed_only = B_TRUE;
+	}
+
 	/* If it's a compressed write that is not raw, compress the buffer. */
 	if (compress != ZIO_COMPRESS_OFF &&
 	    !(zio->io_flags & ZIO_FLAG_RAW_COMPRESS)) {
@@ -1616,6 +1714,8 @@ zio_write_compress(zio_t *zio)
 		if (psize == 0 || psize == lsize) {
 			compress = ZIO_COMPRESS_OFF;
 			zio_buf_free(cbuf, lsize);
+			if (embed_only)
+				psize = lsize;
 		} else if (!zp->zp_dedup && !zp->zp_encrypt &&
 		    psize <= BPE_PAYLOAD_SIZE &&
 		    zp->zp_level == 0 && !DMU_OT_HAS_FILL(zp->zp_type) &&
@@ -1631,6 +1731,10 @@ zio_write_compress(zio_t *zio)
 			ASSERT(spa_feature_is_active(spa,
 			    SPA_FEATURE_EMBEDDED_DATA));
 			return (zio);
+		} else if (embed_only) {
+			compress = ZIO_COMPRESS_OFF;
+			zio_buf_free(cbuf, lsize);
+			psize = lsize;
 		} else {
 			/*
 			 * Round up compressed size up to the ashift
@@ -1802,10 +1906,34 @@ zio_taskq_dispatch(zio_t *zio, zio_taskq_type_t q, boolean_t cutinline)
 	 */
 	ASSERT(taskq_empty_ent(&zio->io_tqent));
 #endif
+	if (zio_stage_histo)
+		zio->io_dispatch_time = gethrtime();
 	spa_taskq_dispatch_ent(spa, t, q, (task_func_t *)zio_execute, zio,
 	    flags, &zio->io_tqent);
 }
 
+/*
+ * Returns the class a pipeline stage is timed in, or ZIO_STAGE_CLASSES
+ * if it is not timed.
+ */
+static zio_stage_class_t
+zio_stage_to_class(enum zio_stage stage)
+{
+	switch (stage) {
+	case ZIO_STAGE_WRITE_COMPRESS:
+		return (ZIO_STAGE_CLASS_COMPRESS);
+	case ZIO_STAGE_ENCRYPT:
+		return (ZIO_STAGE_CLASS_ENCRYPT);
+	case ZIO_STAGE_CHECKSUM_GENERATE:
+	case ZIO_STAGE_CHECKSUM_VERIFY:
+		return (ZIO_STAGE_CLASS_CHECKSUM);
+	case ZIO_STAGE_DVA_ALLOCATE:
+		return (ZIO_STAGE_CLASS_ALLOC);
+	default:
+		return (ZIO_STAGE_CLASSES);
+	}
+}
+
 static boolean_t
 zio_taskq_member(zio_t *zio, zio_taskq_type_t q)
 {
@@ -1824,9 +1952,48 @@ zio_taskq_member(zio_t *zio, zio_taskq_type_t q)
 	return (B_FALSE);
 }
 
+/*
+ * Returns B_TRUE if the stages of a write following ZIO_STAGE_ISSUE_ASYNC
+ * are cheap enough to run on the current thread, see zio_issue_inline_size.
+ */
+static boolean_t
+zio_issue_inline(zio_t *zio)
+{
+	zio_prop_t *zp = &zio->io_prop;
+	blkptr_t *bp = zio->io_bp;
+	enum zio_checksum checksum = zp->zp_checksum;
+
+	if (zio->io_type != ZIO_TYPE_WRITE ||
+	    zio->io_priority != ZIO_PRIORITY_SYNC_WRITE ||
+	    zio->io_size > zio_issue_inline_size)
+		return (B_FALSE);
+
+	if (zp->zp_encrypt || zp->zp_dedup)
+		return (B_FALSE);
+
+	if (IO_IS_ALLOCATING(zio)) {
+		if (zp->zp_compress != ZIO_COMPRESS_OFF)
+			return (B_FALSE);
+	} else if (bp != NULL) {
+		/* A rewrite keeps the checksum and encryption of its bp */
+		if (BP_USES_CRYPT(bp))
+			return (B_FALSE);
+		checksum = BP_GET_CHECKSUM(bp);
+	}
+
+	if (zio_checksum_table[checksum].ci_flags & ZCHECKSUM_FLAG_DEDUP)
+		return (B_FALSE);
+
+	/* Leave the interrupt threads free to complete other I/O */
+	return (!zio_taskq_member(zio, ZIO_TASKQ_INTERRUPT));
+}
+
 static zio_t *
 zio_issue_async(zio_t *zio)
 {
+	if (zio_issue_inline(zio))
+		return (zio);
+
 	zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
 
 	return (NULL);
@@ -1973,7 +2140,8 @@ zio_deadman_impl(zio_t *pio, int ziodepth)
 	vdev_t *vd = pio->io_vd;
 
 	if (zio_deadman_log_all || (vd != NULL && vd->vdev_ops->vdev_op_leaf)) {
-		vdev_queue_t *vq = vd ? &vd->vdev_queue : NULL;
+		vdev_queue_t *vq = vd ? &vd->vdev_queue[pio->io_queue_shard] :
+		    NULL;
 		zbookmark_phys_t *zb = &pio->io_bookmark;
 		uint64_t delta = gethrtime() - pio->io_timestamp;
 		uint64_t failmode = spa_get_deadman_failmode(pio->io_spa);
@@ -2105,12 +2273,36 @@ zio_execute_stack_check(zio_t *zio)
 	return (B_FALSE);
 }
 
+/*
+ * Take SCL_ZIO for the logical VDEV_IO_START stage of a zio if that can be
+ * done without waiting, so the stage can run in interrupt context.
+ */
+static boolean_t
+zio_vdev_io_start_trylock(zio_t *zio, enum zio_stage stage)
+{
+	if (stage != ZIO_STAGE_VDEV_IO_START ||
+	    (zio->io_flags & ZIO_FLAG_CONFIG_WRITER))
+		return (B_FALSE);
+
+	if (!spa_config_tryenter(zio->io_spa, SCL_ZIO, zio, RW_READER))
+		return (B_FALSE);
+
+	zio->io_config_held = B_TRUE;
+	return (B_TRUE);
+}
+
 __attribute__((always_inline))
 static inline void
 __zio_execute(zio_t *zio)
 {
 	ASSERT3U(zio->io_queued_timestamp, >, 0);
 
+	if (zio->io_dispatch_time != 0) {
+		zio->io_stage_time[ZIO_STAGE_CLASS_TASKQ] +=
+		    gethrtime() - zio->io_dispatch_time;
+		zio->io_dispatch_time = 0;
+	}
+
 	while (zio->io_stage < ZIO_STAGE_DONE) {
 		enum zio_stage pipeline = zio->io_pipeline;
 		enum zio_stage stage = zio->io_stage;
@@ -2134,10 +2326,13 @@ __zio_execute(zio_t *zio)
 		 * to complete, issue async to avoid deadlock.
 		 *
 		 * For VDEV_IO_START, we cut in line so that the io will
-		 * be sent to disk promptly.
+		 * be sent to disk promptly.  Unless a config writer is
+		 * waiting, the config lock is taken here without blocking
+		 * and the io is started from this thread instead.
 		 */
 		if ((stage & ZIO_BLOCKING_STAGES) && zio->io_vd == NULL &&
-		    zio_taskq_member(zio, ZIO_TASKQ_INTERRUPT)) {
+		    zio_taskq_member(zio, ZIO_TASKQ_INTERRUPT) &&
+		    !zio_vdev_io_start_trylock(zio, stage)) {
 			boolean_t cut = (stage == ZIO_STAGE_VDEV_IO_START) ?
 			    zio_requeue_io_start_cut_in_line : B_FALSE;
 			zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, cut);
@@ -2161,9 +2356,23 @@ __zio_execute(zio_t *zio)
 		/*
 		 * The zio pipeline stage returns the next zio to execute
 		 * (typically the same as this one), or NULL if we should
-		 * stop.
+		 * stop.  A stage is only timed when it returns the same zio,
+		 * any other zio may have already completed.
 		 */
-		zio = zio_pipeline[highbit64(stage) - 1](zio);
+		zio_stage_class_t class = zio_stage_histo ?
+		    zio_stage_to_class(stage) : ZIO_STAGE_CLASSES;
+		if (class != ZIO_STAGE_CLASSES) {
+			zio_t *pio = zio;
+			hrtime_t start = gethrtime();
+
+			zio = zio_pipeline[highbit64(stage) - 1](zio);
+			if (zio == pio) {
+				zio->io_stage_time[class] +=
+				    gethrtime() - start;
+			}
+		} else {
+			zio = zio_pipeline[highbit64(stage) - 1](zio);
+		}
 
 		if (zio == NULL)
 			return;
@@ -2838,6 +3047,7 @@ zio_write_gang_block(zio_t *pio)
 		zp.zp_dedup_verify = B_FALSE;
 		zp.zp_nopwrite = B_FALSE;
 		zp.zp_encrypt = gio->io_prop.zp_encrypt;
+		zp.zp_early_abort = B_FALSE;
 		zp.zp_byteorder = gio->io_prop.zp_byteorder;
 		bzero(zp.zp_salt, ZIO_DATA_SALT_LEN);
 		bzero(zp.zp_iv, ZIO_DATA_IV_LEN);
@@ -3217,6 +3427,24 @@ zio_ddt_child_write_done(zio_t *zio)
 	ddt_exit(ddt);
 }
 
+/*
+ * Returns true if the entry is neither on disk nor being written.
+ */
+static boolean_t
+zio_ddt_entry_unused(const ddt_entry_t *dde)
+{
+	if (dde->dde_type != DDT_TYPES)
+		return (B_FALSE);
+
+	for (int p = 0; p < DDT_PHYS_TYPES; p++) {
+		if (dde->dde_phys[p].ddp_phys_birth != 0 ||
+		    dde->dde_lead_zio[p] != NULL)
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
 static zio_t *
 zio_ddt_write(zio_t *zio)
 {
@@ -3239,6 +3467,19 @@ zio_ddt_write(zio_t *zio)
 	dde = ddt_lookup(ddt, bp, B_TRUE);
 	ddp = &dde->dde_phys[p];
 
+	/*
+	 * Once the dedup tables are over quota, blocks which would need a
+	 * new entry are written as ordinary blocks.
+	 */
+	if (!zio->io_bp_override && zio_ddt_entry_unused(dde) &&
+	    ddt_over_quota(spa)) {
+		zp->zp_dedup = B_FALSE;
+		BP_SET_DEDUP(bp, B_FALSE);
+		zio->io_pipeline = ZIO_WRITE_PIPELINE;
+		ddt_exit(ddt);
+		return (zio);
+	}
+
 	if (zp->zp_dedup_verify && zio_ddt_collision(zio, ddt, dde)) {
 		/*
 		 * If we're using a weak checksum, upgrade to a strong checksum
@@ -3309,10 +3550,13 @@ zio_ddt_free(zio_t *zio)
 
 	ddt_enter(ddt);
 	freedde = dde = ddt_lookup(ddt, bp, B_TRUE);
-	if (dde) {
-		ddp = ddt_phys_select(dde, bp);
-		if (ddp)
-			ddt_phys_decref(ddp);
+	ddp = ddt_phys_select(dde, bp);
+	if (ddp != NULL) {
+		ddt_phys_decref(ddp);
+	} else {
+		/* The entry was pruned, free it as an ordinary block */
+		ASSERT(spa->spa_dedup_pruned != 0);
+		zio->io_pipeline |= ZIO_STAGE_DVA_FREE;
 	}
 	ddt_exit(ddt);
 
@@ -3412,6 +3656,41 @@ zio_allocate_dispatch(spa_t *spa, int allocator)
 	zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_TRUE);
 }
 
+/*
+ * Move an allocation that failed in its current class over to mc,
+ * transferring any throttle reservation.  The io_allocator slot can
+ * remain the same even though we are switching classes.
+ */
+static void
+zio_dva_allocate_switch(zio_t *zio, metaslab_class_t *mc, int flags)
+{
+	metaslab_class_t *omc = zio->io_metaslab_class;
+
+	if (omc->mc_alloc_throttle_enabled &&
+	    (zio->io_flags & ZIO_FLAG_IO_ALLOCATING)) {
+		metaslab_class_throttle_unreserve(omc,
+		    zio->io_prop.zp_copies, zio->io_allocator, zio);
+		zio->io_flags &= ~ZIO_FLAG_IO_ALLOCATING;
+
+		if (mc->mc_alloc_throttle_enabled) {
+			VERIFY(metaslab_class_throttle_reserve(mc,
+			    zio->io_prop.zp_copies, zio->io_allocator, zio,
+			    flags | METASLAB_MUST_RESERVE));
+		}
+	}
+	zio->io_metaslab_class = mc;
+}
+
+static int
+zio_dva_allocate_retry(zio_t *zio, metaslab_class_t *mc, int flags)
+{
+	zio_dva_allocate_switch(zio, mc, flags);
+
+	return (metaslab_alloc(zio->io_spa, mc, zio->io_size, zio->io_bp,
+	    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
+	    &zio->io_alloc_list, zio, zio->io_allocator));
+}
+
 static zio_t *
 zio_dva_allocate(zio_t *zio)
 {
@@ -3455,41 +3734,41 @@ zio_dva_allocate(zio_t *zio)
 	    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
 	    &zio->io_alloc_list, zio, zio->io_allocator);
 
+	metaslab_class_t *first_mc = mc;
+
 	/*
 	 * Fallback to normal class when an alloc class is full
 	 */
 	if (error == ENOSPC && mc != spa_normal_class(spa)) {
-		/*
-		 * If throttling, transfer reservation over to normal class.
-		 * The io_allocator slot can remain the same even though we
-		 * are switching classes.
-		 */
-		if (mc->mc_alloc_throttle_enabled &&
-		    (zio->io_flags & ZIO_FLAG_IO_ALLOCATING)) {
-			metaslab_class_throttle_unreserve(mc,
-			    zio->io_prop.zp_copies, zio->io_allocator, zio);
-			zio->io_flags &= ~ZIO_FLAG_IO_ALLOCATING;
+		mc = spa_normal_class(spa);
+		error = zio_dva_allocate_retry(zio, mc, flags);
+	}
 
-			mc = spa_normal_class(spa);
-			VERIFY(metaslab_class_throttle_reserve(mc,
-			    zio->io_prop.zp_copies, zio->io_allocator, zio,
-			    flags | METASLAB_MUST_RESERVE));
-		} else {
-			mc = spa_normal_class(spa);
+	/*
+	 * Before ganging the block, give another class with room a chance.
+	 * Gang children are already as small as they are going to get.
+	 */
+	if (error == ENOSPC && zio->io_size > SPA_MINBLOCKSIZE &&
+	    !(flags & METASLAB_GANG_CHILD)) {
+		metaslab_class_t *gmc =
+		    spa_gang_fallback_class(spa, mc, zio->io_size);
+		if (gmc != NULL && gmc != first_mc) {
+			error = zio_dva_allocate_retry(zio, gmc, flags);
+			if (error == 0)
+				metaslab_stat_gang(B_TRUE);
+			else
+				zio_dva_allocate_switch(zio, mc, flags);
 		}
-		zio->io_metaslab_class = mc;
-
-		error = metaslab_alloc(spa, mc, zio->io_size, bp,
-		    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
-		    &zio->io_alloc_list, zio, zio->io_allocator);
 	}
 
 	if (error != 0) {
 		zfs_dbgmsg("%s: metaslab allocation failure: zio %px, "
 		    "size %llu, error %d", spa_name(spa), zio, zio->io_size,
 		    error);
-		if (error == ENOSPC && zio->io_size > SPA_MINBLOCKSIZE)
+		if (error == ENOSPC && zio->io_size > SPA_MINBLOCKSIZE) {
+			metaslab_stat_gang(B_FALSE);
 			return (zio_write_gang_block(zio));
+		}
 		zio->io_error = error;
 	}
 
@@ -3624,6 +3903,27 @@ zio_alloc_zil(spa_t *spa, objset_t *os, uint64_t txg, blkptr_t *new_bp,
  * ==========================================================================
  */
 
+/*
+ * Returns true if this is an I/O issued by a dRAID distributed spare to
+ * one of the children of its dRAID vdev.
+ */
+static boolean_t
+zio_draid_spare_child(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	zio_t *pio;
+
+	if (vd->vdev_top->vdev_ops != &vdev_draid_ops ||
+	    !vd->vdev_ops->vdev_op_leaf ||
+	    vd->vdev_ops == &vdev_draid_spare_ops)
+		return (B_FALSE);
+
+	pio = zio_unique_parent(zio);
+
+	return (pio != NULL && pio->io_vd != NULL &&
+	    pio->io_vd->vdev_ops == &vdev_draid_spare_ops);
+}
+
 /*
  * Issue an I/O to the underlying vdev. Typically the issue pipeline
  * stops after this stage and will resume upon I/O completion.
@@ -3634,6 +3934,74 @@ zio_alloc_zil(spa_t *spa, objset_t *os, uint64_t txg, blkptr_t *new_bp,
  * force the underlying vdev layers to call either zio_execute() or
  * zio_interrupt() to ensure that the pipeline continues with the correct I/O.
  */
+/*
+ * A cache flush only guarantees the durability of writes which completed
+ * before it was issued, so a flush requested while another is in flight on
+ * the same leaf cannot simply share its result.  It can however share the
+ * next one: flushes arriving while one is in flight are queued, and when
+ * it completes a single new flush is issued on behalf of all of them.  With
+ * many datasets committing their ZILs to the same log devices in parallel
+ * this replaces a flush per commit with at most two in a row per device.
+ *
+ * The queued zios are linked through io_queue_node, which flushes do not
+ * otherwise use since they bypass the vdev queue.  Returns B_TRUE when the
+ * zio was queued and must not be issued now.
+ */
+static boolean_t
+zio_flush_coalesce_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+
+	if (!zio_flush_coalesce || zio->io_type != ZIO_TYPE_IOCTL ||
+	    zio->io_cmd != DKIOCFLUSHWRITECACHE || !vd->vdev_ops->vdev_op_leaf)
+		return (B_FALSE);
+
+	mutex_enter(&vd->vdev_flush_lock);
+	if (vd->vdev_flush_zio != NULL) {
+		list_insert_tail(&vd->vdev_flush_queue, zio);
+		mutex_exit(&vd->vdev_flush_lock);
+		return (B_TRUE);
+	}
+	vd->vdev_flush_zio = zio;
+	mutex_exit(&vd->vdev_flush_lock);
+
+	return (B_FALSE);
+}
+
+/*
+ * The in-flight flush completed: complete the zios it was issued for with
+ * its result and issue the next flush for those queued in the meantime.
+ */
+static void
+zio_flush_coalesce_done(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	list_t riders;
+	zio_t *next, *rider;
+
+	list_create(&riders, sizeof (zio_t), offsetof(zio_t, io_queue_node));
+
+	mutex_enter(&vd->vdev_flush_lock);
+	ASSERT3P(vd->vdev_flush_zio, ==, zio);
+	list_move_tail(&riders, &vd->vdev_flush_riders);
+	next = list_remove_head(&vd->vdev_flush_queue);
+	if (next != NULL) {
+		list_move_tail(&vd->vdev_flush_riders,
+		    &vd->vdev_flush_queue);
+	}
+	vd->vdev_flush_zio = next;
+	mutex_exit(&vd->vdev_flush_lock);
+
+	while ((rider = list_remove_head(&riders)) != NULL) {
+		rider->io_error = zio->io_error;
+		zio_interrupt(rider);
+	}
+	list_destroy(&riders);
+
+	if (next != NULL)
+		vd->vdev_ops->vdev_op_io_start(next);
+}
+
 static zio_t *
 zio_vdev_io_start(zio_t *zio)
 {
@@ -3647,7 +4015,9 @@ zio_vdev_io_start(zio_t *zio)
 	ASSERT(zio->io_child_error[ZIO_CHILD_VDEV] == 0);
 
 	if (vd == NULL) {
-		if (!(zio->io_flags & ZIO_FLAG_CONFIG_WRITER))
+		if (zio->io_config_held)
+			zio->io_config_held = B_FALSE;
+		else if (!(zio->io_flags & ZIO_FLAG_CONFIG_WRITER))
 			spa_config_enter(spa, SCL_ZIO, zio, RW_READER);
 
 		/*
@@ -3757,11 +4127,16 @@ zio_vdev_io_start(zio_t *zio)
 	 * However, indirect vdevs point off to other vdevs which may have
 	 * DTL's, so we never bypass them.  The child i/os on concrete vdevs
 	 * will be properly bypassed instead.
+	 *
+	 * Likewise a dRAID distributed spare stores its data on the other
+	 * children of the dRAID vdev, whose DTLs don't reflect it, so its
+	 * child i/os are never bypassed.
 	 */
 	if ((zio->io_flags & ZIO_FLAG_IO_REPAIR) &&
 	    !(zio->io_flags & ZIO_FLAG_SELF_HEAL) &&
 	    zio->io_txg != 0 &&	/* not a delegated i/o */
 	    vd->vdev_ops != &vdev_indirect_ops &&
+	    !zio_draid_spare_child(zio) &&
 	    !vdev_dtl_contains(vd, DTL_PARTIAL, zio->io_txg, 1)) {
 		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
 		zio_vdev_io_bypass(zio);
@@ -3785,6 +4160,9 @@ zio_vdev_io_start(zio_t *zio)
 		zio->io_delay = gethrtime();
 	}
 
+	if (zio_flush_coalesce_start(zio))
+		return (NULL);
+
 	vd->vdev_ops->vdev_op_io_start(zio);
 	return (NULL);
 }
@@ -3901,6 +4279,10 @@ zio_vdev_io_assess(zio_t *zio)
 		return (NULL);
 	}
 
+	if (vd != NULL && zio->io_type == ZIO_TYPE_IOCTL &&
+	    vd->vdev_flush_zio == zio)
+		zio_flush_coalesce_done(zio);
+
 	if (vd == NULL && !(zio->io_flags & ZIO_FLAG_CONFIG_WRITER))
 		spa_config_exit(zio->io_spa, SCL_ZIO, zio);
 
@@ -4345,6 +4727,32 @@ zio_ready(zio_t *zio)
 	return (zio);
 }
 
+/*
+ * Add the stage times of a completed zio to the histograms.  Logical zios
+ * are accounted to the pool and leaf zios to their vdev, the zios of
+ * interior vdevs only relay the work of their children.
+ */
+static void
+zio_stage_histo_update(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	uint64_t (*histo)[VDEV_L_HISTO_BUCKETS];
+
+	if (vd == NULL)
+		histo = zio->io_spa->spa_stage_histo;
+	else if (vd->vdev_ops->vdev_op_leaf)
+		histo = vd->vdev_stat_ex.vsx_stage_histo;
+	else
+		return;
+
+	for (int c = 0; c < ZIO_STAGE_CLASSES; c++) {
+		hrtime_t t = zio->io_stage_time[c];
+
+		if (t != 0)
+			atomic_inc_64(&histo[c][L_HISTO(t)]);
+	}
+}
+
 /*
  * Update the allocation throttle accounting.
  */
@@ -4397,6 +4805,11 @@ zio_dva_throttle_done(zio_t *zio)
 	    pio->io_allocator, B_TRUE);
 	mutex_exit(&pio->io_lock);
 
+	if (zio->io_error == 0 && zio->io_queued_timestamp != 0) {
+		metaslab_group_write_done(vd, zio->io_size,
+		    gethrtime() - zio->io_queued_timestamp);
+	}
+
 	metaslab_class_throttle_unreserve(zio->io_metaslab_class, 1,
 	    pio->io_allocator, pio);
 
@@ -4747,8 +5160,17 @@ zio_done(zio_t *zio)
 	 * particular zio is no longer discoverable for adoption, and as
 	 * such, cannot acquire any new parents.
 	 */
-	if (zio->io_done)
+	if (zio_stage_histo) {
+		hrtime_t start = gethrtime();
+
+		if (zio->io_done)
+			zio->io_done(zio);
+		zio->io_stage_time[ZIO_STAGE_CLASS_DONE] +=
+		    gethrtime() - start;
+		zio_stage_histo_update(zio);
+	} else if (zio->io_done) {
 		zio->io_done(zio);
+	}
 
 	mutex_enter(&zio->io_lock);
 	zio->io_state[ZIO_WAIT_DONE] = 1;
@@ -4953,6 +5375,15 @@ ZFS_MODULE_PARAM(zfs_zio, zio_, slow_io_ms, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_zio, zio_, requeue_io_start_cut_in_line, UINT, ZMOD_RW,
 	"Prioritize requeued I/O");
 
+ZFS_MODULE_PARAM(zfs_zio, zio_, issue_inline_size, INT, ZMOD_RW,
+	"Max size of cheap sync writes issued by the calling thread");
+
+ZFS_MODULE_PARAM(zfs_zio, zio_, stage_histo, INT, ZMOD_RW,
+	"Keep latency histograms of the zio pipeline stages");
+
+ZFS_MODULE_PARAM(zfs_zio, zio_, flush_coalesce, INT, ZMOD_RW,
+	"Coalesce cache flushes queued behind an in-flight flush");
+
 ZFS_MODULE_PARAM(zfs, zfs_, sync_pass_deferred_free,  UINT, ZMOD_RW,
 	"Defer frees starting in this pass");
 
@@ -4962,6 +5393,9 @@ ZFS_MODULE_PARAM(zfs, zfs_, sync_pass_dont_compress, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, sync_pass_rewrite, UINT, ZMOD_RW,
 	"Rewrite new bps starting in this pass");
 
+ZFS_MODULE_PARAM(zfs, zfs_, embed_uncompressed_max, INT, ZMOD_RW,
+	"Largest uncompressed block to try to embed in its block pointer");
+
 ZFS_MODULE_PARAM(zfs_zio, zio_, dva_throttle_enabled, UINT, ZMOD_RW,
 	"Throttle block allocations in the ZIO pipeline");
 
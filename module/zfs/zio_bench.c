@@ -0,0 +1,315 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
+#include <sys/zio_crypt.h>
+#include <sys/abd.h>
+#include <sys/kstat.h>
+
+/*
+ * Algorithm benchmarks.
+ *
+ * fletcher_4_bench and vdev_raidz_bench only cover the implementations
+ * chosen between at load time.  The algo_bench kstat times every checksum,
+ * compression and encryption algorithm a dataset can be configured with,
+ * so that the cost of a property setting can be read off the machine it
+ * will run on.  Each algorithm is run single threaded over the same
+ * ZIO_BENCH_SIZE buffer, half of every page pseudo-random and half zeros
+ * so that compressors have something to do, and the results are reported
+ * in MB/s of plaintext in both directions: native and byteswapped for
+ * checksums, compress and decompress, encrypt and decrypt.
+ *
+ * Since this takes a second or more, it is run the first time the kstat
+ * is read rather than at every module load, unless zfs_algo_bench_at_load
+ * is set.
+ */
+
+#define	ZIO_BENCH_SIZE		(128 * 1024)
+#define	ZIO_BENCH_NS		(MSEC2NSEC(10))	/* 10ms per direction */
+
+int zfs_algo_bench_at_load = 0;
+
+typedef enum zio_bench_type {
+	ZIO_BENCH_CHECKSUM,
+	ZIO_BENCH_COMPRESS,
+	ZIO_BENCH_CRYPT,
+} zio_bench_type_t;
+
+static const char *zio_bench_type_names[] = {
+	"checksum",
+	"compress",
+	"crypt",
+};
+
+typedef struct zio_bench_stat {
+	zio_bench_type_t	zbs_type;
+	const char		*zbs_name;
+	uint64_t		zbs_fwd;	/* MB/s */
+	uint64_t		zbs_rev;	/* MB/s */
+} zio_bench_stat_t;
+
+#define	ZIO_BENCH_MAX_STATS	(ZIO_CHECKSUM_FUNCTIONS + \
+	ZIO_COMPRESS_FUNCTIONS + ZIO_CRYPT_FUNCTIONS)
+
+static zio_bench_stat_t zio_bench_stats[ZIO_BENCH_MAX_STATS];
+static int zio_bench_nstats;
+static boolean_t zio_bench_done;
+static kmutex_t zio_bench_lock;
+static kstat_t *zio_bench_kstat;
+
+/* The benchmark is of no use to libzpool consumers. */
+#if defined(_KERNEL)
+
+static uint64_t
+zio_bench_rate(uint64_t bytes, hrtime_t ns)
+{
+	return (ns == 0 ? 0 : bytes * (NANOSEC / MICROSEC) / ns);
+}
+
+/*
+ * Evaluate expr, one pass over the buffer, until ZIO_BENCH_NS has passed
+ * and set rate to the MB/s achieved, or to 0 if expr ever fails.
+ */
+#define	ZIO_BENCH_LOOP(rate, expr)					\
+{									\
+	hrtime_t start = gethrtime(), ns;				\
+	uint64_t runs = 0;						\
+	boolean_t ok = B_TRUE;						\
+	do {								\
+		ok = (expr);						\
+		runs++;							\
+		ns = gethrtime() - start;				\
+	} while (ok && ns < ZIO_BENCH_NS);				\
+	(rate) = ok ? zio_bench_rate(runs * ZIO_BENCH_SIZE, ns) : 0;	\
+}
+
+static void
+zio_bench_checksum(abd_t *abd)
+{
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		zio_checksum_info_t *ci = &zio_checksum_table[c];
+		zio_bench_stat_t *zbs;
+		zio_cksum_salt_t salt;
+		zio_cksum_t zc;
+		void *tmpl = NULL;
+
+		if (ci->ci_func[0] == NULL || c == ZIO_CHECKSUM_OFF ||
+		    c == ZIO_CHECKSUM_NOPARITY ||
+		    (ci->ci_flags & ZCHECKSUM_FLAG_EMBEDDED))
+			continue;
+
+		if (ci->ci_tmpl_init != NULL) {
+			random_get_pseudo_bytes(salt.zcs_bytes,
+			    sizeof (salt.zcs_bytes));
+			tmpl = ci->ci_tmpl_init(&salt);
+		}
+
+		zbs = &zio_bench_stats[zio_bench_nstats++];
+		zbs->zbs_type = ZIO_BENCH_CHECKSUM;
+		zbs->zbs_name = ci->ci_name;
+		ZIO_BENCH_LOOP(zbs->zbs_fwd,
+		    (ci->ci_func[0](abd, ZIO_BENCH_SIZE, tmpl, &zc), B_TRUE));
+		ZIO_BENCH_LOOP(zbs->zbs_rev,
+		    (ci->ci_func[1](abd, ZIO_BENCH_SIZE, tmpl, &zc), B_TRUE));
+
+		if (tmpl != NULL)
+			ci->ci_tmpl_free(tmpl);
+	}
+}
+
+static void
+zio_bench_compress(void *src, void *dst, void *scratch)
+{
+	for (enum zio_compress c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
+		zio_compress_info_t *ci = &zio_compress_table[c];
+		zio_bench_stat_t *zbs;
+		size_t c_len = 0;
+
+		if (ci->ci_compress == NULL)
+			continue;
+
+		zbs = &zio_bench_stats[zio_bench_nstats++];
+		zbs->zbs_type = ZIO_BENCH_COMPRESS;
+		zbs->zbs_name = ci->ci_name;
+		ZIO_BENCH_LOOP(zbs->zbs_fwd,
+		    ((c_len = ci->ci_compress(src, dst, ZIO_BENCH_SIZE,
+		    ZIO_BENCH_SIZE, ci->ci_level)) < ZIO_BENCH_SIZE));
+
+		/* Incompressible with this algorithm, nothing to decompress */
+		if (zbs->zbs_fwd == 0)
+			continue;
+
+		ZIO_BENCH_LOOP(zbs->zbs_rev,
+		    (ci->ci_decompress(dst, scratch, c_len, ZIO_BENCH_SIZE,
+		    ci->ci_level) == 0));
+	}
+}
+
+static void
+zio_bench_crypt(uint8_t *plain, uint8_t *cipher)
+{
+	zio_crypt_key_t *key = kmem_zalloc(sizeof (zio_crypt_key_t), KM_SLEEP);
+	uint8_t salt[ZIO_DATA_SALT_LEN];
+	uint8_t iv[ZIO_DATA_IV_LEN];
+	uint8_t mac[ZIO_DATA_MAC_LEN];
+	boolean_t no_crypt;
+
+	random_get_pseudo_bytes(salt, sizeof (salt));
+	random_get_pseudo_bytes(iv, sizeof (iv));
+
+	for (enum zio_encrypt c = 0; c < ZIO_CRYPT_FUNCTIONS; c++) {
+		zio_crypt_info_t *ci = &zio_crypt_table[c];
+		zio_bench_stat_t *zbs;
+
+		if (ci->ci_crypt_type == ZC_TYPE_NONE ||
+		    zio_crypt_key_init(c, key) != 0)
+			continue;
+
+		zbs = &zio_bench_stats[zio_bench_nstats++];
+		zbs->zbs_type = ZIO_BENCH_CRYPT;
+		zbs->zbs_name = ci->ci_name;
+		ZIO_BENCH_LOOP(zbs->zbs_fwd,
+		    (zio_do_crypt_data(B_TRUE, key, DMU_OT_PLAIN_FILE_CONTENTS,
+		    B_FALSE, salt, iv, mac, ZIO_BENCH_SIZE, plain, cipher,
+		    &no_crypt) == 0));
+		ZIO_BENCH_LOOP(zbs->zbs_rev,
+		    (zio_do_crypt_data(B_FALSE, key, DMU_OT_PLAIN_FILE_CONTENTS,
+		    B_FALSE, salt, iv, mac, ZIO_BENCH_SIZE, plain, cipher,
+		    &no_crypt) == 0));
+
+		zio_crypt_key_destroy(key);
+	}
+
+	kmem_free(key, sizeof (zio_crypt_key_t));
+}
+
+static void
+zio_bench_run(void)
+{
+	uint8_t *src, *dst, *scratch;
+	abd_t *abd;
+
+	ASSERT(MUTEX_HELD(&zio_bench_lock));
+
+	src = vmem_alloc(ZIO_BENCH_SIZE, KM_SLEEP);
+	dst = vmem_alloc(ZIO_BENCH_SIZE, KM_SLEEP);
+	scratch = vmem_alloc(ZIO_BENCH_SIZE, KM_SLEEP);
+
+	for (size_t off = 0; off < ZIO_BENCH_SIZE; off += PAGESIZE) {
+		random_get_pseudo_bytes(src + off, PAGESIZE / 2);
+		bzero(src + off + PAGESIZE / 2, PAGESIZE / 2);
+	}
+	abd = abd_get_from_buf(src, ZIO_BENCH_SIZE);
+
+	zio_bench_nstats = 0;
+	zio_bench_checksum(abd);
+	zio_bench_compress(src, dst, scratch);
+	zio_bench_crypt(src, dst);
+	zio_bench_done = B_TRUE;
+
+	abd_put(abd);
+	vmem_free(scratch, ZIO_BENCH_SIZE);
+	vmem_free(dst, ZIO_BENCH_SIZE);
+	vmem_free(src, ZIO_BENCH_SIZE);
+}
+
+static int
+zio_bench_kstat_headers(char *buf, size_t size)
+{
+	mutex_enter(&zio_bench_lock);
+	if (!zio_bench_done)
+		zio_bench_run();
+	mutex_exit(&zio_bench_lock);
+
+	(void) snprintf(buf, size, "%-10s%-18s%-12s%-12s\n",
+	    "type", "algorithm", "fwd_MB/s", "rev_MB/s");
+
+	return (0);
+}
+
+static int
+zio_bench_kstat_data(char *buf, size_t size, void *data)
+{
+	zio_bench_stat_t *zbs = data;
+
+	(void) snprintf(buf, size, "%-10s%-18s%-12llu%-12llu\n",
+	    zio_bench_type_names[zbs->zbs_type], zbs->zbs_name,
+	    (u_longlong_t)zbs->zbs_fwd, (u_longlong_t)zbs->zbs_rev);
+
+	return (0);
+}
+
+static void *
+zio_bench_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n < zio_bench_nstats)
+		ksp->ks_private = &zio_bench_stats[n];
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+#endif /* _KERNEL */
+
+void
+zio_bench_init(void)
+{
+	mutex_init(&zio_bench_lock, NULL, MUTEX_DEFAULT, NULL);
+
+#if defined(_KERNEL)
+	if (zfs_algo_bench_at_load) {
+		mutex_enter(&zio_bench_lock);
+		zio_bench_run();
+		mutex_exit(&zio_bench_lock);
+	}
+
+	zio_bench_kstat = kstat_create("zfs", 0, "algo_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (zio_bench_kstat != NULL) {
+		zio_bench_kstat->ks_data = NULL;
+		zio_bench_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(zio_bench_kstat,
+		    zio_bench_kstat_headers,
+		    zio_bench_kstat_data,
+		    zio_bench_kstat_addr);
+		kstat_install(zio_bench_kstat);
+	}
+#endif
+}
+
+void
+zio_bench_fini(void)
+{
+	if (zio_bench_kstat != NULL) {
+		kstat_delete(zio_bench_kstat);
+		zio_bench_kstat = NULL;
+	}
+
+	mutex_destroy(&zio_bench_lock);
+}
+
+#if defined(_KERNEL)
+ZFS_MODULE_PARAM(zfs, zfs_, algo_bench_at_load, INT, ZMOD_RD,
+	"Benchmark checksum, compression and encryption at module load");
+#endif
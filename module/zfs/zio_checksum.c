@@ -127,6 +127,53 @@ abd_fletcher_4_impl(abd_t *abd, uint64_t size, zio_abd_checksum_data_t *acdp)
 	fletcher_4_abd_ops.acf_fini(acdp);
 }
 
+/*
+ * Data is copied in pieces of this size, each of which is checksummed
+ * while it is still in the CPU cache.
+ */
+#define	ZIO_CHECKSUM_COPY_CHUNK	(16 * 1024)
+
+static int
+abd_fletcher_4_copy_iter(void *dbuf, void *sbuf, size_t size, void *private)
+{
+	while (size > 0) {
+		size_t len = MIN(size, ZIO_CHECKSUM_COPY_CHUNK);
+
+		(void) memcpy(dbuf, sbuf, len);
+		(void) fletcher_4_abd_ops.acf_iter(dbuf, len, private);
+
+		dbuf = (char *)dbuf + len;
+		sbuf = (char *)sbuf + len;
+		size -= len;
+	}
+
+	return (0);
+}
+
+/*
+ * Copy the first size bytes of sabd into dabd and compute the fletcher-4
+ * checksum of the data in the same pass, rather than reading it from
+ * memory a second time.  The selected fletcher_4 implementation is used.
+ */
+void
+abd_copy_fletcher_4(abd_t *dabd, abd_t *sabd, uint64_t size,
+    boolean_t byteswap, zio_cksum_t *zcp)
+{
+	fletcher_4_ctx_t ctx;
+
+	zio_abd_checksum_data_t acd = {
+		.acd_byteorder	= byteswap ?
+		    ZIO_CHECKSUM_BYTESWAP : ZIO_CHECKSUM_NATIVE,
+		.acd_zcp	= zcp,
+		.acd_ctx	= &ctx
+	};
+
+	fletcher_4_abd_ops.acf_init(&acd);
+	(void) abd_iterate_func2(dabd, sabd, 0, 0, size,
+	    abd_fletcher_4_copy_iter, &acd);
+	fletcher_4_abd_ops.acf_fini(&acd);
+}
+
 /*ARGSUSED*/
 void
 abd_fletcher_4_native(abd_t *abd, uint64_t size,
@@ -196,6 +243,10 @@ zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
 	    abd_checksum_edonr_tmpl_init, abd_checksum_edonr_tmpl_free,
 	    ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_SALTED |
 	    ZCHECKSUM_FLAG_NOPWRITE, "edonr"},
+	{{abd_checksum_blake3_native,	abd_checksum_blake3_byteswap},
+	    abd_checksum_blake3_tmpl_init, abd_checksum_blake3_tmpl_free,
+	    ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_DEDUP |
+	    ZCHECKSUM_FLAG_SALTED | ZCHECKSUM_FLAG_NOPWRITE, "blake3"},
 #endif
 };
 
@@ -215,6 +266,8 @@ zio_checksum_to_feature(enum zio_checksum cksum)
 		return (SPA_FEATURE_SKEIN);
 	case ZIO_CHECKSUM_EDONR:
 		return (SPA_FEATURE_EDONR);
+	case ZIO_CHECKSUM_BLAKE3:
+		return (SPA_FEATURE_BLAKE3);
 	default:
 		return (SPA_FEATURE_NONE);
 	}
@@ -43,6 +43,22 @@
  */
 unsigned long zio_decompress_fail_fraction = 0;
 
+/*
+ * Controls the early abort heuristic for expensive compression algorithms
+ * (gzip and the slower zstd levels).  Before such a block is compressed it
+ * is first run through lz4, which gives up quickly on incompressible data;
+ * if lz4 cannot reach the required 12.5% saving the block is stored
+ * uncompressed without running the expensive pass.
+ *
+ *   0 - disabled
+ *   1 - adaptive: only probe on datasets where a noticeable fraction of
+ *       recent writes turned out to be incompressible
+ *   2 - always probe
+ */
+int zfs_compress_early_abort = 1;
+
+static taskq_t *zio_chunked_taskq;
+
 /*
  * Compression vectors.
  */
@@ -62,7 +78,49 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{"gzip-8",		8,	gzip_compress,	gzip_decompress},
 	{"gzip-9",		9,	gzip_compress,	gzip_decompress},
 	{"zle",			64,	zle_compress,	zle_decompress},
-	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs}
+	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs},
+	{"zstd-1",		1,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-2",		2,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-3",		3,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-4",		4,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-5",		5,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-6",		6,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-7",		7,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-8",		8,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-9",		9,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-10",		10,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-11",		11,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-12",		12,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-13",		13,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-14",		14,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-15",		15,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-16",		16,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-17",		17,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-18",		18,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-19",		19,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-1",	-1,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-2",	-2,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-3",	-3,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-4",	-4,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-5",	-5,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-6",	-6,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-7",	-7,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-8",	-8,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-9",	-9,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-10",	-10,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-20",	-20,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-30",	-30,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-40",	-40,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-50",	-50,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-60",	-60,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-70",	-70,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-80",	-80,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-90",	-90,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-100",	-100,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-500",	-500,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-1000",	-1000,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"lz4-chunked",	ZIO_COMPRESS_LZ4,
+	    zio_chunked_compress, zio_chunked_decompress}
 };
 
 enum zio_compress
@@ -89,6 +147,254 @@ zio_compress_select(spa_t *spa, enum zio_compress child,
 	return (result);
 }
 
+/*
+ * Returns the feature which must be enabled on the pool before blocks
+ * compressed with "comp" may be written, or SPA_FEATURE_NONE.
+ */
+spa_feature_t
+zio_compress_to_feature(enum zio_compress comp)
+{
+	if (ZIO_COMPRESS_IS_ZSTD(comp))
+		return (SPA_FEATURE_ZSTD_COMPRESS);
+	if (ZIO_COMPRESS_IS_CHUNKED(comp))
+		return (SPA_FEATURE_CHUNKED_COMPRESS);
+
+	return (SPA_FEATURE_NONE);
+}
+
+/*
+ * Returns true if "c" is slow enough that probing the data with lz4 first
+ * is cheaper than finding out the hard way that it does not compress.
+ */
+boolean_t
+zio_compress_early_abort_eligible(enum zio_compress c)
+{
+	if (zfs_compress_early_abort == 0)
+		return (B_FALSE);
+
+	return ((c >= ZIO_COMPRESS_GZIP_1 && c <= ZIO_COMPRESS_GZIP_9) ||
+	    (c >= ZIO_COMPRESS_ZSTD_3 && c <= ZIO_COMPRESS_ZSTD_19));
+}
+
+/*
+ * Quickly decide whether a block is worth compressing with "c".  lz4 is
+ * tried first; zstd levels at or above 3 additionally get a second
+ * chance with zstd-1 since it finds noticeably more redundancy than lz4.
+ * Returns B_FALSE only when the block should be written uncompressed.
+ */
+boolean_t
+zio_compress_probe(enum zio_compress c, abd_t *src, size_t s_len)
+{
+	size_t d_len = s_len - (s_len >> 3);
+	size_t c_len;
+	void *tmp, *dst;
+
+	ASSERT(zio_compress_early_abort_eligible(c));
+
+	tmp = abd_borrow_buf_copy(src, s_len);
+	dst = zio_buf_alloc(s_len);
+
+	c_len = lz4_compress_zfs(tmp, dst, s_len, d_len, 0);
+	if (c_len > d_len && ZIO_COMPRESS_IS_ZSTD(c)) {
+		c_len = zio_compress_table[ZIO_COMPRESS_ZSTD_1].ci_compress(
+		    tmp, dst, s_len, d_len,
+		    zio_compress_table[ZIO_COMPRESS_ZSTD_1].ci_level);
+	}
+
+	zio_buf_free(dst, s_len);
+	abd_return_buf(src, tmp, s_len);
+
+	return (c_len <= d_len);
+}
+
+/*
+ * Chunked compression
+ *
+ * A chunked block starts with a header of big-endian 32-bit words: the
+ * chunk size, the number of chunks, and the compressed size of each chunk.
+ * The chunks follow back to back, each one compressed on its own with the
+ * inner algorithm, or stored as is when that does not make it smaller (in
+ * which case its compressed size equals its logical size).  Since no chunk
+ * depends on another, all but the first are handed to the z_decompress
+ * taskq while the caller decompresses the first.
+ *
+ * Blocks are always written with ZIO_CHUNKED_SHIFT sized chunks.  The size
+ * must not be tunable: the ARC and L2ARC recompress blocks and expect to get
+ * the same bytes back as were written.
+ */
+#define	ZIO_CHUNKED_SHIFT	20
+typedef struct zio_chunked_ctx {
+	kmutex_t		zcc_lock;
+	kcondvar_t		zcc_cv;
+	uint64_t		zcc_pending;	/* chunks not yet done */
+	int			zcc_error;
+	enum zio_compress	zcc_inner;
+} zio_chunked_ctx_t;
+
+typedef struct zio_chunked_job {
+	taskq_ent_t		zcj_ent;
+	zio_chunked_ctx_t	*zcj_ctx;
+	void			*zcj_src;
+	void			*zcj_dst;
+	size_t			zcj_s_len;
+	size_t			zcj_d_len;
+} zio_chunked_job_t;
+
+/*
+ * Blocks which fit in a single chunk gain nothing from chunking, so they
+ * are written with the inner algorithm instead.
+ */
+enum zio_compress
+zio_compress_chunked_select(enum zio_compress c, uint64_t lsize)
+{
+	if (ZIO_COMPRESS_IS_CHUNKED(c) && lsize <= (1ULL << ZIO_CHUNKED_SHIFT))
+		return (zio_compress_table[c].ci_level);
+
+	return (c);
+}
+
+size_t
+zio_chunked_compress(void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int inner)
+{
+	zio_compress_info_t *ci = &zio_compress_table[inner];
+	uint32_t *hdr = d_start;
+	uint64_t chunk = 1ULL << ZIO_CHUNKED_SHIFT;
+	uint64_t nchunks = howmany(s_len, chunk);
+	size_t off = (2 + nchunks) * sizeof (uint32_t);
+
+	ASSERT(ci->ci_compress != NULL);
+
+	if (off >= d_len)
+		return (s_len);
+
+	hdr[0] = BE_32(chunk);
+	hdr[1] = BE_32(nchunks);
+	for (uint64_t i = 0; i < nchunks; i++) {
+		char *src = (char *)s_start + i * chunk;
+		char *dst = (char *)d_start + off;
+		size_t len = MIN(chunk, s_len - i * chunk);
+		size_t c_len;
+
+		c_len = ci->ci_compress(src, dst, len, MIN(d_len - off, len),
+		    ci->ci_level);
+		if (c_len >= len) {
+			if (len > d_len - off)
+				return (s_len);
+			bcopy(src, dst, len);
+			c_len = len;
+		}
+		hdr[2 + i] = BE_32(c_len);
+		off += c_len;
+	}
+
+	return (off);
+}
+
+static void
+zio_chunked_decompress_one(void *arg)
+{
+	zio_chunked_job_t *job = arg;
+	zio_chunked_ctx_t *ctx = job->zcj_ctx;
+	int error = 0;
+
+	if (job->zcj_s_len == job->zcj_d_len) {
+		bcopy(job->zcj_src, job->zcj_dst, job->zcj_d_len);
+	} else {
+		error = zio_decompress_data_buf(ctx->zcc_inner, job->zcj_src,
+		    job->zcj_dst, job->zcj_s_len, job->zcj_d_len);
+	}
+
+	mutex_enter(&ctx->zcc_lock);
+	if (error != 0 && ctx->zcc_error == 0)
+		ctx->zcc_error = error;
+	if (--ctx->zcc_pending == 0)
+		cv_broadcast(&ctx->zcc_cv);
+	mutex_exit(&ctx->zcc_lock);
+}
+
+int
+zio_chunked_decompress(void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int inner)
+{
+	uint32_t *hdr = s_start;
+	zio_chunked_job_t *jobs;
+	zio_chunked_ctx_t ctx;
+	uint64_t chunk, nchunks;
+	size_t off;
+
+	if (s_len < 2 * sizeof (uint32_t))
+		return (SET_ERROR(EINVAL));
+
+	chunk = BE_32(hdr[0]);
+	nchunks = BE_32(hdr[1]);
+	off = (2 + nchunks) * sizeof (uint32_t);
+	if (!ISP2(chunk) || chunk < SPA_OLD_MAXBLOCKSIZE ||
+	    chunk > SPA_MAXBLOCKSIZE || nchunks != howmany(d_len, chunk) ||
+	    off > s_len)
+		return (SET_ERROR(EINVAL));
+
+	jobs = kmem_alloc(nchunks * sizeof (zio_chunked_job_t), KM_SLEEP);
+	for (uint64_t i = 0; i < nchunks; i++) {
+		zio_chunked_job_t *job = &jobs[i];
+
+		job->zcj_ctx = &ctx;
+		job->zcj_src = (char *)s_start + off;
+		job->zcj_dst = (char *)d_start + i * chunk;
+		job->zcj_s_len = BE_32(hdr[2 + i]);
+		job->zcj_d_len = MIN(chunk, d_len - i * chunk);
+		if (job->zcj_s_len > job->zcj_d_len ||
+		    job->zcj_s_len > s_len - off) {
+			kmem_free(jobs, nchunks * sizeof (zio_chunked_job_t));
+			return (SET_ERROR(EINVAL));
+		}
+		off += job->zcj_s_len;
+	}
+
+	mutex_init(&ctx.zcc_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&ctx.zcc_cv, NULL, CV_DEFAULT, NULL);
+	ctx.zcc_pending = nchunks;
+	ctx.zcc_error = 0;
+	ctx.zcc_inner = inner;
+
+	for (uint64_t i = 1; i < nchunks; i++) {
+		if (zio_chunked_taskq != NULL) {
+			taskq_init_ent(&jobs[i].zcj_ent);
+			taskq_dispatch_ent(zio_chunked_taskq,
+			    zio_chunked_decompress_one, &jobs[i], 0,
+			    &jobs[i].zcj_ent);
+		} else {
+			zio_chunked_decompress_one(&jobs[i]);
+		}
+	}
+	zio_chunked_decompress_one(&jobs[0]);
+
+	mutex_enter(&ctx.zcc_lock);
+	while (ctx.zcc_pending != 0)
+		cv_wait(&ctx.zcc_cv, &ctx.zcc_lock);
+	mutex_exit(&ctx.zcc_lock);
+
+	mutex_destroy(&ctx.zcc_lock);
+	cv_destroy(&ctx.zcc_cv);
+	kmem_free(jobs, nchunks * sizeof (zio_chunked_job_t));
+
+	return (ctx.zcc_error);
+}
+
+void
+zio_chunked_init(void)
+{
+	zio_chunked_taskq = taskq_create("z_decompress", boot_ncpus,
+	    defclsyspri, boot_ncpus, INT_MAX, TASKQ_DYNAMIC);
+}
+
+void
+zio_chunked_fini(void)
+{
+	taskq_destroy(zio_chunked_taskq);
+	zio_chunked_taskq = NULL;
+}
+
 /*ARGSUSED*/
 static int
 zio_compress_zeroed_cb(void *data, size_t len, void *private)
@@ -166,3 +472,8 @@ zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
 
 	return (ret);
 }
+
+#if defined(_KERNEL)
+ZFS_MODULE_PARAM(zfs, zfs_, compress_early_abort, INT, ZMOD_RW,
+	"Probe with lz4 before expensive compression (0=off 1=auto 2=always)");
+#endif
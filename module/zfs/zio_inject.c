@@ -530,12 +530,72 @@ spa_handle_ignored_writes(spa_t *spa)
 	rw_exit(&inject_lock);
 }
 
+/*
+ * Return median * e^(sigma * z) for a standard normal z, without floating
+ * point.  z is approximated, in thousandths, by the sum of 12 uniform
+ * variates less 6, and e^x is computed as 2^(x / ln 2) in 1024ths, with a
+ * quadratic for the fractional power of 2.
+ */
+static hrtime_t
+zio_inject_lognormal(hrtime_t median, uint64_t sigma)
+{
+	int64_t z = -6000;
+	int64_t x, ipart, frac, mult;
+
+	for (int i = 0; i < 12; i++)
+		z += spa_get_random(1000);
+
+	/* sigma * z / 10^6 / ln 2, in 1024ths; 1 / ln 2 = 1.4427 */
+	x = (int64_t)MIN(sigma, 10000) * z * 1024 * 14427 / 10000000000LL;
+	ipart = (x >= 0) ? x / 1024 : -((-x + 1023) / 1024);
+	frac = x - ipart * 1024;
+	mult = 1024 + frac * (672 + 352 * frac / 1024) / 1024;
+
+	median = median * mult / 1024;
+	if (ipart >= 0)
+		return (median << MIN(ipart, 16));
+	else
+		return (median >> MIN(-ipart, 62));
+}
+
+/*
+ * How long a lane of this delay handler takes to service the I/O.
+ */
+static hrtime_t
+zio_inject_delay_time(zinject_record_t *record, zio_t *zio)
+{
+	hrtime_t delay = record->zi_timer;
+
+	switch (record->zi_delay_dist) {
+	case ZINJECT_DELAY_LOGNORMAL:
+		delay = zio_inject_lognormal(delay, record->zi_sigma);
+		break;
+	case ZINJECT_DELAY_BIMODAL:
+		if (freq_triggered(record->zi_delay_freq))
+			delay = record->zi_timer2;
+		break;
+	case ZINJECT_DELAY_SPIKE:
+		if (freq_triggered(record->zi_delay_freq))
+			delay += record->zi_timer2;
+		break;
+	default:
+		break;
+	}
+
+	/* Emulate a device which transfers zi_bandwidth bytes a second */
+	if (record->zi_bandwidth != 0)
+		delay += zio->io_size * NANOSEC / record->zi_bandwidth;
+
+	return (delay);
+}
+
 hrtime_t
 zio_handle_io_delay(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
 	inject_handler_t *min_handler = NULL;
 	hrtime_t min_target = 0;
+	int min_lane = 0;
 
 	rw_enter(&inject_lock, RW_READER);
 
@@ -599,6 +659,10 @@ zio_handle_io_delay(zio_t *zio)
 		if (vd->vdev_guid != handler->zi_record.zi_guid)
 			continue;
 
+		if (handler->zi_record.zi_iotype != ZIO_TYPES &&
+		    handler->zi_record.zi_iotype != zio->io_type)
+			continue;
+
 		/*
 		 * Defensive; should never happen as the array allocation
 		 * occurs prior to inserting this handler on the list.
@@ -626,7 +690,9 @@ zio_handle_io_delay(zio_t *zio)
 		 * handler; as it will always be the lane with the
 		 * lowest value for that particular handler (i.e. the
 		 * lane that will become idle the soonest). This saves a
-		 * scan of each handler's lanes array.
+		 * scan of each handler's lanes array.  That is not so if
+		 * the delay varies from one IO to the next, so then we
+		 * do have to scan for the lane.
 		 *
 		 * There's two cases to consider when determining when
 		 * this specific IO request should complete. If this
@@ -640,14 +706,26 @@ zio_handle_io_delay(zio_t *zio)
 		 * each lane will become idle, we use that value to
 		 * determine when this request should complete.
 		 */
-		hrtime_t idle = handler->zi_record.zi_timer + gethrtime();
-		hrtime_t busy = handler->zi_record.zi_timer +
-		    handler->zi_lanes[handler->zi_next_lane];
+		int lane = handler->zi_next_lane;
+		if (handler->zi_record.zi_delay_dist != ZINJECT_DELAY_FIXED ||
+		    handler->zi_record.zi_bandwidth != 0) {
+			for (int l = 0; l < handler->zi_record.zi_nlanes; l++) {
+				if (handler->zi_lanes[l] <
+				    handler->zi_lanes[lane])
+					lane = l;
+			}
+		}
+
+		hrtime_t delay = zio_inject_delay_time(&handler->zi_record,
+		    zio);
+		hrtime_t idle = delay + gethrtime();
+		hrtime_t busy = delay + handler->zi_lanes[lane];
 		hrtime_t target = MAX(idle, busy);
 
 		if (min_handler == NULL) {
 			min_handler = handler;
 			min_target = target;
+			min_lane = lane;
 			continue;
 		}
 
@@ -666,6 +744,7 @@ zio_handle_io_delay(zio_t *zio)
 		if (target < min_target) {
 			min_handler = handler;
 			min_target = target;
+			min_lane = lane;
 		}
 	}
 
@@ -676,14 +755,14 @@ zio_handle_io_delay(zio_t *zio)
 	 */
 	if (min_handler != NULL) {
 		ASSERT3U(min_target, !=, 0);
-		min_handler->zi_lanes[min_handler->zi_next_lane] = min_target;
+		min_handler->zi_lanes[min_lane] = min_target;
 
 		/*
 		 * If we've used all possible lanes for this handler,
 		 * loop back and start using the first lane again;
 		 * otherwise, just increment the lane index.
 		 */
-		min_handler->zi_next_lane = (min_handler->zi_next_lane + 1) %
+		min_handler->zi_next_lane = (min_lane + 1) %
 		    min_handler->zi_record.zi_nlanes;
 	}
 
@@ -773,10 +852,12 @@ zio_inject_fault(char *name, int flags, int *id, zinject_record_t *record)
 
 	if (record->zi_cmd == ZINJECT_DELAY_IO) {
 		/*
-		 * A value of zero for the number of lanes or for the
-		 * delay time doesn't make sense.
+		 * A value of zero for the number of lanes, or for both the
+		 * delay time and the bandwidth, doesn't make sense.
 		 */
-		if (record->zi_timer == 0 || record->zi_nlanes == 0)
+		if ((record->zi_timer == 0 && record->zi_bandwidth == 0) ||
+		    record->zi_nlanes == 0 ||
+		    record->zi_delay_dist >= ZINJECT_DELAY_DISTS)
 			return (SET_ERROR(EINVAL));
 
 		/*
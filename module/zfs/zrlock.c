@@ -75,6 +75,10 @@ zrl_destroy(zrlock_t *zrl)
 void
 zrl_add_impl(zrlock_t *zrl, const char *zc)
 {
+	static spl_lockstat_class_t zrl_lockstat =
+	    SPL_LOCKSTAT_CLASS_INIT("zrlock", __func__);
+	hrtime_t start = 0;
+
 	for (;;) {
 		uint32_t n = (uint32_t)zrl->zr_refcount;
 		while (n != ZRL_LOCKED) {
@@ -92,11 +96,14 @@ zrl_add_impl(zrlock_t *zrl, const char *zc)
 				zrl->zr_owner = curthread;
 				zrl->zr_caller = zc;
 #endif
+				spl_lockstat_acquired(&zrl_lockstat, start);
 				return;
 			}
 			n = cas;
 		}
 
+		if (start == 0)
+			start = spl_lockstat_start();
 		mutex_enter(&zrl->zr_mtx);
 		while (zrl->zr_refcount == ZRL_LOCKED) {
 			cv_wait(&zrl->zr_cv, &zrl->zr_mtx);
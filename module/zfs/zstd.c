@@ -0,0 +1,382 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Zstandard compression for ZFS.
+ *
+ * The compressor itself is not part of this tree.  As with gzip, userland
+ * links against the system libzstd, the Linux kernel module uses the zstd
+ * implementation shipped with the kernel (CONFIG_ZSTD_COMPRESS and
+ * CONFIG_ZSTD_DECOMPRESS), and FreeBSD uses the copy in sys/contrib/zstd.
+ *
+ * Every compressed block starts with a small zfs_zstdhdr_t recording the
+ * exact length of the zstd frame.  This is required because the physical
+ * size of a block is rounded up to the sector size, while zstd refuses to
+ * decode trailing garbage after a frame.
+ *
+ * zstd needs a sizable workspace for every (de)compression context, and
+ * the size depends on the level and on the size of the input.  Rather
+ * than allocating and freeing one on every zio_compress_data() call, the
+ * workspaces are kept in a small pool of per-CPU-ish slots.  A caller
+ * starts looking at the slot matching its CPU and takes the first one it
+ * can lock without blocking.  Idle workspaces are released after
+ * zfs_zstd_pool_timeout seconds by zstd_cache_reap_now(), which is driven by
+ * the ARC reclaim logic.  When every slot is busy the workspace is
+ * allocated directly and freed again after use.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
+
+#if defined(_KERNEL) && defined(__linux__)
+#include <linux/zstd.h>
+#elif defined(_KERNEL) && defined(__FreeBSD__)
+#define	ZSTD_STATIC_LINKING_ONLY
+#include <contrib/zstd/lib/zstd.h>
+#else
+#define	ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+#endif
+
+/*
+ * On-disk header preceding the zstd frame.  Both fields are big endian.
+ * zh_version records the version of the library that produced the block
+ * and is informational only.
+ */
+typedef struct zfs_zstdhdr {
+	uint32_t	zh_c_len;
+	uint32_t	zh_version;
+	char		zh_data[];
+} zfs_zstdhdr_t;
+
+typedef struct zstd_pool {
+	kmutex_t	zp_lock;
+	void		*zp_mem;
+	size_t		zp_size;
+	hrtime_t	zp_timeout;
+} zstd_pool_t;
+
+/*
+ * Seconds an unused workspace is kept around before it is reaped.
+ */
+int zfs_zstd_pool_timeout = 15;
+
+static zstd_pool_t *zstd_cctx_pool;
+static zstd_pool_t *zstd_dctx_pool;
+static int zstd_pool_count;
+
+/*
+ * Thin wrappers hiding the differences between the static allocation
+ * interfaces of the kernel and library versions of zstd.  The original
+ * Linux kernel port predates negative ("fast") levels, so those fall back
+ * to level 1 there.
+ */
+#if defined(_KERNEL) && defined(__linux__)
+static ZSTD_parameters
+zstd_params(int level, size_t s_len)
+{
+	return (ZSTD_getParams(MAX(level, 1), s_len, 0));
+}
+
+static size_t
+zstd_cctx_size(int level, size_t s_len)
+{
+	return (ZSTD_CCtxWorkspaceBound(zstd_params(level, s_len).cParams));
+}
+
+static size_t
+zstd_dctx_size(void)
+{
+	return (ZSTD_DCtxWorkspaceBound());
+}
+
+static size_t
+zstd_compress_ws(void *mem, size_t size, void *dst, size_t d_len,
+    const void *src, size_t s_len, int level)
+{
+	ZSTD_CCtx *cctx = ZSTD_initCCtx(mem, size);
+
+	if (cctx == NULL)
+		return (s_len);
+	return (ZSTD_compressCCtx(cctx, dst, d_len, src, s_len,
+	    zstd_params(level, s_len)));
+}
+
+static size_t
+zstd_decompress_ws(void *mem, size_t size, void *dst, size_t d_len,
+    const void *src, size_t s_len)
+{
+	ZSTD_DCtx *dctx = ZSTD_initDCtx(mem, size);
+
+	if (dctx == NULL)
+		return ((size_t)-1);
+	return (ZSTD_decompressDCtx(dctx, dst, d_len, src, s_len));
+}
+
+#define	zstd_version()	ZSTD_VERSION_NUMBER
+#else
+static size_t
+zstd_cctx_size(int level, size_t s_len)
+{
+	return (ZSTD_estimateCCtxSize_usingCParams(
+	    ZSTD_getCParams(level, s_len, 0)));
+}
+
+static size_t
+zstd_dctx_size(void)
+{
+	return (ZSTD_estimateDCtxSize());
+}
+
+static size_t
+zstd_compress_ws(void *mem, size_t size, void *dst, size_t d_len,
+    const void *src, size_t s_len, int level)
+{
+	ZSTD_CCtx *cctx = ZSTD_initStaticCCtx(mem, size);
+
+	if (cctx == NULL)
+		return (s_len);
+	return (ZSTD_compressCCtx(cctx, dst, d_len, src, s_len, level));
+}
+
+static size_t
+zstd_decompress_ws(void *mem, size_t size, void *dst, size_t d_len,
+    const void *src, size_t s_len)
+{
+	ZSTD_DCtx *dctx = ZSTD_initStaticDCtx(mem, size);
+
+	if (dctx == NULL)
+		return ((size_t)-1);
+	return (ZSTD_decompressDCtx(dctx, dst, d_len, src, s_len));
+}
+
+#define	zstd_version()	ZSTD_versionNumber()
+#endif
+
+/*
+ * Find a workspace of at least "size" bytes.  Returns the locked pool
+ * slot owning it, or NULL along with a privately allocated workspace in
+ * *memp when no slot could be locked.
+ */
+static zstd_pool_t *
+zstd_mempool_get(zstd_pool_t *pool, size_t size, void **memp, int kmflag)
+{
+	zstd_pool_t *zp = NULL;
+	int start = CPU_SEQID % zstd_pool_count;
+
+	for (int i = 0; i < zstd_pool_count; i++) {
+		zstd_pool_t *try = &pool[(start + i) % zstd_pool_count];
+
+		if (!mutex_tryenter(&try->zp_lock))
+			continue;
+		if (try->zp_mem != NULL && try->zp_size >= size) {
+			if (zp != NULL)
+				mutex_exit(&zp->zp_lock);
+			zp = try;
+			break;
+		}
+		/* Remember the first slot we own in case nothing fits. */
+		if (zp == NULL)
+			zp = try;
+		else
+			mutex_exit(&try->zp_lock);
+	}
+
+	if (zp == NULL) {
+		*memp = vmem_alloc(size, kmflag);
+		return (NULL);
+	}
+
+	if (zp->zp_mem == NULL || zp->zp_size < size) {
+		if (zp->zp_mem != NULL)
+			vmem_free(zp->zp_mem, zp->zp_size);
+		zp->zp_size = 0;
+		zp->zp_mem = vmem_alloc(size, kmflag);
+		if (zp->zp_mem == NULL) {
+			mutex_exit(&zp->zp_lock);
+			*memp = NULL;
+			return (NULL);
+		}
+		zp->zp_size = size;
+	}
+
+	*memp = zp->zp_mem;
+	return (zp);
+}
+
+static void
+zstd_mempool_put(zstd_pool_t *zp, void *mem, size_t size)
+{
+	if (zp == NULL) {
+		if (mem != NULL)
+			vmem_free(mem, size);
+		return;
+	}
+
+	zp->zp_timeout = gethrestime_sec() + zfs_zstd_pool_timeout;
+	mutex_exit(&zp->zp_lock);
+}
+
+static void
+zstd_mempool_reap(zstd_pool_t *pool, boolean_t all)
+{
+	hrtime_t now = gethrestime_sec();
+
+	for (int i = 0; i < zstd_pool_count; i++) {
+		zstd_pool_t *zp = &pool[i];
+
+		if (!mutex_tryenter(&zp->zp_lock))
+			continue;
+		if (zp->zp_mem != NULL && (all || zp->zp_timeout < now)) {
+			vmem_free(zp->zp_mem, zp->zp_size);
+			zp->zp_mem = NULL;
+			zp->zp_size = 0;
+		}
+		mutex_exit(&zp->zp_lock);
+	}
+}
+
+/*ARGSUSED*/
+size_t
+zstd_compress_zfs(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	zfs_zstdhdr_t *hdr = d_start;
+	zstd_pool_t *zp;
+	size_t c_len, size;
+	void *mem;
+
+	ASSERT(d_len <= s_len);
+
+	if (d_len <= sizeof (*hdr))
+		return (s_len);
+
+	/*
+	 * Compression is opportunistic; if no workspace can be had without
+	 * sleeping, store the block uncompressed instead.
+	 */
+	size = zstd_cctx_size(level, s_len);
+	zp = zstd_mempool_get(zstd_cctx_pool, size, &mem, KM_NOSLEEP);
+	if (mem == NULL)
+		return (s_len);
+
+	c_len = zstd_compress_ws(mem, size, hdr->zh_data,
+	    d_len - sizeof (*hdr), s_start, s_len, level);
+
+	zstd_mempool_put(zp, mem, size);
+
+	if (ZSTD_isError(c_len) || c_len > d_len - sizeof (*hdr))
+		return (s_len);
+
+	hdr->zh_c_len = BE_32(c_len);
+	hdr->zh_version = BE_32(zstd_version());
+
+	return (c_len + sizeof (*hdr));
+}
+
+/*ARGSUSED*/
+int
+zstd_decompress_zfs(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	const zfs_zstdhdr_t *hdr = s_start;
+	zstd_pool_t *zp;
+	size_t c_len, size, ret;
+	void *mem;
+
+	if (s_len < sizeof (*hdr))
+		return (-1);
+
+	c_len = BE_32(hdr->zh_c_len);
+	if (c_len > s_len - sizeof (*hdr))
+		return (-1);
+
+	size = zstd_dctx_size();
+	zp = zstd_mempool_get(zstd_dctx_pool, size, &mem, KM_SLEEP);
+	if (mem == NULL)
+		return (-1);
+
+	ret = zstd_decompress_ws(mem, size, d_start, d_len, hdr->zh_data,
+	    c_len);
+
+	zstd_mempool_put(zp, mem, size);
+
+	if (ZSTD_isError(ret))
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Release workspaces which have not been used recently.  Called when the
+ * ARC is asked to give memory back.
+ */
+void
+zstd_cache_reap_now(void)
+{
+	if (zstd_pool_count == 0)
+		return;
+
+	zstd_mempool_reap(zstd_cctx_pool, B_FALSE);
+	zstd_mempool_reap(zstd_dctx_pool, B_FALSE);
+}
+
+void
+zstd_init(void)
+{
+	zstd_pool_count = MAX(boot_ncpus, 1) * 4;
+	zstd_cctx_pool = kmem_zalloc(zstd_pool_count * sizeof (zstd_pool_t),
+	    KM_SLEEP);
+	zstd_dctx_pool = kmem_zalloc(zstd_pool_count * sizeof (zstd_pool_t),
+	    KM_SLEEP);
+
+	for (int i = 0; i < zstd_pool_count; i++) {
+		mutex_init(&zstd_cctx_pool[i].zp_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+		mutex_init(&zstd_dctx_pool[i].zp_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+	}
+}
+
+void
+zstd_fini(void)
+{
+	zstd_mempool_reap(zstd_cctx_pool, B_TRUE);
+	zstd_mempool_reap(zstd_dctx_pool, B_TRUE);
+
+	for (int i = 0; i < zstd_pool_count; i++) {
+		ASSERT3P(zstd_cctx_pool[i].zp_mem, ==, NULL);
+		ASSERT3P(zstd_dctx_pool[i].zp_mem, ==, NULL);
+		mutex_destroy(&zstd_cctx_pool[i].zp_lock);
+		mutex_destroy(&zstd_dctx_pool[i].zp_lock);
+	}
+
+	kmem_free(zstd_cctx_pool, zstd_pool_count * sizeof (zstd_pool_t));
+	kmem_free(zstd_dctx_pool, zstd_pool_count * sizeof (zstd_pool_t));
+	zstd_cctx_pool = NULL;
+	zstd_dctx_pool = NULL;
+	zstd_pool_count = 0;
+}
+
+#if defined(_KERNEL)
+ZFS_MODULE_PARAM(zfs, zfs_, zstd_pool_timeout, INT, ZMOD_RW,
+	"Seconds before an idle zstd workspace is freed");
+#endif
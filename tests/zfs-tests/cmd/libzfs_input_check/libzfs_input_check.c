@@ -285,6 +285,26 @@ test_pool_reopen(const char *pool)
 	nvlist_free(required);
 }
 
+static void
+test_pool_vdev_stats(const char *pool)
+{
+	IOC_INPUT_TEST(ZFS_IOC_POOL_VDEV_STATS, pool, NULL, NULL, 0);
+}
+
+static void
+test_pool_error_log(const char *pool)
+{
+	nvlist_t *optional = fnvlist_alloc();
+	uint64_t cookie[3] = { 0, 0, 0 };
+
+	fnvlist_add_uint64_array(optional, "cookie", cookie, 3);
+	fnvlist_add_uint64(optional, "count", 16);
+
+	IOC_INPUT_TEST(ZFS_IOC_POOL_ERROR_LOG, pool, NULL, optional, 0);
+
+	nvlist_free(optional);
+}
+
 static void
 test_pool_checkpoint(const char *pool)
 {
@@ -723,6 +743,43 @@ test_get_bookmark_props(const char *bookmark)
 	IOC_INPUT_TEST(ZFS_IOC_GET_BOOKMARK_PROPS, bookmark, NULL, NULL, 0);
 }
 
+static void
+test_list_snapshots(const char *dataset)
+{
+	nvlist_t *optional = fnvlist_alloc();
+	nvlist_t *props = fnvlist_alloc();
+
+	fnvlist_add_boolean(props, "used");
+	fnvlist_add_boolean(props, "referenced");
+
+	fnvlist_add_uint64(optional, "cookie", 0);
+	fnvlist_add_uint64(optional, "count", 16);
+	fnvlist_add_uint64(optional, SNAP_ITER_MIN_TXG, 0);
+	fnvlist_add_uint64(optional, SNAP_ITER_MAX_TXG, UINT64_MAX);
+	fnvlist_add_nvlist(optional, "props", props);
+
+	IOC_INPUT_TEST(ZFS_IOC_LIST_SNAPSHOTS, dataset, NULL, optional, 0);
+
+	nvlist_free(props);
+	nvlist_free(optional);
+}
+
+static void
+test_diff_blocks(const char *snapshot1, const char *snapshot2)
+{
+	nvlist_t *optional = fnvlist_alloc();
+	uint64_t cookie[2] = { 0, 0 };
+
+	fnvlist_add_string(optional, "from", snapshot1);
+	fnvlist_add_uint64(optional, "object", 0);
+	fnvlist_add_uint64_array(optional, "cookie", cookie, 2);
+	fnvlist_add_uint64(optional, "count", 16);
+
+	IOC_INPUT_TEST(ZFS_IOC_DIFF_BLOCKS, snapshot2, NULL, optional, 0);
+
+	nvlist_free(optional);
+}
+
 static void
 zfs_ioc_input_tests(const char *pool)
 {
@@ -767,6 +824,8 @@ zfs_ioc_input_tests(const char *pool)
 	 */
 	test_pool_sync(pool);
 	test_pool_reopen(pool);
+	test_pool_vdev_stats(pool);
+	test_pool_error_log(pool);
 	test_pool_checkpoint(pool);
 	test_pool_discard_checkpoint(pool);
 	test_log_history(pool);
@@ -776,7 +835,9 @@ zfs_ioc_input_tests(const char *pool)
 	test_snapshot(pool, snapshot);
 
 	test_space_snaps(snapshot);
+	test_list_snapshots(dataset);
 	test_send_space(snapbase, snapshot);
+	test_diff_blocks(snapbase, snapshot);
 	test_send_new(snapshot, tmpfd);
 	test_recv_new(backup, tmpfd);
 
@@ -954,6 +1015,10 @@ validate_ioc_values(void)
 	    ZFS_IOC_BASE + 80 == ZFS_IOC_POOL_TRIM &&
 	    ZFS_IOC_BASE + 81 == ZFS_IOC_REDACT &&
 	    ZFS_IOC_BASE + 82 == ZFS_IOC_GET_BOOKMARK_PROPS &&
+	    ZFS_IOC_BASE + 83 == ZFS_IOC_LIST_SNAPSHOTS &&
+	    ZFS_IOC_BASE + 84 == ZFS_IOC_POOL_VDEV_STATS &&
+	    ZFS_IOC_BASE + 85 == ZFS_IOC_DIFF_BLOCKS &&
+	    ZFS_IOC_BASE + 86 == ZFS_IOC_POOL_ERROR_LOG &&
 	    LINUX_IOC_BASE + 1 == ZFS_IOC_EVENTS_NEXT &&
 	    LINUX_IOC_BASE + 2 == ZFS_IOC_EVENTS_CLEAR &&
 	    LINUX_IOC_BASE + 3 == ZFS_IOC_EVENTS_SEEK);